@@ -0,0 +1,51 @@
+# Find the LMDB includes and library
+#
+# This module defines
+#  LMDB_INCLUDE_DIRS     - Where to find lmdb.h
+#  LMDB_LIBRARIES        - The libraries needed to use LMDB
+#  LMDB_LIBRARY_DIRS     - Directories containing the libraries (-L option)
+#  LMDB_FOUND            - If false, do not try to use LMDB
+#
+# To specify an additional directory to search, set LMDB_ROOT.
+#
+
+IF(LMDB_INCLUDE_DIRS AND LMDB_LIBRARIES)
+
+  SET(LMDB_FOUND TRUE)
+
+ELSE(LMDB_INCLUDE_DIRS AND LMDB_LIBRARIES)
+
+  IF(LMDB_ROOT)
+    FIND_PATH(LMDB_INCLUDE_DIRS
+              NAMES lmdb.h
+              PATHS ${LMDB_ROOT} ${LMDB_ROOT}/include
+              NO_DEFAULT_PATH)
+    SET(LMDB_LIBRARY_DIRS ${LMDB_ROOT})
+    IF(EXISTS "${LMDB_LIBRARY_DIRS}/lib")
+      SET(LMDB_LIBRARY_DIRS ${LMDB_LIBRARY_DIRS} ${LMDB_LIBRARY_DIRS}/lib)
+    ENDIF()
+    FIND_LIBRARY(LMDB_LIBRARIES
+                 NAMES lmdb
+                 PATHS ${LMDB_LIBRARY_DIRS}
+                 NO_DEFAULT_PATH)
+  ENDIF()
+  IF(NOT LMDB_INCLUDE_DIRS)  # now look in system locations
+    FIND_PATH(LMDB_INCLUDE_DIRS NAMES lmdb.h)
+  ENDIF(NOT LMDB_INCLUDE_DIRS)
+  IF(NOT LMDB_LIBRARIES)
+    FIND_LIBRARY(LMDB_LIBRARIES NAMES lmdb)
+  ENDIF(NOT LMDB_LIBRARIES)
+
+  IF(LMDB_INCLUDE_DIRS AND LMDB_LIBRARIES)
+    SET(LMDB_FOUND TRUE)
+    IF(NOT LMDB_FIND_QUIETLY)
+      MESSAGE(STATUS "Found LMDB: headers at ${LMDB_INCLUDE_DIRS}, libraries at ${LMDB_LIBRARIES}")
+    ENDIF(NOT LMDB_FIND_QUIETLY)
+  ELSE(LMDB_INCLUDE_DIRS AND LMDB_LIBRARIES)
+    SET(LMDB_FOUND FALSE)
+    MESSAGE(STATUS "LMDB not found, the lmdb persistence plugin will not be built")
+  ENDIF(LMDB_INCLUDE_DIRS AND LMDB_LIBRARIES)
+
+  MARK_AS_ADVANCED(LMDB_INCLUDE_DIRS LMDB_LIBRARIES)
+
+ENDIF(LMDB_INCLUDE_DIRS AND LMDB_LIBRARIES)
@@ -7,8 +7,10 @@
 
 #include <transfer/EventTransferManager.hpp>
 #include <transfer/LRUPolicy.hpp>
+#include <transfer/GDSFPolicy.hpp>
 #include <transfer/DiskCacheLayer.hpp>
 #include <transfer/MemoryCacheLayer.hpp>
+#include <transfer/SharedMemoryCacheLayer.hpp>
 #include <transfer/NetworkCacheLayer.hpp>
 #include <transfer/HTTPDownloadHandler.hpp>
 #include <transfer/HTTPUploadHandler.hpp>
@@ -66,8 +68,15 @@ CachePolicy *createLRUPolicy(const OptionMap &options) {
     return new LRUPolicy(parseSize(options["size"].getValue()));
 }
 
+CachePolicy *createGDSFPolicy(const OptionMap &options) {
+    const OptionMapPtr &admission = options.get("admission");
+    bool admissionControl = !(admission && admission->getValue() == "false");
+    return new GDSFPolicy(parseSize(options["size"].getValue()), 0.5, admissionControl);
+}
+
 void initializePolicy(OptionFactory<CachePolicy> &factories) {
     factories.insert("LRU",&createLRUPolicy);
+    factories.insert("GDSF",&createGDSFPolicy);
 }
 OptionFactory<CachePolicy> CreatePolicy(&initializePolicy);
 
@@ -81,13 +90,29 @@ CacheLayer *createDiskCache(const OptionMap &options) {
     CachePolicy *policy = CreatePolicy(options["policy"]);
     if (!policy)
         return NULL;
-    return new DiskCacheLayer(policy, options["directory"].getValue(), NULL);
+    unsigned int numThreads = DiskCacheLayer::DEFAULT_NUM_WORKER_THREADS;
+    const OptionMapPtr &threads = options.get("threads");
+    if (threads) {
+        numThreads = (unsigned int)atoi(threads->getValue().c_str());
+    }
+    const OptionMapPtr &compress = options.get("compress");
+    bool compressFiles = (compress && compress->getValue() == "true");
+    return new DiskCacheLayer(policy, options["directory"].getValue(), NULL, numThreads, compressFiles);
+}
+CacheLayer *createSharedCache(const OptionMap &options) {
+    unsigned int numSlots = SharedMemoryCacheLayer::DEFAULT_NUM_SLOTS;
+    const OptionMapPtr &slots = options.get("slots");
+    if (slots) {
+        numSlots = (unsigned int)atoi(slots->getValue().c_str());
+    }
+    return new SharedMemoryCacheLayer(options["name"].getValue(), parseSize(options["size"].getValue()), NULL, numSlots);
 }
 CacheLayer *createNetworkCache(const OptionMap &options); // Defined below.
 
 
 void initializeLayer(OptionFactory<CacheLayer> &factories) {
     factories.insert("Memory",&createMemoryCache);
+    factories.insert("Shared",&createSharedCache);
     factories.insert("Disk",&createDiskCache);
     factories.insert("Network",&createNetworkCache);
 }
@@ -151,7 +176,22 @@ CacheLayer *createNetworkCache(const OptionMap &options) {
                     services,
                     &downloadProtocolRegistry));
     insertServices(options["services"], services);
-    return new NetworkCacheLayer(NULL, downServ);
+    cache_usize_type splitSize = 0;
+    unsigned int numParallel = 1;
+    const OptionMapPtr &split = options.get("split");
+    if (split) {
+        splitSize = parseSize(split->getValue());
+    }
+    const OptionMapPtr &parallel = options.get("parallel");
+    if (parallel) {
+        numParallel = (unsigned int)atoi(parallel->getValue().c_str());
+    }
+    unsigned int maxPrefetching = 2;
+    const OptionMapPtr &prefetch = options.get("prefetch");
+    if (prefetch) {
+        maxPrefetching = (unsigned int)atoi(prefetch->getValue().c_str());
+    }
+    return new NetworkCacheLayer(NULL, downServ, splitSize, numParallel, maxPrefetching);
 }
 void destroyTransferManager(TransferManager*tm) {
     delete tm;
@@ -192,14 +232,49 @@ TransferManager *initializeTransferManager (const OptionMap& options, GenEventMa
             insertServices(options["upload"], upServiceMap);
             insertServices(options["nameupload"], upnameServiceMap);
 
-        return new Transfer::EventTransferManager(
+        std::string nameCacheFile;
+        double ttlSeconds = 3600, staleSeconds = 86400, negativeSeconds = 30;
+        const OptionMapPtr &nameCache = options.get("namecache");
+        if (nameCache) {
+            const OptionMapPtr &file = nameCache->get("file");
+            if (file) {
+                nameCacheFile = file->getValue();
+            }
+            const OptionMapPtr &ttl = nameCache->get("ttl");
+            if (ttl) {
+                ttlSeconds = atof(ttl->getValue().c_str());
+            }
+            const OptionMapPtr &stale = nameCache->get("stale");
+            if (stale) {
+                staleSeconds = atof(stale->getValue().c_str());
+            }
+            const OptionMapPtr &negative = nameCache->get("negative");
+            if (negative) {
+                negativeSeconds = atof(negative->getValue().c_str());
+            }
+        }
+        Transfer::EventTransferManager *transferManager = new Transfer::EventTransferManager(
                 firstCacheLayer,
-                new Transfer::CachedNameLookupManager(nameServ, downServ),
+                new Transfer::CachedNameLookupManager(nameServ, downServ, nameCacheFile,
+                        Duration::seconds(ttlSeconds), Duration::seconds(staleSeconds),
+                        Duration::seconds(negativeSeconds)),
                 eventMgr,
 				downServ,
                 upnameServ,
                 uploadServ
             );
+        const OptionMapPtr &concurrency = options.get("concurrency");
+        if (concurrency) {
+            static const char *classNames[Transfer::NUM_TRANSFER_PRIORITIES] = {"prefetch", "foreground", "critical"};
+            for (int p = 0; p < Transfer::NUM_TRANSFER_PRIORITIES; ++p) {
+                const OptionMapPtr &limit = concurrency->get(classNames[p]);
+                if (limit) {
+                    transferManager->setConcurrencyLimit((Transfer::TransferPriority)p,
+                            (unsigned int)atoi(limit->getValue().c_str()));
+                }
+            }
+        }
+        return transferManager;
 }
 
 }
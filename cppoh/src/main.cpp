@@ -35,6 +35,7 @@
 #include <options/Options.hpp>
 #include <util/PluginManager.hpp>
 #include <oh/SimulationFactory.hpp>
+#include <oh/SimulationScheduler.hpp>
 
 #include <task/EventManager.hpp>
 #include <task/WorkQueue.hpp>
@@ -46,12 +47,16 @@
 #include <oh/SpaceConnection.hpp>
 #include <oh/HostedObject.hpp>
 #include <oh/SpaceIDMap.hpp>
+#include <oh/SceneFile.hpp>
 #include <network/IOServiceFactory.hpp>
+#include <transfer/HTTPRequest.hpp>
 #include <util/KnownServices.hpp>
 #include <persistence/ObjectStorage.hpp>
 #include <persistence/ReadWriteHandlerFactory.hpp>
 #include <ObjectHostBinary_Persistence.pbj.hpp>
 #include <ObjectHostBinary_Sirikata.pbj.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
 #include <time.h>
 namespace Sirikata {
 
@@ -61,13 +66,49 @@ using Transfer::TransferManager;
 OptionValue *cdnConfigFile;
 OptionValue *floatExcept;
 OptionValue *dbFile;
+OptionValue *dbCache;
+OptionValue *restoreBatch;
+OptionValue *sceneFile;
 OptionValue *host;
+OptionValue *eventBudget;
+OptionValue *scriptBudget;
+OptionValue *httpOnIOService;
+OptionValue *batchMessages;
+OptionValue *locationThreshold;
+OptionValue *compactLocations;
+OptionValue *resumeSessions;
+OptionValue *registrationBatch;
+OptionValue *objectThreads;
+OptionValue *proxyRadius;
+OptionValue *proxyAngle;
+OptionValue *sharedStreams;
+OptionValue *parallelSims;
+OptionValue *idleWait;
+OptionValue *headless;
 InitializeGlobalOptions main_options("",
 //    simulationPlugins=new OptionValue("simulationPlugins","ogregraphics",OptionValueType<String>(),"List of plugins that handle simulation."),
     cdnConfigFile=new OptionValue("cdnConfig","cdn = ($import=cdn.txt)",OptionValueType<String>(),"CDN configuration."),
     floatExcept=new OptionValue("sigfpe","false",OptionValueType<bool>(),"Enable floating point exceptions"),
     dbFile=new OptionValue("db","scene.db",OptionValueType<String>(),"Persistence database"),
+    restoreBatch=new OptionValue("restorebatch","256",OptionValueType<uint32>(),"Objects restored per database scan at startup, 0 reads each object on its own"),
+    sceneFile=new OptionValue("scene","",OptionValueType<String>(),"Binary scene from csv_converter.py to create the objects from, instead of the database's ObjectList"),
+    dbCache=new OptionValue("dbcache","0",OptionValueType<uint32>(),"Bytes of write-back cache in front of the persistence database, 0 to disable"),
     host=new OptionValue("host","localhost",OptionValueType<String>(),"space address"),
+    eventBudget=new OptionValue("eventbudget","5",OptionValueType<int>(),"Milliseconds per frame spent dispatching queued events; the rest carry over to the next frame"),
+    scriptBudget=new OptionValue("scriptbudget","4",OptionValueType<int>(),"Milliseconds per frame spent ticking scripts; scripts left over are ticked first next frame"),
+    httpOnIOService=new OptionValue("httpioservice","false",OptionValueType<bool>(),"Run HTTP transfers from the main IOService each frame instead of a separate curl thread"),
+    batchMessages=new OptionValue("batchmessages","false",OptionValueType<bool>(),"Ask the space to coalesce messages to each object into batched stream frames"),
+    locationThreshold=new OptionValue("locationthreshold","0",OptionValueType<double>(),"Distance an observer's extrapolated position may drift before location replies carry a new one, 0 to always send"),
+    compactLocations=new OptionValue("compactloc","false",OptionValueType<bool>(),"Ask each space for quantized location updates between objects"),
+    resumeSessions=new OptionValue("resumesessions","false",OptionValueType<bool>(),"Reconnect to a space whose connection drops and resume every object on it without registering them again"),
+    objectThreads=new OptionValue("objectthreads","0",OptionValueType<uint32>(),"Worker threads running each object's local messages in its own lane, 0 to handle them on the main thread"),
+    proxyRadius=new OptionValue("proxyradius","0",OptionValueType<double>(),"Distance from a local camera within which remote objects get graphics and physics, 0 to show everything"),
+    proxyAngle=new OptionValue("proxyangle",".02",OptionValueType<float>(),"Radians an object must span from a local camera to be shown beyond proxyradius"),
+    sharedStreams=new OptionValue("sharedstreams","0",OptionValueType<uint32>(),"Substreams to each space that all objects' messages share, 0 to give every object its own"),
+    registrationBatch=new OptionValue("registrationbatch","0",OptionValueType<uint32>(),"Objects on shared substreams registered with their space per message, 0 to register each one alone"),
+    parallelSims=new OptionValue("parallelsims","false",OptionValueType<bool>(),"Step simulations that support it, such as physics, on threads of their own while graphics renders"),
+    idleWait=new OptionValue("idlewait","0",OptionValueType<int>(),"Milliseconds the main loop may sleep on the network when no simulation tick is due, 0 to poll without sleeping"),
+    headless=new OptionValue("headless","false",OptionValueType<bool>(),"Host objects without creating a graphics window; physics still runs if its plugin loads"),
     NULL
 );
 
@@ -76,6 +117,73 @@ class UUIDLister : public MessageService {
     SpaceID mSpace;
     MessagePort mPort;
     volatile bool mSuccess;
+    /// Objects waiting on each outstanding scan, by message id
+    std::map<int64,std::vector<UUID> > mBatches;
+    boost::mutex mBatchMutex;
+
+    void restoreScanned(int64 id, const Persistence::Protocol::Response&resp) {
+        boost::mutex::scoped_lock lock(mBatchMutex);
+        std::map<int64,std::vector<UUID> >::iterator batch = mBatches.find(id);
+        if (batch == mBatches.end()) {
+            return;
+        }
+        const std::vector<UUID> &objects = batch->second;
+        if (resp.has_return_status()) {
+            SILOG(cppoh,warning,"Failed to scan "<<objects.size()<<" objects, restoring them one at a time");
+            for (size_t i = 0; i < objects.size(); i++) {
+                HostedObjectPtr obj = HostedObject::construct<HostedObject>(mObjectHost, objects[i]);
+                obj->initializeRestoreFromDatabase(mSpace, HostedObjectPtr());
+            }
+        } else {
+            std::vector<std::map<String,String> > fields(objects.size());
+            for (int i = 0; i < resp.reads_size(); i++) {
+                if (resp.reads(i).has_index() && resp.reads(i).index() >= 0 && resp.reads(i).index() < (int)objects.size()) {
+                    fields[resp.reads(i).index()][resp.reads(i).field_name()] = resp.reads(i).data();
+                }
+            }
+            for (size_t i = 0; i < objects.size(); i++) {
+                SILOG(cppoh,info,"Loading object "<<ObjectReference(objects[i]));
+                HostedObjectPtr obj = HostedObject::construct<HostedObject>(mObjectHost, objects[i]);
+                obj->initializeRestoreFromFields(mSpace, fields[i], HostedObjectPtr());
+            }
+        }
+        mBatches.erase(batch);
+        if (mBatches.empty()) {
+            mSuccess = true;
+        }
+    }
+    /// Sends one scan per batchSize objects, all at once, so a parallel database can work on several
+    void scanObjects(const Protocol::UUIDListProperty &uuidList, uint32 batchSize) {
+        boost::mutex::scoped_lock lock(mBatchMutex);
+        std::vector<std::pair<int64,std::string> > requests;
+        for (int first = 0; first < uuidList.value_size(); first += batchSize) {
+            int64 id = (int64)mBatches.size()+1;
+            std::vector<UUID> &objects = mBatches[id];
+            Persistence::Protocol::ReadWriteSet rws;
+            for (int i = first; i < uuidList.value_size() && i < first+(int)batchSize; i++) {
+                Persistence::Protocol::IStorageElement el = rws.add_scans();
+                el.set_object_uuid(uuidList.value(i));
+                el.set_index((int32)objects.size());
+                objects.push_back(uuidList.value(i));
+            }
+            requests.push_back(std::pair<int64,std::string>(id,std::string()));
+            rws.SerializeToString(&requests.back().second);
+        }
+        if (mBatches.empty()) {
+            mSuccess = true;
+            return;
+        }
+        lock.unlock();
+        for (size_t i = 0; i < requests.size(); i++) {
+            RoutableMessageHeader hdr;
+            hdr.set_source_object(ObjectReference::spaceServiceID());
+            hdr.set_source_port(mPort);
+            hdr.set_destination_port(Services::PERSISTENCE);
+            hdr.set_destination_object(ObjectReference::spaceServiceID());
+            hdr.set_id(requests[i].first);
+            mObjectHost->processMessage(hdr, MemoryReference(requests[i].second));
+        }
+    }
 
 public:
     UUIDLister(ObjectHost*oh, const SpaceID &space)
@@ -94,6 +202,10 @@ public:
     void processMessage(const RoutableMessageHeader &hdr, MemoryReference body) {
         Persistence::Protocol::Response resp;
         resp.ParseFromArray(body.data(), body.length());
+        if (hdr.has_reply_id()) {
+            restoreScanned(hdr.reply_id(), resp);
+            return;
+        }
         if (hdr.has_return_status() || resp.has_return_status()) {
             SILOG(cppoh,info,"Failed to connect to database: "<<hdr.has_return_status()<<", "<<resp.has_return_status());
             mSuccess = true;
@@ -106,6 +218,10 @@ public:
             return;
         }
         uuidList.ParseFromString(resp.reads(0).data());
+        if (restoreBatch->as<uint32>()) {
+            scanObjects(uuidList, restoreBatch->as<uint32>());
+            return;
+        }
         for (int i = 0; i < uuidList.value_size(); i++) {
             SILOG(cppoh,info,"Loading object "<<ObjectReference(uuidList.value(i)));
             HostedObjectPtr obj = HostedObject::construct<HostedObject>(mObjectHost, uuidList.value(i));
@@ -182,20 +298,55 @@ int main ( int argc,const char**argv ) {
     initializeProtocols();
 
     Network::IOService *ioServ = Network::IOServiceFactory::makeIOService();
-    Task::WorkQueue *workQueue = new Task::LockFreeWorkQueue;
+    if (httpOnIOService->as<bool>()) {
+        Transfer::HTTPRequest::setIOService(ioServ);
+    }
+    // Shared by object messages and the event manager, so messages are queued ahead of bulk work.
+    Task::WorkQueue *workQueue = new Task::PriorityWorkQueue;
     Task::GenEventManager *eventManager = new Task::GenEventManager(workQueue);
 
     SpaceID mainSpace(UUID("12345678-1111-1111-1111-DEFA01759ACE",UUID::HumanReadable()));
     SpaceIDMap *spaceMap = new SpaceIDMap;
     spaceMap->insert(mainSpace, Network::Address(host->as<String>(),"5943"));
 
-    Persistence::ReadWriteHandler *database=Persistence::ReadWriteHandlerFactory::getSingleton()
-        .getConstructor("sqlite")(String("--databasefile ")+dbFile->as<String>());
+    Persistence::ReadWriteHandler *database;
+    if (dbCache->as<uint32>()) {
+        database=Persistence::ReadWriteHandlerFactory::getSingleton()
+            .getConstructor("sqlitecache")(String("--backendoptions=\"--databasefile ")+dbFile->as<String>()+"\" --cachesize "+boost::lexical_cast<String>(dbCache->as<uint32>()));
+    } else {
+        database=Persistence::ReadWriteHandlerFactory::getSingleton()
+            .getConstructor("sqlite")(String("--databasefile ")+dbFile->as<String>());
+    }
 
     ObjectHost *oh = new ObjectHost(spaceMap, workQueue, ioServ);
+    oh->setBatchSpaceMessages(batchMessages->as<bool>());
+    oh->setSharedSpaceStreams(sharedStreams->as<uint32>());
+    oh->setRegistrationBatchSize(registrationBatch->as<uint32>());
+    oh->setLocationErrorThreshold(locationThreshold->as<double>());
+    oh->setCompactLocations(compactLocations->as<bool>());
+    oh->setResumeSpaceSessions(resumeSessions->as<bool>());
+    oh->setProxyInterest(proxyRadius->as<double>(), proxyAngle->as<float>());
+    Task::WorkQueue *objectLaneQueue = NULL;
+    Task::WorkQueueThread *objectLaneThreads = NULL;
+    if (objectThreads->as<uint32>()) {
+        objectLaneQueue = new Task::WorkStealingWorkQueue(objectThreads->as<uint32>());
+        objectLaneThreads = objectLaneQueue->createWorkerThreads(objectThreads->as<uint32>());
+        oh->setObjectLaneQueue(objectLaneQueue);
+    }
     oh->registerService(Services::PERSISTENCE, database);
 
-    {
+    if (!sceneFile->as<String>().empty()) {
+        SceneFile scene(sceneFile->as<String>());
+        if (!scene.valid()) {
+            SILOG(cppoh,error,"Unable to read scene "<<sceneFile->as<String>());
+        }
+        for (uint32 i = 0; i < scene.numObjects(); i++) {
+            std::map<String,String> fields;
+            scene.fields(i, fields);
+            HostedObjectPtr obj = HostedObject::construct<HostedObject>(oh, scene.objectID(i));
+            obj->initializeRestoreFromFields(mainSpace, fields, HostedObjectPtr());
+        }
+    } else {
         UUIDLister lister(oh, mainSpace);
         lister.goWait(ioServ, workQueue);
     }
@@ -241,14 +392,19 @@ int main ( int argc,const char**argv ) {
     struct SimulationRequest {
         const char* name;
         bool required;
+        MessagePort service; ///< port the simulation answers RPCs on, or 0 if it only sends
     };
     const uint32 nSimRequests = 2;
     SimulationRequest simRequests[nSimRequests] = {
-        {"ogregraphics", true},
-        {"bulletphysics", false}
+        {"ogregraphics", !headless->as<bool>(), 0},
+        {"bulletphysics", false, Services::PHYSICS}
     };
     for(uint32 ir = 0; ir < nSimRequests && continue_simulation; ir++) {
         String simName = simRequests[ir].name;
+        if (headless->as<bool>() && simName == "ogregraphics") {
+            SILOG(cppoh,info,"Running headless, skipping " << simName);
+            continue;
+        }
         SILOG(cppoh,info,String("Initializing ") + simName);
         TimeSteppedSimulation *sim =
             SimulationFactory::getSingleton()
@@ -268,19 +424,51 @@ int main ( int argc,const char**argv ) {
         else {
             SILOG(cppoh,info,String("Successfully initialized ") + simName);
             sims.push_back(sim);
-			sim->forwardMessagesTo(oh);
+            if (simRequests[ir].service) {
+                oh->registerService(simRequests[ir].service, sim);
+            } else {
+                sim->forwardMessagesTo(oh);
+            }
         }
     }
+    SimulationScheduler *scheduler = new SimulationScheduler(parallelSims->as<bool>());
+    for(SimList::iterator it = sims.begin(); it != sims.end(); it++) {
+        scheduler->add(*it);
+    }
+    Duration eventBudgetPerFrame = Duration::milliseconds((int64)eventBudget->as<int>());
+    Duration idleWaitPerFrame = Duration::milliseconds((int64)idleWait->as<int>());
+    Duration scriptBudgetPerFrame = Duration::milliseconds((int64)scriptBudget->as<int>());
+    unsigned int lastEventBacklog = 0;
     while ( continue_simulation ) {
-        for(SimList::iterator it = sims.begin(); it != sims.end(); it++) {
-            continue_simulation = continue_simulation && (*it)->tick();
-        }
+        Time::updateFrameTime();
+        continue_simulation = scheduler->tick();
         Network::IOServiceFactory::pollService(ioServ);
+        oh->updateProxyInterest(Time::frameTime());
+        oh->tickScripts(Time::frameTime(), scriptBudgetPerFrame);
+        unsigned int eventBacklog = eventManager->processEventQueue(eventBudgetPerFrame);
+        if (eventBacklog > lastEventBacklog) {
+            SILOG(cppoh,debug,"Event backlog grew to " << eventBacklog << " after a frame's dispatch budget");
+        }
+        lastEventBacklog = eventBacklog;
+        if (eventBacklog == 0 && idleWaitPerFrame > Duration::seconds(0.)) {
+            // Nothing queued: sleep until a simulation is due or the network has something for us.
+            // With no simulations at all (headless, no physics) only the network can wake us.
+            Duration untilDue = sims.empty() ? idleWaitPerFrame : scheduler->nextDeadline() - Time::now();
+            if (untilDue > Duration::seconds(0.)) {
+                Network::IOServiceFactory::runOneServiceFor(ioServ, untilDue < idleWaitPerFrame ? untilDue : idleWaitPerFrame);
+            }
+        }
     }
+    delete scheduler;
 	for(SimList::iterator it = sims.begin(); it != sims.end(); it++) {
 		(*it)->endForwardingMessagesTo(oh);
 	}
+    if (objectLaneQueue) {
+        // Stop the lanes while their objects still have an ObjectHost; anything left is dropped with the queue.
+        objectLaneQueue->destroyWorkerThreads(objectLaneThreads);
+    }
     delete oh;
+    delete objectLaneQueue;
 
     // delete after OH in case objects want to do last-minute state flushes
     delete database;
@@ -296,6 +484,7 @@ int main ( int argc,const char**argv ) {
     plugins.gc();
     SimulationFactory::destroy();
 
+    Transfer::HTTPRequest::setIOService(NULL);
     Network::IOServiceFactory::destroyIOService(ioServ);
     delete spaceMap;
 
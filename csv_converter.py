@@ -39,6 +39,7 @@ import math
 import random
 import time
 import uuid
+import struct
 from urllib import unquote_plus
 
 sys.path.append('liboh/scripts/ironpython')
@@ -51,11 +52,11 @@ from protocol.MessageHeader_pb2 import Header
 PHYSICAL_MODES = {
     'graphiconly': Sirikata.PhysicalParameters.NONPHYSICAL,
     'staticmesh': Sirikata.PhysicalParameters.STATIC,
-#    'dynamicmesh': Sirikata.PhysicalParameters.DYNAMIC,
     'dynamicbox': Sirikata.PhysicalParameters.DYNAMICBOX,
     'dynamicsphere': Sirikata.PhysicalParameters.DYNAMICSPHERE,
     'dynamiccylinder': Sirikata.PhysicalParameters.DYNAMICCYLINDER,
     'character': Sirikata.PhysicalParameters.CHARACTER,
+    'dynamicmesh': Sirikata.PhysicalParameters.DYNAMICMESH,
     '': Sirikata.PhysicalParameters.NONPHYSICAL
 }
 
@@ -258,6 +259,80 @@ class CsvToSql:
             print "** Adding a Camera ",uuid
             self.set(cursor, uuid, 'IsCamera', '')
 
+class CsvToScene(CsvToSql):
+    """ Writes the binary scene that cppoh maps with --scene, laid out as
+    described in liboh/include/oh/SceneFile.hpp """
+    MAGIC = 'SIRISCN1'
+    NO_STRING = 0xffffffff
+
+    def __init__(self, outfile):
+        CsvToSql.__init__(self, None)
+        self.outfile = outfile
+        self.objects = []
+        self.objectinfo = {}
+        self.strings = []
+        self.string_index = {}
+
+    def intern(self, value):
+        if value not in self.string_index:
+            self.string_index[value] = len(self.strings)
+            self.strings.append(value)
+        return self.string_index[value]
+
+    def addTable(self, curs):
+        pass
+
+    def set(self, curs, uuid, key, value, which=0):
+        value = "".join(chr(c) for c in value);
+        if uuid not in self.objectinfo:
+            self.objects.append(uuid)
+            self.objectinfo[uuid] = {'pos': (0., 0., 0.), 'orient': (0., 0., 0., 1.),
+                                     'mesh': self.NO_STRING, 'properties': []}
+        info = self.objectinfo[uuid]
+        if key == 'Loc':
+            location = Sirikata.ObjLoc()
+            location.ParseFromString(value)
+            info['pos'] = tuple(location.position)
+            x, y, z = location.orientation
+            info['orient'] = (x, y, z, math.sqrt(max(0., 1.-x*x-y*y-z*z)))
+            if not (location.velocity or location.rotational_axis or location.angular_speed):
+                return # the fixed fields describe it completely
+        if key == 'MeshURI':
+            meshuri = Sirikata.StringProperty()
+            meshuri.ParseFromString(value)
+            info['mesh'] = self.intern(meshuri.value)
+            return
+        info['properties'].append((self.intern(key), self.intern(value)))
+
+    def go(self, openfile, **csvargs):
+        reader = csv.DictReader(openfile, **csvargs)
+        for row in reader:
+            if row['objtype'] not in ALLOWED_TYPES:
+                break # blank or bad row
+            self.processRow(self.addUUID(row), row, None)
+        numproperties = sum(len(self.objectinfo[u]['properties']) for u in self.objects)
+        objectsoffset = 32
+        propertiesoffset = objectsoffset + 64*len(self.objects)
+        stringsoffset = propertiesoffset + 8*numproperties
+        out = [self.MAGIC, struct.pack('<6I', len(self.objects), numproperties, len(self.strings),
+                                       objectsoffset, propertiesoffset, stringsoffset)]
+        properties = []
+        for u in self.objects:
+            info = self.objectinfo[u]
+            out.append(u.get_bytes())
+            out.append(struct.pack('<3d4f2I', info['pos'][0], info['pos'][1], info['pos'][2],
+                                   info['orient'][0], info['orient'][1], info['orient'][2], info['orient'][3],
+                                   info['mesh'], len(properties)))
+            properties += info['properties']
+        for name, value in properties:
+            out.append(struct.pack('<2I', name, value))
+        offset = 0
+        for value in self.strings:
+            out.append(struct.pack('<2I', offset, len(value)))
+            offset += len(value)
+        out += self.strings
+        self.outfile.write(''.join(out))
+
 if __name__=='__main__':
     if len(sys.argv) > 1:
         csvfile = sys.argv[1]
@@ -272,6 +347,13 @@ if __name__=='__main__':
     except OSError:
         pass
 
+    if sqlfile.endswith('.scene'):
+        converter = CsvToScene(open(sqlfile, 'wb'))
+        converter.go(open(csvfile))
+        converter.outfile.close()
+        print "SUCCESS!"
+        sys.exit(0)
+
     conn = sqlite3.connect(sqlfile)
     converter = CsvToSql(conn)
     converter.go(open(csvfile))
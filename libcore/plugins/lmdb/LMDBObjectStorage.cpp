@@ -0,0 +1,606 @@
+/*  Sirikata -- LMDB plugin -- Persistence Services
+ *  LMDBObjectStorage.cpp
+ *
+ *  Copyright (c) 2008, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Platform.hpp>
+#include "options/Options.hpp"
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include "LMDB_Persistence.pbj.hpp"
+#include "LMDBObjectStorage.hpp"
+#include "util/Metrics.hpp"
+
+namespace Sirikata { namespace Persistence {
+
+namespace {
+Metrics::Histogram sRequestTime("lmdb.request_us","microseconds from a request reaching LMDBObjectStorage to its response");
+
+template <typename StorageSet,typename ReadSet> void mergeKeysFromStorageSet(StorageSet &ss, const ReadSet&other) {
+    int len = other.reads_size();
+    int sslen = ss.reads_size();
+    int i;
+    for (i=0;i<sslen;++i) {
+        mergeStorageKey(ss.mutable_reads(i),other.reads(i));
+    }
+    for (;i<len;++i) {
+        ss.add_reads();
+        mergeStorageKey(ss.mutable_reads(i),other.reads(i));
+    }
+}
+
+MDB_val toValue(const String&data) {
+    MDB_val retval;
+    retval.mv_size=data.size();
+    retval.mv_data=(void*)data.data();
+    return retval;
+}
+
+// Stored values are the version of the key followed by the data
+const size_t VERSION_SIZE=sizeof(uint64);
+
+uint64 storedVersion(const MDB_val&value) {
+    uint64 version=0;
+    if (value.mv_size>=VERSION_SIZE)
+        memcpy(&version,value.mv_data,VERSION_SIZE);
+    return version;
+}
+
+const char*storedData(const MDB_val&value) {
+    return (const char*)value.mv_data+VERSION_SIZE;
+}
+
+size_t storedSize(const MDB_val&value) {
+    return value.mv_size>=VERSION_SIZE?value.mv_size-VERSION_SIZE:0;
+}
+
+bool startsWith(const MDB_val&key, const String&prefix, size_t offset) {
+    return key.mv_size>=offset+prefix.size()
+        && memcmp((const char*)key.mv_data+offset,prefix.data(),prefix.size())==0;
+}
+}
+
+LMDBObjectStorage*LMDBObjectStorage::create(bool t, const String&s){
+    return new LMDBObjectStorage(t,s);
+}
+
+LMDBObjectStorage::LMDBObjectStorage(bool transactional, const String& pl)
+ : mTransactional(transactional),
+   mDBName(),
+   mEnv(NULL),
+   mDBI(0),
+   mGroupScheduled(false)
+{
+    OptionValue*databaseFile;
+    OptionValue*workQueueInstance;
+    OptionValue*groupCommit;
+    OptionValue*mapSize;
+    OptionValue*sync;
+    unsigned char * epoch=NULL;
+    static AtomicValue<int> counter(0);
+    int handle_offset=counter++;
+    InitializeClassOptions("lmdb",epoch+handle_offset,
+                           databaseFile=new OptionValue("databasefile","",OptionValueType<String>(),"Sets the database file to be used for storage"),
+                           workQueueInstance=new OptionValue("workqueue","0",OptionValueType<void*>(),"Sets the work queue to be used for disk writes to a common work queue"),
+                           groupCommit=new OptionValue("groupcommit","1",OptionValueType<uint32>(),"Most queued requests applied together in one write transaction, 1 applies each request on its own"),
+                           mapSize=new OptionValue("mapsize","1073741824",OptionValueType<int64>(),"Largest size in bytes the database may grow to"),
+                           sync=new OptionValue("sync","true",OptionValueType<bool>(),"Flush every commit to disk; without it a crash may lose the latest commits but never corrupts the database"),NULL);
+    (mOptions=OptionSet::getOptions("lmdb",epoch+handle_offset))->parse(pl);
+
+    mDiskWorkQueue=(Task::WorkQueue*)workQueueInstance->as<void*>();
+    mWorkQueueThread=NULL;
+    mGroupCommit=groupCommit->as<uint32>();
+    if (mGroupCommit<1)
+        mGroupCommit=1;
+    if(mDiskWorkQueue==NULL) {
+        mDiskWorkQueue=&_mLocalWorkQueue;
+        mWorkQueueThread=mDiskWorkQueue->createWorkerThreads(1);
+    }
+
+    mDBName = databaseFile->as<String>();
+    assert( !mDBName.empty() );
+
+    // Every write transaction runs on the disk thread, so the environment
+    // never sees two writers and needs no thread local reader slots
+    unsigned int flags = MDB_NOSUBDIR|MDB_NOTLS;
+    if (!sync->as<bool>())
+        flags |= MDB_NOSYNC;
+    MDB_txn*txn=NULL;
+    int rc = mdb_env_create(&mEnv);
+    if (rc == MDB_SUCCESS)
+        rc = mdb_env_set_mapsize(mEnv, (size_t)mapSize->as<int64>());
+    if (rc == MDB_SUCCESS)
+        rc = mdb_env_open(mEnv, mDBName.c_str(), flags, 0664);
+    if (rc == MDB_SUCCESS)
+        rc = mdb_txn_begin(mEnv, NULL, 0, &txn);
+    if (rc == MDB_SUCCESS) {
+        rc = mdb_dbi_open(txn, NULL, 0, &mDBI);
+        if (rc == MDB_SUCCESS)
+            rc = mdb_txn_commit(txn);
+        else
+            mdb_txn_abort(txn);
+    }
+    if (rc != MDB_SUCCESS)
+        SILOG(persistence,fatal,"Error opening LMDB database "<<mDBName<<": "<<mdb_strerror(rc));
+}
+
+LMDBObjectStorage::~LMDBObjectStorage() {
+    if(mWorkQueueThread) {
+        _mLocalWorkQueue.destroyWorkerThreads(mWorkQueueThread);
+    }
+    if (mEnv)
+        mdb_env_close(mEnv);
+}
+
+void LMDBObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*mt, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    assert(mTransactional == true);
+
+    enqueueApply(new ApplyTransactionMessage(this,mt,rmh,destroyMinitransaction));
+}
+
+void LMDBObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*rws, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    assert(mTransactional == false);
+
+    enqueueApply(new ApplyReadWriteMessage(this,rws,rmh,destroyReadWriteSet));
+}
+
+void LMDBObjectStorage::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    assert(mTransactional == false);
+
+    enqueueApply(new ApplyReadWriteWorker(this,rws,cb,destroyReadWriteSet));
+}
+
+void LMDBObjectStorage::applyInternal(Protocol::Minitransaction* mt, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    assert(mTransactional == true);
+
+    enqueueApply(new ApplyTransactionWorker(this,mt,cb,destroyMinitransaction));
+}
+
+void LMDBObjectStorage::enqueueApply(ApplyWorker*worker) {
+    worker->mEnqueued=Task::AbsTime::now();
+    boost::mutex::scoped_lock lock(mGroupMutex);
+    mGroupPending.push_back(worker);
+    if (!mGroupScheduled) {
+        mGroupScheduled=true;
+        mDiskWorkQueue->enqueue(new GroupCommitWorker(this));
+    }
+}
+
+void LMDBObjectStorage::GroupCommitWorker::operator() () {
+    std::vector<ApplyWorker*> batch;
+    {
+        boost::mutex::scoped_lock lock(mParent->mGroupMutex);
+        while (batch.size()<mParent->mGroupCommit && !mParent->mGroupPending.empty()) {
+            batch.push_back(mParent->mGroupPending.front());
+            mParent->mGroupPending.pop_front();
+        }
+    }
+
+    // Requests are applied in arrival order, each in its own nested
+    // transaction, so requests touching the same keys see each other just as
+    // they would one after another and a failed compare undoes only its own.
+    // Nothing is delivered until the shared commit is durable.
+    MDB_txn*txn=NULL;
+    int rc=mdb_txn_begin(mParent->mEnv,NULL,0,&txn);
+    if (rc==MDB_SUCCESS) {
+        for (size_t i=0;i<batch.size();++i) {
+            batch[i]->mResponse->set_return_status(Protocol::Response::SUCCESS);
+            MDB_txn*nested=NULL;
+            int nested_rc=mdb_txn_begin(mParent->mEnv,txn,0,&nested);
+            if (nested_rc==MDB_SUCCESS) {
+                if (batch[i]->apply(nested))
+                    nested_rc=mdb_txn_commit(nested);
+                else
+                    mdb_txn_abort(nested);
+            }
+            if (nested_rc!=MDB_SUCCESS) {
+                batch[i]->mResponse->clear_reads();
+                batch[i]->mResponse->set_return_status(convertError(StorageFailed));
+            }
+        }
+        rc=mdb_txn_commit(txn);
+    }
+    if (rc!=MDB_SUCCESS) {
+        SILOG(persistence,error,"Error committing to LMDB database "<<mParent->mDBName<<": "<<mdb_strerror(rc));
+        for (size_t i=0;i<batch.size();++i) {
+            batch[i]->mResponse->clear_reads();
+            batch[i]->mResponse->set_return_status(convertError(StorageFailed));
+        }
+    }
+    for (size_t i=0;i<batch.size();++i)
+        batch[i]->complete();
+
+    {
+        boost::mutex::scoped_lock lock(mParent->mGroupMutex);
+        if (mParent->mGroupPending.empty())
+            mParent->mGroupScheduled=false;
+        else
+            mParent->mDiskWorkQueue->enqueue(new GroupCommitWorker(mParent));
+    }
+    delete this;
+}
+
+void LMDBObjectStorage::ApplyWorker::complete() {
+    if (mEnqueued!=Task::AbsTime::null())
+        sRequestTime.recordDuration(Task::AbsTime::now()-mEnqueued);
+    finish();
+}
+
+LMDBObjectStorage::ApplyReadWriteWorker::ApplyReadWriteWorker(LMDBObjectStorage*parent, Protocol::ReadWriteSet* rws, const ResultCallback&cb, void (*destroyRWS)(Protocol::ReadWriteSet*)){
+    mDestroyReadWrite=destroyRWS;
+    mParent=parent;
+    this->rws=rws;
+    this->cb=cb;
+}
+
+bool LMDBObjectStorage::ApplyReadWriteWorker::apply(MDB_txn*txn) {
+    Error error = mParent->applyReadSet(txn, *rws, *mResponse);
+    if (error == None && rws->scans_size())
+        error = mParent->applyScanSet(txn, *rws, *mResponse);
+    if (error == None)
+        error = mParent->applyWriteSet(txn, *rws);
+    if (error != None) {
+        mResponse->set_return_status(convertError(error));
+        return false;
+    }
+    return true;
+}
+
+void LMDBObjectStorage::ApplyReadWriteWorker::finish() {
+    (*mDestroyReadWrite)(rws);
+    cb(mResponse);
+    delete this;
+}
+
+LMDBObjectStorage::ApplyTransactionWorker::ApplyTransactionWorker(LMDBObjectStorage*parent, Protocol::Minitransaction* mt, const ResultCallback&cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    mDestroyMinitransaction=destroyMinitransaction;
+    mParent=parent;
+    this->mt=mt;
+    this->cb=cb;
+}
+
+bool LMDBObjectStorage::ApplyTransactionWorker::apply(MDB_txn*txn) {
+    Error error = mParent->checkCompareSet(txn, *mt);
+    Error read_error = mParent->applyReadSet(txn, *mt, *mResponse);
+    if (error == None)
+        error = read_error;
+    if (error == None)
+        error = mParent->applyWriteSet(txn, *mt);
+    if (error != None) {
+        mResponse->set_return_status(convertError(error));
+        return false;
+    }
+    return true;
+}
+
+void LMDBObjectStorage::ApplyTransactionWorker::finish() {
+    (*mDestroyMinitransaction)(mt);
+    cb(mResponse);
+    delete this;
+}
+
+LMDBObjectStorage::ApplyTransactionMessage::ApplyTransactionMessage(LMDBObjectStorage*parent, Protocol::Minitransaction* mt,const RoutableMessageHeader&hdr, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    mDestroyMinitransaction=destroyMinitransaction;
+    mParent=parent;
+    this->mt=mt;
+    this->hdr=hdr;
+}
+
+void LMDBObjectStorage::ApplyTransactionMessage::finish() {
+    assert(mResponse!=NULL);
+    (*mDestroyMinitransaction)(mt);
+    hdr.swap_source_and_destination();
+    mParent->forward(hdr,*mResponse);
+    delete mResponse;
+    mResponse=NULL;
+    delete this;
+}
+
+LMDBObjectStorage::ApplyReadWriteMessage::ApplyReadWriteMessage(LMDBObjectStorage*parent, Protocol::ReadWriteSet* rws,const RoutableMessageHeader&hdr, void (*destroyRWS)(Protocol::ReadWriteSet*)){
+    mDestroyReadWrite=destroyRWS;
+    mParent=parent;
+    this->rws=rws;
+    this->hdr=hdr;
+}
+
+void LMDBObjectStorage::ApplyReadWriteMessage::finish() {
+    assert(mResponse!=NULL);
+    (*mDestroyReadWrite)(rws);
+    hdr.swap_source_and_destination();
+    mParent->forward(hdr,*mResponse);
+    delete mResponse;
+    mResponse=NULL;
+    delete this;
+}
+
+template <class StorageKey> String LMDBObjectStorage::getKey(const StorageKey& key) {
+    UUID object = key.object_uuid();
+    std::stringstream ss;
+    ss<<key.field_name()<<'_'<<key.field_id();
+    return String((const char*)object.getArray().data(), UUID::static_size)+ss.str();
+}
+
+Protocol::Response::ReturnStatus LMDBObjectStorage::convertError(Error internal) {
+    switch(internal) {
+      case None:
+        return Protocol::Response::SUCCESS;
+      case KeyMissing:
+        return Protocol::Response::KEY_MISSING;
+      case ComparisonFailed:
+        return Protocol::Response::COMPARISON_FAILED;
+      default:
+        return Protocol::Response::INTERNAL_ERROR;
+    }
+}
+
+template <class ReadSet> LMDBObjectStorage::Error LMDBObjectStorage::applyReadSet(MDB_txn* txn, const ReadSet& rs, Protocol::Response&retval) {
+    int num_reads=rs.reads_size();
+    retval.clear_reads();
+    while (retval.reads_size()<num_reads)
+        retval.add_reads();
+    for (int rs_it=0;rs_it<num_reads;++rs_it) {
+        String key = getKey(rs.reads(rs_it));
+        MDB_val key_val = toValue(key);
+        MDB_val data_val;
+        int rc = mdb_get(txn, mDBI, &key_val, &data_val);
+        if (rc == MDB_SUCCESS) {
+            retval.reads(rs_it).set_data(storedData(data_val), storedSize(data_val));
+            retval.reads(rs_it).set_version(storedVersion(data_val));
+        } else if (rc == MDB_NOTFOUND) {
+            retval.reads(rs_it).clear_data();
+            retval.reads(rs_it).set_return_status(Protocol::StorageElement::KEY_MISSING);
+        } else {
+            retval.clear_reads();
+            return StorageFailed;
+        }
+        if(rs.reads(rs_it).has_index()) {
+            retval.reads(rs_it).set_index(rs.reads(rs_it).index());
+        }
+    }
+    if (rs.has_options()&&(rs.options()&Protocol::ReadWriteSet::RETURN_READ_NAMES)!=0) {
+        mergeKeysFromStorageSet( retval, rs );
+    }
+    return None;
+}
+
+LMDBObjectStorage::Error LMDBObjectStorage::applyScanSet(MDB_txn* txn, const Protocol::ReadWriteSet& rws, Protocol::Response&retval) {
+    MDB_cursor*cursor=NULL;
+    if (mdb_cursor_open(txn, mDBI, &cursor) != MDB_SUCCESS)
+        return StorageFailed;
+    Error error = None;
+    int num_scans=rws.scans_size();
+    for (int scan_it=0;scan_it<num_scans&&error==None;++scan_it) {
+        const String& prefix = rws.scans(scan_it).field_name();
+        bool all_objects = !rws.scans(scan_it).has_object_uuid();
+        // Scans of one object start at its first matching key and stop at the
+        // first one past it; scans of every object have to look at each key
+        String start;
+        if (!all_objects) {
+            UUID object = rws.scans(scan_it).object_uuid();
+            start = String((const char*)object.getArray().data(), UUID::static_size)+prefix;
+        }
+        MDB_val key_val = toValue(start);
+        MDB_val data_val;
+        int rc = start.empty() ? mdb_cursor_get(cursor, &key_val, &data_val, MDB_FIRST)
+                               : mdb_cursor_get(cursor, &key_val, &data_val, MDB_SET_RANGE);
+        for (;rc == MDB_SUCCESS;rc = mdb_cursor_get(cursor, &key_val, &data_val, MDB_NEXT)) {
+            if (!all_objects && !startsWith(key_val, start, 0))
+                break;
+            if (key_val.mv_size < UUID::static_size || !startsWith(key_val, prefix, UUID::static_size))
+                continue;
+            String key_name((const char*)key_val.mv_data+UUID::static_size, key_val.mv_size-UUID::static_size);
+            // undo getKey
+            String::size_type sep = key_name.rfind('_');
+            if (sep == String::npos)
+                continue;
+            uint64 field_id = 0;
+            std::istringstream(key_name.substr(sep+1)) >> field_id;
+            retval.add_reads();
+            int where = retval.reads_size()-1;
+            retval.reads(where).set_object_uuid(UUID((const unsigned char*)key_val.mv_data,UUID::static_size));
+            retval.reads(where).set_field_name(key_name.substr(0, sep));
+            retval.reads(where).set_field_id(field_id);
+            retval.reads(where).set_data(storedData(data_val), storedSize(data_val));
+            retval.reads(where).set_version(storedVersion(data_val));
+            if (rws.scans(scan_it).has_index())
+                retval.reads(where).set_index(rws.scans(scan_it).index());
+        }
+        if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND) {
+            retval.clear_reads();
+            error = StorageFailed;
+        }
+    }
+    mdb_cursor_close(cursor);
+    return error;
+}
+
+template <class WriteSet> LMDBObjectStorage::Error LMDBObjectStorage::applyWriteSet(MDB_txn* txn, const WriteSet& ws) {
+    int num_writes=ws.writes_size();
+    for (int ws_it=0;ws_it<num_writes;++ws_it) {
+        String key = getKey(ws.writes(ws_it));
+        MDB_val key_val = toValue(key);
+        int rc;
+        // Store the value, or delete it if no data was given.  The version
+        // moves forward, and at least to the clock, so a key deleted and
+        // written again doesn't get an old version back
+        if (ws.writes(ws_it).has_data()) {
+            MDB_val old_val;
+            uint64 version = (uint64)(Task::AbsTime::now()-Task::AbsTime::epoch()).toMicroseconds();
+            if (mdb_get(txn, mDBI, &key_val, &old_val) == MDB_SUCCESS && storedVersion(old_val) >= version)
+                version = storedVersion(old_val)+1;
+            const String& data = ws.writes(ws_it).data();
+            MDB_val data_val;
+            data_val.mv_size = VERSION_SIZE+data.size();
+            rc = mdb_put(txn, mDBI, &key_val, &data_val, MDB_RESERVE);
+            if (rc == MDB_SUCCESS) {
+                memcpy(data_val.mv_data, &version, VERSION_SIZE);
+                memcpy((char*)data_val.mv_data+VERSION_SIZE, data.data(), data.size());
+            }
+        } else {
+            rc = mdb_del(txn, mDBI, &key_val, NULL);
+            if (rc == MDB_NOTFOUND)
+                rc = MDB_SUCCESS;
+        }
+        if (rc != MDB_SUCCESS) {
+            SILOG(persistence,error,"Error writing to LMDB database "<<mDBName<<": "<<mdb_strerror(rc));
+            return StorageFailed;
+        }
+    }
+    return None;
+}
+
+template <class CompareSet> LMDBObjectStorage::Error LMDBObjectStorage::checkCompareSet(MDB_txn* txn, const CompareSet& cs) {
+    int num_compares=cs.compares_size();
+    for (int cs_it=0;cs_it<num_compares;++cs_it) {
+        String key = getKey(cs.compares(cs_it));
+        MDB_val key_val = toValue(key);
+        MDB_val data_val;
+        int rc = mdb_get(txn, mDBI, &key_val, &data_val);
+        if (rc == MDB_NOTFOUND)
+            return KeyMissing;
+        if (rc != MDB_SUCCESS)
+            return StorageFailed;
+
+        const char *data=storedData(data_val);
+        size_t size=storedSize(data_val);
+        bool equal = cs.compares(cs_it).data().length() == size
+            && 0==memcmp(cs.compares(cs_it).data().data(), data, size);
+        bool passed_test;
+        if (cs.compares(cs_it).has_comparator() && cs.compares(cs_it).comparator() == Protocol::CompareElement::VERSION) {
+            passed_test = cs.compares(cs_it).has_version() && cs.compares(cs_it).version() == storedVersion(data_val);
+        } else if (cs.compares(cs_it).has_data()==false) {
+            passed_test = false;
+        } else if (cs.compares(cs_it).has_comparator()==false) {
+            passed_test = equal;
+        } else {
+            switch (cs.compares(cs_it).comparator()) {
+              case Protocol::CompareElement::EQUAL:
+                passed_test = equal;
+                break;
+              case Protocol::CompareElement::NEQUAL:
+                passed_test = !equal;
+                break;
+              default:
+                passed_test = false;
+                break;
+            }
+        }
+        if (!passed_test)
+            return ComparisonFailed;
+    }
+    return None;
+}
+
+Persistence::Protocol::Minitransaction* LMDBObjectStorage::createMinitransaction(int numReadKeys, int numWriteKeys, int numCompares) {
+    Persistence::Protocol::Minitransaction* retval=new Persistence::Protocol::Minitransaction();
+    while (numReadKeys--) {
+        retval->add_reads();
+    }
+    while (numWriteKeys--) {
+        retval->add_writes();
+    }
+    while (numCompares--) {
+        retval->add_compares();
+    }
+    return retval;
+}
+
+Persistence::Protocol::ReadWriteSet* LMDBObjectStorage::createReadWriteSet(int numReadKeys, int numWriteKeys) {
+    Persistence::Protocol::ReadWriteSet* retval=new Persistence::Protocol::ReadWriteSet();
+    while (numReadKeys--) {
+        retval->add_reads();
+    }
+    while (numWriteKeys--) {
+        retval->add_writes();
+    }
+    return retval;
+}
+
+void LMDBObjectStorage::destroyResponse(Persistence::Protocol::Response*res) {
+    delete res;
+}
+
+bool LMDBObjectStorage::forwardMessagesTo(MessageService*ms) {
+    mDiskWorkQueue->enqueue(new AddMessageServiceMessage(this,ms));
+    return true;
+}
+
+void LMDBObjectStorage::AddMessageServiceMessage::operator() (){
+    mParent->mInterestedParties.push_back(toAdd);
+    delete this;
+}
+
+void LMDBObjectStorage::RemoveMessageServiceMessage::operator()(){
+    std::vector<MessageService*>::iterator where=mParent->mInterestedParties.begin();
+    while (where!=mParent->mInterestedParties.end()) {
+        where=std::find(where,mParent->mInterestedParties.end(),toRemove);
+        if (where!=mParent->mInterestedParties.end()) {
+            where=mParent->mInterestedParties.erase(where);
+        }
+    }
+    *done=true;
+    delete this;
+}
+
+bool LMDBObjectStorage::endForwardingMessagesTo(MessageService*ms) {
+    volatile bool complete=false;
+    mDiskWorkQueue->enqueue(new RemoveMessageServiceMessage(this,ms,&complete));
+    while(!complete) {
+    }
+    delete this;
+    return true;
+}
+
+void LMDBObjectStorage::processMessage(const RoutableMessageHeader&hdr,MemoryReference ref) {
+    if (mTransactional) {
+        Protocol::Minitransaction *trans=createMinitransaction(0,0,0);
+        if (trans->ParseFromArray(ref.data(),ref.size())) {
+            transactMessage(hdr,trans);
+        }
+    }else {
+        Protocol::ReadWriteSet *rws=createReadWriteSet(0,0);
+        if (rws->ParseFromArray(ref.data(),ref.size())) {
+            applyMessage(hdr,rws);
+        }
+    }
+}
+
+void LMDBObjectStorage::forward (RoutableMessageHeader&hdr, Protocol::Response&resp) {
+    String databuf;
+    resp.SerializeToString(&databuf);
+    MemoryReference membuf(databuf);
+    for (std::vector<MessageService*>::iterator i=mInterestedParties.begin(),ie=mInterestedParties.end();
+         i!=ie;
+         ++i) {
+        (*i)->processMessage(hdr,membuf);
+    }
+}
+
+} }// namespace Sirikata::Persistence
@@ -0,0 +1,215 @@
+/*  Sirikata -- LMDB plugin -- Persistence Services
+ *  LMDBObjectStorage.hpp
+ *
+ *  Copyright (c) 2008, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _LMDB_OBJECT_STORAGE_HPP_
+#define _LMDB_OBJECT_STORAGE_HPP_
+
+#include "persistence/ObjectStorage.hpp"
+#include "task/WorkQueue.hpp"
+#include "util/RoutableMessageHeader.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include <boost/thread/mutex.hpp>
+#include <lmdb.h>
+namespace Sirikata { namespace Persistence {
+
+/** LMDB based object storage.  Keys live in a single memory mapped B+tree,
+ *  so reads and compares are lookups in the map and a Minitransaction is one
+ *  write transaction.  Like SQLiteObjectStorage, an instance is used either
+ *  as a ReadWriteHandler or as a MinitransactionHandler, not both.
+ *  Databases are single files, with a -lock file next to them.  Values are
+ *  stored after their version; as requests are already applied one after
+ *  another on the disk thread, OPTIMISTIC Minitransactions run like any other.
+ */
+class LMDBObjectStorage : public ReadWriteHandler, public MinitransactionHandler {
+    Persistence::Protocol::Minitransaction* createMinitransaction(int numReadKeys, int numWriteKeys, int numCompares);
+public:
+    virtual ~LMDBObjectStorage();
+
+    virtual void destroyResponse(Persistence::Protocol::Response*);
+
+    virtual Persistence::Protocol::ReadWriteSet* createReadWriteSet(int numReadKeys, int numWriteKeys);
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*, void(*minitransactionDestruction)(Protocol::Minitransaction*));
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*,void(*)(Protocol::ReadWriteSet*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::Minitransaction*, const ResultCallback&, void(*minitransactionDestruction)(Protocol::Minitransaction*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::ReadWriteSet*, const ResultCallback&,void(*)(Protocol::ReadWriteSet*));
+
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&,MemoryReference);
+    static LMDBObjectStorage*create(bool transactional,const String&);
+private:
+    std::vector<MessageService*>mInterestedParties;
+    OptionSet*mOptions;
+    Task::WorkQueue *mDiskWorkQueue;
+    Task::ThreadSafeWorkQueue _mLocalWorkQueue;
+    Task::WorkQueueThread* mWorkQueueThread;
+    void forward (RoutableMessageHeader&hdr, Protocol::Response&);
+    LMDBObjectStorage(bool transactional, const String& pl);
+
+    class GroupCommitWorker;
+    /** Common base of the ReadWriteSet and Minitransaction workers.  Applying
+     *  the request and delivering its result are split so a group commit can
+     *  apply a whole batch before any result goes out.
+     */
+    class ApplyWorker {
+    protected:
+        friend class LMDBObjectStorage;
+        friend class GroupCommitWorker;
+        LMDBObjectStorage*mParent;
+        Protocol::Response*mResponse;
+        Task::AbsTime mEnqueued;
+        ApplyWorker():mEnqueued(Task::AbsTime::null()){mParent=NULL;mResponse=new Protocol::Response;}
+        /** Applies the request in a transaction nested in the group's, so a
+         *  failed compare undoes only this request.
+         *  \returns true if its changes should be kept
+         */
+        virtual bool apply(MDB_txn*txn)=0;
+        /// Destroys the request, hands off mResponse and deletes this
+        virtual void finish()=0;
+        /// Records how long the request took since it was queued, then finish()es it
+        void complete();
+    public:
+        virtual ~ApplyWorker(){}
+    };
+    class ApplyReadWriteWorker:public ApplyWorker{
+    protected:
+        void (*mDestroyReadWrite)(Protocol::ReadWriteSet*);
+        ResultCallback cb;
+        Protocol::ReadWriteSet*rws;
+        ApplyReadWriteWorker(){rws=NULL;}
+        virtual bool apply(MDB_txn*txn);
+        virtual void finish();
+    public:
+        ApplyReadWriteWorker(LMDBObjectStorage*parent, Protocol::ReadWriteSet* rws, const ResultCallback&cb,void (*mDestroyReadWrite)(Protocol::ReadWriteSet*));
+    };
+    class ApplyReadWriteMessage:public ApplyReadWriteWorker{
+        RoutableMessageHeader hdr;
+    protected:
+        virtual void finish();
+    public:
+        ApplyReadWriteMessage(LMDBObjectStorage*parent, Protocol::ReadWriteSet* rws, const RoutableMessageHeader&hdr,void (*mDestroyReadWrite)(Protocol::ReadWriteSet*));
+    };
+    class ApplyTransactionWorker:public ApplyWorker{
+    protected:
+        void (*mDestroyMinitransaction)(Protocol::Minitransaction*);
+        ResultCallback cb;
+        Protocol::Minitransaction*mt;
+        ApplyTransactionWorker(){mt=NULL;}
+        virtual bool apply(MDB_txn*txn);
+        virtual void finish();
+    public:
+        ApplyTransactionWorker(LMDBObjectStorage*parent, Protocol::Minitransaction* mt, const ResultCallback&cb,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
+    };
+    class ApplyTransactionMessage:public ApplyTransactionWorker{
+        RoutableMessageHeader hdr;
+    protected:
+        virtual void finish();
+    public:
+        ApplyTransactionMessage(LMDBObjectStorage*parent, Protocol::Minitransaction* mt, const RoutableMessageHeader&,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
+    };
+
+    /** Drains up to mGroupCommit pending workers and applies them in a single
+     *  write transaction, so they share one commit and one sync.  Only one is
+     *  queued at a time; it queues its successor if more work arrived meanwhile.
+     */
+    class GroupCommitWorker:public Task::WorkItem{
+        LMDBObjectStorage*mParent;
+    public:
+        GroupCommitWorker(LMDBObjectStorage*parent){mParent=parent;}
+        void operator()();
+    };
+    void enqueueApply(ApplyWorker*worker);
+
+    class AddMessageServiceMessage:public Task::WorkItem {
+    protected:
+        LMDBObjectStorage*mParent;
+        MessageService*toAdd;
+    public:
+        AddMessageServiceMessage(LMDBObjectStorage*p,MessageService*a){
+            toAdd=a;mParent=p;
+        }
+        void operator()();
+    };
+
+    class RemoveMessageServiceMessage:public Task::WorkItem {
+    protected:
+        LMDBObjectStorage*mParent;
+        MessageService*toRemove;
+        volatile bool *done;
+    public:
+        RemoveMessageServiceMessage(LMDBObjectStorage*p,MessageService*a,volatile bool*d){
+            toRemove=a;
+            mParent=p;
+            done=d;
+        }
+        void operator()();
+    };
+
+    enum Error {
+        None,
+        KeyMissing,
+        ComparisonFailed,
+        StorageFailed
+    };
+
+    /** Looks up every key of a ReadSet, one get per key within txn. */
+    template <class ReadSet> Error applyReadSet(MDB_txn* txn, const ReadSet& rs, Protocol::Response&retval);
+    /** Appends every stored field matched by the scans of a ReadWriteSet to
+     *  the reads of retval, walking the tree from the first matching key.
+     */
+    Error applyScanSet(MDB_txn* txn, const Protocol::ReadWriteSet& rws, Protocol::Response&retval);
+    /** Stores the values of a WriteSet, deleting the keys written without data. */
+    template <class WriteSet> Error applyWriteSet(MDB_txn* txn, const WriteSet& ws);
+    /** Checks the values in the compare set against the stored ones. */
+    template <class CompareSet> Error checkCompareSet(MDB_txn* txn, const CompareSet& cs);
+
+    /** The object UUID followed by the field name and id, so the fields of an
+     *  object and fields sharing a name prefix sort next to each other.
+     */
+    template <class StorageKey> static String getKey(const StorageKey& key);
+
+    static Protocol::Response::ReturnStatus convertError(Error internal);
+
+    bool mTransactional;
+    String mDBName;
+    MDB_env* mEnv;
+    MDB_dbi mDBI;
+
+    uint32 mGroupCommit; // most requests applied per transaction
+    boost::mutex mGroupMutex;
+    std::deque<ApplyWorker*> mGroupPending;
+    bool mGroupScheduled; // a GroupCommitWorker is queued or running
+};
+
+} }// namespace Sirikata::Persistence
+
+
+#endif //_LMDB_OBJECT_STORAGE_HPP_
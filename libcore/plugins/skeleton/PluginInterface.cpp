@@ -31,21 +31,24 @@
  */
 
 #include <util/Platform.hpp>
+#include <util/PluginManager.hpp>
 
 static int core_plugin_refcount = 0;
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     core_plugin_refcount++;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     core_plugin_refcount--;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "skeleton";
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(skeleton)
@@ -0,0 +1,419 @@
+/*  Sirikata -- SQLite plugin -- Persistence Services
+ *  CachingReadWriteHandler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <util/Platform.hpp>
+#include "options/Options.hpp"
+#include "util/AtomicTypes.hpp"
+#include "persistence/ReadWriteHandlerFactory.hpp"
+#include <boost/thread.hpp>
+#include "SQLite_Persistence.pbj.hpp"
+#include "CachingReadWriteHandler.hpp"
+
+namespace Sirikata { namespace Persistence {
+
+class CachingReadWriteHandler::PendingRead {
+public:
+    ResultCallback mCallback;
+    Protocol::Response*mResponse;
+    /// For each read sent to the backend: the read of the request it answers, its key and the fetch it was sent under
+    std::vector<int> mOrigins;
+    std::vector<Key> mKeys;
+    std::vector<uint64> mFetches;
+};
+
+bool CachingReadWriteHandler::Key::operator<(const Key&other) const {
+    if (mObject==other.mObject) {
+        if (mFieldId==other.mFieldId)
+            return mFieldName<other.mFieldName;
+        return mFieldId<other.mFieldId;
+    }
+    return mObject<other.mObject;
+}
+
+template <class StorageKey> CachingReadWriteHandler::Key CachingReadWriteHandler::keyOf(const StorageKey& key) {
+    Key retval;
+    retval.mObject=key.object_uuid();
+    retval.mFieldId=key.field_id();
+    retval.mFieldName=key.field_name();
+    return retval;
+}
+
+namespace {
+template <class StorageX, class StorageY> void copyElement(StorageX a, const StorageY& b) {
+    copyStorageElement(a,b);
+    if (b.has_index())
+        a.set_index(b.index());
+}
+Protocol::ReadWriteSet* copyReadWriteSet(const Protocol::ReadWriteSet&rws) {
+    Protocol::ReadWriteSet*retval=new Protocol::ReadWriteSet;
+    for (int i=0;i<rws.reads_size();++i) {
+        retval->add_reads();
+        copyElement(retval->mutable_reads(i),rws.reads(i));
+    }
+    for (int i=0;i<rws.writes_size();++i) {
+        retval->add_writes();
+        copyElement(retval->mutable_writes(i),rws.writes(i));
+    }
+    for (int i=0;i<rws.scans_size();++i) {
+        retval->add_scans();
+        copyElement(retval->mutable_scans(i),rws.scans(i));
+    }
+    if (rws.has_options())
+        retval->set_options(rws.options());
+    return retval;
+}
+}
+
+CachingReadWriteHandler*CachingReadWriteHandler::create(const String&s){
+    return new CachingReadWriteHandler(s);
+}
+
+CachingReadWriteHandler::CachingReadWriteHandler(const String& pl)
+ : mBytes(0),
+   mDirtyBytes(0),
+   mNextFetch(0),
+   mShutdown(false)
+{
+    OptionValue*backend;
+    OptionValue*backendOptions;
+    OptionValue*cacheSize;
+    OptionValue*flushInterval;
+    unsigned char * epoch=NULL;
+    static AtomicValue<int> counter(0);
+    int handle_offset=counter++;
+    InitializeClassOptions("sqlitecache",epoch+handle_offset,
+                           backend=new OptionValue("backend","sqlite",OptionValueType<String>(),"ReadWriteHandler the cache writes back to"),
+                           backendOptions=new OptionValue("backendoptions","",OptionValueType<String>(),"Options for the backend, e.g. --backendoptions=\"--databasefile scene.db\""),
+                           cacheSize=new OptionValue("cachesize","16777216",OptionValueType<uint32>(),"Approximate bytes of keys and values to keep in memory"),
+                           flushInterval=new OptionValue("flushinterval","1s",OptionValueType<Duration>(),"Longest a written value stays in memory only"),NULL);
+    (mOptions=OptionSet::getOptions("sqlitecache",epoch+handle_offset))->parse(pl);
+
+    mCapacity=cacheSize->as<uint32>();
+    mFlushInterval=flushInterval->as<Duration>();
+    mBackend=ReadWriteHandlerFactory::getSingleton().getConstructor(backend->as<String>())(backendOptions->as<String>());
+    mFlushThread=new boost::thread(std::tr1::bind(&CachingReadWriteHandler::flushLoop,this));
+}
+
+CachingReadWriteHandler::~CachingReadWriteHandler() {
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mShutdown=true;
+    }
+    mFlushCondition.notify_all();
+    mFlushThread->join();
+    delete mFlushThread;
+    flush();
+    // waits for the backend to apply whatever it was sent, including the flush above
+    delete mBackend;
+}
+
+void CachingReadWriteHandler::flushLoop() {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    while (!mShutdown) {
+        mFlushCondition.timed_wait(lock,boost::posix_time::microseconds(mFlushInterval.toMicroseconds()));
+        if (mShutdown)
+            break;
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+size_t CachingReadWriteHandler::footprint(const Key&key, const Entry&entry) {
+    // rough allowance for the map node and recency list node around the strings
+    return sizeof(Key)+sizeof(Entry)+64+key.mFieldName.size()+entry.mData.size();
+}
+
+CachingReadWriteHandler::EntryMap::iterator CachingReadWriteHandler::touch(const Key& key) {
+    EntryMap::iterator where=mEntries.find(key);
+    if (where==mEntries.end()) {
+        where=mEntries.insert(EntryMap::value_type(key,Entry())).first;
+        where->second.mState=Entry::MISSING;
+        where->second.mDirty=false;
+        where->second.mFetch=0;
+        mRecent.push_front(key);
+        where->second.mRecent=mRecent.begin();
+        mBytes+=footprint(where->first,where->second);
+    } else {
+        mRecent.splice(mRecent.begin(),mRecent,where->second.mRecent);
+    }
+    return where;
+}
+
+void CachingReadWriteHandler::evict() {
+    std::list<Key>::iterator candidate=mRecent.end();
+    while (mBytes>mCapacity&&candidate!=mRecent.begin()) {
+        --candidate;
+        EntryMap::iterator where=mEntries.find(*candidate);
+        assert(where!=mEntries.end());
+        // dirty values and outstanding reads are pinned until the backend has them
+        if (where->second.mDirty||where->second.mState==Entry::FETCHING)
+            continue;
+        mBytes-=footprint(where->first,where->second);
+        mEntries.erase(where);
+        candidate=mRecent.erase(candidate);
+    }
+}
+
+Protocol::ReadWriteSet* CachingReadWriteHandler::takeDirty() {
+    if (mDirtyKeys.empty())
+        return NULL;
+    Protocol::ReadWriteSet*writes=new Protocol::ReadWriteSet;
+    for (size_t i=0;i<mDirtyKeys.size();++i) {
+        EntryMap::iterator where=mEntries.find(mDirtyKeys[i]);
+        assert(where!=mEntries.end()&&where->second.mDirty);
+        int w=writes->writes_size();
+        writes->add_writes();
+        writes->mutable_writes(w).set_object_uuid(where->first.mObject);
+        writes->mutable_writes(w).set_field_id(where->first.mFieldId);
+        writes->mutable_writes(w).set_field_name(where->first.mFieldName);
+        if (where->second.mState==Entry::PRESENT)
+            writes->mutable_writes(w).set_data(where->second.mData);
+        where->second.mDirty=false;
+    }
+    mDirtyKeys.clear();
+    mDirtyBytes=0;
+    return writes;
+}
+
+void CachingReadWriteHandler::flush() {
+    using std::tr1::placeholders::_1;
+    boost::mutex::scoped_lock send(mSendMutex);
+    Protocol::ReadWriteSet*writes;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        writes=takeDirty();
+        evict();
+    }
+    if (writes)
+        mBackend->apply(writes,std::tr1::bind(&CachingReadWriteHandler::flushed,this,_1));
+}
+
+void CachingReadWriteHandler::flushed(Protocol::Response*resp) {
+    if (resp->return_status()!=Protocol::Response::SUCCESS) {
+        SILOG(persistence,error,"Write-back of cached values failed with status "<<(int)resp->return_status());
+    }
+    mBackend->destroyResponse(resp);
+}
+
+void CachingReadWriteHandler::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*rws, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    using std::tr1::placeholders::_1;
+    applyInternal(rws,std::tr1::bind(&CachingReadWriteHandler::forward,this,rmh,_1),destroyReadWriteSet);
+}
+
+void CachingReadWriteHandler::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    using std::tr1::placeholders::_1;
+    bool names=rws->has_options()&&(rws->options()&Protocol::ReadWriteSet::RETURN_READ_NAMES)!=0;
+    Protocol::Response*resp=new Protocol::Response;
+    Protocol::ReadWriteSet*misses=NULL;
+    Protocol::ReadWriteSet*writes=NULL;
+    PendingReadPtr pending;
+
+    boost::mutex::scoped_lock send(mSendMutex);
+    if (rws->scans_size()) {
+        // scans can only be answered by the backend: write everything back
+        // first, then pass the request through, forgetting what it writes
+        delete resp;
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            writes=takeDirty();
+            for (int i=0;i<rws->writes_size();++i) {
+                EntryMap::iterator where=mEntries.find(keyOf(rws->writes(i)));
+                if (where!=mEntries.end()) {
+                    mBytes-=footprint(where->first,where->second);
+                    mRecent.erase(where->second.mRecent);
+                    mEntries.erase(where);
+                }
+            }
+        }
+        if (writes)
+            mBackend->apply(writes,std::tr1::bind(&CachingReadWriteHandler::flushed,this,_1));
+        mBackend->apply(copyReadWriteSet(*rws),cb);
+        send.unlock();
+        (*destroyReadWriteSet)(rws);
+        return;
+    }
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        for (int i=0;i<rws->reads_size();++i) {
+            resp->add_reads();
+            if (names)
+                mergeStorageKey(resp->mutable_reads(i),rws->reads(i));
+            if (rws->reads(i).has_index())
+                resp->mutable_reads(i).set_index(rws->reads(i).index());
+
+            Key key=keyOf(rws->reads(i));
+            EntryMap::iterator where=mEntries.find(key);
+            if (where!=mEntries.end()&&where->second.mState!=Entry::FETCHING) {
+                touch(key);
+                if (where->second.mState==Entry::PRESENT) {
+                    resp->mutable_reads(i).set_data(where->second.mData);
+                } else {
+                    resp->mutable_reads(i).clear_data();
+                    resp->mutable_reads(i).set_return_status(Protocol::StorageElement::KEY_MISSING);
+                }
+                continue;
+            }
+            if (where==mEntries.end()) {
+                where=touch(key);
+                where->second.mState=Entry::FETCHING;
+                where->second.mFetch=++mNextFetch;
+            }
+            if (misses==NULL) {
+                misses=new Protocol::ReadWriteSet;
+                pending=PendingReadPtr(new PendingRead);
+            }
+            misses->add_reads();
+            copyStorageKey(misses->mutable_reads(misses->reads_size()-1),rws->reads(i));
+            pending->mOrigins.push_back(i);
+            pending->mKeys.push_back(key);
+            pending->mFetches.push_back(where->second.mFetch);
+        }
+        for (int i=0;i<rws->writes_size();++i) {
+            EntryMap::iterator where=touch(keyOf(rws->writes(i)));
+            Entry&entry=where->second;
+            size_t before=footprint(where->first,entry);
+            mBytes-=before;
+            if (entry.mDirty)
+                mDirtyBytes-=before;
+            else
+                mDirtyKeys.push_back(where->first);
+            if (rws->writes(i).has_data()) {
+                entry.mState=Entry::PRESENT;
+                entry.mData=rws->writes(i).data();
+            } else {
+                entry.mState=Entry::MISSING;
+                entry.mData=String();
+            }
+            entry.mDirty=true;
+            size_t after=footprint(where->first,entry);
+            mBytes+=after;
+            mDirtyBytes+=after;
+        }
+        if (mDirtyBytes*2>mCapacity)
+            writes=takeDirty();
+        evict();
+    }
+    (*destroyReadWriteSet)(rws);
+
+    // the misses go first: they must not see writes made after them
+    if (misses) {
+        pending->mCallback=cb;
+        pending->mResponse=resp;
+        mBackend->apply(misses,std::tr1::bind(&CachingReadWriteHandler::fetched,this,pending,_1));
+    }
+    if (writes)
+        mBackend->apply(writes,std::tr1::bind(&CachingReadWriteHandler::flushed,this,_1));
+    send.unlock();
+    if (!misses)
+        cb(resp);
+}
+
+void CachingReadWriteHandler::fetched(const PendingReadPtr& pending, Protocol::Response*resp) {
+    bool failed=resp->return_status()!=Protocol::Response::SUCCESS;
+    if (failed)
+        pending->mResponse->set_return_status(resp->return_status());
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        for (size_t j=0;j<pending->mOrigins.size();++j) {
+            bool answered=!failed&&j<(size_t)resp->reads_size();
+            if (answered) {
+                int i=pending->mOrigins[j];
+                copyStorageValue(pending->mResponse->mutable_reads(i),resp->reads(j));
+                if (resp->reads(j).has_return_status())
+                    pending->mResponse->mutable_reads(i).set_return_status(resp->reads(j).return_status());
+            }
+            // only the read that created a placeholder may fill it: the
+            // entry may have been written, or evicted and fetched again since
+            EntryMap::iterator where=mEntries.find(pending->mKeys[j]);
+            if (where==mEntries.end()||where->second.mState!=Entry::FETCHING||where->second.mFetch!=pending->mFetches[j])
+                continue;
+            mBytes-=footprint(where->first,where->second);
+            if (!answered) {
+                mRecent.erase(where->second.mRecent);
+                mEntries.erase(where);
+                continue;
+            }
+            if (resp->reads(j).has_data()) {
+                where->second.mState=Entry::PRESENT;
+                where->second.mData=resp->reads(j).data();
+            } else {
+                where->second.mState=Entry::MISSING;
+            }
+            mBytes+=footprint(where->first,where->second);
+        }
+        evict();
+    }
+    mBackend->destroyResponse(resp);
+    pending->mCallback(pending->mResponse);
+}
+
+void CachingReadWriteHandler::destroyResponse(Persistence::Protocol::Response*res) {
+    delete res;
+}
+
+bool CachingReadWriteHandler::forwardMessagesTo(MessageService*ms) {
+    boost::mutex::scoped_lock lock(mInterestedMutex);
+    mInterestedParties.push_back(ms);
+    return true;
+}
+
+bool CachingReadWriteHandler::endForwardingMessagesTo(MessageService*ms) {
+    boost::mutex::scoped_lock lock(mInterestedMutex);
+    mInterestedParties.erase(std::remove(mInterestedParties.begin(),mInterestedParties.end(),ms),mInterestedParties.end());
+    return true;
+}
+
+void CachingReadWriteHandler::processMessage(const RoutableMessageHeader&hdr,MemoryReference ref) {
+    Protocol::ReadWriteSet *rws=new Protocol::ReadWriteSet();
+    if (rws->ParseFromArray(ref.data(),ref.size()))
+        applyMessage(hdr,rws);
+    else
+        delete rws;
+}
+
+void CachingReadWriteHandler::forward(RoutableMessageHeader hdr, Protocol::Response*resp) {
+    hdr.swap_source_and_destination();
+    String databuf;
+    resp->SerializeToString(&databuf);
+    MemoryReference membuf(databuf);
+    {
+        boost::mutex::scoped_lock lock(mInterestedMutex);
+        for (std::vector<MessageService*>::iterator i=mInterestedParties.begin(),ie=mInterestedParties.end();
+             i!=ie;
+             ++i) {
+            (*i)->processMessage(hdr,membuf);
+        }
+    }
+    destroyResponse(resp);
+}
+
+} }// namespace Sirikata::Persistence
@@ -0,0 +1,137 @@
+/*  Sirikata -- SQLite plugin -- Persistence Services
+ *  CachingReadWriteHandler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CACHING_READ_WRITE_HANDLER_HPP_
+#define _CACHING_READ_WRITE_HANDLER_HPP_
+
+#include "persistence/ObjectStorage.hpp"
+#include "util/RoutableMessageHeader.hpp"
+#include "task/Time.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace Sirikata { namespace Persistence {
+
+/** Write-back cache in front of another ReadWriteHandler, selected by the
+ *  backend option.  Reads of cached keys are answered at once, from the
+ *  calling thread, and writes only touch the cache; dirty values go to the
+ *  backend every flushinterval, or sooner once they fill half the cache.
+ *  Keys are read back exactly as last written, whether or not that value
+ *  has been flushed yet.
+ *
+ *  Each request is still applied reads first, then writes, but its writes
+ *  now succeed even if its reads from the backend fail.
+ */
+class CachingReadWriteHandler : public ReadWriteHandler {
+public:
+    static CachingReadWriteHandler*create(const String&);
+    virtual ~CachingReadWriteHandler();
+
+    virtual void destroyResponse(Persistence::Protocol::Response*);
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*,void(*)(Protocol::ReadWriteSet*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::ReadWriteSet*, const ResultCallback&,void(*)(Protocol::ReadWriteSet*));
+
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&,MemoryReference);
+
+    /// Sends every dirty value to the backend
+    void flush();
+private:
+    CachingReadWriteHandler(const String& pl);
+
+    class Key {
+    public:
+        UUID mObject;
+        uint64 mFieldId;
+        String mFieldName;
+        bool operator<(const Key&other) const;
+    };
+    template <class StorageKey> static Key keyOf(const StorageKey& key);
+
+    class Entry {
+    public:
+        enum {
+            FETCHING, ///< placeholder until the backend answers the read issued as mFetch
+            PRESENT,
+            MISSING
+        } mState;
+        String mData;
+        bool mDirty;
+        uint64 mFetch;
+        std::list<Key>::iterator mRecent;
+    };
+    typedef std::map<Key,Entry> EntryMap;
+
+    /// A request waiting on the backend for the reads the cache could not answer
+    class PendingRead;
+    typedef std::tr1::shared_ptr<PendingRead> PendingReadPtr;
+    void fetched(const PendingReadPtr& pending, Protocol::Response*resp);
+    void flushed(Protocol::Response*resp);
+
+    /// \returns the entry for key, created as a MISSING entry if need be, marked most recently used
+    EntryMap::iterator touch(const Key& key);
+    static size_t footprint(const Key&key, const Entry&entry);
+    /// Gathers the dirty values into a ReadWriteSet and marks them clean, \returns NULL if nothing is dirty
+    Protocol::ReadWriteSet* takeDirty();
+    /// Evicts clean entries, least recently used first, until the cache fits
+    void evict();
+    void flushLoop();
+    void forward(RoutableMessageHeader hdr, Protocol::Response*resp);
+
+    OptionSet*mOptions;
+    ReadWriteHandler*mBackend;
+    size_t mCapacity;
+    Duration mFlushInterval;
+
+    /// Held from deciding what to send the backend until it is sent, so the backend sees reads and flushes in the order the cache decided on them
+    boost::mutex mSendMutex;
+    boost::mutex mMutex;
+    EntryMap mEntries;
+    std::list<Key> mRecent; ///< most recently used first
+    size_t mBytes;
+    size_t mDirtyBytes;
+    std::vector<Key> mDirtyKeys;
+    uint64 mNextFetch;
+
+    boost::condition_variable mFlushCondition;
+    bool mShutdown;
+    boost::thread*mFlushThread;
+
+    boost::mutex mInterestedMutex;
+    std::vector<MessageService*> mInterestedParties;
+};
+
+} }// namespace Sirikata::Persistence
+
+#endif //_CACHING_READ_WRITE_HANDLER_HPP_
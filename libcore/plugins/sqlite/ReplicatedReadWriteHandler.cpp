@@ -0,0 +1,323 @@
+/*  Sirikata -- SQLite plugin -- Persistence Services
+ *  ReplicatedReadWriteHandler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <util/Platform.hpp>
+#include "options/Options.hpp"
+#include "util/AtomicTypes.hpp"
+#include "persistence/ReadWriteHandlerFactory.hpp"
+#include <boost/thread.hpp>
+#include "SQLite_Persistence.pbj.hpp"
+#include "ReplicatedReadWriteHandler.hpp"
+
+namespace Sirikata { namespace Persistence {
+
+bool ReplicatedReadWriteHandler::Key::operator<(const Key&other) const {
+    if (mObject==other.mObject) {
+        if (mFieldId==other.mFieldId)
+            return mFieldName<other.mFieldName;
+        return mFieldId<other.mFieldId;
+    }
+    return mObject<other.mObject;
+}
+
+template <class StorageKey> ReplicatedReadWriteHandler::Key ReplicatedReadWriteHandler::keyOf(const StorageKey& key) {
+    Key retval;
+    retval.mObject=key.object_uuid();
+    retval.mFieldId=key.field_id();
+    retval.mFieldName=key.field_name();
+    return retval;
+}
+
+namespace {
+template <class StorageX, class StorageY> void copyElement(StorageX a, const StorageY& b) {
+    copyStorageElement(a,b);
+    if (b.has_index())
+        a.set_index(b.index());
+}
+Protocol::ReadWriteSet* copyReadWriteSet(const Protocol::ReadWriteSet&rws) {
+    Protocol::ReadWriteSet*retval=new Protocol::ReadWriteSet;
+    for (int i=0;i<rws.reads_size();++i) {
+        retval->add_reads();
+        copyElement(retval->mutable_reads(i),rws.reads(i));
+    }
+    for (int i=0;i<rws.writes_size();++i) {
+        retval->add_writes();
+        copyElement(retval->mutable_writes(i),rws.writes(i));
+    }
+    for (int i=0;i<rws.scans_size();++i) {
+        retval->add_scans();
+        copyElement(retval->mutable_scans(i),rws.scans(i));
+    }
+    if (rws.has_options())
+        retval->set_options(rws.options());
+    return retval;
+}
+void appendWrites(Protocol::ReadWriteSet*to, const Protocol::ReadWriteSet&from) {
+    for (int i=0;i<from.writes_size();++i) {
+        int w=to->writes_size();
+        to->add_writes();
+        copyStorageElement(to->mutable_writes(w),from.writes(i));
+    }
+}
+}
+
+ReplicatedReadWriteHandler*ReplicatedReadWriteHandler::create(const String&s){
+    return new ReplicatedReadWriteHandler(s);
+}
+
+ReplicatedReadWriteHandler::ReplicatedReadWriteHandler(const String& pl)
+ : mNextSequence(0),
+   mNextReplica(0)
+{
+    OptionValue*primary;
+    OptionValue*primaryOptions;
+    OptionValue*replica;
+    OptionValue*replicaOptions;
+    OptionValue*maxStaleness;
+    OptionValue*batchSize;
+    unsigned char * epoch=NULL;
+    static AtomicValue<int> counter(0);
+    int handle_offset=counter++;
+    InitializeClassOptions("sqlitereplicated",epoch+handle_offset,
+                           primary=new OptionValue("primary","sqlite",OptionValueType<String>(),"ReadWriteHandler every write goes to"),
+                           primaryOptions=new OptionValue("primaryoptions","",OptionValueType<String>(),"Options for the primary, e.g. --primaryoptions=\"--databasefile scene.db\""),
+                           replica=new OptionValue("replica","sqlite",OptionValueType<String>(),"ReadWriteHandler of the replicas"),
+                           replicaOptions=new OptionValue("replicaoptions","",OptionValueType<String>(),"Options for each replica, separated by |, e.g. --replicaoptions=\"--databasefile copy1.db|--databasefile copy2.db\""),
+                           maxStaleness=new OptionValue("maxstaleness","0s",OptionValueType<Duration>(),"How long a write may be committed on the primary and still be missing from a replica that is read"),
+                           batchSize=new OptionValue("batchsize","64",OptionValueType<uint32>(),"Most committed requests shipped to a replica at once"),NULL);
+    (mOptions=OptionSet::getOptions("sqlitereplicated",epoch+handle_offset))->parse(pl);
+
+    mMaxStaleness=maxStaleness->as<Duration>();
+    mBatchSize=std::max(batchSize->as<uint32>(),(uint32)1);
+    mPrimary=ReadWriteHandlerFactory::getSingleton().getConstructor(primary->as<String>())(primaryOptions->as<String>());
+    String replicas=replicaOptions->as<String>();
+    String::size_type pos=0;
+    while (pos<replicas.length()) {
+        String::size_type bar=replicas.find('|',pos);
+        if (bar==String::npos) bar=replicas.length();
+        mReplicas.push_back(Replica());
+        mReplicas.back().mHandler=ReadWriteHandlerFactory::getSingleton().getConstructor(replica->as<String>())(replicas.substr(pos,bar-pos));
+        pos=bar+1;
+    }
+    if (mReplicas.empty()) {
+        SILOG(persistence,warning,"Replicated storage has no replicas: the primary answers every read");
+    }
+}
+
+ReplicatedReadWriteHandler::~ReplicatedReadWriteHandler() {
+    // waits for the primary to commit what it was sent, which queues the last of the log
+    delete mPrimary;
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        for (size_t r=0;r<mReplicas.size();++r) {
+            while (!mReplicas[r].mFailed&&!mReplicas[r].mPending.empty())
+                mShippedCondition.wait(lock);
+        }
+    }
+    for (size_t r=0;r<mReplicas.size();++r)
+        delete mReplicas[r].mHandler;
+}
+
+bool ReplicatedReadWriteHandler::fresh(const Replica& replica, const Protocol::ReadWriteSet& rws, const Task::AbsTime& now) const {
+    if (replica.mFailed)
+        return false;
+    if (replica.mPending.empty())
+        return true;
+    if (rws.scans_size()) {
+        // a scan could see any key, so the oldest write the replica lacks decides
+        return now-replica.mPending.front().mCommitted<mMaxStaleness;
+    }
+    for (int i=0;i<rws.reads_size();++i) {
+        LastWriteMap::const_iterator where=mLastWrites.find(keyOf(rws.reads(i)));
+        if (where!=mLastWrites.end()&&where->second.mSequence>replica.mApplied&&!(now-where->second.mCommitted<mMaxStaleness))
+            return false;
+    }
+    return true;
+}
+
+ReadWriteHandler* ReplicatedReadWriteHandler::route(const Protocol::ReadWriteSet& rws) {
+    if (rws.writes_size()||mReplicas.empty())
+        return mPrimary;
+    Task::AbsTime now=Task::AbsTime::now();
+    boost::mutex::scoped_lock lock(mMutex);
+    for (size_t tried=0;tried<mReplicas.size();++tried) {
+        size_t r=(mNextReplica+tried)%mReplicas.size();
+        if (fresh(mReplicas[r],rws,now)) {
+            mNextReplica=r+1;
+            return mReplicas[r].mHandler;
+        }
+    }
+    return mPrimary;
+}
+
+void ReplicatedReadWriteHandler::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*rws, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    using std::tr1::placeholders::_1;
+    applyInternal(rws,std::tr1::bind(&ReplicatedReadWriteHandler::forward,this,rmh,_1),destroyReadWriteSet);
+}
+
+void ReplicatedReadWriteHandler::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    using std::tr1::placeholders::_1;
+    ReadWriteHandler*target=route(*rws);
+    if (target!=mPrimary) {
+        target->apply(copyReadWriteSet(*rws),cb);
+    }else if (rws->writes_size()==0) {
+        mPrimary->apply(copyReadWriteSet(*rws),cb);
+    }else {
+        WritesPtr writes(new Protocol::ReadWriteSet);
+        appendWrites(writes.get(),*rws);
+        mPrimary->apply(copyReadWriteSet(*rws),std::tr1::bind(&ReplicatedReadWriteHandler::written,this,writes,cb,_1));
+    }
+    (*destroyReadWriteSet)(rws);
+}
+
+void ReplicatedReadWriteHandler::written(const WritesPtr& writes, const ResultCallback& cb, Protocol::Response*resp) {
+    if (mReplicas.size()&&resp->return_status()==Protocol::Response::SUCCESS) {
+        std::vector<std::pair<Protocol::ReadWriteSet*,uint64> > batches(mReplicas.size(),std::pair<Protocol::ReadWriteSet*,uint64>(NULL,0));
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            LogEntry entry;
+            entry.mSequence=++mNextSequence;
+            entry.mCommitted=Task::AbsTime::now();
+            entry.mWrites=writes;
+            for (int i=0;i<writes->writes_size();++i)
+                mLastWrites[keyOf(writes->writes(i))]=entry;
+            for (size_t r=0;r<mReplicas.size();++r) {
+                if (mReplicas[r].mFailed)
+                    continue;
+                mReplicas[r].mPending.push_back(entry);
+                batches[r].first=takeBatch(r,batches[r].second);
+            }
+        }
+        for (size_t r=0;r<batches.size();++r)
+            if (batches[r].first)
+                send(r,batches[r].first,batches[r].second);
+    }
+    cb(resp);
+}
+
+Protocol::ReadWriteSet* ReplicatedReadWriteHandler::takeBatch(size_t r, uint64& upTo) {
+    Replica&replica=mReplicas[r];
+    if (replica.mInFlight||replica.mPending.empty())
+        return NULL;
+    // later writes to a key land after earlier ones within the batch, as they did on the primary
+    Protocol::ReadWriteSet*batch=new Protocol::ReadWriteSet;
+    size_t count=std::min(replica.mPending.size(),mBatchSize);
+    for (size_t i=0;i<count;++i)
+        appendWrites(batch,*replica.mPending[i].mWrites);
+    replica.mInFlight=count;
+    upTo=replica.mPending[count-1].mSequence;
+    return batch;
+}
+
+void ReplicatedReadWriteHandler::send(size_t r, Protocol::ReadWriteSet* batch, uint64 upTo) {
+    using std::tr1::placeholders::_1;
+    // only one batch per replica is in flight, so nothing else sends to this one until it is shipped
+    mReplicas[r].mHandler->apply(batch,std::tr1::bind(&ReplicatedReadWriteHandler::shipped,this,r,upTo,_1));
+}
+
+void ReplicatedReadWriteHandler::shipped(size_t r, uint64 upTo, Protocol::Response*resp) {
+    int status=resp->return_status();
+    // released first: once the destructor is woken below the replica may go away
+    mReplicas[r].mHandler->destroyResponse(resp);
+    Protocol::ReadWriteSet*next=NULL;
+    uint64 nextUpTo=0;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        Replica&replica=mReplicas[r];
+        if (status!=Protocol::Response::SUCCESS) {
+            SILOG(persistence,error,"Replica "<<r<<" failed to apply shipped writes with status "<<status<<": it is no longer read from");
+            replica.mFailed=true;
+            replica.mPending.clear();
+            replica.mInFlight=0;
+        }else {
+            replica.mPending.erase(replica.mPending.begin(),replica.mPending.begin()+replica.mInFlight);
+            replica.mInFlight=0;
+            replica.mApplied=upTo;
+            next=takeBatch(r,nextUpTo);
+        }
+        // keys every working replica has caught up on need no tracking
+        uint64 caughtUp=mNextSequence;
+        for (size_t i=0;i<mReplicas.size();++i)
+            if (!mReplicas[i].mFailed)
+                caughtUp=std::min(caughtUp,mReplicas[i].mApplied);
+        for (LastWriteMap::iterator i=mLastWrites.begin();i!=mLastWrites.end();) {
+            if (i->second.mSequence<=caughtUp)
+                mLastWrites.erase(i++);
+            else
+                ++i;
+        }
+        mShippedCondition.notify_all();
+    }
+    if (next)
+        send(r,next,nextUpTo);
+}
+
+void ReplicatedReadWriteHandler::destroyResponse(Persistence::Protocol::Response*res) {
+    delete res;
+}
+
+bool ReplicatedReadWriteHandler::forwardMessagesTo(MessageService*ms) {
+    boost::mutex::scoped_lock lock(mInterestedMutex);
+    mInterestedParties.push_back(ms);
+    return true;
+}
+
+bool ReplicatedReadWriteHandler::endForwardingMessagesTo(MessageService*ms) {
+    boost::mutex::scoped_lock lock(mInterestedMutex);
+    mInterestedParties.erase(std::remove(mInterestedParties.begin(),mInterestedParties.end(),ms),mInterestedParties.end());
+    return true;
+}
+
+void ReplicatedReadWriteHandler::processMessage(const RoutableMessageHeader&hdr,MemoryReference ref) {
+    Protocol::ReadWriteSet *rws=new Protocol::ReadWriteSet();
+    if (rws->ParseFromArray(ref.data(),ref.size()))
+        applyMessage(hdr,rws);
+    else
+        delete rws;
+}
+
+void ReplicatedReadWriteHandler::forward(RoutableMessageHeader hdr, Protocol::Response*resp) {
+    hdr.swap_source_and_destination();
+    String databuf;
+    resp->SerializeToString(&databuf);
+    MemoryReference membuf(databuf);
+    {
+        boost::mutex::scoped_lock lock(mInterestedMutex);
+        for (std::vector<MessageService*>::iterator i=mInterestedParties.begin(),ie=mInterestedParties.end();
+             i!=ie;
+             ++i) {
+            (*i)->processMessage(hdr,membuf);
+        }
+    }
+    destroyResponse(resp);
+}
+
+} }// namespace Sirikata::Persistence
@@ -0,0 +1,133 @@
+/*  Sirikata -- SQLite plugin -- Persistence Services
+ *  ReplicatedReadWriteHandler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _REPLICATED_READ_WRITE_HANDLER_HPP_
+#define _REPLICATED_READ_WRITE_HANDLER_HPP_
+
+#include "persistence/ObjectStorage.hpp"
+#include "util/RoutableMessageHeader.hpp"
+#include "task/Time.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
+
+namespace Sirikata { namespace Persistence {
+
+/** Spreads reads over read replicas of a primary ReadWriteHandler.  Requests
+ *  that write go to the primary, and once it has committed them their writes
+ *  are shipped to every replica in the background, in commit order, one
+ *  batch in flight per replica.  Requests that only read or scan go to the
+ *  next replica, round robin, that has every write they could see that was
+ *  committed at least maxstaleness ago, or else to the primary.  With the
+ *  default maxstaleness of 0s a read sees every write that completed before
+ *  it was made, as with the primary alone.
+ *
+ *  Replicas must start out as copies of the primary, e.g. copies of its
+ *  database file taken while nothing writes to it.  A replica that fails to
+ *  apply a batch is no longer read from.
+ */
+class ReplicatedReadWriteHandler : public ReadWriteHandler {
+public:
+    static ReplicatedReadWriteHandler*create(const String&);
+    /// Waits for every committed write to reach the replicas
+    virtual ~ReplicatedReadWriteHandler();
+
+    virtual void destroyResponse(Persistence::Protocol::Response*);
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*,void(*)(Protocol::ReadWriteSet*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::ReadWriteSet*, const ResultCallback&,void(*)(Protocol::ReadWriteSet*));
+
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&,MemoryReference);
+private:
+    ReplicatedReadWriteHandler(const String& pl);
+
+    class Key {
+    public:
+        UUID mObject;
+        uint64 mFieldId;
+        String mFieldName;
+        bool operator<(const Key&other) const;
+    };
+    template <class StorageKey> static Key keyOf(const StorageKey& key);
+
+    typedef std::tr1::shared_ptr<Protocol::ReadWriteSet> WritesPtr;
+    /// The writes of one request, as the primary committed them
+    class LogEntry {
+    public:
+        uint64 mSequence;
+        Task::AbsTime mCommitted;
+        WritesPtr mWrites;
+        LogEntry():mCommitted(Task::AbsTime::null()) {}
+    };
+    class Replica {
+    public:
+        ReadWriteHandler*mHandler;
+        /// Committed entries the replica has not acknowledged, oldest first; the first mInFlight of them are being applied
+        std::deque<LogEntry> mPending;
+        size_t mInFlight;
+        uint64 mApplied;
+        bool mFailed;
+        Replica():mHandler(NULL),mInFlight(0),mApplied(0),mFailed(false) {}
+    };
+    /// When each key some replica still lacks a write to was last written
+    typedef std::map<Key,LogEntry> LastWriteMap;
+
+    void written(const WritesPtr& writes, const ResultCallback& cb, Protocol::Response*resp);
+    /// Gathers the next batch for replica if none is in flight; needs mMutex. \returns NULL if there is nothing to send
+    Protocol::ReadWriteSet* takeBatch(size_t replica, uint64& upTo);
+    void send(size_t replica, Protocol::ReadWriteSet* batch, uint64 upTo);
+    void shipped(size_t replica, uint64 upTo, Protocol::Response*resp);
+    /// Whether replica may answer rws; needs mMutex
+    bool fresh(const Replica& replica, const Protocol::ReadWriteSet& rws, const Task::AbsTime& now) const;
+    ReadWriteHandler* route(const Protocol::ReadWriteSet& rws);
+    void forward(RoutableMessageHeader hdr, Protocol::Response*resp);
+
+    OptionSet*mOptions;
+    ReadWriteHandler*mPrimary;
+    Duration mMaxStaleness;
+    size_t mBatchSize;
+
+    boost::mutex mMutex;
+    boost::condition_variable mShippedCondition;
+    std::vector<Replica> mReplicas;
+    LastWriteMap mLastWrites;
+    uint64 mNextSequence;
+    size_t mNextReplica;
+
+    boost::mutex mInterestedMutex;
+    std::vector<MessageService*> mInterestedParties;
+};
+
+} }// namespace Sirikata::Persistence
+
+#endif //_REPLICATED_READ_WRITE_HANDLER_HPP_
@@ -63,6 +63,8 @@ SQLiteDB::SQLiteDB(const String& name) {
 }
 
 SQLiteDB::~SQLiteDB() {
+    for(StatementMap::iterator it = mStatements.begin(); it != mStatements.end(); ++it)
+        sqlite3_finalize(it->second);
     sqlite3_close(mObjectDB);
 }
 
@@ -70,6 +72,23 @@ sqlite3* SQLiteDB::db() const {
     return mObjectDB;
 }
 
+sqlite3_stmt* SQLiteDB::prepare(const String& sql, int* rc) {
+    StatementMap::iterator it = mStatements.find(sql);
+    if (it != mStatements.end()) {
+        // callers reset after use, this just guards against one that forgot
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        *rc = SQLITE_OK;
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = NULL;
+    *rc = sqlite3_prepare_v2(mObjectDB, sql.c_str(), -1, &stmt, NULL);
+    if (*rc == SQLITE_OK && stmt != NULL)
+        mStatements[sql] = stmt;
+    return stmt;
+}
+
 
 
 SQLite::SQLite() {
@@ -46,8 +46,22 @@ public:
     ~SQLiteDB();
 
     sqlite3* db() const;
+
+    /** Get the compiled statement for sql, compiling it the first time it is
+     *  requested on this connection.  The statement stays owned by the
+     *  connection: callers sqlite3_reset it when they are done with it and
+     *  must never finalize it.  Since SQLite::open hands out one connection
+     *  per thread, no locking is done here.
+     *  \param sql the statement text, used as the cache key
+     *  \param rc set to the result of compiling the statement
+     *  \returns the statement with its bindings cleared, or NULL on error
+     */
+    sqlite3_stmt* prepare(const String& sql, int* rc);
 private:
+    typedef std::map<String, sqlite3_stmt*> StatementMap;
+
     sqlite3* mObjectDB;
+    StatementMap mStatements;
 };
 
 typedef std::tr1::shared_ptr<SQLiteDB> SQLiteDBPtr;
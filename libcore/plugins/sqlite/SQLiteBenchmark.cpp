@@ -0,0 +1,311 @@
+/*  Sirikata SQLite Plugin
+ *  SQLiteBenchmark.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Platform.hpp>
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include "util/UUID.hpp"
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include "SQLite_Persistence.pbj.hpp"
+#include "SQLiteObjectStorage.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Standalone SQLiteObjectStorage benchmark: drives random reads and writes
+ * through the ReadWriteHandler or MinitransactionHandler interface for every
+ * combination of handler, read ratio, key count, value size, storage count
+ * and sqlite option profile given on the command line. Each storage gets its
+ * own connection and disk thread on the same database file, so more than one
+ * of them contend for the database lock. Prints ops/sec, p50/p99/p999 latency
+ * and how often requests were retried or failed on a locked database.
+ */
+using namespace Sirikata;
+using namespace Sirikata::Persistence;
+
+namespace {
+OptionValue*handlers;
+OptionValue*readRatios;
+OptionValue*keyCounts;
+OptionValue*valueSizes;
+OptionValue*storageCounts;
+OptionValue*profiles;
+OptionValue*operations;
+OptionValue*inflight;
+OptionValue*database;
+InitializeGlobalOptions o("sqlitebench",
+                    handlers=new OptionValue("handlers","readwrite,minitransaction",OptionValueType<String>(),"Comma separated interfaces to drive, readwrite and minitransaction"),
+                    readRatios=new OptionValue("read-ratios","0.5,0.95",OptionValueType<String>(),"Comma separated fractions of operations that are reads"),
+                    keyCounts=new OptionValue("keys","1000,10000",OptionValueType<String>(),"Comma separated numbers of distinct keys, all written before each run"),
+                    valueSizes=new OptionValue("value-sizes","100,4000",OptionValueType<String>(),"Comma separated value sizes in bytes"),
+                    storageCounts=new OptionValue("storages","1,4",OptionValueType<String>(),"Comma separated numbers of storages, each with its own connection and disk thread, sharing the database"),
+                    profiles=new OptionValue("profiles",";--journalmode wal;--journalmode wal --groupcommit 32",OptionValueType<String>(),"Semicolon separated sqlite option strings to compare, empty for the defaults"),
+                    operations=new OptionValue("operations","5000",OptionValueType<unsigned int>(),"Operations issued for each combination"),
+                    inflight=new OptionValue("inflight","16",OptionValueType<unsigned int>(),"Operations outstanding per storage at any time"),
+                    database=new OptionValue("database","sqlitebench.db",OptionValueType<String>(),"Database file used for the runs, deleted before each one"),
+                    NULL);
+
+std::vector<String> splitList(const String&list, char separator) {
+    std::vector<String> retval;
+    String::size_type pos=0;
+    while (pos<=list.length()) {
+        String::size_type end=list.find(separator,pos);
+        if (end==String::npos) end=list.length();
+        retval.push_back(list.substr(pos,end-pos));
+        pos=end+1;
+    }
+    return retval;
+}
+std::vector<unsigned int> parseCounts(const String&list) {
+    std::vector<String> items=splitList(list,',');
+    std::vector<unsigned int> retval;
+    for (size_t i=0;i<items.size();++i) {
+        unsigned int value=(unsigned int)strtoul(items[i].c_str(),NULL,10);
+        if (value) retval.push_back(value);
+    }
+    return retval;
+}
+std::vector<double> parseRatios(const String&list) {
+    std::vector<String> items=splitList(list,',');
+    std::vector<double> retval;
+    for (size_t i=0;i<items.size();++i)
+        if (!items[i].empty())
+            retval.push_back(std::min(1.0,std::max(0.0,strtod(items[i].c_str(),NULL))));
+    return retval;
+}
+
+UUID keyObject(unsigned int key) {
+    unsigned char data[UUID::static_size]={0};
+    for (int i=0;i<4;++i)
+        data[i]=(unsigned char)(key>>(8*i));
+    data[8]=0x5b;
+    return UUID(data,UUID::static_size);
+}
+
+template <class Set> void addRead(Set&set, unsigned int key) {
+    Protocol::StorageElement&element=set.add_reads();
+    element.set_object_uuid(keyObject(key));
+    element.set_field_name("v");
+    element.set_field_id(0);
+}
+template <class Set> void addWrite(Set&set, unsigned int key, const String&value) {
+    Protocol::StorageElement&element=set.add_writes();
+    element.set_object_uuid(keyObject(key));
+    element.set_field_name("v");
+    element.set_field_id(0);
+    element.set_data(value);
+}
+
+void createStorage(bool transactional, const String&options, SQLiteObjectStorage**retval) {
+    *retval=SQLiteObjectStorage::create(transactional,options);
+}
+
+class SQLiteBenchmark {
+    boost::mutex mMutex;
+    boost::condition_variable mProgress;
+    std::vector<SQLiteObjectStorage*> mStorages;
+    std::vector<unsigned int> mOutstanding;
+    std::vector<int64> mLatencies;
+    unsigned int mFailures;
+    unsigned int mLocked;
+    unsigned int mCompleted;
+
+    void completed(size_t storage, Task::AbsTime issued, Protocol::Response*response) {
+        int64 latency=(Task::AbsTime::now()-issued).toMicroseconds();
+        Protocol::Response::ReturnStatus status=response->has_return_status()?response->return_status():Protocol::Response::SUCCESS;
+        mStorages[storage]->destroyResponse(response);
+        boost::mutex::scoped_lock lock(mMutex);
+        mLatencies.push_back(latency);
+        if (status==Protocol::Response::DATABASE_LOCKED)
+            ++mLocked;
+        else if (status!=Protocol::Response::SUCCESS)
+            ++mFailures;
+        --mOutstanding[storage];
+        ++mCompleted;
+        mProgress.notify_all();
+    }
+    void issue(size_t storage, bool transactional, bool read, unsigned int key, const String&value) {
+        using std::tr1::placeholders::_1;
+        SQLiteObjectStorage*target=mStorages[storage];
+        ObjectStorageHandler::ResultCallback cb=std::tr1::bind(&SQLiteBenchmark::completed,this,storage,Task::AbsTime::now(),_1);
+        if (transactional) {
+            // writes are read-modify-write so the transaction holds the lock across both
+            Protocol::Minitransaction*mt=new Protocol::Minitransaction;
+            addRead(*mt,key);
+            if (!read)
+                addWrite(*mt,key,value);
+            static_cast<MinitransactionHandler*>(target)->transact(mt,cb);
+        }else {
+            Protocol::ReadWriteSet*rws=new Protocol::ReadWriteSet;
+            if (read)
+                addRead(*rws,key);
+            else
+                addWrite(*rws,key,value);
+            static_cast<ReadWriteHandler*>(target)->apply(rws,cb);
+        }
+    }
+    void waitForAll() {
+        boost::mutex::scoped_lock lock(mMutex);
+        for (size_t i=0;i<mOutstanding.size();++i)
+            while (mOutstanding[i])
+                mProgress.wait(lock);
+    }
+    void removeDatabase(const String&name) {
+        remove(name.c_str());
+        remove((name+"-wal").c_str());
+        remove((name+"-shm").c_str());
+        remove((name+"-journal").c_str());
+    }
+public:
+    bool run(bool transactional, double readRatio, unsigned int keys, unsigned int valueSize,
+             unsigned int storages, const String&profile, const String&profileName) {
+        String databaseName=database->as<String>();
+        removeDatabase(databaseName);
+        String options="--databasefile "+databaseName+" "+profile;
+        for (unsigned int i=0;i<storages;++i) {
+            // SQLite hands out one connection per thread, so open each storage from its own
+            SQLiteObjectStorage*storage=NULL;
+            boost::thread opener(std::tr1::bind(&createStorage,transactional,options,&storage));
+            opener.join();
+            mStorages.push_back(storage);
+        }
+        mOutstanding.assign(storages,0);
+        mLatencies.clear();
+        mFailures=mLocked=mCompleted=0;
+
+        String value(valueSize,'x');
+        enum {POPULATE_BATCH=100};
+        for (unsigned int key=0;key<keys;key+=POPULATE_BATCH) {
+            using std::tr1::placeholders::_1;
+            {
+                boost::mutex::scoped_lock lock(mMutex);
+                ++mOutstanding[0];
+            }
+            ObjectStorageHandler::ResultCallback cb=std::tr1::bind(&SQLiteBenchmark::completed,this,(size_t)0,Task::AbsTime::now(),_1);
+            if (transactional) {
+                Protocol::Minitransaction*mt=new Protocol::Minitransaction;
+                for (unsigned int k=key;k<keys&&k<key+POPULATE_BATCH;++k)
+                    addWrite(*mt,k,value);
+                static_cast<MinitransactionHandler*>(mStorages[0])->transact(mt,cb);
+            }else {
+                Protocol::ReadWriteSet*rws=new Protocol::ReadWriteSet;
+                for (unsigned int k=key;k<keys&&k<key+POPULATE_BATCH;++k)
+                    addWrite(*rws,k,value);
+                static_cast<ReadWriteHandler*>(mStorages[0])->apply(rws,cb);
+            }
+            waitForAll();
+        }
+        bool populated=!mFailures&&!mLocked;
+        mLatencies.clear();
+        mFailures=mLocked=mCompleted=0;
+        uint32 retriesBefore=0;
+        for (size_t i=0;i<mStorages.size();++i)
+            retriesBefore+=mStorages[i]->lockedRetries();
+
+        unsigned int total=operations->as<unsigned int>();
+        unsigned int window=std::max(1u,inflight->as<unsigned int>());
+        srand(keys^valueSize^storages);
+        Task::AbsTime start=Task::AbsTime::now();
+        for (unsigned int op=0;op<total;++op) {
+            size_t storage=op%storages;
+            {
+                boost::mutex::scoped_lock lock(mMutex);
+                while (mOutstanding[storage]>=window)
+                    mProgress.wait(lock);
+                ++mOutstanding[storage];
+            }
+            bool read=rand()<(RAND_MAX*readRatio);
+            issue(storage,transactional,read,(unsigned int)(rand()%keys),value);
+        }
+        waitForAll();
+        double seconds=(Task::AbsTime::now()-start).toSeconds();
+
+        uint32 retries=0;
+        for (size_t i=0;i<mStorages.size();++i) {
+            retries+=mStorages[i]->lockedRetries();
+            delete mStorages[i];
+        }
+        mStorages.clear();
+        removeDatabase(databaseName);
+
+        std::sort(mLatencies.begin(),mLatencies.end());
+        size_t n=mLatencies.size();
+        printf("%15s %6.2f %8u %8u %8u %-34s %10.0f %9lld %9lld %9lld %8u %7u %7u\n",
+               transactional?"minitransaction":"readwrite",readRatio,keys,valueSize,storages,
+               profileName.c_str(),seconds>0?n/seconds:0.,
+               n?(long long)mLatencies[n/2]:0LL,
+               n?(long long)mLatencies[(n*99)/100]:0LL,
+               n?(long long)mLatencies[(n*999)/1000]:0LL,
+               retries-retriesBefore,mLocked,mFailures);
+        fflush(stdout);
+        if (!populated)
+            fprintf(stderr,"Populating %u keys failed\n",keys);
+        return populated&&!mFailures;
+    }
+};
+
+}
+
+int main(int argc, const char**argv) {
+    OptionSet::getOptions("sqlitebench")->parse(argc,argv);
+
+    std::vector<String> handlerNames=splitList(handlers->as<String>(),',');
+    std::vector<double> ratios=parseRatios(readRatios->as<String>());
+    std::vector<unsigned int> keys=parseCounts(keyCounts->as<String>());
+    std::vector<unsigned int> sizes=parseCounts(valueSizes->as<String>());
+    std::vector<unsigned int> storages=parseCounts(storageCounts->as<String>());
+    std::vector<String> profileList=splitList(profiles->as<String>(),';');
+
+    printf("%15s %6s %8s %8s %8s %-34s %10s %9s %9s %9s %8s %7s %7s\n",
+           "handler","reads","keys","size","storages","profile","ops/sec","p50(us)","p99(us)","p999(us)","retries","locked","failed");
+    int retval=0;
+    SQLiteBenchmark benchmark;
+    for (size_t h=0;h<handlerNames.size();++h) {
+        if (handlerNames[h]!="readwrite"&&handlerNames[h]!="minitransaction") {
+            if (!handlerNames[h].empty())
+                fprintf(stderr,"Ignoring unknown handler %s\n",handlerNames[h].c_str());
+            continue;
+        }
+        bool transactional=handlerNames[h]=="minitransaction";
+        for (size_t p=0;p<profileList.size();++p)
+            for (size_t s=0;s<storages.size();++s)
+                for (size_t k=0;k<keys.size();++k)
+                    for (size_t z=0;z<sizes.size();++z)
+                        for (size_t r=0;r<ratios.size();++r)
+                            if (!benchmark.run(transactional,ratios[r],keys[k],sizes[z],storages[s],
+                                               profileList[p],profileList[p].empty()?String("default"):profileList[p]))
+                                retval=1;
+    }
+    return retval;
+}
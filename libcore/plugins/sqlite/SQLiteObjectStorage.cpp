@@ -38,9 +38,19 @@
 #include <boost/thread.hpp>
 #include "SQLite_Persistence.pbj.hpp"
 #include "SQLiteObjectStorage.hpp"
+#include "util/Metrics.hpp"
 #define OPTION_DATABASE   "db"
 
 #define TABLE_NAME "persistence"
+#define VALUE_QUERY "SELECT value, version FROM \"" TABLE_NAME "\" WHERE object == ? AND key == ?"
+#define VERSION_QUERY "SELECT version FROM \"" TABLE_NAME "\" WHERE object == ? AND key == ?"
+// every write moves the version of its key forward, and at least to the
+// clock, so a key deleted and written again doesn't get an old version back
+#define VALUE_INSERT "INSERT OR REPLACE INTO \"" TABLE_NAME "\" (object, key, value, version) VALUES(?1, ?2, ?3, MAX(COALESCE((SELECT version FROM \"" TABLE_NAME "\" WHERE object == ?1 AND key == ?2), 0)+1, ?4))"
+#define VALUE_DELETE "DELETE FROM \"" TABLE_NAME "\" WHERE object = ? AND key = ?"
+// keys are text, so binding a blob as the upper bound leaves the range open
+#define SCAN_OBJECT_QUERY "SELECT object, key, value, version FROM \"" TABLE_NAME "\" WHERE object == ? AND key >= ? AND key < ?"
+#define SCAN_ALL_QUERY "SELECT object, key, value, version FROM \"" TABLE_NAME "\" WHERE key >= ? AND key < ?"
 
 namespace Sirikata { namespace Persistence {
 
@@ -85,6 +95,8 @@ MinitransactionHandler* SQLiteObjectStorage::createMinitransactionHandler(const
     return new SQLiteObjectStorage(true, pl);
 }
 namespace {
+Metrics::Histogram sRequestTime("sqlite.request_us","microseconds from a request reaching SQLiteObjectStorage to its response");
+
 Any pointerparser(std::string s) {
     Task::WorkQueue*retval=NULL;
     size_t temp=0;
@@ -100,20 +112,36 @@ SQLiteObjectStorage::SQLiteObjectStorage(bool transactional, const String& pl)
  : mTransactional(transactional),
    mDBName(),
    mRetries(5),
-   mBusyTimeout(1000)
+   mBusyTimeout(1000),
+   mLockedRetries(0),
+   mVersionConflicts(0),
+   mGroupScheduled(false)
 {
     OptionValue*databaseFile;
     OptionValue*workQueueInstance;
+    OptionValue*groupCommit;
+    OptionValue*journalMode;
+    OptionValue*synchronous;
+    OptionValue*mmapSize;
+    OptionValue*cacheSize;
+    OptionValue*checkpoint;
     unsigned char * epoch=NULL;
     static AtomicValue<int> counter(0);
     int handle_offset=counter++;
     InitializeClassOptions("sqlite",epoch+handle_offset,
                            databaseFile=new OptionValue("databasefile","",OptionValueType<String>(),"Sets the database to be used for storage"),
-                           workQueueInstance=new OptionValue("workqueue","0",OptionValueType<void*>(),"Sets the work queue to be used for disk reads to a common work queue"),NULL);
+                           workQueueInstance=new OptionValue("workqueue","0",OptionValueType<void*>(),"Sets the work queue to be used for disk reads to a common work queue"),
+                           groupCommit=new OptionValue("groupcommit","1",OptionValueType<uint32>(),"Most queued requests applied together in one database transaction, 1 applies each request on its own"),
+                           journalMode=new OptionValue("journalmode","",OptionValueType<String>(),"SQLite journal_mode for the database, e.g. wal so readers don't block behind writers; empty leaves the database as it is"),
+                           synchronous=new OptionValue("synchronous","",OptionValueType<String>(),"SQLite synchronous level: off, normal or full; empty keeps the SQLite default"),
+                           mmapSize=new OptionValue("mmapsize","0",OptionValueType<int64>(),"Bytes of the database to memory map, 0 disables memory mapping"),
+                           cacheSize=new OptionValue("cachesize","0",OptionValueType<int32>(),"SQLite page cache size, in pages if positive or KiB if negative; 0 keeps the SQLite default"),
+                           checkpoint=new OptionValue("checkpoint","1000",OptionValueType<int32>(),"In wal mode, checkpoint automatically once the log reaches this many pages, 0 disables automatic checkpoints"),NULL);
     (mOptions=OptionSet::getOptions("sqlite",epoch+handle_offset))->parse(pl);
 
     mDiskWorkQueue=(Task::WorkQueue*)workQueueInstance->as<void*>();
     mWorkQueueThread=NULL;
+    mGroupCommit=groupCommit->as<uint32>();
     if(mDiskWorkQueue==NULL) {
         mDiskWorkQueue=&_mLocalWorkQueue;
         mWorkQueueThread=mDiskWorkQueue->createWorkerThreads(1);
@@ -125,10 +153,30 @@ SQLiteObjectStorage::SQLiteObjectStorage(bool transactional, const String& pl)
     SQLiteDBPtr db = SQLite::getSingleton().open(mDBName);
     sqlite3_busy_timeout(db->db(), mBusyTimeout);
 
+    // Durability profile: these are per connection except journal_mode=wal,
+    // which sticks to the database file once set
+    std::vector<String> pragmas;
+    if (!journalMode->as<String>().empty())
+        pragmas.push_back("PRAGMA journal_mode=" + journalMode->as<String>());
+    if (!synchronous->as<String>().empty())
+        pragmas.push_back("PRAGMA synchronous=" + synchronous->as<String>());
+    if (mmapSize->as<int64>() != 0)
+        pragmas.push_back("PRAGMA mmap_size=" + boost::lexical_cast<String>(mmapSize->as<int64>()));
+    if (cacheSize->as<int32>() != 0)
+        pragmas.push_back("PRAGMA cache_size=" + boost::lexical_cast<String>(cacheSize->as<int32>()));
+    for (size_t i=0;i<pragmas.size();++i) {
+        char* error_msg=NULL;
+        int rc = sqlite3_exec(db->db(), pragmas[i].c_str(), NULL, NULL, &error_msg);
+        SQLite::check_sql_error(db->db(), rc, &error_msg, "Error executing " + pragmas[i]);
+    }
+#if SQLITE_VERSION_NUMBER >= 3007000
+    sqlite3_wal_autocheckpoint(db->db(), checkpoint->as<int32>());
+#endif
+
     // Create the table for this object if it doesn't exist yet
     String table_create = "CREATE TABLE IF NOT EXISTS ";
     table_create += "\"" TABLE_NAME "\"";
-    table_create += "(object TEXT, key TEXT, value TEXT, PRIMARY KEY(object, key))";
+    table_create += "(object TEXT, key TEXT, value TEXT, version INTEGER NOT NULL DEFAULT 0, PRIMARY KEY(object, key))";
 
     int rc;
     char* remain;
@@ -142,6 +190,17 @@ SQLiteObjectStorage::SQLiteObjectStorage(bool transactional, const String& pl)
     rc = sqlite3_finalize(table_create_stmt);
     SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing table create statement");
 
+    // Tables created before values were versioned start every key at 0
+    sqlite3_stmt* version_check_stmt = NULL;
+    rc = sqlite3_prepare_v2(db->db(), "SELECT version FROM \"" TABLE_NAME "\" LIMIT 0", -1, &version_check_stmt, NULL);
+    if (version_check_stmt)
+        sqlite3_finalize(version_check_stmt);
+    if (rc != SQLITE_OK) {
+        char* error_msg=NULL;
+        rc = sqlite3_exec(db->db(), "ALTER TABLE \"" TABLE_NAME "\" ADD COLUMN version INTEGER NOT NULL DEFAULT 0", NULL, NULL, &error_msg);
+        SQLite::check_sql_error(db->db(), rc, &error_msg, "Error adding version column");
+    }
+
     mDB = db;
 }
 
@@ -153,48 +212,143 @@ SQLiteObjectStorage::~SQLiteObjectStorage() {
 void SQLiteObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*mt, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
     assert(mTransactional == true);
 
-    mDiskWorkQueue->enqueue(new ApplyTransactionMessage(this,mt,rmh,destroyMinitransaction));
+    enqueueApply(new ApplyTransactionMessage(this,mt,rmh,destroyMinitransaction));
 }
 
 void SQLiteObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*mt, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
     assert(mTransactional == false);
 
-    mDiskWorkQueue->enqueue(new ApplyReadWriteMessage(this,mt,rmh,destroyReadWriteSet));
+    enqueueApply(new ApplyReadWriteMessage(this,mt,rmh,destroyReadWriteSet));
 }
 
 void SQLiteObjectStorage::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
     assert(mTransactional == false);
 
-    mDiskWorkQueue->enqueue(new ApplyReadWriteWorker(this,rws,cb,destroyReadWriteSet));
+    enqueueApply(new ApplyReadWriteWorker(this,rws,cb,destroyReadWriteSet));
 }
 
 void SQLiteObjectStorage::applyInternal(Protocol::Minitransaction* mt, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
     assert(mTransactional == true);
 
-    mDiskWorkQueue->enqueue(new ApplyTransactionWorker(this,mt,cb,destroyMinitransaction));
+    enqueueApply(new ApplyTransactionWorker(this,mt,cb,destroyMinitransaction));
+}
+
+void SQLiteObjectStorage::applyTwoPhase(Protocol::Minitransaction* mt, const TwoPhaseCommitPtr& decision, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    assert(mTransactional == true);
+
+    // never grouped: the worker blocks for the other parts while it holds the write lock
+    ApplyWorker*worker=new ApplyTwoPhaseWorker(this,mt,decision,cb,destroyMinitransaction);
+    worker->mEnqueued=Task::AbsTime::now();
+    mDiskWorkQueue->enqueue(worker);
+}
+
+bool SQLiteObjectStorage::TwoPhaseCommit::vote(bool commit) {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    if (!commit)
+        mCommit=false;
+    if (--mRemaining==0)
+        mCondition.notify_all();
+    while (mRemaining>0)
+        mCondition.wait(lock);
+    return mCommit;
+}
+
+void SQLiteObjectStorage::enqueueApply(ApplyWorker*worker) {
+    worker->mEnqueued=Task::AbsTime::now();
+    if (mGroupCommit<=1) {
+        mDiskWorkQueue->enqueue(worker);
+        return;
+    }
+    boost::mutex::scoped_lock lock(mGroupMutex);
+    mGroupPending.push_back(worker);
+    if (!mGroupScheduled) {
+        mGroupScheduled=true;
+        mDiskWorkQueue->enqueue(new GroupCommitWorker(this));
+    }
+}
+
+void SQLiteObjectStorage::GroupCommitWorker::operator() () {
+    std::vector<ApplyWorker*> batch;
+    {
+        boost::mutex::scoped_lock lock(mParent->mGroupMutex);
+        while (batch.size()<mParent->mGroupCommit && !mParent->mGroupPending.empty()) {
+            batch.push_back(mParent->mGroupPending.front());
+            mParent->mGroupPending.pop_front();
+        }
+    }
+
+    // Requests are applied in arrival order, each Minitransaction inside its
+    // own savepoint, so requests touching the same keys see each other just
+    // as they would one after another.  If the shared commit fails nothing
+    // has been delivered yet, so every request is simply applied again alone.
+    SQLiteDBPtr db = mParent->mDB;
+    bool grouped = batch.size()>1 && mParent->beginTransaction(db, true);
+    if (grouped) {
+        for (size_t i=0;i<batch.size();++i)
+            batch[i]->processBatched();
+        if (!mParent->commitTransaction(db)) {
+            mParent->rollbackTransaction(db);
+            ++mParent->mLockedRetries;
+            grouped=false;
+        }
+    }
+    for (size_t i=0;i<batch.size();++i) {
+        if (!grouped) {
+            batch[i]->mResponse->set_return_status(Protocol::Response::SUCCESS);
+            batch[i]->process();
+        }
+        batch[i]->complete();
+    }
+
+    {
+        boost::mutex::scoped_lock lock(mParent->mGroupMutex);
+        if (mParent->mGroupPending.empty())
+            mParent->mGroupScheduled=false;
+        else
+            mParent->mDiskWorkQueue->enqueue(new GroupCommitWorker(mParent));
+    }
+    delete this;
+}
+
+void SQLiteObjectStorage::ApplyWorker::operator() () {
+    process();
+    complete();
+}
+
+void SQLiteObjectStorage::ApplyWorker::complete() {
+    if (mEnqueued!=Task::AbsTime::null())
+        sRequestTime.recordDuration(Task::AbsTime::now()-mEnqueued);
+    finish();
 }
 SQLiteObjectStorage::ApplyReadWriteWorker::ApplyReadWriteWorker(SQLiteObjectStorage*parent, Protocol::ReadWriteSet* rws, const ResultCallback&cb, void (*destroyRWS)(Protocol::ReadWriteSet*)){
     mDestroyReadWrite=destroyRWS;
     mParent=parent;
     this->rws=rws;
     this->cb=cb;
-    mResponse=NULL;
 }
 
 Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyReadWriteWorker::processReadWrite() {
     Error error = DatabaseLocked;
     SQLiteDBPtr db = mParent->mDB;
     int retries =mParent->mRetries;
-    for(int tries = 0; tries < retries+1 && error != None; tries++)
+    for(int tries = 0; tries < retries+1 && error != None; tries++) {
+        if (tries)
+            ++mParent->mLockedRetries;
         error = mParent->applyReadSet(db, *rws, *mResponse);
+        if (error == None && rws->scans_size())
+            error = mParent->applyScanSet(db, *rws, *mResponse);
+    }
     if (error != None) {
         mResponse->set_return_status(convertError(error));
         return mResponse->return_status();
     }else {//FIXME do we want to abort the operation (note it's not a transaction) if we failed to read any items? I think so...
         error = DatabaseLocked;
 
-        for(int tries = 0; tries < retries+1 && error != None; tries++)
+        for(int tries = 0; tries < retries+1 && error != None; tries++) {
+            if (tries)
+                ++mParent->mLockedRetries;
             error = mParent->applyWriteSet(db, *rws, retries);
+        }
         if (error != None) {
             mResponse->set_return_status(convertError(error));
             return mResponse->return_status();
@@ -210,6 +364,8 @@ SQLiteObjectStorage::ApplyTransactionWorker::ApplyTransactionWorker(SQLiteObject
     this->cb=cb;
 }
 Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::processTransaction() {
+    if (mt->has_options()&&(mt->options()&Protocol::Minitransaction::OPTIMISTIC)!=0)
+        return processOptimisticTransaction();
     Error error = None;
     SQLiteDBPtr db = mParent->mDB;
     int retries=mParent->mRetries;
@@ -234,13 +390,100 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::pr
         }
 
         error = mParent->applyWriteSet(db, *mt, 0);
+        if (error == None && !mParent->commitTransaction(db))
+            error = DatabaseLocked;
         if (error != None)
             mParent->rollbackTransaction(db);
-        else
-            mParent->commitTransaction(db);
 
+        // Only a locked database is worth another try; once committed the
+        // transaction must not be applied again
+        tries--;
+        if (error != DatabaseLocked)
+            break;
+        if (tries > 0)
+            ++mParent->mLockedRetries;
+    }
+    if (error != None) {
+        mResponse->set_return_status(convertError(error));
+        return mResponse->return_status();
+    }
+    return convertError(None);
+}
+
+Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::processOptimisticTransaction() {
+    Error error = None;
+    SQLiteDBPtr db = mParent->mDB;
+    int tries = mParent->mRetries + 1;
+    while( tries > 0 ) {
         tries--;
+        ObservedVersions observed;
+
+        // Compares and reads see one snapshot under a shared lock only, so
+        // they don't wait for or hold up writers
+        if (!mParent->beginTransaction(db)) {
+            error = DatabaseLocked;
+        } else {
+            error = mParent->checkCompareSet(db, *mt, &observed);
+            Error read_error = mParent->applyReadSet(db, *mt, *mResponse, &observed);
+            if (error==None)
+                error=read_error;
+            if (!mParent->commitTransaction(db)) {
+                mParent->rollbackTransaction(db);
+                if (error==None)
+                    error=DatabaseLocked;
+            }
+        }
+
+        // The write lock is only held to check nothing seen changed since,
+        // and for the writes themselves
+        if (error == None && mt->writes_size()) {
+            if (!mParent->beginTransaction(db, true)) {
+                error = DatabaseLocked;
+            } else {
+                error = mParent->validateVersions(db, observed);
+                if (error == None)
+                    error = mParent->applyWriteSet(db, *mt, 0);
+                if (error == None && !mParent->commitTransaction(db))
+                    error = DatabaseLocked;
+                if (error != None)
+                    mParent->rollbackTransaction(db);
+            }
+        }
+
+        if (error != DatabaseLocked && error != VersionConflict)
+            break;
+        if (tries > 0) {
+            if (error == VersionConflict)
+                ++mParent->mVersionConflicts;
+            else
+                ++mParent->mLockedRetries;
+        }
+    }
+    if (error != None) {
+        mResponse->set_return_status(convertError(error));
+        return mResponse->return_status();
+    }
+    return convertError(None);
+}
+
+Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::processBatchedTransaction() {
+    SQLiteDBPtr db = mParent->mDB;
+    if (!mParent->executeStatement(db, "SAVEPOINT minitransaction", "savepoint")) {
+        mResponse->set_return_status(convertError(DatabaseLocked));
+        return mResponse->return_status();
     }
+
+    Error error = mParent->checkCompareSet(db, *mt);
+    Error read_error = mParent->applyReadSet(db, *mt, *mResponse);
+    if (error==None)
+        error=read_error;
+    if (error==None)
+        error = mParent->applyWriteSet(db, *mt, 0);
+
+    if (error != None)
+        mParent->executeStatement(db, "ROLLBACK TO minitransaction", "rollback to savepoint");
+    mParent->executeStatement(db, "RELEASE minitransaction", "release savepoint");
+
     if (error != None) {
         mResponse->set_return_status(convertError(error));
         return mResponse->return_status();
@@ -248,18 +491,74 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::pr
     return convertError(None);
 }
 
-void SQLiteObjectStorage::ApplyTransactionWorker::operator() () {
-    mResponse = new Protocol::Response;
+SQLiteObjectStorage::ApplyTwoPhaseWorker::ApplyTwoPhaseWorker(SQLiteObjectStorage*parent, Protocol::Minitransaction* mt, const TwoPhaseCommitPtr&decision, const ResultCallback&cb, void (*destroyMinitransaction)(Protocol::Minitransaction*))
+ : ApplyTransactionWorker(parent,mt,cb,destroyMinitransaction),
+   mDecision(decision)
+{
+}
+
+void SQLiteObjectStorage::ApplyTwoPhaseWorker::process() {
+    SQLiteDBPtr db = mParent->mDB;
+    // Take the write lock up front so nothing but the commit itself can
+    // fail once this part has voted
+    bool started = mParent->beginTransaction(db, true);
+    Error error = started ? None : DatabaseLocked;
+    if (error == None) {
+        error = mParent->checkCompareSet(db, *mt);
+        Error read_error = mParent->applyReadSet(db, *mt, *mResponse);
+        if (error == None)
+            error = read_error;
+    }
+    if (error == None)
+        error = mParent->applyWriteSet(db, *mt, 0);
+
+    bool commit = mDecision->vote(error == None);
+    if (started) {
+        if (commit) {
+            bool committed = mParent->commitTransaction(db);
+            for (int tries = 0; !committed && tries < mParent->mRetries; tries++) {
+                ++mParent->mLockedRetries;
+                committed = mParent->commitTransaction(db);
+            }
+            if (!committed) {
+                mParent->rollbackTransaction(db);
+                error = DatabaseLocked;
+            }
+        } else {
+            mParent->rollbackTransaction(db);
+        }
+    }
+    if (error != None)
+        mResponse->set_return_status(convertError(error));
+}
+
+void SQLiteObjectStorage::ApplyTwoPhaseWorker::processBatched() {
+    process();
+}
+
+void SQLiteObjectStorage::ApplyTransactionWorker::process() {
     processTransaction();
+}
+
+void SQLiteObjectStorage::ApplyTransactionWorker::processBatched() {
+    processBatchedTransaction();
+}
+
+void SQLiteObjectStorage::ApplyTransactionWorker::finish() {
     (*mDestroyMinitransaction)(mt);
     cb(mResponse);
     delete this;
 }
 
+void SQLiteObjectStorage::ApplyReadWriteWorker::process() {
+    processReadWrite();
+}
 
-void SQLiteObjectStorage::ApplyReadWriteWorker::operator() () {
-    mResponse = new Protocol::Response;
+void SQLiteObjectStorage::ApplyReadWriteWorker::processBatched() {
     processReadWrite();
+}
+
+void SQLiteObjectStorage::ApplyReadWriteWorker::finish() {
     (*mDestroyReadWrite)(rws);
     cb(mResponse);
     delete this;
@@ -270,25 +569,21 @@ SQLiteObjectStorage::ApplyTransactionMessage::ApplyTransactionMessage(SQLiteObje
     this->mt=mt;
     this->hdr=hdr;
 }
-void SQLiteObjectStorage::ApplyReadWriteMessage::operator() () {
-    Protocol::Response response;
-    mResponse = &response;
-    processReadWrite();
+void SQLiteObjectStorage::ApplyReadWriteMessage::finish() {
     assert(mResponse!=NULL);
     (*mDestroyReadWrite)(rws);
     hdr.swap_source_and_destination();
-    mParent->forward(hdr,response);
+    mParent->forward(hdr,*mResponse);
+    delete mResponse;
     mResponse=NULL;
     delete this;
 }
-void SQLiteObjectStorage::ApplyTransactionMessage::operator() () {
-    Protocol::Response response;
-    mResponse = &response;
-    processTransaction();
+void SQLiteObjectStorage::ApplyTransactionMessage::finish() {
     assert(mResponse!=NULL);
     (*mDestroyMinitransaction)(mt);
     hdr.swap_source_and_destination();
-    mParent->forward(hdr,response);
+    mParent->forward(hdr,*mResponse);
+    delete mResponse;
     mResponse=NULL;
     delete this;
 }
@@ -307,58 +602,59 @@ void SQLiteObjectStorage::handleResult(const EventPtr& evt) const {
     revt->callback()(revt->error());
 }
 */
-void SQLiteObjectStorage::beginTransaction(const SQLiteDBPtr& db) {
-    String begin = "BEGIN DEFERRED TRANSACTION";
-
+bool SQLiteObjectStorage::beginTransaction(const SQLiteDBPtr& db, bool immediate) {
     int rc;
-    char* remain;
-    sqlite3_stmt* begin_stmt;
-
-    rc = sqlite3_prepare_v2(db->db(), begin.c_str(), -1, &begin_stmt, (const char**)&remain);
+    sqlite3_stmt* begin_stmt = db->prepare(immediate ? "BEGIN IMMEDIATE TRANSACTION" : "BEGIN DEFERRED TRANSACTION", &rc);
     SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing begin transaction statement");
 
-    rc = sqlite3_step(begin_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error executing begin statement");
-    rc = sqlite3_finalize(begin_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing begin statement");
+    int step_rc = sqlite3_step(begin_stmt);
+    SQLite::check_sql_error(db->db(), step_rc, NULL, "Error executing begin statement");
+    rc = sqlite3_reset(begin_stmt);
+    SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting begin statement");
+
+    return step_rc == SQLITE_DONE;
 }
 
 void SQLiteObjectStorage::rollbackTransaction(const SQLiteDBPtr& db) {
-    String rollback = "ROLLBACK TRANSACTION";
-
     int rc;
-    char* remain;
-    sqlite3_stmt* rollback_stmt;
-
-    rc = sqlite3_prepare_v2(db->db(), rollback.c_str(), -1, &rollback_stmt, (const char**)&remain);
+    sqlite3_stmt* rollback_stmt = db->prepare("ROLLBACK TRANSACTION", &rc);
     SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing rollback transaction statement");
 
     rc = sqlite3_step(rollback_stmt);
     SQLite::check_sql_error(db->db(), rc, NULL, "Error executing rollback statement");
-    rc = sqlite3_finalize(rollback_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing rollback statement");
+    rc = sqlite3_reset(rollback_stmt);
+    SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting rollback statement");
 }
 
 bool SQLiteObjectStorage::commitTransaction(const SQLiteDBPtr& db) {
-    String commit = "COMMIT TRANSACTION";
-
     int rc;
-    char* remain;
-    sqlite3_stmt* commit_stmt;
-
-    rc = sqlite3_prepare_v2(db->db(), commit.c_str(), -1, &commit_stmt, (const char**)&remain);
+    sqlite3_stmt* commit_stmt = db->prepare("COMMIT TRANSACTION", &rc);
     SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing commit transaction statement");
 
-    rc = sqlite3_step(commit_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error executing commit statement");
-    rc = sqlite3_finalize(commit_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing commit statement");
+    int step_rc = sqlite3_step(commit_stmt);
+    SQLite::check_sql_error(db->db(), step_rc, NULL, "Error executing commit statement");
+    rc = sqlite3_reset(commit_stmt);
+    SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting commit statement");
 
-    return true;
+    return step_rc == SQLITE_DONE;
+}
+
+bool SQLiteObjectStorage::executeStatement(const SQLiteDBPtr& db, const String& sql, const String& what) {
+    int rc;
+    sqlite3_stmt* stmt = db->prepare(sql, &rc);
+    SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing " + what + " statement");
+
+    int step_rc = sqlite3_step(stmt);
+    SQLite::check_sql_error(db->db(), step_rc, NULL, "Error executing " + what + " statement");
+    rc = sqlite3_reset(stmt);
+    SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting " + what + " statement");
+
+    return step_rc == SQLITE_DONE;
 }
 
-template<class StorageKey> String SQLiteObjectStorage::getTableName(const StorageKey& key) {
-    return key.object_uuid().rawHexData();
+template<class StorageKey> int SQLiteObjectStorage::bindObject(sqlite3_stmt* stmt, int index, const StorageKey& key) {
+    UUID object = key.object_uuid();
+    return sqlite3_bind_blob(stmt, index, object.getArray().data(), UUID::static_size, SQLITE_TRANSIENT);
 }
 
 template <class StorageKey> String SQLiteObjectStorage::getKeyName(const StorageKey& key) {
@@ -379,6 +675,7 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::convertError(Error interna
         return Protocol::Response::COMPARISON_FAILED;
         break;
       case DatabaseLocked:
+      case VersionConflict:
         return Protocol::Response::DATABASE_LOCKED;
         break;
       default:
@@ -386,7 +683,7 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::convertError(Error interna
     }
 }
 
-template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyReadSet(const SQLiteDBPtr& db, const ReadSet& rs, Protocol::Response&retval) {
+template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyReadSet(const SQLiteDBPtr& db, const ReadSet& rs, Protocol::Response&retval, ObservedVersions* observed) {
 
     int num_reads=rs.reads_size();
     retval.clear_reads();
@@ -394,41 +691,36 @@ template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyRe
         retval.add_reads();
     SQLiteObjectStorage::Error databaseError=None;
     for (int rs_it=0;rs_it<num_reads;++rs_it) {
-        String object_hex = getTableName(rs.reads(rs_it));
         String key_name = getKeyName(rs.reads(rs_it));
 
-        String value_query = "SELECT value FROM ";
-        value_query += "\"" TABLE_NAME "\"";
-        value_query += " WHERE object == x\'" + object_hex + "\' AND key == ?";
         int rc;
-        char* remain;
-        sqlite3_stmt* value_query_stmt;
         bool newStep=true;
         bool locked=false;
-        rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
+        int64 version=0;
+        sqlite3_stmt* value_query_stmt = db->prepare(VALUE_QUERY, &rc);
         SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value query statement");
         if (rc==SQLITE_OK) {
-            rc = sqlite3_bind_text(value_query_stmt, 1, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
+            rc = bindObject(value_query_stmt, 1, rs.reads(rs_it));
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to value query statement");
+        }
+        if (rc==SQLITE_OK) {
+            rc = sqlite3_bind_text(value_query_stmt, 2, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
             SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value query statement");
             if (rc==SQLITE_OK) {
                 int step_rc = sqlite3_step(value_query_stmt);
                 while(step_rc == SQLITE_ROW) {
                     newStep=false;
                     retval.reads(rs_it).set_data((const char*)sqlite3_column_text(value_query_stmt, 0),sqlite3_column_bytes(value_query_stmt, 0));
+                    version = sqlite3_column_int64(value_query_stmt, 1);
+                    retval.reads(rs_it).set_version((uint64)version);
                     step_rc = sqlite3_step(value_query_stmt);
                 }
-                if (step_rc != SQLITE_DONE) {
-                    // reset the statement so it'll clean up properly
-                    rc = sqlite3_reset(value_query_stmt);
-                    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
-                    if (rc==SQLITE_LOCKED||rc==SQLITE_BUSY)
-                        locked=true;
-                }         
-                
+                if (step_rc == SQLITE_LOCKED||step_rc == SQLITE_BUSY)
+                    locked=true;
             }
         }
-        rc = sqlite3_finalize(value_query_stmt);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
+        rc = sqlite3_reset(value_query_stmt);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting value query statement");
         if (locked||rc == SQLITE_LOCKED||rc==SQLITE_BUSY) {
             retval.clear_reads();
             return DatabaseLocked;
@@ -438,6 +730,8 @@ template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyRe
             retval.reads(rs_it).clear_data();
             retval.reads(rs_it).set_return_status(Protocol::StorageElement::KEY_MISSING);
         }
+        if (observed)
+            observed->push_back(ObservedVersion(rs.reads(rs_it).object_uuid(), key_name, version));
         if(rs.reads(rs_it).has_index()) {
             retval.reads(rs_it).set_index(rs.reads(rs_it).index());
         }
@@ -449,50 +743,106 @@ template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyRe
     return databaseError;
 }
 
+SQLiteObjectStorage::Error SQLiteObjectStorage::applyScanSet(const SQLiteDBPtr& db, const Protocol::ReadWriteSet& rws, Protocol::Response&retval) {
+    int num_scans=rws.scans_size();
+    for (int scan_it=0;scan_it<num_scans;++scan_it) {
+        const String& prefix = rws.scans(scan_it).field_name();
+        // the smallest key past every key starting with prefix, if there is one
+        String upper = prefix;
+        while (!upper.empty() && (unsigned char)upper[upper.size()-1] == 0xff)
+            upper.resize(upper.size()-1);
+        if (!upper.empty())
+            upper[upper.size()-1] = (char)((unsigned char)upper[upper.size()-1]+1);
+
+        bool all_objects = !rws.scans(scan_it).has_object_uuid();
+        int rc;
+        bool locked=false;
+        sqlite3_stmt* scan_stmt = db->prepare(all_objects ? SCAN_ALL_QUERY : SCAN_OBJECT_QUERY, &rc);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing scan statement");
+        int param = 1;
+        if (rc==SQLITE_OK && !all_objects) {
+            rc = bindObject(scan_stmt, param++, rws.scans(scan_it));
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to scan statement");
+        }
+        if (rc==SQLITE_OK) {
+            rc = sqlite3_bind_text(scan_stmt, param++, prefix.data(), (int)prefix.size(), SQLITE_TRANSIENT);
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key prefix to scan statement");
+        }
+        if (rc==SQLITE_OK) {
+            if (upper.empty())
+                rc = sqlite3_bind_zeroblob(scan_stmt, param++, 0);
+            else
+                rc = sqlite3_bind_text(scan_stmt, param++, upper.data(), (int)upper.size(), SQLITE_TRANSIENT);
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key bound to scan statement");
+        }
+        if (rc==SQLITE_OK) {
+            int step_rc = sqlite3_step(scan_stmt);
+            while(step_rc == SQLITE_ROW) {
+                String key_name((const char*)sqlite3_column_text(scan_stmt, 1),sqlite3_column_bytes(scan_stmt, 1));
+                // undo getKeyName
+                String::size_type sep = key_name.rfind('_');
+                uint64 field_id = 0;
+                if (sep != String::npos)
+                    std::istringstream(key_name.substr(sep+1)) >> field_id;
+                if (sep != String::npos && sqlite3_column_bytes(scan_stmt, 0) == (int)UUID::static_size) {
+                    retval.add_reads();
+                    int where = retval.reads_size()-1;
+                    retval.reads(where).set_object_uuid(UUID((const unsigned char*)sqlite3_column_blob(scan_stmt, 0),UUID::static_size));
+                    retval.reads(where).set_field_name(key_name.substr(0, sep));
+                    retval.reads(where).set_field_id(field_id);
+                    retval.reads(where).set_data((const char*)sqlite3_column_text(scan_stmt, 2),sqlite3_column_bytes(scan_stmt, 2));
+                    retval.reads(where).set_version((uint64)sqlite3_column_int64(scan_stmt, 3));
+                    if (rws.scans(scan_it).has_index())
+                        retval.reads(where).set_index(rws.scans(scan_it).index());
+                }
+                step_rc = sqlite3_step(scan_stmt);
+            }
+            if (step_rc == SQLITE_LOCKED||step_rc == SQLITE_BUSY)
+                locked=true;
+        }
+        rc = sqlite3_reset(scan_stmt);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting scan statement");
+        if (locked||rc == SQLITE_LOCKED||rc==SQLITE_BUSY) {
+            retval.clear_reads();
+            return DatabaseLocked;
+        }
+    }
+    return None;
+}
+
 template <class WriteSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyWriteSet(const SQLiteDBPtr& db, const WriteSet& ws, int retries) {
     int num_writes=ws.writes_size();
     for (int ws_it=0;ws_it<num_writes;++ws_it) {
 
-        String object_hex = getTableName(ws.writes(ws_it));
         String key_name = getKeyName(ws.writes(ws_it));
 
         int rc;
-        char* remain;
 
-        // Insert or replace the value
-
-        String value_insert = "INSERT OR REPLACE INTO ";
-        if (!ws.writes(ws_it).has_data()) {
-             value_insert = "DELETE FROM ";
-        }
-        value_insert += "\"" TABLE_NAME "\"";
-        if (!ws.writes(ws_it).has_data()) {
-            value_insert+= " WHERE object = x\'" + object_hex + "\' AND key = ?";
-        }else {
-        //if (ws.writes(ws_it).has_data()) {
-            value_insert += " (object, key, value) VALUES(x\'" + object_hex + "\', ?, ?)";
-            //}
-        }
-        sqlite3_stmt* value_insert_stmt;
-
-        rc = sqlite3_prepare_v2(db->db(), value_insert.c_str(), -1, &value_insert_stmt, (const char**)&remain);
+        // Insert or replace the value, or delete it if no data was given
+        sqlite3_stmt* value_insert_stmt = db->prepare(ws.writes(ws_it).has_data() ? VALUE_INSERT : VALUE_DELETE, &rc);
         SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value insert statement");
 
-        rc = sqlite3_bind_text(value_insert_stmt, 1, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value insert statement");
+        rc = bindObject(value_insert_stmt, 1, ws.writes(ws_it));
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to value insert statement");
+        if (rc==SQLITE_OK) {
+            rc = sqlite3_bind_text(value_insert_stmt, 2, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value insert statement");
+        }
         if (rc==SQLITE_OK) {
             if (ws.writes(ws_it).has_data()) {
-                rc = sqlite3_bind_blob(value_insert_stmt, 2, ws.writes(ws_it).data().data(), (int)ws.writes(ws_it).data().size(), SQLITE_TRANSIENT);
+                rc = sqlite3_bind_blob(value_insert_stmt, 3, ws.writes(ws_it).data().data(), (int)ws.writes(ws_it).data().size(), SQLITE_TRANSIENT);
                 SQLite::check_sql_error(db->db(), rc, NULL, "Error binding value to value insert statement");
+                if (rc==SQLITE_OK) {
+                    rc = sqlite3_bind_int64(value_insert_stmt, 4, (Task::AbsTime::now()-Task::AbsTime::epoch()).toMicroseconds());
+                    SQLite::check_sql_error(db->db(), rc, NULL, "Error binding version to value insert statement");
+                }
             }
         }
 
         int step_rc = sqlite3_step(value_insert_stmt);
-        if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE)
-            sqlite3_reset(value_insert_stmt); // allow this to be cleaned up
 
-        rc = sqlite3_finalize(value_insert_stmt);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value insert statement");
+        rc = sqlite3_reset(value_insert_stmt);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting value insert statement");
         if (step_rc == SQLITE_BUSY || step_rc == SQLITE_LOCKED)
             return DatabaseLocked;
 
@@ -501,25 +851,19 @@ template <class WriteSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyW
     return None;
 }
 
-template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::checkCompareSet(const SQLiteDBPtr& db, const CompareSet& cs) {
+template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::checkCompareSet(const SQLiteDBPtr& db, const CompareSet& cs, ObservedVersions* observed) {
     int num_compares=cs.compares_size();
     for (int cs_it=0;cs_it<num_compares;++cs_it) {
 
-        String object_hex = getTableName(cs.compares(cs_it));
         String key_name = getKeyName(cs.compares(cs_it));
 
-        String value_query = "SELECT value FROM ";
-        value_query += "\"" TABLE_NAME "\"";
-        value_query += " WHERE object == x\'" + object_hex + "\' AND key == ?";
-
         int rc;
-        char* remain;
-        sqlite3_stmt* value_query_stmt;
-
-        rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
+        sqlite3_stmt* value_query_stmt = db->prepare(VALUE_QUERY, &rc);
         SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value query statement");
 
-        rc = sqlite3_bind_text(value_query_stmt, 1, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
+        rc = bindObject(value_query_stmt, 1, cs.compares(cs_it));
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to value query statement");
+        rc = sqlite3_bind_text(value_query_stmt, 2, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
         SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value query statement");
 
         int step_rc = sqlite3_step(value_query_stmt);
@@ -528,7 +872,12 @@ template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::chec
         if (step_rc == SQLITE_ROW) {
             const char *data=(const char*)sqlite3_column_text(value_query_stmt, 0);
             size_t size=sqlite3_column_bytes(value_query_stmt, 0);
-            if(cs.compares(cs_it).has_data()==false) {
+            int64 version=sqlite3_column_int64(value_query_stmt, 1);
+            if (observed)
+                observed->push_back(ObservedVersion(cs.compares(cs_it).object_uuid(), key_name, version));
+            if (cs.compares(cs_it).has_comparator() && cs.compares(cs_it).comparator() == Protocol::CompareElement::VERSION) {
+                passed_test = cs.compares(cs_it).has_version() && cs.compares(cs_it).version() == (uint64)version;
+            } else if(cs.compares(cs_it).has_data()==false) {
                 passed_test=false; 
             } else if (cs.compares(cs_it).has_comparator()==false) {
                 if (cs.compares(cs_it).data().length() != size) passed_test = false;
@@ -550,12 +899,9 @@ template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::chec
                 }
             }
         }
-        else {
-            sqlite3_reset(value_query_stmt); // allow proper clean up
-        }
 
-        rc = sqlite3_finalize(value_query_stmt);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
+        rc = sqlite3_reset(value_query_stmt);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting value query statement");
 
         if (step_rc == SQLITE_BUSY || step_rc == SQLITE_LOCKED)
             return DatabaseLocked;
@@ -571,6 +917,31 @@ template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::chec
     return None;
 }
 
+SQLiteObjectStorage::Error SQLiteObjectStorage::validateVersions(const SQLiteDBPtr& db, const ObservedVersions& observed) {
+    for (ObservedVersions::const_iterator i=observed.begin(),ie=observed.end();i!=ie;++i) {
+        int rc;
+        sqlite3_stmt* version_query_stmt = db->prepare(VERSION_QUERY, &rc);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing version query statement");
+
+        rc = sqlite3_bind_blob(version_query_stmt, 1, i->mObject.getArray().data(), UUID::static_size, SQLITE_TRANSIENT);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to version query statement");
+        rc = sqlite3_bind_text(version_query_stmt, 2, i->mKey.data(), (int)i->mKey.size(), SQLITE_TRANSIENT);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to version query statement");
+
+        int step_rc = sqlite3_step(version_query_stmt);
+        int64 version = (step_rc == SQLITE_ROW) ? sqlite3_column_int64(version_query_stmt, 0) : 0;
+
+        rc = sqlite3_reset(version_query_stmt);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting version query statement");
+
+        if (step_rc == SQLITE_BUSY || step_rc == SQLITE_LOCKED)
+            return DatabaseLocked;
+        if (version != i->mVersion)
+            return VersionConflict;
+    }
+    return None;
+}
+
 Persistence::Protocol::Minitransaction* SQLiteObjectStorage::createMinitransaction(int numReadKeys, int numWriteKeys, int numCompares) {
     Persistence::Protocol::Minitransaction* retval=new Persistence::Protocol::Minitransaction();
     while (numReadKeys--) {
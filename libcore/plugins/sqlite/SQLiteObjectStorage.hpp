@@ -37,6 +37,8 @@
 #include "SQLite.hpp"
 #include "util/RoutableMessageHeader.hpp"
 #include "util/ThreadSafeQueue.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 namespace Sirikata { namespace Persistence {
 
 /** SQLite based object storage.  This class provides both ReadWriteHandler and
@@ -65,6 +67,40 @@ public:
     bool endForwardingMessagesTo(MessageService*);
     void processMessage(const RoutableMessageHeader&,MemoryReference);
     static SQLiteObjectStorage*create(bool transactional,const String&);
+
+    /** Decision shared by the parts of a Minitransaction split over several
+     *  storages.  Each part is staged under its database's write lock, votes,
+     *  and keeps its transaction open until every part has voted.
+     */
+    class TwoPhaseCommit {
+    public:
+        TwoPhaseCommit(int participants):mRemaining(participants),mCommit(true){}
+        /** Records one participant's vote and blocks until all have voted.
+         *  \returns true if every participant voted to commit
+         */
+        bool vote(bool commit);
+    private:
+        boost::mutex mMutex;
+        boost::condition_variable mCondition;
+        int mRemaining;
+        bool mCommit;
+    };
+    typedef std::tr1::shared_ptr<TwoPhaseCommit> TwoPhaseCommitPtr;
+    /** Applies mt as one part of decision on the disk queue.  Parts of the
+     *  same decision must be queued to every storage in the same relative
+     *  order, and each storage needs its own disk thread, or they deadlock.
+     *  cb gets this part's response after the decision was carried out.
+     */
+    void applyTwoPhase(Protocol::Minitransaction* mt, const TwoPhaseCommitPtr& decision, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*));
+
+    /// Number of times a request found the database locked and was applied again.
+    uint32 lockedRetries() const {
+        return mLockedRetries.read();
+    }
+    /// Number of times an OPTIMISTIC Minitransaction found a key it used changed before it could commit, and was applied again.
+    uint32 versionConflicts() const {
+        return mVersionConflicts.read();
+    }
 private:
     std::vector<MessageService*>mInterestedParties;
     OptionSet*mOptions;
@@ -74,51 +110,108 @@ private:
     void forward (RoutableMessageHeader&hdr, Protocol::Response&);
     SQLiteObjectStorage(bool transactional, const String& pl);
 
+    class GroupCommitWorker;
+    /** Common base of the ReadWriteSet and Minitransaction workers.  Applying
+     *  the request and delivering its result are split so a group commit can
+     *  apply a whole batch before any result goes out.
+     */
+    class ApplyWorker:public Task::WorkItem{
+    protected:
+        friend class SQLiteObjectStorage;
+        friend class GroupCommitWorker;
+        SQLiteObjectStorage*mParent;
+        Protocol::Response*mResponse;
+        ///When enqueueApply took the request, null for requests that did not go through it
+        Task::AbsTime mEnqueued;
+        ApplyWorker():mEnqueued(Task::AbsTime::null()){mParent=NULL;mResponse=new Protocol::Response;}
+        /// Applies the request on its own
+        virtual void process()=0;
+        /// Applies the request inside the transaction a group commit has open
+        virtual void processBatched()=0;
+        /// Destroys the request, hands off mResponse and deletes this
+        virtual void finish()=0;
+        /// Records how long the request took since enqueueApply, then finish()es it
+        void complete();
+    public:
+        void operator()();
+    };
+
     /** Worker method which will be executed in another thread to perform the
      *  application of the ReadWriteSet.
      */
-    class ApplyReadWriteWorker:public Task::WorkItem{
+    class ApplyReadWriteWorker:public ApplyWorker{
     protected:
         void (*mDestroyReadWrite)(Protocol::ReadWriteSet*);
-        SQLiteObjectStorage*mParent;
         ResultCallback cb;
         Protocol::ReadWriteSet*rws;
-        Protocol::Response*mResponse;
         Protocol::Response::ReturnStatus processReadWrite();
-        ApplyReadWriteWorker(){rws=NULL;mResponse=NULL;mParent=NULL;}
+        ApplyReadWriteWorker(){rws=NULL;}
+        virtual void process();
+        virtual void processBatched();
+        virtual void finish();
     public:
         ApplyReadWriteWorker(SQLiteObjectStorage*parent, Protocol::ReadWriteSet* rws, const ResultCallback&cb,void (*mDestroyReadWrite)(Protocol::ReadWriteSet*));
-        void operator()();
     };
     class ApplyReadWriteMessage:public ApplyReadWriteWorker{
         RoutableMessageHeader hdr;
+    protected:
+        virtual void finish();
     public:
         ApplyReadWriteMessage(SQLiteObjectStorage*parent, Protocol::ReadWriteSet* rws, const RoutableMessageHeader&hdr,void (*mDestroyReadWrite)(Protocol::ReadWriteSet*));
-        void operator()();
     };
     
     /** Worker method which will be executed in another thread to perform the
      *  application of the Minitransaction.
      */
-    class ApplyTransactionWorker:public Task::WorkItem{
+    class ApplyTransactionWorker:public ApplyWorker{
     protected:
         void (*mDestroyMinitransaction)(Protocol::Minitransaction*);
-        SQLiteObjectStorage*mParent;
         ResultCallback cb;
         Protocol::Minitransaction*mt;
-        Protocol::Response*mResponse;
         Protocol::Response::ReturnStatus processTransaction();
-        ApplyTransactionWorker(){mt=NULL;mResponse=NULL;mParent=NULL;}
+        /// Applies the Minitransaction within a savepoint of the open group transaction
+        Protocol::Response::ReturnStatus processBatchedTransaction();
+        /** Reads and compares without the write lock, then takes it only to
+         *  check the versions of what was seen and to write.
+         */
+        Protocol::Response::ReturnStatus processOptimisticTransaction();
+        ApplyTransactionWorker(){mt=NULL;}
+        virtual void process();
+        virtual void processBatched();
+        virtual void finish();
     public:
         ApplyTransactionWorker(SQLiteObjectStorage*parent, Protocol::Minitransaction* rws, const ResultCallback&cb,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
-        void operator()();
     };
     class ApplyTransactionMessage:public ApplyTransactionWorker{
         RoutableMessageHeader hdr;
+    protected:
+        virtual void finish();
     public:
         ApplyTransactionMessage(SQLiteObjectStorage*parent, Protocol::Minitransaction* rws, const RoutableMessageHeader&,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
+    };
+
+    /** One part of a Minitransaction split by a TwoPhaseCommit. */
+    class ApplyTwoPhaseWorker:public ApplyTransactionWorker{
+        TwoPhaseCommitPtr mDecision;
+    protected:
+        virtual void process();
+        virtual void processBatched();
+    public:
+        ApplyTwoPhaseWorker(SQLiteObjectStorage*parent, Protocol::Minitransaction* mt, const TwoPhaseCommitPtr&decision, const ResultCallback&cb,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
+    };
+
+    /** Drains up to mGroupCommit pending workers and applies them in a single
+     *  database transaction, so they share one commit.  Only one is queued at
+     *  a time; it queues its successor if more work arrived meanwhile.
+     */
+    class GroupCommitWorker:public Task::WorkItem{
+        SQLiteObjectStorage*mParent;
+    public:
+        GroupCommitWorker(SQLiteObjectStorage*parent){mParent=parent;}
         void operator()();
     };
+    /// Hands a worker to the disk queue, or to the pending group commit
+    void enqueueApply(ApplyWorker*worker);
 
     class AddMessageServiceMessage:public Task::WorkItem {
     protected:
@@ -146,27 +239,52 @@ private:
     };
 
 
-    /** Starts a database transaction. */
-    void beginTransaction(const SQLiteDBPtr& db);
+    /** Starts a database transaction.
+     *  \param immediate take the write lock now rather than at the first write
+     *  \returns true if the transaction was started
+     */
+    bool beginTransaction(const SQLiteDBPtr& db, bool immediate=false);
     /** Attempts to commit a database transaction. */
     bool commitTransaction(const SQLiteDBPtr& db);
     /** Roll back a transaction in progress. */
     void rollbackTransaction(const SQLiteDBPtr& db);
+    /** Runs a statement that returns no rows, such as a savepoint operation.
+     *  \returns true if it succeeded
+     */
+    bool executeStatement(const SQLiteDBPtr& db, const String& sql, const String& what);
     enum Error {
         None,
         KeyMissing,
         ComparisonFailed,
-        DatabaseLocked
+        DatabaseLocked,
+        VersionConflict
     };
 
+    /// A key and the version a Minitransaction found it at, 0 if it was missing
+    struct ObservedVersion {
+        UUID mObject;
+        String mKey;
+        int64 mVersion;
+        ObservedVersion(const UUID&object, const String&key, int64 version):mObject(object),mKey(key),mVersion(version){}
+    };
+    typedef std::vector<ObservedVersion> ObservedVersions;
+
     /** Reads values for the keys specified in a ReadSet. This is a suboperation -
      *  it may or may not complete immediately depending on whether a transaction
      *  has been started.
      *  \param db the database connection
      *  \param rs the ReadSet
+     *  \param observed if set, gets the version each key was read at
+     *  \returns an error code or None if there was no error
+     */
+    template <class ReadSet> Error applyReadSet(const SQLiteDBPtr& db, const ReadSet& rs, Protocol::Response&retval, ObservedVersions* observed=NULL);
+    /** Appends every stored field matched by the scans of a ReadWriteSet to
+     *  the reads of retval, after those applyReadSet filled in.
+     *  \param db the database connection
+     *  \param rws the ReadWriteSet holding the scans
      *  \returns an error code or None if there was no error
      */
-    template <class ReadSet> Error applyReadSet(const SQLiteDBPtr& db, const ReadSet& rs, Protocol::Response&retval);
+    Error applyScanSet(const SQLiteDBPtr& db, const Protocol::ReadWriteSet& rws, Protocol::Response&retval);
     /** Writes the <key,value> pairs specified in a WriteSet. This is a suboperation -
      *  it may or may not complete immediately depending on whether a transaction
      *  has been started.
@@ -180,12 +298,19 @@ private:
      *  \returns true if all the values match, false otherwise
      *  \param db the database connection
      *  \param cs the CompareSet
+     *  \param observed if set, gets the version each key was compared at
      *  \returns an error code or None if there was no error
      */
-    template <class CompareSet> Error checkCompareSet(const SQLiteDBPtr& db, const CompareSet& cs);
+    template <class CompareSet> Error checkCompareSet(const SQLiteDBPtr& db, const CompareSet& cs, ObservedVersions* observed=NULL);
+    /** Checks every key is still at the version it was observed at.
+     *  \returns VersionConflict if one changed, or None
+     */
+    Error validateVersions(const SQLiteDBPtr& db, const ObservedVersions& observed);
 
-    /** Helper method to extract the database table name from a storage key. */
-    template <class StorageKey> String getTableName(const StorageKey& key);
+    /** Helper method to bind the object a storage key refers to as parameter
+     *  index of stmt.  \returns the sqlite result code of the bind
+     */
+    template <class StorageKey> int bindObject(sqlite3_stmt* stmt, int index, const StorageKey& key);
     /** Helper method to extract the key within a database table for a storage
      *   key.
      */
@@ -199,6 +324,13 @@ private:
     SQLiteDBPtr mDB;
     int mRetries;
     int mBusyTimeout; // locked database timeout in milliseconds
+    AtomicValue<uint32> mLockedRetries;
+    AtomicValue<uint32> mVersionConflicts;
+
+    uint32 mGroupCommit; // most requests applied per transaction, 1 disables grouping
+    boost::mutex mGroupMutex;
+    std::deque<ApplyWorker*> mGroupPending;
+    bool mGroupScheduled; // a GroupCommitWorker is queued or running
 };
 
 } }// namespace Sirikata::Persistence
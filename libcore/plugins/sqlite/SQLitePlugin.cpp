@@ -31,15 +31,19 @@
  */
 
 #include <util/Platform.hpp>
+#include <util/PluginManager.hpp>
 #include <boost/thread.hpp>
 #include "persistence/ObjectStorage.hpp"
 #include "persistence/MinitransactionHandlerFactory.hpp"
 #include "persistence/ReadWriteHandlerFactory.hpp"
 #include "SQLite_Persistence.pbj.hpp"
 #include "SQLiteObjectStorage.hpp"
+#include "SQLiteShardedStorage.hpp"
+#include "CachingReadWriteHandler.hpp"
+#include "ReplicatedReadWriteHandler.hpp"
 static int core_plugin_refcount = 0;
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     using namespace Sirikata;
     if (core_plugin_refcount==0) {
         using std::tr1::placeholders::_1;
@@ -51,19 +55,35 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
             .registerConstructor("sqlite",
                                  std::tr1::bind(&Persistence::SQLiteObjectStorage::create,false,_1),
                                  true);
+        Persistence::MinitransactionHandlerFactory::getSingleton()
+            .registerConstructor("sqlitesharded",
+                                 std::tr1::bind(&Persistence::SQLiteShardedStorage::create,true,_1),
+                                 false);
+        Persistence::ReadWriteHandlerFactory::getSingleton()
+            .registerConstructor("sqlitesharded",
+                                 std::tr1::bind(&Persistence::SQLiteShardedStorage::create,false,_1),
+                                 false);
+        Persistence::ReadWriteHandlerFactory::getSingleton()
+            .registerConstructor("sqlitecache",
+                                 &Persistence::CachingReadWriteHandler::create,
+                                 false);
+        Persistence::ReadWriteHandlerFactory::getSingleton()
+            .registerConstructor("sqlitereplicated",
+                                 &Persistence::ReplicatedReadWriteHandler::create,
+                                 false);
     }
     core_plugin_refcount++;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
     return ++core_plugin_refcount;
 }
-SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
     assert(core_plugin_refcount>0);
     return --core_plugin_refcount;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     using namespace Sirikata;
     if (core_plugin_refcount>0) {
         core_plugin_refcount--;
@@ -71,13 +91,19 @@ SIRIKATA_PLUGIN_EXPORT_C void destroy() {
         if (core_plugin_refcount==0) {
             Persistence::MinitransactionHandlerFactory::getSingleton().unregisterConstructor("sqlite",true);
             Persistence::ReadWriteHandlerFactory::getSingleton().unregisterConstructor("sqlite",true);
+            Persistence::MinitransactionHandlerFactory::getSingleton().unregisterConstructor("sqlitesharded",false);
+            Persistence::ReadWriteHandlerFactory::getSingleton().unregisterConstructor("sqlitesharded",false);
+            Persistence::ReadWriteHandlerFactory::getSingleton().unregisterConstructor("sqlitecache",false);
+            Persistence::ReadWriteHandlerFactory::getSingleton().unregisterConstructor("sqlitereplicated",false);
         }
     }
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "sqlite";
 }
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(sqlite)
@@ -0,0 +1,331 @@
+/*  Sirikata -- SQLite plugin -- Persistence Services
+ *  SQLiteShardedStorage.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <util/Platform.hpp>
+#include "options/Options.hpp"
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include "SQLite_Persistence.pbj.hpp"
+#include "SQLiteShardedStorage.hpp"
+
+namespace Sirikata { namespace Persistence {
+
+namespace {
+template <class StorageSet> void destroyPart(StorageSet*part) {
+    delete part;
+}
+template <class StorageSet> StorageSet* partFor(std::vector<StorageSet*>& parts, size_t shard, const StorageSet& whole) {
+    if (parts[shard]==NULL) {
+        parts[shard]=new StorageSet();
+        if (whole.has_options())
+            parts[shard]->set_options(whole.options());
+    }
+    return parts[shard];
+}
+template <class StorageSet> int countParts(const std::vector<StorageSet*>& parts) {
+    int count=0;
+    for (size_t i=0;i<parts.size();++i)
+        if (parts[i])
+            ++count;
+    return count;
+}
+/// Puts shard in the single shard seen so far, \returns false if that was another one
+bool sameShard(size_t shard, size_t& seen, size_t none) {
+    if (seen==none)
+        seen=shard;
+    return seen==shard;
+}
+}
+
+class SQLiteShardedStorage::SplitRequest {
+public:
+    SplitRequest(SQLiteShardedStorage*parent, const ResultCallback&cb, int numReads)
+     : mParent(parent),
+       mCallback(cb),
+       mRemaining(0),
+       mResponse(new Protocol::Response),
+       mReadOrigins(parent->mShards.size())
+    {
+        while (numReads--)
+            mResponse->add_reads();
+    }
+    void partResult(size_t shard, Protocol::Response*resp);
+
+    SQLiteShardedStorage*mParent;
+    ResultCallback mCallback;
+    boost::mutex mMutex;
+    int mRemaining;
+    Protocol::Response*mResponse;
+    /// For each shard, the read of the whole request each of its reads came from
+    std::vector<std::vector<int> > mReadOrigins;
+};
+
+void SQLiteShardedStorage::SplitRequest::partResult(size_t shard, Protocol::Response*resp) {
+    bool done;
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        const std::vector<int>&origins=mReadOrigins[shard];
+        for (int i=0;i<resp->reads_size();++i) {
+            int where;
+            if (i<(int)origins.size()) {
+                where=origins[i];
+            } else {
+                // past the reads come the rows the scans found, in no particular order across shards
+                where=mResponse->reads_size();
+                mResponse->add_reads();
+            }
+            copyStorageElement(mResponse->mutable_reads(where),resp->reads(i));
+            if (resp->reads(i).has_index())
+                mResponse->mutable_reads(where).set_index(resp->reads(i).index());
+            if (resp->reads(i).has_return_status())
+                mResponse->mutable_reads(where).set_return_status(resp->reads(i).return_status());
+        }
+        // the first part to fail decides the status of the whole request
+        if (resp->has_return_status()&&resp->return_status()!=Protocol::Response::SUCCESS
+            &&(!mResponse->has_return_status()||mResponse->return_status()==Protocol::Response::SUCCESS))
+            mResponse->set_return_status(resp->return_status());
+        done=(--mRemaining==0);
+    }
+    mParent->mShards[shard]->destroyResponse(resp);
+    if (done)
+        mCallback(mResponse);
+}
+
+SQLiteShardedStorage*SQLiteShardedStorage::create(bool t, const String&s){
+    return new SQLiteShardedStorage(t,s);
+}
+
+SQLiteShardedStorage::SQLiteShardedStorage(bool transactional, const String& pl)
+ : mTransactional(transactional)
+{
+    OptionValue*databaseFile;
+    OptionValue*numShards;
+    OptionValue*shardOptions;
+    unsigned char * epoch=NULL;
+    static AtomicValue<int> counter(0);
+    int handle_offset=counter++;
+    InitializeClassOptions("sqlitesharded",epoch+handle_offset,
+                           databaseFile=new OptionValue("databasefile","",OptionValueType<String>(),"Sets the database to be used for storage, shard i is kept in databasefile.i"),
+                           numShards=new OptionValue("shards","4",OptionValueType<uint32>(),"Number of database files, each with its own disk thread, to spread objects over"),
+                           shardOptions=new OptionValue("shardoptions","",OptionValueType<String>(),"Options passed on to the sqlite storage of each shard, e.g. --shardoptions=\"--groupcommit 8\""),NULL);
+    (mOptions=OptionSet::getOptions("sqlitesharded",epoch+handle_offset))->parse(pl);
+
+    String databaseName=databaseFile->as<String>();
+    assert( !databaseName.empty() );
+    uint32 shards=numShards->as<uint32>();
+    if (shards==0)
+        shards=1;
+    for (uint32 i=0;i<shards;++i) {
+        mShards.push_back(SQLiteObjectStorage::create(transactional,
+            "--databasefile "+databaseName+"."+boost::lexical_cast<String>(i)+" "+shardOptions->as<String>()));
+    }
+}
+
+SQLiteShardedStorage::~SQLiteShardedStorage() {
+    for (size_t i=0;i<mShards.size();++i)
+        delete mShards[i];
+}
+
+template <class StorageKey> size_t SQLiteShardedStorage::shardFor(const StorageKey& key) const {
+    return key.object_uuid().hash()%mShards.size();
+}
+
+template <class StorageSet> bool SQLiteShardedStorage::singleShard(const StorageSet& set, size_t& shard) const {
+    for (int i=0;i<set.reads_size();++i)
+        if (!sameShard(shardFor(set.reads(i)),shard,mShards.size()))
+            return false;
+    for (int i=0;i<set.writes_size();++i)
+        if (!sameShard(shardFor(set.writes(i)),shard,mShards.size()))
+            return false;
+    return true;
+}
+
+template <class StorageSet> void SQLiteShardedStorage::splitReads(const StorageSet& set, std::vector<StorageSet*>& parts, SplitRequest& request) const {
+    for (int i=0;i<set.reads_size();++i) {
+        size_t shard=shardFor(set.reads(i));
+        StorageSet*part=partFor(parts,shard,set);
+        part->add_reads();
+        int where=part->reads_size()-1;
+        copyStorageElement(part->mutable_reads(where),set.reads(i));
+        if (set.reads(i).has_index())
+            part->mutable_reads(where).set_index(set.reads(i).index());
+        request.mReadOrigins[shard].push_back(i);
+    }
+}
+
+void SQLiteShardedStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*mt, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    using std::tr1::placeholders::_1;
+    applyInternal(mt,std::tr1::bind(&SQLiteShardedStorage::forward,this,rmh,_1),destroyMinitransaction);
+}
+
+void SQLiteShardedStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*rws, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    using std::tr1::placeholders::_1;
+    applyInternal(rws,std::tr1::bind(&SQLiteShardedStorage::forward,this,rmh,_1),destroyReadWriteSet);
+}
+
+void SQLiteShardedStorage::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    assert(mTransactional == false);
+    using std::tr1::placeholders::_1;
+
+    size_t shard=mShards.size();
+    bool single=singleShard(*rws,shard);
+    for (int i=0;single&&i<rws->scans_size();++i) {
+        if (rws->scans(i).has_object_uuid())
+            single=sameShard(shardFor(rws->scans(i)),shard,mShards.size());
+        else
+            single=(mShards.size()==1);
+    }
+    if (single) {
+        // the common case: hand the request over untouched
+        mShards[shard==mShards.size()?0:shard]->applyInternal(rws,cb,destroyReadWriteSet);
+        return;
+    }
+
+    std::vector<Protocol::ReadWriteSet*> parts(mShards.size(),(Protocol::ReadWriteSet*)NULL);
+    SplitRequestPtr request(new SplitRequest(this,cb,rws->reads_size()));
+    splitReads(*rws,parts,*request);
+    for (int i=0;i<rws->writes_size();++i) {
+        Protocol::ReadWriteSet*part=partFor(parts,shardFor(rws->writes(i)),*rws);
+        part->add_writes();
+        copyStorageElement(part->mutable_writes(part->writes_size()-1),rws->writes(i));
+    }
+    for (int i=0;i<rws->scans_size();++i) {
+        size_t first=0, last=mShards.size();
+        if (rws->scans(i).has_object_uuid()) {
+            first=shardFor(rws->scans(i));
+            last=first+1;
+        }
+        for (size_t j=first;j<last;++j) {
+            Protocol::ReadWriteSet*part=partFor(parts,j,*rws);
+            part->add_scans();
+            copyStorageElement(part->mutable_scans(part->scans_size()-1),rws->scans(i));
+            if (rws->scans(i).has_index())
+                part->mutable_scans(part->scans_size()-1).set_index(rws->scans(i).index());
+        }
+    }
+
+    (*destroyReadWriteSet)(rws);
+
+    request->mRemaining=countParts(parts);
+    for (size_t i=0;i<parts.size();++i) {
+        if (parts[i])
+            mShards[i]->applyInternal(parts[i],std::tr1::bind(&SplitRequest::partResult,request,i,_1),&destroyPart<Protocol::ReadWriteSet>);
+    }
+}
+
+void SQLiteShardedStorage::applyInternal(Protocol::Minitransaction* mt, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    assert(mTransactional == true);
+    using std::tr1::placeholders::_1;
+
+    size_t shard=mShards.size();
+    bool single=singleShard(*mt,shard);
+    for (int i=0;single&&i<mt->compares_size();++i)
+        single=sameShard(shardFor(mt->compares(i)),shard,mShards.size());
+    if (single) {
+        mShards[shard==mShards.size()?0:shard]->applyInternal(mt,cb,destroyMinitransaction);
+        return;
+    }
+
+    std::vector<Protocol::Minitransaction*> parts(mShards.size(),(Protocol::Minitransaction*)NULL);
+    SplitRequestPtr request(new SplitRequest(this,cb,mt->reads_size()));
+    splitReads(*mt,parts,*request);
+    for (int i=0;i<mt->writes_size();++i) {
+        Protocol::Minitransaction*part=partFor(parts,shardFor(mt->writes(i)),*mt);
+        part->add_writes();
+        copyStorageElement(part->mutable_writes(part->writes_size()-1),mt->writes(i));
+    }
+    for (int i=0;i<mt->compares_size();++i) {
+        Protocol::Minitransaction*part=partFor(parts,shardFor(mt->compares(i)),*mt);
+        part->add_compares();
+        copyCompareElement(part->mutable_compares(part->compares_size()-1),mt->compares(i));
+    }
+
+    (*destroyMinitransaction)(mt);
+
+    int count=countParts(parts);
+    request->mRemaining=count;
+    SQLiteObjectStorage::TwoPhaseCommitPtr decision(new SQLiteObjectStorage::TwoPhaseCommit(count));
+    boost::mutex::scoped_lock lock(mTwoPhaseMutex);
+    for (size_t i=0;i<parts.size();++i) {
+        if (parts[i])
+            mShards[i]->applyTwoPhase(parts[i],decision,std::tr1::bind(&SplitRequest::partResult,request,i,_1),&destroyPart<Protocol::Minitransaction>);
+    }
+}
+
+void SQLiteShardedStorage::destroyResponse(Persistence::Protocol::Response*res) {
+    delete res;
+}
+
+bool SQLiteShardedStorage::forwardMessagesTo(MessageService*ms) {
+    boost::mutex::scoped_lock lock(mInterestedMutex);
+    mInterestedParties.push_back(ms);
+    return true;
+}
+
+bool SQLiteShardedStorage::endForwardingMessagesTo(MessageService*ms) {
+    boost::mutex::scoped_lock lock(mInterestedMutex);
+    mInterestedParties.erase(std::remove(mInterestedParties.begin(),mInterestedParties.end(),ms),mInterestedParties.end());
+    return true;
+}
+
+void SQLiteShardedStorage::processMessage(const RoutableMessageHeader&hdr,MemoryReference ref) {
+    if (mTransactional) {
+        Protocol::Minitransaction *trans=new Protocol::Minitransaction();
+        if (trans->ParseFromArray(ref.data(),ref.size()))
+            transactMessage(hdr,trans);
+        else
+            delete trans;
+    }else {
+        Protocol::ReadWriteSet *rws=new Protocol::ReadWriteSet();
+        if (rws->ParseFromArray(ref.data(),ref.size()))
+            applyMessage(hdr,rws);
+        else
+            delete rws;
+    }
+}
+
+void SQLiteShardedStorage::forward(RoutableMessageHeader hdr, Protocol::Response*resp) {
+    hdr.swap_source_and_destination();
+    String databuf;
+    resp->SerializeToString(&databuf);
+    MemoryReference membuf(databuf);
+    {
+        boost::mutex::scoped_lock lock(mInterestedMutex);
+        for (std::vector<MessageService*>::iterator i=mInterestedParties.begin(),ie=mInterestedParties.end();
+             i!=ie;
+             ++i) {
+            (*i)->processMessage(hdr,membuf);
+        }
+    }
+    destroyResponse(resp);
+}
+
+} }// namespace Sirikata::Persistence
@@ -0,0 +1,104 @@
+/*  Sirikata -- SQLite plugin -- Persistence Services
+ *  SQLiteShardedStorage.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SQLITE_SHARDED_STORAGE_HPP_
+#define _SQLITE_SHARDED_STORAGE_HPP_
+
+#include "SQLiteObjectStorage.hpp"
+
+namespace Sirikata { namespace Persistence {
+
+/** Object storage spreading objects over several SQLiteObjectStorages, each
+ *  with its own database file and disk thread, so writers to different objects
+ *  don't contend on one database lock.  Keys go to the shard their object UUID
+ *  hashes to.  Requests touching a single shard are handed straight to it;
+ *  ReadWriteSets spanning shards are split and their responses merged, and
+ *  Minitransactions spanning shards are split under a two phase commit.
+ *
+ *  Shard i of databasefile is stored in databasefile.i.  Atomicity across
+ *  shards holds as long as no shard fails its commit after the vote, which
+ *  SQLite only allows if the disk fails or a reader holds the database past
+ *  every retry.
+ */
+class SQLiteShardedStorage : public ReadWriteHandler, public MinitransactionHandler {
+public:
+    static SQLiteShardedStorage*create(bool transactional,const String&);
+    virtual ~SQLiteShardedStorage();
+
+    virtual void destroyResponse(Persistence::Protocol::Response*);
+
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*, void(*minitransactionDestruction)(Protocol::Minitransaction*));
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*,void(*)(Protocol::ReadWriteSet*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::Minitransaction*, const ResultCallback&, void(*minitransactionDestruction)(Protocol::Minitransaction*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::ReadWriteSet*, const ResultCallback&,void(*)(Protocol::ReadWriteSet*));
+
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&,MemoryReference);
+private:
+    SQLiteShardedStorage(bool transactional, const String& pl);
+
+    /** Collects the responses of the parts a request was split into, and
+     *  delivers the merged response once the last one is in.
+     */
+    class SplitRequest;
+    typedef std::tr1::shared_ptr<SplitRequest> SplitRequestPtr;
+
+    /** \returns the shard holding the object of key */
+    template <class StorageKey> size_t shardFor(const StorageKey& key) const;
+    /** \returns true if the reads and writes of set all belong to one shard,
+     *  which is stored in shard unless set is empty.
+     *  \param shard in: mShards.size() or a shard the caller already saw
+     */
+    template <class StorageSet> bool singleShard(const StorageSet& set, size_t& shard) const;
+    /** Splits the reads of set over parts, which are created on demand, and
+     *  records where each read came from in request.
+     */
+    template <class StorageSet> void splitReads(const StorageSet& set, std::vector<StorageSet*>& parts, SplitRequest& request) const;
+    /** Sends the response of a request that arrived as a message to every
+     *  interested MessageService, then destroys it.
+     */
+    void forward(RoutableMessageHeader hdr, Protocol::Response*resp);
+
+    bool mTransactional;
+    OptionSet*mOptions;
+    std::vector<SQLiteObjectStorage*> mShards;
+    /// Held while queuing the parts of a Minitransaction, so every shard sees them in the same order
+    boost::mutex mTwoPhaseMutex;
+    boost::mutex mInterestedMutex;
+    std::vector<MessageService*> mInterestedParties;
+};
+
+} }// namespace Sirikata::Persistence
+
+
+#endif //_SQLITE_SHARDED_STORAGE_HPP_
@@ -48,6 +48,7 @@ void ASIOConnectAndHandshake::checkHeaderContents(unsigned int whichSocket,
     if (connection) {
         if (mFinishedCheckCount==(int)connection->numSockets()) {
             mFirstReceivedHeader=*buffer;
+            connection->setPeerInflates((*buffer)[TCPStream::STRING_PREFIX_LENGTH]>='0'+TCPStream::TcpSstHeaderCompressionFlag);
         }
         if (mFinishedCheckCount>=1) {
             if (mFirstReceivedHeader!=*buffer) {
@@ -108,7 +109,8 @@ void ASIOConnectAndHandshake::connectToIPAddress(const std::tr1::shared_ptr<ASIO
         connection->getASIOSocketWrapper(whichSocket)
             .sendProtocolHeader(connection,
                                 thus->mHeaderUUID,
-                                connection->numSockets());
+                                connection->numSockets(),
+                                MultiplexedSocket::canInflate());
         Array<uint8,TCPStream::TcpSstHeaderSize> *header=new Array<uint8,TCPStream::TcpSstHeaderSize>;
         boost::asio::async_read(connection->getASIOSocketWrapper(whichSocket).getSocket(),
                                 boost::asio::buffer(header->begin(),TCPStream::TcpSstHeaderSize),
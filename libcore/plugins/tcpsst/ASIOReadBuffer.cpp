@@ -34,10 +34,14 @@
 #include "network/TCPDefinitions.hpp"
 #include "TCPStream.hpp"
 #include "util/ThreadSafeQueue.hpp"
+#include "util/Metrics.hpp"
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 #include "ASIOReadBuffer.hpp"
 namespace Sirikata { namespace Network {
+namespace {
+Metrics::Counter sBytesReceived("tcpsst.bytes_received","bytes read from tcpsst sockets");
+}
 void MakeASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket) {
     new ASIOReadBuffer(parentSocket,whichSocket);
 }
@@ -106,9 +110,8 @@ void ASIOReadBuffer::translateBuffer(const std::tr1::shared_ptr<MultiplexedSocke
                 }
             }else {
                 uint32 chunkLength=packetLength.read();
-                Chunk resultChunk;
-                Stream::StreamID resultID=processPartialChunk(mBuffer+chunkPos+packetHeaderLength,packetLength.read(),chunkLength,resultChunk);
-                processFullChunk(thus,mWhichBuffer,resultID,resultChunk);
+                Stream::StreamID resultID=processPartialChunk(mBuffer+chunkPos+packetHeaderLength,packetLength.read(),chunkLength,mSmallChunk);
+                processFullChunk(thus,mWhichBuffer,resultID,mSmallChunk);
                 chunkPos+=packetHeaderLength+packetLength.read();
             }
         }
@@ -124,6 +127,7 @@ void ASIOReadBuffer::translateBuffer(const std::tr1::shared_ptr<MultiplexedSocke
 void ASIOReadBuffer::asioReadIntoChunk(const ErrorCode&error,std::size_t bytes_read){
     TCPSSTLOG(this,"rcv",&mNewChunk[mBufferPos],bytes_read,error);
     mBufferPos+=bytes_read;
+    sBytesReceived.add(bytes_read);
     std::tr1::shared_ptr<MultiplexedSocket> thus(mParentSocket.lock());
     
     if (thus) {
@@ -148,6 +152,7 @@ void ASIOReadBuffer::asioReadIntoChunk(const ErrorCode&error,std::size_t bytes_r
 void ASIOReadBuffer::asioReadIntoFixedBuffer(const ErrorCode&error,std::size_t bytes_read){
     TCPSSTLOG(this,"rcv",&mBuffer[mBufferPos],bytes_read,error);
     mBufferPos+=bytes_read;
+    sBytesReceived.add(bytes_read);
     std::tr1::shared_ptr<MultiplexedSocket> thus(mParentSocket.lock());
     
     if (thus) {
@@ -47,6 +47,8 @@ class ASIOReadBuffer {
     unsigned int mWhichBuffer;
     ///A new chunk being read directly into--usually this member is only used to hold a large packet of information, otherwise the fixed length buffer is used
     Chunk mNewChunk;
+    ///Reused to hand small packets out of mBuffer to processFullChunk, so its capacity persists and steady state receives do not allocate
+    Chunk mSmallChunk;
     ///The StreamID of a new, partially examined new chunk
     Stream::StreamID mNewChunkID;
     ///The shared structure responsible for holding state about the associated TCPStream that this class reads and interprets data from
@@ -86,7 +88,7 @@ class ASIOReadBuffer {
      * \param dataBuffer is the buffer to be read and turned into an active Chunk
      * \param packetLength is the length of the to-be-returned Chunk plus the length of that chunk's streamID
      * \param bufferReceived is the length of the dataBuffer, and the value returned in the bufferReceived is number of useful bytes copied to the returned chunk
-     * \param retval is the newly allocated chunk sized appropriately to hold all data that will ever be copied to it
+     * \param retval is resized appropriately to hold all data that will ever be copied to it (its existing capacity is reused)
      * \returns the StreamID that this chunk was sent from
      */
     Stream::StreamID processPartialChunk(uint8* dataBuffer, uint32 packetLength, uint32 &bufferReceived, Chunk&retval);
@@ -35,10 +35,15 @@
 #include "network/TCPDefinitions.hpp"
 #include "TCPStream.hpp"
 #include "util/ThreadSafeQueue.hpp"
+#include "util/Metrics.hpp"
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 
 namespace Sirikata { namespace Network {
+namespace {
+Metrics::Counter sBytesSent("tcpsst.bytes_sent","bytes written to tcpsst sockets");
+Metrics::Gauge sQueuedPackets("tcpsst.queued_packets","packets waiting for the send in progress on their socket to finish");
+}
 
 void ASIOLogBuffer(void * pointerkey, const char extension[16], const uint8* buffer, size_t buffersize){
     char filename[1024];
@@ -48,9 +53,9 @@ void ASIOLogBuffer(void * pointerkey, const char extension[16], const uint8* buf
     fclose(fp);
     
 }
-void copyHeader(void * destination, const UUID&key, unsigned int num) {
+void copyHeader(void * destination, const UUID&key, unsigned int num, bool offerCompression) {
     std::memcpy(destination,TCPStream::STRING_PREFIX(),TCPStream::STRING_PREFIX_LENGTH);
-    ((char*)destination)[TCPStream::STRING_PREFIX_LENGTH]='0'+(num/10)%10;
+    ((char*)destination)[TCPStream::STRING_PREFIX_LENGTH]='0'+(num/10)%10+(offerCompression?TCPStream::TcpSstHeaderCompressionFlag:0);
     ((char*)destination)[TCPStream::STRING_PREFIX_LENGTH+1]='0'+(num%10);
     std::memcpy(((char*)destination)+TCPStream::STRING_PREFIX_LENGTH+2,
                 key.getArray().begin(),
@@ -62,101 +67,79 @@ void ASIOSocketWrapper::finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSo
     assert(mSendingStatus.read()&ASYNCHRONOUS_SEND_FLAG);
     //Turn on the information that the queue is being checked and this means that further pushes to the queue may not be heeded if the queue happened to be empty
     mSendingStatus+=QUEUE_CHECK_FLAG;
-    std::deque<Chunk*>toSend;
+    std::deque<FairSendQueue::Item>toSend;
     mSendQueue.swap(toSend);
-    std::size_t num_packets=toSend.size();
-    if (num_packets==0) {
+    scheduleSends(toSend);
+    if (mScheduledSends.empty()) {
         //if there are no packets in the queue, some other send() operation will need to take the torch to send further packets
         mSendingStatus-=(ASYNCHRONOUS_SEND_FLAG+QUEUE_CHECK_FLAG);
     }else {
         //there are packets in the queue, now is the chance to send them out, so get rid of the queue check flag since further items *will* be checked from the queue as soon as the
         //send finishes
         mSendingStatus-=QUEUE_CHECK_FLAG;
-        if (num_packets==1)
-            sendToWire(parentMultiSocket,toSend.front());
-        else
-            sendToWire(parentMultiSocket,toSend);
+        sendScheduled(parentMultiSocket);
+    }
+}
+void ASIOSocketWrapper::scheduleSends(const std::deque<FairSendQueue::Item>&toSchedule) {
+    for (std::deque<FairSendQueue::Item>::const_iterator i=toSchedule.begin(),ie=toSchedule.end();i!=ie;++i) {
+        mScheduledSends.push(*i);
     }
 }
+void ASIOSocketWrapper::sendScheduled(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket) {
+    std::deque<FairSendQueue::Packet>toSend;
+    mScheduledSends.pop(toSend,MAX_GATHERED_BUFFERS);
+    sQueuedPackets.add(-(int64)toSend.size());
+    if (toSend.size()==1&&!toSend.front().mPayload)
+        sendToWire(parentMultiSocket,toSend.front().mChunk);
+    else
+        sendToWire(parentMultiSocket,toSend);
+}
 void ASIOSocketWrapper::sendLargeChunkItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
     TCPSSTLOG(this,"snd",&*toSend->begin()+originalOffset,bytes_sent,error);
     if (error)  {
         triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
         SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
     }else if (bytes_sent+originalOffset!=toSend->size()) {
+        sBytesSent.add(bytes_sent);
+        parentMultiSocket->removeQueuedSendBytes(bytes_sent);
         sendToWire(parentMultiSocket,toSend,originalOffset+bytes_sent);
     }else {
-        delete toSend;
+        sBytesSent.add(bytes_sent);
+        parentMultiSocket->removeQueuedSendBytes(bytes_sent);
+        parentMultiSocket->releaseChunk(toSend);
         finishAsyncSend(parentMultiSocket);
     }
 }
 
-void ASIOSocketWrapper::sendLargeDequeItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
-    TCPSSTLOG(this,"snd",&*const_toSend.front()->begin()+originalOffset,bytes_sent,error);
+void ASIOSocketWrapper::sendDequeItems(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<FairSendQueue::Packet> &const_toSend, size_t firstPacketOffset, const ErrorCode &error, std::size_t bytes_sent) {
     if (error )   {
         triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
         SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
-    } else if (bytes_sent+originalOffset!=const_toSend.front()->size()) {
-        sendToWire(parentMultiSocket,const_toSend,originalOffset+bytes_sent);
-    }else if (const_toSend.size()<2) {
-        //the entire packet got sent and there's no more items left: delete the front item
-        delete const_toSend.front();
-        //and send further items on the global queue if they are there
-        finishAsyncSend(parentMultiSocket);
     }else {
-        std::deque<Chunk*> toSend=const_toSend;
-        //the first item got sent out
-        delete toSend.front();
-        toSend.pop_front();
-        if (toSend.size()==1) {
-            //if there's just one item left, it may be sent by itself
-            sendToWire(parentMultiSocket,toSend.front());
-        }else {
-            //otherwise send the whole queue
-            sendToWire(parentMultiSocket,toSend);
+        mCoalescedBytes+=bytes_sent;
+        sBytesSent.add(bytes_sent);
+        parentMultiSocket->removeQueuedSendBytes(bytes_sent);
+        std::deque<FairSendQueue::Packet> toSend=const_toSend;
+        //release every packet that made it out entirely: shared payloads are let go along with the deque entry
+        while (!toSend.empty()&&toSend.front().size()-firstPacketOffset<=bytes_sent) {
+            bytes_sent-=toSend.front().size()-firstPacketOffset;
+            firstPacketOffset=0;
+            parentMultiSocket->releaseChunk(toSend.front().mChunk);
+            toSend.pop_front();
         }
-    }
-}
-#define ASIOSocketWrapperBuffer(pointer,size) boost::asio::buffer(pointer,(size))
-void ASIOSocketWrapper::sendStaticBuffer(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&toSend, uint8* currentBuffer, size_t bufferSize, size_t lastChunkOffset,  const ErrorCode &error, std::size_t bytes_sent) {
-    TCPSSTLOG(this,"snd",current_buffer,bytes_sent,error);
-    if (!error) {
-        //mPacketLogger.insert(mPacketLogger.end(),currentBuffer,currentBuffer+bytes_sent);
-    }
-    if ( error ) {
-        triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
-        SILOG(tcpsst,insane,"Socket disconnected...waiting for recv to trigger error condition\n");
-    }else if (bytes_sent!=bufferSize) {
-		 
-		 
-        //if the previous send was not able to push the whole buffer out to the network, the rest must be sent
-        mSocket->async_send(ASIOSocketWrapperBuffer(currentBuffer+bytes_sent,bufferSize-bytes_sent),
-                            std::tr1::bind(&ASIOSocketWrapper::sendStaticBuffer,
-                                        this,
-                                        parentMultiSocket,
-                                        toSend,
-                                        currentBuffer+bytes_sent,
-                                        bufferSize-bytes_sent,
-                                        lastChunkOffset,
-                                          _1,
-                                          _2));        
-    }else {
-        if (!toSend.empty()) {
-            //if stray items are left in a deque
-            if (toSend.size()==1) {
-                //if there's one item send that
-                sendToWire(parentMultiSocket,toSend.front(),lastChunkOffset);
-            }else {
-                //otherwise send the whole lot
-                sendToWire(parentMultiSocket,toSend,lastChunkOffset);
-            }
-        }else {
-            //no items to send, check the new queue for any more and send those, otherwise sleep
+        if (toSend.empty()) {
+            //and send further items on the global queue if they are there
             finishAsyncSend(parentMultiSocket);
+        }else if (toSend.size()==1&&!toSend.front().mPayload) {
+            //if there's just one plain chunk left, it may be sent by itself
+            sendToWire(parentMultiSocket,toSend.front().mChunk,firstPacketOffset+bytes_sent);
+        }else {
+            //otherwise send the rest of the queue, starting partway into the front packet
+            sendToWire(parentMultiSocket,toSend,firstPacketOffset+bytes_sent);
         }
     }
 }
-    
+#define ASIOSocketWrapperBuffer(pointer,size) boost::asio::buffer(pointer,(size))
 
 void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t bytesSent) {
     //sending a single chunk is a straightforward call directly to asio
@@ -172,53 +155,36 @@ void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>
                                           _2));
 }
 
-void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&const_toSend, size_t bytesSent){
-     
-     
-    if (const_toSend.front()->size()-bytesSent>PACKET_BUFFER_SIZE||const_toSend.size()==1) {
-        //if there's but a single packet, or a single big packet that is bigger than the mBuffer's size...send that one by itself 
-        mSocket->async_send(ASIOSocketWrapperBuffer(&*const_toSend.front()->begin()+bytesSent,const_toSend.front()->size()-bytesSent),
-                            std::tr1::bind(&ASIOSocketWrapper::sendLargeDequeItem,
-                                        this,
-                                        parentMultiSocket,
-                                        const_toSend,
-                                        bytesSent,
-                                          _1,
-                                          _2));
-    }else if (const_toSend.front()->size()){
-        //otherwise copy the packets onto the mBuffer and send from the fixed sized buffer
-        std::deque<Chunk*> toSend=const_toSend;
-        size_t bufferLocation=toSend.front()->size()-bytesSent;
-        std::memcpy(mBuffer,&*toSend.front()->begin()+bytesSent,toSend.front()->size()-bytesSent);
-        delete toSend.front();
-        toSend.pop_front();
-        bytesSent=0;
-        while (bufferLocation<PACKET_BUFFER_SIZE&&toSend.size()) {            
-            if (toSend.front()->size()>PACKET_BUFFER_SIZE-bufferLocation) {
-                //if the first packet is too large for the buffer, copy part of it but keep it around
-                bytesSent=PACKET_BUFFER_SIZE-bufferLocation;
-                std::memcpy(mBuffer+bufferLocation,&*toSend.front()->begin(),bytesSent);
-                bufferLocation=PACKET_BUFFER_SIZE;
-            }else {
-                //if the entire packets fits in the buffer, copy it there and delete the packet
-                std::memcpy(mBuffer+bufferLocation,&*toSend.front()->begin(),toSend.front()->size());
-                bufferLocation+=toSend.front()->size();
-                delete toSend.front();
-                toSend.pop_front();
-            }
+void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<FairSendQueue::Packet>&const_toSend, size_t bytesSent){
+    if (const_toSend.size()==1&&!const_toSend.front().mPayload) {
+        sendToWire(parentMultiSocket,const_toSend.front().mChunk,bytesSent);
+        return;
+    }
+    //gather as many queued chunks and payloads as the OS takes in one writev: nothing is copied, the deque keeps them alive until sendDequeItems releases them
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.reserve(2*const_toSend.size()<(size_t)MAX_GATHERED_BUFFERS?2*const_toSend.size():(size_t)MAX_GATHERED_BUFFERS);
+    size_t offset=bytesSent;
+    for (std::deque<FairSendQueue::Packet>::const_iterator i=const_toSend.begin(),ie=const_toSend.end();i!=ie&&buffers.size()<(size_t)MAX_GATHERED_BUFFERS;++i,offset=0) {
+        const Chunk*chunk=i->mChunk;
+        if (chunk->size()>offset) {
+            buffers.push_back(ASIOSocketWrapperBuffer(&(*chunk)[offset],chunk->size()-offset));
+            offset=0;
+        }else {
+            offset-=chunk->size();
+        }
+        const Chunk*payload=i->mPayload.get();
+        if (payload&&payload->size()>offset&&buffers.size()<(size_t)MAX_GATHERED_BUFFERS) {
+            buffers.push_back(ASIOSocketWrapperBuffer(&(*payload)[offset],payload->size()-offset));
         }
-        //send the buffer filled with possibly many packets
-        mSocket->async_send(ASIOSocketWrapperBuffer(mBuffer,bufferLocation),
-                            std::tr1::bind(&ASIOSocketWrapper::sendStaticBuffer,
-                                          this,
-                                          parentMultiSocket,
-                                          toSend,
-                                          mBuffer,
-                                          bufferLocation,
-                                          bytesSent,
-                                          _1,
-                                          _2));
     }
+    mSocket->async_send(buffers,
+                        std::tr1::bind(&ASIOSocketWrapper::sendDequeItems,
+                                       this,
+                                       parentMultiSocket,
+                                       const_toSend,
+                                       bytesSent,
+                                       _1,
+                                       _2));
 }
 #undef ASIOSocketWrapperBuffer
 void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, uint32 current_status) {
@@ -233,9 +199,10 @@ void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSo
             if (current_status==1) {//if this thread is the first into the system with nothing else having claimed the status
                 //then this thread should take the torch, check the queue and if not empty be willing to send
                 mSendingStatus+=(QUEUE_CHECK_FLAG+ASYNCHRONOUS_SEND_FLAG-1);
-                std::deque<Chunk*>toSend;
+                std::deque<FairSendQueue::Item>toSend;
                 mSendQueue.swap(toSend);
-                if (toSend.empty()) {//the chunk that we put on the queue must have been sent by someone else
+                scheduleSends(toSend);
+                if (mScheduledSends.empty()) {//the chunk that we put on the queue must have been sent by someone else
                     //nothing to send, let another thread take up the torch if something was placed there by it
                     mSendingStatus-=(QUEUE_CHECK_FLAG+ASYNCHRONOUS_SEND_FLAG);
                     return;
@@ -244,13 +211,7 @@ void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSo
                     assert(mSendingStatus.read()&ASYNCHRONOUS_SEND_FLAG);
                     //turn off the queue check since we've got at least one packet to send off and will therefore come around again for further checks
                     mSendingStatus-=QUEUE_CHECK_FLAG;
-                    if (toSend.size()==1) {
-                        //if there's just one packet to send: send that one
-                        sendToWire(parentMultiSocket,toSend.front());
-                    }else {
-                        //if there are more packets to send, send those
-                        sendToWire(parentMultiSocket,toSend);
-                    }
+                    sendScheduled(parentMultiSocket);
                     return;
                 }
             }else {
@@ -288,15 +249,23 @@ void ASIOSocketWrapper::destroySocket() {
 }
 
 
-void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk) {
+void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk, const Stream::StreamID&sid, uint32 weight, const Stream::SharedChunk&payload) {
     TCPSSTLOG(this,"raw",&*chunk->begin(),chunk->size(),false);
+    parentMultiSocket->addQueuedSendBytes(chunk->size()+(payload?payload->size():0));
     uint32 current_status=++mSendingStatus;
     if (current_status==1) {//we are teh chosen thread
         mSendingStatus+=(ASYNCHRONOUS_SEND_FLAG-1);//committed to be the sender thread
-        sendToWire(parentMultiSocket, chunk);
+        if (payload&&payload->size()) {
+            std::deque<FairSendQueue::Packet> toSend;
+            toSend.push_back(FairSendQueue::Packet(chunk,payload));
+            sendToWire(parentMultiSocket, toSend);
+        }else {
+            sendToWire(parentMultiSocket, chunk);
+        }
     }else {//if someone else is possibly sending a packet
         //push the packet on the queue
-        mSendQueue.push(chunk);
+        mSendQueue.push(FairSendQueue::Item(chunk,sid,weight,payload));
+        sQueuedPackets.add(1);
         current_status=--mSendingStatus;
         //the packet is out of our hands now...
         //but the other thread could just have been finishing up and we have missed the send
@@ -304,7 +273,7 @@ void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&pa
         retryQueuedSend(parentMultiSocket,current_status);
     }
 }
-Chunk*ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid){
+Chunk*ASIOSocketWrapper::constructControlPacket(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket,TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid){
     const unsigned int max_size=16;
     uint8 dataStream[max_size+2*Stream::uint30::MAX_SERIALIZED_LENGTH];
     unsigned int size=max_size;
@@ -322,14 +291,17 @@ Chunk*ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamControlCodes
         unsigned int retval=streamSize.serialize(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,Stream::uint30::MAX_SERIALIZED_LENGTH);
         assert(retval==actualHeaderLength);
     }
-    return new Chunk(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,dataStream+size+cur);
+    const uint8*packetBegin=dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength;
+    Chunk*retval=parentMultiSocket->allocateChunk(dataStream+size+cur-packetBegin);
+    std::memcpy(&*retval->begin(),packetBegin,retval->size());
+    return retval;
 }
 
-void ASIOSocketWrapper::sendProtocolHeader(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const UUID&value, unsigned int numConnections) {
+void ASIOSocketWrapper::sendProtocolHeader(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const UUID&value, unsigned int numConnections, bool offerCompression) {
     UUID return_value=UUID::random();
     
-    Chunk *headerData=new Chunk(TCPStream::TcpSstHeaderSize);
-    copyHeader(&*headerData->begin(),value,numConnections);
+    Chunk *headerData=parentMultiSocket->allocateChunk(TCPStream::TcpSstHeaderSize);
+    copyHeader(&*headerData->begin(),value,numConnections,offerCompression);
     rawSend(parentMultiSocket,headerData);
 }
 
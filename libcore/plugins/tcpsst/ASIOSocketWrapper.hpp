@@ -30,6 +30,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "util/UUID.hpp"
+#include "FairSendQueue.hpp"
+#include <climits>
 
 namespace Sirikata { namespace Network {
 class ASIOSocketWrapper;
@@ -48,13 +50,23 @@ class ASIOSocketWrapper {
     /**
      * The queue of packets to send while an active async_send is doing its job
      */
-    ThreadSafeQueue<Chunk*>mSendQueue;
+    ThreadSafeQueue<FairSendQueue::Item>mSendQueue;
+    /**
+     * Packets taken off mSendQueue but not yet handed to ASIO, ordered fairly between the streams that sent them.
+     * Only the thread holding the ASYNCHRONOUS_SEND_FLAG may touch it
+     */
+    FairSendQueue mScheduledSends;
 	enum {
 		ASYNCHRONOUS_SEND_FLAG=(1<<29),
 		QUEUE_CHECK_FLAG=(1<<30),
-		PACKET_BUFFER_SIZE=1400
+#ifdef IOV_MAX
+		MAX_GATHERED_BUFFERS=IOV_MAX
+#else
+		MAX_GATHERED_BUFFERS=16
+#endif
 	};
-    uint8 mBuffer[PACKET_BUFFER_SIZE];
+    ///The number of bytes that went out as part of a multi-Chunk gathered write: only touched by the thread holding ASYNCHRONOUS_SEND_FLAG
+    uint64 mCoalescedBytes;
 
     typedef boost::system::error_code ErrorCode;
     /**
@@ -72,20 +84,21 @@ class ASIOSocketWrapper {
     void sendLargeChunkItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
 
     /**
-     * The callback for when a single large Chunk at the front of a chunk deque was sent.
-     * If the whole large Chunk was not sent then the rest of the Chunk is passed back to sendToWire
-     * If the whole Chunk was shipped off, the sendToWire function is called with the rest of the queue unless it is empty in which case the finishAsyncSend is called
+     * The callback for when a gathered write of the front of a packet deque was sent.
+     * Every packet that made it out completely is released, and whatever remains of the deque (starting with a possibly partially sent packet)
+     * is passed back to sendToWire. If nothing remains, finishAsyncSend is called
      */
-    void sendLargeDequeItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
+    void sendDequeItems(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<FairSendQueue::Packet>&toSend, size_t firstPacketOffset, const ErrorCode &error, std::size_t bytes_sent);
 
-    /**
-     * The callback for when a static buffer was shipped to the network.
-     * If the whole static buffer was not sent then the rest of the static buffer is passed back to async_send and the currentBuffer is offset by the necessary ammt to finish off
-     * sending it. This could be slightly inefficient if there are tons of other packets in the deque toSend but generally the buffer size should be chosen so that it can be sent
-     * in one go.
-     * If the whole buffer was shipped off, the sendToWire function is called with the rest of the queue unless it is empty
-     */
-    void sendStaticBuffer(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&toSend, uint8* currentBuffer, size_t bufferSize, size_t lastChunkOffset,  const ErrorCode &error, std::size_t bytes_sent);
+/**
+ * Moves the contents of a swapped out mSendQueue into mScheduledSends
+ */
+    void scheduleSends(const std::deque<FairSendQueue::Item>&toSchedule);
+
+/**
+ * Pulls the next gathered write's worth of packets from mScheduledSends and hands them to sendToWire
+ */
+    void sendScheduled(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket);
 
 /**
  * When there's a single packet to be sent to the network, mSocket->async_send is simply called upon the Chunk to be sent
@@ -93,13 +106,10 @@ class ASIOSocketWrapper {
     void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t bytesSent=0);
 
 /**
- *  This function sends a while queue of packets to the network
- * The function first checks to see if the front packet is too large to fit in the packet-sized buffer.
- * If it's too large it sends the packet individually much like a chunk would be sent individually and it is left on the queue for data storage purposes
- * If the packet is not too large it and all subsequent packets that can fit are jammed into the packet sized mBuffer
- *  and then those packets are deleted from the queue and shipped to the network partial packets are left on the queue in that case
+ *  This function sends a whole queue of packets to the network
+ *  Up to MAX_GATHERED_BUFFERS Chunks and shared payloads from the front of the queue are handed to ASIO as a single buffer sequence, so they go out in one writev without being copied
  */
-    void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&const_toSend, size_t bytesSent=0);
+    void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<FairSendQueue::Packet>&const_toSend, size_t bytesSent=0);
 
 /**
  * If another thread claimed to be sending data asynchronously
@@ -114,11 +124,11 @@ class ASIOSocketWrapper {
 
 public:
 
-    ASIOSocketWrapper(TCPSocket* socket) :mSocket(socket),mSendingStatus(0){
+    ASIOSocketWrapper(TCPSocket* socket) :mSocket(socket),mSendingStatus(0),mCoalescedBytes(0){
         //mPacketLogger.reserve(268435456);
     }
 
-    ASIOSocketWrapper(const ASIOSocketWrapper& socket) :mSocket(socket.mSocket),mSendingStatus(0){
+    ASIOSocketWrapper(const ASIOSocketWrapper& socket) :mSocket(socket.mSocket),mSendingStatus(0),mCoalescedBytes(0){
         //mPacketLogger.reserve(268435456);
     }
 
@@ -127,13 +137,16 @@ public:
         return *this;
     }
 
-    ASIOSocketWrapper() :mSocket(NULL),mSendingStatus(0){
+    ASIOSocketWrapper() :mSocket(NULL),mSendingStatus(0),mCoalescedBytes(0){
     }
 
     TCPSocket&getSocket() {return *mSocket;}
 
     const TCPSocket&getSocket()const {return *mSocket;}
 
+    ///How many bytes this socket has sent by gathering several queued Chunks into one write
+    uint64 coalescedBytes()const {return mCoalescedBytes;}
+
     ///close this socket by disallowing sends, then closing
     void shutdownAndClose();
 
@@ -145,21 +158,25 @@ public:
     /**
      * Sends the exact bytes contained within the typedeffed vector
      * \param chunk is the exact bytes to put on the network (including streamID and framing data)
+     * \param sid is the stream the chunk belongs to, used along with weight to share the socket fairly when packets back up
+     * \param payload if set is put on the network right after chunk, straight from the shared buffer
      */
-    void rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk);
+    void rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk, const Stream::StreamID&sid=Stream::StreamID(), uint32 weight=1, const Stream::SharedChunk&payload=Stream::SharedChunk());
 
-    static Chunk*constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
+    ///Builds the framed control packet in a Chunk drawn from the parent MultiplexedSocket's pool
+    static Chunk*constructControlPacket(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket,TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
     /**
      *  Sends a streamID #0 packet with further control data on it. 
      *  To start with only stream disconnect and the ack thereof are allowed
      */
     void sendControlPacket(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid) {
-        rawSend(parentMultiSocket,constructControlPacket(code,sid));
+        rawSend(parentMultiSocket,constructControlPacket(parentMultiSocket,code,sid));
     }
     /**
      * Sends 24 byte header that indicates version of SST, a unique ID and how many TCP connections should be established
+     * \param offerCompression flags the connection count to tell the other side this one can inflate TCPStreamCompressedPacket
      */
-    void sendProtocolHeader(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const UUID&value, unsigned int numConnections);
+    void sendProtocolHeader(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const UUID&value, unsigned int numConnections, bool offerCompression);
 
 };
 } }
@@ -49,6 +49,8 @@ namespace {
 typedef std::map<UUID,IncompleteStreamState> IncompleteStreamMap;
 std::deque<UUID> sStaleUUIDs;
 IncompleteStreamMap sIncompleteStreams;
+///accepted connections may be spread over several IOService threads (tcpsst --accept-threads)
+boost::mutex sIncompleteStreamsMutex;
 }
 ///gets called when a complete 24 byte header is actually received: uses the UUID within to match up appropriate sockets
 void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
@@ -61,35 +63,43 @@ void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
         SILOG(tcpsst,warning,"Connection received with incomprehensible header");
     }else {
         UUID context=UUID(buffer->begin()+(TCPStream::TcpSstHeaderSize-16),16);
-        IncompleteStreamMap::iterator where=sIncompleteStreams.find(context);
         unsigned int numConnections=(((*buffer)[TCPStream::STRING_PREFIX_LENGTH]-'0')%10)*10+(((*buffer)[TCPStream::STRING_PREFIX_LENGTH+1]-'0')%10);
         if (numConnections>99) numConnections=99;//FIXME: some option in options
-        if (where==sIncompleteStreams.end()){
-            sIncompleteStreams[context].mNumSockets=numConnections;
-            where=sIncompleteStreams.find(context);
-            assert(where!=sIncompleteStreams.end());
-        }
-        if ((int)numConnections!=where->second.mNumSockets) {
-            SILOG(tcpsst,warning,"Single client disagrees on number of connections to establish: "<<numConnections<<" != "<<where->second.mNumSockets);
-            sIncompleteStreams.erase(where);
-        }else {
-            where->second.mSockets.push_back(socket);
-            if (numConnections==(unsigned int)where->second.mSockets.size()) {
-                std::tr1::shared_ptr<MultiplexedSocket> shared_socket(
-                    MultiplexedSocket::construct<MultiplexedSocket>(ioService,context,where->second.mSockets,callback));
-                MultiplexedSocket::sendAllProtocolHeaders(shared_socket,UUID::random());
+        std::vector<TCPSocket*> sockets;
+        {
+            boost::mutex::scoped_lock lok(sIncompleteStreamsMutex);
+            IncompleteStreamMap::iterator where=sIncompleteStreams.find(context);
+            if (where==sIncompleteStreams.end()){
+                sIncompleteStreams[context].mNumSockets=numConnections;
+                where=sIncompleteStreams.find(context);
+                assert(where!=sIncompleteStreams.end());
+            }
+            if ((int)numConnections!=where->second.mNumSockets) {
+                SILOG(tcpsst,warning,"Single client disagrees on number of connections to establish: "<<numConnections<<" != "<<where->second.mNumSockets);
                 sIncompleteStreams.erase(where);
-                Stream::StreamID newID=Stream::StreamID(1);
-                TCPStream * strm=new TCPStream(shared_socket,newID);
-
-                TCPSetCallbacks setCallbackFunctor(&*shared_socket,strm);
-                callback(strm,setCallbackFunctor);
-                if (setCallbackFunctor.mCallbacks==NULL) {
-                    SILOG(tcpsst,error,"Client code for stream "<<newID.read()<<" did not set listener on socket");
-                    shared_socket->closeStream(shared_socket,newID);
+            }else {
+                where->second.mSockets.push_back(socket);
+                if (numConnections==(unsigned int)where->second.mSockets.size()) {
+                    sockets.swap(where->second.mSockets);
+                    sIncompleteStreams.erase(where);
+                }else{
+                    sStaleUUIDs.push_back(context);
                 }
-            }else{
-                sStaleUUIDs.push_back(context);
+            }
+        }
+        if (!sockets.empty()) {
+            std::tr1::shared_ptr<MultiplexedSocket> shared_socket(
+                MultiplexedSocket::construct<MultiplexedSocket>(ioService,context,sockets,callback));
+            shared_socket->setPeerInflates((*buffer)[TCPStream::STRING_PREFIX_LENGTH]>='0'+TCPStream::TcpSstHeaderCompressionFlag);
+            MultiplexedSocket::sendAllProtocolHeaders(shared_socket,UUID::random());
+            Stream::StreamID newID=Stream::StreamID(1);
+            TCPStream * strm=new TCPStream(shared_socket,newID);
+
+            TCPSetCallbacks setCallbackFunctor(&*shared_socket,strm);
+            callback(strm,setCallbackFunctor);
+            if (setCallbackFunctor.mCallbacks==NULL) {
+                SILOG(tcpsst,error,"Client code for stream "<<newID.read()<<" did not set listener on socket");
+                shared_socket->closeStream(shared_socket,newID);
             }
         }
     }
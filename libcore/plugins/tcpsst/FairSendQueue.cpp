@@ -0,0 +1,97 @@
+/*  Sirikata Network Utilities
+ *  FairSendQueue.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Platform.hpp"
+#include "network/Stream.hpp"
+#include "FairSendQueue.hpp"
+namespace Sirikata { namespace Network {
+
+void FairSendQueue::push(const Item&item) {
+    if (!mDeferred.empty()||(item.mStream==Stream::StreamID()&&!mActiveFlows.empty())) {
+        //a control packet must not overtake the data queued before it, nor may data queued after it overtake it
+        mDeferred.push_back(item);
+    }else {
+        schedule(item);
+    }
+}
+
+void FairSendQueue::releaseDeferred() {
+    while (!mDeferred.empty()) {
+        if (mDeferred.front().mStream==Stream::StreamID()&&!mActiveFlows.empty())
+            break;
+        schedule(mDeferred.front());
+        mDeferred.pop_front();
+    }
+}
+
+void FairSendQueue::schedule(const Item&item) {
+    FlowMap::iterator where=mFlows.find(item.mStream);
+    if (where==mFlows.end()) {
+        where=mFlows.insert(FlowMap::value_type(item.mStream,Flow())).first;
+        mActiveFlows.push_back(item.mStream);
+    }
+    where->second.mWeight=item.mWeight?item.mWeight:1;
+    where->second.mPackets.push_back(item.mPacket);
+}
+
+size_t FairSendQueue::pop(std::deque<Packet>&output, size_t maxChunks) {
+    size_t numPopped=0;
+    while (numPopped<maxChunks&&!empty()) {
+        if (mActiveFlows.empty())
+            releaseDeferred();
+        FlowMap::iterator where=mFlows.find(mActiveFlows.front());
+        assert(where!=mFlows.end());
+        Flow&flow=where->second;
+        if (!flow.mVisited) {
+            flow.mDeficit+=flow.mWeight*(size_t)QUANTUM_BYTES;
+            flow.mVisited=true;
+        }
+        while (numPopped<maxChunks&&!flow.mPackets.empty()&&flow.mPackets.front().size()<=flow.mDeficit) {
+            flow.mDeficit-=flow.mPackets.front().size();
+            output.push_back(flow.mPackets.front());
+            flow.mPackets.pop_front();
+            ++numPopped;
+        }
+        if (flow.mPackets.empty()) {
+            //idle streams do not bank credit
+            mFlows.erase(where);
+            mActiveFlows.pop_front();
+        }else if (numPopped<maxChunks) {
+            //out of credit: the rest waits for the next round
+            flow.mVisited=false;
+            mActiveFlows.push_back(mActiveFlows.front());
+            mActiveFlows.pop_front();
+        }
+    }
+    return numPopped;
+}
+
+} }
@@ -0,0 +1,116 @@
+/*  Sirikata Network Utilities
+ *  FairSendQueue.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_FairSendQueue_HPP__
+#define SIRIKATA_FairSendQueue_HPP__
+namespace Sirikata { namespace Network {
+
+/**
+ * Orders the packets waiting on a single ASIO socket with deficit round robin across the substreams that sent them.
+ * Each stream with a backlog earns its weight times QUANTUM_BYTES of credit per round and may put packets on the wire
+ * until that credit runs out, so a bulky stream such as a mesh upload cannot starve latency critical streams sharing the connection.
+ * Control packets (stream close requests and acks) refer to data sent before them, so they are never reordered ahead of anything queued earlier.
+ * This class is not thread safe: only the thread currently sending on the socket may touch it
+ */
+class FairSendQueue {
+public:
+    enum {
+        ///Bytes of credit a stream of weight 1 earns each time the round robin visits it
+        QUANTUM_BYTES=1024
+    };
+    ///The bytes of one packet: the framing and any data owned by its stream, then an optional payload shared with other streams
+    class Packet {
+    public:
+        Chunk*mChunk;
+        Stream::SharedChunk mPayload;
+        Packet() {
+            mChunk=NULL;
+        }
+        Packet(Chunk*chunk, const Stream::SharedChunk&payload):mPayload(payload) {
+            mChunk=chunk;
+        }
+        size_t size()const {
+            return mChunk->size()+(mPayload?mPayload->size():0);
+        }
+    };
+    ///A packet waiting to be scheduled along with the stream it came from
+    class Item {
+    public:
+        Packet mPacket;
+        Stream::StreamID mStream;
+        uint32 mWeight;
+        Item() {
+            mWeight=1;
+        }
+        Item(Chunk*chunk, const Stream::StreamID&sid, uint32 weight, const Stream::SharedChunk&payload=Stream::SharedChunk()):mPacket(chunk,payload),mStream(sid) {
+            mWeight=weight;
+        }
+    };
+private:
+    class Flow {
+    public:
+        std::deque<Packet> mPackets;
+        uint32 mWeight;
+        size_t mDeficit;
+        ///whether this flow was already granted its quantum on the current visit
+        bool mVisited;
+        Flow() {
+            mWeight=1;
+            mDeficit=0;
+            mVisited=false;
+        }
+    };
+    typedef std::tr1::unordered_map<Stream::StreamID,Flow,Stream::StreamID::Hasher> FlowMap;
+    ///Streams with packets waiting
+    FlowMap mFlows;
+    ///Round robin order of the streams in mFlows
+    std::deque<Stream::StreamID> mActiveFlows;
+    ///Packets held back behind a control packet until everything queued before that control packet has been popped
+    std::deque<Item> mDeferred;
+    ///Adds a packet to its stream's flow
+    void schedule(const Item&item);
+    ///Once the flows drain, schedules deferred packets up to the next control packet that must wait again
+    void releaseDeferred();
+public:
+    ///Queues a packet behind the others from the same stream. The stream's weight is updated to the one given
+    void push(const Item&item);
+    bool empty()const {
+        return mActiveFlows.empty()&&mDeferred.empty();
+    }
+    /**
+     * Moves up to maxChunks packets onto the back of output in the order they should be put on the wire.
+     * \returns the number of packets moved
+     */
+    size_t pop(std::deque<Packet>&output, size_t maxChunks);
+};
+
+} }
+#endif
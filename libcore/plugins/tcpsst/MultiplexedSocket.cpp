@@ -38,13 +38,13 @@
 #include "MultiplexedSocket.hpp"
 #include "ASIOConnectAndHandshake.hpp"
 #include "TCPSetCallbacks.hpp"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 namespace Sirikata { namespace Network {
 
 
-boost::mutex MultiplexedSocket::sConnectingMutex; 
-
-
 void triggerMultiplexedConnectionError(MultiplexedSocket*socket,ASIOSocketWrapper*wrapper,const boost::system::error_code &error){
     socket->hostDisconnectedCallback(wrapper,error);
 }
@@ -73,7 +73,7 @@ bool MultiplexedSocket::CommitCallbacks(std::deque<StreamIDCallbackPair> &regist
             //do a little house cleaning and empty as many new requests as possible
             std::vector<RawRequest> newRequests;            
             {
-                boost::lock_guard<boost::mutex> connecting_mutex(sConnectingMutex);
+                boost::lock_guard<Metrics::ProfiledMutex<> > connecting_mutex(mConnectingMutex);
                 newRequests.swap(mNewRequests);
             }
             for (size_t i=0,ie=newRequests.size();i<ie;++i) {
@@ -81,7 +81,7 @@ bool MultiplexedSocket::CommitCallbacks(std::deque<StreamIDCallbackPair> &regist
             }
             
         }
-        boost::lock_guard<boost::mutex> connecting_mutex(sConnectingMutex);
+        boost::lock_guard<Metrics::ProfiledMutex<> > connecting_mutex(mConnectingMutex);
         statusChanged=(status!=mSocketConnectionPhase);
         if (setConnectedStatus) {
             if (status!=CONNECTED) {
@@ -120,13 +120,15 @@ void MultiplexedSocket::sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocke
     if (data.originStream==Stream::StreamID()) {
         unsigned int socket_size=(unsigned int)thus->mSockets.size();
         for(unsigned int i=1;i<socket_size;++i) {                
-            thus->mSockets[i].rawSend(thus,new Chunk(*data.data));
+            Chunk*copy=thus->allocateChunk(data.data->size());
+            std::memcpy(&*copy->begin(),&*data.data->begin(),data.data->size());
+            thus->mSockets[i].rawSend(thus,copy,Stream::StreamID(),1,data.payload);
         }
-        thus->mSockets[0].rawSend(thus,data.data);
+        thus->mSockets[0].rawSend(thus,data.data,Stream::StreamID(),1,data.payload);
     }else {
         size_t whichStream=data.unordered?thus->leastBusyStream():hasher(data.originStream)%thus->mSockets.size();
         if (data.unreliable==false||rand()/(float)RAND_MAX>thus->dropChance(data.data,whichStream)) {
-            thus->mSockets[whichStream].rawSend(thus,data.data);
+            thus->mSockets[whichStream].rawSend(thus,data.data,data.originStream,data.weight,data.payload);
         }        
     }
 }
@@ -137,7 +139,7 @@ void MultiplexedSocket::closeStream(const std::tr1::shared_ptr<MultiplexedSocket
     closeRequest.originStream=Stream::StreamID();//control packet
     closeRequest.unordered=false;
     closeRequest.unreliable=false;
-    closeRequest.data=ASIOSocketWrapper::constructControlPacket(code,sid);
+    closeRequest.data=ASIOSocketWrapper::constructControlPacket(thus,code,sid);
     sendBytes(thus,closeRequest);
 }
 
@@ -148,7 +150,7 @@ void MultiplexedSocket::sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&
     }else {
         bool lockCheckConnected=false;
         {
-            boost::lock_guard<boost::mutex> connectingMutex(sConnectingMutex);
+            boost::lock_guard<Metrics::ProfiledMutex<> > connectingMutex(thus->mConnectingMutex);
             if (thus->mSocketConnectionPhase==CONNECTED) {
                 lockCheckConnected=true;
             }else if(thus->mSocketConnectionPhase==DISCONNECTED) {
@@ -156,7 +158,7 @@ void MultiplexedSocket::sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&
                 //FIXME is this the correct thing to do?
                 TCPSSTLOG(this,"sendnvr",&*data.data->begin(),data.data->size(),false);                
                 TCPSSTLOG(this,"sendnvr","\n",1,false);
-                delete data.data;
+                thus->releaseChunk(data.data);
             }else {
                 //with the connectionMutex acquired, no socket is allowed to be in the mSocketConnectionPhase
                 assert(thus->mSocketConnectionPhase==PRECONNECTION);
@@ -173,7 +175,7 @@ void MultiplexedSocket::sendBytes(const std::tr1::shared_ptr<MultiplexedSocket>&
 
 MultiplexedSocket::SocketConnectionPhase MultiplexedSocket::addCallbacks(const Stream::StreamID&sid, 
                                                                          TCPStream::Callbacks* cb) {
-    boost::lock_guard<boost::mutex> connectingMutex(sConnectingMutex);
+    boost::lock_guard<Metrics::ProfiledMutex<> > connectingMutex(mConnectingMutex);
     mCallbackRegistration.push_back(StreamIDCallbackPair(sid,cb));
     return mSocketConnectionPhase;
 }
@@ -189,14 +191,24 @@ Stream::StreamID MultiplexedSocket::getNewID() {
     assert(retval>1);
     return Stream::StreamID(retval);
 }
-MultiplexedSocket::MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback):ThreadIdCheck(ThreadId::registerThreadGroup(NULL)),mIO(io),mNewSubstreamCallback(substreamCallback),mHighestStreamID(1) {
+MultiplexedSocket::MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback):ThreadIdCheck(ThreadId::registerThreadGroup(NULL)),mIO(io),mNewSubstreamCallback(substreamCallback),mConnectingMutex("tcpsst.connecting"),mHighestStreamID(1),mPeerInflates(false),mQueuedSendBytes(0),mNumSendWatermarks(0) {
     mSocketConnectionPhase=PRECONNECTION;
+    for (int i=0;i<CHUNK_POOL_CLASSES;++i) {
+        mNumFreeChunks[i]=0;
+    }
 }
 MultiplexedSocket::MultiplexedSocket(IOService*io,const UUID&uuid,const std::vector<TCPSocket*>&sockets, const Stream::SubstreamCallback &substreamCallback)
     :ThreadIdCheck(ThreadId::registerThreadGroup(NULL)),mIO(io),
      mNewSubstreamCallback(substreamCallback),
-     mHighestStreamID(0) {
+     mConnectingMutex("tcpsst.connecting"),
+     mHighestStreamID(0),
+     mPeerInflates(false),
+     mQueuedSendBytes(0),
+     mNumSendWatermarks(0) {
     mSocketConnectionPhase=PRECONNECTION;
+    for (int i=0;i<CHUNK_POOL_CLASSES;++i) {
+        mNumFreeChunks[i]=0;
+    }
     for (unsigned int i=0;i<(unsigned int)sockets.size();++i) {
         mSockets.push_back(ASIOSocketWrapper(sockets[i]));
     }
@@ -204,9 +216,9 @@ MultiplexedSocket::MultiplexedSocket(IOService*io,const UUID&uuid,const std::vec
 void MultiplexedSocket::sendAllProtocolHeaders(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const UUID&syncedUUID) {
     unsigned int numSockets=(unsigned int)thus->mSockets.size();
     for (std::vector<ASIOSocketWrapper>::iterator i=thus->mSockets.begin(),ie=thus->mSockets.end();i!=ie;++i) {
-        i->sendProtocolHeader(thus,syncedUUID,numSockets);
+        i->sendProtocolHeader(thus,syncedUUID,numSockets,thus->peerInflates());
     }
-    boost::lock_guard<boost::mutex> connectingMutex(sConnectingMutex);
+    boost::lock_guard<Metrics::ProfiledMutex<> > connectingMutex(thus->mConnectingMutex);
     thus->mSocketConnectionPhase=CONNECTED;
     for (unsigned int i=0,ie=thus->mSockets.size();i!=ie;++i) {
         MakeASIOReadBuffer(thus,i);
@@ -222,7 +234,7 @@ MultiplexedSocket::~MultiplexedSocket() {
     for (unsigned int i=0;i<(unsigned int)mSockets.size();++i){
         mSockets[i].shutdownAndClose();
     }        
-    boost::lock_guard<boost::mutex> connecting_mutex(sConnectingMutex);        
+    boost::lock_guard<Metrics::ProfiledMutex<> > connecting_mutex(mConnectingMutex);        
     for (unsigned int i=0;i<(unsigned int)mSockets.size();++i){
         mSockets[i].destroySocket();
     }
@@ -240,6 +252,47 @@ MultiplexedSocket::~MultiplexedSocket() {
         delete mCallbacks.begin()->second;
         mCallbacks.erase(mCallbacks.begin());
     }    
+    for (int i=0;i<CHUNK_POOL_CLASSES;++i) {
+        Chunk*spare;
+        while (mFreeChunks[i].pop(spare)) {
+            delete spare;
+        }
+    }
+}
+
+Chunk*MultiplexedSocket::allocateChunk(size_t size) {
+    size_t classSize=CHUNK_POOL_MIN_SIZE;
+    for (int i=0;i<CHUNK_POOL_CLASSES;++i,classSize*=2) {
+        if (size<=classSize) {
+            Chunk*retval;
+            if (mFreeChunks[i].pop(retval)) {
+                --mNumFreeChunks[i];
+            }else {
+                retval=new Chunk;
+                retval->reserve(classSize);
+            }
+            retval->resize(size);
+            return retval;
+        }
+    }
+    return new Chunk(size);
+}
+
+void MultiplexedSocket::releaseChunk(Chunk*chunk) {
+    size_t capacity=chunk->capacity();
+    if (capacity>=CHUNK_POOL_MIN_SIZE&&capacity<((size_t)CHUNK_POOL_MIN_SIZE<<CHUNK_POOL_CLASSES)) {
+        int whichClass=0;
+        //find the largest size class this chunk can still satisfy
+        while (whichClass+1<CHUNK_POOL_CLASSES&&capacity>=((size_t)CHUNK_POOL_MIN_SIZE<<(whichClass+1))) {
+            ++whichClass;
+        }
+        if (++mNumFreeChunks[whichClass]<=(uint32)CHUNK_POOL_MAX_FREE) {
+            mFreeChunks[whichClass].push(chunk);
+            return;
+        }
+        --mNumFreeChunks[whichClass];
+    }
+    delete chunk;
 }
 
 void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stream::StreamID &id) {
@@ -268,6 +321,65 @@ void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stre
         mFreeStreamIDs.push(id);
     }
 }
+void MultiplexedSocket::setSendWatermarks(const Stream::StreamID&sid, size_t low, size_t high, const Stream::WatermarkCallback&callback) {
+    boost::lock_guard<boost::mutex> lok(mSendWatermarkMutex);
+    if (high==0||!callback) {
+        mSendWatermarks.erase(sid);
+    }else {
+        SendWatermark&watermark=mSendWatermarks[sid];
+        watermark.mLow=low<high?low:high;
+        watermark.mHigh=high;
+        watermark.mCallback=callback;
+        watermark.mCongested=false;
+    }
+    mNumSendWatermarks=(uint32)mSendWatermarks.size();
+}
+void MultiplexedSocket::checkSendWatermarks(uint64 queuedBytes) {
+    std::vector<std::pair<Stream::WatermarkCallback,bool> > crossed;
+    {
+        boost::lock_guard<boost::mutex> lok(mSendWatermarkMutex);
+        for (SendWatermarkMap::iterator i=mSendWatermarks.begin(),ie=mSendWatermarks.end();i!=ie;++i) {
+            SendWatermark&watermark=i->second;
+            if (watermark.mCongested?queuedBytes<=watermark.mLow:queuedBytes>=watermark.mHigh) {
+                watermark.mCongested=!watermark.mCongested;
+                crossed.push_back(std::pair<Stream::WatermarkCallback,bool>(watermark.mCallback,watermark.mCongested));
+            }
+        }
+    }
+    //outside the lock, since a callback may well send or change its watermarks
+    for (size_t i=0,ie=crossed.size();i<ie;++i) {
+        crossed[i].first(crossed[i].second);
+    }
+}
+bool MultiplexedSocket::canInflate() {
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+void MultiplexedSocket::receiveCompressedChunk(unsigned int whichSocket, const Chunk&newChunk) {
+#ifdef HAVE_ZLIB
+    Stream::StreamID id;
+    Stream::uint30 inflatedSize;
+    unsigned int pos=1;
+    unsigned int avail_len=newChunk.size()-pos;
+    if (id.unserialize(&newChunk[pos],avail_len)&&avail_len<newChunk.size()-pos) {
+        pos+=avail_len;
+        avail_len=newChunk.size()-pos;
+        if (inflatedSize.unserialize(&newChunk[pos],avail_len)&&avail_len<newChunk.size()-pos&&id!=Stream::StreamID()) {
+            pos+=avail_len;
+            Chunk inflated(inflatedSize.read());
+            uLongf destLen=(uLongf)inflated.size();
+            if (uncompress(inflated.empty()?NULL:&inflated[0],&destLen,&newChunk[pos],(uLong)(newChunk.size()-pos))==Z_OK&&destLen==inflated.size()) {
+                receiveFullChunk(whichSocket,id,inflated);
+                return;
+            }
+        }
+    }
+#endif
+    SILOG(tcpsst,warning,"Dropping compressed packet that could not be inflated");
+}
 void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const Chunk&newChunk){
     if (id==Stream::StreamID()) {//control packet
         if(newChunk.size()) {
@@ -306,6 +418,9 @@ void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::Strea
                     }
                 }
                 break;
+              case TCPStream::TCPStreamCompressedPacket:
+                receiveCompressedChunk(whichSocket,newChunk);
+                break;
               default:
                 break;
             }
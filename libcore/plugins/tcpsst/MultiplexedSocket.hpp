@@ -30,6 +30,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "util/ThreadId.hpp"
+#include "util/LockFreeQueue.hpp"
+#include "util/ProfiledMutex.hpp"
 namespace Sirikata { namespace Network {
 
 class MultiplexedSocket:public SelfWeakPtr<MultiplexedSocket>,ThreadIdCheck {
@@ -39,7 +41,14 @@ public:
         bool unordered;
         bool unreliable;
         Stream::StreamID originStream;
+        ///share of a congested socket originStream receives relative to the other streams backed up on it
+        uint32 weight;
         Chunk * data;
+        ///bytes shared with other streams that go out right after data, so they need not be copied into it
+        Stream::SharedChunk payload;
+        RawRequest() {
+            weight=1;
+        }
     };
     enum SocketConnectionPhase{
         PRECONNECTION,
@@ -71,7 +80,8 @@ private:
         }
     };
     /// these next items (mCallbackRegistration, mNewRequests, mSocketConnectionPhase) are synced together take the lock, check for preconnection,,, if connected, don't take lock...otherwise take lock and push data onto the new requests queue
-    static boost::mutex sConnectingMutex;
+    /// The lock belongs to this socket alone, so a storm of connections being set up at once does not contend on a single process-wide mutex
+    Metrics::ProfiledMutex<> mConnectingMutex;
     ///list of packets that must be sent before mSocketConnectionPhase switches to CONNECTION
     std::vector<RawRequest> mNewRequests;
     ///must be set to PRECONNECTION when items are being placed on mNewRequests queue and WAITCONNECTING when it is emptying the queue (with lock held) and finally CONNECTED when the user can send directly to the socket.  DISCONNECTED must be set as soon as the socket fails to write or read
@@ -84,12 +94,41 @@ private:
     std::tr1::unordered_map<Stream::StreamID,unsigned int,Stream::StreamID::Hasher>mAckedClosingStreams;
     ///a set of StreamIDs to hold the streams that were requested closed but have not been acknowledged, to prevent received packets triggering NewStream callbacks as if a new ID were received
     std::tr1::unordered_set<Stream::StreamID,Stream::StreamID::Hasher>mOneSidedClosingStreams;
-#define ThreadSafeStack ThreadSafeQueue //FIXME this can be way more efficient
     ///The highest streamID that has been used for making new streams on this side
     AtomicValue<uint32> mHighestStreamID;
-    ///actually free stream IDs that will not be sent out until recalimed by this side
-    ThreadSafeStack<Stream::StreamID>mFreeStreamIDs;
-#undef ThreadSafeStack
+    ///actually free stream IDs that will not be sent out until recalimed by this side: lock free so cloning substreams from many threads is not serialized
+    LockFreeQueue<Stream::StreamID>mFreeStreamIDs;
+    enum {
+        ///Capacity of the smallest pooled send Chunk: each further size class doubles it
+        CHUNK_POOL_MIN_SIZE=64,
+        ///Number of size classes in the send Chunk pool, Chunks too large for the last class are left to the heap
+        CHUNK_POOL_CLASSES=8,
+        ///The most spare Chunks a single size class holds on to, so a burst of sends does not pin its memory forever
+        CHUNK_POOL_MAX_FREE=64
+    };
+    ///Spare send Chunks, each with capacity of at least CHUNK_POOL_MIN_SIZE<<index, ready to be handed out by allocateChunk
+    ThreadSafeQueue<Chunk*>mFreeChunks[CHUNK_POOL_CLASSES];
+    ///How many Chunks sit in each entry of mFreeChunks
+    AtomicValue<uint32>mNumFreeChunks[CHUNK_POOL_CLASSES];
+    ///Whether the remote side announced in its handshake that it can inflate TCPStreamCompressedPacket: set before the connection goes live
+    bool mPeerInflates;
+    ///Bytes handed to the ASIOSocketWrappers that have not been written to the network yet
+    AtomicValue<uint64> mQueuedSendBytes;
+    ///A stream's request to hear about mQueuedSendBytes crossing its watermarks
+    struct SendWatermark {
+        size_t mLow;
+        size_t mHigh;
+        Stream::WatermarkCallback mCallback;
+        bool mCongested;
+    };
+    typedef std::map<Stream::StreamID,SendWatermark> SendWatermarkMap;
+    ///guards mSendWatermarks, which any sending thread and the io thread check
+    boost::mutex mSendWatermarkMutex;
+    SendWatermarkMap mSendWatermarks;
+    ///How many entries mSendWatermarks has, so the send path may skip the lock when no one is listening
+    AtomicValue<uint32> mNumSendWatermarks;
+    ///Calls the callbacks of every watermark the backlog has just crossed
+    void checkSendWatermarks(uint64 queuedBytes);
 
 //Begin helper functions//
 
@@ -111,7 +150,7 @@ private:
      */
     static void sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data);
     /**
-     * Calls the connected callback with the succeess or failure status. Sets status while holding the sConnectingMutex lock so that after that point no more Connected responses
+     * Calls the connected callback with the succeess or failure status. Sets status while holding the mConnectingMutex lock so that after that point no more Connected responses
      * will be sent out. Then inserts the registrations into the mCallbacks map during the ioReactor thread.
      */
     void connectionFailureOrSuccessCallback(SocketConnectionPhase status, Stream::ConnectionStatus reportedProblem, const std::string&errorMessage=std::string());
@@ -125,6 +164,8 @@ private:
     * This function will call all substreams disconnected methods
     */
     void hostDisconnectedCallback(const std::string& error);
+    ///Inflates the packet carried by a TCPStreamCompressedPacket control packet and processes it as if it had been received directly
+    void receiveCompressedChunk(unsigned int whichSocket, const Chunk&newChunk);
 public:
     ///public io service accessor for new stream construction
     IOService&getASIOService(){return *mIO;}
@@ -145,8 +186,35 @@ public:
      * Returns true if the callbacks will be actually used or false if the socket is already disconnected
      */
     SocketConnectionPhase addCallbacks(const Stream::StreamID&sid, TCPStream::Callbacks* cb);
-    ///function that searches mFreeStreamIDs or uses the mHighestStreamID to find the next unused free stream ID
+    ///function that searches mFreeStreamIDs or uses the mHighestStreamID to find the next unused free stream ID without taking any lock
     Stream::StreamID getNewID();
+    /**
+     * Hands out a Chunk of exactly size bytes for the send path, reusing a spare one from the pool when possible.
+     * The Chunk must be given back with releaseChunk once it has been written to the network
+     */
+    Chunk*allocateChunk(size_t size);
+    ///Returns a Chunk to its size class in the pool, or deletes it if that class is already full
+    void releaseChunk(Chunk*chunk);
+    ///Bytes handed to the sockets that have not been written yet, added up over all of them
+    uint64 queuedSendBytes()const {return mQueuedSendBytes.read();}
+    ///Called by the ASIOSocketWrappers as packets are handed to them
+    void addQueuedSendBytes(size_t bytes) {
+        uint64 queued=(mQueuedSendBytes+=bytes);
+        if (mNumSendWatermarks.read()) checkSendWatermarks(queued);
+    }
+    ///Called by the ASIOSocketWrappers as bytes make it out to the network
+    void removeQueuedSendBytes(size_t bytes) {
+        uint64 queued=(mQueuedSendBytes-=bytes);
+        if (mNumSendWatermarks.read()) checkSendWatermarks(queued);
+    }
+    ///Registers (or with high==0 removes) the watermark callback of stream sid, see Stream::setSendWatermarks
+    void setSendWatermarks(const Stream::StreamID&sid, size_t low, size_t high, const Stream::WatermarkCallback&callback);
+    ///Whether this build can inflate TCPStreamCompressedPacket and may therefore offer it in the handshake
+    static bool canInflate();
+    ///Whether large packets may be sent to the remote side deflated
+    bool peerInflates()const {return mPeerInflates;}
+    ///Records whether the remote side's handshake offered compression: only takes effect if canInflate()
+    void setPeerInflates(bool peerInflates) {mPeerInflates=peerInflates&&canInflate();}
     ///Constructor for a connecting stream
     MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback);
     ///Constructor for a listening stream with a prebuilt connection of ASIO sockets
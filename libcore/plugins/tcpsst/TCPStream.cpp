@@ -39,11 +39,79 @@
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 #include "TCPSetCallbacks.hpp"
+#include "options/Options.hpp"
+#include "util/Metrics.hpp"
 #include <boost/thread.hpp>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 namespace Sirikata { namespace Network {
 
 using namespace boost::asio::ip;
-TCPStream::TCPStream(const std::tr1::shared_ptr<MultiplexedSocket>&shared_socket,const Stream::StreamID&sid):mSocket(shared_socket),mID(sid),mSendStatus(new AtomicValue<int>(0)) {
+namespace {
+OptionValue*compressThreshold;
+InitializeGlobalOptions compressOptions("tcpsst",
+                    compressThreshold=new OptionValue("compress-threshold","0",OptionValueType<unsigned int>(),"Packets carrying at least this many bytes are deflated if the remote side can inflate them (0 never compresses)"),
+                    NULL);
+Metrics::Counter sCompressionSavedBytes("tcpsst.compression_saved_bytes","bytes kept off tcpsst sockets by deflating large packets");
+
+#ifdef HAVE_ZLIB
+/**
+ * Deflates firstChunk, secondChunk and payload into a TCPStreamCompressedPacket for stream sid, drawing the Chunk from socket.
+ * Returns NULL if the result would not be any smaller than the packet it replaces, which is then sent as is
+ */
+Chunk*constructCompressedPacket(MultiplexedSocket*socket, const Stream::StreamID&sid, MemoryReference firstChunk, MemoryReference secondChunk, const Chunk*payload, size_t uncompressedPacketSize) {
+    const MemoryReference pieces[3]={firstChunk,secondChunk,payload?MemoryReference(*payload):MemoryReference::null()};
+    size_t dataSize=firstChunk.size()+secondChunk.size()+(payload?payload->size():0);
+    //the length goes in last, once the deflated size is known: leave room for the longest one
+    uint8 prefix[Stream::uint30::MAX_SERIALIZED_LENGTH*2+Stream::StreamID::MAX_SERIALIZED_LENGTH*2+1];
+    unsigned int prefixLength=Stream::uint30::MAX_SERIALIZED_LENGTH;
+    prefixLength+=Stream::StreamID().serialize(prefix+prefixLength,sizeof(prefix)-prefixLength);
+    prefix[prefixLength++]=TCPStream::TCPStreamCompressedPacket;
+    prefixLength+=sid.serialize(prefix+prefixLength,sizeof(prefix)-prefixLength);
+    prefixLength+=Stream::uint30((uint32)dataSize).serialize(prefix+prefixLength,sizeof(prefix)-prefixLength);
+
+    z_stream deflater;
+    std::memset(&deflater,0,sizeof(deflater));
+    if (deflateInit(&deflater,Z_BEST_SPEED)!=Z_OK) {
+        return NULL;
+    }
+    size_t bound=deflateBound(&deflater,(uLong)dataSize);
+    Chunk*retval=socket->allocateChunk(prefixLength+bound);
+    std::memcpy(&*retval->begin(),prefix,prefixLength);
+    deflater.next_out=(Bytef*)&(*retval)[prefixLength];
+    deflater.avail_out=(uInt)bound;
+    int status=Z_OK;
+    for (int i=0;i<3&&status==Z_OK;++i) {
+        if (i<2&&pieces[i].size()==0) {
+            continue;//deflate reports an error for a flush with no input and nothing to flush
+        }
+        deflater.next_in=(Bytef*)pieces[i].data();
+        deflater.avail_in=(uInt)pieces[i].size();
+        status=deflate(&deflater,i==2?Z_FINISH:Z_NO_FLUSH);
+        if (deflater.avail_in) {
+            status=Z_BUF_ERROR;
+        }
+    }
+    size_t deflatedSize=bound-deflater.avail_out;
+    deflateEnd(&deflater);
+    Stream::uint30 packetLength((uint32)(prefixLength-Stream::uint30::MAX_SERIALIZED_LENGTH+deflatedSize));
+    uint8 packetLengthSerialized[Stream::uint30::MAX_SERIALIZED_LENGTH];
+    unsigned int packetHeaderLength=packetLength.serialize(packetLengthSerialized,Stream::uint30::MAX_SERIALIZED_LENGTH);
+    size_t unusedPrefix=Stream::uint30::MAX_SERIALIZED_LENGTH-packetHeaderLength;
+    if (status!=Z_STREAM_END||prefixLength+deflatedSize-unusedPrefix>=uncompressedPacketSize) {
+        socket->releaseChunk(retval);
+        return NULL;
+    }
+    std::memcpy(&(*retval)[unusedPrefix],packetLengthSerialized,packetHeaderLength);
+    retval->resize(prefixLength+deflatedSize);
+    retval->erase(retval->begin(),retval->begin()+unusedPrefix);
+    sCompressionSavedBytes.add(uncompressedPacketSize-retval->size());
+    return retval;
+}
+#endif
+}
+TCPStream::TCPStream(const std::tr1::shared_ptr<MultiplexedSocket>&shared_socket,const Stream::StreamID&sid):mSocket(shared_socket),mID(sid),mSendWeight(1),mHighWatermark(0),mSendStatus(new AtomicValue<int>(0)) {
 
 }
 void TCPStream::send(const Chunk&data, StreamReliability reliability) {
@@ -53,6 +121,12 @@ void TCPStream::send(MemoryReference firstChunk, StreamReliability reliability)
     send(firstChunk,MemoryReference::null(),reliability);
 }
 void TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, StreamReliability reliability) {
+    sendFramed(firstChunk,secondChunk,SharedChunk(),reliability);
+}
+void TCPStream::send(const SharedChunk&payload, StreamReliability reliability) {
+    sendFramed(MemoryReference::null(),MemoryReference::null(),payload,reliability);
+}
+void TCPStream::sendFramed(MemoryReference firstChunk, MemoryReference secondChunk, const SharedChunk&payload, StreamReliability reliability) {
     MultiplexedSocket::RawRequest toBeSent;
     // only allow 3 of the four possibilities because unreliable ordered is tricky and usually useless
     switch(reliability) {
@@ -70,33 +144,46 @@ void TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
         break;
     }
     toBeSent.originStream=getID();
+    toBeSent.weight=mSendWeight;
     uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
     unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
     unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
     ///this function should never return something larger than the  MAX_SERIALIZED_LEGNTH
     assert(successLengthNeeded<=streamIdLength);
     streamIdLength=successLengthNeeded;
-    size_t totalSize=firstChunk.size()+secondChunk.size();
+    size_t payloadSize=payload?payload->size():0;
+    size_t totalSize=firstChunk.size()+secondChunk.size()+payloadSize;
     totalSize+=streamIdLength;
     uint30 packetLength=uint30(totalSize);
     uint8 packetLengthSerialized[uint30::MAX_SERIALIZED_LENGTH];
     unsigned int packetHeaderLength=packetLength.serialize(packetLengthSerialized,uint30::MAX_SERIALIZED_LENGTH);
-    //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
-    //packetHeaderLength = the length of the length component of the packet
-    toBeSent.data=new Chunk(totalSize+packetHeaderLength);
-
-    uint8 *outputBuffer=&(*toBeSent.data)[0];
-    std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
-    std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
-    if (firstChunk.size()) {
-        std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
-                    firstChunk.data(),
-                    firstChunk.size());
-    }
-    if (secondChunk.size()) {
-        std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
-                    secondChunk.data(),
-                    secondChunk.size());
+    toBeSent.data=NULL;
+#ifdef HAVE_ZLIB
+    unsigned int threshold=compressThreshold->as<unsigned int>();
+    if (threshold&&totalSize-streamIdLength>=threshold&&mSocket->peerInflates()) {
+        toBeSent.data=constructCompressedPacket(&*mSocket,toBeSent.originStream,firstChunk,secondChunk,payload.get(),totalSize+packetHeaderLength);
+    }
+#endif
+    if (toBeSent.data==NULL) {
+        //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
+        //packetHeaderLength = the length of the length component of the packet. The payload is not copied: it follows this Chunk onto the wire
+        toBeSent.data=mSocket->allocateChunk(totalSize-payloadSize+packetHeaderLength);
+        if (payloadSize)
+            toBeSent.payload=payload;
+
+        uint8 *outputBuffer=&(*toBeSent.data)[0];
+        std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
+        std::memcpy(outputBuffer+packetHeaderLength,serializedStreamId,streamIdLength);
+        if (firstChunk.size()) {
+            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength],
+                        firstChunk.data(),
+                        firstChunk.size());
+        }
+        if (secondChunk.size()) {
+            std::memcpy(&outputBuffer[packetHeaderLength+streamIdLength+firstChunk.size()],
+                        secondChunk.data(),
+                        secondChunk.size());
+        }
     }
     bool didsend=false;
     //indicate to other would-be TCPStream::close()ers that we are sending and they will have to wait until we give up control to actually ack the close and shut down the stream
@@ -109,7 +196,7 @@ void TCPStream::send(MemoryReference firstChunk, MemoryReference secondChunk, St
     --(*mSendStatus);
     if (!didsend) {
         //if the data was not sent, its our job to clean it up
-        delete toBeSent.data;
+        mSocket->releaseChunk(toBeSent.data);
         SILOG(tcpsst,debug,"printing to closed stream id "<<getID().read());
     }
 }
@@ -134,6 +221,10 @@ void TCPStream::close() {
     if (justClosed) {
         //obliterate all incoming callback to this stream
         mSocket->addCallbacks(getID(),NULL);
+        if (mHighWatermark) {
+            mSocket->setSendWatermarks(getID(),0,0,WatermarkCallback());
+            mHighWatermark=0;
+        }
         //send out that the stream is now closed on all sockets
         MultiplexedSocket::closeStream(mSocket,getID());
     }
@@ -141,10 +232,45 @@ void TCPStream::close() {
 TCPStream::~TCPStream() {
     close();
 }
-TCPStream::TCPStream(IOService&io):mIO(&io),mSendStatus(new AtomicValue<int>(0)) {
+TCPStream::TCPStream(IOService&io):mIO(&io),mSendWeight(1),mHighWatermark(0),mSendStatus(new AtomicValue<int>(0)) {
+}
+void TCPStream::setSendWeight(uint32 weight) {
+    mSendWeight=weight?weight:1;
+}
+void TCPStream::setSendWatermarks(size_t low, size_t high, const WatermarkCallback&callback) {
+    if (mSocket) {
+        mHighWatermark=callback?high:0;
+        mSocket->setSendWatermarks(getID(),low,mHighWatermark,callback);
+    }
+}
+size_t TCPStream::queuedSendBytes()const {
+    return mSocket?(size_t)mSocket->queuedSendBytes():0;
+}
+bool TCPStream::trySend(MemoryReference data, StreamReliability reliability) {
+    if (mHighWatermark&&queuedSendBytes()>=mHighWatermark) {
+        return false;
+    }
+    send(data,reliability);
+    return true;
+}
+bool TCPStream::trySend(const SharedChunk&payload, StreamReliability reliability) {
+    if (mHighWatermark&&queuedSendBytes()>=mHighWatermark) {
+        return false;
+    }
+    send(payload,reliability);
+    return true;
 }
 
-#define NUM_SIMULANEOUS_CONNECTIONS 1 // 3 is a good number here.
+namespace {
+OptionValue*parallelSockets;
+InitializeGlobalOptions o("tcpsst",
+                    parallelSockets=new OptionValue("parallel-sockets","1",OptionValueType<unsigned int>(),"TCP connections each outbound stream is striped over (3 is a good number for bulk transfers)"),
+                    NULL);
+unsigned int numSimultaneousConnections() {
+    unsigned int retval=parallelSockets->as<unsigned int>();
+    return retval?(retval>99?99:retval):1;
+}
+}
 
 void TCPStream::connect(const Address&addy,
                         const SubstreamCallback &substreamCallback,
@@ -156,7 +282,7 @@ void TCPStream::connect(const Address&addy,
     mSocket->addCallbacks(getID(),new Callbacks(connectionCallback,
                                                 bytesReceivedCallback,
                                                 mSendStatus));
-    mSocket->connect(addy,NUM_SIMULANEOUS_CONNECTIONS);
+    mSocket->connect(addy,numSimultaneousConnections());
 }
 
 void TCPStream::prepareOutboundConnection(
@@ -169,7 +295,7 @@ void TCPStream::prepareOutboundConnection(
     mSocket->addCallbacks(getID(),new Callbacks(connectionCallback,
                                                 bytesReceivedCallback,
                                                 mSendStatus));
-    mSocket->prepareConnect(NUM_SIMULANEOUS_CONNECTIONS);
+    mSocket->prepareConnect(numSimultaneousConnections());
 }
 void TCPStream::connect(const Address&addy) {
     assert(mSocket);
@@ -185,6 +311,7 @@ Stream* TCPStream::clone(const SubstreamCallback &cloneCallback) {
     }
     TCPStream *retval=new TCPStream(*mIO);
     retval->mSocket=mSocket;
+    retval->mSendWeight=mSendWeight;
 
     StreamID newID=mSocket->getNewID();
     retval->mID=newID;
@@ -200,6 +327,7 @@ Stream* TCPStream::clone(const ConnectionCallback &connectionCallback,
     }
     TCPStream *retval=new TCPStream(*mIO);
     retval->mSocket=mSocket;
+    retval->mSendWeight=mSendWeight;
 
     StreamID newID=mSocket->getNewID();
     retval->mID=newID;
@@ -55,6 +55,8 @@ class IOService;
  * The other side respinds in turn on each connection with a similar handshake (though the 16 bytes may be different)
  * now the connection is online. The remote host may immediately follow the handshake with live packets and 
  * the other side may respond as soon as it receives the remote hosts handshake response
+ * A side able to inflate compressed packets adds 10 to the tens digit of N (so '03' becomes ':3'); older peers read
+ * that digit modulo 10 and are unaffected. The listener only sets the flag in its response if the connector set it.
  *
  * --Live Phase--
  * The first live stream has StreamID of 1. New streams coming from listener must have even StreamID's and new 
@@ -80,6 +82,11 @@ class IOService;
  * This party may not reuse the streamID (given parity match) until it receives control packets with control code equal to 2 (close Ack) on all sockets.
  * The other side must keep the bargain and send the control packet with control code 2 on all sockets to allow ID reuse.
  * 
+ * --Compression--
+ * Once both handshakes carried the compression flag, a side may replace a large packet with a control packet
+ * with control code 3, followed by the variable length StreamID of the original packet, an int30 holding the
+ * original data length and finally the zlib deflated data. It travels on the socket the original would have used.
+ *
  * If all streams are shut down, the sockets may be deactivated
  * If the socket disconnects due to error, then Disconnect callbacks must be called
  */
@@ -91,11 +98,14 @@ public:
     }
     enum HeaderSizeEnumerant {
         STRING_PREFIX_LENGTH=6,
-        TcpSstHeaderSize=24
+        TcpSstHeaderSize=24,
+        ///Added to the tens digit of the connection count by a side that can inflate TCPStreamCompressedPacket
+        TcpSstHeaderCompressionFlag=10
     };
     enum TCPStreamControlCodes {
         TCPStreamCloseStream=1,
-        TCPStreamAckCloseStream=2
+        TCPStreamAckCloseStream=2,
+        TCPStreamCompressedPacket=3
     };
 private:
     friend class MultiplexedSocket;
@@ -108,12 +118,18 @@ private:
     void addCallbacks(Callbacks*);
     ///The streamID that must be prepended to the data within any packet sent and all received packets for this Stream
     StreamID mID;
+    ///This stream's share of a congested connection relative to its sibling substreams. Clones start out with the weight of the stream they came from
+    uint32 mSendWeight;
+    ///The high watermark given to setSendWatermarks, above which trySend declines: 0 when none was set
+    size_t mHighWatermark;
     enum {
     ///A bit flag indicating that the socket is being shut down and no further sends may proceed
         SendStatusClosing=(1<<29)
     };
     ///incremented while sending: or'd in SendStatusClosing when close function triggered so no further packets will be sent using old ID.
     std::tr1::shared_ptr<AtomicValue<int> >mSendStatus;
+    ///Frames firstChunk and secondChunk into a single packet, followed on the wire by payload, which is referenced rather than copied
+    void sendFramed(MemoryReference firstChunk, MemoryReference secondChunk, const SharedChunk&payload, StreamReliability reliability);
 public:
     ///Atomically sets the sendStatus for this socket to closed. FIXME: should use atomic compare and swap for |= instead of += right now only supports 2 non-io threads closing at once
     static bool closeSendStatus(AtomicValue<int>&vSendStatus);
@@ -147,6 +163,8 @@ public:
     virtual void send(MemoryReference, MemoryReference, StreamReliability);
     ///Implementation of send interface
     virtual void send(const Chunk&data,StreamReliability);
+    ///Implementation of send interface: the payload is written to the socket in place rather than copied into the packet
+    virtual void send(const SharedChunk&payload,StreamReliability);
     ///Implementation of connect interface
     virtual void connect(
         const Address& addy,
@@ -178,6 +196,16 @@ public:
     ///Creates a new substream on this connection. This is for when the callbacks do not require the Stream*
     virtual Stream* clone(const ConnectionCallback &connectionCallback,
                           const BytesReceivedCallback&chunkReceivedCallback);
+    ///Implementation of setSendWeight interface
+    virtual void setSendWeight(uint32 weight);
+    ///Implementation of setSendWatermarks interface: the backlog counted is that of the whole connection, shared by all its substreams
+    virtual void setSendWatermarks(size_t low, size_t high, const WatermarkCallback&callback);
+    ///Implementation of queuedSendBytes interface: counts the bytes queued by every substream of the connection
+    virtual size_t queuedSendBytes()const;
+    ///Implementation of trySend interface
+    virtual bool trySend(MemoryReference data, StreamReliability reliability);
+    ///Implementation of trySend interface
+    virtual bool trySend(const SharedChunk&payload, StreamReliability reliability);
     //Shuts down the socket, allowing StreamID to be reused and opposing stream to get disconnection callback
     virtual void close();
     ~TCPStream();
@@ -36,43 +36,108 @@
 #include "TCPStreamListener.hpp"
 #include "ASIOStreamBuilder.hpp"
 #include "options/Options.hpp"
+#include "network/IOServicePool.hpp"
+#include "network/IOServiceFactory.hpp"
 namespace Sirikata { namespace Network {
 using namespace boost::asio::ip;
 
+namespace {
+OptionValue*acceptThreads;
+OptionValue*reusePort;
+InitializeGlobalOptions o("tcpsst",
+                    acceptThreads=new OptionValue("accept-threads","1",OptionValueType<unsigned int>(),"IOService threads accepted connections are spread over, round robin (0 gives one per core, 1 keeps them on the listener's IOService)"),
+                    reusePort=new OptionValue("reuseport","false",OptionValueType<bool>(),"with accept-threads, every thread accepts and reads handshakes on its own SO_REUSEPORT socket instead of one thread accepting for all"),
+                    NULL);
+
+///Shared by every listener in the process; stopped when the plugin goes away
+class AcceptPool {
+    boost::mutex mMutex;
+    IOServicePool*mPool;
+public:
+    AcceptPool():mPool(NULL) {
+    }
+    IOServicePool*get() {
+        unsigned int threads=acceptThreads->as<unsigned int>();
+        if (threads==1)
+            return NULL;
+        boost::mutex::scoped_lock lok(mMutex);
+        if (!mPool) {
+            mPool=new IOServicePool(threads);
+            mPool->run();
+        }
+        return mPool;
+    }
+    ~AcceptPool() {
+        //connections may outlive the plugin's statics, so the IOServices are left allocated
+        if (mPool)
+            mPool->stop();
+    }
+} sAcceptPool;
+}
+
 TCPStreamListener::TCPStreamListener(IOService&io) {
     mIOService=&io;
     mTCPAcceptor=NULL;
+    mAcceptorPool=NULL;
 }
-bool newAcceptPhase(TCPListener*listen, IOService* io,const Stream::SubstreamCallback &cb);
-void handleAccept(const std::tr1::shared_ptr<std::auto_ptr<TCPSocket> >&socket,TCPListener*listen, IOService* io,const Stream::SubstreamCallback &cb,const boost::system::error_code& error){
+bool newAcceptPhase(TCPListener*listen, IOService* io, IOServicePool*pool, const Stream::SubstreamCallback &cb);
+void handleAccept(const std::tr1::shared_ptr<std::auto_ptr<TCPSocket> >&socket,TCPListener*listen, IOService* io,IOServicePool*pool,IOService* connectionIO,const Stream::SubstreamCallback &cb,const boost::system::error_code& error){
     if(error) {
 		boost::system::system_error se(error);
 		SILOG(tcpsst,error, "ERROR IN THE TCP STREAM ACCEPTING PROCESS"<<se.what() << std::endl);
         //FIXME: attempt more?
     }else {
         TCPSocket*newSocket=socket->release();
-        ASIOStreamBuilder::beginNewStream(newSocket,io,cb);
-        newAcceptPhase(listen,io,cb);
+        ASIOStreamBuilder::beginNewStream(newSocket,connectionIO,cb);
+        newAcceptPhase(listen,io,pool,cb);
     }
 }
-bool newAcceptPhase(TCPListener*listen, IOService* io, const Stream::SubstreamCallback &cb) {
-    std::auto_ptr<TCPSocket>tmpsocket(new TCPSocket(*io));
+///pool NULL keeps accepted connections on io, the IOService of the acceptor
+bool newAcceptPhase(TCPListener*listen, IOService* io, IOServicePool*pool, const Stream::SubstreamCallback &cb) {
+    //the connection lives on the IOService its socket is created on, so all its callbacks run on that thread
+    IOService*connectionIO=pool?pool->next():io;
+    std::auto_ptr<TCPSocket>tmpsocket(new TCPSocket(*connectionIO));
     
     std::tr1::shared_ptr<std::auto_ptr<TCPSocket> > socketWrapper(new std::auto_ptr<TCPSocket> (tmpsocket));
     //need to use boost bind to avoid TR1 errors about compatibility with boost::asio::placeholders
      
     listen->async_accept(**socketWrapper,
-                         std::tr1::bind(&handleAccept,socketWrapper,listen,io,cb,_1));
+                         std::tr1::bind(&handleAccept,socketWrapper,listen,io,pool,connectionIO,cb,_1));
     return true;
 }
 bool TCPStreamListener::listen (const Address&address,
                                 const Stream::SubstreamCallback&newStreamCallback) {
-
+    IOServicePool*pool=sAcceptPool.get();
+    if (pool&&reusePort->as<bool>()) {
+        if (TCPListener::supportsReusePort())
+            return listenOnEveryThread(pool,address,newStreamCallback);
+        SILOG(tcpsst,warning,"SO_REUSEPORT is not available, one thread accepts for the whole pool");
+    }
     mTCPAcceptor = new TCPListener(*mIOService,tcp::endpoint(tcp::v4(), atoi(address.getService().c_str())));
-    return newAcceptPhase(mTCPAcceptor,mIOService,newStreamCallback);
+    return newAcceptPhase(mTCPAcceptor,mIOService,pool,newStreamCallback);
+}
+bool TCPStreamListener::listenOnEveryThread(IOServicePool*pool,
+                                            const Address&address,
+                                            const Stream::SubstreamCallback&newStreamCallback) {
+    mAcceptorPool=pool;
+    mTCPAcceptor = new TCPListener(*pool->get(0),tcp::endpoint(tcp::v4(), atoi(address.getService().c_str())),true);
+    //a port picked by the system for the first acceptor is the one the others share
+    tcp::endpoint shared(tcp::v4(),mTCPAcceptor->local_endpoint().port());
+    for (unsigned int i=1;i<pool->size();++i)
+        mPoolAcceptors.push_back(new TCPListener(*pool->get(i),shared,true));
+    //each thread accepts for itself and reads the handshake of what it accepted
+    newAcceptPhase(mTCPAcceptor,pool->get(0),NULL,newStreamCallback);
+    for (unsigned int i=0;i<mPoolAcceptors.size();++i)
+        newAcceptPhase(mPoolAcceptors[i],pool->get(i+1),NULL,newStreamCallback);
+    return true;
+}
+namespace {
+void deleteListener(TCPListener*listener) {
+    delete listener;
+}
 }
 TCPStreamListener::~TCPStreamListener() {
-    delete mTCPAcceptor;
+    close();
 }
 String TCPStreamListener::listenAddressName() const {
     std::stringstream retval;
@@ -87,7 +152,16 @@ Address TCPStreamListener::listenAddress() const {
                    port.str());
 }
 void TCPStreamListener::close(){
-    delete mTCPAcceptor;
+    if (mAcceptorPool) {
+        //acceptors on pool threads are only touched from their own thread
+        IOServiceFactory::dispatchServiceMessage(mAcceptorPool->get(0),std::tr1::bind(&deleteListener,mTCPAcceptor));
+        for (unsigned int i=0;i<mPoolAcceptors.size();++i)
+            IOServiceFactory::dispatchServiceMessage(mAcceptorPool->get(i+1),std::tr1::bind(&deleteListener,mPoolAcceptors[i]));
+        mPoolAcceptors.clear();
+        mAcceptorPool=NULL;
+    }else {
+        delete mTCPAcceptor;
+    }
     mTCPAcceptor=NULL;
 }
 
@@ -36,6 +36,7 @@
 namespace Sirikata { namespace Network {
 class IOService;
 class TCPListener;
+class IOServicePool;
 /**
  * This class waits on a service and listens for incoming connections
  * It calls the callback whenever such connections are encountered
@@ -59,8 +60,17 @@ public:
     }
 
     virtual ~TCPStreamListener();
+private:
+    bool listenOnEveryThread(IOServicePool*pool,
+                             const Address&addy,
+                             const Stream::SubstreamCallback&newStreamCallback);
+public:
     IOService * mIOService;
     TCPListener *mTCPAcceptor;
+    ///with tcpsst --reuseport, the pool whose every thread accepts: mTCPAcceptor is on the first one
+    IOServicePool *mAcceptorPool;
+    ///and the acceptors on the others, in pool order
+    std::vector<TCPListener*> mPoolAcceptors;
 };
 } }
 #endif
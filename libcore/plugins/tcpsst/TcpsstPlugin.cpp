@@ -31,6 +31,7 @@
  */
 
 #include <util/Platform.hpp>
+#include <util/PluginManager.hpp>
 #include <boost/thread.hpp>
 #include "network/StreamFactory.hpp"
 #include "network/StreamListenerFactory.hpp"
@@ -38,7 +39,7 @@
 #include "TCPStreamListener.hpp"
 static int core_plugin_refcount = 0;
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     using namespace Sirikata;
     if (core_plugin_refcount==0) {
         using std::tr1::placeholders::_1;
@@ -56,15 +57,15 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
     core_plugin_refcount++;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
     return ++core_plugin_refcount;
 }
-SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
     assert(core_plugin_refcount>0);
     return --core_plugin_refcount;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     using namespace Sirikata;
     if (core_plugin_refcount>0) {
         core_plugin_refcount--;
@@ -76,9 +77,11 @@ SIRIKATA_PLUGIN_EXPORT_C void destroy() {
     }
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "tcpsst";
 }
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(tcpsst)
@@ -0,0 +1,226 @@
+/*  Sirikata Network Utilities
+ *  UDPSession.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Platform.hpp"
+#include "UDPSession.hpp"
+#include "UDPStream.hpp"
+#include <boost/bind.hpp>
+#include <boost/array.hpp>
+namespace Sirikata { namespace Network {
+using namespace boost::asio::ip;
+
+UDPPort::UDPPort(IOService&io):mIO(io),mSocket(io) {
+}
+UDPPort::~UDPPort() {
+}
+bool UDPPort::open(const UDPEndpoint&local) {
+    boost::system::error_code error;
+    boost::mutex::scoped_lock lok(mMutex);
+    mSocket.open(local.protocol(),error);
+    if (!error)
+        mSocket.bind(local,error);
+    if (!error)
+        mSocket.non_blocking(true,error);
+    if (error) {
+        SILOG(udpsst,error,"Cannot open UDP port "<<local<<": "<<error.message()<<", unreliable sends will use the reliable channel");
+        mSocket.close(error);
+        return false;
+    }
+    return true;
+}
+void UDPPort::startReceiving() {
+    boost::mutex::scoped_lock lok(mMutex);
+    if (!mSocket.is_open())
+        return;
+    mSocket.async_receive_from(boost::asio::buffer(mBuffer,sizeof(mBuffer)),
+                               mSender,
+                               boost::bind(&UDPPort::handleReceive,
+                                           shared_from_this(),
+                                           boost::asio::placeholders::error,
+                                           boost::asio::placeholders::bytes_transferred));
+}
+void UDPPort::close() {
+    boost::system::error_code ignored;
+    boost::mutex::scoped_lock lok(mMutex);
+    mSocket.close(ignored);
+}
+bool UDPPort::isOpen() {
+    boost::mutex::scoped_lock lok(mMutex);
+    return mSocket.is_open();
+}
+void UDPPort::addSession(const std::tr1::shared_ptr<UDPSession>&session) {
+    boost::mutex::scoped_lock lok(mMutex);
+    mSessions[session->token()]=session;
+}
+void UDPPort::removeSession(uint64 token) {
+    boost::mutex::scoped_lock lok(mMutex);
+    mSessions.erase(token);
+}
+std::tr1::shared_ptr<UDPSession> UDPPort::findSession(uint64 token) {
+    boost::mutex::scoped_lock lok(mMutex);
+    SessionMap::iterator where=mSessions.find(token);
+    if (where==mSessions.end())
+        return std::tr1::shared_ptr<UDPSession>();
+    return where->second.lock();
+}
+
+void UDPPort::send(const UDPEndpoint&to, uint64 token, uint32 key, MemoryReference first, MemoryReference second) {
+    uint8 header[HEADER_SIZE];
+    for (int i=0;i<8;++i)
+        header[i]=(uint8)(token>>(8*i));
+    for (int i=0;i<4;++i)
+        header[8+i]=(uint8)(key>>(8*i));
+    boost::array<boost::asio::const_buffer,3> buffers={{
+        boost::asio::buffer(header,HEADER_SIZE),
+        boost::asio::buffer(first.data(),first.size()),
+        boost::asio::buffer(second.data(),second.size())}};
+    boost::system::error_code error;
+    boost::mutex::scoped_lock lok(mMutex);
+    mSocket.send_to(buffers,to,0,error);
+}
+
+void UDPPort::handleReceive(const std::tr1::shared_ptr<UDPPort>&thus,
+                            const boost::system::error_code&error,
+                            std::size_t bytes) {
+    if (error==boost::asio::error::operation_aborted||error==boost::asio::error::bad_descriptor)
+        return;
+    if (!error&&bytes>=HEADER_SIZE) {
+        uint64 token=0;
+        uint32 key=0;
+        for (int i=0;i<8;++i)
+            token|=((uint64)thus->mBuffer[i])<<(8*i);
+        for (int i=0;i<4;++i)
+            key|=((uint32)thus->mBuffer[8+i])<<(8*i);
+        std::tr1::shared_ptr<UDPSession> session=thus->findSession(token);
+        if (session)
+            session->receive(key,thus->mSender,thus->mBuffer+HEADER_SIZE,bytes-HEADER_SIZE);
+    }
+    thus->startReceiving();
+}
+
+UDPSession::UDPSession(const std::tr1::shared_ptr<UDPPort>&port, uint64 token, bool isClient)
+    : mPort(port),
+      mToken(token),
+      mIsClient(isClient),
+      mNextKey(0),
+      mHasRemote(false),
+      mResolver(port->getIOService()),
+      mPingTimer(port->getIOService()) {
+}
+UDPSession::~UDPSession() {
+    boost::system::error_code ignored;
+    mPingTimer.cancel(ignored);
+    mPort->removeSession(mToken);
+    if (mIsClient)
+        mPort->close();
+}
+uint32 UDPSession::newKey() {
+    boost::recursive_mutex::scoped_lock lok(mMutex);
+    uint32 key=(mNextKey++)&0x7fffffff;
+    return mIsClient?key:(key|0x80000000);
+}
+void UDPSession::addStream(uint32 key, UDPStream*stream) {
+    boost::recursive_mutex::scoped_lock lok(mMutex);
+    mStreams[key]=stream;
+}
+void UDPSession::removeStream(uint32 key) {
+    boost::recursive_mutex::scoped_lock lok(mMutex);
+    mStreams.erase(key);
+}
+
+void UDPSession::resolve(const Address&address) {
+    if (!mPort->isOpen())
+        return;
+    udp::resolver::query query(udp::v4(), address.getHostName(), address.getService());
+    mResolver.async_resolve(query,
+                            boost::bind(&UDPSession::handleResolve,
+                                        shared_from_this(),
+                                        boost::asio::placeholders::error,
+                                        boost::asio::placeholders::iterator));
+}
+void UDPSession::handleResolve(const std::tr1::shared_ptr<UDPSession>&thus,
+                               const boost::system::error_code&error,
+                               udp::resolver::iterator it) {
+    if (error||it==udp::resolver::iterator()) {
+        SILOG(udpsst,warning,"Cannot resolve the UDP port of the listener, unreliable sends will use the reliable channel");
+        return;
+    }
+    {
+        boost::recursive_mutex::scoped_lock lok(thus->mMutex);
+        thus->mRemote=*it;
+        thus->mHasRemote=true;
+    }
+    ping(std::tr1::weak_ptr<UDPSession>(thus),0,boost::system::error_code());
+}
+void UDPSession::ping(const std::tr1::weak_ptr<UDPSession>&weakThus,
+                      int attempt,
+                      const boost::system::error_code&error) {
+    //the timer does not keep the session alive once its streams are gone
+    std::tr1::shared_ptr<UDPSession> thus=weakThus.lock();
+    if (error||!thus)
+        return;
+    thus->mPort->send(thus->mRemote,thus->mToken,UDPPort::PING_KEY,MemoryReference::null(),MemoryReference::null());
+    if (++attempt<UDPPort::PING_ATTEMPTS) {
+        thus->mPingTimer.expires_from_now(boost::posix_time::milliseconds(UDPPort::PING_INTERVAL_MS<<attempt));
+        thus->mPingTimer.async_wait(boost::bind(&UDPSession::ping,std::tr1::weak_ptr<UDPSession>(thus),attempt,boost::asio::placeholders::error));
+    }
+}
+
+bool UDPSession::send(uint32 key, MemoryReference first, MemoryReference second) {
+    UDPEndpoint to;
+    {
+        boost::recursive_mutex::scoped_lock lok(mMutex);
+        if (!mHasRemote)
+            return false;
+        to=mRemote;
+    }
+    mPort->send(to,mToken,key,first,second);
+    return true;
+}
+
+void UDPSession::receive(uint32 key, const UDPEndpoint&from, const uint8*data, size_t size) {
+    boost::recursive_mutex::scoped_lock lok(mMutex);
+    if (!mIsClient) {
+        //the client's address as the listener sees it, which may change under a NAT
+        mRemote=from;
+        mHasRemote=true;
+    }
+    if (key==UDPPort::PING_KEY)
+        return;
+    std::map<uint32,UDPStream*>::iterator where=mStreams.find(key);
+    if (where!=mStreams.end()) {
+        Chunk chunk(data,data+size);
+        where->second->receiveDatagram(chunk);
+    }
+}
+
+} }
@@ -0,0 +1,138 @@
+/*  Sirikata Network Utilities
+ *  UDPSession.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_UDPSession_HPP__
+#define SIRIKATA_UDPSession_HPP__
+#include "network/TCPDefinitions.hpp"
+#include "network/Stream.hpp"
+#include <boost/thread/recursive_mutex.hpp>
+namespace Sirikata { namespace Network {
+class UDPStream;
+class UDPSession;
+typedef boost::asio::ip::udp::socket InternalUDPSocket;
+typedef boost::asio::ip::udp::endpoint UDPEndpoint;
+
+/**
+ * A UDP socket and the sessions whose datagrams arrive on it.  A connecting
+ * stream opens a port of its own, a listener shares one port between every
+ * connection it accepts.  Each datagram starts with the token of the session
+ * and the key of the stream within that session, both little endian, and
+ * the rest is the payload handed to that stream.
+ */
+class UDPPort:public std::tr1::enable_shared_from_this<UDPPort>, Noncopyable {
+public:
+    enum {
+        HEADER_SIZE=12,
+        ///key of the empty datagram a client sends so the listener learns where to reach it
+        PING_KEY=0xffffffff,
+        ///pings sent after connecting, in case the first ones beat the hello or get lost
+        PING_ATTEMPTS=5,
+        PING_INTERVAL_MS=200,
+        MAX_DATAGRAM_SIZE=65536
+    };
+    UDPPort(IOService&io);
+    ~UDPPort();
+    ///binds the socket, returns false and leaves it closed if that fails
+    bool open(const UDPEndpoint&local);
+    ///starts the receive loop: must be called once the port is held by a shared_ptr
+    void startReceiving();
+    void close();
+    bool isOpen();
+    void addSession(const std::tr1::shared_ptr<UDPSession>&session);
+    void removeSession(uint64 token);
+    ///returns the live session with the given token, or an empty pointer
+    std::tr1::shared_ptr<UDPSession> findSession(uint64 token);
+    /**
+     * Sends the header and both chunks as a single datagram.  The socket never
+     * blocks: if the kernel has no room the datagram is dropped, which is what
+     * an unreliable send promises anyway.
+     */
+    void send(const UDPEndpoint&to, uint64 token, uint32 key, MemoryReference first, MemoryReference second);
+    IOService&getIOService() {
+        return mIO;
+    }
+private:
+    static void handleReceive(const std::tr1::shared_ptr<UDPPort>&thus,
+                              const boost::system::error_code&error,
+                              std::size_t bytes);
+    IOService&mIO;
+    boost::mutex mMutex;
+    InternalUDPSocket mSocket;
+    typedef std::tr1::unordered_map<uint64,std::tr1::weak_ptr<UDPSession> > SessionMap;
+    SessionMap mSessions;
+    UDPEndpoint mSender;
+    uint8 mBuffer[MAX_DATAGRAM_SIZE];
+};
+
+/**
+ * The datagram half of one udpsst connection: the endpoint of the peer and
+ * the streams, the top level one and its substreams, that datagrams for the
+ * connection are handed to.  Kept alive by the streams that use it.
+ */
+class UDPSession:public std::tr1::enable_shared_from_this<UDPSession>, Noncopyable {
+public:
+    UDPSession(const std::tr1::shared_ptr<UDPPort>&port, uint64 token, bool isClient);
+    ~UDPSession();
+    uint64 token()const {
+        return mToken;
+    }
+    ///Picks a key for a stream opened on this side; the top bit says which side picked it
+    uint32 newKey();
+    void addStream(uint32 key, UDPStream*stream);
+    void removeStream(uint32 key);
+    ///Looks up the UDP port of the listener: it is the same number as its TCP port
+    void resolve(const Address&address);
+    ///false if the peer cannot be reached by datagram (yet): the caller falls back to the reliable channel
+    bool send(uint32 key, MemoryReference first, MemoryReference second);
+    ///Called by the port for every datagram carrying this session's token
+    void receive(uint32 key, const UDPEndpoint&from, const uint8*data, size_t size);
+private:
+    static void handleResolve(const std::tr1::shared_ptr<UDPSession>&thus,
+                              const boost::system::error_code&error,
+                              boost::asio::ip::udp::resolver::iterator it);
+    static void ping(const std::tr1::weak_ptr<UDPSession>&weakThus,
+                     int attempt,
+                     const boost::system::error_code&error);
+    boost::recursive_mutex mMutex;
+    std::tr1::shared_ptr<UDPPort> mPort;
+    uint64 mToken;
+    bool mIsClient;
+    uint32 mNextKey;
+    bool mHasRemote;
+    UDPEndpoint mRemote;
+    std::map<uint32,UDPStream*> mStreams;
+    boost::asio::ip::udp::resolver mResolver;
+    boost::asio::deadline_timer mPingTimer;
+};
+
+} }
+#endif
@@ -0,0 +1,306 @@
+/*  Sirikata Network Utilities
+ *  UDPStream.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Platform.hpp"
+#include "network/TCPDefinitions.hpp"
+#include "network/StreamFactory.hpp"
+#include "options/Options.hpp"
+#include "util/UUID.hpp"
+#include "UDPStream.hpp"
+#include "UDPSession.hpp"
+namespace Sirikata { namespace Network {
+using namespace boost::asio::ip;
+using std::tr1::placeholders::_1;
+using std::tr1::placeholders::_2;
+
+namespace {
+OptionValue*maxDatagramSize;
+InitializeGlobalOptions o("udpsst",
+                    maxDatagramSize=new OptionValue("max-datagram","1400",OptionValueType<unsigned int>(),"largest datagram an unreliable send goes out as, bigger ones use the reliable channel (keep it under the path MTU)"),
+                    NULL);
+
+const char HELLO_MAGIC[4]={'U','D','P','S'};
+
+uint64 randomToken() {
+    String bytes=UUID::random().rawData();
+    uint64 token=0;
+    for (int i=0;i<8;++i)
+        token|=((uint64)(uint8)bytes[i])<<(8*i);
+    return token;
+}
+
+std::tr1::shared_ptr<UDPSession> sameSession(const std::tr1::weak_ptr<UDPSession>&weakSession, uint64 token) {
+    std::tr1::shared_ptr<UDPSession> session=weakSession.lock();
+    if (session&&session->token()==token)
+        return session;
+    return std::tr1::shared_ptr<UDPSession>();
+}
+}
+
+class UDPStream::UDPSetCallbacks:public Stream::SetCallbacks {
+public:
+    bool mCalled;
+    Stream::ConnectionCallback mConnectionCallback;
+    Stream::BytesReceivedCallback mBytesReceivedCallback;
+    UDPSetCallbacks():mCalled(false) {
+    }
+    virtual void operator()(const Stream::ConnectionCallback &connectionCallback,
+                            const Stream::BytesReceivedCallback &bytesReceivedCallback) {
+        mCalled=true;
+        mConnectionCallback=connectionCallback;
+        mBytesReceivedCallback=bytesReceivedCallback;
+    }
+};
+
+UDPStream::UDPStream(IOService&io):mIO(&io),mReliable(NULL),mKey(0),mHasSession(0) {
+}
+UDPStream::~UDPStream() {
+    if (mSession)
+        mSession->removeStream(mKey);
+    delete mReliable;
+}
+Stream*UDPStream::factory() {
+    return new UDPStream(*mIO);
+}
+
+Stream::BytesReceivedCallback UDPStream::setCallbacks(const BytesReceivedCallback&chunkReceivedCallback) {
+    mBytesReceivedCallback=chunkReceivedCallback;
+    return std::tr1::bind(&UDPStream::receiveReliable,this,_1);
+}
+void UDPStream::sendHello(const std::tr1::shared_ptr<UDPSession>&session, uint32 key) {
+    mSession=session;
+    mKey=key;
+    uint64 token=session->token();
+    uint8 hello[HELLO_SIZE];
+    std::memcpy(hello,HELLO_MAGIC,sizeof(HELLO_MAGIC));
+    for (int i=0;i<8;++i)
+        hello[4+i]=(uint8)(token>>(8*i));
+    for (int i=0;i<4;++i)
+        hello[12+i]=(uint8)(key>>(8*i));
+    mReliable->send(MemoryReference(hello,HELLO_SIZE),ReliableOrdered);
+    memory_barrier();
+    mHasSession=1;
+}
+void UDPStream::join() {
+    if (mHasSession.read())
+        mSession->addStream(mKey,this);
+}
+void UDPStream::receiveReliable(const Chunk&data) {
+    if (mAwaitingHello) {
+        SessionLookup lookup;
+        std::swap(lookup,mAwaitingHello);
+        if (data.size()==HELLO_SIZE&&std::memcmp(&data[0],HELLO_MAGIC,sizeof(HELLO_MAGIC))==0) {
+            uint64 token=0;
+            uint32 key=0;
+            for (int i=0;i<8;++i)
+                token|=((uint64)data[4+i])<<(8*i);
+            for (int i=0;i<4;++i)
+                key|=((uint32)data[12+i])<<(8*i);
+            std::tr1::shared_ptr<UDPSession> session=lookup(token);
+            if (session) {
+                mSession=session;
+                mKey=key;
+                memory_barrier();
+                mHasSession=1;
+                join();
+            }
+            return;
+        }
+        //not a udpsst peer: everything stays on the reliable channel
+    }
+    mBytesReceivedCallback(data);
+}
+void UDPStream::receiveDatagram(const Chunk&data) {
+    mBytesReceivedCallback(data);
+}
+
+bool UDPStream::sendDatagram(MemoryReference first, MemoryReference second, StreamReliability reliability) {
+    if (reliability!=Unreliable||!mHasSession.read())
+        return false;
+    if (UDPPort::HEADER_SIZE+first.size()+second.size()>maxDatagramSize->as<unsigned int>())
+        return false;
+    return mSession->send(mKey,first,second);
+}
+void UDPStream::send(MemoryReference data, StreamReliability reliability) {
+    if (!sendDatagram(data,MemoryReference::null(),reliability)&&mReliable)
+        mReliable->send(data,reliability);
+}
+void UDPStream::send(MemoryReference first, MemoryReference second, StreamReliability reliability) {
+    if (!sendDatagram(first,second,reliability)&&mReliable)
+        mReliable->send(first,second,reliability);
+}
+void UDPStream::send(const Chunk&data, StreamReliability reliability) {
+    if (!sendDatagram(MemoryReference(data),MemoryReference::null(),reliability)&&mReliable)
+        mReliable->send(data,reliability);
+}
+void UDPStream::send(const SharedChunk&payload, StreamReliability reliability) {
+    if (payload&&sendDatagram(MemoryReference(*payload),MemoryReference::null(),reliability))
+        return;
+    if (mReliable)
+        mReliable->send(payload,reliability);
+}
+
+void UDPStream::connect(const Address&addy,
+                        const SubstreamCallback &substreamCallback,
+                        const ConnectionCallback &connectionCallback,
+                        const BytesReceivedCallback&chunkReceivedCallback) {
+    prepareOutboundConnection(substreamCallback,connectionCallback,chunkReceivedCallback);
+    connect(addy);
+}
+void UDPStream::prepareOutboundConnection(const SubstreamCallback &substreamCallback,
+                                          const ConnectionCallback &connectionCallback,
+                                          const BytesReceivedCallback&chunkReceivedCallback) {
+    if (!mReliable)
+        mReliable=StreamFactory::getSingleton().getConstructor("tcpsst")(mIO);
+    if (!mReliable) {
+        SILOG(udpsst,error,"udpsst needs the tcpsst plugin for its reliable channel");
+        connectionCallback(ConnectionFailed,"tcpsst plugin not loaded");
+        return;
+    }
+    std::tr1::shared_ptr<UDPPort> port(new UDPPort(*mIO));
+    bool opened=port->open(UDPEndpoint(udp::v4(),0));
+    std::tr1::shared_ptr<UDPSession> session(new UDPSession(port,randomToken(),true));
+    if (opened) {
+        port->addSession(session);
+        port->startReceiving();
+    }
+    SessionLookup lookup=std::tr1::bind(&sameSession,std::tr1::weak_ptr<UDPSession>(session),_1);
+    mReliable->prepareOutboundConnection(std::tr1::bind(&UDPStream::acceptStream,mIO,substreamCallback,lookup,_1,_2),
+                                         connectionCallback,
+                                         setCallbacks(chunkReceivedCallback));
+    sendHello(session,session->newKey());
+    join();
+}
+void UDPStream::connect(const Address&addy) {
+    if (!mReliable)
+        return;
+    mReliable->connect(addy);
+    if (mHasSession.read())
+        mSession->resolve(addy);
+}
+
+void UDPStream::acceptStream(IOService*io,
+                             const SubstreamCallback&callback,
+                             const SessionLookup&lookup,
+                             Stream*reliable,
+                             SetCallbacks&reliableCallbacks) {
+    UDPSetCallbacks callbacks;
+    if (!reliable) {
+        //the connection is going away and is letting go of the callback
+        callback(NULL,callbacks);
+        return;
+    }
+    UDPStream*stream=new UDPStream(*io);
+    stream->mReliable=reliable;
+    stream->mAwaitingHello=lookup;
+    callback(stream,callbacks);
+    //left unset the stream was refused (and has been deleted), so the reliable one gets closed too
+    if (callbacks.mCalled)
+        reliableCallbacks(callbacks.mConnectionCallback,stream->setCallbacks(callbacks.mBytesReceivedCallback));
+}
+void UDPStream::clonedStream(UDPStream*stream,
+                             const std::tr1::shared_ptr<UDPSession>&session,
+                             const SubstreamCallback&callback,
+                             Stream*reliable,
+                             SetCallbacks&reliableCallbacks) {
+    stream->mReliable=reliable;
+    //the hello must precede anything the callback sends
+    if (session)
+        stream->sendHello(session,session->newKey());
+    UDPSetCallbacks callbacks;
+    callback(stream,callbacks);
+    if (callbacks.mCalled) {
+        reliableCallbacks(callbacks.mConnectionCallback,stream->setCallbacks(callbacks.mBytesReceivedCallback));
+        stream->join();
+    }
+}
+Stream*UDPStream::clone(const SubstreamCallback&cloneCallback) {
+    if (!mReliable)
+        return NULL;
+    std::tr1::shared_ptr<UDPSession> session;
+    if (mHasSession.read())
+        session=mSession;
+    UDPStream*stream=new UDPStream(*mIO);
+    if (!mReliable->clone(std::tr1::bind(&UDPStream::clonedStream,stream,session,cloneCallback,_1,_2))) {
+        delete stream;
+        return NULL;
+    }
+    return stream;
+}
+Stream*UDPStream::clone(const ConnectionCallback &connectionCallback,
+                        const BytesReceivedCallback&chunkReceivedCallback) {
+    if (!mReliable)
+        return NULL;
+    UDPStream*stream=new UDPStream(*mIO);
+    stream->mReliable=mReliable->clone(connectionCallback,stream->setCallbacks(chunkReceivedCallback));
+    if (!stream->mReliable) {
+        delete stream;
+        return NULL;
+    }
+    if (mHasSession.read()) {
+        stream->sendHello(mSession,mSession->newKey());
+        stream->join();
+    }
+    return stream;
+}
+
+void UDPStream::setSendWeight(uint32 weight) {
+    if (mReliable)
+        mReliable->setSendWeight(weight);
+}
+void UDPStream::setSendWatermarks(size_t low, size_t high, const WatermarkCallback&callback) {
+    if (mReliable)
+        mReliable->setSendWatermarks(low,high,callback);
+}
+size_t UDPStream::queuedSendBytes()const {
+    return mReliable?mReliable->queuedSendBytes():0;
+}
+bool UDPStream::trySend(MemoryReference data, StreamReliability reliability) {
+    if (sendDatagram(data,MemoryReference::null(),reliability))
+        return true;
+    return mReliable?mReliable->trySend(data,reliability):false;
+}
+bool UDPStream::trySend(const SharedChunk&payload, StreamReliability reliability) {
+    if (payload&&sendDatagram(MemoryReference(*payload),MemoryReference::null(),reliability))
+        return true;
+    return mReliable?mReliable->trySend(payload,reliability):false;
+}
+void UDPStream::close() {
+    if (mHasSession.read()) {
+        mHasSession=0;
+        mSession->removeStream(mKey);
+    }
+    if (mReliable)
+        mReliable->close();
+}
+
+} }
@@ -0,0 +1,136 @@
+/*  Sirikata Network Utilities
+ *  UDPStream.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_UDPStream_HPP__
+#define SIRIKATA_UDPStream_HPP__
+#include "network/Stream.hpp"
+#include "util/AtomicTypes.hpp"
+namespace Sirikata { namespace Network {
+class IOService;
+class UDPSession;
+class UDPPort;
+/**
+ * A stream that carries Unreliable sends as UDP datagrams beside a tcpsst
+ * stream that carries everything else, so unreliable traffic such as
+ * location updates never waits behind a segment TCP is retransmitting.
+ *
+ * The first message every udpsst stream sends on its reliable channel is a
+ * hello naming the session token and the stream's key; the receiving side
+ * consumes it and from then on hands datagrams with that key to the stream.
+ * Until a stream has a datagram path (the hello has not arrived, the UDP port
+ * could not be opened, or a payload does not fit in one datagram) Unreliable
+ * sends quietly go over the reliable channel instead.  Both ends have to be
+ * udpsst: a tcpsst peer would see the hello as data.
+ *
+ * Datagrams are delivered on whichever IOService thread read them, which may
+ * run alongside delivery from the reliable channel.
+ */
+class UDPStream:public Stream {
+public:
+    enum {
+        HELLO_SIZE=16
+    };
+    typedef std::tr1::function<std::tr1::shared_ptr<UDPSession>(uint64 token)> SessionLookup;
+    UDPStream(IOService&);
+    virtual ~UDPStream();
+    static UDPStream* construct(Network::IOService*io) {
+        return new UDPStream(*io);
+    }
+    /**
+     * Wraps a stream accepted on the reliable channel, either a connection a
+     * listener accepted or a substream the peer opened, and hands it to
+     * callback.  lookup maps the token in the peer's hello to its session.
+     */
+    static void acceptStream(IOService*io,
+                             const SubstreamCallback&callback,
+                             const SessionLookup&lookup,
+                             Stream*reliable,
+                             SetCallbacks&reliableCallbacks);
+    ///Hands a datagram for this stream to its receive callback
+    void receiveDatagram(const Chunk&data);
+
+    virtual Stream*factory();
+    virtual void send(MemoryReference, StreamReliability);
+    virtual void send(MemoryReference, MemoryReference, StreamReliability);
+    virtual void send(const Chunk&data,StreamReliability);
+    virtual void send(const SharedChunk&payload,StreamReliability);
+    virtual void connect(
+        const Address& addy,
+        const SubstreamCallback &substreamCallback,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedCallback&chunkReceivedCallback);
+    virtual void prepareOutboundConnection(
+        const SubstreamCallback &substreamCallback,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedCallback&chunkReceivedCallback);
+    virtual void connect(
+        const Address& addy);
+    virtual Stream* clone(const SubstreamCallback&cb);
+    virtual Stream* clone(const ConnectionCallback &connectionCallback,
+                          const BytesReceivedCallback&chunkReceivedCallback);
+    virtual void setSendWeight(uint32 weight);
+    ///Watches the reliable channel's backlog: datagrams are never queued
+    virtual void setSendWatermarks(size_t low, size_t high, const WatermarkCallback&callback);
+    virtual size_t queuedSendBytes()const;
+    virtual bool trySend(MemoryReference data, StreamReliability reliability);
+    virtual bool trySend(const SharedChunk&payload, StreamReliability reliability);
+    virtual void close();
+private:
+    class UDPSetCallbacks;
+    ///Records the user's callbacks and returns the ones to give the reliable channel
+    BytesReceivedCallback setCallbacks(const BytesReceivedCallback&chunkReceivedCallback);
+    ///Takes key in session and tells the peer so with a hello on the reliable channel
+    void sendHello(const std::tr1::shared_ptr<UDPSession>&session, uint32 key);
+    ///Starts taking datagrams from the session: only once the receive callback is set
+    void join();
+    ///Receive callback given to the reliable channel: consumes the peer's hello
+    void receiveReliable(const Chunk&data);
+    static void clonedStream(UDPStream*stream,
+                             const std::tr1::shared_ptr<UDPSession>&session,
+                             const SubstreamCallback&callback,
+                             Stream*reliable,
+                             SetCallbacks&reliableCallbacks);
+    bool sendDatagram(MemoryReference first, MemoryReference second, StreamReliability reliability);
+
+    IOService*mIO;
+    ///The tcpsst stream that carries reliable traffic, NULL until connected or cloned
+    Stream*mReliable;
+    ///Set, along with mKey, before mHasSession so that sends on other threads may read it without a lock
+    std::tr1::shared_ptr<UDPSession> mSession;
+    uint32 mKey;
+    AtomicValue<int> mHasSession;
+    ///Set on accepted streams until the peer's hello has been read
+    SessionLookup mAwaitingHello;
+    BytesReceivedCallback mBytesReceivedCallback;
+};
+} }
+#endif
@@ -0,0 +1,96 @@
+/*  Sirikata Network Utilities
+ *  UDPStreamListener.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Platform.hpp"
+#include "network/TCPDefinitions.hpp"
+#include "network/StreamListenerFactory.hpp"
+#include "UDPStream.hpp"
+#include "UDPStreamListener.hpp"
+#include "UDPSession.hpp"
+namespace Sirikata { namespace Network {
+using namespace boost::asio::ip;
+
+UDPStreamListener::UDPStreamListener(IOService&io):mIOService(&io),mReliable(NULL) {
+}
+UDPStreamListener::~UDPStreamListener() {
+    close();
+    delete mReliable;
+}
+
+std::tr1::shared_ptr<UDPSession> UDPStreamListener::findOrCreateSession(const std::tr1::weak_ptr<UDPPort>&weakPort, uint64 token) {
+    std::tr1::shared_ptr<UDPPort> port=weakPort.lock();
+    if (!port)
+        return std::tr1::shared_ptr<UDPSession>();
+    std::tr1::shared_ptr<UDPSession> session=port->findSession(token);
+    if (!session) {
+        session.reset(new UDPSession(port,token,false));
+        port->addSession(session);
+    }
+    return session;
+}
+
+bool UDPStreamListener::listen(const Address&address,
+                               const Stream::SubstreamCallback&newStreamCallback) {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    if (!mReliable)
+        mReliable=StreamListenerFactory::getSingleton().getConstructor("tcpsst")(mIOService);
+    if (!mReliable) {
+        SILOG(udpsst,error,"udpsst needs the tcpsst plugin for its reliable channel");
+        return false;
+    }
+    mPort.reset(new UDPPort(*mIOService));
+    UDPStream::SessionLookup lookup=std::tr1::bind(&UDPStreamListener::findOrCreateSession,
+                                                   std::tr1::weak_ptr<UDPPort>(mPort),
+                                                   _1);
+    if (!mReliable->listen(address,std::tr1::bind(&UDPStream::acceptStream,mIOService,newStreamCallback,lookup,_1,_2)))
+        return false;
+    //the TCP port may have been picked by the system
+    if (mPort->open(UDPEndpoint(udp::v4(),atoi(mReliable->listenAddress().getService().c_str()))))
+        mPort->startReceiving();
+    return true;
+}
+String UDPStreamListener::listenAddressName() const {
+    return mReliable->listenAddressName();
+}
+Address UDPStreamListener::listenAddress() const {
+    return mReliable->listenAddress();
+}
+void UDPStreamListener::close() {
+    if (mReliable)
+        mReliable->close();
+    if (mPort)
+        mPort->close();
+    mPort.reset();
+}
+
+} }
@@ -0,0 +1,66 @@
+/*  Sirikata Network Utilities
+ *  UDPStreamListener.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_UDPStreamListener_HPP__
+#define SIRIKATA_UDPStreamListener_HPP__
+#include "network/StreamListener.hpp"
+namespace Sirikata { namespace Network {
+class IOService;
+class UDPPort;
+class UDPSession;
+/**
+ * Listens for udpsst connections: a tcpsst listener accepts the reliable
+ * channels and a UDP socket bound to the same port number takes the
+ * datagrams of every connection it accepted.
+ */
+class UDPStreamListener:public StreamListener {
+public:
+    UDPStreamListener(IOService&);
+    virtual bool listen(
+        const Address&addy,
+        const Stream::SubstreamCallback&newStreamCallback);
+    virtual String listenAddressName()const;
+    virtual Address listenAddress()const;
+    virtual void close();
+    static UDPStreamListener* construct(Network::IOService*io) {
+        return new UDPStreamListener(*io);
+    }
+    virtual ~UDPStreamListener();
+private:
+    ///Finds the session of the connection the hello came on, starting it for a new connection
+    static std::tr1::shared_ptr<UDPSession> findOrCreateSession(const std::tr1::weak_ptr<UDPPort>&port, uint64 token);
+    IOService*mIOService;
+    StreamListener*mReliable;
+    std::tr1::shared_ptr<UDPPort> mPort;
+};
+} }
+#endif
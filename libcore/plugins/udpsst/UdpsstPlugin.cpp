@@ -0,0 +1,83 @@
+/*  Sirikata Network Utilities
+ *  UdpsstPlugin.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Platform.hpp>
+#include <util/PluginManager.hpp>
+#include "network/StreamFactory.hpp"
+#include "network/StreamListenerFactory.hpp"
+#include "UDPStream.hpp"
+#include "UDPStreamListener.hpp"
+static int udpsst_plugin_refcount = 0;
+
+SIRIKATA_PLUGIN_ENTRY_C void init() {
+    using namespace Sirikata;
+    if (udpsst_plugin_refcount==0) {
+        Sirikata::Network::StreamFactory::getSingleton()
+            .registerConstructor("udpsst",
+                                 &Network::UDPStream::construct,
+                                 false);
+        Sirikata::Network::StreamListenerFactory::getSingleton()
+            .registerConstructor("udpsst",
+                                 &Network::UDPStreamListener::construct,
+                                 false);
+    }
+    udpsst_plugin_refcount++;
+}
+
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
+    return ++udpsst_plugin_refcount;
+}
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
+    assert(udpsst_plugin_refcount>0);
+    return --udpsst_plugin_refcount;
+}
+
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
+    using namespace Sirikata;
+    if (udpsst_plugin_refcount>0) {
+        udpsst_plugin_refcount--;
+        assert(udpsst_plugin_refcount==0);
+        if (udpsst_plugin_refcount==0) {
+            Sirikata::Network::StreamListenerFactory::getSingleton().unregisterConstructor("udpsst");
+            Sirikata::Network::StreamFactory::getSingleton().unregisterConstructor("udpsst");
+        }
+    }
+}
+
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
+    return "udpsst";
+}
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
+    return udpsst_plugin_refcount;
+}
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(udpsst)
@@ -33,6 +33,8 @@
 #include "TCPDefinitions.hpp"
 #include "IOServiceFactory.hpp"
 #include "util/Time.hpp"
+#include "util/ThreadAffinity.hpp"
+#include "util/TraceEvents.hpp"
 namespace Sirikata { namespace Network {
 namespace {
 boost::once_flag io_singleton=BOOST_ONCE_INIT;
@@ -63,6 +65,7 @@ std::size_t IOServiceFactory::pollService(IOService*ios){
     return ios->poll();
 }
 std::size_t IOServiceFactory::runService(IOService*ios){
+    ThreadAffinity::pinIOServiceThread();
     return ios->run();
 }
 std::size_t IOServiceFactory::pollOneService(IOService*ios){
@@ -77,22 +80,48 @@ void IOServiceFactory::stopService(IOService*ios){
 void IOServiceFactory::resetService(IOService*ios){
     ios->reset();
 }
-void IOServiceFactory::dispatchServiceMessage(IOService*ios,const std::tr1::function<void()>&f){
+namespace {
+void traced_dispatch(const Callback<void()>&f) {
+    SIRIKATA_TRACE_SCOPE("IOService::dispatch");
+    f();
+}
+}
+void IOServiceFactory::dispatchServiceMessage(IOService*ios,const Callback<void()>&f){
+#ifndef SIRIKATA_NO_TRACE_EVENTS
+    if (Sirikata_Trace_Recording) {
+        ios->dispatch(std::tr1::bind(&traced_dispatch,f));
+        return;
+    }
+#endif
     ios->dispatch(f);
 }
 namespace {
-void handle_deadline_timer(const boost::system::error_code&e,const std::tr1::shared_ptr<boost::asio::deadline_timer>&timer,const std::tr1::function<void()>&f) {
+void handle_deadline_timer(const boost::system::error_code&e,const std::tr1::shared_ptr<boost::asio::deadline_timer>&timer,const Callback<void()>&f) {
     if (e) {
     }else {
+        SIRIKATA_TRACE_SCOPE("IOService::timer");
         f();
     }
 }
 }
-void IOServiceFactory::dispatchServiceMessage(IOService*ios,const Duration&waitFor,const std::tr1::function<void()>&f){
+void IOServiceFactory::dispatchServiceMessage(IOService*ios,const Duration&waitFor,const Callback<void()>&f){
     std::tr1::shared_ptr<boost::asio::deadline_timer> t(new boost::asio::deadline_timer(*ios,boost::posix_time::microseconds(waitFor.toMicroseconds())));
     using std::tr1::placeholders::_1;
     t->async_wait(std::tr1::bind(&handle_deadline_timer,_1,t,f));
 }
+namespace {
+void ignore_deadline_timer(const boost::system::error_code&) {
+}
+}
+std::size_t IOServiceFactory::runOneServiceFor(IOService*ios,const Duration&waitFor){
+    boost::asio::deadline_timer timer(*ios,boost::posix_time::microseconds(waitFor.toMicroseconds()));
+    timer.async_wait(&ignore_deadline_timer);
+    std::size_t handled=ios->run_one();
+    timer.cancel();
+    handled+=ios->poll();//retire the aborted wait now, or it would cut the next call short
+    ios->reset();//the timer may have been the only work, which leaves the service stopped
+    return handled;
+}
 
 
 IOService::IOService():boost::asio::io_service(1){}
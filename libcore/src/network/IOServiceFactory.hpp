@@ -31,6 +31,7 @@
  */
 #ifndef _SIRIKATA_IOSERVICEFACTORY_HPP_
 #define _SIRIKATA_IOSERVICEFACTORY_HPP_
+#include "util/Callback.hpp"
 
 namespace Sirikata { namespace Network {
 class IOService;
@@ -44,10 +45,12 @@ class SIRIKATA_EXPORT IOServiceFactory {
     static std::size_t runService(IOService*);
     static std::size_t pollOneService(IOService*);
     static std::size_t runOneService(IOService*);
+    ///Blocks until a handler has run or waitFor has passed, whichever is first, so idle loops need not spin on pollService
+    static std::size_t runOneServiceFor(IOService*,const Duration&waitFor);
     static void stopService(IOService*);
     static void resetService(IOService*);
-    static void dispatchServiceMessage(IOService*,const std::tr1::function<void()>&f);
-    static void dispatchServiceMessage(IOService*,const Duration& waitFor, const std::tr1::function<void()>&f);
+    static void dispatchServiceMessage(IOService*,const Callback<void()>&f);
+    static void dispatchServiceMessage(IOService*,const Duration& waitFor, const Callback<void()>&f);
 };
 } }
 #endif
@@ -0,0 +1,86 @@
+/*  Sirikata Network Utilities
+ *  IOServicePool.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Platform.hpp"
+#include "TCPDefinitions.hpp"
+#include "IOServiceFactory.hpp"
+#include "IOServicePool.hpp"
+#include <boost/bind.hpp>
+namespace Sirikata { namespace Network {
+
+class IOServicePool::Impl {
+public:
+    std::vector<boost::asio::io_service::work*> mWork;
+    std::vector<boost::thread*> mThreads;
+};
+
+IOServicePool::IOServicePool(unsigned int size):mImpl(new Impl),mNext(0) {
+    if (size==0) {
+        size=boost::thread::hardware_concurrency();
+        if (size==0)
+            size=1;
+    }
+    for (unsigned int i=0;i<size;++i)
+        mServices.push_back(IOServiceFactory::makeIOService());
+}
+IOServicePool::~IOServicePool() {
+    stop();
+    for (size_t i=0;i<mServices.size();++i)
+        IOServiceFactory::destroyIOService(mServices[i]);
+    delete mImpl;
+}
+IOService*IOServicePool::next() {
+    return mServices[(mNext++)%mServices.size()];
+}
+void IOServicePool::run() {
+    if (!mImpl->mThreads.empty())
+        return;
+    for (size_t i=0;i<mServices.size();++i) {
+        mImpl->mWork.push_back(new boost::asio::io_service::work(*mServices[i]));
+        mImpl->mThreads.push_back(new boost::thread(boost::bind(&IOServiceFactory::runService,mServices[i])));
+    }
+}
+void IOServicePool::stop() {
+    for (size_t i=0;i<mImpl->mWork.size();++i)
+        delete mImpl->mWork[i];
+    mImpl->mWork.clear();
+    for (size_t i=0;i<mServices.size();++i)
+        IOServiceFactory::stopService(mServices[i]);
+    for (size_t i=0;i<mImpl->mThreads.size();++i) {
+        mImpl->mThreads[i]->join();
+        delete mImpl->mThreads[i];
+    }
+    mImpl->mThreads.clear();
+    for (size_t i=0;i<mServices.size();++i)
+        IOServiceFactory::resetService(mServices[i]);
+}
+
+} }
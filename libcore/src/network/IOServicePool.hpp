@@ -0,0 +1,68 @@
+/*  Sirikata Network Utilities
+ *  IOServicePool.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_IOSERVICEPOOL_HPP_
+#define _SIRIKATA_IOSERVICEPOOL_HPP_
+#include "util/AtomicTypes.hpp"
+
+namespace Sirikata { namespace Network {
+class IOService;
+/**
+ * A set of IOServices, each run by a thread of its own, for spreading
+ * independent connections over the cores.  Anything created on one member,
+ * a socket and everything bound to it, has its handlers run on that member's
+ * thread only, so a connection needs no locking against itself.
+ */
+class SIRIKATA_EXPORT IOServicePool : public Noncopyable {
+    class Impl;
+    std::vector<IOService*> mServices;
+    Impl *mImpl;
+    AtomicValue<uint32> mNext;
+public:
+    ///size 0 makes one IOService per core
+    explicit IOServicePool(unsigned int size=0);
+    ///Stops the threads and destroys the IOServices: nothing may still be using them
+    ~IOServicePool();
+    unsigned int size()const {
+        return (unsigned int)mServices.size();
+    }
+    IOService*get(unsigned int which) {
+        return mServices[which];
+    }
+    ///Hands out the members round robin
+    IOService*next();
+    ///Starts one thread per member; they keep running while idle until stop()
+    void run();
+    ///Stops every member and waits for the threads to exit
+    void stop();
+};
+} }
+#endif
@@ -0,0 +1,214 @@
+/*  Sirikata Network Utilities -- Metrics Endpoint
+ *  MetricsEndpoint.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "MetricsEndpoint.hpp"
+#include "IOServiceFactory.hpp"
+#include "TCPDefinitions.hpp"
+#include "options/Options.hpp"
+#include "util/Metrics.hpp"
+#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+
+namespace Sirikata { namespace Network {
+namespace {
+OptionValue *metricsPort;
+OptionValue *metricsBind;
+InitializeGlobalOptions o("",
+                    metricsPort=new OptionValue("metricsport","",OptionValueType<String>(),"port to serve the metrics on over HTTP for Prometheus to scrape (default: none)"),
+                    metricsBind=new OptionValue("metricsbind","0.0.0.0",OptionValueType<String>(),"address the metrics port listens on"),
+                    NULL);
+
+///Largest request head read before the connection is dropped
+const size_t MAX_REQUEST_SIZE=8192;
+
+class Server;
+
+class Session {
+public:
+    Server *mServer;
+    InternalTCPSocket mSocket;
+    boost::asio::streambuf mRequest;
+    String mResponse;
+    Session(Server *server, IOService &io):mServer(server),mSocket(io),mRequest(MAX_REQUEST_SIZE) {
+    }
+};
+
+/**
+ * Answers one request per connection, HTTP/1.0 style, then closes it. Every
+ * handler runs on mThread, so mSessions needs no lock until stop() joins it.
+ */
+class Server {
+    IOService *mIO;
+    InternalTCPAcceptor *mAcceptor;
+    boost::thread *mThread;
+    std::set<Session*> mSessions;
+    String mConfig;
+
+    void accept() {
+        Session *session=new Session(this,*mIO);
+        mSessions.insert(session);
+        mAcceptor->async_accept(session->mSocket,boost::bind(&Server::accepted,this,session,boost::asio::placeholders::error));
+    }
+    void accepted(Session *session, const boost::system::error_code &error) {
+        if (error) {
+            finish(session);
+            if (error!=boost::asio::error::operation_aborted)
+                accept();
+            return;
+        }
+        boost::asio::async_read_until(session->mSocket,session->mRequest,"\r\n\r\n",
+                                      boost::bind(&Server::readRequest,this,session,boost::asio::placeholders::error));
+        accept();
+    }
+    void readRequest(Session *session, const boost::system::error_code &error) {
+        if (error) {
+            finish(session);
+            return;
+        }
+        std::istream request(&session->mRequest);
+        String method,path;
+        request>>method>>path;
+        path=path.substr(0,path.find('?'));
+        std::ostringstream body;
+        const char *status="200 OK";
+        const char *type="text/plain; version=0.0.4";
+        if (method!="GET"&&method!="HEAD") {
+            status="405 Method Not Allowed";
+            type="text/plain";
+            body<<"Only GET is supported\n";
+        }else if (path=="/metrics"||path=="/") {
+            Metrics::reportPrometheus(body);
+        }else {
+            status="404 Not Found";
+            type="text/plain";
+            body<<"Metrics are served at /metrics\n";
+        }
+        String text=body.str();
+        std::ostringstream response;
+        response<<"HTTP/1.0 "<<status<<"\r\n"
+                <<"Content-Type: "<<type<<"\r\n"
+                <<"Content-Length: "<<text.size()<<"\r\n"
+                <<"Connection: close\r\n\r\n";
+        if (method!="HEAD")
+            response<<text;
+        session->mResponse=response.str();
+        boost::asio::async_write(session->mSocket,boost::asio::buffer(session->mResponse),
+                                 boost::bind(&Server::wroteResponse,this,session));
+    }
+    void wroteResponse(Session *session) {
+        boost::system::error_code ignored;
+        session->mSocket.shutdown(InternalTCPSocket::shutdown_both,ignored);
+        finish(session);
+    }
+    void finish(Session *session) {
+        mSessions.erase(session);
+        delete session;
+    }
+    void run() {
+        IOServiceFactory::runService(mIO);
+    }
+public:
+    Server():mIO(NULL),mAcceptor(NULL),mThread(NULL) {
+    }
+    const String &config() const {
+        return mConfig;
+    }
+    void start(const String &config, const String &address, const String &port) {
+        mIO=IOServiceFactory::makeIOService();
+        try {
+            boost::asio::ip::tcp::endpoint where(boost::asio::ip::address::from_string(address),
+                                                 boost::lexical_cast<unsigned short>(port));
+            mAcceptor=new InternalTCPAcceptor(*mIO,where);
+        }catch (std::exception &e) {
+            SILOG(metrics,error,"Could not serve metrics on "<<address<<':'<<port<<": "<<e.what());
+            IOServiceFactory::destroyIOService(mIO);
+            mIO=NULL;
+            return;
+        }
+        mConfig=config;
+        accept();
+        mThread=new boost::thread(std::tr1::bind(&Server::run,this));
+        SILOG(metrics,info,"Serving metrics on http://"<<address<<':'<<port<<"/metrics");
+    }
+    void stop() {
+        if (!mIO) return;
+        if (mThread) {
+            IOServiceFactory::stopService(mIO);
+            mThread->join();
+            delete mThread;
+            mThread=NULL;
+        }
+        for (std::set<Session*>::iterator i=mSessions.begin();i!=mSessions.end();++i)
+            delete *i;
+        mSessions.clear();
+        delete mAcceptor;
+        mAcceptor=NULL;
+        IOServiceFactory::destroyIOService(mIO);
+        mIO=NULL;
+        mConfig=String();
+    }
+};
+
+Server *sServer=NULL;
+
+class StopAtExit {public:
+    ~StopAtExit() {
+        if (sServer) {
+            sServer->stop();
+        }
+    }
+} sStopAtExit;
+}
+
+void metricsEndpointOptionsChanged() {
+    if (!metricsPort) {
+        // Parsed from a static initializer before this file's options exist
+        return;
+    }
+    String port=metricsPort->as<String>();
+    String address=metricsBind->as<String>();
+    String config;
+    if (!port.empty()) {
+        config=address+':'+port;
+    }
+    if (!sServer) {
+        if (config.empty()) return;
+        sServer=new Server;
+    }
+    if (config==sServer->config()) return;
+    sServer->stop();
+    if (!config.empty()) {
+        sServer->start(config,address,port);
+    }
+}
+
+} }
@@ -33,6 +33,7 @@
 #ifndef SIRIKATA_Stream_HPP__
 #define SIRIKATA_Stream_HPP__
 #include "Address.hpp"
+#include "util/Callback.hpp"
 namespace Sirikata {
 /// Network contains Stream and TCPStream.
 namespace Network {
@@ -132,8 +133,12 @@ public:
     };
     ///Callback type for when a connection happens (or doesn't) Callees will receive a ConnectionStatus code indicating connection successful, rejected or a later disconnection event
     typedef std::tr1::function<void(ConnectionStatus,const std::string&reason)> ConnectionCallback;
-    ///Callback type for when a full chunk of bytes are waiting on the stream
-    typedef std::tr1::function<void(const Chunk&)> BytesReceivedCallback;
+    ///Callback type for when a full chunk of bytes are waiting on the stream: called for every chunk, so kept allocation free
+    typedef Callback<void(const Chunk&)> BytesReceivedCallback;
+    ///An immutable payload that may be handed to the send queues of many streams at once without being copied for each
+    typedef std::tr1::shared_ptr<const Chunk> SharedChunk;
+    ///Callback type for a stream's send backlog crossing a watermark: true once it reaches the high watermark, false once it has drained to the low one
+    typedef std::tr1::function<void(bool congested)> WatermarkCallback;
     /**
      *  This class is passed into any newSubstreamCallback functions so they may 
      *  immediately setup callbacks for connetion events and possibly start sending immediate responses.     
@@ -199,6 +204,46 @@ public:
     virtual void send(MemoryReference, MemoryReference, StreamReliability)=0;
     ///Send a chunk of data to the receiver
     virtual void send(const Chunk&data,StreamReliability)=0;
+    /**
+     * Send a payload that many streams may share, such as one broadcast to every subscriber.
+     * The payload must not be changed once handed over: implementations may keep a reference to it
+     * until it is on the wire rather than copying it. By default the bytes are copied as with any other send
+     */
+    virtual void send(const SharedChunk&payload,StreamReliability reliability) {
+        if (payload)
+            send(*payload,reliability);
+        else
+            send(MemoryReference::null(),reliability);
+    }
+    /**
+     * Sets this stream's share of the connection when several substreams have data backed up at once.
+     * Streams start with weight 1 (clones inherit the weight of the stream they were cloned from),
+     * so latency critical traffic such as location updates may be given a larger weight than bulk transfers.
+     * Implementations that cannot schedule between substreams may ignore it
+     */
+    virtual void setSendWeight(uint32 weight){}
+    /**
+     * Asks to be told when data sent on this stream backs up: callback(true) is called once at least high bytes wait to be
+     * written to the network and callback(false) once they have drained to low bytes or fewer. It may be called from any
+     * thread, including from within send(), so it must not block. A high watermark of 0 cancels the callback.
+     * Implementations without a send queue of their own never call it
+     */
+    virtual void setSendWatermarks(size_t low, size_t high, const WatermarkCallback&callback){}
+    ///Bytes handed to send() that have not been written to the network yet, or 0 if the implementation does not track it
+    virtual size_t queuedSendBytes()const {return 0;}
+    /**
+     * Sends the data unless the high watermark given to setSendWatermarks has been reached, in which case nothing is sent
+     * and false is returned so the caller may drop, coalesce or defer it instead of growing the queue
+     */
+    virtual bool trySend(MemoryReference data, StreamReliability reliability) {
+        send(data,reliability);
+        return true;
+    }
+    ///As trySend(MemoryReference,StreamReliability) for a payload that may be shared with other streams
+    virtual bool trySend(const SharedChunk&payload, StreamReliability reliability) {
+        send(payload,reliability);
+        return true;
+    }
     ///close this stream: if it is the last stream, close the connection as well
     virtual void close()=0;
     virtual ~Stream(){};
@@ -0,0 +1,164 @@
+/*  Sirikata Network Utilities
+ *  StreamCapture.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "StreamCapture.hpp"
+#include "task/Time.hpp"
+
+namespace Sirikata { namespace Network {
+namespace {
+const char sMagic[8]={'S','S','T','C','A','P','1','\n'};
+
+void appendVarint(String &output, uint64 value) {
+    while (value>=128) {
+        output+=(char)((value&127)|128);
+        value>>=7;
+    }
+    output+=(char)value;
+}
+}
+
+StreamCaptureWriter::StreamCaptureWriter():mFile(NULL),mLastTime(0),mNextStream(0) {
+}
+
+StreamCaptureWriter::~StreamCaptureWriter() {
+    if (mFile)
+        fclose(mFile);
+}
+
+bool StreamCaptureWriter::open(const String &filename) {
+    boost::mutex::scoped_lock lok(mLock);
+    if (mFile)
+        fclose(mFile);
+    mFile=fopen(filename.c_str(),"wb");
+    if (!mFile)
+        return false;
+    fwrite(sMagic,1,sizeof(sMagic),mFile);
+    mLastTime=Task::AbsTime::now().raw();
+    mStreams.clear();
+    mNextStream=0;
+    return true;
+}
+
+void StreamCaptureWriter::beginRecord(unsigned int kind, const void *stream, uint32 &number) {
+    std::tr1::unordered_map<const void*,uint32>::iterator where=mStreams.find(stream);
+    if (where==mStreams.end())
+        where=mStreams.insert(std::pair<const void*,uint32>(stream,mNextStream++)).first;
+    number=where->second;
+    uint64 now=Task::AbsTime::now().raw();
+    mRecord.resize(0);
+    appendVarint(mRecord,kind);
+    appendVarint(mRecord,number);
+    appendVarint(mRecord,now>mLastTime?now-mLastTime:0);
+    if (now>mLastTime)
+        mLastTime=now;
+}
+
+void StreamCaptureWriter::received(const void *stream, const Chunk &data) {
+    boost::mutex::scoped_lock lok(mLock);
+    if (!mFile)
+        return;
+    uint32 number;
+    beginRecord(StreamCaptureReader::Record::DATA,stream,number);
+    appendVarint(mRecord,data.size());
+    fwrite(mRecord.data(),1,mRecord.size(),mFile);
+    if (!data.empty())
+        fwrite(&data[0],1,data.size(),mFile);
+}
+
+void StreamCaptureWriter::closed(const void *stream) {
+    boost::mutex::scoped_lock lok(mLock);
+    if (!mFile||mStreams.find(stream)==mStreams.end())
+        return;
+    uint32 number;
+    beginRecord(StreamCaptureReader::Record::CLOSED,stream,number);
+    fwrite(mRecord.data(),1,mRecord.size(),mFile);
+    mStreams.erase(stream);
+}
+
+StreamCaptureReader::StreamCaptureReader():mFile(NULL),mTime(0) {
+}
+
+StreamCaptureReader::~StreamCaptureReader() {
+    if (mFile)
+        fclose(mFile);
+}
+
+bool StreamCaptureReader::open(const String &filename) {
+    if (mFile)
+        fclose(mFile);
+    mTime=0;
+    mFile=fopen(filename.c_str(),"rb");
+    if (!mFile)
+        return false;
+    char magic[sizeof(sMagic)];
+    if (fread(magic,1,sizeof(magic),mFile)!=sizeof(magic)||memcmp(magic,sMagic,sizeof(magic))!=0) {
+        fclose(mFile);
+        mFile=NULL;
+        return false;
+    }
+    return true;
+}
+
+bool StreamCaptureReader::readVarint(uint64 &value) {
+    value=0;
+    for (unsigned int shift=0;shift<64;shift+=7) {
+        int cur=getc(mFile);
+        if (cur==EOF)
+            return false;
+        value|=((uint64)(cur&127))<<shift;
+        if ((cur&128)==0)
+            return true;
+    }
+    return false;
+}
+
+bool StreamCaptureReader::next(Record &record) {
+    uint64 kind,stream,delta;
+    if (!mFile||!readVarint(kind)||!readVarint(stream)||!readVarint(delta)||kind>Record::CLOSED)
+        return false;
+    mTime+=delta;
+    record.mKind=(Record::Kind)kind;
+    record.mStream=(uint32)stream;
+    record.mTime=mTime;
+    record.mData.resize(0);
+    if (record.mKind==Record::DATA) {
+        uint64 length;
+        if (!readVarint(length))
+            return false;
+        record.mData.resize((size_t)length);
+        if (length&&fread(&record.mData[0],1,(size_t)length,mFile)!=length)
+            return false;
+    }
+    return true;
+}
+
+} }
@@ -0,0 +1,95 @@
+/*  Sirikata Network Utilities
+ *  StreamCapture.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_STREAM_CAPTURE_HPP_
+#define _SIRIKATA_STREAM_CAPTURE_HPP_
+#include <boost/thread/mutex.hpp>
+#include <cstdio>
+
+namespace Sirikata { namespace Network {
+/**
+ * A recording of the bytes that arrived on a set of streams, for replaying
+ * a real load pattern later.  The file starts with the 8 byte magic
+ * "SSTCAP1\n" and is followed by records of
+ *   varint kind (0 for data, 1 for the stream closing),
+ *   varint stream, numbered in the order streams were first seen,
+ *   varint microseconds since the previous record (or since the file was opened),
+ * and for data, a varint length and that many bytes.
+ */
+class SIRIKATA_EXPORT StreamCaptureWriter : public Noncopyable {
+    boost::mutex mLock;
+    FILE *mFile;
+    uint64 mLastTime;
+    std::tr1::unordered_map<const void*,uint32> mStreams;
+    uint32 mNextStream;
+    String mRecord;
+    ///starts a record for stream, numbering it if it is new
+    void beginRecord(unsigned int kind, const void *stream, uint32 &number);
+public:
+    StreamCaptureWriter();
+    ///Flushes and closes the file
+    ~StreamCaptureWriter();
+    ///\returns false if the file could not be created
+    bool open(const String &filename);
+    bool isOpen() const {
+        return mFile!=NULL;
+    }
+    ///Records data as received on stream. Safe to call from any thread
+    void received(const void *stream, const Chunk &data);
+    ///Records that stream closed, if it sent anything: a later stream at the same address counts as a new one
+    void closed(const void *stream);
+};
+
+///Reads back the records of a StreamCaptureWriter
+class SIRIKATA_EXPORT StreamCaptureReader : public Noncopyable {
+    FILE *mFile;
+    uint64 mTime;
+    bool readVarint(uint64 &value);
+public:
+    class Record {
+    public:
+        enum Kind {DATA=0,CLOSED=1};
+        Kind mKind;
+        uint32 mStream;
+        ///microseconds since the capture was opened
+        uint64 mTime;
+        Chunk mData;
+    };
+    StreamCaptureReader();
+    ~StreamCaptureReader();
+    ///\returns false if the file cannot be read or is not a capture
+    bool open(const String &filename);
+    ///\returns false at the end of the file, or at a truncated or corrupt record
+    bool next(Record &record);
+};
+
+} }
+#endif
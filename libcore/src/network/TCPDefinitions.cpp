@@ -8,6 +8,26 @@ TCPSocket::TCPSocket(IOService&io):
 TCPListener::TCPListener(IOService&io, const boost::asio::ip::tcp::endpoint&ep):
         boost::asio::ip::tcp::acceptor(io,ep){}
 
+TCPListener::TCPListener(IOService&io, const boost::asio::ip::tcp::endpoint&ep, bool reusePort):
+        boost::asio::ip::tcp::acceptor(io) {
+    open(ep.protocol());
+    set_option(boost::asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+    if (reusePort)
+        set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET,SO_REUSEPORT>(true));
+#endif
+    bind(ep);
+    listen();
+}
+
+bool TCPListener::supportsReusePort() {
+#ifdef SO_REUSEPORT
+    return true;
+#else
+    return false;
+#endif
+}
+
 void TCPListener::async_accept(TCPSocket&socket,
                                const std::tr1::function<void(const boost::system::error_code&)>&cb) {
     this->InternalTCPAcceptor::async_accept(socket,cb);
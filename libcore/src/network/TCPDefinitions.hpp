@@ -58,6 +58,14 @@ class SIRIKATA_EXPORT TCPSocket: public InternalTCPSocket {
 class SIRIKATA_EXPORT TCPListener :public InternalTCPAcceptor {
 public:
     TCPListener(IOService&io, const boost::asio::ip::tcp::endpoint&);
+    /**
+     * With reusePort the socket is bound with SO_REUSEPORT, so several
+     * listeners can share the port and the kernel spreads connections over
+     * them.  Throws like the plain constructor if binding fails.
+     */
+    TCPListener(IOService&io, const boost::asio::ip::tcp::endpoint&, bool reusePort);
+    ///false if this platform cannot share a port between listeners
+    static bool supportsReusePort();
     void async_accept(TCPSocket&socket,
                       const std::tr1::function<void(const boost::system::error_code& ) > &cb);
 };
@@ -236,7 +236,7 @@ class ValueStash:public Stash<OptionValue>, public AutoSingleton<ValueStash> {};
 class QuitOptionsPlugin {
 public:
     ~QuitOptionsPlugin() {
-        for (std::map<OptionSet::StringVoid,OptionSet*>::iterator i=OptionSet::optionSets()->begin();
+        for (OptionSet::OptionSetMap::iterator i=OptionSet::optionSets()->begin();
              i!=OptionSet::optionSets()->end();
              ++i) {
             delete i->second;
@@ -287,6 +287,7 @@ public:
                      HolderStash::getSingleton().hideUntilQuit(i->first,i->second->mValue.newAndDoNotFree(i->second->mParser(*s)));
 				 }
         }
+        Logging::levelsChanged();
         return true;
     }
 };
@@ -300,6 +301,7 @@ bool OptionSet::initializationSet(OptionValue* thus, const OptionValue&other) {
         thus->mParser=other.mParser;
         thus->mChangeFunction=other.mChangeFunction;
         thus->mName=other.mName;
+        Logging::levelsChanged();
         return true;
     }else if (other.mParser==NULL) {
         return true;
@@ -318,6 +320,7 @@ OptionValue& OptionValue::operator=(const OptionValue&other) {
     mChangeFunction(mName,oldValue,mValue);
     mChangeFunction=other.mChangeFunction;
     mName=other.mName;
+    Logging::levelsChanged();
     return *this;
 }
 OptionSet::OptionSet() {
@@ -370,7 +373,7 @@ void OptionSet::parse(const std::string&args){
         exit(0);
 }
 OptionSet* OptionSet::getOptionsNoLock(const std::string&s, const void * context){
-    std::map<StringVoid,OptionSet*>::iterator i=optionSets()->find(StringVoid(s,context));
+    OptionSetMap::iterator i=optionSets()->find(StringVoid(s,context));
     if (i==optionSets()->end()){
         return (*optionSets())[StringVoid(s,context)]=new OptionSet;
     }else{
@@ -104,14 +104,53 @@ public:
         StringVoid(const String &ss,const void*vv) {s=ss;v=vv;}
         bool operator < (const StringVoid&other) const {return (s==other.s?v<other.v:s<other.s);}
         bool operator == (const StringVoid&other) const {return (s==other.s&&v==other.v);}
+        size_t hash() const {return std::tr1::hash<String>()(s)^std::tr1::hash<size_t>()((size_t)v);}
+        class Hasher {public:
+            size_t operator() (const StringVoid&sv) const {return sv.hash();}
+        };
     };
-    static std::map<StringVoid,OptionSet*>* optionSets() {
-        static std::map<StringVoid,OptionSet*>*retval=new std::map<StringVoid,OptionSet*>();
+    typedef std::tr1::unordered_map<StringVoid,OptionSet*,StringVoid::Hasher> OptionSetMap;
+    static OptionSetMap* optionSets() {
+        static OptionSetMap*retval=new OptionSetMap();
         return retval;
     }
     static OptionSet*getOptions(const std::string&s, const void *context);
     static OptionSet*getOptions(const std::string&s);
 };
+
+/**
+ * A typed reference to one option, found by name once: reading it afterwards is
+ * a pointer load and a static cast, with no map lookup, lock or dynamic_cast.
+ * Values replaced by parsing are kept until exit, so a read racing a parse
+ * sees either the old or the new value. The handle may be bound before the
+ * option is registered; it must be registered with type T before get().
+ */
+template <class T> class OptionHandle {
+    OptionValue *mValue;
+public:
+    OptionHandle() : mValue(NULL) {
+    }
+    explicit OptionHandle(OptionValue *value) : mValue(value) {
+    }
+    OptionHandle(OptionSet *options, const std::string &option) : mValue(options->referenceOption(option)) {
+    }
+    OptionHandle(const std::string &module, const std::string &option) : mValue(OptionSet::referenceOption(module,option)) {
+    }
+    bool bound() const {
+        return mValue!=NULL;
+    }
+    OptionValue *option() const {
+        return mValue;
+    }
+    const T &get() const {
+        // compare names since type_infos are not shared across dll lines
+        assert(strcmp(mValue->get()->typeOf().name(),typeid(T).name())==0);
+        return mValue->unsafeAs<T>();
+    }
+    const T &operator*() const {
+        return get();
+    }
+};
 }
 
 /*example options
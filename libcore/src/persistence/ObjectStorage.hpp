@@ -114,11 +114,16 @@ template<class StorageX, class StorageY> void copyStorageValue(StorageX a, const
     if(b.has_data())
         a.set_data(b.data());
     else a.clear_data();
+    if(b.has_version())
+        a.set_version(b.version());
+    else a.clear_version();
 }
 
 template<class StorageX, class StorageY> void mergeStorageValue(StorageX a, const StorageY b) {
     if(b.has_data())
         a.set_data(b.data());
+    if(b.has_version())
+        a.set_version(b.version());
 }
 
 template<class StorageX, class StorageY> void copyStorageElement(StorageX a, const StorageY b) {
@@ -134,7 +139,7 @@ template<class StorageX, class StorageY> void copyCompareElement(StorageX a, con
     copyStorageKey(a,b);
     copyStorageValue(a,b);
     if (b.has_comparator()) {
-        a.set_comparator(a.comparator());        
+        a.set_comparator(b.comparator());        
     }else {
         a.clear_comparator();
     }
@@ -143,7 +148,7 @@ template<class StorageX, class StorageY> void mergeCompareElement(StorageX a, co
     mergeStorageKey(a,b);
     mergeStorageValue(a,b);
     if (b.has_comparator()) {
-        a.set_comparator(a.comparator());        
+        a.set_comparator(b.comparator());        
     }
 }
 
@@ -32,6 +32,8 @@
 #include "util/Standard.hh"
 #include "WorkQueue.hpp"
 #include "DependencyTask.hpp"
+#include <boost/thread.hpp>
+#include <queue>
 namespace Sirikata {
 namespace Task {
 
@@ -69,7 +71,9 @@ class DependentTask::CallFailed : public WorkItem {
 
 void DependentTask::go() {
     if (mNumThisWaitingOn==0) {
-        if (mFailure) {
+        if (mScheduler) {
+            mScheduler->ready(this);
+        }else if (mFailure) {
             mWorkQueue->enqueue(new CallFailed(this));
         }else {
             mWorkQueue->enqueue(new CallSuccess(this));
@@ -79,6 +83,9 @@ void DependentTask::go() {
 void DependentTask::addDepender(DependentTask *depender) {
     ++depender->mNumThisWaitingOn;
     mDependents.push(depender);
+    if (mScheduler) {
+        mScheduler->addDependency(depender, this);
+    }
 }
 void DependentTask::finish(bool success) {
     LockFreeQueue<DependentTask*>::NodeIterator depsIter(mDependents);
@@ -88,16 +95,131 @@ void DependentTask::finish(bool success) {
         if (!success) {
             (*deps)->mFailure=true;
         }
+        if (mScheduler) {
+            mScheduler->removeDependency(*deps, this);
+        }
         --(*deps)->mNumThisWaitingOn;
         (*deps)->go();
     }
     delete this;
 }
 DependentTask::DependentTask(WorkQueue *queue)
-	: mWorkQueue(queue), mNumThisWaitingOn(0), mFailure(false) {
+	: mWorkQueue(queue), mScheduler(NULL), mNumThisWaitingOn(0), mFailure(false), mCriticalPath(0) {
+}
+
+DependentTask::DependentTask(DependencyScheduler *scheduler)
+	: mWorkQueue(scheduler->getQueue()), mScheduler(scheduler), mNumThisWaitingOn(0), mFailure(false), mCriticalPath(0) {
 }
 
 DependentTask::~DependentTask(){}
 
+
+
+class DependencyScheduler::State {
+public:
+    class ReadyTask {
+    public:
+        uint32 mPriority;
+        uint64 mSequence;
+        DependentTask *mTask;
+        ReadyTask(uint32 priority, uint64 sequence, DependentTask *task)
+            : mPriority(priority), mSequence(sequence), mTask(task) {
+        }
+        /// priority_queue pops the largest: longest path first, then whichever became ready first.
+        bool operator< (const ReadyTask &other) const {
+            if (mPriority != other.mPriority) {
+                return mPriority < other.mPriority;
+            }
+            return mSequence > other.mSequence;
+        }
+    };
+    boost::mutex mMutex;
+    std::priority_queue<ReadyTask> mReady;
+    uint64 mSequence;
+    State() : mSequence(0) {
+    }
+};
+
+class DependencyScheduler::RunReady : public WorkItem {
+    DependencyScheduler *mScheduler;
+  public:
+    RunReady(DependencyScheduler *scheduler) : mScheduler(scheduler) {
+    }
+
+    virtual void operator()() {
+        AutoPtr deleteMe(this);
+        mScheduler->runReady();
+    }
+};
+
+DependencyScheduler::DependencyScheduler(WorkQueue *queue)
+	: mWorkQueue(queue), mState(new State) {
+}
+
+DependencyScheduler::~DependencyScheduler() {
+    delete mState;
+}
+
+void DependencyScheduler::addDependency(DependentTask *depender, DependentTask *dependency) {
+    boost::mutex::scoped_lock lock(mState->mMutex);
+    depender->mDependencies.push_back(dependency);
+    // Walk up the graph while the longer path still makes a difference.
+    std::vector<std::pair<DependentTask*, uint32> > toVisit;
+    toVisit.push_back(std::pair<DependentTask*, uint32>(dependency, depender->mCriticalPath + depender->cost()));
+    while (!toVisit.empty()) {
+        DependentTask *task = toVisit.back().first;
+        uint32 path = toVisit.back().second;
+        toVisit.pop_back();
+        if (path <= task->mCriticalPath) {
+            continue;
+        }
+        task->mCriticalPath = path;
+        for (size_t i = 0; i < task->mDependencies.size(); ++i) {
+            toVisit.push_back(std::pair<DependentTask*, uint32>(task->mDependencies[i], path + task->cost()));
+        }
+    }
+}
+
+void DependencyScheduler::removeDependency(DependentTask *depender, DependentTask *dependency) {
+    boost::mutex::scoped_lock lock(mState->mMutex);
+    std::vector<DependentTask*> &deps = depender->mDependencies;
+    std::vector<DependentTask*>::iterator where = std::find(deps.begin(), deps.end(), dependency);
+    if (where != deps.end()) {
+        *where = deps.back();
+        deps.pop_back();
+    }
+}
+
+void DependencyScheduler::ready(DependentTask *task) {
+    {
+        boost::mutex::scoped_lock lock(mState->mMutex);
+        mState->mReady.push(State::ReadyTask(task->mCriticalPath + task->cost(), mState->mSequence++, task));
+    }
+    mWorkQueue->enqueue(new RunReady(this));
+}
+
+void DependencyScheduler::runReady() {
+    DependentTask *task;
+    {
+        boost::mutex::scoped_lock lock(mState->mMutex);
+        if (mState->mReady.empty()) {
+            return;
+        }
+        task = mState->mReady.top().mTask;
+        mState->mReady.pop();
+    }
+    assert (task->mNumThisWaitingOn==0);
+    if (task->mFailure) {
+        task->finish(false);
+    } else {
+        (*task)();
+    }
+}
+
+size_t DependencyScheduler::numReady() {
+    boost::mutex::scoped_lock lock(mState->mMutex);
+    return mState->mReady.size();
+}
+
 }
 }
@@ -41,29 +41,72 @@ namespace Sirikata {
 namespace Task {
 
 class WorkQueue;
+class DependencyScheduler;
 
 /// Scheduler interface
 class SIRIKATA_EXPORT DependentTask {
 	WorkQueue *mWorkQueue;
+    DependencyScheduler *mScheduler;
     LockFreeQueue <DependentTask*>mDependents;
     AtomicValue<int> mNumThisWaitingOn;
     bool mFailure;
+    /// Tasks this one still waits on; only kept when scheduled through a DependencyScheduler, guarded by its lock.
+    std::vector<DependentTask*> mDependencies;
+    /// Longest chain of cost(), from this task through the tasks waiting on it.
+    uint32 mCriticalPath;
 
     class CallFailed;
     friend class CallFailed;
     class CallSuccess;
     friend class CallSuccess;
+    friend class DependencyScheduler;
 public:
     DependentTask(WorkQueue *q);
+    /// Lets scheduler order this task against the others in its graph once it is ready to run.
+    DependentTask(DependencyScheduler *scheduler);
     virtual ~DependentTask();
     void addDepender(DependentTask*);
     void finish(bool success);
     virtual void operator() () = 0;
     ///checks if mNumWaitingOn is 0 and if so sets the event in motion
     void go();
+    /// Relative amount of work in this task, used to weigh critical paths.
+    virtual uint32 cost() const {
+        return 1;
+    }
 
 };
 
+/**
+ * Keeps the whole graph of the DependentTasks created with it, and runs
+ * whichever ready task has the longest remaining critical path first,
+ * so work that many later tasks wait on is never stuck behind leaves.
+ * Every task that becomes ready puts one item on the WorkQueue; each item
+ * runs the best ready task at the time it is dequeued.
+ */
+class SIRIKATA_EXPORT DependencyScheduler {
+    class State;
+    class RunReady;
+    friend class RunReady;
+    friend class DependentTask;
+    WorkQueue *mWorkQueue;
+    State *mState;
+
+    /// depender waits on dependency: extends the critical path of dependency and everything it waits on.
+    void addDependency(DependentTask *depender, DependentTask *dependency);
+    void removeDependency(DependentTask *depender, DependentTask *dependency);
+    void ready(DependentTask *task);
+    void runReady();
+public:
+    DependencyScheduler(WorkQueue *queue);
+    ~DependencyScheduler();
+    WorkQueue *getQueue() {
+        return mWorkQueue;
+    }
+    /// Number of tasks ready to run but not yet picked off the WorkQueue.
+    size_t numReady();
+};
+
 }
 }
 
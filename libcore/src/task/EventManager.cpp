@@ -36,6 +36,7 @@
 
 #include "WorkQueue.hpp"
 #include "TimerQueue.hpp"
+#include "util/Metrics.hpp"
 
 #include <iostream>
 
@@ -74,10 +75,7 @@ struct EventManager<T>::ListenerUnsubRequest : public WorkItem {
 		} else {
 			EventSubscriptionInfo &subInfo = (*iter).second;
 			SILOG(task,debug,"**** Unsubscribe " << mListenerId);
-			if (mNotifyListener) {
-				(*subInfo.mIter).first(EventPtr());
-			}
-			subInfo.mList->erase(subInfo.mIter);
+			subInfo.mList->remove(mListenerId, mNotifyListener);
 			if (subInfo.secondaryMap) {
 				SILOG(task,debug," with Secondary ID " <<
 						  subInfo.secondaryId << std::endl << "\t");
@@ -142,21 +140,24 @@ struct EventManager<T>::ListenerSubRequest : public WorkItem {
 				mParent->insertSecId(*secondListeners, mEventId.mSecId);
 			insertList = &((*secondIter).second->get(mWhichOrder));
 		}
-		typename ListenerList::iterator iter =
-			mParent->addListener(insertList, mListenerFunc, mListenerId);
+		insertList->add(mListenerFunc, mListenerId);
 
 		if (mListenerId != SubscriptionIdClass::null()) {
 			mParent->mRemoveById.insert(
 				typename RemoveMap::value_type(mListenerId,
 					EventSubscriptionInfo(
 						insertList,
-						iter,
 						secondListeners,
 						mEventId.mSecId)));
 		}
 	}
 };
 
+namespace {
+Metrics::Counter sFired("eventmanager.fired","events handed to EventManager::fire");
+Metrics::Histogram sDispatchTime("eventmanager.dispatch_us","microseconds spent calling the listeners of one event");
+}
+
 template <class T>
 struct EventManager<T>::FireEvent : public WorkItem {
 	EventManager<T> *mParent;
@@ -170,6 +171,7 @@ struct EventManager<T>::FireEvent : public WorkItem {
 
 	virtual void operator() () {
 		AutoPtr ref(this); // Allow deletion at the end.
+		Metrics::ScopedTimer timer(sDispatchTime);
 
 		mParent->mSubscriptionQueue->dequeueAll();
 
@@ -352,22 +354,105 @@ SubscriptionId EventManager<T>::subscribeId(
 	return removeId;
 }
 
+// ============= LISTENER STORAGE ==============
+
 /**
  * Standard function to add a listener to a ListenerList.
  *
- * Note that we use push_front so as not to disrupt any
- * events currently being processed (and possibly go in
- * an infinite loop, due to a stupid listener adding another
- * copy of itself back into the end).
+ * Listeners are fired from the back, newest first, so that new listeners
+ * do not disrupt any events currently being processed (and possibly go in
+ * an infinite loop, due to a stupid listener adding another copy of
+ * itself back into the list).
  */
 template <class T>
-typename EventManager<T>::ListenerList::iterator
-EventManager<T>::addListener(ListenerList *insertList,
+void EventManager<T>::ListenerList::add(
 		const EventListener &listener,
 		SubscriptionId removeId)
 {
-	return insertList->insert( insertList->begin(),
-		ListenerSubscriptionInfo(listener, removeId));
+	if (mFiringDepth) {
+		mPending.push_back(ListenerSubscriptionInfo(listener, removeId));
+	} else {
+		mListeners.push_back(ListenerSubscriptionInfo(listener, removeId));
+	}
+}
+
+template <class T>
+void EventManager<T>::ListenerList::removeAt(size_t i) {
+	if (!mListeners[i].mRemoved) {
+		mListeners[i].mRemoved = true;
+		++mNumRemoved;
+		mHasStaleListeners = true;
+	}
+}
+
+template <class T>
+bool EventManager<T>::ListenerList::remove(
+		SubscriptionId removeId,
+		bool notifyListener)
+{
+	for (size_t i = 0; i < mListeners.size(); ++i) {
+		if (mListeners[i].mId == removeId && !mListeners[i].mRemoved) {
+			Firing firing(*this);
+			if (notifyListener) {
+				mListeners[i].mListener(EventPtr());
+			}
+			removeAt(i);
+			return true;
+		}
+	}
+	typename std::vector<ListenerSubscriptionInfo>::iterator iter;
+	for (iter = mPending.begin(); iter != mPending.end(); ++iter) {
+		if ((*iter).mId == removeId) {
+			EventListener listener((*iter).mListener);
+			mPending.erase(iter);
+			if (notifyListener) {
+				listener(EventPtr());
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+template <class T>
+void EventManager<T>::ListenerList::endFiring() {
+	if (--mFiringDepth) {
+		return;
+	}
+	// Compact once a quarter of the entries are dead; until then only
+	// release what the tombstoned listeners hold on to.
+	if (mNumRemoved && mNumRemoved * 4 >= mListeners.size()) {
+		compact();
+	} else if (mHasStaleListeners) {
+		for (size_t i = 0; i < mListeners.size(); ++i) {
+			if (mListeners[i].mRemoved) {
+				mListeners[i].mListener = EventListener();
+			}
+		}
+	}
+	mHasStaleListeners = false;
+	if (!mPending.empty()) {
+		mListeners.insert(mListeners.end(), mPending.begin(), mPending.end());
+		mPending.clear();
+	}
+}
+
+template <class T>
+void EventManager<T>::ListenerList::compact() {
+	size_t numLive = 0;
+	for (size_t i = 0; i < mListeners.size(); ++i) {
+		if (!mListeners[i].mRemoved) {
+			if (numLive != i) {
+				ListenerSubscriptionInfo &dest = mListeners[numLive];
+				dest.mListener.swap(mListeners[i].mListener);
+				dest.mId = mListeners[i].mId;
+				dest.mRemoved = false;
+			}
+			++numLive;
+		}
+	}
+	mListeners.erase(mListeners.begin() + numLive, mListeners.end());
+	mNumRemoved = 0;
 }
 
 // ============= UNSUBSCRIPTION FUNCTIONS ==============
@@ -419,11 +504,21 @@ bool EventManager<T>::cleanUp(
 
 template <class T>
 void EventManager<T>::fire(EventPtr ev) {
+	sFired.increment();
 	mWorkQueue->enqueue(new FireEvent(this, ev));
 	SILOG(task,insane,"**** Firing event " << (void*)(&(*ev)) <<
 		" with " << ev->getId());
 };
 
+template <class T>
+unsigned int EventManager<T>::processEventQueue(const DeltaTime &maxTime) {
+	unsigned int numProcessed = mWorkQueue->dequeueUntil(AbsTime::now() + maxTime);
+	unsigned int backlog = mWorkQueue->probableSize();
+	SILOG(task,insane,"**** Dispatched " << numProcessed <<
+		" events, " << backlog << " left queued");
+	return backlog;
+}
+
 
 /* FIXME: We need a "never" constant for AbsTime that is
    always grreater than anything else */
@@ -433,34 +528,38 @@ bool EventManager<T>::callAllListeners(EventPtr ev,
 			ListenerList *lili) {
 
 	bool cancel = false;
-	typename ListenerList::iterator iter = lili->begin();
-	/* Disallow 'unsubscribe()' while in this while loop.
-	 * We make a temporary mUnsubscribe list, and unsubscribe all
-	 * of them after we are done here.
+	/* 'unsubscribe()' while in this loop only tombstones listeners, and
+	 * listeners subscribed by a nested fire are held back until the
+	 * outermost Firing scope ends.
 	 *
-	 * The reason for this is 'iter' or 'next' may end up getting
-	 * deleted in the process.
+	 * The reason for this is that the storage of the listener being
+	 * called must not move while it runs.
 	 */
 	SILOG(task,insane," >>>\tHas " << lili->size() <<
 		" Listeners registered.");
-	while (iter!=lili->end()) {
-		typename ListenerList::iterator next = iter;
-		++next;
+	typename ListenerList::Firing firing(*lili);
+	for (size_t i = lili->numFiring(); i-- > 0; ) {
+		ListenerSubscriptionInfo &info = (*lili)[i];
+		if (info.mRemoved) {
+			continue;
+		}
 		// Now call the event listener.
-		SILOG(task,insane," >>>\tCalling " << (*iter).second <<"...");
-		EventResponse resp = (*iter).first(ev);
+		SILOG(task,insane," >>>\tCalling " << info.mId <<"...");
+		EventResponse resp = info.mListener(ev);
 		if (((int)resp.mResp) & EventResponse::DELETE_LISTENER) {
 			if (((int)resp.mResp) & EventResponse::CANCEL_EVENT) {
 				SILOG(task,insane," >>>\t\tReturned DELETE_LISTENER and CANCEL_EVENT");
 			} else {
 				SILOG(task,insane," >>>\t\tReturned DELETE_LISTENER");
 			}
-			if ((*iter).second != SubscriptionIdClass::null()) {
-				clearRemoveId((*iter).second);
-				// We do not want to send a NULL message to it.
-				// if we are removing due to return value.
+			if (!info.mRemoved) {
+				if (info.mId != SubscriptionIdClass::null()) {
+					clearRemoveId(info.mId);
+					// We do not want to send a NULL message to it.
+					// if we are removing due to return value.
+				}
+				lili->removeAt(i);
 			}
-			lili->erase(iter);
 		}
 		if (((int)resp.mResp) & EventResponse::CANCEL_EVENT) {
 			if (!(((int)resp.mResp) & EventResponse::DELETE_LISTENER)) {
@@ -468,7 +567,6 @@ bool EventManager<T>::callAllListeners(EventPtr ev,
 			}
 			cancel = true;
 		}
-		iter = next;
 	}
 	return cancel;
 }
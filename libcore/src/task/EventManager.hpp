@@ -36,6 +36,7 @@
 #include "util/LockFreeQueue.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "util/AtomicTypes.hpp"
+#include "util/Callback.hpp"
 #include "options/Options.hpp"
 #include "HashMap.hpp"
 #include "UniqueId.hpp"
@@ -137,23 +138,97 @@ public:
 	typedef std::tr1::shared_ptr<EventBase> EventPtr;
 
 	/**
-	 * A std::tr1::function1 taking an Event and returning a value indicating
+	 * A Callback taking an Event and returning a value indicating
 	 * Whether to cancel the event, remove the event responder, or some
-	 * other values.
+	 * other values.  Listeners are copied each time an event fires, so
+	 * small bound listeners are kept inline rather than on the heap.
 	 *
 	 * @see EventResponse
 	 */
-	typedef std::tr1::function<EventResponse(const EventPtr&)> EventListener;
+	typedef Callback<EventResponse(const EventPtr&)> EventListener;
 
 private:
 
 	/// if the listener does not corresond to an id, use SubscriptionId::null().
-	typedef std::pair<EventListener, SubscriptionId> ListenerSubscriptionInfo;
-	typedef std::list<ListenerSubscriptionInfo> ListenerList;
+	struct ListenerSubscriptionInfo {
+		EventListener mListener;
+		SubscriptionId mId;
+		/// Tombstone: set on unsubscribe, the entry is dropped at the next compaction.
+		bool mRemoved;
+
+		ListenerSubscriptionInfo(const EventListener &listener, SubscriptionId id)
+			: mListener(listener), mId(id), mRemoved(false) {
+		}
+	};
+
+	/**
+	 * The listeners for one event id and EventOrder, stored contiguously so
+	 * that firing is a linear scan. Unsubscribing only marks a tombstone, and
+	 * dead entries are squeezed out once nothing is firing the list.
+	 * Listeners added while the list is being fired (a listener may dequeue
+	 * more events) wait in mPending, so entries being called never move.
+	 */
+	class ListenerList {
+		std::vector<ListenerSubscriptionInfo> mListeners;
+		std::vector<ListenerSubscriptionInfo> mPending;
+		size_t mNumRemoved;
+		/// Tombstones whose EventListener could not be released while firing.
+		bool mHasStaleListeners;
+		unsigned int mFiringDepth;
+
+		void compact();
+	public:
+		/// Keeps the entries of a ListenerList in place while it is in scope.
+		class Firing {
+			ListenerList &mList;
+		public:
+			Firing(ListenerList &list) : mList(list) {
+				mList.beginFiring();
+			}
+			~Firing() {
+				mList.endFiring();
+			}
+		};
+
+		ListenerList() : mNumRemoved(0), mHasStaleListeners(false), mFiringDepth(0) {
+		}
+		/// Number of live listeners, including those waiting to be merged.
+		size_t size() const {
+			return mListeners.size() + mPending.size() - mNumRemoved;
+		}
+		/// \returns true if there are no listeners and nobody is firing this list, so it may be deleted.
+		bool empty() const {
+			return size() == 0 && mFiringDepth == 0;
+		}
+		/// Entries that existed when firing began; use only within a Firing scope.
+		size_t numFiring() const {
+			return mListeners.size();
+		}
+		ListenerSubscriptionInfo &operator[] (size_t i) {
+			return mListeners[i];
+		}
+
+		/// New listeners are fired before older ones.
+		void add(const EventListener &listener, SubscriptionId removeId);
+		/// Tombstones entry i. Call only within a Firing scope.
+		void removeAt(size_t i);
+		/**
+		 * Tombstones the listener registered with removeId.
+		 * \param notifyListener  whether to call the EventListener with NULL first.
+		 * \returns false if the id was not in this list.
+		 */
+		bool remove(SubscriptionId removeId, bool notifyListener);
+
+		void beginFiring() {
+			++mFiringDepth;
+		}
+		/// Merges pending listeners and compacts once the outermost firing finishes.
+		void endFiring();
+	};
 
 	/** Since std::map is free to reallocate its elements at its own choosing
 	 this class must be a pointer, not a statically-allocated array. (we want
-	 to be able to carry ListenerList iterators around) */
+	 to be able to carry ListenerList pointers around) */
 	class PartiallyOrderedListenerList {
 		ListenerList ll[NUM_EVENTORDER];
 	public:
@@ -173,23 +248,20 @@ private:
 
 	struct SIRIKATA_EXPORT EventSubscriptionInfo {
 		ListenerList *mList;
-		typename ListenerList::iterator mIter;
 
 		// used for garbage collection after unsubscribing.
 		SecondaryListenerMap *secondaryMap;
 		IdPair::Secondary secondaryId;
 
-		EventSubscriptionInfo(ListenerList *list,
-					typename ListenerList::iterator &iter)
-			: mList(list), mIter(iter),
+		EventSubscriptionInfo(ListenerList *list)
+			: mList(list),
 			  secondaryMap(NULL), secondaryId(IdPair::Secondary::null()) {
 		}
 
 		EventSubscriptionInfo(ListenerList *list,
-					typename ListenerList::iterator &iter,
 					SecondaryListenerMap *slm,
 					const IdPair::Secondary &slmKey)
-			: mList(list), mIter(iter),
+			: mList(list),
 			 secondaryMap(slm), secondaryId(slmKey) {
 		}
 	};
@@ -229,10 +301,6 @@ private:
 	bool cleanUp(SecondaryListenerMap *slm,
 				typename SecondaryListenerMap::iterator &slm_iter);
 
-	typename ListenerList::iterator
-		addListener(ListenerList *insertList,
-				const EventListener &listener,
-				SubscriptionId removeId);
 
 	bool callAllListeners(EventPtr ev,
 				ListenerList *lili);
@@ -351,6 +419,17 @@ public:
 	 */
 	void fire(EventPtr ev);
 
+	/**
+	 * Dispatches queued events from the WorkQueue until maxTime has
+	 * elapsed or the queue runs dry. Whatever did not fit in the budget
+	 * stays queued for the next call.
+	 *
+	 * @param maxTime  how long this call may spend dispatching.
+	 * @returns        the approximate number of items still queued, so
+	 *                 the caller can pace the next frame on the backlog.
+	 */
+	unsigned int processEventQueue(const DeltaTime &maxTime);
+
 };
 
 /**
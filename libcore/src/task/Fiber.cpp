@@ -0,0 +1,177 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  Fiber.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "Fiber.hpp"
+#include <boost/thread/tss.hpp>
+
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+namespace Sirikata {
+namespace Task {
+
+namespace {
+void leaveFiber(Fiber *) {
+	// The thread does not own the Fiber running on it.
+}
+boost::thread_specific_ptr<Fiber> sCurrentFiber(&leaveFiber);
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+/// Set once the thread has been converted, since only fibers may switch to fibers.
+boost::thread_specific_ptr<bool> sThreadIsFiber;
+#endif
+}
+
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+
+class Fiber::Context {
+public:
+	LPVOID mFiber;
+	/// Whatever was running when this Fiber was last resumed.
+	LPVOID mReturn;
+};
+
+namespace {
+VOID CALLBACK fiberEntry(LPVOID self) {
+	Fiber::run(static_cast<Fiber*>(self));
+}
+}
+
+#else
+
+class Fiber::Context {
+public:
+	ucontext_t mFiber;
+	/// Whatever was running when this Fiber was last resumed.
+	ucontext_t mReturn;
+	char *mStack;
+};
+
+namespace {
+// makecontext only passes ints, so the Fiber comes from sCurrentFiber instead.
+void fiberEntry() {
+	Fiber::run(Fiber::current());
+}
+}
+
+#endif
+
+Fiber::Fiber(const Body &body, size_t stackSize)
+		: mContext(new Context), mBody(body), mResumer(NULL),
+		  mFinished(false), mDeleteWhenFinished(false) {
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+	mContext->mFiber = CreateFiber(stackSize, &fiberEntry, this);
+	mContext->mReturn = NULL;
+#else
+	mContext->mStack = new char[stackSize];
+	getcontext(&mContext->mFiber);
+	mContext->mFiber.uc_stack.ss_sp = mContext->mStack;
+	mContext->mFiber.uc_stack.ss_size = stackSize;
+	// Returning from fiberEntry goes back to the last resume().
+	mContext->mFiber.uc_link = &mContext->mReturn;
+	makecontext(&mContext->mFiber, &fiberEntry, 0);
+#endif
+}
+
+Fiber::~Fiber() {
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+	DeleteFiber(mContext->mFiber);
+#else
+	delete []mContext->mStack;
+#endif
+	delete mContext;
+}
+
+void Fiber::run(Fiber *self) {
+	try {
+		self->mBody();
+	} catch (std::exception &exc) {
+		SILOG(task,error,"Caught exception '" << exc.what() << "' in Fiber");
+	}
+	self->mFinished = true;
+	self->mBody = Body();
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+	// A fiber must never return from its start routine.
+	SwitchToFiber(self->mContext->mReturn);
+#endif
+}
+
+bool Fiber::resume() {
+	assert(!mFinished && sCurrentFiber.get() != this);
+	mResumer = sCurrentFiber.get();
+	sCurrentFiber.reset(this);
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+	if (!sThreadIsFiber.get()) {
+		ConvertThreadToFiber(NULL);
+		sThreadIsFiber.reset(new bool(true));
+	}
+	mContext->mReturn = GetCurrentFiber();
+	SwitchToFiber(mContext->mFiber);
+#else
+	swapcontext(&mContext->mReturn, &mContext->mFiber);
+#endif
+	sCurrentFiber.reset(mResumer);
+	mResumer = NULL;
+	if (mFinished) {
+		if (mDeleteWhenFinished) {
+			delete this;
+		}
+		return false;
+	}
+	return true;
+}
+
+void Fiber::yield() {
+	Fiber *self = sCurrentFiber.get();
+	assert(self);
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+	SwitchToFiber(self->mContext->mReturn);
+#else
+	swapcontext(&self->mContext->mFiber, &self->mContext->mReturn);
+#endif
+}
+
+Fiber *Fiber::current() {
+	return sCurrentFiber.get();
+}
+
+void Fiber::start(const Body &body, size_t stackSize) {
+	Fiber *fiber = new Fiber(body, stackSize);
+	fiber->mDeleteWhenFinished = true;
+	fiber->resume();
+}
+
+}
+}
@@ -0,0 +1,108 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  Fiber.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_Fiber_HPP__
+#define SIRIKATA_Fiber_HPP__
+
+namespace Sirikata {
+namespace Task {
+
+/**
+ * A cooperatively scheduled thread of execution with its own stack.
+ * Code running in a Fiber can suspend itself with yield() partway
+ * through, for instance while waiting for a reply, and carry on from the
+ * same point when whoever receives the reply calls resume(). This lets
+ * a chain of requests be written as straight-line code instead of one
+ * callback per step.
+ *
+ * A Fiber may be resumed from any thread, but never from two at once,
+ * and never from inside itself.
+ */
+class SIRIKATA_EXPORT Fiber {
+public:
+	typedef std::tr1::function<void()> Body;
+	enum {
+		DEFAULT_STACK_SIZE = 128 * 1024
+	};
+private:
+	class Context;
+	Context *mContext;
+	Body mBody;
+	/// The Fiber that resumed this one, or NULL if it was a thread's own stack.
+	Fiber *mResumer;
+	bool mFinished;
+	bool mDeleteWhenFinished;
+
+	Fiber(const Fiber&);
+	Fiber &operator=(const Fiber&);
+public:
+	/**
+	 * Creates a suspended Fiber; nothing runs until the first resume().
+	 *
+	 * @param body       called on the new stack.
+	 * @param stackSize  bytes of stack to allocate for body.
+	 */
+	Fiber(const Body &body, size_t stackSize=DEFAULT_STACK_SIZE);
+	/// Must not be called on a Fiber that is suspended partway through its body.
+	~Fiber();
+
+	/**
+	 * Runs this Fiber until it yields or its body returns.
+	 * @returns true if the Fiber yielded and can be resumed again.
+	 */
+	bool resume();
+
+	/// Suspends the current Fiber, returning control to the resume() that ran it.
+	static void yield();
+
+	/// The Fiber running on this thread, or NULL on a thread's own stack.
+	static Fiber *current();
+
+	/**
+	 * Creates a Fiber which deletes itself once its body returns, and
+	 * runs it until its first yield. Whoever it waits on must hold on
+	 * to current() and resume it.
+	 */
+	static void start(const Body &body, size_t stackSize=DEFAULT_STACK_SIZE);
+
+	bool finished() const {
+		return mFinished;
+	}
+
+	/// Entry point on the new stack; not for use outside Fiber.cpp.
+	static void run(Fiber *self);
+};
+
+}
+}
+
+#endif
@@ -34,33 +34,102 @@
 
 #ifndef _WIN32
 #include <sys/time.h>
+#include <time.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach_time.h>
 #endif
 #include <stdlib.h>
 
 #ifdef _WIN32
 #include <windows.h>
-// probably something like this function
+#endif
 
-Sirikata::Task::AbsTime Sirikata::Task::AbsTime::now() {
+namespace {
+using Sirikata::uint64;
+
+uint64 wallMicroseconds() {
+#ifdef _WIN32
 	FILETIME ft;
 	GetSystemTimeAsFileTime(&ft);
 	ULARGE_INTEGER uli;
 	uli.LowPart = ft.dwLowDateTime;
 	uli.HighPart = ft.dwHighDateTime;
-	ULONGLONG time64 = uli.QuadPart/10;
-	return AbsTime::microseconds(time64);
-}
-
+	return uli.QuadPart/10;
 #else
-Sirikata::Task::AbsTime Sirikata::Task::AbsTime::now() {
 	struct timeval tv = {0, 0};
 	gettimeofday(&tv, NULL);
     uint64 total_time=tv.tv_sec;
     total_time*=1000000;
     total_time+=tv.tv_usec;
-	return AbsTime::microseconds(total_time);
+	return total_time;
+#endif
 }
+
+///Microseconds from an arbitrary start on a clock that is never stepped; falls back to the wall clock where there is none
+uint64 monotonicMicroseconds() {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency={0};
+    if (frequency.QuadPart==0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return (uint64)(ticks.QuadPart/frequency.QuadPart)*1000000+
+        (uint64)(ticks.QuadPart%frequency.QuadPart)*1000000/frequency.QuadPart;
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase={0,0};
+    if (timebase.denom==0) {
+        mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time()*timebase.numer/timebase.denom/1000;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64 total_time=ts.tv_sec;
+    total_time*=1000000;
+    total_time+=ts.tv_nsec/1000;
+    return total_time;
+#else
+    return wallMicroseconds();
 #endif
+}
+
+///The wall clock and monotonic clock read together once, so now() stays comparable to other hosts' times
+struct ClockAnchor {
+    uint64 wall;
+    uint64 monotonic;
+    ClockAnchor() : wall(wallMicroseconds()), monotonic(monotonicMicroseconds()) {
+    }
+};
+const ClockAnchor &clockAnchor() {
+    static ClockAnchor sAnchor;
+    return sAnchor;
+}
+///Set by updateFrameTime(); 0 until the first call
+volatile uint64 sFrameTime=0;
+}
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::now() {
+    const ClockAnchor &anchor=clockAnchor();
+    return AbsTime::microseconds(anchor.wall+(monotonicMicroseconds()-anchor.monotonic));
+}
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::wallClock() {
+    return AbsTime::microseconds(wallMicroseconds());
+}
+
+Sirikata::Task::AbsTime Sirikata::Task::AbsTime::frameTime() {
+    uint64 frameTime=sFrameTime;
+    if (frameTime==0) {
+        return now();
+    }
+    return AbsTime::microseconds(frameTime);
+}
+
+void Sirikata::Task::AbsTime::updateFrameTime() {
+    sFrameTime=now().raw();
+}
 
 namespace Sirikata { namespace Task {
 
@@ -198,10 +198,6 @@ class SIRIKATA_EXPORT AbsTime {
 		this->mTime = t;
 	}
 
-/*
-	static AbsTime sLastFrameTime; // updated in "updateFrameTime"
-	static void updateFrameTime();
-*/
 public:
         uint64 raw() const {
             return mTime;
@@ -262,11 +258,24 @@ public:
 	/**
 	 * The only public construction function for absolute times.
 	 *
-	 * @returns the current system time (gettimeofday), not to be used
+	 * @returns the system time at startup advanced by a monotonic clock, so
+	 * it never goes backwards and ignores later NTP steps. Not to be used
 	 * for time synchronization over the network.
 	 */
 	static AbsTime now(); // Only way to generate an AbsTime for now...
 
+	/// The system clock as it reads right now, which may jump or go backwards.
+	static AbsTime wallClock();
+
+	/**
+	 * The now() sampled by the last updateFrameTime(), for code that takes
+	 * many timestamps per main loop iteration and needs no finer precision.
+	 * Same as now() until updateFrameTime() is first called.
+	 */
+	static AbsTime frameTime();
+	/// Called once at the top of each main loop iteration.
+	static void updateFrameTime();
+
 	/**
 	 * Creates the time when items are 0
 	 *
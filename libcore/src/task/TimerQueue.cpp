@@ -0,0 +1,242 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  TimerQueue.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "TimerQueue.hpp"
+#include "options/Options.hpp"
+
+namespace Sirikata {
+namespace Task {
+
+TimerQueue::TimerQueue(const String &options)
+		: mFreeTimers(NULL), mNumFreeTimers(0), mNumTimers(0),
+		  mStartTime(AbsTime::now()), mCurrentTick(0),
+		  mFiring(NULL), mFiringCancelled(false) {
+	OptionValue *granularity;
+	InitializeClassOptions("timerqueue",this,
+		granularity=new OptionValue("granularity","10ms",OptionValueType<Duration>(),"length of one tick of the timer wheel: events fire on the first tick at or after their scheduled time"),
+		NULL);
+	(mOptions=OptionSet::getOptions("timerqueue",this))->parse(options);
+	mGranularityMicros = granularity->as<Duration>().toMicroseconds();
+	if (mGranularityMicros <= 0) {
+		mGranularityMicros = 1;
+	}
+}
+
+TimerQueue::~TimerQueue() {
+	for (int level = 0; level < NUM_LEVELS; ++level) {
+		for (int slot = 0; slot < SLOTS_PER_LEVEL; ++slot) {
+			Timer *head = &mWheel[level][slot];
+			while (!head->empty()) {
+				Timer *timer = head->mNext;
+				timer->unlink();
+				delete timer;
+			}
+		}
+	}
+	while (mFreeTimers) {
+		Timer *timer = mFreeTimers;
+		mFreeTimers = timer->mNext;
+		delete timer;
+	}
+}
+
+uint64 TimerQueue::tickFor(const AbsTime &time) const {
+	if (time <= mStartTime) {
+		return 0;
+	}
+	// Round up, so an event never fires before its time.
+	return ((time - mStartTime).toMicroseconds() + mGranularityMicros - 1) / mGranularityMicros;
+}
+
+TimerQueue::Timer *TimerQueue::allocTimer() {
+	if (mFreeTimers) {
+		Timer *timer = mFreeTimers;
+		mFreeTimers = timer->mNext;
+		--mNumFreeTimers;
+		timer->mPrev = timer->mNext = timer;
+		return timer;
+	}
+	return new Timer;
+}
+
+void TimerQueue::freeTimer(Timer *timer) {
+	timer->mEvent.clear();
+	if (mNumFreeTimers < MAX_FREE_TIMERS) {
+		timer->mNext = mFreeTimers;
+		mFreeTimers = timer;
+		++mNumFreeTimers;
+	} else {
+		delete timer;
+	}
+}
+
+void TimerQueue::place(Timer *timer) {
+	uint64 delta = timer->mDueTick - mCurrentTick;
+	int level = 0;
+	while (level < NUM_LEVELS - 1 &&
+			delta >= ((uint64)1 << (LEVEL_BITS * (level + 1)))) {
+		++level;
+	}
+	unsigned int slot;
+	if (delta >> (LEVEL_BITS * NUM_LEVELS)) {
+		// Beyond the reach of the outermost wheel: park it in the slot that
+		// comes up last, and it will be placed again when that happens.
+		slot = (unsigned int)(mCurrentTick >> (LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+	} else {
+		slot = (unsigned int)(timer->mDueTick >> (LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+	}
+	timer->insertBefore(&mWheel[level][slot]);
+}
+
+void TimerQueue::cascade(int level, unsigned int slot) {
+	Timer *head = &mWheel[level][slot];
+	Timer pending;
+	while (!head->empty()) {
+		Timer *timer = head->mNext;
+		timer->unlink();
+		timer->insertBefore(&pending);
+	}
+	while (!pending.empty()) {
+		Timer *timer = pending.mNext;
+		timer->unlink();
+		place(timer);
+	}
+}
+
+SubscriptionId TimerQueue::insert(AbsTime nextTime, const TimedEvent &ev, SubscriptionId id) {
+	Timer *timer = allocTimer();
+	timer->mEvent = ev;
+	timer->mId = id;
+	timer->mDueTick = tickFor(nextTime);
+	if (timer->mDueTick <= mCurrentTick) {
+		timer->mDueTick = mCurrentTick + 1;
+	}
+	place(timer);
+	++mNumTimers;
+	if (id != SubscriptionIdClass::null()) {
+		mTimersById[id] = timer;
+	}
+	return id;
+}
+
+void TimerQueue::schedule(AbsTime nextTime,
+			const TimedEvent &ev) {
+	insert(nextTime, ev, SubscriptionIdClass::null());
+}
+
+SubscriptionId TimerQueue::scheduleId(AbsTime nextTime,
+			const TimedEvent &ev) {
+	return insert(nextTime, ev, SubscriptionIdClass::alloc());
+}
+
+void TimerQueue::unschedule(const SubscriptionId &removeId) {
+	TimerIdMap::iterator iter = mTimersById.find(removeId);
+	if (iter == mTimersById.end()) {
+		SILOG(task,warning,"Double-Unschedule for removeId " << removeId);
+		return;
+	}
+	Timer *timer = iter->second;
+	mTimersById.erase(iter);
+	SubscriptionIdClass::free(removeId);
+	timer->mId = SubscriptionIdClass::null();
+	if (timer == mFiring) {
+		// Not linked anywhere while it runs; fire() frees it on return.
+		mFiringCancelled = true;
+	} else {
+		timer->unlink();
+		freeTimer(timer);
+		--mNumTimers;
+	}
+}
+
+void TimerQueue::fire(Timer *timer) {
+	mFiring = timer;
+	mFiringCancelled = false;
+	DeltaTime next = timer->mEvent();
+	mFiring = NULL;
+	if (mFiringCancelled || next < DeltaTime::zero()) {
+		if (timer->mId != SubscriptionIdClass::null()) {
+			mTimersById.erase(timer->mId);
+			SubscriptionIdClass::free(timer->mId);
+		}
+		freeTimer(timer);
+		--mNumTimers;
+		return;
+	}
+	// Count from the tick it fired on rather than from now, so periodic
+	// events do not drift by a fraction of a tick every time.
+	uint64 numTicks = (uint64)((next.toMicroseconds() + mGranularityMicros / 2) / mGranularityMicros);
+	timer->mDueTick = mCurrentTick + (numTicks ? numTicks : 1);
+	place(timer);
+}
+
+unsigned int TimerQueue::tick(const AbsTime &now) {
+	uint64 target = (now <= mStartTime) ? 0 :
+		(now - mStartTime).toMicroseconds() / mGranularityMicros;
+	unsigned int numFired = 0;
+	while (mCurrentTick < target) {
+		if (mNumTimers == 0) {
+			mCurrentTick = target;
+			break;
+		}
+		++mCurrentTick;
+		// Bring down the timers of each coarser wheel whose slot starts at
+		// this tick, coarsest first so they can cascade all the way.
+		int level = 1;
+		while (level < NUM_LEVELS &&
+				(mCurrentTick & (((uint64)1 << (LEVEL_BITS * level)) - 1)) == 0) {
+			++level;
+		}
+		for (--level; level > 0; --level) {
+			cascade(level, (unsigned int)(mCurrentTick >> (LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1));
+		}
+
+		Timer *head = &mWheel[0][mCurrentTick & (SLOTS_PER_LEVEL - 1)];
+		Timer due;
+		while (!head->empty()) {
+			Timer *timer = head->mNext;
+			timer->unlink();
+			timer->insertBefore(&due);
+		}
+		while (!due.empty()) {
+			Timer *timer = due.mNext;
+			timer->unlink();
+			fire(timer);
+			++numFired;
+		}
+	}
+	return numFired;
+}
+
+}
+}
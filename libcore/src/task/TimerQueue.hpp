@@ -35,10 +35,13 @@
 
 #include "Time.hpp"
 #include "UniqueId.hpp"
+#include "util/Callback.hpp"
 
 
 namespace Sirikata {
 
+class OptionSet;
+
 /** TimerQueue.hpp -- includes definitions for TimedEvent and TimerQueue */
 namespace Task {
 
@@ -49,14 +52,98 @@ namespace Task {
  * again, 0 if the function should be called next frame (ASAP), or
  * negative if it should be removed from the timer queue.
  */
-typedef std::tr1::function<DeltaTime()> TimedEvent;
+typedef Callback<DeltaTime()> TimedEvent;
+
+
+
+/**
+ * A work queue that runs on each frame.
+ *
+ * Timers are kept in a hierarchical timing wheel: NUM_LEVELS wheels of
+ * SLOTS_PER_LEVEL slots, each level a factor of SLOTS_PER_LEVEL coarser
+ * than the one below. Scheduling and unscheduling are constant time, and
+ * a timer is moved down a level each time its slot on a coarser wheel
+ * comes up, until it fires from the finest one. Time is rounded up to
+ * the "granularity" option, so events fire on the first tick() at or
+ * after their scheduled time.
+ *
+ * Like the rest of the per-frame machinery this is not thread safe:
+ * schedule, unschedule and tick must be called from the same thread.
+ */
+class SIRIKATA_EXPORT TimerQueue {
+	enum {
+		LEVEL_BITS = 8,
+		SLOTS_PER_LEVEL = 1 << LEVEL_BITS,
+		NUM_LEVELS = 4,
+		/// Unused nodes kept around for reuse, beyond which they are freed.
+		MAX_FREE_TIMERS = 1024
+	};
+
+	/// One scheduled event, linked into its wheel slot.
+	struct Timer {
+		TimedEvent mEvent;
+		uint64 mDueTick;
+		SubscriptionId mId;
+		Timer *mPrev;
+		Timer *mNext;
+
+		/// Constructs a node linked to itself, used as the head of a slot.
+		Timer() : mDueTick(0), mId(SubscriptionIdClass::null()) {
+			mPrev = mNext = this;
+		}
+		void unlink() {
+			mPrev->mNext = mNext;
+			mNext->mPrev = mPrev;
+			mPrev = mNext = this;
+		}
+		void insertBefore(Timer *head) {
+			mNext = head;
+			mPrev = head->mPrev;
+			mPrev->mNext = this;
+			head->mPrev = this;
+		}
+		bool empty() const {
+			return mNext == this;
+		}
+	};
+	typedef std::tr1::unordered_map<SubscriptionId, Timer*, SubscriptionIdHasher> TimerIdMap;
 
+	OptionSet *mOptions;
+	Timer mWheel[NUM_LEVELS][SLOTS_PER_LEVEL];
+	TimerIdMap mTimersById;
+	/// Singly linked through mNext.
+	Timer *mFreeTimers;
+	size_t mNumFreeTimers;
+	size_t mNumTimers;
 
+	AbsTime mStartTime;
+	int64 mGranularityMicros;
+	/// The last tick that has been run.
+	uint64 mCurrentTick;
 
-/** A work queue that runs on each frame. */
-class TimerQueue {
-	std::map<AbsTime, std::list<TimedEvent> > mQueue;
+	/// The timer whose event is being called, and whether it was unscheduled meanwhile.
+	Timer *mFiring;
+	bool mFiringCancelled;
+
+	uint64 tickFor(const AbsTime &time) const;
+	Timer *allocTimer();
+	void freeTimer(Timer *timer);
+	/// Links timer into the wheel slot for its mDueTick, relative to mCurrentTick.
+	void place(Timer *timer);
+	/// Moves every timer in (level, slot) down to the finer wheels.
+	void cascade(int level, unsigned int slot);
+	void fire(Timer *timer);
+	SubscriptionId insert(AbsTime nextTime, const TimedEvent &ev, SubscriptionId id);
+
+	TimerQueue(const TimerQueue&);
+	TimerQueue &operator=(const TimerQueue&);
 public:
+	/**
+	 * @param options  parsed by the "timerqueue" OptionSet; "granularity"
+	 *                 sets the length of one tick of the finest wheel.
+	 */
+	TimerQueue(const String &options=String());
+	~TimerQueue();
 
 	/**
 	 * Schedules this event to occur at nextTime.  The only way to remove
@@ -93,6 +180,21 @@ public:
 	 * @param removeId  the exact SubscriptionID to search for.
 	 */
 	void unschedule(const SubscriptionId &removeId);
+
+	/**
+	 * Calls every event due at or before now, rescheduling those that
+	 * return a non-negative DeltaTime. The delay is counted from the tick
+	 * the event fired on, rounded to the nearest tick.
+	 *
+	 * @param now  The current time, usually the start of the frame.
+	 * @returns    the number of events called.
+	 */
+	unsigned int tick(const AbsTime &now=AbsTime::now());
+
+	/// The number of events waiting in the queue.
+	size_t size() const {
+		return mNumTimers;
+	}
 };
 
 /// Global TimerQueue singleton.
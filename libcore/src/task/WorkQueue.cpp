@@ -36,11 +36,26 @@
 #include "Time.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "util/LockFreeQueue.hpp"
+#include "util/SPSCRingBuffer.hpp"
+#include "util/ThreadAffinity.hpp"
+#include "util/Metrics.hpp"
 #include <boost/thread.hpp>
 
 namespace Sirikata {
 namespace Task {
 
+namespace {
+Metrics::Gauge sBacklog("workqueue.backlog","work items waiting in every WorkQueue");
+Metrics::Counter sEnqueued("workqueue.enqueued","work items handed to any WorkQueue");
+void noteEnqueued(size_t count) {
+	sBacklog.add((int64)count);
+	sEnqueued.add(count);
+}
+void noteDequeued(size_t count) {
+	sBacklog.add(-(int64)count);
+}
+}
+
 bool AbortableWorkItem::doAcquireLock() {
 	if ((++mAbortLock)==1) {
 		return true;
@@ -67,6 +82,7 @@ bool AbortableWorkItem::abort() {
 
 namespace {
 void workQueueWorkerThread(WorkQueue *queue) {
+    ThreadAffinity::pinWorkerThread();
     try {
         while (queue->dequeueBlocking()) {
         }
@@ -103,18 +119,38 @@ void WorkQueue::destroyWorkerThreads(WorkQueueThread *th) {
 	delete th;
 }
 
+template <class QueueType>
+WorkQueueImpl<QueueType>::WorkQueueImpl() : mNumQueued(0) {
+}
+
 template <class QueueType>
 void WorkQueueImpl<QueueType>::enqueue(WorkItem *element) {
     if (element) {
         element->enqueued();
     }
+	++mNumQueued;
+	noteEnqueued(1);
 	mQueue.push(element);
 }
 
+template <class QueueType>
+void WorkQueueImpl<QueueType>::enqueueBatch(WorkItem **elements, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		if (elements[i]) {
+			elements[i]->enqueued();
+		}
+	}
+	mNumQueued += (int)count;
+	noteEnqueued(count);
+	mQueue.pushBatch(elements, count);
+}
+
 template <class QueueType>
 bool WorkQueueImpl<QueueType>::dequeueBlocking() {
 	WorkItem *element;
 	mQueue.blockingPop(element);
+	--mNumQueued;
+	noteDequeued(1);
 	if (element) {
 		(*element)();
 		return true;
@@ -127,6 +163,8 @@ template <class QueueType>
 bool WorkQueueImpl<QueueType>::dequeuePoll() {
 	WorkItem *element;
 	if (mQueue.pop(element)) {
+		--mNumQueued;
+		noteDequeued(1);
 		if (element) {
 			(*element)();
 		}
@@ -135,6 +173,32 @@ bool WorkQueueImpl<QueueType>::dequeuePoll() {
 	return false;
 }
 
+template <class QueueType>
+unsigned int WorkQueueImpl<QueueType>::dequeueUpTo(unsigned int maxCount) {
+	enum {BATCH_SIZE = 32};
+	WorkItem *batch[BATCH_SIZE];
+	unsigned int numProcessed = 0;
+	while (numProcessed < maxCount) {
+		size_t wanted = maxCount - numProcessed;
+		if (wanted > BATCH_SIZE) {
+			wanted = BATCH_SIZE;
+		}
+		size_t numPopped = mQueue.popUpTo(batch, wanted);
+		mNumQueued -= (int)numPopped;
+		noteDequeued(numPopped);
+		for (size_t i = 0; i < numPopped; ++i) {
+			if (batch[i]) {
+				(*batch[i])();
+			}
+		}
+		numProcessed += numPopped;
+		if (numPopped < wanted) {
+			break;
+		}
+	}
+	return numProcessed;
+}
+
 template <class QueueType>
 unsigned int WorkQueueImpl<QueueType>::dequeueAll() {
 	typename Queue::NodeIterator queueIter (mQueue);
@@ -142,6 +206,8 @@ unsigned int WorkQueueImpl<QueueType>::dequeueAll() {
 	unsigned int numProcessed = 0;
 
 	while ((workPtr = queueIter.next()) != NULL) {
+		--mNumQueued;
+		noteDequeued(1);
 		if (*workPtr) {
 			(**workPtr)();
 		}
@@ -152,6 +218,7 @@ unsigned int WorkQueueImpl<QueueType>::dequeueAll() {
 
 template <class QueueType>
 WorkQueueImpl<QueueType>::~WorkQueueImpl() {
+	noteDequeued(probableSize());
 	typename Queue::NodeIterator queueIter (mQueue);
 	WorkItem** workPtr;
 	while ((workPtr = queueIter.next()) != NULL) {
@@ -167,10 +234,17 @@ bool WorkQueueImpl<QueueType>::probablyEmpty() {
 	return mQueue.probablyEmpty();
 }
 
+template <class QueueType>
+unsigned int WorkQueueImpl<QueueType>::probableSize() {
+	int numQueued = mNumQueued.read();
+	return numQueued > 0 ? (unsigned int)numQueued : 0;
+}
+
 
 
 template <class QueueType>
 void UnsafeWorkQueueImpl<QueueType>::enqueue(WorkItem *element) {
+	noteEnqueued(1);
 	mQueue[mWhichQueue].push(element);
 }
 
@@ -184,6 +258,7 @@ bool UnsafeWorkQueueImpl<QueueType>::dequeuePoll() {
 		(*element)();
 	}
 	mQueue[mWhichQueue].pop();
+	noteDequeued(1);
 	return element?true:false;
 }
 
@@ -211,11 +286,13 @@ unsigned int UnsafeWorkQueueImpl<QueueType>::dequeueAll() {
 		queue.pop();
 		++count;
 	}
+	noteDequeued(count);
 	return count;
 }
 
 template <class QueueType>
 UnsafeWorkQueueImpl<QueueType>::~UnsafeWorkQueueImpl() {
+	noteDequeued(mQueue[0].size() + mQueue[1].size());
 	// std::queue has no swap function.
 	QueueType &queue = mQueue[mWhichQueue];
 	mWhichQueue = !mWhichQueue;
@@ -234,8 +311,448 @@ bool UnsafeWorkQueueImpl<QueueType>::probablyEmpty() {
 	return mQueue[mWhichQueue].empty();
 }
 
+template <class QueueType>
+unsigned int UnsafeWorkQueueImpl<QueueType>::probableSize() {
+	return (unsigned int)mQueue[mWhichQueue].size();
+}
+
+
+
+class WorkStealingWorkQueue::WorkerDeque {
+public:
+	boost::mutex mMutex;
+	std::deque<WorkItem*> mItems;
+};
+
+class WorkStealingWorkQueue::SleepState {
+public:
+	boost::mutex mMutex;
+	boost::condition_variable mCondition;
+	/// Number of threads inside dequeueBlocking that found nothing to do.
+	AtomicValue<int> mNumSleeping;
+	/// Which deque, plus one, the current thread owns. 0 if it owns none.
+	boost::thread_specific_ptr<unsigned int> mOwnedDeque;
+	SleepState() : mNumSleeping(0) {
+	}
+};
+
+WorkStealingWorkQueue::WorkStealingWorkQueue(unsigned int numDeques)
+		: mSleep(new SleepState), mNumQueued(0), mNextEnqueue(0), mNextWorker(0) {
+	if (numDeques == 0) {
+		numDeques = boost::thread::hardware_concurrency();
+		if (numDeques == 0) {
+			numDeques = 1;
+		}
+	}
+	for (unsigned int i = 0; i < numDeques; ++i) {
+		mDeques.push_back(new WorkerDeque);
+	}
+}
+
+WorkStealingWorkQueue::~WorkStealingWorkQueue() {
+	noteDequeued(probableSize());
+	for (size_t i = 0; i < mDeques.size(); ++i) {
+		for (std::deque<WorkItem*>::iterator iter = mDeques[i]->mItems.begin(); iter != mDeques[i]->mItems.end(); ++iter) {
+			if (*iter) {
+				std::auto_ptr<WorkItem>deleteMe(*iter);
+			}
+		}
+		delete mDeques[i];
+	}
+	delete mSleep;
+}
+
+WorkStealingWorkQueue::WorkerDeque *WorkStealingWorkQueue::ownDeque(bool claimIfUnowned) {
+	unsigned int *owned = mSleep->mOwnedDeque.get();
+	if (owned == NULL) {
+		if (!claimIfUnowned) {
+			return NULL;
+		}
+		owned = new unsigned int((mNextWorker++) % mDeques.size() + 1);
+		mSleep->mOwnedDeque.reset(owned);
+	}
+	return mDeques[*owned - 1];
+}
+
+void WorkStealingWorkQueue::enqueue(WorkItem *element) {
+	if (element) {
+		element->enqueued();
+	}
+	WorkerDeque *target = ownDeque(false);
+	if (target == NULL || element == NULL) {
+		// NULL wakeups are spread out so that every worker can find one.
+		target = mDeques[(mNextEnqueue++) % mDeques.size()];
+	}
+	{
+		boost::lock_guard<boost::mutex> lock(target->mMutex);
+		target->mItems.push_back(element);
+	}
+	++mNumQueued;
+	noteEnqueued(1);
+	if (mSleep->mNumSleeping.read() > 0) {
+		boost::lock_guard<boost::mutex> lock(mSleep->mMutex);
+		mSleep->mCondition.notify_one();
+	}
+}
+
+void WorkStealingWorkQueue::enqueueBatch(WorkItem **elements, size_t count) {
+	if (count == 0) {
+		return;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (elements[i]) {
+			elements[i]->enqueued();
+		}
+	}
+	WorkerDeque *target = ownDeque(false);
+	if (target == NULL) {
+		target = mDeques[(mNextEnqueue++) % mDeques.size()];
+	}
+	{
+		// Idle workers steal from here, so the batch still spreads out.
+		boost::lock_guard<boost::mutex> lock(target->mMutex);
+		target->mItems.insert(target->mItems.end(), elements, elements + count);
+	}
+	mNumQueued += (int)count;
+	noteEnqueued(count);
+	if (mSleep->mNumSleeping.read() > 0) {
+		boost::lock_guard<boost::mutex> lock(mSleep->mMutex);
+		mSleep->mCondition.notify_all();
+	}
+}
+
+bool WorkStealingWorkQueue::tryDequeue(WorkItem *&element, WorkerDeque *own) {
+	if (mNumQueued.read() <= 0) {
+		return false;
+	}
+	if (own) {
+		boost::lock_guard<boost::mutex> lock(own->mMutex);
+		if (!own->mItems.empty()) {
+			element = own->mItems.back();
+			own->mItems.pop_back();
+			--mNumQueued;
+			noteDequeued(1);
+			return true;
+		}
+	}
+	size_t numDeques = mDeques.size();
+	size_t start = mNextEnqueue.read() % numDeques;
+	for (size_t i = 0; i < numDeques; ++i) {
+		WorkerDeque *victim = mDeques[(start + i) % numDeques];
+		if (victim == own) {
+			continue;
+		}
+		boost::lock_guard<boost::mutex> lock(victim->mMutex);
+		if (!victim->mItems.empty()) {
+			element = victim->mItems.front();
+			victim->mItems.pop_front();
+			--mNumQueued;
+			noteDequeued(1);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool WorkStealingWorkQueue::dequeueBlocking() {
+	WorkerDeque *own = ownDeque(true);
+	WorkItem *element;
+	while (!tryDequeue(element, own)) {
+		boost::unique_lock<boost::mutex> lock(mSleep->mMutex);
+		++mSleep->mNumSleeping;
+		while (mNumQueued.read() <= 0) {
+			mSleep->mCondition.wait(lock);
+		}
+		--mSleep->mNumSleeping;
+	}
+	if (element) {
+		(*element)();
+		return true;
+	} else {
+		return false;
+	}
+}
+
+bool WorkStealingWorkQueue::dequeuePoll() {
+	WorkItem *element;
+	if (tryDequeue(element, ownDeque(false))) {
+		if (element) {
+			(*element)();
+		}
+		return true;
+	}
+	return false;
+}
+
+unsigned int WorkStealingWorkQueue::dequeueAll() {
+	// Only run what was there at the time of the call, anything enqueued by those items waits for the next call.
+	int numToProcess = mNumQueued.read();
+	unsigned int numProcessed = 0;
+	WorkerDeque *own = ownDeque(false);
+	WorkItem *element;
+	while (numToProcess-- > 0 && tryDequeue(element, own)) {
+		if (element) {
+			(*element)();
+		}
+		++numProcessed;
+	}
+	return numProcessed;
+}
+
+bool WorkStealingWorkQueue::probablyEmpty() {
+	return mNumQueued.read() <= 0;
+}
+
+unsigned int WorkStealingWorkQueue::probableSize() {
+	int numQueued = mNumQueued.read();
+	return numQueued > 0 ? (unsigned int)numQueued : 0;
+}
+
+
+class PriorityWorkQueue::State {
+public:
+	struct Entry {
+		WorkItem *mItem;
+		AbsTime mEnqueued;
+		Entry(WorkItem *item, const AbsTime &enqueued) : mItem(item), mEnqueued(enqueued) {
+		}
+	};
+	struct Level {
+		std::deque<Entry> mItems;
+		Metrics::Gauge mBacklog;
+		Metrics::Histogram mWait;
+		Level(const char *name)
+			: mBacklog(String("workqueue.priority.") + name + ".backlog", "work items waiting at this PriorityWorkQueue priority"),
+			  mWait(String("workqueue.priority.") + name + ".wait", "microseconds work items waited at this PriorityWorkQueue priority") {
+		}
+	};
+	boost::mutex mMutex;
+	boost::condition_variable mCondition;
+	Level *mLevels[NUM_WORK_PRIORITIES];
+	State() {
+		static const char *names[NUM_WORK_PRIORITIES] = {"high", "normal", "low"};
+		for (int i = 0; i < NUM_WORK_PRIORITIES; ++i) {
+			mLevels[i] = new Level(names[i]);
+		}
+	}
+	~State() {
+		for (int i = 0; i < NUM_WORK_PRIORITIES; ++i) {
+			for (std::deque<Entry>::iterator iter = mLevels[i]->mItems.begin(); iter != mLevels[i]->mItems.end(); ++iter) {
+				if (iter->mItem) {
+					std::auto_ptr<WorkItem>deleteMe(iter->mItem);
+				}
+			}
+			delete mLevels[i];
+		}
+	}
+};
+
+PriorityWorkQueue::PriorityWorkQueue(const DeltaTime &agingStep)
+		: mState(new State), mNumQueued(0), mAgingStep(agingStep) {
+}
+
+PriorityWorkQueue::~PriorityWorkQueue() {
+	noteDequeued(probableSize());
+	delete mState;
+}
+
+void PriorityWorkQueue::enqueue(WorkItem *element) {
+	enqueuePriority(element, PRIORITY_NORMAL);
+}
+
+void PriorityWorkQueue::enqueuePriority(WorkItem *element, WorkPriority priority) {
+	if (element) {
+		element->enqueued();
+	}
+	{
+		boost::lock_guard<boost::mutex> lock(mState->mMutex);
+		mState->mLevels[priority]->mItems.push_back(State::Entry(element, AbsTime::now()));
+		++mNumQueued;
+	}
+	mState->mLevels[priority]->mBacklog.add(1);
+	noteEnqueued(1);
+	mState->mCondition.notify_one();
+}
+
+void PriorityWorkQueue::enqueueBatch(WorkItem **elements, size_t count) {
+	if (count == 0) {
+		return;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (elements[i]) {
+			elements[i]->enqueued();
+		}
+	}
+	State::Level *level = mState->mLevels[PRIORITY_NORMAL];
+	AbsTime now = AbsTime::now();
+	{
+		boost::lock_guard<boost::mutex> lock(mState->mMutex);
+		for (size_t i = 0; i < count; ++i) {
+			level->mItems.push_back(State::Entry(elements[i], now));
+		}
+		mNumQueued += (int)count;
+	}
+	level->mBacklog.add((int64)count);
+	noteEnqueued(count);
+	mState->mCondition.notify_all();
+}
 
+bool PriorityWorkQueue::tryDequeue(WorkItem *&element) {
+	if (mNumQueued.read() <= 0) {
+		return false;
+	}
+	AbsTime now = AbsTime::now();
+	State::Level *chosen = NULL;
+	DeltaTime waited = DeltaTime::zero();
+	{
+		boost::lock_guard<boost::mutex> lock(mState->mMutex);
+		// Only the head of each level can be the oldest of it, so comparing heads is enough.
+		int64 bestRank = 0;
+		for (int i = 0; i < NUM_WORK_PRIORITIES; ++i) {
+			State::Level *level = mState->mLevels[i];
+			if (level->mItems.empty()) {
+				continue;
+			}
+			DeltaTime headWait = now - level->mItems.front().mEnqueued;
+			int64 rank = i;
+			if (mAgingStep > DeltaTime::zero()) {
+				rank -= headWait.toMicroseconds() / mAgingStep.toMicroseconds();
+			}
+			// On a tie the item that waited longer goes first, which is what lets aged items through.
+			if (chosen == NULL || rank < bestRank || (rank == bestRank && waited < headWait)) {
+				chosen = level;
+				bestRank = rank;
+				waited = headWait;
+			}
+		}
+		if (chosen == NULL) {
+			return false;
+		}
+		element = chosen->mItems.front().mItem;
+		chosen->mItems.pop_front();
+		--mNumQueued;
+	}
+	chosen->mBacklog.add(-1);
+	chosen->mWait.recordDuration(waited);
+	noteDequeued(1);
+	return true;
+}
 
+bool PriorityWorkQueue::dequeueBlocking() {
+	WorkItem *element;
+	while (!tryDequeue(element)) {
+		boost::unique_lock<boost::mutex> lock(mState->mMutex);
+		while (mNumQueued.read() <= 0) {
+			mState->mCondition.wait(lock);
+		}
+	}
+	if (element) {
+		(*element)();
+		return true;
+	} else {
+		return false;
+	}
+}
+
+bool PriorityWorkQueue::dequeuePoll() {
+	WorkItem *element;
+	if (tryDequeue(element)) {
+		if (element) {
+			(*element)();
+		}
+		return true;
+	}
+	return false;
+}
+
+unsigned int PriorityWorkQueue::dequeueAll() {
+	// Only run what was there at the time of the call, anything enqueued by those items waits for the next call.
+	int numToProcess = mNumQueued.read();
+	unsigned int numProcessed = 0;
+	WorkItem *element;
+	while (numToProcess-- > 0 && tryDequeue(element)) {
+		if (element) {
+			(*element)();
+		}
+		++numProcessed;
+	}
+	return numProcessed;
+}
+
+bool PriorityWorkQueue::probablyEmpty() {
+	return mNumQueued.read() <= 0;
+}
+
+unsigned int PriorityWorkQueue::probableSize() {
+	int numQueued = mNumQueued.read();
+	return numQueued > 0 ? (unsigned int)numQueued : 0;
+}
+
+unsigned int PriorityWorkQueue::probableSize(WorkPriority priority) {
+	boost::lock_guard<boost::mutex> lock(mState->mMutex);
+	return (unsigned int)mState->mLevels[priority]->mItems.size();
+}
+
+
+class WorkLane::Mailbox {
+public:
+	WorkQueue *mTarget;
+	ThreadSafeQueue<WorkItem*> mItems;
+	/// Items enqueued but not yet run. Whoever raises it from 0 schedules a Runner.
+	AtomicValue<int> mPending;
+	Mailbox(WorkQueue *target) : mTarget(target), mPending(0) {
+	}
+};
+
+namespace {
+boost::thread_specific_ptr<bool> sThreadInLane;
+}
+
+/// Runs one item of the lane each time the target queue dequeues it, and re-enqueues itself while items remain.
+class WorkLane::Runner : public WorkItem {
+	std::tr1::shared_ptr<Mailbox> mMailbox;
+public:
+	Runner(const std::tr1::shared_ptr<Mailbox> &mailbox) : mMailbox(mailbox) {
+	}
+	void operator() () {
+		WorkItem *element = NULL;
+		// mPending was raised only after the push, so the item is there.
+		mMailbox->mItems.pop(element);
+		if (sThreadInLane.get() == NULL) {
+			sThreadInLane.reset(new bool(false));
+		}
+		bool *inLane = sThreadInLane.get();
+		bool wasInLane = *inLane;
+		*inLane = true;
+		(*element)();
+		*inLane = wasInLane;
+		if (--mMailbox->mPending > 0) {
+			mMailbox->mTarget->enqueue(this);
+		} else {
+			delete this;
+		}
+	}
+};
+
+WorkLane::WorkLane(WorkQueue *target) : mMailbox(new Mailbox(target)) {
+}
+
+WorkLane::~WorkLane() {
+	// Runners still queued hold their own reference to the mailbox.
+}
+
+void WorkLane::enqueue(WorkItem *element) {
+	element->enqueued();
+	mMailbox->mItems.push(element);
+	if (++mMailbox->mPending == 1) {
+		mMailbox->mTarget->enqueue(new Runner(mMailbox));
+	}
+}
+
+bool WorkLane::inLane() {
+	bool *inLane = sThreadInLane.get();
+	return inLane && *inLane;
+}
 
 // Explicit instantiations.
 template class SIRIKATA_EXPORT WorkQueueImpl<ThreadSafeQueue<WorkItem*> >;
@@ -244,6 +761,8 @@ template class SIRIKATA_EXPORT WorkQueueImpl<ThreadSafeQueue<WorkItem*> >;
 // See sem_init (POSIX/Linux), sem_open (OS X), CreateSemaphore (WIN32)
 template class SIRIKATA_EXPORT WorkQueueImpl<LockFreeQueue<WorkItem*> >;
 
+template class SIRIKATA_EXPORT WorkQueueImpl<SPSCRingBuffer<WorkItem*> >;
+
 template class SIRIKATA_EXPORT UnsafeWorkQueueImpl<std::queue<WorkItem*> >;
 
 
@@ -42,6 +42,7 @@ namespace Sirikata {
 
 template <class T> class LockFreeQueue;
 template <class T> class ThreadSafeQueue;
+template <class T> class SPSCRingBuffer;
 template <class T> class AtomicValue;
 
 namespace Task {
@@ -103,6 +104,14 @@ public:
 
 class WorkQueueThread;
 
+/// Levels for WorkQueue::enqueuePriority, most urgent first.
+enum WorkPriority {
+	PRIORITY_HIGH,
+	PRIORITY_NORMAL,
+	PRIORITY_LOW,
+	NUM_WORK_PRIORITIES
+};
+
 class SIRIKATA_EXPORT WorkQueue {
 public:
 	/**
@@ -115,6 +124,25 @@ public:
 	 */
 	virtual void enqueue(WorkItem *element)=0;
 
+	/**
+	 * Enqueues element at the given priority. Queues without priority
+	 * levels run it in enqueue() order, which is what this does by default.
+	 */
+	virtual void enqueuePriority(WorkItem *element, WorkPriority priority) {
+		enqueue(element);
+	}
+
+	/**
+	 * Enqueues count WorkItems at once, in order. Implementations
+	 * may hand the whole batch to the underlying queue in one operation.
+	 * NULL entries are allowed and behave as in enqueue().
+	 */
+	virtual void enqueueBatch(WorkItem **elements, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			enqueue(elements[i]);
+		}
+	}
+
 	/**
 	 * Sleeps on a condition variable or semaphore until a job is added.
 	 *
@@ -149,6 +177,19 @@ public:
 	 */
 	virtual unsigned int dequeueAll()=0;
 
+	/**
+	 * Runs up to maxCount queued WorkItems without blocking.
+	 * Implementations may pull several items off the queue in one operation.
+	 * \returns the number of items dequeued.
+	 */
+	virtual unsigned int dequeueUpTo(unsigned int maxCount) {
+		unsigned int count = 0;
+		while (count < maxCount && dequeuePoll()) {
+			count += 1;
+		}
+		return count;
+	}
+
 	/** Calls dequeuePoll in a loop until either the time runs out, or no more
 	 * jobs are left. Calling this with AbsTime::null() executes dequeueAll(). */
 	virtual unsigned int dequeueUntil(AbsTime deadline) {
@@ -165,6 +206,15 @@ public:
 
 	virtual bool probablyEmpty() = 0;
 
+	/**
+	 * An estimate of how many WorkItems are waiting, for callers that
+	 * want to pace themselves on the backlog. Items may be added or run
+	 * by other threads while this is being read.
+	 */
+	virtual unsigned int probableSize() {
+		return probablyEmpty()?0:1;
+	}
+
 	/// Virtual destructor.
 	virtual ~WorkQueue() {}
 
@@ -176,14 +226,20 @@ template <class QueueType>
 class SIRIKATA_EXPORT WorkQueueImpl : public WorkQueue {
 	typedef QueueType Queue;
 	Queue mQueue;
+	/// Items pushed but not yet popped, maintained alongside mQueue for probableSize().
+	AtomicValue<int> mNumQueued;
 public:
+	WorkQueueImpl();
 	virtual void enqueue(WorkItem *element);
+	virtual void enqueueBatch(WorkItem **elements, size_t count);
 	virtual bool dequeueBlocking();
 	virtual bool dequeuePoll();
+	virtual unsigned int dequeueUpTo(unsigned int maxCount);
 	virtual unsigned int dequeueAll();
 	virtual ~WorkQueueImpl();
 
 	virtual bool probablyEmpty();
+	virtual unsigned int probableSize();
 };
 
 ///// blockingPop not implemented yet in LockFreeQueue.
@@ -192,6 +248,8 @@ public:
 typedef WorkQueueImpl<LockFreeQueue<WorkItem*> > RealLockFreeWorkQueue;
 typedef WorkQueueImpl<ThreadSafeQueue<WorkItem*> > LockFreeWorkQueue;
 typedef WorkQueueImpl<ThreadSafeQueue<WorkItem*> > ThreadSafeWorkQueue;
+/// Only for one enqueueing thread and one dequeueing thread: enqueue() waits while the 4096 item ring is full.
+typedef WorkQueueImpl<SPSCRingBuffer<WorkItem*> > SingleProducerWorkQueue;
 
 template <class QueueType>
 class SIRIKATA_EXPORT UnsafeWorkQueueImpl : public WorkQueue {
@@ -207,10 +265,99 @@ public:
 	virtual ~UnsafeWorkQueueImpl();
 
 	virtual bool probablyEmpty();
+	virtual unsigned int probableSize();
 };
 
 typedef UnsafeWorkQueueImpl<std::queue<WorkItem*> > ListWorkQueue;
 
+/**
+ * A WorkQueue meant to be drained by several worker threads at once.
+ * Rather than one shared queue every thread contends on, each worker owns a deque:
+ * items get spread across the deques as they are enqueued, a worker runs items from
+ * its own deque first and only steals the oldest item from another worker's deque once its own runs dry.
+ * Items enqueued from within a worker go on that worker's own deque, so related work stays on one core.
+ * Order of execution is only first-in first-out per deque.
+ */
+class SIRIKATA_EXPORT WorkStealingWorkQueue : public WorkQueue {
+	class WorkerDeque;
+	class SleepState;
+	std::vector<WorkerDeque*> mDeques;
+	SleepState *mSleep;
+	/// Total number of items in all deques, including NULL wakeups.
+	AtomicValue<int> mNumQueued;
+	/// Used to spread items enqueued from threads that do not own a deque.
+	AtomicValue<uint32> mNextEnqueue;
+	/// Hands out deques to worker threads as they first ask for work.
+	AtomicValue<uint32> mNextWorker;
+
+	/// \returns the deque owned by the calling thread, or NULL if it is not a worker of this queue.
+	WorkerDeque *ownDeque(bool claimIfUnowned);
+	/// Pops from the thread's own deque (newest first), then steals the oldest item from the others.
+	bool tryDequeue(WorkItem *&element, WorkerDeque *own);
+public:
+	/// \param numDeques is the number of per-worker deques. It should match the number of worker threads, and 0 picks the hardware concurrency.
+	WorkStealingWorkQueue(unsigned int numDeques=0);
+	virtual void enqueue(WorkItem *element);
+	virtual void enqueueBatch(WorkItem **elements, size_t count);
+	virtual bool dequeueBlocking();
+	virtual bool dequeuePoll();
+	virtual unsigned int dequeueAll();
+	virtual ~WorkStealingWorkQueue();
+
+	virtual bool probablyEmpty();
+	virtual unsigned int probableSize();
+};
+
+/**
+ * A WorkQueue for latency-critical work that shares its threads with bulk work.
+ * Each WorkPriority has a FIFO of its own and the most urgent waiting item runs
+ * first, but every agingStep an item waits counts as one level more urgent, so a
+ * steady stream of urgent items delays low priority ones without starving them.
+ * enqueue() and enqueueBatch() use PRIORITY_NORMAL. Every level reports its own
+ * backlog and wait metrics, workqueue.priority.<level>.backlog and .wait.
+ */
+class SIRIKATA_EXPORT PriorityWorkQueue : public WorkQueue {
+	class State;
+	State *mState;
+	/// Items in every level, including NULL wakeups.
+	AtomicValue<int> mNumQueued;
+	DeltaTime mAgingStep;
+
+	bool tryDequeue(WorkItem *&element);
+public:
+	PriorityWorkQueue(const DeltaTime &agingStep=DeltaTime::milliseconds((int64)50));
+	virtual void enqueue(WorkItem *element);
+	virtual void enqueuePriority(WorkItem *element, WorkPriority priority);
+	virtual void enqueueBatch(WorkItem **elements, size_t count);
+	virtual bool dequeueBlocking();
+	virtual bool dequeuePoll();
+	virtual unsigned int dequeueAll();
+	virtual ~PriorityWorkQueue();
+
+	virtual bool probablyEmpty();
+	virtual unsigned int probableSize();
+	/// How many items wait at one priority.
+	unsigned int probableSize(WorkPriority priority);
+};
+
+/**
+ * A mailbox that runs its WorkItems one at a time and in the order they were enqueued,
+ * on whichever threads drain the target WorkQueue. Many lanes may share one multi-threaded
+ * target: items of different lanes run in parallel, while the items of one lane never overlap.
+ * Items still waiting when the lane is destroyed are run anyway.
+ */
+class SIRIKATA_EXPORT WorkLane {
+	class Mailbox;
+	class Runner;
+	std::tr1::shared_ptr<Mailbox> mMailbox;
+public:
+	WorkLane(WorkQueue *target);
+	~WorkLane();
+	void enqueue(WorkItem *element);
+	/// \returns true if the calling thread is running an item of any WorkLane.
+	static bool inLane();
+};
+
 }
 }
 
@@ -69,7 +69,8 @@ protected:
 	 * Note that you must *NOT* call the callback until you have
 	 * populated the cache.
 	 *
-	 * @TODO: Handle two requests for the same chunk at the same time.
+	 * Two requests for the same chunk at the same time are merged by
+	 * NetworkCacheLayer, so this runs once per download.
 	 * */
 	inline void populateParentCaches(const Fingerprint &fileId, const DenseDataPtr &data) {
 		if (mRespondTo) {
@@ -174,18 +175,29 @@ public:
 	 * @param uri         A unique identifier corresponding to the file (contains a hash).
 	 * @param requestedRange A Range object specifying a single range that you need.
 	 * @param callback       To be called with the data if successful, or NULL if failed.
+	 * @param priority       How soon the data is needed, if it has to be downloaded.
 	 * @return          false, if the callback happened synchronously (i.e. in memory cache)
 	 */
 	virtual void getData(const RemoteFileId &fid, const Range &requestedRange,
-			const TransferCallback&callback) {
+			const TransferCallback&callback, TransferPriority priority=FOREGROUND_PRIORITY) {
 		if (mNext) {
-			mNext->getData(fid, requestedRange, callback);
+			mNext->getData(fid, requestedRange, callback, priority);
 		} else {
 			// need some way to signal error
 			callback(NULL);
 		}
 	}
 
+	/**
+	 * Raises the priority of an earlier getData for fid that is still in progress
+	 * and covers requestedRange, e.g. when a prefetched file turns out to be needed now.
+	 */
+	virtual void raisePriority(const RemoteFileId &fid, const Range &requestedRange, TransferPriority priority) {
+		if (mNext) {
+			mNext->raisePriority(fid, requestedRange, priority);
+		}
+	}
+
 };
 
 }
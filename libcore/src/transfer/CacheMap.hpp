@@ -36,6 +36,7 @@
 
 #include "CachePolicy.hpp"
 #include "CacheLayer.hpp"
+#include "util/ProfiledMutex.hpp"
 #include <boost/thread.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
@@ -45,6 +46,13 @@ namespace Transfer {
 /**
  * Handles locking, and also stores a map that can be used
  * both by the CachePolicy, and by the CacheLayer.
+ *
+ * The map is split into NUM_SHARDS stripes by Fingerprint hash, each
+ * with its own shared_mutex, so readers and writers of different files
+ * do not wait on each other.  An iterator holds the lock of at most one
+ * stripe at a time, and moves it when find() or insert() goes to a
+ * different one.  The CachePolicy is shared by every stripe and has its
+ * own mutex, which is only ever taken after a stripe lock.
  */
 class CacheMap : Noncopyable {
 public:
@@ -53,16 +61,32 @@ public:
 	class read_iterator;
 	class write_iterator;
 
+	enum {NUM_SHARDS=16};
+
 private:
 	typedef CachePolicy::Data *PolicyData;
 	typedef std::pair<CacheData, std::pair<PolicyData, cache_usize_type> > MapEntry;
 	typedef std::map<Fingerprint, MapEntry> MapClass;
 
-	MapClass mMap;
-	boost::shared_mutex mMapLock;
+	typedef Metrics::ProfiledMutex<boost::shared_mutex> ShardMutex;
+	typedef Metrics::ProfiledMutex<> PolicyMutex;
+
+	struct Shard {
+		MapClass mMap;
+		ShardMutex mLock;
+		Shard() : mLock("cachemap.shard") {
+		}
+	};
+
+	Shard mShards[NUM_SHARDS];
 
 	CacheLayer *mOwner;
 	CachePolicy *mPolicy;
+	PolicyMutex mPolicyLock;
+
+	inline Shard *shardFor(const Fingerprint &id) {
+		return &mShards[Fingerprint::Hasher()(id) % NUM_SHARDS];
+	}
 
 	inline void destroyCacheLayerEntry(const Fingerprint &id, const CacheData &data, cache_usize_type size) {
 		mOwner->destroyCacheEntry(id, data, size);
@@ -71,7 +95,7 @@ private:
 public:
 
 	CacheMap(CacheLayer *owner, CachePolicy *policy) :
-		mOwner(owner), mPolicy(policy) {
+		mOwner(owner), mPolicy(policy), mPolicyLock("cachemap.policy") {
 	}
 
 	~CacheMap() {
@@ -82,19 +106,32 @@ public:
 	/**
 	 * Allocates the requested number of bytes, and erases the
 	 * appropriate set of entries using CachePolicy::allocateSpace().
+	 * The writer is moved around while evicting, so find() or insert()
+	 * again afterwards.
 	 *
 	 * @param required  The space required for the new entry.
 	 * @returns         if the allocation was successful,
 	 *                  or false if the entry is not to be cached.
 	 */
 	inline bool alloc(cache_usize_type required, write_iterator &writer) {
-		bool cachable = mPolicy->cachable(required);
-		if (!cachable) {
-			return false;
+		{
+			boost::lock_guard<PolicyMutex> policyLock(mPolicyLock);
+			if (!mPolicy->cachable(required)) {
+				return false;
+			}
 		}
 		Fingerprint toDelete;
-		while (mPolicy->nextItem(required, toDelete)) {
-			writer.find(toDelete);
+		while (true) {
+			{
+				boost::lock_guard<PolicyMutex> policyLock(mPolicyLock);
+				if (!mPolicy->nextItem(required, toDelete)) {
+					break;
+				}
+			}
+			if (!writer.find(toDelete)) {
+				// Another writer evicted it first; the space is ours either way.
+				break;
+			}
 			writer.erase();
 		}
 		return true;
@@ -103,37 +140,57 @@ public:
 	/**
 	 * A read-only iterator.  Not const because the LRU use-count
 	 * is allowed to be updated, even though the CacheLayer cannot
-	 * be changed.  A read_iterator locks the map using a
+	 * be changed.  A read_iterator locks one stripe of the map using a
 	 * boost::shared_lock.  This means that any number of read_iterator
 	 * objects are allowed access at the same time, except when
-	 * a write_iterator is in use.
+	 * a write_iterator is in use on the same stripe.
 	 */
 	class read_iterator {
 		CacheMap *mCachemap;
-		boost::shared_lock<boost::shared_mutex> mLock;
+		boost::shared_lock<ShardMutex> mLock;
 
-		MapClass *mMap;
+		Shard *mShard;
 		MapClass::iterator mIter;
 
+		void lockShard(Shard *shard) {
+			if (shard != mShard) {
+				if (mLock.owns_lock()) {
+					mLock.unlock(); // never hold two stripes at once.
+				}
+				boost::shared_lock<ShardMutex> shardLock(shard->mLock);
+				mLock.swap(shardLock);
+				mShard = shard;
+			}
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped read lock)
+		/// Construct from a CacheMap (locks nothing until find() or iterate())
 		read_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShard(NULL) {
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return mShard && (mIter != mShard->mMap.end());
 		}
 
+		/**
+		 * Steps through every entry, one stripe at a time.  Entries in
+		 * stripes already visited may change before iterate() returns false.
+		 */
 		inline bool iterate () {
-			if (mIter == mMap->end()) {
-				mIter = mMap->begin();
-			} else {
+			Shard *end = mCachemap->mShards + NUM_SHARDS;
+			if (!mShard) {
+				lockShard(mCachemap->mShards);
+				mIter = mShard->mMap.begin();
+			} else if (mIter != mShard->mMap.end()) {
 				++mIter;
 			}
-			return (mIter != mMap->end());
+			while (mIter == mShard->mMap.end() && mShard + 1 != end) {
+				lockShard(mShard + 1);
+				mIter = mShard->mMap.begin();
+			}
+			return (mIter != mShard->mMap.end());
 		}
 
 		/** Moves this iterator to id.
@@ -141,7 +198,8 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		inline bool find(const Fingerprint &id) {
-			mIter = mMap->find(id);
+			lockShard(mCachemap->shardFor(id));
+			mIter = mShard->mMap.find(id);
 			return (bool)*this;
 		}
 
@@ -167,6 +225,7 @@ public:
 
 		/// Sets the use bit in the corresponding cache policy.
 		inline void use() {
+			boost::lock_guard<PolicyMutex> policyLock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
 		}
 	};
@@ -174,28 +233,38 @@ public:
 	/**
 	 * A read-write iterator.  Also contains insert() and erase()
 	 * functions which also interact with the appropriate CachePolicy.
-	 * The write_iterator aassumes exclusive ownership of the map.
-	 * Since creating two write_iterators at once causes deadlock,
-	 * make sure to call the alloc() function that takes a write_iterator
-	 * argument if you already own one.
+	 * The write_iterator assumes exclusive ownership of the stripe it
+	 * is positioned in.  Since creating two iterators at once can cause
+	 * deadlock, make sure to call the alloc() function that takes a
+	 * write_iterator argument if you already own one.
 	 */
 	class write_iterator : Noncopyable {
 		CacheMap *mCachemap;
-		boost::unique_lock<boost::shared_mutex> mLock;
+		boost::unique_lock<ShardMutex> mLock;
 
-		MapClass *mMap;
+		Shard *mShard;
 		MapClass::iterator mIter;
 
+		void lockShard(Shard *shard) {
+			if (shard != mShard) {
+				if (mLock.owns_lock()) {
+					mLock.unlock(); // never hold two stripes at once.
+				}
+				boost::unique_lock<ShardMutex> shardLock(shard->mLock);
+				mLock.swap(shardLock);
+				mShard = shard;
+			}
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped write lock)
+		/// Construct from a CacheMap (locks nothing until find() or insert())
 		write_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShard(NULL) {
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return mShard && (mIter != mShard->mMap.end());
 		}
 
 		/** Moves this iterator to id.
@@ -203,7 +272,8 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		bool find(const Fingerprint &id) {
-			mIter = mMap->find(id);
+			lockShard(mCachemap->shardFor(id));
+			mIter = mShard->mMap.find(id);
 			return (bool)*this;
 		}
 
@@ -229,6 +299,7 @@ public:
 
 		/// Sets the use bit in the corresponding cache policy.
 		inline void use() {
+			boost::lock_guard<PolicyMutex> policyLock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
 		}
 
@@ -241,6 +312,7 @@ public:
 		inline void update(cache_usize_type newSize) {
 			cache_usize_type oldSize = getSize();
 			(*mIter).second.second.second = newSize;
+			boost::lock_guard<PolicyMutex> policyLock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->useAndUpdate(getId(),
 					getPolicyInfo(), oldSize, newSize);
 		}
@@ -249,25 +321,35 @@ public:
 		 * Erases the current iterator.  Note that this iterator is
 		 * invalidated at the point you erase it.
 		 *
-s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
+		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 */
 		void erase() {
-			mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+			{
+				boost::lock_guard<PolicyMutex> policyLock(mCachemap->mPolicyLock);
+				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+			}
 			mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
-			mMap->erase(mIter);
-			mIter = mMap->end();
+			mShard->mMap.erase(mIter);
+			mIter = mShard->mMap.end();
 		}
 
 		/** Iterates through the whole map, destroy()ing everything.  Note that the
 		 * write_iterator contains no iterate() method because it is generally not safe.
 		 */
 		void eraseAll() {
-			for (mIter = mMap->begin(); mIter != mMap->end(); ++mIter) {
-				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
-				mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+			for (int i = 0; i < NUM_SHARDS; ++i) {
+				lockShard(&mCachemap->mShards[i]);
+				MapClass &map = mShard->mMap;
+				for (mIter = map.begin(); mIter != map.end(); ++mIter) {
+					{
+						boost::lock_guard<PolicyMutex> policyLock(mCachemap->mPolicyLock);
+						mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+					}
+					mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+				}
+				map.clear();
+				mIter = map.end();
 			}
-			mMap->clear();
-			mIter = mMap->end();
 		}
 
 		/**
@@ -284,12 +366,14 @@ s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 * @returns       If this element was actually inserted.
 		 */
 		bool insert(const Fingerprint &id, cache_usize_type size) {
+			lockShard(mCachemap->shardFor(id));
 			std::pair<MapClass::iterator, bool> ins=
-				mMap->insert(MapClass::value_type(id,
+				mShard->mMap.insert(MapClass::value_type(id,
 						MapEntry(CacheData(), std::pair<PolicyData, cache_usize_type>(PolicyData(), size))));
 			mIter = ins.first;
 
 			if (ins.second) {
+				boost::lock_guard<PolicyMutex> policyLock(mCachemap->mPolicyLock);
 				(*mIter).second.second.first = mCachemap->mPolicy->create(id, size);
 			}
 			return ins.second;
@@ -39,32 +39,172 @@
 #include <boost/thread/mutex.hpp>
 
 #include "NameLookupManager.hpp"
+#include "task/Time.hpp"
+
+#include <fstream>
 
 namespace Sirikata {
 namespace Transfer {
 
 /** A subclass of NameLookupManager to handle caching of name lookup requests.
- * Note that this also intends to handle serializing to disk for offline access
- * to a space, However this part is not written yet. Perhaps it is more
- * appropriately handled by a subclass. */
+ *
+ * Entries live for a TTL. Once that runs out they are still answered for a
+ * while longer (stale-while-revalidate) while a fresh lookup runs in the
+ * background. Names the services failed to resolve are remembered for a
+ * shorter time, so a missing asset does not cost a round trip on every
+ * reference. If given a cache file, entries survive restarts. */
 class CachedNameLookupManager : public NameLookupManager {
-	typedef std::map<URI, RemoteFileId > NameMap;
+	struct CacheEntry {
+		RemoteFileId fileId;
+		/// False for a name that could not be resolved.
+		bool found;
+		Time expires;
+
+		CacheEntry() : found(false), expires(Time::null()) {
+		}
+	};
+	typedef std::map<URI, CacheEntry> NameMap;
 	NameMap mLookupCache;
+	/// Stale names with a refresh lookup in flight.
+	std::set<URI> mRefreshing;
 	boost::shared_mutex mMut;
 
+	std::string mCacheFile;
+	Duration mTTL;
+	Duration mStaleFor;
+	Duration mNegativeTTL;
+	/// Changes since mCacheFile was last written.
+	unsigned int mUnsaved;
+	enum {SAVE_EVERY=64};
+
+	/// Needs a unique lock on mMut.
+	void noteChange() {
+		if (!mCacheFile.empty() && ++mUnsaved >= SAVE_EVERY) {
+			writeCacheFile();
+		}
+	}
+
+	/// One "expires name hash uri" line per entry, or "expires name -" for a name that was not found; needs mMut.
+	void writeCacheFile() {
+		mUnsaved = 0;
+		std::string tempFile = mCacheFile + ".tmp";
+		{
+			std::ofstream out(tempFile.c_str());
+			if (!out) {
+				SILOG(transfer,warn,"Unable to write name cache " << tempFile);
+				return;
+			}
+			for (NameMap::const_iterator iter = mLookupCache.begin(); iter != mLookupCache.end(); ++iter) {
+				const CacheEntry &entry = (*iter).second;
+				out << entry.expires.raw() << ' ' << (*iter).first.toString() << ' ';
+				if (entry.found) {
+					out << entry.fileId.fingerprint().convertToHexString() << ' ' << entry.fileId.uri().toString() << '\n';
+				} else {
+					out << "-\n";
+				}
+			}
+		}
+#ifdef _WIN32
+		std::remove(mCacheFile.c_str());
+#endif
+		if (std::rename(tempFile.c_str(), mCacheFile.c_str()) != 0) {
+			SILOG(transfer,warn,"Unable to replace name cache " << mCacheFile);
+		}
+	}
+
+	void gotLookup(const Callback &cb, const URI &namedUri, const RemoteFileId *fileId) {
+		if (!fileId) {
+			// Successful lookups were already added by NameLookupManager.
+			boost::unique_lock<boost::shared_mutex> updatecache(mMut);
+			CacheEntry &entry = mLookupCache[namedUri];
+			entry.fileId = RemoteFileId();
+			entry.found = false;
+			entry.expires = Time::now() + mNegativeTTL;
+			noteChange();
+		}
+		cb(namedUri, fileId);
+	}
+
+	void refreshed(const URI &namedUri, const RemoteFileId *fileId) {
+		// On failure the stale entry keeps being served until its window closes.
+		boost::unique_lock<boost::shared_mutex> updatecache(mMut);
+		mRefreshing.erase(namedUri);
+	}
+
+	void refresh(const URI &namedUri) {
+		{
+			boost::unique_lock<boost::shared_mutex> updatecache(mMut);
+			if (!mRefreshing.insert(namedUri).second) {
+				return;
+			}
+		}
+		NameLookupManager::lookupHash(namedUri,
+			std::tr1::bind(&CachedNameLookupManager::refreshed, this, _1, _2));
+	}
+
 protected:
-	/// Unimplemented.
+	/// Loads mCacheFile, dropping entries too old to be served.
 	virtual void unserialize() {
-		// ...
+		if (mCacheFile.empty()) {
+			return;
+		}
+		std::ifstream in(mCacheFile.c_str());
+		Time now = Time::now();
+		std::string line;
+		boost::unique_lock<boost::shared_mutex> updatecache(mMut);
+		while (std::getline(in, line)) {
+			std::istringstream fields(line);
+			uint64 expires = 0;
+			std::string name, hash, uri;
+			if (!(fields >> expires >> name >> hash)) {
+				continue;
+			}
+			CacheEntry entry;
+			entry.expires = Time::microseconds(expires);
+			entry.found = (hash != "-");
+			if (entry.found) {
+				if (!(fields >> uri) || !(now < entry.expires + mStaleFor)) {
+					continue;
+				}
+				try {
+					entry.fileId = RemoteFileId(Fingerprint::convertFromHex(hash), URI(uri));
+				} catch (std::invalid_argument &e) {
+					continue;
+				}
+			} else if (!(now < entry.expires)) {
+				continue;
+			}
+			mLookupCache[URI(name)] = entry;
+		}
+		mUnsaved = 0;
 	}
-	/// Unimplemented.
 	virtual void serialize() {
-		// ...
+		if (mCacheFile.empty()) {
+			return;
+		}
+		boost::unique_lock<boost::shared_mutex> updatecache(mMut);
+		writeCacheFile();
 	}
 
 public:
-	CachedNameLookupManager(ServiceManager<NameLookupHandler> *nameProtocols, ServiceManager<DownloadHandler> *downloadServ=NULL)
-		: NameLookupManager(nameProtocols, downloadServ) {
+	/**
+	 * @param cacheFile    Where to keep entries between runs; empty to keep them in memory only.
+	 * @param ttl          How long a resolved name is answered without asking the services again.
+	 * @param staleFor     How long after that it is still answered while a refresh runs.
+	 * @param negativeTTL  How long a name that could not be resolved is reported missing.
+	 */
+	CachedNameLookupManager(ServiceManager<NameLookupHandler> *nameProtocols, ServiceManager<DownloadHandler> *downloadServ=NULL,
+			const std::string &cacheFile=std::string(),
+			const Duration &ttl=Duration::seconds(3600.),
+			const Duration &staleFor=Duration::seconds(86400.),
+			const Duration &negativeTTL=Duration::seconds(30.))
+		: NameLookupManager(nameProtocols, downloadServ),
+		  mCacheFile(cacheFile), mTTL(ttl), mStaleFor(staleFor), mNegativeTTL(negativeTTL), mUnsaved(0) {
+		unserialize();
+	}
+
+	virtual ~CachedNameLookupManager() {
+		serialize();
 	}
 
 	virtual void removeFromCache(const URI &origNamedUri) {
@@ -72,12 +212,17 @@ public:
         NameMap::iterator iter = mLookupCache.find(origNamedUri);
         if (iter != mLookupCache.end()) {
             mLookupCache.erase(iter);
+            noteChange();
         }
 	}
 
 	virtual void addToCache(const URI &origNamedUri, const RemoteFileId &toFetch) {
 		boost::unique_lock<boost::shared_mutex> updatecache(mMut);
-		mLookupCache.insert(NameMap::value_type(origNamedUri, toFetch));
+		CacheEntry &entry = mLookupCache[origNamedUri];
+		entry.fileId = toFetch;
+		entry.found = true;
+		entry.expires = Time::now() + mTTL;
+		noteChange();
 	}
 
 	virtual void lookupHash(const URI &namedUri, const Callback &cb) {
@@ -85,14 +230,23 @@ public:
 			boost::shared_lock<boost::shared_mutex> lookuplock(mMut);
 			NameMap::const_iterator iter = mLookupCache.find(namedUri);
 			if (iter != mLookupCache.end()) {
-				RemoteFileId rfid ((*iter).second); // copy, because the map could change.
+				CacheEntry entry ((*iter).second); // copy, because the map could change.
 				lookuplock.unlock();
 
-				cb(namedUri, &rfid);
-				return;
+				Time now = Time::now();
+				if (now < entry.expires) {
+					cb(namedUri, entry.found ? &entry.fileId : NULL);
+					return;
+				}
+				if (entry.found && now < entry.expires + mStaleFor) {
+					cb(namedUri, &entry.fileId);
+					refresh(namedUri);
+					return;
+				}
 			}
 		}
-		NameLookupManager::lookupHash(namedUri, cb);
+		NameLookupManager::lookupHash(namedUri,
+			std::tr1::bind(&CachedNameLookupManager::gotLookup, this, cb, _1, _2));
 	}
 };
 
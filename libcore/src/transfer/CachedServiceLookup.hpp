@@ -38,6 +38,7 @@
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/mutex.hpp>
 #include "ServiceLookup.hpp"
+#include "task/Time.hpp"
 
 namespace Sirikata {
 namespace Transfer {
@@ -46,37 +47,129 @@ namespace Transfer {
  * written to disk--it makes more sense to be in the options system.
  *
  * Currently, you can use addToCache to fill the cache.
+ *
+ * Each lookup hands out the cached services best first: every download
+ * reports how long it took, how many bytes it moved and whether it failed,
+ * and services are ranked by the expected time of a typical download, kept
+ * as moving averages.  A service that fails several times in a row is
+ * skipped (tried only after all others) for a backoff period that doubles
+ * with each further failure.
  */
 class CachedServiceLookup : public ServiceLookup {
-	typedef std::map<URIContext, std::pair<int, ListOfServicesPtr> > ServiceMap;
+	typedef std::map<URIContext, ListOfServicesPtr> ServiceMap;
 	ServiceMap mLookupCache;
 	boost::shared_mutex mMut;
 
+	/// Weight of the newest sample in the moving averages.
+	static double smoothing() { return 0.3; }
+	/// The download size services are compared at.
+	static double typicalBytes() { return 256.*1024.; }
+	/// Downloads at least this big measure throughput; smaller ones measure latency.
+	static uint64 throughputBytes() { return 64*1024; }
+	/// Consecutive failures before a service is skipped.
+	static unsigned int failureThreshold() { return 3; }
+	/// A service not measured for this long is tried again as if it were new.
+	static Task::DeltaTime staleAfter() { return Task::DeltaTime::seconds(60.); }
+
+	struct EndpointStats {
+		double mLatency; ///< Seconds for a download too small to measure throughput.
+		double mBytesPerSecond; ///< 0 until a large download finishes.
+		double mErrorRate;
+		unsigned int mSamples;
+		unsigned int mConsecutiveFailures;
+		Task::AbsTime mLastSample;
+		Task::AbsTime mRetryAfter; ///< Skipped until then once failures pass the threshold.
+		EndpointStats()
+			: mLatency(0), mBytesPerSecond(0), mErrorRate(0), mSamples(0), mConsecutiveFailures(0),
+			mLastSample(Task::AbsTime::null()), mRetryAfter(Task::AbsTime::null()) {
+		}
+		/// Expected seconds for a typical download, counting the retry a failure costs; 0 if unknown.
+		double score(const Task::AbsTime &now) const {
+			if (!mSamples || now - mLastSample > staleAfter()) {
+				return 0;
+			}
+			double expected = mLatency;
+			if (mBytesPerSecond > 0) {
+				expected += typicalBytes() / mBytesPerSecond;
+			}
+			return expected / std::max(0.05, 1. - mErrorRate);
+		}
+	};
+	typedef std::map<URIContext, EndpointStats> StatsMap;
+	StatsMap mStats;
+	boost::mutex mStatsMut;
+
+	struct RankedService {
+		bool skipped;
+		double score;
+		unsigned int index;
+		bool operator< (const RankedService &other) const {
+			if (skipped != other.skipped) {
+				return other.skipped;
+			}
+			return score < other.score;
+		}
+	};
+
+	/// The order to try services in, best first; services measured never or long ago come first to be measured.
+	std::vector<unsigned int> rank(const ListOfServices &services) {
+		Task::AbsTime now = Task::AbsTime::now();
+		std::vector<RankedService> ranked(services.size());
+		{
+			boost::unique_lock<boost::mutex> statslock(mStatsMut);
+			for (unsigned int i = 0; i < services.size(); ++i) {
+				ranked[i].index = i;
+				ranked[i].skipped = false;
+				ranked[i].score = 0;
+				StatsMap::const_iterator iter = mStats.find(services[i].first);
+				if (iter != mStats.end()) {
+					ranked[i].skipped = now < (*iter).second.mRetryAfter;
+					ranked[i].score = (*iter).second.score(now);
+				}
+			}
+		}
+		std::stable_sort(ranked.begin(), ranked.end());
+		std::vector<unsigned int> order(ranked.size());
+		for (size_t i = 0; i < ranked.size(); ++i) {
+			order[i] = ranked[i].index;
+		}
+		return order;
+	}
+
 	class CachedServiceIterator : public ServiceIterator {
-		unsigned int mCurrentService;
+		std::vector<unsigned int> mOrder;
 		unsigned int mIteration;
 		ListOfServicesPtr mServicesList;
 		CachedServiceLookup *mCache;
-		URIContext origContext;
+		/// The service handed out by the last tryNext, if it has not reported back yet.
+		bool mAttempting;
+		Task::AbsTime mAttemptStart;
+
+		const URIContext &current() const {
+			return (*mServicesList)[mOrder[mIteration-1]].first;
+		}
 	public:
 		virtual bool tryNext(ErrorType reason, URI &uri, ServiceParams &outParams) {
-			unsigned int length = mServicesList->size();
-			if (++mIteration > length) {
+			if (mAttempting && (reason == GENERAL_ERROR || reason == NETWORK_ERROR)) {
+				mCache->recordResult(current(), false, (Task::AbsTime::now() - mAttemptStart).toSeconds(), 0);
+			}
+			mAttempting = false;
+			if (mIteration >= mOrder.size()) {
 				delete this;
 				return false;
 			}
-			mCurrentService %= length;
-			uri.getContext() = (*mServicesList)[mCurrentService].first;
-			outParams = (*mServicesList)[mCurrentService].second;
-			mCurrentService++;
+			++mIteration;
+			uri.getContext() = current();
+			outParams = (*mServicesList)[mOrder[mIteration-1]].second;
+			mAttempting = true;
+			mAttemptStart = Task::AbsTime::now();
 			return true;
 		}
 
 		CachedServiceIterator(CachedServiceLookup *parent,
-				unsigned int num,
-				const ListOfServicesPtr &services,
-				const URIContext &origService)
-			: mCurrentService(num), mIteration(0), mServicesList(services), mCache(parent), origContext(origService) {
+				const ListOfServicesPtr &services)
+			: mOrder(parent->rank(*services)), mIteration(0), mServicesList(services), mCache(parent),
+			mAttempting(false), mAttemptStart(Task::AbsTime::null()) {
 		}
 
 		virtual ~CachedServiceIterator() {
@@ -85,28 +178,60 @@ class CachedServiceLookup : public ServiceLookup {
 		/** Notification that the download was successful.
 		 * This may help ServiceLookup to pick a better service next time.
 		 */
-		virtual void finished(ErrorType reason=SUCCESS) {
-			if (reason == SUCCESS) {
-				boost::shared_lock<boost::shared_mutex> lookuplock(mCache->mMut);
-				ServiceMap::iterator iter = mCache->mLookupCache.find(origContext);
-				if (iter != mCache->mLookupCache.end()) {
-					(*iter).second.first = mCurrentService-1;
-				}
+		virtual void finished(ErrorType reason=SUCCESS, uint64 bytes=0) {
+			if (mAttempting) {
+				mCache->recordResult(current(), reason == SUCCESS,
+					(Task::AbsTime::now() - mAttemptStart).toSeconds(), bytes);
 			}
 			delete this;
 		}
 	};
 
 public:
+	/**
+	 * Folds one download from a service into its ranking; called by the
+	 * iterators this hands out.
+	 * @param seconds  How long the download took, including a failed one.
+	 * @param bytes    How much arrived; 0 if unknown.
+	 */
+	void recordResult(const URIContext &service, bool success, double seconds, uint64 bytes) {
+		Task::AbsTime now = Task::AbsTime::now();
+		boost::unique_lock<boost::mutex> statslock(mStatsMut);
+		EndpointStats &stats = mStats[service];
+		double alpha = stats.mSamples ? smoothing() : 1.;
+		stats.mErrorRate += alpha * ((success ? 0. : 1.) - stats.mErrorRate);
+		if (success) {
+			stats.mConsecutiveFailures = 0;
+			stats.mRetryAfter = Task::AbsTime::null();
+			if (bytes >= throughputBytes() && seconds > 0) {
+				double rate = bytes / seconds;
+				stats.mBytesPerSecond = stats.mBytesPerSecond > 0 ?
+					stats.mBytesPerSecond + smoothing() * (rate - stats.mBytesPerSecond) : rate;
+			} else {
+				stats.mLatency += alpha * (seconds - stats.mLatency);
+			}
+		} else {
+			// A failure takes at least as long as a success would have.
+			stats.mLatency += alpha * (std::max(seconds, stats.mLatency) - stats.mLatency);
+			if (++stats.mConsecutiveFailures >= failureThreshold()) {
+				unsigned int extra = std::min(stats.mConsecutiveFailures - failureThreshold(), 6u);
+				stats.mRetryAfter = now + Task::DeltaTime::seconds(5. * (1 << extra));
+				SILOG(transfer,warning,"Skipping " << service << " for " << 5 * (1 << extra) <<
+					" seconds after " << stats.mConsecutiveFailures << " failures");
+			}
+		}
+		++stats.mSamples;
+		stats.mLastSample = now;
+	}
+
 	virtual bool addToCache(const URIContext &origService, const ListOfServicesPtr &toCache,const Callback &cb=Callback()) {
 		{
 			boost::unique_lock<boost::shared_mutex> insertlock(mMut);
-			mLookupCache.insert(ServiceMap::value_type(origService,
-				std::pair<int, ListOfServicesPtr>(0, toCache)));
+			mLookupCache.insert(ServiceMap::value_type(origService, toCache));
 		}
 		if (!ServiceLookup::addToCache(origService, toCache, cb)) {
 			if (cb) {
-				cb(new CachedServiceIterator(this, 0, toCache, origService));
+				cb(new CachedServiceIterator(this, toCache));
 			}
 		}
 		return true;
@@ -114,18 +239,16 @@ public:
 
 	virtual void lookupService(const URIContext &context, const Callback &cb) {
 		ListOfServicesPtr found;
-		int num = 0;
 		{
 			boost::shared_lock<boost::shared_mutex> lookuplock(mMut);
 			ServiceMap::const_iterator iter = mLookupCache.find(context);
 			if (iter != mLookupCache.end()) {
-				found = (*iter).second.second;
-				num = (*iter).second.first;
+				found = (*iter).second;
 			}
 		}
 		if (found) {
 			if (!ServiceLookup::addToCache(context, found, cb)) {
-				cb(new CachedServiceIterator(this, num, found, context));
+				cb(new CachedServiceIterator(this, found));
 			}
 		} else {
 			ServiceLookup::lookupService(context, cb);
@@ -0,0 +1,110 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  ContentChunker.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "ContentChunker.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+/// Random values for each byte; fixed so every process finds the same boundaries.
+class GearTable {
+	uint64 mValues[256];
+public:
+	GearTable() {
+		uint64 state = 0x5192a7ee3c8d1f0bULL;
+		for (int i = 0; i < 256; ++i) {
+			// splitmix64
+			uint64 z = (state += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			mValues[i] = z ^ (z >> 31);
+		}
+	}
+	uint64 operator[] (unsigned char c) const {
+		return mValues[c];
+	}
+};
+const GearTable &gearTable() {
+	static GearTable table;
+	return table;
+}
+// Make sure the table is built before any threads start chunking.
+const GearTable &sInitGearTable = gearTable();
+}
+
+ContentChunker::ContentChunker(size_t minSize, size_t averageSize, size_t maxSize)
+		: mMinSize(minSize), mMaxSize(maxSize) {
+	if (mMinSize == 0) {
+		mMinSize = 1;
+	}
+	if (mMaxSize < mMinSize) {
+		mMaxSize = mMinSize;
+	}
+	int bits = 0;
+	while (((size_t)1 << (bits + 1)) <= averageSize) {
+		++bits;
+	}
+	// the gear hash shifts older bytes up, so test the high bits.
+	mMask = bits ? (~(uint64)0) << (64 - bits) : 0;
+}
+
+size_t ContentChunker::nextBoundary(const unsigned char *data, size_t length) const {
+	if (length <= mMinSize) {
+		return length;
+	}
+	const GearTable &gear = gearTable();
+	size_t end = length < mMaxSize ? length : mMaxSize;
+	uint64 hash = 0;
+	for (size_t i = mMinSize; i < end; ++i) {
+		hash = (hash << 1) + gear[data[i]];
+		if ((hash & mMask) == 0) {
+			return i + 1;
+		}
+	}
+	return end;
+}
+
+void ContentChunker::split(const unsigned char *data, size_t length, ChunkList &out,
+		cache_usize_type baseOffset) const {
+	size_t pos = 0;
+	while (pos < length) {
+		size_t chunkLength = nextBoundary(data + pos, length - pos);
+		out.push_back(Chunk(baseOffset + pos, chunkLength,
+				Fingerprint::computeDigest(data + pos, chunkLength)));
+		pos += chunkLength;
+	}
+}
+
+}
+}
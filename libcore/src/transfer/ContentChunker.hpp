@@ -0,0 +1,92 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  ContentChunker.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_ContentChunker_HPP__
+#define SIRIKATA_ContentChunker_HPP__
+
+#include "Range.hpp"
+#include "URI.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * Splits files into chunks whose boundaries depend on the bytes around them
+ * (a gear rolling hash) rather than on their offsets, so an edit to one part of
+ * a mesh or texture only changes the chunks it touches. Two versions of an
+ * asset then share the fingerprints of every chunk the edit did not reach.
+ */
+class SIRIKATA_EXPORT ContentChunker {
+public:
+	struct Chunk {
+		cache_usize_type offset;
+		cache_usize_type length;
+		Fingerprint fingerprint;
+
+		Chunk(cache_usize_type offset, cache_usize_type length, const Fingerprint &fingerprint)
+			: offset(offset), length(length), fingerprint(fingerprint) {
+		}
+		Range range() const {
+			return Range(offset, length, LENGTH);
+		}
+	};
+	typedef std::vector<Chunk> ChunkList;
+
+	enum {
+		DEFAULT_MIN_CHUNK_SIZE=2048,
+		/// Must be a power of two.
+		DEFAULT_AVERAGE_CHUNK_SIZE=8192,
+		DEFAULT_MAX_CHUNK_SIZE=65536
+	};
+
+private:
+	size_t mMinSize;
+	size_t mMaxSize;
+	uint64 mMask;
+
+public:
+	ContentChunker(size_t minSize=DEFAULT_MIN_CHUNK_SIZE,
+			size_t averageSize=DEFAULT_AVERAGE_CHUNK_SIZE,
+			size_t maxSize=DEFAULT_MAX_CHUNK_SIZE);
+
+	/// Returns the length of the chunk starting at data, never more than length.
+	size_t nextBoundary(const unsigned char *data, size_t length) const;
+
+	/// Appends the chunks covering data to out; offsets start at baseOffset.
+	void split(const unsigned char *data, size_t length, ChunkList &out,
+			cache_usize_type baseOffset=0) const;
+};
+
+}
+}
+
+#endif
@@ -36,6 +36,9 @@
 #include "options/Options.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #ifndef _WIN32
 #ifdef __APPLE__
@@ -49,6 +52,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #endif
+#include <sys/mman.h>
 #define O_BINARY 0 // Other OS's don't always define this flag.
 #else
 #include <io.h>
@@ -69,6 +73,9 @@
 #define O_WRONLY _O_WRONLY
 #define O_CREAT _O_CREAT
 #define O_BINARY _O_BINARY
+#define O_TRUNC _O_TRUNC
+#define O_APPEND _O_APPEND
+#define fsync _commit
 #define _finddata64_t __finddata64_t
 #endif
 
@@ -80,9 +87,87 @@ namespace Transfer {
 
 static const char *PARTIAL_SUFFIX = ".part";
 static const char *RANGES_SUFFIX = ".ranges";
+static const char *INDEX_FILE = "index";
+static const char *INDEX_TEMP_SUFFIX = ".temp";
+/// Whole files stored deflated, behind a little endian 64-bit length of the original.
+static const char *COMPRESSED_SUFFIX = ".z";
+/// Reads at least this big are mapped rather than copied; smaller ones cost less to read() than to map.
+static const cache_usize_type MIN_MAPPED_SIZE = 64 * kibibyte;
 
 namespace {
 
+/// Fills out with the compressed form of data, or returns false if that would not save at least an eighth.
+bool compressData(const DenseData &data, std::string &out) {
+#ifdef HAVE_ZLIB
+	uLong length = (uLong)data.length();
+	uLongf compressedLength = compressBound(length);
+	out.resize(8 + compressedLength);
+	for (int i = 0; i < 8; ++i) {
+		out[i] = (char)(((uint64)data.length() >> (8*i)) & 0xff);
+	}
+	if (compress2((Bytef*)&out[8], &compressedLength, data.data(), length, Z_DEFAULT_COMPRESSION) != Z_OK ||
+			compressedLength >= length - length/8) {
+		out.clear();
+		return false;
+	}
+	out.resize(8 + compressedLength);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/// Returns the original bytes of a file written with compressData, or NULL if it cannot be read.
+MutableDenseDataPtr readCompressedFile(const std::string &path) {
+	MutableDenseDataPtr result;
+#ifdef HAVE_ZLIB
+	int fd = open(path.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
+	if (fd < 0) {
+		return result;
+	}
+	struct stat64 st;
+	std::vector<unsigned char> compressed;
+	if (fstat64(fd, &st) == 0 && st.st_size > 8) {
+		compressed.resize((size_t)st.st_size);
+		if (read(fd, &compressed[0], (size_t)st.st_size) != (ssize_t)st.st_size) {
+			compressed.clear();
+		}
+	}
+	close(fd);
+	if (compressed.empty()) {
+		return result;
+	}
+	uint64 length = 0;
+	for (int i = 0; i < 8; ++i) {
+		length |= (uint64)compressed[i] << (8*i);
+	}
+	MutableDenseDataPtr contents(new DenseData(Range(0, length, LENGTH, true)));
+	uLongf decompressedLength = (uLongf)length;
+	if (uncompress(contents->writableData(), &decompressedLength, &compressed[8], (uLong)(compressed.size() - 8)) == Z_OK &&
+			decompressedLength == length) {
+		result = contents;
+	} else {
+		SILOG(transfer,error, "Failed to decompress " << path);
+	}
+#endif
+	return result;
+}
+
+/// The part of a whole file that was asked for.
+DenseDataPtr sliceRange(const MutableDenseDataPtr &whole, const Range &range) {
+	if (range.startbyte() == 0 && range.goesToEndOfFile()) {
+		return whole;
+	}
+	cache_usize_type end = whole->length();
+	if (!range.goesToEndOfFile() && range.endbyte() < end) {
+		end = range.endbyte();
+	}
+	cache_usize_type start = range.startbyte() < end ? range.startbyte() : end;
+	MutableDenseDataPtr part(new DenseData(Range(start, end - start, LENGTH, range.goesToEndOfFile())));
+	std::copy(whole->data() + start, whole->data() + end, part->writableData());
+	return part;
+}
+
 cache_usize_type getDiskUsage(const struct stat64 *st) {
 #ifdef _WIN32
 	return (cache_usize_type)st->st_size;
@@ -172,149 +257,689 @@ cache_usize_type sizeFromDirentry(const std::string &name, dirent *ent, bool &is
 
 #endif
 
+/**
+ * Index layout, all in host byte order since the cache never leaves the machine:
+ * INDEX_MAGIC, INDEX_VERSION, then records of
+ * [uint32 payload length][uint32 FNV-1a of payload][payload].
+ * A payload is a uint8 IndexRecordType and the 32 byte fingerprint; a put adds
+ * uint64 disk usage, uint64 last use, uint32 range count and that many
+ * (uint64 start, int64 length) pairs, negative lengths going to the end of the file.
+ * No ranges means the whole file is there.
+ * Loading stops at the first record that is cut short or fails its checksum.
+ */
+static const uint32 INDEX_MAGIC = 0x58444353; // "SCDX" read little endian
+static const uint32 INDEX_VERSION = 1;
+enum IndexRecordType {INDEX_PUT=1, INDEX_DELETE=2};
+enum {INDEX_HEADER_SIZE=8, INDEX_RECORD_HEADER_SIZE=8};
+/// How many superseded records the index may hold beyond twice its live ones before it is rewritten.
+enum {INDEX_SLACK_RECORDS=1024};
+
+uint32 fnv1a(const char *data, size_t length) {
+	uint32 hash = 2166136261U;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+template <class T> void appendRaw(std::string &out, const T &value) {
+	out.append((const char*)&value, sizeof(T));
+}
+
+template <class T> bool readRaw(const char *&pos, const char *end, T &value) {
+	if ((size_t)(end - pos) < sizeof(T)) {
+		return false;
+	}
+	memcpy(&value, pos, sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+void appendIndexHeader(std::string &out) {
+	appendRaw(out, INDEX_MAGIC);
+	appendRaw(out, INDEX_VERSION);
+}
+
+/// Frames payload with its length and checksum.
+void frameIndexRecord(std::string &out, const std::string &payload) {
+	appendRaw(out, (uint32)payload.length());
+	appendRaw(out, fnv1a(payload.data(), payload.length()));
+	out += payload;
+}
+
+std::string makePutPayload(const Fingerprint &id, cache_usize_type diskUsage, uint64 lastUse, const RangeList &ranges) {
+	std::string payload;
+	appendRaw(payload, (unsigned char)INDEX_PUT);
+	payload.append((const char*)id.rawData().data(), Fingerprint::static_size);
+	appendRaw(payload, (uint64)diskUsage);
+	appendRaw(payload, lastUse);
+	appendRaw(payload, (uint32)ranges.size());
+	for (RangeList::const_iterator iter = ranges.begin(); iter != ranges.end(); ++iter) {
+		int64 length = (int64)(*iter).length();
+		if ((*iter).goesToEndOfFile()) {
+			length = -length;
+		}
+		appendRaw(payload, (uint64)(*iter).startbyte());
+		appendRaw(payload, length);
+	}
+	return payload;
+}
+
+std::string makeDeletePayload(const Fingerprint &id) {
+	std::string payload;
+	appendRaw(payload, (unsigned char)INDEX_DELETE);
+	payload.append((const char*)id.rawData().data(), Fingerprint::static_size);
+	return payload;
+}
+
+struct IndexEntry {
+	cache_usize_type mDiskUsage;
+	uint64 mLastUse;
+	RangeList mRanges;
+};
+
+/// Parses one payload into entries; returns false if it is malformed.
+bool applyIndexPayload(const char *pos, const char *end, std::map<Fingerprint, IndexEntry> &entries) {
+	unsigned char type;
+	if (!readRaw(pos, end, type) || (size_t)(end - pos) < (size_t)Fingerprint::static_size) {
+		return false;
+	}
+	Fingerprint id = Fingerprint::convertFromBinary(pos);
+	pos += Fingerprint::static_size;
+	if (type == INDEX_DELETE) {
+		entries.erase(id);
+		return pos == end;
+	}
+	if (type != INDEX_PUT) {
+		return false;
+	}
+	IndexEntry entry;
+	uint64 diskUsage;
+	uint32 numRanges;
+	if (!readRaw(pos, end, diskUsage) || !readRaw(pos, end, entry.mLastUse) || !readRaw(pos, end, numRanges)) {
+		return false;
+	}
+	entry.mDiskUsage = (cache_usize_type)diskUsage;
+	for (uint32 i = 0; i < numRanges; ++i) {
+		uint64 start;
+		int64 length;
+		if (!readRaw(pos, end, start) || !readRaw(pos, end, length)) {
+			return false;
+		}
+		bool toEndOfFile = false;
+		if (length < 0) {
+			length = -length;
+			toEndOfFile = true;
+		}
+		Range toAdd (start, length, LENGTH, toEndOfFile);
+		toAdd.addToList(toAdd, entry.mRanges);
+	}
+	if (pos != end) {
+		return false;
+	}
+	entries[id] = entry;
+	return true;
+}
+
+bool olderUse(const std::pair<const Fingerprint, IndexEntry> *a, const std::pair<const Fingerprint, IndexEntry> *b) {
+	return a->second.mLastUse < b->second.mLastUse;
+}
+
+#ifndef _WIN32
+
+struct UnmapRegion {
+	size_t mLength;
+	UnmapRegion(size_t length) : mLength(length) {
+	}
+	void operator() (void *address) const {
+		munmap(address, mLength);
+	}
+};
+
+/// Maps length bytes at offset (rounded out to whole pages); returns the start of the mapping, or NULL.
+void *mapRegion(int fd, cache_usize_type alignedOffset, size_t length) {
+	void *address = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, (off_t)alignedOffset);
+	return address == MAP_FAILED ? NULL : address;
+}
+
+cache_usize_type mapGranularity() {
+	return (cache_usize_type)sysconf(_SC_PAGESIZE);
+}
+
+std::tr1::shared_ptr<void> mapOwner(void *address, size_t length) {
+	return std::tr1::shared_ptr<void>(address, UnmapRegion(length));
+}
+
+#else
+
+struct UnmapRegion {
+	void operator() (void *address) const {
+		UnmapViewOfFile(address);
+	}
+};
+
+void *mapRegion(int fd, cache_usize_type alignedOffset, size_t length) {
+	HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	void *address = MapViewOfFile(mapping, FILE_MAP_READ,
+		(DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xffffffff), length);
+	CloseHandle(mapping); // the view keeps the mapping alive.
+	return address;
+}
+
+cache_usize_type mapGranularity() {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (cache_usize_type)info.dwAllocationGranularity;
+}
+
+std::tr1::shared_ptr<void> mapOwner(void *address, size_t length) {
+	return std::tr1::shared_ptr<void>(address, UnmapRegion());
+}
+
+#endif
+
+/**
+ * Maps toRead from an open file straight out of the page cache.
+ * The mapping stays valid after the file is closed, or even deleted.
+ * @returns NULL if the range could not be mapped.
+ */
+DenseDataPtr mapFileRange(int fd, const Range &toRead) {
+	struct stat64 st;
+	if (fstat64(fd, &st) != 0 || (cache_usize_type)st.st_size < toRead.endbyte()) {
+		// touching mapped pages past the end of the file faults instead of coming up short like read().
+		return DenseDataPtr();
+	}
+	cache_usize_type granularity = mapGranularity();
+	cache_usize_type alignedOffset = toRead.startbyte() - toRead.startbyte() % granularity;
+	size_t mapLength = (size_t)(toRead.endbyte() - alignedOffset);
+	void *address = mapRegion(fd, alignedOffset, mapLength);
+	if (address == NULL) {
+		return DenseDataPtr();
+	}
+	const unsigned char *start = (const unsigned char *)address + (size_t)(toRead.startbyte() - alignedOffset);
+	return DenseDataPtr(new DenseData(toRead, start, mapOwner(address, mapLength)));
+}
+
 } // anon namespace.
 
+void DiskCacheLayer::submitRequest(const DiskRequestPtr &req) {
+	boost::lock_guard<boost::mutex> lock(mQueueLock);
+	WaitingMap::iterator iter = mWaitingOnFile.find(req->fileId.fingerprint());
+	if (iter != mWaitingOnFile.end()) {
+		(*iter).second.push_back(req);
+		return;
+	}
+	mWaitingOnFile.insert(WaitingMap::value_type(req->fileId.fingerprint(), std::deque<DiskRequestPtr>()));
+	if (req->op == DiskRequest::OPREAD) {
+		mReadQueue.push_back(req);
+	} else {
+		mWriteQueue.push_back(req);
+	}
+	mQueueCV.notify_one();
+}
+
+bool DiskCacheLayer::nextRequest(DiskRequestPtr &req) {
+	boost::unique_lock<boost::mutex> lock(mQueueLock);
+	while (mReadQueue.empty() && mWriteQueue.empty()) {
+		// A request still running may release another one for its file.
+		if (mExiting && mNumInFlight == 0) {
+			mQueueCV.notify_all();
+			return false;
+		}
+		mQueueCV.wait(lock);
+	}
+	std::deque<DiskRequestPtr> &queue = mReadQueue.empty() ? mWriteQueue : mReadQueue;
+	req = queue.front();
+	queue.pop_front();
+	++mNumInFlight;
+	return true;
+}
+
+void DiskCacheLayer::finishRequest(const DiskRequestPtr &req) {
+	boost::lock_guard<boost::mutex> lock(mQueueLock);
+	--mNumInFlight;
+	WaitingMap::iterator iter = mWaitingOnFile.find(req->fileId.fingerprint());
+	if ((*iter).second.empty()) {
+		mWaitingOnFile.erase(iter);
+		if (mExiting && mNumInFlight == 0) {
+			mQueueCV.notify_all();
+		}
+		return;
+	}
+	DiskRequestPtr next = (*iter).second.front();
+	(*iter).second.pop_front();
+	if (next->op == DiskRequest::OPREAD) {
+		mReadQueue.push_back(next);
+	} else {
+		mWriteQueue.push_back(next);
+	}
+	mQueueCV.notify_one();
+}
+
 void DiskCacheLayer::workerThread() {
-	while (true) {
-		std::tr1::shared_ptr<DiskRequest> req;
+	DiskRequestPtr req;
+	while (nextRequest(req)) {
+		processRequest(req);
+		finishRequest(req);
+		req = DiskRequestPtr();
+	}
+}
 
-		mRequestQueue.blockingPop(req);
-		if (req->op == DiskRequest::OPEXIT) {
-			break;
-		} else if (req->op == DiskRequest::OPWRITE) {
-			// Note: TransferLayer::populatePreviousCaches has already been called.
-			std::string fileId = req->fileId.fingerprint().convertToHexString();
-			bool newFile = true;
-			{
-				CacheMap::write_iterator writer(mFiles);
-				if (writer.find(req->fileId.fingerprint())) {
-					CacheData *rlist = static_cast<CacheData*>(*writer);
-					if (rlist->wholeFile() || rlist->contains(*(req->data))) {
-						// this range is already written to disk.
-						continue;
-					}
-					newFile = false;
-				}
-				if (!mFiles.alloc(req->data->length(), writer)) {
-					continue;
+void DiskCacheLayer::processRequest(const DiskRequestPtr &req) {
+	if (req->op == DiskRequest::OPWRITE) {
+		// Note: TransferLayer::populatePreviousCaches has already been called.
+		std::string fileId = req->fileId.fingerprint().convertToHexString();
+		bool newFile = true;
+		{
+			CacheMap::write_iterator writer(mFiles);
+			if (writer.find(req->fileId.fingerprint())) {
+				CacheData *rlist = static_cast<CacheData*>(*writer);
+				if (rlist->wholeFile() || rlist->contains(*(req->data))) {
+					// this range is already written to disk.
+					return;
 				}
+				newFile = false;
 			}
-
-			std::string rangesPath = mPrefix + fileId + RANGES_SUFFIX;
-			std::string filePath = mPrefix + fileId + PARTIAL_SUFFIX;
-			if (newFile) {
-				unlink(rangesPath.c_str()); // in case of a leftover old file.
+			if (!mFiles.alloc(req->data->length(), writer)) {
+				return;
 			}
-			int fd = open(filePath.c_str(), O_CREAT|O_WRONLY|DEFAULT_OPEN_OPTIONS, 0666);
-			if (fd < 0) {
-				SILOG(transfer,error, "Failed to open " << fileId <<
-					"for writing; reason: " << errno);
-				continue;
+		}
+
+		std::string rangesPath = mPrefix + fileId + RANGES_SUFFIX;
+		std::string filePath = mPrefix + fileId + PARTIAL_SUFFIX;
+		if (newFile) {
+			unlink(rangesPath.c_str()); // in case of a leftover old file.
+		}
+		std::string compressed;
+		if (mCompressFiles && newFile) {
+			RangeList onePiece;
+			req->data->addToList(*(req->data), onePiece);
+			if (Range(true).isContainedBy(onePiece)) {
+				compressData(*(req->data), compressed);
 			}
+		}
+		int fd = open(filePath.c_str(), O_CREAT|O_WRONLY|DEFAULT_OPEN_OPTIONS, 0666);
+		if (fd < 0) {
+			SILOG(transfer,error, "Failed to open " << fileId <<
+				"for writing; reason: " << errno);
+			return;
+		}
+		if (!compressed.empty()) {
+			write(fd, compressed.data(), compressed.length());
+		} else {
 			lseek(fd, req->data->startbyte(), SEEK_SET);
 			write(fd, req->data->data(), (size_t)req->data->length());
-			cache_usize_type diskUsage;
-			{
-				struct stat64 st;
-				fstat64(fd, &st);
-				diskUsage = getDiskUsage(&st);
-			}
-			close(fd);
+		}
+		cache_usize_type diskUsage;
+		{
+			struct stat64 st;
+			fstat64(fd, &st);
+			diskUsage = getDiskUsage(&st);
+		}
+		close(fd);
 
-			std::string rangesStr;
-			{
-				CacheMap::write_iterator writer(mFiles);
+		bool wholeFile;
+		std::string record;
+		{
+			CacheMap::write_iterator writer(mFiles);
 
-				if (writer.insert(req->fileId.fingerprint(), diskUsage)) {
-					*writer = new CacheData;
-					writer.use();
-				} else {
-					writer.update(diskUsage);
-				}
-				RangeList &data = static_cast<CacheData*>(*writer)->mRanges;
-				req->data->addToList(*(req->data), data);
-				if (Range(true).isContainedBy(data)) {
-					data.clear();
-				} else {
-					serializeRanges(data, rangesStr);
-				}
+			if (writer.insert(req->fileId.fingerprint(), diskUsage)) {
+				*writer = new CacheData;
+				writer.use();
+			} else {
+				writer.update(diskUsage);
+			}
+			CacheData *cdata = static_cast<CacheData*>(*writer);
+			RangeList &data = cdata->mRanges;
+			req->data->addToList(*(req->data), data);
+			wholeFile = Range(true).isContainedBy(data);
+			if (wholeFile) {
+				data.clear();
 			}
+			cdata->mLastUse = (uint64)time(NULL);
+			record = makePutPayload(req->fileId.fingerprint(), diskUsage, cdata->mLastUse, data);
+		}
 
-			if (rangesStr.empty()) {
-				std::string renameToPath = mPrefix + fileId;
-				// first do atomic rename, the delete ranges file.
-				rename(filePath.c_str(), renameToPath.c_str());
-				unlink(rangesPath.c_str());
-			} else {
-				std::string rangesTempPath = rangesPath + ".temp";
-				FILE * fp = fopen(rangesTempPath.c_str(), "wb");
-				fwrite(rangesStr.data(), 1, rangesStr.length(), fp);
-				fclose(fp);
-				rename(rangesTempPath.c_str(), rangesPath.c_str());
+		if (wholeFile) {
+			std::string renameToPath = mPrefix + fileId;
+			if (!compressed.empty()) {
+				renameToPath += COMPRESSED_SUFFIX;
 			}
-		} else if (req->op == DiskRequest::OPREAD) {
-			bool useWholeFile = false;
-			{
-				CacheMap::read_iterator iter(mFiles);
-				if (iter.find(req->fileId.fingerprint())) {
-					CacheData *rlist = static_cast<CacheData*>(*iter);
-					if (rlist->wholeFile()) {
-						useWholeFile = true;
-					} else if (!rlist->contains(req->toRead)) {
-						// this range is already written to disk.
-						CacheLayer::getData(req->fileId, req->toRead, req->finished);
-						continue;
+			// first do atomic rename, the delete ranges file.
+			rename(filePath.c_str(), renameToPath.c_str());
+			unlink(rangesPath.c_str());
+			if (newFile) {
+				// written in one piece, so every byte is in req->data.
+				indexChunks(req->fileId.fingerprint(), *(req->data));
+			} else {
+				// put together from pieces, often by assembleFromChunks; read it back
+				// so that the next version can reuse its chunks too.
+				int wholeFd = open(renameToPath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
+				struct stat64 st;
+				if (wholeFd >= 0 && fstat64(wholeFd, &st) == 0 && st.st_size > 0) {
+					MutableDenseDataPtr contents(new DenseData(Range(0, st.st_size, LENGTH, true)));
+					if (read(wholeFd, contents->writableData(), (size_t)st.st_size) == (ssize_t)st.st_size) {
+						indexChunks(req->fileId.fingerprint(), *contents);
 					}
 				}
+				if (wholeFd >= 0) {
+					close(wholeFd);
+				}
 			}
-			std::string fileId = req->fileId.fingerprint().convertToHexString();
-			std::string filePath = mPrefix + fileId;
-			if (!useWholeFile) {
-				filePath += PARTIAL_SUFFIX;
+		}
+		appendIndexRecord(record);
+	} else if (req->op == DiskRequest::OPREAD) {
+		bool useWholeFile = false;
+		{
+			CacheMap::read_iterator iter(mFiles);
+			if (iter.find(req->fileId.fingerprint())) {
+				CacheData *rlist = static_cast<CacheData*>(*iter);
+				if (rlist->wholeFile()) {
+					useWholeFile = true;
+				} else if (!rlist->contains(req->toRead)) {
+					// this range is already written to disk.
+					CacheLayer::getData(req->fileId, req->toRead, req->finished, req->priority);
+					return;
+				}
 			}
-			int fd = open(filePath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
-			if (fd < 0) {
-				SILOG(transfer,error, "Failed to open " << fileId <<
-					"for writing; reason: " << errno);
-				CacheLayer::getData(req->fileId, req->toRead, req->finished);
-				continue;
+		}
+		std::string fileId = req->fileId.fingerprint().convertToHexString();
+		std::string filePath = mPrefix + fileId;
+		if (!useWholeFile) {
+			filePath += PARTIAL_SUFFIX;
+		}
+		int fd = -1;
+		if (!useWholeFile || !mCompressFiles) {
+			fd = open(filePath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
+		}
+		if (fd < 0 && useWholeFile) {
+			// Expect a compressed file first if new ones are compressed, but files from either setting may be here.
+			MutableDenseDataPtr contents = readCompressedFile(filePath + COMPRESSED_SUFFIX);
+			if (contents) {
+				DenseDataPtr datum = sliceRange(contents, req->toRead);
+				CacheLayer::populateParentCaches(req->fileId.fingerprint(), datum);
+				SparseData data;
+				data.addValidData(datum);
+				req->finished(&data);
+				return;
 			}
-			if (req->toRead.goesToEndOfFile()) {
-				struct stat64 st;
-				if (fstat64(fd, &st)==0 && st.st_size > 0) {
-					req->toRead.setLength(st.st_size - req->toRead.startbyte(), true);
-				}
+			if (mCompressFiles) {
+				fd = open(filePath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
 			}
-			if (req->toRead.startbyte() != 0) {
-				// FIXME: may not work with 64-bit files?
-				if (lseek(fd, req->toRead.startbyte(), SEEK_SET) != (cache_ssize_type)req->toRead.startbyte()) {
-					SILOG(transfer,error, "Failed to seek in " << fileId <<
-						"to byte "<<req->toRead.startbyte()<<"; reason: " << errno);
-					CacheLayer::getData(req->fileId, req->toRead, req->finished);
-					continue;
-				}
+		}
+		if (fd < 0) {
+			SILOG(transfer,error, "Failed to open " << fileId <<
+				"for writing; reason: " << errno);
+			CacheLayer::getData(req->fileId, req->toRead, req->finished, req->priority);
+			return;
+		}
+		if (req->toRead.goesToEndOfFile()) {
+			struct stat64 st;
+			if (fstat64(fd, &st)==0 && st.st_size > 0) {
+				req->toRead.setLength(st.st_size - req->toRead.startbyte(), true);
+			}
+		}
+		if (req->toRead.startbyte() != 0) {
+			// FIXME: may not work with 64-bit files?
+			if (lseek(fd, req->toRead.startbyte(), SEEK_SET) != (cache_ssize_type)req->toRead.startbyte()) {
+				SILOG(transfer,error, "Failed to seek in " << fileId <<
+					"to byte "<<req->toRead.startbyte()<<"; reason: " << errno);
+				CacheLayer::getData(req->fileId, req->toRead, req->finished, req->priority);
+				return;
 			}
-			MutableDenseDataPtr datum(new DenseData(req->toRead));
-			read(fd, datum->writableData(), (size_t)req->toRead.length());
+		}
+		DenseDataPtr datum;
+		if (req->toRead.length() >= MIN_MAPPED_SIZE) {
+			datum = mapFileRange(fd, req->toRead);
+		}
+		if (!datum) {
+			MutableDenseDataPtr readDatum(new DenseData(req->toRead));
+			read(fd, readDatum->writableData(), (size_t)req->toRead.length());
+			datum = readDatum;
+		}
+		close(fd);
+
+		CacheLayer::populateParentCaches(req->fileId.fingerprint(), datum);
+		SparseData data;
+		data.addValidData(datum);
+		req->finished(&data);
+	} else if (req->op == DiskRequest::OPDELETE) {
+		std::string fileId = req->fileId.fingerprint().convertToHexString();
+		std::string filePath = mPrefix + fileId;
+		unlink(filePath.c_str());
+		std::string rangesPath = filePath + RANGES_SUFFIX;
+		unlink(rangesPath.c_str());
+		std::string partialPath = filePath + PARTIAL_SUFFIX;
+		unlink(partialPath.c_str());
+		std::string compressedPath = filePath + COMPRESSED_SUFFIX;
+		unlink(compressedPath.c_str());
+		forgetChunks(req->fileId.fingerprint());
+		appendIndexRecord(makeDeletePayload(req->fileId.fingerprint()));
+	} else if (req->op == DiskRequest::OPCOPY) {
+		std::string sourcePath = mPrefix + req->sourceFile.convertToHexString();
+		MutableDenseDataPtr chunk(new DenseData(req->toRead));
+		size_t length = (size_t)req->toRead.length();
+		bool readAll = false;
+		int fd = open(sourcePath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
+		if (fd >= 0) {
+			readAll = lseek(fd, req->sourceOffset, SEEK_SET) == (cache_ssize_type)req->sourceOffset &&
+				read(fd, chunk->writableData(), length) == (ssize_t)length;
 			close(fd);
+		} else {
+			MutableDenseDataPtr contents = readCompressedFile(sourcePath + COMPRESSED_SUFFIX);
+			if (contents && req->sourceOffset + length <= contents->length()) {
+				const unsigned char *from = contents->data() + req->sourceOffset;
+				std::copy(from, from + length, chunk->writableData());
+				readAll = true;
+			}
+		}
+		// The source may have been replaced since it was chunked; then the range is simply downloaded.
+		if (!readAll || Fingerprint::computeDigest(chunk->data(), length) != req->chunkDigest) {
+			forgetChunks(req->sourceFile);
+			return;
+		}
+		DiskRequestPtr write(new DiskRequest(DiskRequest::OPWRITE, req->fileId, *chunk));
+		write->data = chunk;
+		processRequest(write);
+	}
+}
 
-			CacheLayer::populateParentCaches(req->fileId.fingerprint(), datum);
-			SparseData data;
-			data.addValidData(datum);
-			req->finished(&data);
-		} else if (req->op == DiskRequest::OPDELETE) {
-			std::string fileId = req->fileId.fingerprint().convertToHexString();
-			std::string filePath = mPrefix + fileId;
-			unlink(filePath.c_str());
-			std::string rangesPath = filePath + RANGES_SUFFIX;
-			unlink(rangesPath.c_str());
-			std::string partialPath = filePath + PARTIAL_SUFFIX;
-			unlink(partialPath.c_str());
+void DiskCacheLayer::indexChunks(const Fingerprint &fileId, const DenseData &data) {
+	ContentChunker::ChunkList chunks;
+	mChunker.split(data.data(), (size_t)data.length(), chunks);
+
+	boost::lock_guard<boost::mutex> lock(mChunkLock);
+	std::vector<Fingerprint> &fileChunks = mFileChunks[fileId];
+	fileChunks.clear();
+	for (ContentChunker::ChunkList::const_iterator iter = chunks.begin(); iter != chunks.end(); ++iter) {
+		ChunkSource &source = mChunkSources[iter->fingerprint];
+		source.file = fileId;
+		source.offset = iter->offset;
+		source.length = iter->length;
+		fileChunks.push_back(iter->fingerprint);
+	}
+}
+
+void DiskCacheLayer::forgetChunks(const Fingerprint &fileId) {
+	boost::lock_guard<boost::mutex> lock(mChunkLock);
+	std::map<Fingerprint, std::vector<Fingerprint> >::iterator fileIter = mFileChunks.find(fileId);
+	if (fileIter == mFileChunks.end()) {
+		return;
+	}
+	const std::vector<Fingerprint> &fileChunks = fileIter->second;
+	for (std::vector<Fingerprint>::const_iterator iter = fileChunks.begin(); iter != fileChunks.end(); ++iter) {
+		std::map<Fingerprint, ChunkSource>::iterator source = mChunkSources.find(*iter);
+		// another file may have taken over the chunk since.
+		if (source != mChunkSources.end() && source->second.file == fileId) {
+			mChunkSources.erase(source);
+		}
+	}
+	mFileChunks.erase(fileIter);
+}
+
+void DiskCacheLayer::assembleFromChunks(const Fingerprint &fileId,
+		const ContentChunker::ChunkList &manifest,
+		RangeList &missing) {
+	std::vector<DiskRequestPtr> copies;
+	{
+		boost::lock_guard<boost::mutex> lock(mChunkLock);
+		for (ContentChunker::ChunkList::const_iterator iter = manifest.begin(); iter != manifest.end(); ++iter) {
+			std::map<Fingerprint, ChunkSource>::const_iterator source = mChunkSources.find(iter->fingerprint);
+			if (source == mChunkSources.end() || source->second.length != iter->length) {
+				iter->range().addToList(iter->range(), missing);
+				continue;
+			}
+			DiskRequestPtr req(new DiskRequest(DiskRequest::OPCOPY,
+					RemoteFileId(fileId, URI(URIContext(),"")), iter->range()));
+			req->sourceFile = source->second.file;
+			req->sourceOffset = source->second.offset;
+			req->chunkDigest = iter->fingerprint;
+			copies.push_back(req);
+		}
+	}
+	for (std::vector<DiskRequestPtr>::const_iterator iter = copies.begin(); iter != copies.end(); ++iter) {
+		submitRequest(*iter);
+	}
+}
+
+bool DiskCacheLayer::loadIndex() {
+	std::string indexPath = mPrefix + INDEX_FILE;
+	int fd = open(indexPath.c_str(), O_RDONLY|DEFAULT_OPEN_OPTIONS);
+	if (fd < 0) {
+		return false;
+	}
+	std::vector<char> contents;
+	{
+		struct stat64 st;
+		if (fstat64(fd, &st) == 0 && st.st_size > 0) {
+			contents.resize((size_t)st.st_size);
+		}
+	}
+	size_t numRead = 0;
+	while (numRead < contents.size()) {
+		int got = read(fd, &contents[numRead], (unsigned int)(contents.size() - numRead));
+		if (got <= 0) {
+			break;
+		}
+		numRead += got;
+	}
+	close(fd);
+	contents.resize(numRead);
+
+	const char *pos = contents.empty() ? NULL : &contents[0];
+	const char *end = pos + contents.size();
+	uint32 magic, version;
+	if (!readRaw(pos, end, magic) || !readRaw(pos, end, version) ||
+			magic != INDEX_MAGIC || version != INDEX_VERSION) {
+		SILOG(transfer,warning,"Ignoring unreadable disk cache index " << indexPath);
+		return false;
+	}
+
+	std::map<Fingerprint, IndexEntry> entries;
+	unsigned int numRecords = 0;
+	while (pos != end) {
+		uint32 length, checksum;
+		const char *recordStart = pos;
+		if (!readRaw(pos, end, length) || !readRaw(pos, end, checksum) ||
+				(size_t)(end - pos) < length ||
+				fnv1a(pos, length) != checksum ||
+				!applyIndexPayload(pos, pos + length, entries)) {
+			// A crash while appending leaves a torn record at the end: drop it and anything after.
+			SILOG(transfer,warning,"Disk cache index " << indexPath << " is damaged after " <<
+				(recordStart - &contents[0]) << " bytes; keeping the " << numRecords << " records before that");
+			numRecords = (unsigned int)-1; // force a rewrite.
+			break;
 		}
+		pos += length;
+		++numRecords;
 	}
+
+	// Insert least recently used first, so the policy starts out in the same order it was left in.
+	std::vector<const std::pair<const Fingerprint, IndexEntry>*> byUse;
+	byUse.reserve(entries.size());
+	for (std::map<Fingerprint, IndexEntry>::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+		byUse.push_back(&(*iter));
+	}
+	std::stable_sort(byUse.begin(), byUse.end(), &olderUse);
 	{
-		boost::unique_lock<boost::mutex> wake_cv(destroyLock);
-		destroyCV.notify_one();
+		CacheMap::write_iterator writer(mFiles);
+		for (size_t i = 0; i < byUse.size(); ++i) {
+			if (writer.insert(byUse[i]->first, byUse[i]->second.mDiskUsage)) {
+				CacheData *cdata = new CacheData;
+				cdata->mRanges = byUse[i]->second.mRanges;
+				cdata->mLastUse = byUse[i]->second.mLastUse;
+				*writer = cdata;
+			}
+		}
+	}
+	mIndexRecords = numRecords;
+	mIndexLiveRecords = (unsigned int)entries.size();
+	return true;
+}
+
+void DiskCacheLayer::compactIndex() {
+	std::string contents;
+	appendIndexHeader(contents);
+	unsigned int numLive = 0;
+	{
+		CacheMap::read_iterator iter(mFiles);
+		while (iter.iterate()) {
+			const CacheData *cdata = static_cast<const CacheData*>(*iter);
+			frameIndexRecord(contents, makePutPayload(iter.getId(), iter.getSize(), cdata->mLastUse, cdata->mRanges));
+			++numLive;
+		}
+	}
+	if (mIndexFd >= 0) {
+		close(mIndexFd);
+		mIndexFd = -1;
+	}
+	// Write the new index beside the old one and rename it over, so a crash leaves one or the other intact.
+	std::string indexPath = mPrefix + INDEX_FILE;
+	std::string tempPath = indexPath + INDEX_TEMP_SUFFIX;
+	int fd = open(tempPath.c_str(), O_CREAT|O_TRUNC|O_WRONLY|DEFAULT_OPEN_OPTIONS, 0666);
+	if (fd < 0) {
+		SILOG(transfer,error, "Failed to open " << tempPath << " for writing; reason: " << errno);
+		return;
+	}
+	bool written = (write(fd, contents.data(), (unsigned int)contents.length()) == (int)contents.length());
+	written = written && fsync(fd) == 0;
+	close(fd);
+	if (!written) {
+		SILOG(transfer,error, "Failed to write " << tempPath << "; reason: " << errno);
+		unlink(tempPath.c_str());
+		return;
+	}
+#ifdef _WIN32
+	unlink(indexPath.c_str()); // rename() will not replace an existing file.
+#endif
+	rename(tempPath.c_str(), indexPath.c_str());
+	mIndexFd = open(indexPath.c_str(), O_WRONLY|O_APPEND|DEFAULT_OPEN_OPTIONS);
+	mIndexRecords = numLive;
+	mIndexLiveRecords = numLive;
+}
+
+void DiskCacheLayer::appendIndexRecord(const std::string &payload) {
+	std::string record;
+	frameIndexRecord(record, payload);
+	boost::lock_guard<boost::mutex> lock(mIndexLock);
+	if (mIndexFd >= 0) {
+		write(mIndexFd, record.data(), (unsigned int)record.length());
+	}
+	if (++mIndexRecords > 2 * mIndexLiveRecords + INDEX_SLACK_RECORDS) {
+		compactIndex();
+	}
+}
+
+void DiskCacheLayer::closeIndex() {
+	boost::lock_guard<boost::mutex> lock(mIndexLock);
+	compactIndex(); // also saves use times, which are not journaled as they change.
+	if (mIndexFd >= 0) {
+		close(mIndexFd);
+		mIndexFd = -1;
 	}
 }
 
@@ -343,6 +968,17 @@ void DiskCacheLayer::unserialize() {
 		++slash;
 	}
 
+	if (loadIndex()) {
+		if (mIndexRecords > 2 * mIndexLiveRecords + INDEX_SLACK_RECORDS) {
+			compactIndex();
+		} else {
+			std::string indexPath = mPrefix + INDEX_FILE;
+			mIndexFd = open(indexPath.c_str(), O_WRONLY|O_APPEND|DEFAULT_OPEN_OPTIONS);
+		}
+		return;
+	}
+
+	// No index yet: find what is on disk, then write one so the next startup can skip this.
 	DIR *mydir = opendir (mPrefix.c_str());
 	if(mydir) {
 		dirent *myentry;
@@ -364,6 +1000,10 @@ void DiskCacheLayer::unserialize() {
 			CacheData *cdata = new CacheData();
 			std::string fingerprintName(strName);
 			bool thisispartial = false;
+			if (strName.length() > strlen(COMPRESSED_SUFFIX) &&
+					strName.substr(strName.length()-strlen(COMPRESSED_SUFFIX)) == COMPRESSED_SUFFIX) {
+				fingerprintName = strName.substr(0, strName.length()-strlen(COMPRESSED_SUFFIX));
+			}
 			if (strName.length() > strlen(PARTIAL_SUFFIX) &&
 					strName.substr(strName.length()-strlen(PARTIAL_SUFFIX)) == PARTIAL_SUFFIX) {
 				thisispartial = true;
@@ -414,6 +1054,7 @@ void DiskCacheLayer::unserialize() {
 		closedir(mydir);
 		// And we are done reading the directory.
 	}
+	compactIndex();
 }
 
 }
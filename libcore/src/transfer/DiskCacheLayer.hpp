@@ -39,19 +39,24 @@
 
 #include "CacheLayer.hpp"
 #include "CacheMap.hpp"
-#include "util/ThreadSafeQueue.hpp"
+#include "ContentChunker.hpp"
+#include "util/Metrics.hpp"
 
 namespace Sirikata {
 namespace Transfer {
 
-// should really be a config option.
-//#define NUM_WORKER_THREADS 10
-
-/// Disk Cache keeps track of what files are on disk, and manages a helper thread to retrieve it.
+/**
+ * Disk Cache keeps track of what files are on disk, and manages a pool of helper threads to retrieve it.
+ * Reads are handed to workers ahead of writes, while requests for one file always run one at a time in the order they were made.
+ */
 class SIRIKATA_EXPORT DiskCacheLayer : public CacheLayer {
 public:
 	struct CacheData : public CacheEntry {
 		RangeList mRanges;
+		/// Seconds since the epoch this entry was last read or written; saved in the index so startup keeps the use order.
+		uint64 mLastUse;
+		CacheData() : mLastUse(0) {
+		}
 		bool wholeFile() const {
 			return mRanges.empty();
 		}
@@ -66,8 +71,19 @@ public:
 private:
 
 	struct DiskRequest;
-	ThreadSafeQueue<std::tr1::shared_ptr<DiskRequest> > mRequestQueue; // must be initialized before the thread.
-	boost::thread mWorkerThread;
+	typedef std::tr1::shared_ptr<DiskRequest> DiskRequestPtr;
+
+	boost::mutex mQueueLock;
+	boost::condition_variable mQueueCV;
+	/// Requests whose file has nothing else queued or running, ready for any worker.
+	std::deque<DiskRequestPtr> mReadQueue;
+	std::deque<DiskRequestPtr> mWriteQueue;
+	/// Has a key for every file with a request queued or running, holding the requests for it that came in afterwards.
+	typedef std::map<Fingerprint, std::deque<DiskRequestPtr> > WaitingMap;
+	WaitingMap mWaitingOnFile;
+	unsigned int mNumInFlight;
+	bool mExiting;
+	boost::thread_group mWorkerThreads;
 
 	CacheMap mFiles;
 
@@ -75,48 +91,110 @@ private:
 	std::string mPrefix; // directory or prefix name with trailing slash.
 
 	struct DiskRequest {
-		enum Operation {OPREAD, OPWRITE, OPDELETE, OPEXIT} op;
+		/// OPCOPY writes toRead of fileId with a chunk read from another cached file.
+		enum Operation {OPREAD, OPWRITE, OPDELETE, OPCOPY} op;
 
 		DiskRequest(Operation op, const RemoteFileId &myURI, const Range &myRange)
-			:op(op), fileId(myURI), toRead(myRange) {}
+			:op(op), fileId(myURI), toRead(myRange), priority(FOREGROUND_PRIORITY), sourceOffset(0) {}
 
 		RemoteFileId fileId;
 		Range toRead;
 		TransferCallback finished;
+		/// Passed on to the next layer if a read is not on disk.
+		TransferPriority priority;
 		DenseDataPtr data; // if NULL, read data.
 
+		Fingerprint sourceFile;
+		cache_usize_type sourceOffset;
+		Fingerprint chunkDigest;
+	};
+
+	/// Where a chunk's bytes can be found among the whole files on disk.
+	struct ChunkSource {
+		Fingerprint file;
+		cache_usize_type offset;
+		cache_usize_type length;
 	};
 
-	boost::mutex destroyLock;
-	boost::condition_variable destroyCV;
+	/**
+	 * Fingerprints of the chunks in each whole file that was written in one piece,
+	 * so new versions of the file can be put together from unchanged chunks.
+	 * Kept in memory only; files cached by earlier runs are not chunked.
+	 */
+	boost::mutex mChunkLock;
+	ContentChunker mChunker;
+	std::map<Fingerprint, ChunkSource> mChunkSources;
+	std::map<Fingerprint, std::vector<Fingerprint> > mFileChunks;
+
+	/// Records the chunks of fileId, whose whole contents are data.
+	void indexChunks(const Fingerprint &fileId, const DenseData &data); // defined in DiskCache.cpp
+	void forgetChunks(const Fingerprint &fileId); // defined in DiskCache.cpp
+
 	bool mCleaningUp; // do not delete any files.
+	/// Whole files written in one piece are stored deflated (with a COMPRESSED_SUFFIX) when that saves space.
+	bool mCompressFiles;
+
+	/**
+	 * The index is a binary journal of every entry added to or removed from the cache,
+	 * so startup can load it with one read instead of scanning the directory.
+	 * It is rewritten with just the live entries when it grows well past them.
+	 */
+	boost::mutex mIndexLock;
+	int mIndexFd;
+	/// Records in the index file, and live entries as of the last rewrite.
+	unsigned int mIndexRecords;
+	unsigned int mIndexLiveRecords;
+
+	Metrics::Counter mHits;
+	Metrics::Counter mMisses;
+
+	/// Rebuilds mFiles from the index; returns false if there is no usable index.
+	bool loadIndex(); // defined in DiskCache.cpp
+	/// Rewrites the index from mFiles. Needs mIndexLock once the workers are running, and no CacheMap iterator may be held.
+	void compactIndex(); // defined in DiskCache.cpp
+	/// Appends one record, compacting if the index has grown too far. No CacheMap iterator may be held.
+	void appendIndexRecord(const std::string &record); // defined in DiskCache.cpp
+	/// Saves the latest use times and closes the index.
+	void closeIndex(); // defined in DiskCache.cpp
+
+	/// Queues req behind any earlier requests for the same file.
+	void submitRequest(const DiskRequestPtr &req); // defined in DiskCache.cpp
+	/// Blocks for the next runnable request; returns false once the layer is being destroyed and no work is left.
+	bool nextRequest(DiskRequestPtr &req); // defined in DiskCache.cpp
+	/// Releases the next request waiting on the file req was for.
+	void finishRequest(const DiskRequestPtr &req); // defined in DiskCache.cpp
+	void processRequest(const DiskRequestPtr &req); // defined in DiskCache.cpp
 
 public:
+	/// Number of disk worker threads used when the caller does not specify any.
+	enum {DEFAULT_NUM_WORKER_THREADS=4};
+
 	void workerThread(); // defined in DiskCache.cpp
+	/// Loads the index, falling back to scanning the directory (and its old per-file .ranges files) if there is none.
 	void unserialize(); // defined in DiskCache.cpp
 
 	void readDataFromDisk(const RemoteFileId &fileURI,
 			const Range &requestedRange,
-			const TransferCallback&callback) {
-		std::tr1::shared_ptr<DiskRequest> req (
+			const TransferCallback&callback,
+			TransferPriority priority=FOREGROUND_PRIORITY) {
+		DiskRequestPtr req (
 				new DiskRequest(DiskRequest::OPREAD, fileURI, requestedRange));
 		req->finished = callback;
+		req->priority = priority;
 
-		mRequestQueue.push(req);
+		submitRequest(req);
 	}
 
-	void serializeRanges(const RangeList &list, std::string &out) {
-		std::ostringstream outs;
-
-		for (RangeList::const_iterator liter = list.begin(); liter != list.end(); ++liter) {
-			cache_ssize_type len = (cache_ssize_type)((*liter).length());
-			if ((*liter).goesToEndOfFile()) {
-				len = -len;
-			}
-			outs << (*liter).startbyte() << " " << len << "; ";
-		}
-		out = outs.str();
-	}
+	/**
+	 * Starts filling in fileId with every chunk of manifest (the chunks of
+	 * fileId, in order) that some other cached file already contains.
+	 * The copies are queued ahead of any later request for fileId, so getData
+	 * afterwards only goes past this layer for the parts still missing.
+	 * @param missing  receives the ranges of fileId that need to be downloaded.
+	 */
+	void assembleFromChunks(const Fingerprint &fileId,
+			const ContentChunker::ChunkList &manifest,
+			RangeList &missing); // defined in DiskCache.cpp
 
 	void unserializeRanges(RangeList &rlist, std::istream &iranges) {
 		while (iranges.good()) {
@@ -144,11 +222,11 @@ public:
 
 protected:
 	virtual void populateCache(const Fingerprint& fileId, const DenseDataPtr &data) {
-		std::tr1::shared_ptr<DiskRequest> req (
+		DiskRequestPtr req (
 				new DiskRequest(DiskRequest::OPWRITE, RemoteFileId(fileId, URI(URIContext(),"")), *data));
 		req->data = data;
 
-		mRequestQueue.push(req);
+		submitRequest(req);
 
 		CacheLayer::populateParentCaches(req->fileId.fingerprint(), data);
 	}
@@ -157,8 +235,10 @@ protected:
 		if (!mCleaningUp) {
 			// don't want to erase the disk cache when exiting the program.
 			std::string fileName = fileId.convertToHexString();
-			std::tr1::shared_ptr<DiskRequest> req
+			DiskRequestPtr req
 				(new DiskRequest(DiskRequest::OPDELETE, RemoteFileId(fileId, URI(URIContext(),"")), Range(true)));
+			// Also records the removal in the index, or the entry would come back at the next startup.
+			submitRequest(req);
 		}
 		CacheData *toDelete = static_cast<CacheData*>(cacheLayerData);
 		delete toDelete;
@@ -166,12 +246,26 @@ protected:
 
 public:
 
-	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext)
+	/**
+	 * @param numWorkerThreads  how many requests may be on disk at once, so that
+	 *                          reads are not stuck behind large writes and fast disks see some queue depth.
+	 * @param compressFiles     store compressible files deflated; ignored if built without zlib.
+	 */
+	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext,
+			unsigned int numWorkerThreads=DEFAULT_NUM_WORKER_THREADS,
+			bool compressFiles=false)
 			: CacheLayer(tryNext),
-			mWorkerThread(std::tr1::bind(&DiskCacheLayer::workerThread, this)),
+			mNumInFlight(0),
+			mExiting(false),
 			mFiles(this, policy),
 			mPrefix(prefix+"/"),
-			mCleaningUp(false) {
+			mCleaningUp(false),
+			mCompressFiles(compressFiles),
+			mIndexFd(-1),
+			mIndexRecords(0),
+			mIndexLiveRecords(0),
+			mHits("cache.disk.hits", "requests whose range the disk cache holds"),
+			mMisses("cache.disk.misses", "requests passed on to the next cache layer") {
 
 		try {
 			unserialize();
@@ -179,14 +273,28 @@ public:
 			SILOG(transfer,fatal,"ERROR loading file list!");
 			/// do nothing
 		}
+#ifndef HAVE_ZLIB
+		if (mCompressFiles) {
+			SILOG(transfer,warning,"DiskCacheLayer built without zlib; storing files uncompressed.");
+			mCompressFiles = false;
+		}
+#endif
+		if (numWorkerThreads == 0) {
+			numWorkerThreads = 1;
+		}
+		for (unsigned int i = 0; i < numWorkerThreads; ++i) {
+			mWorkerThreads.create_thread(std::tr1::bind(&DiskCacheLayer::workerThread, this));
+		}
 	}
 
 	virtual ~DiskCacheLayer() {
-		std::tr1::shared_ptr<DiskRequest> req
-			(new DiskRequest(DiskRequest::OPEXIT, RemoteFileId(Fingerprint(), URI(URIContext(),"")), Range(true)));
-		boost::unique_lock<boost::mutex> sleep_cv(destroyLock);
-		mRequestQueue.push(req);
-		destroyCV.wait(sleep_cv); // we know the thread has terminated.
+		{
+			boost::lock_guard<boost::mutex> lock(mQueueLock);
+			mExiting = true;
+			mQueueCV.notify_all();
+		}
+		mWorkerThreads.join_all(); // queued requests are finished first.
+		closeIndex();
 
 		mCleaningUp = true; // don't allow destroyCacheEntry to delete files.
 
@@ -202,7 +310,8 @@ public:
 
 	virtual void getData(const RemoteFileId &fileId,
 			const Range &requestedRange,
-			const TransferCallback&callback) {
+			const TransferCallback&callback,
+			TransferPriority priority=FOREGROUND_PRIORITY) {
 		bool haveRange = false;
 		{
 			CacheMap::read_iterator iter(mFiles);
@@ -213,12 +322,16 @@ public:
 			}
 			if (haveRange) {
 				iter.use(); // or is it more proper to use() after reading from disk?
+				// Only the index reads this back, so a racing update just loses one timestamp.
+				static_cast<CacheData*>(*iter)->mLastUse = (uint64)time(NULL);
 			}
 		}
 		if (haveRange) {
-			readDataFromDisk(fileId, requestedRange, callback);
+			mHits.increment();
+			readDataFromDisk(fileId, requestedRange, callback, priority);
 		} else {
-			CacheLayer::getData(fileId, requestedRange, callback);
+			mMisses.increment();
+			CacheLayer::getData(fileId, requestedRange, callback, priority);
 		}
 	}
 };
@@ -35,6 +35,7 @@
 #define SIRIKATA_DownloadHandler_HPP__
 
 #include "ProtocolRegistry.hpp"
+#include "ServiceLookup.hpp"
 
 namespace Sirikata {
 namespace Transfer {
@@ -128,13 +129,49 @@ public:
 	 */
 	typedef std::tr1::function<void(const Fingerprint& hash, const std::string& uriString, bool success)> Callback;
 
+	/// Maps each name in a names file to its URI, or to an empty string if the name was removed.
+	typedef std::map<std::string, std::string> NameList;
+
 	virtual ~NameLookupHandler() {
 	}
 
+	/** Reads the "name uri" lines used by names files and batch lookup replies.
+	 * A line with only a name removes it; later lines override earlier ones. */
+	static void parseNameList(const DenseData &data, NameList &names) {
+		for (const unsigned char *iter = data.begin(); iter != data.end();) {
+			const unsigned char *newlinepos = std::find(iter, data.end(), '\n');
+			if (newlinepos == data.end()) {
+				break;
+			}
+			const unsigned char *spacepos = std::find(iter, newlinepos, ' ');
+			if (spacepos == newlinepos || spacepos + 1 == newlinepos) {
+				names[std::string(iter, spacepos)] = std::string();
+			} else {
+				names[std::string(iter, spacepos)] = std::string(spacepos+1, newlinepos);
+			}
+			iter = newlinepos + 1;
+		}
+	}
+
 	/** Performs a name lookup using this method, and calls cb whether it succeeded or not. */
 	virtual void nameLookup(TransferDataPtr *ptrRef, const URI &uri, const Callback &cb) {
 		cb(Fingerprint(), std::string(), false);
 	}
+
+	/** The most names batchNameLookup() should be given at once for this service;
+	 * 1 if the service can only answer one name per request. */
+	virtual unsigned int maxNameBatch(const ServiceParams &params) const {
+		return 1;
+	}
+
+	/** Looks up several names that share a URIContext, ideally in a single request.
+	 * cbs[i] is called for uris[i], in any order. The default does one nameLookup() each. */
+	virtual void batchNameLookup(const ServiceParams &params, const std::vector<URI> &uris,
+			const std::vector<Callback> &cbs) {
+		for (size_t i = 0; i < uris.size(); ++i) {
+			nameLookup(NULL, uris[i], cbs[i]);
+		}
+	}
 };
 typedef std::tr1::shared_ptr<NameLookupHandler> NameLookupHandlerPtr;
 
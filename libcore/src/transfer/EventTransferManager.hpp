@@ -63,24 +63,146 @@ class EventTransferManager : public TransferManager {
 	AtomicValue<int> mPendingCleanup;
 	boost::condition_variable mCleanupCV;
 
-	typedef std::tr1::unordered_multimap<Fingerprint, Range, Fingerprint::Hasher> DownloadRangeMap;
+	/// A download in progress, or waiting in mQueued for a free slot in its priority class.
+	struct ActiveDownload {
+		Range range;
+		TransferPriority priority;
+		Time deadline;
+		bool queued;
+
+		ActiveDownload(const Range &range, TransferPriority priority, const Time &deadline)
+			: range(range), priority(priority), deadline(deadline), queued(true) {
+		}
+	};
+	/// An entry in mQueued, or a download about to be handed to the cache layers.
+	struct QueuedDownload {
+		RemoteFileId fileId;
+		Range range;
+		TransferPriority priority;
+		Time deadline;
+
+		QueuedDownload(const RemoteFileId &fileId, const Range &range, TransferPriority priority, const Time &deadline)
+			: fileId(fileId), range(range), priority(priority), deadline(deadline) {
+		}
+	};
+	typedef std::list<QueuedDownload> DownloadQueue;
+
+	typedef std::tr1::unordered_multimap<Fingerprint, ActiveDownload, Fingerprint::Hasher> DownloadRangeMap;
 	typedef std::tr1::unordered_set<std::string> UploadMap;
 	DownloadRangeMap mActiveTransfers;
 	UploadMap mActiveUploads;
 
+	/// Downloads waiting for a slot, one queue per TransferPriority, earliest deadline first.
+	DownloadQueue mQueued[NUM_TRANSFER_PRIORITIES];
+	unsigned int mNumActive[NUM_TRANSFER_PRIORITIES];
+	/// 0 for no limit.
+	unsigned int mMaxActive[NUM_TRANSFER_PRIORITIES];
+
 	boost::mutex mMutex;
 	boost::mutex mUploadMutex;
 
-	void downloadFinished(const RemoteFileId &remoteid, const Range &range, const SparseData *downloadedData) {
+	/// Whether deadline a comes before b; Time::null() comes after everything.
+	static bool sooner(const Time &a, const Time &b) {
+		if (a == Time::null()) {
+			return false;
+		}
+		return b == Time::null() || a < b;
+	}
+
+	/// Queues a download behind those of its class due no later than it; needs mMutex.
+	void enqueue(const QueuedDownload &download) {
+		DownloadQueue &queue = mQueued[download.priority];
+		DownloadQueue::iterator pos = queue.begin();
+		while (pos != queue.end() && !sooner(download.deadline, (*pos).deadline)) {
+			++pos;
+		}
+		queue.insert(pos, download);
+	}
+
+	/// Takes a queued download out of line; needs mMutex.
+	void dequeue(const Fingerprint &fprint, const ActiveDownload &active) {
+		DownloadQueue &queue = mQueued[active.priority];
+		for (DownloadQueue::iterator iter = queue.begin(); iter != queue.end(); ++iter) {
+			if ((*iter).fileId.fingerprint() == fprint && (*iter).range == active.range) {
+				queue.erase(iter);
+				return;
+			}
+		}
+	}
+
+	inline bool hasSlot(TransferPriority priority) const {
+		return mMaxActive[priority] == 0 || mNumActive[priority] < mMaxActive[priority];
+	}
+
+	/// Moves queued downloads into toStart while their class has free slots, most urgent class first; needs mMutex.
+	void nextDownloads(std::vector<QueuedDownload> &toStart) {
+		for (int p = NUM_TRANSFER_PRIORITIES-1; p >= 0 && !mCleanup; --p) {
+			TransferPriority priority = (TransferPriority)p;
+			DownloadQueue &queue = mQueued[p];
+			while (!queue.empty() && hasSlot(priority)) {
+				const QueuedDownload &next = queue.front();
+				DownloadRangeMap::iterator iter = mActiveTransfers.find(next.fileId.fingerprint());
+				while (iter != mActiveTransfers.end() && (*iter).first == next.fileId.fingerprint()) {
+					if ((*iter).second.queued && (*iter).second.range == next.range) {
+						(*iter).second.queued = false;
+						break;
+					}
+					++iter;
+				}
+				++mNumActive[p];
+				toStart.push_back(next);
+				queue.pop_front();
+			}
+		}
+	}
+
+	/// Call without holding mMutex: the cache layers may finish a download synchronously.
+	void startDownloads(CacheLayer *theCacheLayer, const std::vector<QueuedDownload> &toStart) {
+		for (std::vector<QueuedDownload>::const_iterator iter = toStart.begin(); iter != toStart.end(); ++iter) {
+			theCacheLayer->getData((*iter).fileId, (*iter).range,
+				std::tr1::bind(&EventTransferManager::downloadFinished, this,
+					(*iter).fileId, (*iter).range, (*iter).priority, _1),
+				(*iter).priority);
+		}
+	}
+
+	/**
+	 * Gives a tracked download a new priority and deadline; needs mMutex.
+	 * A queued download moves in line; a running one keeps its slot.
+	 * @returns true if it is running and the cache layers should be told it became more urgent.
+	 */
+	bool reschedule(const RemoteFileId &fileId, ActiveDownload &active, TransferPriority priority, const Time &deadline) {
+		if (!active.queued) {
+			active.deadline = deadline;
+			if (priority > active.priority) {
+				active.priority = priority;
+				return true;
+			}
+			return false;
+		}
+		dequeue(fileId.fingerprint(), active);
+		active.priority = priority;
+		active.deadline = deadline;
+		enqueue(QueuedDownload(fileId, active.range, priority, deadline));
+		return false;
+	}
+
+	void downloadFinished(const RemoteFileId &remoteid, const Range &range, TransferPriority slot, const SparseData *downloadedData) {
 		bool found = true;
+		std::vector<QueuedDownload> toStart;
+		CacheLayer *theCacheLayer;
 		{
 			boost::unique_lock<boost::mutex> l(mMutex);
-			DownloadRangeMap::const_iterator iter =
+			DownloadRangeMap::iterator iter =
 				mActiveTransfers.find(remoteid.fingerprint());
 			while (iter != mActiveTransfers.end() && (*iter).first == remoteid.fingerprint()) {
 				if (downloadedData ?
-						downloadedData->contains((*iter).second) :
-						((*iter).second == range)) {
+						downloadedData->contains((*iter).second.range) :
+						((*iter).second.range == range)) {
+					// Requests still waiting in line are satisfied by this data too.
+					if ((*iter).second.queued) {
+						dequeue(remoteid.fingerprint(), (*iter).second);
+					}
 					// Return value is the iterator immediately following q prior to the erasure.
 					iter = mActiveTransfers.erase(iter);
 					found = true;
@@ -88,6 +210,9 @@ class EventTransferManager : public TransferManager {
 					++iter;
 				}
 			}
+			--mNumActive[slot];
+			nextDownloads(toStart);
+			theCacheLayer = mFirstTransferLayer;
 		}
 
 		if (found) {
@@ -101,12 +226,47 @@ class EventTransferManager : public TransferManager {
 		} else {
 			SILOGNOCR(transfer,error,"Finished download for " << remoteid.uri() << " but event has already fired...");
 		}
+		startDownloads(theCacheLayer, toStart);
 	}
 
-	void downloadNameLookupSuccess(const EventListener &listener, const Range &range, const RemoteFileId *remoteid) {
-	        doDownloadByHash(listener, range, remoteid, false);
+	void reprioritizeNameLookupSuccess(const Range &range, TransferPriority priority, const Time &deadline, const RemoteFileId *remoteid) {
+		if (remoteid) {
+			doReprioritize(*remoteid, range, priority, deadline);
+		}
+		if (--mPendingCleanup == 0) {
+			if (mCleanup) {
+				mCleanupCV.notify_one(); // We are the last one to finish.
+			}
+		}
 	}
-    Task::SubscriptionId doDownloadByHash(const EventListener &listener, const Range &range, const RemoteFileId *remoteid, bool requestID) {
+	void doReprioritize(const RemoteFileId &remoteid, const Range &range, TransferPriority priority, const Time &deadline) {
+		std::vector<QueuedDownload> toStart;
+		bool raise = false;
+		boost::unique_lock<boost::mutex> l(mMutex);
+		if (mCleanup) {
+			return;
+		}
+		DownloadRangeMap::iterator iter = mActiveTransfers.find(remoteid.fingerprint());
+		while (iter != mActiveTransfers.end() && (*iter).first == remoteid.fingerprint()) {
+			if (range.isContainedBy((*iter).second.range)) {
+				raise = reschedule(remoteid, (*iter).second, priority, deadline);
+				nextDownloads(toStart);
+				break;
+			}
+			++iter;
+		}
+		CacheLayer * theCacheLayer = mFirstTransferLayer;
+		l.unlock();
+		if (raise) {
+			theCacheLayer->raisePriority(remoteid, range, priority);
+		}
+		startDownloads(theCacheLayer, toStart);
+	}
+
+	void downloadNameLookupSuccess(const EventListener &listener, const Range &range, TransferPriority priority, const Time &deadline, const RemoteFileId *remoteid) {
+	        doDownloadByHash(listener, range, priority, deadline, remoteid, false);
+	}
+    Task::SubscriptionId doDownloadByHash(const EventListener &listener, const Range &range, TransferPriority priority, const Time &deadline, const RemoteFileId *remoteid, bool requestID) {
 		Task::SubscriptionId ret = Task::SubscriptionIdClass::null();
 		if (!remoteid) {
 			listener(DownloadEventPtr(new DownloadEvent(FAIL_NAMELOOKUP, RemoteFileId(), NULL)));
@@ -123,12 +283,12 @@ class EventTransferManager : public TransferManager {
 				return ret;
 			}
 
-			DownloadRangeMap::const_iterator iter =
+			DownloadRangeMap::iterator iter =
 				mActiveTransfers.find(remoteid->fingerprint());
 			bool found = false;
 			while (iter != mActiveTransfers.end() && (*iter).first == remoteid->fingerprint()) {
-				if (range.isContainedBy((*iter).second)) {
-					SILOG(transfer,debug,"ISContained " << range << " " << (*iter).second);
+				if (range.isContainedBy((*iter).second.range)) {
+					SILOG(transfer,debug,"ISContained " << range << " " << (*iter).second.range);
 					found = true;
 					break;
 				}
@@ -140,26 +300,41 @@ class EventTransferManager : public TransferManager {
 			} else {
 			     mEventSystem->subscribe(DownloadEvent::getIdPair(*remoteid), listener);
 			}
-			if (!found) {
+			std::vector<QueuedDownload> toStart;
+			bool raise = false;
+			TransferPriority raisedTo = priority;
+			if (found) {
+				// Joining a download makes it at least as urgent as the new request.
+				ActiveDownload &active = (*iter).second;
+				TransferPriority joinedPriority = std::max(priority, active.priority);
+				Time joinedDeadline = sooner(deadline, active.deadline) ? deadline : active.deadline;
+				if (joinedPriority != active.priority || joinedDeadline != active.deadline) {
+					raise = reschedule(*remoteid, active, joinedPriority, joinedDeadline);
+					raisedTo = joinedPriority;
+					nextDownloads(toStart);
+				}
+			} else {
 				mActiveTransfers.insert(
-					DownloadRangeMap::value_type(remoteid->fingerprint(), range));
-				CacheLayer * theCacheLayer = mFirstTransferLayer;
-				// release lock after subscribing to ensure that event does not fire until now.
-				l.unlock();
-
-				/* Don't want to own a lock here, but also need to make sure
-				 * nobody deletes mFirstTransferLayer while we are in the call.
-				 * For any asynchronous callbacks, CacheLayer will handle cleanup,
-				 * but for synchronous callbacks it is our responsibility.
-				 */
-
-				// FIXME: mFirstTransferLayer may be destroyed if cleanup is called after previous check.
-                //using std::tr1::placeholders::_1;
-				theCacheLayer->getData(*remoteid, range,
-					std::tr1::bind(&EventTransferManager::downloadFinished, this, *remoteid, range, _1));
-
+					DownloadRangeMap::value_type(remoteid->fingerprint(), ActiveDownload(range, priority, deadline)));
+				enqueue(QueuedDownload(*remoteid, range, priority, deadline));
+				nextDownloads(toStart);
 			}
-
+			CacheLayer * theCacheLayer = mFirstTransferLayer;
+			// release lock after subscribing to ensure that event does not fire until now.
+			l.unlock();
+
+			/* Don't want to own a lock here, but also need to make sure
+			 * nobody deletes mFirstTransferLayer while we are in the call.
+			 * For any asynchronous callbacks, CacheLayer will handle cleanup,
+			 * but for synchronous callbacks it is our responsibility.
+			 */
+
+			// FIXME: mFirstTransferLayer may be destroyed if cleanup is called after previous check.
+			if (raise) {
+				// The download in progress may be a prefetch still waiting for a connection.
+				theCacheLayer->raisePriority(*remoteid, range, raisedTo);
+			}
+			startDownloads(theCacheLayer, toStart);
 		}
 
 		if (--mPendingCleanup == 0) {
@@ -330,9 +505,30 @@ public:
 			  mUploadServ(uploadDataReg),
 			  mCleanup(false),
 			  mPendingCleanup(0) {
+		for (int p = 0; p < NUM_TRANSFER_PRIORITIES; ++p) {
+			mNumActive[p] = 0;
+			mMaxActive[p] = 0;
+		}
+		mMaxActive[PREFETCH_PRIORITY] = 4;
+		mMaxActive[FOREGROUND_PRIORITY] = 16;
+	}
+
+	/** Sets how many downloads of one priority class may be handed to the cache layers
+	 * at once; the rest wait in line. CRITICAL_PRIORITY has no limit by default.
+	 * @param maxActive  0 for no limit.
+	 */
+	void setConcurrencyLimit(TransferPriority priority, unsigned int maxActive) {
+		std::vector<QueuedDownload> toStart;
+		boost::unique_lock<boost::mutex> l(mMutex);
+		mMaxActive[priority] = maxActive;
+		nextDownloads(toStart);
+		CacheLayer * theCacheLayer = mFirstTransferLayer;
+		l.unlock();
+		startDownloads(theCacheLayer, toStart);
 	}
 
 	virtual void cleanup() {
+		std::vector<QueuedDownload> aborted;
 		{
 			boost::unique_lock<boost::mutex> cleanuplock(mMutex);
 
@@ -342,12 +538,30 @@ public:
 			mNameLookup = NULL;
 			mFirstTransferLayer = NULL;
 
+			// Downloads still waiting in line never reached a cache layer, so nobody else will fail them.
+			for (int p = 0; p < NUM_TRANSFER_PRIORITIES; ++p) {
+				for (DownloadQueue::iterator iter = mQueued[p].begin(); iter != mQueued[p].end(); ++iter) {
+					DownloadRangeMap::iterator active = mActiveTransfers.find((*iter).fileId.fingerprint());
+					while (active != mActiveTransfers.end() && (*active).first == (*iter).fileId.fingerprint()) {
+						if ((*active).second.queued && (*active).second.range == (*iter).range) {
+							mActiveTransfers.erase(active);
+							break;
+						}
+						++active;
+					}
+					aborted.push_back(*iter);
+				}
+				mQueued[p].clear();
+			}
+
 			while (mPendingCleanup.read() != 0) {
 				// Wait for any downloadNameLookupSuccess callbacks to return.
 				mCleanupCV.wait(cleanuplock);
 			}
 		}
-
+		for (std::vector<QueuedDownload>::const_iterator iter = aborted.begin(); iter != aborted.end(); ++iter) {
+			mEventSystem->fire(DownloadEventPtr(new DownloadEvent(FAIL_SHUTDOWN, (*iter).fileId, NULL)));
+		}
 	}
 
 	virtual ~EventTransferManager() {
@@ -359,16 +573,33 @@ public:
 		mFirstTransferLayer->purgeFromCache(fprint);
 	}
 
-	virtual void download(const URI &name, const EventListener &listener, const Range &range) {
+	virtual void addToCache(const Fingerprint &fprint, const DenseDataPtr &data) {
+		mFirstTransferLayer->addToCache(fprint, data);
+	}
+
+	virtual void download(const URI &name, const EventListener &listener, const Range &range,
+			TransferPriority priority=FOREGROUND_PRIORITY, const Time &deadline=Time::null()) {
 		// TODO: Handle multiple name lookups at the same time to the same filename. Is this possible? worth doing?
 		++mPendingCleanup;
-		mNameLookup->lookupHash(name, std::tr1::bind(&EventTransferManager::downloadNameLookupSuccess, this, listener, range, _2));
+		mNameLookup->lookupHash(name, std::tr1::bind(&EventTransferManager::downloadNameLookupSuccess, this, listener, range, priority, deadline, _2));
 	}
 
-	virtual SubscriptionId downloadByHash(const RemoteFileId &name, const EventListener &listener, const Range &range) {
+	virtual SubscriptionId downloadByHash(const RemoteFileId &name, const EventListener &listener, const Range &range,
+			TransferPriority priority=FOREGROUND_PRIORITY, const Time &deadline=Time::null()) {
 		// This is the same as if the download() function got a cached name lookup response.
 		++mPendingCleanup;
-		return doDownloadByHash(listener, range, &name, true);
+		return doDownloadByHash(listener, range, priority, deadline, &name, true);
+	}
+
+	virtual void reprioritize(const URI &name, const Range &range,
+			TransferPriority priority, const Time &deadline=Time::null()) {
+		if (isNameURI(name)) {
+			doReprioritize(RemoteFileId(name), range, priority, deadline);
+		} else {
+			// The name was looked up when the download started, so this is normally cached.
+			++mPendingCleanup;
+			mNameLookup->lookupHash(name, std::tr1::bind(&EventTransferManager::reprioritizeNameLookupSuccess, this, range, priority, deadline, _2));
+		}
 	}
 
 	virtual void downloadName(const URI &nameURI,
@@ -53,6 +53,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #endif
+#include <sys/mman.h>
 #define O_BINARY 0 // Other OS's don't always define this flag.
 #else
 #include <io.h>
@@ -210,6 +211,23 @@ public:
 	}
 };
 
+#ifndef _WIN32
+/// Reads at least this long are mapped instead of copied; below it read() is cheaper than a mapping.
+static const cache_usize_type MMAP_MIN_LENGTH = 64*1024;
+
+/// Owns a mapping of part of a file for the DenseData that refers to it.
+class MappedSlice : Noncopyable {
+	void *mAddress;
+	size_t mLength;
+public:
+	MappedSlice(void *address, size_t length) : mAddress(address), mLength(length) {
+	}
+	~MappedSlice() {
+		munmap(mAddress, mLength);
+	}
+};
+#endif
+
 class ReadTask : public Task::AbortableWorkItem {
 protected:
 	std::string mPath;
@@ -230,7 +248,26 @@ public:
 				aborted();
 				return;
 			}
+		} else if (mDiskSize > 0 && mRange.endbyte() > mDiskSize) {
+			// Like an HTTP server, return whatever part of the range exists.
+			if (mRange.startbyte() >= mDiskSize) {
+				aborted();
+				return;
+			}
+			mRange.setLength(mDiskSize - mRange.startbyte(), false);
+		}
+#ifndef _WIN32
+		if (mDiskSize > 0 && mRange.length() >= MMAP_MIN_LENGTH) {
+			DenseDataPtr mapped(mapRange());
+			if (mapped) {
+				mCallback(mapped, true, mDiskSize);
+				return;
+			}
 		}
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(mFd, (off_t)mRange.startbyte(), (off_t)mRange.length(), POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
 		MutableDenseDataPtr memoryBuffer(new DenseData(mRange));
 		if (!read_full(mFd, memoryBuffer->writableData(), mRange.length())) {
 			aborted();
@@ -239,6 +276,31 @@ public:
 		mCallback(memoryBuffer, true, mDiskSize);
 	}
 
+#ifndef _WIN32
+	/**
+	 * Maps just the pages holding mRange, so nothing is read until the data is
+	 * touched and the pages stay in the shared page cache rather than a private buffer.
+	 * Returns NULL if the file cannot be mapped, and the caller falls back to read().
+	 * If the file is truncated while a slice is mapped, touching the lost pages faults,
+	 * so this is only meant for asset files that are replaced rather than rewritten.
+	 */
+	DenseDataPtr mapRange() {
+		static const cache_usize_type pageSize = (cache_usize_type)sysconf(_SC_PAGESIZE);
+		cache_usize_type mapStart = mRange.startbyte() - mRange.startbyte() % pageSize;
+		size_t mapLength = (size_t)(mRange.endbyte() - mapStart);
+		void *address = mmap(NULL, mapLength, PROT_READ, MAP_PRIVATE, mFd, (off_t)mapStart);
+		if (address == MAP_FAILED) {
+			SILOG(transfer,debug, "Unable to map " << mPath << "; reading instead. reason: " << errno);
+			return DenseDataPtr();
+		}
+		madvise(address, mapLength, MADV_SEQUENTIAL);
+		madvise(address, mapLength, MADV_WILLNEED);
+		std::tr1::shared_ptr<void> owner(new MappedSlice(address, mapLength));
+		return DenseDataPtr(new DenseData(mRange,
+				(const unsigned char*)address + (mRange.startbyte() - mapStart), owner));
+	}
+#endif
+
 	void operator() () {
 		Task::AbortableWorkItemPtr tempReference(shared_from_this());
 		if (!prepareExecute()) {
@@ -518,6 +580,24 @@ void FileNameHandler::finishedDownload(const NameLookupHandler::Callback &cb,
 	}
 }
 
+void FileNameHandler::finishedBatchDownload(const std::vector<URI> &uris,
+	const std::vector<NameLookupHandler::Callback> &cbs, DenseDataPtr data, bool success)
+{
+	NameList names;
+	if (success) {
+		parseNameList(*data, names);
+	}
+	for (size_t i = 0; i < uris.size(); ++i) {
+		NameList::const_iterator iter = names.find(uris[i].filename());
+		if (iter != names.end() && !(*iter).second.empty()) {
+			RemoteFileId foundURI((URI((*iter).second)));
+			cbs[i](foundURI.fingerprint(), foundURI.uri().toString(), true);
+		} else {
+			cbs[i](Fingerprint::null(), std::string(), false);
+		}
+	}
+}
+
 
 }
 }
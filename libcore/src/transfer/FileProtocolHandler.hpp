@@ -132,6 +132,10 @@ class SIRIKATA_EXPORT FileNameHandler :
 						  const std::string &filename,
 						  DenseDataPtr data,
 						  bool success);
+	void finishedBatchDownload(const std::vector<URI> &uris,
+						  const std::vector<NameLookupHandler::Callback> &cbs,
+						  DenseDataPtr data,
+						  bool success);
 public:
 	FileNameHandler(FileProtocolHandlerPtr fileProtocol)
 		: mFileProtocol(fileProtocol) {
@@ -148,6 +152,17 @@ public:
 								std::tr1::bind(&FileNameHandler::finishedDownload, this, cb, uri.filename(), _1, _2));
 	}
 
+	/// The whole names file is read for every lookup anyway, so any number of names can share one read.
+	virtual unsigned int maxNameBatch(const ServiceParams &params) const {
+		return 1024;
+	}
+
+	virtual void batchNameLookup(const ServiceParams &params, const std::vector<URI> &uris,
+			const std::vector<NameLookupHandler::Callback> &cbs) {
+		mFileProtocol->download(NULL, URI(uris[0].context().toString(false)), Range(true),
+								std::tr1::bind(&FileNameHandler::finishedBatchDownload, this, uris, cbs, _1, _2));
+	}
+
 	virtual void uploadName(NameUploadHandler::TransferDataPtr *ptrRef,
 			const ServiceParams &params,
 			const URI &uri,
@@ -0,0 +1,152 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  GDSFPolicy.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_GDSFPolicy_HPP__
+#define SIRIKATA_GDSFPolicy_HPP__
+
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * GreedyDual-Size-Frequency policy: an entry's priority is the cache's current
+ * inflation value plus how often it has been used divided by its size, and the
+ * lowest priority entry is evicted first. Evicting an entry raises the inflation
+ * value to its priority, so entries that stop being used age out.
+ *
+ * Small, often used entries outrank a large one-time download. With admission
+ * control on, a new entry that could only fit by evicting something with a
+ * higher priority than its own is not cached at all, so one big file cannot
+ * flush the working set.
+ */
+class GDSFPolicy : public CachePolicy {
+
+	typedef std::pair<Fingerprint, cache_usize_type> GDSFElement;
+	typedef std::multimap<double, GDSFElement> PriorityQueue;
+
+	struct GDSFData : public Data {
+		PriorityQueue::iterator mIter;
+		uint32 mFrequency;
+
+		GDSFData(const PriorityQueue::iterator &copyIter)
+			: mIter(copyIter), mFrequency(1) {
+		}
+	};
+
+	PriorityQueue mByPriority;
+	/// Priority of the most recently evicted entry; every new priority is offset by it.
+	double mInflation;
+	bool mAdmissionControl;
+
+	double priority(uint32 frequency, cache_usize_type size) const {
+		return mInflation + (double)frequency / (double)(size ? size : 1);
+	}
+
+public:
+	GDSFPolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5, bool admissionControl=true)
+		: CachePolicy(allocatedSpace, maxSizePct),
+		mInflation(0),
+		mAdmissionControl(admissionControl) {
+	}
+
+	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
+		GDSFData *gdsfdata = static_cast<GDSFData*>(data);
+
+		++gdsfdata->mFrequency;
+		mByPriority.erase(gdsfdata->mIter);
+		gdsfdata->mIter = mByPriority.insert(PriorityQueue::value_type(
+				priority(gdsfdata->mFrequency, size), GDSFElement(id, size)));
+	}
+
+	virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+		use(id, data, newsize);
+		CachePolicy::updateSpace(oldsize, newsize);
+	}
+
+	virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+		GDSFData *gdsfdata = static_cast<GDSFData*>(data);
+
+		CachePolicy::updateSpace(size, 0);
+
+		SILOG(transfer,debug,"[GDSFPolicy] Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+		mByPriority.erase(gdsfdata->mIter);
+		delete gdsfdata;
+	}
+
+	virtual Data* create(const Fingerprint &id, cache_usize_type size) {
+		CachePolicy::updateSpace(0, size);
+
+		return new GDSFData(mByPriority.insert(PriorityQueue::value_type(
+				priority(1, size), GDSFElement(id, size))));
+	}
+
+	virtual bool cachable(cache_usize_type requiredSpace) {
+		if (!CachePolicy::cachable(requiredSpace)) {
+			return false;
+		}
+		if (!mAdmissionControl) {
+			return true;
+		}
+		// Walk the entries nextItem() would evict, and refuse if any is worth more than the newcomer.
+		double newPriority = priority(1, requiredSpace);
+		cache_ssize_type freed = mFreeSpace;
+		for (PriorityQueue::const_iterator iter = mByPriority.begin();
+				freed < (cache_ssize_type)requiredSpace && iter != mByPriority.end();
+				++iter) {
+			if ((*iter).first > newPriority) {
+				SILOG(transfer,debug,"[GDSFPolicy] Not admitting " << requiredSpace << " bytes: would evict higher priority entries");
+				return false;
+			}
+			freed += (cache_ssize_type)(*iter).second.second;
+		}
+		return true;
+	}
+
+	virtual bool nextItem(
+			cache_usize_type requiredSpace,
+			Fingerprint &myprint)
+	{
+		if (mFreeSpace < (cache_ssize_type)requiredSpace && !mByPriority.empty()) {
+			mInflation = (*mByPriority.begin()).first;
+			myprint = (*mByPriority.begin()).second.first;
+			return true;
+		} else {
+			return false;
+		}
+	}
+};
+
+}
+}
+
+#endif /* SIRIKATA_GDSFPolicy_HPP__ */
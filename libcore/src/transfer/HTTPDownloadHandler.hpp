@@ -110,6 +110,39 @@ class HTTPDownloadHandler :
 		}
 	}
 
+	/// Calls cbs[i] with the entry for uris[i] in a batch reply, failing names the reply leaves out.
+	static void batchNameCallback(
+			const std::vector<URI> &uris,
+			const std::vector<NameLookupHandler::Callback> &cbs,
+			HTTPRequest* httpreq,
+			const DenseDataPtr &data,
+			bool success) {
+		NameLookupHandler::NameList names;
+		if (success && data) {
+			NameLookupHandler::parseNameList(*data, names);
+		} else {
+			SILOG(transfer,error,"HTTP batch name lookup failed for " << httpreq->getURI());
+		}
+		for (size_t i = 0; i < uris.size(); ++i) {
+			NameLookupHandler::NameList::const_iterator iter = names.find(uris[i].filename());
+			Fingerprint fp;
+			bool found = false;
+			if (iter != names.end() && !(*iter).second.empty()) {
+				try {
+					fp = Fingerprint::convertFromHex(URI(uris[i].context(), (*iter).second).filename());
+					found = true;
+				} catch (std::invalid_argument &e) {
+					SILOG(transfer,error,"HTTP batch name lookup gave " << (*iter).second << " for " << uris[i] << " which is not a hash URI!");
+				}
+			}
+			if (found) {
+				cbs[i](fp, (*iter).second, true);
+			} else {
+				cbs[i](Fingerprint(), std::string(), false);
+			}
+		}
+	}
+
 public:
 	/** Simple wrapper around HTTPRequest to download a URL.
 	 * The returned TransferDataPtr contains a shared reference to the HTTPRequest.
@@ -176,6 +209,37 @@ public:
 		}
 		req->go(req);
 	}
+
+	/// Name services that accept batches are listed with a "batch" parameter giving the most names per request.
+	virtual unsigned int maxNameBatch(const ServiceParams &params) const {
+		ServiceParams::const_iterator iter = params.find("batch");
+		if (iter == params.end()) {
+			return 1;
+		}
+		int maxBatch = atoi((*iter).second.c_str());
+		return maxBatch > 1 ? (unsigned int)maxBatch : 1;
+	}
+
+	/** POSTs the newline-separated filenames as the "names" field to the shared
+	 * directory URI. The reply uses the "name uri" lines of a names file.
+	 */
+	virtual void batchNameLookup(const ServiceParams &params, const std::vector<URI> &uris,
+			const std::vector<NameLookupHandler::Callback> &cbs) {
+		if (uris.size() == 1) {
+			nameLookup(NULL, uris[0], cbs[0]);
+			return;
+		}
+		std::string names;
+		for (std::vector<URI>::const_iterator iter = uris.begin(); iter != uris.end(); ++iter) {
+			names += (*iter).filename();
+			names += '\n';
+		}
+		HTTPRequestPtr req (new HTTPRequest(URI(uris[0].context().toString()), Range(true)));
+		req->addSimplePOSTField("names", names);
+		req->setCallback(
+			std::tr1::bind(&HTTPDownloadHandler::batchNameCallback, uris, cbs, _1, _2, _3));
+		req->go(req);
+	}
 };
 
 }
@@ -43,6 +43,10 @@
 #include <fcntl.h>
 
 #include <curl/curl.h>
+#include "network/TCPDefinitions.hpp"
+#ifndef _WIN32
+#include <boost/asio/posix/stream_descriptor.hpp>
+#endif
 
 namespace Sirikata {
 namespace Transfer {
@@ -93,7 +97,6 @@ size_t HTTPRequest::write(const unsigned char *copyFrom, size_t length) {
 	if (mData->length() < totalNeeded) {
 		mData->setLength(totalNeeded, mRequestedRange.goesToEndOfFile());
 	}
-	// FIXME: do not adjust the length until actually copying data.
 	unsigned char *copyTo = mData->writableData() + startByte;
 	std::copy(copyFrom, copyFrom + length, copyTo);
 	mOffset += length;
@@ -152,17 +155,32 @@ void HTTPRequest::gotHeader(const std::string &header) {
 	for (std::string::iterator iter = headername.begin(),iterend=headername.end();iter!=iterend; ++iter) {
 		*iter = tolower(*iter);
 	}
+	if (headername == "content-encoding" && headervalue != "identity" && !headervalue.empty()) {
+		// Content-Length counts encoded bytes; let write() size the data as it is decoded.
+		mContentEncoded = true;
+		mFullFilesizeOnServer = 0;
+		mData->setLength(0, mRequestedRange.goesToEndOfFile());
+	}
 	if (headername == "content-length") {
 		std::istringstream istr(headervalue);
 		cache_usize_type dataToReserve = 0;
 		istr >> dataToReserve;
 		if (dataToReserve) {
-			// FIXME: only reserve() here -- do not adjust the actual length until copying data.
-			mData->setLength(dataToReserve, mRequestedRange.goesToEndOfFile());
-			SILOG(transfer,debug,"Downloading file range " << (Range)(*mData) << " from "<<mURI);
-
-			if (mRequestedRange.startbyte() == 0 && mRequestedRange.goesToEndOfFile()) {
-				mFullFilesizeOnServer = dataToReserve;
+			if (mRequestedRange.length() == 0 && !mRequestedRange.goesToEndOfFile()) {
+				// A HEAD request receives no body: its data's range reports the size.
+				if (!mContentEncoded) {
+					mData->setLength(dataToReserve, false);
+				}
+			} else {
+				// Allocate once: write() only sets the length as the data is copied in.
+				// Decoded content is at least as long as the encoded bytes counted here.
+				mData->reserve((size_t)dataToReserve);
+			}
+			if (!mContentEncoded) {
+				SILOG(transfer,debug,"Downloading " << dataToReserve << " bytes at " << mData->startbyte() << " from "<<mURI);
+				if (mRequestedRange.startbyte() == 0 && mRequestedRange.goesToEndOfFile()) {
+					mFullFilesizeOnServer = dataToReserve;
+				}
 			}
 		}
 	}
@@ -184,6 +202,19 @@ void HTTPRequest::gotHeader(const std::string &header) {
 
 namespace {
 
+	OptionValue *maxConnects;
+	OptionValue *hostTransfers;
+	OptionValue *multiplex;
+	OptionValue *shareCache;
+	OptionValue *compression;
+	InitializeGlobalOptions o("",
+		maxConnects=new OptionValue("httpmaxconnects","8",OptionValueType<uint32>(),"idle HTTP connections kept open for reuse across all servers (raise on servers that fetch from many hosts)"),
+		hostTransfers=new OptionValue("httphosttransfers","2",OptionValueType<uint32>(),"HTTP transfers in progress at once per server path; the rest wait their turn"),
+		multiplex=new OptionValue("httpmultiplex","false",OptionValueType<bool>(),"send concurrent transfers to one server over a single connection where it supports it"),
+		shareCache=new OptionValue("httpsharecache","true",OptionValueType<bool>(),"share the DNS and TLS session caches between all HTTP transfers"),
+		compression=new OptionValue("httpcompression","true",OptionValueType<bool>(),"ask servers to gzip (or zstd, if curl supports it) whole file downloads, decoding them as they arrive"),
+		NULL);
+
 	struct ServerProperties {
 		bool does_not_support_Expect_100_continue;
 		std::list<HTTPRequest*> pendingtransfers;
@@ -205,12 +236,29 @@ namespace {
 		return defaultProps;
 	}
 	ServerProperties &editProperties(const URI &uri) {
-		return properties[uri.host()+'/'+uri.basepath()];
+		std::pair<ServerPropertyMap::iterator, bool> ins = properties.insert(
+			ServerPropertyMap::value_type(uri.host()+'/'+uri.basepath(), ServerProperties()));
+		if (ins.second) {
+			(*ins.first).second.maxTransfers = std::max(1, (int)hostTransfers->as<uint32>());
+		}
+		return (*ins.first).second;
 	}
 
 	static boost::once_flag flag = BOOST_ONCE_INIT;
 	CURLM *curlm = NULL;
 	CURL *parent_easy_curl = NULL;
+	/// DNS and TLS sessions shared by every easy handle, or NULL if httpsharecache is off.
+	CURLSH *curlsh = NULL;
+	/// If set, transfers are driven from this IOService instead of curlLoop.
+	Network::IOService *curlIO = NULL;
+	boost::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+	void lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+		shareLocks[data].lock();
+	}
+	void unlockShare(CURL *handle, curl_lock_data data, void *userptr) {
+		shareLocks[data].unlock();
+	}
 
 	//static ThreadSafeQueue<HTTPRequest*> requestQueue;
 	struct CurlGlobals {
@@ -297,12 +345,178 @@ namespace {
 				if (curlm) {
 					curl_multi_cleanup(curlm);
 				}
+				if (curlsh) {
+					curl_share_cleanup(curlsh);
+				}
 				curl_global_cleanup();
 			}
 		}
 	} globals;
 }
 
+/**
+ * Runs curl_multi from an IOService: curl tells us which sockets to watch
+ * and when to time out, and asio calls curl_multi_socket_action when they
+ * are ready.  Every member is guarded by globals.http_lock, which curl
+ * already holds whenever it calls socketCallback or timerCallback.
+ */
+struct CurlIODriver {
+#ifndef _WIN32
+	struct Socket {
+		boost::asio::posix::stream_descriptor desc;
+		curl_socket_t fd;
+		int what; ///< the CURL_POLL_* curl is waiting for.
+		bool reading;
+		bool writing;
+		bool removed;
+
+		Socket(Network::IOService &io, curl_socket_t fd)
+			: desc(io), fd(fd), what(CURL_POLL_NONE),
+			reading(false), writing(false), removed(false) {
+			desc.assign(fd);
+		}
+	};
+	typedef std::tr1::shared_ptr<Socket> SocketPtr;
+	typedef std::map<curl_socket_t, SocketPtr> SocketMap;
+
+	static SocketMap sockets;
+	static boost::asio::deadline_timer *timer;
+
+	static void watch(const SocketPtr &sock) {
+		using std::tr1::placeholders::_1;
+		if ((sock->what & CURL_POLL_IN) && !sock->reading) {
+			sock->reading = true;
+			sock->desc.async_read_some(boost::asio::null_buffers(),
+				std::tr1::bind(&CurlIODriver::socketReady, sock, (int)CURL_CSELECT_IN, _1));
+		}
+		if ((sock->what & CURL_POLL_OUT) && !sock->writing) {
+			sock->writing = true;
+			sock->desc.async_write_some(boost::asio::null_buffers(),
+				std::tr1::bind(&CurlIODriver::socketReady, sock, (int)CURL_CSELECT_OUT, _1));
+		}
+	}
+
+	/// Stops asio from using the fd without closing it; curl owns the socket.
+	static void forget(const SocketPtr &sock) {
+		boost::system::error_code ec;
+		sock->removed = true;
+		sock->desc.cancel(ec);
+		sock->desc.release();
+	}
+
+	static int socketCallback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp) {
+		SocketMap::iterator iter = sockets.find(fd);
+		if (what == CURL_POLL_REMOVE) {
+			if (iter != sockets.end()) {
+				forget((*iter).second);
+				sockets.erase(iter);
+			}
+			return 0;
+		}
+		if (iter == sockets.end()) {
+			iter = sockets.insert(SocketMap::value_type(fd, SocketPtr(new Socket(*curlIO, fd)))).first;
+		}
+		(*iter).second->what = what;
+		watch((*iter).second);
+		return 0;
+	}
+
+	static void socketReady(const SocketPtr &sock, int direction, const boost::system::error_code &ec) {
+		{
+			boost::lock_guard<boost::mutex> access_curl_handle(globals.http_lock);
+			if (direction == CURL_CSELECT_IN) {
+				sock->reading = false;
+			} else {
+				sock->writing = false;
+			}
+			if (sock->removed || ec == boost::asio::error::operation_aborted) {
+				return;
+			}
+			int running;
+			curl_multi_socket_action(curlm, sock->fd, direction | (ec ? CURL_CSELECT_ERR : 0), &running);
+			if (!sock->removed) {
+				watch(sock); // curl wants to hear about the socket again.
+			}
+		}
+		HTTPRequest::finishTransfers();
+	}
+
+	static int timerCallback(CURLM *multi, long timeout_ms, void *userp) {
+		using std::tr1::placeholders::_1;
+		if (timeout_ms < 0) {
+			timer->cancel();
+		} else {
+			timer->expires_from_now(boost::posix_time::milliseconds(timeout_ms));
+			timer->async_wait(std::tr1::bind(&CurlIODriver::timerFired, _1));
+		}
+		return 0;
+	}
+
+	static void timerFired(const boost::system::error_code &ec) {
+		if (ec == boost::asio::error::operation_aborted) {
+			return;
+		}
+		{
+			boost::lock_guard<boost::mutex> access_curl_handle(globals.http_lock);
+			if (!curlIO) {
+				return;
+			}
+			int running;
+			curl_multi_socket_action(curlm, CURL_SOCKET_TIMEOUT, 0, &running);
+		}
+		HTTPRequest::finishTransfers();
+	}
+
+	/// Called from initCurl.
+	static void attach() {
+		timer = new boost::asio::deadline_timer(*curlIO);
+		curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION, &CurlIODriver::socketCallback);
+		curl_multi_setopt(curlm, CURLMOPT_TIMERFUNCTION, &CurlIODriver::timerCallback);
+	}
+
+	/// Lets go of every descriptor and the timer before the IOService goes away.
+	static void detach() {
+		boost::lock_guard<boost::mutex> access_curl_handle(globals.http_lock);
+		for (SocketMap::iterator iter = sockets.begin(); iter != sockets.end(); ++iter) {
+			forget((*iter).second);
+		}
+		sockets.clear();
+		if (timer) {
+			curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION, NULL);
+			curl_multi_setopt(curlm, CURLMOPT_TIMERFUNCTION, NULL);
+			timer->cancel();
+			delete timer;
+			timer = NULL;
+		}
+		curlIO = NULL;
+	}
+#endif
+};
+#ifndef _WIN32
+CurlIODriver::SocketMap CurlIODriver::sockets;
+boost::asio::deadline_timer *CurlIODriver::timer = NULL;
+#endif
+
+void HTTPRequest::setIOService(Network::IOService *io) {
+#ifdef _WIN32
+	if (io) {
+		SILOG(transfer,warning,"HTTPRequest cannot run on an IOService on Windows; using the curl thread.");
+	}
+#else
+	if (!io) {
+		if (curlIO) {
+			CurlIODriver::detach();
+		}
+		return;
+	}
+	if (curlm) {
+		SILOG(transfer,error,"HTTPRequest::setIOService must be called before the first request.");
+		return;
+	}
+	curlIO = io;
+#endif
+}
+
 CURL *HTTPRequest::allocDefaultCurl() {
 	CURL *mycurl = curl_easy_init( );
 	curl_easy_setopt(mycurl, CURLOPT_VERBOSE, 0);
@@ -317,6 +531,9 @@ CURL *HTTPRequest::allocDefaultCurl() {
 	curl_easy_setopt(mycurl, CURLOPT_USERAGENT, "Sirikata/0.1 (" __DATE__ ")");
 	curl_easy_setopt(mycurl, CURLOPT_CONNECTTIMEOUT, 5);
 	// curl_easy_setopt(mycurl, CURLOPT_TIMEOUT, ...); // if the connection is tarpitted by a nasty firewall...
+	if (curlsh) {
+		curl_easy_setopt(mycurl, CURLOPT_SHARE, curlsh);
+	}
 
 	// CURLOPT_DNS_USE_GLOBAL_CACHE: WARNING: this option is considered obsolete. Stop using it. Switch over to using the share interface instead! See CURLOPT_SHARE and curl_share_init(3).
 	// From curl_multi_add_handle: If the easy handle is not set to use a shared (CURLOPT_SHARE) or global DNS cache (CURLOPT_DNS_USE_GLOBAL_CACHE), it will be made to use the DNS cache that is shared between all easy handles within the multi handle when curl_multi_add_handle(3) is called.
@@ -357,82 +574,115 @@ void HTTPRequest::initCurl () {
 	curl_global_init(CURL_GLOBAL_ALL);
 	curlm = curl_multi_init();
 #ifndef _WIN32
-	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, 0);
-	curl_multi_setopt(curlm, CURLMOPT_MAXCONNECTS, 8); // make higher if a server.
+	long pipelining = 0;
+	if (multiplex->as<bool>()) {
+#ifdef CURLPIPE_MULTIPLEX
+		pipelining = CURLPIPE_MULTIPLEX;
+#else
+		pipelining = 1; // HTTP/1.1 pipelining on curl without HTTP/2.
+#endif
+	}
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, pipelining);
+	curl_multi_setopt(curlm, CURLMOPT_MAXCONNECTS, (long)maxConnects->as<uint32>());
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	// Do not let curl open more connections per host than we run transfers.
+	curl_multi_setopt(curlm, CURLMOPT_MAX_HOST_CONNECTIONS, (long)std::max(1, (int)hostTransfers->as<uint32>()));
+#endif
 #endif
+	if (shareCache->as<bool>()) {
+		curlsh = curl_share_init();
+		curl_share_setopt(curlsh, CURLSHOPT_LOCKFUNC, &lockShare);
+		curl_share_setopt(curlsh, CURLSHOPT_UNLOCKFUNC, &unlockShare);
+		curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
 	// CURLOPT_PROGRESSFUNCTION may be useful for determining whether to timeout during an active connection.
 	parent_easy_curl = allocDefaultCurl();
 
+#ifndef _WIN32
+	if (curlIO) {
+		CurlIODriver::attach();
+		return;
+	}
+#endif
 	globals.main_loop = new boost::thread(&curlLoop);
 
 }
 
-void HTTPRequest::curlLoop () {
-	while (!globals.cleaningUp) {
-		int numevents;
-
-		while (true) {
-			boost::unique_lock<boost::mutex> access_curl_handle(globals.http_lock);
-			CURLMsg *transferMsg = curl_multi_info_read(curlm, &numevents);
-			if (transferMsg == NULL) {
-				break;
-			}
-			CURL *handle = transferMsg->easy_handle;
-			void *dataptr;
-			curl_easy_getinfo(handle, CURLINFO_PRIVATE, &dataptr);
-
-			if (transferMsg->msg == CURLMSG_DONE) {
-				HTTPRequest *request = (HTTPRequest*)dataptr;
-				bool success;
-				curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &request->mStatusCode);
-				bool retry = false; // Only retry if ServerProperties has changed! Do not want to get stuck in an infinite loop.
-				if (transferMsg->data.result == 0) {
-					success = true;
-				} else {
-					// CURLE_RANGE_ERROR
-					// CURLE_HTTP_RETURNED_ERROR
-					std::stringstream str;
-					str << curl_easy_strerror(transferMsg->data.result) <<
-							" (" << request->mStatusCode << ") for " << request->mURI;
-					SILOG(transfer,info,str.str());
-					success = false;
-					if (request->mStatusCode == 417) {
-						editProperties(request->mURI).does_not_support_Expect_100_continue = true;
-						retry = true;
-					}
+void HTTPRequest::finishTransfers () {
+	int numevents;
+	while (true) {
+		boost::unique_lock<boost::mutex> access_curl_handle(globals.http_lock);
+		CURLMsg *transferMsg = curl_multi_info_read(curlm, &numevents);
+		if (transferMsg == NULL) {
+			break;
+		}
+		CURL *handle = transferMsg->easy_handle;
+		void *dataptr;
+		curl_easy_getinfo(handle, CURLINFO_PRIVATE, &dataptr);
+
+		if (transferMsg->msg == CURLMSG_DONE) {
+			HTTPRequest *request = (HTTPRequest*)dataptr;
+			bool success;
+			curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &request->mStatusCode);
+			bool retry = false; // Only retry if ServerProperties has changed! Do not want to get stuck in an infinite loop.
+			if (transferMsg->data.result == 0) {
+				success = true;
+				if (request->mContentEncoded && request->mRequestedRange.startbyte() == 0) {
+					request->mFullFilesizeOnServer = request->mData->length();
+				}
+			} else {
+				// CURLE_RANGE_ERROR
+				// CURLE_HTTP_RETURNED_ERROR
+				std::stringstream str;
+				str << curl_easy_strerror(transferMsg->data.result) <<
+						" (" << request->mStatusCode << ") for " << request->mURI;
+				SILOG(transfer,info,str.str());
+				success = false;
+				if (request->mStatusCode == 417) {
+					editProperties(request->mURI).does_not_support_Expect_100_continue = true;
+					retry = true;
 				}
+			}
 
-				curl_multi_remove_handle(curlm, handle);
-				curl_easy_cleanup(handle);
-
-				if (retry) {
-					request->initCurlHandle();
-					request->setFinalProperties();
-					curl_multi_add_handle(curlm, request->mCurlRequest);
-				} else {
-					request->mCurlRequest = NULL; // handle is freed.
-					request->mState = FINISHED;
-					CallbackFunc temp (request->mCallback);
-					DenseDataPtr finishedData(request->getData());
-					request->mCallback = nullCallback;
-
-					std::tr1::shared_ptr<HTTPRequest> tempPtr (request->mPreventDeletion);
-					request->mPreventDeletion.reset(); // won't be freed until tempPtr goes out of scope.
-
-					editProperties(request->mURI).activeTransfers--;
-					std::list<HTTPRequest*> *pendingtransfers = &editProperties(request->mURI).pendingtransfers;
-					if (!pendingtransfers->empty()) {
-						pendingtransfers->back()->finalGo();
-						pendingtransfers->pop_back();
-					}
-
-					access_curl_handle.unlock(); // UNLOCK: the callback may start a new HTTP transfer.
-					temp(request, finishedData, success); // may delete request.
-					// now tempPtr is allowed to free request.
-					//access_curl_handle.lock();
+			curl_multi_remove_handle(curlm, handle);
+			curl_easy_cleanup(handle);
+
+			if (retry) {
+				request->initCurlHandle();
+				request->setFinalProperties();
+				curl_multi_add_handle(curlm, request->mCurlRequest);
+			} else {
+				request->mCurlRequest = NULL; // handle is freed.
+				request->mState = FINISHED;
+				CallbackFunc temp (request->mCallback);
+				DenseDataPtr finishedData(request->getData());
+				request->mCallback = nullCallback;
+
+				std::tr1::shared_ptr<HTTPRequest> tempPtr (request->mPreventDeletion);
+				request->mPreventDeletion.reset(); // won't be freed until tempPtr goes out of scope.
+
+				editProperties(request->mURI).activeTransfers--;
+				std::list<HTTPRequest*> *pendingtransfers = &editProperties(request->mURI).pendingtransfers;
+				if (!pendingtransfers->empty()) {
+					pendingtransfers->back()->finalGo();
+					pendingtransfers->pop_back();
 				}
+
+				access_curl_handle.unlock(); // UNLOCK: the callback may start a new HTTP transfer.
+				temp(request, finishedData, success); // may delete request.
+				// now tempPtr is allowed to free request.
+				//access_curl_handle.lock();
 			}
 		}
+	}
+}
+
+void HTTPRequest::curlLoop () {
+	while (!globals.cleaningUp) {
+		int numevents;
+
+		finishTransfers();
 
 		fd_set read_fd_set, write_fd_set, exc_fd_set;
 		long timeout_ms=0;
@@ -527,6 +777,7 @@ void HTTPRequest::initCurlHandle() {
 	mStatusCode = 0;
 	mOffset = 0;
 	mFullFilesizeOnServer = 0;
+	mContentEncoded = false;
 	mData = MutableDenseDataPtr(new DenseData(mRequestedRange));
 	mUploadOffset = 0;
 
@@ -568,6 +819,10 @@ void HTTPRequest::initCurlHandle() {
 	if (nontrivialRange) {
 		mRangeString = orangestring.str();
 		curl_easy_setopt(mCurlRequest, CURLOPT_RANGE, mRangeString.c_str());
+	} else if (mRequestedRange.goesToEndOfFile() && compression->as<bool>()) {
+		// Byte ranges of an encoded body are not ranges of the file, so only whole files are negotiated.
+		// An empty string offers every encoding this curl was built with.
+		curl_easy_setopt(mCurlRequest, CURLOPT_ENCODING, "");
 	}
 }
 
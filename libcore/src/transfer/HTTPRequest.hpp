@@ -40,6 +40,9 @@
 extern "C" struct curl_httppost;
 
 namespace Sirikata {
+namespace Network {
+class IOService;
+}
 namespace Transfer {
 
 
@@ -82,6 +85,8 @@ private:
 
 	Range::base_type mOffset;
 	Range::length_type mFullFilesizeOnServer;
+	/// The server compressed the body; curl decodes it, so Content-Length is not the size we get.
+	bool mContentEncoded;
 	MutableDenseDataPtr mData;
 
 	/** The default callback--useful for POST queries where you do not care about the response */
@@ -93,6 +98,8 @@ private:
 	void gotHeader(const std::string &header);
 
 	static void curlLoop();
+	/// Hands finished transfers to their callbacks; takes the curl lock itself.
+	static void finishTransfers();
 	static void initCurl();
 	static void destroyCurl();
 	static CURL *allocDefaultCurl();
@@ -106,8 +113,17 @@ private:
 	void finalGo(); ///< Actually performs the request, if not too many connections are active.
 
 	HTTPRequest(const HTTPRequest &other);
+	friend struct CurlIODriver;
 public:
 
+	/**
+	 * Runs every transfer from io's event loop through curl_multi_socket_action
+	 * instead of a dedicated curl thread, so callbacks arrive on whichever thread
+	 * runs io.  Must be called before the first request is made; call it again
+	 * with NULL before destroying io.  Only supported on POSIX systems.
+	 */
+	static void setIOService(Network::IOService *io);
+
 	/** Do not ever use this--it is not thread safe, and the DenseDataPtr
 	 is passed to the callback anyway. May be made private */
 	inline const MutableDenseDataPtr &getData() {
@@ -36,6 +36,7 @@
 
 #include "CacheLayer.hpp"
 #include "CacheMap.hpp"
+#include "util/Metrics.hpp"
 
 namespace Sirikata {
 /** MemoryCacheLayer.hpp -- MemoryCacheLayer -- the first layer of transfer cache. */
@@ -51,6 +52,8 @@ public:
 private:
 	typedef CacheMap MemoryMap;
 	MemoryMap mData;
+	Metrics::Counter mHits;
+	Metrics::Counter mMisses;
 
 protected:
 	virtual void populateCache(const Fingerprint &fileId, const DenseDataPtr &respondData) {
@@ -91,7 +94,9 @@ protected:
 public:
 	MemoryCacheLayer(CachePolicy *policy, CacheLayer *tryNext)
 			: CacheLayer(tryNext),
-			mData(this, policy) {
+			mData(this, policy),
+			mHits("cache.memory.hits", "requests answered from memory"),
+			mMisses("cache.memory.misses", "requests passed on to the next cache layer") {
 	}
 
 	virtual void purgeFromCache(const Fingerprint &fileId) {
@@ -103,7 +108,7 @@ public:
 	}
 
 	virtual void getData(const RemoteFileId &uri, const Range &requestedRange,
-			const TransferCallback&callback) {
+			const TransferCallback&callback, TransferPriority priority=FOREGROUND_PRIORITY) {
 		bool haveData = false;
 		SparseData foundData;
 		{
@@ -130,9 +135,11 @@ public:
 					++iter) {
 				CacheLayer::populateParentCaches(uri.fingerprint(), iter.getPtr());
 			}
+			mHits.increment();
 			callback(&foundData);
 		} else {
-			CacheLayer::getData(uri, requestedRange, callback);
+			mMisses.increment();
+			CacheLayer::getData(uri, requestedRange, callback, priority);
 		}
 	}
 };
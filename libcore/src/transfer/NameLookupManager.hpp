@@ -38,6 +38,9 @@
 #include "ServiceManager.hpp"
 #include "ServiceLookup.hpp"
 #include "DownloadHandler.hpp"
+#include "util/AtomicTypes.hpp"
+
+#include <boost/thread/mutex.hpp>
 
 namespace Sirikata {
 namespace Transfer {
@@ -56,11 +59,94 @@ class NameLookupManager {
 	 */
 	ServiceManager<DownloadHandler> *mDownloadServ; // check if someone referenced a file by hash direct
 
+	/** Lookups for one name service that arrive while a request to it is in flight
+	 * wait here, and go out together once it comes back. */
+	struct PendingBatch {
+		std::tr1::shared_ptr<NameLookupHandler> handler;
+		ServiceParams params;
+		unsigned int maxBatch;
+		std::vector<URI> uris;
+		std::vector<NameLookupHandler::Callback> cbs;
+	};
+	/// Keyed by the URIContext of the lookup URIs; only services in the middle of a request have an entry.
+	typedef std::map<std::string, PendingBatch> BatchMap;
+	BatchMap mBatches;
+	boost::mutex mBatchLock;
+
 public:
 	/** Called with a temporary pointer to a fingerprint, or NULL if the lookup failed. */
 	typedef std::tr1::function<void(const URI &namedURI, const RemoteFileId *fingerprint)> Callback;
 
 private:
+	/// Moves up to maxBatch waiting names into uris and cbs; needs mBatchLock.
+	static void takeBatch(PendingBatch &batch, std::vector<URI> &uris, std::vector<NameLookupHandler::Callback> &cbs) {
+		size_t count = std::min((size_t)batch.maxBatch, batch.uris.size());
+		uris.assign(batch.uris.begin(), batch.uris.begin() + count);
+		cbs.assign(batch.cbs.begin(), batch.cbs.begin() + count);
+		batch.uris.erase(batch.uris.begin(), batch.uris.begin() + count);
+		batch.cbs.erase(batch.cbs.begin(), batch.cbs.begin() + count);
+	}
+
+	void sendBatch(const std::string &key, const std::tr1::shared_ptr<NameLookupHandler> &handler,
+			const ServiceParams &params, const std::vector<URI> &uris,
+			const std::vector<NameLookupHandler::Callback> &cbs) {
+		std::tr1::shared_ptr<AtomicValue<int> > remaining(new AtomicValue<int>((int)uris.size()));
+		std::vector<NameLookupHandler::Callback> answered;
+		for (size_t i = 0; i < cbs.size(); ++i) {
+			answered.push_back(std::tr1::bind(&NameLookupManager::batchAnswered, this, key, remaining, cbs[i], _1, _2, _3));
+		}
+		handler->batchNameLookup(params, uris, answered);
+	}
+
+	void batchAnswered(const std::string &key, const std::tr1::shared_ptr<AtomicValue<int> > &remaining,
+			const NameLookupHandler::Callback &cb, const Fingerprint &hash, const std::string &str, bool success) {
+		cb(hash, str, success);
+		if (--(*remaining) != 0) {
+			return;
+		}
+		std::vector<URI> uris;
+		std::vector<NameLookupHandler::Callback> cbs;
+		std::tr1::shared_ptr<NameLookupHandler> handler;
+		ServiceParams params;
+		{
+			boost::unique_lock<boost::mutex> lock(mBatchLock);
+			BatchMap::iterator iter = mBatches.find(key);
+			if ((*iter).second.uris.empty()) {
+				mBatches.erase(iter);
+				return;
+			}
+			takeBatch((*iter).second, uris, cbs);
+			handler = (*iter).second.handler;
+			params = (*iter).second.params;
+		}
+		sendBatch(key, handler, params, uris, cbs);
+	}
+
+	/** Sends a lookup right away if its service is idle, otherwise holds it
+	 * for the batch that goes out when the current request returns. */
+	void queueLookup(const std::tr1::shared_ptr<NameLookupHandler> &handler, const ServiceParams &params,
+			unsigned int maxBatch, const URI &lookupUri, const NameLookupHandler::Callback &cb) {
+		std::string key = lookupUri.context().toString();
+		std::vector<URI> uris;
+		std::vector<NameLookupHandler::Callback> cbs;
+		{
+			boost::unique_lock<boost::mutex> lock(mBatchLock);
+			BatchMap::iterator iter = mBatches.find(key);
+			if (iter != mBatches.end()) {
+				(*iter).second.uris.push_back(lookupUri);
+				(*iter).second.cbs.push_back(cb);
+				return;
+			}
+			PendingBatch &batch = mBatches[key];
+			batch.handler = handler;
+			batch.params = params;
+			batch.maxBatch = maxBatch;
+		}
+		uris.push_back(lookupUri);
+		cbs.push_back(cb);
+		sendBatch(key, handler, params, uris, cbs);
+	}
+
 	void gotNameLookup(const Callback &cb, const URI &origNamedUri, ServiceIterator *services,
 			const Fingerprint &hash, const std::string &str, bool success) {
 		if (!success) {
@@ -100,8 +186,14 @@ private:
 		std::tr1::shared_ptr<NameLookupHandler> handler;
 		if (mNameServ->getNextProtocol(services,reason,origNamedUri,lookupUri,params,handler)) {
 			/// FIXME: Need a way of aborting a name lookup that is taking too long.
-			handler->nameLookup(NULL, lookupUri,
+			NameLookupHandler::Callback gotLookup(
 				std::tr1::bind(&NameLookupManager::gotNameLookup, this, cb, origNamedUri, services, _1, _2, _3));
+			unsigned int maxBatch = handler->maxNameBatch(params);
+			if (maxBatch > 1) {
+				queueLookup(handler, params, maxBatch, lookupUri, gotLookup);
+			} else {
+				handler->nameLookup(NULL, lookupUri, gotLookup);
+			}
 		} else {
 			SILOG(transfer,warn,"None of the services registered for " <<
 					origNamedUri << " were successful for NameLookup.");
@@ -38,6 +38,7 @@
 #include "ServiceManager.hpp"
 #include "ServiceLookup.hpp"
 #include "DownloadHandler.hpp"
+#include "util/Metrics.hpp"
 
 #include <boost/thread.hpp>
 namespace Sirikata {
@@ -49,13 +50,35 @@ namespace Transfer {
 class NetworkCacheLayer : public CacheLayer {
 	struct RequestInfo {
 		DownloadHandler::TransferDataPtr httpreq;
-		TransferCallback callback;
+		/// Everyone waiting on this download: the first requester plus any that joined while it was in flight.
+		std::list<TransferCallback> callbacks;
 		RemoteFileId fileId;
 		Range range;
 		ServiceIterator* serviter;
+		/// Set once the callbacks have been taken, so no new request can join.
+		bool finished;
+		/// The highest priority of anyone waiting.
+		TransferPriority priority;
+		/// False while a prefetch waits in mPrefetchQueue for a free slot.
+		bool started;
+		/// Counted in mNumPrefetching.
+		bool holdsPrefetchSlot;
 
-		RequestInfo(const RemoteFileId &fileId, const Range &range, const TransferCallback &cb)
-			: callback(cb), fileId(fileId), range(range), serviter(NULL) {
+		/// The service currently downloading, kept so the remaining pieces of a split download can use it.
+		std::tr1::shared_ptr<DownloadHandler> handler;
+		URI lookupUri;
+		/// Pieces of a split download still in flight, and what has arrived so far.
+		std::vector<DownloadHandler::TransferDataPtr> pieceReqs;
+		SparseData pieces;
+		unsigned int piecesLeft;
+		bool pieceFailed;
+
+		RequestInfo(const RemoteFileId &fileId, const Range &range, const TransferCallback &cb,
+				TransferPriority priority)
+			: fileId(fileId), range(range), serviter(NULL), finished(false),
+			priority(priority), started(false), holdsPrefetchSlot(false),
+			piecesLeft(0), pieceFailed(false) {
+			callbacks.push_back(cb);
 		}
 
 		~RequestInfo() {
@@ -65,32 +88,221 @@ class NetworkCacheLayer : public CacheLayer {
 		}
 	};
 
+	typedef std::list<RequestInfo>::iterator RequestIterator;
+
 	volatile bool cleanup;
 	std::list<RequestInfo> mActiveTransfers;
 	ServiceManager<DownloadHandler> *mService;
 	boost::mutex mActiveTransferLock; ///< for abort.
 	boost::condition_variable mCleanupCV;
 
-	void httpCallback(std::list<RequestInfo>::iterator iter, DenseDataPtr recvData, bool success) {
-		RequestInfo &info = *iter;
-		if (recvData && success) {
-			// Now go back through the chain!
-			CacheLayer::populateParentCaches(info.fileId.fingerprint(), recvData);
-			SparseData data;
-			data.addValidData(recvData);
-			info.serviter->finished(ServiceIterator::SUCCESS);
-			info.serviter = NULL; // avoid double-free in RequestInfo destructor.
-			info.callback(&data);
+	/// Prefetches beyond mMaxPrefetching wait here, oldest first, so they never hold up foreground downloads.
+	std::deque<RequestIterator> mPrefetchQueue;
+	unsigned int mNumPrefetching;
+	/// 0 for no limit.
+	unsigned int mMaxPrefetching;
+
+	/// Whole-file requests start with a request for this many bytes; 0 disables splitting.
+	cache_usize_type mSplitSize;
+	/// The most Range requests to have in flight for the rest of a split file.
+	unsigned int mNumParallel;
+
+	Metrics::Counter mDownloads;
+	Metrics::Counter mMerged;
+
+	inline bool splitting(const Range &range) const {
+		return mSplitSize && mNumParallel > 1 &&
+			range.startbyte() == 0 && range.goesToEndOfFile();
+	}
+
+	/// Marks data starting at byte 0 as the whole file, without copying it.
+	static DenseDataPtr asWholeFile(const DenseDataPtr &data) {
+		if (data->goesToEndOfFile()) {
+			return data;
+		}
+		std::tr1::shared_ptr<void> owner(std::tr1::const_pointer_cast<DenseData>(data));
+		return DenseDataPtr(new DenseData(Range(data->startbyte(), data->length(), LENGTH, true),
+				data->data(), owner));
+	}
+
+	/**
+	 * Closes a request to new joiners and hands back everyone waiting on it.
+	 * @param iter    The request that finished or failed.
+	 * @param waiters Receives the callbacks; call them without holding any lock.
+	 */
+	void takeCallbacks(std::list<RequestInfo>::iterator iter, std::list<TransferCallback> &waiters) {
+		boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
+		(*iter).finished = true;
+		waiters.swap((*iter).callbacks);
+	}
+
+	/// Marks a request as started; needs mActiveTransferLock.
+	void claimSlot(RequestIterator iter) {
+		(*iter).started = true;
+		if ((*iter).priority == PREFETCH_PRIORITY) {
+			(*iter).holdsPrefetchSlot = true;
+			++mNumPrefetching;
+		}
+	}
+
+	/// Moves queued prefetches into toStart while slots are free; needs mActiveTransferLock.
+	void nextPrefetches(std::vector<RequestIterator> &toStart) {
+		while (!cleanup && !mPrefetchQueue.empty() &&
+				(mMaxPrefetching == 0 || mNumPrefetching < mMaxPrefetching)) {
+			RequestIterator next = mPrefetchQueue.front();
+			mPrefetchQueue.pop_front();
+			claimSlot(next);
+			toStart.push_back(next);
+		}
+	}
+
+	/// Gives a request a higher priority, starting it if it was queued; needs mActiveTransferLock.
+	void promote(RequestIterator iter, TransferPriority priority, std::vector<RequestIterator> &toStart) {
+		if (priority <= (*iter).priority) {
+			return;
+		}
+		(*iter).priority = priority;
+		if (!(*iter).started) {
+			mPrefetchQueue.erase(std::find(mPrefetchQueue.begin(), mPrefetchQueue.end(), iter));
+			claimSlot(iter);
+			toStart.push_back(iter);
+		} else if ((*iter).holdsPrefetchSlot) {
+			(*iter).holdsPrefetchSlot = false;
+			--mNumPrefetching;
+			nextPrefetches(toStart);
+		}
+	}
+
+	/// Call without holding mActiveTransferLock: the lookup may finish synchronously.
+	void startRequests(const std::vector<RequestIterator> &toStart) {
+		for (std::vector<RequestIterator>::const_iterator iter = toStart.begin(); iter != toStart.end(); ++iter) {
+			mService->lookupService((**iter).fileId.uri().context(),
+					std::tr1::bind(&NetworkCacheLayer::gotServices, this, *iter, _1));
+		}
+	}
 
+	void eraseRequest(std::list<RequestInfo>::iterator iter) {
+		std::vector<RequestIterator> toStart;
+		{
 			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
+			if ((*iter).holdsPrefetchSlot) {
+				--mNumPrefetching;
+				nextPrefetches(toStart);
+			}
 			mActiveTransfers.erase(iter);
 			mCleanupCV.notify_one();
+		}
+		startRequests(toStart);
+	}
+
+	void httpCallback(std::list<RequestInfo>::iterator iter, DenseDataPtr recvData, bool success, cache_usize_type fileSize) {
+		RequestInfo &info = *iter;
+		if (recvData && success) {
+			if (splitting(info.range) && !recvData->goesToEndOfFile()) {
+				if (startPieces(iter, recvData, fileSize)) {
+					return;
+				}
+				recvData = asWholeFile(recvData);
+			}
+			finishFetch(iter, recvData);
 		} else {
 			// todo: add a more specific error code instead of 'bool success'.
 			doFetch(iter, ServiceIterator::GENERAL_ERROR);
 		}
 	}
 
+	/**
+	 * Requests the rest of a file whose first mSplitSize bytes have arrived,
+	 * as up to mNumParallel Range requests of at least mSplitSize each.
+	 *
+	 * @param first     The data from the first request.
+	 * @param fileSize  The size reported by the server, or 0 if unknown.
+	 * @returns         false if first was already the whole file.
+	 */
+	bool startPieces(std::list<RequestInfo>::iterator iter, const DenseDataPtr &first, cache_usize_type fileSize) {
+		RequestInfo &info = *iter;
+		cache_usize_type received = first->endbyte();
+		if (fileSize ? (fileSize <= received) : (first->length() < mSplitSize)) {
+			return false;
+		}
+		std::vector<Range> ranges;
+		if (fileSize) {
+			cache_usize_type rest = fileSize - received;
+			cache_usize_type numPieces = (rest + mSplitSize - 1) / mSplitSize;
+			if (numPieces > mNumParallel) {
+				numPieces = mNumParallel;
+			}
+			cache_usize_type pieceLength = (rest + numPieces - 1) / numPieces;
+			for (cache_usize_type start = received; start < fileSize; start += pieceLength) {
+				if (start + pieceLength >= fileSize) {
+					ranges.push_back(Range(start, fileSize, BOUNDS, true));
+				} else {
+					ranges.push_back(Range(start, pieceLength, LENGTH));
+				}
+			}
+		} else {
+			// Without a size there is nothing to split; fetch the remainder in one go.
+			ranges.push_back(Range(received, true));
+		}
+		{
+			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
+			info.pieces.clear();
+			info.pieces.addValidData(first);
+			info.piecesLeft = (unsigned int)ranges.size();
+			info.pieceFailed = false;
+			info.pieceReqs.assign(ranges.size(), DownloadHandler::TransferDataPtr());
+		}
+		SILOG(transfer,debug,"Fetching the rest of " << info.fileId.uri() << " as " << ranges.size() << " ranges");
+		for (size_t i = 0; i < ranges.size(); ++i) {
+			info.handler->download(&info.pieceReqs[i], info.lookupUri, ranges[i],
+					std::tr1::bind(&NetworkCacheLayer::pieceCallback, this, iter, _1, _2));
+		}
+		return true;
+	}
+
+	void pieceCallback(std::list<RequestInfo>::iterator iter, DenseDataPtr recvData, bool success) {
+		RequestInfo &info = *iter;
+		{
+			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
+			if (recvData && success) {
+				info.pieces.addValidData(recvData);
+			} else {
+				info.pieceFailed = true;
+			}
+			if (--info.piecesLeft) {
+				return;
+			}
+		}
+		info.pieceReqs.clear();
+		info.pieces.coalesce();
+		if (info.pieceFailed || !info.pieces.contiguous() || info.pieces.startbyte() != 0) {
+			info.pieces.clear();
+			doFetch(iter, ServiceIterator::GENERAL_ERROR);
+			return;
+		}
+		DenseDataPtr whole = asWholeFile(info.pieces.flatten());
+		info.pieces.clear();
+		finishFetch(iter, whole);
+	}
+
+	void finishFetch(std::list<RequestInfo>::iterator iter, const DenseDataPtr &recvData) {
+		RequestInfo &info = *iter;
+		// Now go back through the chain!
+		CacheLayer::populateParentCaches(info.fileId.fingerprint(), recvData);
+		SparseData data;
+		data.addValidData(recvData);
+		info.serviter->finished(ServiceIterator::SUCCESS, recvData->length());
+		info.serviter = NULL; // avoid double-free in RequestInfo destructor.
+		std::list<TransferCallback> waiters;
+		takeCallbacks(iter, waiters);
+		for (std::list<TransferCallback>::iterator cbiter = waiters.begin();
+				cbiter != waiters.end();
+				++cbiter) {
+			(*cbiter)(&data);
+		}
+		eraseRequest(iter);
+	}
+
 	void doFetch(std::list<RequestInfo>::iterator iter, ServiceIterator::ErrorType reason) {
 		/* FIXME: this does not acquire a lock--which will cause a problem
 		 * if this class is destructed while we are executing doFetch.
@@ -99,10 +311,14 @@ class NetworkCacheLayer : public CacheLayer {
 		if (cleanup || !info.serviter) {
 			SILOG(transfer,error,"None of the services registered for " <<
 					info.fileId.uri() << " were successful.");
-			CacheLayer::getData(info.fileId, info.range, info.callback);
-			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
-			mActiveTransfers.erase(iter);
-			mCleanupCV.notify_one();
+			std::list<TransferCallback> waiters;
+			takeCallbacks(iter, waiters);
+			for (std::list<TransferCallback>::iterator cbiter = waiters.begin();
+					cbiter != waiters.end();
+					++cbiter) {
+				CacheLayer::getData(info.fileId, info.range, *cbiter, info.priority);
+			}
+			eraseRequest(iter);
 			return;
 		}
 		URI lookupUri;
@@ -111,8 +327,14 @@ class NetworkCacheLayer : public CacheLayer {
 		if (mService->getNextProtocol(info.serviter,reason,info.fileId.uri(),lookupUri,params,handler)) {
 			// info IS GETTING FREED BEFORE download RETURNS TO SET info.httpreq!!!!!!!!!
 			info.httpreq = DownloadHandler::TransferDataPtr();
-			handler->download(&info.httpreq, lookupUri, info.range,
-					std::tr1::bind(&NetworkCacheLayer::httpCallback, this, iter, _1, _2));
+			info.handler = handler;
+			info.lookupUri = lookupUri;
+			Range fetchRange = info.range;
+			if (splitting(info.range)) {
+				fetchRange = Range(0, mSplitSize, LENGTH);
+			}
+			handler->download(&info.httpreq, lookupUri, fetchRange,
+					std::tr1::bind(&NetworkCacheLayer::httpCallback, this, iter, _1, _2, _3));
 			// info may be deleted by now (not so unlikely as it sounds -- it happens if you connect to localhost)
 		} else {
 			info.serviter = NULL; // deleted.
@@ -120,19 +342,65 @@ class NetworkCacheLayer : public CacheLayer {
 		}
 	}
 
+	/// The unfinished request covering range, or mActiveTransfers.end(); needs mActiveTransferLock.
+	RequestIterator findRequest(const RemoteFileId &fileId, const Range &range) {
+		RequestIterator infoIter;
+		for (infoIter = mActiveTransfers.begin();
+				infoIter != mActiveTransfers.end();
+				++infoIter) {
+			if (!(*infoIter).finished &&
+					(*infoIter).fileId.fingerprint() == fileId.fingerprint() &&
+					(*infoIter).range.contains(range)) {
+				break;
+			}
+		}
+		return infoIter;
+	}
+
 	void gotServices(std::list<RequestInfo>::iterator iter, ServiceIterator *services) {
 		(*iter).serviter = services;
 		doFetch(iter, ServiceIterator::SUCCESS);
 	}
 
 public:
-	NetworkCacheLayer(CacheLayer *next, ServiceManager<DownloadHandler> *serviceMgr)
-			:CacheLayer(next), mService(serviceMgr) {
+	/// URIs in this protocol name files made locally from others, e.g. converted textures; they are never downloaded.
+	static const char *cacheOnlyProtocol() {
+		return "cache";
+	}
+
+	/**
+	 * @param splitSize    If nonzero, whole-file downloads first fetch this many
+	 *                     bytes, then fetch the rest as parallel Range requests.
+	 * @param numParallel  The most Range requests per file for the rest.
+	 * @param maxPrefetching  The most PREFETCH_PRIORITY downloads in flight at once; 0 for no limit.
+	 */
+	NetworkCacheLayer(CacheLayer *next, ServiceManager<DownloadHandler> *serviceMgr,
+			cache_usize_type splitSize=0, unsigned int numParallel=1,
+			unsigned int maxPrefetching=2)
+			:CacheLayer(next), mService(serviceMgr),
+			mNumPrefetching(0), mMaxPrefetching(maxPrefetching),
+			mSplitSize(splitSize), mNumParallel(numParallel),
+			mDownloads("cache.network.downloads", "requests that started a download"),
+			mMerged("cache.network.merged", "requests that waited on a download already in progress") {
 		cleanup = false;
 	}
 
 	virtual ~NetworkCacheLayer() {
 		cleanup = true; // Prevents doFetch (callback for NameLookup) from starting a new download.
+		std::vector<RequestIterator> neverStarted;
+		{
+			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
+			neverStarted.assign(mPrefetchQueue.begin(), mPrefetchQueue.end());
+			mPrefetchQueue.clear();
+		}
+		for (std::vector<RequestIterator>::const_iterator iter = neverStarted.begin(); iter != neverStarted.end(); ++iter) {
+			std::list<TransferCallback> waiters;
+			takeCallbacks(*iter, waiters);
+			for (std::list<TransferCallback>::iterator cbiter = waiters.begin(); cbiter != waiters.end(); ++cbiter) {
+				CacheLayer::getData((**iter).fileId, (**iter).range, *cbiter, (**iter).priority);
+			}
+			eraseRequest(*iter);
+		}
 		std::list<DownloadHandler::TransferDataPtr> pendingDelete;
 		{
 			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
@@ -142,6 +410,11 @@ public:
 				if ((*iter).httpreq) {
 					pendingDelete.push_back((*iter).httpreq);
 				}
+				for (size_t i = 0; i < (*iter).pieceReqs.size(); ++i) {
+					if ((*iter).pieceReqs[i]) {
+						pendingDelete.push_back((*iter).pieceReqs[i]);
+					}
+				}
 			}
 		}
 		std::list<DownloadHandler::TransferDataPtr>::iterator iter;
@@ -160,17 +433,49 @@ public:
 
 	virtual void getData(const RemoteFileId &downloadFileId,
 			const Range &requestedRange,
-			const TransferCallback &callback) {
+			const TransferCallback &callback,
+			TransferPriority priority=FOREGROUND_PRIORITY) {
+		if (downloadFileId.uri().proto() == cacheOnlyProtocol()) {
+			CacheLayer::getData(downloadFileId, requestedRange, callback, priority);
+			return;
+		}
 
-		RequestInfo info(downloadFileId, requestedRange, callback);
-		std::list<RequestInfo>::iterator infoIter;
+		RequestInfo info(downloadFileId, requestedRange, callback, priority);
+		std::vector<RequestIterator> toStart;
 		{
 			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
-			infoIter = mActiveTransfers.insert(mActiveTransfers.end(), info);
+			// Single-flight: if a download already in progress covers this range,
+			// wait on it instead of fetching the same bytes again.
+			RequestIterator infoIter = findRequest(downloadFileId, requestedRange);
+			if (infoIter != mActiveTransfers.end()) {
+				(*infoIter).callbacks.push_back(callback);
+				promote(infoIter, priority, toStart);
+				mMerged.increment();
+			} else {
+				mDownloads.increment();
+				infoIter = mActiveTransfers.insert(mActiveTransfers.end(), info);
+				if (priority == PREFETCH_PRIORITY && mMaxPrefetching &&
+						mNumPrefetching >= mMaxPrefetching) {
+					mPrefetchQueue.push_back(infoIter);
+				} else {
+					claimSlot(infoIter);
+					toStart.push_back(infoIter);
+				}
+			}
 		}
+		startRequests(toStart);
+	}
 
-		mService->lookupService(downloadFileId.uri().context(),
-				std::tr1::bind(&NetworkCacheLayer::gotServices, this, infoIter, _1));
+	virtual void raisePriority(const RemoteFileId &fileId, const Range &requestedRange, TransferPriority priority) {
+		std::vector<RequestIterator> toStart;
+		{
+			boost::unique_lock<boost::mutex> transfer_lock(mActiveTransferLock);
+			RequestIterator infoIter = findRequest(fileId, requestedRange);
+			if (infoIter != mActiveTransfers.end()) {
+				promote(infoIter, priority, toStart);
+			}
+		}
+		startRequests(toStart);
 	}
 };
 
@@ -41,15 +41,8 @@ namespace Sirikata {
 namespace Transfer {
 
 /** A vector of URIContexts to be tried.
- * FIXME: It is not smart to try them in order every time.
- * What if one of these services goes down (and times out each time)?
- *
- * Perhaps it would make sense to have a service get shifted to the
- * end of the list if it is "slow" or experiences a timeout.
- *
- * This could possibly be solved by returning a pointer to a ListOfServicesPtr,
- * and simply changing the pointer but keeping the old ListOfServices around
- * until it is dereferenced.
+ * CachedServiceLookup hands them out fastest first and skips services
+ * that keep failing; other lookups try them in order.
  *
  * We still need an interface to invalidate a service--perhaps another class.
  */
@@ -103,8 +96,9 @@ public:
 
 	/** Notification that the download was successful.
 	 * This may help ServiceLookup to pick a better service next time.
+	 * @param bytes  How much the download moved, if known.
 	 */
-	virtual void finished(ErrorType reason=SUCCESS) {
+	virtual void finished(ErrorType reason=SUCCESS, uint64 bytes=0) {
 		delete this;
 	}
 
@@ -0,0 +1,326 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  SharedMemoryCacheLayer.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*  Created on: Oct 14, 2009 */
+#include "util/Standard.hh"
+#include "SharedMemoryCacheLayer.hpp"
+#include "util/AtomicTypes.hpp"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'S','I','R','I','S','H','M','1'};
+/// Entries start on cache line boundaries so two processes never write the same line.
+const uint64 ENTRY_ALIGNMENT = 64;
+
+/// Written once by the process that creates the segment; mReady is set last.
+struct SegmentHeader {
+	char mMagic[8];
+	volatile uint64 mReady;
+	uint64 mNumSlots;
+	uint64 mDataSize;
+	/// Bytes of the data area handed out so far; only ever grows.
+	volatile uint64 mDataUsed;
+	uint64 mPad[3];
+};
+
+/// An index slot goes EMPTY -> WRITING -> READY, and READY -> DEAD if purged; it is never reused.
+struct SegmentSlot {
+	unsigned char mDigest[Fingerprint::static_size];
+	uint64 mOffset;
+	uint64 mLength;
+	volatile uint64 mState;
+	uint64 mPad;
+};
+
+enum SlotState {SLOT_EMPTY=0, SLOT_WRITING, SLOT_READY, SLOT_DEAD};
+
+uint64 alignEntry(uint64 size) {
+	return (size + ENTRY_ALIGNMENT - 1) & ~(ENTRY_ALIGNMENT - 1);
+}
+
+}
+
+struct SharedMemoryCacheLayer::Segment : public Sirikata::Noncopyable {
+	unsigned char *mBase;
+	size_t mSize;
+	SegmentHeader *mHeader;
+	SegmentSlot *mSlots;
+	unsigned char *mData;
+
+	Segment(unsigned char *base, size_t size)
+		: mBase(base), mSize(size),
+		  mHeader((SegmentHeader*)base),
+		  mSlots((SegmentSlot*)(base + sizeof(SegmentHeader))),
+		  mData(base + sizeof(SegmentHeader) + sizeof(SegmentSlot)*((SegmentHeader*)base)->mNumSlots) {
+	}
+	~Segment() {
+#ifndef _WIN32
+		munmap(mBase, mSize);
+#endif
+	}
+
+	static size_t totalSize(uint64 numSlots, uint64 dataSize) {
+		return (size_t)(sizeof(SegmentHeader) + sizeof(SegmentSlot)*numSlots + dataSize);
+	}
+	/// Whether a mapping of size bytes holds a segment another process has finished creating.
+	static bool ready(const unsigned char *base, size_t size) {
+		const SegmentHeader *header = (const SegmentHeader*)base;
+		if (!header->mReady) {
+			return false;
+		}
+		memory_barrier();
+		return memcmp(header->mMagic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0 &&
+			header->mNumSlots > 0 &&
+			totalSize(header->mNumSlots, header->mDataSize) <= size;
+	}
+	static Segment *open(const std::string &name, uint64 numSlots, uint64 dataSize);
+};
+
+SharedMemoryCacheLayer::Segment *SharedMemoryCacheLayer::Segment::open(
+		const std::string &name, uint64 numSlots, uint64 dataSize) {
+#ifdef _WIN32
+	SILOG(transfer,warning,"SharedMemoryCacheLayer is not supported on this platform; passing requests through.");
+	return NULL;
+#else
+	std::string shmName = (name.empty() || name[0] != '/') ? "/" + name : name;
+	size_t size = totalSize(numSlots, dataSize);
+	int fd = shm_open(shmName.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd >= 0) {
+		void *address = MAP_FAILED;
+		if (ftruncate(fd, (off_t)size) == 0) {
+			address = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (address == MAP_FAILED) {
+			SILOG(transfer,error,"Unable to create shared cache segment " << shmName << ": " << strerror(errno));
+			shm_unlink(shmName.c_str());
+			return NULL;
+		}
+		// ftruncate zero fills, which leaves every slot SLOT_EMPTY.
+		SegmentHeader *header = (SegmentHeader*)address;
+		memcpy(header->mMagic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+		header->mNumSlots = numSlots;
+		header->mDataSize = dataSize;
+		header->mDataUsed = 0;
+		memory_barrier();
+		header->mReady = 1;
+		SILOG(transfer,info,"Created shared cache segment " << shmName << " of " << size << " bytes");
+		return new Segment((unsigned char*)address, size);
+	}
+	if (errno != EEXIST) {
+		SILOG(transfer,error,"Unable to open shared cache segment " << shmName << ": " << strerror(errno));
+		return NULL;
+	}
+	fd = shm_open(shmName.c_str(), O_RDWR, 0600);
+	if (fd < 0) {
+		SILOG(transfer,error,"Unable to open shared cache segment " << shmName << ": " << strerror(errno));
+		return NULL;
+	}
+	// Another process may still be creating it; give it a second to finish.
+	for (int tries = 0; tries < 100; ++tries) {
+		struct stat info;
+		if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(SegmentHeader)) {
+			size_t existingSize = (size_t)info.st_size;
+			void *address = mmap(NULL, existingSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+			if (address == MAP_FAILED) {
+				break;
+			}
+			if (ready((const unsigned char*)address, existingSize)) {
+				close(fd);
+				if (existingSize != size) {
+					SILOG(transfer,info,"Shared cache segment " << shmName << " already exists; using its size of " << existingSize << " bytes");
+				}
+				return new Segment((unsigned char*)address, existingSize);
+			}
+			munmap(address, existingSize);
+		}
+		usleep(10000);
+	}
+	close(fd);
+	SILOG(transfer,error,"Shared cache segment " << shmName << " is not usable; passing requests through.");
+	return NULL;
+#endif
+}
+
+SharedMemoryCacheLayer::SharedMemoryCacheLayer(const std::string &name, cache_usize_type dataSize,
+		CacheLayer *tryNext, unsigned int numSlots)
+		: CacheLayer(tryNext),
+		mFullWarned(false),
+		mHits("cache.shared.hits", "requests answered from the shared memory cache"),
+		mMisses("cache.shared.misses", "requests passed on to the next cache layer") {
+	if (numSlots == 0) {
+		numSlots = DEFAULT_NUM_SLOTS;
+	}
+	mSegment = SegmentPtr(Segment::open(name, numSlots, alignEntry(dataSize)));
+}
+
+SharedMemoryCacheLayer::~SharedMemoryCacheLayer() {
+	// The segment itself stays for the other processes and the next run.
+}
+
+DenseDataPtr SharedMemoryCacheLayer::lookup(const Fingerprint &fileId) const {
+	const uint64 numSlots = mSegment->mHeader->mNumSlots;
+	uint64 start = Fingerprint::Hasher()(fileId) % numSlots;
+	for (uint64 i = 0; i < numSlots; ++i) {
+		SegmentSlot *slot = &mSegment->mSlots[(start + i) % numSlots];
+		uint64 state = slot->mState;
+		if (state == SLOT_EMPTY) {
+			break;
+		}
+		if (state != SLOT_READY) {
+			continue;
+		}
+		memory_barrier();
+		if (memcmp(slot->mDigest, fileId.rawData().data(), Fingerprint::static_size) == 0) {
+			return DenseDataPtr(new DenseData(Range(0, slot->mLength, LENGTH, true),
+					mSegment->mData + slot->mOffset, mSegment));
+		}
+	}
+	return DenseDataPtr();
+}
+
+DenseDataPtr SharedMemoryCacheLayer::insert(const Fingerprint &fileId, const DenseData &data) {
+	SegmentHeader *header = mSegment->mHeader;
+	const uint64 length = data.length();
+	const uint64 reserved = alignEntry(length);
+	uint64 offset;
+	do {
+		offset = header->mDataUsed;
+		if (offset + reserved > header->mDataSize) {
+			if (!mFullWarned) {
+				mFullWarned = true;
+				SILOG(transfer,warning,"Shared cache segment is full; new files will not be shared.");
+			}
+			return DenseDataPtr();
+		}
+	} while (!compare_and_swap(&header->mDataUsed, offset, offset + reserved));
+	memcpy(mSegment->mData + offset, data.data(), (size_t)length);
+
+	const uint64 numSlots = header->mNumSlots;
+	uint64 start = Fingerprint::Hasher()(fileId) % numSlots;
+	for (uint64 i = 0; i < numSlots; ++i) {
+		SegmentSlot *slot = &mSegment->mSlots[(start + i) % numSlots];
+		uint64 state = slot->mState;
+		if (state == SLOT_EMPTY) {
+			if (!compare_and_swap(&slot->mState, (uint64)SLOT_EMPTY, (uint64)SLOT_WRITING)) {
+				--i; // Lost the slot to another process; look at it again.
+				continue;
+			}
+			memcpy(slot->mDigest, fileId.rawData().data(), Fingerprint::static_size);
+			slot->mOffset = offset;
+			slot->mLength = length;
+			memory_barrier();
+			slot->mState = SLOT_READY;
+			return DenseDataPtr(new DenseData(Range(0, length, LENGTH, true),
+					mSegment->mData + offset, mSegment));
+		}
+		if (state == SLOT_READY) {
+			memory_barrier();
+			if (memcmp(slot->mDigest, fileId.rawData().data(), Fingerprint::static_size) == 0) {
+				// Another process added it while we were copying; our copy goes unused.
+				return DenseDataPtr(new DenseData(Range(0, slot->mLength, LENGTH, true),
+						mSegment->mData + slot->mOffset, mSegment));
+			}
+		}
+	}
+	if (!mFullWarned) {
+		mFullWarned = true;
+		SILOG(transfer,warning,"Shared cache index is full; new files will not be shared.");
+	}
+	return DenseDataPtr();
+}
+
+void SharedMemoryCacheLayer::populateCache(const Fingerprint &fileId, const DenseDataPtr &data) {
+	// Only whole files are shared, so that a hit never needs the later layers.
+	if (mSegment && data->startbyte() == 0 && data->goesToEndOfFile() && data->length() > 0) {
+		DenseDataPtr shared = lookup(fileId);
+		if (!shared) {
+			shared = insert(fileId, *data);
+		}
+		if (shared) {
+			// Earlier layers keep the shared bytes instead of a private copy.
+			CacheLayer::populateParentCaches(fileId, shared);
+			return;
+		}
+	}
+	CacheLayer::populateParentCaches(fileId, data);
+}
+
+void SharedMemoryCacheLayer::purgeFromCache(const Fingerprint &fileId) {
+	if (mSegment) {
+		const uint64 numSlots = mSegment->mHeader->mNumSlots;
+		uint64 start = Fingerprint::Hasher()(fileId) % numSlots;
+		for (uint64 i = 0; i < numSlots; ++i) {
+			SegmentSlot *slot = &mSegment->mSlots[(start + i) % numSlots];
+			uint64 state = slot->mState;
+			if (state == SLOT_EMPTY) {
+				break;
+			}
+			if (state == SLOT_READY &&
+					memcmp(slot->mDigest, fileId.rawData().data(), Fingerprint::static_size) == 0) {
+				compare_and_swap(&slot->mState, (uint64)SLOT_READY, (uint64)SLOT_DEAD);
+			}
+		}
+	}
+	CacheLayer::purgeFromCache(fileId);
+}
+
+void SharedMemoryCacheLayer::getData(const RemoteFileId &fid, const Range &requestedRange,
+		const TransferCallback&callback, TransferPriority priority) {
+	DenseDataPtr found;
+	if (mSegment) {
+		found = lookup(fid.fingerprint());
+	}
+	if (found && requestedRange.isContainedBy(static_cast<const Range&>(*found))) {
+		SparseData foundData;
+		foundData.addValidData(found);
+		CacheLayer::populateParentCaches(fid.fingerprint(), found);
+		mHits.increment();
+		callback(&foundData);
+	} else {
+		mMisses.increment();
+		CacheLayer::getData(fid, requestedRange, callback, priority);
+	}
+}
+
+}
+}
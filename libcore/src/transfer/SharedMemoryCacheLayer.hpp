@@ -0,0 +1,101 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  SharedMemoryCacheLayer.hpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_SharedMemoryCacheLayer_HPP__
+#define SIRIKATA_SharedMemoryCacheLayer_HPP__
+
+#include "CacheLayer.hpp"
+#include "util/Metrics.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * Keeps whole files in a shared memory segment that every object host on the
+ * machine maps, so a popular asset is held in RAM once rather than once per process.
+ * Sits between MemoryCacheLayer and DiskCacheLayer: data found here is handed
+ * up without copying, and whole files coming back from the later layers are added.
+ *
+ * The segment is append only. Entries are published through an open addressed
+ * index with compare-and-swap, so neither lookups nor inserts take a lock, and
+ * once the data area is full new files just pass through. Remove the segment
+ * (e.g. /dev/shm/<name>) while no object host is running to reset it.
+ */
+class SIRIKATA_EXPORT SharedMemoryCacheLayer : public CacheLayer {
+public:
+	enum {DEFAULT_NUM_SLOTS=16384};
+
+private:
+	struct Segment;
+	typedef std::tr1::shared_ptr<Segment> SegmentPtr;
+
+	/// Shared with every DenseData handed out, so the mapping outlives this layer if it has to.
+	SegmentPtr mSegment;
+	bool mFullWarned;
+
+	Metrics::Counter mHits;
+	Metrics::Counter mMisses;
+
+	/// Returns data for the whole of fileId, or NULL if the segment does not have it.
+	DenseDataPtr lookup(const Fingerprint &fileId) const; // defined in SharedMemoryCacheLayer.cpp
+	/// Copies data into the segment; returns the shared copy, or NULL if there was no room.
+	DenseDataPtr insert(const Fingerprint &fileId, const DenseData &data); // defined in SharedMemoryCacheLayer.cpp
+
+protected:
+	virtual void populateCache(const Fingerprint &fileId, const DenseDataPtr &data); // defined in SharedMemoryCacheLayer.cpp
+
+public:
+	/**
+	 * @param name      name of the segment, the same for every process that should share it.
+	 * @param dataSize  bytes of file data the segment holds; only used by the process that creates it.
+	 * @param numSlots  how many files the index has room for; also only used on creation.
+	 */
+	SharedMemoryCacheLayer(const std::string &name, cache_usize_type dataSize, CacheLayer *tryNext,
+			unsigned int numSlots=DEFAULT_NUM_SLOTS); // defined in SharedMemoryCacheLayer.cpp
+	virtual ~SharedMemoryCacheLayer(); // defined in SharedMemoryCacheLayer.cpp
+
+	/// True if the segment could be mapped; otherwise every request goes on to the next layer.
+	bool isMapped() const {
+		return mSegment.get() != NULL;
+	}
+
+	/// Hides fileId from later lookups. Its bytes stay in the segment for anyone still reading them.
+	virtual void purgeFromCache(const Fingerprint &fileId); // defined in SharedMemoryCacheLayer.cpp
+
+	virtual void getData(const RemoteFileId &fid, const Range &requestedRange,
+			const TransferCallback&callback, TransferPriority priority=FOREGROUND_PRIORITY); // defined in SharedMemoryCacheLayer.cpp
+};
+
+}
+}
+
+#endif /* SIRIKATA_SharedMemoryCacheLayer_HPP__ */
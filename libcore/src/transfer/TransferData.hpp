@@ -39,32 +39,77 @@
 namespace Sirikata {
 namespace Transfer {
 
+/// How soon a download is needed. Higher values are more urgent.
+enum TransferPriority {
+	PREFETCH_PRIORITY, ///< might be needed soon, e.g. by objects the camera is heading towards
+	FOREGROUND_PRIORITY, ///< something is waiting for it
+	CRITICAL_PRIORITY, ///< holding up what is on screen right now
+	NUM_TRANSFER_PRIORITIES
+};
+
 
-/// Represents a single block of data, and also knows the range of the file it came from.
+/**
+ * Represents a single block of data, and also knows the range of the file it came from.
+ * The bytes either live in the DenseData itself or are borrowed from memory that
+ * someone else keeps alive, such as a mapped cache file.
+ */
 class DenseData : Noncopyable, public Range {
-	std::vector<unsigned char> mData;
+	typedef std::vector<unsigned char, Memory::Allocator<unsigned char, Memory::TRANSFER> > DataVector;
+	DataVector mData;
+	/// Borrowed bytes starting at startbyte(), or NULL if they are in mData.
+	const unsigned char *mExternalData;
+	/// Keeps mExternalData valid for as long as this DenseData refers to it.
+	std::tr1::shared_ptr<void> mExternalOwner;
 
     // All too easy to mix up string constructors (binarydata,length) with (string,startbyte)
 	DenseData(const char *str, size_t len) : Range(false) {}
 	DenseData(const unsigned char *str, size_t len) : Range(false) {}
 
+	/// Copies borrowed bytes into mData, so they can be written or resized.
+	void ownData() {
+		if (mExternalData) {
+			mData.assign(mExternalData, mExternalData+(size_t)length());
+			mExternalData = NULL;
+			mExternalOwner.reset();
+		}
+	}
+
 public:
 	/// The only constructor--the length can be changed later with setLength().
 	DenseData(const Range &range)
-			:Range(range) {
+			:Range(range), mExternalData(NULL) {
 		if (range.length()) {
-			mData.resize((std::vector<unsigned char>::size_type)range.length());
+			mData.resize((DataVector::size_type)range.length());
 		}
 	}
 
 	DenseData(const std::string &str, Range::base_type start=0, bool wholeFile=true)
-			:Range(start, str.length(), LENGTH, wholeFile) {
+			:Range(start, str.length(), LENGTH, wholeFile), mExternalData(NULL) {
 		setLength(str.length(), wholeFile);
 		std::copy(str.begin(), str.end(), writableData());
 	}
 
+	/**
+	 * Refers to range.length() bytes at externalData without copying them.
+	 *
+	 * @param externalData  the bytes for range.startbyte() onwards.
+	 * @param owner         released when this DenseData is destroyed or copies
+	 *                      the bytes for writing, and must keep externalData valid until then.
+	 */
+	DenseData(const Range &range, const unsigned char *externalData, const std::tr1::shared_ptr<void> &owner)
+			:Range(range), mExternalData(externalData), mExternalOwner(owner) {
+	}
+
+	/// @returns whether the bytes are borrowed rather than held by this DenseData.
+	inline bool isExternal() const {
+		return mExternalData != NULL;
+	}
+
 	/// equals dataAt(startbyte()).
 	inline const unsigned char *data() const {
+		if (mExternalData) {
+			return mExternalData;
+		}
 		return &(mData[0]);
 	}
 
@@ -76,8 +121,9 @@ public:
 		return data()+length();
 	}
 
-	/// Returns a non-const data, starting at startbyte().
+	/// Returns a non-const data, starting at startbyte(). Borrowed bytes are copied first.
 	inline unsigned char *writableData() {
+		ownData();
 		return &(mData[0]);
 	}
 
@@ -89,7 +135,7 @@ public:
 		if (offset >= endbyte() || offset < startbyte()) {
 			return NULL;
 		}
-		return &(mData[(std::vector<unsigned char>::size_type)(offset-startbyte())]);
+		return data()+(size_t)(offset-startbyte());
 	}
 
 	inline std::string asString() const {
@@ -98,11 +144,18 @@ public:
 
 	/// Sets the length of the range, as well as allocates more space in the data vector.
 	inline void setLength(size_t len, bool is_npos) {
+		ownData();
 		Range::setLength(len, is_npos);
 		mData.resize(len);
 		//message1.reserve(size);
 		//std::copy(data, data+len, std::back_inserter(mData));
 	}
+
+	/// Allocates room for len bytes up front, so growing to that length with setLength() does not reallocate.
+	inline void reserve(size_t len) {
+		ownData();
+		mData.reserve(len);
+	}
 };
 
 typedef std::tr1::shared_ptr<DenseData> MutableDenseDataPtr;
@@ -412,6 +465,9 @@ public:
 
 	typedef const_iterator iterator; // Only supports read-only operations
 
+	/// addValidData() merges touching pieces once there are more than this many.
+	enum {COALESCE_PIECES=8};
+
 	SparseData() {
 	}
 
@@ -419,6 +475,79 @@ public:
 		addValidData(contents);
 	}
 
+	/**
+	 * Adds a range of valid data, then coalesce()s if downloads have
+	 * left the set split into more than COALESCE_PIECES pieces.
+	 */
+	void addValidData(const DenseDataPtr &data) {
+		DenseDataList::addValidData(data);
+		if (mSparseData.size() > COALESCE_PIECES) {
+			coalesce();
+		}
+	}
+
+	/**
+	 * Copies every run of touching or overlapping DenseData into a
+	 * single new DenseData.  The pieces themselves are left alone, since
+	 * other SparseData may share them.  Afterwards, a contiguous
+	 * SparseData holds exactly one DenseData, and flatten() and span()
+	 * do not need to copy.
+	 */
+	void coalesce() {
+		ListType::iterator iter = mSparseData.begin();
+		while (iter != mSparseData.end()) {
+			ListType::iterator runEnd = iter;
+			++runEnd;
+			Range::base_type runStart = (*iter)->startbyte();
+			Range::base_type runEndByte = (*iter)->endbyte();
+			bool eof = (*iter)->goesToEndOfFile();
+			size_t numPieces = 1;
+			while (runEnd != mSparseData.end() && !eof &&
+					(*runEnd)->startbyte() <= runEndByte) {
+				if ((*runEnd)->endbyte() > runEndByte) {
+					runEndByte = (*runEnd)->endbyte();
+				}
+				eof = (*runEnd)->goesToEndOfFile();
+				++runEnd;
+				++numPieces;
+			}
+			if (numPieces > 1) {
+				MutableDenseDataPtr merged(new DenseData(Range(runStart, runEndByte, BOUNDS, eof)));
+				unsigned char *outdata = merged->writableData();
+				Range::base_type written = runStart;
+				for (ListType::iterator piece = iter; piece != runEnd; ++piece) {
+					if ((*piece)->endbyte() > written) {
+						std::copy((*piece)->dataAt(written), (*piece)->end(),
+							outdata + (size_t)(written - runStart));
+						written = (*piece)->endbyte();
+					}
+				}
+				iter = mSparseData.erase(iter, runEnd);
+				iter = mSparseData.insert(iter, merged);
+			}
+			++iter;
+		}
+	}
+
+	/**
+	 * Flat access to a range without walking the pieces byte by byte.
+	 * @param range  the bytes wanted
+	 * @returns      a pointer to range.startbyte() if a single DenseData
+	 *               holds all of range, or NULL.  Call coalesce() first
+	 *               if the range may straddle pieces.
+	 */
+	const unsigned char *span(const Range &range) const {
+		for (ListType::const_iterator iter = mSparseData.begin(); iter != mSparseData.end(); ++iter) {
+			if ((*iter)->startbyte() > range.startbyte()) {
+				break;
+			}
+			if ((*iter)->contains(range)) {
+				return (*iter)->dataAt(range.startbyte());
+			}
+		}
+		return NULL;
+	}
+
 	inline cache_usize_type length() const {
 		return endbyte() - startbyte();
 	}
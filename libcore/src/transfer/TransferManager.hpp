@@ -188,6 +188,12 @@ public:
 	virtual void purgeFromCache(const Fingerprint &fprint) {
 	}
 
+	/** Stores data for fprint in every cache layer, as if it had been downloaded.
+	 * For files derived locally from others, which are then fetched with a
+	 * URI in NetworkCacheLayer::cacheOnlyProtocol(). */
+	virtual void addToCache(const Fingerprint &fprint, const DenseDataPtr &data) {
+	}
+
 	/** Performs a name lookup, and then downloads this file.
 	 *
 	 * Uses the event system in order to ensure that multiple copies of a duplicate file
@@ -196,9 +202,13 @@ public:
 	 * @param name      URI of the named file (e.g. meerkat:///somefile.texture)
 	 * @param listener  An EventListener to receive a DownloadEventPtr with the retrieved data.
 	 * @param range     What part of the file to retrieve, or Range(true) for the whole file.
+	 * @param priority  PREFETCH_PRIORITY for files that are not needed yet.
+	 * @param deadline  When the file is needed by, to order it among others of the same priority;
+	 *                  Time::null() to queue it behind those that have one.
 	 */
 	///
-	virtual void download(const URI &name, const EventListener &listener, const Range &range) {
+	virtual void download(const URI &name, const EventListener &listener, const Range &range,
+			TransferPriority priority=FOREGROUND_PRIORITY, const Time &deadline=Time::null()) {
 		listener(DownloadEventPtr(new DownloadEvent(FAIL_UNIMPLEMENTED, RemoteFileId(), NULL)));
 	}
 
@@ -209,12 +219,27 @@ public:
 	 * @param name      RemoteFileId of the hash and download URI (e.g. mhash:///1234567890abcdef...)
 	 * @param listener  An EventListener to receive a DownloadEventPtr with the retrieved data.
 	 * @param range     What part of the file to retrieve, or Range(true) for the whole file.
+	 * @param priority  PREFETCH_PRIORITY for files that are not needed yet.
+	 * @param deadline  When the file is needed by, or Time::null().
 	 */
-	virtual SubscriptionId downloadByHash(const RemoteFileId &name, const EventListener &listener, const Range &range) {
+	virtual SubscriptionId downloadByHash(const RemoteFileId &name, const EventListener &listener, const Range &range,
+			TransferPriority priority=FOREGROUND_PRIORITY, const Time &deadline=Time::null()) {
 		listener(DownloadEventPtr(new DownloadEvent(FAIL_UNIMPLEMENTED, name, NULL)));
 		return SubscriptionIdClass::null();
 	}
 
+	/** Changes the priority and deadline of a download that has not finished yet,
+	 * e.g. when a prefetched object turns out to be in view. Downloads still waiting
+	 * for a slot move to their new place in line; ones already running can only be
+	 * made more urgent.
+	 *
+	 * @param name      The URI passed to download() or downloadByHash().
+	 * @param range     The Range passed to download().
+	 */
+	virtual void reprioritize(const URI &name, const Range &range,
+			TransferPriority priority, const Time &deadline=Time::null()) {
+	}
+
         virtual void downloadName(const URI &nameURI,
                 const std::tr1::function<void(const URI &nameURI,const RemoteFileId *fingerprint)> &listener) {
             listener(nameURI, NULL);
@@ -154,10 +154,11 @@ public:
         return *(T*)getThisAlignedAddress(mMemory)==*(T*)getThisAlignedAddress(other.mMemory);
     }
     operator T ()const {
-        return *(T*)getThisAlignedAddress(mMemory);
+        return *getThisAlignedAddress(mMemory);
     }
+    ///Reads through the volatile address so that polling loops see other threads' updates
     T read() const {
-        return *(T*)getThisAlignedAddress(mMemory);
+        return *getThisAlignedAddress(mMemory);
     }
     T operator +=(const T&other) {
         return SizedAtomicValue<sizeof(T)>::add(getThisAlignedAddress(mMemory),other);
@@ -196,6 +197,32 @@ inline bool compare_and_swap(volatile Node*volatile *target, volatile Node *comp
 #endif
 }
 
+///Compare and swap on a full 64 bit word, useful for pairing a 32 bit index with an ABA tag
+inline bool compare_and_swap(volatile uint64 *target, uint64 comperand, uint64 exchange){
+#ifdef _WIN32
+        return InterlockedCompareExchange64((volatile LONGLONG*)target, (LONGLONG)exchange, (LONGLONG)comperand)==(LONGLONG)comperand;
+#else
+#ifdef __APPLE__
+        return OSAtomicCompareAndSwap64((int64_t)comperand, (int64_t)exchange, (volatile int64_t*)target);
+#else
+        return __sync_bool_compare_and_swap (target, comperand, exchange);
+#endif
+#endif
+}
+
+///Full fence: no load or store is reordered across it by either the compiler or the processor
+inline void memory_barrier() {
+#ifdef _WIN32
+        MemoryBarrier();
+#else
+#ifdef __APPLE__
+        OSMemoryBarrier();
+#else
+        __sync_synchronize();
+#endif
+#endif
+}
+
 #ifdef _WIN32
 #pragma warning( pop )
 #endif
@@ -0,0 +1,363 @@
+/*  Sirikata Utilities -- Small Buffer Callback
+ *  Callback.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_CALLBACK_HPP_
+#define _SIRIKATA_CALLBACK_HPP_
+
+#include <new>
+#include <boost/type_traits/alignment_of.hpp>
+
+namespace Sirikata {
+
+namespace CallbackDetail {
+
+enum {
+    /// Pointer sized words stored inline: enough for a bound member function with a few arguments.
+    INLINE_WORDS = 6
+};
+
+/// Either the functor itself, when it fits, or a pointer to a heap copy.
+union Storage {
+    void *mHeap;
+    double mAlignDouble;
+    int64 mAlignInt64;
+    void *mAlignPointer[INLINE_WORDS];
+    char mBytes[INLINE_WORDS * sizeof(void*)];
+};
+
+/// Lifetime operations for one functor type, shared by every Callback holding that type.
+struct Manager {
+    void (*clone)(const Storage &from, Storage &to);
+    /// Moves the functor from one storage to another, leaving from empty. Never allocates.
+    void (*move)(Storage &from, Storage &to);
+    void (*destroy)(Storage &storage);
+};
+
+template <class F> struct FitsInline {
+    enum {
+        value = sizeof(F) <= sizeof(Storage) &&
+                boost::alignment_of<F>::value <= boost::alignment_of<Storage>::value &&
+                boost::alignment_of<Storage>::value % boost::alignment_of<F>::value == 0
+    };
+};
+
+template <class F, bool Inline=FitsInline<F>::value> struct Holder {
+    static F *get(Storage &storage) {
+        return reinterpret_cast<F*>(storage.mBytes);
+    }
+    static const F *get(const Storage &storage) {
+        return reinterpret_cast<const F*>(storage.mBytes);
+    }
+    static void create(const F &f, Storage &to) {
+        new (to.mBytes) F(f);
+    }
+    static void clone(const Storage &from, Storage &to) {
+        create(*get(from), to);
+    }
+    static void move(Storage &from, Storage &to) {
+        create(*get(from), to);
+        destroy(from);
+    }
+    static void destroy(Storage &storage) {
+        get(storage)->~F();
+    }
+    static const Manager *manager() {
+        static const Manager sManager = { &clone, &move, &destroy };
+        return &sManager;
+    }
+};
+
+template <class F> struct Holder<F, false> {
+    static F *get(Storage &storage) {
+        return static_cast<F*>(storage.mHeap);
+    }
+    static const F *get(const Storage &storage) {
+        return static_cast<const F*>(storage.mHeap);
+    }
+    static void create(const F &f, Storage &to) {
+        to.mHeap = new F(f);
+    }
+    static void clone(const Storage &from, Storage &to) {
+        create(*get(from), to);
+    }
+    static void move(Storage &from, Storage &to) {
+        to.mHeap = from.mHeap;
+        from.mHeap = NULL;
+    }
+    static void destroy(Storage &storage) {
+        delete get(storage);
+        storage.mHeap = NULL;
+    }
+    static const Manager *manager() {
+        static const Manager sManager = { &clone, &move, &destroy };
+        return &sManager;
+    }
+};
+
+template <class T> bool isNull(T *ptr) {
+    return ptr == NULL;
+}
+template <class F> bool isNull(const F &) {
+    return false;
+}
+template <class Signature> bool isNull(const std::tr1::function<Signature> &f) {
+    return !f;
+}
+
+/// Type independent half of Callback: owns the storage and the functor's lifetime.
+class Base {
+protected:
+    mutable Storage mStorage;
+    const Manager *mManager;
+
+    Base() : mManager(NULL) {
+    }
+    Base(const Base &other) : mManager(other.mManager) {
+        if (mManager)
+            mManager->clone(other.mStorage, mStorage);
+    }
+    ~Base() {
+        if (mManager)
+            mManager->destroy(mStorage);
+    }
+    void assign(const Base &other) {
+        if (this == &other)
+            return;
+        clear();
+        if (other.mManager)
+            other.mManager->clone(other.mStorage, mStorage);
+        mManager = other.mManager;
+    }
+    void moveFrom(Base &other) {
+        if (this == &other)
+            return;
+        clear();
+        if (other.mManager)
+            other.mManager->move(other.mStorage, mStorage);
+        mManager = other.mManager;
+        other.mManager = NULL;
+    }
+    void swap(Base &other) {
+        Storage temp;
+        const Manager *tempManager = other.mManager;
+        if (tempManager)
+            tempManager->move(other.mStorage, temp);
+        if (mManager)
+            mManager->move(mStorage, other.mStorage);
+        if (tempManager)
+            tempManager->move(temp, mStorage);
+        other.mManager = mManager;
+        mManager = tempManager;
+    }
+    typedef const Manager *Base::*SafeBool;
+public:
+    /// Destroys the held functor, leaving this empty.
+    void clear() {
+        if (mManager) {
+            mManager->destroy(mStorage);
+            mManager = NULL;
+        }
+    }
+    bool empty() const {
+        return mManager == NULL;
+    }
+    operator SafeBool() const {
+        return mManager ? &Base::mManager : NULL;
+    }
+    bool operator!() const {
+        return mManager == NULL;
+    }
+};
+
+/// Adds the signature specific call thunk to Base.
+template <class Invoker> class Typed : public Base {
+protected:
+    Invoker mInvoke;
+
+    Typed() : mInvoke(NULL) {
+    }
+    template <class F> void init(const F &f, Invoker invoke) {
+        if (isNull(f))
+            return;
+        Holder<F>::create(f, mStorage);
+        mManager = Holder<F>::manager();
+        mInvoke = invoke;
+    }
+    void assign(const Typed &other) {
+        Base::assign(other);
+        mInvoke = other.mInvoke;
+    }
+public:
+    /// Takes other's functor without copying it, leaving other empty.
+    void moveFrom(Typed &other) {
+        Base::moveFrom(other);
+        mInvoke = other.mInvoke;
+        other.mInvoke = NULL;
+    }
+    /// Exchanges functors without copying either.
+    void swap(Typed &other) {
+        Base::swap(other);
+        std::swap(mInvoke, other.mInvoke);
+    }
+};
+
+}
+
+/**
+ * A std::tr1::function replacement for callbacks on the network and task hot
+ * paths.  Functors up to CallbackDetail::INLINE_WORDS pointers in size, which
+ * covers the usual std::tr1::bind of a member function and a few arguments,
+ * are stored inside the Callback itself, so building, copying and calling one
+ * does not touch the heap.  Larger functors fall back to a heap copy.
+ * moveFrom() and swap() hand a functor over without copying it.
+ *
+ * Constructible from anything a std::tr1::function is (an empty
+ * std::tr1::function or a NULL function pointer make an empty Callback), and
+ * a Callback can itself be stored in a std::tr1::function.
+ */
+template <class Signature> class Callback;
+
+template <class R>
+class Callback<R()> : public CallbackDetail::Typed<R(*)(CallbackDetail::Storage&)> {
+    template <class F> static R invoke(CallbackDetail::Storage &storage) {
+        return (*CallbackDetail::Holder<F>::get(storage))();
+    }
+public:
+    typedef R result_type;
+    Callback() {
+    }
+    template <class F> Callback(F f) {
+        this->init(f, &Callback::invoke<F>);
+    }
+    Callback(const Callback &other) : CallbackDetail::Typed<R(*)(CallbackDetail::Storage&)>(other) {
+    }
+    Callback &operator=(const Callback &other) {
+        this->assign(other);
+        return *this;
+    }
+    template <class F> Callback &operator=(F f) {
+        Callback temp(f);
+        this->swap(temp);
+        return *this;
+    }
+    R operator()() const {
+        return this->mInvoke(this->mStorage);
+    }
+};
+
+template <class R, class A1>
+class Callback<R(A1)> : public CallbackDetail::Typed<R(*)(CallbackDetail::Storage&, A1)> {
+    template <class F> static R invoke(CallbackDetail::Storage &storage, A1 a1) {
+        return (*CallbackDetail::Holder<F>::get(storage))(a1);
+    }
+public:
+    typedef R result_type;
+    Callback() {
+    }
+    template <class F> Callback(F f) {
+        this->init(f, &Callback::invoke<F>);
+    }
+    Callback(const Callback &other) : CallbackDetail::Typed<R(*)(CallbackDetail::Storage&, A1)>(other) {
+    }
+    Callback &operator=(const Callback &other) {
+        this->assign(other);
+        return *this;
+    }
+    template <class F> Callback &operator=(F f) {
+        Callback temp(f);
+        this->swap(temp);
+        return *this;
+    }
+    R operator()(A1 a1) const {
+        return this->mInvoke(this->mStorage, a1);
+    }
+};
+
+template <class R, class A1, class A2>
+class Callback<R(A1, A2)> : public CallbackDetail::Typed<R(*)(CallbackDetail::Storage&, A1, A2)> {
+    template <class F> static R invoke(CallbackDetail::Storage &storage, A1 a1, A2 a2) {
+        return (*CallbackDetail::Holder<F>::get(storage))(a1, a2);
+    }
+public:
+    typedef R result_type;
+    Callback() {
+    }
+    template <class F> Callback(F f) {
+        this->init(f, &Callback::invoke<F>);
+    }
+    Callback(const Callback &other) : CallbackDetail::Typed<R(*)(CallbackDetail::Storage&, A1, A2)>(other) {
+    }
+    Callback &operator=(const Callback &other) {
+        this->assign(other);
+        return *this;
+    }
+    template <class F> Callback &operator=(F f) {
+        Callback temp(f);
+        this->swap(temp);
+        return *this;
+    }
+    R operator()(A1 a1, A2 a2) const {
+        return this->mInvoke(this->mStorage, a1, a2);
+    }
+};
+
+template <class R, class A1, class A2, class A3>
+class Callback<R(A1, A2, A3)> : public CallbackDetail::Typed<R(*)(CallbackDetail::Storage&, A1, A2, A3)> {
+    template <class F> static R invoke(CallbackDetail::Storage &storage, A1 a1, A2 a2, A3 a3) {
+        return (*CallbackDetail::Holder<F>::get(storage))(a1, a2, a3);
+    }
+public:
+    typedef R result_type;
+    Callback() {
+    }
+    template <class F> Callback(F f) {
+        this->init(f, &Callback::invoke<F>);
+    }
+    Callback(const Callback &other) : CallbackDetail::Typed<R(*)(CallbackDetail::Storage&, A1, A2, A3)>(other) {
+    }
+    Callback &operator=(const Callback &other) {
+        this->assign(other);
+        return *this;
+    }
+    template <class F> Callback &operator=(F f) {
+        Callback temp(f);
+        this->swap(temp);
+        return *this;
+    }
+    R operator()(A1 a1, A2 a2, A3 a3) const {
+        return this->mInvoke(this->mStorage, a1, a2, a3);
+    }
+};
+
+}
+
+#endif //_SIRIKATA_CALLBACK_HPP_
@@ -0,0 +1,222 @@
+/*  Sirikata Utilities -- Compact Location Encoding
+ *  CompactLocation.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_COMPACT_LOCATION_HPP_
+#define _SIRIKATA_COMPACT_LOCATION_HPP_
+
+#include "Location.hpp"
+#include "Time.hpp"
+#include <cmath>
+
+namespace Sirikata {
+
+/**
+ * Packs ObjLoc fields into a CompactObjLoc: positions become a sector index plus a 16 bit offset within the sector,
+ * orientations are sent as their smallest three components, velocities and axes as 16 bit fractions of their range,
+ * and the timestamp as microseconds after an epoch the space hands out. Values that do not fit are left at full precision.
+ * Templated on the message types since every plugin compiles the protocol into its own namespace.
+ */
+class CompactLocationFormat {
+    double mSectorSize;
+    float mMaxSpeed;
+    Time mEpoch;
+
+    static void writeUInt16(unsigned char*out, uint16 value) {
+        out[0]=(unsigned char)(value&255);
+        out[1]=(unsigned char)(value>>8);
+    }
+    static uint16 readUInt16(const unsigned char*in) {
+        return (uint16)(in[0]|(in[1]<<8));
+    }
+    static int16 quantizeUnit(double value) {
+        double scaled=std::floor(value*32767.0+.5);
+        return (int16)(scaled<-32767.0?-32767:(scaled>32767.0?32767:scaled));
+    }
+public:
+    CompactLocationFormat(double sectorSize, float maxSpeed, const Time&epoch)
+     : mSectorSize(sectorSize), mMaxSpeed(maxSpeed), mEpoch(epoch) {
+    }
+    ///Reads a CompactLocFormat message, taking the defaults for any field the granting space left out
+    template <class CompactLocFormat> static CompactLocationFormat fromMessage(const CompactLocFormat&format) {
+        return CompactLocationFormat(format.has_sector_size()?format.sector_size():1024.0,
+                                     format.has_max_speed()?format.max_speed():256.0f,
+                                     format.has_epoch()?format.epoch():Time::epoch());
+    }
+    template <class CompactLocFormat> void toMessage(CompactLocFormat format) const {
+        format.set_sector_size(mSectorSize);
+        format.set_max_speed(mMaxSpeed);
+        format.set_epoch(mEpoch);
+    }
+    double sectorSize() const {
+        return mSectorSize;
+    }
+    float maxSpeed() const {
+        return mMaxSpeed;
+    }
+    const Time&epoch() const {
+        return mEpoch;
+    }
+
+    ///\returns false if the position lies outside the +/-32768 sectors around the origin
+    bool packPosition(const Vector3d&position, String&out) const {
+        unsigned char packed[12];
+        for (unsigned int i=0;i<3;++i) {
+            double sector=std::floor(position[i]/mSectorSize);
+            if (!(sector>=-32768.0&&sector<=32767.0))
+                return false;
+            double offset=(position[i]-sector*mSectorSize)/mSectorSize*65536.0;
+            writeUInt16(packed+2*i,(uint16)(int16)sector);
+            writeUInt16(packed+6+2*i,(uint16)(offset<0.0?0:(offset>=65535.0?65535:offset)));
+        }
+        out.assign((const char*)packed,sizeof(packed));
+        return true;
+    }
+    bool unpackPosition(const String&in, Vector3d&position) const {
+        if (in.size()!=12)
+            return false;
+        const unsigned char*packed=(const unsigned char*)in.data();
+        for (unsigned int i=0;i<3;++i) {
+            double sector=(int16)readUInt16(packed+2*i);
+            position[i]=(sector+(readUInt16(packed+6+2*i)+.5)/65536.0)*mSectorSize;
+        }
+        return true;
+    }
+    static void packOrientation(const Quaternion&orientation, String&out) {
+        Quaternion q(orientation.normal());
+        unsigned int largest=0;
+        for (unsigned int i=1;i<4;++i) {
+            if (std::fabs(q[i])>std::fabs(q[largest]))
+                largest=i;
+        }
+        //q and -q are the same rotation, so the dropped component can always be taken as positive
+        double sign=q[largest]<0?-1.0:1.0;
+        uint64 bits=largest;
+        for (unsigned int i=0;i<4;++i) {
+            if (i!=largest) {
+                double unit=(sign*q[i]*1.41421356237+1.0)*.5;
+                double scaled=std::floor(unit*32767.0+.5);
+                bits=(bits<<15)|(uint64)(scaled<0.0?0:(scaled>32767.0?32767:scaled));
+            }
+        }
+        unsigned char packed[6];
+        for (unsigned int i=0;i<6;++i)
+            packed[i]=(unsigned char)((bits>>(8*i))&255);
+        out.assign((const char*)packed,sizeof(packed));
+    }
+    static bool unpackOrientation(const String&in, Quaternion&orientation) {
+        if (in.size()!=6)
+            return false;
+        const unsigned char*packed=(const unsigned char*)in.data();
+        uint64 bits=0;
+        for (unsigned int i=0;i<6;++i)
+            bits|=((uint64)packed[i])<<(8*i);
+        unsigned int largest=(unsigned int)((bits>>45)&3);
+        double sumSquares=0;
+        int shift=30;
+        for (unsigned int i=0;i<4;++i) {
+            if (i!=largest) {
+                double unit=((bits>>shift)&32767)/32767.0;
+                orientation[i]=(float)((unit*2.0-1.0)/1.41421356237);
+                sumSquares+=orientation[i]*orientation[i];
+                shift-=15;
+            }
+        }
+        orientation[largest]=(float)std::sqrt(sumSquares<1.0?1.0-sumSquares:0.0);
+        return true;
+    }
+    ///\returns false if a component of value is larger than range
+    static bool packVector(const Vector3f&value, float range, String&out) {
+        unsigned char packed[6];
+        for (unsigned int i=0;i<3;++i) {
+            if (!(std::fabs(value[i])<=range))
+                return false;
+            writeUInt16(packed+2*i,(uint16)quantizeUnit(value[i]/range));
+        }
+        out.assign((const char*)packed,sizeof(packed));
+        return true;
+    }
+    static bool unpackVector(const String&in, float range, Vector3f&value) {
+        if (in.size()!=6)
+            return false;
+        const unsigned char*packed=(const unsigned char*)in.data();
+        for (unsigned int i=0;i<3;++i)
+            value[i]=(float)((int16)readUInt16(packed+2*i))/32767.0f*range;
+        return true;
+    }
+
+    ///Moves each field of loc that fits the format into loc.compact
+    template <class ObjLoc> void compress(ObjLoc&loc) const {
+        String packed;
+        if (loc.has_timestamp()&&loc.timestamp()>=mEpoch) {
+            loc.mutable_compact().set_delta_timestamp((loc.timestamp()-mEpoch).toMicroseconds());
+            loc.clear_timestamp();
+        }
+        if (loc.has_position()&&packPosition(loc.position(),packed)) {
+            loc.mutable_compact().set_position(packed);
+            loc.clear_position();
+        }
+        if (loc.has_orientation()) {
+            packOrientation(loc.orientation(),packed);
+            loc.mutable_compact().set_orientation(packed);
+            loc.clear_orientation();
+        }
+        if (loc.has_velocity()&&packVector(loc.velocity(),mMaxSpeed,packed)) {
+            loc.mutable_compact().set_velocity(packed);
+            loc.clear_velocity();
+        }
+        if (loc.has_rotational_axis()&&packVector(loc.rotational_axis(),1.0f,packed)) {
+            loc.mutable_compact().set_rotational_axis(packed);
+            loc.clear_rotational_axis();
+        }
+    }
+    ///Restores the full precision fields of loc from loc.compact, if present
+    template <class ObjLoc> void expand(ObjLoc&loc) const {
+        if (!loc.has_compact())
+            return;
+        Vector3d position;
+        Quaternion orientation;
+        Vector3f vector;
+        if (loc.compact().has_delta_timestamp())
+            loc.set_timestamp(mEpoch+Duration::microseconds((int64)loc.compact().delta_timestamp()));
+        if (loc.compact().has_position()&&unpackPosition(loc.compact().position(),position))
+            loc.set_position(position);
+        if (loc.compact().has_orientation()&&unpackOrientation(loc.compact().orientation(),orientation))
+            loc.set_orientation(orientation);
+        if (loc.compact().has_velocity()&&unpackVector(loc.compact().velocity(),mMaxSpeed,vector))
+            loc.set_velocity(vector);
+        if (loc.compact().has_rotational_axis()&&unpackVector(loc.compact().rotational_axis(),1.0f,vector))
+            loc.set_rotational_axis(vector);
+        loc.clear_compact();
+    }
+};
+
+}
+#endif
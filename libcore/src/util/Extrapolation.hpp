@@ -36,6 +36,19 @@
 
 namespace Sirikata {
 
+/// How a TimedWeightedExtrapolatorBase fades from its old extrapolation into an update.
+enum ExtrapolationBlend {
+    /// Weight of the update grows linearly over the fade time.
+    LINEAR_BLEND,
+    /// Weight follows the Hermite basis 3s^2-2s^3, so the correction starts and ends without a jump in speed.
+    HERMITE_BLEND
+};
+
+/// Share of the update in the blend once fraction of the fade time has passed.
+inline float64 extrapolationBlendWeight(ExtrapolationBlend blend, float64 fraction) {
+    return blend == HERMITE_BLEND ? fraction*fraction*(3-2*fraction) : fraction;
+}
+
 template<typename Value, typename TimeType>
 class ExtrapolatorBase {
 public:
@@ -63,13 +76,15 @@ protected:
     TemporalValueType mValuePast;
     TemporalValueType mValuePresent;
     DurationType mFadeTime;
+    ExtrapolationBlend mBlend;
 public:
     TimedWeightedExtrapolatorBase(const DurationType&fadeTime, const TimeType&t, const Value&actualValue, const UpdatePredicate&needsUpdate)
      : ExtrapolatorBase<Value, TimeType>(),
        UpdatePredicate(needsUpdate),
        mValuePast(t,actualValue),
        mValuePresent(t,actualValue),
-       mFadeTime(fadeTime)
+       mFadeTime(fadeTime),
+       mBlend(LINEAR_BLEND)
     {}
     virtual ~TimedWeightedExtrapolatorBase(){}
     virtual bool needsUpdate(const TimeType&now,const Value&actualValue) const{
@@ -83,7 +98,7 @@ public:
         }else{
             return mValuePast.extrapolate(t)
                 .blend(mValuePresent.extrapolate(t),
-                       timeSinceUpdate/mFadeTime);
+                       extrapolationBlendWeight(mBlend, timeSinceUpdate/mFadeTime));
         }
     }
     const Value& lastValue() const {
@@ -92,6 +107,20 @@ public:
     TimeType lastUpdateTime()const{
         return mValuePresent.time();
     }
+    /// The value being faded out, taken at lastUpdateTime() like lastValue().
+    const Value& pastValue() const {
+        return mValuePast.value();
+    }
+    const DurationType& fadeTime() const {
+        return mFadeTime;
+    }
+    ExtrapolationBlend blend() const {
+        return mBlend;
+    }
+    /// Takes effect from the next update on, and for the fade in progress.
+    void setBlend(ExtrapolationBlend blend) {
+        mBlend=blend;
+    }
     ExtrapolatorBase<Value, TimeType>& updateValue(const TimeType&t, const Value&l) {
         mValuePast=TemporalValueType(t,extrapolate(t));
         mValuePresent.updateValue(t,l);
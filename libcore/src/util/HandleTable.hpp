@@ -0,0 +1,158 @@
+/*  Sirikata Utilities -- Object Handle Table
+ *  HandleTable.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_HANDLE_TABLE_HPP_
+#define _SIRIKATA_HANDLE_TABLE_HPP_
+
+#include <vector>
+
+namespace Sirikata {
+
+/**
+ * Interns keys, usually UUIDs or ObjectReferences, as dense 32-bit handles.
+ * The key is hashed once, when it is inserted; whoever holds on to the handle
+ * afterwards finds its data in a SlotVector by plain indexing.
+ * Erased handles are reused by later inserts, so the handles stay compact.
+ */
+template <class Key, class Hasher=typename Key::Hasher>
+class HandleTable {
+public:
+    typedef uint32 Handle;
+    static const Handle npos=(Handle)-1;
+private:
+    typedef std::tr1::unordered_map<Key,Handle,Hasher> HandleMap;
+    HandleMap mHandles;
+    std::vector<Key> mKeys;
+    std::vector<bool> mInUse;
+    std::vector<Handle> mFree;
+public:
+    /// Returns the handle of key, assigning one if key has none yet
+    Handle insert(const Key&key) {
+        typename HandleMap::iterator where=mHandles.find(key);
+        if (where!=mHandles.end())
+            return where->second;
+        Handle handle;
+        if (mFree.empty()) {
+            handle=(Handle)mKeys.size();
+            mKeys.push_back(key);
+            mInUse.push_back(true);
+        } else {
+            handle=mFree.back();
+            mFree.pop_back();
+            mKeys[handle]=key;
+            mInUse[handle]=true;
+        }
+        mHandles.insert(typename HandleMap::value_type(key,handle));
+        return handle;
+    }
+    /// Returns the handle of key, or npos if it has none
+    Handle find(const Key&key) const {
+        typename HandleMap::const_iterator where=mHandles.find(key);
+        if (where==mHandles.end())
+            return npos;
+        return where->second;
+    }
+    bool valid(Handle handle) const {
+        return handle<mInUse.size()&&mInUse[handle];
+    }
+    /// The key a valid handle was inserted for
+    const Key&key(Handle handle) const {
+        return mKeys[handle];
+    }
+    /// Frees a valid handle for reuse; returns false if it was not in use
+    bool erase(Handle handle) {
+        if (!valid(handle))
+            return false;
+        mHandles.erase(mKeys[handle]);
+        mKeys[handle]=Key();
+        mInUse[handle]=false;
+        mFree.push_back(handle);
+        return true;
+    }
+    bool erase(const Key&key) {
+        return erase(find(key));
+    }
+    /// Number of keys with a handle
+    size_t size() const {
+        return mHandles.size();
+    }
+    /// One past the highest handle handed out so far: the size a SlotVector for this table grows to
+    size_t capacity() const {
+        return mKeys.size();
+    }
+};
+
+/**
+ * Per-handle storage for the handles of a HandleTable.
+ * Slots that were never set read back as a default constructed T, so a missing
+ * entry looks like an empty pointer rather than needing a separate find.
+ */
+template <class T>
+class SlotVector {
+    std::vector<T> mSlots;
+    T mEmpty;
+public:
+    typedef uint32 Handle;
+
+    SlotVector() : mEmpty() {
+    }
+    /// The slot of handle, growing the vector to hold it
+    T&operator[](Handle handle) {
+        if (handle>=mSlots.size())
+            mSlots.resize((size_t)handle+1);
+        return mSlots[handle];
+    }
+    /// The slot of handle, or an empty T if it is past the end
+    const T&get(Handle handle) const {
+        if (handle<mSlots.size())
+            return mSlots[handle];
+        return mEmpty;
+    }
+    /// Resets the slot of handle to an empty T
+    void reset(Handle handle) {
+        if (handle<mSlots.size())
+            mSlots[handle]=T();
+    }
+    size_t size() const {
+        return mSlots.size();
+    }
+    void clear() {
+        mSlots.clear();
+    }
+    void swap(SlotVector&other) {
+        mSlots.swap(other.mSlots);
+    }
+};
+
+}
+
+#endif //_SIRIKATA_HANDLE_TABLE_HPP_
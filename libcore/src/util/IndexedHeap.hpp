@@ -0,0 +1,169 @@
+/*  Sirikata Utilities -- Indexed Priority Heap
+ *  IndexedHeap.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_INDEXED_HEAP_HPP_
+#define _SIRIKATA_INDEXED_HEAP_HPP_
+
+#include <vector>
+#include <functional>
+
+namespace Sirikata {
+
+/**
+ * A 4-ary heap of (priority, item) pairs in one contiguous vector whose items
+ * remember their own slot, so changing or removing an item's priority is a
+ * sift instead of a search plus erase and reinsert.
+ * IndexOf(item), a const call, must return a reference to a size_t stored with the item; it
+ * holds npos while the item is not in a heap, so an item may be in one heap at a time.
+ * Before(a,b) is true when priority a should come out before b; the default pops the largest first.
+ */
+template <typename Item, typename Priority, class IndexOf, class Before=std::greater<Priority> >
+class IndexedHeap {
+public:
+    enum {ARITY=4};
+    static const size_t npos=(size_t)-1;
+private:
+    typedef std::pair<Priority,Item> Entry;
+    std::vector<Entry> mEntries;
+    IndexOf mIndexOf;
+    Before mBefore;
+
+    void place(size_t where, const Entry&entry) {
+        mEntries[where]=entry;
+        mIndexOf(mEntries[where].second)=where;
+    }
+    void siftUp(size_t where) {
+        Entry moving=mEntries[where];
+        while (where) {
+            size_t parent=(where-1)/ARITY;
+            if (!mBefore(moving.first,mEntries[parent].first))
+                break;
+            place(where,mEntries[parent]);
+            where=parent;
+        }
+        place(where,moving);
+    }
+    void siftDown(size_t where) {
+        Entry moving=mEntries[where];
+        size_t size=mEntries.size();
+        while (true) {
+            size_t first=where*ARITY+1;
+            if (first>=size)
+                break;
+            size_t best=first;
+            for (size_t child=first+1;child<first+ARITY&&child<size;++child) {
+                if (mBefore(mEntries[child].first,mEntries[best].first))
+                    best=child;
+            }
+            if (!mBefore(mEntries[best].first,moving.first))
+                break;
+            place(where,mEntries[best]);
+            where=best;
+        }
+        place(where,moving);
+    }
+    void removeAt(size_t where) {
+        mIndexOf(mEntries[where].second)=npos;
+        Entry last=mEntries.back();
+        mEntries.pop_back();
+        if (where<mEntries.size()) {
+            mEntries[where]=last;
+            reprioritizeAt(where,last.first);
+        }
+    }
+    void reprioritizeAt(size_t where, const Priority&priority) {
+        mEntries[where].first=priority;
+        if (where&&mBefore(priority,mEntries[(where-1)/ARITY].first))
+            siftUp(where);
+        else
+            siftDown(where);
+    }
+public:
+    IndexedHeap(const IndexOf&indexOf=IndexOf(), const Before&before=Before())
+        : mIndexOf(indexOf), mBefore(before) {
+    }
+    ~IndexedHeap() {
+        clear();
+    }
+    bool empty() const {
+        return mEntries.empty();
+    }
+    size_t size() const {
+        return mEntries.size();
+    }
+    bool contains(const Item&item) const {
+        size_t where=mIndexOf(item);
+        return where<mEntries.size()&&mEntries[where].second==item;
+    }
+    /// Adds item, or moves it to priority if it is already queued
+    void push(const Item&item, const Priority&priority) {
+        if (contains(item)) {
+            reprioritizeAt(mIndexOf(item),priority);
+            return;
+        }
+        mEntries.push_back(Entry(priority,item));
+        siftUp(mEntries.size()-1);
+    }
+    /// Moves a queued item to priority; returns false and does nothing if item is not queued
+    bool update(const Item&item, const Priority&priority) {
+        if (!contains(item))
+            return false;
+        reprioritizeAt(mIndexOf(item),priority);
+        return true;
+    }
+    /// Removes item if it is queued
+    bool erase(const Item&item) {
+        if (!contains(item))
+            return false;
+        removeAt(mIndexOf(item));
+        return true;
+    }
+    const Item&top() const {
+        return mEntries.front().second;
+    }
+    const Priority&topPriority() const {
+        return mEntries.front().first;
+    }
+    void pop() {
+        removeAt(0);
+    }
+    /// Empties the heap but keeps its storage for the next round
+    void clear() {
+        for (size_t i=0;i<mEntries.size();++i)
+            mIndexOf(mEntries[i].second)=npos;
+        mEntries.clear();
+    }
+};
+
+}
+
+#endif //_SIRIKATA_INDEXED_HEAP_HPP_
@@ -41,6 +41,9 @@ enum Ports{
     ROUTER=4,
     PERSISTENCE=5,
 	PHYSICS=6,
+    OSEG=7,
+    CSEG=8,
+    LOAD_BALANCER=9,
     OBJECT_CONNECTIONS=16383
 };
 }
@@ -34,18 +34,95 @@
 
 
 namespace Sirikata {
+/**
+ * A vector that keeps its first InlineSize elements inside itself, so that the
+ * usual handful of listeners costs no heap allocation. Only supports what Provider needs.
+ */
+template <typename T, unsigned int InlineSize> class SmallListenerVector {
+    T mInline[InlineSize];
+    uint32 mInlineUsed;
+    ///Holds every element once there were ever more than InlineSize of them
+    std::vector<T> mOverflow;
+public:
+    SmallListenerVector():mInlineUsed(0) {}
+    size_t size() const {
+        return mOverflow.empty()?mInlineUsed:mOverflow.size();
+    }
+    bool empty() const {
+        return size()==0;
+    }
+    T&operator[](size_t i) {
+        return mOverflow.empty()?mInline[i]:mOverflow[i];
+    }
+    const T&operator[](size_t i) const {
+        return mOverflow.empty()?mInline[i]:mOverflow[i];
+    }
+    T&back() {
+        return (*this)[size()-1];
+    }
+    void push_back(const T&value) {
+        if (!mOverflow.empty()) {
+            mOverflow.push_back(value);
+        }else if (mInlineUsed<InlineSize) {
+            mInline[mInlineUsed++]=value;
+        }else {
+            mOverflow.reserve(InlineSize*2);
+            mOverflow.insert(mOverflow.end(),mInline,mInline+InlineSize);
+            mOverflow.push_back(value);
+            for (uint32 i=0;i<InlineSize;++i) {
+                mInline[i]=T();
+            }
+            mInlineUsed=0;
+        }
+    }
+    void pop_back() {
+        if (!mOverflow.empty()) {
+            mOverflow.pop_back();
+            if (mOverflow.empty()) {
+                std::vector<T>().swap(mOverflow);
+            }
+        }else {
+            mInline[--mInlineUsed]=T();
+        }
+    }
+    void clear() {
+        while (!empty()) {
+            pop_back();
+        }
+    }
+};
+
 /**
  * This class gives listeners an interface to register themselves and a mechanism to notify listeners
  * Users of this class should remember to notify new listeners 
  */
 template <typename ListenerPtr> class Provider {
 protected:
-    typedef std::vector<ListenerPtr> ListenerVector;
+    enum {
+        ///Listeners stored without any allocation
+        INLINE_LISTENERS=4,
+        ///Beyond this many listeners removeListener looks them up in mListenerIndex rather than scanning
+        INDEXED_LISTENERS=8
+    };
+    typedef SmallListenerVector<ListenerPtr,INLINE_LISTENERS> ListenerVector;
     typedef std::map<ListenerPtr,uint32> ListenerMap;
     ///A list of listeners interested in updates from this class
     ListenerVector mListeners;
-    ///A map from listener pointers to indexes in the listeners vector
+    ///A map from listener pointers to indexes in the listeners vector, only filled while there are more than INDEXED_LISTENERS
     ListenerMap mListenerIndex;
+    uint32 listenerIndex(const ListenerPtr&p) {
+        if (mListeners.size()>INDEXED_LISTENERS) {
+            typename ListenerMap::iterator where=mListenerIndex.find(p);
+            assert(where!=mListenerIndex.end());
+            return where->second;
+        }
+        uint32 i=0;
+        while (i+1<mListeners.size()&&!(mListeners[i]==p)) {
+            ++i;
+        }
+        assert(mListeners[i]==p);
+        return i;
+    }
     virtual ~Provider(){}
    ///This function is called with a new listener just after every listener is added to the callbacks (Override for interesting behavior, such as feeding the initial values to it)
     virtual void listenerAdded(ListenerPtr ){}
@@ -171,12 +248,15 @@ public:
         if (mListeners.empty()) {
             mListeners.push_back(p);
             this->firstListenerAdded(p);
-        }else if (mListeners.size()==1) {
-            mListenerIndex[mListeners[0]]=0;
-            mListenerIndex[p]=1;
-            mListeners.push_back(p);
         }else {
-            mListenerIndex[p]=mListeners.size();
+            if (mListeners.size()==INDEXED_LISTENERS) {
+                for (uint32 i=0;i<mListeners.size();++i) {
+                    mListenerIndex[mListeners[i]]=i;
+                }
+            }
+            if (mListeners.size()>=INDEXED_LISTENERS) {
+                mListenerIndex[p]=mListeners.size();
+            }
             mListeners.push_back(p);
         }
         this->listenerAdded(p);
@@ -188,19 +268,26 @@ public:
     virtual void removeListener(ListenerPtr p) {
         this->listenerRemoved(p);
         if (mListeners.size()>1) {
-            typename ListenerMap::iterator where=mListenerIndex.find(p);
-            assert(where!=mListenerIndex.end());
-            if (where->second+1!=mListeners.size()) {
-                mListenerIndex[mListeners.back()]=where->second;
-                mListeners[where->second]=mListeners.back();
+            bool indexed=mListeners.size()>INDEXED_LISTENERS;
+            uint32 where=listenerIndex(p);
+            if (where+1!=mListeners.size()) {
+                if (indexed) {
+                    mListenerIndex[mListeners.back()]=where;
+                }
+                mListeners[where]=mListeners.back();
+            }
+            mListeners.pop_back();
+            if (indexed) {
+                if (mListeners.size()>INDEXED_LISTENERS) {
+                    mListenerIndex.erase(p);
+                }else {
+                    mListenerIndex=ListenerMap();
+                }
             }
-            mListeners.resize(mListeners.size()-1);                
-            mListenerIndex.erase(where);
         }else {
             this->lastListenerRemoved(p);
             assert(mListeners[0]==p);
-            mListeners.resize(0);
-            mListenerIndex=ListenerMap();
+            mListeners.clear();
         }
     }
 };
@@ -40,8 +40,11 @@ class Location: public Transform {
     Vector3<float32> mVelocity;
     Vector3<float32> mAxisOfRotation;
     float32 mAngularSpeed;
+    Vector3<float32> mAcceleration;
 
     void changeToWorld(const Location &reference) {
+        // Acceleration only picks up the reference's own; centripetal terms of a spinning reference are left out.
+        setAcceleration(reference.getAcceleration() + reference.getOrientation() * getAcceleration());
         setVelocity(reference.getVelocity() + reference.getOrientation() * getVelocity());
         addAngularRotation(reference.getAxisOfRotation(), reference.getAngularSpeed());
         setVelocity(getVelocity() +
@@ -63,6 +66,7 @@ class Location: public Transform {
         addAngularRotation(reference.getAxisOfRotation(), -reference.getAngularSpeed());
         Quaternion inverseOtherOrientation (reference.getOrientation().inverse());
         setVelocity(inverseOtherOrientation * (getVelocity() - reference.getVelocity()));
+        setAcceleration(inverseOtherOrientation * (getAcceleration() - reference.getAcceleration()));
     }
 public:
     Location(){}
@@ -70,14 +74,16 @@ public:
              const Quaternion&orientation,
              const Vector3<float32> &velocity,
              const Vector3<float32> angularVelocityAxis,
-             float32 angularVelocityRadians):Transform(position,orientation),mVelocity(velocity),mAxisOfRotation(angularVelocityAxis), mAngularSpeed(angularVelocityRadians) {}
+             float32 angularVelocityRadians,
+             const Vector3<float32> &acceleration=Vector3<float32>(0,0,0)):Transform(position,orientation),mVelocity(velocity),mAxisOfRotation(angularVelocityAxis), mAngularSpeed(angularVelocityRadians), mAcceleration(acceleration) {}
     bool operator ==(const Location&other)const {
         bool eq=getPosition()==other.getPosition();
         bool veq=other.mVelocity==mVelocity;
         bool qeq=getOrientation()==other.getOrientation();
         bool aeq=mAxisOfRotation==other.mAxisOfRotation;
         bool seq=mAngularSpeed==other.mAngularSpeed;
-        return eq&&veq&&qeq&&aeq&&seq;
+        bool acceq=mAcceleration==other.mAcceleration;
+        return eq&&veq&&qeq&&aeq&&seq&&acceq;
     }
 
     const Vector3<float32>&getVelocity()const {
@@ -86,6 +92,13 @@ public:
     void setVelocity(const Vector3<float32> velocity) {
         mVelocity=velocity;
     }
+    /// Zero unless the object is extrapolated with acceleration, see ExtrapolationBlend.
+    const Vector3<float32>&getAcceleration()const {
+        return mAcceleration;
+    }
+    void setAcceleration(const Vector3<float32> &acceleration) {
+        mAcceleration=acceleration;
+    }
     const Transform &getTransform() const {
         return *this;
     }
@@ -117,7 +130,8 @@ public:
                          (newLocation.getOrientation()*percentNew+getOrientation()*percentOld).normal(),
                          newLocation.getVelocity()*percentNew+getVelocity()*percentOld,
                          angAxis,
-                         angSpeed);
+                         angSpeed,
+                         newLocation.getAcceleration()*percentNew+getAcceleration()*percentOld);
     }
     Location toWorld(const Location &reference) const {
         Location copy(*this);
@@ -130,20 +144,22 @@ public:
         return copy;
     }
     template<class TimeDuration> Location extrapolate(const TimeDuration&dt)const {
-        return Location(getPosition()+Vector3<float64>(getVelocity())*dt.toSeconds(),
+        float64 seconds=dt.toSeconds();
+        return Location(getPosition()+(Vector3<float64>(getVelocity())+Vector3<float64>(getAcceleration())*(.5*seconds))*seconds,
                         getAngularSpeed()
                          ? getOrientation()*Quaternion(getAxisOfRotation(),
-                             getAngularSpeed()*dt.toSeconds())
+                             getAngularSpeed()*seconds)
                          : getOrientation(),
-                        getVelocity(),
+                        getVelocity()+getAcceleration()*(float32)seconds,
                         getAxisOfRotation(),
-                        getAngularSpeed());
+                        getAngularSpeed(),
+                        getAcceleration());
     }
 };
 inline std::ostream &operator<< (std::ostream &os, const Location &loc) {
     os << "[" << loc.getTransform() << "; vel=" <<
         loc.getVelocity() << "; angVel = " << loc.getAngularSpeed() <<
-        " around " << loc.getAxisOfRotation() << "]";
+        " around " << loc.getAxisOfRotation() << "; accel=" << loc.getAcceleration() << "]";
     return os;
 }
 
@@ -0,0 +1,194 @@
+/*  Sirikata Utilities -- Batched Location Extrapolation
+ *  LocationTable.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "LocationTable.hpp"
+#include <cmath>
+
+namespace Sirikata {
+
+void LocationTable::Samples::resize(size_t size) {
+    mPosX.resize(size, 0);
+    mPosY.resize(size, 0);
+    mPosZ.resize(size, 0);
+    mVelX.resize(size, 0);
+    mVelY.resize(size, 0);
+    mVelZ.resize(size, 0);
+    mAccX.resize(size, 0);
+    mAccY.resize(size, 0);
+    mAccZ.resize(size, 0);
+    mRotX.resize(size, 0);
+    mRotY.resize(size, 0);
+    mRotZ.resize(size, 0);
+    mRotW.resize(size, 1);
+    mAxisX.resize(size, 0);
+    mAxisY.resize(size, 1);
+    mAxisZ.resize(size, 0);
+    mAngularSpeed.resize(size, 0);
+}
+
+void LocationTable::Samples::set(Slot slot, const Location&loc) {
+    mPosX[slot] = loc.getPosition().x;
+    mPosY[slot] = loc.getPosition().y;
+    mPosZ[slot] = loc.getPosition().z;
+    mVelX[slot] = loc.getVelocity().x;
+    mVelY[slot] = loc.getVelocity().y;
+    mVelZ[slot] = loc.getVelocity().z;
+    mAccX[slot] = loc.getAcceleration().x;
+    mAccY[slot] = loc.getAcceleration().y;
+    mAccZ[slot] = loc.getAcceleration().z;
+    mRotX[slot] = loc.getOrientation().x;
+    mRotY[slot] = loc.getOrientation().y;
+    mRotZ[slot] = loc.getOrientation().z;
+    mRotW[slot] = loc.getOrientation().w;
+    mAxisX[slot] = loc.getAxisOfRotation().x;
+    mAxisY[slot] = loc.getAxisOfRotation().y;
+    mAxisZ[slot] = loc.getAxisOfRotation().z;
+    mAngularSpeed[slot] = loc.getAngularSpeed();
+}
+
+void LocationTable::Samples::advance(const float64 *dt, Samples&out) const {
+    size_t size = mPosX.size();
+    const float64 *px = &mPosX[0], *py = &mPosY[0], *pz = &mPosZ[0];
+    const float32 *vx = &mVelX[0], *vy = &mVelY[0], *vz = &mVelZ[0];
+    const float32 *ax = &mAccX[0], *ay = &mAccY[0], *az = &mAccZ[0];
+    float64 *ox = &out.mPosX[0], *oy = &out.mPosY[0], *oz = &out.mPosZ[0];
+    for (size_t i = 0; i < size; ++i) {
+        ox[i] = px[i] + (vx[i] + .5 * ax[i] * dt[i]) * dt[i];
+        oy[i] = py[i] + (vy[i] + .5 * ay[i] * dt[i]) * dt[i];
+        oz[i] = pz[i] + (vz[i] + .5 * az[i] * dt[i]) * dt[i];
+    }
+    // Most objects do not spin, so the trigonometry is only paid for those that do.
+    for (size_t i = 0; i < size; ++i) {
+        float32 x = mRotX[i], y = mRotY[i], z = mRotZ[i], w = mRotW[i];
+        if (mAngularSpeed[i]) {
+            float32 angle = (float32)(mAngularSpeed[i] * dt[i]);
+            float32 s = (float32)sin(angle * .5);
+            float32 ax = s * mAxisX[i], ay = s * mAxisY[i], az = s * mAxisZ[i];
+            float32 aw = (float32)cos(angle * .5);
+            float32 rw = w*aw - x*ax - y*ay - z*az;
+            float32 rx = w*ax + x*aw + y*az - z*ay;
+            float32 ry = w*ay + y*aw + z*ax - x*az;
+            float32 rz = w*az + z*aw + x*ay - y*ax;
+            x = rx; y = ry; z = rz; w = rw;
+        }
+        out.mRotX[i] = x;
+        out.mRotY[i] = y;
+        out.mRotZ[i] = z;
+        out.mRotW[i] = w;
+    }
+}
+
+LocationTable::LocationTable() : mExtrapolatedTime(Time::null()) {
+}
+
+LocationTable::Slot LocationTable::allocate() {
+    if (!mFreeSlots.empty()) {
+        Slot slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        return slot;
+    }
+    Slot slot = mUpdateTime.size();
+    size_t size = slot + 1;
+    mUpdateTime.resize(size, 0);
+    mFadeSeconds.resize(size, 0);
+    mHermite.resize(size, 0);
+    mStale.resize(size, 1);
+    mDelta.resize(size, 0);
+    mPast.resize(size);
+    mPresent.resize(size);
+    mPastResult.resize(size);
+    mResult.resize(size);
+    return slot;
+}
+
+void LocationTable::release(Slot slot) {
+    // A static sample costs the kernel nothing beyond its share of the flat loops.
+    Location origin(Vector3d(0,0,0), Quaternion::identity(), Vector3f(0,0,0), Vector3f(0,1,0), 0);
+    set(slot, Time::null(), origin, origin, Duration::zero());
+    mFreeSlots.push_back(slot);
+}
+
+void LocationTable::set(Slot slot, const Time&updated, const Location&past, const Location&present, const Duration&fade, ExtrapolationBlend blend) {
+    mUpdateTime[slot] = updated.raw();
+    mFadeSeconds[slot] = fade.toSeconds();
+    mHermite[slot] = (blend == HERMITE_BLEND);
+    mPast.set(slot, past);
+    mPresent.set(slot, present);
+    mStale[slot] = 1;
+}
+
+void LocationTable::extrapolate(const Time&now) {
+    mExtrapolatedTime = now;
+    size_t size = mUpdateTime.size();
+    if (size == 0) {
+        return;
+    }
+    uint64 nowRaw = now.raw();
+    const uint64 *updated = &mUpdateTime[0];
+    float64 *dt = &mDelta[0];
+    for (size_t i = 0; i < size; ++i) {
+        dt[i] = (float64)(int64)(nowRaw - updated[i]) * .000001;
+    }
+    mPresent.advance(dt, mResult);
+    mPast.advance(dt, mPastResult);
+    // Same weighting as TimedWeightedExtrapolatorBase::extrapolate followed by Location::blend.
+    const float64 *fade = &mFadeSeconds[0];
+    const char *hermite = &mHermite[0];
+    float64 *ox = &mResult.mPosX[0], *oy = &mResult.mPosY[0], *oz = &mResult.mPosZ[0];
+    const float64 *qx = &mPastResult.mPosX[0], *qy = &mPastResult.mPosY[0], *qz = &mPastResult.mPosZ[0];
+    float32 *rx = &mResult.mRotX[0], *ry = &mResult.mRotY[0], *rz = &mResult.mRotZ[0], *rw = &mResult.mRotW[0];
+    const float32 *sx = &mPastResult.mRotX[0], *sy = &mPastResult.mRotY[0], *sz = &mPastResult.mRotZ[0], *sw = &mPastResult.mRotW[0];
+    for (size_t i = 0; i < size; ++i) {
+        float32 percentNew = 1.0f;
+        if (fade[i] > 0 && dt[i] < fade[i]) {
+            float64 s = dt[i] / fade[i];
+            percentNew = (float32)(hermite[i] ? s*s*(3-2*s) : s);
+        }
+        float32 percentOld = 1.0f - percentNew;
+        ox[i] = ox[i] * percentNew + qx[i] * percentOld;
+        oy[i] = oy[i] * percentNew + qy[i] * percentOld;
+        oz[i] = oz[i] * percentNew + qz[i] * percentOld;
+        float32 x = rx[i] * percentNew + sx[i] * percentOld;
+        float32 y = ry[i] * percentNew + sy[i] * percentOld;
+        float32 z = rz[i] * percentNew + sz[i] * percentOld;
+        float32 w = rw[i] * percentNew + sw[i] * percentOld;
+        float32 len = sqrtf(x*x + y*y + z*z + w*w);
+        float32 scale = (percentNew < 1.0f && len > 1e-08f) ? 1.0f / len : 1.0f;
+        rx[i] = x * scale;
+        ry[i] = y * scale;
+        rz[i] = z * scale;
+        rw[i] = w * scale;
+    }
+    std::fill(mStale.begin(), mStale.end(), 0);
+}
+
+}
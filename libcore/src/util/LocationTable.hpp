@@ -0,0 +1,103 @@
+/*  Sirikata Utilities -- Batched Location Extrapolation
+ *  LocationTable.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_LOCATION_TABLE_HPP_
+#define _SIRIKATA_LOCATION_TABLE_HPP_
+#include "Location.hpp"
+#include "Extrapolation.hpp"
+#include "Time.hpp"
+
+namespace Sirikata {
+/**
+ * Holds the two samples of many TimedWeightedExtrapolator<Location> in
+ * structure-of-arrays form, so that extrapolate() moves all of them in a few
+ * flat loops the compiler can vectorize, instead of one virtual call and one
+ * scattered Location per object. Results are read back per slot until the
+ * next extrapolate() or until the slot's samples change.
+ */
+class SIRIKATA_EXPORT LocationTable {
+public:
+    typedef size_t Slot;
+private:
+    /// One Location per slot, split by component.
+    class Samples {
+    public:
+        std::vector<float64> mPosX, mPosY, mPosZ;
+        std::vector<float32> mVelX, mVelY, mVelZ;
+        std::vector<float32> mAccX, mAccY, mAccZ;
+        std::vector<float32> mRotX, mRotY, mRotZ, mRotW;
+        std::vector<float32> mAxisX, mAxisY, mAxisZ, mAngularSpeed;
+        void resize(size_t size);
+        void set(Slot slot, const Location&loc);
+        /// Moves every sample dt[i] seconds along its velocity and acceleration into out, which only receives position and orientation.
+        void advance(const float64 *dt, Samples&out) const;
+    };
+    std::vector<uint64> mUpdateTime;
+    std::vector<float64> mFadeSeconds;
+    std::vector<char> mHermite;
+    std::vector<char> mStale;
+    Samples mPast;
+    Samples mPresent;
+    Samples mPastResult;
+    Samples mResult;
+    std::vector<float64> mDelta;
+    std::vector<Slot> mFreeSlots;
+    Time mExtrapolatedTime;
+public:
+    LocationTable();
+    /// \returns a slot holding a static location at the origin until set() is called.
+    Slot allocate();
+    /// Makes slot available to a later allocate().
+    void release(Slot slot);
+    /// Stores the samples of an extrapolator: past and present were both taken at updated, and present fades in over fade.
+    void set(Slot slot, const Time&updated, const Location&past, const Location&present, const Duration&fade, ExtrapolationBlend blend=LINEAR_BLEND);
+    template <class Extrapolator> void set(Slot slot, const Extrapolator&extrapolator) {
+        set(slot, extrapolator.lastUpdateTime(), extrapolator.pastValue(), extrapolator.lastValue(), extrapolator.fadeTime(), extrapolator.blend());
+    }
+    /// Extrapolates every slot to now.
+    void extrapolate(const Time&now);
+    /// \returns whether position() and orientation() of slot hold its extrapolation to now.
+    bool isCurrent(Slot slot, const Time&now) const {
+        return now == mExtrapolatedTime && slot < mStale.size() && !mStale[slot];
+    }
+    Vector3d position(Slot slot) const {
+        return Vector3d(mResult.mPosX[slot], mResult.mPosY[slot], mResult.mPosZ[slot]);
+    }
+    Quaternion orientation(Slot slot) const {
+        return Quaternion(mResult.mRotX[slot], mResult.mRotY[slot], mResult.mRotZ[slot], mResult.mRotW[slot], Quaternion::XYZW());
+    }
+    /// Number of slots, including released ones.
+    size_t size() const {
+        return mUpdateTime.size();
+    }
+};
+}
+#endif
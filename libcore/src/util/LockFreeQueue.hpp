@@ -42,57 +42,120 @@ namespace Sirikata {
 /// A queue of any type that has thread-safe push() and pop() functions.
 template <typename T> class LockFreeQueue {
 private:
+    enum {
+        ///Assumed size of a cache line: mHead and mTail are kept this far apart so producers and consumers do not false share
+        CACHE_LINE_SIZE=64
+    };
     struct Node {
         volatile Node * mNext;
         T mContent;
+        ///Position of this node in its FreeNodePool, or NOT_POOLED if it came from the heap after the pool filled up
+        uint32 mIndex;
+        ///Index plus one of the next node on the free list, 0 for the end of the list
+        volatile uint32 mNextFree;
         void *operator new(size_t num_bytes) {
             return Sirikata::aligned_malloc<Node>(num_bytes,16);
         }
         void operator delete(void *data) {
             Sirikata::aligned_free(data);
         }
-        Node() :mNext(NULL), mContent() {
+        Node() :mNext(NULL), mContent(), mIndex(0), mNextFree(0) {
         }
     };
+    /**
+     * Hands out Nodes carved from cache line aligned slabs, so steady state queue operations never touch the global allocator.
+     * The free list head pairs a node index with a tag bumped on every change, and both are swapped together so a node
+     * popped and pushed back by other threads between a read and a compare and swap cannot be mistaken for an unchanged head (ABA).
+     */
     class FreeNodePool {
-
-        volatile Node *mHead;
+        enum {
+            SLAB_SIZE=64,
+            MAX_SLABS=1024,
+            NOT_POOLED=0xffffffff
+        };
+        ///Low 32 bits: index plus one of the first free node (0 if none). High 32 bits: ABA tag
+        volatile uint64 mFreeHead;
+        char mFreeHeadPad[CACHE_LINE_SIZE];
+        ///Number of slab slots claimed so far
+        AtomicValue<uint32> mNumSlabs;
+        Node* volatile mSlabs[MAX_SLABS];
+
+        Node *nodeAt(uint32 index) {
+            return mSlabs[index/SLAB_SIZE]+index%SLAB_SIZE;
+        }
+        static uint64 makeHead(uint64 oldHead, uint32 indexPlusOne) {
+            return (((oldHead>>32)+1)<<32)|indexPlusOne;
+        }
+        ///Pushes the chain of free nodes first..last (linked through mNextFree) onto the free list
+        void pushFree(Node *first, Node *last) {
+            uint64 oldHead;
+            do {
+                oldHead = mFreeHead;
+                last->mNextFree = (uint32)(oldHead&0xffffffff);
+            } while (!compare_and_swap(&mFreeHead, oldHead, makeHead(oldHead, first->mIndex+1)));
+        }
+        ///Carves out a new slab, keeping one node for the caller and putting the rest on the free list
+        Node *grow() {
+            uint32 whichSlab = (++mNumSlabs)-1;
+            if (whichSlab >= (uint32)MAX_SLABS) {
+                --mNumSlabs;
+                Node *retval = new Node();
+                retval->mIndex = NOT_POOLED;
+                return retval;
+            }
+            Node *slab = Sirikata::aligned_malloc<Node>(sizeof(Node)*SLAB_SIZE,CACHE_LINE_SIZE);
+            for (uint32 i=0;i<(uint32)SLAB_SIZE;++i) {
+                ::new (slab+i) Node();
+                slab[i].mIndex = whichSlab*SLAB_SIZE+i;
+                slab[i].mNextFree = (i+1<(uint32)SLAB_SIZE)?slab[i].mIndex+2:0;
+            }
+            mSlabs[whichSlab] = slab;
+            pushFree(slab+1, slab+SLAB_SIZE-1);
+            return slab;
+        }
     public:
-        FreeNodePool() {
-            mHead = new Node();
+        FreeNodePool() :mFreeHead(0), mNumSlabs(0) {
         }
 
         ~FreeNodePool() {
-            Node *cur = const_cast<Node*>(mHead);
-            Node *next = NULL;
-            do {
-                next = const_cast<Node*>(cur->mNext);
-                delete cur;
-            } while ((cur=next)!=NULL);
+            uint32 numSlabs = mNumSlabs.read();
+            for (uint32 i=0;i<numSlabs;++i) {
+                for (uint32 j=0;j<(uint32)SLAB_SIZE;++j) {
+                    mSlabs[i][j].~Node();
+                }
+                Sirikata::aligned_free(mSlabs[i]);
+            }
         }
 
         Node* allocate() {
-            volatile Node* node=0;
+            uint64 oldHead;
+            Node *node;
             do {
-                node = mHead->mNext;
-                if (node == 0) {
-                    return new Node();//FIXME should probably be aligned to size(Node) bytes
+                oldHead = mFreeHead;
+                uint32 indexPlusOne = (uint32)(oldHead&0xffffffff);
+                if (indexPlusOne == 0) {
+                    node = grow();
+                    break;
                 }
-            } while (!compare_and_swap(&mHead->mNext, node, node->mNext));
-            Node * return_node=(Node*)node;//FIXME volatile cast only allowed if mContent is primitive type of pointer size or less
-            return_node->mNext = NULL;
-            return_node->mContent=T();
-            return return_node;
+                node = nodeAt(indexPlusOne-1);
+            } while (!compare_and_swap(&mFreeHead, oldHead, makeHead(oldHead, node->mNextFree)));
+            node->mNext = NULL;
+            node->mContent=T();
+            return node;
         }
 
         void release(Node *node) {
             node->mContent = T();
-            do {
-                node->mNext = mHead->mNext;
-            } while (!compare_and_swap(&mHead->mNext, node->mNext, node));
+            if (node->mIndex == (uint32)NOT_POOLED) {
+                delete node;
+            }else {
+                pushFree(node, node);
+            }
         }
     } mFreeNodePool;
+    char mHeadPad[CACHE_LINE_SIZE];
     volatile Node *mHead;
+    char mTailPad[CACHE_LINE_SIZE];
     volatile Node *mTail;
 public:
     LockFreeQueue() {
@@ -202,6 +265,92 @@ public:
         compare_and_swap(&mTail, formerTail, newNode);
     }
 
+    /**
+     * Pushes count values onto the queue as one chain of nodes, so the whole batch costs a single successful compare and swap on the tail.
+     *
+     * @param values  points to count values which will be copied and placed onto the end of the queue in order.
+     */
+    void pushBatch(const T *values, size_t count) {
+        if (count==0) return;
+        Node* firstNode = mFreeNodePool.allocate();
+        firstNode->mContent = values[0];
+        Node* lastNode = firstNode;
+        for (size_t i=1;i<count;++i) {
+            Node* node = mFreeNodePool.allocate();
+            node->mContent = values[i];
+            lastNode->mNext = node;
+            lastNode = node;
+        }
+        volatile Node* formerTail = NULL;
+        volatile Node* formerTailNext=NULL;
+        volatile Node* newFirst=firstNode;
+        volatile Node* newLast=lastNode;
+        bool successfulAddNode = false;
+        while (!successfulAddNode) {
+            formerTail = mTail;
+            formerTailNext = formerTail->mNext;
+
+            if (mTail == formerTail) {
+                if (formerTailNext == 0)
+                    successfulAddNode = compare_and_swap(&mTail->mNext, (volatile Node*)0, newFirst);
+                else
+                    compare_and_swap(&mTail, formerTail, formerTailNext);
+            }
+        }
+
+        compare_and_swap(&mTail, formerTail, newLast);
+    }
+
+    /**
+     * Pops up to maxCount values from the front of the queue by advancing the head past all of them in a single compare and swap.
+     *
+     * @param values  receives the popped values in queue order.
+     * @returns       the number of values popped.
+     */
+    size_t popUpTo(T *values, size_t maxCount) {
+        if (maxCount==0) return 0;
+        volatile Node* formerHead = NULL;
+        volatile Node* newHead = NULL;
+        size_t count = 0;
+
+        bool headAlreadyAdvanced = false;
+        while (!headAlreadyAdvanced) {
+
+            formerHead = mHead;
+            if (formerHead == NULL) {
+            	// fork() function is operating on mTail.
+            	continue;
+            }
+            volatile Node*formerTail = mTail;
+            volatile Node* formerHeadNext = formerHead->mNext;
+
+            if (formerHead == mHead) {
+                if (formerHead == formerTail) {
+                    if (formerHeadNext == NULL) {
+                        return 0;
+                    }
+                    compare_and_swap(&mTail, formerTail, formerHeadNext);
+                }else {
+                    //walk no further than the tail we read, since the head may never pass the tail
+                    count = 0;
+                    newHead = formerHead;
+                    do {
+                        newHead = newHead->mNext;
+                        values[count++] = ((Node*)newHead)->mContent;//FIXME volatile cast only allowed if mContent is primitive type of pointer size or less
+                    } while (count < maxCount && newHead != formerTail && newHead->mNext != NULL);
+                    headAlreadyAdvanced = compare_and_swap(&mHead, formerHead, newHead);
+                }
+            }
+        }
+        //the old head and every node up to but not including the new head were consumed
+        while (formerHead != newHead) {
+            volatile Node* next = formerHead->mNext;
+            mFreeNodePool.release((Node*)formerHead);//FIXME volatile cast only allowed if mContent is primitive type of pointer size or less
+            formerHead = next;
+        }
+        return count;
+    }
+
     /**
      * Pops the front value from the queue and places it in value.
      *
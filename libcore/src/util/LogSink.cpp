@@ -0,0 +1,364 @@
+/*  Sirikata Utilities -- Asynchronous Log Sink
+ *  LogSink.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "LogSink.hpp"
+#include "SPSCRingBuffer.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+#include <cstdio>
+
+extern "C" {
+volatile int Sirikata_Logging_Async=0;
+}
+
+namespace Sirikata { namespace Logging {
+namespace {
+OptionValue *logAsync;
+OptionValue *logFile;
+OptionValue *logFormat;
+OptionValue *logBuffer;
+InitializeGlobalOptions o("",
+                    logAsync=new OptionValue("logasync","false",OptionValueType<bool>(),"hand log messages to a background thread to write out, so logging threads only pay for formatting them"),
+                    logFile=new OptionValue("logfile","",OptionValueType<String>(),"file the background log thread appends to (default: stderr)"),
+                    logFormat=new OptionValue("logformat","text",OptionValueType<String>(),"text, or binary for the timestamped records described in LogSink.hpp"),
+                    logBuffer=new OptionValue("logbuffer","1024",OptionValueType<uint32>(),"log records a thread may have waiting for the background log thread before it blocks"),
+                    NULL);
+
+struct ThreadLog;
+
+struct Record {
+    uint64 time;
+    ThreadLog *log;
+    uint16 level;
+    char module[LogSinkFormat::MAX_MODULE_LENGTH+1];
+    std::ostringstream *text;
+};
+
+///The rings one logging thread shares with the writer; outlives restarts of the writer thread
+struct ThreadLog {
+    uint32 thread;
+    ///Records waiting to be written: pushed by the logging thread, popped by the writer
+    SPSCRingBuffer<Record> full;
+    ///Written out streams handed back for reuse: pushed by the writer, popped by the logging thread
+    SPSCRingBuffer<std::ostringstream*> spare;
+    ///Set when the thread exits; the writer deletes the ThreadLog once it has drained it
+    volatile uint32 retired;
+    ThreadLog(uint32 thread, size_t capacity)
+     : thread(thread), full(capacity), spare(capacity), retired(0) {
+    }
+};
+
+void retireThreadLog(ThreadLog *log) {
+    memory_barrier();
+    log->retired=1;
+}
+
+bool earlier(const Record &a, const Record &b) {
+    return a.time<b.time;
+}
+
+void appendLittleEndian(String &out, uint64 value, int bytes) {
+    for (int i=0;i<bytes;++i) {
+        out+=(char)(value>>(8*i));
+    }
+}
+
+class LogWriter {
+    enum {
+        ///How long the writer thread sleeps when it finds nothing to write
+        IDLE_WAIT_MS=5,
+        ///Records popped from one thread at a time
+        DRAIN_CHUNK=256
+    };
+    boost::mutex mLock;
+    boost::condition_variable mWake;
+    boost::condition_variable mFlushed;
+    std::vector<ThreadLog*> mThreads;
+    uint32 mNextThread;
+    uint64 mFlushRequested;
+    uint64 mFlushDone;
+    bool mStopping;
+    boost::thread *mThread;
+    boost::thread_specific_ptr<ThreadLog> mThreadLog;
+    size_t mCapacity;
+    FILE *mOut;
+    bool mBinary;
+    String mConfig;
+    ///Formatting state every pooled stream is reset to once it has been written out
+    std::ostringstream mPristine;
+    std::vector<Record> mBatch;
+    std::vector<ThreadLog*> mRetired;
+    String mEncoded;
+
+    void drain() {
+        std::vector<ThreadLog*> threads;
+        {
+            boost::mutex::scoped_lock lock(mLock);
+            threads=mThreads;
+        }
+        Record chunk[DRAIN_CHUNK];
+        for (size_t i=0;i<threads.size();++i) {
+            bool retired=threads[i]->retired!=0;
+            memory_barrier();
+            size_t count;
+            while ((count=threads[i]->full.popUpTo(chunk,DRAIN_CHUNK))) {
+                mBatch.insert(mBatch.end(),chunk,chunk+count);
+            }
+            if (retired) {
+                mRetired.push_back(threads[i]);
+            }
+        }
+    }
+    void write() {
+        std::stable_sort(mBatch.begin(),mBatch.end(),&earlier);
+        for (size_t i=0;i<mBatch.size();++i) {
+            const Record &record=mBatch[i];
+            String text=record.text->str();
+            if (mBinary) {
+                size_t moduleLength=strlen(record.module);
+                mEncoded.clear();
+                appendLittleEndian(mEncoded,record.time,8);
+                appendLittleEndian(mEncoded,record.log->thread,4);
+                appendLittleEndian(mEncoded,record.level,2);
+                appendLittleEndian(mEncoded,moduleLength,2);
+                appendLittleEndian(mEncoded,text.size(),4);
+                mEncoded.append(record.module,moduleLength);
+                fwrite(mEncoded.data(),1,mEncoded.size(),mOut);
+            }
+            fwrite(text.data(),1,text.size(),mOut);
+            recycle(record);
+        }
+        if (!mBatch.empty()) {
+            fflush(mOut);
+        }
+        mBatch.clear();
+    }
+    void recycle(const Record &record) {
+        record.text->str(String());
+        record.text->clear();
+        record.text->copyfmt(mPristine);
+        if (record.log->retired||!record.log->spare.tryPush(record.text)) {
+            delete record.text;
+        }
+    }
+    void releaseRetired() {
+        if (mRetired.empty()) return;
+        boost::mutex::scoped_lock lock(mLock);
+        for (size_t i=0;i<mRetired.size();++i) {
+            mThreads.erase(std::find(mThreads.begin(),mThreads.end(),mRetired[i]));
+            std::ostringstream *spare;
+            while (mRetired[i]->spare.pop(spare)) {
+                delete spare;
+            }
+            delete mRetired[i];
+        }
+        mRetired.clear();
+    }
+    void run() {
+        while (true) {
+            uint64 flushing;
+            bool stopping;
+            {
+                boost::mutex::scoped_lock lock(mLock);
+                flushing=mFlushRequested;
+                stopping=mStopping;
+            }
+            drain();
+            bool wrote=!mBatch.empty();
+            write();
+            releaseRetired();
+            boost::mutex::scoped_lock lock(mLock);
+            if (mFlushDone<flushing) {
+                mFlushDone=flushing;
+                mFlushed.notify_all();
+            }
+            if (stopping) {
+                break;
+            }
+            if (!wrote&&!mStopping&&mFlushRequested==mFlushDone) {
+                mWake.timed_wait(lock,boost::posix_time::milliseconds((long)IDLE_WAIT_MS));
+            }
+        }
+    }
+public:
+    LogWriter()
+     : mNextThread(0), mFlushRequested(0), mFlushDone(0), mStopping(false), mThread(NULL),
+       mThreadLog(&retireThreadLog), mCapacity(1024), mOut(stderr), mBinary(false) {
+    }
+    const String &config() const {
+        return mConfig;
+    }
+    ThreadLog *threadLog() {
+        ThreadLog *log=mThreadLog.get();
+        if (!log) {
+            boost::mutex::scoped_lock lock(mLock);
+            log=new ThreadLog(mNextThread++,mCapacity);
+            mThreads.push_back(log);
+            mThreadLog.reset(log);
+        }
+        return log;
+    }
+    void start(const String &config, const String &file, bool binary, size_t capacity) {
+        mConfig=config;
+        mBinary=binary;
+        mCapacity=capacity?capacity:1;
+        mOut=stderr;
+        if (!file.empty()) {
+            FILE *out=fopen(file.c_str(),binary?"ab":"a");
+            if (out) {
+                mOut=out;
+            } else {
+                std::cerr<<"Could not open log file "<<file<<", logging to stderr"<<std::endl;
+            }
+        }
+        if (binary&&(fseek(mOut,0,SEEK_END)!=0||ftell(mOut)<=0)) {
+            fwrite(LogSinkFormat::BINARY_MAGIC,1,sizeof(LogSinkFormat::BINARY_MAGIC),mOut);
+        }
+        mStopping=false;
+        mThread=new boost::thread(std::tr1::bind(&LogWriter::run,this));
+        memory_barrier();
+        Sirikata_Logging_Async=1;
+    }
+    void stop() {
+        if (!mThread) return;
+        Sirikata_Logging_Async=0;
+        memory_barrier();
+        {
+            boost::mutex::scoped_lock lock(mLock);
+            mStopping=true;
+            mWake.notify_one();
+        }
+        mThread->join();
+        delete mThread;
+        mThread=NULL;
+        // The writer is gone, so this thread may drain whatever was queued while it finished
+        drain();
+        write();
+        releaseRetired();
+        if (mOut!=stderr) {
+            fclose(mOut);
+        }
+        mOut=stderr;
+        mConfig=String();
+        boost::mutex::scoped_lock lock(mLock);
+        mFlushDone=mFlushRequested;
+        mFlushed.notify_all();
+    }
+    void flush() {
+        boost::mutex::scoped_lock lock(mLock);
+        uint64 generation=++mFlushRequested;
+        mWake.notify_one();
+        while (mThread&&mFlushDone<generation) {
+            mFlushed.wait(lock);
+        }
+    }
+};
+
+///Created the first time logasync is turned on and never destroyed, since any thread may still hold its ThreadLog
+LogWriter *sWriter=NULL;
+
+class ShutdownAtExit {public:
+    ~ShutdownAtExit() {
+        shutdownLogSink();
+    }
+} sShutdownAtExit;
+}
+
+std::ostream &beginRecord() {
+    ThreadLog *log=sWriter->threadLog();
+    std::ostringstream *text;
+    if (!log->spare.pop(text)) {
+        text=new std::ostringstream;
+    }
+    return *text;
+}
+
+void endRecord(std::ostream &stream, const char *module, LOGGING_LEVEL level) {
+    std::ostringstream *text=static_cast<std::ostringstream*>(&stream);
+    if (!Sirikata_Logging_Async) {
+        // The sink was shut down while this record was being formatted
+        std::cerr<<text->str();
+        delete text;
+        return;
+    }
+    Record record;
+    record.time=Task::AbsTime::now().raw();
+    record.log=sWriter->threadLog();
+    record.level=(uint16)level;
+    strncpy(record.module,module,LogSinkFormat::MAX_MODULE_LENGTH);
+    record.module[LogSinkFormat::MAX_MODULE_LENGTH]='\0';
+    record.text=text;
+    record.log->full.push(record);
+    if (level==fatal) {
+        sWriter->flush();
+    }
+}
+
+void flushLog() {
+    if (Sirikata_Logging_Async) {
+        sWriter->flush();
+    }
+    std::cerr.flush();
+}
+
+void logSinkOptionsChanged() {
+    if (!logAsync) {
+        // Options set from static initializers that run before this file's
+        return;
+    }
+    bool async=logAsync->as<bool>();
+    String config;
+    if (async) {
+        std::ostringstream joined;
+        joined<<logFile->as<String>()<<'\n'<<logFormat->as<String>()<<'\n'<<logBuffer->as<uint32>();
+        config=joined.str();
+    }
+    if (sWriter&&sWriter->config()==config) {
+        return;
+    }
+    shutdownLogSink();
+    if (async) {
+        if (!sWriter) {
+            sWriter=new LogWriter;
+        }
+        sWriter->start(config,logFile->as<String>(),logFormat->as<String>()=="binary",logBuffer->as<uint32>());
+    }
+}
+
+void shutdownLogSink() {
+    if (sWriter) {
+        sWriter->stop();
+    }
+}
+
+} }
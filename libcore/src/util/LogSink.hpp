@@ -0,0 +1,58 @@
+/*  Sirikata Utilities -- Asynchronous Log Sink
+ *  LogSink.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_LOG_SINK_HPP_
+#define _SIRIKATA_LOG_SINK_HPP_
+
+namespace Sirikata { namespace Logging {
+/**
+ * Layout of the files written with --logasync=true --logformat=binary.
+ * The file begins with the 8 bytes of BINARY_MAGIC, then holds one record per
+ * log statement: a little endian uint64 time in microseconds, uint32 thread
+ * number, uint16 level, uint16 module length and uint32 text length, followed
+ * by the module name and then the text, neither of them nul terminated.
+ * Thread numbers are handed out in the order threads first log.
+ */
+namespace LogSinkFormat {
+static const char BINARY_MAGIC[8]={'S','I','L','O','G','B','0','1'};
+enum {
+    MAX_MODULE_LENGTH=31,
+    RECORD_HEADER_SIZE=8+4+2+2+4
+};
+}
+
+///Reacts to a change in the logasync, logfile, logformat or logbuffer options, starting or stopping the writer thread
+SIRIKATA_EXPORT void logSinkOptionsChanged();
+///Writes out every record handed to the sink so far and stops its writer thread; later log statements go straight to std::cerr
+SIRIKATA_EXPORT void shutdownLogSink();
+
+} }
+#endif
@@ -31,10 +31,17 @@
  */
 #include "util/Standard.hh"
 #include "options/Options.hpp"
+#include "util/AtomicTypes.hpp"
+#include "util/LogSink.hpp"
+#include "util/Metrics.hpp"
+#include "util/ProfiledMutex.hpp"
+#include "network/MetricsEndpoint.hpp"
+#include "util/TraceEvents.hpp"
 extern "C" {
 void *Sirikata_Logging_OptionValue_defaultLevel;
 void *Sirikata_Logging_OptionValue_atLeastLevel;
 void *Sirikata_Logging_OptionValue_moduleLevel;
+volatile int Sirikata_Logging_LevelEpoch=0;
 }
 namespace Sirikata { namespace Logging {
 class LogLevelParser {public:
@@ -105,4 +112,25 @@ InitializeGlobalOptions o("",
 
 std::tr1::unordered_map<std::string,LOGGING_LEVEL> module_level;
 
+//needs to use unsafeAs because the LOGGING_LEVEL typeinfos are not preserved across dll lines
+LOGGING_LEVEL moduleLevel(const char *module) {
+    LOGGING_LEVEL defaultLevel=reinterpret_cast<OptionValue*>(Sirikata_Logging_OptionValue_defaultLevel)->unsafeAs<LOGGING_LEVEL>();
+    const std::tr1::unordered_map<std::string,LOGGING_LEVEL>&levels=
+        reinterpret_cast<OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,LOGGING_LEVEL> >();
+    std::tr1::unordered_map<std::string,LOGGING_LEVEL>::const_iterator where=levels.find(module);
+    if (where!=levels.end()&&where->second<defaultLevel)
+        return where->second;
+    return defaultLevel;
+}
+
+void levelsChanged() {
+    memory_barrier();
+    ++Sirikata_Logging_LevelEpoch;
+    logSinkOptionsChanged();
+    Metrics::metricsOptionsChanged();
+    Metrics::LockProfile::optionsChanged();
+    Network::metricsEndpointOptionsChanged();
+    Trace::traceOptionsChanged();
+}
+
 } }
@@ -36,6 +36,10 @@
 extern "C" SIRIKATA_EXPORT void* Sirikata_Logging_OptionValue_defaultLevel;
 extern "C" SIRIKATA_EXPORT void* Sirikata_Logging_OptionValue_atLeastLevel;
 extern "C" SIRIKATA_EXPORT void* Sirikata_Logging_OptionValue_moduleLevel;
+///Bumped by Logging::levelsChanged() so cached levels at each log statement get re-read
+extern "C" SIRIKATA_EXPORT volatile int Sirikata_Logging_LevelEpoch;
+///Nonzero while SILOG statements hand their text to the background writer of LogSink.cpp instead of std::cerr
+extern "C" SIRIKATA_EXPORT volatile int Sirikata_Logging_Async;
 namespace Sirikata {
 class OptionValue;
 namespace Logging {
@@ -48,22 +52,74 @@ enum LOGGING_LEVEL {
     debug=4096,
     insane=32768
 };
+
+///The level a log statement for module must be at or below to print: the lower of loglevel and its moduleloglevel entry
+SIRIKATA_EXPORT LOGGING_LEVEL moduleLevel(const char *module);
+///Call after changing loglevel, moduleloglevel, the LogSink, metrics, metrics endpoint or trace options other than through OptionSet parsing
+SIRIKATA_EXPORT void levelsChanged();
+
+///One log statement's copy of moduleLevel(), valid while epoch matches Sirikata_Logging_LevelEpoch
+struct CachedLevel {
+    int epoch;
+    const char *module;
+    LOGGING_LEVEL level;
+};
+inline LOGGING_LEVEL cachedLevel(CachedLevel &cache, const char *module) {
+    int epoch = Sirikata_Logging_LevelEpoch;
+    if (cache.epoch != epoch || cache.module != module) {
+        cache.level = moduleLevel(module);
+        cache.module = module;
+        cache.epoch = epoch;
+    }
+    return cache.level;
+}
+
+///Takes a cleared stream from the calling thread's pool to format one record into
+SIRIKATA_EXPORT std::ostream &beginRecord();
+///Queues the text written to stream for the writer thread; fatal records are waited on until they are written
+SIRIKATA_EXPORT void endRecord(std::ostream &stream, const char *module, LOGGING_LEVEL level);
+///Waits until every record queued so far has been written out and flushed
+SIRIKATA_EXPORT void flushLog();
+
+///Where one SILOG statement writes: std::cerr, or with logasync a pooled stream that is queued when the statement ends
+class LogRecord {
+    std::ostream *mStream;
+    const char *mModule;
+    LOGGING_LEVEL mLevel;
+    bool mAsync;
+    LogRecord(const LogRecord &other);
+    void operator=(const LogRecord &other);
+public:
+    LogRecord(const char *module, LOGGING_LEVEL level)
+     : mModule(module), mLevel(level), mAsync(Sirikata_Logging_Async!=0) {
+        mStream = mAsync ? &beginRecord() : &std::cerr;
+    }
+    ~LogRecord() {
+        if (mAsync)
+            endRecord(*mStream, mModule, mLevel);
+    }
+    std::ostream &stream() {
+        return *mStream;
+    }
+};
 } }
+namespace {
+///Each source line gets its own CachedLevel; two statements for different modules on one line just share and re-read.
+template <int line> struct SilogCallSite {
+    static Sirikata::Logging::CachedLevel sCache;
+};
+template <int line> Sirikata::Logging::CachedLevel SilogCallSite<line>::sCache = {-1, NULL, Sirikata::Logging::insane};
+}
 #if 1
 # ifdef DEBUG_ALL
 #  define SILOGP(module,lvl) true
 # else
-//needs to use unsafeAs because the LOGGING_LEVEL typeinfos are not preserved across dll lines
 #  define SILOGP(module,lvl) \
-    (reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_defaultLevel)->unsafeAs<Sirikata::Logging::LOGGING_LEVEL>()>=Sirikata::Logging::lvl&& \
-        ( (reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().find(#module)==reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().end() && \
-           reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_defaultLevel)->unsafeAs<Sirikata::Logging::LOGGING_LEVEL>()>=(Sirikata::Logging::lvl)) \
-		   || (reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().find(#module)!=reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >().end() && \
-              reinterpret_cast<Sirikata::OptionValue*>(Sirikata_Logging_OptionValue_moduleLevel)->unsafeAs<std::tr1::unordered_map<std::string,Sirikata::Logging::LOGGING_LEVEL> >()[#module]>=Sirikata::Logging::lvl)))
+    (Sirikata::Logging::cachedLevel(::SilogCallSite<__LINE__>::sCache, #module)>=Sirikata::Logging::lvl)
 # endif
 # define SILOGNOCR(module,lvl,value) \
     if (SILOGP(module,lvl)) \
-        std::cerr << value
+        Sirikata::Logging::LogRecord(#module,Sirikata::Logging::lvl).stream() << value
 # define SILOG(module,lvl,value) SILOGNOCR(module,lvl,value) << std::endl
 #else
 # define SILOGP(module,lvl) false
@@ -0,0 +1,77 @@
+/*  Sirikata Utilities -- Read Only File Mapping
+ *  MappedFile.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "MappedFile.hpp"
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace Sirikata {
+
+MappedFile::MappedFile(const String&name):mData(NULL),mSize(0) {
+#ifndef _WIN32
+    int fd=open(name.c_str(),O_RDONLY);
+    if (fd<0)
+        return;
+    struct stat info;
+    if (fstat(fd,&info)==0&&info.st_size>0) {
+        void*address=mmap(NULL,(size_t)info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (address!=MAP_FAILED) {
+            mData=(const char*)address;
+            mSize=(size_t)info.st_size;
+        }
+    }
+    close(fd);
+#else
+    std::ifstream in(name.c_str(),std::ios::in|std::ios::binary);
+    if (in) {
+        mCopy.assign(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+        if (!mCopy.empty()) {
+            mData=&mCopy[0];
+            mSize=mCopy.size();
+        }
+    }
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mData)
+        munmap((void*)mData,mSize);
+#endif
+}
+
+}
@@ -0,0 +1,120 @@
+/*  Sirikata Utilities -- Memory Accounting
+ *  MemoryAccounting.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "MemoryAccounting.hpp"
+#include "Metrics.hpp"
+#include <new>
+#ifdef SIRIKATA_MEMORY_ARENAS
+#include <jemalloc/jemalloc.h>
+#endif
+
+namespace Sirikata { namespace Memory {
+namespace {
+const char *sTagNames[NUM_TAGS]={"transfer","network","proxy","graphics","messages"};
+
+///Never destroyed: memory is still released by static destructors after this file's statics would be gone
+Metrics::Gauge *gauges() {
+    static Metrics::Gauge *sGauges=NULL;
+    if (!sGauges) {
+        static const char *sDescriptions[NUM_TAGS]={
+            "bytes of downloaded and cached content",
+            "bytes of Chunks held by streams and their callers",
+            "bytes of ProxyObjects",
+            "bytes of GraphicsResource objects, not counting what Ogre allocates for them",
+            "bytes of messages waiting in ObjectHost queues"};
+        Metrics::Gauge *created=(Metrics::Gauge*)::operator new(sizeof(Metrics::Gauge)*NUM_TAGS);
+        for (int i=0;i<NUM_TAGS;++i) {
+            new (created+i) Metrics::Gauge(String("memory.")+sTagNames[i]+".bytes",sDescriptions[i]);
+        }
+        sGauges=created;
+    }
+    return sGauges;
+}
+///Makes sure the gauges are registered before main, while only one thread is running
+Metrics::Gauge *sGaugesAtStartup=gauges();
+
+#ifdef SIRIKATA_MEMORY_ARENAS
+unsigned int sArenas[NUM_TAGS];
+bool sArenasCreated=false;
+///One arena per tag, created before main like the gauges; allocations before that use arena 0
+bool createArenas() {
+    for (int i=0;i<NUM_TAGS;++i) {
+        size_t size=sizeof(sArenas[i]);
+        if (mallctl("arenas.create",&sArenas[i],&size,NULL,0)) {
+            return false;
+        }
+    }
+    return true;
+}
+bool sArenasCreatedAtStartup=(sArenasCreated=createArenas());
+#endif
+}
+
+const char *tagName(Tag tag) {
+    return sTagNames[tag];
+}
+
+int64 liveBytes(Tag tag) {
+    return gauges()[tag].value();
+}
+
+void adjust(Tag tag, int64 bytes) {
+    gauges()[tag].add(bytes);
+}
+
+void *allocate(Tag tag, size_t bytes) {
+    void *data;
+#ifdef SIRIKATA_MEMORY_ARENAS
+    data=mallocx(bytes?bytes:1,sArenasCreated?MALLOCX_ARENA(sArenas[tag]):0);
+#else
+    data=malloc(bytes?bytes:1);
+#endif
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    gauges()[tag].add((int64)bytes);
+    return data;
+}
+
+void release(Tag tag, void *data, size_t bytes) {
+    if (!data) {
+        return;
+    }
+    gauges()[tag].add(-(int64)bytes);
+#ifdef SIRIKATA_MEMORY_ARENAS
+    sdallocx(data,bytes?bytes:1,0);
+#else
+    free(data);
+#endif
+}
+
+} }
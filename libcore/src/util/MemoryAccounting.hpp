@@ -0,0 +1,112 @@
+/*  Sirikata Utilities -- Memory Accounting
+ *  MemoryAccounting.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_MEMORY_ACCOUNTING_HPP_
+#define _SIRIKATA_MEMORY_ACCOUNTING_HPP_
+
+#include <memory>
+
+namespace Sirikata { namespace Memory {
+/**
+ * The subsystems heap memory is accounted to. Each has a live byte count
+ * surfaced as the memory.<name>.bytes gauge, and, when the tree is built with
+ * SIRIKATA_MEMORY_ARENAS, a jemalloc arena of its own that can be tuned apart
+ * from the rest of the process.
+ */
+enum Tag {
+    TRANSFER, ///< downloaded and cached content, i.e. DenseData
+    NETWORK, ///< Chunks received from or queued for streams
+    PROXY, ///< ProxyObjects
+    GRAPHICS, ///< GraphicsResource bookkeeping; Ogre's own allocations are not seen here
+    MESSAGES, ///< messages waiting in the ObjectHost's queue
+    NUM_TAGS
+};
+
+SIRIKATA_EXPORT const char *tagName(Tag tag);
+///Bytes currently allocated under tag
+SIRIKATA_EXPORT int64 liveBytes(Tag tag);
+///Accounts bytes held under tag that were allocated elsewhere, negative once they are given back
+SIRIKATA_EXPORT void adjust(Tag tag, int64 bytes);
+///Allocates bytes under tag, from its arena if there is one; throws std::bad_alloc
+SIRIKATA_EXPORT void *allocate(Tag tag, size_t bytes);
+///Frees memory from allocate(tag,bytes) with the same tag and size
+SIRIKATA_EXPORT void release(Tag tag, void *data, size_t bytes);
+
+/**
+ * Base class that accounts every instance of its subclasses to TagValue.
+ * The sized operator delete sees the size of the most derived class, so
+ * subclasses need no declarations of their own.
+ */
+template <int TagValue>
+class Accounted {
+public:
+    static void *operator new(size_t bytes) {
+        return allocate((Tag)TagValue,bytes);
+    }
+    static void operator delete(void *data, size_t bytes) {
+        release((Tag)TagValue,data,bytes);
+    }
+};
+
+///STL allocator that accounts a container's storage to TagValue
+template <class T, int TagValue>
+class Allocator : public std::allocator<T> {
+public:
+    typedef size_t size_type;
+    typedef T *pointer;
+    template <class U> struct rebind {
+        typedef Allocator<U,TagValue> other;
+    };
+    Allocator() {
+    }
+    Allocator(const Allocator &other) : std::allocator<T>(other) {
+    }
+    template <class U> Allocator(const Allocator<U,TagValue> &) {
+    }
+    pointer allocate(size_type count, const void * =0) {
+        return (pointer)Memory::allocate((Tag)TagValue,count*sizeof(T));
+    }
+    void deallocate(pointer data, size_type count) {
+        Memory::release((Tag)TagValue,data,count*sizeof(T));
+    }
+};
+template <class T, class U, int TagValue>
+bool operator==(const Allocator<T,TagValue> &, const Allocator<U,TagValue> &) {
+    return true;
+}
+template <class T, class U, int TagValue>
+bool operator!=(const Allocator<T,TagValue> &, const Allocator<U,TagValue> &) {
+    return false;
+}
+
+} }
+
+#endif //_SIRIKATA_MEMORY_ACCOUNTING_HPP_
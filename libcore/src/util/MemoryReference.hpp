@@ -52,7 +52,7 @@ public:
         first=s.data();
         second=s.length();
     }
-    template <class U> explicit DataReference(const std::vector<U> &v) {
+    template <class U, class A> explicit DataReference(const std::vector<U,A> &v) {
         if (v.empty()) {
             first=NULL;
             second=0;
@@ -0,0 +1,100 @@
+/*  Sirikata Utilities -- Message Object Pool
+ *  MessagePool.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_MESSAGE_POOL_HPP_
+#define _SIRIKATA_MESSAGE_POOL_HPP_
+#include <boost/thread/tss.hpp>
+namespace Sirikata {
+
+/**
+ * Keeps decoded messages around between uses, so parsing the next message
+ * reuses the strings and repeated field storage left by the last one instead
+ * of allocating them again.  Each thread keeps its own free list, so neither
+ * acquiring nor releasing takes a lock.  Messages are emptied with Clear()
+ * when they come back to the pool.
+ */
+template <class T> class MessagePool : Noncopyable {
+    typedef std::vector<T*> FreeList;
+    boost::thread_specific_ptr<FreeList> mFree;
+    size_t mMaxFree;
+    static void destroyFreeList(FreeList*freeList) {
+        for (typename FreeList::iterator i=freeList->begin(),ie=freeList->end();i!=ie;++i) {
+            delete *i;
+        }
+        delete freeList;
+    }
+public:
+    ///\param maxFree how many idle messages each thread holds onto
+    explicit MessagePool(size_t maxFree=8):mFree(&destroyFreeList),mMaxFree(maxFree) {
+    }
+    ///\returns an empty message, which must be given back with release() when done
+    T*acquire() {
+        FreeList*freeList=mFree.get();
+        if (freeList&&!freeList->empty()) {
+            T*retval=freeList->back();
+            freeList->pop_back();
+            return retval;
+        }
+        return new T;
+    }
+    void release(T*message) {
+        FreeList*freeList=mFree.get();
+        if (!freeList) {
+            mFree.reset(freeList=new FreeList);
+        }
+        if (freeList->size()<mMaxFree) {
+            message->Clear();
+            freeList->push_back(message);
+        }else {
+            delete message;
+        }
+    }
+    ///Holds a message from the pool for the current scope
+    class Handle : Noncopyable {
+        MessagePool&mPool;
+        T*mMessage;
+    public:
+        explicit Handle(MessagePool&pool):mPool(pool),mMessage(pool.acquire()) {
+        }
+        ~Handle() {
+            mPool.release(mMessage);
+        }
+        T&operator*() const {
+            return *mMessage;
+        }
+        T*operator->() const {
+            return mMessage;
+        }
+    };
+};
+
+}
+#endif
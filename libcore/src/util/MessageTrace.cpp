@@ -0,0 +1,174 @@
+/*  Sirikata Utilities -- Message Latency Tracing
+ *  MessageTrace.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "MessageTrace.hpp"
+#include "Metrics.hpp"
+#include "AtomicTypes.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+
+namespace Sirikata { namespace MessageTrace {
+namespace {
+OptionValue *messageTraceRate;
+InitializeGlobalOptions o("",
+                    messageTraceRate=new OptionValue("messagetracerate","0",OptionValueType<uint32>(),"trace one in this many messages sent by hosted objects through to their receiver, 0 for none"),
+                    NULL);
+
+AtomicValue<uint32> sNumSent(0);
+
+const char *hopName(unsigned int hop) {
+    switch(hop) {
+      case OBJECT_SEND: return "object_send";
+      case SPACE_RECEIVE: return "space_receive";
+      case SPACE_SEND: return "space_send";
+      case OBJECT_RECEIVE: return "object_receive";
+      default: return "unknown";
+    }
+}
+
+/**
+ * The histograms for each pair of hops, made the first time that pair is
+ * seen. Like every trace, they live until exit.
+ */
+class Latencies {
+    boost::mutex mLock;
+    Metrics::Histogram *mHops[NUM_HOPS][NUM_HOPS];
+    Metrics::Histogram mEndToEnd;
+public:
+    Latencies():mEndToEnd("message.latency.end_to_end_us","microseconds from the first traced hop of a message to its last") {
+        memset(mHops,0,sizeof(mHops));
+    }
+    Metrics::Histogram &between(unsigned int from, unsigned int to) {
+        if (from>=NUM_HOPS) from=0;
+        if (to>=NUM_HOPS) to=0;
+        boost::mutex::scoped_lock lock(mLock);
+        if (!mHops[from][to]) {
+            mHops[from][to]=new Metrics::Histogram(String("message.latency.")+hopName(from)+"."+hopName(to)+"_us",
+                                                   String("microseconds traced messages took from ")+hopName(from)+" to "+hopName(to));
+        }
+        return *mHops[from][to];
+    }
+    Metrics::Histogram &endToEnd() {
+        return mEndToEnd;
+    }
+};
+Latencies &latencies() {
+    static Latencies *sLatencies=new Latencies;
+    return *sLatencies;
+}
+
+void appendVarint(String &output, uint64 value) {
+    while (value>=128) {
+        output+=(char)((value&127)|128);
+        value>>=7;
+    }
+    output+=(char)value;
+}
+
+bool parseVarint(const String &input, size_t &offset, uint64 &value) {
+    value=0;
+    for (unsigned int shift=0;offset<input.size()&&shift<64;shift+=7) {
+        unsigned char cur=(unsigned char)input[offset++];
+        value|=((uint64)(cur&127))<<shift;
+        if ((cur&128)==0)
+            return true;
+    }
+    return false;
+}
+
+void appendHop(String &context, Hop hop) {
+    appendVarint(context,hop);
+    appendVarint(context,Task::AbsTime::now().raw());
+}
+}
+
+void begin(RoutableMessageHeader &header, Hop hop) {
+    if (header.has_trace_context()) {
+        stamp(header,hop);
+        return;
+    }
+    uint32 rate=messageTraceRate->as<uint32>();
+    if (rate==0||(sNumSent++)%rate!=0)
+        return;
+    appendHop(header.mutable_trace_context(),hop);
+}
+
+void force(RoutableMessageHeader &header, Hop hop) {
+    String &context=header.mutable_trace_context();
+    context.resize(0);
+    appendHop(context,hop);
+}
+
+void stamp(RoutableMessageHeader &header, Hop hop) {
+    if (header.has_trace_context())
+        appendHop(header.mutable_trace_context(),hop);
+}
+
+void stamp(RoutableMessageHeaderView &header, Hop hop) {
+    if (!header.has_trace_context())
+        return;
+    String context=header.trace_context();
+    appendHop(context,hop);
+    header.set_trace_context(context);
+}
+
+void finish(const RoutableMessageHeader &header, Hop hop) {
+    if (!header.has_trace_context())
+        return;
+    String context=header.trace_context();
+    appendHop(context,hop);
+    std::vector<std::pair<Hop,uint64> > hops;
+    parse(context,hops);
+    Latencies &histograms=latencies();
+    for (size_t i=1;i<hops.size();++i) {
+        uint64 gap=hops[i].second>hops[i-1].second?hops[i].second-hops[i-1].second:0;
+        histograms.between(hops[i-1].first,hops[i].first).record(gap);
+    }
+    if (hops.size()>1) {
+        uint64 first=hops.front().second,last=hops.back().second;
+        histograms.endToEnd().record(last>first?last-first:0);
+    }
+}
+
+bool parse(const String &context, std::vector<std::pair<Hop,uint64> > &hops) {
+    size_t offset=0;
+    while (offset<context.size()) {
+        uint64 hop,time;
+        if (!parseVarint(context,offset,hop)||!parseVarint(context,offset,time))
+            return false;
+        hops.push_back(std::pair<Hop,uint64>((Hop)hop,time));
+    }
+    return true;
+}
+
+} }
@@ -0,0 +1,78 @@
+/*  Sirikata Utilities -- Message Latency Tracing
+ *  MessageTrace.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_MESSAGE_TRACE_HPP_
+#define _SIRIKATA_MESSAGE_TRACE_HPP_
+#include "RoutableMessageHeader.hpp"
+#include "RoutableMessageHeaderView.hpp"
+
+namespace Sirikata {
+/**
+ * Follows a sample of messages from the HostedObject that sends them, through
+ * the space, to the HostedObject that receives them. A sampled header carries
+ * a trace_context field that every hop appends its number and the time to;
+ * the receiver turns the gaps between hops into the message.latency
+ * histograms of Metrics, one per pair of consecutive hops.
+ *
+ * Hops on different machines compare clocks that were never synchronized, so
+ * gaps across a network link include the clocks' offset; gaps that come out
+ * negative are counted as zero.
+ */
+namespace MessageTrace {
+enum Hop {
+    OBJECT_SEND=1,
+    SPACE_RECEIVE=2,
+    SPACE_SEND=3,
+    OBJECT_RECEIVE=4,
+    NUM_HOPS
+};
+
+/**
+ * Starts tracing header with its first hop if it falls in the sample set by
+ * the messagetracerate option, and its sender did not already trace it.
+ */
+SIRIKATA_EXPORT void begin(RoutableMessageHeader &header, Hop hop=OBJECT_SEND);
+///Starts a fresh trace on header whatever the sample rate, dropping any it carried
+SIRIKATA_EXPORT void force(RoutableMessageHeader &header, Hop hop=OBJECT_SEND);
+///Notes that a traced message passed hop; untraced headers are left alone
+SIRIKATA_EXPORT void stamp(RoutableMessageHeader &header, Hop hop);
+SIRIKATA_EXPORT void stamp(RoutableMessageHeaderView &header, Hop hop);
+///Stamps hop as the last one and records the latency between each pair of hops the message passed
+SIRIKATA_EXPORT void finish(const RoutableMessageHeader &header, Hop hop=OBJECT_RECEIVE);
+
+/**
+ * Decodes a trace context into the hops and times, in microseconds, it holds.
+ * \returns false if the context was malformed; hops decoded so far are kept
+ */
+SIRIKATA_EXPORT bool parse(const String &context, std::vector<std::pair<Hop,uint64> > &hops);
+}
+}
+#endif
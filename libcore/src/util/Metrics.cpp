@@ -0,0 +1,405 @@
+/*  Sirikata Utilities -- Runtime Metrics
+ *  Metrics.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "Metrics.hpp"
+#include "options/Options.hpp"
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+
+namespace Sirikata { namespace Metrics {
+namespace {
+OptionValue *metricsInterval;
+OptionValue *metricsFile;
+InitializeGlobalOptions o("",
+                    metricsInterval=new OptionValue("metricsinterval","0s",OptionValueType<Duration>(),"how often every registered metric is written out, 0s for never"),
+                    metricsFile=new OptionValue("metricsfile","",OptionValueType<String>(),"file the metrics are appended to (default: the log, as module metrics)"),
+                    NULL);
+
+class Registry {
+public:
+    boost::mutex mLock;
+    std::vector<Metric*> mMetrics;
+};
+///Never destroyed, so metrics in other libraries' static storage may unregister after this file's statics are gone
+Registry &registry() {
+    static Registry *sRegistry=new Registry;
+    return *sRegistry;
+}
+
+bool byName(const Metric *a, const Metric *b) {
+    return a->name()<b->name();
+}
+
+String prometheusFamily(const Metric *metric) {
+    String family="sirikata_"+metric->name();
+    for (size_t i=9;i<family.size();++i) {
+        char c=family[i];
+        if (!((c>='a'&&c<='z')||(c>='A'&&c<='Z')||(c>='0'&&c<='9')||c=='_'))
+            family[i]='_';
+    }
+    if (strcmp(metric->prometheusType(),"counter")==0)
+        family+="_total";
+    return family;
+}
+
+///Escapes a HELP text: backslashes and newlines are the only special characters there
+String prometheusHelp(const String &text) {
+    String retval;
+    for (size_t i=0;i<text.size();++i) {
+        if (text[i]=='\\') retval+="\\\\";
+        else if (text[i]=='\n') retval+="\\n";
+        else retval+=text[i];
+    }
+    return retval;
+}
+
+void prometheusSample(std::ostream &os, const String &name, const String &labels, const String &extraLabel) {
+    os<<name;
+    if (!labels.empty()||!extraLabel.empty()) {
+        os<<'{'<<extraLabel;
+        if (!labels.empty()&&!extraLabel.empty()) os<<',';
+        os<<labels<<'}';
+    }
+    os<<' ';
+}
+
+AtomicValue<unsigned int> sNextStripe(0);
+boost::thread_specific_ptr<unsigned int> &stripeOfThread() {
+    static boost::thread_specific_ptr<unsigned int> *sStripe=new boost::thread_specific_ptr<unsigned int>;
+    return *sStripe;
+}
+
+class Reporter {
+    boost::mutex mLock;
+    boost::condition_variable mWake;
+    boost::thread *mThread;
+    bool mStopping;
+    Duration mInterval;
+    String mFile;
+    String mConfig;
+
+    void write() {
+        std::ostringstream text;
+        report(text);
+        String written=text.str();
+        if (mFile.empty()) {
+            if (!written.empty()) {
+                SILOG(metrics,info,written.substr(0,written.size()-1));
+            }
+            return;
+        }
+        FILE *out=fopen(mFile.c_str(),"a");
+        if (!out) {
+            SILOG(metrics,error,"Could not open metrics file "<<mFile);
+            return;
+        }
+        fprintf(out,"# %llu\n",(unsigned long long)Task::AbsTime::now().raw());
+        fwrite(written.data(),1,written.size(),out);
+        fclose(out);
+    }
+    void run() {
+        boost::mutex::scoped_lock lock(mLock);
+        while (!mStopping) {
+            mWake.timed_wait(lock,boost::posix_time::microseconds((long)mInterval.toMicroseconds()));
+            if (mStopping)
+                break;
+            lock.unlock();
+            write();
+            lock.lock();
+        }
+    }
+public:
+    Reporter():mThread(NULL),mStopping(false),mInterval(Duration::seconds(0)) {
+    }
+    const String &config() const {
+        return mConfig;
+    }
+    void start(const String &config, const Duration &interval, const String &file) {
+        mConfig=config;
+        mInterval=interval;
+        mFile=file;
+        mStopping=false;
+        mThread=new boost::thread(std::tr1::bind(&Reporter::run,this));
+    }
+    void stop() {
+        if (!mThread) return;
+        {
+            boost::mutex::scoped_lock lock(mLock);
+            mStopping=true;
+            mWake.notify_one();
+        }
+        mThread->join();
+        delete mThread;
+        mThread=NULL;
+        mConfig=String();
+    }
+};
+
+Reporter *sReporter=NULL;
+
+class StopAtExit {public:
+    ~StopAtExit() {
+        if (sReporter) {
+            sReporter->stop();
+        }
+    }
+} sStopAtExit;
+}
+
+unsigned int threadStripe() {
+    boost::thread_specific_ptr<unsigned int> &stripe=stripeOfThread();
+    unsigned int *index=stripe.get();
+    if (!index) {
+        index=new unsigned int((sNextStripe++)%NUM_STRIPES);
+        stripe.reset(index);
+    }
+    return *index;
+}
+
+Metric::Metric(const String &name, const String &description)
+ : mName(name), mDescription(description) {
+    Registry &metrics=registry();
+    boost::mutex::scoped_lock lock(metrics.mLock);
+    metrics.mMetrics.push_back(this);
+}
+
+Metric::~Metric() {
+    unregister();
+}
+
+void Metric::unregister() {
+    Registry &metrics=registry();
+    boost::mutex::scoped_lock lock(metrics.mLock);
+    std::vector<Metric*>::iterator where=std::find(metrics.mMetrics.begin(),metrics.mMetrics.end(),this);
+    if (where!=metrics.mMetrics.end()) {
+        metrics.mMetrics.erase(where);
+    }
+}
+
+Counter::Counter(const String &name, const String &description)
+ : Metric(name,description) {
+    for (int i=0;i<NUM_STRIPES;++i) {
+        mStripes[i].mValue=0;
+    }
+}
+
+uint64 Counter::value() const {
+    uint64 total=0;
+    for (int i=0;i<NUM_STRIPES;++i) {
+        total+=mStripes[i].mValue;
+    }
+    return total;
+}
+
+void Counter::report(std::ostream &os) const {
+    os<<value();
+}
+
+const char *Counter::prometheusType() const {
+    return "counter";
+}
+
+void Counter::reportPrometheus(std::ostream &os, const String &family, const String &labels) const {
+    prometheusSample(os,family,labels,String());
+    os<<value()<<'\n';
+}
+
+Gauge::Gauge(const String &name, const String &description)
+ : Metric(name,description) {
+    for (int i=0;i<NUM_STRIPES;++i) {
+        mStripes[i].mValue=0;
+    }
+}
+
+void Gauge::set(int64 value) {
+    for (int i=1;i<NUM_STRIPES;++i) {
+        mStripes[i].mValue=0;
+    }
+    mStripes[0].mValue=value;
+}
+
+int64 Gauge::value() const {
+    int64 total=0;
+    for (int i=0;i<NUM_STRIPES;++i) {
+        total+=mStripes[i].mValue;
+    }
+    return total;
+}
+
+void Gauge::report(std::ostream &os) const {
+    os<<value();
+}
+
+const char *Gauge::prometheusType() const {
+    return "gauge";
+}
+
+void Gauge::reportPrometheus(std::ostream &os, const String &family, const String &labels) const {
+    prometheusSample(os,family,labels,String());
+    os<<value()<<'\n';
+}
+
+Histogram::Histogram(const String &name, const String &description)
+ : Metric(name,description) {
+    mStripes=Sirikata::aligned_malloc<Stripe>(sizeof(Stripe)*NUM_STRIPES,CACHE_LINE_SIZE);
+    for (int i=0;i<NUM_STRIPES;++i) {
+        for (int j=0;j<NUM_BUCKETS;++j) {
+            mStripes[i].mBuckets[j]=0;
+        }
+        mStripes[i].mSum=0;
+    }
+}
+
+Histogram::~Histogram() {
+    // before the stripes go, so a concurrent report never reads freed memory
+    unregister();
+    Sirikata::aligned_free(mStripes);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot retval;
+    for (int i=0;i<NUM_STRIPES;++i) {
+        for (int j=0;j<NUM_BUCKETS;++j) {
+            uint64 count=mStripes[i].mBuckets[j];
+            retval.mBuckets[j]+=count;
+            retval.mCount+=count;
+        }
+        retval.mSum+=mStripes[i].mSum;
+    }
+    return retval;
+}
+
+uint64 Histogram::Snapshot::percentile(double fraction) const {
+    if (!mCount)
+        return 0;
+    uint64 wanted=(uint64)ceil(fraction*mCount);
+    if (wanted<1) wanted=1;
+    uint64 seen=0;
+    for (unsigned int i=0;i<NUM_BUCKETS;++i) {
+        seen+=mBuckets[i];
+        if (seen>=wanted) {
+            return i+1<NUM_BUCKETS?bucketStart(i+1)-1:bucketStart(i);
+        }
+    }
+    return bucketStart(NUM_BUCKETS-1);
+}
+
+void Histogram::report(std::ostream &os) const {
+    Snapshot counts=snapshot();
+    os<<"count="<<counts.mCount
+      <<" mean="<<counts.mean()
+      <<" p50="<<counts.percentile(.5)
+      <<" p90="<<counts.percentile(.9)
+      <<" p99="<<counts.percentile(.99)
+      <<" p999="<<counts.percentile(.999)
+      <<" max="<<counts.max();
+}
+
+const char *Histogram::prometheusType() const {
+    return "summary";
+}
+
+void Histogram::reportPrometheus(std::ostream &os, const String &family, const String &labels) const {
+    static const char *quantiles[]={"0.5","0.9","0.99","0.999"};
+    static const double fractions[]={.5,.9,.99,.999};
+    Snapshot counts=snapshot();
+    for (int i=0;i<4;++i) {
+        prometheusSample(os,family,labels,String("quantile=\"")+quantiles[i]+"\"");
+        os<<counts.percentile(fractions[i])<<'\n';
+    }
+    prometheusSample(os,family+"_sum",labels,String());
+    os<<counts.mSum<<'\n';
+    prometheusSample(os,family+"_count",labels,String());
+    os<<counts.mCount<<'\n';
+}
+
+void report(std::ostream &os) {
+    Registry &metrics=registry();
+    boost::mutex::scoped_lock lock(metrics.mLock);
+    std::vector<Metric*> sorted(metrics.mMetrics);
+    std::stable_sort(sorted.begin(),sorted.end(),&byName);
+    for (size_t i=0;i<sorted.size();++i) {
+        os<<sorted[i]->name()<<' ';
+        sorted[i]->report(os);
+        os<<'\n';
+    }
+}
+
+void reportPrometheus(std::ostream &os) {
+    Registry &metrics=registry();
+    boost::mutex::scoped_lock lock(metrics.mLock);
+    std::vector<Metric*> sorted(metrics.mMetrics);
+    std::stable_sort(sorted.begin(),sorted.end(),&byName);
+    for (size_t i=0;i<sorted.size();) {
+        size_t end=i+1;
+        while (end<sorted.size()&&sorted[end]->name()==sorted[i]->name())
+            ++end;
+        String family=prometheusFamily(sorted[i]);
+        if (!sorted[i]->description().empty())
+            os<<"# HELP "<<family<<' '<<prometheusHelp(sorted[i]->description())<<'\n';
+        os<<"# TYPE "<<family<<' '<<sorted[i]->prometheusType()<<'\n';
+        for (size_t j=i;j<end;++j) {
+            String labels;
+            if (end-i>1)
+                labels="instance=\""+boost::lexical_cast<String>(j-i)+"\"";
+            sorted[j]->reportPrometheus(os,family,labels);
+        }
+        i=end;
+    }
+}
+
+void metricsOptionsChanged() {
+    if (!metricsInterval) {
+        // Parsed from a static initializer before this file's options exist
+        return;
+    }
+    Duration interval=metricsInterval->as<Duration>();
+    String file=metricsFile->as<String>();
+    String config;
+    if (interval>Duration::seconds(0)) {
+        std::ostringstream describe;
+        describe<<interval.toMicroseconds()<<' '<<file;
+        config=describe.str();
+    }
+    if (!sReporter) {
+        if (config.empty()) return;
+        sReporter=new Reporter;
+    }
+    if (config==sReporter->config()) return;
+    sReporter->stop();
+    if (!config.empty()) {
+        sReporter->start(config,interval,file);
+    }
+}
+
+} }
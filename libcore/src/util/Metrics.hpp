@@ -0,0 +1,223 @@
+/*  Sirikata Utilities -- Runtime Metrics
+ *  Metrics.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_METRICS_HPP_
+#define _SIRIKATA_METRICS_HPP_
+
+#include "AtomicTypes.hpp"
+#include "task/Time.hpp"
+
+namespace Sirikata { namespace Metrics {
+/**
+ * Named counters, gauges and latency histograms that stay cheap enough to leave
+ * in hot paths. Declare them at namespace scope, or as members for a value per
+ * instance; they register themselves by name and unregister when destroyed.
+ * Metrics::report() writes the current value of every one of them, and the
+ * metricsinterval option has them written out periodically.
+ */
+class SIRIKATA_EXPORT Metric : Noncopyable {
+    String mName;
+    String mDescription;
+protected:
+    Metric(const String &name, const String &description);
+    ///Stops report() from reaching this metric; subclasses whose report() reads memory they free call it first
+    void unregister();
+public:
+    virtual ~Metric();
+    const String &name() const {
+        return mName;
+    }
+    const String &description() const {
+        return mDescription;
+    }
+    ///Writes the value without the name or a trailing newline
+    virtual void report(std::ostream &os) const=0;
+    ///The Prometheus metric type: counter, gauge or summary
+    virtual const char *prometheusType() const=0;
+    ///Writes the sample lines for family, each given labels if not empty
+    virtual void reportPrometheus(std::ostream &os, const String &family, const String &labels) const=0;
+};
+
+enum {
+    ///Threads share stripes once there are more of them than this
+    NUM_STRIPES=8,
+    CACHE_LINE_SIZE=64
+};
+///The stripe the calling thread updates, handed out round robin the first time each thread asks
+SIRIKATA_EXPORT unsigned int threadStripe();
+
+///Monotonic count, striped so threads bumping it do not bounce one cache line between them
+class SIRIKATA_EXPORT Counter : public Metric {
+    struct Stripe {
+        volatile uint64 mValue;
+        char mPad[CACHE_LINE_SIZE-sizeof(uint64)];
+    };
+    Stripe mStripes[NUM_STRIPES];
+public:
+    Counter(const String &name, const String &description=String());
+    void add(uint64 amount) {
+        SizedAtomicValue<8>::add(&mStripes[threadStripe()].mValue,amount);
+    }
+    void increment() {
+        SizedAtomicValue<8>::inc(&mStripes[threadStripe()].mValue);
+    }
+    uint64 value() const;
+    virtual void report(std::ostream &os) const;
+    virtual const char *prometheusType() const;
+    virtual void reportPrometheus(std::ostream &os, const String &family, const String &labels) const;
+};
+
+/**
+ * Value that goes up and down, such as a queue depth. add() is striped like
+ * Counter so it may be used from any thread; set() is for gauges that only one
+ * thread at a time updates, and should not be mixed with add() on one gauge.
+ */
+class SIRIKATA_EXPORT Gauge : public Metric {
+    struct Stripe {
+        volatile int64 mValue;
+        char mPad[CACHE_LINE_SIZE-sizeof(int64)];
+    };
+    Stripe mStripes[NUM_STRIPES];
+public:
+    Gauge(const String &name, const String &description=String());
+    void set(int64 value);
+    void add(int64 amount) {
+        SizedAtomicValue<8>::add(&mStripes[threadStripe()].mValue,amount);
+    }
+    int64 value() const;
+    virtual void report(std::ostream &os) const;
+    virtual const char *prometheusType() const;
+    virtual void reportPrometheus(std::ostream &os, const String &family, const String &labels) const;
+};
+
+/**
+ * Log linear histogram in the style of HdrHistogram: every power of two is split
+ * into SUB_BUCKETS equal buckets, so any recorded value is known to within 1/16th
+ * and recording is one bucket increment. Values are usually microseconds.
+ */
+class SIRIKATA_EXPORT Histogram : public Metric {
+public:
+    enum {
+        SUB_BUCKET_BITS=4,
+        SUB_BUCKETS=1<<SUB_BUCKET_BITS,
+        ///Values of 2^MAX_VALUE_BITS and above land in the last bucket
+        MAX_VALUE_BITS=40,
+        NUM_BUCKETS=(MAX_VALUE_BITS-SUB_BUCKET_BITS+1)*SUB_BUCKETS
+    };
+    static unsigned int bucketOf(uint64 value) {
+        if (value<SUB_BUCKETS)
+            return (unsigned int)value;
+        if (value>>MAX_VALUE_BITS)
+            return NUM_BUCKETS-1;
+        unsigned int magnitude=SUB_BUCKET_BITS;
+        while (value>>(magnitude+1))
+            ++magnitude;
+        unsigned int shift=magnitude-SUB_BUCKET_BITS;
+        return (shift+1)*SUB_BUCKETS+(unsigned int)((value>>shift)-SUB_BUCKETS);
+    }
+    ///Smallest value that lands in bucket
+    static uint64 bucketStart(unsigned int bucket) {
+        if (bucket<SUB_BUCKETS)
+            return bucket;
+        unsigned int shift=bucket/SUB_BUCKETS-1;
+        return (uint64)(SUB_BUCKETS+bucket%SUB_BUCKETS)<<shift;
+    }
+    ///Counts summed over every stripe at one moment
+    class SIRIKATA_EXPORT Snapshot {
+    public:
+        std::vector<uint64> mBuckets;
+        uint64 mCount;
+        uint64 mSum;
+        Snapshot():mBuckets(NUM_BUCKETS,0),mCount(0),mSum(0) {
+        }
+        double mean() const {
+            return mCount?mSum/(double)mCount:0;
+        }
+        ///Largest value in the bucket holding the given fraction of the samples, 0 when empty
+        uint64 percentile(double fraction) const;
+        uint64 max() const {
+            return percentile(1);
+        }
+    };
+private:
+    struct Stripe {
+        volatile uint64 mBuckets[NUM_BUCKETS];
+        volatile uint64 mSum;
+        char mPad[CACHE_LINE_SIZE];
+    };
+    Stripe *mStripes;
+public:
+    Histogram(const String &name, const String &description=String());
+    ~Histogram();
+    void record(uint64 value) {
+        Stripe &stripe=mStripes[threadStripe()];
+        SizedAtomicValue<8>::inc(&stripe.mBuckets[bucketOf(value)]);
+        SizedAtomicValue<8>::add(&stripe.mSum,value);
+    }
+    void recordDuration(const Duration &duration) {
+        int64 us=duration.toMicroseconds();
+        record(us>0?(uint64)us:0);
+    }
+    Snapshot snapshot() const;
+    virtual void report(std::ostream &os) const;
+    virtual const char *prometheusType() const;
+    virtual void reportPrometheus(std::ostream &os, const String &family, const String &labels) const;
+};
+
+///Records the microseconds from its construction to its destruction into a Histogram
+class ScopedTimer : Noncopyable {
+    Histogram &mHistogram;
+    Task::AbsTime mStart;
+public:
+    explicit ScopedTimer(Histogram &histogram)
+     : mHistogram(histogram), mStart(Task::AbsTime::now()) {
+    }
+    ~ScopedTimer() {
+        mHistogram.recordDuration(Task::AbsTime::now()-mStart);
+    }
+};
+
+///Writes one "name value" line per registered metric, sorted by name
+SIRIKATA_EXPORT void report(std::ostream &os);
+/**
+ * Writes every registered metric in the Prometheus text exposition format.
+ * Names get a sirikata_ prefix with anything but letters, digits and
+ * underscores turned into underscores; counters also get a _total suffix and
+ * histograms are summaries with 0.5, 0.9, 0.99 and 0.999 quantiles. Metrics
+ * sharing a name, like those of two cache layers of one kind, are told apart
+ * by an instance label.
+ */
+SIRIKATA_EXPORT void reportPrometheus(std::ostream &os);
+///Reacts to a change in the metricsinterval or metricsfile options, starting or stopping the reporting thread
+SIRIKATA_EXPORT void metricsOptionsChanged();
+
+} }
+#endif
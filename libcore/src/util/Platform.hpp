@@ -110,6 +110,16 @@
 # define SIRIKATA_PLUGIN_EXPORT_C extern "C" SIRIKATA_PLUGIN_EXPORT
 #endif
 
+// Plugin entry points (init, destroy, name, refcount...) are file local when
+// the plugin is linked into an executable, so several can share one binary.
+#ifndef SIRIKATA_PLUGIN_ENTRY_C
+# ifdef SIRIKATA_STATIC_PLUGINS
+#   define SIRIKATA_PLUGIN_ENTRY_C static
+# else
+#   define SIRIKATA_PLUGIN_ENTRY_C SIRIKATA_PLUGIN_EXPORT_C
+# endif
+#endif
+
 
 #ifdef __GLIBC__
 # include <endian.h>
@@ -237,12 +247,15 @@ typedef double float64;
 typedef uchar byte;
 typedef std::string String;
 typedef std::vector<uint8> MemoryBuffer;
+} // namespace Sirikata
+#include "MemoryAccounting.hpp"
+namespace Sirikata {
 
 namespace Network {
 class IOService;
 class Stream;
 class Address;
-typedef std::vector<uint8> Chunk;
+typedef std::vector<uint8, Memory::Allocator<uint8, Memory::NETWORK> > Chunk;
 }
 #ifdef NDEBUG
 class ThreadIdCheck{};
@@ -37,6 +37,18 @@ namespace Sirikata {
 
 Plugin::Plugin(const String& path)
  : mDL(path),
+   mLinked(NULL),
+   mInit(NULL),
+   mDestroy(NULL),
+   mName(NULL),
+   mRefCount(NULL),
+   mInitialized(0)
+{
+}
+
+Plugin::Plugin(const String& path, const EntryPoints& linked)
+ : mDL(path),
+   mLinked(&linked),
    mInit(NULL),
    mDestroy(NULL),
    mName(NULL),
@@ -52,6 +64,14 @@ Plugin::~Plugin() {
 }
 
 bool Plugin::load() {
+    if (mLinked) {
+        mInit = mLinked->init;
+        mDestroy = mLinked->destroy;
+        mName = mLinked->name;
+        mRefCount = mLinked->refcount;
+        return (mInit != NULL && mDestroy != NULL && mName != NULL && mRefCount != NULL);
+    }
+
     if (!mDL.load())
         return false;
 
@@ -53,7 +53,24 @@ namespace Sirikata {
  */
 class Plugin {
 public:
+    typedef void(*InitFunc)();
+    typedef void(*DestroyFunc)();
+    typedef const char*(*NameFunc)();
+    typedef int(*RefCountFunc)();
+
+    /** The C interface of a plugin which was linked into the executable
+     *  rather than built as a separate dynamic library. */
+    struct EntryPoints {
+        InitFunc init;
+        DestroyFunc destroy;
+        NameFunc name;
+        RefCountFunc refcount;
+    };
+
     Plugin(const String& path);
+    /** Wrap a plugin that is already linked in.  load() and unload() only
+     *  bind and release the given entry points and never touch the disk. */
+    Plugin(const String& path, const EntryPoints& linked);
     ~Plugin();
 
     /** Loads the plugin, returning true if it satisfies all the plugin requirements,
@@ -76,12 +93,8 @@ public:
     /** Get the current refcount of this plugin. */
     int refcount();
 private:
-    typedef void(*InitFunc)();
-    typedef void(*DestroyFunc)();
-    typedef const char*(*NameFunc)();
-    typedef int(*RefCountFunc)();
-
     DynamicLibrary mDL;
+    const EntryPoints* mLinked;
     InitFunc mInit;
     DestroyFunc mDestroy;
     NameFunc mName;
@@ -55,6 +55,37 @@ static std::list<String> getDirectoryFiles(const String& dirpath) {
     return files;
 }
 
+typedef std::map<String, Plugin::EntryPoints> StaticPluginMap;
+
+/** Plugins linked into the executable, keyed by build target name. Constructed
+ *  on first use since registration happens during static initialization. */
+static StaticPluginMap& staticPlugins() {
+    static StaticPluginMap sPlugins;
+    return sPlugins;
+}
+
+/** Recover the build target name from a library filename, the reverse of
+ *  DynamicLibrary::filename. */
+static String pluginTargetName(const String& filename) {
+    String result = filename;
+    String::size_type sep = result.find_last_of("/\\");
+    if (sep != String::npos)
+        result = result.substr(sep+1);
+
+    String pref = DynamicLibrary::prefix();
+    if (!pref.empty() && result.compare(0, pref.size(), pref) == 0)
+        result = result.substr(pref.size());
+
+    String suffixes[2] = { DynamicLibrary::extension(), DynamicLibrary::postfix() };
+    for(int i = 0; i < 2; i++) {
+        const String& suffix = suffixes[i];
+        if (!suffix.empty() && result.size() >= suffix.size() &&
+            result.compare(result.size() - suffix.size(), suffix.size(), suffix) == 0)
+            result = result.substr(0, result.size() - suffix.size());
+    }
+    return result;
+}
+
 
 PluginManager::PluginManager() {
 }
@@ -71,8 +102,19 @@ void PluginManager::searchPath(const String& path) {
     }
 }
 
+void PluginManager::registerStatic(const String& name, const Plugin::EntryPoints& entries) {
+    staticPlugins()[name] = entries;
+}
+
+bool PluginManager::isStatic(const String& name) {
+    return staticPlugins().find(name) != staticPlugins().end();
+}
+
 void PluginManager::load(const String& filename) {
-    Plugin* plugin = new Plugin(filename);
+    StaticPluginMap::const_iterator linked = staticPlugins().find(pluginTargetName(filename));
+    Plugin* plugin = (linked == staticPlugins().end()) ?
+        new Plugin(filename) :
+        new Plugin(filename, linked->second);
 
     if (!plugin->load()) {
         delete plugin;
@@ -49,9 +49,19 @@ public:
      *  initializing them. */
     void searchPath(const String& path);
 
-    /** Load a specific plugin from the specified file. */
+    /** Load a specific plugin from the specified file.  If a plugin of the
+     *  same name was linked into the executable, that copy is initialized
+     *  instead and the file is never opened. */
     void load(const String& filename);
 
+    /** Record the entry points of a plugin linked into the executable. Called
+     *  during static initialization by SIRIKATA_REGISTER_STATIC_PLUGIN. */
+    static void registerStatic(const String& name, const Plugin::EntryPoints& entries);
+
+    /** Returns true if a plugin is registered under name(), as opposed to
+     *  having to be found on disk. */
+    static bool isStatic(const String& name);
+
     /** Perform garbage collection on plugins, unloading any currently unused
      *  plugins.  */
     void gc();
@@ -67,6 +77,31 @@ private:
     PluginInfoList mPlugins;
 }; // class PluginManager
 
+/** Registers a linked-in plugin's entry points with PluginManager from a
+ *  static constructor.  Use through SIRIKATA_REGISTER_STATIC_PLUGIN. */
+class SIRIKATA_EXPORT StaticPluginRegistration {
+public:
+    StaticPluginRegistration(const char* name, Plugin::InitFunc init, Plugin::DestroyFunc destroy,
+                             Plugin::NameFunc pluginName, Plugin::RefCountFunc refcount) {
+        Plugin::EntryPoints entries = { init, destroy, pluginName, refcount };
+        PluginManager::registerStatic(name, entries);
+    }
+};
+
 } // namespace Sirikata
 
+/** Placed once in the file defining a plugin's init/destroy/name/refcount.
+ *  When the plugin's sources are compiled into an executable with
+ *  SIRIKATA_STATIC_PLUGINS defined, the entry points are file local and this
+ *  registers them under the given name, which must match the plugin's build
+ *  target so that PluginManager::load(DynamicLibrary::filename(target)) finds
+ *  it.  Otherwise it expands to nothing.
+ */
+#ifdef SIRIKATA_STATIC_PLUGINS
+# define SIRIKATA_REGISTER_STATIC_PLUGIN(target) \
+    static Sirikata::StaticPluginRegistration sirikata_static_plugin_##target(#target, &init, &destroy, &name, &refcount);
+#else
+# define SIRIKATA_REGISTER_STATIC_PLUGIN(target)
+#endif
+
 #endif //_SIRIKATA_PLUGIN_MANAGER_HPP_
@@ -0,0 +1,83 @@
+/*  Sirikata Utilities -- Runtime Metrics
+ *  ProfiledMutex.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "ProfiledMutex.hpp"
+#include "options/Options.hpp"
+#include <boost/thread.hpp>
+
+namespace Sirikata { namespace Metrics {
+namespace {
+OptionValue *lockProfiling;
+InitializeGlobalOptions o("",
+                    lockProfiling=new OptionValue("lockprofiling","false",OptionValueType<bool>(),"whether the wait and hold times of named locks are recorded as lock.* metrics"),
+                    NULL);
+
+class ProfileTable {
+public:
+    boost::mutex mLock;
+    std::map<String,LockProfile*> mProfiles;
+};
+///Never destroyed, like the profiles in it, so locks in static storage may be used until exit
+ProfileTable &profiles() {
+    static ProfileTable *sProfiles=new ProfileTable;
+    return *sProfiles;
+}
+}
+
+volatile bool LockProfile::sEnabled=false;
+
+LockProfile::LockProfile(const String &name)
+ : mAcquired("lock."+name+".acquired","times a "+name+" lock was taken"),
+   mContended("lock."+name+".contended","times a "+name+" lock was found held and waited for"),
+   mWait("lock."+name+".wait_us","microseconds waited for a "+name+" lock that was held"),
+   mHold("lock."+name+".hold_us","microseconds a "+name+" lock was held exclusively") {
+}
+
+LockProfile *LockProfile::named(const char *name) {
+    ProfileTable &table=profiles();
+    boost::lock_guard<boost::mutex> lok(table.mLock);
+    LockProfile *&profile=table.mProfiles[name];
+    if (!profile)
+        profile=new LockProfile(name);
+    return profile;
+}
+
+void LockProfile::optionsChanged() {
+    if (!lockProfiling) {
+        // Parsed from a static initializer before this file's options exist
+        return;
+    }
+    sEnabled=lockProfiling->as<bool>();
+}
+
+} }
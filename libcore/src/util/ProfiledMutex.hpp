@@ -0,0 +1,152 @@
+/*  Sirikata Utilities -- Runtime Metrics
+ *  ProfiledMutex.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_PROFILED_MUTEX_HPP_
+#define _SIRIKATA_PROFILED_MUTEX_HPP_
+
+#include "Metrics.hpp"
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata { namespace Metrics {
+
+/**
+ * The metrics shared by every lock of one name: how often it was taken, how
+ * often a taker found it held, how long those takers waited and how long it
+ * was held exclusively.  Their names are lock.<name>.acquired, .contended,
+ * .wait_us and .hold_us.  Nothing is recorded unless the lockprofiling
+ * option is on.
+ */
+class SIRIKATA_EXPORT LockProfile : Noncopyable {
+    Counter mAcquired;
+    Counter mContended;
+    Histogram mWait;
+    Histogram mHold;
+    explicit LockProfile(const String &name);
+public:
+    ///The profile for name, created on first use and never destroyed
+    static LockProfile *named(const char *name);
+    ///Follows the lockprofiling option; called from Logging::levelsChanged() after every parse
+    static void optionsChanged();
+    static volatile bool sEnabled;
+
+    void acquired() {
+        mAcquired.increment();
+    }
+    void contended(const Duration &wait) {
+        mAcquired.increment();
+        mContended.increment();
+        mWait.recordDuration(wait);
+    }
+    void held(const Duration &hold) {
+        mHold.recordDuration(hold);
+    }
+};
+
+/**
+ * Drop-in replacement for a boost mutex that reports to the LockProfile of
+ * its name.  It meets the Lockable concept, and SharedLockable as well when
+ * Mutex does, so it works with boost::lock_guard, unique_lock, shared_lock
+ * and condition_variable_any.  With profiling off a lock costs one extra
+ * branch; with it on, an uncontended lock is a try_lock plus the two clock
+ * reads that time how long it is held.
+ */
+template <class Mutex=boost::mutex> class ProfiledMutex : Noncopyable {
+    Mutex mMutex;
+    LockProfile *mProfile;
+    ///When the exclusive holder took the lock, or 0 if it was taken with profiling off
+    uint64 mAcquiredAt;
+
+    void lockProfiled() {
+        if (mMutex.try_lock()) {
+            mProfile->acquired();
+        }else {
+            Task::AbsTime start=Task::AbsTime::now();
+            mMutex.lock();
+            mProfile->contended(Task::AbsTime::now()-start);
+        }
+    }
+public:
+    explicit ProfiledMutex(const char *name)
+     : mProfile(LockProfile::named(name)), mAcquiredAt(0) {
+    }
+    void lock() {
+        if (!LockProfile::sEnabled) {
+            mMutex.lock();
+            mAcquiredAt=0;
+            return;
+        }
+        lockProfiled();
+        mAcquiredAt=Task::AbsTime::now().raw();
+    }
+    bool try_lock() {
+        if (!mMutex.try_lock())
+            return false;
+        if (LockProfile::sEnabled) {
+            mProfile->acquired();
+            mAcquiredAt=Task::AbsTime::now().raw();
+        }else {
+            mAcquiredAt=0;
+        }
+        return true;
+    }
+    void unlock() {
+        if (mAcquiredAt) {
+            mProfile->held(Task::AbsTime::now()-Task::AbsTime::microseconds((int64)mAcquiredAt));
+        }
+        mMutex.unlock();
+    }
+    ///Shared holders overlap, so only their waits are recorded
+    void lock_shared() {
+        if (!LockProfile::sEnabled) {
+            mMutex.lock_shared();
+        }else if (mMutex.try_lock_shared()) {
+            mProfile->acquired();
+        }else {
+            Task::AbsTime start=Task::AbsTime::now();
+            mMutex.lock_shared();
+            mProfile->contended(Task::AbsTime::now()-start);
+        }
+    }
+    bool try_lock_shared() {
+        if (!mMutex.try_lock_shared())
+            return false;
+        if (LockProfile::sEnabled)
+            mProfile->acquired();
+        return true;
+    }
+    void unlock_shared() {
+        mMutex.unlock_shared();
+    }
+};
+
+} }
+#endif
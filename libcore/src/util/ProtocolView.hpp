@@ -0,0 +1,399 @@
+/*  Sirikata Utilities -- Message Packet Body Parser
+ *  ProtocolView.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_PROTOCOL_VIEW_HPP_
+#define _SIRIKATA_PROTOCOL_VIEW_HPP_
+#include "UUID.hpp"
+namespace Sirikata {
+
+/**
+ * Walks the fields of a serialized protocol buffer where it lies.  Length
+ * delimited fields come back as spans of the input, so nothing is copied or
+ * allocated; the input must outlive the fields read from it.
+ */
+class WireReader {
+public:
+    enum WireType {
+        VARINT=0,
+        FIXED64=1,
+        LENGTH_DELIMITED=2,
+        FIXED32=5
+    };
+    class Field {
+    public:
+        uint32 tag;
+        WireType type;
+        ///The varint, or the raw bits of a fixed field
+        uint64 value;
+        ///The payload of a length delimited field
+        MemoryReference bytes;
+        Field() : tag(0), type(VARINT), value(0), bytes(MemoryReference::null()) {
+        }
+    };
+private:
+    const unsigned char *mInput;
+    size_t mSize;
+    bool mError;
+    bool readVarint(uint64 &retval) {
+        retval=0;
+        for (unsigned int shift=0;shift<64;shift+=7) {
+            if (!mSize)
+                return false;
+            unsigned char cur=*mInput;
+            ++mInput;
+            --mSize;
+            retval|=((uint64)(cur&127))<<shift;
+            if ((cur&128)==0)
+                return true;
+        }
+        return false;
+    }
+    bool readFixed(uint64 &retval, size_t bytes) {
+        if (mSize<bytes)
+            return false;
+        retval=0;
+        for (size_t i=0;i<bytes;++i)
+            retval|=((uint64)mInput[i])<<(8*i);
+        mInput+=bytes;
+        mSize-=bytes;
+        return true;
+    }
+public:
+    WireReader(const void *input, size_t size)
+     : mInput((const unsigned char*)input), mSize(size), mError(false) {
+    }
+    explicit WireReader(MemoryReference input)
+     : mInput((const unsigned char*)input.data()), mSize(input.size()), mError(false) {
+    }
+    /**
+     * Reads the next field into field
+     * \returns false at the end of the input or if it is malformed, which error() tells apart
+     */
+    bool next(Field &field) {
+        if (!mSize||mError)
+            return false;
+        uint64 key;
+        bool ok=readVarint(key);
+        if (ok) {
+            field.tag=(uint32)(key>>3);
+            field.type=(WireType)(key&7);
+            switch (field.type) {
+              case VARINT:
+                ok=readVarint(field.value);
+                break;
+              case FIXED64:
+                ok=readFixed(field.value,8);
+                break;
+              case FIXED32:
+                ok=readFixed(field.value,4);
+                break;
+              case LENGTH_DELIMITED:
+                ok=readVarint(field.value)&&field.value<=mSize;
+                if (ok) {
+                    field.bytes=MemoryReference(mInput,(size_t)field.value);
+                    mInput+=field.value;
+                    mSize-=(size_t)field.value;
+                }
+                break;
+              default:
+                ok=false;
+            }
+        }
+        mError=!ok;
+        return ok;
+    }
+    bool error() const {
+        return mError;
+    }
+    ///Reads a uuid field: PBJ writes all 16 bytes, MessageHeader drops trailing zeros
+    static UUID toUUID(MemoryReference bytes) {
+        unsigned char uuidArray[UUID::static_size]={0};
+        memcpy(uuidArray,bytes.data(),bytes.size()<UUID::static_size?bytes.size():UUID::static_size);
+        return UUID(uuidArray,UUID::static_size);
+    }
+};
+
+/**
+ * Writes protocol buffer fields straight into a buffer the caller provides.
+ * Once a field does not fit, nothing more is written, but size() keeps
+ * counting so the caller learns how big a buffer to retry with.
+ */
+class WireWriter {
+    unsigned char *mOutput;
+    size_t mCapacity;
+    size_t mSize;
+    bool mOverflowed;
+    void put(const void *data, size_t size) {
+        if (mSize+size>mCapacity)
+            mOverflowed=true;
+        if (!mOverflowed)
+            memcpy(mOutput+mSize,data,size);
+        mSize+=size;
+    }
+    void putVarint(uint64 value) {
+        unsigned char encoded[10];
+        size_t size=0;
+        while (value>=128) {
+            encoded[size++]=(unsigned char)((value&127)|128);
+            value>>=7;
+        }
+        encoded[size++]=(unsigned char)value;
+        put(encoded,size);
+    }
+public:
+    WireWriter(void *output, size_t capacity)
+     : mOutput((unsigned char*)output), mCapacity(capacity), mSize(0), mOverflowed(false) {
+    }
+    static size_t varintSize(uint64 value) {
+        size_t retval=1;
+        while (value>=128) {
+            value>>=7;
+            ++retval;
+        }
+        return retval;
+    }
+    void writeVarint(uint32 tag, uint64 value) {
+        putVarint(((uint64)tag<<3)|WireReader::VARINT);
+        putVarint(value);
+    }
+    void writeFixed32(uint32 tag, uint32 value) {
+        putVarint(((uint64)tag<<3)|WireReader::FIXED32);
+        unsigned char encoded[4];
+        for (int i=0;i<4;++i)
+            encoded[i]=(unsigned char)(value>>(8*i));
+        put(encoded,4);
+    }
+    void writeBytes(uint32 tag, const void *data, size_t size) {
+        putVarint(((uint64)tag<<3)|WireReader::LENGTH_DELIMITED);
+        putVarint(size);
+        put(data,size);
+    }
+    void writeBytes(uint32 tag, MemoryReference bytes) {
+        writeBytes(tag,bytes.data(),bytes.size());
+    }
+    void writeUUID(uint32 tag, const UUID &uuid) {
+        writeBytes(tag,uuid.getArray().begin(),UUID::static_size);
+    }
+    ///Bytes written, or that would have been written had the buffer been large enough
+    size_t size() const {
+        return mSize;
+    }
+    bool overflowed() const {
+        return mOverflowed;
+    }
+};
+
+/**
+ * A ProxCall from Sirikata.pbj read in place.  The tags and event values
+ * below must match the message declared there.
+ */
+class ProxCallView {
+public:
+    enum ProximityEvent {
+        EXITED_PROXIMITY=0,
+        ENTERED_PROXIMITY=1,
+        STATELESS_PROXIMITY=2
+    };
+    enum {
+        QUERY_ID_TAG=2,
+        PROXIMATE_OBJECT_TAG=3,
+        PROXIMITY_EVENT_TAG=4,
+        AGGREGATE_TAG=5
+    };
+private:
+    uint32 mQueryId;
+    MemoryReference mProximateObject;
+    ProximityEvent mEvent;
+    MemoryReference mAggregate;
+    bool mHasAggregate;
+public:
+    ProxCallView()
+     : mQueryId(0), mProximateObject(MemoryReference::null()), mEvent(EXITED_PROXIMITY),
+       mAggregate(MemoryReference::null()), mHasAggregate(false) {
+    }
+    ///\returns whether input held a well formed ProxCall; anything missing reads as 0
+    bool ParseFromArray(const void *input, size_t size) {
+        WireReader reader(input,size);
+        WireReader::Field field;
+        mQueryId=0;
+        mProximateObject=MemoryReference::null();
+        mEvent=EXITED_PROXIMITY;
+        mAggregate=MemoryReference::null();
+        mHasAggregate=false;
+        while (reader.next(field)) {
+            if (field.tag==QUERY_ID_TAG&&field.type==WireReader::VARINT)
+                mQueryId=(uint32)field.value;
+            else if (field.tag==PROXIMATE_OBJECT_TAG&&field.type==WireReader::LENGTH_DELIMITED)
+                mProximateObject=field.bytes;
+            else if (field.tag==PROXIMITY_EVENT_TAG&&field.type==WireReader::VARINT)
+                mEvent=(ProximityEvent)field.value;
+            else if (field.tag==AGGREGATE_TAG&&field.type==WireReader::LENGTH_DELIMITED) {
+                mAggregate=field.bytes;
+                mHasAggregate=true;
+            }
+        }
+        return !reader.error();
+    }
+    bool ParseFromArray(MemoryReference input) {
+        return ParseFromArray(input.data(),input.size());
+    }
+    uint32 query_id() const {
+        return mQueryId;
+    }
+    UUID proximate_object() const {
+        return WireReader::toUUID(mProximateObject);
+    }
+    ProximityEvent proximity_event() const {
+        return mEvent;
+    }
+    bool has_aggregate() const {
+        return mHasAggregate;
+    }
+    ///The serialized ProxAggregate, for the caller to parse when has_aggregate()
+    MemoryReference aggregate() const {
+        return mAggregate;
+    }
+    /**
+     * Encodes a ProxCall into output
+     * \returns the bytes it needs, which were only written if no more than size
+     */
+    static size_t SerializeToArray(void *output, size_t size, uint32 queryId, const UUID &proximateObject, ProximityEvent event) {
+        WireWriter writer(output,size);
+        writer.writeVarint(QUERY_ID_TAG,queryId);
+        writer.writeUUID(PROXIMATE_OBJECT_TAG,proximateObject);
+        writer.writeVarint(PROXIMITY_EVENT_TAG,event);
+        return writer.size();
+    }
+};
+
+/**
+ * A MessageBody from Sirikata.pbj read in place, answering like
+ * RoutableMessageBody: a message past the last name takes the last name.
+ * Names and arguments are spans of the parsed buffer.
+ */
+class MessageBodyView {
+public:
+    enum {
+        MESSAGE_NAMES_TAG=7,
+        MESSAGE_ARGUMENTS_TAG=8
+    };
+private:
+    MemoryReference mBody;
+    int mNames;
+    int mArguments;
+    ///\returns the index'th field with the given tag, or the last one if there are fewer
+    MemoryReference find(uint32 tag, int index) const {
+        WireReader reader(mBody);
+        WireReader::Field field;
+        MemoryReference retval(MemoryReference::null());
+        int seen=0;
+        while (seen<=index&&reader.next(field)) {
+            if (field.tag==tag&&field.type==WireReader::LENGTH_DELIMITED) {
+                retval=field.bytes;
+                ++seen;
+            }
+        }
+        return retval;
+    }
+public:
+    MessageBodyView()
+     : mBody(MemoryReference::null()), mNames(0), mArguments(0) {
+    }
+    bool ParseFromArray(const void *input, size_t size) {
+        mBody=MemoryReference(input,size);
+        mNames=0;
+        mArguments=0;
+        WireReader reader(mBody);
+        WireReader::Field field;
+        while (reader.next(field)) {
+            if (field.type!=WireReader::LENGTH_DELIMITED)
+                continue;
+            if (field.tag==MESSAGE_NAMES_TAG)
+                ++mNames;
+            else if (field.tag==MESSAGE_ARGUMENTS_TAG)
+                ++mArguments;
+        }
+        return !reader.error();
+    }
+    bool ParseFromArray(MemoryReference input) {
+        return ParseFromArray(input.data(),input.size());
+    }
+    int message_size() const {
+        return mArguments>mNames?mArguments:mNames;
+    }
+    MemoryReference message_names(int i) const {
+        return find(MESSAGE_NAMES_TAG,i<mNames?i:mNames-1);
+    }
+    ///Empty for a message that has a name but no arguments
+    MemoryReference message_arguments(int i) const {
+        if (i>=mArguments)
+            return MemoryReference(mBody.data(),0);
+        return find(MESSAGE_ARGUMENTS_TAG,i);
+    }
+
+    /**
+     * Builds a MessageBody in a caller's buffer, writing names the way
+     * RoutableMessageBody::add_message does.  The last name passed must stay
+     * valid until the next add_message.
+     */
+    class Writer {
+        WireWriter mWriter;
+        MemoryReference mLastName;
+        int mNames;
+        int mArguments;
+    public:
+        Writer(void *output, size_t capacity)
+         : mWriter(output,capacity), mLastName(MemoryReference::null()), mNames(0), mArguments(0) {
+        }
+        void add_message(MemoryReference name, MemoryReference arguments) {
+            if (mNames==0||name.size()!=mLastName.size()||memcmp(name.data(),mLastName.data(),name.size())!=0) {
+                while (mNames&&mNames<mArguments) {
+                    mWriter.writeBytes(MESSAGE_NAMES_TAG,mLastName);
+                    ++mNames;
+                }
+                mWriter.writeBytes(MESSAGE_NAMES_TAG,name);
+                mLastName=name;
+                ++mNames;
+            }
+            mWriter.writeBytes(MESSAGE_ARGUMENTS_TAG,arguments);
+            ++mArguments;
+        }
+        size_t size() const {
+            return mWriter.size();
+        }
+        bool overflowed() const {
+            return mWriter.overflowed();
+        }
+    };
+};
+
+}
+#endif
@@ -35,11 +35,82 @@
 #include "util/RoutableMessageHeader.hpp"
 #include "QueryTracker.hpp"
 #include "SentMessage.hpp"
+#include "task/Time.hpp"
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/error.hpp>
+
+#include <network/TCPDefinitions.hpp> // For "class IOService" definition...
 
 namespace Sirikata {
 
+/** One asio timer per QueryTracker, re-armed a tick at a time while any
+    timeout is pending. Handlers hold a reference to it and check mTracker,
+    which the tracker clears when it goes away. */
+class QueryTracker::TimeoutTimer {
+public:
+    boost::asio::deadline_timer mTimer;
+    QueryTracker *mTracker;
+    Task::AbsTime mLastTick;
+    bool mArmed;
+
+    TimeoutTimer(Network::IOService *io, QueryTracker *tracker)
+        : mTimer(*static_cast<boost::asio::io_service*>(io)),
+          mTracker(tracker),
+          mLastTick(Task::AbsTime::now()),
+          mArmed(false) {
+    }
+
+    static Duration tickLength() {
+        return Duration::milliseconds((int64)TIMEOUT_TICK_MILLISECONDS);
+    }
+
+    static void arm(const std::tr1::shared_ptr<TimeoutTimer> &self) {
+        if (self->mArmed)
+            return;
+        if (!self->mTracker->mNumTimeouts)
+            self->mLastTick = Task::AbsTime::now();
+        self->mArmed = true;
+        self->mTimer.expires_from_now(boost::posix_time::milliseconds((long)TIMEOUT_TICK_MILLISECONDS));
+        self->mTimer.async_wait(
+            boost::bind(&TimeoutTimer::ticked, self, boost::asio::placeholders::error));
+    }
+
+    static void ticked(std::tr1::shared_ptr<TimeoutTimer> self, const boost::system::error_code &error) {
+        self->mArmed = false;
+        if (error == boost::asio::error::operation_aborted || self->mTracker == NULL) {
+            return;
+        }
+        // Catch up on any ticks the io service was too busy to deliver.
+        int64 elapsed = (Task::AbsTime::now() - self->mLastTick).toMicroseconds();
+        int64 ticks = elapsed / tickLength().toMicroseconds();
+        if (ticks < 1)
+            ticks = 1;
+        self->mLastTick = self->mLastTick + tickLength() * (double)ticks;
+        self->mTracker->advanceTimeouts(ticks > TIMEOUT_WHEEL_SLOTS * 16 ? TIMEOUT_WHEEL_SLOTS * 16 : (unsigned int)ticks);
+        if (self->mTracker && self->mTracker->mNumTimeouts)
+            arm(self);
+    }
+};
+
 QueryTracker::~QueryTracker() {
     mForwardService = NULL; // can't resend a message.
+    if (mTimeoutTimer) {
+        mTimeoutTimer->mTracker = NULL;
+        mTimeoutTimer->mTimer.cancel();
+    }
+    if (mTimeoutWheel) {
+        // Leave any SentMessage that outlives us unlinked rather than pointing into the wheel.
+        for (int slot = 0; slot < TIMEOUT_WHEEL_SLOTS; ++slot) {
+            while (mTimeoutWheel[slot].linked())
+                mTimeoutWheel[slot].mNext->unlink();
+        }
+        delete []mTimeoutWheel;
+    }
+    mSlots.clear();
+    mFreeSlots.clear();
     SentMessageMap sentMessageCopy;
     mSentMessages.swap(sentMessageCopy);
 	// FIXME: Need to have an "error" callback of some sort, but ideally before getting to the destructor
@@ -57,20 +128,121 @@ QueryTracker::~QueryTracker() {
 	*/
 }
 
+int64 QueryTracker::allocateId() {
+    uint32 index;
+    if (mFreeSlots.empty()) {
+        index = (uint32)mSlots.size();
+        Slot slot = { NULL, 0, false };
+        mSlots.push_back(slot);
+    } else {
+        index = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    }
+    mSlots[index].mAllocated = true;
+    return ((int64)mSlots[index].mGeneration << 32) | index;
+}
+
 void QueryTracker::insert(SentMessage *ret) {
-    mSentMessages.insert(SentMessageMap::value_type(ret->getId(), ret));
+    int64 id = ret->getId();
+    uint32 index = (uint32)id;
+    if (id >= 0 && index < mSlots.size() &&
+        mSlots[index].mGeneration == (uint32)(id >> 32) &&
+        mSlots[index].mAllocated && mSlots[index].mMessage == NULL) {
+        mSlots[index].mMessage = ret;
+    } else {
+        mSentMessages.insert(SentMessageMap::value_type(id, ret));
+    }
 }
 
 bool QueryTracker::remove(SentMessage *ret) {
     int64 id = ret->getId();
+    uint32 index = (uint32)id;
+    if (id >= 0 && index < mSlots.size() && mSlots[index].mMessage == ret &&
+        mSlots[index].mGeneration == (uint32)(id >> 32)) {
+        mSlots[index].mMessage = NULL;
+        mSlots[index].mAllocated = false;
+        mSlots[index].mGeneration = (mSlots[index].mGeneration + 1) & 0x7fffffff;
+        mFreeSlots.push_back(index);
+        return true;
+    }
     SentMessageMap::iterator iter = mSentMessages.find(id);
-    if (iter != mSentMessages.end()) {
+    if (iter != mSentMessages.end() && iter->second == ret) {
         mSentMessages.erase(iter);
         return true;
     }
     return false;
 }
 
+SentMessage *QueryTracker::find(int64 id) const {
+    uint32 index = (uint32)id;
+    if (id >= 0 && index < mSlots.size() && mSlots[index].mMessage &&
+        mSlots[index].mGeneration == (uint32)(id >> 32)) {
+        return mSlots[index].mMessage;
+    }
+    if (mSentMessages.empty())
+        return NULL;
+    SentMessageMap::const_iterator iter = mSentMessages.find(id);
+    return iter == mSentMessages.end() ? NULL : iter->second;
+}
+
+void QueryTracker::scheduleTimeout(SentMessage *msg, const Duration &timeout) {
+    cancelTimeout(msg);
+    if (!mIOService)
+        return;
+    if (!mTimeoutWheel)
+        mTimeoutWheel = new TimeoutLink[TIMEOUT_WHEEL_SLOTS];
+    if (!mTimeoutTimer)
+        mTimeoutTimer.reset(new TimeoutTimer(mIOService, this));
+    TimeoutTimer::arm(mTimeoutTimer);
+
+    int64 tickMicros = TimeoutTimer::tickLength().toMicroseconds();
+    int64 ticks = (timeout.toMicroseconds() + tickMicros - 1) / tickMicros;
+    if (ticks < 1)
+        ticks = 1;
+    msg->mTimeout.mRounds = (uint32)((ticks - 1) / TIMEOUT_WHEEL_SLOTS);
+    msg->mTimeout.insertBefore(&mTimeoutWheel[(mTimeoutCursor + ticks) % TIMEOUT_WHEEL_SLOTS]);
+    ++mNumTimeouts;
+}
+
+void QueryTracker::cancelTimeout(SentMessage *msg) {
+    if (msg->mTimeout.linked()) {
+        msg->mTimeout.unlink();
+        --mNumTimeouts;
+    }
+}
+
+void QueryTracker::advanceTimeouts(unsigned int ticks) {
+    // Collect everything due first: callbacks may delete, cancel or
+    // reschedule any message, which just unlinks it from this list.
+    std::tr1::shared_ptr<TimeoutTimer> timer(mTimeoutTimer);
+    TimeoutLink due;
+    for (unsigned int i = 0; i < ticks && mNumTimeouts; ++i) {
+        mTimeoutCursor = (mTimeoutCursor + 1) % TIMEOUT_WHEEL_SLOTS;
+        TimeoutLink *head = &mTimeoutWheel[mTimeoutCursor];
+        for (TimeoutLink *link = head->mNext; link != head;) {
+            TimeoutLink *next = link->mNext;
+            if (link->mRounds) {
+                --link->mRounds;
+            } else {
+                link->unlink();
+                link->insertBefore(&due);
+            }
+            link = next;
+        }
+    }
+    while (due.linked()) {
+        SentMessage *msg = due.mNext->mMessage;
+        due.mNext->unlink();
+        --mNumTimeouts;
+        msg->timedOut();
+        if (timer->mTracker == NULL)
+            break; // a callback destroyed this tracker
+    }
+    // Anything left belonged to a destroyed tracker; just let go of it.
+    while (due.linked())
+        due.mNext->unlink();
+}
+
 void QueryTracker::sendMessage(const RoutableMessageHeader &msgHeader, MemoryReference bodyStr) {
     if (mForwardService) {
         mForwardService->processMessage(msgHeader, bodyStr);
@@ -84,13 +256,13 @@ void QueryTracker::processMessage(const RoutableMessageHeader &msgHeader, Memory
     }
     // This is a response message;
     int64 id = msgHeader.reply_id();
-    SentMessageMap::iterator iter = mSentMessages.find(id);
-    if (iter != mSentMessages.end()) {
-        if ((!iter->second->header().has_destination_space() ||
-             iter->second->header().destination_space() == msgHeader.destination_space()) &&
-            iter->second->getRecipient() == msgHeader.source_object())
+    SentMessage *sent = find(id);
+    if (sent) {
+        if ((!sent->header().has_destination_space() ||
+             sent->header().destination_space() == msgHeader.destination_space()) &&
+            sent->getRecipient() == msgHeader.source_object())
         {
-            iter->second->processMessage(msgHeader, body);
+            sent->processMessage(msgHeader, body);
         } else {
             ObjectReference dest(ObjectReference::null());
             if (msgHeader.has_destination_object()) {
@@ -98,7 +270,7 @@ void QueryTracker::processMessage(const RoutableMessageHeader &msgHeader, Memory
             }
             std::ostringstream os;
             os << "Response message with ID "<<id<<" to object "<<dest<<
-                " should come from "<<iter->second->getRecipient() <<
+                " should come from "<<sent->getRecipient() <<
                 " but instead came from " <<msgHeader.source_object();
             SILOG(cppoh, warning, os.str());
         }
@@ -46,19 +46,80 @@ public:
     /// Each sent query has an int64 id. This maps that id to a SentMessage structure.
     typedef std::tr1::unordered_map<int64, SentMessage*> SentMessageMap;
 
+    /// Intrusive link through which a SentMessage waits in its tracker's timeout wheel.
+    struct TimeoutLink {
+        TimeoutLink *mPrev;
+        TimeoutLink *mNext;
+        SentMessage *mMessage;
+        /// Whole turns of the wheel left before the timeout is due.
+        uint32 mRounds;
+
+        explicit TimeoutLink(SentMessage *msg=NULL)
+            : mPrev(this), mNext(this), mMessage(msg), mRounds(0) {
+        }
+        bool linked() const {
+            return mNext != this;
+        }
+        void unlink() {
+            mPrev->mNext = mNext;
+            mNext->mPrev = mPrev;
+            mPrev = mNext = this;
+        }
+        void insertBefore(TimeoutLink *head) {
+            mNext = head;
+            mPrev = head->mPrev;
+            mPrev->mNext = this;
+            head->mPrev = this;
+        }
+    private:
+        TimeoutLink(const TimeoutLink&);
+        TimeoutLink&operator=(const TimeoutLink&);
+    };
+
+    enum {
+        /// Slots in the timeout wheel; longer timeouts go around more than once.
+        TIMEOUT_WHEEL_SLOTS = 64,
+        /// Length of one wheel slot: timeouts fire up to this late.
+        TIMEOUT_TICK_MILLISECONDS = 10
+    };
+
 private:
+    /** Ids from allocateId() are (generation << 32 | slot), so a reply is
+        matched with one index and compare.  The generation is bumped each
+        time a slot is freed, so late replies to a finished query are
+        dropped instead of reaching the slot's next occupant. */
+    struct Slot {
+        SentMessage *mMessage;
+        uint32 mGeneration;
+        /// Handed out by allocateId() and not yet removed.
+        bool mAllocated;
+    };
+    std::vector<Slot> mSlots;
+    std::vector<uint32> mFreeSlots;
+    /// Messages constructed with an id not handed out by allocateId().
     SentMessageMap mSentMessages;
-    int64 mNextQueryId;
+
+    class TimeoutTimer;
+    /// Drives the wheel from mIOService while any timeout is pending.
+    std::tr1::shared_ptr<TimeoutTimer> mTimeoutTimer;
+    /// TIMEOUT_WHEEL_SLOTS list heads, allocated with the first timeout.
+    TimeoutLink *mTimeoutWheel;
+    unsigned int mTimeoutCursor;
+    size_t mNumTimeouts;
+
     Network::IOService *mIOService;
     MessageService *mForwardService;
 
+    SentMessage *find(int64 id) const;
+    void advanceTimeouts(unsigned int ticks);
+
 public:
     /** Constructs a QueryTracker.
      @param timerService  An IOService instance for creating timeouts.
      If timerService is NULL, timeouts will not be honored.
     */
-    explicit QueryTracker(Network::IOService *timerService, MessageService *forwarder=NULL) {
-        mNextQueryId = NULL;
+    explicit QueryTracker(Network::IOService *timerService, MessageService *forwarder=NULL)
+        : mTimeoutWheel(NULL), mTimeoutCursor(0), mNumTimeouts(0) {
         mIOService = timerService;
         mForwardService = forwarder;
     }
@@ -66,9 +127,7 @@ public:
     ~QueryTracker();
 
     /// Returns the next allocated ID. Used in the SentMessage(QueryTracker*) constrcutor.
-    int64 allocateId() {
-        return mNextQueryId++;
-    }
+    int64 allocateId();
 
     /// Adds a new SentMessage to the map.
     void insert(SentMessage *msg);
@@ -76,6 +135,19 @@ public:
     /// Removes the SentMessage from this map.
     bool remove(SentMessage *msg);
 
+    /** Waits timeout (rounded up to a wheel tick) before delivering a
+        TIMEOUT_FAILURE to msg, replacing any timeout it already had.
+        Does nothing without an IOService. */
+    void scheduleTimeout(SentMessage *msg, const Duration &timeout);
+
+    /// Cancels msg's pending timeout, if any.
+    void cancelTimeout(SentMessage *msg);
+
+    /// Number of SentMessages waiting for a timeout.
+    size_t numPendingTimeouts() const {
+        return mNumTimeouts;
+    }
+
     /// MessageService interface: sent messages will go through serv.
     bool forwardMessagesTo(MessageService*serv) {
         mForwardService = serv;
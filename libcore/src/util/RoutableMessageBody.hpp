@@ -101,6 +101,10 @@ public:
         clear_message_names();
         clear_message_arguments();
     }
+    ///Empties the body, keeping the storage of the old names and arguments for the next parse
+    void Clear() {
+        clear_message();
+    }
 
     using Protocol::MessageBody::message_arguments;
     using Protocol::MessageBody::ParseFromArray;
@@ -56,6 +56,8 @@ class RoutableMessageHeader {
     uint32 mReturnStatus;
     bool mHasMessageId;
     bool mHasMessageReplyId;
+    bool mHasTraceContext;
+    std::string mTraceContext;
 
     std::string mData;
 public:
@@ -72,6 +74,7 @@ public:
         mSourcePort=0;
         mHasDestinationObject=mHasSourceObject=mHasDestinationSpace=mHasSourceSpace=false;
         mHasMessageId=mHasMessageReplyId=false;
+        mHasTraceContext=false;
         mReturnStatus = SUCCESS;
     }
     RoutableMessageHeader(const ObjectReference &destinationObject,
@@ -81,6 +84,7 @@ public:
         mHasDestinationObject=mHasSourceObject=true;
         mHasDestinationSpace=mHasSourceSpace=false;
         mHasMessageId=mHasMessageReplyId=false;
+        mHasTraceContext=false;
         mReturnStatus = SUCCESS;
     }
 private:
@@ -185,12 +189,20 @@ public:
                     mHasDestinationSpace=true;
                     mDestinationSpace=SpaceID(parseUUID(curInput,size));
                     continue;
+                  case Sirikata::Protocol::MessageHeader::trace_context_field_tag: {
+                      size_t len=parseLength(curInput,size);
+                      if (len>size) len=size;
+                      mHasTraceContext=true;
+                      mTraceContext.assign((const char*)curInput,len);
+                      curInput+=len;
+                      size-=len;
+                      continue;
+                  }
                   default: {
                       size_t len=parseLength(curInput,size);
-                      if (len>=size) {
-                          size-=len;
-                          curInput+=len;
-                      }
+                      if (len>size) len=size;
+                      size-=len;
+                      curInput+=len;
                   }
                 }
                 break;
@@ -272,6 +284,13 @@ private:
         s.replace(output,output+size,(const char*)uuid.getArray().begin(),size);
         return output+size;
     }
+    std::string::iterator copyBytes(std::string&s,std::string::iterator start_output, unsigned int protoNum, const std::string&bytes, unsigned int size) const{
+        std::string::iterator output=copyKey(s,start_output,protoNum,size,2);
+        size-=(output-start_output);
+        output=copyIntValue(s,output,bytes.size(),size);
+        s.replace(output,output+bytes.size(),bytes);
+        return output+bytes.size();
+    }
     bool AppendOrSerializeToString(std::string*s,size_t slength)const {
         size_t original_size=slength;
         size_t total_size=original_size+mData.length();
@@ -281,7 +300,7 @@ private:
         size_t sourceSpaceSize=0;
         unsigned int sourcePortSize=0;
         unsigned int destinationPortSize=0;
-        unsigned int sendidSize=0, replyidSize=0, retstatusSize=0;
+        unsigned int sendidSize=0, replyidSize=0, retstatusSize=0, traceSize=0;
         if (mHasDestinationObject)total_size+=(destinationObjectSize=getSize(mDestinationObject.getAsUUID(),Sirikata::Protocol::MessageHeader::source_object_field_tag));
         if (mHasSourceObject)total_size+=(sourceObjectSize=getSize(mSourceObject.getAsUUID(),Sirikata::Protocol::MessageHeader::destination_object_field_tag));
         if (mDestinationPort)total_size+=(destinationPortSize=getSize(mDestinationPort,Sirikata::Protocol::MessageHeader::destination_port_field_tag));
@@ -291,6 +310,7 @@ private:
         if (mHasMessageId)total_size+=(sendidSize=getSize(mMessageId,Sirikata::Protocol::MessageHeader::id_field_tag));
         if (mHasMessageReplyId)total_size+=(replyidSize=getSize(mMessageReplyId,Sirikata::Protocol::MessageHeader::reply_id_field_tag));
         if (mReturnStatus!=SUCCESS)total_size+=(retstatusSize=getSize(mReturnStatus,Sirikata::Protocol::MessageHeader::return_status_field_tag));
+        if (mHasTraceContext&&!mTraceContext.empty())total_size+=(traceSize=getSize(mTraceContext.size(),Sirikata::Protocol::MessageHeader::trace_context_field_tag)+mTraceContext.size());
         s->resize(total_size);
         std::string::iterator output=s->begin();
         output+=original_size;
@@ -322,6 +342,9 @@ private:
         if (mReturnStatus!=SUCCESS) {
             output=copyInt(*s,output,Sirikata::Protocol::MessageHeader::return_status_field_tag,mReturnStatus,retstatusSize);
         }
+        if (mHasTraceContext&&!mTraceContext.empty()) {
+            output=copyBytes(*s,output,Sirikata::Protocol::MessageHeader::trace_context_field_tag,mTraceContext,traceSize);
+        }
         if (output!=s->end()) {
             assert(s->end()-output==(ptrdiff_t)mData.size());
             s->replace(output,s->end(),mData);
@@ -372,6 +395,8 @@ public:
         mHasMessageReplyId = mHasMessageId;
         mMessageReplyId = mMessageId;
         mHasMessageId = false;
+        // a reply is traced, if at all, as a message of its own
+        clear_trace_context();
     }
     inline void clear_source_object() {mHasSourceObject=false;}
     inline bool has_source_object() const {return mHasSourceObject;}
@@ -449,6 +474,21 @@ public:
         mReturnStatus=(int32)status;
     }
 
+    inline bool has_trace_context() const{
+        return mHasTraceContext;
+    }
+    inline const std::string& trace_context() const{
+        return mTraceContext;
+    }
+    inline std::string& mutable_trace_context() {
+        mHasTraceContext = true;
+        return mTraceContext;
+    }
+    inline void clear_trace_context() {
+        mHasTraceContext = false;
+        mTraceContext.clear();
+    }
+
 };
 
 typedef RoutableMessageHeader::ReturnStatus ReturnStatus;
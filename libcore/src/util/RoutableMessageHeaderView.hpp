@@ -0,0 +1,443 @@
+/*  Sirikata Utilities -- Message Packet Header Parser
+ *  RoutableMessageHeaderView.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_ROUTABLE_MESSAGE_HEADER_VIEW_HPP_
+#define _SIRIKATA_ROUTABLE_MESSAGE_HEADER_VIEW_HPP_
+#include "RoutableMessageHeader.hpp"
+namespace Sirikata {
+
+/**
+ * A RoutableMessageHeader read in place.  ParseFromArray only notes where
+ * each field lies in the caller's buffer; fields are decoded when asked for,
+ * and SerializeToArray writes the header, with any changes made since, into a
+ * buffer the caller provides.  Nothing is allocated on the way, so a message
+ * that only needs its source and destination touched can be passed on
+ * without being copied apart.  The parsed buffer must outlive the view.
+ *
+ * The serialized form matches RoutableMessageHeader::SerializeToString.
+ */
+class RoutableMessageHeaderView {
+    enum Field {
+        SOURCE_OBJECT,
+        DESTINATION_OBJECT,
+        SOURCE_PORT,
+        DESTINATION_PORT,
+        SOURCE_SPACE,
+        DESTINATION_SPACE,
+        MESSAGE_ID,
+        REPLY_ID,
+        RETURN_STATUS,
+        TRACE_CONTEXT,
+        NUM_FIELDS
+    };
+    ///Where a field's payload lies, or the value it was given since
+    class FieldValue {
+    public:
+        enum {ABSENT, PARSED, SET} mState;
+        ///the UUID bytes, without their length, or the varint
+        const unsigned char *mPayload;
+        size_t mPayloadSize;
+        UUID mUUID;
+        uint64 mInt;
+        String mBytes;
+    };
+    FieldValue mFields[NUM_FIELDS];
+    const unsigned char *mHeader;
+    size_t mHeaderSize;
+    ///Whether fields other than the known ones were seen, and so need copying when serializing
+    bool mHasUnknownFields;
+
+    static bool isUUIDField(Field field) {
+        return field==SOURCE_OBJECT||field==DESTINATION_OBJECT||field==SOURCE_SPACE||field==DESTINATION_SPACE;
+    }
+    ///UUIDs and the trace context carry their length, the rest are varints
+    static bool isLengthDelimited(Field field) {
+        return isUUIDField(field)||field==TRACE_CONTEXT;
+    }
+    static uint32 fieldTag(Field field) {
+        switch(field) {
+          case SOURCE_OBJECT: return Sirikata::Protocol::MessageHeader::source_object_field_tag;
+          case DESTINATION_OBJECT: return Sirikata::Protocol::MessageHeader::destination_object_field_tag;
+          case SOURCE_PORT: return Sirikata::Protocol::MessageHeader::source_port_field_tag;
+          case DESTINATION_PORT: return Sirikata::Protocol::MessageHeader::destination_port_field_tag;
+          case SOURCE_SPACE: return Sirikata::Protocol::MessageHeader::source_space_field_tag;
+          case DESTINATION_SPACE: return Sirikata::Protocol::MessageHeader::destination_space_field_tag;
+          case MESSAGE_ID: return Sirikata::Protocol::MessageHeader::id_field_tag;
+          case REPLY_ID: return Sirikata::Protocol::MessageHeader::reply_id_field_tag;
+          case TRACE_CONTEXT: return Sirikata::Protocol::MessageHeader::trace_context_field_tag;
+          default: return Sirikata::Protocol::MessageHeader::return_status_field_tag;
+        }
+    }
+    ///\returns the known field with the given tag and wire type, or NUM_FIELDS
+    static Field fieldFor(size_t key, unsigned int type) {
+        for (int i=0;i<NUM_FIELDS;++i) {
+            Field field=(Field)i;
+            if (fieldTag(field)==key&&(isLengthDelimited(field)?type==2:type==0))
+                return field;
+        }
+        return NUM_FIELDS;
+    }
+    static uint64 parseVarint(const unsigned char*&input, size_t&size) {
+        uint64 retval=0;
+        unsigned int shift=0;
+        while (size) {
+            unsigned char cur=*input;
+            ++input;
+            --size;
+            retval|=((uint64)(cur&127))<<shift;
+            if ((cur&128)==0)
+                break;
+            shift+=7;
+        }
+        return retval;
+    }
+    static size_t varintSize(uint64 value) {
+        size_t retval=1;
+        while (value>=128) {
+            value>>=7;
+            ++retval;
+        }
+        return retval;
+    }
+    static unsigned char* writeVarint(unsigned char*output, uint64 value) {
+        while (value>=128) {
+            *output++=(unsigned char)((value&127)|128);
+            value>>=7;
+        }
+        *output++=(unsigned char)value;
+        return output;
+    }
+    ///RoutableMessageHeader leaves off the trailing zero bytes of UUIDs
+    static size_t trimmedSize(const UUID&uuid) {
+        size_t retval=UUID::static_size;
+        while (retval&&uuid.getArray()[retval-1]==0)
+            --retval;
+        return retval;
+    }
+    size_t payloadSize(const FieldValue&value, Field field) const {
+        if (value.mState==FieldValue::PARSED)
+            return value.mPayloadSize;
+        if (field==TRACE_CONTEXT)
+            return value.mBytes.size();
+        return isUUIDField(field)?trimmedSize(value.mUUID):varintSize(value.mInt);
+    }
+    ///whether RoutableMessageHeader would write this field out
+    bool present(Field field) const {
+        const FieldValue&value=mFields[field];
+        if (value.mState==FieldValue::ABSENT)
+            return false;
+        // ports and return status are left out when zero
+        if (field==SOURCE_PORT||field==DESTINATION_PORT||field==RETURN_STATUS)
+            return getInt(field)!=0;
+        // and so is an empty trace context
+        if (field==TRACE_CONTEXT)
+            return payloadSize(value,field)!=0;
+        return true;
+    }
+    UUID getUUID(Field field) const {
+        const FieldValue&value=mFields[field];
+        if (value.mState==FieldValue::SET)
+            return value.mUUID;
+        unsigned char uuidArray[UUID::static_size]={0};
+        if (value.mState==FieldValue::PARSED)
+            memcpy(uuidArray,value.mPayload,value.mPayloadSize<UUID::static_size?value.mPayloadSize:UUID::static_size);
+        return UUID(uuidArray,UUID::static_size);
+    }
+    uint64 getInt(Field field) const {
+        const FieldValue&value=mFields[field];
+        if (value.mState==FieldValue::SET)
+            return value.mInt;
+        if (value.mState==FieldValue::ABSENT)
+            return 0;
+        const unsigned char*input=value.mPayload;
+        size_t size=value.mPayloadSize;
+        return parseVarint(input,size);
+    }
+    void setUUID(Field field, const UUID&uuid) {
+        mFields[field].mState=FieldValue::SET;
+        mFields[field].mUUID=uuid;
+    }
+    void setInt(Field field, uint64 value) {
+        mFields[field].mState=FieldValue::SET;
+        mFields[field].mInt=value;
+    }
+    void clear(Field field) {
+        mFields[field].mState=FieldValue::ABSENT;
+    }
+    /**
+     * Skips over the header field at input
+     * \returns the known field it holds, with its payload, or NUM_FIELDS
+     * \returns false in ok if the field is not a header field
+     */
+    static Field parseField(const unsigned char*&input, size_t&size, FieldValue&value, bool&ok) {
+        const unsigned char*start=input;
+        size_t startSize=size;
+        uint64 keyType=parseVarint(input,size);
+        size_t key=(size_t)(keyType/8);
+        if (!Sirikata::Protocol::MessageHeader::within_reserved_field_tag_range(key)) {
+            input=start;
+            size=startSize;
+            ok=false;
+            return NUM_FIELDS;
+        }
+        ok=true;
+        unsigned int type=(unsigned int)(keyType%8);
+        Field field=fieldFor(key,type);
+        const unsigned char*payload=input;
+        size_t skip=0;
+        switch(type) {
+          case 0:
+            parseVarint(input,size);
+            break;
+          case 1:
+            skip=8;
+            break;
+          case 2:
+            skip=(size_t)parseVarint(input,size);
+            payload=input;
+            break;
+          case 5:
+            skip=4;
+            break;
+        }
+        if (skip>size)
+            skip=size;
+        input+=skip;
+        size-=skip;
+        if (field!=NUM_FIELDS) {
+            value.mState=FieldValue::PARSED;
+            value.mPayload=payload;
+            value.mPayloadSize=input-payload;
+        }
+        return field;
+    }
+public:
+    typedef RoutableMessageHeader::ReturnStatus ReturnStatus;
+
+    RoutableMessageHeaderView() {
+        mHeader=NULL;
+        mHeaderSize=0;
+        mHasUnknownFields=false;
+        for (int i=0;i<NUM_FIELDS;++i)
+            mFields[i].mState=FieldValue::ABSENT;
+    }
+    /**
+     * Notes where the header fields at the start of input lie
+     * \returns the rest of input, the message body
+     */
+    MemoryReference ParseFromArray(const void *input, size_t size) {
+        const unsigned char*curInput=(const unsigned char*)input;
+        mHeader=curInput;
+        bool ok=true;
+        while (size&&ok) {
+            FieldValue value;
+            Field field=parseField(curInput,size,value,ok);
+            if (field!=NUM_FIELDS)
+                mFields[field]=value;
+            else if (ok)
+                mHasUnknownFields=true;
+        }
+        mHeaderSize=curInput-mHeader;
+        return MemoryReference(curInput,size);
+    }
+    MemoryReference ParseFromArray(MemoryReference input) {
+        return ParseFromArray(input.data(),input.size());
+    }
+    ///The header as it was parsed, before any changes
+    MemoryReference originalHeader() const {
+        return MemoryReference(mHeader,mHeaderSize);
+    }
+
+    ///\returns the number of bytes SerializeToArray will write
+    size_t ByteSize() const {
+        size_t retval=0;
+        for (int i=0;i<NUM_FIELDS;++i) {
+            Field field=(Field)i;
+            if (present(field)) {
+                size_t payload=payloadSize(mFields[field],field);
+                retval+=varintSize(fieldTag(field)*8)+payload;
+                if (isLengthDelimited(field))
+                    retval+=varintSize(payload);
+            }
+        }
+        if (mHasUnknownFields) {
+            const unsigned char*input=mHeader;
+            size_t size=mHeaderSize;
+            bool ok=true;
+            while (size&&ok) {
+                const unsigned char*start=input;
+                FieldValue value;
+                if (parseField(input,size,value,ok)==NUM_FIELDS)
+                    retval+=input-start;
+            }
+        }
+        return retval;
+    }
+    /**
+     * Writes the header, with any changes, to output
+     * \returns the number of bytes written, or 0 if they would not fit in size
+     */
+    size_t SerializeToArray(void *output, size_t size) const {
+        if (ByteSize()>size)
+            return 0;
+        unsigned char*out=(unsigned char*)output;
+        for (int i=0;i<NUM_FIELDS;++i) {
+            Field field=(Field)i;
+            if (!present(field))
+                continue;
+            const FieldValue&value=mFields[field];
+            bool delimited=isLengthDelimited(field);
+            out=writeVarint(out,fieldTag(field)*8+(delimited?2:0));
+            size_t payload=payloadSize(value,field);
+            if (delimited)
+                out=writeVarint(out,payload);
+            if (value.mState==FieldValue::PARSED) {
+                memcpy(out,value.mPayload,payload);
+                out+=payload;
+            } else if (field==TRACE_CONTEXT) {
+                memcpy(out,value.mBytes.data(),payload);
+                out+=payload;
+            } else if (delimited) {
+                memcpy(out,value.mUUID.getArray().begin(),payload);
+                out+=payload;
+            } else {
+                out=writeVarint(out,value.mInt);
+            }
+        }
+        if (mHasUnknownFields) {
+            // the same order as RoutableMessageHeader: unknown fields go last
+            const unsigned char*input=mHeader;
+            size_t remaining=mHeaderSize;
+            bool ok=true;
+            while (remaining&&ok) {
+                const unsigned char*start=input;
+                FieldValue value;
+                if (parseField(input,remaining,value,ok)==NUM_FIELDS&&input!=start) {
+                    memcpy(out,start,input-start);
+                    out+=input-start;
+                }
+            }
+        }
+        return out-(unsigned char*)output;
+    }
+    ///Decodes every field into a full RoutableMessageHeader, for code that wants one
+    void copyTo(RoutableMessageHeader&hdr) const {
+        String serialized;
+        serialized.resize(ByteSize());
+        if (!serialized.empty())
+            SerializeToArray(&serialized[0],serialized.size());
+        hdr.ParseFromString(serialized);
+    }
+
+    inline bool has_source_object() const {return mFields[SOURCE_OBJECT].mState!=FieldValue::ABSENT;}
+    inline ObjectReference source_object() const {
+        assert(has_source_object());
+        return ObjectReference(getUUID(SOURCE_OBJECT));
+    }
+    inline void set_source_object(const ObjectReference&value) {setUUID(SOURCE_OBJECT,value.getAsUUID());}
+    inline void clear_source_object() {clear(SOURCE_OBJECT);}
+
+    inline bool has_destination_object() const {return mFields[DESTINATION_OBJECT].mState!=FieldValue::ABSENT;}
+    inline ObjectReference destination_object() const {
+        assert(has_destination_object());
+        return ObjectReference(getUUID(DESTINATION_OBJECT));
+    }
+    inline void set_destination_object(const ObjectReference&value) {setUUID(DESTINATION_OBJECT,value.getAsUUID());}
+    inline void clear_destination_object() {clear(DESTINATION_OBJECT);}
+
+    inline bool has_source_space() const {return mFields[SOURCE_SPACE].mState!=FieldValue::ABSENT;}
+    inline SpaceID source_space() const {
+        assert(has_source_space());
+        return SpaceID(getUUID(SOURCE_SPACE));
+    }
+    inline void set_source_space(const SpaceID&value) {setUUID(SOURCE_SPACE,value.getAsUUID());}
+    inline void clear_source_space() {clear(SOURCE_SPACE);}
+
+    inline bool has_destination_space() const {return mFields[DESTINATION_SPACE].mState!=FieldValue::ABSENT;}
+    inline SpaceID destination_space() const {
+        assert(has_destination_space());
+        return SpaceID(getUUID(DESTINATION_SPACE));
+    }
+    inline void set_destination_space(const SpaceID&value) {setUUID(DESTINATION_SPACE,value.getAsUUID());}
+    inline void clear_destination_space() {clear(DESTINATION_SPACE);}
+
+    inline MessagePort source_port() const {return (MessagePort)getInt(SOURCE_PORT);}
+    inline void set_source_port(MessagePort port) {setInt(SOURCE_PORT,port);}
+    inline MessagePort destination_port() const {return (MessagePort)getInt(DESTINATION_PORT);}
+    inline void set_destination_port(MessagePort port) {setInt(DESTINATION_PORT,port);}
+
+    inline bool has_id() const {return mFields[MESSAGE_ID].mState!=FieldValue::ABSENT;}
+    inline int64 id() const {
+        assert(has_id());
+        return (int64)getInt(MESSAGE_ID);
+    }
+    inline void set_id(int64 id) {setInt(MESSAGE_ID,(uint64)id);}
+    inline void clear_id() {clear(MESSAGE_ID);}
+
+    inline bool has_reply_id() const {return mFields[REPLY_ID].mState!=FieldValue::ABSENT;}
+    inline int64 reply_id() const {
+        assert(has_reply_id());
+        return (int64)getInt(REPLY_ID);
+    }
+    inline void set_reply_id(int64 id) {setInt(REPLY_ID,(uint64)id);}
+    inline void clear_reply_id() {clear(REPLY_ID);}
+
+    inline bool has_return_status() const {return getInt(RETURN_STATUS)!=RoutableMessageHeader::SUCCESS;}
+    inline ReturnStatus return_status() const {return (ReturnStatus)getInt(RETURN_STATUS);}
+    inline void set_return_status(ReturnStatus status) {setInt(RETURN_STATUS,(uint64)status);}
+
+    inline bool has_trace_context() const {return present(TRACE_CONTEXT);}
+    inline String trace_context() const {
+        const FieldValue&value=mFields[TRACE_CONTEXT];
+        if (value.mState==FieldValue::PARSED)
+            return String((const char*)value.mPayload,value.mPayloadSize);
+        return value.mBytes;
+    }
+    inline void set_trace_context(const String&value) {
+        mFields[TRACE_CONTEXT].mState=FieldValue::SET;
+        mFields[TRACE_CONTEXT].mBytes=value;
+    }
+    inline void clear_trace_context() {clear(TRACE_CONTEXT);}
+
+    ///Same as RoutableMessageHeader::swap_source_and_destination, without decoding anything
+    void swap_source_and_destination() {
+        std::swap(mFields[SOURCE_OBJECT],mFields[DESTINATION_OBJECT]);
+        std::swap(mFields[SOURCE_SPACE],mFields[DESTINATION_SPACE]);
+        std::swap(mFields[SOURCE_PORT],mFields[DESTINATION_PORT]);
+        mFields[REPLY_ID]=mFields[MESSAGE_ID];
+        mFields[MESSAGE_ID].mState=FieldValue::ABSENT;
+        mFields[TRACE_CONTEXT].mState=FieldValue::ABSENT;
+    }
+};
+
+}
+#endif
@@ -0,0 +1,307 @@
+/*  Sirikata Utilities -- Sirikata Synchronization Utilities
+ *  SPSCRingBuffer.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_SPSC_RING_BUFFER_HPP_
+#define _SIRIKATA_SPSC_RING_BUFFER_HPP_
+
+#include "AtomicTypes.hpp"
+#include "ThreadSafeQueue.hpp"
+
+/// SPSCRingBuffer.hpp
+namespace Sirikata {
+
+/**
+ * A bounded queue for exactly one producer thread and one consumer thread.
+ * push(), pushBatch() and tryPush() may only be called by the producer; pop(), popUpTo(),
+ * blockingPop() and NodeIterator only by the consumer. Neither side takes a lock unless
+ * the other has gone to sleep in blockingPop() or a full push().
+ * Since push() waits for room, a thread must never push into a full buffer that only it drains.
+ */
+template <typename T> class SPSCRingBuffer {
+private:
+    enum {
+        ///Assumed size of a cache line: the producer's and consumer's indices are kept this far apart so they do not false share
+        CACHE_LINE_SIZE=64,
+        ///How many times an empty (or full) buffer is rechecked before the caller goes to sleep
+        SPIN_COUNT=64,
+        DEFAULT_CAPACITY=4096
+    };
+    // Noncopyable
+    SPSCRingBuffer(const SPSCRingBuffer &other);
+    void operator=(const SPSCRingBuffer &other);
+
+    T *mSlots;
+    uint32 mMask;
+    ThreadSafeQueueNS::Lock *mLock;
+    ///Signalled by the producer when the consumer sleeps on an empty buffer
+    ThreadSafeQueueNS::Condition *mNotEmpty;
+    ///Signalled by the consumer when the producer sleeps on a full buffer
+    ThreadSafeQueueNS::Condition *mNotFull;
+    char mHeadPad[CACHE_LINE_SIZE];
+    ///Position of the next slot to pop: written only by the consumer
+    volatile uint32 mHead;
+    ///Consumer's last look at mTail, so it only reads the producer's line when it seems to have run out
+    uint32 mCachedTail;
+    volatile uint32 mConsumerSleeping;
+    char mTailPad[CACHE_LINE_SIZE];
+    ///Position of the next slot to push: written only by the producer
+    volatile uint32 mTail;
+    ///Producer's last look at mHead, so it only reads the consumer's line when it seems to have run out of room
+    uint32 mCachedHead;
+    volatile uint32 mProducerSleeping;
+    char mEndPad[CACHE_LINE_SIZE];
+
+    static uint32 roundCapacity(size_t capacity) {
+        uint32 retval=1;
+        while (retval<capacity) {
+            retval<<=1;
+        }
+        return retval;
+    }
+    ///\returns how many values the consumer may pop, only rereading mTail if the cached count is below wanted
+    uint32 available(uint32 wanted=1) {
+        if (mCachedTail-mHead<wanted) {
+            mCachedTail=mTail;
+            memory_barrier();
+        }
+        return mCachedTail-mHead;
+    }
+    ///\returns how many values the producer may push, only rereading mHead if the cached room is below wanted
+    uint32 room(uint32 wanted=1) {
+        if (mMask+1-(mTail-mCachedHead)<wanted) {
+            mCachedHead=mHead;
+            memory_barrier();
+        }
+        return mMask+1-(mTail-mCachedHead);
+    }
+    ///Called by the consumer after freeing slots
+    void advanceHead(uint32 newHead) {
+        memory_barrier();
+        mHead=newHead;
+        memory_barrier();
+        if (mProducerSleeping) {
+            ThreadSafeQueueNS::lock(mLock);
+            ThreadSafeQueueNS::notify(mNotFull);
+            ThreadSafeQueueNS::unlock(mLock);
+        }
+    }
+    ///Called by the producer after filling slots
+    void advanceTail(uint32 newTail) {
+        memory_barrier();
+        mTail=newTail;
+        memory_barrier();
+        if (mConsumerSleeping) {
+            ThreadSafeQueueNS::lock(mLock);
+            ThreadSafeQueueNS::notify(mNotEmpty);
+            ThreadSafeQueueNS::unlock(mLock);
+        }
+    }
+    static bool emptyCheck(void *thus, void *) {
+        SPSCRingBuffer *buffer=reinterpret_cast<SPSCRingBuffer*>(thus);
+        return buffer->mTail==buffer->mHead;
+    }
+    static bool fullCheck(void *thus, void *) {
+        SPSCRingBuffer *buffer=reinterpret_cast<SPSCRingBuffer*>(thus);
+        return buffer->mTail-buffer->mHead>buffer->mMask;
+    }
+    void waitForData() {
+        for (int i=0;i<SPIN_COUNT;++i) {
+            if (available()) return;
+        }
+        mConsumerSleeping=1;
+        memory_barrier();
+        ThreadSafeQueueNS::wait(mLock,mNotEmpty,&SPSCRingBuffer<T>::emptyCheck,this,NULL);
+        mConsumerSleeping=0;
+        memory_barrier();
+    }
+    void waitForRoom() {
+        for (int i=0;i<SPIN_COUNT;++i) {
+            if (room()) return;
+        }
+        mProducerSleeping=1;
+        memory_barrier();
+        ThreadSafeQueueNS::wait(mLock,mNotFull,&SPSCRingBuffer<T>::fullCheck,this,NULL);
+        mProducerSleeping=0;
+        memory_barrier();
+    }
+public:
+    /**
+     * @param capacity  the most values the buffer holds before push() waits, rounded up to a power of two.
+     */
+    explicit SPSCRingBuffer(size_t capacity=DEFAULT_CAPACITY)
+        : mMask(roundCapacity(capacity)-1),
+          mHead(0), mCachedTail(0), mConsumerSleeping(0),
+          mTail(0), mCachedHead(0), mProducerSleeping(0) {
+        mSlots=new T[mMask+1];
+        mLock=ThreadSafeQueueNS::lockCreate();
+        mNotEmpty=ThreadSafeQueueNS::condCreate();
+        mNotFull=ThreadSafeQueueNS::condCreate();
+    }
+    ~SPSCRingBuffer() {
+        delete []mSlots;
+        ThreadSafeQueueNS::lockDestroy(mLock);
+        ThreadSafeQueueNS::condDestroy(mNotEmpty);
+        ThreadSafeQueueNS::condDestroy(mNotFull);
+    }
+
+    size_t capacity() const {
+        return mMask+1;
+    }
+
+    /**
+     * Pops, one at a time, the values that were in the buffer when the iterator was made.
+     * Consumer only.
+     */
+    class NodeIterator {
+    private:
+        // Noncopyable
+        NodeIterator(const NodeIterator &other);
+        void operator=(const NodeIterator &other);
+
+        SPSCRingBuffer<T> *mBuffer;
+        uint32 mRemaining;
+        T mCurrent;
+    public:
+        NodeIterator(SPSCRingBuffer<T> &buffer)
+            : mBuffer(&buffer), mRemaining(buffer.available(buffer.mMask+1)), mCurrent() {
+        }
+        T *next() {
+            if (mRemaining==0 || !mBuffer->pop(mCurrent)) {
+                mCurrent=T();
+                return NULL;
+            }
+            --mRemaining;
+            return &mCurrent;
+        }
+    };
+    friend class NodeIterator;
+
+    /**
+     * Copies value into the buffer without waiting. Producer only.
+     *
+     * @returns  false, leaving the buffer unchanged, if it was full.
+     */
+    bool tryPush(const T &value) {
+        if (!room()) {
+            return false;
+        }
+        mSlots[mTail&mMask]=value;
+        advanceTail(mTail+1);
+        return true;
+    }
+
+    /**
+     * Copies value into the buffer, waiting for the consumer to make room if it is full. Producer only.
+     */
+    void push(const T &value) {
+        while (!tryPush(value)) {
+            waitForRoom();
+        }
+    }
+
+    /**
+     * Pushes count values in order, publishing each run that fits with a single index update. Producer only.
+     */
+    void pushBatch(const T *values, size_t count) {
+        while (count) {
+            uint32 fits=room(count>mMask?mMask+1:(uint32)count);
+            if (fits==0) {
+                waitForRoom();
+                continue;
+            }
+            if (fits>count) {
+                fits=(uint32)count;
+            }
+            uint32 tail=mTail;
+            for (uint32 i=0;i<fits;++i) {
+                mSlots[(tail+i)&mMask]=values[i];
+            }
+            advanceTail(tail+fits);
+            values+=fits;
+            count-=fits;
+        }
+    }
+
+    /**
+     * Pops the front value into value without waiting. Consumer only.
+     *
+     * @returns  whether value was changed (if the buffer had at least one item).
+     */
+    bool pop(T &value) {
+        if (!available()) {
+            return false;
+        }
+        uint32 head=mHead;
+        value=mSlots[head&mMask];
+        mSlots[head&mMask]=T();
+        advanceHead(head+1);
+        return true;
+    }
+
+    /**
+     * Pops up to maxCount values in order, freeing all of their slots with a single index update. Consumer only.
+     *
+     * @returns  the number of values placed in values.
+     */
+    size_t popUpTo(T *values, size_t maxCount) {
+        uint32 count=available(maxCount>mMask?mMask+1:(uint32)maxCount);
+        if (count>maxCount) {
+            count=(uint32)maxCount;
+        }
+        if (count==0) {
+            return 0;
+        }
+        uint32 head=mHead;
+        for (uint32 i=0;i<count;++i) {
+            values[i]=mSlots[(head+i)&mMask];
+            mSlots[(head+i)&mMask]=T();
+        }
+        advanceHead(head+count);
+        return count;
+    }
+
+    /**
+     * Waits until an item is available, briefly spinning before sleeping. Consumer only.
+     */
+    void blockingPop(T &value) {
+        while (!pop(value)) {
+            waitForData();
+        }
+    }
+
+    bool probablyEmpty() {
+        return mTail==mHead;
+    }
+};
+}
+
+#endif //_SIRIKATA_SPSC_RING_BUFFER_HPP_
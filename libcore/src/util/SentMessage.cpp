@@ -34,55 +34,24 @@
 #include <util/Standard.hh>
 #include "util/RoutableMessageHeader.hpp"
 #include "SentMessage.hpp"
-
-#include <boost/asio/deadline_timer.hpp>
-#include <boost/bind.hpp>
-#include <boost/asio/placeholders.hpp>
-#include <boost/asio/error.hpp>
-
-#include <network/TCPDefinitions.hpp> // For "class IOService" definition...
+#include "task/Fiber.hpp"
 
 
 namespace Sirikata {
 
-class SentMessage::TimerHandler {
-    boost::asio::deadline_timer mTimer;
-    SentMessage *mSentMessage;
-    int64 mMessageId;
-
-    void timedOut(const boost::system::error_code &error) {
-        std::auto_ptr<TimerHandler> scopedDestructor(this);
-        if (error == boost::asio::error::operation_aborted) {
-            return; // don't care if the timer was cancelled.
-        }
-        RoutableMessageHeader msg;
-        if (mSentMessage->header().has_destination_object()) {
-            msg.set_source_object(mSentMessage->header().destination_object());
-        }
-        if (mSentMessage->header().has_destination_space()) {
-            msg.set_source_space(mSentMessage->header().destination_space());
-        }
-        msg.set_source_port(mSentMessage->header().destination_port());
-        msg.set_return_status(RoutableMessageHeader::TIMEOUT_FAILURE);
-        msg.set_reply_id(mSentMessage->getId());
-        mSentMessage->mTimerHandle=NULL;
-        mSentMessage->mResponseCallback(mSentMessage, msg, MemoryReference(NULL,0));
-        //formerly called this, but that asked asio to unset an ignored callback mSentMessage->processMessage(msg, MemoryReference(NULL,0));
+void SentMessage::timedOut() {
+    RoutableMessageHeader msg;
+    if (header().has_destination_object()) {
+        msg.set_source_object(header().destination_object());
     }
-public:
-    TimerHandler(Network::IOService *io, SentMessage *messageInfo, const Duration& num_seconds)
-        : mTimer(*static_cast<boost::asio::io_service*>(io), boost::posix_time::microseconds(num_seconds.toMicroseconds())) {
-
-        mSentMessage = messageInfo;
-        mTimer.async_wait(
-            boost::bind(&TimerHandler::timedOut, this, boost::asio::placeholders::error));
-    }
-
-    void cancel() {
-        mMessageId = -1;
-        mTimer.cancel();
+    if (header().has_destination_space()) {
+        msg.set_source_space(header().destination_space());
     }
-};
+    msg.set_source_port(header().destination_port());
+    msg.set_return_status(RoutableMessageHeader::TIMEOUT_FAILURE);
+    msg.set_reply_id(getId());
+    mResponseCallback(this, msg, MemoryReference(NULL,0));
+}
 
 void SentMessage::processMessage(const RoutableMessageHeader &header, MemoryReference body) {
     unsetTimeout();
@@ -90,28 +59,28 @@ void SentMessage::processMessage(const RoutableMessageHeader &header, MemoryRefe
 }
 
 SentMessage::SentMessage(int64 newId, QueryTracker *tracker)
-    : mTimerHandle(NULL), mId(newId), mTracker(tracker)
+    : mTimeout(this), mId(newId), mTracker(tracker)
 {
     header().set_id(mId);
     tracker->insert(this);
 }
 
 SentMessage::SentMessage(int64 newId, QueryTracker *tracker, const QueryCallback& cb)
- : mTimerHandle(NULL), mId(newId), mResponseCallback(cb), mTracker(tracker)
+ : mTimeout(this), mId(newId), mResponseCallback(cb), mTracker(tracker)
 {
     header().set_id(mId);
     tracker->insert(this);
 }
 
 SentMessage::SentMessage(QueryTracker *tracker)
- : mTimerHandle(NULL), mId(tracker->allocateId()), mTracker(tracker)
+ : mTimeout(this), mId(tracker->allocateId()), mTracker(tracker)
 {
     header().set_id(mId);
     tracker->insert(this);
 }
 
 SentMessage::SentMessage(QueryTracker *tracker, const QueryCallback& cb)
- : mTimerHandle(NULL), mId(tracker->allocateId()), mResponseCallback(cb), mTracker(tracker)
+ : mTimeout(this), mId(tracker->allocateId()), mResponseCallback(cb), mTracker(tracker)
 {
     header().set_id(mId);
     tracker->insert(this);
@@ -137,20 +106,61 @@ void SentMessage::send(MemoryReference bodystr) {
     mTracker->sendMessage(header(), bodystr);
 }
 
+namespace {
+struct AwaitedResponse {
+    Task::Fiber *mFiber;
+    RoutableMessageHeader *mHeader;
+    std::string *mBody;
+    bool mReceived;
+    /// Set while the fiber is suspended: a reply delivered from within send() must not resume it.
+    bool mSuspended;
+};
+void receivedAwaitedResponse(AwaitedResponse *awaited, SentMessage *, const RoutableMessageHeader &hdr, MemoryReference body) {
+    if (awaited->mReceived) {
+        return;
+    }
+    *awaited->mHeader = hdr;
+    awaited->mBody->assign((const char*)body.data(), body.length());
+    awaited->mReceived = true;
+    if (awaited->mSuspended) {
+        awaited->mFiber->resume();
+    }
+}
+void ignoreLateResponse(SentMessage *, const RoutableMessageHeader &, MemoryReference) {
+}
+}
+
+void SentMessage::sendAndAwait(MemoryReference body, RoutableMessageHeader &responseHeader, std::string &responseBody) {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    using std::tr1::placeholders::_3;
+    AwaitedResponse awaited;
+    awaited.mFiber = Task::Fiber::current();
+    assert(awaited.mFiber && "sendAndAwait must be called from a Task::Fiber");
+    awaited.mHeader = &responseHeader;
+    awaited.mBody = &responseBody;
+    awaited.mReceived = false;
+    awaited.mSuspended = false;
+    setCallback(std::tr1::bind(&receivedAwaitedResponse, &awaited, _1, _2, _3));
+    send(body);
+    while (!awaited.mReceived) {
+        awaited.mSuspended = true;
+        Task::Fiber::yield();
+        awaited.mSuspended = false;
+    }
+    // awaited lives on this stack, so later replies must not reach it.
+    setCallback(&ignoreLateResponse);
+}
+
 void SentMessage::unsetTimeout() {
-    if (mTimerHandle) {
-        mTimerHandle->cancel();
-        mTimerHandle = 0;
+    if (mTimeout.linked()) {
+        mTracker->cancelTimeout(this);
     }
 }
 
 void SentMessage::setTimeout(const Duration& timeout) {
-    unsetTimeout();
     if (mTracker) {
-        Network::IOService *io = mTracker->getIOService();
-        if (io) {
-            mTimerHandle = new TimerHandler(io, this, timeout);
-        }
+        mTracker->scheduleTimeout(this, timeout);
     }
 }
 
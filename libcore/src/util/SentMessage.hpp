@@ -60,8 +60,8 @@ public:
     typedef std::tr1::function<void (SentMessage* sentMessage, const RoutableMessageHeader &responseHeader, MemoryReference responseBody)> QueryCallback;
 
 private:
-    struct TimerHandler;
-    TimerHandler *mTimerHandle; ///< Holds onto the timeout, if one exists.
+    friend class QueryTracker;
+    QueryTracker::TimeoutLink mTimeout; ///< Linked into the tracker's timeout wheel while a timeout is pending.
     const int64 mId; ///< This query ID. Passed to the constructor.
 
     RoutableMessageHeader mHeader; ///< Header embedded into the struct
@@ -69,6 +69,9 @@ private:
     QueryCallback mResponseCallback; ///< Callback, or null if not yet set.
     QueryTracker *const mTracker;
 
+    /// Delivers a TIMEOUT_FAILURE reply to the callback. Called by the tracker's timeout wheel.
+    void timedOut();
+
 public:
     /// Destructor: Caution: NOT VIRTUAL!!! Make sure to downcast if necessary!!
     ~SentMessage();
@@ -149,6 +152,18 @@ public:
         that was originally sent out.
     */
     void send(MemoryReference body);
+
+    /** Sends body like send(), then suspends the calling Task::Fiber until
+        the first response, or the timeout, comes back. The reply is handed
+        over directly instead of through a callback for each step.
+        Replaces any callback set on this SentMessage.
+
+        @param responseHeader  Filled with the reply's header: check return_status().
+        @param responseBody    Filled with a copy of the reply's body.
+        @note Must be called from inside a Task::Fiber. Whoever processes the
+        reply resumes it, so it continues on that thread.
+    */
+    void sendAndAwait(MemoryReference body, RoutableMessageHeader &responseHeader, std::string &responseBody);
 };
 
 /** Subclass of SentMessage which holds onto the body for help when
@@ -32,6 +32,8 @@
 #include "util/Standard.hh"
 #include "Sha256.hpp"
 #include "internal_sha2.hpp"
+#include "AtomicTypes.hpp"
+#include <boost/thread.hpp>
 #include <stdexcept>
 #include <iostream>
 namespace Sirikata {
@@ -104,6 +106,38 @@ SHA256 SHA256::computeDigest(const std::string&data) {
     return retval;
 }
 
+namespace {
+/// Hashes buffers off a shared counter until none are left.
+class DigestWorker {
+    const std::vector<MemoryReference>*mData;
+    SHA256*mDigests;
+    AtomicValue<int>*mNext;
+public:
+    DigestWorker(const std::vector<MemoryReference>*data, SHA256*digests, AtomicValue<int>*next)
+        : mData(data), mDigests(digests), mNext(next) {
+    }
+    void operator()() {
+        for (int i=++*mNext-1;i<(int)mData->size();i=++*mNext-1) {
+            mDigests[i]=SHA256::computeDigest((*mData)[i].data(),(*mData)[i].size());
+        }
+    }
+};
+}
+void SHA256::computeDigests(const std::vector<MemoryReference>&data, SHA256*digests, unsigned int numThreads) {
+    if (numThreads==0)
+        numThreads=boost::thread::hardware_concurrency();
+    if (numThreads>data.size())
+        numThreads=data.size();
+    AtomicValue<int> next(0);
+    DigestWorker worker(&data,digests,&next);
+    boost::thread_group helpers;
+    for (unsigned int i=1;i<numThreads;++i) {
+        helpers.create_thread(worker);
+    }
+    worker();
+    helpers.join_all();
+}
+
 SHA256Context::SHA256Context() {
     mCtx = new SHA256_CTX;
     SHA256_Init((SHA256_CTX*)mCtx);
@@ -39,6 +39,7 @@
 #include <exception>
 
 #include "Array.hpp"
+#include "MemoryReference.hpp"
 
 namespace Sirikata {
 
@@ -132,6 +133,14 @@ public:
      * \returns SHASum digest
      */
     static SHA256 computeDigest(const std::string&data);
+    /**
+     * Computes the digests of many buffers, hashing different buffers on
+     * different threads.
+     * \param data the buffers to be hashed
+     * \param digests receives data.size() digests, digests[i] for data[i]
+     * \param numThreads the most threads to use, 0 for one per hardware thread
+     */
+    static void computeDigests(const std::vector<MemoryReference>&data, SHA256*digests, unsigned int numThreads=0);
     /**
      * Fills the SHA256 with array of entirely 0's.
      */
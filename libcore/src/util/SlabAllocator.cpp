@@ -0,0 +1,101 @@
+/*  Sirikata Utilities -- Size Class Slab Allocator
+ *  SlabAllocator.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "SlabAllocator.hpp"
+#include <boost/thread/mutex.hpp>
+
+namespace Sirikata {
+
+class SlabAllocator::Lock : public boost::mutex {
+};
+
+SlabAllocator::SlabAllocator()
+    : mLock(new Lock),
+      mFreeLists(sizeClass(MAX_POOLED_SIZE)+1, (FreeBlock*)NULL),
+      mNumOutstanding(0) {
+}
+
+SlabAllocator::~SlabAllocator() {
+    for (size_t i = 0; i < mSlabs.size(); ++i) {
+        free(mSlabs[i]);
+    }
+    delete mLock;
+}
+
+void *SlabAllocator::allocate(size_t size) {
+    if (size > MAX_POOLED_SIZE || size == 0) {
+        void *retval = malloc(size ? size : 1);
+        if (retval == NULL) {
+            throw std::bad_alloc();
+        }
+        return retval;
+    }
+    size_t which = sizeClass(size);
+    boost::mutex::scoped_lock lock(*mLock);
+    FreeBlock *block = mFreeLists[which];
+    if (block == NULL) {
+        size_t blockSize = which * GRANULARITY;
+        char *slab = (char*)malloc(blockSize * BLOCKS_PER_SLAB);
+        if (slab == NULL) {
+            throw std::bad_alloc();
+        }
+        mSlabs.push_back(slab);
+        for (size_t i = BLOCKS_PER_SLAB - 1; i > 0; --i) {
+            FreeBlock *freeBlock = (FreeBlock*)(slab + i * blockSize);
+            freeBlock->mNext = mFreeLists[which];
+            mFreeLists[which] = freeBlock;
+        }
+        block = (FreeBlock*)slab;
+    } else {
+        mFreeLists[which] = block->mNext;
+    }
+    ++mNumOutstanding;
+    return block;
+}
+
+void SlabAllocator::release(void *data, size_t size) {
+    if (data == NULL) {
+        return;
+    }
+    if (size > MAX_POOLED_SIZE || size == 0) {
+        free(data);
+        return;
+    }
+    size_t which = sizeClass(size);
+    boost::mutex::scoped_lock lock(*mLock);
+    FreeBlock *block = (FreeBlock*)data;
+    block->mNext = mFreeLists[which];
+    mFreeLists[which] = block;
+    --mNumOutstanding;
+}
+
+}
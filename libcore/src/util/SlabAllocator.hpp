@@ -0,0 +1,75 @@
+/*  Sirikata Utilities -- Size Class Slab Allocator
+ *  SlabAllocator.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_SLAB_ALLOCATOR_HPP_
+#define _SIRIKATA_SLAB_ALLOCATOR_HPP_
+
+namespace Sirikata {
+/**
+ * Hands out small blocks from slabs, one free list per 16 byte size class, so
+ * objects that are created and destroyed in bulk reuse each other's memory and
+ * sit next to each other instead of going through the global heap every time.
+ * Blocks larger than MAX_POOLED_SIZE go to malloc. Slabs are only returned
+ * to the system when the allocator is destroyed. Safe to use from several threads.
+ */
+class SIRIKATA_EXPORT SlabAllocator : public Noncopyable {
+public:
+    enum {
+        GRANULARITY=16,
+        MAX_POOLED_SIZE=1024,
+        ///Blocks carved out of each new slab
+        BLOCKS_PER_SLAB=64
+    };
+private:
+    struct FreeBlock {
+        FreeBlock *mNext;
+    };
+    class Lock;
+    Lock *mLock;
+    std::vector<FreeBlock*> mFreeLists;
+    std::vector<void*> mSlabs;
+    size_t mNumOutstanding;
+    static size_t sizeClass(size_t size) {
+        return (size+GRANULARITY-1)/GRANULARITY;
+    }
+public:
+    SlabAllocator();
+    ~SlabAllocator();
+    void *allocate(size_t size);
+    /// size must be the one passed to allocate().
+    void release(void *data, size_t size);
+    /// Number of pooled blocks allocated and not yet released.
+    size_t numOutstanding() const {
+        return mNumOutstanding;
+    }
+};
+}
+#endif
@@ -0,0 +1,121 @@
+/*  Sirikata Utilities -- Sirikata Synchronization Utilities
+ *  ThreadAffinity.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "ThreadAffinity.hpp"
+#include "AtomicTypes.hpp"
+#include "options/Options.hpp"
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+#include <windows.h>
+#elif SIRIKATA_PLATFORM == PLATFORM_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <cstdlib>
+
+namespace Sirikata {
+namespace {
+OptionValue*workerCpus;
+OptionValue*ioCpus;
+InitializeGlobalOptions o("",
+                    workerCpus=new OptionValue("workercpus","",OptionValueType<String>(),"CPUs to spread WorkQueue worker threads over, one CPU per thread, e.g. 0-7 (default: unpinned)"),
+                    ioCpus=new OptionValue("iocpus","",OptionValueType<String>(),"CPUs that threads running an IOService are restricted to, e.g. 8-11 (default: unpinned)"),
+                    NULL);
+AtomicValue<uint32> nextWorkerCpu(0);
+}
+
+std::vector<unsigned int> ThreadAffinity::parseCpuSet(const String&cpuSet) {
+    std::vector<unsigned int> retval;
+    String::size_type pos=0;
+    while (pos<cpuSet.length()) {
+        String::size_type comma=cpuSet.find(',',pos);
+        if (comma==String::npos) comma=cpuSet.length();
+        String range=cpuSet.substr(pos,comma-pos);
+        pos=comma+1;
+        if (range.empty()) continue;
+        String::size_type dash=range.find('-');
+        char*end=NULL;
+        unsigned long first=strtoul(range.c_str(),&end,10);
+        unsigned long last=first;
+        if (end==range.c_str()) return std::vector<unsigned int>();
+        if (dash!=String::npos) {
+            const char*lastStr=range.c_str()+dash+1;
+            last=strtoul(lastStr,&end,10);
+            if (end==lastStr||last<first) return std::vector<unsigned int>();
+        }
+        for (unsigned long cpu=first;cpu<=last;++cpu) {
+            retval.push_back((unsigned int)cpu);
+        }
+    }
+    return retval;
+}
+
+bool ThreadAffinity::pinCurrentThread(const std::vector<unsigned int>&cpus) {
+    if (cpus.empty()) return false;
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+    DWORD_PTR mask=0;
+    for (size_t i=0;i<cpus.size();++i) {
+        if (cpus[i]<sizeof(DWORD_PTR)*8)
+            mask|=((DWORD_PTR)1)<<cpus[i];
+    }
+    return mask!=0&&SetThreadAffinityMask(GetCurrentThread(),mask)!=0;
+#elif SIRIKATA_PLATFORM == PLATFORM_LINUX
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (size_t i=0;i<cpus.size();++i) {
+        if (cpus[i]<CPU_SETSIZE)
+            CPU_SET(cpus[i],&mask);
+    }
+    return pthread_setaffinity_np(pthread_self(),sizeof(mask),&mask)==0;
+#else
+    // Mac OS X only offers affinity hints between threads, not pinning.
+    return false;
+#endif
+}
+
+void ThreadAffinity::pinWorkerThread() {
+    std::vector<unsigned int> cpus=parseCpuSet(workerCpus->as<String>());
+    if (cpus.empty()) return;
+    std::vector<unsigned int> cpu(1,cpus[(nextWorkerCpu++)%cpus.size()]);
+    if (!pinCurrentThread(cpu)) {
+        SILOG(task,warning,"Unable to pin worker thread to cpu "<<cpu[0]);
+    }
+}
+
+void ThreadAffinity::pinIOServiceThread() {
+    std::vector<unsigned int> cpus=parseCpuSet(ioCpus->as<String>());
+    if (cpus.empty()) return;
+    if (!pinCurrentThread(cpus)) {
+        SILOG(task,warning,"Unable to pin IOService thread to cpus "<<ioCpus->as<String>());
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+/*  Sirikata Utilities -- Sirikata Synchronization Utilities
+ *  ThreadAffinity.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_THREADAFFINITY_HPP
+#define _SIRIKATA_THREADAFFINITY_HPP
+namespace Sirikata {
+/**
+ * Keeps threads on a chosen set of CPUs, so that on multi-socket machines
+ * they stay near their caches and memory. The --workercpus and --iocpus
+ * options select the CPUs used by WorkQueue worker threads and by threads
+ * running an IOService. Leaving an option empty lets the OS place the threads.
+ * Memory a pinned thread touches first is allocated on its own node by the
+ * usual first-touch policy.
+ */
+class SIRIKATA_EXPORT ThreadAffinity {public:
+    /// Parses a list like "0-3,8,10-11". \returns an empty list if the string is empty or malformed.
+    static std::vector<unsigned int> parseCpuSet(const String&cpuSet);
+    /// Restricts the calling thread to cpus. \returns false if the platform cannot pin threads.
+    static bool pinCurrentThread(const std::vector<unsigned int>&cpus);
+    /// Pins the calling worker thread to a single cpu of --workercpus, handed out round robin over all pools.
+    static void pinWorkerThread();
+    /// Pins the calling thread, which is about to run an IOService, to all cpus of --iocpus.
+    static void pinIOServiceThread();
+};
+}
+#endif
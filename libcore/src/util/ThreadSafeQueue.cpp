@@ -31,18 +31,21 @@
  */
 #include "util/Standard.hh"
 #include "ThreadSafeQueue.hpp"
+#include "ProfiledMutex.hpp"
 #include <boost/thread.hpp>
 namespace Sirikata {
 namespace ThreadSafeQueueNS{
-class Lock :public boost::mutex {
+class Lock :public Metrics::ProfiledMutex<> {
+public:
+    Lock():Metrics::ProfiledMutex<>("threadsafequeue") {}
 };
-class Condition :public boost::condition_variable {
+class Condition :public boost::condition_variable_any {
 };
 void lock(Lock*lok) {
     lok->lock();
 }
 void wait(Lock*lok,Condition *cond, bool (*check) (void*, void*), void * arg1, void * arg2){
-    boost::unique_lock<boost::mutex> lock(*lok);
+    boost::unique_lock<Lock> lock(*lok);
     while ((*check)(arg1,arg2)){
         cond->wait(lock);
     }
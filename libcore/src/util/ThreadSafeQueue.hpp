@@ -192,6 +192,46 @@ public:
         ThreadSafeQueueNS::unlock(mLock);
     }
 
+	/**
+	 * Pushes count values onto the queue, taking the lock only once
+	 *
+	 * @param values  points to count new'ed values (you must not keep a reference)
+	 */
+	void pushBatch(const T*values, size_t count) {
+        ThreadSafeQueueNS::lock(mLock);
+        try {
+            mList.insert(mList.end(),values,values+count);
+            for (size_t i=0;i<count;++i) {
+                ThreadSafeQueueNS::notify(mCond);
+            }
+        } catch (...) {
+            ThreadSafeQueueNS::unlock(mLock);
+            throw;
+        }
+        ThreadSafeQueueNS::unlock(mLock);
+    }
+
+	/**
+	 * Pops up to maxCount values from the front of the queue into values, taking the lock only once
+	 *
+	 * @returns  the number of values placed in values
+	 */
+	size_t popUpTo(T*values, size_t maxCount) {
+        size_t count=0;
+        ThreadSafeQueueNS::lock(mLock);
+        try {
+            while (count<maxCount&&!mList.empty()) {
+                values[count++]=mList.front();
+                mList.pop_front();
+            }
+        }catch (...) {
+            ThreadSafeQueueNS::unlock(mLock);
+            throw;
+        }
+        ThreadSafeQueueNS::unlock(mLock);
+        return count;
+    }
+
 	/**
 	 * Pops the front value from the queue and places it in value.
 	 *
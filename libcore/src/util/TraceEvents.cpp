@@ -0,0 +1,207 @@
+/*  Sirikata Utilities -- Trace Events
+ *  TraceEvents.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TraceEvents.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+#include <fstream>
+
+volatile int Sirikata_Trace_Recording=0;
+
+namespace Sirikata { namespace Trace {
+namespace {
+OptionValue *traceRecord;
+OptionValue *traceFile;
+OptionValue *traceBuffer;
+InitializeGlobalOptions o("",
+                    traceRecord=new OptionValue("tracerecord","false",OptionValueType<bool>(),"keep trace events from startup instead of waiting for Trace::start"),
+                    traceFile=new OptionValue("tracefile","sirikata_trace.json",OptionValueType<String>(),"file Trace::dump writes Chrome trace JSON to, also written at exit while recording"),
+                    traceBuffer=new OptionValue("tracebuffer","65536",OptionValueType<uint32>(),"most recent trace events kept per thread"),
+                    NULL);
+
+struct Event {
+    const char *mName;
+    uint64 mStart;
+    uint64 mEnd;
+};
+
+/**
+ * One thread's ring of events. Only its thread writes it, so the lock is
+ * uncontended except while a dump copies it out.
+ */
+class ThreadBuffer {
+public:
+    boost::mutex mLock;
+    std::vector<Event> mEvents;
+    uint64 mNumRecorded;
+    unsigned int mThread;
+    ThreadBuffer(unsigned int thread, size_t size):mEvents(size?size:1),mNumRecorded(0),mThread(thread) {
+    }
+};
+
+class Registry {
+public:
+    boost::mutex mLock;
+    std::vector<ThreadBuffer*> mBuffers;
+};
+///Never destroyed, so spans closing during static destruction still have somewhere to go
+Registry &registry() {
+    static Registry *sRegistry=new Registry;
+    return *sRegistry;
+}
+
+boost::thread_specific_ptr<ThreadBuffer*> &bufferOfThread() {
+    static boost::thread_specific_ptr<ThreadBuffer*> *sBuffer=new boost::thread_specific_ptr<ThreadBuffer*>;
+    return *sBuffer;
+}
+
+///Buffers outlive their threads so a dump still shows them; the thread specific slot only holds a pointer
+ThreadBuffer *threadBuffer() {
+    boost::thread_specific_ptr<ThreadBuffer*> &slot=bufferOfThread();
+    ThreadBuffer **buffer=slot.get();
+    if (!buffer) {
+        Registry &buffers=registry();
+        boost::mutex::scoped_lock lock(buffers.mLock);
+        uint32 size=traceBuffer?traceBuffer->as<uint32>():65536;
+        buffers.mBuffers.push_back(new ThreadBuffer(buffers.mBuffers.size()+1,size));
+        buffer=new ThreadBuffer*(buffers.mBuffers.back());
+        slot.reset(buffer);
+    }
+    return *buffer;
+}
+
+void writeName(std::ostream &os, const char *name) {
+    os<<'"';
+    for (;*name;++name) {
+        if (*name=='"'||*name=='\\')
+            os<<'\\';
+        os<<*name;
+    }
+    os<<'"';
+}
+
+class DumpAtExit {public:
+    ~DumpAtExit() {
+        if (Sirikata_Trace_Recording&&traceFile&&!traceFile->as<String>().empty()) {
+            dump();
+        }
+    }
+} sDumpAtExit;
+}
+
+uint64 timestamp() {
+    return Task::AbsTime::now().raw();
+}
+
+void record(const char *name, uint64 start, uint64 end) {
+    ThreadBuffer *buffer=threadBuffer();
+    boost::mutex::scoped_lock lock(buffer->mLock);
+    Event &event=buffer->mEvents[buffer->mNumRecorded%buffer->mEvents.size()];
+    event.mName=name;
+    event.mStart=start;
+    event.mEnd=end;
+    ++buffer->mNumRecorded;
+}
+
+void start() {
+    if (Sirikata_Trace_Recording) return;
+    Registry &buffers=registry();
+    boost::mutex::scoped_lock lock(buffers.mLock);
+    for (size_t i=0;i<buffers.mBuffers.size();++i) {
+        boost::mutex::scoped_lock bufferLock(buffers.mBuffers[i]->mLock);
+        buffers.mBuffers[i]->mNumRecorded=0;
+    }
+    Sirikata_Trace_Recording=1;
+}
+
+void stop() {
+    Sirikata_Trace_Recording=0;
+}
+
+bool isRecording() {
+    return Sirikata_Trace_Recording!=0;
+}
+
+void dump(std::ostream &os) {
+    Registry &buffers=registry();
+    boost::mutex::scoped_lock lock(buffers.mLock);
+    os<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first=true;
+    std::vector<Event> events;
+    for (size_t i=0;i<buffers.mBuffers.size();++i) {
+        ThreadBuffer *buffer=buffers.mBuffers[i];
+        {
+            boost::mutex::scoped_lock bufferLock(buffer->mLock);
+            size_t size=buffer->mEvents.size();
+            size_t kept=buffer->mNumRecorded<size?(size_t)buffer->mNumRecorded:size;
+            events.resize(kept);
+            for (size_t j=0;j<kept;++j)
+                events[j]=buffer->mEvents[(buffer->mNumRecorded-kept+j)%size];
+        }
+        for (size_t j=0;j<events.size();++j) {
+            os<<(first?"\n":",\n")<<"{\"name\":";
+            writeName(os,events[j].mName);
+            os<<",\"ph\":\"X\",\"pid\":1,\"tid\":"<<buffer->mThread
+              <<",\"ts\":"<<events[j].mStart<<",\"dur\":"<<events[j].mEnd-events[j].mStart<<'}';
+            first=false;
+        }
+    }
+    os<<"\n]}\n";
+}
+
+bool dump(const String &file) {
+    String path=file.empty()?traceFile->as<String>():file;
+    std::ofstream out(path.c_str());
+    if (!out) {
+        SILOG(trace,error,"Could not open trace file "<<path);
+        return false;
+    }
+    dump(out);
+    SILOG(trace,info,"Wrote trace events to "<<path);
+    return true;
+}
+
+void traceOptionsChanged() {
+    if (!traceRecord) {
+        // Parsed from a static initializer before this file's options exist
+        return;
+    }
+    static bool sWasRequested=false;
+    bool requested=traceRecord->as<bool>();
+    if (requested==sWasRequested) return;
+    sWasRequested=requested;
+    if (requested) start();
+    else stop();
+}
+
+} }
@@ -0,0 +1,84 @@
+/*  Sirikata Utilities -- Trace Events
+ *  TraceEvents.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_TRACE_EVENTS_HPP_
+#define _SIRIKATA_TRACE_EVENTS_HPP_
+
+///Nonzero while trace events are being kept; read inline so idle trace points cost one load
+extern "C" SIRIKATA_EXPORT volatile int Sirikata_Trace_Recording;
+
+namespace Sirikata { namespace Trace {
+///Microseconds on the clock trace events are stamped with
+SIRIKATA_EXPORT uint64 timestamp();
+///Keeps one finished span in the calling thread's buffer; name must outlive the trace
+SIRIKATA_EXPORT void record(const char *name, uint64 start, uint64 end);
+
+/**
+ * Times its own lifetime as one span. Use through SIRIKATA_TRACE_SCOPE,
+ * which takes a string literal and vanishes when trace events are compiled
+ * out. While not recording it only checks Sirikata_Trace_Recording.
+ */
+class Scope {
+    const char *mName;
+    uint64 mStart;
+public:
+    explicit Scope(const char *name):mName(Sirikata_Trace_Recording?name:NULL),mStart(0) {
+        if (mName)
+            mStart=timestamp();
+    }
+    ~Scope() {
+        if (mName)
+            record(mName,mStart,timestamp());
+    }
+};
+
+///Starts keeping trace events, in a ring of tracebuffer events per thread
+SIRIKATA_EXPORT void start();
+///Stops keeping trace events; those already kept stay until the next start()
+SIRIKATA_EXPORT void stop();
+SIRIKATA_EXPORT bool isRecording();
+///Writes every kept event as Chrome trace JSON, loadable in chrome://tracing or Perfetto
+SIRIKATA_EXPORT void dump(std::ostream &os);
+///Writes the trace to file, or to the tracefile option if file is empty; false if it could not be opened
+SIRIKATA_EXPORT bool dump(const String &file=String());
+///Follows the tracerecord option; called from Logging::levelsChanged() after every parse
+SIRIKATA_EXPORT void traceOptionsChanged();
+} }
+
+#define SIRIKATA_TRACE_CONCAT_(a,b) a##b
+#define SIRIKATA_TRACE_CONCAT(a,b) SIRIKATA_TRACE_CONCAT_(a,b)
+#ifndef SIRIKATA_NO_TRACE_EVENTS
+# define SIRIKATA_TRACE_SCOPE(name) Sirikata::Trace::Scope SIRIKATA_TRACE_CONCAT(sirikataTraceScope,__LINE__)(name)
+#else
+# define SIRIKATA_TRACE_SCOPE(name)
+#endif
+
+#endif
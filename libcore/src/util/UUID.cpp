@@ -32,6 +32,7 @@
 #include "util/Standard.hh"
 #include "UUID.hpp"
 #include "boost_uuid.hpp"
+#include <boost/thread/tss.hpp>
 BOOST_STATIC_ASSERT(Sirikata::UUID::static_size==sizeof(boost_::uuid));
 
 namespace Sirikata {
@@ -42,13 +43,67 @@ UUID::UUID(const std::string & other,HumanReadable ) {
 UUID::UUID(const boost_::uuid&other){
     mData.initialize(other.begin(),other.end());
 }
+namespace {
+///xoshiro256**: each thread seeds one from the same entropy boost_::uuid::create() uses, then never touches /dev/urandom again
+class FastUUIDGenerator {
+    uint64 mState[4];
+    static uint64 rotl(uint64 x, int k) {
+        return (x<<k)|(x>>(64-k));
+    }
+public:
+    FastUUIDGenerator() {
+        unsigned int first[5]={0};
+        unsigned int second[5]={0};
+        boost_::detail::sha1_random_digest(first);
+        boost_::detail::sha1_random_digest(second);
+        memcpy(mState,first,16);
+        memcpy(mState+2,second,16);
+        mState[3]^=(uint64)(size_t)this;
+        if ((mState[0]|mState[1]|mState[2]|mState[3])==0) {
+            mState[0]=1;
+        }
+    }
+    uint64 next() {
+        uint64 retval=rotl(mState[1]*5,7)*9;
+        uint64 t=mState[1]<<17;
+        mState[2]^=mState[0];
+        mState[3]^=mState[1];
+        mState[1]^=mState[2];
+        mState[0]^=mState[3];
+        mState[2]^=t;
+        mState[3]=rotl(mState[3],45);
+        return retval;
+    }
+};
+///A function static so UUIDs made by other files' static initializers still find it constructed
+boost::thread_specific_ptr<FastUUIDGenerator> &threadGenerator() {
+    static boost::thread_specific_ptr<FastUUIDGenerator> sGenerator;
+    return sGenerator;
+}
+}
 UUID::UUID(UUID::Random) {
-    boost_::uuid randval = boost_::uuid::create();
-    mData.initialize(randval.begin(),randval.end());
+    boost::thread_specific_ptr<FastUUIDGenerator> &generator=threadGenerator();
+    if (generator.get()==NULL) {
+        generator.reset(new FastUUIDGenerator);
+    }
+    uint64 words[2]={generator->next(),generator->next()};
+    unsigned char data[static_size];
+    memcpy(data,words,static_size);
+    // variant 0b10xxxxxx and version 0b0100xxxx, as boost_::uuid::create_random_based sets them
+    data[8]=(data[8]&0x3F)|0x80;
+    data[6]=(data[6]&0x0F)|0x40;
+    mData.initialize(data,data+static_size);
 }
 UUID UUID::random() {
     return UUID(UUID::Random());
 }
+UUID::UUID(UUID::SecureRandom) {
+    boost_::uuid randval = boost_::uuid::create();
+    mData.initialize(randval.begin(),randval.end());
+}
+UUID UUID::secureRandom() {
+    return UUID(UUID::SecureRandom());
+}
 std::string UUID::readableHexData()const{
     std::ostringstream oss;
     oss<<boost_::uuid(getArray().begin(),getArray().end());
@@ -72,8 +72,13 @@ public:
         mData.memcpy(s.data(),s.length());
     }
     class Random{};
+    ///Fast version 4 UUID from a per thread generator seeded from the system's entropy; unique, but predictable to anyone who sees enough of them
     UUID(Random);
     static UUID random();
+    class SecureRandom{};
+    ///Version 4 UUID drawn from the system's entropy on every call, for anything that acts as a key or secret
+    UUID(SecureRandom);
+    static UUID secureRandom();
     const Data& getArray()const{return mData;}
     UUID & operator=(const UUID & other) { mData = other.mData; return *this; }
     UUID & operator=(const Data & other) { mData = other; return *this; }
@@ -0,0 +1,187 @@
+/*  Sirikata Utilities -- Math Library
+ *  VectorKernels.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_VECTOR_KERNELS_HPP_
+#define _SIRIKATA_VECTOR_KERNELS_HPP_
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SIRIKATA_VECTOR_KERNELS_SSE 1
+#include <xmmintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIRIKATA_VECTOR_KERNELS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Sirikata {
+/**
+ * Operations over arrays of Vector3, Quaternion and Matrix3x3, for loops that
+ * move many points or orientations at once. The float (and for
+ * extrapolatePoints, double) versions use SSE when the compiler targets it;
+ * everything else falls back to the scalar operators, which give the same
+ * results up to rounding. out may be the same array as the input.
+ */
+namespace VectorKernels {
+
+/// out[i] = rotation*in[i] + translation
+template <typename scalar>
+inline void transformPoints(const Matrix3x3<scalar> &rotation, const Vector3<scalar> &translation,
+                            const Vector3<scalar> *in, Vector3<scalar> *out, size_t count) {
+    for (size_t i=0;i<count;++i) {
+        out[i]=rotation*in[i]+translation;
+    }
+}
+
+/// out[i] = in[i] + velocity[i]*seconds
+template <typename scalar>
+inline void extrapolatePoints(const Vector3<scalar> *in, const Vector3<scalar> *velocity, scalar seconds,
+                              Vector3<scalar> *out, size_t count) {
+    for (size_t i=0;i<count;++i) {
+        out[i]=in[i]+velocity[i]*seconds;
+    }
+}
+
+#ifdef SIRIKATA_VECTOR_KERNELS_SSE
+template <>
+inline void transformPoints(const Matrix3x3<float> &rotation, const Vector3<float> &translation,
+                            const Vector3<float> *in, Vector3<float> *out, size_t count) {
+    const Vector3<float> &c0=rotation.getCol(0);
+    const Vector3<float> &c1=rotation.getCol(1);
+    const Vector3<float> &c2=rotation.getCol(2);
+    __m128 col0=_mm_set_ps(0.f,c0.z,c0.y,c0.x);
+    __m128 col1=_mm_set_ps(0.f,c1.z,c1.y,c1.x);
+    __m128 col2=_mm_set_ps(0.f,c2.z,c2.y,c2.x);
+    __m128 offset=_mm_set_ps(0.f,translation.z,translation.y,translation.x);
+    for (size_t i=0;i<count;++i) {
+        __m128 result=_mm_add_ps(_mm_add_ps(_mm_mul_ps(col0,_mm_set1_ps(in[i].x)),
+                                            _mm_mul_ps(col1,_mm_set1_ps(in[i].y))),
+                                 _mm_add_ps(_mm_mul_ps(col2,_mm_set1_ps(in[i].z)),offset));
+        // Store exactly three floats so in place transforms never clobber the next point
+        _mm_storel_pi((__m64*)&out[i].x,result);
+        _mm_store_ss(&out[i].z,_mm_movehl_ps(result,result));
+    }
+}
+
+template <>
+inline void extrapolatePoints(const Vector3<float> *in, const Vector3<float> *velocity, float seconds,
+                              Vector3<float> *out, size_t count) {
+    // Vector3 is three packed floats, so the arrays are walked as flat float arrays four at a time
+    const float *src=&in[0].x;
+    const float *vel=&velocity[0].x;
+    float *dst=&out[0].x;
+    size_t total=count*3;
+    __m128 dt=_mm_set1_ps(seconds);
+    size_t i=0;
+    for (;i+4<=total;i+=4) {
+        _mm_storeu_ps(dst+i,_mm_add_ps(_mm_loadu_ps(src+i),_mm_mul_ps(_mm_loadu_ps(vel+i),dt)));
+    }
+    for (;i<total;++i) {
+        dst[i]=src[i]+vel[i]*seconds;
+    }
+}
+#endif
+
+#ifdef SIRIKATA_VECTOR_KERNELS_SSE2
+template <>
+inline void extrapolatePoints(const Vector3<double> *in, const Vector3<double> *velocity, double seconds,
+                              Vector3<double> *out, size_t count) {
+    const double *src=&in[0].x;
+    const double *vel=&velocity[0].x;
+    double *dst=&out[0].x;
+    size_t total=count*3;
+    __m128d dt=_mm_set1_pd(seconds);
+    size_t i=0;
+    for (;i+2<=total;i+=2) {
+        _mm_storeu_pd(dst+i,_mm_add_pd(_mm_loadu_pd(src+i),_mm_mul_pd(_mm_loadu_pd(vel+i),dt)));
+    }
+    for (;i<total;++i) {
+        dst[i]=src[i]+vel[i]*seconds;
+    }
+}
+#endif
+
+/// out[i] = rotation*in[i], building the rotation matrix once instead of two cross products per point
+inline void rotatePoints(const Quaternion &rotation, const Vector3<float> *in, Vector3<float> *out, size_t count) {
+    Matrix3x3<float> matrix(rotation.xAxis(),rotation.yAxis(),rotation.zAxis(),COLUMNS());
+    transformPoints(matrix,Vector3<float>(0,0,0),in,out,count);
+}
+
+/**
+ * out[i] = spherical interpolation from from[i] to to[i] by t[i], taking the
+ * shorter way around. Unit quaternions in, unit quaternions out; nearly equal
+ * pairs are blended linearly and renormalized.
+ */
+inline void slerpQuaternions(const Quaternion *from, const Quaternion *to, const float *t,
+                             Quaternion *out, size_t count) {
+    for (size_t i=0;i<count;++i) {
+        float cosine=from[i].x*to[i].x+from[i].y*to[i].y+from[i].z*to[i].z+from[i].w*to[i].w;
+        float sign=1.f;
+        if (cosine<0.f) {
+            cosine=-cosine;
+            sign=-1.f;
+        }
+        float fromWeight;
+        float toWeight;
+        bool renormalize=cosine>0.9995f;
+        if (renormalize) {
+            fromWeight=1.f-t[i];
+            toWeight=t[i];
+        } else {
+            float angle=acosf(cosine);
+            float inverseSine=1.f/sinf(angle);
+            fromWeight=sinf((1.f-t[i])*angle)*inverseSine;
+            toWeight=sinf(t[i]*angle)*inverseSine;
+        }
+        toWeight*=sign;
+#ifdef SIRIKATA_VECTOR_KERNELS_SSE
+        __m128 result=_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from[i].v),_mm_set1_ps(fromWeight)),
+                                 _mm_mul_ps(_mm_loadu_ps(to[i].v),_mm_set1_ps(toWeight)));
+        if (renormalize) {
+            __m128 squared=_mm_mul_ps(result,result);
+            squared=_mm_add_ps(squared,_mm_shuffle_ps(squared,squared,_MM_SHUFFLE(2,3,0,1)));
+            squared=_mm_add_ps(squared,_mm_shuffle_ps(squared,squared,_MM_SHUFFLE(1,0,3,2)));
+            result=_mm_div_ps(result,_mm_sqrt_ps(squared));
+        }
+        _mm_storeu_ps(out[i].v,result);
+#else
+        Quaternion result(from[i].x*fromWeight+to[i].x*toWeight,
+                          from[i].y*fromWeight+to[i].y*toWeight,
+                          from[i].z*fromWeight+to[i].z*toWeight,
+                          from[i].w*fromWeight+to[i].w*toWeight,
+                          Quaternion::XYZW());
+        out[i]=renormalize?result.normal():result;
+#endif
+    }
+}
+
+}
+}
+#endif
@@ -0,0 +1,130 @@
+/*  Sirikata Tests -- Sirikata Testing Framework
+ *  CachePolicyTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "transfer/LRUPolicy.hpp"
+#include "transfer/GDSFPolicy.hpp"
+
+using namespace Sirikata;
+class CachePolicyTest : public CxxTest::TestSuite
+{
+	typedef std::map<Transfer::Fingerprint, std::pair<Transfer::CachePolicy::Data*, Transfer::cache_usize_type> > EntryMap;
+
+	/// Does what CacheMap::alloc() and write_iterator::insert() would for a new entry.
+	static bool insert(Transfer::CachePolicy &policy, EntryMap &entries, int name, Transfer::cache_usize_type size) {
+		if (!policy.cachable(size)) {
+			return false;
+		}
+		Transfer::Fingerprint toDelete;
+		while (policy.nextItem(size, toDelete)) {
+			EntryMap::iterator iter = entries.find(toDelete);
+			policy.destroy((*iter).first, (*iter).second.first, (*iter).second.second);
+			entries.erase(iter);
+		}
+		Transfer::Fingerprint id = fingerprint(name);
+		entries[id] = std::pair<Transfer::CachePolicy::Data*, Transfer::cache_usize_type>(policy.create(id, size), size);
+		return true;
+	}
+	static void use(Transfer::CachePolicy &policy, EntryMap &entries, int name) {
+		EntryMap::iterator iter = entries.find(fingerprint(name));
+		policy.use((*iter).first, (*iter).second.first, (*iter).second.second);
+	}
+	static bool contains(EntryMap &entries, int name) {
+		return entries.find(fingerprint(name)) != entries.end();
+	}
+	static void clear(Transfer::CachePolicy &policy, EntryMap &entries) {
+		for (EntryMap::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+			policy.destroy((*iter).first, (*iter).second.first, (*iter).second.second);
+		}
+		entries.clear();
+	}
+	static Transfer::Fingerprint fingerprint(int name) {
+		std::ostringstream os;
+		os << name;
+		return Transfer::Fingerprint::computeDigest(os.str());
+	}
+	/// 60 small entries of 15 bytes each, all used twice, leaving 100 bytes free.
+	static void fillSmall(Transfer::CachePolicy &policy, EntryMap &entries) {
+		for (int i = 0; i < 60; ++i) {
+			insert(policy, entries, i, 15);
+		}
+		for (int i = 0; i < 60; ++i) {
+			use(policy, entries, i);
+			use(policy, entries, i);
+		}
+	}
+	static int countSmall(EntryMap &entries) {
+		int count = 0;
+		for (int i = 0; i < 60; ++i) {
+			count += contains(entries, i) ? 1 : 0;
+		}
+		return count;
+	}
+public:
+	void testLRUFlushedByLargeEntry( void ) {
+		Transfer::LRUPolicy policy(1000);
+		EntryMap entries;
+		fillSmall(policy, entries);
+		TS_ASSERT(insert(policy, entries, 1000, 450));
+		TS_ASSERT_EQUALS(countSmall(entries), 36);
+		clear(policy, entries);
+	}
+	void testGDSFAdmission( void ) {
+		Transfer::GDSFPolicy policy(1000);
+		EntryMap entries;
+		fillSmall(policy, entries);
+		TS_ASSERT(!insert(policy, entries, 1000, 450));
+		TS_ASSERT_EQUALS(countSmall(entries), 60);
+		// Still room for something that fits without evicting.
+		TS_ASSERT(insert(policy, entries, 1001, 90));
+		TS_ASSERT_EQUALS(countSmall(entries), 60);
+		clear(policy, entries);
+	}
+	void testGDSFEvictsLargeAndUnused( void ) {
+		Transfer::GDSFPolicy policy(1000, 0.5, false);
+		EntryMap entries;
+		fillSmall(policy, entries);
+		TS_ASSERT(insert(policy, entries, 1000, 450));
+		int smallLeft = countSmall(entries);
+		TS_ASSERT_EQUALS(smallLeft, 36);
+		// As long as the small entries stay in use, a second large entry displaces the first rather than more small ones.
+		for (int i = 0; i < 60; ++i) {
+			if (contains(entries, i)) {
+				use(policy, entries, i);
+			}
+		}
+		TS_ASSERT(insert(policy, entries, 1001, 450));
+		TS_ASSERT(!contains(entries, 1000));
+		TS_ASSERT(contains(entries, 1001));
+		TS_ASSERT_EQUALS(countSmall(entries), smallLeft);
+		clear(policy, entries);
+	}
+};
@@ -0,0 +1,446 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  CacheTraceReplay.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "transfer/DiskCacheLayer.hpp"
+#include "transfer/MemoryCacheLayer.hpp"
+#include "transfer/NetworkCacheLayer.hpp"
+#include "transfer/TransferData.hpp"
+#include "transfer/LRUPolicy.hpp"
+#include "transfer/GDSFPolicy.hpp"
+#include "transfer/ProtocolRegistry.hpp"
+#include "transfer/ServiceManager.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include "util/AtomicTypes.hpp"
+#include <boost/thread.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <cstdio>
+
+/**
+ * Replays a recorded asset access trace through MemoryCacheLayer,
+ * DiskCacheLayer and NetworkCacheLayer stacks, for every combination of layer
+ * stack, CachePolicy and cache size given on the command line.  The network
+ * layer talks to a simulated origin that returns blocks of the recorded size
+ * after --origin-latency, so no server is needed.  Prints hit ratio, byte hit
+ * ratio, p50/p99/p999 request latency and origin bandwidth for each.
+ *
+ * The trace has one JSON object per line, like our request logs:
+ *   {"time": 12.5, "id": "models/tree.mesh", "size": 48213}
+ * "id" (or "hash", a 64 digit hex fingerprint) names the asset and "size" is
+ * its length in bytes.  "time" in seconds is optional and only used with
+ * --speed; "offset" and "length" request part of the file.
+ */
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+namespace {
+OptionValue*traceFile;
+OptionValue*stacks;
+OptionValue*policies;
+OptionValue*memorySizes;
+OptionValue*diskSizes;
+OptionValue*diskDirectory;
+OptionValue*originLatency;
+OptionValue*concurrency;
+OptionValue*speed;
+InitializeGlobalOptions o("cachereplay",
+                    traceFile=new OptionValue("trace","",OptionValueType<String>(),"Access trace to replay, one JSON object per line"),
+                    stacks=new OptionValue("stacks","memory,disk,memory+disk",OptionValueType<String>(),"Comma separated cache stacks in front of the network layer, each memory, disk or memory+disk"),
+                    policies=new OptionValue("policies","lru,gdsf",OptionValueType<String>(),"Comma separated cache policies out of lru and gdsf"),
+                    memorySizes=new OptionValue("memory-sizes","16M,64M",OptionValueType<String>(),"Comma separated memory cache sizes, with optional K, M or G suffix"),
+                    diskSizes=new OptionValue("disk-sizes","256M,1G",OptionValueType<String>(),"Comma separated disk cache sizes, with optional K, M or G suffix"),
+                    diskDirectory=new OptionValue("disk-dir","cachereplay",OptionValueType<String>(),"Scratch directory for disk caches, removed after each run"),
+                    originLatency=new OptionValue("origin-latency","50ms",OptionValueType<Duration>(),"Time the simulated origin takes to answer a request"),
+                    concurrency=new OptionValue("concurrency","1",OptionValueType<unsigned int>(),"Requests allowed in flight at once"),
+                    speed=new OptionValue("speed","0",OptionValueType<double>(),"Replay the trace timestamps at this multiple of real time, 0 for as fast as possible"),
+                    NULL);
+
+std::vector<String> splitList(const String&list) {
+    std::vector<String> retval;
+    String::size_type pos=0;
+    while (pos<list.length()) {
+        String::size_type comma=list.find(',',pos);
+        if (comma==String::npos) comma=list.length();
+        if (comma>pos)
+            retval.push_back(list.substr(pos,comma-pos));
+        pos=comma+1;
+    }
+    return retval;
+}
+std::vector<cache_usize_type> parseSizes(const String&list) {
+    std::vector<String> items=splitList(list);
+    std::vector<cache_usize_type> retval;
+    for (size_t i=0;i<items.size();++i) {
+        char*end=NULL;
+        double value=strtod(items[i].c_str(),&end);
+        switch (end?*end:'\0') {
+          case 'g': case 'G': value*=1024.0;
+          case 'm': case 'M': value*=1024.0;
+          case 'k': case 'K': value*=1024.0;
+          default: break;
+        }
+        if (value>0) retval.push_back((cache_usize_type)value);
+    }
+    return retval;
+}
+
+/// Finds "key": value in a flat JSON object; strings are returned without quotes or escapes
+bool jsonField(const String&line, const char*key, String&value) {
+    String quoted=String("\"")+key+"\"";
+    String::size_type pos=line.find(quoted);
+    if (pos==String::npos) return false;
+    pos=line.find(':',pos+quoted.length());
+    if (pos==String::npos) return false;
+    pos=line.find_first_not_of(" \t",pos+1);
+    if (pos==String::npos) return false;
+    value.clear();
+    if (line[pos]=='"') {
+        for (++pos;pos<line.length()&&line[pos]!='"';++pos) {
+            if (line[pos]=='\\'&&pos+1<line.length()) ++pos;
+            value+=line[pos];
+        }
+        return pos<line.length();
+    }
+    String::size_type end=line.find_first_of(",} \t",pos);
+    value=line.substr(pos,end==String::npos?String::npos:end-pos);
+    return !value.empty();
+}
+
+struct TraceRecord {
+    double mTime;
+    Fingerprint mHash;
+    cache_usize_type mSize;
+    Range mRange;
+    TraceRecord():mTime(0),mSize(0),mRange(true) {}
+};
+
+bool readTrace(const String&filename, std::vector<TraceRecord>&trace) {
+    std::ifstream input(filename.c_str());
+    if (!input) {
+        fprintf(stderr,"Unable to open trace %s\n",filename.c_str());
+        return false;
+    }
+    String line,value;
+    size_t lineNumber=0;
+    while (std::getline(input,line)) {
+        ++lineNumber;
+        TraceRecord record;
+        if (jsonField(line,"hash",value)&&value.length()==64) {
+            record.mHash=SHA256::convertFromHex(value);
+        }else if (jsonField(line,"id",value)||jsonField(line,"uri",value)) {
+            record.mHash=SHA256::computeDigest(value);
+        }else {
+            if (line.find_first_not_of(" \t\r")!=String::npos)
+                fprintf(stderr,"Skipping trace line %u without an id\n",(unsigned int)lineNumber);
+            continue;
+        }
+        if (!jsonField(line,"size",value)||!(record.mSize=strtoull(value.c_str(),NULL,10))) {
+            fprintf(stderr,"Skipping trace line %u without a size\n",(unsigned int)lineNumber);
+            continue;
+        }
+        if (jsonField(line,"time",value))
+            record.mTime=strtod(value.c_str(),NULL);
+        cache_usize_type offset=0;
+        if (jsonField(line,"offset",value))
+            offset=strtoull(value.c_str(),NULL,10);
+        if (jsonField(line,"length",value)) {
+            cache_usize_type length=strtoull(value.c_str(),NULL,10);
+            record.mRange=Range(offset,length,LENGTH,offset+length>=record.mSize);
+        }else if (offset) {
+            record.mRange=Range(offset,record.mSize-offset,LENGTH,true);
+        }
+        trace.push_back(record);
+    }
+    return true;
+}
+
+/**
+ * Origin behind the NetworkCacheLayer: answers "trace" URIs of the form
+ * trace://origin/<size>/<fingerprint> with that many zero bytes, after a fixed delay.
+ */
+class TraceOriginHandler : public DownloadHandler {
+    Network::IOService*mIO;
+    boost::thread*mThread;
+    Duration mLatency;
+    ///Shared by every response, so keeping a file in a memory cache costs nothing here; never resized
+    std::vector<unsigned char> mZeros;
+    std::tr1::shared_ptr<void> mZerosOwner;
+    boost::mutex mMutex;
+    std::map<Fingerprint,unsigned int> mFetches;
+    uint64 mOriginBytes;
+    uint64 mOriginRequests;
+    AtomicValue<int> mStopping;
+
+    ///Runs responses as they come due; a plain runService would return as soon as the service ran out of work
+    void serve() {
+        while (!mStopping.read())
+            Network::IOServiceFactory::runOneServiceFor(mIO,Duration::milliseconds(100.0));
+    }
+    void respond(DenseDataPtr data, cache_usize_type size, const Callback&cb) {
+        cb(data,true,size);
+    }
+public:
+    TraceOriginHandler(const Duration&latency, cache_usize_type largestFile)
+            : mIO(Network::IOServiceFactory::makeIOService()),
+              mLatency(latency),
+              mZeros((size_t)largestFile),
+              mOriginBytes(0),
+              mOriginRequests(0),
+              mStopping(0) {
+        mThread=new boost::thread(std::tr1::bind(&TraceOriginHandler::serve,this));
+    }
+    ~TraceOriginHandler() {
+        mStopping=1;
+        mThread->join();
+        delete mThread;
+        Network::IOServiceFactory::destroyIOService(mIO);
+    }
+    static URI uriFor(const TraceRecord&record) {
+        std::ostringstream path;
+        path<<"trace://origin/"<<record.mSize<<"/"<<record.mHash.convertToHexString();
+        return URI(URIContext(),path.str());
+    }
+    virtual void download(TransferDataPtr *ptrRef, const URI &uri, const Range &bytes, const Callback &cb) {
+        String path=uri.toString();
+        String::size_type hashStart=path.rfind('/');
+        String::size_type sizeStart=hashStart==String::npos?String::npos:path.rfind('/',hashStart-1);
+        if (sizeStart==String::npos) {
+            Network::IOServiceFactory::dispatchServiceMessage(mIO,std::tr1::bind(cb,DenseDataPtr(),false,0));
+            return;
+        }
+        cache_usize_type size=strtoull(path.c_str()+sizeStart+1,NULL,10);
+        Fingerprint hash=SHA256::convertFromHex(path.substr(hashStart+1));
+        cache_usize_type start=bytes.startbyte();
+        cache_usize_type end=bytes.goesToEndOfFile()?size:std::min(size,bytes.endbyte());
+        if (start>end) start=end;
+        if (end-start>mZeros.size()) end=start+mZeros.size();
+        DenseDataPtr data(new DenseData(Range(start,end-start,LENGTH,end==size),
+                                        mZeros.empty()?NULL:&mZeros[0],mZerosOwner));
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            ++mFetches[hash];
+            mOriginBytes+=end-start;
+            ++mOriginRequests;
+        }
+        Network::IOServiceFactory::dispatchServiceMessage(mIO,mLatency,std::tr1::bind(&TraceOriginHandler::respond,this,data,size,cb));
+    }
+    virtual void stream(TransferDataPtr *ptrRef, const URI &uri, const Range &bytes, const Callback &cb) {
+        download(ptrRef,uri,bytes,cb);
+    }
+    unsigned int fetches(const Fingerprint&hash) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        std::map<Fingerprint,unsigned int>::const_iterator where=mFetches.find(hash);
+        return where==mFetches.end()?0:where->second;
+    }
+    void reset() {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mFetches.clear();
+        mOriginBytes=0;
+        mOriginRequests=0;
+    }
+    uint64 originBytes() {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        return mOriginBytes;
+    }
+    uint64 originRequests() {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        return mOriginRequests;
+    }
+};
+
+CachePolicy*createPolicy(const String&name, cache_usize_type size) {
+    if (name=="gdsf")
+        return new GDSFPolicy(size);
+    if (name!="lru")
+        fprintf(stderr,"Unknown policy %s, using lru\n",name.c_str());
+    return new LRUPolicy(size);
+}
+
+class CacheTraceReplay {
+    const std::vector<TraceRecord>&mTrace;
+    std::tr1::shared_ptr<TraceOriginHandler> mOrigin;
+    ProtocolRegistry<DownloadHandler> mProtocols;
+    NullServiceLookup mServices;
+    ServiceManager<DownloadHandler> mServiceManager;
+
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+    unsigned int mOutstanding;
+    std::vector<int64> mLatencies;
+    uint64 mHits;
+    uint64 mHitBytes;
+    uint64 mFailures;
+
+    void finished(Task::AbsTime start, const TraceRecord*record, unsigned int fetchesBefore, const SparseData*data) {
+        int64 latency=(Task::AbsTime::now()-start).toMicroseconds();
+        bool hit=data&&mOrigin->fetches(record->mHash)==fetchesBefore;
+        cache_usize_type bytes=record->mRange.goesToEndOfFile()?record->mSize-record->mRange.startbyte():record->mRange.length();
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mLatencies.push_back(latency);
+        if (!data) {
+            ++mFailures;
+        }else if (hit) {
+            ++mHits;
+            mHitBytes+=bytes;
+        }
+        --mOutstanding;
+        mDone.notify_all();
+    }
+    void waitForOutstanding(unsigned int most) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        while (mOutstanding>most)
+            mDone.wait(lock);
+    }
+    static int64 percentile(const std::vector<int64>&sorted, double fraction) {
+        if (sorted.empty()) return 0;
+        return sorted[(size_t)(fraction*(sorted.size()-1)+0.5)];
+    }
+public:
+    CacheTraceReplay(const std::vector<TraceRecord>&trace, cache_usize_type largestFile)
+            : mTrace(trace),
+              mOrigin(new TraceOriginHandler(originLatency->as<Duration>(),largestFile)),
+              mServiceManager(&mServices,&mProtocols) {
+        mProtocols.setHandler("trace",mOrigin);
+    }
+    void run(const String&stack, const String&policy, cache_usize_type memorySize, cache_usize_type diskSize, unsigned int runNumber) {
+        bool memory=stack.find("memory")!=String::npos;
+        bool disk=stack.find("disk")!=String::npos;
+        std::vector<CachePolicy*> cachePolicies;
+        std::vector<CacheLayer*> layers;
+        String diskDir=diskDirectory->as<String>()+"/run"+boost::lexical_cast<String>(runNumber);
+        layers.push_back(new NetworkCacheLayer(NULL,&mServiceManager));
+        if (disk) {
+            boost::filesystem::remove_all(boost::filesystem::path(diskDir));
+            cachePolicies.push_back(createPolicy(policy,diskSize));
+            layers.push_back(new DiskCacheLayer(cachePolicies.back(),diskDir+"/",layers.back()));
+        }
+        if (memory) {
+            cachePolicies.push_back(createPolicy(policy,memorySize));
+            layers.push_back(new MemoryCacheLayer(cachePolicies.back(),layers.back()));
+        }
+        mOrigin->reset();
+        mLatencies.clear();
+        mLatencies.reserve(mTrace.size());
+        mHits=mHitBytes=mFailures=0;
+        mOutstanding=0;
+        uint64 requestedBytes=0;
+        unsigned int maxOutstanding=concurrency->as<unsigned int>();
+        if (!maxOutstanding) maxOutstanding=1;
+        double replaySpeed=speed->as<double>();
+
+        using std::tr1::placeholders::_1;
+        Task::AbsTime start=Task::AbsTime::now();
+        for (size_t i=0;i<mTrace.size();++i) {
+            const TraceRecord&record=mTrace[i];
+            if (replaySpeed>0) {
+                Task::AbsTime due=start+Duration::seconds((record.mTime-mTrace[0].mTime)/replaySpeed);
+                Task::AbsTime now=Task::AbsTime::now();
+                if (now<due)
+                    boost::this_thread::sleep(boost::posix_time::microseconds((due-now).toMicroseconds()));
+            }
+            waitForOutstanding(maxOutstanding-1);
+            {
+                boost::unique_lock<boost::mutex> lock(mMutex);
+                ++mOutstanding;
+            }
+            requestedBytes+=record.mRange.goesToEndOfFile()?record.mSize-record.mRange.startbyte():record.mRange.length();
+            layers.back()->getData(RemoteFileId(record.mHash,TraceOriginHandler::uriFor(record)),
+                                   record.mRange,
+                                   std::tr1::bind(&CacheTraceReplay::finished,this,Task::AbsTime::now(),&record,mOrigin->fetches(record.mHash),_1));
+        }
+        waitForOutstanding(0);
+        double seconds=(Task::AbsTime::now()-start).toSeconds();
+        double traceSeconds=mTrace.empty()?0:mTrace.back().mTime-mTrace.front().mTime;
+        if (seconds<=0) seconds=1.0e-6;
+
+        for (std::vector<CacheLayer*>::reverse_iterator i=layers.rbegin();i!=layers.rend();++i)
+            delete *i;
+        for (std::vector<CachePolicy*>::iterator i=cachePolicies.begin();i!=cachePolicies.end();++i)
+            delete *i;
+        if (disk)
+            boost::filesystem::remove_all(boost::filesystem::path(diskDir));
+
+        std::sort(mLatencies.begin(),mLatencies.end());
+        double megabyte=1024.0*1024.0;
+        printf("%-12s %-5s %9.1f %9.1f %8.2f %8.2f %10.1f %10.1f %10.1f %11.2f %11.2f %7llu\n",
+               stack.c_str(),policy.c_str(),
+               memory?memorySize/megabyte:0.0,disk?diskSize/megabyte:0.0,
+               mTrace.empty()?0.0:100.0*mHits/mTrace.size(),
+               requestedBytes?100.0*mHitBytes/requestedBytes:0.0,
+               percentile(mLatencies,0.5)/1000.0,percentile(mLatencies,0.99)/1000.0,percentile(mLatencies,0.999)/1000.0,
+               mOrigin->originBytes()/megabyte,
+               mOrigin->originBytes()/megabyte/(replaySpeed>0&&traceSeconds>0?traceSeconds:seconds),
+               (unsigned long long)mFailures);
+        fflush(stdout);
+    }
+};
+}
+
+int main(int argc, const char**argv) {
+    OptionSet::getOptions("cachereplay")->parse(argc,argv);
+    std::vector<TraceRecord> trace;
+    if (traceFile->as<String>().empty()) {
+        fprintf(stderr,"Usage: %s --trace <file> [--help for more options]\n",argv[0]);
+        return 1;
+    }
+    if (!readTrace(traceFile->as<String>(),trace))
+        return 1;
+    cache_usize_type largestFile=0;
+    for (size_t i=0;i<trace.size();++i)
+        largestFile=std::max(largestFile,trace[i].mSize);
+
+    std::vector<String> stackNames=splitList(stacks->as<String>());
+    std::vector<String> policyNames=splitList(policies->as<String>());
+    std::vector<cache_usize_type> memory=parseSizes(memorySizes->as<String>());
+    std::vector<cache_usize_type> disk=parseSizes(diskSizes->as<String>());
+    if (memory.empty()) memory.push_back(0);
+    if (disk.empty()) disk.push_back(0);
+
+    printf("# %u requests, largest file %.1f MB\n",(unsigned int)trace.size(),largestFile/(1024.0*1024.0));
+    printf("%-12s %-5s %9s %9s %8s %8s %10s %10s %10s %11s %11s %7s\n",
+           "stack","policy","mem(MB)","disk(MB)","hit%","bytehit%","p50(ms)","p99(ms)","p999(ms)","origin(MB)","origin MB/s","failed");
+    CacheTraceReplay replay(trace,largestFile);
+    unsigned int runNumber=0;
+    for (size_t s=0;s<stackNames.size();++s) {
+        bool usesMemory=stackNames[s].find("memory")!=String::npos;
+        bool usesDisk=stackNames[s].find("disk")!=String::npos;
+        for (size_t p=0;p<policyNames.size();++p)
+            for (size_t m=0;m<(usesMemory?memory.size():1);++m)
+                for (size_t d=0;d<(usesDisk?disk.size():1);++d)
+                    replay.run(stackNames[s],policyNames[p],memory[m],disk[d],runNumber++);
+    }
+    return 0;
+}
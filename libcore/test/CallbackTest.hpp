@@ -0,0 +1,129 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  CallbackTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/Callback.hpp"
+
+using namespace Sirikata;
+
+namespace {
+int addTo(int *total, int amount) {
+    *total += amount;
+    return *total;
+}
+void appendTo(String &out, const String &a, const String &b) {
+    out += a;
+    out += b;
+}
+/// Counts live instances, and is too large to be stored inline.
+struct BigFunctor {
+    static int sLive;
+    char mPadding[CallbackDetail::INLINE_WORDS * sizeof(void*) * 2];
+    int mValue;
+    explicit BigFunctor(int value) : mValue(value) {
+        ++sLive;
+    }
+    BigFunctor(const BigFunctor &other) : mValue(other.mValue) {
+        ++sLive;
+    }
+    ~BigFunctor() {
+        --sLive;
+    }
+    int operator()() const {
+        return mValue;
+    }
+};
+int BigFunctor::sLive = 0;
+}
+
+class CallbackTest : public CxxTest::TestSuite
+{
+public:
+    void testBoundCall() {
+        using std::tr1::placeholders::_1;
+        int total = 1;
+        Callback<int(int)> add(std::tr1::bind(&addTo, &total, _1));
+        TS_ASSERT(add);
+        TS_ASSERT_EQUALS(add(2), 3);
+        Callback<int(int)> copy(add);
+        TS_ASSERT_EQUALS(copy(4), 7);
+        TS_ASSERT_EQUALS(total, 7);
+
+        String out;
+        Callback<void(String&, const String&, const String&)> append(&appendTo);
+        append(out, "foo", "bar");
+        TS_ASSERT_EQUALS(out, "foobar");
+    }
+    void testEmpty() {
+        Callback<void()> none;
+        TS_ASSERT(!none);
+        TS_ASSERT(none.empty());
+        std::tr1::function<void()> emptyFunction;
+        Callback<void()> fromEmpty(emptyFunction);
+        TS_ASSERT(!fromEmpty);
+        void (*nullPointer)() = NULL;
+        Callback<void()> fromNull(nullPointer);
+        TS_ASSERT(!fromNull);
+    }
+    void testMoveAndSwap() {
+        {
+            Callback<int()> big(BigFunctor(5));
+            TS_ASSERT_EQUALS(BigFunctor::sLive, 1);
+            Callback<int()> moved;
+            moved.moveFrom(big);
+            // heap copies change hands instead of being copied
+            TS_ASSERT_EQUALS(BigFunctor::sLive, 1);
+            TS_ASSERT(!big);
+            TS_ASSERT_EQUALS(moved(), 5);
+
+            using std::tr1::placeholders::_1;
+            int total = 0;
+            Callback<int()> small(std::tr1::bind(&addTo, &total, 3));
+            small.swap(moved);
+            TS_ASSERT_EQUALS(small(), 5);
+            TS_ASSERT_EQUALS(moved(), 3);
+            TS_ASSERT_EQUALS(BigFunctor::sLive, 1);
+            small.clear();
+            TS_ASSERT_EQUALS(BigFunctor::sLive, 0);
+        }
+        TS_ASSERT_EQUALS(BigFunctor::sLive, 0);
+    }
+    void testInsideFunction() {
+        int total = 0;
+        Callback<int()> cb(std::tr1::bind(&addTo, &total, 2));
+        std::tr1::function<int()> f(cb);
+        f();
+        TS_ASSERT_EQUALS(total, 2);
+        cb = std::tr1::function<int()>();
+        TS_ASSERT(!cb);
+    }
+};
@@ -0,0 +1,96 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  CompactLocationTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/CompactLocation.hpp"
+#include "Test_Sirikata.pbj.hpp"
+class CompactLocationTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::Vector3d Vector3d;
+    typedef Sirikata::Vector3f Vector3f;
+    typedef Sirikata::Quaternion Quaternion;
+    typedef Sirikata::Time Time;
+    typedef Sirikata::Duration Duration;
+public:
+    void testRoundTrip( void )
+    {
+        using namespace Sirikata;
+        Time epoch=Time::now();
+        CompactLocationFormat format(1024.0,256.0f,epoch);
+        Protocol::ObjLoc loc;
+        Time timestamp=epoch+Duration::seconds(3600.0);
+        Vector3d position(-40000.25,12.5,987654.0);
+        Quaternion orientation(Vector3f(1,2,3).normal(),2.5f);
+        Vector3f velocity(-100,3.5,200);
+        Vector3f axis(Vector3f(0,1,1).normal());
+        loc.set_timestamp(timestamp);
+        loc.set_position(position);
+        loc.set_orientation(orientation);
+        loc.set_velocity(velocity);
+        loc.set_rotational_axis(axis);
+        loc.set_angular_speed(.75f);
+        String full;
+        loc.SerializeToString(&full);
+
+        format.compress(loc);
+        TS_ASSERT(loc.has_compact());
+        TS_ASSERT(!loc.has_timestamp()&&!loc.has_position()&&!loc.has_orientation()&&!loc.has_velocity()&&!loc.has_rotational_axis());
+        TS_ASSERT(loc.has_angular_speed());
+        String compact;
+        loc.SerializeToString(&compact);
+        TS_ASSERT_LESS_THAN(compact.size(),full.size()*3/4);
+
+        Protocol::ObjLoc received;
+        received.ParseFromString(compact);
+        format.expand(received);
+        TS_ASSERT(!received.has_compact());
+        TS_ASSERT_EQUALS(received.timestamp(),timestamp);
+        TS_ASSERT_LESS_THAN((received.position()-position).length(),1024.0/65536.0);
+        TS_ASSERT_LESS_THAN(1.0f-std::fabs(received.orientation().dot(orientation)),1e-4f);
+        TS_ASSERT_LESS_THAN((received.velocity()-velocity).length(),.05f);
+        TS_ASSERT_LESS_THAN((received.rotational_axis()-axis).length(),1e-3f);
+        TS_ASSERT_EQUALS(received.angular_speed(),.75f);
+    }
+    void testOutOfRangeStaysFull( void )
+    {
+        using namespace Sirikata;
+        CompactLocationFormat format(1.0,10.0f,Time::now());
+        Protocol::ObjLoc loc;
+        loc.set_position(Vector3d(1.0e6,0,0));
+        loc.set_velocity(Vector3f(20,0,0));
+        format.compress(loc);
+        TS_ASSERT(loc.has_position());
+        TS_ASSERT(loc.has_velocity());
+        format.expand(loc);
+        TS_ASSERT_EQUALS(loc.position(),Vector3d(1.0e6,0,0));
+        TS_ASSERT_EQUALS(loc.velocity(),Vector3f(20,0,0));
+    }
+};
@@ -0,0 +1,92 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ContentChunkerTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "transfer/ContentChunker.hpp"
+using namespace Sirikata::Transfer;
+class ContentChunkerTest : public CxxTest::TestSuite
+{
+    static std::vector<unsigned char> randomData(size_t length, unsigned int seed) {
+        std::vector<unsigned char> data(length);
+        for (size_t i=0;i<length;++i) {
+            seed = seed*1103515245+12345;
+            data[i]=(unsigned char)(seed>>16);
+        }
+        return data;
+    }
+public:
+    void testChunksCoverData( void )
+    {
+        std::vector<unsigned char> data = randomData(300000,1);
+        ContentChunker chunker;
+        ContentChunker::ChunkList chunks;
+        chunker.split(&data[0],data.size(),chunks);
+        TS_ASSERT(chunks.size()>1);
+        Sirikata::uint64 offset=0;
+        for (size_t i=0;i<chunks.size();++i) {
+            TS_ASSERT_EQUALS(chunks[i].offset,offset);
+            TS_ASSERT(chunks[i].length<=ContentChunker::DEFAULT_MAX_CHUNK_SIZE);
+            if (i+1<chunks.size()) {
+                TS_ASSERT(chunks[i].length>ContentChunker::DEFAULT_MIN_CHUNK_SIZE);
+            }
+            TS_ASSERT_EQUALS(chunks[i].fingerprint,
+                             Sirikata::Transfer::Fingerprint::computeDigest(&data[offset],(size_t)chunks[i].length));
+            offset+=chunks[i].length;
+        }
+        TS_ASSERT_EQUALS(offset,data.size());
+    }
+    void testEditKeepsOtherChunks( void )
+    {
+        std::vector<unsigned char> original = randomData(300000,2);
+        std::vector<unsigned char> edited = original;
+        std::vector<unsigned char> insert = randomData(100,3);
+        edited.insert(edited.begin()+150000,insert.begin(),insert.end());
+
+        ContentChunker chunker;
+        ContentChunker::ChunkList before, after;
+        chunker.split(&original[0],original.size(),before);
+        chunker.split(&edited[0],edited.size(),after);
+
+        std::set<Sirikata::Transfer::Fingerprint> known;
+        for (size_t i=0;i<before.size();++i) {
+            known.insert(before[i].fingerprint);
+        }
+        size_t changedBytes=0;
+        for (size_t i=0;i<after.size();++i) {
+            if (known.find(after[i].fingerprint)==known.end()) {
+                changedBytes+=(size_t)after[i].length;
+            }
+        }
+        TS_ASSERT(changedBytes>=insert.size());
+        TS_ASSERT(changedBytes<=insert.size()+2*ContentChunker::DEFAULT_MAX_CHUNK_SIZE);
+    }
+};
@@ -189,4 +189,31 @@ public:
     void testDeliveryE( void ) {
         deliveryABCDE(4);
     }
+
+    void testManyListeners( void ) {
+        using std::tr1::placeholders::_1;
+        Task::GenEventManager::EventPtr a(new EventA(1));
+        Task::SubscriptionId ids[5];
+        for (int i=0;i<5;++i) {
+            mManager->subscribe(a->getId(),
+                                std::tr1::bind(&EventSystemTestSuite::oneShotTest,this,_1));
+            ids[i]=mManager->subscribeId(a->getId(),
+                                         std::tr1::bind(&EventSystemTestSuite::manyShotTest,this,_1));
+        }
+        mManager->fire(a);
+        mManager->fire(a);
+        mManager->getWorkQueue()->dequeueAll();
+        // one-shot listeners are removed while the list is firing
+        TS_ASSERT_EQUALS(mCount, 15);
+
+        mCount = 0;
+        for (int i=0;i<3;++i) {
+            mManager->unsubscribe(ids[i]);
+        }
+        mManager->fire(a);
+        mManager->getWorkQueue()->dequeueAll();
+        TS_ASSERT_EQUALS(mCount, 2);
+        mManager->unsubscribe(ids[3]);
+        mManager->unsubscribe(ids[4]);
+    }
 };
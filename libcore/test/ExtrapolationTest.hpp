@@ -78,6 +78,45 @@ public:
                                   0));
         delete base;
     }
+    void testPredictAcceleration( void )
+    {
+        using namespace Sirikata;
+        Location start(Vector3d(1,2,3),
+                       Quaternion::identity(),
+                       Vector3f(1,0,0),
+                       Vector3f(0,1,0),
+                       0,
+                       Vector3f(0,-2,.5));
+        assert_near(start.extrapolate(Duration::seconds(2.0)),
+                    Location(Vector3d(3,-2,4),
+                             Quaternion::identity(),
+                             Vector3f(1,-4,1),
+                             Vector3f(0,1,0),
+                             0,
+                             Vector3f(0,-2,.5)));
+    }
+    void testHermiteBlend( void )
+    {
+        using namespace Sirikata;
+        ErrorPredicate ep(Location::Error(3,3));
+        Time now=Time::now();
+        Duration fade=Duration::seconds(1.0);
+        Location still(Vector3d(0,0,0),Quaternion::identity(),Vector3f(0,0,0),Vector3f(0,1,0),0);
+        Location moved(Vector3d(8,0,0),Quaternion::identity(),Vector3f(0,0,0),Vector3f(0,1,0),0);
+        Extrapolator linear(fade,now,still,ep);
+        Extrapolator hermite(fade,now,still,ep);
+        hermite.setBlend(HERMITE_BLEND);
+        TS_ASSERT_EQUALS(hermite.blend(),HERMITE_BLEND);
+        linear.updateValue(now,moved);
+        hermite.updateValue(now,moved);
+        // A quarter of the way in, the eased correction has covered 3s^2-2s^3 of the distance.
+        Time quarter=now+Duration::seconds(.25);
+        assert_near(linear.extrapolate(quarter).getTransform(),Transform(Vector3d(2,0,0),Quaternion::identity()));
+        assert_near(hermite.extrapolate(quarter).getTransform(),Transform(Vector3d(1.25,0,0),Quaternion::identity()));
+        Time half=now+Duration::seconds(.5);
+        assert_near(hermite.extrapolate(half).getTransform(),Transform(Vector3d(4,0,0),Quaternion::identity()));
+        assert_near(hermite.extrapolate(now+fade*2.0).getTransform(),Transform(Vector3d(8,0,0),Quaternion::identity()));
+    }
 
     template <class T>
     bool check_near(T a, T b) {
@@ -128,6 +167,11 @@ public:
                 b.getAxisOfRotation()<<" differ."<<std::endl;
             fail=true;
         }
+        if (!check_near(a.getAcceleration(), b.getAcceleration())) {
+            str << "Accelerations "<<a.getAcceleration()<<" and "<<
+                b.getAcceleration()<<" differ."<<std::endl;
+            fail=true;
+        }
         if (!check_near(a.getAngularSpeed(), b.getAngularSpeed())) {
             str << "Rotation speeds "<<a.getAngularSpeed()<<" and "<<
                 b.getAngularSpeed()<<" differ."<<std::endl;
@@ -0,0 +1,75 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  FiberTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "task/Fiber.hpp"
+using namespace Sirikata;
+class FiberTestSuite : public CxxTest::TestSuite
+{
+    int mSteps;
+    Task::Fiber *mWaiting;
+    void countSteps(int numSteps) {
+        for (int i=0;i<numSteps;++i) {
+            ++mSteps;
+            Task::Fiber::yield();
+        }
+    }
+    void waitOnce() {
+        mWaiting=Task::Fiber::current();
+        Task::Fiber::yield();
+        mSteps+=100;
+    }
+public:
+    void setUp( void ) {
+        mSteps=0;
+        mWaiting=NULL;
+    }
+    void testYieldResume( void ) {
+        Task::Fiber fiber(std::tr1::bind(&FiberTestSuite::countSteps,this,3));
+        TS_ASSERT(Task::Fiber::current()==NULL);
+        int numResumes=0;
+        while (fiber.resume()) {
+            ++numResumes;
+            TS_ASSERT_EQUALS(mSteps,numResumes);
+        }
+        TS_ASSERT_EQUALS(numResumes,3);
+        TS_ASSERT(fiber.finished());
+        TS_ASSERT(Task::Fiber::current()==NULL);
+    }
+    void testStart( void ) {
+        Task::Fiber::start(std::tr1::bind(&FiberTestSuite::waitOnce,this));
+        TS_ASSERT(mWaiting!=NULL);
+        TS_ASSERT_EQUALS(mSteps,0);
+        // deletes itself once the body returns
+        TS_ASSERT(!mWaiting->resume());
+        TS_ASSERT_EQUALS(mSteps,100);
+    }
+};
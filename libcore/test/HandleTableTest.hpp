@@ -0,0 +1,84 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  HandleTableTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/Platform.hpp"
+#include "util/HandleTable.hpp"
+#include "util/UUID.hpp"
+class HandleTableTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::HandleTable<Sirikata::UUID> Table;
+public:
+    void testHandlesAreDenseAndStable( void )
+    {
+        Table table;
+        std::vector<Sirikata::UUID> ids;
+        for (int i=0;i<20;++i) {
+            ids.push_back(Sirikata::UUID::random());
+            TS_ASSERT_EQUALS(table.insert(ids.back()),(Table::Handle)i);
+        }
+        for (int i=0;i<20;++i) {
+            TS_ASSERT_EQUALS(table.insert(ids[i]),(Table::Handle)i);
+            TS_ASSERT_EQUALS(table.find(ids[i]),(Table::Handle)i);
+            TS_ASSERT(table.key(i)==ids[i]);
+        }
+        TS_ASSERT_EQUALS(table.size(),20u);
+        TS_ASSERT_EQUALS(table.find(Sirikata::UUID::random()),Table::npos);
+    }
+    void testErasedHandlesAreReused( void )
+    {
+        Table table;
+        Sirikata::UUID a=Sirikata::UUID::random(),b=Sirikata::UUID::random(),c=Sirikata::UUID::random();
+        table.insert(a);
+        Table::Handle hb=table.insert(b);
+        TS_ASSERT(table.erase(b));
+        TS_ASSERT(!table.valid(hb));
+        TS_ASSERT(!table.erase(hb));
+        TS_ASSERT_EQUALS(table.find(b),Table::npos);
+        TS_ASSERT_EQUALS(table.insert(c),hb);
+        TS_ASSERT_EQUALS(table.capacity(),2u);
+        TS_ASSERT_EQUALS(table.size(),2u);
+    }
+    void testSlotVector( void )
+    {
+        Table table;
+        Sirikata::SlotVector<int> slots;
+        Sirikata::UUID a=Sirikata::UUID::random(),b=Sirikata::UUID::random();
+        slots[table.insert(a)]=1;
+        slots[table.insert(b)]=2;
+        TS_ASSERT_EQUALS(slots.get(table.find(a)),1);
+        TS_ASSERT_EQUALS(slots.get(table.find(b)),2);
+        TS_ASSERT_EQUALS(slots.get(Table::npos),0);
+        slots.reset(table.find(a));
+        TS_ASSERT_EQUALS(slots.get(table.find(a)),0);
+    }
+};
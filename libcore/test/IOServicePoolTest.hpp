@@ -0,0 +1,81 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  IOServicePoolTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "network/IOServicePool.hpp"
+#include "network/IOServiceFactory.hpp"
+#include <boost/thread.hpp>
+using namespace Sirikata;
+class IOServicePoolTest : public CxxTest::TestSuite
+{
+    typedef std::map<Network::IOService*,std::set<boost::thread::id> > ThreadsSeen;
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+    ThreadsSeen mThreads;
+    int mPending;
+    void record(Network::IOService*io) {
+        boost::mutex::scoped_lock lok(mMutex);
+        mThreads[io].insert(boost::this_thread::get_id());
+        if (--mPending==0)
+            mDone.notify_all();
+    }
+public:
+    void testRoundRobin( void )
+    {
+        Network::IOServicePool pool(3);
+        TS_ASSERT_EQUALS(pool.size(),3u);
+        Network::IOService*first=pool.next();
+        Network::IOService*second=pool.next();
+        Network::IOService*third=pool.next();
+        TS_ASSERT(first!=second&&second!=third&&first!=third);
+        TS_ASSERT_EQUALS(pool.next(),first);
+    }
+    void testEachMemberKeepsItsThread( void )
+    {
+        Network::IOServicePool pool(2);
+        pool.run();
+        mPending=20;
+        for (int i=0;i<20;++i) {
+            Network::IOService*io=pool.next();
+            Network::IOServiceFactory::dispatchServiceMessage(io,std::tr1::bind(&IOServicePoolTest::record,this,io));
+        }
+        {
+            boost::mutex::scoped_lock lok(mMutex);
+            while (mPending)
+                mDone.wait(lok);
+        }
+        pool.stop();
+        TS_ASSERT_EQUALS(mThreads.size(),2u);
+        for (ThreadsSeen::iterator i=mThreads.begin();i!=mThreads.end();++i)
+            TS_ASSERT_EQUALS(i->second.size(),1u);
+        TS_ASSERT(*mThreads[pool.get(0)].begin()!=*mThreads[pool.get(1)].begin());
+    }
+};
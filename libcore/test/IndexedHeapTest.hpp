@@ -0,0 +1,110 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  IndexedHeapTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/IndexedHeap.hpp"
+#include <algorithm>
+class IndexedHeapTest : public CxxTest::TestSuite
+{
+    struct Node {
+        int id;
+        size_t heapIndex;
+    };
+    struct NodeIndex {
+        size_t &operator()(Node*node) const {
+            return node->heapIndex;
+        }
+    };
+    typedef Sirikata::IndexedHeap<Node*,float,NodeIndex> Heap;
+public:
+    void testPopsInPriorityOrder( void )
+    {
+        std::vector<Node> nodes(100);
+        Heap heap;
+        for (int i=0;i<100;++i) {
+            nodes[i].id=i;
+            nodes[i].heapIndex=Heap::npos;
+            heap.push(&nodes[i],(float)((i*37)%100));
+        }
+        TS_ASSERT_EQUALS(heap.size(),100u);
+        float last=1000;
+        while (!heap.empty()) {
+            TS_ASSERT(heap.topPriority()<=last);
+            last=heap.topPriority();
+            TS_ASSERT_EQUALS((float)((heap.top()->id*37)%100),last);
+            Node*popped=heap.top();
+            heap.pop();
+            TS_ASSERT_EQUALS(popped->heapIndex,(size_t)Heap::npos);
+        }
+    }
+    void testUpdateAndErase( void )
+    {
+        std::vector<Node> nodes(50);
+        std::vector<float> priority(50);
+        Heap heap;
+        for (int i=0;i<50;++i) {
+            nodes[i].id=i;
+            nodes[i].heapIndex=Heap::npos;
+            priority[i]=(float)i;
+            heap.push(&nodes[i],priority[i]);
+        }
+        for (int i=0;i<50;i+=3) {
+            priority[i]=(float)(100-i);
+            TS_ASSERT(heap.update(&nodes[i],priority[i]));
+        }
+        for (int i=1;i<50;i+=5) {
+            TS_ASSERT(heap.erase(&nodes[i]));
+            TS_ASSERT(!heap.contains(&nodes[i]));
+            TS_ASSERT(!heap.erase(&nodes[i]));
+            TS_ASSERT(!heap.update(&nodes[i],0));
+            priority[i]=-1;
+        }
+        // Pushing a queued item moves it rather than adding it twice.
+        size_t size=heap.size();
+        priority[2]=1000;
+        heap.push(&nodes[2],priority[2]);
+        TS_ASSERT_EQUALS(heap.size(),size);
+        std::vector<float> expected;
+        for (int i=0;i<50;++i) {
+            if (priority[i]>=0)
+                expected.push_back(priority[i]);
+        }
+        std::sort(expected.begin(),expected.end());
+        while (!heap.empty()) {
+            TS_ASSERT_EQUALS(heap.topPriority(),expected.back());
+            TS_ASSERT_EQUALS(priority[heap.top()->id],expected.back());
+            expected.pop_back();
+            heap.pop();
+        }
+        TS_ASSERT(expected.empty());
+    }
+};
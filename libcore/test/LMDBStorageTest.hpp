@@ -0,0 +1,114 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  LMDBStorageTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn and Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include <persistence/ObjectStorage.hpp>
+#include <util/PluginManager.hpp>
+#include <util/DynamicLibrary.hpp>
+#include <persistence/ReadWriteHandlerFactory.hpp>
+#include <persistence/MinitransactionHandlerFactory.hpp>
+#include "ReadWriteHandlerTest.hpp"
+#include "MinitransactionHandlerTest.hpp"
+#include <cstdio>
+
+/** Runs the handler tests on the lmdb plugin.  The plugin is only built
+ *  where LMDB was found, so every test passes trivially without it.
+ */
+class LMDBStorageTest:public CxxTest::TestSuite
+{
+public:
+    static void removeDatabase() {
+        std::remove("testLMDB.db");
+        std::remove("testLMDB.db-lock");
+    }
+    static Sirikata::String databaseArguments(const Sirikata::String&s) {
+        if (s.find("--databasefile")==Sirikata::String::npos)
+            return "--databasefile testLMDB.db"+s;
+        return s;
+    }
+    static Sirikata::Persistence::ReadWriteHandler* createReadWriteHandlerFunction(const Sirikata::String&s){
+        return Sirikata::Persistence::ReadWriteHandlerFactory::getSingleton().getConstructor("lmdb")(databaseArguments(s));
+    }
+    static Sirikata::Persistence::MinitransactionHandler* createMinitransactionHandlerFunction(const Sirikata::String&s){
+        return Sirikata::Persistence::MinitransactionHandlerFactory::getSingleton().getConstructor("lmdb")(databaseArguments(s));
+    }
+    bool mAvailable;
+    LMDBStorageTest() {
+        Sirikata::PluginManager plugins;
+        plugins.load(Sirikata::DynamicLibrary::filename("lmdb"));
+        removeDatabase();
+        Sirikata::Persistence::ReadWriteHandler*probe=createReadWriteHandlerFunction("");
+        mAvailable=(probe!=NULL);
+        delete probe;
+        removeDatabase();
+    }
+    static LMDBStorageTest*createSuite() {
+        return new LMDBStorageTest;
+    }
+    static void destroySuite(LMDBStorageTest*t) {
+        delete t;
+    }
+    void testReadWriteHandlerOrder( void ) {
+        if (mAvailable)
+            test_read_write_handler_order(&LMDBStorageTest::removeDatabase,
+                                          &LMDBStorageTest::createReadWriteHandlerFunction,
+                                          "",
+                                          &LMDBStorageTest::removeDatabase);
+    }
+    void testReadWriteHandlerScan( void ) {
+        if (mAvailable)
+            test_read_write_handler_scan(&LMDBStorageTest::removeDatabase,
+                                         &LMDBStorageTest::createReadWriteHandlerFunction,
+                                         "",
+                                         &LMDBStorageTest::removeDatabase);
+    }
+    void testMinitransactionHandlerOrder( void ) {
+        if (mAvailable)
+            test_minitransaction_handler_order(&LMDBStorageTest::removeDatabase,
+                                               &LMDBStorageTest::createMinitransactionHandlerFunction,
+                                               "",
+                                               &LMDBStorageTest::removeDatabase);
+    }
+    void testMinitransactionHandlerVersions( void ) {
+        if (mAvailable)
+            test_minitransaction_handler_versions(&LMDBStorageTest::removeDatabase,
+                                                  &LMDBStorageTest::createMinitransactionHandlerFunction,
+                                                  "",
+                                                  &LMDBStorageTest::removeDatabase);
+    }
+    void testMinitransactionHandlerOrderGroupCommit( void ) {
+        if (mAvailable)
+            test_minitransaction_handler_order(&LMDBStorageTest::removeDatabase,
+                                               &LMDBStorageTest::createMinitransactionHandlerFunction,
+                                               " --groupcommit 8",
+                                               &LMDBStorageTest::removeDatabase);
+    }
+};
@@ -140,4 +140,34 @@ public:
         TS_ASSERT_EQUALS(d->total,14);
         delete a;delete b;delete c; delete d;
     }
+    class ManyListeners :public Sirikata::Provider<ListenerTestClass*>{
+    public:
+        void notifyAll(int i) {
+            this->notify(&ListenerTestClass::notify,i);
+        }
+    };
+    void testManyListenerAddRemove( void ) {
+        // Crosses both the inline storage and the indexed lookup thresholds on the way up and down.
+        enum {NUM=20};
+        ManyListeners provider;
+        Test listeners[NUM];
+        for (int i=0;i<NUM;++i) {
+            provider.addListener(&listeners[i]);
+        }
+        provider.notifyAll(1);
+        for (int i=0;i<NUM;i+=2) {
+            provider.removeListener(&listeners[i]);
+        }
+        provider.notifyAll(2);
+        for (int i=NUM-1;i>=0;i-=2) {
+            provider.removeListener(&listeners[i]);
+        }
+        provider.notifyAll(4);
+        provider.addListener(&listeners[3]);
+        provider.notifyAll(8);
+        provider.removeListener(&listeners[3]);
+        for (int i=0;i<NUM;++i) {
+            TS_ASSERT_EQUALS(listeners[i].total,i==3?11:(i%2?3:1));
+        }
+    }
 };
@@ -0,0 +1,121 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  LocationTableTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/LocationTable.hpp"
+#include "util/Extrapolation.hpp"
+class LocationTableTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::Vector3d Vector3d;
+    typedef Sirikata::Vector3f Vector3f;
+    typedef Sirikata::Quaternion Quaternion;
+    typedef Sirikata::Location Location;
+    typedef Sirikata::Time Time;
+    typedef Sirikata::Duration Duration;
+    class NeverUpdate {
+    public:
+        bool operator()(const Location&, const Location&) const {
+            return false;
+        }
+    };
+    typedef Sirikata::TimedWeightedExtrapolator<Location,NeverUpdate> LocationExtrapolator;
+    void checkMatches(const Sirikata::LocationTable &table, Sirikata::LocationTable::Slot slot,
+                      const LocationExtrapolator &extrapolator, const Time &when) {
+        Location expected(extrapolator.extrapolate(when));
+        TS_ASSERT(table.isCurrent(slot,when));
+        TS_ASSERT_LESS_THAN((table.position(slot)-expected.getPosition()).length(),1e-6);
+        TS_ASSERT_LESS_THAN(1.0f-std::fabs(table.orientation(slot).dot(expected.getOrientation())),1e-5f);
+    }
+public:
+    void testMatchesExtrapolator( void )
+    {
+        using namespace Sirikata;
+        Time start=Time::now();
+        LocationExtrapolator moving(Duration::seconds(.1),start,
+                                    Location(Vector3d(10,20,30),Quaternion::identity(),Vector3f(1,-2,.5),Vector3f(0,1,0),0),
+                                    NeverUpdate());
+        LocationExtrapolator spinning(Duration::seconds(.1),start,
+                                      Location(Vector3d(-5,0,1e6),Quaternion(Vector3f(1,0,0),.5f),Vector3f(0,0,0),Vector3f(0,0,1),2.0f),
+                                      NeverUpdate());
+        LocationTable table;
+        LocationTable::Slot first=table.allocate();
+        LocationTable::Slot second=table.allocate();
+        TS_ASSERT_DIFFERS(first,second);
+        Time update=start+Duration::seconds(1.0);
+        moving.updateValue(update,Location(Vector3d(12,18,31),Quaternion(Vector3f(0,1,0),1.0f),Vector3f(-3,0,0),Vector3f(1,0,0),1.0f));
+        table.set(first,moving);
+        table.set(second,spinning);
+        TS_ASSERT(!table.isCurrent(first,update));
+
+        // Half way through the fade, then well after it.
+        Time times[2]={update+Duration::seconds(.05),update+Duration::seconds(2.5)};
+        for (int i=0;i<2;++i) {
+            table.extrapolate(times[i]);
+            checkMatches(table,first,moving,times[i]);
+            checkMatches(table,second,spinning,times[i]);
+        }
+        spinning.resetValue(times[1],Location(Vector3d(0,0,0),Quaternion::identity(),Vector3f(0,0,0),Vector3f(0,1,0),0));
+        table.set(second,spinning);
+        TS_ASSERT(table.isCurrent(first,times[1]));
+        TS_ASSERT(!table.isCurrent(second,times[1]));
+    }
+    void testMatchesAcceleratedHermite( void )
+    {
+        using namespace Sirikata;
+        Time start=Time::now();
+        LocationExtrapolator turning(Duration::seconds(.2),start,
+                                     Location(Vector3d(0,0,0),Quaternion::identity(),Vector3f(5,0,0),Vector3f(0,1,0),0,Vector3f(0,0,-3)),
+                                     NeverUpdate());
+        turning.setBlend(HERMITE_BLEND);
+        LocationTable table;
+        LocationTable::Slot slot=table.allocate();
+        Time update=start+Duration::seconds(.5);
+        turning.updateValue(update,Location(Vector3d(2,0,-1),Quaternion::identity(),Vector3f(4,0,-2),Vector3f(0,1,0),0,Vector3f(1,0,-3)));
+        table.set(slot,turning);
+        Time times[3]={update+Duration::seconds(.05),update+Duration::seconds(.15),update+Duration::seconds(1.5)};
+        for (int i=0;i<3;++i) {
+            table.extrapolate(times[i]);
+            checkMatches(table,slot,turning,times[i]);
+        }
+    }
+    void testReuseReleasedSlot( void )
+    {
+        using namespace Sirikata;
+        LocationTable table;
+        LocationTable::Slot first=table.allocate();
+        table.allocate();
+        table.release(first);
+        TS_ASSERT_EQUALS(table.allocate(),first);
+        TS_ASSERT_EQUALS(table.size(),2u);
+        table.extrapolate(Time::now());
+        TS_ASSERT_EQUALS(table.position(first),Vector3d(0,0,0));
+    }
+};
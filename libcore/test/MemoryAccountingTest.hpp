@@ -0,0 +1,77 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  MemoryAccountingTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/Platform.hpp"
+#include "util/MemoryAccounting.hpp"
+class MemoryAccountingTest : public CxxTest::TestSuite
+{
+    struct Tracked : public Sirikata::Memory::Accounted<Sirikata::Memory::PROXY> {
+        virtual ~Tracked() {}
+        char mPadding[100];
+    };
+    struct BiggerTracked : public Tracked {
+        char mMorePadding[300];
+    };
+public:
+    void testContainersAreAccounted( void )
+    {
+        using namespace Sirikata;
+        int64 before=Memory::liveBytes(Memory::NETWORK);
+        {
+            Network::Chunk chunk(1000);
+            TS_ASSERT(Memory::liveBytes(Memory::NETWORK)>=before+1000);
+            Network::Chunk copy(chunk);
+            TS_ASSERT(Memory::liveBytes(Memory::NETWORK)>=before+2000);
+        }
+        TS_ASSERT_EQUALS(Memory::liveBytes(Memory::NETWORK),before);
+    }
+    void testClassesAreAccountedByDynamicSize( void )
+    {
+        using namespace Sirikata;
+        int64 before=Memory::liveBytes(Memory::PROXY);
+        Tracked *tracked=new BiggerTracked;
+        TS_ASSERT_EQUALS(Memory::liveBytes(Memory::PROXY),before+(int64)sizeof(BiggerTracked));
+        delete tracked;
+        TS_ASSERT_EQUALS(Memory::liveBytes(Memory::PROXY),before);
+    }
+    void testAdjust( void )
+    {
+        using namespace Sirikata;
+        int64 before=Memory::liveBytes(Memory::GRAPHICS);
+        Memory::adjust(Memory::GRAPHICS,4096);
+        TS_ASSERT_EQUALS(Memory::liveBytes(Memory::GRAPHICS),before+4096);
+        Memory::adjust(Memory::GRAPHICS,-4096);
+        TS_ASSERT_EQUALS(Memory::liveBytes(Memory::GRAPHICS),before);
+        TS_ASSERT_EQUALS(String(Memory::tagName(Memory::GRAPHICS)),"graphics");
+    }
+};
@@ -0,0 +1,149 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  MetricsTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/Metrics.hpp"
+#include "util/ProfiledMutex.hpp"
+#include <boost/thread.hpp>
+using namespace Sirikata;
+class MetricsTest : public CxxTest::TestSuite
+{
+    static void bump(Metrics::Counter *counter, Metrics::Gauge *gauge, int times) {
+        for (int i=0;i<times;++i) {
+            counter->increment();
+            gauge->add(2);
+            gauge->add(-1);
+        }
+    }
+    static void lockOnce(Metrics::ProfiledMutex<> *mutex) {
+        boost::lock_guard<Metrics::ProfiledMutex<> > lok(*mutex);
+    }
+public:
+    void testCounterAndGaugeAcrossThreads( void )
+    {
+        Metrics::Counter counter("test.counter");
+        Metrics::Gauge gauge("test.gauge");
+        std::vector<boost::thread*> threads;
+        for (int i=0;i<12;++i) {
+            threads.push_back(new boost::thread(std::tr1::bind(&MetricsTest::bump,&counter,&gauge,10000)));
+        }
+        for (size_t i=0;i<threads.size();++i) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        TS_ASSERT_EQUALS(counter.value(),(uint64)120000);
+        TS_ASSERT_EQUALS(gauge.value(),(int64)120000);
+        gauge.set(7);
+        TS_ASSERT_EQUALS(gauge.value(),(int64)7);
+    }
+    void testHistogramBuckets( void )
+    {
+        typedef Metrics::Histogram H;
+        for (uint64 value=0;value<100000;value+=7) {
+            unsigned int bucket=H::bucketOf(value);
+            TS_ASSERT(H::bucketStart(bucket)<=value);
+            TS_ASSERT(value<H::bucketStart(bucket+1));
+            // within 1/16th of the value
+            TS_ASSERT((value-H::bucketStart(bucket))*H::SUB_BUCKETS<=value);
+        }
+        TS_ASSERT_EQUALS(H::bucketOf(15),15u);
+        TS_ASSERT_EQUALS(H::bucketOf(16),16u);
+        TS_ASSERT_EQUALS(H::bucketOf((uint64)1<<50),(unsigned int)H::NUM_BUCKETS-1);
+    }
+    void testHistogramPercentiles( void )
+    {
+        Metrics::Histogram histogram("test.histogram");
+        for (uint64 i=1;i<=1000;++i) {
+            histogram.record(i);
+        }
+        Metrics::Histogram::Snapshot counts=histogram.snapshot();
+        TS_ASSERT_EQUALS(counts.mCount,(uint64)1000);
+        TS_ASSERT_DELTA(counts.mean(),500.5,.001);
+        uint64 median=counts.percentile(.5);
+        TS_ASSERT(median>=500&&median<=500+500/16);
+        uint64 top=counts.max();
+        TS_ASSERT(top>=1000&&top<=1000+1000/16);
+    }
+    void testReport( void )
+    {
+        std::ostringstream text;
+        {
+            Metrics::Counter counter("test.report.counter");
+            counter.add(3);
+            Metrics::report(text);
+        }
+        TS_ASSERT(text.str().find("test.report.counter 3\n")!=std::string::npos);
+        std::ostringstream after;
+        Metrics::report(after);
+        TS_ASSERT(after.str().find("test.report.counter")==std::string::npos);
+    }
+    void testReportPrometheus( void )
+    {
+        Metrics::Counter first("test.prom-counter","two layers of one kind");
+        Metrics::Counter second("test.prom-counter","two layers of one kind");
+        Metrics::Histogram histogram("test.prom.latency_us");
+        first.add(2);
+        second.add(5);
+        histogram.record(10);
+        std::ostringstream text;
+        Metrics::reportPrometheus(text);
+        String exposed=text.str();
+        TS_ASSERT(exposed.find("# HELP sirikata_test_prom_counter_total two layers of one kind\n")!=std::string::npos);
+        TS_ASSERT(exposed.find("# TYPE sirikata_test_prom_counter_total counter\n")!=std::string::npos);
+        TS_ASSERT(exposed.find("sirikata_test_prom_counter_total{instance=\"0\"} 2\n")!=std::string::npos);
+        TS_ASSERT(exposed.find("sirikata_test_prom_counter_total{instance=\"1\"} 5\n")!=std::string::npos);
+        TS_ASSERT(exposed.find("# TYPE sirikata_test_prom_latency_us summary\n")!=std::string::npos);
+        TS_ASSERT(exposed.find("sirikata_test_prom_latency_us{quantile=\"0.5\"} 10\n")!=std::string::npos);
+        TS_ASSERT(exposed.find("sirikata_test_prom_latency_us_count 1\n")!=std::string::npos);
+    }
+    void testProfiledMutex( void )
+    {
+        bool wasEnabled=Metrics::LockProfile::sEnabled;
+        Metrics::LockProfile::sEnabled=true;
+        Metrics::ProfiledMutex<> mutex("test.profiled");
+        lockOnce(&mutex);
+        mutex.lock();
+        boost::thread waiter(std::tr1::bind(&MetricsTest::lockOnce,&mutex));
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+        mutex.unlock();
+        waiter.join();
+        Metrics::LockProfile::sEnabled=false;
+        lockOnce(&mutex);
+        Metrics::LockProfile::sEnabled=wasEnabled;
+        std::ostringstream text;
+        Metrics::report(text);
+        String reported=text.str();
+        TS_ASSERT(reported.find("lock.test.profiled.acquired 3\n")!=std::string::npos);
+        TS_ASSERT(reported.find("lock.test.profiled.contended 1\n")!=std::string::npos);
+        TS_ASSERT(reported.find("lock.test.profiled.wait_us ")!=std::string::npos);
+        TS_ASSERT(reported.find("lock.test.profiled.hold_us ")!=std::string::npos);
+    }
+};
@@ -289,3 +289,61 @@ void test_minitransaction_handler_order(SetupMinitransactionHandlerFunction _set
     copyStorageElement(expected_11.mutable_reads(0),keyvalues()[2]);
     test_minitransaction(fixture.handler, trans_11, Response::SUCCESS, expected_11,11);
 }
+
+static void record_read_version(MinitransactionHandler* mth, Protocol::Response *response, volatile bool* done, uint64* version) {
+    TS_ASSERT_EQUALS( response->reads_size(), 1 );
+    if (response->reads_size()==1) {
+        TS_ASSERT(response->reads(0).has_version());
+        *version=response->reads(0).version();
+    }
+    mth->destroyResponse(response);
+    *done = true;
+}
+
+void test_minitransaction_handler_versions(SetupMinitransactionHandlerFunction _setup, CreateMinitransactionHandlerFunction create_handler,
+                                           Sirikata::String pl, TeardownMinitransactionHandlerFunction _teardown) {
+    MinitransactionHandlerTestFixture fixture(_setup, create_handler, pl, _teardown);
+    using namespace Sirikata::Persistence;
+    using namespace Sirikata::Persistence::Protocol;
+    fill_minitransaction_handler(fixture.handler);
+
+    // read the version of a stored key
+    Minitransaction* trans_1 = fixture.handler->createMinitransaction((Minitransaction*)NULL,1,0,0);
+    copyStorageKey(trans_1->mutable_reads(0),keyvalues()[0]);
+    uint64 version=0;
+    volatile bool done = false;
+    fixture.handler->transact(trans_1, std::tr1::bind(record_read_version, fixture.handler, _1, &done, &version));
+    while( !done )
+        pollMinitransaction();
+
+    // optimistic write conditional on that version
+    Minitransaction* trans_2 = fixture.handler->createMinitransaction((Minitransaction*)NULL,0,1,1);
+    copyStorageKey(trans_2->mutable_compares(0),keyvalues()[0]);
+    trans_2->mutable_compares(0).set_comparator(CompareElement::VERSION);
+    trans_2->mutable_compares(0).set_version(version);
+    copyStorageKey(trans_2->mutable_writes(0),keyvalues()[0]);
+    copyStorageValue(trans_2->mutable_writes(0),keyvalues()[1]);
+    trans_2->set_options(Minitransaction::OPTIMISTIC);
+    StorageSet expected_2;
+    test_minitransaction(fixture.handler, trans_2, Response::SUCCESS, expected_2,2);
+
+    // the write moved the version on, so the same condition fails now
+    Minitransaction* trans_3 = fixture.handler->createMinitransaction((Minitransaction*)NULL,0,1,1);
+    copyStorageKey(trans_3->mutable_compares(0),keyvalues()[0]);
+    trans_3->mutable_compares(0).set_comparator(CompareElement::VERSION);
+    trans_3->mutable_compares(0).set_version(version);
+    copyStorageKey(trans_3->mutable_writes(0),keyvalues()[0]);
+    copyStorageValue(trans_3->mutable_writes(0),keyvalues()[2]);
+    trans_3->set_options(Minitransaction::OPTIMISTIC);
+    StorageSet expected_3;
+    test_minitransaction(fixture.handler, trans_3, Response::COMPARISON_FAILED, expected_3,3);
+
+    // and only the first write happened
+    Minitransaction* trans_4 = fixture.handler->createMinitransaction((Minitransaction*)NULL,1,0,0);
+    copyStorageKey(trans_4->mutable_reads(0),keyvalues()[0]);
+    trans_4->set_options(Minitransaction::OPTIMISTIC);
+    StorageSet expected_4;
+    expected_4.add_reads();
+    copyStorageValue(expected_4.mutable_reads(0),keyvalues()[1]);
+    test_minitransaction(fixture.handler, trans_4, Response::SUCCESS, expected_4,4);
+}
@@ -51,6 +51,16 @@ void test_minitransaction_handler_order(SetupMinitransactionHandlerFunction _set
                                         Sirikata::String pl, TeardownMinitransactionHandlerFunction _teardown);
 
 
+/** Checks version stamps: a VERSION compare against the version a read
+ *  returned succeeds once, and fails after the write it guarded.
+ *  \param _setup function to perform any implementation specific setup
+ *  \param create_handler function for creating the handler
+ *  \param pl parameters to create the handler with
+ *  \param _teardown function to perform any implementation specific teardown
+ */
+void test_minitransaction_handler_versions(SetupMinitransactionHandlerFunction _setup, CreateMinitransactionHandlerFunction create_handler,
+                                           Sirikata::String pl, TeardownMinitransactionHandlerFunction _teardown);
+
 /** Performs a stress test on the MinitransactionHandler.  Submits many Minitransactions
  *  to the MinitransactionHandler at once, stressing the parallelism of the handler.
  *  \param _setup function to perform any implementation specific setup
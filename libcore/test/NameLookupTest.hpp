@@ -46,6 +46,36 @@
 #include <boost/thread/mutex.hpp>
 using namespace Sirikata;
 
+/// Holds every name lookup until the test answers it.
+class HeldNameHandler : public Transfer::NameLookupHandler {
+public:
+	std::vector<std::vector<Transfer::URI> > mBatches;
+	std::vector<std::vector<Callback> > mCallbacks;
+
+	virtual void nameLookup(TransferDataPtr *ptrRef, const Transfer::URI &uri, const Callback &cb) {
+		mBatches.push_back(std::vector<Transfer::URI>(1, uri));
+		mCallbacks.push_back(std::vector<Callback>(1, cb));
+	}
+	virtual unsigned int maxNameBatch(const Transfer::ServiceParams &params) const {
+		return 8;
+	}
+	virtual void batchNameLookup(const Transfer::ServiceParams &params, const std::vector<Transfer::URI> &uris,
+			const std::vector<Callback> &cbs) {
+		mBatches.push_back(uris);
+		mCallbacks.push_back(cbs);
+	}
+	/// Resolves every name whose filename starts with "found" to hash, and fails the rest.
+	void answer(size_t batch, const Transfer::Fingerprint &hash) {
+		std::vector<Callback> cbs (mCallbacks[batch]);
+		for (size_t i = 0; i < cbs.size(); ++i) {
+			if (mBatches[batch][i].filename().find("found") == 0) {
+				cbs[i](hash, "mhash:///" + hash.convertToHexString(), true);
+			} else {
+				cbs[i](Transfer::Fingerprint(), std::string(), false);
+			}
+		}
+	}
+};
 
 class NameLookupTest : public CxxTest::TestSuite
 {
@@ -208,4 +238,90 @@ public:
 
 		waitFor(1);
 	}
+
+	void countLookup(int *count, const RemoteFileId **result, const URI&, const RemoteFileId *rfid) {
+		++*count;
+		*result = rfid;
+	}
+	struct HeldServices {
+		std::tr1::shared_ptr<HeldNameHandler> handler;
+		Transfer::ServiceLookup *services;
+		Transfer::ProtocolRegistry<Transfer::NameLookupHandler> *registry;
+		Transfer::ServiceManager<Transfer::NameLookupHandler> *manager;
+
+		HeldServices() : handler(new HeldNameHandler) {
+			services = new Transfer::CachedServiceLookup();
+			Transfer::ListOfServices *list = new Transfer::ListOfServices;
+			list->push_back(Transfer::ListOfServices::value_type(
+					URIContext("held","names","",""), Transfer::ServiceParams()));
+			services->addToCache(URIContext("held","","",""), Transfer::ListOfServicesPtr(list));
+			registry = new Transfer::ProtocolRegistry<Transfer::NameLookupHandler>;
+			registry->setHandler("held", handler);
+			manager = new Transfer::ServiceManager<Transfer::NameLookupHandler>(services, registry);
+		}
+		~HeldServices() {
+			delete manager;
+			delete registry;
+			delete services;
+		}
+	};
+	void testBatchWhileInFlight() {
+		using std::tr1::placeholders::_1;
+		using std::tr1::placeholders::_2;
+		HeldServices held;
+		Transfer::NameLookupManager lookups(held.manager);
+		Fingerprint hash = Fingerprint::computeDigest("batch");
+		int count = 0;
+		const RemoteFileId *result = NULL;
+		lookups.lookupHash(URI(URIContext(), "held:/found1"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+		lookups.lookupHash(URI(URIContext(), "held:/found2"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+		lookups.lookupHash(URI(URIContext(), "held:/found3"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+		// The first name goes out alone; the others wait for it and then share one request.
+		TS_ASSERT_EQUALS(held.handler->mBatches.size(), 1u);
+		held.handler->answer(0, hash);
+		TS_ASSERT_EQUALS(held.handler->mBatches.size(), 2u);
+		TS_ASSERT_EQUALS(held.handler->mBatches[1].size(), 2u);
+		held.handler->answer(1, hash);
+		TS_ASSERT_EQUALS(count, 3);
+	}
+	void testCacheEntries() {
+		using std::tr1::placeholders::_1;
+		using std::tr1::placeholders::_2;
+		HeldServices held;
+		std::string cacheFile = "NameLookupTest.cache";
+		std::remove(cacheFile.c_str());
+		Fingerprint hash = Fingerprint::computeDigest("cached");
+		int count = 0;
+		const RemoteFileId *result = NULL;
+		{
+			Transfer::CachedNameLookupManager lookups(held.manager, NULL, cacheFile);
+			lookups.lookupHash(URI(URIContext(), "held:/found"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+			held.handler->answer(0, hash);
+			lookups.lookupHash(URI(URIContext(), "held:/missing"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+			held.handler->answer(1, hash);
+			TS_ASSERT(result == NULL);
+			// A name that was not found is not asked for again right away.
+			lookups.lookupHash(URI(URIContext(), "held:/missing"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+			TS_ASSERT_EQUALS(count, 3);
+			TS_ASSERT_EQUALS(held.handler->mBatches.size(), 2u);
+		}
+		{
+			// Entries come back from the cache file.
+			Transfer::CachedNameLookupManager lookups(held.manager, NULL, cacheFile);
+			lookups.lookupHash(URI(URIContext(), "held:/found"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+			TS_ASSERT_EQUALS(count, 4);
+			TS_ASSERT_EQUALS(held.handler->mBatches.size(), 2u);
+		}
+		{
+			// Expired entries are still answered while a refresh runs.
+			Transfer::CachedNameLookupManager lookups(held.manager, NULL, std::string(),
+				Duration::seconds(0.), Duration::seconds(3600.));
+			lookups.addToCache(URI(URIContext(), "held:/found"), RemoteFileId(hash, URIContext("mhash","","","")));
+			lookups.lookupHash(URI(URIContext(), "held:/found"), std::tr1::bind(&NameLookupTest::countLookup, this, &count, &result, _1, _2));
+			TS_ASSERT_EQUALS(count, 5);
+			TS_ASSERT_EQUALS(held.handler->mBatches.size(), 3u);
+			held.handler->answer(2, hash);
+		}
+		std::remove(cacheFile.c_str());
+	}
 };
@@ -77,4 +77,22 @@ public:
         }
         //SILOG(option_test,info,"Logging test");
     }
+    void testOptionHandle( void )
+    {
+        // Bound before the option exists, then follows every parse
+        Sirikata::OptionHandle<int> early("testHandle","count");
+        InitializeGlobalOptions::module("testHandle")
+            .addOption(new OptionValue("count","7",OptionValueTypeInt(),"how many"))
+            .addOption(new OptionValue("name","seven",Sirikata::OptionValueType<Sirikata::String>(),"what to call them"));
+        Sirikata::OptionHandle<Sirikata::String> name(OptionSet::getOptions("testHandle"),"name");
+        const char *defaults[]={"test.exe",NULL};
+        OptionSet::getOptions("testHandle")->parse(1,defaults);
+        TS_ASSERT_EQUALS(early.get(),7);
+        TS_ASSERT_EQUALS(*name,"seven");
+        const char *args[]={"test.exe","--count=9","--name=nine",NULL};
+        OptionSet::getOptions("testHandle")->parse(3,args);
+        TS_ASSERT_EQUALS(*early,9);
+        TS_ASSERT_EQUALS(name.get(),"nine");
+        TS_ASSERT_EQUALS(early.option(),OptionSet::referenceOption("testHandle","count"));
+    }
 };
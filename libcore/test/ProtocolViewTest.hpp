@@ -0,0 +1,112 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ProtocolViewTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/ProtocolView.hpp"
+class ProtocolViewTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::MemoryReference MemoryReference;
+    static std::string str(MemoryReference ref) {
+        return std::string((const char*)ref.data(),ref.size());
+    }
+public:
+    void testProxCall( void )
+    {
+        unsigned char uuidBytes[16];
+        for (int i=0;i<16;++i)
+            uuidBytes[i]=(unsigned char)(i*17+3);
+        Sirikata::UUID object(uuidBytes,16);
+        unsigned char buffer[64];
+        TS_ASSERT_EQUALS(Sirikata::ProxCallView::SerializeToArray(buffer,4,300,object,Sirikata::ProxCallView::ENTERED_PROXIMITY),23u);
+        size_t size=Sirikata::ProxCallView::SerializeToArray(buffer,sizeof(buffer),300,object,Sirikata::ProxCallView::ENTERED_PROXIMITY);
+        TS_ASSERT_EQUALS(size,23u);
+        // query_id=300 as a varint under tag 2, then the uuid under tag 3 and the event under tag 4
+        TS_ASSERT_EQUALS(buffer[0],0x10);
+        TS_ASSERT_EQUALS(buffer[1],0xac);
+        TS_ASSERT_EQUALS(buffer[2],0x02);
+        TS_ASSERT_EQUALS(buffer[3],0x1a);
+        TS_ASSERT_EQUALS(buffer[4],16);
+        TS_ASSERT_EQUALS(buffer[21],0x20);
+        Sirikata::ProxCallView view;
+        TS_ASSERT(view.ParseFromArray(buffer,size));
+        TS_ASSERT_EQUALS(view.query_id(),300u);
+        TS_ASSERT_EQUALS(view.proximate_object(),object);
+        TS_ASSERT_EQUALS(view.proximity_event(),Sirikata::ProxCallView::ENTERED_PROXIMITY);
+        TS_ASSERT(!view.ParseFromArray(buffer,size-3));
+        TS_ASSERT(view.ParseFromArray(buffer,size));
+        TS_ASSERT(!view.has_aggregate());
+    }
+    void testProxCallAggregate( void )
+    {
+        Sirikata::UUID object(Sirikata::UUID::random());
+        unsigned char buffer[64];
+        size_t size=Sirikata::ProxCallView::SerializeToArray(buffer,sizeof(buffer),7,object,Sirikata::ProxCallView::ENTERED_PROXIMITY);
+        const char aggregate[]={0x18,0x05};
+        Sirikata::WireWriter writer(buffer+size,sizeof(buffer)-size);
+        writer.writeBytes(Sirikata::ProxCallView::AGGREGATE_TAG,aggregate,sizeof(aggregate));
+        Sirikata::ProxCallView view;
+        TS_ASSERT(view.ParseFromArray(buffer,size+writer.size()));
+        TS_ASSERT_EQUALS(view.proximate_object(),object);
+        TS_ASSERT(view.has_aggregate());
+        TS_ASSERT_EQUALS(str(view.aggregate()),std::string(aggregate,sizeof(aggregate)));
+    }
+    void testMessageBody( void )
+    {
+        unsigned char buffer[128];
+        Sirikata::MessageBodyView::Writer writer(buffer,sizeof(buffer));
+        std::string loc("LocRequest"), prox("ProxCall"), a("1"), b("22"), c("333");
+        writer.add_message(MemoryReference(loc),MemoryReference(a));
+        writer.add_message(MemoryReference(loc),MemoryReference(b));
+        writer.add_message(MemoryReference(prox),MemoryReference(c));
+        TS_ASSERT(!writer.overflowed());
+        Sirikata::MessageBodyView view;
+        TS_ASSERT(view.ParseFromArray(buffer,writer.size()));
+        TS_ASSERT_EQUALS(view.message_size(),3);
+        TS_ASSERT_EQUALS(str(view.message_names(0)),loc);
+        TS_ASSERT_EQUALS(str(view.message_names(1)),loc);
+        TS_ASSERT_EQUALS(str(view.message_names(2)),prox);
+        TS_ASSERT_EQUALS(str(view.message_arguments(0)),a);
+        TS_ASSERT_EQUALS(str(view.message_arguments(1)),b);
+        TS_ASSERT_EQUALS(str(view.message_arguments(2)),c);
+        // Names are only repeated once a different name follows, as RoutableMessageBody::add_message does
+        Sirikata::WireReader reader(buffer,writer.size());
+        Sirikata::WireReader::Field field;
+        int names=0;
+        while (reader.next(field))
+            if (field.tag==Sirikata::MessageBodyView::MESSAGE_NAMES_TAG)
+                ++names;
+        TS_ASSERT_EQUALS(names,3);
+        Sirikata::MessageBodyView::Writer small(buffer,8);
+        small.add_message(MemoryReference(loc),MemoryReference(a));
+        TS_ASSERT(small.overflowed());
+        TS_ASSERT_EQUALS(small.size(),15u);
+    }
+};
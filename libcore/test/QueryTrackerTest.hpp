@@ -0,0 +1,121 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  QueryTrackerTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/RoutableMessageHeader.hpp"
+#include "util/QueryTracker.hpp"
+#include "util/SentMessage.hpp"
+#include "task/Time.hpp"
+#include "network/IOServiceFactory.hpp"
+
+using namespace Sirikata;
+
+class QueryTrackerTest : public CxxTest::TestSuite
+{
+    int mResponses;
+    int mTimeouts;
+    void countResponse(SentMessage *, const RoutableMessageHeader &hdr, MemoryReference) {
+        if (hdr.return_status() == RoutableMessageHeader::TIMEOUT_FAILURE)
+            ++mTimeouts;
+        else
+            ++mResponses;
+    }
+    SentMessage::QueryCallback counter() {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+        return std::tr1::bind(&QueryTrackerTest::countResponse, this, _1, _2, _3);
+    }
+    void reply(QueryTracker &tracker, int64 id, const ObjectReference &from) {
+        RoutableMessageHeader hdr;
+        hdr.set_reply_id(id);
+        hdr.set_source_object(from);
+        tracker.processMessage(hdr, MemoryReference(NULL,0));
+    }
+public:
+    void setUp() {
+        mResponses = 0;
+        mTimeouts = 0;
+    }
+    void testStaleReplyIsDropped() {
+        QueryTracker tracker(NULL);
+        ObjectReference peer(UUID::random());
+        SentMessage *first = new SentMessage(&tracker, counter());
+        int64 firstId = first->getId();
+        delete first;
+        // reuses the slot under a new generation
+        SentMessage *second = new SentMessage(&tracker, counter());
+        second->header().set_destination_object(peer);
+        TS_ASSERT(second->getId() != firstId);
+        reply(tracker, firstId, peer);
+        TS_ASSERT_EQUALS(mResponses, 0);
+        int64 secondId = second->getId();
+        reply(tracker, secondId, peer);
+        TS_ASSERT_EQUALS(mResponses, 1);
+        delete second;
+        reply(tracker, secondId, peer);
+        TS_ASSERT_EQUALS(mResponses, 1);
+    }
+    void testCallerChosenId() {
+        QueryTracker tracker(NULL);
+        ObjectReference peer(UUID::random());
+        SentMessage *msg = new SentMessage(12345, &tracker, counter());
+        msg->header().set_destination_object(peer);
+        reply(tracker, 12345, peer);
+        TS_ASSERT_EQUALS(mResponses, 1);
+        delete msg;
+        reply(tracker, 12345, peer);
+        TS_ASSERT_EQUALS(mResponses, 1);
+    }
+    void testTimeoutWheel() {
+        Network::IOService *io = Network::IOServiceFactory::makeIOService();
+        {
+            QueryTracker tracker(io);
+            SentMessage quick(&tracker, counter());
+            SentMessage slow(&tracker, counter());
+            SentMessage cancelled(&tracker, counter());
+            quick.setTimeout(Duration::milliseconds((int64)20));
+            // more than one turn of the wheel
+            slow.setTimeout(Duration::milliseconds((int64)(QueryTracker::TIMEOUT_WHEEL_SLOTS*QueryTracker::TIMEOUT_TICK_MILLISECONDS+50)));
+            cancelled.setTimeout(Duration::milliseconds((int64)30));
+            cancelled.unsetTimeout();
+            TS_ASSERT_EQUALS(tracker.numPendingTimeouts(), 2u);
+            Task::AbsTime start = Task::AbsTime::now();
+            // the io service runs out of work once the wheel is empty
+            Network::IOServiceFactory::runService(io);
+            TS_ASSERT_EQUALS(mTimeouts, 2);
+            TS_ASSERT_EQUALS(tracker.numPendingTimeouts(), 0u);
+            TS_ASSERT((Task::AbsTime::now() - start).toMilliseconds() >= QueryTracker::TIMEOUT_WHEEL_SLOTS*QueryTracker::TIMEOUT_TICK_MILLISECONDS);
+        }
+        Network::IOServiceFactory::destroyIOService(io);
+    }
+};
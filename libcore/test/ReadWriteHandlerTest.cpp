@@ -197,6 +197,56 @@ void stress_test_read_write_handler(SetupReadWriteHandlerFunction _setup, Create
 }
 
 
+static void check_scan_results(ReadWriteHandler* rwh, Protocol::Response *response, volatile bool* done, const UUID& object, int index) {
+    TS_ASSERT(!response->has_return_status() || response->return_status() == Protocol::Response::SUCCESS);
+    std::map<uint64,String> expected;
+    for(int i = 0; i < OBJECT_STORAGE_GENERATED_PAIRS; i++) {
+        if (keyvalues()[i].object_uuid() == object)
+            expected[keyvalues()[i].field_id()] = keyvalues()[i].data();
+    }
+    TS_ASSERT_EQUALS( response->reads_size(), (int)expected.size() );
+    for (int i = 0; i < response->reads_size(); ++i) {
+        TS_ASSERT( response->reads(i).object_uuid() == object );
+        TS_ASSERT_EQUALS( response->reads(i).index(), index );
+        std::map<uint64,String>::iterator where = expected.find(response->reads(i).field_id());
+        TS_ASSERT( where != expected.end() );
+        if (where != expected.end()) {
+            TS_ASSERT_EQUALS( response->reads(i).data(), where->second );
+            expected.erase(where);
+        }
+    }
+    rwh->destroyResponse(response);
+    *done = true;
+}
+
+void test_read_write_handler_scan(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
+                                  String pl, TeardownReadWriteHandlerFunction _teardown) {
+    ReadWriteHandlerTestFixture fixture(_setup, create_handler, pl, _teardown);
+    using namespace Sirikata::Persistence::Protocol;
+    fill_read_write_handler(fixture.handler);
+    const StorageElement& first = keyvalues()[0];
+
+    // every field of one object
+    ReadWriteSet* by_object = fixture.handler->createReadWriteSet((ReadWriteSet*)NULL,0,0);
+    by_object->add_scans();
+    by_object->mutable_scans(0).set_object_uuid(first.object_uuid());
+    by_object->mutable_scans(0).set_index(3);
+    volatile bool done = false;
+    fixture.handler->apply(by_object, std::tr1::bind(check_scan_results, fixture.handler, _1, &done, first.object_uuid(), 3));
+    while(!done)
+        pollReadWrite();
+
+    // the generated field names are unique to their object, so a prefix scan over all objects finds the same fields
+    ReadWriteSet* by_prefix = fixture.handler->createReadWriteSet((ReadWriteSet*)NULL,0,0);
+    by_prefix->add_scans();
+    by_prefix->mutable_scans(0).set_field_name(first.field_name().substr(0,2));
+    by_prefix->mutable_scans(0).set_index(5);
+    done = false;
+    fixture.handler->apply(by_prefix, std::tr1::bind(check_scan_results, fixture.handler, _1, &done, first.object_uuid(), 5));
+    while(!done)
+        pollReadWrite();
+}
+
 void test_read_write_handler_order(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
                                    String pl, TeardownReadWriteHandlerFunction _teardown) {
     ReadWriteHandlerTestFixture fixture(_setup, create_handler, pl, _teardown);
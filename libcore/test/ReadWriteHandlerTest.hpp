@@ -55,6 +55,17 @@ void test_read_write_handler_order(SetupReadWriteHandlerFunction _setup, CreateR
                                    Sirikata::String pl, TeardownReadWriteHandlerFunction _teardown);
 
 
+/** Checks the scans of a ReadWriteHandler: after filling it with the generated
+ *  pairs, scanning one object, by uuid or by field name prefix, must return
+ *  exactly the pairs stored for it.
+ *  \param _setup function to perform any implementation specific setup
+ *  \param create_handler function for creating the handler
+ *  \param pl parameters to create the handler with
+ *  \param _teardown function to perform any implementation specific teardown
+ */
+void test_read_write_handler_scan(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
+                                  Sirikata::String pl, TeardownReadWriteHandlerFunction _teardown);
+
 /** Performs a stress test on the ReadWriteHandler.  Submits many ReadWriteSets
  *  to the ReadWriteHandler at once, stressing the parallelism of the handler.
  *  \param _setup function to perform any implementation specific setup
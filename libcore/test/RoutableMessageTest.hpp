@@ -31,6 +31,11 @@
  */
 
 #include "util/RoutableMessageHeader.hpp"
+#include "util/RoutableMessageHeaderView.hpp"
+#include "util/MessageTrace.hpp"
+#include "Test_Sirikata.pbj.hpp"
+#include "util/RoutableMessageBody.hpp"
+#include "util/MessagePool.hpp"
 #include "util/SpaceObjectReference.hpp"
 
 using namespace Sirikata;
@@ -56,4 +61,108 @@ public:
         TS_ASSERT_EQUALS(TEST_SOURCE_PORT, headerOut.source_port());
         TS_ASSERT_EQUALS(TEST_DESTINATION_PORT, headerOut.destination_port());
     }
+    void testHeaderView() {
+        RoutableMessageHeader header;
+        ObjectReference sourceID(UUID::random());
+        ObjectReference destinationID(UUID::random());
+        header.set_source_object(sourceID);
+        header.set_destination_object(destinationID);
+        header.set_source_port(1000000);
+        header.set_destination_port(100);
+        header.set_id(12345678901ll);
+        String message;
+        header.SerializeToString(&message);
+        message+="body";
+
+        RoutableMessageHeaderView view;
+        MemoryReference body=view.ParseFromArray(message.data(),message.size());
+        TS_ASSERT_EQUALS(String((const char*)body.data(),body.size()), "body");
+        TS_ASSERT_EQUALS(sourceID, view.source_object());
+        TS_ASSERT_EQUALS(destinationID, view.destination_object());
+        TS_ASSERT_EQUALS(1000000u, view.source_port());
+        TS_ASSERT_EQUALS(100u, view.destination_port());
+        TS_ASSERT_EQUALS(12345678901ll, view.id());
+        TS_ASSERT(!view.has_reply_id());
+
+        char unchanged[64];
+        size_t unchangedSize=view.SerializeToArray(unchanged,sizeof(unchanged));
+        TS_ASSERT_EQUALS(String(unchanged,unchangedSize), message.substr(0,message.size()-4));
+
+        // the view's edits serialize the same as the full header's
+        view.swap_source_and_destination();
+        view.clear_destination_object();
+        header.swap_source_and_destination();
+        header.clear_destination_object();
+        String expected;
+        header.SerializeToString(&expected);
+        char swapped[64];
+        size_t swappedSize=view.SerializeToArray(swapped,sizeof(swapped));
+        TS_ASSERT_EQUALS(String(swapped,swappedSize), expected);
+        TS_ASSERT_EQUALS(view.ByteSize(), expected.size());
+        TS_ASSERT_EQUALS(view.SerializeToArray(swapped,expected.size()-1), 0u);
+    }
+    void testTraceContext() {
+        RoutableMessageHeader header;
+        header.set_destination_object(ObjectReference(UUID::random()));
+        header.set_destination_port(100);
+        header.mutable_trace_context();
+        MessageTrace::stamp(header,MessageTrace::OBJECT_SEND);
+        String message;
+        header.SerializeToString(&message);
+        message+="body";
+
+        // the space stamps the view in place and passes it on
+        RoutableMessageHeaderView view;
+        MemoryReference body=view.ParseFromArray(message.data(),message.size());
+        TS_ASSERT_EQUALS(String((const char*)body.data(),body.size()), "body");
+        TS_ASSERT(view.has_trace_context());
+        MessageTrace::stamp(view,MessageTrace::SPACE_RECEIVE);
+        String forwarded;
+        forwarded.resize(view.ByteSize());
+        TS_ASSERT_EQUALS(view.SerializeToArray(&forwarded[0],forwarded.size()), forwarded.size());
+
+        RoutableMessageHeader received;
+        received.ParseFromString(forwarded);
+        TS_ASSERT_EQUALS(received.destination_port(), 100u);
+        std::vector<std::pair<MessageTrace::Hop,uint64> > hops;
+        TS_ASSERT(MessageTrace::parse(received.trace_context(),hops));
+        TS_ASSERT_EQUALS(hops.size(), 2u);
+        if (hops.size()==2) {
+            TS_ASSERT_EQUALS(hops[0].first, MessageTrace::OBJECT_SEND);
+            TS_ASSERT_EQUALS(hops[1].first, MessageTrace::SPACE_RECEIVE);
+            TS_ASSERT(hops[1].second>=hops[0].second);
+        }
+
+        // untraced messages stay untraced, and replies start over
+        RoutableMessageHeader untraced;
+        MessageTrace::stamp(untraced,MessageTrace::SPACE_SEND);
+        TS_ASSERT(!untraced.has_trace_context());
+        received.swap_source_and_destination();
+        TS_ASSERT(!received.has_trace_context());
+    }
+    void testBodyPool() {
+        RoutableMessageBody body;
+        body.add_message("First","one");
+        body.add_message("Second","two");
+        String serialized;
+        body.SerializeToString(&serialized);
+
+        MessagePool<RoutableMessageBody> pool;
+        RoutableMessageBody*first=pool.acquire();
+        first->ParseFromString(serialized);
+        TS_ASSERT_EQUALS(first->message_size(), 2);
+        TS_ASSERT_EQUALS(first->message_names(1), "Second");
+        pool.release(first);
+        {
+            // the same thread gets the released body back, emptied
+            MessagePool<RoutableMessageBody>::Handle second(pool);
+            TS_ASSERT_EQUALS(&*second, first);
+            TS_ASSERT_EQUALS(second->message_size(), 0);
+            second->ParseFromString(serialized);
+            TS_ASSERT_EQUALS(second->message_arguments(0), "one");
+        }
+        MessagePool<RoutableMessageBody>::Handle third(pool);
+        TS_ASSERT_EQUALS(&*third, first);
+        TS_ASSERT_EQUALS(third->message_size(), 0);
+    }
 };
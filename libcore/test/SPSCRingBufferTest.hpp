@@ -0,0 +1,130 @@
+/*  Sirikata Tests -- Sirikata Testing Framework
+ *  SPSCRingBufferTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/SPSCRingBuffer.hpp"
+#include <boost/thread.hpp>
+using namespace Sirikata;
+class SPSCRingBufferTest : public CxxTest::TestSuite
+{
+    enum {NUM_THREADED_VALUES=200000};
+    static void produce(SPSCRingBuffer<int>*buffer) {
+        int batch[7];
+        int next=1;
+        while (next<=NUM_THREADED_VALUES) {
+            if (next%3) {
+                buffer->push(next++);
+            }else {
+                int count=0;
+                while (count<7&&next<=NUM_THREADED_VALUES) {
+                    batch[count++]=next++;
+                }
+                buffer->pushBatch(batch,count);
+            }
+        }
+    }
+public:
+    void testWrapAround( void ) {
+        SPSCRingBuffer<int> buffer(5);
+        TS_ASSERT_EQUALS(buffer.capacity(),8u);
+        TS_ASSERT(buffer.probablyEmpty());
+        int value=0;
+        TS_ASSERT(!buffer.pop(value));
+        for (int round=0;round<10;++round) {
+            for (int i=0;i<8;++i) {
+                TS_ASSERT(buffer.tryPush(round*8+i));
+            }
+            TS_ASSERT(!buffer.tryPush(-1));
+            for (int i=0;i<8;++i) {
+                TS_ASSERT(buffer.pop(value));
+                TS_ASSERT_EQUALS(value,round*8+i);
+            }
+            TS_ASSERT(buffer.probablyEmpty());
+        }
+    }
+    void testBatches( void ) {
+        SPSCRingBuffer<int> buffer(16);
+        int values[10]={0,1,2,3,4,5,6,7,8,9};
+        int results[16];
+        buffer.pushBatch(values,10);
+        TS_ASSERT_EQUALS(buffer.popUpTo(results,4),4u);
+        buffer.pushBatch(values,10);
+        TS_ASSERT_EQUALS(buffer.popUpTo(results,16),16u);
+        TS_ASSERT_EQUALS(results[0],4);
+        TS_ASSERT_EQUALS(results[5],9);
+        TS_ASSERT_EQUALS(results[6],0);
+        TS_ASSERT_EQUALS(results[15],9);
+        TS_ASSERT_EQUALS(buffer.popUpTo(results,16),0u);
+    }
+    void testNodeIterator( void ) {
+        SPSCRingBuffer<int> buffer(8);
+        for (int i=0;i<5;++i) {
+            buffer.push(i);
+        }
+        int expected=0;
+        {
+            SPSCRingBuffer<int>::NodeIterator iter(buffer);
+            buffer.push(5);
+            int *value;
+            while ((value=iter.next())!=NULL) {
+                TS_ASSERT_EQUALS(*value,expected++);
+            }
+        }
+        TS_ASSERT_EQUALS(expected,5);
+        int value=0;
+        TS_ASSERT(buffer.pop(value));
+        TS_ASSERT_EQUALS(value,5);
+    }
+    void testThreadedOrder( void ) {
+        // small enough that both sides regularly sleep on a full or empty buffer
+        SPSCRingBuffer<int> buffer(64);
+        boost::thread producer(std::tr1::bind(&SPSCRingBufferTest::produce,&buffer));
+        int expected=1;
+        int results[10];
+        while (expected<=NUM_THREADED_VALUES) {
+            int value;
+            if (expected%2) {
+                buffer.blockingPop(value);
+                TS_ASSERT_EQUALS(value,expected);
+                if (value!=expected) break;
+                ++expected;
+            }else {
+                size_t count=buffer.popUpTo(results,10);
+                for (size_t i=0;i<count;++i) {
+                    TS_ASSERT_EQUALS(results[i],expected);
+                    ++expected;
+                }
+            }
+        }
+        producer.join();
+        TS_ASSERT(buffer.probablyEmpty());
+    }
+};
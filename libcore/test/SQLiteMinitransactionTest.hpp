@@ -73,6 +73,18 @@ public:
                                            "",
                                            &MinitransactionTestNs::teardownMinitransactionalHandler);
     }
+    void testMinitransactionHandlerOrderGroupCommit( void ) {
+        test_minitransaction_handler_order(&MinitransactionTestNs::setupMinitransactionalHandler,
+                                           &SQLiteMinitransactionTest::createMinitransactionalHandlerFunction,
+                                           " --groupcommit 8",
+                                           &MinitransactionTestNs::teardownMinitransactionalHandler);
+    }
+    void testMinitransactionHandlerVersions( void ) {
+        test_minitransaction_handler_versions(&MinitransactionTestNs::setupMinitransactionalHandler,
+                                              &SQLiteMinitransactionTest::createMinitransactionalHandlerFunction,
+                                              "",
+                                              &MinitransactionTestNs::teardownMinitransactionalHandler);
+    }
 
     void xestStressMinitransactionHandlerOrder( void ) {
         stress_test_minitransaction_handler(&MinitransactionTestNs::setupMinitransactionalHandler,
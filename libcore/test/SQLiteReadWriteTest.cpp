@@ -43,4 +43,15 @@ void teardownReadWritealHandler(){
         boost::filesystem::remove( boost::filesystem::path(databaseReadWriteFilename)) ;
 
 }
+const char *databaseReplicaFilename="testReadWriteReplica.db";
+void setupReplicatedReadWriteHandler(){
+    setupReadWritealHandler();
+    if (boost::filesystem::exists( boost::filesystem::path(databaseReplicaFilename) ))
+        boost::filesystem::remove( boost::filesystem::path(databaseReplicaFilename)) ;
+}
+void teardownReplicatedReadWriteHandler(){
+    teardownReadWritealHandler();
+    if (boost::filesystem::exists( boost::filesystem::path(databaseReplicaFilename) ))
+        boost::filesystem::remove( boost::filesystem::path(databaseReplicaFilename)) ;
+}
 }
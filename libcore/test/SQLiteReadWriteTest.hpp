@@ -39,6 +39,9 @@ namespace ReadWriteTestNs {
 extern const char *databaseReadWriteFilename;
 void setupReadWritealHandler();
 void teardownReadWritealHandler();
+extern const char *databaseReplicaFilename;
+void setupReplicatedReadWriteHandler();
+void teardownReplicatedReadWriteHandler();
 }
 
 class SQLiteReadWriteTest:public CxxTest::TestSuite
@@ -51,6 +54,15 @@ public:
         }
         return Sirikata::Persistence::ReadWriteHandlerFactory::getSingleton().getConstructor("sqlite")(arg);
     }
+    static Sirikata::Persistence::ReadWriteHandler* createCachedReadWriteHandlerFunction(const Sirikata::String&s){
+        Sirikata::String arg="--backendoptions=\"--databasefile "+Sirikata::String(ReadWriteTestNs::databaseReadWriteFilename)+"\""+s;
+        return Sirikata::Persistence::ReadWriteHandlerFactory::getSingleton().getConstructor("sqlitecache")(arg);
+    }
+    static Sirikata::Persistence::ReadWriteHandler* createReplicatedReadWriteHandlerFunction(const Sirikata::String&s){
+        Sirikata::String arg="--primaryoptions=\"--databasefile "+Sirikata::String(ReadWriteTestNs::databaseReadWriteFilename)+"\""
+            " --replicaoptions=\"--databasefile "+Sirikata::String(ReadWriteTestNs::databaseReplicaFilename)+"\""+s;
+        return Sirikata::Persistence::ReadWriteHandlerFactory::getSingleton().getConstructor("sqlitereplicated")(arg);
+    }
     Sirikata::Persistence::ReadWriteHandler*mDatabase;
     SQLiteReadWriteTest() {
         Sirikata::PluginManager plugins;
@@ -73,6 +85,42 @@ public:
                                            "",
                                            &ReadWriteTestNs::teardownReadWritealHandler);
     }
+    void testReadWriteHandlerOrderGroupCommit( void ) {
+        test_read_write_handler_order(&ReadWriteTestNs::setupReadWritealHandler,
+                                           &SQLiteReadWriteTest::createReadWritealHandlerFunction,
+                                           " --groupcommit 8",
+                                           &ReadWriteTestNs::teardownReadWritealHandler);
+    }
+    void testReadWriteHandlerScan( void ) {
+        test_read_write_handler_scan(&ReadWriteTestNs::setupReadWritealHandler,
+                                          &SQLiteReadWriteTest::createReadWritealHandlerFunction,
+                                          "",
+                                          &ReadWriteTestNs::teardownReadWritealHandler);
+    }
+    void testCachedReadWriteHandlerScan( void ) {
+        test_read_write_handler_scan(&ReadWriteTestNs::setupReadWritealHandler,
+                                          &SQLiteReadWriteTest::createCachedReadWriteHandlerFunction,
+                                          "",
+                                          &ReadWriteTestNs::teardownReadWritealHandler);
+    }
+    void testCachedReadWriteHandlerOrder( void ) {
+        test_read_write_handler_order(&ReadWriteTestNs::setupReadWritealHandler,
+                                           &SQLiteReadWriteTest::createCachedReadWriteHandlerFunction,
+                                           " --cachesize 4096",
+                                           &ReadWriteTestNs::teardownReadWritealHandler);
+    }
+    void testReplicatedReadWriteHandlerOrder( void ) {
+        test_read_write_handler_order(&ReadWriteTestNs::setupReplicatedReadWriteHandler,
+                                           &SQLiteReadWriteTest::createReplicatedReadWriteHandlerFunction,
+                                           "",
+                                           &ReadWriteTestNs::teardownReplicatedReadWriteHandler);
+    }
+    void testReplicatedReadWriteHandlerScan( void ) {
+        test_read_write_handler_scan(&ReadWriteTestNs::setupReplicatedReadWriteHandler,
+                                          &SQLiteReadWriteTest::createReplicatedReadWriteHandlerFunction,
+                                          "",
+                                          &ReadWriteTestNs::teardownReplicatedReadWriteHandler);
+    }
 
     void xestStressReadWriteHandlerOrder( void ) {
         stress_test_read_write_handler(&ReadWriteTestNs::setupReadWritealHandler,
@@ -0,0 +1,90 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SQLiteShardedTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include <persistence/ObjectStorage.hpp>
+#include <util/PluginManager.hpp>
+#include <util/DynamicLibrary.hpp>
+#include <persistence/MinitransactionHandlerFactory.hpp>
+#include <persistence/ReadWriteHandlerFactory.hpp>
+#include "MinitransactionHandlerTest.hpp"
+#include "ReadWriteHandlerTest.hpp"
+namespace ShardedTestNs {
+extern const char *databaseShardedFilename;
+void setupShardedHandler();
+void teardownShardedHandler();
+}
+
+class SQLiteShardedTest:public CxxTest::TestSuite
+{
+public:
+    static Sirikata::String shardedArguments(const Sirikata::String&s) {
+        Sirikata::String arg=s;
+        if (arg.find("--databasefile")==Sirikata::String::npos) {
+            arg="--databasefile "+Sirikata::String(ShardedTestNs::databaseShardedFilename)+arg;
+        }
+        return arg;
+    }
+    static Sirikata::Persistence::MinitransactionHandler* createMinitransactionalHandlerFunction(const Sirikata::String&s){
+        return Sirikata::Persistence::MinitransactionHandlerFactory::getSingleton().getConstructor("sqlitesharded")(shardedArguments(s));
+    }
+    static Sirikata::Persistence::ReadWriteHandler* createReadWritealHandlerFunction(const Sirikata::String&s){
+        return Sirikata::Persistence::ReadWriteHandlerFactory::getSingleton().getConstructor("sqlitesharded")(shardedArguments(s));
+    }
+    Sirikata::PluginManager mPlugins;
+    SQLiteShardedTest() {
+        mPlugins.load(Sirikata::DynamicLibrary::filename("sqlite"));
+    }
+    static SQLiteShardedTest*createSuite() {
+        return new SQLiteShardedTest;
+    }
+    static void destroySuite(SQLiteShardedTest*mt) {
+        delete mt;
+    }
+    void testShardedMinitransactionHandlerOrder( void ) {
+        test_minitransaction_handler_order(&ShardedTestNs::setupShardedHandler,
+                                           &SQLiteShardedTest::createMinitransactionalHandlerFunction,
+                                           " --shards 3",
+                                           &ShardedTestNs::teardownShardedHandler);
+    }
+    void testShardedReadWriteHandlerOrder( void ) {
+        test_read_write_handler_order(&ShardedTestNs::setupShardedHandler,
+                                      &SQLiteShardedTest::createReadWritealHandlerFunction,
+                                      " --shards 3",
+                                      &ShardedTestNs::teardownShardedHandler);
+    }
+    void testShardedReadWriteHandlerScan( void ) {
+        test_read_write_handler_scan(&ShardedTestNs::setupShardedHandler,
+                                     &SQLiteShardedTest::createReadWritealHandlerFunction,
+                                     " --shards 3",
+                                     &ShardedTestNs::teardownShardedHandler);
+    }
+};
@@ -0,0 +1,122 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  ServiceLookupTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "transfer/CachedServiceLookup.hpp"
+
+using namespace Sirikata;
+
+class ServiceLookupTest : public CxxTest::TestSuite {
+	typedef Transfer::URIContext URIContext;
+
+	Transfer::CachedServiceLookup *mLookup;
+	Transfer::ServiceIterator *mIter;
+
+	void gotIterator(Transfer::ServiceIterator *iter) {
+		mIter = iter;
+	}
+
+	/// The service the next lookup tries first.
+	std::string first() {
+		mIter = NULL;
+		mLookup->lookupService(URIContext("mhash","","",""),
+			std::tr1::bind(&ServiceLookupTest::gotIterator, this, _1));
+		TS_ASSERT(mIter);
+		Transfer::URI uri;
+		Transfer::ServiceParams params;
+		TS_ASSERT(mIter->tryNext(Transfer::ServiceIterator::SUCCESS, uri, params));
+		delete mIter;
+		return uri.host();
+	}
+
+	URIContext mirror(const std::string &host) {
+		return URIContext("http", host, "", "files");
+	}
+public:
+	void setUp() {
+		mLookup = new Transfer::CachedServiceLookup;
+		Transfer::ListOfServicesPtr services(new Transfer::ListOfServices);
+		services->push_back(Transfer::ListOfServices::value_type(mirror("a"), Transfer::ServiceParams()));
+		services->push_back(Transfer::ListOfServices::value_type(mirror("b"), Transfer::ServiceParams()));
+		services->push_back(Transfer::ListOfServices::value_type(mirror("c"), Transfer::ServiceParams()));
+		mLookup->addToCache(URIContext("mhash","","",""), services);
+	}
+	void tearDown() {
+		delete mLookup;
+	}
+
+	void testConfiguredOrderUntilMeasured() {
+		TS_ASSERT_EQUALS(first(), "a");
+	}
+
+	void testFastestFirst() {
+		mLookup->recordResult(mirror("a"), true, 0.5, 1000);
+		mLookup->recordResult(mirror("b"), true, 0.05, 1000);
+		mLookup->recordResult(mirror("c"), true, 0.2, 1000);
+		TS_ASSERT_EQUALS(first(), "b");
+		// Throughput counts too: b is quick to answer but slow to send.
+		mLookup->recordResult(mirror("b"), true, 10., 1024*1024);
+		mLookup->recordResult(mirror("c"), true, 0.5, 1024*1024);
+		TS_ASSERT_EQUALS(first(), "c");
+	}
+
+	void testFailingServiceSkipped() {
+		mLookup->recordResult(mirror("a"), true, 0.01, 1000);
+		mLookup->recordResult(mirror("b"), true, 1., 1000);
+		mLookup->recordResult(mirror("c"), true, 1., 1000);
+		TS_ASSERT_EQUALS(first(), "a");
+		mLookup->recordResult(mirror("a"), false, 0.01, 0);
+		mLookup->recordResult(mirror("a"), false, 0.01, 0);
+		mLookup->recordResult(mirror("a"), false, 0.01, 0);
+		TS_ASSERT_EQUALS(first(), "b");
+	}
+
+	void testIteratorReports() {
+		mLookup->recordResult(mirror("a"), true, 0.01, 1000);
+		mLookup->recordResult(mirror("b"), true, 1., 1000);
+		mLookup->recordResult(mirror("c"), true, 2., 1000);
+		Transfer::URI uri;
+		Transfer::ServiceParams params;
+		// a fails every time, and b answers instead.
+		for (int round = 0; round < 3; ++round) {
+			mIter = NULL;
+			mLookup->lookupService(URIContext("mhash","","",""),
+				std::tr1::bind(&ServiceLookupTest::gotIterator, this, _1));
+			TS_ASSERT(mIter->tryNext(Transfer::ServiceIterator::SUCCESS, uri, params));
+			TS_ASSERT_EQUALS(uri.host(), "a");
+			TS_ASSERT(mIter->tryNext(Transfer::ServiceIterator::GENERAL_ERROR, uri, params));
+			TS_ASSERT_EQUALS(uri.host(), "b");
+			mIter->finished(Transfer::ServiceIterator::SUCCESS, 1000);
+		}
+		TS_ASSERT_EQUALS(first(), "b");
+	}
+};
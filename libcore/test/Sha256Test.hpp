@@ -0,0 +1,66 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  Sha256Test.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/Sha256.hpp"
+class Sha256Test : public CxxTest::TestSuite
+{
+public:
+    void testKnownDigest( void )
+    {
+        TS_ASSERT_EQUALS(Sirikata::SHA256::computeDigest("abc").convertToHexString(),
+                         "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        Sirikata::SHA256Context context;
+        context.update("a");
+        context.update("bc");
+        TS_ASSERT_EQUALS(context.get(),Sirikata::SHA256::computeDigest("abc"));
+    }
+    void testParallelDigests( void )
+    {
+        std::vector<std::string> buffers;
+        for (int i=0;i<37;++i) {
+            buffers.push_back(std::string(i*257,(char)i));
+        }
+        std::vector<Sirikata::MemoryReference> refs;
+        for (size_t i=0;i<buffers.size();++i) {
+            refs.push_back(Sirikata::MemoryReference(buffers[i]));
+        }
+        std::vector<Sirikata::SHA256> digests(buffers.size());
+        Sirikata::SHA256::computeDigests(refs,&digests[0],4);
+        for (size_t i=0;i<buffers.size();++i) {
+            TS_ASSERT_EQUALS(digests[i],Sirikata::SHA256::computeDigest(buffers[i]));
+        }
+        std::vector<Sirikata::SHA256> serial(buffers.size());
+        Sirikata::SHA256::computeDigests(refs,&serial[0],1);
+        TS_ASSERT(serial==digests);
+    }
+};
@@ -0,0 +1,139 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SharedMemoryCacheLayerTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "transfer/SharedMemoryCacheLayer.hpp"
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+using namespace Sirikata::Transfer;
+class SharedMemoryCacheLayerTest : public CxxTest::TestSuite
+{
+    std::string mName;
+    std::string mFound;
+    bool mCalled;
+    bool mExternal;
+    SparseData mKept;
+
+    void receive(const SparseData *data) {
+        mCalled = true;
+        mFound.clear();
+        mExternal = false;
+        if (data) {
+            mKept = *data;
+            const DenseData &dense = *data->DenseDataList::begin();
+            mFound.assign((const char*)dense.data(), (size_t)dense.length());
+            mExternal = dense.isExternal();
+        }
+    }
+    bool fetch(CacheLayer *layer, const RemoteFileId &fid) {
+        mCalled = false;
+        mFound.clear();
+        layer->getData(fid, Range(true), std::tr1::bind(&SharedMemoryCacheLayerTest::receive, this, std::tr1::placeholders::_1));
+        TS_ASSERT(mCalled);
+        return !mFound.empty();
+    }
+    static RemoteFileId fileFor(const std::string &contents) {
+        return RemoteFileId(Fingerprint::computeDigest(contents), URI(URIContext(), "mhash:///test"));
+    }
+public:
+    void setUp() {
+        std::ostringstream name;
+        name << "/sirikata-test-" << getpid();
+        mName = name.str();
+#ifndef _WIN32
+        shm_unlink(mName.c_str());
+#endif
+    }
+    void tearDown() {
+#ifndef _WIN32
+        shm_unlink(mName.c_str());
+#endif
+    }
+    void testSharedBetweenMappings( void )
+    {
+        std::string contents(5000, 'a');
+        RemoteFileId fid = fileFor(contents);
+        SharedMemoryCacheLayer writer(mName, 1024*1024, NULL, 64);
+        SharedMemoryCacheLayer reader(mName, 1024*1024, NULL, 64);
+        TS_ASSERT(writer.isMapped());
+        TS_ASSERT(reader.isMapped());
+        TS_ASSERT(!fetch(&reader, fid));
+
+        writer.addToCache(fid.fingerprint(), DenseDataPtr(new DenseData(contents)));
+        TS_ASSERT(fetch(&reader, fid));
+        TS_ASSERT_EQUALS(mFound, contents);
+        TS_ASSERT(mExternal);
+    }
+    void testPartialDataNotShared( void )
+    {
+        std::string contents(100, 'b');
+        RemoteFileId fid = fileFor(contents);
+        SharedMemoryCacheLayer layer(mName, 1024*1024, NULL, 64);
+        layer.addToCache(fid.fingerprint(), DenseDataPtr(new DenseData(contents, 0, false)));
+        TS_ASSERT(!fetch(&layer, fid));
+    }
+    void testPurge( void )
+    {
+        std::string contents(100, 'c');
+        RemoteFileId fid = fileFor(contents);
+        SharedMemoryCacheLayer writer(mName, 1024*1024, NULL, 64);
+        SharedMemoryCacheLayer reader(mName, 1024*1024, NULL, 64);
+        writer.addToCache(fid.fingerprint(), DenseDataPtr(new DenseData(contents)));
+        writer.purgeFromCache(fid.fingerprint());
+        TS_ASSERT(!fetch(&reader, fid));
+    }
+    void testFullSegmentPassesThrough( void )
+    {
+        std::string small(100, 'd'), large(4096, 'e');
+        RemoteFileId smallId = fileFor(small), largeId = fileFor(large);
+        SharedMemoryCacheLayer layer(mName, 1024, NULL, 64);
+        layer.addToCache(largeId.fingerprint(), DenseDataPtr(new DenseData(large)));
+        layer.addToCache(smallId.fingerprint(), DenseDataPtr(new DenseData(small)));
+        TS_ASSERT(!fetch(&layer, largeId));
+        TS_ASSERT(fetch(&layer, smallId));
+        TS_ASSERT_EQUALS(mFound, small);
+    }
+    void testDataOutlivesLayer( void )
+    {
+        std::string contents(300, 'f');
+        RemoteFileId fid = fileFor(contents);
+        {
+            SharedMemoryCacheLayer layer(mName, 1024*1024, NULL, 64);
+            layer.addToCache(fid.fingerprint(), DenseDataPtr(new DenseData(contents)));
+            TS_ASSERT(fetch(&layer, fid));
+        }
+        const DenseData &dense = *mKept.DenseDataList::begin();
+        TS_ASSERT(dense.isExternal());
+        TS_ASSERT_EQUALS(std::string((const char*)dense.data(), (size_t)dense.length()), contents);
+    }
+};
@@ -0,0 +1,71 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SlabAllocatorTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/SlabAllocator.hpp"
+class SlabAllocatorTest : public CxxTest::TestSuite
+{
+public:
+    void testReuseWithinSizeClass( void )
+    {
+        Sirikata::SlabAllocator allocator;
+        void *first=allocator.allocate(40);
+        void *second=allocator.allocate(48);
+        TS_ASSERT_DIFFERS(first,second);
+        TS_ASSERT_EQUALS(allocator.numOutstanding(),2u);
+        memset(first,0xab,40);
+        memset(second,0xcd,48);
+        allocator.release(first,40);
+        // 33 through 48 bytes share a size class, so the block just released comes straight back.
+        TS_ASSERT_EQUALS(allocator.allocate(33),first);
+        allocator.release(first,33);
+        allocator.release(second,48);
+        TS_ASSERT_EQUALS(allocator.numOutstanding(),0u);
+    }
+    void testManyBlocksAndLargeSizes( void )
+    {
+        Sirikata::SlabAllocator allocator;
+        std::vector<char*> blocks;
+        for (int i=0;i<1000;++i) {
+            char *block=(char*)allocator.allocate(200);
+            memset(block,i&0xff,200);
+            blocks.push_back(block);
+        }
+        for (int i=0;i<1000;++i) {
+            TS_ASSERT_EQUALS((unsigned char)blocks[i][199],(unsigned char)(i&0xff));
+            allocator.release(blocks[i],200);
+        }
+        char *big=(char*)allocator.allocate(Sirikata::SlabAllocator::MAX_POOLED_SIZE+1);
+        memset(big,0,Sirikata::SlabAllocator::MAX_POOLED_SIZE+1);
+        allocator.release(big,Sirikata::SlabAllocator::MAX_POOLED_SIZE+1);
+        TS_ASSERT_EQUALS(allocator.numOutstanding(),0u);
+    }
+};
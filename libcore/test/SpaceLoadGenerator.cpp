@@ -0,0 +1,608 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SpaceLoadGenerator.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "network/Stream.hpp"
+#include "network/StreamFactory.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "util/ObjectReference.hpp"
+#include "Test_Sirikata.pbj.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/KnownServices.hpp"
+#include "util/PluginManager.hpp"
+#include "util/DynamicLibrary.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/**
+ * Headless synthetic object host for load testing a space node. For every
+ * combination of connection and per connection object counts it opens that
+ * many top level space connections, registers the objects with NewObj on
+ * their own substreams, gives a fraction of them proximity queries, then
+ * streams ObjLoc updates along scripted trajectories while the objects ping
+ * each other through the space. Prints connection setup and registration
+ * rates and latencies, object to object message latency, what came back
+ * from proximity and loc, and the CPU used by the space process if its pid
+ * is given.
+ */
+using namespace Sirikata;
+using namespace Sirikata::Network;
+
+namespace {
+OptionValue*host;
+OptionValue*port;
+OptionValue*connections;
+OptionValue*objects;
+OptionValue*duration;
+OptionValue*updateRate;
+OptionValue*pingRate;
+OptionValue*trajectory;
+OptionValue*worldSize;
+OptionValue*queryFraction;
+OptionValue*queryRadius;
+OptionValue*ioThreads;
+OptionValue*setupTimeout;
+OptionValue*serverPid;
+InitializeGlobalOptions o("spaceload",
+                    host=new OptionValue("host","127.0.0.1",OptionValueType<String>(),"Host the space server listens on"),
+                    port=new OptionValue("port","5943",OptionValueType<String>(),"Port the space server listens on"),
+                    connections=new OptionValue("connections","1,4,16",OptionValueType<String>(),"Comma separated counts of top level space connections, each one standing in for an object host"),
+                    objects=new OptionValue("objects","10,100",OptionValueType<String>(),"Comma separated counts of objects registered on each connection"),
+                    duration=new OptionValue("duration","10s",OptionValueType<Duration>(),"How long updates and pings are sent for once every object is registered"),
+                    updateRate=new OptionValue("update-rate","10",OptionValueType<double>(),"ObjLoc updates each object sends per second"),
+                    pingRate=new OptionValue("ping-rate","1",OptionValueType<double>(),"Timestamped messages each object sends to a random other object per second"),
+                    trajectory=new OptionValue("trajectory","mix",OptionValueType<String>(),"Object motion: orbit, line, wander, still or mix"),
+                    worldSize=new OptionValue("world-size","1000",OptionValueType<double>(),"Edge of the cube in meters that objects are placed and move in"),
+                    queryFraction=new OptionValue("query-fraction","0.1",OptionValueType<double>(),"Fraction of objects that register a proximity query"),
+                    queryRadius=new OptionValue("query-radius","100",OptionValueType<float>(),"Radius of the proximity queries in meters"),
+                    ioThreads=new OptionValue("io-threads","2",OptionValueType<unsigned int>(),"Threads running the network IOService"),
+                    setupTimeout=new OptionValue("setup-timeout","30s",OptionValueType<Duration>(),"How long connecting or registering may take before the run carries on without the stragglers"),
+                    serverPid=new OptionValue("server-pid","0",OptionValueType<unsigned int>(),"Process id of a space server on this machine whose CPU use is reported, 0 to skip"),
+                    NULL);
+
+///Port the objects ping each other on: not used by any space service
+const MessagePort PING_PORT=15000;
+
+std::vector<unsigned int> parseCounts(const String&list) {
+    std::vector<unsigned int> retval;
+    String::size_type pos=0;
+    while (pos<list.length()) {
+        String::size_type comma=list.find(',',pos);
+        if (comma==String::npos) comma=list.length();
+        unsigned int value=(unsigned int)strtoul(list.substr(pos,comma-pos).c_str(),NULL,10);
+        if (value) retval.push_back(value);
+        pos=comma+1;
+    }
+    return retval;
+}
+
+int64 percentile(const std::vector<int64>&sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index=(size_t)(fraction*(sorted.size()-1)+0.5);
+    return sorted[index];
+}
+
+double randomUnit() {
+    return rand()/(double)RAND_MAX;
+}
+
+///CPU seconds used so far by pid, or a negative number if that cannot be found out
+double processCpuSeconds(unsigned int pid) {
+#ifdef __linux__
+    if (!pid) return -1;
+    FILE*fp=fopen(("/proc/"+boost::lexical_cast<String>(pid)+"/stat").c_str(),"r");
+    if (!fp) return -1;
+    char buffer[1024];
+    size_t len=fread(buffer,1,sizeof(buffer)-1,fp);
+    fclose(fp);
+    buffer[len]='\0';
+    // fields after the parenthesized command name, which may contain spaces
+    const char*rest=strrchr(buffer,')');
+    unsigned long utime=0,stime=0;
+    if (!rest||sscanf(rest+2,"%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",&utime,&stime)!=2)
+        return -1;
+    return (utime+stime)/(double)sysconf(_SC_CLK_TCK);
+#else
+    return -1;
+#endif
+}
+
+/// A scripted path: where an object is and how fast it moves at a given time since the run started.
+class Trajectory {
+public:
+    enum Kind {STILL,ORBIT,LINE,WANDER};
+private:
+    Kind mKind;
+    Vector3d mOrigin;
+    Vector3d mAxis;
+    double mRadius;
+    double mSpeed;
+    double mPhase;
+    double mWorld;
+public:
+    Trajectory(Kind kind, double world):mKind(kind),mWorld(world) {
+        mOrigin=Vector3d(randomUnit()*world,randomUnit()*world,randomUnit()*world);
+        mAxis=Vector3d(randomUnit()-.5,randomUnit()-.5,randomUnit()-.5);
+        if (mAxis.length()<1.0e-6) mAxis=Vector3d(1,0,0);
+        mAxis=mAxis/mAxis.length();
+        mRadius=5+randomUnit()*world/20;
+        mSpeed=1+randomUnit()*10;
+        mPhase=randomUnit()*2*M_PI;
+    }
+    void at(double t, Vector3d&position, Vector3f&velocity) const {
+        switch (mKind) {
+          case ORBIT: {
+              double angle=mPhase+t*mSpeed/mRadius;
+              position=mOrigin+Vector3d(cos(angle),sin(angle),0)*mRadius;
+              velocity=Vector3f((float)(-sin(angle)*mSpeed),(float)(cos(angle)*mSpeed),0);
+              break;
+          }
+          case LINE: {
+              // back and forth along mAxis, turning around every mRadius meters
+              double span=2*mRadius;
+              double travelled=fmod(mPhase*mRadius+t*mSpeed,2*span);
+              double offset=travelled<span?travelled:2*span-travelled;
+              double direction=travelled<span?mSpeed:-mSpeed;
+              position=mOrigin+mAxis*(offset-mRadius);
+              velocity=Vector3f((float)(mAxis.x*direction),(float)(mAxis.y*direction),(float)(mAxis.z*direction));
+              break;
+          }
+          case WANDER: {
+              // smooth, deterministic meander from a few summed sines per axis
+              double a=t*mSpeed/mRadius+mPhase;
+              position=mOrigin+Vector3d(sin(a)+.5*sin(2.3*a),sin(1.7*a)+.5*cos(3.1*a),.3*sin(.9*a))*mRadius;
+              double d=mSpeed;
+              velocity=Vector3f((float)((cos(a)+1.15*cos(2.3*a))*d),(float)((1.7*cos(1.7*a)-1.55*sin(3.1*a))*d),(float)(.27*cos(.9*a)*d));
+              break;
+          }
+          default:
+            position=mOrigin;
+            velocity=Vector3f(0,0,0);
+        }
+    }
+};
+
+class SpaceLoadGenerator {
+    struct Connection {
+        Stream*mStream;
+        Task::AbsTime mStarted;
+        bool mDone;
+        Connection():mStream(NULL),mStarted(Task::AbsTime::null()),mDone(false) {
+        }
+    };
+    struct LoadObject {
+        size_t mConnection;
+        Stream*mStream;
+        UUID mEvidence;
+        ObjectReference mReference;
+        bool mRegistered;
+        Task::AbsTime mRegisterSent;
+        Trajectory mTrajectory;
+        Task::AbsTime mNextUpdate;
+        Task::AbsTime mNextPing;
+        LoadObject(const Trajectory&trajectory):mConnection(0),mStream(NULL),mRegistered(false),
+                                                mRegisterSent(Task::AbsTime::null()),mTrajectory(trajectory),
+                                                mNextUpdate(Task::AbsTime::null()),mNextPing(Task::AbsTime::null()) {
+        }
+    };
+    IOService*mIO;
+    std::vector<boost::thread*> mThreads;
+    boost::mutex mMutex;
+    boost::condition_variable mProgress;
+    ///Bumped every run so callbacks from the streams of an earlier run are ignored
+    unsigned int mGeneration;
+    std::vector<Connection> mConnections;
+    std::vector<LoadObject> mObjects;
+    std::vector<int64> mSetupLatencies;
+    std::vector<int64> mRegisterLatencies;
+    std::vector<int64> mPingLatencies;
+    unsigned int mConnected;
+    unsigned int mConnectFailed;
+    unsigned int mRegistered;
+    unsigned int mPingsReceived;
+    unsigned int mProxEvents;
+    unsigned int mLocUpdates;
+    unsigned int mDisconnected;
+
+    void connectionStatus(unsigned int generation, size_t which, Stream::ConnectionStatus status, const std::string&reason) {
+        Task::AbsTime now=Task::AbsTime::now();
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        if (generation!=mGeneration||which>=mConnections.size())
+            return;
+        Connection&connection=mConnections[which];
+        if (!connection.mDone) {
+            connection.mDone=true;
+            if (status==Stream::Connected) {
+                ++mConnected;
+                mSetupLatencies.push_back((now-connection.mStarted).toMicroseconds());
+            }else {
+                ++mConnectFailed;
+                fprintf(stderr,"Connection %u failed: %s\n",(unsigned int)which,reason.c_str());
+            }
+        }else if (status!=Stream::Connected) {
+            ++mDisconnected;
+        }
+        mProgress.notify_all();
+    }
+    void objectStatus(unsigned int generation, size_t which, Stream::ConnectionStatus status, const std::string&reason) {
+        if (status==Stream::Connected)
+            return;
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        if (generation==mGeneration&&which<mObjects.size())
+            ++mDisconnected;
+    }
+    void objectReceived(unsigned int generation, size_t which, const Chunk&chunk) {
+        if (chunk.empty())
+            return;
+        Task::AbsTime now=Task::AbsTime::now();
+        RoutableMessageHeader header;
+        MemoryReference body=header.ParseFromArray(&chunk[0],chunk.size());
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        if (generation!=mGeneration||which>=mObjects.size())
+            return;
+        if (header.destination_port()==PING_PORT) {
+            int64 sent=0;
+            if (body.size()>=sizeof(sent)) {
+                memcpy(&sent,body.data(),sizeof(sent));
+                mPingLatencies.push_back((now-Task::AbsTime::microseconds(sent)).toMicroseconds());
+                ++mPingsReceived;
+            }
+            return;
+        }
+        RoutableMessageBody messages;
+        if (!messages.ParseFromArray(body.data(),body.size()))
+            return;
+        for (int i=0;i<messages.message_size();++i) {
+            const std::string&name=messages.message_names(i);
+            if (name=="RetObj") {
+                Protocol::RetObj retObj;
+                LoadObject&object=mObjects[which];
+                const std::string&args=messages.message_arguments(i);
+                if (!object.mRegistered&&retObj.ParseFromArray(args.data(),args.length())&&retObj.has_object_reference()) {
+                    object.mRegistered=true;
+                    object.mReference=ObjectReference(retObj.object_reference());
+                    ++mRegistered;
+                    mRegisterLatencies.push_back((now-object.mRegisterSent).toMicroseconds());
+                    mProgress.notify_all();
+                }
+            }else if (name=="ProxCall"||name=="ProxCallBatch") {
+                ++mProxEvents;
+            }else if (header.source_port()==Services::LOC) {
+                ++mLocUpdates;
+            }
+        }
+    }
+
+    void sendToSpace(const LoadObject&object, MessagePort destinationPort, const RoutableMessageBody&body) {
+        RoutableMessageHeader header;
+        header.set_destination_object(ObjectReference::spaceServiceID());
+        header.set_destination_port(destinationPort);
+        std::string serializedHeader,serializedBody;
+        header.SerializeToString(&serializedHeader);
+        body.SerializeToString(&serializedBody);
+        object.mStream->send(MemoryReference(serializedHeader),MemoryReference(serializedBody),ReliableOrdered);
+    }
+    void fillLocation(Protocol::ObjLoc&loc, const LoadObject&object, double t, const Task::AbsTime&now) {
+        Vector3d position;
+        Vector3f velocity;
+        object.mTrajectory.at(t,position,velocity);
+        loc.set_timestamp(now);
+        loc.set_position(position);
+        loc.set_orientation(Quaternion::identity());
+        loc.set_velocity(velocity);
+    }
+    void sendNewObj(LoadObject&object) {
+        Protocol::NewObj newObj;
+        newObj.set_object_uuid_evidence(object.mEvidence);
+        newObj.set_bounding_sphere(BoundingSphere3f(Vector3f(0,0,0),1));
+        Vector3d position;
+        Vector3f velocity;
+        object.mTrajectory.at(0,position,velocity);
+        Protocol::IObjLoc loc=newObj.mutable_requested_object_loc();
+        loc.set_timestamp(Time::now());
+        loc.set_position(position);
+        loc.set_orientation(Quaternion::identity());
+        loc.set_velocity(velocity);
+        RoutableMessageBody body;
+        newObj.SerializeToString(body.add_message("NewObj"));
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            object.mRegisterSent=Task::AbsTime::now();
+        }
+        sendToSpace(object,Services::REGISTRATION,body);
+    }
+    void sendProxQuery(const LoadObject&object, uint32 queryId) {
+        Protocol::NewProxQuery query;
+        query.set_query_id(queryId);
+        query.set_relative_center(Vector3f(0,0,0));
+        query.set_max_radius(queryRadius->as<float>());
+        RoutableMessageBody body;
+        query.SerializeToString(body.add_message("NewProxQuery"));
+        sendToSpace(object,Services::GEOM,body);
+    }
+    void sendPing(const LoadObject&from, const ObjectReference&to) {
+        RoutableMessageHeader header;
+        header.set_destination_object(to);
+        header.set_destination_port(PING_PORT);
+        header.set_source_port(PING_PORT);
+        std::string serializedHeader;
+        header.SerializeToString(&serializedHeader);
+        int64 now=Task::AbsTime::now().raw();
+        from.mStream->send(MemoryReference(serializedHeader),MemoryReference(&now,sizeof(now)),ReliableOrdered);
+    }
+    ///Waits until done() holds or the setup timeout runs out; returns whether done() held
+    template <class Predicate> bool waitFor(Predicate done) {
+        Task::AbsTime deadline=Task::AbsTime::now()+setupTimeout->as<Duration>();
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        while (!done()) {
+            if (Task::AbsTime::now()>deadline)
+                return false;
+            mProgress.timed_wait(lock,boost::posix_time::milliseconds(100));
+        }
+        return true;
+    }
+    bool allConnected() const {
+        return mConnected+mConnectFailed>=mConnections.size();
+    }
+    bool allRegistered() const {
+        return mRegistered>=mObjects.size();
+    }
+    static Trajectory::Kind pickTrajectory(const String&name) {
+        if (name=="orbit") return Trajectory::ORBIT;
+        if (name=="line") return Trajectory::LINE;
+        if (name=="wander") return Trajectory::WANDER;
+        if (name=="still") return Trajectory::STILL;
+        return (Trajectory::Kind)(rand()%4);
+    }
+public:
+    SpaceLoadGenerator():mIO(IOServiceFactory::makeIOService()),mGeneration(0) {
+        // keeps the IOService running while no stream has work queued
+        IOServiceFactory::dispatchServiceMessage(mIO,Duration::seconds(365*24*3600.0),&SpaceLoadGenerator::idle);
+        unsigned int threads=std::max(1u,ioThreads->as<unsigned int>());
+        for (unsigned int i=0;i<threads;++i)
+            mThreads.push_back(new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO)));
+    }
+    static void idle() {
+    }
+    ~SpaceLoadGenerator() {
+        IOServiceFactory::stopService(mIO);
+        for (size_t i=0;i<mThreads.size();++i) {
+            mThreads[i]->join();
+            delete mThreads[i];
+        }
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    bool run(unsigned int numConnections, unsigned int objectsPerConnection) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        Address address(host->as<String>(),port->as<String>());
+        unsigned int generation;
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            generation=++mGeneration;
+            mConnections.clear();
+            mObjects.clear();
+            mSetupLatencies.clear();
+            mRegisterLatencies.clear();
+            mPingLatencies.clear();
+            mConnected=mConnectFailed=mRegistered=mPingsReceived=mProxEvents=mLocUpdates=mDisconnected=0;
+            mConnections.resize(numConnections);
+            for (unsigned int i=0;i<numConnections*objectsPerConnection;++i) {
+                mObjects.push_back(LoadObject(Trajectory(pickTrajectory(trajectory->as<String>()),worldSize->as<double>())));
+                mObjects.back().mConnection=i/objectsPerConnection;
+                mObjects.back().mEvidence=UUID::random();
+            }
+        }
+
+        // Connection setup
+        Task::AbsTime setupStart=Task::AbsTime::now();
+        for (size_t i=0;i<mConnections.size();++i) {
+            Stream*stream=StreamFactory::getSingleton().getConstructor("tcpsst")(mIO);
+            {
+                boost::unique_lock<boost::mutex> lock(mMutex);
+                mConnections[i].mStream=stream;
+                mConnections[i].mStarted=Task::AbsTime::now();
+            }
+            stream->connect(address,
+                            &Stream::ignoreSubstreamCallback,
+                            std::tr1::bind(&SpaceLoadGenerator::connectionStatus,this,generation,i,_1,_2),
+                            &Stream::ignoreBytesReceived);
+        }
+        waitFor(std::tr1::bind(&SpaceLoadGenerator::allConnected,this));
+        double setupSeconds=(Task::AbsTime::now()-setupStart).toSeconds();
+
+        // Registration, on a substream per object like HostedObject
+        Task::AbsTime registerStart=Task::AbsTime::now();
+        for (size_t i=0;i<mObjects.size();++i) {
+            LoadObject&object=mObjects[i];
+            object.mStream=mConnections[object.mConnection].mStream->clone(
+                std::tr1::bind(&SpaceLoadGenerator::objectStatus,this,generation,i,_1,_2),
+                std::tr1::bind(&SpaceLoadGenerator::objectReceived,this,generation,i,_1));
+            sendNewObj(object);
+        }
+        waitFor(std::tr1::bind(&SpaceLoadGenerator::allRegistered,this));
+        double registerSeconds=(Task::AbsTime::now()-registerStart).toSeconds();
+
+        // objects still registering after the timeout sit the load phase out
+        std::vector<ObjectReference> references;
+        std::vector<bool> active(mObjects.size(),false);
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            for (size_t i=0;i<mObjects.size();++i)
+                if (mObjects[i].mRegistered) {
+                    references.push_back(mObjects[i].mReference);
+                    active[i]=true;
+                }
+        }
+        uint32 queries=0;
+        for (size_t i=0;i<mObjects.size();++i)
+            if (active[i]&&randomUnit()<queryFraction->as<double>())
+                sendProxQuery(mObjects[i],queries++);
+
+        // Steady load: updates along the trajectories and pings between objects
+        double rate=updateRate->as<double>();
+        double pings=pingRate->as<double>();
+        Duration updateInterval=Duration::seconds(rate>0?1.0/rate:1.0e9);
+        Duration pingInterval=Duration::seconds(pings>0?1.0/pings:1.0e9);
+        Task::AbsTime loadStart=Task::AbsTime::now();
+        for (size_t i=0;i<mObjects.size();++i) {
+            // spread the first sends over an interval so they do not all go out in one burst
+            mObjects[i].mNextUpdate=loadStart+updateInterval*randomUnit();
+            mObjects[i].mNextPing=loadStart+pingInterval*randomUnit();
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mProxEvents=mLocUpdates=0;
+        }
+        double cpuBefore=processCpuSeconds(serverPid->as<unsigned int>());
+        Task::AbsTime loadEnd=loadStart+duration->as<Duration>();
+        uint64 updatesSent=0,pingsSent=0;
+        for (Task::AbsTime now=loadStart;now<loadEnd;now=Task::AbsTime::now()) {
+            double t=(now-loadStart).toSeconds();
+            for (size_t i=0;i<mObjects.size();++i) {
+                if (!active[i])
+                    continue;
+                LoadObject&object=mObjects[i];
+                if (rate>0&&now>=object.mNextUpdate) {
+                    Protocol::ObjLoc loc;
+                    fillLocation(loc,object,t,now);
+                    RoutableMessageBody body;
+                    loc.SerializeToString(body.add_message("ObjLoc"));
+                    sendToSpace(object,Services::LOC,body);
+                    object.mNextUpdate+=updateInterval;
+                    if (object.mNextUpdate<now)//fell behind: do not try to catch up in a burst
+                        object.mNextUpdate=now+updateInterval;
+                    ++updatesSent;
+                }
+                if (pings>0&&references.size()>1&&now>=object.mNextPing) {
+                    const ObjectReference&to=references[rand()%references.size()];
+                    if (!(to==object.mReference)) {
+                        sendPing(object,to);
+                        ++pingsSent;
+                    }
+                    object.mNextPing+=pingInterval;
+                    if (object.mNextPing<now)
+                        object.mNextPing=now+pingInterval;
+                }
+            }
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+        double loadSeconds=(Task::AbsTime::now()-loadStart).toSeconds();
+        double cpuAfter=processCpuSeconds(serverPid->as<unsigned int>());
+        // let the last pings arrive
+        boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+
+        std::vector<int64> setup,registration,latency;
+        unsigned int connected,registered,received,proxEvents,locUpdates,disconnected;
+        std::vector<Stream*> streams;
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            setup.swap(mSetupLatencies);
+            registration.swap(mRegisterLatencies);
+            latency.swap(mPingLatencies);
+            connected=mConnected;
+            registered=mRegistered;
+            received=mPingsReceived;
+            proxEvents=mProxEvents;
+            locUpdates=mLocUpdates;
+            disconnected=mDisconnected;
+            for (size_t i=0;i<mObjects.size();++i)
+                if (mObjects[i].mStream)
+                    streams.push_back(mObjects[i].mStream);
+            for (size_t i=0;i<mConnections.size();++i)
+                streams.push_back(mConnections[i].mStream);
+            ++mGeneration;
+            mObjects.clear();
+            mConnections.clear();
+        }
+        for (size_t i=0;i<streams.size();++i) {
+            streams[i]->close();
+            delete streams[i];
+        }
+
+        std::sort(setup.begin(),setup.end());
+        std::sort(registration.begin(),registration.end());
+        std::sort(latency.begin(),latency.end());
+        if (setupSeconds<=0) setupSeconds=1.0e-6;
+        if (registerSeconds<=0) registerSeconds=1.0e-6;
+        if (loadSeconds<=0) loadSeconds=1.0e-6;
+        char cpu[32]="-";
+        if (cpuBefore>=0&&cpuAfter>=0)
+            snprintf(cpu,sizeof(cpu),"%.1f",100*(cpuAfter-cpuBefore)/loadSeconds);
+        printf("%6u %8u %9.1f %9lld %9lld %9.1f %9lld %9lld %10.0f %8.0f %9lld %9lld %9lld %7u %9.0f %9.0f %6s %5u\n",
+               numConnections,numConnections*objectsPerConnection,
+               connected/setupSeconds,
+               (long long)percentile(setup,0.5)/1000,(long long)percentile(setup,0.99)/1000,
+               registered/registerSeconds,
+               (long long)percentile(registration,0.5)/1000,(long long)percentile(registration,0.99)/1000,
+               updatesSent/loadSeconds,pingsSent/loadSeconds,
+               (long long)percentile(latency,0.5),(long long)percentile(latency,0.99),(long long)percentile(latency,0.999),
+               (unsigned int)(pingsSent>received?pingsSent-received:0),
+               proxEvents/loadSeconds,locUpdates/loadSeconds,cpu,disconnected);
+        fflush(stdout);
+        return connected==numConnections&&registered==numConnections*objectsPerConnection;
+    }
+};
+}
+
+int main(int argc, const char**argv) {
+    PluginManager plugins;
+    plugins.load(DynamicLibrary::filename("tcpsst"));
+    OptionSet::getOptions("spaceload")->parse(argc,argv);
+    srand((unsigned int)time(NULL));
+
+    std::vector<unsigned int> connectionCounts=parseCounts(connections->as<String>());
+    std::vector<unsigned int> objectCounts=parseCounts(objects->as<String>());
+
+    printf("%6s %8s %9s %9s %9s %9s %9s %9s %10s %8s %9s %9s %9s %7s %9s %9s %6s %5s\n",
+           "conns","objects","conn/s","p50(ms)","p99(ms)","reg/s","p50(ms)","p99(ms)",
+           "upd/s","ping/s","p50(us)","p99(us)","p999(us)","lost","prox/s","loc/s","cpu%","drops");
+    int retval=0;
+    {
+        SpaceLoadGenerator generator;
+        for (size_t c=0;c<connectionCounts.size();++c)
+            for (size_t o=0;o<objectCounts.size();++o)
+                if (!generator.run(connectionCounts[c],objectCounts[o]))
+                    retval=1;
+    }
+    return retval;
+}
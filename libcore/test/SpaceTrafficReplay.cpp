@@ -0,0 +1,313 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SpaceTrafficReplay.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "network/Stream.hpp"
+#include "network/StreamFactory.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "network/StreamCapture.hpp"
+#include "util/ObjectReference.hpp"
+#include "Test_Sirikata.pbj.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/MessageTrace.hpp"
+#include "util/PluginManager.hpp"
+#include "util/DynamicLibrary.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+
+/**
+ * Plays the traffic a space server recorded with its capture option back
+ * against a space server, on the recorded schedule or faster. Every recorded
+ * stream gets a substream of one of the top level connections, its bytes are
+ * sent as they arrived and it is closed when it closed. Messages go out
+ * traced, so the MessageTrace hops of whatever the space forwards back tell
+ * how long the space held each message and how long it took end to end.
+ *
+ * Registration names objects from the evidence in their NewObj, so a capture
+ * replayed against a space with the same registration key reaches the same
+ * object references and the recorded object to object messages still arrive.
+ */
+using namespace Sirikata;
+using namespace Sirikata::Network;
+
+namespace {
+OptionValue*capture;
+OptionValue*host;
+OptionValue*port;
+OptionValue*speed;
+OptionValue*connections;
+OptionValue*ioThreads;
+OptionValue*setupTimeout;
+OptionValue*drain;
+InitializeGlobalOptions o("spacereplay",
+                    capture=new OptionValue("capture","space.cap",OptionValueType<String>(),"File a space server recorded with its capture option"),
+                    host=new OptionValue("host","127.0.0.1",OptionValueType<String>(),"Host the space server listens on"),
+                    port=new OptionValue("port","5943",OptionValueType<String>(),"Port the space server listens on"),
+                    speed=new OptionValue("speed","1",OptionValueType<double>(),"How many times faster than recorded the traffic is played, 0 for as fast as it can be sent"),
+                    connections=new OptionValue("connections","1",OptionValueType<unsigned int>(),"Top level space connections the recorded streams are spread over"),
+                    ioThreads=new OptionValue("io-threads","2",OptionValueType<unsigned int>(),"Threads running the network IOService"),
+                    setupTimeout=new OptionValue("setup-timeout","30s",OptionValueType<Duration>(),"How long connecting may take before the replay starts without the stragglers"),
+                    drain=new OptionValue("drain","1s",OptionValueType<Duration>(),"How long to wait for replies after the last record is played"),
+                    NULL);
+
+int64 percentile(const std::vector<int64>&sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index=(size_t)(fraction*(sorted.size()-1)+0.5);
+    return sorted[index];
+}
+
+class SpaceTrafficReplay {
+    IOService*mIO;
+    std::vector<boost::thread*> mThreads;
+    boost::mutex mMutex;
+    boost::condition_variable mProgress;
+    std::vector<Stream*> mConnections;
+    unsigned int mConnected;
+    unsigned int mConnectFailed;
+    unsigned int mReceived;
+    unsigned int mRegistered;
+    unsigned int mDisconnected;
+    ///Time the space held traced messages, from SPACE_RECEIVE to SPACE_SEND
+    std::vector<int64> mSpaceLatencies;
+    ///Time traced messages took from OBJECT_SEND to arriving here
+    std::vector<int64> mEndToEndLatencies;
+
+    void connectionStatus(Stream::ConnectionStatus status, const std::string&reason) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        if (status==Stream::Connected) {
+            ++mConnected;
+        }else {
+            ++mConnectFailed;
+            fprintf(stderr,"Connection failed: %s\n",reason.c_str());
+        }
+        mProgress.notify_all();
+    }
+    void streamStatus(Stream::ConnectionStatus status, const std::string&reason) {
+        if (status==Stream::Connected)
+            return;
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        ++mDisconnected;
+    }
+    void received(const Chunk&chunk) {
+        if (chunk.empty())
+            return;
+        uint64 now=Task::AbsTime::now().raw();
+        RoutableMessageHeader header;
+        MemoryReference body=header.ParseFromArray(&chunk[0],chunk.size());
+        int64 space=-1,endToEnd=-1;
+        if (header.has_trace_context()) {
+            std::vector<std::pair<MessageTrace::Hop,uint64> > hops;
+            MessageTrace::parse(header.trace_context(),hops);
+            uint64 sent=0,spaceReceived=0,spaceSent=0;
+            for (size_t i=0;i<hops.size();++i) {
+                switch (hops[i].first) {
+                  case MessageTrace::OBJECT_SEND: sent=hops[i].second; break;
+                  case MessageTrace::SPACE_RECEIVE: spaceReceived=hops[i].second; break;
+                  case MessageTrace::SPACE_SEND: spaceSent=hops[i].second; break;
+                  default: break;
+                }
+            }
+            if (spaceReceived&&spaceSent)
+                space=spaceSent>spaceReceived?spaceSent-spaceReceived:0;
+            if (sent)
+                endToEnd=now>sent?now-sent:0;
+        }
+        unsigned int registered=0;
+        RoutableMessageBody messages;
+        if (messages.ParseFromArray(body.data(),body.size())) {
+            for (int i=0;i<messages.message_size();++i)
+                if (messages.message_names(i)=="RetObj")
+                    ++registered;
+        }
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        ++mReceived;
+        mRegistered+=registered;
+        if (space>=0)
+            mSpaceLatencies.push_back(space);
+        if (endToEnd>=0)
+            mEndToEndLatencies.push_back(endToEnd);
+    }
+    bool allConnected() const {
+        return mConnected+mConnectFailed>=mConnections.size();
+    }
+    ///Sends one recorded chunk with a fresh trace in place of any it was recorded with
+    void send(Stream*stream, const Chunk&chunk) {
+        if (chunk.empty()) {
+            stream->send(chunk,ReliableOrdered);
+            return;
+        }
+        RoutableMessageHeader header;
+        MemoryReference body=header.ParseFromArray(&chunk[0],chunk.size());
+        MessageTrace::force(header);
+        std::string serializedHeader;
+        header.SerializeToString(&serializedHeader);
+        stream->send(MemoryReference(serializedHeader),body,ReliableOrdered);
+    }
+public:
+    SpaceTrafficReplay():mIO(IOServiceFactory::makeIOService()),
+                         mConnected(0),mConnectFailed(0),mReceived(0),mRegistered(0),mDisconnected(0) {
+        // keeps the IOService running while no stream has work queued
+        IOServiceFactory::dispatchServiceMessage(mIO,Duration::seconds(365*24*3600.0),&SpaceTrafficReplay::idle);
+        unsigned int threads=std::max(1u,ioThreads->as<unsigned int>());
+        for (unsigned int i=0;i<threads;++i)
+            mThreads.push_back(new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO)));
+    }
+    static void idle() {
+    }
+    ~SpaceTrafficReplay() {
+        IOServiceFactory::stopService(mIO);
+        for (size_t i=0;i<mThreads.size();++i) {
+            mThreads[i]->join();
+            delete mThreads[i];
+        }
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    bool run(StreamCaptureReader&reader) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        Address address(host->as<String>(),port->as<String>());
+        unsigned int numConnections=std::max(1u,connections->as<unsigned int>());
+        for (unsigned int i=0;i<numConnections;++i) {
+            Stream*stream=StreamFactory::getSingleton().getConstructor("tcpsst")(mIO);
+            {
+                boost::unique_lock<boost::mutex> lock(mMutex);
+                mConnections.push_back(stream);
+            }
+            stream->connect(address,
+                            &Stream::ignoreSubstreamCallback,
+                            std::tr1::bind(&SpaceTrafficReplay::connectionStatus,this,_1,_2),
+                            std::tr1::bind(&SpaceTrafficReplay::received,this,_1));
+        }
+        {
+            Task::AbsTime deadline=Task::AbsTime::now()+setupTimeout->as<Duration>();
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            while (!allConnected()&&Task::AbsTime::now()<deadline)
+                mProgress.timed_wait(lock,boost::posix_time::milliseconds(100));
+            if (mConnected==0)
+                return false;
+        }
+
+        double rate=speed->as<double>();
+        std::tr1::unordered_map<uint32,Stream*> streams;
+        std::vector<Stream*> finished;
+        std::vector<int64> lags;
+        uint64 records=0,messages=0,bytes=0;
+        StreamCaptureReader::Record record;
+        Task::AbsTime start=Task::AbsTime::now();
+        while (reader.next(record)) {
+            ++records;
+            if (rate>0) {
+                Task::AbsTime due=start+Duration::microseconds((int64)(record.mTime/rate));
+                Task::AbsTime now=Task::AbsTime::now();
+                if (now<due) {
+                    boost::this_thread::sleep(boost::posix_time::microseconds((now-due).toMicroseconds()*-1));
+                    now=Task::AbsTime::now();
+                }
+                lags.push_back((now-due).toMicroseconds());
+            }
+            std::tr1::unordered_map<uint32,Stream*>::iterator where=streams.find(record.mStream);
+            if (record.mKind==StreamCaptureReader::Record::CLOSED) {
+                if (where!=streams.end()) {
+                    where->second->close();
+                    finished.push_back(where->second);
+                    streams.erase(where);
+                }
+                continue;
+            }
+            if (where==streams.end()) {
+                Stream*parent=mConnections[record.mStream%mConnections.size()];
+                where=streams.insert(std::pair<uint32,Stream*>(record.mStream,parent->clone(
+                    std::tr1::bind(&SpaceTrafficReplay::streamStatus,this,_1,_2),
+                    std::tr1::bind(&SpaceTrafficReplay::received,this,_1)))).first;
+            }
+            send(where->second,record.mData);
+            ++messages;
+            bytes+=record.mData.size();
+        }
+        double seconds=(Task::AbsTime::now()-start).toSeconds();
+        boost::this_thread::sleep(boost::posix_time::microseconds(drain->as<Duration>().toMicroseconds()));
+
+        std::vector<int64> space,endToEnd;
+        unsigned int received,registered,disconnected;
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            space.swap(mSpaceLatencies);
+            endToEnd.swap(mEndToEndLatencies);
+            received=mReceived;
+            registered=mRegistered;
+            disconnected=mDisconnected;
+        }
+        for (std::tr1::unordered_map<uint32,Stream*>::iterator i=streams.begin();i!=streams.end();++i)
+            finished.push_back(i->second);
+        finished.insert(finished.end(),mConnections.begin(),mConnections.end());
+        mConnections.clear();
+        for (size_t i=0;i<finished.size();++i) {
+            finished[i]->close();
+            delete finished[i];
+        }
+
+        std::sort(lags.begin(),lags.end());
+        std::sort(space.begin(),space.end());
+        std::sort(endToEnd.begin(),endToEnd.end());
+        if (seconds<=0) seconds=1.0e-6;
+        printf("%9llu %8.2f %9.0f %7.2f %9lld %9lld %8u %7u %9lld %9lld %9lld %9lld %9lld %5u\n",
+               (unsigned long long)records,seconds,messages/seconds,bytes/seconds/1.0e6,
+               (long long)percentile(lags,0.5),(long long)percentile(lags,0.99),
+               received,registered,
+               (long long)percentile(space,0.5),(long long)percentile(space,0.99),
+               (long long)percentile(endToEnd,0.5),(long long)percentile(endToEnd,0.99),(long long)percentile(endToEnd,0.999),
+               disconnected);
+        fflush(stdout);
+        return true;
+    }
+};
+}
+
+int main(int argc, const char**argv) {
+    PluginManager plugins;
+    plugins.load(DynamicLibrary::filename("tcpsst"));
+    OptionSet::getOptions("spacereplay")->parse(argc,argv);
+
+    StreamCaptureReader reader;
+    if (!reader.open(capture->as<String>())) {
+        fprintf(stderr,"%s is not a traffic capture\n",capture->as<String>().c_str());
+        return 1;
+    }
+    printf("%9s %8s %9s %7s %9s %9s %8s %7s %9s %9s %9s %9s %9s %5s\n",
+           "records","seconds","msg/s","MB/s","lag50(us)","lag99(us)","received","retobj",
+           "space50","space99","p50(us)","p99(us)","p999(us)","drops");
+    SpaceTrafficReplay replay;
+    return replay.run(reader)?0:1;
+}
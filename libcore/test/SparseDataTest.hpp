@@ -0,0 +1,96 @@
+/*  Sirikata Tests -- Sirikata Testing Framework
+ *  SparseDataTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "transfer/TransferData.hpp"
+
+using namespace Sirikata;
+class SparseDataTest : public CxxTest::TestSuite
+{
+	static Transfer::DenseDataPtr piece(const std::string &bytes, Transfer::Range::base_type start) {
+		return Transfer::DenseDataPtr(new Transfer::DenseData(bytes, start, false));
+	}
+	static std::string contents(const Transfer::SparseData &data) {
+		return std::string(data.begin(), data.end());
+	}
+	static size_t numPieces(const Transfer::SparseData &data) {
+		size_t count = 0;
+		for (Transfer::DenseDataList::const_iterator iter = data.DenseDataList::begin();
+				iter != data.DenseDataList::end();
+				++iter) {
+			++count;
+		}
+		return count;
+	}
+public:
+	void testCoalesceAdjacent() {
+		Transfer::SparseData data;
+		data.addValidData(piece("abc", 0));
+		data.addValidData(piece("def", 3));
+		data.addValidData(piece("xyz", 10));
+		TS_ASSERT_EQUALS(numPieces(data), 3u);
+		TS_ASSERT(data.span(Transfer::Range(2, 2, Transfer::LENGTH)) == NULL);
+
+		data.coalesce();
+		TS_ASSERT_EQUALS(numPieces(data), 2u);
+		const unsigned char *flat = data.span(Transfer::Range(0, 6, Transfer::LENGTH));
+		TS_ASSERT(flat != NULL);
+		if (flat) {
+			TS_ASSERT_EQUALS(std::string(flat, flat+6), "abcdef");
+		}
+		TS_ASSERT(data.span(Transfer::Range(5, 6, Transfer::LENGTH)) == NULL);
+	}
+	void testCoalesceOverlapping() {
+		Transfer::SparseData data;
+		data.addValidData(piece("abcd", 0));
+		data.addValidData(piece("cdefg", 2));
+		data.addValidData(piece("ghi", 6));
+		data.coalesce();
+		TS_ASSERT_EQUALS(numPieces(data), 1u);
+		TS_ASSERT_EQUALS(contents(data), "abcdefghi");
+		// One piece left, so flatten() hands it back without copying.
+		TS_ASSERT_EQUALS(data.flatten().get(), &*data.DenseDataList::begin());
+	}
+	void testAutomaticCoalesce() {
+		Transfer::SparseData data;
+		std::string expected;
+		for (int i = 0; i <= Transfer::SparseData::COALESCE_PIECES * 2; ++i) {
+			std::string bytes(4, (char)('a' + i));
+			data.addValidData(piece(bytes, i * 4));
+			expected += bytes;
+		}
+		TS_ASSERT(numPieces(data) <= (size_t)Transfer::SparseData::COALESCE_PIECES);
+		TS_ASSERT_EQUALS(contents(data), expected);
+		data.coalesce();
+		TS_ASSERT_EQUALS(numPieces(data), 1u);
+		TS_ASSERT(data.span(Transfer::Range(0, expected.length(), Transfer::LENGTH)) != NULL);
+	}
+};
@@ -0,0 +1,290 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SstBenchmark.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "network/StreamFactory.hpp"
+#include "network/StreamListenerFactory.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "util/AtomicTypes.hpp"
+#include "util/PluginManager.hpp"
+#include "util/DynamicLibrary.hpp"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+#include <cstring>
+
+/**
+ * Standalone tcpsst benchmark: pushes timestamped messages over loopback
+ * through TCPStream/MultiplexedSocket for every combination of message size,
+ * substream count, reliability and parallel sockets given on the command line,
+ * and prints messages/sec, MB/sec and p50/p99/p999 one way latency for each.
+ */
+using namespace Sirikata;
+using namespace Sirikata::Network;
+
+namespace {
+OptionValue*sizes;
+OptionValue*substreams;
+OptionValue*reliabilities;
+OptionValue*connections;
+OptionValue*messages;
+OptionValue*window;
+OptionValue*port;
+InitializeGlobalOptions o("sstbench",
+                    sizes=new OptionValue("sizes","16,256,4096,65536",OptionValueType<String>(),"Comma separated message sizes in bytes"),
+                    substreams=new OptionValue("substreams","1,4",OptionValueType<String>(),"Comma separated counts of substreams the messages are spread over"),
+                    reliabilities=new OptionValue("reliability","ordered,unordered,unreliable",OptionValueType<String>(),"Comma separated reliability modes out of ordered, unordered and unreliable"),
+                    connections=new OptionValue("connections","1,3",OptionValueType<String>(),"Comma separated counts of TCP connections each stream is striped over"),
+                    messages=new OptionValue("messages","20000",OptionValueType<unsigned int>(),"Messages sent for each combination"),
+                    window=new OptionValue("window","256",OptionValueType<unsigned int>(),"Messages allowed in flight before the sender waits for the receiver"),
+                    port=new OptionValue("port","9143",OptionValueType<String>(),"Loopback port the benchmark listens on"),
+                    NULL);
+
+std::vector<String> splitList(const String&list) {
+    std::vector<String> retval;
+    String::size_type pos=0;
+    while (pos<list.length()) {
+        String::size_type comma=list.find(',',pos);
+        if (comma==String::npos) comma=list.length();
+        if (comma>pos)
+            retval.push_back(list.substr(pos,comma-pos));
+        pos=comma+1;
+    }
+    return retval;
+}
+std::vector<unsigned int> parseCounts(const String&list) {
+    std::vector<String> items=splitList(list);
+    std::vector<unsigned int> retval;
+    for (size_t i=0;i<items.size();++i) {
+        unsigned int value=(unsigned int)strtoul(items[i].c_str(),NULL,10);
+        if (value) retval.push_back(value);
+    }
+    return retval;
+}
+std::vector<StreamReliability> parseReliabilities(const String&list) {
+    std::vector<String> items=splitList(list);
+    std::vector<StreamReliability> retval;
+    for (size_t i=0;i<items.size();++i) {
+        if (items[i]=="ordered") retval.push_back(ReliableOrdered);
+        else if (items[i]=="unordered") retval.push_back(ReliableUnordered);
+        else if (items[i]=="unreliable") retval.push_back(Unreliable);
+        else fprintf(stderr,"Ignoring unknown reliability %s\n",items[i].c_str());
+    }
+    return retval;
+}
+const char*reliabilityName(StreamReliability reliability) {
+    switch (reliability) {
+      case ReliableOrdered: return "ordered";
+      case ReliableUnordered: return "unordered";
+      default: return "unreliable";
+    }
+}
+
+class SstBenchmark {
+    IOService*mIO;
+    boost::thread*mThread;
+    StreamListener*mListener;
+    boost::mutex mMutex;
+    boost::condition_variable mProgress;
+    std::vector<Stream*> mAcceptedStreams;
+    std::vector<int64> mLatencies;
+    uint64 mBytesReceived;
+    unsigned int mReceived;
+    unsigned int mLost;
+    bool mConnectFailed;
+
+    void listenerNewStream(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (!newStream) return;
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mAcceptedStreams.push_back(newStream);
+        }
+        setCallbacks(&Stream::ignoreConnectionStatus,
+                     std::tr1::bind(&SstBenchmark::bytesReceived,this,_1));
+    }
+    void bytesReceived(const Chunk&data) {
+        Task::AbsTime now=Task::AbsTime::now();
+        uint64 sent=0;
+        if (data.size()>=sizeof(sent))
+            memcpy(&sent,&data[0],sizeof(sent));
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        mLatencies.push_back((now-Task::AbsTime::microseconds(sent)).toMicroseconds());
+        mBytesReceived+=data.size();
+        ++mReceived;
+        mProgress.notify_all();
+    }
+    void connectionStatus(Stream::ConnectionStatus status, const std::string&reason) {
+        if (status==Stream::ConnectionFailed) {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            fprintf(stderr,"Connection failed: %s\n",reason.c_str());
+            mConnectFailed=true;
+            mProgress.notify_all();
+        }
+    }
+    ///Waits until at most maxOutstanding of sent messages are unaccounted for; unreliable messages that never arrive are eventually counted lost
+    bool waitForReceiver(unsigned int sent, unsigned int maxOutstanding) {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        unsigned int lastReceived=mReceived;
+        while (!mConnectFailed) {
+            if (mReceived+mLost>sent)//a message given up on turned up after all
+                mLost=sent-mReceived;
+            if (sent-mReceived-mLost<=maxOutstanding)
+                break;
+            if (!mProgress.timed_wait(lock,boost::posix_time::seconds(1))&&mReceived==lastReceived) {
+                mLost=sent-mReceived-maxOutstanding;
+            }
+            lastReceived=mReceived;
+        }
+        return !mConnectFailed;
+    }
+    static int64 percentile(const std::vector<int64>&sorted, double fraction) {
+        if (sorted.empty()) return 0;
+        size_t index=(size_t)(fraction*(sorted.size()-1)+0.5);
+        return sorted[index];
+    }
+public:
+    SstBenchmark():mIO(IOServiceFactory::makeIOService()),mThread(NULL),mListener(NULL) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        mListener=StreamListenerFactory::getSingleton().getConstructor("tcpsst")(mIO);
+        mListener->listen(Address("127.0.0.1",port->as<String>()),
+                          std::tr1::bind(&SstBenchmark::listenerNewStream,this,_1,_2));
+        mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO));
+    }
+    ~SstBenchmark() {
+        mListener->close();
+        IOServiceFactory::stopService(mIO);
+        mThread->join();
+        delete mThread;
+        delete mListener;
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    bool run(unsigned int messageSize, unsigned int numSubstreams, StreamReliability reliability, unsigned int numConnections) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        OptionSet::getOptions("tcpsst")->parse("--parallel-sockets "+boost::lexical_cast<std::string>(numConnections));
+        unsigned int numMessages=messages->as<unsigned int>();
+        unsigned int maxOutstanding=window->as<unsigned int>();
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            mLatencies.clear();
+            mLatencies.reserve(numMessages);
+            mBytesReceived=0;
+            mReceived=0;
+            mLost=0;
+            mConnectFailed=false;
+        }
+        std::vector<Stream*> streams;
+        streams.push_back(StreamFactory::getSingleton().getConstructor("tcpsst")(mIO));
+        streams[0]->connect(Address("127.0.0.1",port->as<String>()),
+                            &Stream::ignoreSubstreamCallback,
+                            std::tr1::bind(&SstBenchmark::connectionStatus,this,_1,_2),
+                            &Stream::ignoreBytesReceived);
+        while (streams.size()<numSubstreams) {
+            streams.push_back(streams[0]->clone(std::tr1::bind(&SstBenchmark::connectionStatus,this,_1,_2),
+                                                &Stream::ignoreBytesReceived));
+        }
+        Chunk payload(messageSize<sizeof(uint64)?sizeof(uint64):messageSize,'x');
+        Task::AbsTime start=Task::AbsTime::now();
+        bool ok=true;
+        for (unsigned int i=0;ok&&i<numMessages;++i) {
+            uint64 now=Task::AbsTime::now().raw();
+            memcpy(&payload[0],&now,sizeof(now));
+            streams[i%streams.size()]->send(payload,reliability);
+            ok=waitForReceiver(i+1,maxOutstanding);
+        }
+        if (ok)
+            ok=waitForReceiver(numMessages,0);
+        double seconds=(Task::AbsTime::now()-start).toSeconds();
+        for (size_t i=0;i<streams.size();++i) {
+            streams[i]->close();
+            delete streams[i];
+        }
+        std::vector<Stream*> accepted;
+        std::vector<int64> latencies;
+        uint64 bytesReceived;
+        unsigned int received,lost;
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            accepted.swap(mAcceptedStreams);
+            latencies.swap(mLatencies);
+            bytesReceived=mBytesReceived;
+            received=mReceived;
+            lost=mLost;
+        }
+        for (size_t i=0;i<accepted.size();++i) {
+            accepted[i]->close();
+            delete accepted[i];
+        }
+        std::sort(latencies.begin(),latencies.end());
+        if (seconds<=0) seconds=1.0e-6;
+        printf("%8u %10u %10s %11u %12.0f %10.2f %9lld %9lld %9lld %6u\n",
+               messageSize,numSubstreams,reliabilityName(reliability),numConnections,
+               received/seconds,bytesReceived/seconds/(1024.0*1024.0),
+               (long long)percentile(latencies,0.5),(long long)percentile(latencies,0.99),(long long)percentile(latencies,0.999),
+               lost);
+        fflush(stdout);
+        return ok;
+    }
+};
+}
+
+int main(int argc, const char**argv) {
+    PluginManager plugins;
+    plugins.load(DynamicLibrary::filename("tcpsst"));
+    OptionSet::getOptions("sstbench")->parse(argc,argv);
+
+    std::vector<unsigned int> messageSizes=parseCounts(sizes->as<String>());
+    std::vector<unsigned int> substreamCounts=parseCounts(substreams->as<String>());
+    std::vector<StreamReliability> modes=parseReliabilities(reliabilities->as<String>());
+    std::vector<unsigned int> connectionCounts=parseCounts(connections->as<String>());
+
+    printf("%8s %10s %10s %11s %12s %10s %9s %9s %9s %6s\n",
+           "size","substreams","mode","connections","msgs/sec","MB/sec","p50(us)","p99(us)","p999(us)","lost");
+    int retval=0;
+    {
+        SstBenchmark benchmark;
+        for (size_t c=0;c<connectionCounts.size();++c)
+            for (size_t m=0;m<modes.size();++m)
+                for (size_t s=0;s<substreamCounts.size();++s)
+                    for (size_t z=0;z<messageSizes.size();++z)
+                        if (!benchmark.run(messageSizes[z],substreamCounts[s],modes[m],connectionCounts[c]))
+                            retval=1;
+    }
+    return retval;
+}
@@ -47,8 +47,12 @@ class SstTest : public CxxTest::TestSuite
 public:
     void runRoutine(Stream* s) {
         for (unsigned int i=0;i<mMessagesToSend.size();++i) {
-            s->send(Chunk(mMessagesToSend[i].begin(),mMessagesToSend[i].end()),
-                    mMessagesToSend[i].size()?(mMessagesToSend[i][0]=='U'?ReliableUnordered:(mMessagesToSend[i][0]=='X'?Unreliable:ReliableOrdered)):ReliableOrdered);
+            StreamReliability reliability=mMessagesToSend[i].size()?(mMessagesToSend[i][0]=='U'?ReliableUnordered:(mMessagesToSend[i][0]=='X'?Unreliable:ReliableOrdered)):ReliableOrdered;
+            //alternate between copied and shared payloads so both send paths see the same traffic
+            if (i%2)
+                s->send(Stream::SharedChunk(new Chunk(mMessagesToSend[i].begin(),mMessagesToSend[i].end())),reliability);
+            else
+                s->send(Chunk(mMessagesToSend[i].begin(),mMessagesToSend[i].end()),reliability);
         }
     }
     ///this will only be calledback if main connection fails--which means that secondary stream rather than answerer to secondary stream will fail
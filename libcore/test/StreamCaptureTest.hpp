@@ -0,0 +1,95 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  StreamCaptureTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "network/StreamCapture.hpp"
+#include <cstdio>
+using namespace Sirikata;
+class StreamCaptureTest : public CxxTest::TestSuite
+{
+    static Network::Chunk chunkOf(const char *data) {
+        return Network::Chunk(data,data+strlen(data));
+    }
+public:
+    void testRoundTrip( void )
+    {
+        String filename="stream_capture_test.cap";
+        int first=1,second=2;
+        {
+            Network::StreamCaptureWriter writer;
+            TS_ASSERT(writer.open(filename));
+            writer.received(&first,chunkOf("hello"));
+            writer.received(&second,chunkOf(""));
+            writer.closed(&first);
+            // the same address after a close is a new stream
+            writer.received(&first,Network::Chunk(300,'x'));
+        }
+        Network::StreamCaptureReader reader;
+        TS_ASSERT(reader.open(filename));
+        Network::StreamCaptureReader::Record record;
+        uint64 lastTime=0;
+
+        TS_ASSERT(reader.next(record));
+        TS_ASSERT_EQUALS(record.mKind,Network::StreamCaptureReader::Record::DATA);
+        TS_ASSERT_EQUALS(record.mStream,0u);
+        TS_ASSERT(record.mData==chunkOf("hello"));
+        lastTime=record.mTime;
+
+        TS_ASSERT(reader.next(record));
+        TS_ASSERT_EQUALS(record.mStream,1u);
+        TS_ASSERT(record.mData.empty());
+        TS_ASSERT(record.mTime>=lastTime);
+        lastTime=record.mTime;
+
+        TS_ASSERT(reader.next(record));
+        TS_ASSERT_EQUALS(record.mKind,Network::StreamCaptureReader::Record::CLOSED);
+        TS_ASSERT_EQUALS(record.mStream,0u);
+        TS_ASSERT(record.mTime>=lastTime);
+
+        TS_ASSERT(reader.next(record));
+        TS_ASSERT_EQUALS(record.mKind,Network::StreamCaptureReader::Record::DATA);
+        TS_ASSERT_EQUALS(record.mStream,2u);
+        TS_ASSERT(record.mData==Network::Chunk(300,'x'));
+
+        TS_ASSERT(!reader.next(record));
+        remove(filename.c_str());
+    }
+    void testRejectsOtherFiles( void )
+    {
+        String filename="stream_capture_test.txt";
+        FILE *file=fopen(filename.c_str(),"wb");
+        fputs("not a capture",file);
+        fclose(file);
+        Network::StreamCaptureReader reader;
+        TS_ASSERT(!reader.open(filename));
+        remove(filename.c_str());
+    }
+};
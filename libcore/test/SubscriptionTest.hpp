@@ -44,6 +44,7 @@
 #include "subscription/Server.hpp"
 #include "subscription/SubscriptionClient.hpp"
 #include "subscription/Broadcast.hpp"
+#include "subscription/Relay.hpp"
 #include <cxxtest/TestSuite.h>
 #include <boost/thread.hpp>
 #include <time.h>
@@ -51,6 +52,7 @@ using namespace Sirikata;
 using namespace Sirikata::Network;
 static unsigned char g_tarray[16]={1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,0};
 static unsigned char g_oarray[16]={2,2,2,2, 2,2,2,2, 2,2,2,2, 2,2,2,0};
+static unsigned char g_darray[16]={3,3,3,3, 3,3,3,3, 3,3,3,3, 3,3,3,0};
 class SubscriptionTest : public CxxTest::TestSuite
 {
     bool mDisconnected;
@@ -67,6 +69,13 @@ class SubscriptionTest : public CxxTest::TestSuite
         }
         ++mSubInitStage[whichIndex];
     }
+    std::vector<Network::Chunk> mDeltaReceived;
+    void deltaCallback(const Network::Chunk&c){
+        if (!c.empty()) {
+            mDeltaReceived.push_back(c);
+            ++mSubInitStage[2];
+        }
+    }
     void subscriptionDiscon(int whichIndex){
         mSubInitStage[whichIndex]+=(1<<30);
     }
@@ -193,4 +202,65 @@ public:
         }
         TS_ASSERT_EQUALS(mSubInitStage[1].read(),1);       
     }
+    void testDeltaSubscribe(){
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+        using namespace Sirikata::Subscription;
+        UUID dBroadcastUUID(g_darray,sizeof(g_darray));
+        Protocol::Subscribe deltaSubscription(mSubscriptionMessage);
+        deltaSubscription.set_broadcast_name(dBroadcastUUID);
+        deltaSubscription.set_update_period(Duration::microseconds(0));
+        deltaSubscription.set_delta_updates(true);
+        std::string serialized;
+        deltaSubscription.SerializeToString(&serialized);
+        std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription> deltaSub
+            =mSub->subscribe(serialized,
+                             std::tr1::bind(&SubscriptionTest::deltaCallback,this,_1),
+                             std::tr1::bind(&SubscriptionTest::subscriptionDiscon,this,2));
+        Broadcast::BroadcastStream *dBroadcast=mBroad->establishBroadcast(mBroadcastAddress,
+                                                                         dBroadcastUUID,
+                                                                         std::tr1::bind(&SubscriptionTest::broadcastCallback,this,_2,_3));
+        //a slowly changing message followed by one that grows: each must arrive exactly as sent
+        std::vector<std::string> messages;
+        messages.push_back(std::string(1024,'a'));
+        messages.push_back(std::string(1024,'a'));
+        messages.back()[17]='b';
+        messages.back()[900]='c';
+        messages.push_back(messages.back()+std::string(100,'d'));
+        for (size_t i=0;i<messages.size();++i) {
+            for (int j=0;j<30&&mSubInitStage[2].read()<(int)i;++j) {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+            }
+            (*dBroadcast)->send(MemoryReference(messages[i]),Network::ReliableOrdered);
+        }
+        for (int j=0;j<30&&mSubInitStage[2].read()<(int)messages.size();++j) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        }
+        TS_ASSERT_EQUALS(mSubInitStage[2].read(),(int)messages.size());
+        for (size_t i=0;i<messages.size()&&i<mDeltaReceived.size();++i) {
+            TS_ASSERT_EQUALS(std::string(mDeltaReceived[i].begin(),mDeltaReceived[i].end()),messages[i]);
+        }
+        deltaSub=std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>();
+        delete dBroadcast;
+    }
+    void testRelayTreeShape(){
+        using Sirikata::Subscription::Relay;
+        TS_ASSERT_EQUALS(Relay::parentIndex(0,3),0u);
+        //every server but the root has a parent earlier in the list, and no parent feeds more than degree children
+        std::vector<size_t> children(40,0);
+        for (size_t i=1;i<children.size();++i) {
+            size_t parent=Relay::parentIndex(i,3);
+            TS_ASSERT(parent<i);
+            ++children[parent];
+        }
+        for (size_t i=0;i<children.size();++i) {
+            TS_ASSERT(children[i]<=3);
+        }
+        //depth grows with the log of the audience
+        size_t depth=0;
+        for (size_t i=children.size()-1;i;i=Relay::parentIndex(i,3))
+            ++depth;
+        TS_ASSERT(depth<=4);
+    }
 };
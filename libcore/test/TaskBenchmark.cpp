@@ -0,0 +1,414 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  TaskBenchmark.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "util/AtomicTypes.hpp"
+#include "util/LockFreeQueue.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "util/SPSCRingBuffer.hpp"
+#include "task/WorkQueue.hpp"
+#include "task/EventManager.hpp"
+#include "task/TimerQueue.hpp"
+#include "task/Time.hpp"
+#include "options/Options.hpp"
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Standalone microbenchmark for the libcore task primitives: push/pop
+ * throughput of the queues and WorkQueues under every producer/consumer
+ * count given on the command line, fire-to-listener latency through a
+ * GenEventManager, and the cost of scheduling, unscheduling and firing
+ * TimerQueue events. Results are written as one JSON document so runs can
+ * be compared against a saved baseline.
+ */
+using namespace Sirikata;
+
+namespace {
+OptionValue*threads;
+OptionValue*items;
+OptionValue*events;
+OptionValue*timers;
+OptionValue*repeat;
+OptionValue*output;
+InitializeGlobalOptions o("taskbench",
+                    threads=new OptionValue("threads","1,2,4",OptionValueType<String>(),"Comma separated counts of producer and consumer threads; every pairing is run"),
+                    items=new OptionValue("items","1000000",OptionValueType<unsigned int>(),"Items pushed through each queue per run"),
+                    events=new OptionValue("events","200000",OptionValueType<unsigned int>(),"Events fired for the EventManager latency run"),
+                    timers=new OptionValue("timers","200000",OptionValueType<unsigned int>(),"Timers scheduled for the TimerQueue runs"),
+                    repeat=new OptionValue("repeat","3",OptionValueType<unsigned int>(),"Runs of each case; the median is reported"),
+                    output=new OptionValue("output","",OptionValueType<String>(),"File the JSON results are written to, standard output if empty"),
+                    NULL);
+
+std::vector<unsigned int> parseCounts(const String&list) {
+    std::vector<unsigned int> retval;
+    String::size_type pos=0;
+    while (pos<list.length()) {
+        String::size_type comma=list.find(',',pos);
+        if (comma==String::npos) comma=list.length();
+        unsigned int value=(unsigned int)strtoul(list.substr(pos,comma-pos).c_str(),NULL,10);
+        if (value) retval.push_back(value);
+        pos=comma+1;
+    }
+    return retval;
+}
+
+double median(std::vector<double> samples) {
+    if (samples.empty()) return 0;
+    std::sort(samples.begin(),samples.end());
+    return samples[samples.size()/2];
+}
+
+int64 percentile(const std::vector<int64>&sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index=(size_t)(fraction*(sorted.size()-1));
+    return sorted[index];
+}
+
+/// Collects results and writes them out as a JSON array of flat objects.
+class JsonResults {
+    std::vector<String> mRecords;
+    String mCurrent;
+public:
+    void begin(const String&kind, const String&name) {
+        mCurrent="{\"kind\":\""+kind+"\",\"name\":\""+name+"\"";
+    }
+    void field(const char*key, double value) {
+        char buffer[64];
+        snprintf(buffer,sizeof(buffer),"%.6g",value);
+        mCurrent+=String(",\"")+key+"\":"+buffer;
+    }
+    void end() {
+        mRecords.push_back(mCurrent+"}");
+        fprintf(stderr,"%s\n",mRecords.back().c_str());
+    }
+    void write(FILE*fp) const {
+        fprintf(fp,"{\"benchmark\":\"taskbench\",\"results\":[\n");
+        for (size_t i=0;i<mRecords.size();++i)
+            fprintf(fp,"  %s%s\n",mRecords[i].c_str(),i+1<mRecords.size()?",":"");
+        fprintf(fp,"]}\n");
+    }
+};
+
+/// Holds every thread of a run at the starting line so thread creation is not timed.
+class StartGate {
+    boost::barrier mBarrier;
+public:
+    StartGate(unsigned int threads):mBarrier(threads) {}
+    void wait() {
+        mBarrier.wait();
+    }
+};
+
+template <class Queue> void queueProducer(Queue*queue, StartGate*gate, unsigned int count) {
+    gate->wait();
+    for (unsigned int i=0;i<count;++i)
+        queue->push(i+1);
+}
+template <class Queue> void queueConsumer(Queue*queue, StartGate*gate, AtomicValue<int>*remaining) {
+    gate->wait();
+    unsigned int value;
+    while (remaining->read()>0) {
+        if (queue->pop(value))
+            --*remaining;
+        else
+            boost::this_thread::yield();
+    }
+}
+
+/// Pushes total items through queue with the given threads, returns the seconds it took.
+template <class Queue> double runQueue(Queue&queue, unsigned int producers, unsigned int consumers, unsigned int total) {
+    AtomicValue<int> remaining(total);
+    StartGate gate(producers+consumers+1);
+    std::vector<boost::thread*> workers;
+    for (unsigned int i=0;i<producers;++i) {
+        unsigned int share=total/producers+(i<total%producers?1:0);
+        workers.push_back(new boost::thread(std::tr1::bind(&queueProducer<Queue>,&queue,&gate,share)));
+    }
+    for (unsigned int i=0;i<consumers;++i)
+        workers.push_back(new boost::thread(std::tr1::bind(&queueConsumer<Queue>,&queue,&gate,&remaining)));
+    gate.wait();
+    Task::AbsTime start=Task::AbsTime::now();
+    for (size_t i=0;i<workers.size();++i) {
+        workers[i]->join();
+        delete workers[i];
+    }
+    return (Task::AbsTime::now()-start).toSeconds();
+}
+
+/// Does nothing but count, so only the WorkQueue itself is measured. The same item is enqueued over and over.
+class CountItem : public Task::WorkItem {
+    AtomicValue<int>*mRemaining;
+public:
+    CountItem(AtomicValue<int>*remaining):mRemaining(remaining) {}
+    virtual void operator()() {
+        --*mRemaining;
+    }
+};
+
+void workProducer(Task::WorkQueue*queue, StartGate*gate, Task::WorkItem*item, unsigned int count) {
+    gate->wait();
+    for (unsigned int i=0;i<count;++i)
+        queue->enqueue(item);
+}
+void workConsumer(Task::WorkQueue*queue, StartGate*gate, AtomicValue<int>*remaining) {
+    gate->wait();
+    while (remaining->read()>0) {
+        if (!queue->dequeuePoll())
+            boost::this_thread::yield();
+    }
+}
+
+double runWorkQueue(Task::WorkQueue&queue, unsigned int producers, unsigned int consumers, unsigned int total) {
+    AtomicValue<int> remaining(total);
+    CountItem item(&remaining);
+    StartGate gate(producers+consumers+1);
+    std::vector<boost::thread*> workers;
+    for (unsigned int i=0;i<producers;++i) {
+        unsigned int share=total/producers+(i<total%producers?1:0);
+        workers.push_back(new boost::thread(std::tr1::bind(&workProducer,&queue,&gate,&item,share)));
+    }
+    for (unsigned int i=0;i<consumers;++i)
+        workers.push_back(new boost::thread(std::tr1::bind(&workConsumer,&queue,&gate,&remaining)));
+    gate.wait();
+    Task::AbsTime start=Task::AbsTime::now();
+    for (size_t i=0;i<workers.size();++i) {
+        workers[i]->join();
+        delete workers[i];
+    }
+    return (Task::AbsTime::now()-start).toSeconds();
+}
+
+void reportThroughput(JsonResults&results, const char*kind, const char*name,
+                      unsigned int producers, unsigned int consumers,
+                      unsigned int total, const std::vector<double>&seconds) {
+    double elapsed=median(seconds);
+    results.begin(kind,name);
+    results.field("producers",producers);
+    results.field("consumers",consumers);
+    results.field("items",total);
+    results.field("seconds",elapsed);
+    results.field("ops_per_sec",elapsed>0?total/elapsed:0);
+    results.end();
+}
+
+template <class Queue> void benchQueue(JsonResults&results, const char*name,
+                                       const std::vector<unsigned int>&counts,
+                                       unsigned int total, unsigned int runs) {
+    for (size_t p=0;p<counts.size();++p)
+        for (size_t c=0;c<counts.size();++c) {
+            std::vector<double> seconds;
+            for (unsigned int r=0;r<runs;++r) {
+                Queue queue;
+                seconds.push_back(runQueue(queue,counts[p],counts[c],total));
+            }
+            reportThroughput(results,"queue",name,counts[p],counts[c],total,seconds);
+        }
+}
+
+template <class WorkQueueType> void benchWorkQueue(JsonResults&results, const char*name,
+                                                   const std::vector<unsigned int>&counts,
+                                                   unsigned int total, unsigned int runs,
+                                                   bool singleProducer) {
+    for (size_t p=0;p<counts.size();++p)
+        for (size_t c=0;c<counts.size();++c) {
+            if (singleProducer&&(counts[p]!=1||counts[c]!=1))
+                continue;
+            std::vector<double> seconds;
+            for (unsigned int r=0;r<runs;++r) {
+                WorkQueueType queue;
+                seconds.push_back(runWorkQueue(queue,counts[p],counts[c],total));
+            }
+            reportThroughput(results,"workqueue",name,counts[p],counts[c],total,seconds);
+        }
+}
+
+void benchWorkStealing(JsonResults&results, const std::vector<unsigned int>&counts,
+                       unsigned int total, unsigned int runs) {
+    for (size_t p=0;p<counts.size();++p)
+        for (size_t c=0;c<counts.size();++c) {
+            std::vector<double> seconds;
+            for (unsigned int r=0;r<runs;++r) {
+                Task::WorkStealingWorkQueue queue(counts[c]);
+                seconds.push_back(runWorkQueue(queue,counts[p],counts[c],total));
+            }
+            reportThroughput(results,"workqueue","WorkStealingWorkQueue",counts[p],counts[c],total,seconds);
+        }
+}
+
+/// Carries the time it was fired so the listener can measure the delivery latency.
+class StampedEvent : public Task::Event {
+public:
+    Task::AbsTime mFired;
+    StampedEvent():Event(Task::IdPair("Bench",0)),mFired(Task::AbsTime::now()) {}
+};
+
+class LatencyListener {
+    std::vector<int64>&mLatencies;
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+public:
+    LatencyListener(std::vector<int64>&latencies):mLatencies(latencies) {
+    }
+    Task::EventResponse receive(const Task::GenEventManager::EventPtr&ev) {
+        int64 latency=(Task::AbsTime::now()-static_cast<StampedEvent*>(&*ev)->mFired).toMicroseconds();
+        boost::mutex::scoped_lock lock(mMutex);
+        mLatencies.push_back(latency);
+        mDone.notify_all();
+        return Task::EventResponse::nop();
+    }
+    void waitFor(size_t received) {
+        boost::mutex::scoped_lock lock(mMutex);
+        while (mLatencies.size()<received)
+            mDone.wait(lock);
+    }
+};
+
+/**
+ * Fires count events from this thread while one worker thread dispatches them.
+ * With oneInFlight each event is delivered before the next is fired, which
+ * gives the unloaded latency rather than the time spent queued behind a burst.
+ */
+void benchEvents(JsonResults&results, unsigned int count, unsigned int runs, bool oneInFlight) {
+    std::vector<double> seconds;
+    std::vector<int64> latencies;
+    for (unsigned int r=0;r<runs;++r) {
+        std::vector<int64> runLatencies;
+        runLatencies.reserve(count);
+        Task::ThreadSafeWorkQueue queue;
+        Task::GenEventManager manager(&queue);
+        LatencyListener listener(runLatencies);
+        manager.subscribe(Task::IdPair("Bench",0),
+                          std::tr1::bind(&LatencyListener::receive,&listener,std::tr1::placeholders::_1));
+        Task::WorkQueueThread*dispatcher=queue.createWorkerThreads(1);
+        Task::AbsTime start=Task::AbsTime::now();
+        for (unsigned int i=0;i<count;++i) {
+            manager.fire(Task::GenEventManager::EventPtr(new StampedEvent));
+            if (oneInFlight)
+                listener.waitFor(i+1);
+        }
+        listener.waitFor(count);
+        seconds.push_back((Task::AbsTime::now()-start).toSeconds());
+        queue.destroyWorkerThreads(dispatcher);
+        latencies.insert(latencies.end(),runLatencies.begin(),runLatencies.end());
+    }
+    std::sort(latencies.begin(),latencies.end());
+    double elapsed=median(seconds);
+    results.begin("event",oneInFlight?"GenEventManager fire one in flight":"GenEventManager fire burst");
+    results.field("events",count);
+    results.field("seconds",elapsed);
+    results.field("events_per_sec",elapsed>0?count/elapsed:0);
+    results.field("latency_p50_us",(double)percentile(latencies,.5));
+    results.field("latency_p99_us",(double)percentile(latencies,.99));
+    results.field("latency_p999_us",(double)percentile(latencies,.999));
+    results.end();
+}
+
+Task::DeltaTime oneShot(unsigned int*fired) {
+    ++*fired;
+    return Task::DeltaTime::seconds(-1);
+}
+
+/// Schedules count one-shot timers spread over a minute, then ticks a simulated clock through them.
+void benchTimers(JsonResults&results, unsigned int count, unsigned int runs) {
+    std::vector<double> scheduleNs, unscheduleNs, fireNs;
+    for (unsigned int r=0;r<runs;++r) {
+        Task::TimerQueue queue("--granularity=1ms");
+        Task::AbsTime base=Task::AbsTime::now();
+        unsigned int fired=0;
+        srand(r+1);
+        std::vector<Task::AbsTime> due(count,base);
+        for (unsigned int i=0;i<count;++i)
+            due[i]=base+Task::DeltaTime::microseconds(1000+(int64)(rand()%60000)*1000);
+
+        Task::AbsTime start=Task::AbsTime::now();
+        std::vector<Task::SubscriptionId> ids;
+        ids.reserve(count);
+        for (unsigned int i=0;i<count;++i)
+            ids.push_back(queue.scheduleId(due[i],std::tr1::bind(&oneShot,&fired)));
+        scheduleNs.push_back((Task::AbsTime::now()-start).toSeconds()*1.0e9/count);
+
+        start=Task::AbsTime::now();
+        for (unsigned int i=0;i<count;i+=2)
+            queue.unschedule(ids[i]);
+        unscheduleNs.push_back((Task::AbsTime::now()-start).toSeconds()*1.0e9/((count+1)/2));
+
+        unsigned int remaining=queue.size();
+        start=Task::AbsTime::now();
+        for (int64 ms=0;ms<=61000;++ms)
+            queue.tick(base+Task::DeltaTime::microseconds(ms*1000));
+        double elapsed=(Task::AbsTime::now()-start).toSeconds();
+        fireNs.push_back(remaining?elapsed*1.0e9/remaining:0);
+        if (fired!=remaining)
+            fprintf(stderr,"TimerQueue fired %u of %u timers\n",fired,remaining);
+    }
+    results.begin("timer","TimerQueue");
+    results.field("timers",count);
+    results.field("schedule_ns",median(scheduleNs));
+    results.field("unschedule_ns",median(unscheduleNs));
+    results.field("fire_ns",median(fireNs));
+    results.end();
+}
+
+}
+
+int main(int argc, const char**argv) {
+    OptionSet::getOptions("taskbench")->parse(argc,argv);
+
+    std::vector<unsigned int> counts=parseCounts(threads->as<String>());
+    unsigned int total=items->as<unsigned int>();
+    unsigned int runs=std::max(1u,repeat->as<unsigned int>());
+    JsonResults results;
+
+    benchQueue<LockFreeQueue<unsigned int> >(results,"LockFreeQueue",counts,total,runs);
+    benchQueue<ThreadSafeQueue<unsigned int> >(results,"ThreadSafeQueue",counts,total,runs);
+    benchWorkQueue<Task::ThreadSafeWorkQueue>(results,"ThreadSafeWorkQueue",counts,total,runs,false);
+    benchWorkQueue<Task::RealLockFreeWorkQueue>(results,"RealLockFreeWorkQueue",counts,total,runs,false);
+    benchWorkQueue<Task::SingleProducerWorkQueue>(results,"SingleProducerWorkQueue",counts,total,runs,true);
+    benchWorkStealing(results,counts,total,runs);
+    benchEvents(results,events->as<unsigned int>(),runs,false);
+    benchEvents(results,events->as<unsigned int>(),runs,true);
+    benchTimers(results,timers->as<unsigned int>(),runs);
+
+    const String&path=output->as<String>();
+    FILE*fp=path.empty()?stdout:fopen(path.c_str(),"w");
+    if (!fp) {
+        fprintf(stderr,"Unable to open %s\n",path.c_str());
+        return 1;
+    }
+    results.write(fp);
+    if (fp!=stdout)
+        fclose(fp);
+    return 0;
+}
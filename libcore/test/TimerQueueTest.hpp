@@ -0,0 +1,88 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  TimerQueueTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "task/TimerQueue.hpp"
+using namespace Sirikata;
+class TimerQueueTestSuite : public CxxTest::TestSuite
+{
+    int mCount;
+    Duration countOnce() {
+        ++mCount;
+        return Duration::seconds(-1.0);
+    }
+    Duration countRepeating() {
+        ++mCount;
+        return Duration::milliseconds((int64)50);
+    }
+public:
+    void setUp( void ) {
+        mCount=0;
+    }
+    void testFireInOrder( void ) {
+        Task::TimerQueue queue("--granularity=10ms");
+        Task::AbsTime start=Task::AbsTime::now();
+        queue.schedule(start+Duration::milliseconds((int64)100),std::tr1::bind(&TimerQueueTestSuite::countOnce,this));
+        queue.schedule(start+Duration::seconds(10.0),std::tr1::bind(&TimerQueueTestSuite::countOnce,this));
+        // farther than one turn of the finest wheels, so it has to cascade down
+        queue.schedule(start+Duration::seconds(1000.0),std::tr1::bind(&TimerQueueTestSuite::countOnce,this));
+        TS_ASSERT_EQUALS(queue.size(),3u);
+        TS_ASSERT_EQUALS(queue.tick(start+Duration::milliseconds((int64)50)),0u);
+        TS_ASSERT_EQUALS(queue.tick(start+Duration::milliseconds((int64)200)),1u);
+        TS_ASSERT_EQUALS(queue.tick(start+Duration::seconds(999.0)),1u);
+        TS_ASSERT_EQUALS(mCount,2);
+        TS_ASSERT_EQUALS(queue.tick(start+Duration::seconds(1001.0)),1u);
+        TS_ASSERT_EQUALS(mCount,3);
+        TS_ASSERT_EQUALS(queue.size(),0u);
+    }
+    void testUnschedule( void ) {
+        Task::TimerQueue queue("--granularity=10ms");
+        Task::AbsTime start=Task::AbsTime::now();
+        Task::SubscriptionId id=queue.scheduleId(start+Duration::milliseconds((int64)100),std::tr1::bind(&TimerQueueTestSuite::countOnce,this));
+        queue.schedule(start+Duration::milliseconds((int64)100),std::tr1::bind(&TimerQueueTestSuite::countOnce,this));
+        queue.unschedule(id);
+        TS_ASSERT_EQUALS(queue.size(),1u);
+        TS_ASSERT_EQUALS(queue.tick(start+Duration::seconds(1.0)),1u);
+        TS_ASSERT_EQUALS(mCount,1);
+    }
+    void testRepeating( void ) {
+        Task::TimerQueue queue("--granularity=10ms");
+        Task::AbsTime start=Task::AbsTime::now();
+        Task::SubscriptionId id=queue.scheduleId(start,std::tr1::bind(&TimerQueueTestSuite::countRepeating,this));
+        for (int64 ms=0;ms<=1000;ms+=5) {
+            queue.tick(start+Duration::milliseconds(ms));
+        }
+        TS_ASSERT_EQUALS(mCount,20);
+        TS_ASSERT_EQUALS(queue.size(),1u);
+        queue.unschedule(id);
+        TS_ASSERT_EQUALS(queue.size(),0u);
+    }
+};
@@ -0,0 +1,69 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  TraceEventsTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/TraceEvents.hpp"
+#include <boost/thread.hpp>
+using namespace Sirikata;
+class TraceEventsTest : public CxxTest::TestSuite
+{
+    static void nested() {
+        SIRIKATA_TRACE_SCOPE("TraceEventsTest::outer");
+        SIRIKATA_TRACE_SCOPE("TraceEventsTest::inner");
+    }
+public:
+    void testIdleScopesAreDropped( void )
+    {
+        Trace::stop();
+        nested();
+        Trace::start();
+        std::ostringstream text;
+        Trace::dump(text);
+        Trace::stop();
+        TS_ASSERT(text.str().find("TraceEventsTest::outer")==std::string::npos);
+    }
+    void testDumpSpansThreads( void )
+    {
+        Trace::start();
+        nested();
+        boost::thread other(&TraceEventsTest::nested);
+        other.join();
+        std::ostringstream text;
+        Trace::dump(text);
+        Trace::stop();
+        String json=text.str();
+        TS_ASSERT_EQUALS(json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["),(size_t)0);
+        size_t first=json.find("\"name\":\"TraceEventsTest::outer\",\"ph\":\"X\"");
+        TS_ASSERT(first!=std::string::npos);
+        TS_ASSERT(json.find("\"name\":\"TraceEventsTest::outer\"",first+1)!=std::string::npos);
+        TS_ASSERT(json.find("\"name\":\"TraceEventsTest::inner\"")!=std::string::npos);
+    }
+};
@@ -0,0 +1,157 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  TransferSchedulerTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "transfer/EventTransferManager.hpp"
+#include "task/EventManager.hpp"
+#include "task/WorkQueue.hpp"
+
+using namespace Sirikata;
+
+class TransferSchedulerTest : public CxxTest::TestSuite {
+	typedef Transfer::RemoteFileId RemoteFileId;
+	typedef Transfer::Range Range;
+
+	/// Holds on to every request so the test decides when each one finishes.
+	class HoldingCacheLayer : public Transfer::CacheLayer {
+	public:
+		struct Request {
+			RemoteFileId fileId;
+			Transfer::TransferCallback callback;
+			Transfer::TransferPriority priority;
+		};
+		std::vector<Request> mRequests;
+		std::vector<Transfer::TransferPriority> mRaised;
+
+		HoldingCacheLayer() : Transfer::CacheLayer(NULL) {
+		}
+		virtual void getData(const RemoteFileId &fid, const Range &requestedRange,
+				const Transfer::TransferCallback &callback, Transfer::TransferPriority priority) {
+			Request req;
+			req.fileId = fid;
+			req.callback = callback;
+			req.priority = priority;
+			mRequests.push_back(req);
+		}
+		virtual void raisePriority(const RemoteFileId &fid, const Range &requestedRange, Transfer::TransferPriority priority) {
+			mRaised.push_back(priority);
+		}
+		void finish(size_t which) {
+			mRequests[which].callback(NULL);
+		}
+	};
+
+	Task::WorkQueue *mWorkQueue;
+	Task::GenEventManager *mEventSystem;
+	HoldingCacheLayer *mCacheLayer;
+	Transfer::EventTransferManager *mTransferManager;
+
+	static Task::EventResponse ignoreDownload(Task::EventPtr ev) {
+		return Task::EventResponse::del();
+	}
+	static RemoteFileId fileNamed(const char *name) {
+		return RemoteFileId(Transfer::Fingerprint::computeDigest(name, strlen(name)),
+				Transfer::URIContext("mhash","","",""));
+	}
+	void download(const char *name, Transfer::TransferPriority priority, const Time &deadline=Time::null()) {
+		mTransferManager->downloadByHash(fileNamed(name), &ignoreDownload, Range(true), priority, deadline);
+	}
+	bool requested(size_t which, const char *name) {
+		return which < mCacheLayer->mRequests.size() &&
+			mCacheLayer->mRequests[which].fileId.fingerprint() == fileNamed(name).fingerprint();
+	}
+public:
+	void setUp() {
+		mWorkQueue = new Task::ThreadSafeWorkQueue;
+		mEventSystem = new Task::GenEventManager(mWorkQueue);
+		mCacheLayer = new HoldingCacheLayer;
+		mTransferManager = new Transfer::EventTransferManager(mCacheLayer, NULL, mEventSystem, NULL, NULL, NULL);
+	}
+	void tearDown() {
+		mTransferManager->cleanup();
+		while (mWorkQueue->dequeuePoll()) {
+		}
+		delete mTransferManager;
+		delete mCacheLayer;
+		delete mEventSystem;
+		delete mWorkQueue;
+	}
+
+	void testPerClassLimit() {
+		mTransferManager->setConcurrencyLimit(Transfer::PREFETCH_PRIORITY, 2);
+		download("p1", Transfer::PREFETCH_PRIORITY);
+		download("p2", Transfer::PREFETCH_PRIORITY);
+		download("p3", Transfer::PREFETCH_PRIORITY);
+		TS_ASSERT_EQUALS(mCacheLayer->mRequests.size(), 2u);
+		// A full prefetch class does not hold up foreground downloads.
+		download("f1", Transfer::FOREGROUND_PRIORITY);
+		TS_ASSERT(requested(2, "f1"));
+		mCacheLayer->finish(0);
+		TS_ASSERT(requested(3, "p3"));
+		TS_ASSERT_EQUALS(mCacheLayer->mRequests[3].priority, Transfer::PREFETCH_PRIORITY);
+	}
+
+	void testDeadlineOrder() {
+		mTransferManager->setConcurrencyLimit(Transfer::FOREGROUND_PRIORITY, 1);
+		Time now = Time::now();
+		download("running", Transfer::FOREGROUND_PRIORITY);
+		download("whenever", Transfer::FOREGROUND_PRIORITY);
+		download("later", Transfer::FOREGROUND_PRIORITY, now + Duration::seconds(10));
+		download("soon", Transfer::FOREGROUND_PRIORITY, now + Duration::seconds(1));
+		TS_ASSERT_EQUALS(mCacheLayer->mRequests.size(), 1u);
+		mCacheLayer->finish(0);
+		TS_ASSERT(requested(1, "soon"));
+		mCacheLayer->finish(1);
+		TS_ASSERT(requested(2, "later"));
+		mCacheLayer->finish(2);
+		TS_ASSERT(requested(3, "whenever"));
+	}
+
+	void testReprioritize() {
+		mTransferManager->setConcurrencyLimit(Transfer::PREFETCH_PRIORITY, 1);
+		download("p1", Transfer::PREFETCH_PRIORITY);
+		download("p2", Transfer::PREFETCH_PRIORITY);
+		download("p3", Transfer::PREFETCH_PRIORITY);
+		TS_ASSERT_EQUALS(mCacheLayer->mRequests.size(), 1u);
+		// A queued prefetch moves straight to the foreground class.
+		mTransferManager->reprioritize(fileNamed("p3").uri(), Range(true), Transfer::FOREGROUND_PRIORITY);
+		TS_ASSERT(requested(1, "p3"));
+		TS_ASSERT_EQUALS(mCacheLayer->mRequests[1].priority, Transfer::FOREGROUND_PRIORITY);
+		// Asking for a running prefetch in the foreground tells the cache layers it is urgent.
+		download("p1", Transfer::CRITICAL_PRIORITY);
+		TS_ASSERT_EQUALS(mCacheLayer->mRequests.size(), 2u);
+		TS_ASSERT_EQUALS(mCacheLayer->mRaised.size(), 1u);
+		// p1 still holds its prefetch slot until it finishes.
+		mCacheLayer->finish(0);
+		TS_ASSERT(requested(2, "p2"));
+	}
+};
@@ -0,0 +1,73 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  UUIDTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/UUID.hpp"
+#include <boost/thread.hpp>
+namespace {
+void fillRandom(std::vector<Sirikata::UUID> *out, size_t count) {
+    for (size_t i=0;i<count;++i) {
+        out->push_back(Sirikata::UUID::random());
+    }
+}
+}
+class UUIDTest : public CxxTest::TestSuite
+{
+public:
+    void testRandomIsVersion4( void )
+    {
+        for (int i=0;i<100;++i) {
+            Sirikata::UUID fast=Sirikata::UUID::random();
+            Sirikata::UUID secure=Sirikata::UUID::secureRandom();
+            TS_ASSERT_EQUALS(fast.getArray()[6]&0xF0,0x40);
+            TS_ASSERT_EQUALS(fast.getArray()[8]&0xC0,0x80);
+            TS_ASSERT_EQUALS(secure.getArray()[6]&0xF0,0x40);
+            TS_ASSERT_EQUALS(secure.getArray()[8]&0xC0,0x80);
+            TS_ASSERT(!fast.isNil());
+        }
+    }
+    void testRandomUniqueAcrossThreads( void )
+    {
+        enum {THREADS=4,PER_THREAD=20000};
+        std::vector<Sirikata::UUID> generated[THREADS];
+        std::vector<boost::thread*> threads;
+        for (int i=0;i<THREADS;++i) {
+            threads.push_back(new boost::thread(std::tr1::bind(&fillRandom,&generated[i],(size_t)PER_THREAD)));
+        }
+        std::set<Sirikata::UUID> seen;
+        for (int i=0;i<THREADS;++i) {
+            threads[i]->join();
+            delete threads[i];
+            seen.insert(generated[i].begin(),generated[i].end());
+        }
+        TS_ASSERT_EQUALS(seen.size(),(size_t)(THREADS*PER_THREAD));
+    }
+};
@@ -0,0 +1,105 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  VectorKernelsTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/VectorKernels.hpp"
+class VectorKernelsTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::Vector3f Vector3f;
+    typedef Sirikata::Vector3d Vector3d;
+    typedef Sirikata::Quaternion Quaternion;
+    static bool near(const Vector3f &a, const Vector3f &b) {
+        return (a-b).length()<1e-4f;
+    }
+    static std::vector<Vector3f> somePoints(size_t count) {
+        std::vector<Vector3f> retval;
+        for (size_t i=0;i<count;++i) {
+            retval.push_back(Vector3f(i*.5f-3.f,1.f/(i+1),(float)(i%7)));
+        }
+        return retval;
+    }
+public:
+    void testTransformMatchesScalar( void )
+    {
+        Quaternion rotation(Vector3f(1,2,3).normal(),.7f);
+        Sirikata::Matrix3x3<float> matrix(rotation.xAxis(),rotation.yAxis(),rotation.zAxis(),Sirikata::COLUMNS());
+        Vector3f translation(10,-2,.5f);
+        std::vector<Vector3f> points=somePoints(13);
+        std::vector<Vector3f> out(points.size());
+        Sirikata::VectorKernels::transformPoints(matrix,translation,&points[0],&out[0],points.size());
+        for (size_t i=0;i<points.size();++i) {
+            TS_ASSERT(near(out[i],matrix*points[i]+translation));
+        }
+        // In place, rotating by the quaternion directly
+        std::vector<Vector3f> inPlace=points;
+        Sirikata::VectorKernels::rotatePoints(rotation,&inPlace[0],&inPlace[0],inPlace.size());
+        for (size_t i=0;i<points.size();++i) {
+            TS_ASSERT(near(inPlace[i],rotation*points[i]));
+        }
+    }
+    void testExtrapolateMatchesScalar( void )
+    {
+        std::vector<Vector3f> points=somePoints(11);
+        std::vector<Vector3f> velocity=somePoints(11);
+        std::vector<Vector3f> out(points.size());
+        Sirikata::VectorKernels::extrapolatePoints(&points[0],&velocity[0],.25f,&out[0],points.size());
+        std::vector<Vector3d> pointsd, velocityd;
+        for (size_t i=0;i<points.size();++i) {
+            TS_ASSERT(near(out[i],points[i]+velocity[i]*.25f));
+            pointsd.push_back(Vector3d(points[i]));
+            velocityd.push_back(Vector3d(velocity[i]));
+        }
+        Sirikata::VectorKernels::extrapolatePoints(&pointsd[0],&velocityd[0],2.,&pointsd[0],pointsd.size());
+        for (size_t i=0;i<points.size();++i) {
+            TS_ASSERT_EQUALS(pointsd[i],Vector3d(points[i])+Vector3d(velocity[i])*2.);
+        }
+    }
+    void testSlerp( void )
+    {
+        Quaternion from[3]={Quaternion::identity(),
+                            Quaternion(Vector3f(0,1,0),1.f),
+                            Quaternion(Vector3f(1,0,0),.2f)};
+        Quaternion to[3]={Quaternion(Vector3f(0,0,1),2.f),
+                          -Quaternion(Vector3f(0,1,0),1.f+1e-4f),
+                          Quaternion(Vector3f(1,0,0),1.8f)};
+        float t[3]={.5f,.5f,.25f};
+        Quaternion out[3];
+        Sirikata::VectorKernels::slerpQuaternions(from,to,t,out,3);
+        Quaternion expected[3]={Quaternion(Vector3f(0,0,1),1.f),
+                                Quaternion(Vector3f(0,1,0),1.f+5e-5f),
+                                Quaternion(Vector3f(1,0,0),.6f)};
+        for (int i=0;i<3;++i) {
+            float cosine=out[i].x*expected[i].x+out[i].y*expected[i].y+out[i].z*expected[i].z+out[i].w*expected[i].w;
+            TS_ASSERT(fabs(fabs(cosine)-1.f)<1e-4f);
+            TS_ASSERT(fabs(out[i].lengthSquared()-1.f)<1e-4f);
+        }
+    }
+};
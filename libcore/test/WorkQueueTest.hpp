@@ -0,0 +1,244 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  WorkQueueTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "task/WorkQueue.hpp"
+#include "util/AtomicTypes.hpp"
+#include "util/LockFreeQueue.hpp"
+#include "util/ThreadSafeQueue.hpp"
+using namespace Sirikata;
+class WorkQueueTestSuite : public CxxTest::TestSuite
+{
+    class CountItem : public Task::WorkItem {
+        AtomicValue<int> *mCount;
+    public:
+        CountItem(AtomicValue<int> *count):mCount(count) {}
+        virtual void operator()() {
+            AutoPtr deleteMe(this);
+            ++*mCount;
+        }
+    };
+    /// Enqueues another CountItem from inside a worker, so it lands on that worker's own deque
+    class SpawnItem : public Task::WorkItem {
+        Task::WorkQueue *mQueue;
+        AtomicValue<int> *mCount;
+    public:
+        SpawnItem(Task::WorkQueue *queue, AtomicValue<int> *count):mQueue(queue),mCount(count) {}
+        virtual void operator()() {
+            AutoPtr deleteMe(this);
+            mQueue->enqueue(new CountItem(mCount));
+            ++*mCount;
+        }
+    };
+    /// Checks that the items of one WorkLane run in order and never at the same time
+    class LaneItem : public Task::WorkItem {
+        AtomicValue<int> *mActive;
+        int *mNext;
+        int mIndex;
+        AtomicValue<int> *mErrors;
+        AtomicValue<int> *mCount;
+    public:
+        LaneItem(AtomicValue<int> *active, int *next, int index, AtomicValue<int> *errors, AtomicValue<int> *count)
+            :mActive(active),mNext(next),mIndex(index),mErrors(errors),mCount(count) {}
+        virtual void operator()() {
+            AutoPtr deleteMe(this);
+            if (++*mActive!=1 || *mNext!=mIndex || !Task::WorkLane::inLane()) {
+                ++*mErrors;
+            }
+            *mNext=mIndex+1;
+            --*mActive;
+            ++*mCount;
+        }
+    };
+    /// Appends its tag to a shared log, to check the order a queue ran items in
+    class TagItem : public Task::WorkItem {
+        std::vector<int> *mLog;
+        int mTag;
+    public:
+        TagItem(std::vector<int> *log, int tag):mLog(log),mTag(tag) {}
+        virtual void operator()() {
+            AutoPtr deleteMe(this);
+            mLog->push_back(mTag);
+        }
+    };
+    void checkBatch(Task::WorkQueue &queue) {
+        AtomicValue<int> count(0);
+        Task::WorkItem *items[50];
+        for (int i=0;i<50;++i) {
+            items[i]=new CountItem(&count);
+        }
+        queue.enqueueBatch(items,50);
+        TS_ASSERT_EQUALS(queue.probableSize(),50u);
+        TS_ASSERT_EQUALS(queue.dequeueUpTo(20),20u);
+        TS_ASSERT_EQUALS(count.read(),20);
+        TS_ASSERT_EQUALS(queue.probableSize(),30u);
+        TS_ASSERT_EQUALS(queue.dequeueUpTo(100),30u);
+        TS_ASSERT_EQUALS(count.read(),50);
+        TS_ASSERT_EQUALS(queue.probableSize(),0u);
+        TS_ASSERT_EQUALS(queue.dequeueUpTo(100),0u);
+    }
+public:
+    void testThreadSafeBatch( void ) {
+        Task::ThreadSafeWorkQueue queue;
+        checkBatch(queue);
+    }
+    void testLockFreeBatch( void ) {
+        Task::RealLockFreeWorkQueue queue;
+        checkBatch(queue);
+    }
+    void testWorkStealingBatch( void ) {
+        Task::WorkStealingWorkQueue queue(4);
+        checkBatch(queue);
+    }
+    void testPriorityBatch( void ) {
+        Task::PriorityWorkQueue queue;
+        checkBatch(queue);
+    }
+    void testPriorityOrder( void ) {
+        Task::PriorityWorkQueue queue(Task::DeltaTime::zero());
+        std::vector<int> log;
+        queue.enqueuePriority(new TagItem(&log,3),Task::PRIORITY_LOW);
+        queue.enqueue(new TagItem(&log,2));
+        queue.enqueuePriority(new TagItem(&log,1),Task::PRIORITY_HIGH);
+        queue.enqueuePriority(new TagItem(&log,4),Task::PRIORITY_LOW);
+        queue.enqueuePriority(new TagItem(&log,5),Task::PRIORITY_HIGH);
+        TS_ASSERT_EQUALS(queue.probableSize(Task::PRIORITY_LOW),2u);
+        TS_ASSERT_EQUALS(queue.dequeueAll(),5u);
+        TS_ASSERT_EQUALS(log.size(),5u);
+        int expected[5]={1,5,2,3,4};
+        for (size_t i=0;i<log.size()&&i<5;++i) {
+            TS_ASSERT_EQUALS(log[i],expected[i]);
+        }
+        TS_ASSERT(queue.probablyEmpty());
+    }
+    void testPriorityAging( void ) {
+        Task::PriorityWorkQueue queue(Task::DeltaTime::milliseconds((int64)1));
+        std::vector<int> log;
+        queue.enqueuePriority(new TagItem(&log,1),Task::PRIORITY_LOW);
+        Task::AbsTime start=Task::AbsTime::now();
+        while (Task::AbsTime::now()-start<Task::DeltaTime::milliseconds((int64)10)) {
+        }
+        // The low priority item has waited well past two aging steps, so it now outranks fresh urgent work.
+        queue.enqueuePriority(new TagItem(&log,2),Task::PRIORITY_HIGH);
+        TS_ASSERT(queue.dequeuePoll());
+        TS_ASSERT(queue.dequeuePoll());
+        TS_ASSERT(!queue.dequeuePoll());
+        TS_ASSERT_EQUALS(log.size(),2u);
+        if (log.size()==2) {
+            TS_ASSERT_EQUALS(log[0],1);
+            TS_ASSERT_EQUALS(log[1],2);
+        }
+    }
+    void testPriorityThreads( void ) {
+        Task::PriorityWorkQueue queue;
+        AtomicValue<int> count(0);
+        Task::WorkQueueThread *threads=queue.createWorkerThreads(4);
+        for (int i=0;i<1000;++i) {
+            queue.enqueuePriority(new CountItem(&count),(Task::WorkPriority)(i%Task::NUM_WORK_PRIORITIES));
+        }
+        while (count.read()<1000) {
+        }
+        queue.destroyWorkerThreads(threads);
+        TS_ASSERT_EQUALS(count.read(),1000);
+        TS_ASSERT(queue.probablyEmpty());
+    }
+    void testLockFreeQueuePopUpTo( void ) {
+        LockFreeQueue<int> queue;
+        int in[10]={0,1,2,3,4,5,6,7,8,9};
+        int out[10];
+        queue.pushBatch(in,7);
+        queue.push(7);
+        TS_ASSERT_EQUALS(queue.popUpTo(out,3),3u);
+        for (int i=0;i<3;++i) {
+            TS_ASSERT_EQUALS(out[i],i);
+        }
+        TS_ASSERT_EQUALS(queue.popUpTo(out,10),5u);
+        for (int i=0;i<5;++i) {
+            TS_ASSERT_EQUALS(out[i],i+3);
+        }
+        TS_ASSERT_EQUALS(queue.popUpTo(out,10),0u);
+    }
+    void testWorkStealingPoll( void ) {
+        Task::WorkStealingWorkQueue queue(4);
+        AtomicValue<int> count(0);
+        for (int i=0;i<100;++i) {
+            queue.enqueue(new CountItem(&count));
+        }
+        TS_ASSERT(!queue.probablyEmpty());
+        TS_ASSERT_EQUALS(queue.dequeueAll(),100u);
+        TS_ASSERT_EQUALS(count.read(),100);
+        TS_ASSERT(queue.probablyEmpty());
+        TS_ASSERT(!queue.dequeuePoll());
+    }
+    void testWorkStealingThreads( void ) {
+        Task::WorkStealingWorkQueue queue(4);
+        AtomicValue<int> count(0);
+        Task::WorkQueueThread *threads=queue.createWorkerThreads(4);
+        for (int i=0;i<1000;++i) {
+            queue.enqueue(new SpawnItem(&queue,&count));
+        }
+        while (count.read()<2000) {
+        }
+        queue.destroyWorkerThreads(threads);
+        TS_ASSERT_EQUALS(count.read(),2000);
+        TS_ASSERT(queue.probablyEmpty());
+    }
+    void testWorkLanes( void ) {
+        enum {NUM_LANES=8, NUM_ITEMS=500};
+        Task::WorkStealingWorkQueue queue(4);
+        AtomicValue<int> count(0);
+        AtomicValue<int> errors(0);
+        std::vector<AtomicValue<int> > active(NUM_LANES, AtomicValue<int>(0));
+        std::vector<int> next(NUM_LANES, 0);
+        std::vector<Task::WorkLane*> lanes;
+        for (int i=0;i<NUM_LANES;++i) {
+            lanes.push_back(new Task::WorkLane(&queue));
+        }
+        Task::WorkQueueThread *threads=queue.createWorkerThreads(4);
+        for (int j=0;j<NUM_ITEMS;++j) {
+            for (int i=0;i<NUM_LANES;++i) {
+                lanes[i]->enqueue(new LaneItem(&active[i],&next[i],j,&errors,&count));
+            }
+        }
+        // Destroying a lane must not drop what it still holds.
+        for (int i=0;i<NUM_LANES;++i) {
+            delete lanes[i];
+        }
+        while (count.read()<NUM_LANES*NUM_ITEMS) {
+        }
+        queue.destroyWorkerThreads(threads);
+        TS_ASSERT_EQUALS(errors.read(),0);
+        TS_ASSERT(!Task::WorkLane::inLane());
+        for (int i=0;i<NUM_LANES;++i) {
+            TS_ASSERT_EQUALS(next[i],(int)NUM_ITEMS);
+        }
+    }
+};
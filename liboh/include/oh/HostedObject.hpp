@@ -37,6 +37,8 @@
 #include "oh/TopLevelSpaceConnection.hpp"
 #include "oh/ProxyObject.hpp"
 #include "util/QueryTracker.hpp"
+#include "oh/PropertyStore.hpp"
+#include "util/HandleTable.hpp"
 
 namespace Sirikata {
 class ObjectHost;
@@ -52,6 +54,9 @@ class ObjLoc;
 using Protocol::ObjLoc;
 
 class ObjectScript;
+namespace Task {
+class WorkLane;
+}
 class HostedObject;
 typedef std::tr1::weak_ptr<HostedObject> HostedObjectWPtr;
 typedef std::tr1::shared_ptr<HostedObject> HostedObjectPtr;
@@ -67,11 +72,18 @@ protected:
     SpaceDataMap *mSpaceData;
 
     // name -> encoded property message
-    typedef std::map<String, String> PropertyMap;
-    PropertyMap mProperties;
+    PropertyStore mProperties;
+    bool mPropertyFlushQueued; ///< a flushPropertyUpdates() is waiting behind the queued work
     ObjectScript *mObjectScript;
     ObjectHost *mObjectHost;
     UUID mInternalObjectReference;
+    Task::WorkLane *mWorkLane; ///< NULL unless the ObjectHost has an objectLaneQueue()
+public:
+    /** Handles an RPC registered with registerRPCHandler.
+        @returns whether the ObjectScript should still be given the message. */
+    typedef std::tr1::function<bool(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue)> RPCHandler;
+protected:
+    SlotVector<RPCHandler> mRPCHandlers; ///< indexed by internRPCName()
 
 //------- Constructors/Destructors
 private:
@@ -88,6 +100,24 @@ private:
     void initializePythonScript();//FIXME this is a temporary function
 //------- Private member functions:
     PerSpaceData &cloneTopLevelStream(const SpaceID&,const std::tr1::shared_ptr<TopLevelSpaceConnection>&);
+    /// Asks the space to hand our registration over to the stream just cloned after a reconnect.
+    void sendResumeObj(const SpaceID&, const PerSpaceData&);
+    /// Runs the ObjectHost messages queued so far, unless called from a WorkLane thread which must leave that queue alone.
+    void dequeueHostMessages();
+    /// Schedules flushPropertyUpdates() after the work already queued for this object.
+    void queuePropertyFlush();
+
+    /// A built-in RPC: @returns whether the ObjectScript should see the message too.
+    typedef bool (HostedObject::*BuiltinRPC)(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    static SlotVector<BuiltinRPC> sBuiltinRPCs; ///< indexed by internRPCName()
+    bool processLocRequest(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processSetLoc(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processDelObj(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processResumeFailed(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processMigrateObj(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processRetObj(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processProxCallBatch(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
+    bool processProxCall(const RoutableMessageHeader &msg, MemoryReference args, String *returnValue, std::ostream &printstr);
 
 public:
 //------- Public member functions:
@@ -100,10 +130,14 @@ public:
     void initializeScript(const String&script, const std::map<String,String> &args);
     /// Attempt to restore this item from database including script [not implemented]
     void initializeRestoreFromDatabase(const SpaceID&spaceID, const HostedObjectPtr&spaceConnectionHint=HostedObjectPtr());
+    /// Restore this item from fields already read out of the database, e.g. by a bulk scan, keyed by field name
+    void initializeRestoreFromFields(const SpaceID&spaceID, const std::map<String,String>&fields, const HostedObjectPtr&spaceConnectionHint=HostedObjectPtr());
     /** Gets the ObjectHost (usually one per host).
         See getProxy(space)->getProxyManger() for the per-space object.
     */
     ObjectHost *getObjectHost()const {return mObjectHost;}
+    /// The lane this object's locally routed messages run on, or NULL if they run on the ObjectHost's queue.
+    Task::WorkLane *getWorkLane()const {return mWorkLane;}
 
     /// Gets the proxy object representing this HostedObject inside space.
     const ProxyObjectPtr &getProxy(const SpaceID &space) const;
@@ -130,6 +164,14 @@ public:
     void setProperty(const String &propName, const String &encodedValue=String());
     /// Deletes a public property from this object.
     void unsetProperty(const String &propName);
+    /// Sets a property like setProperty, and also writes it through to persistence with the next flush.
+    void writeProperty(const String &propName, const String &encodedValue);
+    /** Applies every property changed since the last flush to the proxies in each space,
+        and writes the ones from writeProperty to persistence in a single ReadWriteSet.
+        Runs by itself once the work queued for this object has drained, so the
+        changes of a frame go out as one batch.
+    */
+    void flushPropertyUpdates();
 
     //FIXME implement SpaceConnection& connect(const SpaceID&space);
     //FIXME implement SpaceConnection& connect(const SpaceID&space, const SpaceConnection&example);
@@ -195,6 +237,10 @@ public:
         @param body  An encoded RoutableMessageBody.
     */
     void send(const RoutableMessageHeader &header, MemoryReference body);
+    /** Same as above, but a locally destined message takes over body's buffer
+        rather than copying it into the ObjectHost's WorkQueue. body is left empty.
+    */
+    void send(const RoutableMessageHeader &header, String &body);
 
     /** Equivalent to header.swap_source_and_destination(); send(header, body);
         @see send.
@@ -204,6 +250,11 @@ public:
         replyHeader.swap_source_and_destination();
         send(replyHeader, body);
     }
+    void sendReply(const RoutableMessageHeader &origHdr, String &body) {
+        RoutableMessageHeader replyHeader(origHdr);
+        replyHeader.swap_source_and_destination();
+        send(replyHeader, body);
+    }
 
     /** Equivalent to header.swap_source_and_destination();
         header.set_return_status(error); send(header, NULL);
@@ -225,6 +276,12 @@ public:
         @see ReceivedMessage
     */
     void processRPC(const RoutableMessageHeader &msg, const std::string &name, MemoryReference args, String *returnValue);
+    /// Gives name the small integer RPC tables are indexed by; the same name always gets the same one.
+    static uint32 internRPCName(const String &name);
+    /** Routes the named RPC to handler ahead of the built-in handling, replacing
+        any handler registered for it before. Call from the object's own thread. */
+    void registerRPCHandler(const String &name, const RPCHandler &handler);
+    void unregisterRPCHandler(const String &name);
     /// Call if you know that a property from some other ProxyObject has changed. FIXME: should this be made private?
     void receivedPropertyUpdate(const ProxyObjectPtr &proxy, const String &propertyName, const String &arguments);
     /// Call if you know that a position for some other ProxyObject has changed. FIXME: should this be made private?
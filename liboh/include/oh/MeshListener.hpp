@@ -45,7 +45,8 @@ struct PhysicalParameters {
         DynamicBox,                 /// fully physical -- collision & dynamics
         DynamicSphere,
         DynamicCylinder,
-        Character
+        Character,
+        DynamicMesh                 /// dynamic, colliding as the convex hull of its mesh
     };
 
     std::string name;
@@ -37,14 +37,18 @@
 #include <util/MessageService.hpp>
 #include <util/SpaceObjectReference.hpp>
 #include <network/Address.hpp>
+#include <util/HandleTable.hpp>
 namespace Sirikata {
 class ProxyManager;
 class SpaceIDMap;
 class TopLevelSpaceConnection;
 class SpaceConnection;
 class ObjectScriptManager;
+class ObjectScript;
+class ScriptTickScheduler;
 namespace Task {
 class WorkQueue;
+class WorkLane;
 }
 class HostedObject;
 typedef std::tr1::weak_ptr<HostedObject> HostedObjectWPtr;
@@ -55,7 +59,10 @@ class SIRIKATA_OH_EXPORT ObjectHost :public MessageService{
     typedef std::tr1::unordered_multimap<SpaceID,std::tr1::weak_ptr<TopLevelSpaceConnection>,SpaceID::Hasher> SpaceConnectionMap;
     typedef std::tr1::unordered_map<Network::Address,std::tr1::weak_ptr<TopLevelSpaceConnection>,Network::Address::Hasher> AddressConnectionMap;
 
-    typedef std::tr1::unordered_map<UUID, HostedObjectPtr, UUID::Hasher> HostedObjectMap;
+    /// HostedObjects live in slots by the handle of their UUID
+    typedef SlotVector<HostedObjectPtr> HostedObjectMap;
+    /// Services on ports below this are found by indexing mServices, the rest in mHighServices
+    enum { MAX_INDEXED_PORT = 65536 };
     typedef std::map<MessagePort, MessageService *> ServicesMap;
     
     SpaceConnectionMap mSpaceConnections;
@@ -69,8 +76,20 @@ class SIRIKATA_OH_EXPORT ObjectHost :public MessageService{
     struct AtomicInt;
     AtomicInt *mEnqueuers;
 
+    HandleTable<UUID> mHostedObjectHandles;
     HostedObjectMap mHostedObjects;
-    ServicesMap mServices;
+    SlotVector<MessageService *> mServices;
+    ServicesMap mHighServices;
+    bool mBatchSpaceMessages;
+    double mLocationErrorThreshold;
+    bool mCompactLocations;
+    bool mResumeSpaceSessions;
+    Task::WorkQueue *mObjectLaneQueue;
+    float64 mProxyFullRadius;
+    float32 mProxyMinAngularSize;
+    uint32 mSharedSpaceStreams;
+    uint32 mRegistrationBatchSize;
+    ScriptTickScheduler *mScriptTicks;
 public:
 
     /** Caller is responsible for starting a thread
@@ -92,21 +111,35 @@ public:
         @param serv  MessageService* -- make sure to unregister before deleting.
     */
     void registerService(MessagePort port, MessageService *serv) {
-        mServices.insert(ServicesMap::value_type(port, serv));
+        if (port >= MAX_INDEXED_PORT) {
+            mHighServices.insert(ServicesMap::value_type(port, serv));
+        } else if (!mServices.get(port)) {
+            mServices[port] = serv;
+        }
         serv->forwardMessagesTo(this);
     }
     /// Unregister a global service. Unnecessary if you delete the ObjectHost first.
     void unregisterService(MessagePort port) {
-        ServicesMap::iterator iter = mServices.find(port);
-        if (iter != mServices.end()) {
+        if (port < MAX_INDEXED_PORT) {
+            if (MessageService *serv = mServices.get(port)) {
+                serv->endForwardingMessagesTo(this);
+                mServices.reset(port);
+            }
+            return;
+        }
+        ServicesMap::iterator iter = mHighServices.find(port);
+        if (iter != mHighServices.end()) {
             iter->second->endForwardingMessagesTo(this);
-            mServices.erase(iter);
+            mHighServices.erase(iter);
         }
     }
     /// Lookup a global service by port number.
     MessageService *getService(MessagePort port) const {
-        ServicesMap::const_iterator iter = mServices.find(port);
-        if (iter != mServices.end()) {
+        if (port < MAX_INDEXED_PORT) {
+            return mServices.get(port);
+        }
+        ServicesMap::const_iterator iter = mHighServices.find(port);
+        if (iter != mHighServices.end()) {
             return iter->second;
         }
         return NULL;
@@ -130,6 +163,9 @@ public:
     ///This method checks if the message is destined for any named mServices. If not, it gives it to mRouter
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
+    ///Same as above, but the queued message takes over message_body's buffer instead of copying it: message_body is left empty
+    void processMessage(const RoutableMessageHeader&header,
+                        String&message_body);
     /// @see connectToSpaceAddress. Looks up the space in the spaceIDMap().
     std::tr1::shared_ptr<TopLevelSpaceConnection> connectToSpace(const SpaceID& space);
     ///immediately returns a usable stream for the spaceID. The stream may or may not connect successfully, but will allow queueing messages. The stream will be deallocated if the return value is discarded. In most cases, this should not be called directly.
@@ -144,6 +180,81 @@ public:
     Task::WorkQueue *getWorkQueue() const {
         return mMessageQueue;
     }
+    /** Whether objects connecting from now on ask the space to send
+        their messages in batches rather than one per stream frame. */
+    void setBatchSpaceMessages(bool batch) {
+        mBatchSpaceMessages = batch;
+    }
+    bool batchSpaceMessages() const {
+        return mBatchSpaceMessages;
+    }
+    /** Spaces connected to from now on carry all their objects' messages over
+        this many substreams, told apart by object in the headers, instead
+        of one substream per object. 0, the default, clones one per object. */
+    void setSharedSpaceStreams(uint32 count) {
+        mSharedSpaceStreams = count;
+    }
+    uint32 sharedSpaceStreams() const {
+        return mSharedSpaceStreams;
+    }
+    /** Spaces connected to from now on get the NewObj requests of objects on shared
+        substreams in NewObjBatch messages of up to this many. 0 registers each object alone. */
+    void setRegistrationBatchSize(uint32 count) {
+        mRegistrationBatchSize = count;
+    }
+    uint32 registrationBatchSize() const {
+        return mRegistrationBatchSize;
+    }
+    /** How far a requester's extrapolation of a hosted object may drift
+        before LocRequest replies carry a fresh location; 0 always sends one. */
+    void setLocationErrorThreshold(double distance) {
+        mLocationErrorThreshold = distance;
+    }
+    double locationErrorThreshold() const {
+        return mLocationErrorThreshold;
+    }
+    /** Whether objects connecting from now on ask the space for a
+        CompactLocFormat, to exchange quantized location updates. */
+    void setCompactLocations(bool compact) {
+        mCompactLocations = compact;
+    }
+    bool compactLocations() const {
+        return mCompactLocations;
+    }
+    /** Whether objects connecting from now on ask the space for a resume token, and
+        connections to spaces reconnect after dropping so those objects resume without
+        registering again. */
+    void setResumeSpaceSessions(bool resume) {
+        mResumeSpaceSessions = resume;
+    }
+    bool resumeSpaceSessions() const {
+        return mResumeSpaceSessions;
+    }
+    /** Objects created from now on get a Task::WorkLane on this queue, and their
+        locally routed messages are handled there instead of on getWorkQueue().
+        NULL, the default, keeps every object on the message queue. */
+    void setObjectLaneQueue(Task::WorkQueue *queue) {
+        mObjectLaneQueue = queue;
+    }
+    Task::WorkQueue *objectLaneQueue() const {
+        return mObjectLaneQueue;
+    }
+    /** Only hands remote proxies to the ProxyCreationListeners once they come
+        within fullRadius of a local camera or span minAngularSize radians from one.
+        @see ObjectHostProxyManager::setInterestPolicy. 0 shows every proxy. */
+    void setProxyInterest(float64 fullRadius, float32 minAngularSize);
+    /// Promotes and demotes proxies in every space, call once per frame.
+    void updateProxyInterest(const Time&now);
+    /** Has tickScripts() call script->tick() about once per interval, every
+        frame if it is zero. A negative interval makes the script event-driven
+        again: it then only runs when a message or RPC arrives.
+        @see ObjectScript::tickInterval */
+    void registerScriptTick(ObjectScript *script, const Duration&interval);
+    /// Must be called before a registered script is deleted.
+    void unregisterScriptTick(ObjectScript *script);
+    /** Ticks the registered scripts that are due, in turn, until budget is spent;
+        call once per frame. \returns how many due scripts wait for the next frame */
+    size_t tickScripts(const Time&now, const Duration&budget);
     /// Looks up a TopLevelSpaceConnection corresponding to a certain space.
     ProxyManager *getProxyManager(const SpaceID&space) const;
 }; // class ObjectHost
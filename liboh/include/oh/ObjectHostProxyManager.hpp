@@ -41,12 +41,21 @@ namespace Sirikata {
 class HostedObject;
 
 class SIRIKATA_OH_EXPORT ObjectHostProxyManager :public ProxyManager, public Noncopyable {
+public:
+    /// How much of a proxy exists for the rest of the object host.
+    enum ProxyTier {
+        /// Kept up to date and extrapolated, but not yet handed to any ProxyCreationListener
+        LOCATION_TIER,
+        /// Handed to every ProxyCreationListener, so graphics, physics and scripts see it
+        FULL_TIER
+    };
 protected:
     struct ObjectHostProxyInfo {
         ProxyObjectPtr obj;
         std::tr1::unordered_multiset<QueryTracker*> viewers;
+        ProxyTier tier;
         ObjectHostProxyInfo(const ProxyObjectPtr &obj)
-            : obj(obj) {
+            : obj(obj), tier(LOCATION_TIER) {
         }
         inline bool operator<(const ObjectHostProxyInfo &other) const {
             return obj->getObjectReference() < other.obj->getObjectReference();
@@ -59,7 +68,18 @@ protected:
     ProxyMap mProxyMap;
     SpaceID mSpaceID;
 
+    float64 mFullRadius;
+    float32 mMinAngularSize;
+    /// Positions of the local cameras at the last updateInterest
+    std::vector<Vector3d> mInterestViewers;
+    Time mNextInterestUpdate;
+    /// Whether obj is close enough to, or looks big enough from, any viewer; slack above 1 widens the test.
+    bool isInteresting(const ProxyObjectPtr &obj, const Time&now, float32 slack) const;
+    void promote(ObjectHostProxyInfo &info);
+    void demote(ObjectHostProxyInfo &info);
+
 public:
+    ObjectHostProxyManager();
 	~ObjectHostProxyManager();
     void initialize();
     void destroy();
@@ -73,6 +93,15 @@ public:
     QueryTracker *getQueryTracker(const SpaceObjectReference &id) const;
 
     ProxyObjectPtr getProxyObject(const SpaceObjectReference &id) const;
+
+    /** Remote objects within fullRadius of a local camera, or spanning at least
+        minAngularSize radians from one, are FULL_TIER; the rest stay LOCATION_TIER
+        until they qualify. A fullRadius of 0, the default, makes every proxy FULL_TIER. */
+    void setInterestPolicy(float64 fullRadius, float32 minAngularSize);
+    /// Promotes and demotes proxies against where the local cameras are at now. Cheap to call every frame.
+    void updateInterest(const Time&now);
+    /// \returns the tier of id, or LOCATION_TIER if there is no such proxy.
+    ProxyTier getTier(const SpaceObjectReference &id) const;
 };
 
 }
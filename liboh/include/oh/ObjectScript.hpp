@@ -40,9 +40,16 @@ namespace Sirikata {
 */
 class SIRIKATA_OH_EXPORT ObjectScript : public MessageService{
   public:
-    /// Called every frame. Might not be necessary if the script runs in a separate thread.
+    /// Called every tickInterval() while the script is registered with its ObjectHost.
     virtual void tick() = 0;
 
+    /** How often the script wants tick() called, registered when it is created.
+        Zero ticks it every frame; negative, the default, leaves it event-driven.
+        @see ObjectHost::registerScriptTick */
+    virtual Duration tickInterval() const {
+        return Duration::seconds(-1.);
+    }
+
     /// RPC messages are handled specially because they are usually gathered into a single message.
     virtual bool processRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue) = 0;
 
@@ -0,0 +1,111 @@
+/*  Sirikata Object Host
+ *  PropertyStore.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_PROPERTY_STORE_HPP_
+#define _SIRIKATA_PROPERTY_STORE_HPP_
+
+#include <oh/Platform.hpp>
+
+namespace Sirikata {
+
+/** The public properties of a HostedObject: a flat vector sorted by name, with
+    the names interned in one process-wide table so that every object shares a
+    single copy of "MeshURI" and friends.
+    Changes are marked dirty until takeDirty() collects them, which lets the
+    owner apply everything that changed during a frame as one batch.
+*/
+class SIRIKATA_OH_EXPORT PropertyStore {
+public:
+    /// An interned property name; equal names always share the same pointer.
+    typedef const String *Name;
+    /// Returns the interned copy of name, adding it to the table if needed.
+    static Name intern(const String &name);
+
+    enum DirtyFlags {
+        CLEAN = 0,
+        DIRTY_UPDATE = 1, ///< needs to be applied to the proxies of the object
+        DIRTY_PERSIST = 2 ///< needs to be written through to persistence
+    };
+    struct Entry {
+        Name mName;
+        String mValue;
+        unsigned char mDirty;
+        bool mPresent; ///< false for an unset property that is kept until takeDirty()
+    };
+    typedef std::vector<Entry> EntryVector;
+    typedef EntryVector::const_iterator const_iterator;
+
+private:
+    EntryVector mEntries; ///< sorted by *mName
+    size_t mDirtyCount;
+
+    EntryVector::iterator lowerBound(const String &name);
+    EntryVector::const_iterator lowerBound(const String &name) const;
+    /// Finds or inserts the entry for name, and marks it dirty.
+    Entry &touch(const String &name, unsigned char dirty);
+
+public:
+    PropertyStore() : mDirtyCount(0) {}
+
+    bool has(const String &name) const {
+        return get(name) != NULL;
+    }
+    /// @returns the encoded value of a property, or NULL if it is not set.
+    const String *get(const String &name) const;
+    /// Gets a value to fill in for a (possibly new) property, and marks it dirty.
+    String *mutableValue(const String &name, unsigned char dirty=DIRTY_UPDATE);
+    /// Sets a property, marking it dirty unless it already had this value.
+    void set(const String &name, const String &value, unsigned char dirty=DIRTY_UPDATE);
+    /// Removes a property; the removal is reported once by takeDirty().
+    void unset(const String &name, unsigned char dirty=DIRTY_UPDATE);
+
+    /// @returns true if anything changed since the last takeDirty().
+    bool dirty() const {
+        return mDirtyCount != 0;
+    }
+    /** Appends the entries changed since the last call to out, in name order,
+        and marks them clean. Unset properties are dropped from the store here.
+    */
+    void takeDirty(EntryVector &out);
+
+    /// Iterates all entries in name order; skip the ones without mPresent.
+    const_iterator begin() const {
+        return mEntries.begin();
+    }
+    const_iterator end() const {
+        return mEntries.end();
+    }
+};
+
+}
+
+#endif
@@ -30,6 +30,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <util/ListenerProvider.hpp>
+#include <util/LocationTable.hpp>
 #include "TimeSteppedSimulation.hpp"
 #include "ProxyObject.hpp"
 namespace Sirikata {
@@ -39,6 +40,7 @@ class QueryTracker;
 class SIRIKATA_OH_EXPORT ProxyManager : 
 //        public MessageService,
         public Provider<ProxyCreationListener*> {
+    LocationTable mLocationTable;
 public:
     ProxyManager() {}
     virtual ~ProxyManager() {}
@@ -59,6 +61,11 @@ public:
     /// Ask for a proxy object by ID. Returns ProxyObjectPtr() if it doesn't exist.
     virtual ProxyObjectPtr getProxyObject(const SpaceObjectReference &id) const=0;
 
+    /// Locations of every ProxyObject of this manager, to extrapolate them all in one pass per frame.
+    LocationTable &getLocationTable() {
+        return mLocationTable;
+    }
+
 
 };
 }
@@ -46,6 +46,8 @@ protected:
     URI mMeshURI;
     Vector3f mScale;
     PhysicalParameters mPhysical;
+    /// Brings a listener that arrives after the mesh was set, e.g. once the proxy is promoted to FULL_TIER, up to date.
+    virtual void listenerAdded(MeshListener *listener);
 public:
     ProxyMeshObject(ProxyManager *man, const SpaceObjectReference&id);
     void setMesh (const URI &newMesh);
@@ -33,6 +33,7 @@
 #ifndef _SIRIKATA_PROXY_OBJECT_HPP_
 #define _SIRIKATA_PROXY_OBJECT_HPP_
 #include <util/Extrapolation.hpp>
+#include <util/LocationTable.hpp>
 #include <util/SpaceObjectReference.hpp>
 #include "ProxyObjectListener.hpp"
 #include "ProxyObject.hpp"
@@ -63,6 +64,7 @@ typedef Provider<PositionListener*> PositionProvider;
 class SIRIKATA_OH_EXPORT ProxyObject
   : public ProxyObjectProvider,
     public PositionProvider,
+    public Memory::Accounted<Memory::PROXY>,
     protected ProxyObjectListener // Parent death notification. FIXME: or should we leave the parent here, but ignore it in globalLocation()???
 {
 
@@ -81,6 +83,10 @@ private:
     SpaceObjectReference mParentId;
     LocationAuthority* mLocationAuthority;
     bool mLocal;
+    LocationTable::Slot mLocationSlot;
+    bool mInLocationTable; ///< false once destroy() gave mLocationSlot back
+    /// Copies mLocation into the ProxyManager's LocationTable.
+    void updateLocationTable();
 protected:
     /// Notification that the Parent has been destroyed.
     virtual void destroyed();
@@ -93,6 +99,9 @@ public:
     */
     ProxyObject(ProxyManager *man, const SpaceObjectReference&id);
     virtual ~ProxyObject();
+    /// Proxies of every subclass come from a shared SlabAllocator, since proximity creates and destroys them in bulk.
+    static void *operator new(size_t size);
+    static void operator delete(void *data, size_t size);
 
     void setLocal(bool isLocal);
     bool isLocal() {
@@ -170,6 +179,13 @@ public:
         mLocationAuthority = auth;
     }
     
+    /** Picks how updates are faded in: HERMITE_BLEND for objects extrapolated
+        with acceleration (ObjLoc::ACCELERATED), LINEAR_BLEND otherwise. */
+    void setLocationBlend(ExtrapolationBlend blend);
+    ExtrapolationBlend locationBlend() const {
+        return mLocation.blend();
+    }
+
     /** @see setLocation. This disables interpolation from the last update. */
     void resetLocation(TemporalValue<Location>::Time timeStamp,
                                const Location&location);
@@ -209,6 +225,10 @@ public:
     Location extrapolateLocation(TemporalValue<Location>::Time current) const {
         return mLocation.extrapolate(current);
     }
+    /** Local position and orientation at current, taken from the ProxyManager's
+        LocationTable if it was last extrapolated to current. */
+    void extrapolatePositionOrientation(TemporalValue<Location>::Time current,
+                                        Vector3d &position, Quaternion &orientation) const;
 };
 }
 #endif
@@ -0,0 +1,106 @@
+/*  Sirikata Object Host
+ *  SceneFile.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_SCENE_FILE_HPP_
+#define _SIRIKATA_SCENE_FILE_HPP_
+
+#include <oh/Platform.hpp>
+#include <util/UUID.hpp>
+#include <util/MappedFile.hpp>
+
+namespace Sirikata {
+
+/**
+ * A binary scene, as written by csv_converter.py when its output ends in .scene,
+ * mapped into memory and read in place. All values are little endian:
+ *   - a 32 byte header: the magic "SIRISCN1", then the uint32 counts of objects,
+ *     properties and strings, and the uint32 file offsets of their tables;
+ *   - one 64 byte record per object: its 16 byte UUID, float64 position[3],
+ *     float32 orientation[4] as x,y,z,w, the uint32 string index of its mesh URI
+ *     (NO_STRING if none) and the uint32 index of its first property. Its
+ *     properties run up to the first property of the next object;
+ *   - one 8 byte record per property: the uint32 string indices of its name and
+ *     of its encoded value;
+ *   - the string table: a uint32 offset and length for each string, relative to
+ *     the end of the table, then the bytes. Identical strings are stored once, so
+ *     property names, mesh URIs and repeated values cost nothing per object.
+ */
+class SIRIKATA_OH_EXPORT SceneFile : Noncopyable {
+public:
+    enum {
+        HEADER_SIZE=32,
+        OBJECT_SIZE=64,
+        PROPERTY_SIZE=8,
+        NO_STRING=0xffffffff
+    };
+private:
+    MappedFile mFile;
+    uint32 mNumObjects;
+    uint32 mNumProperties;
+    uint32 mNumStrings;
+    const unsigned char *mObjects;
+    const unsigned char *mProperties;
+    const unsigned char *mStrings;
+    const char *mStringData;
+    size_t mStringDataSize;
+    bool mValid;
+
+    const unsigned char *object(uint32 which) const {
+        return mObjects+(size_t)which*OBJECT_SIZE;
+    }
+    bool checkStrings() const;
+    bool checkObjects() const;
+public:
+    /// Maps filename; valid() is false if it is missing or malformed.
+    SceneFile(const String &filename);
+
+    bool valid() const {
+        return mValid;
+    }
+    uint32 numObjects() const {
+        return mNumObjects;
+    }
+    UUID objectID(uint32 which) const;
+    Vector3d position(uint32 which) const;
+    Quaternion orientation(uint32 which) const;
+    /// The mesh URI of an object, empty if it has none.
+    String meshURI(uint32 which) const;
+    /** Fills fields with what persistence would hold for an object, ready for
+        HostedObject::initializeRestoreFromFields: its properties, plus a Loc
+        and MeshURI made from the fixed fields unless properties override them.
+    */
+    void fields(uint32 which, std::map<String,String> &fields) const;
+};
+
+}
+
+#endif
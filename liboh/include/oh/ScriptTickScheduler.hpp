@@ -0,0 +1,81 @@
+/*  Sirikata liboh -- Object Host
+ *  ScriptTickScheduler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_SCRIPT_TICK_SCHEDULER_HPP_
+#define _SIRIKATA_SCRIPT_TICK_SCHEDULER_HPP_
+
+#include <oh/Platform.hpp>
+
+namespace Sirikata {
+
+class ObjectScript;
+
+/**
+ * Ticks the ObjectScripts that asked for it, each at its own interval.
+ * Scripts that never registered are event-driven and cost nothing per frame.
+ * A pass stops once its time budget is spent; the scripts it did not reach
+ * are first in line on the next pass, so none of them starves.
+ */
+class SIRIKATA_OH_EXPORT ScriptTickScheduler {
+    struct Entry {
+        ObjectScript *script; ///< NULL once removed during a pass
+        Duration interval;
+        Time due;
+        Entry(ObjectScript *script, const Duration &interval, const Time &due)
+            : script(script), interval(interval), due(due) {
+        }
+    };
+    typedef std::list<Entry> Ring;
+    Ring mRing;
+    std::map<ObjectScript*, Ring::iterator> mEntries;
+    ///where the next pass starts looking for due scripts
+    Ring::iterator mCursor;
+    bool mTicking;
+    void erase(Ring::iterator where);
+public:
+    ScriptTickScheduler();
+    /** Ticks script about once per interval from now on, or every pass if
+        interval is zero. Registering again changes the interval; a negative
+        one makes the script event-driven, same as remove(). */
+    void add(ObjectScript *script, const Duration &interval);
+    void remove(ObjectScript *script);
+    /** Ticks the scripts due by now until budget runs out, at least one if any is due.
+        \returns how many due scripts were left for the next pass */
+    size_t tick(const Time &now, const Duration &budget);
+    size_t size() const {
+        return mEntries.size();
+    }
+};
+
+}
+
+#endif
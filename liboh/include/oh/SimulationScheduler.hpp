@@ -0,0 +1,69 @@
+/*  Sirikata liboh -- Object Host
+ *  SimulationScheduler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_SIMULATION_SCHEDULER_HPP_
+#define _SIRIKATA_SIMULATION_SCHEDULER_HPP_
+
+#include <oh/Platform.hpp>
+
+namespace Sirikata {
+
+class TimeSteppedSimulation;
+
+/**
+ * Ticks the object host's simulations once per pass of the main loop.
+ * When parallel, each simulation that canStepInParallel() has its step()
+ * run on a thread of its own, started at most once per desiredTickRate(),
+ * while the others keep ticking on the calling thread.
+ */
+class SIRIKATA_OH_EXPORT SimulationScheduler {
+    class SteppingThread;
+    std::vector<TimeSteppedSimulation*> mSimulations;
+    ///parallel to mSimulations, NULL for each simulation ticked on the calling thread
+    std::vector<SteppingThread*> mThreads;
+    ///when each simulation ticked on the calling thread last ticked
+    std::vector<Time> mLastTicks;
+    bool mParallel;
+public:
+    SimulationScheduler(bool parallel);
+    ///Waits out any step in progress: delete the scheduler before its simulations.
+    ~SimulationScheduler();
+    void add(TimeSteppedSimulation *sim);
+    ///Runs one pass over every simulation. \returns false once one of them asks to quit
+    bool tick();
+    ///The earliest a simulation wants its next tick or step by its desiredTickRate(), Time::null() if there are none
+    Time nextDeadline() const;
+};
+
+}
+
+#endif
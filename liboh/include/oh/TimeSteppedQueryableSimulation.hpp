@@ -35,6 +35,7 @@
 #include "TimeSteppedSimulation.hpp"
 #include <oh/ProxyObject.hpp>
 #include <oh/ProxyMeshObject.hpp>
+#include <util/SpaceObjectReference.hpp>
 
 namespace Sirikata {
 typedef std::tr1::shared_ptr<ProxyMeshObject> ProxyMeshObjectPtr;
@@ -43,6 +44,22 @@ class SpaceObjectReference;
 
 class TimeSteppedQueryableSimulation: public TimeSteppedSimulation {
 public:
+    /// One ray of a queryRays batch, with the same meaning as the queryRay arguments
+    struct RayQuery {
+        Vector3d position;
+        Vector3f direction;
+        double maxDistance;
+        ProxyMeshObjectPtr ignore;
+    };
+    /// The answer to one RayQuery; distance, normal and name are only set if hit
+    struct RayHit {
+        bool hit;
+        double distance;
+        Vector3f normal;
+        SpaceObjectReference name;
+        RayHit() : hit(false), distance(0), normal(0,0,0), name(SpaceObjectReference::null()) {
+        }
+    };
     /**
      * Query the scene to look for the first active simulation object that intersects the ray
      * @param position the starting point for the ray query
@@ -60,6 +77,20 @@ public:
                           double &returnDistance,
                           Vector3f &returnNormal,
                           SpaceObjectReference &returnName)=0;
+    /**
+     * Answers a whole batch of ray queries at once, so that simulations can share the work of
+     * finding candidates between rays.  The default just calls queryRay for each.
+     * @param rays the queries to answer
+     * @param hits resized to rays.size(), hits[i] is the answer to rays[i]
+     */
+    virtual void queryRays(const std::vector<RayQuery> &rays, std::vector<RayHit> &hits) {
+        hits.clear();
+        hits.resize(rays.size());
+        for (size_t i=0; i<rays.size(); ++i) {
+            hits[i].hit = queryRay(rays[i].position, rays[i].direction, rays[i].maxDistance, rays[i].ignore,
+                                   hits[i].distance, hits[i].normal, hits[i].name);
+        }
+    }
     virtual Duration desiredTickRate()const=0;
     ///returns true if simulation should continue (false quits app)
     virtual bool tick()=0;
@@ -41,6 +41,18 @@ public:
     virtual Duration desiredTickRate()const=0;
     ///returns true if simulation should continue (false quits app)
     virtual bool tick()=0;
+    /**
+     * Whether the expensive part of tick() can run on a thread of its own.
+     * A SimulationScheduler then calls snapshot(), step() on that thread and
+     * publish() instead of tick(), ticking the other simulations meanwhile.
+     */
+    virtual bool canStepInParallel()const{return false;}
+    ///main thread: copy in what the next step() reads from ProxyObjects
+    virtual void snapshot(){}
+    ///simulation thread: advance on the last snapshot() without touching ProxyObjects
+    virtual void step(){}
+    ///main thread, after step() returned and before the next snapshot(): hand the results out; returns false to quit
+    virtual bool publish(){return true;}
 };
 
 }
@@ -35,7 +35,10 @@
 
 #include <oh/Platform.hpp>
 #include <network/Address.hpp>
+#include <network/Stream.hpp>
 #include <oh/ObjectHostProxyManager.hpp>
+#include <boost/thread/mutex.hpp>
+#include <util/HandleTable.hpp>
 namespace Sirikata {
 
 class HostedObject;
@@ -44,14 +47,57 @@ typedef std::tr1::shared_ptr<HostedObject> HostedObjectPtr;
 class ObjectHost;
 
 class SIRIKATA_OH_EXPORT TopLevelSpaceConnection :public ObjectHostProxyManager {
-    typedef std::tr1::unordered_map<ObjectReference,HostedObjectWPtr,ObjectReference::Hasher> HostedObjectMap;
+    ///registered objects in slots by the handle of their ObjectReference in mHostedObjectHandles
+    typedef SlotVector<HostedObjectWPtr> HostedObjectMap;
 
     ObjectHost*mParent;
+    Network::IOService*mIO;
+    std::tr1::weak_ptr<TopLevelSpaceConnection> mWeakThis;
     Network::Address mRegisteredAddress;
     Network::Stream *mTopLevelStream;
+    bool mResumeSessions;
+    ///bumped every time reconnect() replaces mTopLevelStream
+    uint32 mGeneration;
+    ///whether mTopLevelStream ever came up: one that never did is not worth reconnecting
+    bool mTopLevelConnected;
+    ///streams replaced by reconnect(): their callbacks may still be on the stack, so they go on the next reconnect
+    std::vector<Network::Stream*> mRetiredStreams;
+    HandleTable<ObjectReference> mHostedObjectHandles;
     HostedObjectMap mHostedObjects;
 
+    ///An object attached to one of the shared substreams, by the key in its messages' headers
+    struct SharedStreamObject {
+        size_t mStream;
+        Network::Stream::ConnectionCallback mConnectionCallback;
+        Network::Stream::BytesReceivedCallback mBytesReceivedCallback;
+    };
+    typedef std::tr1::unordered_map<UUID,SharedStreamObject,UUID::Hasher> SharedStreamObjectMap;
+    uint32 mNumSharedStreams;
+    bool mBatchSharedStreams;
+    std::vector<Network::Stream*> mSharedStreams;
+    SharedStreamObjectMap mSharedStreamObjects;
+    boost::mutex mSharedStreamMutex;
+
+    ///A NewObj waiting to go out in the next NewObjBatch down its object's shared substream
+    struct PendingRegistration {
+        size_t mStream;
+        UUID mKey;
+        String mNewObj;
+    };
+    uint32 mRegistrationBatchSize;
+    std::vector<PendingRegistration> mPendingRegistrations;
+    static void flushRegistrations(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus);
+    ///sends everything in mPendingRegistrations: the caller holds mSharedStreamMutex
+    void sendRegistrations();
+    void registrationBatchReceived(MemoryReference body);
+
+    void sendConnectionOptions(Network::Stream*stream, const RoutableMessageBody&options, const UUID*key);
+    void sharedStreamConnectionEvent(uint32 generation, size_t which, Network::Stream::ConnectionStatus status, const std::string&reason);
+    void sharedStreamReceived(const Network::Chunk&chunk);
+    void sharedMessageReceived(MemoryReference message, const Network::Chunk*whole);
+
     void removeFromMap();
+    static void connectionStatus(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus,uint32 generation,Network::Stream::ConnectionStatus status,const std::string&reason);
     static void connectToAddress(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus,ObjectHost*oh,const Network::Address*addy);
 
   public:
@@ -70,6 +116,46 @@ class SIRIKATA_OH_EXPORT TopLevelSpaceConnection :public ObjectHostProxyManager
     void registerHostedObject(const ObjectReference &mRef, const HostedObjectPtr &hostedObj);
     void unregisterHostedObject(const ObjectReference &mRef);
     HostedObjectPtr getHostedObject(const ObjectReference &mref) const;
+
+    /** Whether a top level stream that drops after coming up is replaced by a new
+        connection to the same address, for objects holding a resume token to move over. */
+    void setResumeSessions(bool resume) {
+        mResumeSessions=resume;
+    }
+    bool resumeSessions() const {
+        return mResumeSessions;
+    }
+    /// How many times reconnect() replaced the top level stream: streams cloned before that are dead.
+    uint32 generation() const {
+        return mGeneration;
+    }
+    /** Called when a stream cloned from the given generation drops. The first report of
+        a generation replaces the top level stream, so every object resumes over the same new one.
+        \returns whether the object should clone its stream again and resume itself on it. */
+    bool reconnect(uint32 generation);
+
+    /** Objects attached from now on share count substreams instead of cloning their own,
+        asking the space to batch messages down them if batch is set. 0 clones one per object. */
+    void setSharedStreams(uint32 count, bool batch);
+    uint32 sharedStreamCount() const {
+        return mNumSharedStreams;
+    }
+    /** Routes the messages the space sends to key on a shared substream to the given callbacks.
+        key must go in the source_object of everything sent down the returned stream.
+        \returns the shared substream, which belongs to this TopLevelSpaceConnection. */
+    Network::Stream *attachSharedStream(const UUID&key,
+                                        const Network::Stream::ConnectionCallback&connectionCallback,
+                                        const Network::Stream::BytesReceivedCallback&bytesReceivedCallback);
+    /// Drops the callbacks of key and tells the space the object has left its shared substream.
+    void detachSharedStream(const UUID&key);
+    /** NewObj requests from objects on shared substreams are gathered into one NewObjBatch per
+        substream, sent once this many are waiting or the IO service gets around to it. 0 sends each alone. */
+    void setRegistrationBatchSize(uint32 count) {
+        mRegistrationBatchSize=count;
+    }
+    /** Queues the serialized NewObj of the object attached with key for the next NewObjBatch.
+        \returns false if the caller should send it itself: batching is off or key is not attached. */
+    bool queueRegistration(const UUID&key, const String&newObj);
 };
 /*
 class HostedObjectListener {
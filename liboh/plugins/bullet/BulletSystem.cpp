@@ -32,12 +32,18 @@
 
 #include <fstream>
 #include <oh/Platform.hpp>
+#include <util/PluginManager.hpp>
 #include <oh/SimulationFactory.hpp>
 #include <oh/ProxyObject.hpp>
 #include <options/Options.hpp>
+#include <util/TraceEvents.hpp>
 #include <transfer/TransferManager.hpp>
 #include "btBulletDynamicsCommon.h"
 #include "btBulletCollisionCommon.h"
+#include "BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h"
+#include "BulletCollision/CollisionShapes/btShapeHull.h"
+#include "LinearMath/btAabbUtil2.h"
+#include <boost/thread/thread.hpp>
 #include "BulletSystem.hpp"
 #include "Bullet_Sirikata.pbj.hpp"
 #include "Bullet_Physics.pbj.hpp"
@@ -51,7 +57,7 @@ static int core_plugin_refcount = 0;
 //#define DEBUG_OUTPUT(x) x
 #define DEBUG_OUTPUT(x)
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     using namespace Sirikata;
     DEBUG_OUTPUT(cout << "dbm: plugin init" << endl;)
     if (core_plugin_refcount==0)
@@ -62,15 +68,15 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
     DEBUG_OUTPUT(cout << "dbm: plugin init return" << endl;)
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
     return ++core_plugin_refcount;
 }
-SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
     assert(core_plugin_refcount>0);
     return --core_plugin_refcount;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     using namespace Sirikata;
     if (core_plugin_refcount>0) {
         core_plugin_refcount--;
@@ -80,13 +86,15 @@ SIRIKATA_PLUGIN_EXPORT_C void destroy() {
     }
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "bulletphysics";
 }
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
 
+SIRIKATA_REGISTER_STATIC_PLUGIN(bulletphysics)
+
 namespace Sirikata {
 
 const ObjectReference&BulletObj::getObjectReference()const {
@@ -102,6 +110,7 @@ void BulletObj::meshChanged (const URI &newMesh) {
 }
 
 void BulletObj::setPhysical (const PhysicalParameters &pp) {
+    boost::recursive_mutex::scoped_lock lock(system->worldMutex());
     DEBUG_OUTPUT(cout << "dbm: setPhysical: " << this << " mode=" << pp.mode << " name: " << pp.name << " mesh: " << mMeshname << endl);
     mName = pp.name;
     mHull = pp.hull;
@@ -134,6 +143,10 @@ void BulletObj::setPhysical (const PhysicalParameters &pp) {
         mDynamic = true;
         mShape = ShapeCharacter;
         break;
+    case PhysicalParameters::DynamicMesh:
+        mDynamic = true;
+        mShape = ShapeHull;
+        break;
     }
     if (mMeshptr) {
         if (mDynamic && (!mMeshptr->isLocal()) ) {      /// for now, physics ignores dynamic objects on other hosts
@@ -154,6 +167,13 @@ void BulletObj::setPhysical (const PhysicalParameters &pp) {
     }
 }
 
+void BulletObj::markMoved() {
+    if (!system->mPublishing && !mMovedExternally) {
+        mMovedExternally = true;
+        system->mMovedObjects.push_back(this);
+    }
+}
+
 positionOrientation BulletObj::getBulletState() {
     btTransform trans;
     this->mBulletBodyPtr->getMotionState()->getWorldTransform(trans);
@@ -178,14 +198,17 @@ void BulletObj::setBulletState(positionOrientation po) {
 void BulletObj::setScale (const Vector3f &newScale) {
     if (mSizeX == 0)         /// this gets called once before the bullet stuff is ready
         return;
+    boost::recursive_mutex::scoped_lock lock(system->worldMutex());
     if (mSizeX==newScale.x && mSizeY==newScale.y && mSizeZ==newScale.z)
         return;
     mSizeX = newScale.x;
     mSizeY = newScale.y;
     mSizeZ = newScale.z;
+    if (!mBulletBodyPtr)     /// mesh still downloading; buildBulletBody will use the new size
+        return;
     float mass;
     btVector3 localInertia(0,0,0);
-    buildBulletShape(NULL, 0, mass);        /// null, 0 means re-use original vertices
+    buildBulletShape(mass);
     if (mDynamic) {                          /// inertia meaningless for static objects
         if (!mShape==ShapeMesh) {
             mColShape->calculateLocalInertia(mass,localInertia);
@@ -200,12 +223,15 @@ void BulletObj::setScale (const Vector3f &newScale) {
     mBulletBodyPtr->setMassProps(mass, localInertia);
     mBulletBodyPtr->setGravity(btVector3(0, -9.8, 0));                              /// otherwise gravity assumes old inertia!
     mBulletBodyPtr->activate(true);
+    for (unsigned int i=0; i<mGhostBodies.size(); i++) {
+        mGhostBodies[i].second->setCollisionShape(mColShape);
+    }
+    system->placeInRegions(this);
     DEBUG_OUTPUT(cout << "dbm: setScale " << newScale << " old X: " << mSizeX << " mass: "
                  << mass << " localInertia: " << localInertia.getX() << "," << localInertia.getY() << "," << localInertia.getZ() << endl);
 }
 
-void BulletObj::buildBulletShape(const unsigned char* meshdata, int meshbytes, float &mass) {
-    /// if meshbytes = 0, reuse vertices & indices (for rescaling)
+void BulletObj::buildBulletShape(float &mass) {
     if (mColShape) delete mColShape;
     if (mDynamic) {
         if (mShape == ShapeSphere) {
@@ -228,79 +254,156 @@ void BulletObj::buildBulletShape(const unsigned char* meshdata, int meshbytes, f
             mColShape = new btCylinderShape(btVector3(mSizeX*mHull.x, mSizeY*mHull.y, mSizeZ*mHull.z));
             mass = mSizeX * mSizeY * mSizeZ * mDensity * 3.1416;
         }
+        else if (mShape == ShapeHull) {
+            DEBUG_OUTPUT(cout << "dbm: shape=hull " << endl);
+            mColShape = mCollisionMesh->makeHull(btVector3(mSizeX, mSizeY, mSizeZ));
+            if (mColShape) {
+                btTransform identity;
+                identity.setIdentity();
+                btVector3 aabbMin, aabbMax;
+                mColShape->getAabb(identity, aabbMin, aabbMax);
+                btVector3 extent = aabbMax-aabbMin;
+                mass = extent.x() * extent.y() * extent.z() * mDensity;            /// the hull's box; close enough for props
+            }
+            else {
+                mColShape = new btBoxShape(btVector3(mSizeX*.5, mSizeY*.5, mSizeZ*.5));   /// mesh had no vertices
+                mass = mSizeX * mSizeY * mSizeZ * mDensity;
+            }
+        }
     }
     else {
         /// create a mesh-based static (not dynamic ie forces, though kinematic, ie movable) object
-        /// assuming !dynamic; in future, may support dynamic mesh through gimpact collision
-        vector<double> bounds;
-        if (mBtVertices)
-            btAlignedFree(mBtVertices);
-        mBtVertices=NULL;
-        unsigned int i,j;
-
-        if (meshbytes) {
-            mVertices.clear();
-            mIndices.clear();
-            parseOgreMesh parser;
-            parser.parseData(meshdata, meshbytes, mVertices, mIndices, bounds);
-        }
-        DEBUG_OUTPUT (cout << "dbm:mesh " << mVertices.size() << " vertices:" << endl);
-        mBtVertices=(btScalar*)btAlignedAlloc(mVertices.size()/3*sizeof(btScalar)*4,16);
-        for (i=0; i<mVertices.size()/3; i+=1) {
-            DEBUG_OUTPUT ( cout << "dbm:mesh");
-            for (j=0; j<3; j+=1) {
-                DEBUG_OUTPUT (cout <<" " << mVertices[i*3+j]);
-            }
-            mBtVertices[i*4]=mVertices[i*3]*mSizeX;
-            mBtVertices[i*4+1]=mVertices[i*3+1]*mSizeY;
-            mBtVertices[i*4+2]=mVertices[i*3+2]*mSizeZ;
-            mBtVertices[i*4+3]=1;
-            DEBUG_OUTPUT (cout << endl);
-        }
-        DEBUG_OUTPUT (cout << endl);
-        DEBUG_OUTPUT (cout << "dbm:mesh " << mIndices.size() << " indices:");
-        for (i=0; i<mIndices.size(); i++) {
-            DEBUG_OUTPUT (cout << " " << mIndices[i]);
-        }
-        DEBUG_OUTPUT (cout << endl);
-        DEBUG_OUTPUT (cout << "dbm:mesh bounds:");
-        for (i=0; i<bounds.size(); i++) {
-            DEBUG_OUTPUT (cout << " " << bounds[i]);
-        }
-        DEBUG_OUTPUT (cout << endl);
-
-        if (mIndexArray) delete mIndexArray;
-        mIndexArray = new btTriangleIndexVertexArray(
-            mIndices.size()/3,                       // # of triangles (int)
-            &(mIndices[0]),                          // ptr to list of indices (int)
-            sizeof(int)*3,                          // index stride, in bytes (typically 3X sizeof(int) = 12
-            mVertices.size()/3,                      // # of vertices (int)
-            mBtVertices,         // (btScalar*) pointer to vertex list
-            sizeof(btScalar)*4);                     // vertex stride, in bytes
-        btVector3 aabbMin(-10000,-10000,-10000),aabbMax(10000,10000,10000);
-        mColShape  = new btBvhTriangleMeshShape(mIndexArray,false, aabbMin, aabbMax);
-        DEBUG_OUTPUT(cout << "dbm: shape=trimesh mColShape: " << mColShape <<
-                     " triangles: " << mIndices.size()/3 << " verts: " << mVertices.size()/3 << endl);
+        /// far from every dynamic body, its hull is good enough
+        mColShape = NULL;
+        if (mLod != LodExact) {
+            mColShape = mCollisionMesh->makeHull(btVector3(mSizeX, mSizeY, mSizeZ));
+        }
+        if (!mColShape) {
+            mColShape = new btScaledBvhTriangleMeshShape(mCollisionMesh->mShape, btVector3(mSizeX, mSizeY, mSizeZ));
+        }
+        DEBUG_OUTPUT(cout << "dbm: shape=scaled trimesh mColShape: " << mColShape <<
+                     " triangles: " << mCollisionMesh->mIndices.size()/3 << " lod: " << (int)mLod << endl);
         mass = 0.0;
     }
 }
+
+SharedCollisionMesh::SharedCollisionMesh(const unsigned char* meshdata, int meshbytes) {
+    vector<double> vertices;
+    vector<double> bounds;
+    unsigned int i;
+    parseOgreMesh parser;
+    parser.parseData(meshdata, meshbytes, vertices, mIndices, bounds);
+    DEBUG_OUTPUT (cout << "dbm:mesh " << vertices.size()/3 << " vertices, " << mIndices.size()/3 << " triangles" << endl);
+    mBtVertices=(btScalar*)btAlignedAlloc(vertices.size()/3*sizeof(btScalar)*4,16);
+    for (i=0; i<vertices.size()/3; i+=1) {
+        mBtVertices[i*4]=vertices[i*3];
+        mBtVertices[i*4+1]=vertices[i*3+1];
+        mBtVertices[i*4+2]=vertices[i*3+2];
+        mBtVertices[i*4+3]=1;
+    }
+    mIndexArray = new btTriangleIndexVertexArray(
+        mIndices.size()/3,                       // # of triangles (int)
+        &(mIndices[0]),                          // ptr to list of indices (int)
+        sizeof(int)*3,                          // index stride, in bytes (typically 3X sizeof(int) = 12
+        vertices.size()/3,                       // # of vertices (int)
+        mBtVertices,         // (btScalar*) pointer to vertex list
+        sizeof(btScalar)*4);                     // vertex stride, in bytes
+    btVector3 aabbMin(-10000,-10000,-10000),aabbMax(10000,10000,10000);
+    mShape = new btBvhTriangleMeshShape(mIndexArray,false, aabbMin, aabbMax);
+    if (vertices.size()) {
+        /// btShapeHull keeps at most 42 of the hull's points, whatever the mesh's size
+        btConvexHullShape everyVertex(mBtVertices, vertices.size()/3, sizeof(btScalar)*4);
+        btShapeHull simplified(&everyVertex);
+        if (simplified.buildHull(everyVertex.getMargin())) {
+            for (int v=0; v<simplified.numVertices(); v++) {
+                mHullPoints.push_back(simplified.getVertexPointer()[v]);
+            }
+        }
+    }
+    DEBUG_OUTPUT (cout << "dbm:mesh hull " << mHullPoints.size() << " points" << endl);
+}
+
+SharedCollisionMesh::~SharedCollisionMesh() {
+    delete mShape;
+    delete mIndexArray;
+    btAlignedFree(mBtVertices);
+}
+
+btConvexHullShape* SharedCollisionMesh::makeHull(const btVector3 &scale) const {
+    if (mHullPoints.size() == 0)
+        return NULL;
+    btConvexHullShape* hull = new btConvexHullShape(&mHullPoints[0].getX(), mHullPoints.size(), sizeof(btVector3));
+    hull->setLocalScaling(scale);
+    return hull;
+}
+
+SharedCollisionMeshPtr BulletSystem::findCollisionMesh(const Fingerprint &hash) {
+    std::map<Fingerprint, std::tr1::weak_ptr<SharedCollisionMesh> >::iterator where = mCollisionMeshes.find(hash);
+    if (where == mCollisionMeshes.end())
+        return SharedCollisionMeshPtr();
+    return where->second.lock();
+}
+
+void BulletSystem::attachCollisionMesh(const Fingerprint &hash, const SharedCollisionMeshPtr &mesh) {
+    for (std::map<Fingerprint, std::tr1::weak_ptr<SharedCollisionMesh> >::iterator iter = mCollisionMeshes.begin();
+         iter != mCollisionMeshes.end(); ) {
+        if (iter->first != hash && iter->second.expired())
+            mCollisionMeshes.erase(iter++);
+        else
+            ++iter;
+    }
+    mCollisionMeshes[hash] = mesh;
+    std::map<Fingerprint, std::vector<BulletObj*> >::iterator pending = mPendingMeshes.find(hash);
+    if (pending == mPendingMeshes.end())
+        return;
+    std::vector<BulletObj*> waiting;
+    waiting.swap(pending->second);
+    mPendingMeshes.erase(pending);
+    for (unsigned int i=0; i<waiting.size(); i++) {
+        waiting[i]->mCollisionMesh = mesh;
+        waiting[i]->buildBulletBody();
+    }
+}
+
+void BulletSystem::meshBuilt(const Fingerprint &hash, const SharedCollisionMeshPtr &mesh) {
+    boost::mutex::scoped_lock lock(mBuiltMeshesMutex);
+    mBuiltMeshes.push_back(std::pair<Fingerprint, SharedCollisionMeshPtr>(hash, mesh));
+}
+
+/// Parses one downloaded mesh and builds its BVH on a mesh-build worker.
+class MeshBuildTask : public Task::WorkItem {
+    BulletSystem *mSystem;
+    Fingerprint mHash;
+    Transfer::DenseDataPtr mData;
+public:
+    MeshBuildTask(BulletSystem *system, const Fingerprint &hash, const Transfer::DenseDataPtr &data)
+        : mSystem(system), mHash(hash), mData(data) {
+    }
+    void operator() () {
+        AutoPtr delete_me(this);
+        SharedCollisionMeshPtr mesh(new SharedCollisionMesh(mData->data(), (int)mData->length()));
+        mData.reset();
+        mSystem->meshBuilt(mHash, mesh);
+    }
+};
+
 BulletObj::~BulletObj() {
     DEBUG_OUTPUT(cout << "dbm: BulletObj destructor " << this << endl);
-    if (mBtVertices!=NULL)
-        btAlignedFree(mBtVertices);
     if (mMotionState!=NULL) delete mMotionState;
-    if (mIndexArray!=NULL) delete mIndexArray;
     if (mColShape!=NULL) delete mColShape;
     if (mBulletBodyPtr!=NULL) delete mBulletBodyPtr;
+    for (unsigned int i=0; i<mGhostBodies.size(); i++) {
+        delete mGhostBodies[i].second;
+    }
 }
 
-void BulletObj::buildBulletBody(const unsigned char* meshdata, int meshbytes) {
+void BulletObj::buildBulletBody() {
     float mass;
     btTransform startTransform;
     btVector3 localInertia(0,0,0);
     btRigidBody* body;
 
-    buildBulletShape(meshdata, meshbytes, mass);
+    buildBulletShape(mass);
 
     DEBUG_OUTPUT(cout << "dbm: mass = " << mass << endl;)
     if (mDynamic) {
@@ -324,13 +427,18 @@ void BulletObj::buildBulletBody(const unsigned char* meshdata, int meshbytes) {
             body->setAngularFactor(0);  /// for now, all we do with characters is avoid external angular effects
         }
     }
-    system->dynamicsWorld->addRigidBody(body);
     mBulletBodyPtr=body;
     mActive=true;
     system->bt2siri[body]=this;
+    mRegion=system->regionAt(mInitialPo.p);
+    system->mRegions[mRegion].dynamicsWorld->addRigidBody(body);
+    system->placeInRegions(this);
 }
 
 void BulletObj::requestLocation(TemporalValue<Location>::Time timeStamp, const Protocol::ObjLoc& reqLoc) {
+    boost::recursive_mutex::scoped_lock lock(system->worldMutex());
+    if (!mBulletBodyPtr)     /// mesh still downloading
+        return;
     if (reqLoc.has_velocity()) {
         btVector3 btvel(reqLoc.velocity().x, reqLoc.velocity().y, reqLoc.velocity().z);
         mBulletBodyPtr->setLinearVelocity(btvel);
@@ -364,7 +472,28 @@ Task::EventResponse BulletSystem::downloadFinished(Task::EventPtr evbase, Bullet
         Transfer::DenseDataPtr flatData = ev->data().flatten();
         const unsigned char* realData = flatData->data();
         DEBUG_OUTPUT (cout << "dbm downloadFinished: data: " << (char*)&realData[2] << endl);
-        bullobj->buildBulletBody(realData, ev->data().length());
+        boost::recursive_mutex::scoped_lock lock(mWorldMutex);
+        SharedCollisionMeshPtr mesh = findCollisionMesh(ev->fingerprint());
+        if (mesh) {
+            bullobj->mCollisionMesh = mesh;
+            bullobj->buildBulletBody();
+        }
+        else {
+            std::vector<BulletObj*> &waiting = mPendingMeshes[ev->fingerprint()];
+            if (std::find(waiting.begin(), waiting.end(), bullobj) == waiting.end()) {
+                waiting.push_back(bullobj);
+            }
+            if (waiting.size() == 1) {
+                /// first object to want this mesh; the body is built in snapshot() once the worker is done
+                if (mMeshBuildQueue) {
+                    mMeshBuildQueue->enqueue(new MeshBuildTask(this, ev->fingerprint(), flatData));
+                }
+                else {
+                    attachCollisionMesh(ev->fingerprint(),
+                                        SharedCollisionMeshPtr(new SharedCollisionMesh(realData, ev->data().length())));
+                }
+            }
+        }
     }
     return Task::EventResponse::del();
 }
@@ -384,9 +513,9 @@ void BulletSystem::addPhysicalObject(BulletObj* obj,
     obj->mInitialPo = po;
     obj->mHull = hull;
     DEBUG_OUTPUT(cout << "dbm: adding active object: " << obj << " shape: " << (int)obj->mShape << endl);
-    if (obj->mDynamic) {
+    if (!obj->needsMesh()) {
         /// create the object now
-        obj->buildBulletBody(NULL, 0);                /// no mesh data
+        obj->buildBulletBody();                /// no mesh data
     }
     else {
         /// set up a mesh download; callback (downloadFinished) calls buildBulletBody and completes object
@@ -401,10 +530,27 @@ void BulletSystem::removePhysicalObject(BulletObj* obj) {
     /// there are a number of objects created during the instantiation of a BulletObj
     /// if they really need to be kept around, we should keep track of them & delete them
     DEBUG_OUTPUT(cout << "dbm: removing active object: " << obj << endl;)
+    boost::recursive_mutex::scoped_lock lock(mWorldMutex);
+    for (unsigned int i=0; i<mSnapshot.size(); i++) {
+        if (mSnapshot[i].first == obj) {
+            mSnapshot.erase(mSnapshot.begin()+i);
+            break;
+        }
+    }
+    if (obj->mMovedExternally) {
+        mMovedObjects.erase(std::find(mMovedObjects.begin(), mMovedObjects.end(), obj));
+    }
+    for (std::map<Fingerprint, std::vector<BulletObj*> >::iterator iter = mPendingMeshes.begin();
+         iter != mPendingMeshes.end(); ++iter) {
+        std::vector<BulletObj*>::iterator where = std::find(iter->second.begin(), iter->second.end(), obj);
+        if (where != iter->second.end()) {
+            iter->second.erase(where);
+        }
+    }
     for (unsigned int i=0; i<objects.size(); i++) {
         if (objects[i] == obj) {
             if (objects[i]->mActive) {
-                dynamicsWorld->removeRigidBody(obj->mBulletBodyPtr);
+                removeFromRegions(obj);
             }
             delete obj;
             break;
@@ -412,162 +558,416 @@ void BulletSystem::removePhysicalObject(BulletObj* obj) {
     }
 }
 
-bool BulletSystem::tick() {
-    static Task::AbsTime lasttime = mStartTime;
-    static Task::DeltaTime waittime = Task::DeltaTime::seconds(0.02);
-    static int mode = 0;
+void BulletSystem::snapshot() {
+    boost::recursive_mutex::scoped_lock lock(mWorldMutex);
     Task::AbsTime now = Task::AbsTime::now();
-    Task::DeltaTime delta;
-    positionOrientation po;
-
-    DEBUG_OUTPUT(cout << "dbm: BulletSystem::tick time: " << (now-mStartTime).toSeconds() << endl;)
-    if (now > lasttime + waittime) {
-        delta = now-lasttime;
-        if (delta.toSeconds() > 0.05) delta = delta.seconds(0.05);           /// avoid big time intervals, they are trubble
-        lasttime = now;
+    mStepDue = false;
+    mSnapshot.clear();
+    {
+        std::vector<std::pair<Fingerprint, SharedCollisionMeshPtr> > built;
+        {
+            boost::mutex::scoped_lock builtLock(mBuiltMeshesMutex);
+            built.swap(mBuiltMeshes);
+        }
+        for (unsigned int i=0; i<built.size(); i++) {
+            attachCollisionMesh(built[i].first, built[i].second);
+        }
+    }
+    DEBUG_OUTPUT(cout << "dbm: BulletSystem::snapshot time: " << (now-mStartTime).toSeconds() << endl;)
+    if (now > mLastStep + desiredTickRate()) {
+        mStepDelta = now-mLastStep;
+        mLastStep = now;
+        mStepTime = now;
         if ((now-mStartTime) > Duration::seconds(20.0)) {
-            for (unsigned int i=0; i<objects.size(); i++) {
-                if (objects[i]->mActive) {
-                    if (objects[i]->mMeshptr->getPosition() != objects[i]->getBulletState().p ||
-                            objects[i]->mMeshptr->getOrientation() != objects[i]->getBulletState().o) {
-                        /// if object has been moved, reset bullet position accordingly
-                        DEBUG_OUTPUT(cout << "    dbm: object, " << objects[i]->mName << " moved by user!"
-                                     << " meshpos: " << objects[i]->mMeshptr->getPosition()
-                                     << " bulletpos before reset: " << objects[i]->getBulletState().p;)
-                        objects[i]->setBulletState(
-                            positionOrientation (
-                                objects[i]->mMeshptr->getPosition(),
-                                objects[i]->mMeshptr->getOrientation()
-                            ));
-                        DEBUG_OUTPUT(cout << "bulletpos after reset: " << objects[i]->getBulletState().p << endl;)
-                    }
+            mStepDue = true;
+            if (mSyncAll->as<bool>()) {
+                for (unsigned int i=0; i<objects.size(); i++) {
+                    objects[i]->markMoved();
                 }
             }
-            dynamicsWorld->stepSimulation(delta.toSeconds(),Duration::seconds(10).toSeconds());
-
-            for (unsigned int i=0; i<objects.size(); i++) {
-                if (objects[i]->mActive) {
-                    po = objects[i]->getBulletState();
-                    DEBUG_OUTPUT(cout << "    dbm: object, " << objects[i]->mName << ", delta, "
-                                 << delta.toSeconds() << ", newpos, " << po.p << "obj: " << objects[i] << endl;)
-                    Location loc (objects[i]->mMeshptr->globalLocation(now));
-                    loc.setPosition(po.p);
-                    loc.setOrientation(po.o);
-                    objects[i]->mMeshptr->setLocation(now, loc);
+            for (unsigned int i=0; i<mMovedObjects.size(); i++) {
+                BulletObj *obj = mMovedObjects[i];
+                obj->mMovedExternally = false;
+                if (obj->mActive) {
+                    mSnapshot.push_back(std::pair<BulletObj*,positionOrientation>(
+                                            obj,
+                                            positionOrientation(obj->mMeshptr->getPosition(),
+                                                                obj->mMeshptr->getOrientation())));
                 }
             }
+            mMovedObjects.clear();
+            updateLevelsOfDetail();
+        }
+    }
+}
 
-            /// test queryRay
-            /*
-            ProxyMeshObjectPtr bugObj;
-            for (unsigned int i=0; i<objects.size(); i++)
-                if (objects[i]->mName == "queryRay") bugObj = objects[i]->mMeshptr;
-            double dist;
-            Vector3f norm;
-            SpaceObjectReference sor;
-            //queryRay(Vector3d(48.81, 4618.08, 23.31), Vector3f(0,-1,0), 100.0, dist, norm, sor);  /// BORNHOLM SCENE
-            queryRay(Vector3d(0, 10, 0), Vector3f(0,-1,0), 20.0, bugObj, dist, norm, sor);
-            cout << "dbm debug: queryRay returns distance: " << dist << " normal: " << norm << " object: " << sor << endl;
-            */
-
-            /// collision messages
-            std::map<ObjectReference,RoutableMessageBody> mBeginCollisionMessagesToSend;
-            std::map<ObjectReference,RoutableMessageBody> mEndCollisionMessagesToSend;
-            BulletObj* anExampleCollidingMesh=NULL;
-            for (customDispatch::CollisionPairMap::iterator i=dispatcher->collisionPairs.begin();
-                    i != dispatcher->collisionPairs.end(); /*increment in if*/) {
-                BulletObj* b0=anExampleCollidingMesh=i->first.getLower();
-                BulletObj* b1=i->first.getHigher();
-                ObjectReference b0id=b0->getObjectReference();
-                ObjectReference b1id=b1->getObjectReference();
-
-                if (i->second.collidedThisFrame()) {             /// recently colliding; send msg & change mode
-                    if (!i->second.collidedLastFrame()) {
-                        if (b1->colMsg & b0->colMask) {
-                            RoutableMessageBody *body=&mBeginCollisionMessagesToSend[b1id];
-
-                            Physics::Protocol::CollisionBegin collide;
-                            collide.set_timestamp(now);
-                            collide.set_other_object_reference(b0id.getAsUUID());
-                            for (std::vector<customDispatch::ActiveCollisionState::PointCollision>::iterator iter=i->second.mPointCollisions.begin(),iterend=i->second.mPointCollisions.end();iter!=iterend;++iter) {
-                                collide.add_this_position(iter->mWorldOnHigher);
-                                collide.add_other_position(iter->mWorldOnLower);
-                                collide.add_this_normal(iter->mNormalWorldOnHigher);
-                                collide.add_impulse(iter->mAppliedImpulse);
-
-                            }
-                            collide.SerializeToString(body->add_message("BegCol"));
-                            cout << "   begin collision msg: " << b0->mName << " --> " << b1->mName
-                            << " time: " << (Task::AbsTime::now()-mStartTime).toSeconds() << endl;
-                        }
-                        if (b0->colMsg & b1->colMask) {
-                            RoutableMessageBody *body=&mBeginCollisionMessagesToSend[b0id];
-
-                            Physics::Protocol::CollisionBegin collide;
-                            collide.set_timestamp(now);
-                            collide.set_other_object_reference(b1id.getAsUUID());
-                            for (std::vector<customDispatch::ActiveCollisionState::PointCollision>::iterator iter=i->second.mPointCollisions.begin(),iterend=i->second.mPointCollisions.end();iter!=iterend;++iter) {
-                                collide.add_other_position(iter->mWorldOnHigher);
-                                collide.add_this_position(iter->mWorldOnLower);
-                                collide.add_this_normal(-iter->mNormalWorldOnHigher);
-                                collide.add_impulse(iter->mAppliedImpulse);
-
-                            }
-                            collide.SerializeToString(body->add_message("BegCol"));
-                            cout << "   begin collision msg: " << b1->mName << " --> " << b0->mName
-                            << " time: " << (Task::AbsTime::now()-mStartTime).toSeconds() << endl;
-                        }
-                    }
-                    i->second.resetCollisionFlag();
-                    ++i;
+void BulletSystem::updateLevelsOfDetail() {
+    double hullDistance = mLodHullDistance->as<double>();
+    double removeDistance = mLodRemoveDistance->as<double>();
+    if (hullDistance <= 0 && removeDistance <= 0)
+        return;
+    Task::AbsTime now = Task::AbsTime::now();
+    if (now < mLastLodUpdate + mLodInterval->as<Duration>())
+        return;
+    mLastLodUpdate = now;
+    std::vector<btVector3> dynamicBodies;
+    for (unsigned int i=0; i<objects.size(); i++) {
+        if (objects[i]->mActive && objects[i]->mDynamic) {
+            dynamicBodies.push_back(objects[i]->mBulletBodyPtr->getWorldTransform().getOrigin());
+        }
+    }
+    for (unsigned int i=0; i<objects.size(); i++) {
+        BulletObj *obj = objects[i];
+        if (!obj->mActive || obj->mDynamic)
+            continue;
+        btTransform trans;
+        obj->mMotionState->getWorldTransform(trans);
+        btVector3 aabbMin, aabbMax;
+        obj->mColShape->getAabb(trans, aabbMin, aabbMax);
+        /// from the nearest dynamic body to the closest point of the bounds, so large meshes like terrain stay exact under it
+        double nearest = BT_LARGE_FLOAT;
+        for (unsigned int d=0; d<dynamicBodies.size(); d++) {
+            btVector3 outside(0,0,0);
+            for (int axis=0; axis<3; axis++) {
+                if (dynamicBodies[d][axis] < aabbMin[axis])
+                    outside[axis] = aabbMin[axis]-dynamicBodies[d][axis];
+                else if (dynamicBodies[d][axis] > aabbMax[axis])
+                    outside[axis] = dynamicBodies[d][axis]-aabbMax[axis];
+            }
+            nearest = std::min(nearest, (double)outside.length());
+        }
+        /// a level is left for a finer one only well inside its threshold, so a body on the line doesn't flip it every update
+        BulletObj::LevelOfDetail lod = BulletObj::LodExact;
+        if (removeDistance > 0 && nearest > removeDistance*(obj->mLod == BulletObj::LodRemoved ? .9 : 1.)) {
+            lod = BulletObj::LodRemoved;
+        }
+        else if (hullDistance > 0 && nearest > hullDistance*(obj->mLod != BulletObj::LodExact ? .9 : 1.)) {
+            lod = BulletObj::LodHull;
+        }
+        setLevelOfDetail(obj, lod);
+    }
+}
+
+void BulletSystem::setLevelOfDetail(BulletObj* obj, BulletObj::LevelOfDetail lod) {
+    if (lod == obj->mLod)
+        return;
+    DEBUG_OUTPUT(cout << "dbm: object " << obj->mName << " lod " << (int)obj->mLod << " -> " << (int)lod << endl);
+    /// Bullet caches collision algorithms by shape type, so the body leaves the world while its shape changes
+    removeFromRegions(obj);
+    obj->mLod = lod;
+    if (lod == BulletObj::LodRemoved)
+        return;
+    float mass;
+    obj->buildBulletShape(mass);
+    obj->mBulletBodyPtr->setCollisionShape(obj->mColShape);
+    bt2siri[obj->mBulletBodyPtr] = obj;
+    mRegions[obj->mRegion].dynamicsWorld->addRigidBody(obj->mBulletBodyPtr);
+    placeInRegions(obj);
+}
+
+/// Steps one region's world on a region worker.
+class RegionStepTask : public Task::WorkItem {
+    BulletSystem *mSystem;
+    btDiscreteDynamicsWorld *mWorld;
+    double mTimeStep;
+    int mMaxSubsteps;
+    double mFixedStep;
+public:
+    RegionStepTask(BulletSystem *system, btDiscreteDynamicsWorld *world, double timeStep, int maxSubsteps, double fixedStep)
+        : mSystem(system), mWorld(world), mTimeStep(timeStep), mMaxSubsteps(maxSubsteps), mFixedStep(fixedStep) {
+    }
+    void operator() () {
+        AutoPtr delete_me(this);
+        mWorld->stepSimulation(mTimeStep, mMaxSubsteps, mFixedStep);
+        mSystem->regionStepped();
+    }
+};
+
+void BulletSystem::regionStepped() {
+    boost::mutex::scoped_lock steppingLock(mRegionsSteppingMutex);
+    if (--mRegionsStepping == 0) {
+        mRegionsSteppingDone.notify_all();
+    }
+}
+
+unsigned int BulletSystem::regionCell(double coord) const {
+    double cell = (coord+mWorldHalfExtent)/(2.0*mWorldHalfExtent)*mRegionGrid;
+    if (cell < 0)
+        return 0;
+    if (cell >= mRegionGrid)
+        return mRegionGrid-1;
+    return (unsigned int)cell;
+}
+
+unsigned int BulletSystem::regionAt(const Vector3d &pos) const {
+    return regionCell(pos.z)*mRegionGrid + regionCell(pos.x);
+}
+
+void BulletSystem::placeInRegions(BulletObj* obj) {
+    if (mRegions.size() <= 1 || !obj->mBulletBodyPtr || obj->mLod == BulletObj::LodRemoved)
+        return;
+    btTransform trans;
+    if (obj->mDynamic)
+        trans = obj->mBulletBodyPtr->getWorldTransform();
+    else
+        obj->mBulletBodyPtr->getMotionState()->getWorldTransform(trans);
+    unsigned int home = regionAt(positionFromBullet(this, trans.getOrigin()));
+    if (home != obj->mRegion) {
+        mRegions[obj->mRegion].dynamicsWorld->removeRigidBody(obj->mBulletBodyPtr);
+        mRegions[home].dynamicsWorld->addRigidBody(obj->mBulletBodyPtr);
+        obj->mRegion = home;
+    }
+    if (obj->mDynamic)
+        return;
+    btVector3 aabbMin, aabbMax;
+    obj->mColShape->getAabb(trans, aabbMin, aabbMax);
+    std::vector<std::pair<unsigned int, btRigidBody*> > ghosts;
+    for (unsigned int z=regionCell(aabbMin.z()); z<=regionCell(aabbMax.z()); z++) {
+        for (unsigned int x=regionCell(aabbMin.x()); x<=regionCell(aabbMax.x()); x++) {
+            unsigned int r = z*mRegionGrid + x;
+            if (r == home)
+                continue;
+            btRigidBody *ghost = NULL;
+            for (unsigned int i=0; i<obj->mGhostBodies.size(); i++) {
+                if (obj->mGhostBodies[i].first == r) {
+                    ghost = obj->mGhostBodies[i].second;
+                    obj->mGhostBodies.erase(obj->mGhostBodies.begin()+i);
+                    break;
                 }
-                else {        /// didn't get flagged again; collision now over
-                    assert(i->second.collidedLastFrame());
-                    if (b1->colMsg & b0->colMask) {
-                        RoutableMessageBody *body=&mEndCollisionMessagesToSend[b1id];
-
-                        Physics::Protocol::CollisionEnd collide;
-                        collide.set_timestamp(now);
-                        collide.set_other_object_reference(b0id.getAsUUID());
-                        collide.SerializeToString(body->add_message("EndCol"));
-
-                        cout << "     end collision msg: " << b0->mName << " --> " << b1->mName
-                        << " time: " << (Task::AbsTime::now()-mStartTime).toSeconds() << endl;
+            }
+            if (!ghost) {
+                btRigidBody::btRigidBodyConstructionInfo rbInfo(0.0f, obj->mMotionState, obj->mColShape);
+                ghost = new btRigidBody(rbInfo);
+                ghost->setFriction(obj->mFriction);
+                ghost->setRestitution(obj->mBounce);
+                ghost->setCollisionFlags(ghost->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+                ghost->setActivationState(DISABLE_DEACTIVATION);
+                mRegions[r].dynamicsWorld->addRigidBody(ghost);
+                bt2siri[ghost] = obj;
+            }
+            ghosts.push_back(std::pair<unsigned int, btRigidBody*>(r, ghost));
+        }
+    }
+    obj->mGhostBodies.swap(ghosts);
+    /// whatever is left in ghosts are cells the object no longer reaches
+    for (unsigned int i=0; i<ghosts.size(); i++) {
+        mRegions[ghosts[i].first].dynamicsWorld->removeRigidBody(ghosts[i].second);
+        bt2siri.erase(ghosts[i].second);
+        delete ghosts[i].second;
+    }
+}
+
+void BulletSystem::removeFromRegions(BulletObj* obj) {
+    if (obj->mLod == BulletObj::LodRemoved)
+        return;
+    mRegions[obj->mRegion].dynamicsWorld->removeRigidBody(obj->mBulletBodyPtr);
+    bt2siri.erase(obj->mBulletBodyPtr);
+    for (unsigned int i=0; i<obj->mGhostBodies.size(); i++) {
+        mRegions[obj->mGhostBodies[i].first].dynamicsWorld->removeRigidBody(obj->mGhostBodies[i].second);
+        bt2siri.erase(obj->mGhostBodies[i].second);
+        delete obj->mGhostBodies[i].second;
+    }
+    obj->mGhostBodies.clear();
+}
+
+void BulletSystem::step() {
+    boost::recursive_mutex::scoped_lock lock(mWorldMutex);
+    if (!mStepDue) {
+        return;
+    }
+    mStepDue = false;
+    for (unsigned int i=0; i<mSnapshot.size(); i++) {
+        BulletObj *obj = mSnapshot[i].first;
+        const positionOrientation &meshpo = mSnapshot[i].second;
+        if (obj->mActive && (meshpo.p != obj->getBulletState().p || meshpo.o != obj->getBulletState().o)) {
+            /// if object has been moved, reset bullet position accordingly
+            DEBUG_OUTPUT(cout << "    dbm: object, " << obj->mName << " moved by user!"
+                         << " meshpos: " << meshpo.p
+                         << " bulletpos before reset: " << obj->getBulletState().p;)
+            obj->setBulletState(meshpo);
+            placeInRegions(obj);
+            DEBUG_OUTPUT(cout << "bulletpos after reset: " << obj->getBulletState().p << endl;)
+        }
+    }
+    /// Bullet keeps the remainder between ticks and drops whatever exceeds max-substeps,
+    /// then leaves each motion state interpolated to the end of mStepDelta.
+    double timeStep = mStepDelta.toSeconds();
+    int maxSubsteps = mMaxSubsteps->as<int>();
+    double fixedStep = 1.0/mSubstepRate->as<double>();
+    if (mRegionQueue) {
+        {
+            boost::mutex::scoped_lock steppingLock(mRegionsSteppingMutex);
+            mRegionsStepping = mRegions.size()-1;
+        }
+        for (unsigned int r=1; r<mRegions.size(); r++) {
+            mRegionQueue->enqueue(new RegionStepTask(this, mRegions[r].dynamicsWorld, timeStep, maxSubsteps, fixedStep));
+        }
+    }
+    else {
+        for (unsigned int r=1; r<mRegions.size(); r++) {
+            mRegions[r].dynamicsWorld->stepSimulation(timeStep, maxSubsteps, fixedStep);
+        }
+    }
+    mRegions[0].dynamicsWorld->stepSimulation(timeStep, maxSubsteps, fixedStep);
+    if (mRegionQueue) {
+        boost::mutex::scoped_lock steppingLock(mRegionsSteppingMutex);
+        while (mRegionsStepping) {
+            mRegionsSteppingDone.wait(steppingLock);
+        }
+    }
+
+    bool syncAll = mSyncAll->as<bool>();
+    for (unsigned int i=0; i<objects.size(); i++) {
+        /// static objects only move when their owner moves them, and sleeping ones not at all
+        if (objects[i]->mActive && (syncAll || (objects[i]->mDynamic && objects[i]->mBulletBodyPtr->isActive()))) {
+            positionOrientation po = objects[i]->getBulletState();
+            if (objects[i]->mDynamic) {
+                placeInRegions(objects[i]);
+            }
+            DEBUG_OUTPUT(cout << "    dbm: object, " << objects[i]->mName << ", delta, "
+                         << mStepDelta.toSeconds() << ", newpos, " << po.p << "obj: " << objects[i] << endl;)
+            mSteppedLocations.push_back(std::pair<ProxyMeshObjectPtr,positionOrientation>(objects[i]->mMeshptr, po));
+        }
+    }
+    collectCollisionMessages();
+}
+
+void BulletSystem::collectCollisionMessages() {
+    Task::AbsTime now = mStepTime;
+    mCollisionEvents.clear();
+    mCollisionPoints.clear();
+    for (unsigned int region=0; region<mRegions.size(); region++) {
+        customDispatch* dispatcher = mRegions[region].dispatcher;
+        for (customDispatch::CollisionPairMap::iterator i=dispatcher->collisionPairs.begin();
+                i != dispatcher->collisionPairs.end(); /*increment in if*/) {
+            BulletObj* b0=i->first.getLower();
+            BulletObj* b1=i->first.getHigher();
+            /// an object only hears about the ones whose mask matches what it subscribed to in colMsg
+            bool toHigher = (b1->colMsg & b0->colMask) != 0;
+            bool toLower = (b0->colMsg & b1->colMask) != 0;
+            CollisionEvent event;
+            if (i->second.collidedThisFrame()) {             /// recently colliding; send msg & change mode
+                if (!i->second.collidedLastFrame() && (toHigher || toLower)) {
+                    event.mBegin = true;
+                    event.mFirstPoint = mCollisionPoints.size();
+                    event.mPointCount = i->second.mPointCollisions.size();
+                    mCollisionPoints.insert(mCollisionPoints.end(),
+                                            i->second.mPointCollisions.begin(), i->second.mPointCollisions.end());
+                    if (toHigher) {
+                        event.mDestination = b1;
+                        event.mOther = b0;
+                        event.mDestinationIsHigher = true;
+                        mCollisionEvents.push_back(event);
                     }
-                    if (b0->colMsg & b1->colMask) {
-                        RoutableMessageBody *body=&mEndCollisionMessagesToSend[b0id];
-
-                        Physics::Protocol::CollisionEnd collide;
-                        collide.set_timestamp(now);
-                        collide.set_other_object_reference(b1id.getAsUUID());
-                        collide.SerializeToString(body->add_message("EndCol"));
-                        cout << "     end collision msg: " << b1->mName << " --> " << b0->mName
-                        << " time: " << (Task::AbsTime::now()-mStartTime).toSeconds() << endl;
+                    if (toLower) {
+                        event.mDestination = b0;
+                        event.mOther = b1;
+                        event.mDestinationIsHigher = false;
+                        mCollisionEvents.push_back(event);
                     }
-                    dispatcher->collisionPairs.erase(i++);
                 }
-                for (std::map<ObjectReference,RoutableMessageBody>*whichMessages=&mBeginCollisionMessagesToSend;true;whichMessages=&mEndCollisionMessagesToSend) {//send all items from map 1, then all items from map 2 (for loop of size 2)
-                    for (std::map<ObjectReference,RoutableMessageBody>::iterator iter=whichMessages->begin(),iterend=whichMessages->end();iter!=iterend;++iter) {
-                        RoutableMessageHeader hdr;
-                        hdr.set_destination_object(iter->first);
-                        hdr.set_destination_space(anExampleCollidingMesh->getSpaceID());
-                        hdr.set_source_object(ObjectReference::spaceServiceID());
-                        hdr.set_source_port(Services::PHYSICS);
-                        std::string body;
-                        iter->second.SerializeToString(&body);
-                        sendMessage(hdr,MemoryReference(body));
+                i->second.resetCollisionFlag();
+                ++i;
+            }
+            else {        /// didn't get flagged again; collision now over
+                assert(i->second.collidedLastFrame());
+                event.mBegin = false;
+                event.mFirstPoint = 0;
+                event.mPointCount = 0;
+                if (toHigher) {
+                    event.mDestination = b1;
+                    event.mOther = b0;
+                    event.mDestinationIsHigher = true;
+                    mCollisionEvents.push_back(event);
+                }
+                if (toLower) {
+                    event.mDestination = b0;
+                    event.mOther = b1;
+                    event.mDestinationIsHigher = false;
+                    mCollisionEvents.push_back(event);
+                }
+                dispatcher->collisionPairs.erase(i++);
+            }
+        }
+    }
+    /// one message per destination, holding every begin and end it got this step
+    std::stable_sort(mCollisionEvents.begin(), mCollisionEvents.end());
+    for (size_t first=0, last=0; first<mCollisionEvents.size(); first=last) {
+        BulletObj* destination = mCollisionEvents[first].mDestination;
+        RoutableMessageBody body;
+        for (last=first; last<mCollisionEvents.size() && mCollisionEvents[last].mDestination==destination; ++last) {
+            const CollisionEvent &event = mCollisionEvents[last];
+            UUID other = event.mOther->getObjectReference().getAsUUID();
+            if (event.mBegin) {
+                Physics::Protocol::CollisionBegin collide;
+                collide.set_timestamp(now);
+                collide.set_other_object_reference(other);
+                for (unsigned int p=event.mFirstPoint; p<event.mFirstPoint+event.mPointCount; ++p) {
+                    const customDispatch::ActiveCollisionState::PointCollision &point = mCollisionPoints[p];
+                    if (event.mDestinationIsHigher) {
+                        collide.add_this_position(point.mWorldOnHigher);
+                        collide.add_other_position(point.mWorldOnLower);
+                        collide.add_this_normal(point.mNormalWorldOnHigher);
                     }
-                    if (whichMessages==&mEndCollisionMessagesToSend) {
-                        break;
+                    else {
+                        collide.add_other_position(point.mWorldOnHigher);
+                        collide.add_this_position(point.mWorldOnLower);
+                        collide.add_this_normal(-point.mNormalWorldOnHigher);
                     }
+                    collide.add_impulse(point.mAppliedImpulse);
                 }
+                collide.SerializeToString(body.add_message("BegCol"));
+            }
+            else {
+                Physics::Protocol::CollisionEnd collide;
+                collide.set_timestamp(now);
+                collide.set_other_object_reference(other);
+                collide.SerializeToString(body.add_message("EndCol"));
             }
+            DEBUG_OUTPUT(cout << (event.mBegin ? "   begin" : "     end") << " collision msg: " << event.mOther->mName
+                         << " --> " << destination->mName << " time: " << (Task::AbsTime::now()-mStartTime).toSeconds() << endl);
         }
+        mSteppedMessages.push_back(SteppedMessage());
+        mSteppedMessages.back().mDestination = destination->getObjectReference();
+        mSteppedMessages.back().mSpace = destination->getSpaceID();
+        body.SerializeToString(&mSteppedMessages.back().mBody);
+    }
+}
+
+bool BulletSystem::publish() {
+    mPublishing = true;
+    for (unsigned int i=0; i<mSteppedLocations.size(); i++) {
+        const ProxyMeshObjectPtr &mesh = mSteppedLocations[i].first;
+        Location loc (mesh->globalLocation(mStepTime));
+        loc.setPosition(mSteppedLocations[i].second.p);
+        loc.setOrientation(mSteppedLocations[i].second.o);
+        mesh->setLocation(mStepTime, loc);
     }
+    mPublishing = false;
+    mSteppedLocations.clear();
+    for (unsigned int i=0; i<mSteppedMessages.size(); i++) {
+        RoutableMessageHeader hdr;
+        hdr.set_destination_object(mSteppedMessages[i].mDestination);
+        hdr.set_destination_space(mSteppedMessages[i].mSpace);
+        hdr.set_source_object(ObjectReference::spaceServiceID());
+        hdr.set_source_port(Services::PHYSICS);
+        sendMessage(hdr,MemoryReference(mSteppedMessages[i].mBody));
+    }
+    mSteppedMessages.clear();
     DEBUG_OUTPUT(cout << endl;)
     return true;
 }
 
+bool BulletSystem::tick() {
+    SIRIKATA_TRACE_SCOPE("BulletSystem::tick");
+    snapshot();
+    {
+        SIRIKATA_TRACE_SCOPE("BulletSystem::step");
+        step();
+    }
+    return publish();
+}
+
 void customDispatch::ActiveCollisionState::collide(BulletObj* first, BulletObj* second, btPersistentManifold *currentCollisionManifold) {
     bool flipped= !(first<second);
     //so we can save the normals
@@ -622,10 +1022,12 @@ void customNearCallback(btBroadphasePair& collisionPair, btCollisionDispatcher&
             btPersistentManifold*persistentManifold=contactPointResult.getPersistentManifold();
             int contacts = persistentManifold->getNumContacts();
             if (contacts) {
-                BulletObj* siri0 = ((customDispatch*)(&dispatcher))->bt2siri[0][colObj0];
-                BulletObj* siri1 = ((customDispatch*)(&dispatcher))->bt2siri[0][colObj1];
+                BulletObj* siri0 = ((customDispatch*)(&dispatcher))->lookup(colObj0);
+                BulletObj* siri1 = ((customDispatch*)(&dispatcher))->lookup(colObj1);
                 if (siri0 && siri1) {
-                    if (siri0->colMask & siri1->colMask) {
+                    /// pairs nobody subscribed to would never produce a message, so don't track them
+                    if ((siri0->colMask & siri1->colMask) &&
+                        ((siri0->colMsg & siri1->colMask) || (siri1->colMsg & siri0->colMask))) {
                         ((customDispatch*)(&dispatcher))->collisionPairs[customDispatch::OrderedCollisionPair(siri0,siri1)].collide(siri0,siri1,persistentManifold);
                     }
                 }
@@ -640,41 +1042,47 @@ bool BulletSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, con
     mTempTferManager = new OptionValue("transfermanager","0", OptionValueType<void*>(),"dummy");
     mWorkQueue = new OptionValue("workqueue","0",OptionValueType<void*>(),"Memory address of the WorkQueue");
     mEventManager = new OptionValue("eventmanager","0",OptionValueType<void*>(),"Memory address of the EventManager<Event>");
-    InitializeClassOptions("bulletphysics",this, mTempTferManager, mWorkQueue, mEventManager, NULL);
+    mSyncAll = new OptionValue("sync-all","false",OptionValueType<bool>(),"Compare and publish every object each step instead of only the externally moved and the awake");
+    mSubstepRate = new OptionValue("substep-rate","60",OptionValueType<double>(),"Fixed rate, in steps per second, at which the world is simulated");
+    mMaxSubsteps = new OptionValue("max-substeps","4",OptionValueType<int>(),"Most fixed steps taken per tick; time beyond that is dropped so a long frame can't snowball");
+    mMeshBuildThreads = new OptionValue("mesh-build-threads","1",OptionValueType<int>(),"Threads that parse meshes and build their collision trees; 0 builds them in the download callback");
+    mRegionsPerSide = new OptionValue("regions","1",OptionValueType<int>(),"Split the world into this many cells along x and along z, each a dynamics world stepped in parallel");
+    mBroadphase = new OptionValue("broadphase","sweep",OptionValueType<String>(),"Broadphase of each region: sweep (btAxisSweep3 over fixed bounds) or dbvt (btDbvtBroadphase, for many movers)");
+    mLodHullDistance = new OptionValue("lod-hull-distance","0",OptionValueType<double>(),"Static meshes farther than this from every dynamic body collide as their convex hull; 0 keeps them exact");
+    mLodRemoveDistance = new OptionValue("lod-remove-distance","0",OptionValueType<double>(),"Static meshes farther than this from every dynamic body leave the world, and rays no longer hit them; 0 keeps them in. Keep it well over how far a body moves in lod-interval");
+    mLodInterval = new OptionValue("lod-interval","1s",OptionValueType<Duration>(),"How often static meshes are moved between levels of detail");
+    InitializeClassOptions("bulletphysics",this, mTempTferManager, mWorkQueue, mEventManager, mSyncAll, mSubstepRate, mMaxSubsteps, mMeshBuildThreads, mRegionsPerSide, mBroadphase,
+                           mLodHullDistance, mLodRemoveDistance, mLodInterval, NULL);
     OptionSet::getOptions("bulletphysics",this)->parse(options);
+    if (mMeshBuildThreads->as<int>() > 0) {
+        mMeshBuildQueue = new Task::ThreadSafeWorkQueue;
+        mMeshBuildWorkers = mMeshBuildQueue->createWorkerThreads(mMeshBuildThreads->as<int>());
+    }
     Transfer::TransferManager* tm = (Transfer::TransferManager*)mTempTferManager->as<void*>();
     this->transferManager = tm;
 
     gravity = Vector3d(0, -9.8, 0);
     //groundlevel = 3044.0;
     groundlevel = 0.0;
-    btTransform groundTransform;
-    btDefaultMotionState* mMotionState;
-    btVector3 worldAabbMin(-10000,-10000,-10000);
-    btVector3 worldAabbMax(10000,10000,10000);
-    int maxProxies = 1024;
     btVector3 localInertia(0,0,0);
 
-    /// set up bullet stuff
-    collisionConfiguration = new btDefaultCollisionConfiguration();
-    //dispatcher = new btCollisionDispatcher(collisionConfiguration);
-    dispatcher = new customDispatch(collisionConfiguration, &bt2siri);
-    dispatcher->setNearCallback(customNearCallback);
-    overlappingPairCache= new btAxisSweep3(worldAabbMin,worldAabbMax,maxProxies);
-    solver = new btSequentialImpulseConstraintSolver;
-    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,overlappingPairCache,solver,collisionConfiguration);
-    dynamicsWorld->setGravity(btVector3(gravity.x, gravity.y, gravity.z));
-
     /// create ground
     groundShape= new btBoxShape(btVector3(btScalar(1500.),btScalar(1.0),btScalar(1500.)));
-    groundTransform.setIdentity();
-    groundTransform.setOrigin(btVector3(0,groundlevel-1,0));
     groundShape->calculateLocalInertia(0.0f,localInertia);
-    mMotionState = new btDefaultMotionState(groundTransform);
-    btRigidBody::btRigidBodyConstructionInfo rbInfo(0.0f,mMotionState,groundShape,localInertia);
-    groundBody = new btRigidBody(rbInfo);
-    groundBody->setRestitution(0.5);                 /// bouncy for fun & profit
-    dynamicsWorld->addRigidBody(groundBody);
+
+    /// set up bullet stuff
+    mRegionGrid = std::max(mRegionsPerSide->as<int>(), 1);
+    mRegions.resize(mRegionGrid*mRegionGrid);
+    for (unsigned int r=0; r<mRegions.size(); r++) {
+        buildRegion(mRegions[r]);
+    }
+    if (mRegions.size() > 1) {
+        unsigned int threads = std::min((unsigned int)mRegions.size(), std::max(boost::thread::hardware_concurrency(), 1u));
+        if (threads > 1) {
+            mRegionQueue = new Task::ThreadSafeWorkQueue;
+            mRegionWorkers = mRegionQueue->createWorkerThreads(threads-1);
+        }
+    }
     proxyManager->addListener(this);
     DEBUG_OUTPUT(cout << "dbm: BulletSystem::initialized, including test bullet object" << endl);
     /// we don't delete these, the ProxyManager does (I think -- someone does anyway)
@@ -684,19 +1092,79 @@ bool BulletSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, con
     return true;
 }
 
-BulletSystem::BulletSystem() :             mStartTime(Task::AbsTime::now()) {
+void BulletSystem::buildRegion(PhysicsRegion &region) {
+    btVector3 worldAabbMin(-mWorldHalfExtent,-mWorldHalfExtent,-mWorldHalfExtent);
+    btVector3 worldAabbMax(mWorldHalfExtent,mWorldHalfExtent,mWorldHalfExtent);
+    int maxProxies = 1024;
+    region.collisionConfiguration = new btDefaultCollisionConfiguration();
+    region.dispatcher = new customDispatch(region.collisionConfiguration, &bt2siri);
+    region.dispatcher->setNearCallback(customNearCallback);
+    if (mBroadphase->as<String>() == "dbvt") {
+        region.broadphase = new btDbvtBroadphase();
+    }
+    else {
+        if (mBroadphase->as<String>() != "sweep") {
+            cout << "BulletSystem: unknown broadphase " << mBroadphase->as<String>() << ", using sweep" << endl;
+        }
+        region.broadphase = new btAxisSweep3(worldAabbMin,worldAabbMax,maxProxies);
+    }
+    region.solver = new btSequentialImpulseConstraintSolver;
+    region.dynamicsWorld = new btDiscreteDynamicsWorld(region.dispatcher,region.broadphase,region.solver,region.collisionConfiguration);
+    region.dynamicsWorld->setGravity(btVector3(gravity.x, gravity.y, gravity.z));
+
+    btTransform groundTransform;
+    groundTransform.setIdentity();
+    groundTransform.setOrigin(btVector3(0,groundlevel-1,0));
+    btRigidBody::btRigidBodyConstructionInfo rbInfo(0.0f,new btDefaultMotionState(groundTransform),groundShape);
+    region.groundBody = new btRigidBody(rbInfo);
+    region.groundBody->setRestitution(0.5);                 /// bouncy for fun & profit
+    region.dynamicsWorld->addRigidBody(region.groundBody);
+}
+
+void BulletSystem::destroyRegion(PhysicsRegion &region) {
+    region.dynamicsWorld->removeRigidBody(region.groundBody);
+    delete region.dynamicsWorld;
+    delete region.solver;
+    delete region.broadphase;
+    delete region.dispatcher;
+    delete region.collisionConfiguration;
+    delete region.groundBody->getMotionState();
+    delete region.groundBody;
+}
+
+BulletSystem::BulletSystem() :
+        mStartTime(Task::AbsTime::now()),
+        mLastLodUpdate(mStartTime),
+        mRegionGrid(1),
+        mWorldHalfExtent(10000),
+        mRegionQueue(NULL),
+        mRegionWorkers(NULL),
+        mRegionsStepping(0),
+        mLastStep(mStartTime),
+        mStepTime(mStartTime),
+        mStepDue(false),
+        mMeshBuildQueue(NULL),
+        mMeshBuildWorkers(NULL),
+        mPublishing(false) {
     DEBUG_OUTPUT(cout << "dbm: I am the BulletSystem constructor!" << endl);
 }
 
 BulletSystem::~BulletSystem() {
     DEBUG_OUTPUT(cout << "dbm: BulletSystem destructor" << endl);
+    if (mMeshBuildQueue) {
+        /// the workers finish whatever is queued before they exit
+        mMeshBuildQueue->destroyWorkerThreads(mMeshBuildWorkers);
+        delete mMeshBuildQueue;
+    }
+    mBuiltMeshes.clear();
+    if (mRegionQueue) {
+        mRegionQueue->destroyWorkerThreads(mRegionWorkers);
+        delete mRegionQueue;
+    }
 
-    delete dynamicsWorld;
-    delete solver;
-    delete overlappingPairCache;
-    delete dispatcher;
-    delete collisionConfiguration;
-    delete groundBody;
+    for (unsigned int r=0; r<mRegions.size(); r++) {
+        destroyRegion(mRegions[r]);
+    }
     delete groundShape;
     DEBUG_OUTPUT(cout << "dbm: BulletSystem destructor finished" << endl;)
 }
@@ -705,18 +1173,22 @@ void BulletSystem::createProxy(ProxyObjectPtr p) {
     ProxyMeshObjectPtr meshptr(tr1::dynamic_pointer_cast<ProxyMeshObject>(p));
     if (meshptr) {
         DEBUG_OUTPUT(cout << "dbm: createProxy ptr:" << meshptr << " mesh: " << meshptr->getMesh() << endl;)
+        boost::recursive_mutex::scoped_lock lock(mWorldMutex);
         objects.push_back(new BulletObj(this));     /// clean up memory!!!
         objects.back()->mMeshptr = meshptr;
         meshptr->MeshProvider::addListener(objects.back());
+        meshptr->PositionProvider::addListener(objects.back());
     }
 }
 
 void BulletSystem::destroyProxy(ProxyObjectPtr p) {
     ProxyMeshObjectPtr meshptr(tr1::dynamic_pointer_cast<ProxyMeshObject>(p));
+    boost::recursive_mutex::scoped_lock lock(mWorldMutex);
     for (unsigned int i=0; i<objects.size(); i++) {
         if (objects[i]->mMeshptr==meshptr) {
             DEBUG_OUTPUT(cout << "dbm: destroyProxy, object=" << objects[i] << endl);
             meshptr->MeshProvider::removeListener(objects[i]);
+            meshptr->PositionProvider::removeListener(objects[i]);
             removePhysicalObject(objects[i]);
             objects.erase(objects.begin()+i);
             break;
@@ -769,7 +1241,56 @@ bool BulletSystem::endForwardingMessagesTo(MessageService*ms) {
 }
 
 void BulletSystem::processMessage(const RoutableMessageHeader&mh, MemoryReference message_body) {
-
+    RoutableMessageBody body;
+    body.ParseFromArray(message_body.data(), message_body.size());
+    RoutableMessageBody reply;
+    for (int i=0; i<body.message_size(); ++i) {
+        String *response = reply.add_message_reply();
+        if (body.message_names(i) != "QueryRays") {
+            continue;
+        }
+        Physics::Protocol::RayQueries queries;
+        queries.ParseFromString(body.message_arguments(i));
+        std::vector<RayQuery> rays(queries.rays_size());
+        {
+            boost::recursive_mutex::scoped_lock lock(mWorldMutex);
+            for (int r=0; r<queries.rays_size(); ++r) {
+                const Physics::Protocol::RayQuery &query = queries.rays(r);
+                rays[r].position = query.position();
+                rays[r].direction = query.direction();
+                rays[r].maxDistance = query.has_max_distance() ? query.max_distance() : 1.0e+6;
+                if (query.has_ignore_object_reference()) {
+                    for (unsigned int o=0; o<objects.size(); ++o) {
+                        if (objects[o]->mMeshptr->getObjectReference().object().getAsUUID() == query.ignore_object_reference()) {
+                            rays[r].ignore = objects[o]->mMeshptr;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        std::vector<RayHit> hits;
+        queryRays(rays, hits);
+        Physics::Protocol::RayHits results;
+        for (unsigned int h=0; h<hits.size(); ++h) {
+            Physics::Protocol::RayHit &result = results.add_hits();
+            if (hits[h].hit) {
+                result.set_distance(hits[h].distance);
+                result.set_hit_normal(hits[h].normal);
+                if (hits[h].name != SpaceObjectReference::null()) {
+                    result.set_object_reference(hits[h].name.object().getAsUUID());
+                }
+            }
+        }
+        results.SerializeToString(response);
+    }
+    if (mh.has_id()) {
+        RoutableMessageHeader replyHeader(mh);
+        replyHeader.swap_source_and_destination();
+        String replyBody;
+        reply.SerializeToString(&replyBody);
+        sendMessage(replyHeader, MemoryReference(replyBody));
+    }
 }
 
 void BulletSystem::sendMessage(const RoutableMessageHeader&mh, MemoryReference message_body) {
@@ -785,30 +1306,96 @@ bool BulletSystem::queryRay(const Vector3d& position,
                             double &returnDistance,
                             Vector3f &returnNormal,
                             SpaceObjectReference &returnName) {
+    std::vector<RayQuery> rays(1);
+    rays[0].position = position;
+    rays[0].direction = direction;
+    rays[0].maxDistance = maxDistance;
+    rays[0].ignore = ignore;
+    std::vector<RayHit> hits;
+    queryRays(rays, hits);
+    if (!hits[0].hit) {
+        return false;
+    }
+    returnDistance = hits[0].distance;
+    returnNormal = hits[0].normal;
+    if (hits[0].name != SpaceObjectReference::null()) {
+        returnName = hits[0].name;
+    }
+    return true;
+}
 
-    btVector3 start(position.x, position.y, position.z);
-    Vector3d temp = position + Vector3d(direction)*maxDistance;
-    btVector3 end(temp.x, temp.y, temp.z);
-    btCollisionObject* btIgnore=0;
-    if (ignore)
-        btIgnore = mesh2bullet(ignore)->mBulletBodyPtr;         /// right now this is a slow walk in the park
-    raycastCallback cb(btIgnore);
-    dynamicsWorld->rayTest (start, end, cb);
-    if (cb.hasHit ()) {
-        btVector3 norm = cb.m_hitNormalWorld.normalize();
-        returnNormal.x = norm.getX();
-        returnNormal.y = norm.getY();
-        returnNormal.z = norm.getZ();
-        BulletObj* obj=bt2siri[cb.m_collisionObject];
-        returnDistance = maxDistance * cb.m_closestHitFraction;
-        if (obj) {
-            /// if not found, it's probably the ground body
-            returnName = obj->mMeshptr->getObjectReference();
-        }
-        return true;
+void BulletSystem::queryRays(const std::vector<RayQuery> &rays, std::vector<RayHit> &hits) {
+    hits.clear();
+    hits.resize(rays.size());
+    if (rays.empty())
+        return;
+    btAlignedObjectArray<btVector3> rayFrom, rayTo, rayMin, rayMax;
+    btAlignedObjectArray<btTransform> rayFromTrans, rayToTrans;
+    btAlignedObjectArray<raycastCallback> callbacks;
+    boost::recursive_mutex::scoped_lock lock(mWorldMutex);
+    std::map<ProxyMeshObject*, btCollisionObject*> ignored;
+    for (unsigned int i=0; i<rays.size(); i++) {
+        Vector3d end = rays[i].position + Vector3d(rays[i].direction)*rays[i].maxDistance;
+        rayFrom.push_back(btVector3(rays[i].position.x, rays[i].position.y, rays[i].position.z));
+        rayTo.push_back(btVector3(end.x, end.y, end.z));
+        rayMin.push_back(rayFrom[i]);
+        rayMin[i].setMin(rayTo[i]);
+        rayMax.push_back(rayFrom[i]);
+        rayMax[i].setMax(rayTo[i]);
+        btTransform trans;
+        trans.setIdentity();
+        trans.setOrigin(rayFrom[i]);
+        rayFromTrans.push_back(trans);
+        trans.setOrigin(rayTo[i]);
+        rayToTrans.push_back(trans);
+        btCollisionObject* btIgnore=0;
+        if (rays[i].ignore) {
+            std::map<ProxyMeshObject*, btCollisionObject*>::iterator where = ignored.find(rays[i].ignore.get());
+            if (where == ignored.end()) {
+                BulletObj *obj = mesh2bullet(rays[i].ignore);         /// right now this is a slow walk in the park
+                where = ignored.insert(std::pair<ProxyMeshObject*, btCollisionObject*>(
+                                           rays[i].ignore.get(), obj ? obj->mBulletBodyPtr : 0)).first;
+            }
+            btIgnore = where->second;
+        }
+        callbacks.push_back(raycastCallback(btIgnore));
     }
-    else {
-        return false;
+    /// one walk over the bodies serves the whole batch, and each body's bounds are found only once
+    for (unsigned int r=0; r<mRegions.size(); r++) {
+        btCollisionObjectArray &bodies = mRegions[r].dynamicsWorld->getCollisionObjectArray();
+        for (int b=0; b<bodies.size(); b++) {
+            btCollisionObject *body = bodies[b];
+            btVector3 bodyMin, bodyMax;
+            body->getCollisionShape()->getAabb(body->getWorldTransform(), bodyMin, bodyMax);
+            for (unsigned int i=0; i<rays.size(); i++) {
+                raycastCallback &cb = callbacks[i];
+                if (!TestAabbAgainstAabb2(rayMin[i], rayMax[i], bodyMin, bodyMax) ||
+                    !cb.needsCollision(body->getBroadphaseHandle())) {
+                    continue;
+                }
+                /// the callback keeps the closest hit so far, so only bodies that could beat it are tested
+                btScalar hitLambda = cb.m_closestHitFraction;
+                btVector3 hitNormal;
+                if (btRayAabb(rayFrom[i], rayTo[i], bodyMin, bodyMax, hitLambda, hitNormal)) {
+                    btCollisionWorld::rayTestSingle(rayFromTrans[i], rayToTrans[i], body, body->getCollisionShape(),
+                                                    body->getWorldTransform(), cb);
+                }
+            }
+        }
+    }
+    for (unsigned int i=0; i<rays.size(); i++) {
+        raycastCallback &cb = callbacks[i];
+        if (cb.hasHit ()) {
+            btVector3 norm = cb.m_hitNormalWorld.normalize();
+            hits[i].hit = true;
+            hits[i].normal = Vector3f(norm.getX(), norm.getY(), norm.getZ());
+            hits[i].distance = rays[i].maxDistance * cb.m_closestHitFraction;
+            std::tr1::unordered_map<btCollisionObject*, BulletObj*>::iterator obj = bt2siri.find(cb.m_collisionObject);
+            if (obj != bt2siri.end() && obj->second) {
+                /// if not found, it's probably the ground body
+                hits[i].name = obj->second->mMeshptr->getObjectReference();
+            }
+        }
     }
 }
 
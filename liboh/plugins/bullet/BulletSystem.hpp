@@ -39,36 +39,44 @@
 #include <oh/TimeSteppedQueryableSimulation.hpp>
 #include <oh/ProxyObject.hpp>
 #include <fstream>
+#include <iterator>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <oh/ProxyMeshObject.hpp>
 #include <task/EventManager.hpp>
+#include <task/WorkQueue.hpp>
 #include <options/Options.hpp>
 #include <transfer/TransferManager.hpp>
 #include "btBulletDynamicsCommon.h"
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 using namespace std;
 namespace Sirikata {
 
 /*
-                 dead simple, brute-force parsing of ogre.mesh to get the precious vertex data for physics
+                 dead simple parsing of ogre.mesh to get the precious vertex data for physics
+                 reads straight out of the caller's buffer; running off the end yields zeros
 */
 class parseOgreMesh {
-    vector<unsigned char> data;
+    const unsigned char* data;
+    int size;
     vector<double>* vertices;
     vector<int>* indices;
     vector<double>* bounds;
     int ix;
-    int lastVertexCount, lastVertexSize;
+    int lastVertexCount, lastVertexSize, lastBindIndex;
+    int positionSource, positionOffset;      /// which vertex buffer, and where in it, holds VES_POSITION
+    int sharedVertexBase;                    /// index of the first shared vertex in *vertices
+    bool inSubmesh;
 
     int read_ubyte() {
-        int r;
-        if ((int)data.size()<=ix) {
+        if (size<=ix) {
             return 0;
         }
-        r = data[ix];
-        ix = (ix+1);
-        return r;
+        return data[ix++];
     }
 
     int read_bool() {
@@ -76,55 +84,56 @@ class parseOgreMesh {
     }
 
     int read_u16() {
-        return (read_ubyte()+(read_ubyte()*256));
+        if (size-ix<2) {
+            ix = size;
+            return 0;
+        }
+        int n = data[ix] | (data[ix+1]<<8);
+        ix += 2;
+        return n;
     }
 
     int read_u32() {
-        int n;
-        n = 0;
-        n = (n+read_ubyte());
-        n = (n+(read_ubyte()<<8));
-        n = (n+(read_ubyte()<<16));
-        n = (n+(read_ubyte()<<24));
+        if (size-ix<4) {
+            ix = size;
+            return 0;
+        }
+        int n = peek_u32(data+ix);
+        ix += 4;
         return n;
     }
 
-    double power(double b, int e) {
-        double n=1.0;
-        if (e<0) {
-            e = -e;
-            b = 1.0/b;
-        }
-        for (int i=0; i<e; i++) {
-            n *= b;
-        }
-        return n;
+    static uint32 peek_u32(const unsigned char* p) {
+        return (uint32)p[0] | ((uint32)p[1]<<8) | ((uint32)p[2]<<16) | ((uint32)p[3]<<24);
+    }
+
+    /// the format is little endian IEEE single-precision; assembling the bits first keeps this
+    /// independent of the host byte order
+    static double peek_float(const unsigned char* p) {
+        uint32 u = peek_u32(p);
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
     }
 
     double read_float() {
-        /// ok, this may look ridiculous, but I'm concerned about alternative architectures
-        /// the format is IEEE single-precision float; I don't trust casting to work everywhere
-        /// note this conversion does not deal properly with NAN, INF...
-        double man, v;
-        int exp, sign, u;
-        u = read_u32();
-        if ((!u)) {
+        if (size-ix<4) {
+            ix = size;
             return 0.0;
         }
-        exp = (u>>23)&255;
-        sign = u>>31?-1:1;
-        man = (((double)(u&0x7fffff))/((double)0x800000))+1.0;
-        v = (sign * power(2.0, (exp-127)) ) * man;
+        double v = peek_float(data+ix);
+        ix += 4;
         return v;
     }
 
     string read_string() {
-        string s;
-        int b;
-        b = read_ubyte();
-        while (!(b==10)) {
-            s.push_back(b);
-            b = read_ubyte();
+        int start = ix;
+        while (ix<size && data[ix]!=10) {
+            ix++;
+        }
+        string s((const char*)data+start, ix-start);
+        if (ix<size) {
+            ix++;                                           /// the newline
         }
         return s;
     }
@@ -132,14 +141,69 @@ class parseOgreMesh {
     void read_chunks(int count) {
         int start;
         start = ix;
-        while ( ix<(start+count) && ix<(int)data.size() ) {
+        while ( ix<(start+count) && ix<size ) {
+            int before = ix;
             read_chunk();
+            if (ix<=before) {                               /// corrupt length; don't spin on it
+                ix = size;
+            }
         }
     }
 
+    void read_indices(int indexCount, bool indexes32Bit, int base) {
+        int width = indexes32Bit?4:2;
+        if (ix>=size) {
+            return;
+        }
+        if (indexCount<0 || (size-ix)/width<indexCount) {
+            indexCount = (size-ix)/width;
+        }
+        if (indexCount==0) {
+            return;
+        }
+        const unsigned char* p = data+ix;
+        size_t first = indices->size();
+        indices->resize(first+indexCount);
+        int* out = &(*indices)[0]+first;
+        if (indexes32Bit) {
+            for (int i=0; i<indexCount; i++, p+=4) {
+                out[i] = base+(int)peek_u32(p);
+            }
+        }
+        else {
+            for (int i=0; i<indexCount; i++, p+=2) {
+                out[i] = base+(p[0] | (p[1]<<8));
+            }
+        }
+        ix += indexCount*width;
+    }
+
+    void read_positions() {
+        int count = lastVertexCount;
+        if (lastVertexSize<=0 || count<0 || ix>=size) {
+            return;
+        }
+        if ((size-ix)/lastVertexSize<count) {
+            count = (size-ix)/lastVertexSize;
+        }
+        if (count>0 && lastBindIndex==positionSource && positionOffset+12<=lastVertexSize) {
+            const unsigned char* p = data+ix+positionOffset;
+            size_t first = vertices->size();
+            vertices->resize(first+count*3);
+            double* out = &(*vertices)[0]+first;
+            for (int i=0; i<count; i++, p+=lastVertexSize) {
+                out[i*3] = peek_float(p);
+                out[i*3+1] = peek_float(p+4);
+                out[i*3+2] = peek_float(p+8);
+            }
+        }
+        ix += lastVertexCount*lastVertexSize;
+    }
+
     void read_chunk() {
         string version;
-        int count, floatsPerVertex, i, id, ii, indexCount, indexes32Bit, jj, skeletallyAnimated, skip, useSharedVertices;
+        int count, i, id, indexCount, indexes32Bit, skeletallyAnimated, useSharedVertices;
+        int source, semantic, offset;
 
         id = read_u16();
         if ((id==0x1000)) {                                 /// HEADER
@@ -156,46 +220,44 @@ class parseOgreMesh {
                 useSharedVertices = read_bool();
                 indexCount = read_u32();
                 indexes32Bit = read_bool();
-
-                for (i=0; i<indexCount; i+=1) {
-                    indices->push_back(indexes32Bit?read_u32():read_u16());
-                }
+                /// a submesh with its own geometry is concatenated onto the vertex list right after its indices
+                read_indices(indexCount, indexes32Bit!=0, useSharedVertices?sharedVertexBase:(int)(vertices->size()/3));
 
                 if ((!useSharedVertices)) {
+                    inSubmesh = true;
                     read_chunk();
+                    inSubmesh = false;
                 }
             }
             else if ((id==0x5000)) {                        /// GEOMETRY
+                if (!inSubmesh) {
+                    sharedVertexBase = vertices->size()/3;
+                }
                 lastVertexCount = read_u32();
+                positionSource = -1;
                 read_chunks((count-10));
             }
             else if ((id==0x5100)) {                        /// GEOMETRY_VERTEX_DECLARATION
                 read_chunks((count-6));
             }
             else if ((id==0x5110)) {                        /// GEOMETRY_VERTEX_ELEMENT
-                read_u16();
-                read_u16();
-                read_u16();
-                read_u16();
-                read_u16();
+                source = read_u16();
+                read_u16();                                 /// type; positions are always VET_FLOAT3
+                semantic = read_u16();
+                offset = read_u16();
+                read_u16();                                 /// index
+                if (semantic==1 && positionSource<0) {      /// VES_POSITION
+                    positionSource = source;
+                    positionOffset = offset;
+                }
             }
             else if ((id==0x5200)) {                        /// GEOMETRY_VERTEX_BUFFER
-                read_u16();
+                lastBindIndex = read_u16();
                 lastVertexSize = read_u16();
                 read_chunk();
             }
             else if ((id==0x5210)) {                        /// GEOMETRY_VERTEX_BUFFER_DATA
-                floatsPerVertex = lastVertexSize>>2;
-                skip = (floatsPerVertex-3);
-
-                for (ii=0; ii<lastVertexCount; ii+=1) {
-                    for (jj=0; jj<3; jj+=1) {
-                        vertices->push_back(read_float());
-                    }
-                    for (jj=0; jj<skip; jj+=1) {
-                        read_u32();
-                    }
-                }
+                read_positions();
             }
             /*
             else if ((id==0x8110)) {
@@ -215,48 +277,54 @@ class parseOgreMesh {
     }
 public:
     bool parseData(const unsigned char* rawdata, int bytes, vector<double>& vertices, vector<int>& indices, vector<double>& bounds)    {
-        char temp;
         this->vertices = &vertices;
         this->indices = &indices;
         this->bounds = &bounds;
-        data.clear();
-        ix=0;
-        for (int i=0; i<bytes; i++) {
-            data.push_back(rawdata[i]);
-        }
-//        data.pop_back();                                    // why? whence extra byte?
-        printf("read data %d bytes\n", (int32)data.size());
-        read_chunks(data.size());
+        data = rawdata;
+        size = bytes;
+        ix = 0;
+        lastVertexCount = lastVertexSize = lastBindIndex = 0;
+        positionSource = -1;
+        positionOffset = 0;
+        sharedVertexBase = 0;
+        inSubmesh = false;
+        read_chunks(size);
         return true;
     }
 
     bool parseFile(const char* filename, vector<double>& vertices, vector<int>& indices, vector<double>& bounds)    {
-        char temp;
-        this->vertices = &vertices;
-        this->indices = &indices;
-        this->bounds = &bounds;
-        data.clear();
-        ix=0;
-        ifstream f;
-        f.open(filename);
+        ifstream f(filename, ios::in|ios::binary);
         if (!f) {
             return false;
         }
-        while (!f.eof()) {
-            f.read(&temp, 1);
-            data.push_back(temp);
+        vector<unsigned char> contents((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+        if (contents.empty()) {
+            return false;
         }
-        f.close();
-        data.pop_back();                                    // why? whence extra byte?
-        printf("read data %d bytes\n", (int32)data.size());
-        read_chunks(data.size());
-        return true;
+        return parseData(&contents[0], contents.size(), vertices, indices, bounds);
     }
 };//class parseOgreMesh
 
 
 typedef tr1::shared_ptr<ProxyMeshObject> ProxyMeshObjectPtr;
 
+/// The triangles of one mesh and the BVH built over them, at unit scale.  Every BulletObj
+/// using the mesh wraps the shape in its own btScaledBvhTriangleMeshShape.
+class SharedCollisionMesh : Noncopyable {
+public:
+    btScalar* mBtVertices;//<-- this dude must be aligned on 16 byte boundaries
+    vector<int> mIndices;
+    btTriangleIndexVertexArray* mIndexArray;
+    btBvhTriangleMeshShape* mShape;
+    /// a few dozen points whose convex hull stands in for the mesh, for dynamic and distant bodies
+    btAlignedObjectArray<btVector3> mHullPoints;
+    SharedCollisionMesh(const unsigned char* meshdata, int meshbytes);
+    ~SharedCollisionMesh();
+    /// a hull shape of the mesh at scale, or NULL if the mesh had no vertices
+    btConvexHullShape* makeHull(const btVector3 &scale) const;
+};
+typedef std::tr1::shared_ptr<SharedCollisionMesh> SharedCollisionMeshPtr;
+
 class BulletSystem;
 struct positionOrientation {
     Vector3d p;
@@ -279,36 +347,60 @@ Vector3f normalFromBullet(const btVector3&bt) {
     return Vector3f(bt.x(),bt.y(),bt.z());
 }
 
-class BulletObj : public MeshListener, LocationAuthority, Noncopyable {
+class BulletObj : public MeshListener, public PositionListener, LocationAuthority, Noncopyable {
     friend class BulletSystem;
     enum shapeID {
         ShapeMesh,
         ShapeBox,
         ShapeSphere,
         ShapeCylinder,
-        ShapeCharacter
+        ShapeCharacter,
+        ShapeHull
+    };
+    /// how exactly a static mesh is simulated, chosen by BulletSystem from its distance to the dynamic bodies
+    enum LevelOfDetail {
+        LodExact,
+        LodHull,
+        LodRemoved             /// in no region's world
     };
     BulletSystem* system;
     void setPhysical (const PhysicalParameters &pp);
     void meshChanged (const URI &newMesh);
     void setScale (const Vector3f &newScale);
     void requestLocation(TemporalValue<Location>::Time timeStamp, const Protocol::ObjLoc& reqLoc);
+    ///queues this object for the next snapshot() unless the change came from BulletSystem::publish
+    void markMoved();
+    void resetLocation(Time timestamp, const Location &newLocation) {
+        markMoved();
+    }
+    void updateLocation(Time timestamp, const Location &newLocation) {
+        markMoved();
+    }
+    void setParent(const ProxyObjectPtr &parent, TemporalValue<Location>::Time timeStamp,
+                   const Location &absLocation, const Location &relLocation) {
+        markMoved();
+    }
+    void unsetParent(TemporalValue<Location>::Time timeStamp, const Location &absLocation) {
+        markMoved();
+    }
 
     /// these guys seem to need to stay around for the lifetime of the object.  Otherwise we crash
-    btScalar* mBtVertices;//<-- this dude must be aligned on 16 byte boundaries
-    vector<double> mVertices;
-    vector<int> mIndices;
-    btTriangleIndexVertexArray* mIndexArray;
+    SharedCollisionMeshPtr mCollisionMesh;
     btDefaultMotionState* mMotionState;
     float mDensity;
     float mFriction;
     float mBounce;
     bool mActive;              /// anything that bullet sees is active
     bool mDynamic;             /// but only some are dynamic (affected by forces)
+    bool mMovedExternally;     /// in BulletSystem::mMovedObjects, waiting for snapshot()
     shapeID mShape;
+    LevelOfDetail mLod;
     positionOrientation mInitialPo;
     Vector3d mVelocity;
     btRigidBody* mBulletBodyPtr;
+    unsigned int mRegion;      /// index into BulletSystem::mRegions of the world holding mBulletBodyPtr
+    /// copies of a static body in each other region its bounds reach, sharing its shape and motion state
+    std::vector<std::pair<unsigned int, btRigidBody*> > mGhostBodies;
     btCollisionShape* mColShape;
     ProxyMeshObjectPtr mMeshptr;
     URI mMeshname;
@@ -324,13 +416,14 @@ public:
 
     /// public methods
     BulletObj(BulletSystem* sys) :
-            mBtVertices(NULL),
-            mIndexArray(NULL),
             mMotionState(NULL),
             mActive(false),
             mDynamic(false),
+            mMovedExternally(false),
+            mLod(LodExact),
             mVelocity(Vector3d()),
             mBulletBodyPtr(NULL),
+            mRegion(0),
             mColShape(NULL),
             mSizeX(0),
             mSizeY(0),
@@ -343,8 +436,12 @@ public:
     const SpaceID& getSpaceID()const;
     positionOrientation getBulletState();
     void setBulletState(positionOrientation pq);
-    void buildBulletBody(const unsigned char*, int);
-    void buildBulletShape(const unsigned char* meshdata, int meshbytes, float& mass);
+    void buildBulletBody();
+    void buildBulletShape(float& mass);
+    /// whether the shape comes from a downloaded mesh, so the body waits for it
+    bool needsMesh() const {
+        return !mDynamic || mShape==ShapeHull;
+    }
     BulletSystem * getBulletSystem() {
         return system;
     }
@@ -430,6 +527,23 @@ public:
             btCollisionDispatcher(collisionConfiguration) {
         this->bt2siri=bt2siri;
     }
+    /// read only, as regions may be stepping on several threads at once
+    BulletObj* lookup(btCollisionObject* obj) const {
+        std::tr1::unordered_map<btCollisionObject*, BulletObj*>::const_iterator where = bt2siri->find(obj);
+        return where == bt2siri->end() ? NULL : where->second;
+    }
+};
+
+/// One cell of the region grid, with a dynamics world of its own so that cells can be stepped in parallel.
+/// Dynamic bodies live in the cell holding their centre and only touch bodies in that cell; static
+/// bodies are ghosted into every cell their bounds reach.
+struct PhysicsRegion {
+    btDefaultCollisionConfiguration* collisionConfiguration;
+    customDispatch* dispatcher;
+    btBroadphaseInterface* broadphase;
+    btSequentialImpulseConstraintSolver* solver;
+    btDiscreteDynamicsWorld* dynamicsWorld;
+    btRigidBody* groundBody;
 };
 
 class BulletSystem: public TimeSteppedQueryableSimulation {
@@ -440,21 +554,97 @@ class BulletSystem: public TimeSteppedQueryableSimulation {
     OptionValue* mTempTferManager;
     OptionValue* mWorkQueue;
     OptionValue* mEventManager;
+    OptionValue* mSyncAll;
+    OptionValue* mSubstepRate;
+    OptionValue* mMaxSubsteps;
+    OptionValue* mMeshBuildThreads;
+    OptionValue* mRegionsPerSide;
+    OptionValue* mBroadphase;
+    OptionValue* mLodHullDistance;
+    OptionValue* mLodRemoveDistance;
+    OptionValue* mLodInterval;
     Task::AbsTime mStartTime;
+    Task::AbsTime mLastLodUpdate;
+    /// moves static meshes between their exact shape, their hull and out of the world by how far
+    /// they are from the nearest dynamic body; needs mWorldMutex
+    void updateLevelsOfDetail();
+    void setLevelOfDetail(BulletObj* obj, BulletObj::LevelOfDetail lod);
 
     ///local bullet stuff:
-    btDefaultCollisionConfiguration* collisionConfiguration;
-    customDispatch* dispatcher;
-    btAxisSweep3* overlappingPairCache;
-    btSequentialImpulseConstraintSolver* solver;
     btCollisionShape* groundShape;
-    btRigidBody* groundBody;
+    ///mRegionsPerSide squared cells tiling the world bounds on the x-z plane, row by row along z
+    std::vector<PhysicsRegion> mRegions;
+    unsigned int mRegionGrid;
+    double mWorldHalfExtent;
+    ///steps every region but the first while step() does that one; NULL with a single region
+    Task::ThreadSafeWorkQueue* mRegionQueue;
+    Task::WorkQueueThread* mRegionWorkers;
+    boost::mutex mRegionsSteppingMutex;
+    boost::condition_variable mRegionsSteppingDone;
+    unsigned int mRegionsStepping;
+    void buildRegion(PhysicsRegion &region);
+    void destroyRegion(PhysicsRegion &region);
+    unsigned int regionCell(double coord) const;
+    unsigned int regionAt(const Vector3d &pos) const;
+    ///moves obj into the region holding its centre and refreshes its ghosts; needs mWorldMutex
+    void placeInRegions(BulletObj* obj);
+    void removeFromRegions(BulletObj* obj);
+
+    ///held by step() and by every change to the world from outside it, as step() may run on a thread of its own
+    boost::recursive_mutex mWorldMutex;
+    Task::AbsTime mLastStep;
+    Task::AbsTime mStepTime;
+    Task::DeltaTime mStepDelta;
+    bool mStepDue;
+    ///where each active object's mesh was at snapshot(), so step() need not read the ProxyObjects
+    std::vector<std::pair<BulletObj*,positionOrientation> > mSnapshot;
+    ///collision meshes by content, alive while some BulletObj uses them
+    std::map<Fingerprint, std::tr1::weak_ptr<SharedCollisionMesh> > mCollisionMeshes;
+    ///parses downloaded meshes and builds their BVHs away from the simulation; NULL if mesh-build-threads is 0
+    Task::ThreadSafeWorkQueue* mMeshBuildQueue;
+    Task::WorkQueueThread* mMeshBuildWorkers;
+    ///objects waiting on a collision mesh that is still being built, by content
+    std::map<Fingerprint, std::vector<BulletObj*> > mPendingMeshes;
+    ///meshes the workers have finished since the last snapshot(), guarded by mBuiltMeshesMutex
+    std::vector<std::pair<Fingerprint, SharedCollisionMeshPtr> > mBuiltMeshes;
+    boost::mutex mBuiltMeshesMutex;
+    ///caches a finished mesh and builds the bodies of every object waiting on it; needs mWorldMutex
+    void attachCollisionMesh(const Fingerprint &hash, const SharedCollisionMeshPtr &mesh);
+    ///objects whose ProxyObject was moved by someone other than us since the last snapshot(); main thread only
+    std::vector<BulletObj*> mMovedObjects;
+    ///set while publish() writes locations, so BulletObj::markMoved can tell our own updates apart
+    bool mPublishing;
+    ///where step() left each active object, for publish() to hand back to its ProxyObject
+    std::vector<std::pair<ProxyMeshObjectPtr,positionOrientation> > mSteppedLocations;
+    struct SteppedMessage {
+        ObjectReference mDestination;
+        SpaceID mSpace;
+        String mBody;
+    };
+    ///collision messages raised by step(), for publish() to send
+    std::vector<SteppedMessage> mSteppedMessages;
+    ///one side's view of a collision starting or ending this step
+    struct CollisionEvent {
+        BulletObj* mDestination;
+        BulletObj* mOther;
+        bool mBegin;
+        bool mDestinationIsHigher;     /// which side of the OrderedCollisionPair mDestination was
+        unsigned int mFirstPoint;      /// the contacts of a begin event, in mCollisionPoints
+        unsigned int mPointCount;
+        bool operator<(const CollisionEvent &other) const {
+            return mDestination<other.mDestination;
+        }
+    };
+    ///this step's collision events and their contacts, flat and reused from step to step
+    std::vector<CollisionEvent> mCollisionEvents;
+    std::vector<customDispatch::ActiveCollisionState::PointCollision> mCollisionPoints;
+    void collectCollisionMessages();
 
 
 public:
     BulletSystem();
+    friend class BulletObj;
     std::tr1::unordered_map<btCollisionObject*, BulletObj*> bt2siri;  /// map bullet bodies (what we get in the callbacks) to BulletObj's
-    btDiscreteDynamicsWorld* dynamicsWorld;
     vector<BulletObj*>objects;
     vector<MessageService*>messageServices;
 //    btAlignedObjectArray<btCollisionShape*> collisionShapes;
@@ -484,7 +674,8 @@ public:
     bool forwardMessagesTo(MessageService*);
     bool endForwardingMessagesTo(MessageService*);
     /**
-     * Process an incoming message that may be meant for this system
+     * Process an incoming message that may be meant for this system.
+     * Answers QueryRays RPCs, sent to the PHYSICS port, with RayHits.
      */
     void processMessage(const RoutableMessageHeader&,
                         MemoryReference message_body);
@@ -511,14 +702,31 @@ public:
                           double &returnDistance,
                           Vector3f &returnNormal,
                           SpaceObjectReference &returnName);
+    ///answers every ray in one pass over the bodies of each region
+    virtual void queryRays(const std::vector<RayQuery> &rays, std::vector<RayHit> &hits);
     virtual void createProxy(ProxyObjectPtr p);
     virtual void destroyProxy(ProxyObjectPtr p);
     virtual Duration desiredTickRate()const {
-        return Duration::seconds(0.1);
+        return Duration::seconds(0.02);
     };
     Task::EventResponse downloadFinished(Task::EventPtr evbase, BulletObj* bullobj);
+    ///returns the cached collision mesh for hash, or null if no object holds one
+    SharedCollisionMeshPtr findCollisionMesh(const Fingerprint &hash);
+    ///hands a mesh built on a worker thread to the next snapshot()
+    void meshBuilt(const Fingerprint &hash, const SharedCollisionMeshPtr &mesh);
+    boost::recursive_mutex &worldMutex() {
+        return mWorldMutex;
+    }
     ///returns if rendering should continue
     virtual bool tick();
+    virtual bool canStepInParallel()const {
+        return true;
+    }
+    virtual void snapshot();
+    virtual void step();
+    ///called by a region worker once its world has been stepped
+    void regionStepped();
+    virtual bool publish();
     ~BulletSystem();
 };
 }
@@ -82,6 +82,26 @@ void MonoContext::setVWObject(HostedObject* vwobj, const Mono::Domain &current_d
 }
 
 
+void MonoContext::setDispatchers(const MonoDispatcher& to_host, const MonoDispatcher& to_script) {
+    current().ToHost = to_host;
+    current().ToScript = to_script;
+}
+
+void MonoContext::runOnHost(const std::tr1::function<void()>& task) const {
+    if (current().ToHost)
+        current().ToHost(task);
+    else
+        task();
+}
+
+const MonoDispatcher& MonoContext::scriptDispatcher() const {
+    return current().ToScript;
+}
+
+const MonoDispatcher& MonoContext::hostDispatcher() const {
+    return current().ToHost;
+}
+
 Sirikata::UUID MonoContext::getUUID() const {
     std::tr1::shared_ptr<HostedObject> tmp=getVWObject();
     if (tmp) 
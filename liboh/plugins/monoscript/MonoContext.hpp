@@ -8,6 +8,11 @@ namespace Sirikata {
 
 class MonoContext;
 
+/** Runs a task somewhere else: on the object host's thread, or on the thread
+ *  a script is bound to.
+ */
+typedef std::tr1::function<void(const std::tr1::function<void()>&)> MonoDispatcher;
+
 /** This is the storage class for MonoContext data.  This is
  *  made available so copies of context data can be carried
  *  around and maintained across calls.  However, data is only
@@ -19,6 +24,9 @@ private:
     friend class MonoContext;
     Mono::Domain CurrentDomain;
     std::tr1::weak_ptr<Sirikata::HostedObject> Object;
+    /// Empty when the script runs on the object host's thread.
+    MonoDispatcher ToHost;
+    MonoDispatcher ToScript;
 public:
     MonoContextData();
 };
@@ -68,6 +76,24 @@ public:
      * Get the domain the object was allocated and is running under
      */
     Mono::Domain& getDomain() const;
+
+    /** Set how to reach the object host and the current script's thread;
+     *  leave both empty when the script runs on the object host's thread.
+     */
+    void setDispatchers(const MonoDispatcher& to_host, const MonoDispatcher& to_script);
+
+    /** Run task where it may use the HostedObject: right away on the object
+     *  host's thread, or queued for it from a script thread.
+     */
+    void runOnHost(const std::tr1::function<void()>& task) const;
+
+    /** Gets back to the current script's thread, to run callbacks that arrive
+     *  on the object host's; empty if that is the same thread.
+     */
+    const MonoDispatcher& scriptDispatcher() const;
+
+    /** Gets to the object host's thread; empty if that is the current one. */
+    const MonoDispatcher& hostDispatcher() const;
     /** Get the UUID of the current VWObject
      *  being called.  If the object is null,
      *  then a null UUID will be returned.
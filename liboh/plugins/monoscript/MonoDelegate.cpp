@@ -53,37 +53,37 @@ bool Delegate::null() const {
 }
 
 Object Delegate::invoke() const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke");
 }
 
 Object Delegate::invoke(const Object& p1) const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke", p1);
 }
 
 Object Delegate::invoke(const Object& p1, const Object& p2) const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke", p1, p2);
 }
 
 Object Delegate::invoke(const Object& p1, const Object& p2, const Object& p3) const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke", p1, p2, p3);
 }
 
 Object Delegate::invoke(const Object& p1, const Object& p2, const Object& p3, const Object& p4) const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke", p1, p2, p3, p4);
 }
 
 Object Delegate::invoke(const Object& p1, const Object& p2, const Object& p3, const Object& p4, const Object& p5) const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke", p1, p2, p3, p4, p5);
 }
 
 Object Delegate::invoke(const std::vector<Object>& args) const {
-    static ThreadSafeSingleMethodLookupCache invoke_cache;
+    static PolymorphicMethodLookupCache invoke_cache;
     return mDelegateObj.send(&invoke_cache, "Invoke", args);
 }
 
@@ -123,7 +123,7 @@ void ContextualMonoDelegate::popContext() const {
 
 Mono::Object ContextualMonoDelegate::invoke() const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke");
     popContext();
     return rv;
@@ -131,7 +131,7 @@ Mono::Object ContextualMonoDelegate::invoke() const {
 
 Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1) const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke", p1);
     popContext();
     return rv;
@@ -139,7 +139,7 @@ Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1) const {
 
 Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::Object& p2) const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke", p1, p2);
     popContext();
     return rv;
@@ -147,7 +147,7 @@ Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::
 
 Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::Object& p2, const Mono::Object& p3) const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke", p1, p2, p3);
     popContext();
     return rv;
@@ -155,7 +155,7 @@ Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::
 
 Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::Object& p2, const Mono::Object& p3, const Mono::Object& p4) const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke", p1, p2, p3, p4);
     popContext();
     return rv;
@@ -163,7 +163,7 @@ Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::
 
 Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::Object& p2, const Mono::Object& p3, const Mono::Object& p4, const Mono::Object& p5) const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke", p1, p2, p3, p4, p5);
     popContext();
     return rv;
@@ -171,7 +171,7 @@ Mono::Object ContextualMonoDelegate::invoke(const Mono::Object& p1, const Mono::
 
 Mono::Object ContextualMonoDelegate::invoke(const std::vector<Mono::Object>& args) const {
     pushContext();
-    static Mono::ThreadSafeSingleMethodLookupCache invoke_cache;
+    static Mono::PolymorphicMethodLookupCache invoke_cache;
     Mono::Object rv = mDelegateObj.send(&invoke_cache, "Invoke", args);
     popContext();
     return rv;
@@ -310,6 +310,18 @@ Array Domain::ByteArray(const Sirikata::MemoryBuffer& data) {
     return byte_array;
 }
 
+Array Domain::ByteArray(Object& reuse, const void* data, unsigned int length) {
+    MonoArray* reuse_mono_array = (MonoArray*)reuse.object();
+    if (reuse_mono_array != NULL && mono_array_length(reuse_mono_array) == length) {
+        if (length)
+            memcpy( mono_array_addr(reuse_mono_array,char,0), data, length );
+        return ::Mono::Array(reuse);
+    }
+    ::Mono::Array byte_array = ByteArray(data, length);
+    reuse = byte_array;
+    return byte_array;
+}
+
 //#####################################################################
 // Function wrapObject
 //#####################################################################
@@ -167,6 +167,13 @@ public:
     /** Create a Mono Byte[] that contains the provided data. */
     ::Mono::Array ByteArray(const Sirikata::MemoryBuffer& data);
 
+    /** Fill a Mono Byte[] with the provided data, reusing reuse when it is
+     *  already a Byte[] of exactly length bytes so that a stream of equally
+     *  sized messages doesn't allocate an array per message.
+     *  \param reuse the previously returned array, updated to the one returned
+     */
+    ::Mono::Array ByteArray(Object& reuse, const void* data, unsigned int length);
+
     /** Create a Mono Time that belongs to this Domain.
      *  \param time the Time to copy
      */
@@ -27,19 +27,20 @@ static MonoObject* Mono_Context_CallFunction(MonoObject*callback) {
     return obj.object();
 }
 */
-static void Mono_Context_CallFunctionCallback(const std::tr1::weak_ptr<HostedObject>&weak_ho,
-                                              const Mono::Domain &domain,
-                                              const Mono::Delegate &callback,
-                                              SentMessage*sentMessage,
-                                              const RoutableMessageHeader&responseHeader,
-                                              MemoryReference responseBody) {
-    std::tr1::shared_ptr<HostedObject>ho(weak_ho);
+/// Runs a reply callback in the script, on the thread the script runs on; true to keep waiting for more replies.
+static bool Mono_Context_InvokeCallback(const std::tr1::weak_ptr<HostedObject>&weak_ho,
+                                        const Mono::Domain &domain,
+                                        const Mono::Delegate &callback,
+                                        const MonoDispatcher &to_host,
+                                        const MonoDispatcher &to_script,
+                                        const String &header,
+                                        MemoryReference responseBody) {
+    std::tr1::shared_ptr<HostedObject>ho(weak_ho.lock());
     bool keepquery = false;
     if (ho) {
         MonoContext::getSingleton().push(MonoContextData());
         MonoContext::getSingleton().setVWObject(&*ho,domain);
-        String header;
-        responseHeader.SerializeToString(&header);
+        MonoContext::getSingleton().setDispatchers(to_host,to_script);
         try {
             Object ret = callback.invoke(MonoContext::getSingleton().getDomain().ByteArray(header.data(),
                                                                               header.size()),
@@ -54,10 +55,75 @@ static void Mono_Context_CallFunctionCallback(const std::tr1::weak_ptr<HostedObj
         }
         MonoContext::getSingleton().pop();
     }
-    if (!keepquery) {
+    return keepquery;
+}
+/// Object host side: done is set once the query is deleted, so replies already on their way to the script are dropped.
+static void Mono_Context_FinishQuery(SentMessage*sentMessage, const std::tr1::shared_ptr<bool>&done) {
+    if (!*done) {
+        *done = true;
         delete sentMessage;
     }
 }
+static void Mono_Context_ScriptThreadCallback(const std::tr1::weak_ptr<HostedObject>&weak_ho,
+                                              const Mono::Domain &domain,
+                                              const Mono::Delegate &callback,
+                                              const MonoDispatcher &to_host,
+                                              const MonoDispatcher &to_script,
+                                              SentMessage*sentMessage,
+                                              const std::tr1::shared_ptr<bool>&done,
+                                              const String &header,
+                                              const String &body) {
+    if (!Mono_Context_InvokeCallback(weak_ho,domain,callback,to_host,to_script,header,MemoryReference(body))) {
+        to_host(std::tr1::bind(&Mono_Context_FinishQuery,sentMessage,done));
+    }
+}
+static void Mono_Context_CallFunctionCallback(const std::tr1::weak_ptr<HostedObject>&weak_ho,
+                                              const Mono::Domain &domain,
+                                              const Mono::Delegate &callback,
+                                              const MonoDispatcher &to_host,
+                                              const MonoDispatcher &to_script,
+                                              const std::tr1::shared_ptr<bool>&done,
+                                              SentMessage*sentMessage,
+                                              const RoutableMessageHeader&responseHeader,
+                                              MemoryReference responseBody) {
+    if (*done)
+        return;
+    String header;
+    responseHeader.SerializeToString(&header);
+    if (to_script) {
+        // The script may be running on its own thread right now; the reply waits its turn there.
+        to_script(std::tr1::bind(&Mono_Context_ScriptThreadCallback,weak_ho,domain,callback,to_host,to_script,
+                                 sentMessage,done,header,String((const char*)responseBody.data(),responseBody.size())));
+        return;
+    }
+    if (!Mono_Context_InvokeCallback(weak_ho,domain,callback,to_host,to_script,header,responseBody)) {
+        Mono_Context_FinishQuery(sentMessage,done);
+    }
+}
+static void Mono_Context_SendQuery(const std::tr1::weak_ptr<HostedObject>&weak_ho,
+                                   const Mono::Domain &domain,
+                                   const Mono::Delegate &callback,
+                                   const MonoDispatcher &to_host,
+                                   const MonoDispatcher &to_script,
+                                   const RoutableMessageHeader &hdr,
+                                   const String &body,
+                                   const Duration &duration) {
+    std::tr1::shared_ptr<HostedObject> ho(weak_ho.lock());
+    if (!ho)
+        return;
+    SentMessage*sm=hdr.has_id()?new SentMessage(hdr.id(),ho->getTracker()):new SentMessage(ho->getTracker());
+    sm->setCallback(std::tr1::bind(&Mono_Context_CallFunctionCallback,
+                                   weak_ho,
+                                   domain,
+                                   callback,
+                                   to_host,
+                                   to_script,
+                                   std::tr1::shared_ptr<bool>(new bool(false)),
+                                   _1,_2,_3));
+    sm->setTimeout(duration);
+    sm->header()=hdr;
+    sm->send(MemoryReference(body));
+}
 static MonoObject* InternalMono_Context_CallFunction(MonoObject *message, MonoObject*callback, const Duration&duration){
     std::tr1::shared_ptr<HostedObject> ho=MonoContext::getSingleton().getVWObject();
     MemoryBuffer buf;
@@ -66,15 +132,15 @@ static MonoObject* InternalMono_Context_CallFunction(MonoObject *message, MonoOb
     if (ho&&!buf.empty()) {
         RoutableMessageHeader hdr;
         MemoryReference body=hdr.ParseFromArray(&buf[0],buf.size());
-        SentMessage*sm=hdr.has_id()?new SentMessage(hdr.id(),ho->getTracker()):new SentMessage(ho->getTracker());
-        sm->setCallback(std::tr1::bind(&Mono_Context_CallFunctionCallback,
-                                       ho->getWeakPtr(),
-                                       MonoContext::getSingleton().getDomain(),
-                                       Mono::Delegate(Mono::Object(callback)),
-                                       _1,_2,_3));
-        sm->setTimeout(duration);
-        sm->header()=hdr;
-        sm->send(body);
+        MonoContext::getSingleton().runOnHost(std::tr1::bind(&Mono_Context_SendQuery,
+                                                             ho->getWeakPtr(),
+                                                             MonoContext::getSingleton().getDomain(),
+                                                             Mono::Delegate(Mono::Object(callback)),
+                                                             MonoContext::getSingleton().hostDispatcher(),
+                                                             MonoContext::getSingleton().scriptDispatcher(),
+                                                             hdr,
+                                                             String((const char*)body.data(),body.size()),
+                                                             duration));
     }else {
         return MonoContext::getSingleton().getDomain().Boolean(false).object();
     }
@@ -86,6 +152,11 @@ static MonoObject* Mono_Context_CallFunctionWithTimeout(MonoObject *message, Mon
 static MonoObject* Mono_Context_CallFunction(MonoObject *message, MonoObject*callback){
     return InternalMono_Context_CallFunction(message,callback,Duration::seconds(4.0));
 }
+static void Mono_Context_Send(const std::tr1::weak_ptr<HostedObject>&weak_ho, const RoutableMessageHeader &hdr, const String &body) {
+    std::tr1::shared_ptr<HostedObject> ho(weak_ho.lock());
+    if (ho)
+        ho->send(hdr,MemoryReference(body));
+}
 static MonoObject* Mono_Context_SendMessage(MonoObject *message){
     std::tr1::shared_ptr<HostedObject> ho=MonoContext::getSingleton().getVWObject();
     MemoryBuffer buf;
@@ -95,7 +166,8 @@ static MonoObject* Mono_Context_SendMessage(MonoObject *message){
         RoutableMessageHeader hdr;
         MemoryReference body=hdr.ParseFromArray(&buf[0],buf.size());
         
-        ho->send(hdr,body);
+        MonoContext::getSingleton().runOnHost(std::tr1::bind(&Mono_Context_Send,ho->getWeakPtr(),hdr,
+                                                             String((const char*)body.data(),body.size())));
     }else {
         return MonoContext::getSingleton().getDomain().Boolean(false).object();
     }
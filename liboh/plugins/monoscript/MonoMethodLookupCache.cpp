@@ -31,6 +31,7 @@
  */
 #include "oh/Platform.hpp"
 #include "MonoMethodLookupCache.hpp"
+#include "util/AtomicTypes.hpp"
 
 namespace Mono {
 
@@ -84,4 +85,117 @@ void ThreadSafeSingleMethodLookupCache::update(MonoClass* dest_class, const char
 }
 
 
+
+PolymorphicMethodLookupCache::PolymorphicMethodLookupCache()
+ : mEntries(new Entries)
+{
+    mEntries->mCount = 0;
+}
+
+PolymorphicMethodLookupCache::~PolymorphicMethodLookupCache() {
+    for(std::vector<Entries*>::iterator it = mRetired.begin(); it != mRetired.end(); ++it)
+        delete *it;
+    delete mEntries;
+}
+
+MonoMethod* PolymorphicMethodLookupCache::lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs) {
+    const Entries* entries = mEntries;
+    for(int i = 0; i < entries->mCount; i++) {
+        if (entries->mDestClass[i] == dest_class)
+            return entries->mResolvedMethod[i];
+    }
+    return NULL;
+}
+
+void PolymorphicMethodLookupCache::update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved) {
+    boost::mutex::scoped_lock updateLock(mMutex, boost::try_to_lock_t());
+    if (!updateLock.owns_lock())
+        return;
+
+    Entries* current = mEntries;
+    if (current->mCount == MAX_ENTRIES)
+        return;
+    for(int i = 0; i < current->mCount; i++) {
+        if (current->mDestClass[i] == dest_class)
+            return;
+    }
+
+    Entries* next = new Entries(*current);
+    next->mDestClass[next->mCount] = dest_class;
+    next->mResolvedMethod[next->mCount] = resolved;
+    next->mCount++;
+    // Make the new entries visible before the table that points at them.
+    Sirikata::memory_barrier();
+    mEntries = next;
+    mRetired.push_back(current);
+}
+
+
+
+static MethodResolutionCache* sGlobalResolutionCache = NULL;
+
+MethodResolutionCache::MethodResolutionCache() {
+}
+
+MethodResolutionCache::~MethodResolutionCache() {
+}
+
+MethodResolutionCache* MethodResolutionCache::global() {
+    return sGlobalResolutionCache;
+}
+
+void MethodResolutionCache::setGlobal(MethodResolutionCache* cache) {
+    sGlobalResolutionCache = cache;
+}
+
+bool MethodResolutionCache::Key::operator==(const Key& other) const {
+    if (mDestClass != other.mDestClass || mNumArgs != other.mNumArgs)
+        return false;
+    for(int i = 0; i < mNumArgs; i++) {
+        if (mArgClasses[i] != other.mArgClasses[i])
+            return false;
+    }
+    return mMessage == other.mMessage;
+}
+
+size_t MethodResolutionCache::KeyHasher::operator()(const Key& key) const {
+    size_t hash = std::tr1::hash<std::string>()(key.mMessage);
+    hash ^= (size_t)key.mDestClass + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    for(int i = 0; i < key.mNumArgs; i++)
+        hash ^= (size_t)key.mArgClasses[i] + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+bool MethodResolutionCache::makeKey(Key& key, MonoClass* dest_class, const char* message, MonoObject* args[], int nargs) {
+    if (nargs > MAX_CACHED_ARGUMENTS)
+        return false;
+    key.mDestClass = dest_class;
+    key.mNumArgs = nargs;
+    // Overload resolution depends on the argument types, so they are part of
+    // the key; a NULL argument matches any parameter type and keys as NULL.
+    for(int i = 0; i < nargs; i++)
+        key.mArgClasses[i] = (args[i] == NULL) ? NULL : mono_object_get_class(args[i]);
+    key.mMessage = message;
+    return true;
+}
+
+MonoMethod* MethodResolutionCache::lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs) {
+    Key key;
+    if (!makeKey(key, dest_class, message, args, nargs))
+        return NULL;
+    boost::shared_lock<boost::shared_mutex> readLock(mMutex);
+    MethodMap::const_iterator it = mMethods.find(key);
+    if (it == mMethods.end())
+        return NULL;
+    return it->second;
+}
+
+void MethodResolutionCache::update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved) {
+    Key key;
+    if (!makeKey(key, dest_class, message, args, nargs))
+        return;
+    boost::unique_lock<boost::shared_mutex> writeLock(mMutex);
+    mMethods[key] = resolved;
+}
+
 } // namespace Mono
@@ -36,6 +36,7 @@
 #include <mono/metadata/object.h>
 
 #include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 namespace Mono {
 
@@ -70,6 +71,10 @@ public:
     virtual MonoMethod* lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs);
     virtual void update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved);
 
+    /// True once a send through this cache has successfully resolved a method.
+    bool resolved() const {
+        return mResolvedMethod != NULL;
+    }
 private:
     MonoClass* mDestClass;
     MonoMethod* mResolvedMethod;
@@ -93,6 +98,76 @@ private:
     MonoMethod* mResolvedMethod;
 };
 
+/** A polymorphic inline cache: remembers up to MAX_ENTRIES receiver types
+ *  for a call site that always sends the same message with the same
+ *  argument types, e.g. Delegate::invoke, where every delegate type has its
+ *  own Invoke.  Lookups take no lock; updates build a new entry table and
+ *  publish it, and are skipped if another thread is already updating.  Once
+ *  the table is full the site is megamorphic and further receiver types are
+ *  left to the MonoSystem wide MethodResolutionCache.
+ */
+class PolymorphicMethodLookupCache : public MethodLookupCache {
+public:
+    enum {
+        MAX_ENTRIES = 8
+    };
+    PolymorphicMethodLookupCache();
+    virtual ~PolymorphicMethodLookupCache();
+
+    virtual MonoMethod* lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs);
+    virtual void update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved);
+
+private:
+    struct Entries {
+        int mCount;
+        MonoClass* mDestClass[MAX_ENTRIES];
+        MonoMethod* mResolvedMethod[MAX_ENTRIES];
+    };
+    Entries* volatile mEntries;
+    boost::mutex mMutex;
+    /// Tables replaced by a later update; readers may still hold them, so
+    /// they live as long as the cache.  At most MAX_ENTRIES are ever made.
+    std::vector<Entries*> mRetired;
+};
+
+/** Resolved methods keyed by receiver class, message and argument classes,
+ *  shared by every call site.  send_base consults it when a call site's own
+ *  cache misses, so only the first send of a message to a given type with
+ *  given argument types pays for overload resolution.  Classes are never
+ *  unloaded because domains are never unloaded, so the keys stay valid.
+ */
+class MethodResolutionCache {
+public:
+    enum {
+        MAX_CACHED_ARGUMENTS = 8
+    };
+    MethodResolutionCache();
+    ~MethodResolutionCache();
+
+    MonoMethod* lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs);
+    void update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved);
+
+    /// The cache owned by the running MonoSystem, or NULL if there is none.
+    static MethodResolutionCache* global();
+    static void setGlobal(MethodResolutionCache* cache);
+private:
+    struct Key {
+        MonoClass* mDestClass;
+        int mNumArgs;
+        MonoClass* mArgClasses[MAX_CACHED_ARGUMENTS];
+        std::string mMessage;
+        bool operator==(const Key& other) const;
+    };
+    struct KeyHasher {
+        size_t operator()(const Key& key) const;
+    };
+    static bool makeKey(Key& key, MonoClass* dest_class, const char* message, MonoObject* args[], int nargs);
+
+    typedef std::tr1::unordered_map<Key, MonoMethod*, KeyHasher> MethodMap;
+    boost::shared_mutex mMutex;
+    MethodMap mMethods;
+};
+
 } // namespace Mono
 
 #endif //_MONO_METHOD_LOOKUP_CACHE_
@@ -31,6 +31,7 @@
  */
 
 #include <oh/Platform.hpp>
+#include <util/PluginManager.hpp>
 #include "MonoDefs.hpp"
 #include "MonoDomain.hpp"
 #include "MonoSystem.hpp"
@@ -65,7 +66,7 @@ bool loadCustomAssembly(Mono::MonoSystem*mono_system, const Sirikata::String&ass
             ||mono_system->loadAssembly(assembly,"Debug");
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     using namespace Sirikata;
     if (core_plugin_refcount==0) {
         mono_system = new Mono::MonoSystem();
@@ -98,29 +99,32 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
     core_plugin_refcount++;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
     return ++core_plugin_refcount;
 }
-SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
     assert(core_plugin_refcount>0);
     return --core_plugin_refcount;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     using namespace Sirikata;
     if (core_plugin_refcount>0) {
         core_plugin_refcount--;
         assert(core_plugin_refcount==0);
         if (core_plugin_refcount==0) {
             ObjectScriptManagerFactory::getSingleton().unregisterConstructor("monoscript",true);
+            MonoVWObjectScriptManager::destroyScheduler();
             delete mono_system;
         }
     }
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "mono";
 }
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(monoscript)
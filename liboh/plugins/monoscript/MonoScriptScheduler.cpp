@@ -0,0 +1,143 @@
+/*  Sirikata - Mono Embedding
+ *  MonoScriptScheduler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "oh/Platform.hpp"
+#include "MonoDefs.hpp"
+#include "MonoDomain.hpp"
+#include "MonoThread.hpp"
+#include "MonoContext.hpp"
+#include "MonoScriptScheduler.hpp"
+
+namespace Sirikata {
+
+MonoScriptScheduler::MonoScriptScheduler(unsigned int numThreads) {
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        Worker* worker = new Worker;
+        mWorkers.push_back(worker);
+        worker->mThread = new boost::thread(std::tr1::bind(&MonoScriptScheduler::run, worker));
+    }
+}
+
+MonoScriptScheduler::~MonoScriptScheduler() {
+    for (std::vector<Worker*>::iterator iter = mWorkers.begin(); iter != mWorkers.end(); ++iter) {
+        {
+            boost::unique_lock<boost::mutex> lock((*iter)->mMutex);
+            (*iter)->mStop = true;
+        }
+        (*iter)->mCond.notify_one();
+    }
+    for (std::vector<Worker*>::iterator iter = mWorkers.begin(); iter != mWorkers.end(); ++iter) {
+        (*iter)->mThread->join();
+        delete (*iter)->mThread;
+        delete *iter;
+    }
+}
+
+void MonoScriptScheduler::run(Worker* worker) {
+    Mono::Thread attached(Mono::Domain::root());
+    MonoContext::getSingleton().initializeThread();
+    boost::unique_lock<boost::mutex> lock(worker->mMutex);
+    while (true) {
+        while (worker->mTasks.empty() && !worker->mStop)
+            worker->mCond.wait(lock);
+        if (worker->mTasks.empty())
+            break;
+        Task task;
+        task.swap(worker->mTasks.front());
+        worker->mTasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+unsigned int MonoScriptScheduler::assign() {
+    boost::unique_lock<boost::mutex> lock(mAssignMutex);
+    unsigned int best = 0;
+    for (unsigned int i = 1; i < mWorkers.size(); ++i) {
+        if (mWorkers[i]->mScripts < mWorkers[best]->mScripts)
+            best = i;
+    }
+    ++mWorkers[best]->mScripts;
+    return best;
+}
+
+void MonoScriptScheduler::release(unsigned int thread) {
+    boost::unique_lock<boost::mutex> lock(mAssignMutex);
+    --mWorkers[thread]->mScripts;
+}
+
+void MonoScriptScheduler::post(unsigned int thread, const Task& task) {
+    Worker* worker = mWorkers[thread];
+    {
+        boost::unique_lock<boost::mutex> lock(worker->mMutex);
+        worker->mTasks.push_back(task);
+    }
+    worker->mCond.notify_one();
+}
+
+void MonoScriptScheduler::runAndSignal(const Task& task, boost::mutex* mutex, boost::condition_variable* cond, bool* done) {
+    task();
+    boost::unique_lock<boost::mutex> lock(*mutex);
+    *done = true;
+    cond->notify_one();
+}
+
+void MonoScriptScheduler::call(unsigned int thread, const Task& task) {
+    if (boost::this_thread::get_id() == mWorkers[thread]->mThread->get_id()) {
+        task();
+        return;
+    }
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool done = false;
+    post(thread, std::tr1::bind(&MonoScriptScheduler::runAndSignal, task, &mutex, &cond, &done));
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!done)
+        cond.wait(lock);
+}
+
+void MonoScriptScheduler::postToHost(const Task& task) {
+    boost::unique_lock<boost::mutex> lock(mHostMutex);
+    mHostTasks.push_back(task);
+}
+
+void MonoScriptScheduler::runHostTasks() {
+    std::vector<Task> tasks;
+    {
+        boost::unique_lock<boost::mutex> lock(mHostMutex);
+        tasks.swap(mHostTasks);
+    }
+    for (std::vector<Task>::iterator iter = tasks.begin(); iter != tasks.end(); ++iter)
+        (*iter)();
+}
+
+}
@@ -0,0 +1,92 @@
+/*  Sirikata - Mono Embedding
+ *  MonoScriptScheduler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _MONO_SCRIPT_SCHEDULER_HPP_
+#define _MONO_SCRIPT_SCHEDULER_HPP_
+
+#include <boost/thread.hpp>
+#include <deque>
+
+namespace Sirikata {
+
+/** Runs Mono scripts on a pool of threads attached to the runtime.  Each
+ *  script is assigned one thread for its whole life, so its calls run in the
+ *  order they were made and never two at once; different scripts run in
+ *  parallel.
+ */
+class MonoScriptScheduler {
+public:
+    typedef std::tr1::function<void()> Task;
+
+    MonoScriptScheduler(unsigned int numThreads);
+    /** Finishes the tasks already queued, then stops the threads. */
+    ~MonoScriptScheduler();
+
+    /** Picks the least loaded thread for a new script. */
+    unsigned int assign();
+    /** The script on thread is gone. */
+    void release(unsigned int thread);
+
+    /** Queues task on thread and returns at once. */
+    void post(unsigned int thread, const Task& task);
+    /** Runs task on thread after everything queued before it, and waits for it;
+     *  runs it directly if called from that thread.
+     */
+    void call(unsigned int thread, const Task& task);
+
+    /** Queues task for the object host's thread, for scripts that need the
+     *  HostedObject; it runs at the next runHostTasks.
+     */
+    void postToHost(const Task& task);
+    /** Runs everything scripts queued for the object host; call from its thread. */
+    void runHostTasks();
+private:
+    struct Worker {
+        boost::mutex mMutex;
+        boost::condition_variable mCond;
+        std::deque<Task> mTasks;
+        bool mStop;
+        unsigned int mScripts;
+        boost::thread* mThread;
+        Worker():mStop(false),mScripts(0),mThread(NULL) {}
+    };
+    static void run(Worker* worker);
+    static void runAndSignal(const Task& task, boost::mutex* mutex, boost::condition_variable* cond, bool* done);
+
+    std::vector<Worker*> mWorkers;
+    boost::mutex mAssignMutex;
+    boost::mutex mHostMutex;
+    std::vector<Task> mHostTasks;
+};
+
+}
+
+#endif //_MONO_SCRIPT_SCHEDULER_HPP_
@@ -46,6 +46,7 @@ MonoSystem::MonoSystem()
 
     assert(!mDomain.null());
     Domain::setRoot(mDomain);
+    MethodResolutionCache::setGlobal(&mMethodResolutionCache);
 
     //mono_trace_set_level(G_LOG_LEVEL_INFO);
     //mono_trace_set_level(G_LOG_LEVEL_DEBUG);
@@ -58,6 +59,7 @@ MonoSystem::~MonoSystem() {
     reportPinnedObjects();
 
     mDomain.fireProcessExit();
+    MethodResolutionCache::setGlobal(NULL);
     mono_jit_cleanup(mDomain.domain());
 }
 
@@ -105,33 +107,51 @@ Class MonoSystem::getClass(const Meru::String& name_space, const Meru::String& k
 }
 
 //#####################################################################
-// Function loadAssembly
+// Function findLoadedAssembly
 //#####################################################################
-bool MonoSystem::loadAssembly(const Meru::String& name) const {
+MonoAssembly* MonoSystem::findLoadedAssembly(const Meru::String& name) const {
+    std::map<Meru::String, MonoAssembly*>::const_iterator iter = mLoadedByName.find(name);
+    if (iter != mLoadedByName.end())
+        return iter->second;
+    return NULL;
+}
+
+//#####################################################################
+// Function loadAssemblyFrom
+//#####################################################################
+bool MonoSystem::loadAssemblyFrom(const Meru::String& name, const char* dir) const {
+    if (findLoadedAssembly(name) != NULL)
+        return true;
+
     MonoAssemblyName aname;
     bool parsed = mono_assembly_name_parse(name.c_str(), &aname);
     if (!parsed) return false;
 
+    // The runtime picks up an AOT image (name.dll.so, see the SirikataScriptAOT
+    // build target) next to the assembly by itself, mapping the precompiled code
+    // instead of JIT compiling it.
     MonoImageOpenStatus image_open_status;
-    MonoAssembly* assembly = mono_assembly_load(&aname, mWorkDir.c_str(), &image_open_status);
+    MonoAssembly* assembly = mono_assembly_load(&aname, dir, &image_open_status);
     mono_assembly_name_free(&aname);
 
-    return (assembly != NULL);
+    if (assembly == NULL)
+        return false;
+    mLoadedByName[name] = assembly;
+    return true;
 }
 
 //#####################################################################
 // Function loadAssembly
 //#####################################################################
-bool MonoSystem::loadAssembly(const Meru::String& name, const Meru::String& dir) const {
-    MonoAssemblyName aname;
-    bool parsed = mono_assembly_name_parse(name.c_str(), &aname);
-    if (!parsed) return false;
-
-    MonoImageOpenStatus image_open_status;
-    MonoAssembly* assembly = mono_assembly_load(&aname, dir.c_str(), &image_open_status);
-    mono_assembly_name_free(&aname);
+bool MonoSystem::loadAssembly(const Meru::String& name) const {
+    return loadAssemblyFrom(name, mWorkDir.c_str());
+}
 
-    return (assembly != NULL);
+//#####################################################################
+// Function loadAssembly
+//#####################################################################
+bool MonoSystem::loadAssembly(const Meru::String& name, const Meru::String& dir) const {
+    return loadAssemblyFrom(name, dir.c_str());
 }
 
 //#####################################################################
@@ -33,6 +33,7 @@
 #ifndef _SIRIKATA_MONO_SYSTEM_HPP_
 #define _SIRIKATA_MONO_SYSTEM_HPP_
 #include "MonoDefs.hpp"
+#include "MonoMethodLookupCache.hpp"
 #include <mono/metadata/mono-gc.h>
 namespace Mono {
 
@@ -82,9 +83,20 @@ private:
      */
     Class getClass(const Sirikata::String& name_space, const Sirikata::String& klass);
 
+    /** Returns the assembly already loaded under name, or NULL, so that every
+     *  script after the first skips the load and the search path.
+     */
+    MonoAssembly* findLoadedAssembly(const Sirikata::String& name) const;
+    /** Loads name, looking in dir as well as the usual places. */
+    bool loadAssemblyFrom(const Sirikata::String& name, const char* dir) const;
+
     Domain mDomain;
     std::vector<Assembly> mAssemblies;
+    /// Assemblies loaded so far, by the name they were requested by.
+    mutable std::map<Sirikata::String, MonoAssembly*> mLoadedByName;
     Sirikata::String mWorkDir;
+    /// Resolved methods shared by every call site; see MethodResolutionCache.
+    MethodResolutionCache mMethodResolutionCache;
 };
 
 }
@@ -517,6 +517,24 @@ static MonoMethod* lookupMethod(MonoClass* klass, MonoObject* this_ptr, const ch
     return NULL;
 }
 
+/** lookupMethod, going through the MonoSystem wide resolution cache first so
+ *  that call sites which miss in their own cache don't redo overload
+ *  resolution for a type they have seen before.
+ */
+static MonoMethod* resolveMethod(MonoClass* klass, MonoObject* this_ptr, const char* name, MonoObject* args[], guint32 nargs) {
+    MethodResolutionCache* global = MethodResolutionCache::global();
+    MonoMethod* method = NULL;
+    if (global != NULL)
+        method = global->lookup(klass, name, args, nargs);
+    if (method == NULL) {
+        method = lookupMethod(klass, this_ptr, name, args, nargs);
+        assert(method != NULL);
+        if (global != NULL)
+            global->update(klass, name, args, nargs, method);
+    }
+    return method;
+}
+
 void* object_to_raw(MonoClass* receive_klass, MonoObject* obj) {
     if ( mono_class_is_valuetype( receive_klass ) ) {
         return mono_object_unbox(obj);
@@ -567,8 +585,7 @@ Object send_base(MonoObject* this_ptr, const char* message, MonoObject* args[],
     if (cache != NULL)
         method = cache->lookup(this_class, message, args, nargs);
     if (method == NULL) {
-        method = lookupMethod(this_class, this_ptr, message, args, nargs);
-        assert(method != NULL);
+        method = resolveMethod(this_class, this_ptr, message, args, nargs);
         if (cache != NULL)
             cache->update(this_class, message, args, nargs, method);
     }
@@ -584,8 +601,7 @@ Object send_base(MonoClass* klass, const char* message, MonoObject* args[], int
     if (cache != NULL)
         method = cache->lookup(klass, message, args, nargs);
     if (method == NULL) {
-        method = lookupMethod(klass, NULL, message, args, nargs);
-        assert(method != NULL);
+        method = resolveMethod(klass, NULL, message, args, nargs);
         if (cache != NULL)
             cache->update(klass, message, args, nargs, method);
     }
@@ -30,6 +30,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "oh/Platform.hpp"
+#include "oh/HostedObject.hpp"
+#include "oh/ObjectHost.hpp"
 #include "MonoVWObjectScriptManager.hpp"
 #include "MonoVWObjectScript.hpp"
 #include "MonoSystem.hpp"
@@ -39,15 +41,35 @@
 #include "MonoException.hpp"
 #include "util/RoutableMessageHeader.hpp"
 #include "MonoContext.hpp"
+#include "MonoScriptScheduler.hpp"
 namespace Sirikata {
+namespace {
+///Counts a message callback as on the stack for as long as the guard lives, even if the script throws
+class MessageDepthGuard {
+    int&mDepth;
+public:
+    MessageDepthGuard(int&depth):mDepth(depth) {
+        ++mDepth;
+    }
+    ~MessageDepthGuard() {
+        --mDepth;
+    }
+};
+void finishedQueuedCalls() {
+}
+}
 
-MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObject*ho, const ObjectScriptManager::Arguments&args):mDomain(mono_system->createDomain()){
+MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, MonoScriptScheduler*scheduler, HostedObject*ho, const ObjectScriptManager::Arguments&args):mDomain(mono_system->createDomain()),mNoTick(false),mNoProcessMessage(false),mNoProcessRPC(false),mReuseBuffers(false),mTickInterval(Duration::seconds(-1.)),mMessageDepth(0),mScheduler(scheduler),mThread(0){
+    if (mScheduler)
+        mThread=mScheduler->assign();
     mParent=ho;
     int ignored_args=0;
     String reserved_string_assembly="Assembly";
     String reserved_string_class="Class";
     String reserved_string_namespace="Namespace";
     String reserved_string_function="Function";
+    String reserved_string_reuse_buffers="ReuseBuffers";
+    String reserved_string_tick_interval="TickInterval";
     String assembly_name;//="Sirikata.Runtime";
     ObjectScriptManager::Arguments::const_iterator i=args.begin(),j,func_iter;
     if ((i=args.find(reserved_string_assembly))!=args.end()) {
@@ -71,6 +93,14 @@ MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObjec
         if ((func_iter=args.find(reserved_string_function))!=args.end()) {        
             ++ignored_args;
         }
+        if ((i=args.find(reserved_string_reuse_buffers))!=args.end()) {
+            ++ignored_args;
+            mReuseBuffers=(i->second=="true");
+        }
+        if ((i=args.find(reserved_string_tick_interval))!=args.end()) {
+            ++ignored_args;
+            mTickInterval=Duration::seconds(strtod(i->second.c_str(),NULL));
+        }
         MonoContext::getSingleton().push(MonoContextData());
         MonoContext::getSingleton().setVWObject(ho,mDomain);
         try {
@@ -81,7 +111,7 @@ MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObjec
             unsigned int mono_count=0;
             
             for (i=args.begin(),j=args.end();i!=j;++i) {
-                if (i->first!=reserved_string_assembly&&i->first!=reserved_string_class&&i->first!=reserved_string_namespace&&i->first!=reserved_string_function) {                        
+                if (i->first!=reserved_string_assembly&&i->first!=reserved_string_class&&i->first!=reserved_string_namespace&&i->first!=reserved_string_function&&i->first!=reserved_string_reuse_buffers&&i->first!=reserved_string_tick_interval) {                        
                     mono_args.set(mono_count++,mDomain.String(i->first));
                     mono_args.set(mono_count++,mDomain.String(i->second));
                 }
@@ -105,6 +135,11 @@ MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObjec
     }
 }
 MonoVWObjectScript::~MonoVWObjectScript(){
+    if (mScheduler) {
+        // Let the calls already queued for this script finish before it goes away.
+        mScheduler->call(mThread,&finishedQueuedCalls);
+        mScheduler->release(mThread);
+    }
 
     //mono_jit_cleanup(mDomain.domain());
 }
@@ -116,50 +151,108 @@ bool MonoVWObjectScript::endForwardingMessagesTo(MessageService*){
     NOT_IMPLEMENTED(mono);
     return false;
 }
-bool MonoVWObjectScript::processRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue){
+Mono::Array MonoVWObjectScript::messageArray(Mono::Object&reuse, const void*data, unsigned int length){
+    if (mReuseBuffers&&mMessageDepth==0)
+        return mDomain.ByteArray(reuse,data,length);
+    return mDomain.ByteArray(data,length);
+}
+void MonoVWObjectScript::enterContext(){
     MonoContext::getSingleton().push(MonoContextData());
     MonoContext::getSingleton().setVWObject(mParent,mDomain);
-    std::string header;
-    receivedHeader.SerializeToString(&header);
+    if (mScheduler) {
+        MonoContext::getSingleton().setDispatchers(std::tr1::bind(&MonoScriptScheduler::postToHost,mScheduler,_1),
+                                                   std::tr1::bind(&MonoScriptScheduler::post,mScheduler,mThread,_1));
+    }
+}
+bool MonoVWObjectScript::processRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue){
+    if (mNoProcessRPC||mObject.null())
+        return false;
+    bool handled=false;
+    if (mScheduler) {
+        // The caller needs the return value now, so wait for the script's thread.
+        mScheduler->call(mThread,std::tr1::bind(&MonoVWObjectScript::doProcessRPC,this,std::tr1::cref(receivedHeader),std::tr1::cref(name),args,std::tr1::ref(returnValue),&handled));
+        mScheduler->runHostTasks();
+    }else {
+        doProcessRPC(receivedHeader,name,args,returnValue,&handled);
+    }
+    return handled;
+}
+void MonoVWObjectScript::doProcessRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue, bool*handled){
+    enterContext();
+    receivedHeader.SerializeToString(&mHeaderScratch);
     try {
-        Mono::Object retval=mObject.send("processRPC",mDomain.ByteArray(header.data(),(unsigned int)header.size()),mDomain.String(name),mDomain.ByteArray((const char*)args.data(),(int)args.size()));
+        Mono::Array header_array=messageArray(mHeaderArray,mHeaderScratch.data(),(unsigned int)mHeaderScratch.size());
+        Mono::Array args_array=messageArray(mBodyArray,args.data(),(unsigned int)args.size());
+        Mono::Object retval;
+        {
+            MessageDepthGuard nested(mMessageDepth);
+            retval=mObject.send(&mProcessRPCCache,"processRPC",header_array,mDomain.String(name),args_array);
+        }
         if (!retval.null()) {
-            returnValue=retval.unboxByteArray();
-            MonoContext::getSingleton().pop();
-            return true;
+            retval.unboxInPlaceByteArray(returnValue);
+            *handled=true;
         }
-        MonoContext::getSingleton().pop();
-        return false;
     }catch (Mono::Exception&e) {
         SILOG(mono,debug,"RPC Exception "<<e);
-        MonoContext::getSingleton().pop();
-        return false;        
+        mNoProcessRPC=!mProcessRPCCache.resolved();
     }
     MonoContext::getSingleton().pop();
-    return true;
 }
 void MonoVWObjectScript::tick(){
-    MonoContext::getSingleton().push(MonoContextData());
-    MonoContext::getSingleton().setVWObject(mParent,mDomain);
+    if (mNoTick||mObject.null())
+        return;
+    if (mScheduler) {
+        mScheduler->runHostTasks();
+        mScheduler->post(mThread,std::tr1::bind(&MonoVWObjectScript::doTick,this));
+    }else {
+        doTick();
+    }
+}
+Duration MonoVWObjectScript::tickInterval() const{
+    return mTickInterval;
+}
+void MonoVWObjectScript::doTick(){
+    if (mNoTick)
+        return;
+    enterContext();
     try {
-        Mono::Object retval=mObject.send("tick",mDomain.Time(Time::now()));
+        Mono::Object retval=mObject.send(&mTickCache,"tick",mDomain.Time(Time::now()));
     }catch (Mono::Exception&e) {
         SILOG(mono,debug,"Tick Exception "<<e);
+        mNoTick=!mTickCache.resolved();
+        if (mNoTick)
+            mParent->getObjectHost()->unregisterScriptTick(this);
     }
     MonoContext::getSingleton().pop();
 }
 void MonoVWObjectScript::processMessage(const RoutableMessageHeader&receivedHeader , MemoryReference body){
-    std::string header;
-    receivedHeader.SerializeToString(&header);
-    MonoContext::getSingleton().push(MonoContextData());
-    MonoContext::getSingleton().setVWObject(mParent,mDomain);
+    if (mNoProcessMessage||mObject.null())
+        return;
+    if (mScheduler) {
+        mScheduler->runHostTasks();
+        mScheduler->post(mThread,std::tr1::bind(&MonoVWObjectScript::doProcessMessageCopy,this,receivedHeader,std::string((const char*)body.data(),body.size())));
+    }else {
+        doProcessMessage(receivedHeader,body);
+    }
+}
+void MonoVWObjectScript::doProcessMessageCopy(const RoutableMessageHeader&receivedHeader, const std::string&body){
+    doProcessMessage(receivedHeader,MemoryReference(body));
+}
+void MonoVWObjectScript::doProcessMessage(const RoutableMessageHeader&receivedHeader, MemoryReference body){
+    if (mNoProcessMessage)
+        return;
+    receivedHeader.SerializeToString(&mHeaderScratch);
+    enterContext();
     try {
-        Mono::Object retval=mObject.send("processMessage",mDomain.ByteArray(header.data(),(unsigned int)header.size()),mDomain.ByteArray((const char*)body.data(),(unsigned int)body.size()));
+        Mono::Array header_array=messageArray(mHeaderArray,mHeaderScratch.data(),(unsigned int)mHeaderScratch.size());
+        Mono::Array body_array=messageArray(mBodyArray,body.data(),(unsigned int)body.size());
+        MessageDepthGuard nested(mMessageDepth);
+        Mono::Object retval=mObject.send(&mProcessMessageCache,"processMessage",header_array,body_array);
     }catch (Mono::Exception&e) {
         SILOG(mono,debug,"Message Exception "<<e);
+        mNoProcessMessage=!mProcessMessageCache.resolved();
     }
     MonoContext::getSingleton().pop();
 }
 
-
 }
@@ -34,6 +34,7 @@
 #include "MonoDefs.hpp"
 #include "MonoObject.hpp"
 #include "MonoDomain.hpp"
+#include "MonoMethodLookupCache.hpp"
 #include "oh/ObjectScript.hpp"
 
 
@@ -43,18 +44,51 @@ class MonoSystem;
 }
 namespace Sirikata {
 class HostedObject;
+class MonoScriptScheduler;
 
 class MonoVWObjectScript : public ObjectScript{
     HostedObject*mParent;
     Mono::Domain mDomain;
     Mono::Object mObject;
+    /// Per script method caches for the callbacks invoked on every tick and message,
+    /// so overload resolution only runs the first time each one is sent.
+    Mono::SingleMethodLookupCache mTickCache;
+    Mono::SingleMethodLookupCache mProcessMessageCache;
+    Mono::SingleMethodLookupCache mProcessRPCCache;
+    /// Set when the script class has no matching callback, so it is not looked up again.
+    bool mNoTick;
+    bool mNoProcessMessage;
+    bool mNoProcessRPC;
+    /// When the script is created with ReuseBuffers=true, message header and body
+    /// arrays are overwritten by the next message of the same size instead of being
+    /// reallocated, so the script must copy any bytes it keeps past the callback.
+    bool mReuseBuffers;
+    /// Seconds between ticks from the TickInterval argument; negative if the script only handles messages.
+    Duration mTickInterval;
+    Mono::Object mHeaderArray;
+    Mono::Object mBodyArray;
+    std::string mHeaderScratch;
+    /// Message callbacks currently on the stack; nested deliveries get fresh arrays.
+    int mMessageDepth;
+    /// The pool this script runs on and its thread in it; NULL runs it on the object host's thread.
+    MonoScriptScheduler*mScheduler;
+    unsigned int mThread;
+    Mono::Array messageArray(Mono::Object&reuse, const void*data, unsigned int length);
+    ///Makes mParent the current object, with the way back to the object host if this runs on a script thread
+    void enterContext();
+    void doTick();
+    void doProcessMessage(const RoutableMessageHeader&header, MemoryReference body);
+    ///Holds on to a message queued for the script's thread
+    void doProcessMessageCopy(const RoutableMessageHeader&header, const std::string&body);
+    void doProcessRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue, bool*handled);
 public:
-    MonoVWObjectScript(Mono::MonoSystem*, HostedObject*, const ObjectScriptManager::Arguments&args);
+    MonoVWObjectScript(Mono::MonoSystem*, MonoScriptScheduler*, HostedObject*, const ObjectScriptManager::Arguments&args);
     ~MonoVWObjectScript();
     bool forwardMessagesTo(MessageService*);
     bool endForwardingMessagesTo(MessageService*);
     bool processRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue);
     void tick();
+    Duration tickInterval() const;
     void processMessage(const RoutableMessageHeader&header , MemoryReference body);
 };
 
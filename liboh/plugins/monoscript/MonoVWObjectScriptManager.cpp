@@ -1,14 +1,27 @@
 #include "oh/Platform.hpp"
+#include "options/Options.hpp"
 #include "MonoVWObjectScriptManager.hpp"
 #include "MonoVWObjectScript.hpp"
+#include "MonoScriptScheduler.hpp"
 namespace Sirikata {
+namespace {
+OptionValue*scriptThreads;
+InitializeGlobalOptions o("",
+                    scriptThreads=new OptionValue("mono-script-threads","0",OptionValueType<uint32>(),"Threads Mono scripts run on, each script always on the same one so its calls stay in order (default: the object host's thread)"),
+                    NULL);
+}
+MonoScriptScheduler*MonoVWObjectScriptManager::sScheduler=NULL;
+
 MonoVWObjectScriptManager::MonoVWObjectScriptManager(Mono::MonoSystem*system, const Sirikata::String&arguments){
     mSystem=system;
-    
+    // Made on first use since plugins load before the command line is parsed; shared by every manager.
+    if (!sScheduler && scriptThreads->as<uint32>()) {
+        sScheduler=new MonoScriptScheduler(scriptThreads->as<uint32>());
+    }
 }
 ObjectScript *MonoVWObjectScriptManager::createObjectScript(HostedObject* ho,
                                                             const Arguments &args){
-    return new MonoVWObjectScript(mSystem,ho,args);
+    return new MonoVWObjectScript(mSystem,sScheduler,ho,args);
 }
 void MonoVWObjectScriptManager::destroyObjectScript(ObjectScript*toDestroy){
     delete toDestroy;
@@ -16,5 +29,9 @@ void MonoVWObjectScriptManager::destroyObjectScript(ObjectScript*toDestroy){
 MonoVWObjectScriptManager::~MonoVWObjectScriptManager(){
     
 }
+void MonoVWObjectScriptManager::destroyScheduler(){
+    delete sScheduler;
+    sScheduler=NULL;
+}
 
 }
@@ -38,9 +38,12 @@ class MonoSystem;
 namespace Sirikata {
 class HostedObject;
 class ObjectScript;
+class MonoScriptScheduler;
 
 class MonoVWObjectScriptManager : public ObjectScriptManager {
     Mono::MonoSystem * mSystem;
+    /// NULL unless mono-script-threads is set.
+    static MonoScriptScheduler * sScheduler;
   public:
     MonoVWObjectScriptManager(Mono::MonoSystem*system, const Sirikata::String&arguments);
     static ObjectScriptManager*createObjectScriptManager(Mono::MonoSystem *monosystem,const Sirikata::String&arguments) {
@@ -50,6 +53,8 @@ class MonoVWObjectScriptManager : public ObjectScriptManager {
                                              const Arguments &args);
     virtual void destroyObjectScript(ObjectScript*toDestroy);
     virtual ~MonoVWObjectScriptManager();
+    /// Stops the script threads; call once every script is gone.
+    static void destroyScheduler();
 };
 }
 #endif
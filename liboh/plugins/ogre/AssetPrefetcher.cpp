@@ -0,0 +1,134 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  AssetPrefetcher.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <task/Event.hpp>
+#include <transfer/TransferManager.hpp>
+#include <oh/ProxyCameraObject.hpp>
+#include "OgreSystem.hpp"
+#include "CameraEntity.hpp"
+#include "MeshEntity.hpp"
+#include "AssetPrefetcher.hpp"
+
+namespace Sirikata {
+namespace Graphics {
+
+namespace {
+/// Walking every entity each frame is not worth it; the camera does not get far in this time.
+const Duration SCAN_INTERVAL = Duration::milliseconds(250.0);
+/// Forget what was requested once this many files are remembered, so evicted files can be fetched again.
+const size_t MAX_REMEMBERED = 4096;
+
+/// Square of the distance from point to the segment from start to end.
+float64 distanceToSegmentSquared(const Vector3d &point, const Vector3d &start, const Vector3d &end) {
+    Vector3d segment = end - start;
+    float64 lengthSquared = segment.lengthSquared();
+    float64 t = 0;
+    if (lengthSquared > 0) {
+        t = (point - start).dot(segment) / lengthSquared;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    }
+    return (start + segment * t - point).lengthSquared();
+}
+}
+
+AssetPrefetcher::AssetPrefetcher(OgreSystem *scene, Transfer::TransferManager *transferManager,
+                                 Duration lookahead, float64 radius, uint32 maxOutstanding)
+  : mScene(scene),
+    mTransferManager(transferManager),
+    mLookahead(lookahead),
+    mRadius(radius),
+    mMaxOutstanding(maxOutstanding),
+    mLastScan(Time::null()),
+    mOutstanding(new AtomicValue<int32>(0)) {
+}
+
+Task::EventResponse AssetPrefetcher::downloadFinished(const std::tr1::shared_ptr<AtomicValue<int32> > &outstanding,
+                                                      const Task::EventPtr &ev) {
+    --*outstanding;
+    return Task::EventResponse::del();
+}
+
+void AssetPrefetcher::tick(Time currentTime) {
+    if (!mTransferManager || !mMaxOutstanding || currentTime - mLastScan < SCAN_INTERVAL) {
+        return;
+    }
+    mLastScan = currentTime;
+    CameraEntity *camera = mScene->getPrimaryCamera();
+    int32 numFree = (int32)mMaxOutstanding - mOutstanding->read();
+    if (!camera || numFree <= 0) {
+        return;
+    }
+    Location cameraLoc = camera->getProxy().globalLocation(currentTime);
+    Vector3d start = cameraLoc.getPosition();
+    Vector3d end = start + Vector3d(cameraLoc.getVelocity()) * mLookahead.toSeconds();
+    float64 radiusSquared = mRadius * mRadius;
+
+    // Closest to the path first, since only numFree can start this time.
+    std::multimap<float64, const URI*> candidates;
+    for (OgreSystem::SceneEntitiesMap::const_iterator iter = mScene->mSceneEntities.begin();
+         iter != mScene->mSceneEntities.end();
+         ++iter) {
+        MeshEntity *mesh = dynamic_cast<MeshEntity*>(iter->second);
+        if (!mesh || mesh->getMeshURI().toString().empty() || mRequested.find(mesh->getMeshURI()) != mRequested.end()) {
+            continue;
+        }
+        Vector3d position = mesh->getProxy().globalLocation(currentTime).getPosition();
+        float64 distanceSquared = distanceToSegmentSquared(position, start, end);
+        if (distanceSquared <= radiusSquared) {
+            candidates.insert(std::pair<float64, const URI*>(distanceSquared, &mesh->getMeshURI()));
+        }
+    }
+    if (mRequested.size() + candidates.size() > MAX_REMEMBERED) {
+        mRequested.clear();
+    }
+    for (std::multimap<float64, const URI*>::const_iterator iter = candidates.begin();
+         iter != candidates.end() && numFree > 0;
+         ++iter) {
+        const URI &meshURI = *iter->second;
+        if (!mRequested.insert(meshURI).second) {
+            continue; // several objects share the mesh.
+        }
+        --numFree;
+        ++*mOutstanding;
+        Transfer::TransferManager::EventListener listener(std::tr1::bind(&AssetPrefetcher::downloadFinished, mOutstanding, _1));
+        if (mTransferManager->isNameURI(meshURI)) {
+            mTransferManager->downloadByHash(Transfer::RemoteFileId(meshURI), listener,
+                                             Transfer::Range(true), Transfer::PREFETCH_PRIORITY);
+        } else {
+            mTransferManager->download(meshURI, listener, Transfer::Range(true), Transfer::PREFETCH_PRIORITY);
+        }
+    }
+}
+
+}
+}
@@ -0,0 +1,74 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  AssetPrefetcher.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_GRAPHICS_ASSET_PREFETCHER_HPP_
+#define _SIRIKATA_GRAPHICS_ASSET_PREFETCHER_HPP_
+
+namespace Sirikata {
+namespace Transfer {
+class TransferManager;
+}
+namespace Graphics {
+class OgreSystem;
+
+/**
+ * Downloads the meshes of objects near where the primary camera will be in a
+ * little while, following its current velocity, at PREFETCH_PRIORITY. By the
+ * time the resource manager gets to them they are already in the cache, so
+ * objects do not pop in late when the camera moves quickly.
+ */
+class AssetPrefetcher {
+    OgreSystem *mScene;
+    Transfer::TransferManager *mTransferManager;
+    Duration mLookahead;
+    float64 mRadius;
+    uint32 mMaxOutstanding;
+    Time mLastScan;
+    /// Prefetches not yet finished; shared with their listeners, which may outlive the prefetcher.
+    std::tr1::shared_ptr<AtomicValue<int32> > mOutstanding;
+    /// Files already asked for, so each is only prefetched once.
+    std::set<URI> mRequested;
+    static Task::EventResponse downloadFinished(const std::tr1::shared_ptr<AtomicValue<int32> > &outstanding,
+                                                const Task::EventPtr &ev);
+public:
+    /**
+     * @param lookahead       how far along the camera's path to look
+     * @param radius          how close to that path an object must be
+     * @param maxOutstanding  the most prefetches in flight; 0 disables prefetching
+     */
+    AssetPrefetcher(OgreSystem *scene, Transfer::TransferManager *transferManager,
+                    Duration lookahead, float64 radius, uint32 maxOutstanding);
+    void tick(Time currentTime);
+};
+
+}
+}
+#endif
@@ -89,9 +89,12 @@ void CubeMap::swapBuffers() {
         mState[mMapCounter].mFrontbuffer[i]=tmp;
     }
 }
-CubeMap::CubeMap(OgreSystem*parent,const std::vector<String>&cubeMapTexture, int size, const std::vector<Vector3f>&cameraDelta, const std::vector<float>&cameraNearPlanes){
+CubeMap::CubeMap(OgreSystem*parent,const std::vector<String>&cubeMapTexture, int size, const std::vector<Vector3f>&cameraDelta, const std::vector<float>&cameraNearPlanes, int facesPerFrame, float minMoveDistance){
     bool valid=true;
     mFaceCounter=mMapCounter=0;
+    mFirstFaceInFlight=0;
+    mFacesPerFrame=std::max(1,std::min(facesPerFrame,6));
+    mMinMoveDistance=minMoveDistance;
     mFrontbufferCloser=true;
     mAlpha=0;
     mParent=parent;
@@ -288,7 +291,7 @@ bool CubeMap::tooSmall(Ogre::Vector3 delta) {
     if (delta.x<0) delta.x=-delta.x;
     if (delta.y<0) delta.y=-delta.y;
     if (delta.z<0) delta.z=-delta.z;
-    if (delta.x<.03125&&delta.y<.03125&&delta.z<.03125) {
+    if (delta.x<mMinMoveDistance&&delta.y<mMinMoveDistance&&delta.z<mMinMoveDistance) {
         return true;
     }
     return false;
@@ -312,13 +315,19 @@ bool CubeMap::frameEnded(const Ogre::FrameEvent&evt) {
         mState[mMapCounter].mCamera->setPosition(toOgre(mParent->getPrimaryCamera()->getOgrePosition()+Vector3d(mState[mMapCounter].mCameraDelta),mParent->getOffset()));
     }
     if (mFaceCounter>0&&mFaceCounter<7) {
-        mBackbuffer[mFaceCounter-1]->getBuffer(0)->getRenderTarget()->removeAllViewports();        
+        for (int i=mFirstFaceInFlight;i<mFaceCounter;++i) {
+            mBackbuffer[i]->getBuffer(0)->getRenderTarget()->removeAllViewports();
+        }
     }
     if (mFaceCounter<6) {
-        Ogre::Viewport *viewport = mBackbuffer[mFaceCounter]->getBuffer(0)->getRenderTarget()->addViewport( mState[mMapCounter].mCamera );        
-        viewport->setOverlaysEnabled(false);
-        viewport->setClearEveryFrame( true );
-        viewport->setBackgroundColour( Ogre::ColourValue(0,0,0,0) );
+        int lastFace=std::min(mFaceCounter+mFacesPerFrame,6);
+        for (int i=mFaceCounter;i<lastFace;++i) {
+            Ogre::Viewport *viewport = mBackbuffer[i]->getBuffer(0)->getRenderTarget()->addViewport( mState[mMapCounter].mCamera );
+            viewport->setOverlaysEnabled(false);
+            viewport->setClearEveryFrame( true );
+            viewport->setBackgroundColour( Ogre::ColourValue(0,0,0,0) );
+        }
+        mFirstFaceInFlight=mFaceCounter;
     }
 
     BlendProgress progress=DOING_BLENDING;
@@ -334,7 +343,9 @@ bool CubeMap::frameEnded(const Ogre::FrameEvent&evt) {
             viewport->setBackgroundColour( Ogre::ColourValue(1,0,0,1) );
         }
     }
-    if (mFaceCounter!=8||progress==DONE_BLENDING) {
+    if (mFaceCounter<6) {
+        mFaceCounter=std::min(mFaceCounter+mFacesPerFrame,6);
+    }else if (mFaceCounter!=8||progress==DONE_BLENDING) {
       ++mFaceCounter;
     }
 
@@ -65,6 +65,10 @@ class CubeMap {//:public Ogre::FrameListener{
 
     int mFaceCounter;
     int mMapCounter;
+    ///First of the faces given viewports last frame, whose viewports come off this frame
+    int mFirstFaceInFlight;
+    int mFacesPerFrame;
+    float mMinMoveDistance;
     String createMaterialString(const String&materialName);
     enum BlendProgress{
       DOING_BLENDING,
@@ -72,7 +76,12 @@ class CubeMap {//:public Ogre::FrameListener{
     };
     BlendProgress updateBlendState(const Ogre::FrameEvent&evt);
 public:
-    CubeMap(OgreSystem*parent, const std::vector<String>&cubeMapTexture, int size, const std::vector<Vector3f> &mCameraDelta, const std::vector<float>& nearClipMapDistance);
+    /**
+     * facesPerFrame faces of the current cube map are rendered each frame, round robin,
+     * and a cube map is skipped entirely while the camera has moved less than
+     * minMoveDistance along every axis since it was last rendered.
+     */
+    CubeMap(OgreSystem*parent, const std::vector<String>&cubeMapTexture, int size, const std::vector<Vector3f> &mCameraDelta, const std::vector<float>& nearClipMapDistance, int facesPerFrame=1, float minMoveDistance=.03125);
     ~CubeMap();
     bool frameEnded(const Ogre::FrameEvent&evt);
     void preRenderTargetUpdate(Ogre::Camera*cam,int renderTargetIndex,const Ogre::RenderTargetEvent& evt);
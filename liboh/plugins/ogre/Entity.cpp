@@ -106,15 +106,21 @@ void Entity::setStatic(bool isStatic) {
             SILOG(ogre,debug,"Removed "<<this<<" from moving entities queue.");
             mScene->mMovingEntities.erase(mMovingIter);
             mMovingIter = end;
+            staticChanged(true);
         }
     } else {
         if (mMovingIter == end) {
             SILOG(ogre,debug,"Added "<<this<<" to moving entities queue.");
             mMovingIter = mScene->mMovingEntities.insert(end, this);
+            staticChanged(false);
         }
     }
 }
 
+bool Entity::isMoving() const {
+    return mMovingIter != mScene->mMovingEntities.end();
+}
+
 void Entity::removeFromScene() {
     Ogre::SceneNode *oldParent = mSceneNode->getParentSceneNode();
     if (oldParent) {
@@ -131,13 +137,19 @@ void Entity::addToScene(Ogre::SceneNode *newParent) {
     setStatic(false); // May get set to true after the next frame has drawn.
 }
 
+// Setting a node, even to its current value, makes Ogre update its subtree
+// and re-place it in the scene manager, so only write values that changed.
 void Entity::setOgrePosition(const Vector3d &pos) {
     Ogre::Vector3 ogrepos = toOgre(pos, getScene()->getOffset());
-    const Ogre::Vector3 &scale = mSceneNode->getScale();
-    mSceneNode->setPosition(ogrepos);
+    if (ogrepos != mSceneNode->getPosition()) {
+        mSceneNode->setPosition(ogrepos);
+    }
 }
 void Entity::setOgreOrientation(const Quaternion &orient) {
-    mSceneNode->setOrientation(toOgre(orient));
+    Ogre::Quaternion ogreorient = toOgre(orient);
+    if (ogreorient != mSceneNode->getOrientation()) {
+        mSceneNode->setOrientation(ogreorient);
+    }
 }
 
 
@@ -180,9 +192,11 @@ void Entity::destroyed() {
     delete this;
 }
 void Entity::extrapolateLocation(TemporalValue<Location>::Time current) {
-    Location loc (getProxy().extrapolateLocation(current));
-    setOgrePosition(loc.getPosition());
-    setOgreOrientation(loc.getOrientation());
+    Vector3d position;
+    Quaternion orientation;
+    getProxy().extrapolatePositionOrientation(current, position, orientation);
+    setOgrePosition(position);
+    setOgreOrientation(orientation);
     setStatic(getProxy().isStatic(current));
 }
 
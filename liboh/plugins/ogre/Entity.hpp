@@ -61,6 +61,9 @@ protected:
     void init(Ogre::MovableObject *obj);
 
     void setStatic(bool isStatic);
+    ///Called when the entity joins or leaves the moving entities queue
+    virtual void staticChanged(bool isStatic) {}
+    bool isMoving() const;
 
 protected:
     void setOgrePosition(const Vector3d &pos);
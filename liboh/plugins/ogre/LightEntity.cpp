@@ -33,6 +33,7 @@
 #include <oh/Platform.hpp>
 #include <oh/LightListener.hpp>
 #include "LightEntity.hpp"
+#include "LightManager.hpp"
 #include <OgreLight.h>
 #include <oh/ProxyLightObject.hpp>
 
@@ -45,9 +46,15 @@ LightEntity::LightEntity(OgreSystem *scene, const std::tr1::shared_ptr<ProxyLigh
              id.length()?id:ogreLightName(plo->getObjectReference()),
              scene->getSceneManager()->createLight(id.length()?id:ogreLightName(plo->getObjectReference()))) {
     getProxy().LightProvider::addListener(this);
+    if (scene->getLightManager()) {
+        scene->getLightManager()->addLight(this);
+    }
 }
 
 LightEntity::~LightEntity() {    
+    if (mScene->getLightManager()) {
+        mScene->getLightManager()->removeLight(this);
+    }
     Ogre::Light *toDestroy=getOgreLight();
     init(NULL);
     mScene->getSceneManager()->destroyLight(toDestroy);
@@ -0,0 +1,199 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  LightManager.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include "CameraEntity.hpp"
+#include "LightEntity.hpp"
+#include "LightManager.hpp"
+#include <OgreCamera.h>
+#include <OgreRoot.h>
+#include <OgreViewport.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Sirikata {
+namespace Graphics {
+
+namespace {
+struct MoreImportant {
+    bool operator()(const std::pair<float,Ogre::Light*> &a, const std::pair<float,Ogre::Light*> &b) const {
+        return a.first>b.first;
+    }
+};
+}
+
+LightManager::LightManager(OgreSystem *scene, uint32 maxPerObject, uint32 frameBudget, float fullDetailPixels)
+  : mScene(scene),
+    mMaxPerObject(maxPerObject?maxPerObject:1),
+    mFrameBudget(frameBudget),
+    mFullDetailPixels(fullDetailPixels) {
+}
+
+LightManager::~LightManager() {
+    for (std::set<LightEntity*>::iterator iter=mLights.begin();iter!=mLights.end();++iter) {
+        (*iter)->getOgreLight()->setVisible(true);
+    }
+}
+
+void LightManager::addLight(LightEntity *light) {
+    mLights.insert(light);
+}
+
+void LightManager::removeLight(LightEntity *light) {
+    mLights.erase(light);
+}
+
+void LightManager::manage(Ogre::MovableObject *object) {
+    object->setListener(this);
+}
+
+void LightManager::objectDestroyed(Ogre::MovableObject *object) {
+    mLists.erase(object);
+}
+
+float LightManager::importance(const Ogre::Light *light, const Ogre::Vector3 &center, float radius) {
+    const Ogre::ColourValue &diffuse=light->getDiffuseColour();
+    float intensity=(0.3f*diffuse.r+0.59f*diffuse.g+0.11f*diffuse.b)*light->getPowerScale();
+    if (light->getType()==Ogre::Light::LT_DIRECTIONAL) {
+        return intensity;
+    }
+    Ogre::Vector3 toObject=center-light->getDerivedPosition();
+    float distance=toObject.length();
+    float gap=std::max(0.0f,distance-radius);
+    if (gap>light->getAttenuationRange()) {
+        return 0;
+    }
+    if (light->getType()==Ogre::Light::LT_SPOTLIGHT && distance>radius) {
+        // Outside the cone once the angle to the object is more than the outer angle plus the object's angular size.
+        float cosAngle=light->getDerivedDirection().dotProduct(toObject)/distance;
+        float angle=acosf(std::max(-1.0f,std::min(1.0f,cosAngle)));
+        if (angle>light->getSpotlightOuterAngle().valueRadians()*0.5f+asinf(std::min(1.0f,radius/distance))) {
+            return 0;
+        }
+    }
+    float falloff=light->getAttenuationConstant()+light->getAttenuationLinear()*gap+
+        light->getAttenuationQuadric()*gap*gap;
+    return falloff>0 ? intensity/falloff : intensity;
+}
+
+uint32 LightManager::limitFor(const Ogre::Vector3 &center, float radius) const {
+    CameraEntity *primary=mScene->getPrimaryCamera();
+    if (!primary || mFullDetailPixels<=0) {
+        return mMaxPerObject;
+    }
+    Ogre::Camera *camera=primary->getOgreCamera();
+    Ogre::Viewport *viewport=primary->getViewport();
+    float distance=(center-camera->getDerivedPosition()).length();
+    if (distance<=radius) {
+        return mMaxPerObject;
+    }
+    float halfHeight=viewport?viewport->getActualHeight()*0.5f:1.0f;
+    float pixels=2.0f*radius/(distance*tanf(camera->getFOVy().valueRadians()*0.5f))*halfHeight;
+    uint32 limit=(uint32)ceilf(mMaxPerObject*std::min(1.0f,pixels/mFullDetailPixels));
+    return std::max<uint32>(1,limit);
+}
+
+const Ogre::LightList *LightManager::objectQueryLights(const Ogre::MovableObject *object) {
+    unsigned long frame=Ogre::Root::getSingleton().getNextFrameNumber();
+    CachedList &cached=mLists[object];
+    // Ogre asks once per renderable, several times a frame.
+    if (cached.mFrame==frame) {
+        return &cached.mLights;
+    }
+    cached.mFrame=frame;
+    cached.mLights.clear();
+    Ogre::Node *node=object->getParentNode();
+    if (!node) {
+        return &cached.mLights;
+    }
+    Ogre::Vector3 center=node->_getDerivedPosition();
+    const Ogre::Vector3 &scale=node->_getDerivedScale();
+    float radius=object->getBoundingRadius()*std::max(scale.x,std::max(scale.y,scale.z));
+    Ogre::LightList candidates;
+    mScene->getSceneManager()->_populateLightList(center,radius,candidates);
+    std::vector<std::pair<float,Ogre::Light*> > ranked;
+    ranked.reserve(candidates.size());
+    for (Ogre::LightList::iterator iter=candidates.begin();iter!=candidates.end();++iter) {
+        float score=importance(*iter,center,radius);
+        if (score>0) {
+            ranked.push_back(std::pair<float,Ogre::Light*>(score,*iter));
+        }
+    }
+    size_t keep=std::min<size_t>(ranked.size(),limitFor(center,radius));
+    std::partial_sort(ranked.begin(),ranked.begin()+keep,ranked.end(),MoreImportant());
+    for (size_t i=0;i<keep;++i) {
+        cached.mLights.push_back(ranked[i].second);
+    }
+    return &cached.mLights;
+}
+
+void LightManager::tick() {
+    CameraEntity *primary=mScene->getPrimaryCamera();
+    if (!mFrameBudget || !primary || mLights.size()<=mFrameBudget) {
+        for (std::set<LightEntity*>::iterator iter=mLights.begin();iter!=mLights.end();++iter) {
+            (*iter)->getOgreLight()->setVisible(true);
+        }
+        return;
+    }
+    Ogre::Camera *camera=primary->getOgreCamera();
+    std::vector<std::pair<float,Ogre::Light*> > ranked;
+    ranked.reserve(mLights.size());
+    for (std::set<LightEntity*>::iterator iter=mLights.begin();iter!=mLights.end();++iter) {
+        Ogre::Light *light=(*iter)->getOgreLight();
+        float score;
+        if (light->getType()==Ogre::Light::LT_DIRECTIONAL) {
+            score=std::numeric_limits<float>::max();
+        } else if (!camera->isVisible(Ogre::Sphere(light->getDerivedPosition(),light->getAttenuationRange()))) {
+            score=0;
+        } else {
+            // Rated at the camera, the nearest anything it lights can be seen from.
+            score=importance(light,camera->getDerivedPosition(),0);
+            if (score==0) {
+                score=importance(light,light->getDerivedPosition(),0)/
+                    std::max(1.0f,(light->getDerivedPosition()-camera->getDerivedPosition()).squaredLength());
+            }
+            // Favour lights already on so ones of similar importance do not flicker as the camera moves.
+            if (light->isVisible()) {
+                score*=1.25f;
+            }
+        }
+        ranked.push_back(std::pair<float,Ogre::Light*>(score,light));
+    }
+    std::sort(ranked.begin(),ranked.end(),MoreImportant());
+    for (size_t i=0;i<ranked.size();++i) {
+        ranked[i].second->setVisible(i<mFrameBudget && ranked[i].first>0);
+    }
+}
+
+}
+}
@@ -0,0 +1,88 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  LightManager.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_GRAPHICS_LIGHT_MANAGER_HPP_
+#define _SIRIKATA_GRAPHICS_LIGHT_MANAGER_HPP_
+
+#include <OgreMovableObject.h>
+
+namespace Sirikata {
+namespace Graphics {
+class OgreSystem;
+class LightEntity;
+
+/**
+ * Keeps the cost of many dynamic lights bounded.  Each mesh gets only the
+ * lights that matter most to it, ranked by colour and power attenuated over
+ * the distance to the mesh and cut off outside spotlight cones; meshes that
+ * cover little of the screen get fewer of them.  When more lights reach the
+ * view than the frame budget allows, the weakest of them, as seen from the
+ * primary camera, are switched off altogether until they matter again.
+ */
+class LightManager : public Ogre::MovableObject::Listener {
+    struct CachedList {
+        Ogre::LightList mLights;
+        unsigned long mFrame;
+        CachedList():mFrame((unsigned long)-1) {}
+    };
+    typedef std::map<const Ogre::MovableObject*,CachedList> ListMap;
+    ListMap mLists;
+    std::set<LightEntity*> mLights;
+    OgreSystem *mScene;
+    uint32 mMaxPerObject;
+    uint32 mFrameBudget;
+    float mFullDetailPixels;
+    ///How much a light affects a sphere, from its colour, power, attenuation and cone; 0 if not at all
+    static float importance(const Ogre::Light *light, const Ogre::Vector3 &center, float radius);
+    ///Most lights an object whose bounds are radius across gets from the primary camera
+    uint32 limitFor(const Ogre::Vector3 &center, float radius) const;
+public:
+    /**
+     * maxPerObject is the most lights one mesh is lit by; frameBudget the most
+     * lights on at once (0 for no limit); meshes whose bounds project to fewer
+     * than fullDetailPixels pixels across get proportionally fewer lights.
+     */
+    LightManager(OgreSystem *scene, uint32 maxPerObject, uint32 frameBudget, float fullDetailPixels);
+    ~LightManager();
+    void addLight(LightEntity *light);
+    void removeLight(LightEntity *light);
+    /// Has the manager choose the lights for this mesh.
+    void manage(Ogre::MovableObject *object);
+    /// Turns lights on or off to fit the frame budget; called once per frame.
+    void tick();
+
+    virtual const Ogre::LightList *objectQueryLights(const Ogre::MovableObject *object);
+    virtual void objectDestroyed(Ogre::MovableObject *object);
+};
+
+}
+}
+#endif
@@ -0,0 +1,149 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  MeshBatcher.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include "MeshEntity.hpp"
+#include "MeshBatcher.hpp"
+#include <OgreStaticGeometry.h>
+#include <OgreSubEntity.h>
+
+namespace Sirikata {
+namespace Graphics {
+
+MeshBatcher::MeshBatcher(OgreSystem *scene, uint32 threshold, Duration settleTime)
+  : mScene(scene),
+    mThreshold(threshold),
+    mSettleTime(settleTime),
+    mNumBuilt(0) {
+}
+
+MeshBatcher::~MeshBatcher() {
+    for (BatchMap::iterator iter=mBatches.begin();iter!=mBatches.end();++iter) {
+        dissolve(iter->second);
+        for (std::set<MeshEntity*>::iterator member=iter->second.mMembers.begin();
+             member!=iter->second.mMembers.end();
+             ++member) {
+            (*member)->mBatchKey.clear();
+        }
+    }
+}
+
+String MeshBatcher::batchKey(MeshEntity *entity) {
+    Ogre::Entity *ent=entity->getOgreEntity();
+    String key=ent->getMesh()->getName();
+    for (unsigned int i=0;i<ent->getNumSubEntities();++i) {
+        key+='\0';
+        key+=ent->getSubEntity(i)->getMaterialName();
+    }
+    return key;
+}
+
+void MeshBatcher::dissolve(Batch &batch) {
+    if (batch.mGeometry) {
+        mScene->getSceneManager()->destroyStaticGeometry(batch.mGeometry);
+        batch.mGeometry=NULL;
+        for (std::set<MeshEntity*>::iterator iter=batch.mMembers.begin();iter!=batch.mMembers.end();++iter) {
+            (*iter)->getOgreEntity()->setVisible(true);
+        }
+    }
+}
+
+void MeshBatcher::build(Batch &batch) {
+    Ogre::StaticGeometry *geometry=mScene->getSceneManager()->createStaticGeometry(
+        "MeshBatch:"+boost::lexical_cast<std::string>(mNumBuilt++));
+    bool castShadows=false;
+    for (std::set<MeshEntity*>::iterator iter=batch.mMembers.begin();iter!=batch.mMembers.end();++iter) {
+        Ogre::Entity *ent=(*iter)->getOgreEntity();
+        Ogre::SceneNode *node=(*iter)->mSceneNode;
+        geometry->addEntity(ent, node->getPosition(), node->getOrientation(), node->getScale());
+        castShadows=castShadows||ent->getCastShadows();
+    }
+    geometry->setCastShadows(castShadows);
+    try {
+        geometry->build();
+    } catch (Ogre::Exception &e) {
+        SILOG(ogre,warning,"Failed to build mesh batch of "<<batch.mMembers.size()<<" entities: "<<e.getDescription());
+        mScene->getSceneManager()->destroyStaticGeometry(geometry);
+        return;
+    }
+    for (std::set<MeshEntity*>::iterator iter=batch.mMembers.begin();iter!=batch.mMembers.end();++iter) {
+        (*iter)->getOgreEntity()->setVisible(false);
+    }
+    batch.mGeometry=geometry;
+}
+
+void MeshBatcher::add(MeshEntity *entity) {
+    if (!enabled() || !entity->mBatchKey.empty()) {
+        return;
+    }
+    entity->mBatchKey=batchKey(entity);
+    Batch &batch=mBatches[entity->mBatchKey];
+    dissolve(batch);
+    batch.mMembers.insert(entity);
+    batch.mDirty=true;
+    batch.mLastChange=Time::now();
+}
+
+void MeshBatcher::remove(MeshEntity *entity) {
+    if (entity->mBatchKey.empty()) {
+        return;
+    }
+    BatchMap::iterator where=mBatches.find(entity->mBatchKey);
+    entity->mBatchKey.clear();
+    if (where==mBatches.end()) {
+        return;
+    }
+    Batch &batch=where->second;
+    dissolve(batch);
+    batch.mMembers.erase(entity);
+    if (batch.mMembers.empty()) {
+        mBatches.erase(where);
+    } else {
+        batch.mDirty=true;
+        batch.mLastChange=Time::now();
+    }
+}
+
+void MeshBatcher::tick(Time now) {
+    for (BatchMap::iterator iter=mBatches.begin();iter!=mBatches.end();++iter) {
+        Batch &batch=iter->second;
+        if (batch.mDirty && now-batch.mLastChange>=mSettleTime) {
+            batch.mDirty=false;
+            if (batch.mMembers.size()>=mThreshold) {
+                build(batch);
+            }
+        }
+    }
+}
+
+}
+}
@@ -0,0 +1,85 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  MeshBatcher.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_GRAPHICS_MESH_BATCHER_HPP_
+#define _SIRIKATA_GRAPHICS_MESH_BATCHER_HPP_
+
+namespace Ogre {
+class StaticGeometry;
+}
+namespace Sirikata {
+namespace Graphics {
+class OgreSystem;
+class MeshEntity;
+
+/**
+ * Merges static MeshEntities that share a mesh and set of materials into one
+ * Ogre::StaticGeometry, so a field of identical trees costs a handful of draw
+ * calls instead of one per tree.  The individual entities stay in the scene,
+ * hidden, so picking and selection keep working on them.  Any change to a
+ * batch's membership dissolves it back into individual entities; it is
+ * rebuilt once it has gone unchanged for the settle time.
+ */
+class MeshBatcher {
+    struct Batch {
+        std::set<MeshEntity*> mMembers;
+        Ogre::StaticGeometry *mGeometry;
+        Time mLastChange;
+        bool mDirty;
+        Batch():mGeometry(NULL),mLastChange(Time::null()),mDirty(false) {}
+    };
+    typedef std::map<String,Batch> BatchMap;
+    BatchMap mBatches;
+    OgreSystem *mScene;
+    uint32 mThreshold;
+    Duration mSettleTime;
+    uint32 mNumBuilt;
+    static String batchKey(MeshEntity *entity);
+    void dissolve(Batch &batch);
+    void build(Batch &batch);
+public:
+    /// threshold is the fewest members worth merging; 0 disables batching.
+    MeshBatcher(OgreSystem *scene, uint32 threshold, Duration settleTime);
+    ~MeshBatcher();
+    bool enabled() const {
+        return mThreshold!=0;
+    }
+    /// Adds a loaded, static, root-parented entity at its current placement.
+    void add(MeshEntity *entity);
+    /// Removes an entity if batched; must be called before it moves or unloads.
+    void remove(MeshEntity *entity);
+    /// Rebuilds batches that have settled; called once per frame.
+    void tick(Time now);
+};
+
+}
+}
+#endif
@@ -31,6 +31,9 @@
  */
 #include <oh/Platform.hpp>
 #include "MeshEntity.hpp"
+#include "MeshBatcher.hpp"
+#include "OcclusionCuller.hpp"
+#include "LightManager.hpp"
 #include <util/AtomicTypes.hpp>
 #include <OgreMeshManager.h>
 #include <OgreResourceGroupManager.h>
@@ -46,13 +49,17 @@ MeshEntity::MeshEntity(OgreSystem *scene,
         : Entity(scene,
                  pmo,
                  id.length()?id:ogreMeshName(pmo->getObjectReference()),
-                 NULL)
+                 NULL),
+          mOccluded(false)
 {
     getProxy().MeshProvider::addListener(this);
     Meru::GraphicsResourceManager* grm = Meru::GraphicsResourceManager::getSingletonPtr();
     mResource = std::tr1::dynamic_pointer_cast<Meru::GraphicsResourceEntity>
         (grm->getResourceEntity(pmo->getObjectReference(), this));
     unloadMesh();
+    if (getScene()->getOcclusionCuller()) {
+        getScene()->getOcclusionCuller()->add(this);
+    }
 }
 
 void MeshEntity::meshChanged(const URI &meshFile) {
@@ -71,6 +78,12 @@ std::string MeshEntity::ogreMovableName()const{
 }
 MeshEntity::~MeshEntity() {
     mResource->entityDestroyed();
+    if (getScene()->getMeshBatcher()) {
+        getScene()->getMeshBatcher()->remove(this);
+    }
+    if (getScene()->getOcclusionCuller()) {
+        getScene()->getOcclusionCuller()->remove(this);
+    }
     Ogre::Entity * toDestroy=getOgreEntity();
     init(NULL);
     if (toDestroy) {
@@ -134,21 +147,69 @@ void MeshEntity::loadMesh(const String& meshname)
         new_entity->getSubEntity(subent)->setCustomParameter(1,parallax_steps);
     }
 
+    if (getScene()->getLightManager()) {
+        getScene()->getLightManager()->manage(new_entity);
+    }
+    mRaytrace.reset();
     init(new_entity);
+    setOccluded(mOccluded);
     if (oldMeshObj) {
         getScene()->getSceneManager()->destroyEntity(oldMeshObj);
     }
+    rebatch();
 }
 
 void MeshEntity::unloadMesh() {
     Ogre::Entity * meshObj=getOgreEntity();
+    if (getScene()->getMeshBatcher()) {
+        getScene()->getMeshBatcher()->remove(this);
+    }
     //init(getScene()->getSceneManager()->createEntity(ogreMovableName(), Ogre::SceneManager::PT_CUBE));
+    mRaytrace.reset();
     init(NULL);
     if (meshObj) {
         getScene()->getSceneManager()->destroyEntity(meshObj);
     }
 }
 
+const std::tr1::shared_ptr<OgreMeshRaytrace> &MeshEntity::getRaytrace() {
+    if (!mRaytrace && getOgreEntity()) {
+        mRaytrace=OgreMeshRaytrace::get(getOgreEntity()->getMesh().get());
+    }
+    return mRaytrace;
+}
+
+void MeshEntity::setOccluded(bool occluded) {
+    mOccluded=occluded;
+    Ogre::Entity *ent=getOgreEntity();
+    if (ent) {
+        // Visibility flags rather than setVisible, which MeshBatcher uses for batched entities.
+        ent->setVisibilityFlags(occluded?0:Ogre::MovableObject::getDefaultVisibilityFlags());
+    }
+}
+
+void MeshEntity::rebatch() {
+    MeshBatcher *batcher=getScene()->getMeshBatcher();
+    if (!batcher) {
+        return;
+    }
+    batcher->remove(this);
+    // Only root-parented entities: a child inherits its parent's motion.
+    if (getOgreEntity() && !isMoving() &&
+        mSceneNode->getParentSceneNode()==getScene()->getSceneManager()->getRootSceneNode()) {
+        batcher->add(this);
+    }
+}
+
+void MeshEntity::updateLocation(Time ti, const Location &newLocation) {
+    Entity::updateLocation(ti, newLocation);
+    rebatch();
+}
+
+void MeshEntity::resetLocation(Time ti, const Location &newLocation) {
+    Entity::resetLocation(ti, newLocation);
+    rebatch();
+}
 
 }
 }
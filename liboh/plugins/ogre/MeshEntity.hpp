@@ -43,6 +43,7 @@
 #include "Entity.hpp"
 #include <OgreEntity.h>
 #include "resourceManager/GraphicsResourceEntity.hpp"
+#include "OgreMeshRaytrace.hpp"
 
 namespace Sirikata {
 namespace Graphics {
@@ -57,10 +58,25 @@ class MeshEntity
     URI mMeshURI;
     SharedResourcePtr mResource;
     BoundingInfo mBoundingInfo;
+    ///Key of the MeshBatcher batch this entity is merged into, empty if none
+    String mBatchKey;
+    ///Triangles of the loaded mesh for fine grained ray tests, synced on the first test
+    std::tr1::shared_ptr<OgreMeshRaytrace> mRaytrace;
+    ///Hidden because occlusion queries find it covered
+    bool mOccluded;
+    friend class MeshBatcher;
+    friend class OcclusionCuller;
 
     Ogre::Entity *getOgreEntity() const {
         return static_cast<Ogre::Entity*const>(mOgreObject);
     }
+    ///Moves this entity into or out of its mesh batch to match its current state
+    void rebatch();
+    ///Hides or shows the Ogre entity for the OcclusionCuller
+    void setOccluded(bool occluded);
+    virtual void staticChanged(bool isStatic) {
+        rebatch();
+    }
 
 public:
     ProxyMeshObject &getProxy() const {
@@ -79,7 +95,10 @@ public:
     }
     void setScale(const Vector3f &scale) {
         mSceneNode->setScale(toOgre(scale));
+        rebatch();
     }
+    virtual void updateLocation(Time ti, const Location &newLocation);
+    virtual void resetLocation(Time ti, const Location &newLocation);
     void setPhysical(const PhysicalParameters &pp) {
     }
     static std::string ogreMeshName(const SpaceObjectReference&ref);
@@ -98,6 +117,12 @@ public:
     const BoundingInfo& getBoundingInfo()const{
         return mBoundingInfo;
     }
+    ///The shared raytrace data for the loaded mesh, or NULL if no mesh is loaded
+    const std::tr1::shared_ptr<OgreMeshRaytrace> &getRaytrace();
+    ///Whether the OcclusionCuller last found this entity covered by others from the primary camera
+    bool isOccluded() const {
+        return mOccluded;
+    }
     const SharedResourcePtr &getResource() const {
         return mResource;
     }
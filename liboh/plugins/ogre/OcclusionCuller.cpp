@@ -0,0 +1,227 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  OcclusionCuller.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include "MeshEntity.hpp"
+#include "CameraEntity.hpp"
+#include "OcclusionCuller.hpp"
+#include <OgreHardwareBufferManager.h>
+#include <OgreHardwareOcclusionQuery.h>
+#include <OgreMaterialManager.h>
+#include <OgreRenderSystem.h>
+#include <OgreRoot.h>
+#include <OgreSimpleRenderable.h>
+#include <OgreTechnique.h>
+
+namespace Sirikata {
+namespace Graphics {
+
+/// A unit cube placed and stretched over each box being tested.
+class OcclusionCuller::BoxRenderable : public Ogre::SimpleRenderable {
+    Ogre::Matrix4 mTransform;
+public:
+    BoxRenderable() {
+        static const float corners[24]={0,0,0, 1,0,0, 0,1,0, 1,1,0, 0,0,1, 1,0,1, 0,1,1, 1,1,1};
+        static const Ogre::uint16 faces[36]={0,2,1, 1,2,3, 4,5,6, 5,7,6, 0,1,4, 1,5,4,
+                                             2,6,3, 3,6,7, 0,4,2, 2,4,6, 1,3,5, 3,7,5};
+        mRenderOp.vertexData=new Ogre::VertexData;
+        mRenderOp.vertexData->vertexCount=8;
+        mRenderOp.vertexData->vertexDeclaration->addElement(0,0,Ogre::VET_FLOAT3,Ogre::VES_POSITION);
+        Ogre::HardwareVertexBufferSharedPtr vertices=Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+            3*sizeof(float),8,Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+        vertices->writeData(0,vertices->getSizeInBytes(),corners,true);
+        mRenderOp.vertexData->vertexBufferBinding->setBinding(0,vertices);
+        mRenderOp.indexData=new Ogre::IndexData;
+        mRenderOp.indexData->indexCount=36;
+        mRenderOp.indexData->indexBuffer=Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+            Ogre::HardwareIndexBuffer::IT_16BIT,36,Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+        mRenderOp.indexData->indexBuffer->writeData(0,mRenderOp.indexData->indexBuffer->getSizeInBytes(),faces,true);
+        mRenderOp.operationType=Ogre::RenderOperation::OT_TRIANGLE_LIST;
+        mRenderOp.useIndexes=true;
+    }
+    ~BoxRenderable() {
+        delete mRenderOp.vertexData;
+        delete mRenderOp.indexData;
+    }
+    void place(const Ogre::AxisAlignedBox &box) {
+        mTransform.makeTransform(box.getMinimum(),box.getMaximum()-box.getMinimum(),Ogre::Quaternion::IDENTITY);
+        setBoundingBox(box);
+    }
+    virtual void getWorldTransforms(Ogre::Matrix4 *xform) const {
+        *xform=mTransform;
+    }
+    virtual Ogre::Real getSquaredViewDepth(const Ogre::Camera *camera) const {
+        return (mBox.getCenter()-camera->getDerivedPosition()).squaredLength();
+    }
+    virtual Ogre::Real getBoundingRadius() const {
+        return mBox.getHalfSize().length();
+    }
+};
+
+OcclusionCuller::OcclusionCuller(OgreSystem *scene, uint32 visibleTestInterval, uint32 hideAfter)
+  : mScene(scene),
+    mVisibleTestInterval(visibleTestInterval?visibleTestInterval:1),
+    mHideAfter(hideAfter?hideAfter:1),
+    mFrame(0),
+    mBox(new BoxRenderable) {
+    static const char *materialName="Sirikata/OcclusionQueryBox";
+    Ogre::MaterialPtr material=Ogre::MaterialManager::getSingleton().getByName(materialName);
+    if (material.isNull()) {
+        material=Ogre::MaterialManager::getSingleton().create(materialName,Ogre::ResourceGroupManager::INTERNAL_RESOURCE_GROUP_NAME);
+        Ogre::Pass *pass=material->getTechnique(0)->getPass(0);
+        // Only the depth test matters: the box must neither show nor hide anything drawn after it.
+        pass->setColourWriteEnabled(false);
+        pass->setDepthWriteEnabled(false);
+        pass->setDepthCheckEnabled(true);
+        pass->setCullingMode(Ogre::CULL_NONE);
+        pass->setLightingEnabled(false);
+        material->load();
+    }
+    mPass=material->getTechnique(0)->getPass(0);
+    mBox->setMaterial(materialName);
+    mScene->getSceneManager()->addRenderQueueListener(this);
+}
+
+OcclusionCuller::~OcclusionCuller() {
+    mScene->getSceneManager()->removeRenderQueueListener(this);
+    while (!mStates.empty()) {
+        remove(mStates.begin()->first);
+    }
+    delete mBox;
+}
+
+bool OcclusionCuller::supported() {
+    Ogre::RenderSystem *renderSystem=Ogre::Root::getSingleton().getRenderSystem();
+    return renderSystem && renderSystem->getCapabilities() &&
+        renderSystem->getCapabilities()->hasCapability(Ogre::RSC_HWOCCLUSION);
+}
+
+void OcclusionCuller::add(MeshEntity *entity) {
+    State &state=mStates[entity];
+    if (!state.mQuery) {
+        state.mQuery=Ogre::Root::getSingleton().getRenderSystem()->createHardwareOcclusionQuery();
+        // Spread the retests of visible entities over the interval.
+        state.mNextTestFrame=mFrame+(uint32)mStates.size()%mVisibleTestInterval;
+    }
+}
+
+void OcclusionCuller::remove(MeshEntity *entity) {
+    StateMap::iterator where=mStates.find(entity);
+    if (where==mStates.end()) {
+        return;
+    }
+    entity->setOccluded(false);
+    Ogre::Root::getSingleton().getRenderSystem()->destroyHardwareOcclusionQuery(where->second.mQuery);
+    mStates.erase(where);
+}
+
+void OcclusionCuller::collect(MeshEntity *entity, State &state) {
+    if (!state.mPending || state.mQuery->isStillOutstanding()) {
+        return;
+    }
+    state.mPending=false;
+    unsigned int pixels=0;
+    state.mQuery->pullOcclusionQuery(&pixels);
+    if (pixels) {
+        state.mMisses=0;
+        state.mNextTestFrame=mFrame+mVisibleTestInterval;
+        entity->setOccluded(false);
+    } else if (++state.mMisses>=mHideAfter) {
+        entity->setOccluded(true);
+    }
+}
+
+void OcclusionCuller::test(MeshEntity *entity, State &state, Ogre::Camera *camera) {
+    Ogre::AxisAlignedBox box;
+    Ogre::Entity *ogreEntity=entity->getOgreEntity();
+    if (ogreEntity) {
+        box=ogreEntity->getWorldBoundingBox(true);
+    } else {
+        float radius=entity->getBoundingInfo().radius();
+        if (radius<=0) {
+            return;
+        }
+        const Ogre::Vector3 &center=entity->mSceneNode->_getDerivedPosition();
+        box.setExtents(center-Ogre::Vector3(radius),center+Ogre::Vector3(radius));
+    }
+    if (box.isNull() || box.isInfinite()) {
+        entity->setOccluded(false);
+        return;
+    }
+    if (!camera->isVisible(box)) {
+        // Out of the frustum: Ogre does not draw it, and load priority already accounts for it.
+        state.mMisses=0;
+        entity->setOccluded(false);
+        return;
+    }
+    // Grow the box so a camera just outside it cannot have the near plane clip away its front faces.
+    Ogre::Vector3 margin(camera->getNearClipDistance()*2);
+    box.setExtents(box.getMinimum()-margin,box.getMaximum()+margin);
+    if (box.contains(camera->getDerivedPosition())) {
+        state.mMisses=0;
+        entity->setOccluded(false);
+        return;
+    }
+    mBox->place(box);
+    state.mQuery->beginOcclusionQuery();
+    mScene->getSceneManager()->_injectRenderWithPass(mPass,mBox,false);
+    state.mQuery->endOcclusionQuery();
+    state.mPending=true;
+}
+
+void OcclusionCuller::renderQueueEnded(Ogre::uint8 queueGroupId, const Ogre::String &invocation, bool &repeatThisInvocation) {
+    // Test once per frame, against the depth of everything opaque, from the main view only.
+    if (queueGroupId!=Ogre::RENDER_QUEUE_MAIN || !invocation.empty()) {
+        return;
+    }
+    CameraEntity *primary=mScene->getPrimaryCamera();
+    Ogre::Viewport *viewport=mScene->getSceneManager()->getCurrentViewport();
+    if (!primary || !viewport || viewport!=primary->getViewport()) {
+        return;
+    }
+    Ogre::Camera *camera=primary->getOgreCamera();
+    ++mFrame;
+    for (StateMap::iterator iter=mStates.begin();iter!=mStates.end();++iter) {
+        State &state=iter->second;
+        collect(iter->first,state);
+        if (state.mPending) {
+            continue;
+        }
+        // Hidden entities are tested every frame so they reappear promptly; visible ones now and then.
+        if (iter->first->isOccluded() || state.mMisses || (int32)(mFrame-state.mNextTestFrame)>=0) {
+            test(iter->first,state,camera);
+        }
+    }
+}
+
+}
+}
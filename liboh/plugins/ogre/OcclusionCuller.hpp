@@ -0,0 +1,96 @@
+/*  Sirikata liboh -- Ogre Graphics Plugin
+ *  OcclusionCuller.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_GRAPHICS_OCCLUSION_CULLER_HPP_
+#define _SIRIKATA_GRAPHICS_OCCLUSION_CULLER_HPP_
+
+#include <OgreRenderQueueListener.h>
+
+namespace Ogre {
+class HardwareOcclusionQuery;
+class Pass;
+}
+namespace Sirikata {
+namespace Graphics {
+class OgreSystem;
+class MeshEntity;
+
+/**
+ * Hides MeshEntities that hardware occlusion queries find covered by the
+ * rest of the scene from the primary camera, and marks them occluded so that
+ * GraphicsResourceManager deprioritizes loading them.  After the opaque
+ * geometry is drawn each frame, the bounding boxes of hidden entities are
+ * tested against the depth buffer so they reappear one frame after coming
+ * into view.  Visible entities are retested only every few frames, and hide
+ * only after several tests in a row find nothing, so results from one frame
+ * carry over to the next.  Entities whose mesh has not loaded yet are tested
+ * with their bounding sphere, so they can be loaded last.
+ */
+class OcclusionCuller : public Ogre::RenderQueueListener {
+    class BoxRenderable;
+    struct State {
+        Ogre::HardwareOcclusionQuery *mQuery;
+        bool mPending;
+        ///Consecutive tests that found no pixels
+        uint32 mMisses;
+        uint32 mNextTestFrame;
+        State():mQuery(NULL),mPending(false),mMisses(0),mNextTestFrame(0) {}
+    };
+    typedef std::map<MeshEntity*,State> StateMap;
+    StateMap mStates;
+    OgreSystem *mScene;
+    uint32 mVisibleTestInterval;
+    uint32 mHideAfter;
+    uint32 mFrame;
+    BoxRenderable *mBox;
+    Ogre::Pass *mPass;
+    void collect(MeshEntity *entity, State &state);
+    void test(MeshEntity *entity, State &state, Ogre::Camera *camera);
+public:
+    /**
+     * visibleTestInterval is how many frames pass between tests of a visible entity;
+     * hideAfter is how many tests in a row must find it covered before it is hidden.
+     */
+    OcclusionCuller(OgreSystem *scene, uint32 visibleTestInterval, uint32 hideAfter);
+    ~OcclusionCuller();
+    /// Whether the render system can run occlusion queries at all.
+    static bool supported();
+    void add(MeshEntity *entity);
+    /// Removes an entity, showing it again; must be called before it is destroyed.
+    void remove(MeshEntity *entity);
+
+    virtual void renderQueueStarted(Ogre::uint8 queueGroupId, const Ogre::String &invocation, bool &skipThisInvocation) {}
+    virtual void renderQueueEnded(Ogre::uint8 queueGroupId, const Ogre::String &invocation, bool &repeatThisInvocation);
+};
+
+}
+}
+#endif
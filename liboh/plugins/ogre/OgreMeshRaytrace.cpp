@@ -1,8 +1,11 @@
 #include "oh/Platform.hpp"
 #include "OgreMeshRaytrace.hpp"
 #include "OgreSubMesh.h"
+#include "OgreMesh.h"
 #include "OgreEntity.h"
 #include "OgreNode.h"
+#include "OgreRay.h"
+#include <algorithm>
 
 //using Ogre::RenderOperation;
 using Ogre::SubMesh;
@@ -26,20 +29,17 @@ using Ogre::Real;
 //using Ogre::AxisAlignedBox;
 
 namespace Sirikata { namespace Graphics {
-OgreMesh::OgreMesh(Ogre::Entity *entity, Ogre::SubMesh *subMesh)
+OgreMesh::OgreMesh(Ogre::SubMesh *subMesh)
 {
-    syncFromOgreMesh(entity,subMesh);
+    syncFromOgreMesh(subMesh);
+    buildHierarchy();
 }
 int64 OgreMesh::size() const{
-    return mTriangles.size()*sizeof(Triangle);
+    return mTriangles.size()*sizeof(Triangle)+mPrepared.size()*sizeof(PreparedTriangle)+mNodes.size()*sizeof(Node);
 }
-void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
+void OgreMesh::syncFromOgreMesh(Ogre::SubMesh*subMesh)
 {
-  const Ogre::Vector3 &position = entity->getParentNode()->_getDerivedPosition();
-  const Ogre::Quaternion &orient = entity->getParentNode()->_getDerivedOrientation();
-  const Ogre::Vector3 &scale = entity->getParentNode()->_getDerivedScale();
-
-  VertexData *vertexData = subMesh->vertexData;
+  VertexData *vertexData = subMesh->useSharedVertices ? subMesh->parent->sharedVertexData : subMesh->vertexData;
   if (vertexData) {
       VertexDeclaration *vertexDecl = vertexData->vertexDeclaration;
       
@@ -51,6 +51,7 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
       HardwareVertexBuffer *buffer = bufferBinding->getBuffer(element->getSource()).get();
       unsigned char *pVert = static_cast<unsigned char*>(buffer->lock(HardwareBuffer::HBL_READ_ONLY));
       std::vector<Ogre::Vector3> lvertices;
+      lvertices.reserve(vertexData->vertexCount);
       for (size_t vert = 0; vert < vertexData->vertexCount; vert++) {
           Real *vertex = 0;
           Real x, y, z;
@@ -58,10 +59,7 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
           x = *vertex++;
           y = *vertex++;
           z = *vertex++;
-          Ogre::Vector3 vec(x, y, z);
-          vec = (orient * (vec * scale)) + position;
-          
-          lvertices.push_back(vec);
+          lvertices.push_back(Ogre::Vector3(x, y, z));
           
           pVert += buffer->getVertexSize();
       }
@@ -71,8 +69,10 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
       IndexData * indexData = subMesh->indexData;
       HardwareIndexBuffer *indexBuffer = indexData->indexBuffer.get();
       void *pIndex = static_cast<unsigned char *>(indexBuffer->lock(HardwareBuffer::HBL_READ_ONLY));
+      size_t indexEnd = indexData->indexStart + indexData->indexCount;
+      mTriangles.reserve(indexData->indexCount/3);
       if (indexBuffer->getType() == HardwareIndexBuffer::IT_16BIT) {
-          for (size_t index = indexData->indexStart; index < indexData->indexCount; ) {
+          for (size_t index = indexData->indexStart; index + 2 < indexEnd; ) {
               uint16 *uint16Buffer = (uint16 *) pIndex;
               uint16 v1 = uint16Buffer[index++];
               uint16 v2 = uint16Buffer[index++];
@@ -81,7 +81,7 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
               mTriangles.push_back(Triangle(lvertices[v1], lvertices[v2], lvertices[v3]));
           }
       } else if (indexBuffer->getType() == HardwareIndexBuffer::IT_32BIT) {
-          for (size_t index = indexData->indexStart; index < indexData->indexCount; ) {
+          for (size_t index = indexData->indexStart; index + 2 < indexEnd; ) {
               uint32 *uint16Buffer = (uint32 *) pIndex;
               uint32 v1 = uint16Buffer[index++];
               uint32 v2 = uint16Buffer[index++];
@@ -96,25 +96,212 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
   }
 }
 
-std::pair<bool, std::pair< double, Vector3f> > OgreMesh::intersect(const Ogre::Ray &ray)
+class OgreMesh::CentroidLess {
+    const std::vector<Ogre::Vector3> &mCentroids;
+    int mAxis;
+public:
+    CentroidLess(const std::vector<Ogre::Vector3> &centroids, int axis):mCentroids(centroids),mAxis(axis) {}
+    bool operator()(uint32 a, uint32 b) const {
+        return mCentroids[a][mAxis]<mCentroids[b][mAxis];
+    }
+};
+
+uint32 OgreMesh::buildNode(std::vector<uint32> &order, const std::vector<Ogre::Vector3> &centroids, uint32 begin, uint32 end) {
+    uint32 index=mNodes.size();
+    mNodes.push_back(Node());
+    Ogre::Vector3 lo(mTriangles[order[begin]].mV1), hi(lo);
+    Ogre::Vector3 centroidLo(centroids[order[begin]]), centroidHi(centroidLo);
+    for (uint32 i=begin;i<end;++i) {
+        const Triangle &tri=mTriangles[order[i]];
+        lo.makeFloor(tri.mV1);lo.makeFloor(tri.mV2);lo.makeFloor(tri.mV3);
+        hi.makeCeil(tri.mV1);hi.makeCeil(tri.mV2);hi.makeCeil(tri.mV3);
+        centroidLo.makeFloor(centroids[order[i]]);
+        centroidHi.makeCeil(centroids[order[i]]);
+    }
+    mNodes[index].mMin=lo;
+    mNodes[index].mMax=hi;
+    Ogre::Vector3 extent=centroidHi-centroidLo;
+    int axis=extent.x>extent.y?(extent.x>extent.z?0:2):(extent.y>extent.z?1:2);
+    if (end-begin<=MAX_LEAF_TRIANGLES||extent[axis]<=0) {
+        mNodes[index].mOffset=begin;
+        mNodes[index].mCount=end-begin;
+        return index;
+    }
+    uint32 mid=begin+(end-begin)/2;
+    std::nth_element(order.begin()+begin,order.begin()+mid,order.begin()+end,CentroidLess(centroids,axis));
+    buildNode(order,centroids,begin,mid);
+    uint32 second=buildNode(order,centroids,mid,end);
+    mNodes[index].mOffset=second;
+    mNodes[index].mCount=0;
+    return index;
+}
+
+void OgreMesh::buildHierarchy() {
+    if (mTriangles.empty()) {
+        return;
+    }
+    std::vector<uint32> order(mTriangles.size());
+    std::vector<Ogre::Vector3> centroids(mTriangles.size());
+    for (uint32 i=0;i<order.size();++i) {
+        order[i]=i;
+        centroids[i]=(mTriangles[i].mV1+mTriangles[i].mV2+mTriangles[i].mV3)/3;
+    }
+    mNodes.reserve(2*mTriangles.size()/MAX_LEAF_TRIANGLES+1);
+    buildNode(order,centroids,0,order.size());
+    // Store triangles in leaf order so every leaf covers a contiguous range.
+    std::vector<Triangle> sorted;
+    sorted.reserve(mTriangles.size());
+    mPrepared.resize(mTriangles.size());
+    for (uint32 i=0;i<order.size();++i) {
+        const Triangle &tri=mTriangles[order[i]];
+        sorted.push_back(tri);
+        mPrepared[i].mCorner=tri.mV1;
+        mPrepared[i].mEdge1=tri.mV2-tri.mV1;
+        mPrepared[i].mEdge2=tri.mV3-tri.mV1;
+    }
+    mTriangles.swap(sorted);
+}
+
+namespace {
+bool intersectsBox(const Ogre::Vector3 &origin, const Ogre::Vector3 &invDirection,
+                   const Ogre::Vector3 &lo, const Ogre::Vector3 &hi, Real maxDistance) {
+    Real tmin=0, tmax=maxDistance;
+    for (int axis=0;axis<3;++axis) {
+        Real t1=(lo[axis]-origin[axis])*invDirection[axis];
+        Real t2=(hi[axis]-origin[axis])*invDirection[axis];
+        if (t1>t2) std::swap(t1,t2);
+        if (t1>tmin) tmin=t1;
+        if (t2<tmax) tmax=t2;
+        if (tmin>tmax) return false;
+    }
+    return true;
+}
+}
+
+std::pair<bool, std::pair< double, Vector3f> > OgreMesh::intersect(const Ogre::Ray &ray) const
 {
   std::pair<bool, std::pair< double, Vector3f> > rtn(false,std::pair<double,Vector3f>(std::numeric_limits<Real>::max(),Vector3f(0,0,0)));
-  std::vector<Triangle>::iterator itr,itere=mTriangles.end();
-
-  for (itr = mTriangles.begin(); itr != itere; itr++) {
-    std::pair<bool, Real> hit = Ogre::Math::intersects(ray,
-      itr->mV1, itr->mV2,itr->mV3, true, false);
-    if (hit.first && hit.second < rtn.second.first) {
-      rtn.first = hit.first;
-      rtn.second.first = hit.second;
-      Ogre::Vector3 nml=(itr->mV1-itr->mV2).crossProduct(itr->mV3-itr->mV2);
+  if (mNodes.empty()) {
+      return rtn;
+  }
+  const Ogre::Vector3 &origin=ray.getOrigin();
+  const Ogre::Vector3 &direction=ray.getDirection();
+  Ogre::Vector3 invDirection(1/direction.x,1/direction.y,1/direction.z);
+  Real best=std::numeric_limits<Real>::max();
+  int bestTriangle=-1;
+  uint32 stack[MAX_DEPTH];
+  int stackSize=0;
+  stack[stackSize++]=0;
+  while (stackSize) {
+      const Node &node=mNodes[stack[--stackSize]];
+      if (!intersectsBox(origin,invDirection,node.mMin,node.mMax,best)) {
+          continue;
+      }
+      if (node.mCount==0) {
+          uint32 first=&node-&mNodes[0]+1;
+          stack[stackSize++]=node.mOffset;
+          stack[stackSize++]=first;
+          continue;
+      }
+      for (uint32 i=node.mOffset,end=node.mOffset+node.mCount;i<end;++i) {
+          const PreparedTriangle &tri=mPrepared[i];
+          // Moller-Trumbore, front faces only, matching Ogre::Math::intersects(ray,a,b,c,true,false)
+          Ogre::Vector3 p=direction.crossProduct(tri.mEdge2);
+          Real det=tri.mEdge1.dotProduct(p);
+          if (det<=0) continue;
+          Ogre::Vector3 s=origin-tri.mCorner;
+          Real u=s.dotProduct(p);
+          if (u<0||u>det) continue;
+          Ogre::Vector3 q=s.crossProduct(tri.mEdge1);
+          Real v=direction.dotProduct(q);
+          if (v<0||u+v>det) continue;
+          Real t=tri.mEdge2.dotProduct(q)/det;
+          if (t>=0&&t<best) {
+              best=t;
+              bestTriangle=i;
+          }
+      }
+  }
+  if (bestTriangle>=0) {
+      const Triangle &tri=mTriangles[bestTriangle];
+      rtn.first = true;
+      rtn.second.first = best;
+      Ogre::Vector3 nml=(tri.mV1-tri.mV2).crossProduct(tri.mV3-tri.mV2);
       rtn.second.second.x=nml.x;
       rtn.second.second.y=nml.y;
       rtn.second.second.z=nml.z;
-    }
   }
 
   return rtn;
 }
 
+namespace {
+typedef std::map<Ogre::Mesh*,std::tr1::weak_ptr<OgreMeshRaytrace> > RaytraceCache;
+RaytraceCache sRaytraceCache;
+}
+
+OgreMeshRaytrace::OgreMeshRaytrace(Ogre::Mesh *mesh) {
+    uint16 numSubMeshes = mesh->getNumSubMeshes();
+    for (uint16 ndx = 0; ndx < numSubMeshes; ndx++) {
+        mSubMeshes.push_back(new OgreMesh(mesh->getSubMesh(ndx)));
+    }
+}
+
+OgreMeshRaytrace::~OgreMeshRaytrace() {
+    for (size_t i=0;i<mSubMeshes.size();++i) {
+        delete mSubMeshes[i];
+    }
+}
+
+std::tr1::shared_ptr<OgreMeshRaytrace> OgreMeshRaytrace::get(Ogre::Mesh *mesh) {
+    std::tr1::weak_ptr<OgreMeshRaytrace> &slot=sRaytraceCache[mesh];
+    std::tr1::shared_ptr<OgreMeshRaytrace> retval=slot.lock();
+    if (!retval) {
+        // Entries only expire when the last entity drops its mesh, so sweep them here.
+        for (RaytraceCache::iterator iter=sRaytraceCache.begin();iter!=sRaytraceCache.end();) {
+            if (iter->first!=mesh&&iter->second.expired()) {
+                sRaytraceCache.erase(iter++);
+            } else {
+                ++iter;
+            }
+        }
+        retval=std::tr1::shared_ptr<OgreMeshRaytrace>(new OgreMeshRaytrace(mesh));
+        slot=retval;
+    }
+    return retval;
+}
+
+int64 OgreMeshRaytrace::size() const {
+    int64 retval=0;
+    for (size_t i=0;i<mSubMeshes.size();++i) {
+        retval+=mSubMeshes[i]->size();
+    }
+    return retval;
+}
+
+std::pair<bool, std::pair< double, Vector3f> > OgreMeshRaytrace::intersect(const Ogre::Ray &ray, Ogre::Node *node) const
+{
+  const Ogre::Vector3 &position = node->_getDerivedPosition();
+  const Ogre::Quaternion &orient = node->_getDerivedOrientation();
+  const Ogre::Vector3 &scale = node->_getDerivedScale();
+  Ogre::Quaternion invOrient = orient.Inverse();
+  // The direction is not renormalized, so ray parameters mean the same thing in both spaces.
+  Ogre::Ray meshRay((invOrient * (ray.getOrigin() - position)) / scale,
+                    (invOrient * ray.getDirection()) / scale);
+  std::pair<bool, std::pair< double, Vector3f> > rtn(false,std::pair<double,Vector3f>(std::numeric_limits<Real>::max(),Vector3f(0,0,0)));
+  for (size_t i=0;i<mSubMeshes.size();++i) {
+      std::pair<bool, std::pair< double, Vector3f> > curHit = mSubMeshes[i]->intersect(meshRay);
+      if (curHit.first && curHit.second.first < rtn.second.first) {
+          rtn=curHit;
+      }
+  }
+  if (rtn.first) {
+      // Normals transform by the inverse transpose: divide by scale, then rotate.
+      const Vector3f &nml=rtn.second.second;
+      Ogre::Vector3 worldNormal=orient*(Ogre::Vector3(nml.x,nml.y,nml.z)/scale);
+      rtn.second.second=Vector3f(worldNormal.x,worldNormal.y,worldNormal.z);
+  }
+  return rtn;
+}
+
 } }
@@ -6,7 +6,9 @@
 #include "OgreVector3.h"
 namespace Ogre {
   class Entity;
+  class Mesh;
   class SubMesh;
+  class Node;
   class Ray;
 }
 
@@ -24,7 +26,8 @@ public:
 };
 
 /**
- * This class syncs Ogre::Meshes from the hardware and does ray intersection tests.
+ * This class syncs one Ogre::SubMesh from the hardware, in mesh space, and
+ * does ray intersection tests against a bounding volume hierarchy over it.
  */
 class OgreMesh {
     class EntitySubmeshPair {
@@ -47,16 +50,57 @@ class OgreMesh {
             return mEntity<b.mEntity;
         }
     };
+    enum {
+        MAX_LEAF_TRIANGLES=4,
+        ///Deeper than any median split tree can get
+        MAX_DEPTH=64
+    };
+    struct Node {
+        Ogre::Vector3 mMin;
+        Ogre::Vector3 mMax;
+        ///First triangle of a leaf, or index of the second child; the first child follows its parent
+        uint32 mOffset;
+        ///Number of triangles in a leaf, 0 for inner nodes
+        uint32 mCount;
+    };
+    ///A triangle as one corner and the two edges leaving it, ready for the Moller-Trumbore test
+    struct PreparedTriangle {
+        Ogre::Vector3 mCorner;
+        Ogre::Vector3 mEdge1;
+        Ogre::Vector3 mEdge2;
+    };
+    class CentroidLess;
+    std::vector<PreparedTriangle> mPrepared;
+    std::vector<Node> mNodes;
+    uint32 buildNode(std::vector<uint32> &order, const std::vector<Ogre::Vector3> &centroids, uint32 begin, uint32 end);
+    void buildHierarchy();
 public:
-  std::pair<bool, std::pair< double, Vector3f> > intersect(const Ogre::Ray &ray);
-  OgreMesh(Ogre::Entity *entity, Ogre::SubMesh *submesh);
+  OgreMesh(Ogre::SubMesh *submesh);
+  ///ray is in mesh space; returns the ray parameter of the nearest front facing hit and the unnormalized normal there
+  std::pair<bool, std::pair< double, Vector3f> > intersect(const Ogre::Ray &ray) const;
 protected:
-  void syncFromOgreMesh(Ogre::Entity *entity,  Ogre::SubMesh *mSubMesh);
+  void syncFromOgreMesh(Ogre::SubMesh *mSubMesh);
   std::vector<Triangle> mTriangles;
 public:
   int64 size()const;
 };
 
+/**
+ * The OgreMeshes for every submesh of one Ogre::Mesh, synced once and shared
+ * by all the entities showing that mesh.
+ */
+class OgreMeshRaytrace {
+    std::vector<OgreMesh*> mSubMeshes;
+    OgreMeshRaytrace(Ogre::Mesh *mesh);
+public:
+    ~OgreMeshRaytrace();
+    ///Returns the cached raytrace data for mesh, syncing it if no entity holds it yet
+    static std::tr1::shared_ptr<OgreMeshRaytrace> get(Ogre::Mesh *mesh);
+    ///ray is in world space and node places the mesh in the world
+    std::pair<bool, std::pair< double, Vector3f> > intersect(const Ogre::Ray &ray, Ogre::Node *node) const;
+    int64 size()const;
+};
+
 } }
 
 #endif
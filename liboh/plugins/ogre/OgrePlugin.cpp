@@ -31,11 +31,12 @@
  */
 
 #include <oh/Platform.hpp>
+#include <util/PluginManager.hpp>
 #include <oh/SimulationFactory.hpp>
 #include "OgreSystem.hpp"
 static int core_plugin_refcount = 0;
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     using namespace Sirikata;
     using namespace Sirikata::Graphics;
     if (core_plugin_refcount==0)
@@ -45,15 +46,15 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
     core_plugin_refcount++;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
     return ++core_plugin_refcount;
 }
-SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
     assert(core_plugin_refcount>0);
     return --core_plugin_refcount;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     using namespace Sirikata;
     if (core_plugin_refcount>0) {
         core_plugin_refcount--;
@@ -63,9 +64,11 @@ SIRIKATA_PLUGIN_EXPORT_C void destroy() {
     }
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "ogregraphics";
 }
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(ogregraphics)
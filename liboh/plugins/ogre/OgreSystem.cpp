@@ -32,6 +32,7 @@
 #include <oh/Platform.hpp>
 
 #include "options/Options.hpp"
+#include "util/TraceEvents.hpp"
 #include "OgreSystem.hpp"
 #include "OgrePlugin.hpp"
 
@@ -46,6 +47,10 @@
 #include "LightEntity.hpp"
 #include <Ogre.h>
 #include "CubeMap.hpp"
+#include "MeshBatcher.hpp"
+#include "AssetPrefetcher.hpp"
+#include "OcclusionCuller.hpp"
+#include "LightManager.hpp"
 #include "input/SDLInputManager.hpp"
 #include "input/InputDevice.hpp"
 #include "input/InputEvents.hpp"
@@ -54,6 +59,7 @@
 #include "resourceManager/ResourceManager.hpp"
 #include "resourceManager/GraphicsResourceManager.hpp"
 #include "resourceManager/ManualMaterialLoader.hpp"
+#include "resourceManager/ShaderMicrocodeCache.hpp"
 #include "resourceManager/UploadTool.hpp"
 #include "meruCompat/EventSource.hpp"
 #include "meruCompat/SequentialWorkQueue.hpp"
@@ -62,6 +68,7 @@ using Meru::ResourceManager;
 using Meru::CDNArchivePlugin;
 using Meru::SequentialWorkQueue;
 using Meru::MaterialScriptManager;
+using Meru::ShaderMicrocodeCache;
 
 #include <boost/filesystem.hpp>
 
@@ -132,6 +139,11 @@ OgreSystem::OgreSystem():mLastFrameTime(Time::now()),mFloatingPointOffset(0,0,0)
 {
     increfcount();
     mCubeMap=NULL;
+    mMeshBatcher=NULL;
+    mAssetPrefetcher=NULL;
+    mOcclusionCuller=NULL;
+    mLightManager=NULL;
+    mBudgetLodBias=false;
     mInputManager=NULL;
     mRenderTarget=NULL;
     mSceneManager=NULL;
@@ -316,7 +328,7 @@ std::list<CameraEntity*>::iterator OgreSystem::attachCamera(const String &render
         cubeMapOffsets.push_back(Vector3f(0,0,0));
         cubeMapNearPlanes.push_back(0.1);
         try {
-            mCubeMap=new CubeMap(this,cubeMapNames,512,cubeMapOffsets, cubeMapNearPlanes);
+            mCubeMap=new CubeMap(this,cubeMapNames,mCubeMapSize->as<uint32>(),cubeMapOffsets, cubeMapNearPlanes, mCubeMapFacesPerFrame->as<uint32>(), mCubeMapMinMove->as<float32>());
         }catch (std::bad_alloc&) {
             mCubeMap=NULL;
         }
@@ -351,6 +363,21 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
     OptionValue*renderBufferAutoMipmap;
     OptionValue*transferManager,*workQueue,*eventManager;
     OptionValue*grabCursor;
+    OptionValue*instancingThreshold;
+    OptionValue*budgetLodBias;
+    OptionValue*instancingSettle;
+    OptionValue*webViewMaxFps;
+    OptionValue*webViewFrameBudget;
+    OptionValue*prefetchLookahead;
+    OptionValue*prefetchRadius;
+    OptionValue*prefetchMaxOutstanding;
+    OptionValue*shaderCacheDir;
+    OptionValue*occlusionCulling;
+    OptionValue*occlusionTestInterval;
+    OptionValue*occlusionHideAfter;
+    OptionValue*maxLightsPerObject;
+    OptionValue*lightBudget;
+    OptionValue*lightFullDetailPixels;
     InitializeClassOptions("ogregraphics",this,
                            pluginFile=new OptionValue("pluginfile","plugins.cfg",OptionValueType<String>(),"sets the file ogre should read options from."),
                            configFile=new OptionValue("configfile","ogre.cfg",OptionValueType<String>(),"sets the ogre config file for config options"),
@@ -370,6 +397,24 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
                            shadowTechnique=new OptionValue("shadows","none",ShadowType(),"Shadow Style=[none,texture_additive,texture_modulative,stencil_additive,stencil_modulaive]"),
                            shadowFarDistance=new OptionValue("shadowfar","1000",OptionValueType<float32>(),"The distance away a shadowcaster may hide the light"),
                            mParallaxSteps=new OptionValue("parallax-steps","1.0",OptionValueType<float>(),"Multiplies the per-material parallax steps by this constant (default 1.0)"),
+                           budgetLodBias=new OptionValue("budget-lod-bias","false",OptionValueType<bool>(),"Switch to coarser mesh LOD levels sooner when the video memory budget cannot hold every wanted resource"),
+                           instancingThreshold=new OptionValue("instancing-threshold","0",OptionValueType<uint32>(),"Merge static meshes into one batch once this many share a mesh and materials (0 disables)"),
+                           instancingSettle=new OptionValue("instancing-settle","500ms",OptionValueType<Duration>(),"How long a mesh batch must go unchanged before it is rebuilt"),
+                           webViewMaxFps=new OptionValue("webview-max-fps","0",OptionValueType<uint32>(),"Render rate for web views that don't set their own (0 for every frame)"),
+                           webViewFrameBudget=new OptionValue("webview-frame-budget","0ms",OptionValueType<Duration>(),"Rendering time all web views may use per frame before the rest wait (0 for no limit)"),
+                           prefetchLookahead=new OptionValue("prefetch-lookahead","3s",OptionValueType<Duration>(),"How far ahead along the camera's path to download meshes early"),
+                           prefetchRadius=new OptionValue("prefetch-radius","50",OptionValueType<float64>(),"Distance from the camera's predicted path within which meshes are downloaded early"),
+                           prefetchMaxOutstanding=new OptionValue("prefetch-max-outstanding","4",OptionValueType<uint32>(),"Most early mesh downloads in flight at once (0 disables prefetching)"),
+                           occlusionCulling=new OptionValue("occlusion-culling","true",OptionValueType<bool>(),"Hide meshes that occlusion queries find covered by others, and load them last"),
+                           occlusionTestInterval=new OptionValue("occlusion-test-interval","8",OptionValueType<uint32>(),"Frames between occlusion tests of a mesh that was last found visible"),
+                           occlusionHideAfter=new OptionValue("occlusion-hide-after","2",OptionValueType<uint32>(),"Occlusion tests in a row that must find a mesh covered before it is hidden"),
+                           maxLightsPerObject=new OptionValue("max-lights-per-object","8",OptionValueType<uint32>(),"Most lights one mesh is lit by, choosing the most important (0 leaves the choice to Ogre)"),
+                           lightBudget=new OptionValue("light-budget","32",OptionValueType<uint32>(),"Most lights switched on at once; the least important in view are turned off (0 for no limit)"),
+                           lightFullDetailPixels=new OptionValue("light-full-detail-pixels","128",OptionValueType<float32>(),"Meshes smaller than this many pixels across get proportionally fewer lights"),
+                           shaderCacheDir=new OptionValue("shader-cache-dir","Cache",OptionValueType<String>(),"Directory to keep compiled shaders in between runs (empty to compile them every run)"),
+                           mCubeMapSize=new OptionValue("cubemap-size","512",OptionValueType<uint32>(),"Resolution of each face of the reflection cube maps"),
+                           mCubeMapFacesPerFrame=new OptionValue("cubemap-faces-per-frame","1",OptionValueType<uint32>(),"How many cube map faces are re-rendered each frame (1 to 6)"),
+                           mCubeMapMinMove=new OptionValue("cubemap-min-move",".03125",OptionValueType<float32>(),"Camera movement along every axis below which a cube map is not re-rendered"),
                            mParallaxShadowSteps=new OptionValue("parallax-shadow-steps","10",OptionValueType<int>(),"Total number of steps for shadow parallax mapping (default 10)"),
                            new OptionValue("nearplane",".125",OptionValueType<float32>(),"The min distance away you can see"),
                            new OptionValue("farplane","5000",OptionValueType<float32>(),"The max distance away you can see"),
@@ -403,6 +448,7 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
             new ResourceManager(mTransferManager);
             new GraphicsResourceManager(SequentialWorkQueue::getSingleton().getWorkQueue());
             new MaterialScriptManager;
+            new ShaderMicrocodeCache(shaderCacheDir->as<String>());
 
             mCDNArchivePlugin = new CDNArchivePlugin;
             sRoot->installPlugin(&*mCDNArchivePlugin);
@@ -505,10 +551,30 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
     mSceneManager->setShadowTechnique(shadowTechnique->as<Ogre::ShadowTechnique>());
     mSceneManager->setShadowFarDistance(shadowFarDistance->as<float32>());
     mSceneManager->setAmbientLight(Ogre::ColourValue(0.0,0.0,0.0,0));
+    mBudgetLodBias=budgetLodBias->as<bool>();
+    mRayQuery=mSceneManager->createRayQuery(Ogre::Ray(), Ogre::SceneManager::WORLD_GEOMETRY_TYPE_MASK);
+    if (instancingThreshold->as<uint32>()) {
+        mMeshBatcher=new MeshBatcher(this,instancingThreshold->as<uint32>(),instancingSettle->as<Duration>());
+    }
+    if (occlusionCulling->as<bool>()) {
+        if (OcclusionCuller::supported()) {
+            mOcclusionCuller=new OcclusionCuller(this,occlusionTestInterval->as<uint32>(),occlusionHideAfter->as<uint32>());
+        } else {
+            SILOG(ogre,info,"Render system has no occlusion queries; culling by view frustum only");
+        }
+    }
+    if (maxLightsPerObject->as<uint32>()) {
+        mLightManager=new LightManager(this,maxLightsPerObject->as<uint32>(),lightBudget->as<uint32>(),lightFullDetailPixels->as<float32>());
+    }
+    if (prefetchMaxOutstanding->as<uint32>()) {
+        mAssetPrefetcher=new AssetPrefetcher(this,mTransferManager,prefetchLookahead->as<Duration>(),
+                                             prefetchRadius->as<float64>(),prefetchMaxOutstanding->as<uint32>());
+    }
     sActiveOgreScenes.push_back(this);
 
     allocMouseHandler();
     new WebViewManager(0, mInputManager, getAwesomiumResourcesDir()); ///// FIXME: Initializing singleton class
+    WebViewManager::getSingleton().setUpdateBudget(webViewMaxFps->as<uint32>(),webViewFrameBudget->as<Duration>().toMicroseconds()/1000.0);
 
 /*  // Test web view
     WebView* view = WebViewManager::getSingleton().createWebView(UUID::random().rawHexData(), 400, 300, OverlayPosition());
@@ -642,6 +708,18 @@ OgreSystem::~OgreSystem() {
             delete current;
         }
     }
+    delete mMeshBatcher;
+    mMeshBatcher=NULL;
+    delete mAssetPrefetcher;
+    mAssetPrefetcher=NULL;
+    delete mOcclusionCuller;
+    mOcclusionCuller=NULL;
+    delete mLightManager;
+    mLightManager=NULL;
+    if (mRayQuery) {
+        mSceneManager->destroyQuery(mRayQuery);
+        mRayQuery=NULL;
+    }
     if (mSceneManager) {
         Ogre::Root::getSingleton().destroySceneManager(mSceneManager);
     }
@@ -656,6 +734,7 @@ OgreSystem::~OgreSystem() {
     }
     --sNumOgreSystems;
     if (sNumOgreSystems==0) {
+        ShaderMicrocodeCache::destroy();
         OGRE_DELETE sCDNArchivePlugin;
         sCDNArchivePlugin=NULL;
         OGRE_DELETE sRoot;
@@ -716,7 +795,11 @@ void OgreSystem::createProxy(ProxyObjectPtr p){
 
 }
 void OgreSystem::destroyProxy(ProxyObjectPtr p){
-
+    // Destroyed proxies already took their Entity with them; this one was only demoted out of view.
+    Entity *ent = getEntity(p);
+    if (ent) {
+        delete ent;
+    }
 }
 struct RayTraceResult {
     Ogre::Real mDistance;
@@ -775,8 +858,6 @@ bool OgreSystem::queryRay(const Vector3d&position,
 }
 Entity *OgreSystem::internalRayTrace(const Vector3d &position, const Vector3f &direction, bool aabbOnly,int&resultCount,double &returnresult, Vector3f&returnNormal, int which) const {
     Ogre::Ray traceFrom(toOgre(position, getOffset()), toOgre(direction));
-    Ogre::RaySceneQuery* mRayQuery;
-    mRayQuery = mSceneManager->createRayQuery(Ogre::Ray(), Ogre::SceneManager::WORLD_GEOMETRY_TYPE_MASK);
     mRayQuery->setRay(traceFrom);
     mRayQuery->setSortByDistance(aabbOnly);
     const Ogre::RaySceneQueryResult& resultList = mRayQuery->execute();
@@ -795,11 +876,10 @@ Entity *OgreSystem::internalRayTrace(const Vector3d &position, const Vector3f &d
             bool passed=aabbOnly&&result.distance > 0;
             if (aabbOnly==false) {
                 rtr.mDistance=3.0e38f;
-                Ogre::Mesh *mesh = foundEntity->getMesh().get();
-                uint16 numSubMeshes = mesh->getNumSubMeshes();
-                for (uint16 ndx = 0; ndx < numSubMeshes; ndx++) {
-                    OgreMesh ogreMesh(foundEntity, mesh->getSubMesh(ndx));
-                    std::pair<bool, std::pair<double, Vector3f> > curHit = ogreMesh.intersect(traceFrom);
+                MeshEntity *meshEntity = dynamic_cast<MeshEntity*>(ourEntity);
+                if (meshEntity && meshEntity->getRaytrace()) {
+                    std::pair<bool, std::pair<double, Vector3f> > curHit =
+                        meshEntity->getRaytrace()->intersect(traceFrom, foundEntity->getParentNode());
                     if (curHit.first && curHit.second.first < rtr.mDistance && curHit.second.first > 0 ) {
                         rtr.mMovableObject = result.movable;
                         rtr.mDistance=curHit.second.first;
@@ -835,9 +915,6 @@ Entity *OgreSystem::internalRayTrace(const Vector3d &position, const Vector3f &d
         }
     }
     mRayQuery->clearResults();
-    if (mRayQuery) {
-        mSceneManager->destroyQuery(mRayQuery);
-    }
     resultCount=count;
     return toReturn;
 }
@@ -929,11 +1006,13 @@ Duration OgreSystem::desiredTickRate()const{
 }
 
 bool OgreSystem::renderOneFrame(Time curFrameTime, Duration deltaTime) {
+    SIRIKATA_TRACE_SCOPE("OgreSystem::renderOneFrame");
     for (std::list<OgreSystem*>::iterator iter=sActiveOgreScenes.begin();iter!=sActiveOgreScenes.end();) {
         (*iter++)->preFrame(curFrameTime, deltaTime);
     }
     Ogre::WindowEventUtilities::messagePump();
     if (mPrimaryCamera) {
+        SIRIKATA_TRACE_SCOPE("Ogre::Root::renderOneFrame");
         Ogre::Root::getSingleton().renderOneFrame();
     }
     Time postFrameTime = Time::now();
@@ -958,6 +1037,7 @@ bool OgreSystem::renderOneFrame(Time curFrameTime, Duration deltaTime) {
             // else, keep waiting for a camera to appear (may require connecting to a space).
         }
         if (webViewInitialized) {
+            SIRIKATA_TRACE_SCOPE("WebViewManager::Update");
             WebViewManager::getSingleton().Update();
         }
     }
@@ -966,7 +1046,13 @@ bool OgreSystem::renderOneFrame(Time curFrameTime, Duration deltaTime) {
 }
 static Time debugStartTime = Time::now();
 bool OgreSystem::tick(){
+    SIRIKATA_TRACE_SCOPE("OgreSystem::tick");
     GraphicsResourceManager::getSingleton().computeLoadedSet();
+    if (mBudgetLodBias && mPrimaryCamera) {
+        // Never push LOD switches in to less than a quarter of their authored distances.
+        float bias = std::max(GraphicsResourceManager::getSingleton().getBudgetFit(), 0.25f);
+        mPrimaryCamera->getOgreCamera()->setLodBias(bias);
+    }
     Time curFrameTime(Time::now());
     Time finishTime(curFrameTime + desiredTickRate()); // arbitrary
 
@@ -981,19 +1067,47 @@ bool OgreSystem::tick(){
     }
     mLastFrameTime=curFrameTime;//reevaluate Time::now()?
 
-    Meru::SequentialWorkQueue::getSingleton().dequeuePoll();
-    Meru::SequentialWorkQueue::getSingleton().dequeueUntil(finishTime);
+    {
+        SIRIKATA_TRACE_SCOPE("SequentialWorkQueue::dequeue");
+        Meru::SequentialWorkQueue::getSingleton().dequeuePoll();
+        Meru::SequentialWorkQueue::getSingleton().dequeueUntil(finishTime);
+    }
 
     return continueRendering;
 }
 void OgreSystem::preFrame(Time currentTime, Duration frameTime) {
     std::list<Entity*>::iterator iter;
+    // Extrapolate whole ProxyManagers at once when enough of their objects are moving to pay for it.
+    std::vector<ProxyManager*> managers;
+    size_t numMoving = 0, numSlots = 0;
+    for (iter = mMovingEntities.begin(); iter != mMovingEntities.end(); ++iter) {
+        ProxyManager *manager = (*iter)->getProxy().getProxyManager();
+        if (std::find(managers.begin(), managers.end(), manager) == managers.end()) {
+            managers.push_back(manager);
+            numSlots += manager->getLocationTable().size();
+        }
+        ++numMoving;
+    }
+    if (numMoving * 4 >= numSlots) {
+        for (size_t i = 0; i < managers.size(); ++i) {
+            managers[i]->getLocationTable().extrapolate(currentTime);
+        }
+    }
     for (iter = mMovingEntities.begin(); iter != mMovingEntities.end();) {
         Entity *current = *iter;
         ++iter;
 //        SILOG(ogre,debug,"Extrapolating "<<current<<" for time "<<(float64)(currentTime-debugStartTime));
         current->extrapolateLocation(currentTime);
     }
+    if (mMeshBatcher) {
+        mMeshBatcher->tick(currentTime);
+    }
+    if (mLightManager) {
+        mLightManager->tick();
+    }
+    if (mAssetPrefetcher) {
+        mAssetPrefetcher->tick(currentTime);
+    }
 }
 
 void OgreSystem::postFrame(Time current, Duration frameTime) {
@@ -75,6 +75,10 @@ class Entity;
 using Input::SDLInputManager;
 class CameraEntity;
 class CubeMap;
+class MeshBatcher;
+class AssetPrefetcher;
+class OcclusionCuller;
+class LightManager;
 
 /** Represents one OGRE SceneManager, a single environment. */
 class OgreSystem: public TimeSteppedQueryableSimulation {
@@ -96,6 +100,7 @@ class OgreSystem: public TimeSteppedQueryableSimulation {
     std::list<Entity*> mMovingEntities;
     friend class Entity; //Entity will insert/delete itself from these arrays.
     friend class CameraEntity; //CameraEntity will insert/delete itself from the scene cameras array.
+    friend class AssetPrefetcher; //AssetPrefetcher looks through mSceneEntities for meshes to fetch early.
     OptionValue*mWindowWidth;
     OptionValue*mWindowHeight;
     OptionValue*mWindowDepth;
@@ -122,6 +127,12 @@ class OgreSystem: public TimeSteppedQueryableSimulation {
     Vector3d mFloatingPointOffset;
     Ogre::RaySceneQuery* mRayQuery;
     CubeMap *mCubeMap;
+    MeshBatcher *mMeshBatcher;
+    AssetPrefetcher *mAssetPrefetcher;
+    OcclusionCuller *mOcclusionCuller;
+    LightManager *mLightManager;
+    ///Whether the primary camera's LOD bias follows GraphicsResourceManager::getBudgetFit
+    bool mBudgetLodBias;
     Entity* internalRayTrace(const Vector3d &position,
                      const Vector3f &direction,
                      bool aabbOnly,
@@ -142,6 +153,9 @@ public:
 
     OptionValue *mParallaxSteps;
     OptionValue *mParallaxShadowSteps;
+    OptionValue *mCubeMapSize;
+    OptionValue *mCubeMapFacesPerFrame;
+    OptionValue *mCubeMapMinMove;
     static std::list<OgreSystem*> sActiveOgreScenes;
     static uint32 sNumOgreSystems;
     std::list<CameraEntity*> mAttachedCameras;
@@ -154,6 +168,18 @@ public:
     CameraEntity*getPrimaryCamera() {
         return mPrimaryCamera;
     }
+    ///The batcher merging repeated static meshes, or NULL if instancing is disabled
+    MeshBatcher *getMeshBatcher() {
+        return mMeshBatcher;
+    }
+    ///The culler hiding meshes covered by others, or NULL if occlusion culling is off or unsupported
+    OcclusionCuller *getOcclusionCuller() {
+        return mOcclusionCuller;
+    }
+    ///The manager choosing which lights light each mesh, or NULL if Ogre's own choice is used
+    LightManager *getLightManager() {
+        return mLightManager;
+    }
     SDLInputManager *getInputManager() {
         return mInputManager;
     }
@@ -49,6 +49,7 @@
 #include <task/Event.hpp>
 #include <task/Time.hpp>
 #include <task/EventManager.hpp>
+#include <util/TraceEvents.hpp>
 #include <SDL_keysym.h>
 #include <set>
 
@@ -126,6 +127,8 @@ class OgreSystem::MouseHandler {
        each cursor should have its own MouseHandler instance */
     std::map<int, DragAction> mDragAction;
     std::map<int, ActiveDrag*> mActiveDrag;
+    // Motion for each active drag not yet acted on, merged until the next frame.
+    std::map<int, MouseDragEventPtr> mPendingDrag;
     /*
         typedef EventResponse (MouseHandler::*ClickAction) (EventPtr evbase);
         std::map<int, ClickAction> mClickAction;
@@ -696,6 +699,16 @@ private:
         fclose(output);
     }
 
+    /// First press starts keeping trace events, later ones write out the last few seconds of them.
+    void dumpTraceAction() {
+        if (!Trace::isRecording()) {
+            Trace::start();
+            SILOG(ogre,info,"Recording trace events, press again to write them out");
+            return;
+        }
+        Trace::dump();
+    }
+
     bool quat2Euler(Quaternion q, double& pitch, double& roll, double& yaw) {
         /// note that in the 'gymbal lock' situation, we will get nan's for pitch.
         /// for now, in that case we should revert to quaternion
@@ -815,6 +828,9 @@ private:
             case PhysicalParameters::Character:
                 subtype="character";
                 break;
+            case PhysicalParameters::DynamicMesh:
+                subtype="dynamicmesh";
+                break;
             default:
                 std::cout << "unknown physical mode! " << (int)phys.mode << std::endl;
             }
@@ -940,6 +956,12 @@ private:
         mInputBinding.handle(inputev);
 
         ActiveDrag * &drag = mActiveDrag[ev->mButton];
+        if (drag && ev->mType == Input::DRAG_DRAG) {
+            // Drags pick and move objects; do that once per frame, from tick, however often the mouse reports.
+            coalesceDrag(ev);
+            return EventResponse::nop();
+        }
+        flushDrag(ev->mButton);
         if (ev->mType == Input::DRAG_START) {
             if (drag) {
                 delete drag;
@@ -965,6 +987,41 @@ private:
         return EventResponse::nop();
     }
 
+    void coalesceDrag(const MouseDragEventPtr &ev) {
+        MouseDragEventPtr &pending = mPendingDrag[ev->mButton];
+        if (!pending) {
+            pending = ev;
+            return;
+        }
+        // Each event's last position is the one before it, so keeping the oldest
+        // last position makes deltaLastX/Y span every merged event.
+        pending = MouseDragEventPtr(new MouseDragEvent(
+                ev->getDevice(), Input::DRAG_DRAG,
+                ev->mXStart, ev->mYStart, ev->mX, ev->mY,
+                pending->mLastX, pending->mLastY,
+                ev->mCursorType, ev->mButton,
+                ev->mPressure, ev->mPressureMin, ev->mPressureMax));
+    }
+
+    void flushDrag(int button) {
+        std::map<int, MouseDragEventPtr>::iterator iter = mPendingDrag.find(button);
+        if (iter == mPendingDrag.end()) {
+            return;
+        }
+        MouseDragEventPtr ev = iter->second;
+        mPendingDrag.erase(iter);
+        ActiveDrag *drag = mActiveDrag[button];
+        if (drag && ev) {
+            drag->mouseMoved(ev);
+        }
+    }
+
+    void flushDrags() {
+        while (!mPendingDrag.empty()) {
+            flushDrag(mPendingDrag.begin()->first);
+        }
+    }
+
     EventResponse webviewHandler(EventPtr ev) {
         WebViewEventPtr webview_ev (std::tr1::dynamic_pointer_cast<WebViewEvent>(ev));
         if (!webview_ev)
@@ -1195,6 +1252,7 @@ public:
         mInputResponses["cloneObjects"] = new SimpleInputResponse(std::tr1::bind(&MouseHandler::cloneObjectsAction, this));
         mInputResponses["import"] = new SimpleInputResponse(std::tr1::bind(&MouseHandler::importAction, this));
         mInputResponses["saveScene"] = new SimpleInputResponse(std::tr1::bind(&MouseHandler::saveSceneAction, this));
+        mInputResponses["dumpTrace"] = new SimpleInputResponse(std::tr1::bind(&MouseHandler::dumpTraceAction, this));
 
         mInputResponses["selectObject"] = new Vector2fInputResponse(std::tr1::bind(&MouseHandler::selectObjectAction, this, _1, 1));
         mInputResponses["selectObjectReverse"] = new Vector2fInputResponse(std::tr1::bind(&MouseHandler::selectObjectAction, this, _1, -1));
@@ -1249,6 +1307,7 @@ public:
         mInputBinding.add(InputBindingEvent::Key(SDL_SCANCODE_D), mInputResponses["cloneObjects"]);
         mInputBinding.add(InputBindingEvent::Key(SDL_SCANCODE_O, Input::MOD_CTRL), mInputResponses["import"]);
         mInputBinding.add(InputBindingEvent::Key(SDL_SCANCODE_S, Input::MOD_CTRL), mInputResponses["saveScene"]);
+        mInputBinding.add(InputBindingEvent::Key(SDL_SCANCODE_T, Input::MOD_CTRL), mInputResponses["dumpTrace"]);
         // Drag modes
         mInputBinding.add(InputBindingEvent::Key(SDL_SCANCODE_Q), mInputResponses["setDragModeNone"]);
         mInputBinding.add(InputBindingEvent::Key(SDL_SCANCODE_W), mInputResponses["setDragModeMoveObject"]);
@@ -1310,6 +1369,7 @@ public:
     }
 
     void tick(const Time& t) {
+        flushDrags();
         cameraPathTick(t);
     }
 };
@@ -31,6 +31,7 @@
  */
 
 #include "WebView.hpp"
+#include "util/TraceEvents.hpp"
 #include <OgreBitwise.h>
 
 using namespace Ogre;
@@ -60,6 +61,7 @@ WebView::WebView(const std::string& name, unsigned short width, unsigned short h
 	texHeight = height;
 	alphaCache = 0;
 	alphaCachePitch = 0;
+	needsFullUpload = true;
 	matPass = 0;
 	baseTexUnit = 0;
 	maskTexUnit = 0;
@@ -101,6 +103,7 @@ WebView::WebView(const std::string& name, unsigned short width, unsigned short h
 	texHeight = height;
 	alphaCache = 0;
 	alphaCachePitch = 0;
+	needsFullUpload = true;
 	matPass = 0;
 	baseTexUnit = 0;
 	maskTexUnit = 0;
@@ -191,7 +194,7 @@ void WebView::createMaterial()
 	TexturePtr texture = TextureManager::getSingleton().createManual(
 		viewName + "Texture", ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
 		TEX_TYPE_2D, texWidth, texHeight, 0, PF_BYTE_BGRA,
-		TU_DYNAMIC_WRITE_ONLY_DISCARDABLE, this);
+		TU_DYNAMIC_WRITE_ONLY, this);
 
 	HardwarePixelBufferSharedPtr pixelBuffer = texture->getBuffer();
 	pixelBuffer->lock(HardwareBuffer::HBL_DISCARD);
@@ -228,18 +231,21 @@ void WebView::loadResource(Resource* resource)
 	tex->setHeight(texHeight);
 	tex->setNumMipmaps(0);
 	tex->setFormat(PF_BYTE_BGRA);
-	tex->setUsage(TU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+	tex->setUsage(TU_DYNAMIC_WRITE_ONLY);
 	tex->createInternalResources();
 
 	// force update
+	needsFullUpload = true;
 }
 
-void WebView::update()
+bool WebView::update(bool allowRender)
 {
+	SIRIKATA_TRACE_SCOPE("WebView::update");
 #ifdef HAVE_AWESOMIUM
-	if(maxUpdatePS)
-		if(timer.getMilliseconds() - lastUpdateTime < 1000 / maxUpdatePS)
-			return;
+	unsigned int updateRate = maxUpdatePS ? maxUpdatePS : WebViewManager::getSingleton().maxViewUpdatesPerSecond;
+	if(updateRate)
+		if(timer.getMilliseconds() - lastUpdateTime < 1000 / updateRate)
+			return false;
 
 	updateFade();
 
@@ -250,29 +256,57 @@ void WebView::update()
 	else
 		baseTexUnit->setAlphaOperation(LBX_SOURCE1, LBS_MANUAL, LBS_CURRENT, fadeValue * opacity);
 
+	// Hidden or fully faded views keep accumulating dirty area in Awesomium and catch up
+	// with a single render once they are shown again.
+	if(!allowRender || !getVisibility())
+		return false;
+
 	if(!webView->isDirty())
-		return;
+		return false;
 
 	TexturePtr texture = TextureManager::getSingleton().getByName(viewName + "Texture");
 
-	HardwarePixelBufferSharedPtr pixelBuffer = texture->getBuffer();
-	pixelBuffer->lock(HardwareBuffer::HBL_DISCARD);
-	const PixelBox& pixelBox = pixelBuffer->getCurrentLock();
-
-	uint8* destBuffer = static_cast<uint8*>(pixelBox.data);
+	if(stagingBuffer.size() != texHeight * texPitch)
+	{
+		stagingBuffer.assign(texHeight * texPitch, 128);
+		needsFullUpload = true;
+	}
+	uint8* destBuffer = &stagingBuffer[0];
 
-	webView->render(destBuffer, (int)texPitch, (int)texDepth);
+	// Awesomium only redraws the area that changed since the last render into the buffer
+	// and reports it, so the rest of the staging copy is still current.
+	Awesomium::Rect dirtyRect;
+	webView->render(destBuffer, (int)texPitch, (int)texDepth, &dirtyRect);
 
-	if(isWebViewTransparent && !usingMask && ignoringTrans)
+	Box region(0, 0, texWidth, texHeight);
+	if(!needsFullUpload)
 	{
-		for(int row = 0; row < texHeight; row++)
-			for(int col = 0; col < texWidth; col++)
-				alphaCache[row * alphaCachePitch + col] = destBuffer[row * texPitch + col * 4 + 3];
+		region.left = std::max(0, dirtyRect.x);
+		region.top = std::max(0, dirtyRect.y);
+		region.right = std::min((int)texWidth, dirtyRect.x + dirtyRect.width);
+		region.bottom = std::min((int)texHeight, dirtyRect.y + dirtyRect.height);
 	}
 
-	pixelBuffer->unlock();
+	if(region.right > region.left && region.bottom > region.top)
+	{
+		PixelBox staged(texWidth, texHeight, 1, PF_BYTE_BGRA, destBuffer);
+		staged.rowPitch = texPitch / texDepth;
+		staged.slicePitch = staged.rowPitch * texHeight;
+		texture->getBuffer()->blitFromMemory(staged.getSubVolume(region), region);
+
+		if(isWebViewTransparent && !usingMask && ignoringTrans)
+		{
+			for(size_t row = region.top; row < region.bottom; row++)
+				for(size_t col = region.left; col < region.right; col++)
+					alphaCache[row * alphaCachePitch + col] = destBuffer[row * texPitch + col * 4 + 3];
+		}
+	}
+	needsFullUpload = false;
 
 	lastUpdateTime = timer.getMilliseconds();
+	return true;
+#else
+	return false;
 #endif
 }
 
@@ -787,6 +821,8 @@ void WebView::captureImage(const std::string& filename)
 	unsigned char* buffer = OGRE_ALLOC_T(unsigned char, viewWidth * viewHeight * bpp, Ogre::MEMCATEGORY_GENERAL);
 
 	webView->render(buffer, viewWidth * bpp, bpp);
+	// That render consumed the dirty area, so the staging copy has missed it.
+	needsFullUpload = true;
 
 	result.loadDynamicImage(buffer, viewWidth, viewHeight, 1, isWebViewTransparent? Ogre::PF_BYTE_BGRA : Ogre::PF_BYTE_BGR, false);
 	result.save(Awesomium::WebCore::Get().getBaseDirectory() + "\\" + filename);
@@ -851,7 +887,7 @@ void WebView::resize(int width, int height)
 	TexturePtr texture = TextureManager::getSingleton().createManual(
 		viewName + "Texture", ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
 		TEX_TYPE_2D, texWidth, texHeight, 0, PF_BYTE_BGRA,
-		TU_DYNAMIC_WRITE_ONLY_DISCARDABLE, this);
+		TU_DYNAMIC_WRITE_ONLY, this);
 
 	HardwarePixelBufferSharedPtr pixelBuffer = texture->getBuffer();
 	pixelBuffer->lock(HardwareBuffer::HBL_DISCARD);
@@ -864,6 +900,7 @@ void WebView::resize(int width, int height)
 	memset(pDest, 128, texHeight*texPitch);
 
 	pixelBuffer->unlock();
+	needsFullUpload = true;
 #endif
 
 	baseTexUnit = matPass->createTextureUnitState(viewName + "Texture");
@@ -401,6 +401,11 @@ namespace Graphics {
 		unsigned short texHeight;
 		size_t texDepth;
 		size_t texPitch;
+		/// Persistent copy of the page that Awesomium renders into, so only the area it
+		/// reports as changed has to be blitted to the texture.
+		std::vector<unsigned char> stagingBuffer;
+		/// Set when the texture contents can't be trusted (new, resized or reloaded texture).
+		bool needsFullUpload;
 		std::map<std::string, JSDelegate> delegateMap;
 		Ogre::FilterOptions texFiltering;
 		std::pair<std::string, std::string> maskImageParameters;
@@ -423,7 +428,9 @@ namespace Graphics {
 
 		void loadResource(Ogre::Resource* resource);
 
-		void update();
+		/// Advances the fade and, if allowRender and the view is visible and dirty, re-renders
+		/// the page into the texture. Returns whether it rendered.
+		bool update(bool allowRender = true);
 
 		void updateFade();
 
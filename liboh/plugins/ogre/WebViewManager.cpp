@@ -74,6 +74,7 @@ WebViewManager::WebViewManager(Ogre::Viewport* defaultViewport, InputManager* in
 	  isDragging(false), isResizing(false),
           zOrderCounter(5),
 	  lastTooltip(0), tooltipShowTime(0), isDraggingFocusedWebView(0),
+	  maxViewUpdatesPerSecond(0), frameBudgetMS(0),
           mInputManager(inputMgr)
 {
     tooltipWebView = 0;
@@ -93,6 +94,12 @@ WebViewManager::WebViewManager(Ogre::Viewport* defaultViewport, InputManager* in
 #endif
 }
 
+void WebViewManager::setUpdateBudget(unsigned int maxUpdatesPerSecond, double frameBudget)
+{
+	maxViewUpdatesPerSecond = maxUpdatesPerSecond;
+	frameBudgetMS = frameBudget;
+}
+
 WebViewManager::~WebViewManager()
 {
 	WebViewMap::iterator iter;
@@ -148,10 +155,30 @@ void WebViewManager::Update()
 			delete webViewToDelete;
 		}
 		else
-		{
-			iter->second->update();
 			++iter;
+	}
+
+	if(activeWebViews.empty())
+		return;
+
+	// Go round the views starting after the one that ran out of budget last frame, so a few
+	// expensive views can't keep the rest from ever rendering.
+	iter = activeWebViews.upper_bound(resumeUpdatesAfter);
+	if(iter == end)
+		iter = activeWebViews.begin();
+	double budgetStart = budgetTimer.getMicroseconds() / 1000.0;
+	bool allowRender = true;
+	resumeUpdatesAfter.clear();
+	for(size_t count = activeWebViews.size(); count > 0; --count)
+	{
+		if(iter->second->update(allowRender) && allowRender && frameBudgetMS > 0 &&
+			budgetTimer.getMicroseconds() / 1000.0 - budgetStart > frameBudgetMS)
+		{
+			allowRender = false;
+			resumeUpdatesAfter = iter->first;
 		}
+		if(++iter == end)
+			iter = activeWebViews.begin();
 	}
 
 	if(tooltipShowTime)
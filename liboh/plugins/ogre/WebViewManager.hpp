@@ -126,6 +126,15 @@ public:
 	*/
 	void Update();
 
+	/**
+	* Limits how much time WebView rendering may take.
+	*
+	* @param	maxUpdatesPerSecond	The render rate for views that don't set their own with WebView::setMaxUPS, 0 for no limit.
+	* @param	frameBudgetMS	Once views have spent this many milliseconds rendering in a frame the rest wait for a later
+	*						frame, starting where this one stopped. 0 for no limit.
+	*/
+	void setUpdateBudget(unsigned int maxUpdatesPerSecond, double frameBudgetMS);
+
 	/**
 	* Creates a WebView.
 	*/
@@ -270,6 +279,12 @@ protected:
 	double lastTooltip, tooltipShowTime;
 	bool isDraggingFocusedWebView;
 
+	unsigned int maxViewUpdatesPerSecond;
+	double frameBudgetMS;
+	Ogre::Timer budgetTimer;
+	/// Name of the last view rendered in a frame that ran out of budget; the next frame starts after it.
+	std::string resumeUpdatesAfter;
+
 	bool focusWebView(int x, int y, WebView* selection = 0);
 	WebView* getTopWebView(int x, int y);
 	void onResizeTooltip(WebView* WebView, const Awesomium::JSArguments& args);
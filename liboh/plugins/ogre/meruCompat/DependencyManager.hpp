@@ -57,17 +57,30 @@ namespace Meru
 class DependencyManager
 {
   Sirikata::Task::WorkQueue *mWorkQueue;
+  ///Orders ready tasks by critical path so downloads that gate long load chains start first
+  Sirikata::Task::DependencyScheduler mScheduler;
+  ///Worker threads' queue for preparing resources off the main thread, or NULL
+  Sirikata::Task::WorkQueue *mPrepareQueue;
 
 public:
 
   Sirikata::Task::WorkQueue *getQueue() {
     return mWorkQueue;
   }
+  Sirikata::Task::DependencyScheduler *getScheduler() {
+    return &mScheduler;
+  }
+  Sirikata::Task::WorkQueue *getPrepareQueue() {
+    return mPrepareQueue;
+  }
+  void setPrepareQueue(Sirikata::Task::WorkQueue *prepareQueue) {
+    mPrepareQueue = prepareQueue;
+  }
   /** DependencyManager constructor.
    *  \param destroy_on_completion if true, the Manager will destroy itself
    *         (and all tasks as a result) when all tasks are complete.
    */
-  DependencyManager(Sirikata::Task::WorkQueue *wq) : mWorkQueue(wq) {
+  DependencyManager(Sirikata::Task::WorkQueue *wq) : mWorkQueue(wq), mScheduler(wq), mPrepareQueue(NULL) {
   	//bool destroy_on_completion = false);
   }
   //virtual ~DependencyManager();
@@ -35,13 +35,65 @@
 #include <boost/algorithm/string.hpp>
 #include <fstream>
 #include "ReplacingDataStream.hpp"
+#include "util/ProfiledMutex.hpp"
 
 namespace Meru {
 
-static boost::mutex CDNArchiveMutex;
+namespace {
+typedef Sirikata::Metrics::ProfiledMutex<> CDNArchiveMutex;
+typedef boost::lock_guard<CDNArchiveMutex> CDNArchiveLock;
+
+struct CDNArchiveFile {
+  ResourceBuffer buffer;
+  unsigned int refcount;
+};
+
+/// One slice of the file table: files hash to a shard by canonical name, so opens of different files rarely share a lock
+struct CDNArchiveShard {
+  CDNArchiveMutex mutex;
+  std::map<Ogre::String, CDNArchiveFile> files;
+  ///Files whose last open stream closed, erased on the next change to this shard unless something took them again
+  std::vector<Ogre::String> toBeDeleted;
+
+  CDNArchiveShard() : mutex("cdnarchive.shard") {
+  }
+
+  /// Caller holds mutex
+  void removeUndesirables() {
+    while (!toBeDeleted.empty()) {
+      std::map<Ogre::String, CDNArchiveFile>::iterator tbd=files.find(toBeDeleted.back());
+      if (tbd!=files.end()) {
+        if (tbd->second.refcount==0) {
+          files.erase(tbd);
+        }
+      }
+      toBeDeleted.pop_back();
+    }
+  }
+};
+
+enum {NUM_CDN_ARCHIVE_SHARDS=16};
+CDNArchiveShard sShards[NUM_CDN_ARCHIVE_SHARDS];
+
+CDNArchiveShard &shardFor(const Ogre::String &canonicalName) {
+  unsigned int hash=2166136261u;
+  for (Ogre::String::const_iterator i=canonicalName.begin(),ie=canonicalName.end();i!=ie;++i) {
+    hash=(hash^(unsigned char)*i)*16777619u;
+  }
+  return sShards[hash%NUM_CDN_ARCHIVE_SHARDS];
+}
+
+void removeAllUndesirables() {
+  for (int i=0;i<NUM_CDN_ARCHIVE_SHARDS;++i) {
+    CDNArchiveLock lok(sShards[i].mutex);
+    sShards[i].removeUndesirables();
+  }
+}
+}
+
+///Guards CDNArchivePackages and sCurArchive; never held while taking a shard's lock
+static CDNArchiveMutex CDNArchivePackageMutex("cdnarchive.packages");
 static std::map<unsigned int, std::vector <Ogre::String> > CDNArchivePackages;
-static std::map<Ogre::String, std::pair<ResourceBuffer, unsigned int> > CDNArchiveFileRefcount;
-static std::vector <Ogre::String> CDNArchiveToBeDeleted;
 static int sCurArchive = 0;
 static const unsigned char white_png[] = /* 160 */
 {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A,0x00,0x00,0x00,0x0D,0x49,0x48,0x44
@@ -127,19 +179,6 @@ static const char *const native_files_data[]={(char*)white_png,(char*)black_png,
 static const int native_files_size[]={sizeof(white_png),sizeof(black_png),sizeof(whiteclear_png) , sizeof(blackclear_png) , sizeof(graytrans_png) , sizeof(black_png), sizeof(black_png), sizeof(black_png), sizeof(black_png), sizeof(black_png), sizeof(black_png), sizeof(white_png), sizeof(white_png), sizeof(white_png), sizeof(white_png), sizeof(white_png), sizeof(white_png) };
 static const int num_native_files=sizeof(native_files)/sizeof(native_files[0]);
 
-static void removeUndesirables()
-{
-  while (!CDNArchiveToBeDeleted.empty()) {
-    std::map<Ogre::String, std::pair<ResourceBuffer,unsigned int> >::iterator tbd=CDNArchiveFileRefcount.find(CDNArchiveToBeDeleted.back());
-    if (tbd!=CDNArchiveFileRefcount.end()) {
-      if (tbd->second.second==0) {
-        CDNArchiveFileRefcount.erase(tbd);
-      }
-    }
-    CDNArchiveToBeDeleted.pop_back();
-  }
-}
-
 static std::string MERU_URI_HASH_PREFIX("mhash:");
 
 static String canonicalizeHash(const String&filename)
@@ -165,33 +204,40 @@ time_t CDNArchive::getModifiedTime(const Ogre::String&)
 
 unsigned int CDNArchive::addArchive()
 {
-  boost::mutex::scoped_lock lok(CDNArchiveMutex);
+  removeAllUndesirables();
+  CDNArchiveLock lok(CDNArchivePackageMutex);
   CDNArchivePackages[sCurArchive]=std::vector<Ogre::String>();
-  removeUndesirables();
   return sCurArchive++;
 }
 
 unsigned int CDNArchive::addArchive(const Ogre::String&filename, const ResourceBuffer &rbuffer)
 {
-  boost::mutex::scoped_lock lok(CDNArchiveMutex);
-  CDNArchivePackages[sCurArchive]=std::vector<Ogre::String>();
-  removeUndesirables();
-  addArchiveDataNoLock(sCurArchive, filename, rbuffer);
-  return sCurArchive++;
+  unsigned int archiveName=addArchive();
+  addFile(archiveName, filename, rbuffer);
+  return archiveName;
 }
 
-void CDNArchive::addArchiveDataNoLock(unsigned int archiveName, const Ogre::String&filename, const ResourceBuffer &rbuffer)
+void CDNArchive::addFile(unsigned int archiveName, const Ogre::String&filename, const ResourceBuffer &rbuffer)
 {
-  std::map<Ogre::String,std::pair<ResourceBuffer,unsigned int> >::iterator where=CDNArchiveFileRefcount.find(filename);
-  if (where==CDNArchiveFileRefcount.end()) {
-    SILOG(resource,debug,"File "<<filename<<" Added to CDNArchive");
-    CDNArchiveFileRefcount[canonicalizeHash(filename)]=std::pair<ResourceBuffer,unsigned int>(rbuffer,1);
-  }
-  else {
-    SILOG(resource,debug,"File "<<filename<<" already downloaded to CDNArchive, what a waste! incref to "<<where->second.second+1);
-    ++where->second.second;
+  Ogre::String key=canonicalizeHash(filename);
+  {
+    CDNArchiveShard &shard=shardFor(key);
+    CDNArchiveLock lok(shard.mutex);
+    shard.removeUndesirables();
+    std::map<Ogre::String,CDNArchiveFile>::iterator where=shard.files.find(key);
+    if (where==shard.files.end()) {
+      SILOG(resource,debug,"File "<<filename<<" Added to CDNArchive");
+      CDNArchiveFile &file=shard.files[key];
+      file.buffer=rbuffer;
+      file.refcount=1;
+    }
+    else {
+      SILOG(resource,debug,"File "<<filename<<" already downloaded to CDNArchive, what a waste! incref to "<<where->second.refcount+1);
+      ++where->second.refcount;
+    }
   }
-  CDNArchivePackages[archiveName].push_back(filename);
+  CDNArchiveLock lok(CDNArchivePackageMutex);
+  CDNArchivePackages[archiveName].push_back(key);
 }
 
 Ogre::String CDNArchive::canonicalMhashName(const Ogre::String&filename)
@@ -210,26 +256,32 @@ Ogre::String CDNArchive::canonicalMhashName(const Ogre::String&filename)
 
 void CDNArchive::addArchiveData(unsigned int archiveName, const Ogre::String&filename, const ResourceBuffer &rbuffer)
 {
-  boost::mutex::scoped_lock lok(CDNArchiveMutex);
-  addArchiveDataNoLock(archiveName,canonicalMhashName(filename),rbuffer);
+  addFile(archiveName,canonicalMhashName(filename),rbuffer);
 }
 
 void CDNArchive::clearArchive(unsigned int which)
 {
-  boost::mutex::scoped_lock lok(CDNArchiveMutex);
-  std::map<unsigned int, std::vector<Ogre::String> >::iterator where=CDNArchivePackages.find(which);
-  if (where!=CDNArchivePackages.end()) {
-    for (std::vector<Ogre::String>::iterator i=where->second.begin(),ie=where->second.end();i!=ie;++i) {
-      std::map<Ogre::String,std::pair<ResourceBuffer,unsigned int> >::iterator where2=CDNArchiveFileRefcount.find(*i);
-      if (where2!=CDNArchiveFileRefcount.end()) {
-        if (where2->second.second==0||--where2->second.second==0) {
-          CDNArchiveFileRefcount.erase(where2);
-          SILOG(resource,debug,"File "<<*i<<" Removed from CDNArchive");
-        }else {
-          SILOG(resource,debug,"File "<<*i<<" Decref'd from CDNArchive to "<<where2->second.second);
-        }
+  std::vector<Ogre::String> files;
+  {
+    CDNArchiveLock lok(CDNArchivePackageMutex);
+    std::map<unsigned int, std::vector<Ogre::String> >::iterator where=CDNArchivePackages.find(which);
+    if (where==CDNArchivePackages.end())
+      return;
+    files.swap(where->second);
+  }
+  for (std::vector<Ogre::String>::iterator i=files.begin(),ie=files.end();i!=ie;++i) {
+    CDNArchiveShard &shard=shardFor(*i);
+    CDNArchiveLock lok(shard.mutex);
+    std::map<Ogre::String,CDNArchiveFile>::iterator where2=shard.files.find(*i);
+    if (where2!=shard.files.end()) {
+      if (where2->second.refcount==0||--where2->second.refcount==0) {
+        shard.files.erase(where2);
+        SILOG(resource,debug,"File "<<*i<<" Removed from CDNArchive");
+      }else {
+        SILOG(resource,debug,"File "<<*i<<" Decref'd from CDNArchive to "<<where2->second.refcount);
       }
     }
+    shard.removeUndesirables();
   }
 }
 
@@ -237,33 +289,34 @@ void CDNArchive::removeArchive(unsigned int which)
 {
   clearArchive(which);
 
-  boost::mutex::scoped_lock lok(CDNArchiveMutex);
+  CDNArchiveLock lok(CDNArchivePackageMutex);
   std::map<unsigned int, std::vector<Ogre::String> >::iterator where=CDNArchivePackages.find(which);
   if (where!=CDNArchivePackages.end()) {
     CDNArchivePackages.erase(where);
   }
-  removeUndesirables();
 }
 
 class CDNArchiveDataStream : public Ogre::MemoryDataStream
 {
 public:
-  CDNArchiveDataStream(const Ogre::String &name, std::pair<ResourceBuffer,unsigned int> *input)
-    : Ogre::MemoryDataStream((void*)input->first->data(),(size_t)input->first->length(),false),mBuffer(&input->first)
+  /// Caller holds the lock of the shard that owns input
+  CDNArchiveDataStream(const Ogre::String &name, const Ogre::String &key, CDNArchiveFile *input)
+    : Ogre::MemoryDataStream((void*)input->buffer->data(),(size_t)input->buffer->length(),false),mKey(key),mBuffer(input->buffer)
   {
       mName=name;
-      input->second++;
+      input->refcount++;
   }
 
   virtual void close() {
-    boost::mutex::scoped_lock lok(CDNArchiveMutex);
-    std::map<Ogre::String,std::pair<ResourceBuffer,unsigned int> >::iterator where=CDNArchiveFileRefcount.find(getName());
-    if (where!=CDNArchiveFileRefcount.end()) {
-      if (where->second.second==0){
+    CDNArchiveShard &shard=shardFor(mKey);
+    CDNArchiveLock lok(shard.mutex);
+    std::map<Ogre::String,CDNArchiveFile>::iterator where=shard.files.find(mKey);
+    if (where!=shard.files.end()) {
+      if (where->second.refcount==0){
         SILOG(resource,error,"File "<<getName()<< " Not in CDNArchive Map already has refcount=0");
       }else {
-        if (--where->second.second==0){
-          CDNArchiveToBeDeleted.push_back(where->first);
+        if (--where->second.refcount==0){
+          shard.toBeDeleted.push_back(where->first);
         }
       }
     }else {
@@ -274,7 +327,9 @@ public:
   }
 
 private:
-  ResourceBuffer *mBuffer;
+  Ogre::String mKey;
+  ///Holds the data this stream reads even if the file is dropped from the table first
+  ResourceBuffer mBuffer;
 };
 
 CDNArchive::CDNArchive(const Ogre::String& name, const Ogre::String& archType)
@@ -286,7 +341,7 @@ CDNArchive::CDNArchive(const Ogre::String& name, const Ogre::String& archType)
         DenseData*dd=new DenseData(Transfer::Range((Transfer::cache_usize_type)0,(Transfer::cache_usize_type)size,Transfer::LENGTH,true));
         memcpy(dd->writableData(),native_files_data[i],size);
         DenseDataPtr rbuffer(dd);
-        addArchiveDataNoLock(mNativeFileArchive, native_files[i], rbuffer);
+        addFile(mNativeFileArchive, native_files[i], rbuffer);
     }
 }
 
@@ -314,18 +369,20 @@ char * findMem(char *data, size_t howmuch, const char * target, size_t targlen)
 
 Ogre::DataStreamPtr CDNArchive::open(const Ogre::String& filename) const
 {
-  boost::mutex::scoped_lock lok(CDNArchiveMutex);
-  std::map<Ogre::String,std::pair<ResourceBuffer,unsigned int> >::iterator where=CDNArchiveFileRefcount.find(canonicalizeHash(filename));
-  if (where != CDNArchiveFileRefcount.end()) {
+  Ogre::String key=canonicalizeHash(filename);
+  CDNArchiveShard &shard=shardFor(key);
+  CDNArchiveLock lok(shard.mutex);
+  std::map<Ogre::String,CDNArchiveFile>::iterator where=shard.files.find(key);
+  if (where != shard.files.end()) {
     SILOG(resource,debug,"File "<<filename << " Opened");
     unsigned int hintlen=strlen(CDN_REPLACING_MATERIAL_STREAM_HINT);
     if (filename.length()>hintlen&&memcmp(filename.data(),CDN_REPLACING_MATERIAL_STREAM_HINT,hintlen)==0) {
-      Ogre::DataStreamPtr inner (new CDNArchiveDataStream(filename.substr(hintlen),&where->second));
+      Ogre::DataStreamPtr inner (new CDNArchiveDataStream(filename.substr(hintlen),key,&where->second));
       Ogre::DataStreamPtr retval(new ReplacingDataStream(inner,filename.substr(hintlen),NULL));
       return retval;
     }
     else {
-      Ogre::DataStreamPtr retval(new CDNArchiveDataStream(filename.find("mhash://") == 0 ? filename.substr(filename.length() - SHA256::hex_size) : filename, &where->second));
+      Ogre::DataStreamPtr retval(new CDNArchiveDataStream(filename.find("mhash://") == 0 ? filename.substr(filename.length() - SHA256::hex_size) : filename, key, &where->second));
       return retval;
     }
   }
@@ -371,8 +428,10 @@ Ogre::FileInfoListPtr CDNArchive::findFileInfo(const Ogre::String& pattern, bool
 }
 
 bool CDNArchive::exists(const Ogre::String& filename) {
-    boost::mutex::scoped_lock lok(CDNArchiveMutex);
-    if (CDNArchiveFileRefcount.find(canonicalizeHash(filename))!=CDNArchiveFileRefcount.end()) {
+    Ogre::String key=canonicalizeHash(filename);
+    CDNArchiveShard &shard=shardFor(key);
+    CDNArchiveLock lok(shard.mutex);
+    if (shard.files.find(key)!=shard.files.end()) {
       SILOG(resource,info,"File "<<filename << " Exists as "<<canonicalizeHash(filename));
         return true;
     }else {
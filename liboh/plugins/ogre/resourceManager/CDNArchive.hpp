@@ -45,7 +45,7 @@ namespace Meru {
 class CDNArchive : public Ogre::Archive
 {
   time_t getModifiedTime(const Ogre::String&);
-  static void addArchiveDataNoLock(unsigned int archiveName, const Ogre::String &filename, const ResourceBuffer &rbuffer);
+  static void addFile(unsigned int archiveName, const Ogre::String &filename, const ResourceBuffer &rbuffer);
   unsigned int mNativeFileArchive;
 public:
 
@@ -42,7 +42,7 @@ GraphicsResource::GraphicsResource(const String &id, Type type)
 : mID(id), mParseState(PARSE_INVALID), mLoadState(LOAD_NEW),
   mType(type), mCostEpoch(0), mLoadEpoch(0), mRemoveEpoch(0),
   mCostPropEpoch(0), mBenefit(0), mDepBenefit(0),
-  mCurCost(0), mCost(0), mDepCost(0)
+  mCurCost(0), mCost(0), mDepCost(0), mLoadQueueIndex((size_t)-1)
 {
 
 }
@@ -144,6 +144,21 @@ float GraphicsResource::value() const
   return (totalBenefit) / mCurCost;
 }
 
+float GraphicsResource::maxDependentBenefit() const
+{
+  float best = mBenefit;
+  set<WeakResourcePtr>::const_iterator itr, eitr;
+  for (itr = mDependents.begin(), eitr = mDependents.end(); itr != eitr; ++itr) {
+    SharedResourcePtr resourcePtr = itr->lock();
+    if (resourcePtr) {
+      float benefit = resourcePtr->maxDependentBenefit();
+      if (benefit > best)
+        best = benefit;
+    }
+  }
+  return best;
+}
+
 void GraphicsResource::parse()
 {
   assert(mParseState == PARSE_INVALID);
@@ -40,7 +40,7 @@ class GraphicsResource;
 typedef std::tr1::shared_ptr<GraphicsResource> SharedResourcePtr;
 typedef std::tr1::weak_ptr<GraphicsResource> WeakResourcePtr;
 
-class GraphicsResource : public SelfWeakPtr<GraphicsResource>
+class GraphicsResource : public SelfWeakPtr<GraphicsResource>, public Memory::Accounted<Memory::GRAPHICS>
 {
 public:
   enum Type {
@@ -89,6 +89,8 @@ public:
   void setCost(float cost);
   float getDepCost(unsigned int epoch);
   float value() const;
+  ///Largest benefit of this resource or of anything depending on it, e.g. the biggest entity showing a texture
+  float maxDependentBenefit() const;
 
   virtual void parsed(bool success);
   virtual void loaded(bool success, unsigned int epoch);
@@ -112,6 +114,15 @@ public:
   ParseState getParseState();
   LoadState getLoadState();
 
+  ///Slot in GraphicsResourceManager's load queue, IndexedHeap::npos while not queued
+  size_t &loadQueueIndex() {
+    return mLoadQueueIndex;
+  }
+  ///Whether removeLoadDependencies kept this resource loaded in the given epoch
+  bool keptInEpoch(unsigned int epoch) const {
+    return mRemoveEpoch == epoch;
+  }
+
 protected:
   static unsigned int sCostPropEpoch;
 
@@ -168,6 +179,7 @@ protected:
   float mCurCost;
   float mCost;
   float mDepCost;
+  size_t mLoadQueueIndex;
 };
 
 }
@@ -37,11 +37,23 @@
 #include "../OgreSystem.hpp"
 #include "../CameraEntity.hpp"
 #include "../MeshEntity.hpp"
+#include <OgreCamera.h>
+#include <OgreViewport.h>
 
 using std::set;
 
 namespace Meru {
 
+OptionValue*OPTION_SCREEN_SPACE_PRIORITY = new OptionValue("screen-space-priority","false",OptionValueType<bool>(),"Rank meshes by the pixels they cover in each camera's view instead of by radius over squared distance");
+OptionValue*OPTION_OFFSCREEN_BENEFIT = new OptionValue("offscreen-benefit","0.05",OptionValueType<float>(),"Fraction of its benefit a mesh behind every camera keeps under screen-space-priority, so turning around does not start from nothing");
+OptionValue*OPTION_OCCLUDED_BENEFIT = new OptionValue("occluded-benefit","0.1",OptionValueType<float>(),"Fraction of its benefit a mesh keeps while occlusion culling finds it hidden behind others");
+
+InitializeGlobalOptions graphicsresourceentityopts("ogregraphics",
+    OPTION_SCREEN_SPACE_PRIORITY,
+    OPTION_OFFSCREEN_BENEFIT,
+    OPTION_OCCLUDED_BENEFIT,
+    NULL);
+
 GraphicsResourceEntity::GraphicsResourceEntity(const SpaceObjectReference &id, GraphicsEntity *graphicsEntity)
 : GraphicsResource(id.toString(), ENTITY), mGraphicsEntity(graphicsEntity), mLoadTime(Time::now())
 {
@@ -55,11 +67,61 @@ GraphicsResourceEntity::~GraphicsResourceEntity()
 {
 }
 
+float GraphicsResourceEntity::screenBenefit(const Location &curLoc, CameraEntity *camera, float radius)
+{
+  const Location& avatarLoc = camera->getProxy().extrapolateLocation(Time::now());
+  Vector3f toEntity(curLoc.getPosition() - avatarLoc.getPosition());
+  float dist = toEntity.length();
+  if (dist <= radius) {
+    return std::numeric_limits<float>::max();
+  }
+  Ogre::Camera *ogreCamera = camera->getOgreCamera();
+  Ogre::Viewport *viewport = camera->getViewport();
+  float halfHeight = viewport ? viewport->getActualHeight() * 0.5f : 1.0f;
+  float halfWidth = viewport ? viewport->getActualWidth() * 0.5f : ogreCamera->getAspectRatio();
+  float tanHalfFov = tan(ogreCamera->getFOVy().valueRadians() * 0.5f);
+  // Radius of the bounding sphere's projection in pixels, and the area it covers clipped to the viewport.
+  float projected = radius / (dist * tanHalfFov) * halfHeight;
+  float area = 3.14159265f * projected * projected;
+  float viewArea = 4.0f * halfWidth * halfHeight;
+  if (area > viewArea)
+    area = viewArea;
+  // Ogre cameras look down their -z axis.
+  Vector3f forward = -avatarLoc.getOrientation().zAxis();
+  if (forward.dot(toEntity) < -radius)
+    area *= OPTION_OFFSCREEN_BENEFIT->as<float>();
+  return area;
+}
+
 float GraphicsResourceEntity::calcBenefit()
 {
   if (!mGraphicsEntity) {
     return 0.0f;
   }
+  float benefit = viewBenefit();
+  if (mGraphicsEntity->isOccluded() && benefit < std::numeric_limits<float>::max())
+    benefit *= OPTION_OCCLUDED_BENEFIT->as<float>();
+  return benefit;
+}
+
+float GraphicsResourceEntity::viewBenefit()
+{
+  if (OPTION_SCREEN_SPACE_PRIORITY->as<bool>()) {
+    const Location& curLoc = mGraphicsEntity->getProxy().extrapolateLocation(Time::now());
+    float radius = mGraphicsEntity->getBoundingInfo().radius();
+    float best = 0.0f;
+    std::list<OgreSystem*>::const_iterator systemIter = OgreSystem::sActiveOgreScenes.begin(),
+      systemend = OgreSystem::sActiveOgreScenes.end();
+    for (; systemIter != systemend; ++systemIter) {
+      std::list<CameraEntity*>::const_iterator cameraIter = (*systemIter)->mAttachedCameras.begin(),
+        cameraEnd = (*systemIter)->mAttachedCameras.end();
+      for (; cameraIter != cameraEnd; ++cameraIter) {
+        float area = screenBenefit(curLoc, *cameraIter, radius);
+        best = best > area ? best : area;
+      }
+    }
+    return best;
+  }
   if (MESH_DISTANCE_IS_KING || STANDARD_COST_BENEFIT) {
     const Location& curLoc = mGraphicsEntity->getProxy().extrapolateLocation(Time::now());
 
@@ -57,6 +57,10 @@ public:
 protected:
 
   virtual float calcBenefit();
+  /// Benefit from where the entity is relative to the cameras, before occlusion is considered
+  float viewBenefit();
+  /// Pixels the entity's bounding sphere covers in camera's viewport, cut down if it is behind the camera
+  float screenBenefit(const Location &curLoc, CameraEntity *camera, float radius);
 
   GraphicsEntity *mGraphicsEntity;
   URI mMeshID;
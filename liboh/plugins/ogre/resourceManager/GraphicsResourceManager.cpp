@@ -41,6 +41,7 @@
 #include "ResourceManager.hpp"
 #include "Event.hpp"
 #include "EventSource.hpp"
+#include <algorithm>
 
 using std::map;
 using std::set;
@@ -51,15 +52,19 @@ namespace Meru {
 
 MANUAL_SINGLETON_STORAGE(GraphicsResourceManager);
 
+extern OptionValue*OPTION_TEXTURE_REFINES_PER_FRAME;
+
 OptionValue*OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE = new OptionValue("video-memory-cache-size","1024",OptionValueType<int>(),"Number of megabytes to store from CDN in video memory");
+OptionValue*OPTION_RESOURCE_PREPARE_THREADS = new OptionValue("resource-prepare-threads","0",OptionValueType<int>(),"Threads that read and decode meshes, textures and materials before the render thread uploads them, 0 to do it all on the render thread");
 
 InitializeGlobalOptions graphicsresourcemanageropts("ogregraphics",
     OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE,
+    OPTION_RESOURCE_PREPARE_THREADS,
     NULL);
 
 
 GraphicsResourceManager::GraphicsResourceManager(Sirikata::Task::WorkQueue *dependencyQueue)
-: mEpoch(0), mEnabled(true)
+: mEpoch(0), mBudgetFit(1.0f), mEnabled(true)
 {
   this->mTickListener = EventSource::getSingleton().subscribeId(
     EventID(EventTypes::Tick),
@@ -67,6 +72,13 @@ GraphicsResourceManager::GraphicsResourceManager(Sirikata::Task::WorkQueue *depe
   );
 
   mDependencyManager = new DependencyManager(dependencyQueue);
+  mPrepareQueue = NULL;
+  mPrepareThreads = NULL;
+  if (OPTION_RESOURCE_PREPARE_THREADS->as<int>() > 0) {
+    mPrepareQueue = new Sirikata::Task::ThreadSafeWorkQueue;
+    mPrepareThreads = mPrepareQueue->createWorkerThreads(OPTION_RESOURCE_PREPARE_THREADS->as<int>());
+    mDependencyManager->setPrepareQueue(mPrepareQueue);
+  }
   mBudget = OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE->as<int>() * 1024 * 1024;
 }
 
@@ -74,6 +86,10 @@ GraphicsResourceManager::~GraphicsResourceManager()
 {
   EventSource::getSingleton().unsubscribe(this->mTickListener,false);
 
+  if (mPrepareQueue) {
+    mPrepareQueue->destroyWorkerThreads(mPrepareThreads);
+    delete mPrepareQueue;
+  }
   delete mDependencyManager;
 }
 
@@ -168,7 +184,6 @@ void GraphicsResourceManager::computeLoadedSet()
     return;
 
   mEpoch++;
-  mToUnload = mResources;
 
   set<GraphicsResource *>::iterator itr;
   for (itr = mEntities.begin(); itr != mEntities.end(); itr++) {
@@ -182,11 +197,13 @@ void GraphicsResourceManager::computeLoadedSet()
   }
 
   float budgetUsed = 0;
-  while (mQueue.size() > 0) {
-    GraphicsResource* resource = mQueue.begin()->second;
-    mQueue.erase(mQueue.begin());
+  float costWanted = 0;
+  while (!mQueue.empty()) {
+    GraphicsResource* resource = mQueue.top();
+    mQueue.pop();
 
     float cost = resource->cost();
+    costWanted += cost;
     //assert(cost >= 0);
     ////////////////SILOG(resource,error,"Cost " << resource->cost() << " for "<<resource->getID()<<" is less than 0.");
 
@@ -201,9 +218,17 @@ void GraphicsResourceManager::computeLoadedSet()
       budgetUsed += cost;
     }
   }
+  mBudgetFit = costWanted > 0 ? budgetUsed / costWanted : 1.0f;
 
-  set<GraphicsResource *>::iterator vitr;
+  // Anything removeLoadDependencies did not reach this epoch falls outside the budget.
+  for (itr = mResources.begin(); itr != mResources.end(); itr++) {
+    if (!(*itr)->keptInEpoch(mEpoch))
+      mToUnload.push_back(*itr);
+  }
+  std::vector<GraphicsResource *>::iterator vitr;
   for (vitr = mToUnload.begin(); vitr != mToUnload.end(); vitr++) {
+    if (*vitr == NULL)
+      continue;
     GraphicsResource::LoadState loadState = (*vitr)->getLoadState();
     if (loadState != GraphicsResource::LOAD_UNLOADED
      && loadState != GraphicsResource::LOAD_UNLOADING
@@ -213,40 +238,30 @@ void GraphicsResourceManager::computeLoadedSet()
   }
   mToUnload.clear();
 
+  // Streamed textures move toward the mip levels their entities and the budget call for.
+  int refines = OPTION_TEXTURE_REFINES_PER_FRAME->as<int>();
+  for (itr = mResources.begin(); itr != mResources.end() && refines > 0; itr++) {
+    if ((*itr)->getType() == GraphicsResource::TEXTURE
+     && static_cast<GraphicsResourceTexture*>(*itr)->updateResidency(mBudgetFit))
+      --refines;
+  }
+
 //  MERU_BENCH("ecomputeLoadedSet");
 }
 
 void GraphicsResourceManager::updateLoadValue(GraphicsResource* resource, float oldValue)
 {
-  ResourcePriorityQueue::iterator itr;
-  itr = mQueue.find(pair<float, GraphicsResource*>(oldValue, resource));
-  if (itr != mQueue.end()) {
-    mQueue.erase(itr);
-    mQueue.insert(pair<float, GraphicsResource*>(resource->value(), resource));
-  }
+  mQueue.update(resource, resource->value());
 }
 
 void GraphicsResourceManager::registerLoad(GraphicsResource* resource, float oldValue)
 {
-  ResourcePriorityQueue::iterator itr;
-  itr = mQueue.find(pair<float, GraphicsResource*>(oldValue, resource));
-  if (itr != mQueue.end()) {
-    mQueue.erase(itr);
-  }
-  mQueue.insert(pair<float, GraphicsResource*>(resource->value(), resource));
+  mQueue.push(resource, resource->value());
 }
 
 void GraphicsResourceManager::unregisterLoad(GraphicsResource* resource)
 {
-  ResourcePriorityQueue::iterator itr;
-  itr = mQueue.find(pair<float, GraphicsResource*>(resource->value(), resource));
-  if (itr != mQueue.end()) {
-    mQueue.erase(itr);
-  }
-
-  set<GraphicsResource*>::iterator uitr = mToUnload.find(resource);
-  if (uitr != mToUnload.end())
-    mToUnload.erase(uitr);
+  mQueue.erase(resource);
 }
 
 void GraphicsResourceManager::unregisterResource(GraphicsResource* resource)
@@ -258,9 +273,10 @@ void GraphicsResourceManager::unregisterResource(GraphicsResource* resource)
   if (eitr != mEntities.end())
     mEntities.erase(eitr);
 
-  std::set<GraphicsResource *>::iterator qitr = mToUnload.find(resource);
+  mQueue.erase(resource);
+  std::vector<GraphicsResource *>::iterator qitr = std::find(mToUnload.begin(), mToUnload.end(), resource);
   if (qitr != mToUnload.end())
-    mToUnload.erase(qitr);
+    *qitr = NULL;
 }
 
 EventResponse GraphicsResourceManager::tick(const EventPtr &evtPtr)
@@ -37,6 +37,7 @@
 #include <oh/ProxyObject.hpp>
 #include "Singleton.hpp"
 #include "Event.hpp"
+#include <util/IndexedHeap.hpp>
 
 namespace Sirikata {
 namespace Task {
@@ -51,16 +52,15 @@ class DependencyManager;
 class GraphicsResourceManager : public ManualSingleton<GraphicsResourceManager>
 {
 protected:
-  struct GraphicsResourcePriorityLessThanFunctor
+  struct LoadQueueIndex
   {
-    bool operator()(const std::pair<float, GraphicsResource*>& key1, const std::pair<float, GraphicsResource*>& key2) const {
-      if (key1.first != key2.first)
-        return key1.first > key2.first;
-      return key1.second < key2.second;
+    size_t &operator()(GraphicsResource* resource) const {
+      return resource->loadQueueIndex();
     }
   };
 
-  typedef std::set<std::pair<float, GraphicsResource *>, GraphicsResourcePriorityLessThanFunctor> ResourcePriorityQueue;
+  ///Highest value first; re-prioritizing a queued resource sifts it in place
+  typedef Sirikata::IndexedHeap<GraphicsResource *, float, LoadQueueIndex> ResourcePriorityQueue;
 
 public:
 
@@ -88,6 +88,11 @@ public:
     mBudget = budget * (1024.0f * 1024.0f);
   }
 
+  ///Fraction of the cost wanted by the last computeLoadedSet that fit in the budget
+  float getBudgetFit() const {
+    return mBudgetFit;
+  }
+
   void updateLoadValue(GraphicsResource* resource, float oldValue);
   void registerLoad(GraphicsResource* resource, float oldValue);
   void unregisterLoad(GraphicsResource* resource);
@@ -102,14 +107,19 @@ protected:
 
   std::map<String, WeakResourcePtr> mIDResourceMap;
   std::set<GraphicsResource *> mResources;
-  std::set<GraphicsResource *> mToUnload;
+  ///Scratch list of resources to unload at the end of computeLoadedSet, kept to reuse its storage
+  std::vector<GraphicsResource *> mToUnload;
   std::set<GraphicsResource *> mEntities;
   //std::set<GraphicsResource *> mMeshes;
   ResourcePriorityQueue mQueue;
 
   unsigned int mEpoch;
   DependencyManager *mDependencyManager;
+  ///Workers preparing resources for the render thread, NULL unless resource-prepare-threads is set
+  Sirikata::Task::WorkQueue *mPrepareQueue;
+  Sirikata::Task::WorkQueueThread *mPrepareThreads;
   float mBudget;
+  float mBudgetFit;
   SubscriptionId mTickListener;
   bool mEnabled;
 };
@@ -60,8 +60,11 @@ public:
   virtual void doRun();
 
 protected:
+  virtual Ogre::ResourcePtr beginPrepare();
+
   const unsigned int mArchiveName;
   Ogre::NameValuePairList* mTextureAliases;
+  bool mArchiveAdded;
 };
 
 class MaterialUnloadTask : public ResourceUnloadTask
@@ -361,13 +364,23 @@ void MaterialDependencyTask::operator()()
 /***************************** MATERIAL LOAD TASK *************************/
 
 MaterialLoadTask::MaterialLoadTask(DependencyManager *mgr, SharedResourcePtr resourcePtr, const String& hash, unsigned int archiveName, Ogre::NameValuePairList* textureAliases, unsigned int epoch)
-: ResourceLoadTask(mgr, resourcePtr, hash, epoch), mArchiveName(archiveName), mTextureAliases(textureAliases)
+: ResourceLoadTask(mgr, resourcePtr, hash, epoch), mArchiveName(archiveName), mTextureAliases(textureAliases), mArchiveAdded(false)
 {
 }
 
-void MaterialLoadTask::doRun()
+Ogre::ResourcePtr MaterialLoadTask::beginPrepare()
 {
+  // The script's archive belongs to the resource and is cleared by the unload task, so nothing to abandon.
   CDNArchive::addArchiveData(mArchiveName, CDNArchive::canonicalMhashName(mHash), mBuffer);
+  mArchiveAdded = true;
+  return MaterialScriptManager::getSingleton().createOrRetrieve(CDNArchive::canonicalMhashName(mHash), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+    false, 0, mTextureAliases).first;
+}
+
+void MaterialLoadTask::doRun()
+{
+  if (!mArchiveAdded)
+    CDNArchive::addArchiveData(mArchiveName, CDNArchive::canonicalMhashName(mHash), mBuffer);
   MaterialScriptManager::getSingleton().load(CDNArchive::canonicalMhashName(mHash), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
     false, 0, mTextureAliases);
 
@@ -39,13 +39,20 @@
 #include "SequentialWorkQueue.hpp"
 #include <boost/bind.hpp>
 #include <OgreResourceBackgroundQueue.h>
+#include <OgreProgressiveMesh.h>
 
 namespace Meru {
 
 OptionValue*OPTION_ENABLE_TEXTURES = new OptionValue("enable-textures","true",OptionValueType<bool>(),"Enable or disable texture rendering");
+OptionValue*OPTION_MESH_LOD_LEVELS = new OptionValue("mesh-lod-levels","0",OptionValueType<int>(),"Number of decimated LOD levels generated for meshes that come without any, 0 to disable");
+OptionValue*OPTION_MESH_LOD_DISTANCE = new OptionValue("mesh-lod-distance","50",OptionValueType<float>(),"Distance at which the first generated LOD level takes over; each further level starts at twice the distance");
+OptionValue*OPTION_MESH_LOD_REDUCTION = new OptionValue("mesh-lod-reduction","0.25",OptionValueType<float>(),"Fraction of the original vertices collapsed at each generated LOD level");
 
 InitializeGlobalOptions graphicsresourcemeshopts("ogregraphics",
     OPTION_ENABLE_TEXTURES,
+    OPTION_MESH_LOD_LEVELS,
+    OPTION_MESH_LOD_DISTANCE,
+    OPTION_MESH_LOD_REDUCTION,
     NULL);
 
 class MeshDependencyTask : public ResourceDependencyTask
@@ -63,6 +70,13 @@ public:
   MeshLoadTask(DependencyManager *mgr, SharedResourcePtr resource, const String &hash, unsigned int epoch);
 
   virtual void doRun();
+
+protected:
+  virtual Ogre::ResourcePtr beginPrepare();
+  virtual void abandonPrepare();
+
+  unsigned int mArchiveName;
+  bool mArchiveAdded;
 };
 
 class MeshUnloadTask : public ResourceUnloadTask
@@ -121,6 +135,27 @@ void GraphicsResourceMesh::setMaterialNames(GraphicsResourceMesh* resourcePtr)
   }
 }
 
+void GraphicsResourceMesh::generateLodLevels(const String &meshName)
+{
+  int levels = OPTION_MESH_LOD_LEVELS->as<int>();
+  if (levels <= 0)
+    return;
+  Ogre::MeshPtr meshPtr = Ogre::MeshManager::getSingleton().getByName(meshName);
+  // Keep whatever LOD the artist authored.
+  if (meshPtr.isNull() || meshPtr->getNumLodLevels() > 1)
+    return;
+
+  Ogre::Mesh::LodDistanceList distances;
+  float distance = OPTION_MESH_LOD_DISTANCE->as<float>();
+  for (int i = 0; i < levels; ++i, distance *= 2)
+    distances.push_back(distance);
+  try {
+    meshPtr->generateLodLevels(distances, Ogre::ProgressiveMesh::VRQ_PROPORTIONAL, OPTION_MESH_LOD_REDUCTION->as<float>());
+  } catch (Ogre::Exception &e) {
+    SILOG(resource,warning,"Could not generate LOD levels for " << meshName << ": " << e.getDescription());
+  }
+}
+
 ResourceDownloadTask* GraphicsResourceMesh::createDownloadTask(DependencyManager *manager, ResourceRequestor *resourceRequestor)
 {
   return new ResourceDownloadTask(manager, mResourceID, resourceRequestor);
@@ -212,16 +247,33 @@ void MeshDependencyTask::operator()()
 /***************************** MESH LOAD TASK *************************/
 
 MeshLoadTask::MeshLoadTask(DependencyManager *mgr, SharedResourcePtr resourcePtr, const String &hash, unsigned int epoch)
-: ResourceLoadTask(mgr, resourcePtr, hash, epoch)
+: ResourceLoadTask(mgr, resourcePtr, hash, epoch), mArchiveName(0), mArchiveAdded(false)
+{
+}
+
+Ogre::ResourcePtr MeshLoadTask::beginPrepare()
+{
+  // prepare() reads the mesh file into memory; loading it into hardware buffers stays in doRun
+  mArchiveName = CDNArchive::addArchive(mHash, mBuffer);
+  mArchiveAdded = true;
+  return Ogre::MeshManager::getSingleton().createOrRetrieve(mHash, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME).first;
+}
+
+void MeshLoadTask::abandonPrepare()
 {
+  CDNArchive::removeArchive(mArchiveName);
+  mArchiveAdded = false;
 }
 
 void MeshLoadTask::doRun()
 {
   String hash = mHash; //CDNArchive::canonicalMhashName(mHash);
-  int archive = CDNArchive::addArchive(hash, mBuffer);
+  if (!mArchiveAdded)
+    mArchiveName = CDNArchive::addArchive(hash, mBuffer);
   Ogre::MeshManager::getSingleton().load(hash, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
-  CDNArchive::removeArchive(archive);
+  CDNArchive::removeArchive(mArchiveName);
+  mArchiveAdded = false;
+  GraphicsResourceMesh::generateLodLevels(hash);
 
   //Ogre::SkeletonPtr skeletonPtr = Ogre::SkeletonManager::getSingleton().getByName(meshPtr->getSkeletonName());
   //if ((!skeletonPtr.isNull()) && (skeletonPtr->isLoaded())) {
@@ -50,6 +50,8 @@ public:
   virtual ResourceUnloadTask * createUnloadTask(DependencyManager *manager);
 
   static void setMaterialNames(GraphicsResourceMesh* resourcePtr);
+  ///Adds decimated LOD levels to a loaded mesh that has none, if mesh-lod-levels asks for them
+  static void generateLodLevels(const String &meshName);
 
 protected:
   std::map<String, String> mMaterialNames;
@@ -52,7 +52,7 @@ class SkeletonLoadTask : public DependencyTask, public Ogre::ResourceBackgroundQ
   String mName;
 public:
   SkeletonLoadTask(DependencyManager *mgr, const String &name)
-   : DependencyTask(mgr->getQueue()), mName(name)
+   : DependencyTask(mgr->getScheduler()), mName(name)
   {
   }
 
@@ -30,18 +30,153 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "CDNArchive.hpp"
+#include "DependencyManager.hpp"
+#include "EventSource.hpp"
 #include "GraphicsResourceManager.hpp"
 #include "GraphicsResourceTexture.hpp"
 #include "ResourceDependencyTask.hpp"
 #include "ResourceLoadTask.hpp"
 #include "ResourceLoadingQueue.hpp"
+#include "ResourceTransfer.hpp"
 #include "ResourceUnloadTask.hpp"
 #include "SequentialWorkQueue.hpp"
+#include "TextureTranscoder.hpp"
 #include <boost/bind.hpp>
 #include <OgreResourceBackgroundQueue.h>
+#include <cmath>
 
 namespace Meru {
 
+extern OptionValue*OPTION_SCREEN_SPACE_PRIORITY;
+
+OptionValue*OPTION_TEXTURE_STREAMING = new OptionValue("texture-streaming","true",OptionValueType<bool>(),"Load DDS textures starting from their small mip levels and refine or drop levels as they are shown larger or smaller");
+OptionValue*OPTION_TEXTURE_FIRST_LEVEL_SIZE = new OptionValue("texture-first-level-size","64",OptionValueType<int>(),"Larger side in texels of the first mip level shown for a streamed texture");
+OptionValue*OPTION_TEXTURE_REFINES_PER_FRAME = new OptionValue("texture-refines-per-frame","4",OptionValueType<int>(),"Most streamed textures to start reloading at a different mip level each frame");
+OptionValue*OPTION_TEXTURE_TRANSCODE = new OptionValue("texture-transcode","true",OptionValueType<bool>(),"Convert PNG, JPEG and BMP textures to DXT with mipmaps the first time they are seen, and load the cached copy after that");
+
+InitializeGlobalOptions graphicsresourcetextureopts("ogregraphics",
+    OPTION_TEXTURE_STREAMING,
+    OPTION_TEXTURE_FIRST_LEVEL_SIZE,
+    OPTION_TEXTURE_REFINES_PER_FRAME,
+    OPTION_TEXTURE_TRANSCODE,
+    NULL);
+
+namespace {
+
+Sirikata::uint32 readLE32(const unsigned char *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((Sirikata::uint32)data[3] << 24);
+}
+
+void writeLE32(unsigned char *data, Sirikata::uint32 value) {
+  data[0] = (unsigned char)value;
+  data[1] = (unsigned char)(value >> 8);
+  data[2] = (unsigned char)(value >> 16);
+  data[3] = (unsigned char)(value >> 24);
+}
+
+// Offsets into a DDS file, counting the "DDS " magic.
+enum {
+  DDS_HEADER_SIZE = 128,
+  DDS_FLAGS = 8, DDS_HEIGHT = 12, DDS_WIDTH = 16, DDS_PITCH_OR_LINEAR_SIZE = 20,
+  DDS_MIPMAP_COUNT = 28, DDS_PF_FLAGS = 80, DDS_PF_FOURCC = 84, DDS_PF_RGB_BIT_COUNT = 88,
+  DDS_CAPS2 = 112
+};
+enum {
+  DDSD_PITCH = 0x8, DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000,
+  DDPF_FOURCC = 0x4, DDSCAPS2_CUBEMAP = 0x200, DDSCAPS2_VOLUME = 0x200000
+};
+
+}
+
+/***************************** TEXTURE MIP LAYOUT *************************/
+
+GraphicsResourceTexture::MipLayout::MipLayout()
+  : mWidth(0), mHeight(0), mLevels(0), mUnitSize(0), mCompressed(false)
+{
+}
+
+bool GraphicsResourceTexture::MipLayout::parse(const unsigned char *data, size_t length)
+{
+  mLevels = 0;
+  if (length < DDS_HEADER_SIZE || memcmp(data, "DDS ", 4) != 0)
+    return false;
+  Sirikata::uint32 flags = readLE32(data + DDS_FLAGS);
+  Sirikata::uint32 pfFlags = readLE32(data + DDS_PF_FLAGS);
+  Sirikata::uint32 mipCount = readLE32(data + DDS_MIPMAP_COUNT);
+  // Cube maps and volumes interleave their levels per face or slice, so the small levels are not at the end.
+  if (!(flags & DDSD_MIPMAPCOUNT) || mipCount <= 1 ||
+      (readLE32(data + DDS_CAPS2) & (DDSCAPS2_CUBEMAP|DDSCAPS2_VOLUME)))
+    return false;
+  mWidth = readLE32(data + DDS_WIDTH);
+  mHeight = readLE32(data + DDS_HEIGHT);
+  if (mWidth == 0 || mHeight == 0)
+    return false;
+  if (pfFlags & DDPF_FOURCC) {
+    Sirikata::uint32 fourCC = readLE32(data + DDS_PF_FOURCC);
+    if (fourCC == readLE32((const unsigned char*)"DXT1"))
+      mUnitSize = 8;
+    else if (fourCC == readLE32((const unsigned char*)"DXT3") || fourCC == readLE32((const unsigned char*)"DXT5"))
+      mUnitSize = 16;
+    else
+      return false; // DX10 headers and float formats are loaded whole.
+    mCompressed = true;
+  } else {
+    Sirikata::uint32 bits = readLE32(data + DDS_PF_RGB_BIT_COUNT);
+    if (bits == 0 || bits % 8)
+      return false;
+    mUnitSize = bits / 8;
+    mCompressed = false;
+  }
+
+  mHeader.assign((const char*)data, DDS_HEADER_SIZE);
+  mOffsets.resize(mipCount + 1);
+  Sirikata::uint64 offset = DDS_HEADER_SIZE;
+  for (unsigned int level = 0; level < mipCount; ++level) {
+    mOffsets[level] = offset;
+    Sirikata::uint64 w = std::max<Sirikata::uint32>(1, mWidth >> level);
+    Sirikata::uint64 h = std::max<Sirikata::uint32>(1, mHeight >> level);
+    if (mCompressed)
+      offset += ((w + 3) / 4) * ((h + 3) / 4) * mUnitSize;
+    else
+      offset += w * h * mUnitSize;
+  }
+  mOffsets[mipCount] = offset;
+  mLevels = mipCount;
+  return true;
+}
+
+unsigned int GraphicsResourceTexture::MipLayout::levelForSize(unsigned int size) const
+{
+  unsigned int level = 0;
+  while (level + 1 < mLevels &&
+         std::max(mWidth >> (level + 1), mHeight >> (level + 1)) >= size)
+    ++level;
+  return level;
+}
+
+DenseDataPtr GraphicsResourceTexture::MipLayout::buildFile(unsigned int first, const DenseData &tail) const
+{
+  Sirikata::uint64 tailLength = levelOffset(mLevels) - levelOffset(first);
+  if (tail.startbyte() > levelOffset(first) || tail.endbyte() < levelOffset(mLevels))
+    return DenseDataPtr();
+  Sirikata::Transfer::MutableDenseDataPtr file(new DenseData(
+    Sirikata::Transfer::Range(0, mHeader.size() + tailLength, Sirikata::Transfer::LENGTH, true)));
+  unsigned char *out = file->writableData();
+  memcpy(out, mHeader.data(), mHeader.size());
+  Sirikata::uint32 width = std::max<Sirikata::uint32>(1, mWidth >> first);
+  Sirikata::uint32 height = std::max<Sirikata::uint32>(1, mHeight >> first);
+  writeLE32(out + DDS_WIDTH, width);
+  writeLE32(out + DDS_HEIGHT, height);
+  writeLE32(out + DDS_MIPMAP_COUNT, mLevels - first);
+  Sirikata::uint32 flags = readLE32(out + DDS_FLAGS);
+  if (flags & DDSD_LINEARSIZE)
+    writeLE32(out + DDS_PITCH_OR_LINEAR_SIZE, (Sirikata::uint32)(levelOffset(first + 1) - levelOffset(first)));
+  else if (flags & DDSD_PITCH)
+    writeLE32(out + DDS_PITCH_OR_LINEAR_SIZE, width * mUnitSize);
+  memcpy(out + mHeader.size(), tail.dataAt(levelOffset(first)), (size_t)tailLength);
+  return file;
+}
+
 class TextureDependencyTask : public ResourceDependencyTask
 {
 public:
@@ -49,17 +184,66 @@ public:
   virtual ~TextureDependencyTask();
 
   virtual void operator()();
+
+  ///The buffer will be the header of the converted copy rather than of the texture itself
+  void setConverted() {
+    mConverted = true;
+  }
+
+protected:
+  class TranscodeInBackground;
+  class FinishTranscode;
+
+  ///Records the layout and cost of what the texture will load
+  void parseHeader(const DenseDataPtr &header);
+  ///Caches a successful conversion and parses it
+  void finishTranscode();
+
+  bool mConverted;
+  DenseDataPtr mSource;
+  DenseDataPtr mConvertedFile;
+  Sirikata::Task::WorkQueue *mPrepareQueue;
+  Sirikata::Task::WorkQueue *mMainQueue;
+};
+
+/**
+ * Fetches just the header first, and the whole file only if it is not a DDS file that can be streamed.
+ * When transcoding, the header of a cached converted copy is tried before any of that.
+ */
+class TextureHeaderDownloadTask : public ResourceDownloadTask
+{
+public:
+  TextureHeaderDownloadTask(DependencyManager *mgr, const RemoteFileId &hash, TextureDependencyTask *dependencyTask);
+
+  virtual void operator()();
+
+protected:
+  void probeSource();
+  EventResponse convertedCompleteHandler(const EventPtr &event);
+  EventResponse headerCompleteHandler(const EventPtr &event);
+
+  TextureDependencyTask *mDependencyTask;
 };
 
 class TextureLoadTask : public ResourceLoadTask
 {
 public:
-  TextureLoadTask(DependencyManager *mgr, SharedResourcePtr resource, const String &hash, unsigned int epoch);
+  TextureLoadTask(DependencyManager *mgr, SharedResourcePtr resource, const String &hash, unsigned int epoch,
+                  const GraphicsResourceTexture::MipLayout &layout, unsigned int firstLevel, bool refine);
 
   virtual void doRun();
 
 protected:
+  virtual Ogre::ResourcePtr beginPrepare();
+  virtual void abandonPrepare();
+  ///The texture file to hand Ogre, rebuilt from the downloaded levels when streaming
+  DenseDataPtr textureFile();
+
   unsigned int mArchiveName;
+  bool mArchiveAdded;
+  GraphicsResourceTexture::MipLayout mLayout;
+  const unsigned int mFirstLevel;
+  const bool mRefine;
 };
 
 class TextureUnloadTask : public ResourceUnloadTask
@@ -74,7 +258,8 @@ protected:
 };
 
 GraphicsResourceTexture::GraphicsResourceTexture(const RemoteFileId &resourceID)
-  : GraphicsResourceAsset(resourceID, GraphicsResource::TEXTURE)
+  : GraphicsResourceAsset(resourceID, GraphicsResource::TEXTURE),
+    mLoadID(resourceID), mResidentLevel(0), mLoadingLevel(0), mRefining(false)
 {
 
 }
@@ -87,7 +272,15 @@ GraphicsResourceTexture::~GraphicsResourceTexture()
 
 ResourceDownloadTask* GraphicsResourceTexture::createDownloadTask(DependencyManager *manager, ResourceRequestor *resourceRequestor)
 {
-  return new ResourceDownloadTask(manager, mResourceID, resourceRequestor);
+  if (resourceRequestor == mParseTask) {
+    if (OPTION_TEXTURE_STREAMING->as<bool>() || OPTION_TEXTURE_TRANSCODE->as<bool>())
+      return new TextureHeaderDownloadTask(manager, mResourceID, static_cast<TextureDependencyTask*>(mParseTask));
+    return new ResourceDownloadTask(manager, mResourceID, resourceRequestor);
+  }
+  if (OPTION_TEXTURE_STREAMING->as<bool>() && mLayout.valid())
+    return new ResourceDownloadTask(manager, mLoadID, resourceRequestor,
+                                    Sirikata::Transfer::Range(mLayout.levelOffset(mLoadingLevel), true));
+  return new ResourceDownloadTask(manager, mLoadID, resourceRequestor);
 }
 
 ResourceDependencyTask* GraphicsResourceTexture::createDependencyTask(DependencyManager *manager)
@@ -97,7 +290,8 @@ ResourceDependencyTask* GraphicsResourceTexture::createDependencyTask(Dependency
 
 ResourceLoadTask* GraphicsResourceTexture::createLoadTask(DependencyManager *manager)
 {
-  return new TextureLoadTask(manager, getSharedPtr(), mResourceID.toString(), mLoadEpoch);
+  return new TextureLoadTask(manager, getSharedPtr(), mResourceID.toString(), mLoadEpoch,
+                             mLayout, mLoadingLevel, mRefining);
 }
 
 ResourceUnloadTask* GraphicsResourceTexture::createUnloadTask(DependencyManager *manager)
@@ -105,10 +299,144 @@ ResourceUnloadTask* GraphicsResourceTexture::createUnloadTask(DependencyManager
   return new TextureUnloadTask(manager, getWeakPtr(), mResourceID.toString(), mLoadEpoch);
 }
 
+void GraphicsResourceTexture::useConverted(const MipLayout &layout)
+{
+  mLayout = layout;
+  mLoadID = TextureTranscoder::convertedFileId(mResourceID);
+}
+
+void GraphicsResourceTexture::doLoad()
+{
+  mRefining = false;
+  if (mLayout.valid() && OPTION_TEXTURE_STREAMING->as<bool>()) {
+    // Show something small quickly; updateResidency refines it once it is up.
+    unsigned int first = mLayout.levelForSize(OPTION_TEXTURE_FIRST_LEVEL_SIZE->as<int>());
+    mLoadingLevel = std::max(first, wantedLevel(GraphicsResourceManager::getSingleton().getBudgetFit()));
+  } else {
+    mLoadingLevel = 0;
+  }
+  GraphicsResourceAsset::doLoad();
+}
+
+void GraphicsResourceTexture::doUnload()
+{
+  mRefining = false;
+  GraphicsResourceAsset::doUnload();
+}
+
+unsigned int GraphicsResourceTexture::wantedLevel(float budgetFit) const
+{
+  unsigned int level = 0;
+  if (OPTION_SCREEN_SPACE_PRIORITY->as<bool>()) {
+    // Benefit is then the pixels the largest entity using this texture covers.
+    float benefit = maxDependentBenefit();
+    if (benefit < std::numeric_limits<float>::max())
+      level = mLayout.levelForSize((unsigned int)std::max(1.0f, sqrtf(benefit)));
+  }
+  if (budgetFit < 1.0f) {
+    // Each level dropped quarters the memory.
+    unsigned int budgetLevel = mLayout.levels();
+    if (budgetFit > 0.0f)
+      budgetLevel = (unsigned int)ceilf(logf(1.0f / budgetFit) / logf(4.0f));
+    level = std::max(level, budgetLevel);
+  }
+  return std::min(level, mLayout.levels() - 1);
+}
+
+bool GraphicsResourceTexture::updateResidency(float budgetFit)
+{
+  if (mLoadState != LOAD_LOADED || mRefining || !mLayout.valid() || !OPTION_TEXTURE_STREAMING->as<bool>())
+    return false;
+  unsigned int wanted = wantedLevel(budgetFit);
+  // Drop levels only once well past needing them, so small camera moves do not reload.
+  if (wanted >= mResidentLevel && wanted <= mResidentLevel + 1)
+    return false;
+  mRefining = true;
+  mLoadingLevel = wanted;
+  GraphicsResourceAsset::doLoad();
+  return true;
+}
+
+void GraphicsResourceTexture::levelsLoaded(unsigned int first, bool refine, bool success, unsigned int epoch)
+{
+  if (success)
+    mResidentLevel = first;
+  if (refine) {
+    mRefining = false;
+    mLoadTask = NULL;
+  } else {
+    loaded(success, epoch);
+  }
+}
+
+/***************************** TEXTURE DOWNLOAD TASK *************************/
+
+TextureHeaderDownloadTask::TextureHeaderDownloadTask(DependencyManager *mgr, const RemoteFileId &hash, TextureDependencyTask *dependencyTask)
+  : ResourceDownloadTask(mgr, hash, dependencyTask), mDependencyTask(dependencyTask)
+{
+}
+
+void TextureHeaderDownloadTask::operator()()
+{
+  mStarted = true;
+  if (OPTION_TEXTURE_TRANSCODE->as<bool>()) {
+    // Only ever answered from the caches, so this costs nothing for textures never converted.
+    mCurrentDownload = Meru::ResourceManager::getSingleton().request(TextureTranscoder::convertedFileId(mHash),
+        std::tr1::bind(&TextureHeaderDownloadTask::convertedCompleteHandler, this, _1),
+        Sirikata::Transfer::Range(0, GraphicsResourceTexture::MipLayout::HEADER_PROBE_SIZE, Sirikata::Transfer::LENGTH));
+  } else {
+    probeSource();
+  }
+}
+
+EventResponse TextureHeaderDownloadTask::convertedCompleteHandler(const EventPtr &event)
+{
+  std::tr1::shared_ptr<DownloadCompleteEvent> transferEvent = DowncastEvent<DownloadCompleteEvent>(event);
+  if (transferEvent->success()) {
+    DenseDataPtr header = transferEvent->data().flatten();
+    GraphicsResourceTexture::MipLayout layout;
+    if (header && header->startbyte() == 0 && layout.parse(header->data(), (size_t)header->length())) {
+      mDependencyTask->setConverted();
+      mResourceRequestor->setResourceBuffer(transferEvent->data());
+      finish(true);
+      return EventResponse::del();
+    }
+  }
+  probeSource();
+  return EventResponse::del();
+}
+
+void TextureHeaderDownloadTask::probeSource()
+{
+  mCurrentDownload = Meru::ResourceManager::getSingleton().request(mHash,
+      std::tr1::bind(&TextureHeaderDownloadTask::headerCompleteHandler, this, _1),
+      Sirikata::Transfer::Range(0, GraphicsResourceTexture::MipLayout::HEADER_PROBE_SIZE, Sirikata::Transfer::LENGTH));
+}
+
+EventResponse TextureHeaderDownloadTask::headerCompleteHandler(const EventPtr &event)
+{
+  std::tr1::shared_ptr<DownloadCompleteEvent> transferEvent = DowncastEvent<DownloadCompleteEvent>(event);
+  if (transferEvent->success()) {
+    DenseDataPtr header = transferEvent->data().flatten();
+    GraphicsResourceTexture::MipLayout layout;
+    if (header && header->startbyte() == 0 &&
+        (header->goesToEndOfFile() ||
+         (OPTION_TEXTURE_STREAMING->as<bool>() && layout.parse(header->data(), (size_t)header->length())))) {
+      mResourceRequestor->setResourceBuffer(transferEvent->data());
+      finish(true);
+      return EventResponse::del();
+    }
+  }
+  // Not something we can stream (or the range request failed); fetch it all as before.
+  ResourceDownloadTask::operator()();
+  return EventResponse::del();
+}
+
 /***************************** TEXTURE DEPENDENCY TASK *************************/
 
 TextureDependencyTask::TextureDependencyTask(DependencyManager *mgr, WeakResourcePtr resource, const String& hash)
-  : ResourceDependencyTask(mgr, resource, hash)
+  : ResourceDependencyTask(mgr, resource, hash), mConverted(false),
+    mPrepareQueue(mgr->getPrepareQueue()), mMainQueue(mgr->getQueue())
 {
 
 }
@@ -118,7 +446,68 @@ TextureDependencyTask::~TextureDependencyTask()
 
 }
 
+class TextureDependencyTask::FinishTranscode : public Sirikata::Task::WorkItem {
+  TextureDependencyTask *mTask;
+public:
+  FinishTranscode(TextureDependencyTask *task) : mTask(task) {
+  }
+  virtual void operator() () {
+    AutoPtr deleteThis(this);
+    mTask->finishTranscode();
+  }
+};
+
+class TextureDependencyTask::TranscodeInBackground : public Sirikata::Task::WorkItem {
+  TextureDependencyTask *mTask;
+public:
+  TranscodeInBackground(TextureDependencyTask *task) : mTask(task) {
+  }
+  virtual void operator() () {
+    AutoPtr deleteThis(this);
+    mTask->mConvertedFile = TextureTranscoder::transcode(*mTask->mSource);
+    mTask->mMainQueue->enqueue(new FinishTranscode(mTask));
+  }
+};
+
 void TextureDependencyTask::operator()()
+{
+  DenseDataPtr file = mBuffer.flatten();
+  if (!mConverted && OPTION_TEXTURE_TRANSCODE->as<bool>() && file &&
+      file->startbyte() == 0 && file->goesToEndOfFile() &&
+      TextureTranscoder::isConvertible(file->data(), (size_t)file->length())) {
+    mSource = file;
+    if (mPrepareQueue) {
+      // Decoding and encoding a large image takes long enough to cost frames.
+      mPrepareQueue->enqueue(new TranscodeInBackground(this));
+      return;
+    }
+    mConvertedFile = TextureTranscoder::transcode(*mSource);
+    finishTranscode();
+    return;
+  }
+  parseHeader(file);
+}
+
+void TextureDependencyTask::finishTranscode()
+{
+  mSource.reset();
+  if (!mConvertedFile) {
+    parseHeader(mBuffer.flatten());
+    return;
+  }
+  SharedResourcePtr resourcePtr = mResource.lock();
+  if (resourcePtr) {
+    SILOG(resource,debug,"Transcoded texture "<<mHash<<" from "<<mBuffer.size()<<" to "<<mConvertedFile->length()<<" bytes");
+    GraphicsResourceTexture *texture = static_cast<GraphicsResourceTexture*>(resourcePtr.get());
+    ResourceManager::getSingleton().addToCache(TextureTranscoder::convertedFileId(texture->getRemoteFileId()).fingerprint(), mConvertedFile);
+  }
+  mConverted = true;
+  DenseDataPtr converted = mConvertedFile;
+  mConvertedFile.reset();
+  parseHeader(converted);
+}
+
+void TextureDependencyTask::parseHeader(const DenseDataPtr &header)
 {
   SharedResourcePtr resourcePtr = mResource.lock();
   if (!resourcePtr) {
@@ -126,7 +515,18 @@ void TextureDependencyTask::operator()()
     return;
   }
 
-  resourcePtr->setCost(mBuffer.size());
+  GraphicsResourceTexture *texture = static_cast<GraphicsResourceTexture*>(resourcePtr.get());
+  GraphicsResourceTexture::MipLayout layout;
+  if (header && header->startbyte() == 0 && layout.parse(header->data(), (size_t)header->length())) {
+    if (mConverted)
+      texture->useConverted(layout);
+    else
+      texture->setMipLayout(layout);
+    // Often only the header came down, so cost comes from the level sizes.
+    resourcePtr->setCost(layout.levelOffset(layout.levels()));
+  } else {
+    resourcePtr->setCost(mBuffer.size());
+  }
   resourcePtr->parsed(true);
 
   finish(true);
@@ -134,17 +534,61 @@ void TextureDependencyTask::operator()()
 
 /***************************** TEXTURE LOAD TASK *************************/
 
-TextureLoadTask::TextureLoadTask(DependencyManager *mgr, SharedResourcePtr resourcePtr, const String &hash, unsigned int epoch)
-: ResourceLoadTask(mgr, resourcePtr, hash, epoch)
+TextureLoadTask::TextureLoadTask(DependencyManager *mgr, SharedResourcePtr resourcePtr, const String &hash, unsigned int epoch,
+                                 const GraphicsResourceTexture::MipLayout &layout, unsigned int firstLevel, bool refine)
+: ResourceLoadTask(mgr, resourcePtr, hash, epoch), mArchiveName(0), mArchiveAdded(false),
+  mLayout(layout), mFirstLevel(firstLevel), mRefine(refine)
 {
 }
 
+DenseDataPtr TextureLoadTask::textureFile()
+{
+  if (mLayout.valid() && mBuffer && !(mBuffer->startbyte() == 0 && mFirstLevel == 0))
+    return mLayout.buildFile(mFirstLevel, *mBuffer);
+  return mBuffer;
+}
+
+Ogre::ResourcePtr TextureLoadTask::beginPrepare()
+{
+  // A refinement replaces a texture that is in use, so it reloads in doRun instead
+  if (mRefine)
+    return Ogre::ResourcePtr();
+  DenseDataPtr file = textureFile();
+  if (!file)
+    return Ogre::ResourcePtr();
+  // prepare() decodes the image; creating the hardware texture stays in doRun
+  mArchiveName = CDNArchive::addArchive(CDNArchive::canonicalMhashName(mHash), file);
+  mArchiveAdded = true;
+  return Ogre::TextureManager::getSingleton().createOrRetrieve(CDNArchive::canonicalMhashName(mHash), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME).first;
+}
+
+void TextureLoadTask::abandonPrepare()
+{
+  CDNArchive::removeArchive(mArchiveName);
+  mArchiveAdded = false;
+}
+
 void TextureLoadTask::doRun()
 {
-  mArchiveName = CDNArchive::addArchive(CDNArchive::canonicalMhashName(mHash), mBuffer);
-  Ogre::TextureManager::getSingleton().load(CDNArchive::canonicalMhashName(mHash), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+  GraphicsResourceTexture *texture = static_cast<GraphicsResourceTexture*>(mResource.get());
+  if (!mArchiveAdded) {
+    DenseDataPtr file = textureFile();
+    if (!file) {
+      SILOG(resource,error,"Texture "<<mHash<<" is shorter than its header says");
+      texture->levelsLoaded(mFirstLevel, mRefine, false, mEpoch);
+      return;
+    }
+    mArchiveName = CDNArchive::addArchive(CDNArchive::canonicalMhashName(mHash), file);
+  }
+  Ogre::TextureManager &textureManager = Ogre::TextureManager::getSingleton();
+  Ogre::ResourcePtr existing = textureManager.getByName(CDNArchive::canonicalMhashName(mHash));
+  if (mRefine && !existing.isNull())
+    existing->reload();
+  else
+    textureManager.load(CDNArchive::canonicalMhashName(mHash), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
   CDNArchive::removeArchive(mArchiveName);
-  mResource->loaded(true, mEpoch);
+  mArchiveAdded = false;
+  texture->levelsLoaded(mFirstLevel, mRefine, true, mEpoch);
 }
 
 /***************************** TEXTURE UNLOAD TASK *************************/
@@ -39,6 +39,45 @@ namespace Meru {
 
 class GraphicsResourceTexture : public GraphicsResourceAsset {
 public:
+  /**
+   * Where each mip level of a DDS file lies. Levels are stored largest first,
+   * so any number of the smallest ones can be fetched with one range request
+   * on the end of the file and loaded behind a rewritten header.
+   */
+  class MipLayout {
+  public:
+    ///Bytes to download to be sure of having the whole header
+    enum {HEADER_PROBE_SIZE=148};
+
+    MipLayout();
+    ///Reads a DDS header; false for other files and for DDS files that cannot be loaded level by level
+    bool parse(const unsigned char *data, size_t length);
+    bool valid() const {
+      return mLevels > 1;
+    }
+    unsigned int levels() const {
+      return mLevels;
+    }
+    ///Offset in the file of the given level; levelOffset(levels()) is the file size
+    Sirikata::uint64 levelOffset(unsigned int level) const {
+      return mOffsets[level];
+    }
+    ///Deepest level whose larger side is still at least size texels
+    unsigned int levelForSize(unsigned int size) const;
+    ///A DDS file of levels first onwards, from file bytes starting at levelOffset(first); NULL if tail is too short
+    DenseDataPtr buildFile(unsigned int first, const DenseData &tail) const;
+
+  private:
+    std::string mHeader;
+    Sirikata::uint32 mWidth;
+    Sirikata::uint32 mHeight;
+    unsigned int mLevels;
+    ///Bytes per 4x4 block for compressed formats, otherwise bytes per texel
+    unsigned int mUnitSize;
+    bool mCompressed;
+    std::vector<Sirikata::uint64> mOffsets;
+  };
+
   GraphicsResourceTexture(const RemoteFileId &resourceID);
   virtual ~GraphicsResourceTexture();
 
@@ -46,6 +85,38 @@ public:
   virtual ResourceDependencyTask * createDependencyTask(DependencyManager *manager);
   virtual ResourceLoadTask * createLoadTask(DependencyManager *manager);
   virtual ResourceUnloadTask * createUnloadTask(DependencyManager *manager);
+
+  void setMipLayout(const MipLayout &layout) {
+    mLayout = layout;
+  }
+  ///Loads from the cached block compressed copy made by TextureTranscoder, laid out as given
+  void useConverted(const MipLayout &layout);
+
+  /**
+   * Called by GraphicsResourceManager for loaded textures after each computeLoadedSet.
+   * Starts reloading with more levels for textures that are now shown larger, or
+   * fewer for ones far away or when the budget is short.
+   * @returns true if a reload was started
+   */
+  bool updateResidency(float budgetFit);
+  ///Called by the load task once Ogre has levels first onwards
+  void levelsLoaded(unsigned int first, bool refine, bool success, unsigned int epoch);
+
+protected:
+  virtual void doLoad();
+  virtual void doUnload();
+
+  ///Top level to keep resident given the entities using this texture and the budget fit
+  unsigned int wantedLevel(float budgetFit) const;
+
+  ///What load downloads: mResourceID, or its converted copy
+  RemoteFileId mLoadID;
+  MipLayout mLayout;
+  ///Top mip level of what Ogre holds, and of the load in flight
+  unsigned int mResidentLevel;
+  unsigned int mLoadingLevel;
+  ///A reload to a different level is in flight while the texture stays loaded
+  bool mRefining;
 };
 
 }
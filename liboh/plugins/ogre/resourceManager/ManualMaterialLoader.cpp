@@ -45,6 +45,7 @@
 #include "transfer/URI.hpp"
 #include "util/Logging.hpp"
 #include "SequentialWorkQueue.hpp"
+#include "ShaderMicrocodeCache.hpp"
 
 template<> Meru::MaterialScriptManager *Ogre::Singleton<Meru::MaterialScriptManager>::ms_Singleton = 0;
 
@@ -220,12 +221,13 @@ public:
             }else {
                 Ogre::ResourcePtr resource=Ogre::HighLevelGpuProgramManager::getSingleton().getByName(mMaterialNames.back());
 
-                if (!resource.isNull()) {
-                    resource->load();
-                }else {
+                if (resource.isNull()) {
                     resource=Ogre::GpuProgramManager::getSingleton().getByName(mMaterialNames.back());
-                    resource->load();
                 }
+                if (ShaderMicrocodeCache::isInstantiated()) {
+                    ShaderMicrocodeCache::getSingleton().prime(static_cast<Ogre::GpuProgram*>(&*resource));
+                }
+                resource->load();
             }
             mMaterialNames.pop_back();
             mTus=NULL;
@@ -34,7 +34,9 @@
 
 #include "CDNArchive.hpp"
 #include <boost/regex.hpp>
+#include <boost/thread/mutex.hpp>
 #include <vector>
+#include <deque>
 
 namespace Meru{
 namespace MangleTextureName {
@@ -368,10 +370,70 @@ Ogre::String ReplacingDataStream::replaceData(Ogre::String input) {
 
   return retval;
 }
+namespace {
+/// A finished rewrite of one script, shared by every later stream over the same bytes, name and aliases
+struct CachedRewrite {
+  Ogre::String data;
+  std::vector<Ogre::String> provides;
+  std::vector<Ogre::String> depends_on;
+};
+enum {MAX_CACHED_REWRITES=256};
+boost::mutex sRewriteCacheMutex;
+std::map<SHA256, CachedRewrite> sRewriteCache;
+///Insertion order of sRewriteCache so the oldest rewrite is dropped first
+std::deque<SHA256> sRewriteCacheOrder;
+}
+
+SHA256 ReplacingDataStream::rewriteKey(const Ogre::String &input) const {
+  Ogre::String key(input);
+  key+='\0';
+  key+=mName;
+  if (mTextureAliases) {
+    for (Ogre::NameValuePairList::const_iterator iter=mTextureAliases->begin(),iterend=mTextureAliases->end();iter!=iterend;++iter) {
+      key+='\0';
+      key+=iter->first;
+      key+='=';
+      key+=iter->second;
+    }
+  }
+  return SHA256::computeDigest(key);
+}
+
 void ReplacingDataStream::verifyData() const{
   if (helper.isNull()) {
     ReplacingDataStream*thus=const_cast<ReplacingDataStream*>(this);//initialize cache in a way that violates constness
-    thus->dataAsString=thus->replaceData(thus->file->getAsString());
+    Ogre::String input=thus->file->getAsString();
+    if (cacheRewrites()) {
+      SHA256 key=rewriteKey(input);
+      bool found=false;
+      {
+        boost::mutex::scoped_lock lok(sRewriteCacheMutex);
+        std::map<SHA256, CachedRewrite>::const_iterator where=sRewriteCache.find(key);
+        if (where!=sRewriteCache.end()) {
+          thus->dataAsString=where->second.data;
+          thus->provides=where->second.provides;
+          thus->depends_on=where->second.depends_on;
+          found=true;
+        }
+      }
+      if (!found) {
+        thus->dataAsString=thus->replaceData(input);
+        boost::mutex::scoped_lock lok(sRewriteCacheMutex);
+        if (sRewriteCache.find(key)==sRewriteCache.end()) {
+          CachedRewrite &cached=sRewriteCache[key];
+          cached.data=dataAsString;
+          cached.provides=provides;
+          cached.depends_on=depends_on;
+          sRewriteCacheOrder.push_back(key);
+          if (sRewriteCacheOrder.size()>MAX_CACHED_REWRITES) {
+            sRewriteCache.erase(sRewriteCacheOrder.front());
+            sRewriteCacheOrder.pop_front();
+          }
+        }
+      }
+    }else {
+      thus->dataAsString=thus->replaceData(input);
+    }
     thus->mSize=dataAsString.length();
 /*
     char filename[1024];
@@ -33,6 +33,7 @@
 #define _REPLACING_DATA_STREAM_HPP_
 
 #include <OgreDataStream.h>
+#include <util/Sha256.hpp>
 #ifndef STANDALONE
 #include <OgreCommon.h>
 #endif
@@ -59,6 +60,15 @@ protected:
   const Ogre::NameValuePairList*mTextureAliases;  
   ///loads in and replaces the data
   void verifyData()const;
+  ///Identifies a rewrite by the script's bytes, the name it will be loaded as and the texture aliases applied to it
+  Sirikata::SHA256 rewriteKey(const Ogre::String &input) const;
+  /**
+   * Whether finished rewrites may be shared through a process-wide cache instead of rerunning replaceData.
+   * Subclasses that record something in their callbacks should return false so that the callbacks keep running.
+   */
+  virtual bool cacheRewrites() const {
+    return true;
+  }
     /**
      * This function gets a callback from the ReplacingDataStream whenever a script file name is encountered
      * it is defined as a noop but is used in replace_material tools
@@ -35,7 +35,7 @@
 namespace Meru {
 
 ResourceDependencyTask::ResourceDependencyTask(DependencyManager* mgr, WeakResourcePtr resource, const String& hash)
-: DependencyTask(mgr->getQueue()),
+: DependencyTask(mgr->getScheduler()),
   mResource(resource),
   mHash(hash)
 {
@@ -40,8 +40,9 @@ namespace Meru {
 ResourceRequestor::~ResourceRequestor() {
 }
 
-ResourceDownloadTask::ResourceDownloadTask(DependencyManager *mgr, const RemoteFileId &hash, ResourceRequestor* resourceRequestor)
-: DependencyTask(mgr->getQueue()), mHash(hash), mResourceRequestor(resourceRequestor)
+ResourceDownloadTask::ResourceDownloadTask(DependencyManager *mgr, const RemoteFileId &hash, ResourceRequestor* resourceRequestor,
+                                           const Sirikata::Transfer::Range &range)
+: DependencyTask(mgr->getScheduler()), mHash(hash), mRange(range), mResourceRequestor(resourceRequestor)
 {
   mStarted = false;
 }
@@ -71,7 +72,7 @@ void ResourceDownloadTask::operator()()
   mStarted = true;
   // FIXME: Daniel: the defaultProgressiveDownloadFunctor will not properly deal with textures
   mCurrentDownload = Meru::ResourceManager::getSingleton().request(mHash,
-      std::tr1::bind(&ResourceDownloadTask::downloadCompleteHandler, this, _1));
+      std::tr1::bind(&ResourceDownloadTask::downloadCompleteHandler, this, _1), mRange);
 }
 
 }
@@ -53,7 +53,8 @@ class ResourceDownloadTask : public DependencyTask
 {
 public:
 
-  ResourceDownloadTask(DependencyManager* mgr, const RemoteFileId& hash, ResourceRequestor* resourceRequestor);
+  ResourceDownloadTask(DependencyManager* mgr, const RemoteFileId& hash, ResourceRequestor* resourceRequestor,
+                       const Sirikata::Transfer::Range &range=Sirikata::Transfer::Range(true));
   virtual ~ResourceDownloadTask();
 
   virtual void operator()();
@@ -69,6 +70,8 @@ protected:
   bool mStarted;
 
   const RemoteFileId mHash;
+  ///Part of the file to fetch, the whole file unless a resource streams it in pieces
+  Sirikata::Transfer::Range mRange;
   SubscriptionId mCurrentDownload;
   ResourceRequestor* mResourceRequestor;
 };
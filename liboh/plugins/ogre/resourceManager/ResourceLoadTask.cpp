@@ -32,16 +32,19 @@
 #include "ResourceLoadTask.hpp"
 #include "CDNArchive.hpp"
 #include "DependencyManager.hpp"
+#include <OgreException.h>
 
 namespace Meru {
 
 ResourceLoadTask::ResourceLoadTask(DependencyManager *mgr, SharedResourcePtr resource, const String& hash, unsigned int epoch)
-: DependencyTask(mgr->getQueue()),
+: DependencyTask(mgr->getScheduler()),
   mResource(resource),
   mHash(CDNArchive::canonicalMhashName(hash)),
   mEpoch(epoch),
   mCancelled(false),
-  mStarted(false)
+  mStarted(false),
+  mPrepareQueue(mgr->getPrepareQueue()),
+  mMainQueue(mgr->getQueue())
 {
 }
 
@@ -50,6 +53,45 @@ ResourceLoadTask::~ResourceLoadTask()
 
 }
 
+class ResourceLoadTask::FinishPrepared : public Sirikata::Task::WorkItem {
+  ResourceLoadTask *mTask;
+public:
+  FinishPrepared(ResourceLoadTask *task) : mTask(task) {
+  }
+  virtual void operator() () {
+    AutoPtr deleteThis(this);
+    if (mTask->mCancelled)
+      mTask->abandonPrepare();
+    else
+      mTask->doRun();
+    mTask->mPrepared.setNull();
+    mTask->finish(true);
+  }
+};
+
+class ResourceLoadTask::PrepareInBackground : public Sirikata::Task::WorkItem {
+  ResourceLoadTask *mTask;
+  Ogre::Resource *mResource;
+public:
+  PrepareInBackground(ResourceLoadTask *task, Ogre::Resource *resource) : mTask(task), mResource(resource) {
+  }
+  virtual void operator() () {
+    AutoPtr deleteThis(this);
+    try {
+      mResource->prepare();
+    } catch (Ogre::Exception &e) {
+      // doRun's load() will prepare it again on the main thread and report the failure there.
+      SILOG(resource,warning,"Failed to prepare "<<mResource->getName()<<" in background: "<<e.getDescription());
+    }
+    mTask->mMainQueue->enqueue(new FinishPrepared(mTask));
+  }
+};
+
+void ResourceLoadTask::prepareInBackground()
+{
+  mPrepareQueue->enqueue(new PrepareInBackground(this, mPrepared.get()));
+}
+
 
 
 }
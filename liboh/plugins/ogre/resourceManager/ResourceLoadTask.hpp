@@ -35,6 +35,7 @@
 #include "DependencyTask.hpp"
 #include "GraphicsResource.hpp"
 #include "ResourceDownloadTask.hpp"
+#include <OgreResource.h>
 
 namespace Meru {
 
@@ -47,6 +48,13 @@ public:
   virtual void operator() ()
   {
     mStarted = true;
+    if (!mCancelled && mPrepareQueue) {
+      mPrepared = beginPrepare();
+      if (!mPrepared.isNull()) {
+        prepareInBackground();
+        return;
+      }
+    }
     if (!mCancelled)
       doRun();
     finish(true);
@@ -68,12 +76,34 @@ public:
 protected:
   virtual void doRun() = 0;
 
+  /** Called on the main thread when a prepare queue is available. Returns the
+   *  Ogre resource whose prepare() (file reads, decoding, script parsing) may
+   *  run on a worker before doRun uploads it, or a null pointer to load it all
+   *  in doRun.
+   */
+  virtual Ogre::ResourcePtr beginPrepare() {
+    return Ogre::ResourcePtr();
+  }
+  /// Undoes beginPrepare when the task was cancelled while its resource was being prepared
+  virtual void abandonPrepare() {}
+
+  class PrepareInBackground;
+  class FinishPrepared;
+  friend class PrepareInBackground;
+  friend class FinishPrepared;
+  void prepareInBackground();
+
   SharedResourcePtr mResource;
   String mHash;
   DenseDataPtr mBuffer;
   const unsigned int mEpoch;
   bool mCancelled;
   bool mStarted;
+  ///Worker queue for beginPrepare resources, NULL to do all loading on the main thread
+  Sirikata::Task::WorkQueue *mPrepareQueue;
+  Sirikata::Task::WorkQueue *mMainQueue;
+  ///Only touched on the main thread, Ogre's shared pointers are not thread safe in our builds
+  Ogre::ResourcePtr mPrepared;
 };
 
 
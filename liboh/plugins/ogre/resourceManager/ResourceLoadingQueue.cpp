@@ -37,6 +37,7 @@
 #include "EventSource.hpp"
 #include "ResourceTransfer.hpp"
 #include "ResourceManager.hpp"
+#include "util/TraceEvents.hpp"
 #include "Proxy.hpp"
 #include "util/UUID.hpp"
 
@@ -45,7 +46,13 @@
 template<> Meru::ResourceLoadingQueue* Ogre::Singleton<Meru::ResourceLoadingQueue>::ms_Singleton=NULL;
 namespace Meru {
 
-ResourceLoadingQueue::ResourceLoadingQueue() :mNextTicketID(0),mHowLongAgoHadNothing(0),mProcessPerFrame(1){
+OptionValue*OPTION_RESOURCE_LOAD_BUDGET = new OptionValue("resource-load-budget","0",OptionValueType<float>(),"Milliseconds per frame spent loading queued resources, 0 to ramp up a count of loads per frame instead");
+
+InitializeGlobalOptions resourceloadingqueueopts("ogregraphics",
+    OPTION_RESOURCE_LOAD_BUDGET,
+    NULL);
+
+ResourceLoadingQueue::ResourceLoadingQueue() :mNextTicketID(0),mHowLongAgoHadNothing(0),mProcessPerFrame(1),mAverageRequestTime(Duration::seconds(0.)){
     EventSource::getSingleton().addListener(EventTypes::Tick,EVENT_CALLBACK(ResourceLoadingQueue, operator(), this));
 }
 
@@ -94,6 +101,7 @@ Ogre::BackgroundProcessTicket ResourceLoadingQueue::unload (const Ogre::String&r
 }
 
 void ResourceLoadingQueue::processBackgroundEvent() {
+    SIRIKATA_TRACE_SCOPE("ResourceLoadingQueue::processBackgroundEvent");
     Request req=mRequests.front();
     mRequests.pop();
     Ogre::ResourceManager *rm=NULL;
@@ -119,7 +127,26 @@ void ResourceLoadingQueue::processBackgroundEvent() {
     }
 }
 
+void ResourceLoadingQueue::processBudgeted(const Duration&budget) {
+    Time start = Time::now();
+    Time last = start;
+    // Always make progress, then keep going while the next load is expected to fit.
+    do {
+        this->processBackgroundEvent();
+        Time now = Time::now();
+        mAverageRequestTime = (mAverageRequestTime*7.0 + (now - last))/8.0;
+        last = now;
+    } while (mRequests.size() && (last - start) + mAverageRequestTime < budget);
+}
+
 void ResourceLoadingQueue::processBackgroundEvents(const Meru::EventPtr&) {
+    float budget = OPTION_RESOURCE_LOAD_BUDGET->as<float>();
+    if (budget > 0) {
+        if (mRequests.size()) {
+            processBudgeted(Duration::seconds(budget/1000.0));
+        }
+        return;
+    }
     if (mRequests.size()) {
         mHowLongAgoHadNothing++;
         if (mHowLongAgoHadNothing>mProcessPerFrame*mHowLongAgoHadNothing) {
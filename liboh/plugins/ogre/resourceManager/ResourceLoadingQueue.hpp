@@ -63,6 +63,9 @@ typedef Ogre::ResourceBackgroundQueue ResourceLoadingQueue;
     Ogre::BackgroundProcessTicket mNextTicketID;
     unsigned int mHowLongAgoHadNothing;
     unsigned int mProcessPerFrame;
+    ///Running average of how long one request takes, used to stop before a load would overrun the budget
+    Duration mAverageRequestTime;
+    void processBudgeted(const Duration&budget);
   public:
     Ogre::BackgroundProcessTicket load (const Ogre::String&resType, const Ogre::String&name, const Ogre::String&group,
                bool isManual,
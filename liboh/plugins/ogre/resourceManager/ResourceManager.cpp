@@ -120,8 +120,12 @@ void ResourceManager::handleExternalDownloadComplete(const EventPtr&transferEven
 }
 */
 
-Sirikata::Task::SubscriptionId ResourceManager::request (const RemoteFileId &request, const std::tr1::function<EventResponse(const EventPtr&)>&downloadFunctor){
-    return mTransferManager->downloadByHash(request,downloadFunctor,Transfer::Range(true));
+Sirikata::Task::SubscriptionId ResourceManager::request (const RemoteFileId &request, const std::tr1::function<EventResponse(const EventPtr&)>&downloadFunctor, const Transfer::Range &range){
+    return mTransferManager->downloadByHash(request,downloadFunctor,range);
+}
+
+void ResourceManager::addToCache (const Transfer::Fingerprint &fprint, const DenseDataPtr &data){
+    mTransferManager->addToCache(fprint,data);
 }
 
 void ResourceManager::nameLookup(const URI &resource_id, std::tr1::function<void(const URI&,const ResourceHash*)>callback) {
@@ -108,8 +108,18 @@ public:
      *  locally this does nothing.
      *
      *  \param rid the ResourceID of the resource to be downloaded
+     *  \param range the part of the file wanted, the whole file by default
      */
-    SubscriptionId request (const RemoteFileId &rid, const std::tr1::function<EventResponse(const EventPtr&)>&);
+    SubscriptionId request (const RemoteFileId &rid, const std::tr1::function<EventResponse(const EventPtr&)>&,
+                            const Sirikata::Transfer::Range &range=Sirikata::Transfer::Range(true));
+
+    /** Caches a file made locally from downloaded ones so that later runs
+     *  can request it instead of making it again.
+     *
+     *  \param fprint the hash the file is requested by later
+     *  \param data the whole file
+     */
+    void addToCache (const ::Sirikata::Transfer::Fingerprint &fprint, const DenseDataPtr &data);
 
 
     /** Create a new resource from in-memory data.
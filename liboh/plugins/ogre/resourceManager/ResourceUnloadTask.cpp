@@ -36,7 +36,7 @@
 namespace Meru {
 
 ResourceUnloadTask::ResourceUnloadTask(DependencyManager *mgr, WeakResourcePtr resource, const String& hash, unsigned int epoch)
-: DependencyTask(mgr->getQueue()),
+: DependencyTask(mgr->getScheduler()),
  mResource(resource),
  mHash(CDNArchive::canonicalMhashName(hash)),
  mEpoch(epoch),
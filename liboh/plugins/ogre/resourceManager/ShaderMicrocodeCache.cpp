@@ -0,0 +1,252 @@
+/*  Meru
+ *  ShaderMicrocodeCache.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ShaderMicrocodeCache.hpp"
+#include <OgreGpuProgramManager.h>
+#include <OgreHighLevelGpuProgramManager.h>
+#include <OgreRenderSystem.h>
+#include <OgreRenderSystemCapabilities.h>
+#include <OgreResourceGroupManager.h>
+#include <OgreRoot.h>
+#include <OgreStringConverter.h>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir _mkdir
+#endif
+
+MANUAL_SINGLETON_STORAGE(Meru::ShaderMicrocodeCache);
+
+namespace Meru {
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'S','I','R','I','S','H','D','1'};
+
+void writeString(std::ostream &out, const std::string &value) {
+  unsigned char length[4];
+  for (int i = 0; i < 4; ++i)
+    length[i] = (unsigned char)(value.size() >> (i * 8));
+  out.write((const char*)length, 4);
+  out.write(value.data(), value.size());
+}
+
+bool readString(std::istream &in, std::string &value) {
+  unsigned char length[4];
+  if (!in.read((char*)length, 4))
+    return false;
+  Sirikata::uint32 size = length[0] | (length[1] << 8) | (length[2] << 16) | ((Sirikata::uint32)length[3] << 24);
+  // Nothing legitimate comes close; a larger size means the file is corrupt.
+  if (size > 64 * 1024 * 1024)
+    return false;
+  value.resize(size);
+  return size == 0 || in.read(&value[0], size);
+}
+
+}
+
+ShaderMicrocodeCache::ShaderMicrocodeCache(const String &directory)
+  : mDirectory(directory), mOpened(false), mDirty(false), mPrimed(0)
+{
+}
+
+ShaderMicrocodeCache::~ShaderMicrocodeCache()
+{
+  save();
+}
+
+bool ShaderMicrocodeCache::open()
+{
+  if (mOpened)
+    return !mPath.empty();
+#if OGRE_VERSION >= 0x010700
+  if (mDirectory.empty()) {
+    mOpened = true;
+    return false;
+  }
+  Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+  const Ogre::RenderSystemCapabilities *caps = renderSystem ? renderSystem->getCapabilities() : NULL;
+  if (!caps)
+    return false; // The driver is not known until a window exists; try again next time.
+  mOpened = true;
+  mDriver = renderSystem->getName() + "|" + caps->getDeviceName() + "|" +
+    caps->getDriverVersion().toString() + "|" + Ogre::StringConverter::toString(OGRE_VERSION);
+  mPath = mDirectory + "/shaders-" + SHA256::computeDigest(mDriver).convertToHexString().substr(0, 16) + ".bin";
+  Ogre::GpuProgramManager::getSingleton().setSaveMicrocodesToCache(true);
+
+  std::ifstream in(mPath.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(CACHE_MAGIC)];
+  if (!in || !in.read(magic, sizeof(magic)) || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0)
+    return true;
+  std::string name, digest;
+  Entry entry;
+  while (readString(in, name) && readString(in, digest) && readString(in, entry.key) &&
+         readString(in, entry.microcode)) {
+    if (digest.size() != SHA256::static_size)
+      break;
+    entry.digest = SHA256::convertFromBinary(digest.data());
+    mEntries[name] = entry;
+  }
+  SILOG(ogre,info,"Read "<<mEntries.size()<<" compiled shaders from "<<mPath);
+  return true;
+#else
+  mOpened = true;
+  if (!mDirectory.empty())
+    SILOG(ogre,debug,"Compiled shaders are not cached: Ogre 1.7 or later is needed");
+  return false;
+#endif
+}
+
+SHA256 ShaderMicrocodeCache::programDigest(Ogre::GpuProgram *program, const String &source) const
+{
+  std::string key = mDriver;
+  key += '\0';
+  key += Ogre::StringConverter::toString((int)program->getType());
+  key += '\0';
+  key += program->getLanguage();
+  key += '\0';
+  key += program->getSyntaxCode();
+  // Profiles, entry points, targets and defines are all parameters.
+  const Ogre::ParameterList &params = program->getParameters();
+  for (Ogre::ParameterList::const_iterator i = params.begin(); i != params.end(); ++i) {
+    key += '\0';
+    key += i->name;
+    key += '=';
+    key += program->getParameter(i->name);
+  }
+  key += '\0';
+  key += source;
+  return SHA256::computeDigest(key);
+}
+
+void ShaderMicrocodeCache::prime(Ogre::GpuProgram *program)
+{
+#if OGRE_VERSION >= 0x010700
+  if (!program || program->isLoaded() || !open())
+    return;
+  std::map<String, Entry>::const_iterator found = mEntries.find(program->getName());
+  if (found == mEntries.end())
+    return;
+  Ogre::GpuProgramManager &manager = Ogre::GpuProgramManager::getSingleton();
+  if (manager.isMicrocodeAvailableInCache(found->second.key))
+    return;
+  String source = program->getSource();
+  if (source.empty() && !program->getSourceFile().empty()) {
+    try {
+      source = Ogre::ResourceGroupManager::getSingleton().openResource(
+        program->getSourceFile(), program->getGroup(), true, program)->getAsString();
+    } catch (Ogre::Exception &) {
+      return; // load() will report it.
+    }
+  }
+  if (programDigest(program, source) != found->second.digest) {
+    SILOG(ogre,debug,"Shader "<<program->getName()<<" changed since it was cached; compiling it again");
+    return;
+  }
+  const std::string &code = found->second.microcode;
+  Ogre::GpuProgramManager::Microcode microcode = manager.createMicrocode((Sirikata::uint32)code.size());
+  if (!code.empty())
+    memcpy(microcode->getPtr(), code.data(), code.size());
+  manager.addMicrocodeToCache(found->second.key, microcode);
+  ++mPrimed;
+#endif
+}
+
+void ShaderMicrocodeCache::save()
+{
+#if OGRE_VERSION >= 0x010700
+  if (!open())
+    return;
+  Ogre::GpuProgramManager &manager = Ogre::GpuProgramManager::getSingleton();
+  Ogre::ResourceManager *managers[2] = {&manager, Ogre::HighLevelGpuProgramManager::getSingletonPtr()};
+  for (int m = 0; m < 2; ++m) {
+    if (!managers[m])
+      continue;
+    Ogre::ResourceManager::ResourceMapIterator iter = managers[m]->getResourceIterator();
+    while (iter.hasMoreElements()) {
+      Ogre::GpuProgram *program = static_cast<Ogre::GpuProgram*>(iter.getNext().get());
+      if (!program->isLoaded() || program->getSource().empty())
+        continue;
+      // Render systems differ in what they file microcode under.
+      String candidates[2] = {program->getName(), program->getSyntaxCode() + program->getName()};
+      for (int c = 0; c < 2; ++c) {
+        if (!manager.isMicrocodeAvailableInCache(candidates[c]))
+          continue;
+        SHA256 digest = programDigest(program, program->getSource());
+        Entry &entry = mEntries[program->getName()];
+        if (entry.digest != digest || entry.key != candidates[c]) {
+          const Ogre::GpuProgramManager::Microcode &microcode = manager.getMicrocodeFromCache(candidates[c]);
+          entry.digest = digest;
+          entry.key = candidates[c];
+          entry.microcode.assign((const char*)microcode->getPtr(), microcode->size());
+          mDirty = true;
+        }
+        break;
+      }
+    }
+  }
+  if (!mDirty)
+    return;
+
+  mkdir(mDirectory.c_str()
+#ifndef _WIN32
+        ,0755
+#endif
+        );
+  String tempPath = mPath + ".tmp";
+  {
+    std::ofstream out(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    for (std::map<String, Entry>::const_iterator i = mEntries.begin(); i != mEntries.end(); ++i) {
+      writeString(out, i->first);
+      writeString(out, std::string((const char*)i->second.digest.rawData().data(), SHA256::static_size));
+      writeString(out, i->second.key);
+      writeString(out, i->second.microcode);
+    }
+    if (!out) {
+      SILOG(ogre,warning,"Unable to write compiled shaders to "<<tempPath);
+      return;
+    }
+  }
+  // Written aside and moved in, so a crash mid-write leaves the old cache.
+  remove(mPath.c_str());
+  if (rename(tempPath.c_str(), mPath.c_str()) != 0) {
+    SILOG(ogre,warning,"Unable to replace "<<mPath);
+    return;
+  }
+  mDirty = false;
+  SILOG(ogre,info,"Saved "<<mEntries.size()<<" compiled shaders to "<<mPath<<" ("<<mPrimed<<" reused this run)");
+#endif
+}
+
+}
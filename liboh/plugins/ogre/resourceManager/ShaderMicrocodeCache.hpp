@@ -0,0 +1,90 @@
+/*  Meru
+ *  ShaderMicrocodeCache.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SHADER_MICROCODE_CACHE_HPP
+#define _SHADER_MICROCODE_CACHE_HPP
+
+#include "MeruDefs.hpp"
+#include "Singleton.hpp"
+#include <map>
+
+namespace Ogre {
+class GpuProgram;
+}
+
+namespace Meru {
+
+/**
+ * Keeps the microcode Ogre compiles shaders to between runs, one file per
+ * render system, device and driver version. Entries are also keyed by each
+ * program's source and parameters (profiles, entry point, defines), and are
+ * only given back to Ogre just before that program loads with the same ones,
+ * so an edited shader that keeps its name is compiled afresh.
+ *
+ * Needs Ogre 1.7 or later; with older versions every program compiles each run.
+ */
+class ShaderMicrocodeCache : public ManualSingleton<ShaderMicrocodeCache> {
+public:
+  ///directory may be empty to turn the cache off
+  ShaderMicrocodeCache(const String &directory);
+  ///Saves what was compiled this run
+  ~ShaderMicrocodeCache();
+
+  ///Call before loading program so it can skip compilation if an earlier run compiled it
+  void prime(Ogre::GpuProgram *program);
+  ///Records the microcode of every loaded program and writes the cache file if anything changed
+  void save();
+
+private:
+  struct Entry {
+    SHA256 digest;
+    ///Name Ogre filed the microcode under
+    String key;
+    std::string microcode;
+  };
+
+  ///Reads the cache file for this driver the first time it is needed; false if there is no cache
+  bool open();
+  SHA256 programDigest(Ogre::GpuProgram *program, const String &source) const;
+
+  String mDirectory;
+  String mPath;
+  String mDriver;
+  bool mOpened;
+  bool mDirty;
+  unsigned int mPrimed;
+  ///By program name
+  std::map<String, Entry> mEntries;
+};
+
+}
+
+#endif
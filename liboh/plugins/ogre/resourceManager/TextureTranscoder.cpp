@@ -0,0 +1,275 @@
+/*  Meru
+ *  TextureTranscoder.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "TextureTranscoder.hpp"
+#include <transfer/NetworkCacheLayer.hpp>
+#include <OgreImage.h>
+#include <OgreDataStream.h>
+#include <OgrePixelFormat.h>
+#include <algorithm>
+
+namespace Meru {
+
+namespace {
+
+// Bumped whenever the encoder changes, so old converted files are not reused.
+const char *CONVERTED_SUFFIX = ":dxt-v1";
+
+void writeLE16(unsigned char *data, Sirikata::uint32 value) {
+  data[0] = (unsigned char)value;
+  data[1] = (unsigned char)(value >> 8);
+}
+
+void writeLE32(unsigned char *data, Sirikata::uint32 value) {
+  writeLE16(data, value);
+  writeLE16(data + 2, value >> 16);
+}
+
+unsigned int blockCount(Sirikata::uint32 size) {
+  return (size + 3) / 4;
+}
+
+/// Next mip level down, averaging each 2x2 square; odd edges reuse their last row or column.
+std::vector<unsigned char> halve(const std::vector<unsigned char> &src, Sirikata::uint32 width, Sirikata::uint32 height) {
+  Sirikata::uint32 outWidth = std::max<Sirikata::uint32>(1, width / 2);
+  Sirikata::uint32 outHeight = std::max<Sirikata::uint32>(1, height / 2);
+  std::vector<unsigned char> out(outWidth * outHeight * 4);
+  for (Sirikata::uint32 y = 0; y < outHeight; ++y) {
+    Sirikata::uint32 y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+    for (Sirikata::uint32 x = 0; x < outWidth; ++x) {
+      Sirikata::uint32 x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+      for (int c = 0; c < 4; ++c) {
+        unsigned int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+                           src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+        out[(y * outWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+      }
+    }
+  }
+  return out;
+}
+
+Sirikata::uint32 to565(const int *rgb) {
+  return ((rgb[0] * 31 + 127) / 255 << 11) | ((rgb[1] * 63 + 127) / 255 << 5) | ((rgb[2] * 31 + 127) / 255);
+}
+
+void from565(Sirikata::uint32 color, int *rgb) {
+  int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+/// BC1 colour block of 16 RGBA texels: endpoints from the inset bounding box, four colour mode.
+void encodeColorBlock(const unsigned char *texels, unsigned char *out) {
+  int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < 3; ++c) {
+      lo[c] = std::min<int>(lo[c], texels[i * 4 + c]);
+      hi[c] = std::max<int>(hi[c], texels[i * 4 + c]);
+    }
+  for (int c = 0; c < 3; ++c) {
+    int inset = (hi[c] - lo[c]) / 16;
+    lo[c] += inset;
+    hi[c] -= inset;
+  }
+  Sirikata::uint32 c0 = to565(hi), c1 = to565(lo);
+  if (c0 < c1)
+    std::swap(c0, c1);
+  Sirikata::uint32 indices = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    from565(c0, palette[0]);
+    from565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; ++i) {
+      int best = 0, bestDistance = 0x7fffffff;
+      for (int p = 0; p < 4; ++p) {
+        int distance = 0;
+        for (int c = 0; c < 3; ++c) {
+          int d = texels[i * 4 + c] - palette[p][c];
+          distance += d * d;
+        }
+        if (distance < bestDistance) {
+          bestDistance = distance;
+          best = p;
+        }
+      }
+      indices |= (Sirikata::uint32)best << (i * 2);
+    }
+  }
+  writeLE16(out, c0);
+  writeLE16(out + 2, c1);
+  writeLE32(out + 4, indices);
+}
+
+/// BC3 alpha block: the alpha range split into eight steps.
+void encodeAlphaBlock(const unsigned char *texels, unsigned char *out) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; ++i) {
+    lo = std::min<int>(lo, texels[i * 4 + 3]);
+    hi = std::max<int>(hi, texels[i * 4 + 3]);
+  }
+  Sirikata::uint64 indices = 0;
+  if (hi != lo) {
+    int palette[8];
+    palette[0] = hi;
+    palette[1] = lo;
+    for (int p = 2; p < 8; ++p)
+      palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7;
+    for (int i = 0; i < 16; ++i) {
+      int best = 0, bestDistance = 256;
+      for (int p = 0; p < 8; ++p) {
+        int distance = abs(texels[i * 4 + 3] - palette[p]);
+        if (distance < bestDistance) {
+          bestDistance = distance;
+          best = p;
+        }
+      }
+      indices |= (Sirikata::uint64)best << (i * 3);
+    }
+  }
+  out[0] = (unsigned char)hi;
+  out[1] = (unsigned char)lo;
+  for (int b = 0; b < 6; ++b)
+    out[2 + b] = (unsigned char)(indices >> (b * 8));
+}
+
+}
+
+DenseDataPtr TextureTranscoder::encode(const unsigned char *rgba, Sirikata::uint32 width, Sirikata::uint32 height, bool alpha)
+{
+  const unsigned int blockSize = alpha ? 16 : 8;
+  unsigned int levels = 1;
+  size_t fileSize = 128;
+  for (Sirikata::uint32 w = width, h = height; ; w = std::max<Sirikata::uint32>(1, w / 2), h = std::max<Sirikata::uint32>(1, h / 2), ++levels) {
+    fileSize += blockCount(w) * blockCount(h) * blockSize;
+    if (w == 1 && h == 1)
+      break;
+  }
+
+  Sirikata::Transfer::MutableDenseDataPtr file(new DenseData(
+    Sirikata::Transfer::Range(0, fileSize, Sirikata::Transfer::LENGTH, true)));
+  unsigned char *out = file->writableData();
+  memset(out, 0, 128);
+  memcpy(out, "DDS ", 4);
+  writeLE32(out + 4, 124);
+  // CAPS|HEIGHT|WIDTH|PIXELFORMAT|MIPMAPCOUNT|LINEARSIZE
+  writeLE32(out + 8, 0x1|0x2|0x4|0x1000|0x20000|0x80000);
+  writeLE32(out + 12, height);
+  writeLE32(out + 16, width);
+  writeLE32(out + 20, blockCount(width) * blockCount(height) * blockSize);
+  writeLE32(out + 28, levels);
+  writeLE32(out + 76, 32);
+  writeLE32(out + 80, 0x4); // DDPF_FOURCC
+  memcpy(out + 84, alpha ? "DXT5" : "DXT1", 4);
+  // TEXTURE|MIPMAP|COMPLEX
+  writeLE32(out + 108, 0x1000|0x400000|0x8);
+  out += 128;
+
+  std::vector<unsigned char> level(rgba, rgba + width * height * 4);
+  Sirikata::uint32 w = width, h = height;
+  for (unsigned int l = 0; l < levels; ++l) {
+    unsigned char block[64];
+    for (Sirikata::uint32 by = 0; by < blockCount(h); ++by) {
+      for (Sirikata::uint32 bx = 0; bx < blockCount(w); ++bx) {
+        // Blocks hanging off the edge repeat the last row and column.
+        for (int i = 0; i < 16; ++i) {
+          Sirikata::uint32 x = std::min(bx * 4 + (i & 3), w - 1);
+          Sirikata::uint32 y = std::min(by * 4 + (i >> 2), h - 1);
+          memcpy(block + i * 4, &level[(y * w + x) * 4], 4);
+        }
+        if (alpha) {
+          encodeAlphaBlock(block, out);
+          out += 8;
+        }
+        encodeColorBlock(block, out);
+        out += 8;
+      }
+    }
+    if (l + 1 < levels) {
+      level = halve(level, w, h);
+      w = std::max<Sirikata::uint32>(1, w / 2);
+      h = std::max<Sirikata::uint32>(1, h / 2);
+    }
+  }
+  return file;
+}
+
+bool TextureTranscoder::isConvertible(const unsigned char *data, size_t length)
+{
+  if (length >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0)
+    return true;
+  if (length >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+    return true;
+  return length >= 2 && data[0] == 'B' && data[1] == 'M';
+}
+
+DenseDataPtr TextureTranscoder::transcode(const DenseData &source)
+{
+  const unsigned char *data = source.data();
+  size_t length = (size_t)source.length();
+  if (!isConvertible(data, length))
+    return DenseDataPtr();
+  const char *extension = data[0] == 0x89 ? "png" : data[0] == 0xff ? "jpg" : "bmp";
+  try {
+    Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(const_cast<unsigned char*>(data), length, false, true));
+    Ogre::Image image;
+    image.load(stream, extension);
+    Sirikata::uint32 width = (Sirikata::uint32)image.getWidth(), height = (Sirikata::uint32)image.getHeight();
+    if (width == 0 || height == 0 || image.getDepth() != 1 || image.getNumFaces() != 1)
+      return DenseDataPtr();
+    std::vector<unsigned char> rgba(width * height * 4);
+    Ogre::PixelBox converted(width, height, 1, Ogre::PF_BYTE_RGBA, &rgba[0]);
+    Ogre::PixelUtil::bulkPixelConversion(image.getPixelBox(), converted);
+    bool alpha = false;
+    if (Ogre::PixelUtil::hasAlpha(image.getFormat())) {
+      // Plenty of PNGs carry an alpha channel that is opaque throughout; those still fit DXT1.
+      for (size_t i = 3; i < rgba.size() && !alpha; i += 4)
+        alpha = rgba[i] != 255;
+    }
+    return encode(&rgba[0], width, height, alpha);
+  } catch (Ogre::Exception &e) {
+    SILOG(resource,warning,"Unable to decode texture for transcoding: "<<e.getDescription());
+    return DenseDataPtr();
+  }
+}
+
+RemoteFileId TextureTranscoder::convertedFileId(const RemoteFileId &source)
+{
+  SHA256 converted = SHA256::computeDigest(source.fingerprint().convertToHexString() + CONVERTED_SUFFIX);
+  return RemoteFileId(converted, Sirikata::Transfer::URI(Sirikata::Transfer::URIContext(),
+      std::string(Sirikata::Transfer::NetworkCacheLayer::cacheOnlyProtocol()) + ":///" + converted.convertToHexString()));
+}
+
+}
@@ -0,0 +1,59 @@
+/*  Meru
+ *  TextureTranscoder.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _TEXTURE_TRANSCODER_HPP
+#define _TEXTURE_TRANSCODER_HPP
+
+#include "MeruDefs.hpp"
+
+namespace Meru {
+
+/**
+ * Converts PNG, JPEG and BMP textures to block compressed DDS files with a full
+ * mip chain, so they take a quarter to an eighth of the memory once loaded and
+ * can be streamed by level like any other DDS file. Converted files are cached
+ * under convertedFileId() so each texture is only converted once.
+ */
+class TextureTranscoder {
+public:
+  ///Decodes an image file and encodes it as DXT1, or DXT5 if any texel is not opaque; NULL if it is not an image Ogre can decode
+  static DenseDataPtr transcode(const DenseData &source);
+  ///Encodes width*height texels of 8 bit RGBA, top row first, with mip levels down to 1x1
+  static DenseDataPtr encode(const unsigned char *rgba, Sirikata::uint32 width, Sirikata::uint32 height, bool alpha);
+  ///Whether data starts like a file transcode() can convert
+  static bool isConvertible(const unsigned char *data, size_t length);
+  ///The id the converted copy of source is cached and fetched under
+  static RemoteFileId convertedFileId(const RemoteFileId &source);
+};
+
+}
+
+#endif
@@ -381,6 +381,10 @@ public:
     RecordingDependencyDataStream(Ogre::DataStreamPtr&input,Ogre::String destination, ReplaceMaterialOptionsAndReturn &opts): ReplacingDataStream(input,destination,&nvpl){
         this->opts=&opts;
   }
+    ///The dependencies are recorded by the callbacks, so every file must actually be scanned
+    virtual bool cacheRewrites() const {
+        return false;
+    }
     /**
      * This function gets a callback from the ReplacingDataStream whenever a material name DEPENDED ON is encountered
      * it uses this callback to build up knowledge about the dependencies in a current resource script
@@ -703,6 +707,41 @@ DenseDataPtr getHashFileData(const DiskFile& name) {
       return DenseDataPtr();
   }
 }
+/// Textures and shader sources are uploaded as they are: they never name other files.
+static bool cannotReferenceFiles(const String&filefirst) {
+  return filefirst.find(".dds")!=Ogre::String::npos||filefirst.find(".gif")!=Ogre::String::npos||filefirst.find(".jpeg")!=Ogre::String::npos||filefirst.find(".png")!=Ogre::String::npos||filefirst.find(".tif")!=Ogre::String::npos||filefirst.find(".tga")!=Ogre::String::npos||filefirst.find(".jpg")!=Ogre::String::npos||filefirst.find(".vert")!=Ogre::String::npos||filefirst.find(".frag")!=Ogre::String::npos||filefirst.find(".hlsl")!=Ogre::String::npos||filefirst.find(".cg")!=Ogre::String::npos||filefirst.find(".glsl")!=Ogre::String::npos;
+}
+/**
+ * Loads every file in the map that cannot reference other files and hashes them all at once,
+ * spread across threads.  Their hashes don't depend on any other file's so unlike the rest
+ * they need not wait for processFileDependency to reach them in dependency order.
+ */
+static void hashIndependentFiles(FileMap &filemap) {
+  std::vector<ResourceFileUploadData*> files;
+  std::vector<MemoryReference> contents;
+  for (FileMap::iterator i=filemap.begin(),ie=filemap.end();i!=ie;++i) {
+      ResourceFileUploadData *file=i->second;
+      String filefirst = stripslashes(file->mSourceFilename);
+      if (file->mData || isNativeFile(filefirst) || !cannotReferenceFiles(filefirst)) {
+          continue;
+      }
+      DenseDataPtr data (getHashFileData(file->mSourceFilename));
+      if (!data) {
+          continue; // processFileDependency reports it as missing.
+      }
+      file->mData = data;
+      files.push_back(file);
+      contents.push_back(MemoryReference(data->data(), (size_t)data->length()));
+  }
+  if (files.empty()) {
+      return;
+  }
+  std::vector<Fingerprint> hashes(files.size());
+  Fingerprint::computeDigests(contents, &hashes[0]);
+  for (size_t i=0;i<files.size();++i) {
+      files[i]->mHash=hashes[i];
+  }
+}
 void processFileDependency(ResourceFileUploadData *file,FileMap &filemap, const MaterialMap &materialmap,ReplaceMaterialOptionsAndReturn &opts) {
   if (file->mData) {
       return; // Already processed.
@@ -716,7 +755,7 @@ void processFileDependency(ResourceFileUploadData *file,FileMap &filemap, const
   if (!processed) {
       return;
   }
-  if (filefirst.find(".dds")!=Ogre::String::npos||filefirst.find(".gif")!=Ogre::String::npos||filefirst.find(".jpeg")!=Ogre::String::npos||filefirst.find(".png")!=Ogre::String::npos||filefirst.find(".tif")!=Ogre::String::npos||filefirst.find(".tga")!=Ogre::String::npos||filefirst.find(".jpg")!=Ogre::String::npos||filefirst.find(".vert")!=Ogre::String::npos||filefirst.find(".frag")!=Ogre::String::npos||filefirst.find(".hlsl")!=Ogre::String::npos||filefirst.find(".cg")!=Ogre::String::npos||filefirst.find(".glsl")!=Ogre::String::npos) {
+  if (cannotReferenceFiles(filefirst)) {
       // These file formats cannot reference any other files, so do not alter them.
   }else {
     bool isbinary=filefirst.find(".mesh")!=Ogre::String::npos||filefirst.find(".skeleton")!=Ogre::String::npos;
@@ -1049,6 +1088,7 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
         }
     }
   }
+  hashIndependentFiles(opts.mFileMap);
   for (FileMap::iterator i=opts.mFileMap.begin(),ie=opts.mFileMap.end();i!=ie;++i) {
       if (!i->second->mData) {
           processFileDependency(i->second,opts.mFileMap,opts.mMaterialMap,opts);
@@ -1083,19 +1123,38 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
 struct UploadStatus {
     std::tr1::function<void(ResourceStatusMap const &)> mCallback;
     ResourceStatusMap mStatusMap;
+    ::Sirikata::Transfer::TransferManager *mTransferManager;
+    ::Sirikata::Transfer::URIContext mHashContext;
+    /// Copies, since the caller's list need not outlive the uploads.
+    std::vector<ResourceFileUpload> mFiles;
+    size_t mNextToStart;
+    /// Uploads not yet finished, plus one held by UploadFilesAndConfirmReplacement while it starts the first ones.
     int mNumberRemaining;
     boost::mutex mLock;
-    UploadStatus (const std::tr1::function<void(ResourceStatusMap const &)> &cb, int count)
-        : mCallback(cb), mNumberRemaining(count) {
+    UploadStatus (const std::tr1::function<void(ResourceStatusMap const &)> &cb,
+                  ::Sirikata::Transfer::TransferManager *tm,
+                  const ::Sirikata::Transfer::URIContext &hashContext)
+        : mCallback(cb), mTransferManager(tm), mHashContext(hashContext), mNextToStart(0), mNumberRemaining(1) {
+    }
+    /// Drops one count from mNumberRemaining with mLock held, reporting whether the status is now done with.
+    bool finishOne() {
+        if (--mNumberRemaining == 0) {
+            mCallback(mStatusMap);
+            return true;
+        }
+        return false;
     }
 };
 
+static void startNextUpload(UploadStatus *stat);
+
 EventResponse UploadFinished(UploadStatus *stat, const ResourceFileUpload &current, EventPtr ev) {
     Transfer::UploadEventPtr uploadev (std::tr1::static_pointer_cast<UploadEvent>(ev));
     if (!uploadev) {
         return EventResponse::nop();
     }
     bool del = false;
+    bool startAnother = false;
     {
         boost::unique_lock<boost::mutex> mylock (stat->mLock);
         ResourceUploadStatus st;
@@ -1103,49 +1162,96 @@ EventResponse UploadFinished(UploadStatus *stat, const ResourceFileUpload &curre
 
         if (stat->mStatusMap.insert(ResourceStatusMap::value_type(current, st)).second==false) {
             std::cout << "Warning: Duplicate upload finished for "<<uploadev->uri()<<std::endl;
+        } else {
+            startAnother = stat->mNextToStart < stat->mFiles.size();
+            if (startAnother) {
+                // Hold the count for the next upload until it has been started.
+                ++stat->mNumberRemaining;
+            }
         }
-        if (--stat->mNumberRemaining == 0) {
-            stat->mCallback(stat->mStatusMap);
-            del = true;
-        }
+        del = stat->finishOne();
         std::cout <<"FINISHED UPLOAD " << current.mID << "! Number left = "<<stat->mNumberRemaining<<std::endl;
     }
+    if (startAnother) {
+        startNextUpload(stat);
+    }
     if (del) {
         delete stat;
     }
     return EventResponse::del();
 }
 
+/// Starts the next upload that hasn't been started, if any, and gives up the count the caller took for it.
+static void startNextUpload(UploadStatus *stat) {
+    const ResourceFileUpload *next = NULL;
+    {
+        boost::unique_lock<boost::mutex> mylock (stat->mLock);
+        if (stat->mNextToStart < stat->mFiles.size()) {
+            next = &stat->mFiles[stat->mNextToStart++];
+            ++stat->mNumberRemaining;
+        }
+    }
+    if (next) {
+        const ResourceFileUpload &current = *next;
+        std::cout << "Uploading "<<stripslashes(current.mSourceFilename)<<" to URI " << current.mID<<". Hash = "<<current.mHash<<"; Size = "<<current.mData->length()<<std::endl;
+        if (current.mID.context() == stat->mHashContext) {
+            stat->mTransferManager->uploadByHash(Transfer::RemoteFileId(current.mHash, current.mID),
+                       current.mData,
+                       std::tr1::bind(&UploadFinished, stat, current, _1),false);
+        } else {
+            stat->mTransferManager->upload(current.mID,
+                       Transfer::RemoteFileId(current.mHash, stat->mHashContext),
+                       current.mData,
+                       std::tr1::bind(&UploadFinished, stat, current, _1),false);
+        }
+    }
+    bool del;
+    {
+        boost::unique_lock<boost::mutex> mylock (stat->mLock);
+        del = stat->finishOne();
+    }
+    if (del) {
+        delete stat;
+    }
+}
+
 void UploadFilesAndConfirmReplacement(::Sirikata::Transfer::TransferManager*tm,
                                       const std::vector<ResourceFileUpload> &origFilesToUpload,
                                       const ::Sirikata::Transfer::URIContext &hashContext,
-                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback) {
-    std::vector<const ResourceFileUpload*> filesToUpload;
+                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback,
+                                      size_t maxInFlight) {
+    UploadStatus *status = new UploadStatus(callback, tm, hashContext);
     {
         std::set<String> duplicateTracking;
         for (size_t i = 0; i < origFilesToUpload.size(); ++i) {
             if (duplicateTracking.insert(origFilesToUpload[i].mID.toString()).second) {
-                filesToUpload.push_back(&origFilesToUpload[i]);
+                status->mFiles.push_back(origFilesToUpload[i]);
             }
         }
     }
-    UploadStatus *status = new UploadStatus(callback, filesToUpload.size());
-    for (size_t i = 0; i < filesToUpload.size(); ++i) {
-        const ResourceFileUpload &current = *(filesToUpload[i]);
-        std::cout << "Uploading "<<stripslashes(current.mSourceFilename)<<" to URI " << current.mID<<". Hash = "<<current.mHash<<"; Size = "<<current.mData->length()<<std::endl;
-        if (current.mID.context() == hashContext) {
-            tm->uploadByHash(Transfer::RemoteFileId(current.mHash, current.mID),
-                       current.mData,
-                       std::tr1::bind(&UploadFinished, status, current, _1),false);
-        } else {
-            tm->upload(current.mID,
-                       Transfer::RemoteFileId(current.mHash, hashContext),
-                       current.mData,
-                       std::tr1::bind(&UploadFinished, status, current, _1),false);
+    size_t window = status->mFiles.size();
+    if (maxInFlight && maxInFlight < window) {
+        window = maxInFlight;
+    }
+    // Each finished upload starts the next, keeping window of them outstanding.
+    // The count taken below for each one keeps the status alive even if uploads
+    // complete as soon as they are started.
+    for (size_t i = 0; i < window; ++i) {
+        {
+            boost::unique_lock<boost::mutex> mylock (status->mLock);
+            ++status->mNumberRemaining;
         }
+        startNextUpload(status);
+    }
+    bool del;
+    {
+        boost::unique_lock<boost::mutex> mylock (status->mLock);
+        del = status->finishOne();
+    }
+    if (del) {
+        delete status;
     }
 }
-
 }
 
 #ifdef STANDALONE
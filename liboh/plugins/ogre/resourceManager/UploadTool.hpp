@@ -208,6 +208,7 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
  * \param username_to_resource_upload_choices is a map of previously chosen responses to uploads from usernames
  * \callback is the function to call when its over...it takes a map mapping resource uploads to whether they succeeded so that a second try can be establised, the result of new resource_upload_choices and a set of usernames to logout when this is all over
  * \param actuallyUpload dictates if the file should actually be uploaded
+ * \param maxInFlight how many uploads may be outstanding at once, 0 for all of them
 
    FIXME, Reimplement using Sirikata::Transfer::TransferManager::upload().
 
@@ -217,7 +218,8 @@ typedef std::map<ResourceFileUpload,ResourceUploadStatus> ResourceStatusMap;
 void UploadFilesAndConfirmReplacement(::Sirikata::Transfer::TransferManager*tm,
                                       const std::vector<ResourceFileUpload> &filesToUpload,
                                       const URIContext &hashContext,
-                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback);
+                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback,
+                                      size_t maxInFlight=8);
 
 
 
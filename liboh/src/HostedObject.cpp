@@ -36,7 +36,11 @@
 #include <ObjectHost_Persistence.pbj.hpp>
 #include <task/WorkQueue.hpp>
 #include "util/RoutableMessage.hpp"
+#include "util/MessagePool.hpp"
 #include "util/KnownServices.hpp"
+#include "util/CompactLocation.hpp"
+#include "util/ProtocolView.hpp"
+#include "util/HandleTable.hpp"
 #include "persistence/PersistenceSentMessage.hpp"
 #include "network/Stream.hpp"
 #include "util/SpaceObjectReference.hpp"
@@ -44,6 +48,8 @@
 #include "oh/TopLevelSpaceConnection.hpp"
 #include "oh/HostedObject.hpp"
 #include "util/SentMessage.hpp"
+#include "util/TraceEvents.hpp"
+#include "util/MessageTrace.hpp"
 #include "oh/ObjectHost.hpp"
 #include "oh/ProxyMeshObject.hpp"
 #include "oh/ProxyLightObject.hpp"
@@ -53,11 +59,34 @@
 #include "oh/ObjectScript.hpp"
 #include "oh/ObjectScriptManagerFactory.hpp"
 #include <util/KnownServices.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 namespace Sirikata {
 
 typedef SentMessageBody<RoutableMessageBody> RPCMessage;
 
+namespace {
+///Incoming RPC bodies and their replies, reused across messages on each thread
+MessagePool<RoutableMessageBody> sRPCBodyPool;
+
+///True once a requester's extrapolation of our location is off by more than the ObjectHost's threshold
+class LocationErrorExceeds {
+    double mThreshold;
+public:
+    LocationErrorExceeds(double threshold):mThreshold(threshold) {}
+    bool operator() (const Location&actualValue, const Location&predictedValue) const {
+        Vector3f ax,ay,az,px,py,pz;
+        actualValue.getOrientation().toAxes(ax,ay,az);
+        predictedValue.getOrientation().toAxes(px,py,pz);
+        return (actualValue.getPosition()-predictedValue.getPosition()).lengthSquared()>mThreshold*mThreshold ||
+               ax.dot(px)<.9||ay.dot(py)<.9||az.dot(pz)<.9;
+    }
+};
+///Mirrors the TimedWeightedExtrapolator each requester's ProxyObject runs on the replies we send it
+typedef TimedWeightedExtrapolator<Location,LocationErrorExceeds> SentLocationModel;
+}
+
 class HostedObject::PerSpaceData {
 public:
     SpaceConnection mSpaceConnection;
@@ -66,8 +95,24 @@ public:
     typedef std::map<uint32, std::set<ObjectReference> > ProxQueryMap;
     ProxQueryMap mProxQueryMap; ///< indexed by ProxCall::query_id()
 
-    PerSpaceData(const std::tr1::shared_ptr<TopLevelSpaceConnection>&topLevel,Network::Stream*stream)
-        :mSpaceConnection(topLevel,stream) {
+    typedef std::map<ObjectReference, SentLocationModel> SentLocationMap;
+    SentLocationMap mSentLocations; ///< what each LocRequest poller believes our location to be
+
+    CompactLocationFormat mCompactFormat; ///< sector size 0 unless RetObj granted compact location updates
+
+    bool mShared; ///< the stream is one of the TopLevelSpaceConnection's shared substreams
+
+    uint32 mGeneration; ///< TopLevelSpaceConnection::generation() the stream was cloned in
+
+    bool mResumable; ///< RetObj gave us mResumeToken, to take the object over from a new connection
+    UUID mResumeToken;
+
+    PerSpaceData(const std::tr1::shared_ptr<TopLevelSpaceConnection>&topLevel,Network::Stream*stream,bool shared)
+        :mSpaceConnection(topLevel,stream),
+         mCompactFormat(0,0,Time::null()),
+         mShared(shared),
+         mGeneration(topLevel->generation()),
+         mResumable(false) {
     }
 };
 
@@ -78,6 +123,11 @@ HostedObject::HostedObject(ObjectHost*parent, const UUID &objectName)
     mSpaceData = new SpaceDataMap;
     mObjectHost=parent;
     mObjectScript=NULL;
+    mPropertyFlushQueued=false;
+    mWorkLane=NULL;
+    if (parent->objectLaneQueue()) {
+        mWorkLane = new Task::WorkLane(parent->objectLaneQueue());
+    }
     mSendService.ho = this;
     mReceiveService.ho = this;
     mTracker.forwardMessagesTo(&mSendService);
@@ -85,6 +135,7 @@ HostedObject::HostedObject(ObjectHost*parent, const UUID &objectName)
 
 HostedObject::~HostedObject() {
     if (mObjectScript) {
+        mObjectHost->unregisterScriptTick(mObjectScript);
         delete mObjectScript;
     }
     for (SpaceDataMap::const_iterator iter = mSpaceData->begin();
@@ -101,13 +152,26 @@ HostedObject::~HostedObject() {
                     destroyViewedObject(SpaceObjectReference(iter->first, *oriter), getTracker());
             }
         }
+        if (iter->second.mShared) {
+            iter->second.mSpaceConnection.getTopLevelStream()->detachSharedStream(mInternalObjectReference);
+        }
     }
     mObjectHost->unregisterHostedObject(mInternalObjectReference);
     mTracker.endForwardingMessagesTo(&mSendService);
     delete mSpaceData;
+    // Items already in the lane hold only a weak reference, and find this object gone.
+    delete mWorkLane;
+}
+
+void HostedObject::dequeueHostMessages() {
+    if (!Task::WorkLane::inLane()) {
+        mObjectHost->getWorkQueue()->dequeueAll();
+    }
 }
 
 struct HostedObject::PrivateCallbacks {
+    /// Fills sBuiltinRPCs
+    static SlotVector<BuiltinRPC> builtinRPCs();
 
     static void initializeDatabaseCallback(
         HostedObject *realThis,
@@ -121,20 +185,33 @@ struct HostedObject::PrivateCallbacks {
             delete msg;
             return; // unable to get starting position.
         }
-        String scriptName;
-        std::map<String,String> scriptParams;
-        Location location(Vector3d::nil(),Quaternion::identity(),Vector3f::nil(),Vector3f(1,0,0),0);
+        std::map<String,String> fields;
         for (int i = 0; i < msg->body().reads_size(); i++) {
-            String name = msg->body().reads(i).field_name();
             if (msg->body().reads(i).has_return_status() || !msg->body().reads(i).has_data()) {
                 continue;
             }
+            fields[msg->body().reads(i).field_name()] = msg->body().reads(i).data();
+        }
+        delete msg;
+        restoreFields(realThis, spaceID, fields);
+    }
+
+    static void restoreFields(
+        HostedObject *realThis,
+        const SpaceID &spaceID,
+        const std::map<String,String> &fields)
+    {
+        String scriptName;
+        std::map<String,String> scriptParams;
+        Location location(Vector3d::nil(),Quaternion::identity(),Vector3f::nil(),Vector3f(1,0,0),0);
+        for (std::map<String,String>::const_iterator iter = fields.begin(); iter != fields.end(); ++iter) {
+            const String &name = iter->first;
             if (!name.empty() && name[0] != '_') {
-                realThis->setProperty(name, msg->body().reads(i).data());
+                realThis->setProperty(name, iter->second);
             }
             if (name == "Loc") {
                 ObjLoc loc;
-                loc.ParseFromString(msg->body().reads(i).data());
+                loc.ParseFromString(iter->second);
                 SILOG(cppoh,debug,"Creating object "<<ObjectReference(realThis->getUUID())
                       <<" at position "<<loc.position());
                 if (loc.has_position()) {
@@ -152,15 +229,18 @@ struct HostedObject::PrivateCallbacks {
                 if (loc.has_angular_speed()) {
                     location.setAngularSpeed(loc.angular_speed());
                 }
+                if (loc.has_acceleration() && loc.extrapolation() == ObjLoc::ACCELERATED) {
+                    location.setAcceleration(loc.acceleration());
+                }
             }
             if (name == "_Script") {
                 Protocol::StringProperty scrProp;
-                scrProp.ParseFromString(msg->body().reads(i).data());
+                scrProp.ParseFromString(iter->second);
                 scriptName = scrProp.value();
             }
             if (name == "_ScriptParams") {
                 Protocol::StringMapProperty scrProp;
-                scrProp.ParseFromString(msg->body().reads(i).data());
+                scrProp.ParseFromString(iter->second);
                 int numkeys = scrProp.keys_size();
                 {
                     int numvalues = scrProp.values_size();
@@ -176,20 +256,42 @@ struct HostedObject::PrivateCallbacks {
         // Temporary Hack because we do not have access to the CDN here.
         BoundingSphere3f sphere(Vector3f::nil(),1);
         realThis->sendNewObj(location, sphere, spaceID);
-        delete msg;
         if (!scriptName.empty()) {
             realThis->initializeScript(scriptName, scriptParams);
         }
-        realThis->mObjectHost->getWorkQueue()->dequeueAll();
+        realThis->dequeueHostMessages();
     }
 
     static void receivedRoutableMessage(const HostedObjectWPtr&thus,const SpaceID&sid, const Network::Chunk&msgChunk) {
         HostedObjectPtr realThis (thus.lock());
-
+        receivedSpaceMessage(realThis, sid, MemoryReference(msgChunk));
+    }
+    static void receivedSpaceMessage(const HostedObjectPtr&realThis,const SpaceID&sid, MemoryReference message) {
         RoutableMessageHeader header;
-        MemoryReference bodyData = header.ParseFromArray(&(msgChunk[0]),msgChunk.size());
+        MemoryReference bodyData = header.ParseFromArray(message.data(),message.size());
+        if (!header.has_source_object() && header.source_port() == Services::OBJECT_CONNECTIONS) {
+            // A batch from the space: each whole message is preceded by its length.
+            const uint8 *data = (const uint8*)bodyData.data();
+            size_t remaining = bodyData.size();
+            while (remaining) {
+                Network::Stream::uint30 length;
+                unsigned int lengthSize = remaining < Network::Stream::uint30::MAX_SERIALIZED_LENGTH ? remaining : Network::Stream::uint30::MAX_SERIALIZED_LENGTH;
+                if (!length.unserialize(data, lengthSize) || length.read() > remaining - lengthSize) {
+                    SILOG(objecthost,error,"Malformed message batch from space "<<sid);
+                    return;
+                }
+                receivedSpaceMessage(realThis, sid, MemoryReference(data + lengthSize, length.read()));
+                data += lengthSize + length.read();
+                remaining -= lengthSize + length.read();
+            }
+            return;
+        }
         header.set_source_space(sid);
         header.set_destination_space(sid);
+        if (!realThis) {
+            SILOG(objecthost,error,"Received message for dead HostedObject. SpaceID = "<<sid<<"; DestObject = "<<header.destination_object());
+            return;
+        }
         {
             ProxyObjectPtr destinationObject = realThis->getProxy(header.source_space());
             if (destinationObject) {
@@ -200,11 +302,6 @@ struct HostedObject::PrivateCallbacks {
             }
         }
 
-        if (!realThis) {
-            SILOG(objecthost,error,"Received message for dead HostedObject. SpaceID = "<<sid<<"; DestObject = "<<header.destination_object());
-            return;
-        }
-
         realThis->processRoutableMessage(header, bodyData);
     }
 
@@ -231,11 +328,11 @@ struct HostedObject::PrivateCallbacks {
             }
             std::string errorData;
             resp.SerializeToString(&errorData);
-            realThis->sendReply(origHeader, MemoryReference(errorData));
+            realThis->sendReply(origHeader, errorData);
         } else {
             realThis->sendReply(origHeader, bodyData);
         }
-        realThis->mObjectHost->getWorkQueue()->dequeueAll();
+        realThis->dequeueHostMessages();
     }
     static void handlePersistenceMessage(HostedObject *realThis, const RoutableMessageHeader &header, MemoryReference bodyData) {
         using namespace Persistence::Protocol;
@@ -318,13 +415,8 @@ struct HostedObject::PrivateCallbacks {
                 fail = true;
             } else {
                 if (rws.writes(i).has_data()) {
+                    // Reaches the proxies with the next flushPropertyUpdates(); the write itself goes out below.
                     realThis->setProperty(name, rws.writes(i).data());
-                    SpaceDataMap::iterator iter;
-                    for (iter = realThis->mSpaceData->begin();
-                         iter != realThis->mSpaceData->end();
-                         ++iter) {
-                        realThis->receivedPropertyUpdate(iter->second.mProxyObject, name, rws.writes(i).data());
-                    }
                 } else {
                     if (name != "LightInfo" && name != "MeshURI" && name != "IsCamera") {
                         // changing the type of this object has to wait until we reload from database.
@@ -364,30 +456,28 @@ struct HostedObject::PrivateCallbacks {
         } else {
             delete persistenceMsg;
         }
-        realThis->mObjectHost->getWorkQueue()->dequeueAll();
+        realThis->dequeueHostMessages();
     }
     static void handleRPCMessage(HostedObject *realThis, const RoutableMessageHeader &header, MemoryReference bodyData) {
         /// Parse message_names and message_arguments.
 
-        RoutableMessageBody msg;
-        msg.ParseFromArray(bodyData.data(), bodyData.length());
-        int numNames = msg.message_size();
+        MessagePool<RoutableMessageBody>::Handle msg(sRPCBodyPool);
+        msg->ParseFromArray(bodyData.data(), bodyData.length());
+        int numNames = msg->message_size();
         if (numNames <= 0) {
             // Invalid message!
             realThis->sendErrorReply(header, RoutableMessageHeader::PROTOCOL_ERROR);
             return;
         }
 
-        RoutableMessageBody responseMessage;
+        MessagePool<RoutableMessageBody>::Handle responseMessage(sRPCBodyPool);
         for (int i = 0; i < numNames; ++i) {
-            std::string name = msg.message_names(i);
-            MemoryReference body(msg.message_arguments(i));
+            const std::string &name = msg->message_names(i);
+            MemoryReference body(msg->message_arguments(i));
 
             if (header.has_id()) {
-                std::string response;
                 /// Pass response parameter if we expect a response.
-                realThis->processRPC(header, name, body, &response);
-                responseMessage.add_message_reply(response);
+                realThis->processRPC(header, name, body, responseMessage->add_message_reply());
             } else {
                 /// Return value not needed.
                 realThis->processRPC(header, name, body, NULL);
@@ -396,8 +486,8 @@ struct HostedObject::PrivateCallbacks {
 
         if (header.has_id()) {
             std::string serializedResponse;
-            responseMessage.SerializeToString(&serializedResponse);
-            realThis->sendReply(header, MemoryReference(serializedResponse));
+            responseMessage->SerializeToString(&serializedResponse);
+            realThis->sendReply(header, serializedResponse);
         }
     }
 
@@ -535,6 +625,8 @@ struct HostedObject::PrivateCallbacks {
             request->header().set_destination_space(proximateObjectId.space());
             request->header().set_destination_object(proximateObjectId.object());
             Protocol::LocRequest loc;
+            if (iter->second.mCompactFormat.sectorSize() > 0)
+                loc.set_compact(true);
             loc.SerializeToString(request->body().add_message("LocRequest"));
             request->setCallback(std::tr1::bind(&receivedPositionUpdateResponse, weakThis, _1, _2, _3));
             request->serializeSend();
@@ -542,6 +634,87 @@ struct HostedObject::PrivateCallbacks {
         return;
     }
 
+    /// Shows a ProxAggregate as one mesh at the center of its bounds, updating it in place if it was shown before.
+    static void receivedProxAggregate(
+        HostedObject *realThis,
+        ObjectHostProxyManager *proxyMgr,
+        const SpaceObjectReference &aggregateId,
+        ProxyObjectPtr proxyObj,
+        const Protocol::ProxAggregate &aggregate)
+    {
+        bool created = false;
+        if (!proxyObj) {
+            SILOG(cppoh,info, "* I found an AGGREGATE of " << aggregate.member_count() << " named " << aggregateId.object());
+            proxyObj = ProxyObjectPtr(new ProxyMeshObject(proxyMgr, aggregateId));
+            proxyObj->setLocal(false);
+            created = true;
+        }
+        Vector3f center = aggregate.bounds().center();
+        ObjLoc objLoc;
+        objLoc.set_timestamp(Task::AbsTime::now());
+        objLoc.set_position(Vector3d(center.x, center.y, center.z));
+        objLoc.set_orientation(Quaternion::identity());
+        objLoc.set_velocity(Vector3f::nil());
+        realThis->receivedPositionUpdate(proxyObj, objLoc, true);
+        if (created) {
+            proxyMgr->createViewedObject(proxyObj, realThis->getTracker());
+        }
+        ProxyMeshObject *proxymesh = dynamic_cast<ProxyMeshObject*>(proxyObj.get());
+        if (!proxymesh) {
+            return;
+        }
+        if (aggregate.has_mesh_uri()) {
+            // The space's aggregate mesh is taken to be of unit radius.
+            float32 radius = aggregate.bounds().radius();
+            proxymesh->setMesh(URI(aggregate.mesh_uri()));
+            proxymesh->setScale(Vector3f(radius, radius, radius));
+        } else if (aggregate.has_representative()) {
+            Persistence::SentReadWriteSet *request = new Persistence::SentReadWriteSet(&realThis->mTracker);
+            request->header().set_destination_space(aggregateId.space());
+            request->header().set_destination_object(ObjectReference(aggregate.representative()));
+            request->header().set_destination_port(Services::PERSISTENCE);
+            request->body().add_reads().set_field_name("MeshURI");
+            request->body().add_reads().set_field_name("MeshScale");
+            request->setPersistenceCallback(std::tr1::bind(&PrivateCallbacks::receivedProxAggregateMesh,
+                                                           realThis->getWeakPtr(), _1, _2, _3,
+                                                           aggregateId));
+            request->setTimeout(Duration::seconds(5.0));
+            request->serializeSend();
+        }
+    }
+    /// Gives an aggregate the mesh of its representative member.
+    static void receivedProxAggregateMesh(
+        const HostedObjectWPtr &weakThis,
+        SentMessage* sentMessageBase,
+        const RoutableMessageHeader &hdr,
+        Persistence::Protocol::Response::ReturnStatus returnStatus,
+        const SpaceObjectReference &aggregateId)
+    {
+        std::auto_ptr<Persistence::SentReadWriteSet> sentMessage(Persistence::SentReadWriteSet::cast_sent_message(sentMessageBase));
+        HostedObjectPtr realThis(weakThis.lock());
+        if (!realThis) {
+            return;
+        }
+        if (hdr.return_status() != RoutableMessageHeader::SUCCESS || returnStatus) {
+            SILOG(cppoh,info,"FAILURE receiving the mesh of aggregate "<<aggregateId.object()<<": Error = "<<(int)hdr.return_status());
+            return;
+        }
+        SpaceDataMap::iterator iter = realThis->mSpaceData->find(aggregateId.space());
+        if (iter == realThis->mSpaceData->end()) {
+            return;
+        }
+        ProxyObjectPtr proxyObj(iter->second.mSpaceConnection.getTopLevelStream()->getProxyObject(aggregateId));
+        if (!proxyObj) {
+            return; // refined into its members before the reply came
+        }
+        for (int i = 0; i < sentMessage->body().reads_size(); ++i) {
+            if (sentMessage->body().reads(i).has_return_status()) {
+                continue;
+            }
+            realThis->receivedPropertyUpdate(proxyObj, sentMessage->body().reads(i).field_name(), sentMessage->body().reads(i).data());
+        }
+    }
+
     static void receivedPositionUpdateResponse(
         const HostedObjectWPtr &weakThus,
         SentMessage* sentMessage,
@@ -572,11 +745,21 @@ struct HostedObject::PrivateCallbacks {
         static_cast<RPCMessage*>(sentMessage)->serializeSend(); // Resend position update each time we get one.
     }
 
-    static void disconnectionEvent(const HostedObjectWPtr&weak_thus,const SpaceID&sid, const String&reason) {
+    static void disconnectionEvent(const HostedObjectWPtr&weak_thus,const SpaceID&sid, const TopLevelSpaceConnection*from, uint32 generation, const String&reason) {
         std::tr1::shared_ptr<HostedObject>thus=weak_thus.lock();
         if (thus) {
             SpaceDataMap::iterator where=thus->mSpaceData->find(sid);
-            if (where!=thus->mSpaceData->end()) {
+            // Streams to a server the object has since migrated away from, or from before a reconnect, are ignored.
+            if (where!=thus->mSpaceData->end() &&
+                where->second.mSpaceConnection.getTopLevelStream().get()==from &&
+                where->second.mGeneration==generation) {
+                PerSpaceData &psd = where->second;
+                std::tr1::shared_ptr<TopLevelSpaceConnection> topLevel(psd.mSpaceConnection.getTopLevelStream());
+                if (psd.mResumable && psd.mProxyObject && topLevel->reconnect(generation)) {
+                    thus->cloneTopLevelStream(sid, topLevel);
+                    thus->sendResumeObj(sid, psd);
+                    return;
+                }
                 thus->mSpaceData->erase(where);//FIXME do we want to back this up to the database first?
             }
         }
@@ -584,10 +767,12 @@ struct HostedObject::PrivateCallbacks {
 
     static void connectionEvent(const HostedObjectWPtr&thus,
                                 const SpaceID&sid,
+                                const TopLevelSpaceConnection*from,
+                                uint32 generation,
                                 Network::Stream::ConnectionStatus ce,
                                 const String&reason) {
         if (ce!=Network::Stream::Connected) {
-            disconnectionEvent(thus,sid,reason);
+            disconnectionEvent(thus,sid,from,generation,reason);
         }
     }
 };
@@ -595,45 +780,169 @@ struct HostedObject::PrivateCallbacks {
 HostedObject::PerSpaceData& HostedObject::cloneTopLevelStream(const SpaceID&sid,const std::tr1::shared_ptr<TopLevelSpaceConnection>&tls) {
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
-    SpaceDataMap::iterator iter = mSpaceData->insert(
-        SpaceDataMap::value_type(
-            sid,
-            PerSpaceData(tls,
-                         tls->topLevelStream()->clone(
-                             std::tr1::bind(&PrivateCallbacks::connectionEvent,
-                                            getWeakPtr(),
-                                            sid,
-                                            _1,
-                                            _2),
-                             std::tr1::bind(&PrivateCallbacks::receivedRoutableMessage,
-                                            getWeakPtr(),
-                                            sid,
-                                            _1))))).first;
+    Network::Stream::ConnectionCallback connectionCallback(
+        std::tr1::bind(&PrivateCallbacks::connectionEvent,
+                       getWeakPtr(),
+                       sid,
+                       tls.get(),
+                       tls->generation(),
+                       _1,
+                       _2));
+    Network::Stream::BytesReceivedCallback bytesReceivedCallback(
+        std::tr1::bind(&PrivateCallbacks::receivedRoutableMessage,
+                       getWeakPtr(),
+                       sid,
+                       _1));
+    bool shared = tls->sharedStreamCount() != 0;
+    Network::Stream *stream = shared
+        ? tls->attachSharedStream(mInternalObjectReference, connectionCallback, bytesReceivedCallback)
+        : tls->topLevelStream()->clone(connectionCallback, bytesReceivedCallback);
+    SpaceDataMap::iterator iter = mSpaceData->find(sid);
+    if (iter == mSpaceData->end()) {
+        iter = mSpaceData->insert(
+            SpaceDataMap::value_type(
+                sid,
+                PerSpaceData(tls, stream, shared))).first;
+    } else {
+        // Resuming after a reconnect: everything but the stream stays as it was.
+        iter->second.mSpaceConnection = SpaceConnection(tls, stream);
+        iter->second.mShared = shared;
+        iter->second.mGeneration = tls->generation();
+    }
+    // Shared substreams have their options set once by the TopLevelSpaceConnection.
+    if (!shared && mObjectHost->batchSpaceMessages()) {
+        RoutableMessageHeader optionsHeader;
+        optionsHeader.set_destination_space(sid);
+        optionsHeader.set_destination_object(ObjectReference::spaceServiceID());
+        optionsHeader.set_destination_port(Services::OBJECT_CONNECTIONS);
+        RoutableMessageBody options;
+        options.add_message("EnableBatching");
+        std::string serializedOptions;
+        options.SerializeToString(&serializedOptions);
+        sendViaSpace(optionsHeader, MemoryReference(serializedOptions));
+    }
     return iter->second;
 }
 
+void HostedObject::sendResumeObj(const SpaceID&sid, const PerSpaceData&psd) {
+    RoutableMessageHeader resumeHeader;
+    resumeHeader.set_destination_space(sid);
+    resumeHeader.set_destination_object(ObjectReference::spaceServiceID());
+    resumeHeader.set_destination_port(Services::OBJECT_CONNECTIONS);
+    Protocol::ResumeObj resumeObj;
+    resumeObj.set_object_reference(psd.mProxyObject->getObjectReference().object().getAsUUID());
+    resumeObj.set_resume_token(psd.mResumeToken);
+    RoutableMessageBody options;
+    resumeObj.SerializeToString(options.add_message("ResumeObject"));
+    std::string serializedOptions;
+    options.SerializeToString(&serializedOptions);
+    sendViaSpace(resumeHeader, MemoryReference(serializedOptions));
+}
+
 static String nullProperty;
 bool HostedObject::hasProperty(const String &propName) const {
-    PropertyMap::const_iterator iter = mProperties.find(propName);
-    return (iter != mProperties.end());
+    return mProperties.has(propName);
 }
 const String &HostedObject::getProperty(const String &propName) const {
-    PropertyMap::const_iterator iter = mProperties.find(propName);
-    if (iter != mProperties.end()) {
-        return (*iter).second;
+    const String *value = mProperties.get(propName);
+    if (value) {
+        return *value;
     }
     return nullProperty;
 }
 String *HostedObject::propertyPtr(const String &propName) {
-    return &(mProperties[propName]);
+    queuePropertyFlush();
+    return mProperties.mutableValue(propName);
 }
 void HostedObject::setProperty(const String &propName, const String &encodedValue) {
-    mProperties.insert(PropertyMap::value_type(propName, encodedValue));
+    mProperties.set(propName, encodedValue);
+    queuePropertyFlush();
 }
 void HostedObject::unsetProperty(const String &propName) {
-    PropertyMap::iterator iter = mProperties.find(propName);
-    if (iter != mProperties.end()) {
-        mProperties.erase(iter);
+    mProperties.unset(propName);
+    queuePropertyFlush();
+}
+void HostedObject::writeProperty(const String &propName, const String &encodedValue) {
+    mProperties.set(propName, encodedValue, PropertyStore::DIRTY_UPDATE|PropertyStore::DIRTY_PERSIST);
+    queuePropertyFlush();
+}
+
+/// Runs flushPropertyUpdates() for a HostedObject once the work queued ahead of it is done.
+class PropertyFlush : public Task::WorkItem {
+    HostedObjectWPtr mObject;
+public:
+    PropertyFlush(const HostedObjectWPtr &object) : mObject(object) {
+    }
+    void operator() () {
+        AutoPtr delete_me(this);
+        HostedObjectPtr object(mObject.lock());
+        if (object) {
+            object->flushPropertyUpdates();
+        }
+    }
+};
+
+void HostedObject::queuePropertyFlush() {
+    if (mPropertyFlushQueued || !mProperties.dirty() || getWeakPtr().expired()) {
+        // Also waits while still constructing: the first change after construct() queues it.
+        return;
+    }
+    mPropertyFlushQueued = true;
+    if (mWorkLane) {
+        mWorkLane->enqueue(new PropertyFlush(getWeakPtr()));
+    } else {
+        mObjectHost->getWorkQueue()->enqueuePriority(new PropertyFlush(getWeakPtr()), Task::PRIORITY_LOW);
+    }
+}
+
+static void handlePropertyWriteResponse(SentMessage *sent, const RoutableMessageHeader &header, MemoryReference) {
+    std::auto_ptr<SentMessageBody<Persistence::Protocol::ReadWriteSet> > sentDestruct(static_cast<SentMessageBody<Persistence::Protocol::ReadWriteSet> *>(sent));
+    if (header.has_return_status()) {
+        SILOG(cppoh,error,"Persistence failed to write through properties: "<<(int)header.return_status());
+    }
+}
+
+void HostedObject::flushPropertyUpdates() {
+    using namespace Persistence::Protocol;
+    mPropertyFlushQueued = false;
+    // Take the changes out first: proxy listeners may well set more properties from in here.
+    PropertyStore::EntryVector changed;
+    mProperties.takeDirty(changed);
+    if (changed.empty()) {
+        return;
+    }
+    SentMessageBody<ReadWriteSet> *persistenceMsg = NULL;
+    for (PropertyStore::EntryVector::const_iterator iter = changed.begin(); iter != changed.end(); ++iter) {
+        if (iter->mDirty & PropertyStore::DIRTY_PERSIST) {
+            if (!persistenceMsg) {
+                persistenceMsg = new SentMessageBody<ReadWriteSet>(&mTracker);
+            }
+            IStorageElement el = persistenceMsg->body().add_writes();
+            el.set_field_name(*iter->mName);
+            if (iter->mPresent) {
+                el.set_data(iter->mValue);
+            }
+            el.set_object_uuid(getUUID());
+        }
+    }
+    if (persistenceMsg) {
+        SILOG(cppoh,debug,"Writing "<<persistenceMsg->body().writes_size()<<" properties through to Persistence");
+        persistenceMsg->header().set_destination_space(SpaceID::null());
+        persistenceMsg->header().set_destination_object(ObjectReference::spaceServiceID());
+        persistenceMsg->header().set_destination_port(Services::PERSISTENCE);
+        persistenceMsg->setCallback(&handlePropertyWriteResponse);
+        persistenceMsg->serializeSend();
+    }
+    for (SpaceDataMap::iterator spaceIter = mSpaceData->begin(); spaceIter != mSpaceData->end(); ++spaceIter) {
+        ProxyObjectPtr proxy(spaceIter->second.mProxyObject);
+        if (!proxy) {
+            continue;
+        }
+        for (PropertyStore::EntryVector::const_iterator iter = changed.begin(); iter != changed.end(); ++iter) {
+            if ((iter->mDirty & PropertyStore::DIRTY_UPDATE) && iter->mPresent) {
+                receivedPropertyUpdate(proxy, *iter->mName, iter->mValue);
+            }
+        }
     }
 }
 
@@ -671,6 +980,22 @@ void HostedObject::sendNewObj(
     loc.set_velocity(startingLocation.getVelocity());
     loc.set_rotational_axis(startingLocation.getAxisOfRotation());
     loc.set_angular_speed(startingLocation.getAngularSpeed());
+    if (startingLocation.getAcceleration() != Vector3f(0,0,0)) {
+        loc.set_acceleration(startingLocation.getAcceleration());
+        loc.set_extrapolation(ObjLoc::ACCELERATED);
+    }
+    if (mObjectHost->compactLocations())
+        newObj.mutable_compact_loc_format();
+    if (mObjectHost->resumeSpaceSessions())
+        newObj.set_resumable(true);
+
+    SpaceDataMap::iterator where = mSpaceData->find(spaceID);
+    if (where != mSpaceData->end() && where->second.mShared) {
+        String serializedNewObj;
+        newObj.SerializeToString(&serializedNewObj);
+        if (where->second.mSpaceConnection.getTopLevelStream()->queueRegistration(mInternalObjectReference, serializedNewObj))
+            return; // goes out in a NewObjBatch with the other objects registering on our substream
+    }
 
     RoutableMessageBody messageBody;
     newObj.SerializeToString(messageBody.add_message("NewObj"));
@@ -689,7 +1014,7 @@ void HostedObject::initializeConnect(
     mObjectHost->registerHostedObject(getSharedPtr());
     connectToSpace(spaceID, spaceConnectionHint);
     sendNewObj(startingLocation, meshBounds, spaceID);
-    mObjectHost->getWorkQueue()->dequeueAll(); // don't need to wait until next frame.
+    dequeueHostMessages(); // don't need to wait until next frame.
 
     if (!mesh.empty()) {
         Protocol::StringProperty meshprop;
@@ -722,6 +1047,7 @@ void HostedObject::initializePythonScript() {
         mObjectScript=mgr->createObjectScript(this,args);
         if (mObjectScript) {
             mObjectScript->tick();
+            mObjectHost->registerScriptTick(mObjectScript, mObjectScript->tickInterval());
         }
     }
 }
@@ -752,7 +1078,12 @@ void HostedObject::initializeRestoreFromDatabase(const SpaceID&spaceID, const Ho
     msg->header().set_destination_object(ObjectReference::spaceServiceID());
     msg->header().set_destination_port(Services::PERSISTENCE);
     msg->serializeSend();
-    mObjectHost->getWorkQueue()->dequeueAll(); // don't need to wait until next frame.
+    dequeueHostMessages(); // don't need to wait until next frame.
+}
+void HostedObject::initializeRestoreFromFields(const SpaceID&spaceID, const std::map<String,String>&fields, const HostedObjectPtr&spaceConnectionHint) {
+    mObjectHost->registerHostedObject(getSharedPtr());
+    connectToSpace(spaceID, spaceConnectionHint);
+    PrivateCallbacks::restoreFields(this, spaceID, fields);
 }
 void HostedObject::initializeScript(const String& script, const ObjectScriptManager::Arguments &args) {
     assert(!mObjectScript); // Don't want to kill a live script!
@@ -760,6 +1091,9 @@ void HostedObject::initializeScript(const String& script, const ObjectScriptMana
     ObjectScriptManager *mgr = ObjectScriptManagerFactory::getSingleton().getConstructor(script)("");
     if (mgr) {
         mObjectScript = mgr->createObjectScript(this, args);
+        if (mObjectScript) {
+            mObjectHost->registerScriptTick(mObjectScript, mObjectScript->tickInterval());
+        }
     }
 }
 void HostedObject::connectToSpace(const SpaceID&id,const HostedObjectPtr&spaceConnectionHint) {
@@ -781,20 +1115,16 @@ void HostedObject::connectToSpace(const SpaceID&id,const HostedObjectPtr&spaceCo
 }
 
 void HostedObject::processRoutableMessage(const RoutableMessageHeader &header, MemoryReference bodyData) {
-    std::string myself_name;
-    {
-        std::ostringstream os;
+    SIRIKATA_TRACE_SCOPE("HostedObject::processRoutableMessage");
+    MessageTrace::finish(header);
+    if (SILOGP(cppoh,debug)) {
+        std::ostringstream myself_name;
         if (header.has_destination_object()) {
-            os << header.destination_object();
+            myself_name << header.destination_object();
         } else {
-            os << "[Temporary UUID " << mInternalObjectReference.toString() << "]";
+            myself_name << "[Temporary UUID " << mInternalObjectReference.toString() << "]";
         }
-        myself_name = os.str();
-    }
-    {
-        std::ostringstream os;
-        os << "** Message from: " << header.source_object() << " port " << header.source_port() << " to "<<myself_name<<" port " << header.destination_port();
-        SILOG(cppoh,debug,os.str());
+        SILOG(cppoh,debug,"** Message from: " << header.source_object() << " port " << header.source_port() << " to "<<myself_name.str()<<" port " << header.destination_port());
     }
     /// Handle Return values to queries we sent to someone:
     if (header.has_reply_id()) {
@@ -824,7 +1154,12 @@ void HostedObject::sendViaSpace(const RoutableMessageHeader &hdrOrig, MemoryRefe
         RoutableMessageHeader hdr (hdrOrig);
         hdr.clear_destination_space();
         hdr.clear_source_space();
-        hdr.clear_source_object();
+        if (where->second.mShared) {
+            hdr.set_source_object(ObjectReference(mInternalObjectReference)); // how the space tells us apart from the other objects on the stream
+        } else {
+            hdr.clear_source_object();
+        }
+        MessageTrace::begin(hdr);
         String serialized_header;
         hdr.SerializeToString(&serialized_header);
         where->second.mSpaceConnection.getStream()->send(MemoryReference(serialized_header),body, Network::ReliableOrdered);
@@ -838,6 +1173,7 @@ void HostedObject::send(const RoutableMessageHeader &hdrOrig, MemoryReference bo
         RoutableMessageHeader hdr (hdrOrig);
         hdr.set_destination_space(SpaceID::null());
         hdr.set_source_object(ObjectReference(mInternalObjectReference));
+        MessageTrace::begin(hdr);
         mObjectHost->processMessage(hdr, body);
         return;
     }
@@ -847,6 +1183,7 @@ void HostedObject::send(const RoutableMessageHeader &hdrOrig, MemoryReference bo
         if (obj) {
             RoutableMessageHeader hdr (hdrOrig);
             hdr.set_source_object(obj->getObjectReference().object());
+            MessageTrace::begin(hdr);
             mObjectHost->processMessage(hdr, body);
         } else {
             sendViaSpace(hdrOrig, body);
@@ -854,6 +1191,28 @@ void HostedObject::send(const RoutableMessageHeader &hdrOrig, MemoryReference bo
     }
 }
 
+void HostedObject::send(const RoutableMessageHeader &hdrOrig, String &body) {
+    assert(hdrOrig.has_destination_object());
+    if (!hdrOrig.has_destination_space() || hdrOrig.destination_space() == SpaceID::null()) {
+        RoutableMessageHeader hdr (hdrOrig);
+        hdr.set_destination_space(SpaceID::null());
+        hdr.set_source_object(ObjectReference(mInternalObjectReference));
+        MessageTrace::begin(hdr);
+        mObjectHost->processMessage(hdr, body);
+        return;
+    }
+    SpaceDataMap::iterator where=mSpaceData->find(hdrOrig.destination_space());
+    if (where!=mSpaceData->end() && where->second.mProxyObject) {
+        RoutableMessageHeader hdr (hdrOrig);
+        hdr.set_source_object(where->second.mProxyObject->getObjectReference().object());
+        MessageTrace::begin(hdr);
+        mObjectHost->processMessage(hdr, body);
+        return;
+    }
+    // The space stream copies the body as it frames it anyway.
+    send(hdrOrig, MemoryReference(body));
+}
+
 void HostedObject::receivedPositionUpdate(
     const ProxyObjectPtr &proxy,
     const ObjLoc &objLoc,
@@ -862,6 +1221,17 @@ void HostedObject::receivedPositionUpdate(
     if (!proxy) {
         return;
     }
+    if (objLoc.has_compact()) {
+        SpaceDataMap::iterator iter = mSpaceData->find(proxy->getObjectReference().space());
+        if (iter == mSpaceData->end() || !(iter->second.mCompactFormat.sectorSize() > 0)) {
+            SILOG(cppoh,warning,"Compact position update for "<<proxy->getObjectReference().object()<<" in a space without a compact format");
+            return;
+        }
+        ObjLoc expanded(objLoc);
+        iter->second.mCompactFormat.expand(expanded);
+        receivedPositionUpdate(proxy, expanded, force_reset);
+        return;
+    }
     force_reset = force_reset || (objLoc.update_flags() & ObjLoc::FORCE);
     if (!objLoc.has_timestamp()) {
         objLoc.set_timestamp(Task::AbsTime::now());
@@ -882,6 +1252,14 @@ void HostedObject::receivedPositionUpdate(
     if (force_reset || objLoc.has_angular_speed()) {
         currentLoc.setAngularSpeed(objLoc.angular_speed());
     }
+    if (force_reset || objLoc.has_extrapolation()) {
+        proxy->setLocationBlend(objLoc.extrapolation() == ObjLoc::ACCELERATED ? HERMITE_BLEND : LINEAR_BLEND);
+    }
+    if (proxy->locationBlend() == LINEAR_BLEND) {
+        currentLoc.setAcceleration(Vector3f(0,0,0));
+    } else if (force_reset || objLoc.has_acceleration()) {
+        currentLoc.setAcceleration(objLoc.acceleration());
+    }
     if (force_reset) {
         proxy->resetLocation(objLoc.timestamp(), currentLoc);
     } else {
@@ -893,217 +1271,424 @@ void HostedObject::receivedPositionUpdate(
 }
 
 
+namespace {
+/// RPC names interned process wide, so each message costs one hash of its name.
+class RPCNameTable {
+    boost::shared_mutex mMutex;
+    HandleTable<String, std::tr1::hash<String> > mNames;
+public:
+    uint32 intern(const String &name) {
+        boost::unique_lock<boost::shared_mutex> lock(mMutex);
+        return mNames.insert(name);
+    }
+    uint32 find(const String &name) {
+        boost::shared_lock<boost::shared_mutex> lock(mMutex);
+        return mNames.find(name);
+    }
+};
+RPCNameTable &rpcNames() {
+    static RPCNameTable names;
+    return names;
+}
+}
+
+uint32 HostedObject::internRPCName(const String &name) {
+    return rpcNames().intern(name);
+}
+
+SlotVector<HostedObject::BuiltinRPC> HostedObject::PrivateCallbacks::builtinRPCs() {
+    SlotVector<BuiltinRPC> table;
+    table[internRPCName("LocRequest")] = &HostedObject::processLocRequest;
+    table[internRPCName("SetLoc")] = &HostedObject::processSetLoc;
+    table[internRPCName("DelObj")] = &HostedObject::processDelObj;
+    table[internRPCName("ResumeFailed")] = &HostedObject::processResumeFailed;
+    table[internRPCName("MigrateObj")] = &HostedObject::processMigrateObj;
+    table[internRPCName("RetObj")] = &HostedObject::processRetObj;
+    table[internRPCName("ProxCallBatch")] = &HostedObject::processProxCallBatch;
+    table[internRPCName("ProxCall")] = &HostedObject::processProxCall;
+    return table;
+}
+SlotVector<HostedObject::BuiltinRPC> HostedObject::sBuiltinRPCs(HostedObject::PrivateCallbacks::builtinRPCs());
+
+void HostedObject::registerRPCHandler(const String &name, const RPCHandler &handler) {
+    mRPCHandlers[internRPCName(name)] = handler;
+}
+void HostedObject::unregisterRPCHandler(const String &name) {
+    uint32 id = rpcNames().find(name);
+    if (id != HandleTable<String, std::tr1::hash<String> >::npos)
+        mRPCHandlers.reset(id);
+}
+
 static int32 query_id = 0;
 using Protocol::LocRequest;
 void HostedObject::processRPC(const RoutableMessageHeader &msg, const std::string &name, MemoryReference args, String *response) {
     std::ostringstream printstr;
     printstr<<"\t";
-    ProxyObjectPtr thisObj = getProxy(msg.source_space());
-
-    if (name == "LocRequest") {
-        LocRequest query;
-        printstr<<"LocRequest: ";
-        query.ParseFromArray(args.data(), args.length());
-        ObjLoc loc;
-        Task::AbsTime now = Task::AbsTime::now();
-        if (thisObj) {
-            Location globalLoc = thisObj->globalLocation(now);
-            loc.set_timestamp(now);
-            uint32 fields = 0;
-            bool all_fields = true;
-            if (query.has_requested_fields()) {
-                fields = query.requested_fields();
-                all_fields = false;
-            }
-            if (all_fields || (fields & LocRequest::POSITION))
-                loc.set_position(globalLoc.getPosition());
-            if (all_fields || (fields & LocRequest::ORIENTATION))
-                loc.set_orientation(globalLoc.getOrientation());
-            if (all_fields || (fields & LocRequest::VELOCITY))
-                loc.set_velocity(globalLoc.getVelocity());
-            if (all_fields || (fields & LocRequest::ROTATIONAL_AXIS))
-                loc.set_rotational_axis(globalLoc.getAxisOfRotation());
-            if (all_fields || (fields & LocRequest::ANGULAR_SPEED))
-                loc.set_angular_speed(globalLoc.getAngularSpeed());
-            if (response)
-                loc.SerializeToString(response);
-        } else {
-            SILOG(objecthost, error, "LocRequest message not for any known object.");
-        }
-        // loc requests need to be fast, unlikely to land in infinite recursion.
-        mObjectHost->getWorkQueue()->dequeueAll();
-        return;             /// comment out if we want scripts to see these requests
+    uint32 id = rpcNames().find(name);
+    bool toScript = true;
+    if (mRPCHandlers.get(id)) {
+        // Copied, as the handler may unregister itself.
+        RPCHandler handler(mRPCHandlers.get(id));
+        printstr<<"Message handled by registered handler: "<<name;
+        toScript = handler(msg, args, response);
+    } else if (BuiltinRPC builtin = sBuiltinRPCs.get(id)) {
+        toScript = (this->*builtin)(msg, args, response, printstr);
+    } else {
+        printstr<<"Message to be handled in script: "<<name;
     }
-    else if (name == "SetLoc") {
-        ObjLoc setloc;
-        printstr<<"Someone wants to set my position: ";
-        setloc.ParseFromArray(args.data(), args.length());
-        if (thisObj) {
-            printstr<<setloc.position();
-            receivedPositionUpdate(thisObj, setloc, false);
+    if (!toScript) {
+        return;
+    }
+    SILOG(cppoh,debug,printstr.str());
+    if (mObjectScript) {
+        MemoryBuffer returnCopy;
+        mObjectScript->processRPC(msg, name, args, returnCopy);
+        if (response) {
+            response->reserve(returnCopy.size());
+            std::copy(returnCopy.begin(), returnCopy.end(),
+                      std::insert_iterator<std::string>(*response, response->begin()));
         }
     }
-    else if (name == "DelObj") {
+}
+
+bool HostedObject::processLocRequest(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    ProxyObjectPtr thisObj = getProxy(msg.source_space());
+    LocRequest query;
+    printstr<<"LocRequest: ";
+    query.ParseFromArray(args.data(), args.length());
+    ObjLoc loc;
+    Task::AbsTime now = Task::AbsTime::now();
+    if (thisObj) {
+        Location globalLoc = thisObj->globalLocation(now);
+        loc.set_timestamp(now);
+        uint32 fields = 0;
+        bool all_fields = true;
+        if (query.has_requested_fields()) {
+            fields = query.requested_fields();
+            all_fields = false;
+        }
+        double threshold = mObjectHost->locationErrorThreshold();
         SpaceDataMap::iterator perSpaceIter = mSpaceData->find(msg.source_space());
-        if (perSpaceIter == mSpaceData->end()) {
-            SILOG(objecthost, error, "DelObj message not for any known space.");
-            return;
+        const CompactLocationFormat *compactFormat = NULL;
+        if (query.compact() && perSpaceIter != mSpaceData->end() && perSpaceIter->second.mCompactFormat.sectorSize() > 0)
+            compactFormat = &perSpaceIter->second.mCompactFormat;
+        if (all_fields && threshold > 0 && perSpaceIter != mSpaceData->end()) {
+            PerSpaceData::SentLocationMap &sent = perSpaceIter->second.mSentLocations;
+            PerSpaceData::SentLocationMap::iterator model = sent.find(msg.source_object());
+            if (model != sent.end())
+                model->second.setBlend(thisObj->locationBlend());
+            if (model == sent.end()) {
+                // Pollers ask continuously, so a model nobody refreshed belongs to an observer that left.
+                for (PerSpaceData::SentLocationMap::iterator stale = sent.begin(); stale != sent.end(); ) {
+                    if (now - stale->second.lastUpdateTime() > Duration::seconds(30.0))
+                        sent.erase(stale++);
+                    else
+                        ++stale;
+                }
+                sent.insert(PerSpaceData::SentLocationMap::value_type(
+                                msg.source_object(),
+                                SentLocationModel(Duration::seconds(.1), now, globalLoc,
+                                                  LocationErrorExceeds(threshold))))
+                    .first->second.setBlend(thisObj->locationBlend());
+            } else if (model->second.needsUpdate(now, globalLoc)) {
+                model->second.updateValue(now, globalLoc);
+            } else {
+                // The requester keeps extrapolating from a timestamp-only reply, as we do here.
+                model->second.updateValue(now, model->second.extrapolate(now));
+                if (compactFormat)
+                    compactFormat->compress(loc);
+                if (response)
+                    loc.SerializeToString(response);
+                dequeueHostMessages();
+                return false;
+            }
         }
-        TopLevelSpaceConnection *proxyMgr =
-            perSpaceIter->second.mSpaceConnection.getTopLevelStream().get();
-        if (thisObj && proxyMgr) {
-            proxyMgr->unregisterHostedObject(thisObj->getObjectReference().object());
+        if (all_fields || (fields & LocRequest::POSITION))
+            loc.set_position(globalLoc.getPosition());
+        if (all_fields || (fields & LocRequest::ORIENTATION))
+            loc.set_orientation(globalLoc.getOrientation());
+        if (all_fields || (fields & LocRequest::VELOCITY))
+            loc.set_velocity(globalLoc.getVelocity());
+        if (all_fields || (fields & LocRequest::ROTATIONAL_AXIS))
+            loc.set_rotational_axis(globalLoc.getAxisOfRotation());
+        if (all_fields || (fields & LocRequest::ANGULAR_SPEED))
+            loc.set_angular_speed(globalLoc.getAngularSpeed());
+        if (thisObj->locationBlend() == HERMITE_BLEND) {
+            loc.set_extrapolation(ObjLoc::ACCELERATED);
+            if (all_fields || (fields & LocRequest::ACCELERATION))
+                loc.set_acceleration(globalLoc.getAcceleration());
         }
+        if (compactFormat)
+            compactFormat->compress(loc);
+        if (response)
+            loc.SerializeToString(response);
+    } else {
+        SILOG(objecthost, error, "LocRequest message not for any known object.");
     }
-    else if (name == "RetObj") {
-        SpaceDataMap::iterator perSpaceIter = mSpaceData->find(msg.source_space());
-        if (msg.source_object() != ObjectReference::spaceServiceID()) {
-            SILOG(objecthost, error, "RetObj message not coming from space: "<<msg.source_object());
-            return;
+    // loc requests need to be fast, unlikely to land in infinite recursion.
+    dequeueHostMessages();
+    return false;             /// comment out if we want scripts to see these requests
+}
+
+bool HostedObject::processSetLoc(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    ProxyObjectPtr thisObj = getProxy(msg.source_space());
+    ObjLoc setloc;
+    printstr<<"Someone wants to set my position: ";
+    setloc.ParseFromArray(args.data(), args.length());
+    if (thisObj) {
+        printstr<<setloc.position();
+        receivedPositionUpdate(thisObj, setloc, false);
+    }
+    return true;
+}
+
+bool HostedObject::processDelObj(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    ProxyObjectPtr thisObj = getProxy(msg.source_space());
+    SpaceDataMap::iterator perSpaceIter = mSpaceData->find(msg.source_space());
+    if (perSpaceIter == mSpaceData->end()) {
+        SILOG(objecthost, error, "DelObj message not for any known space.");
+        return false;
+    }
+    TopLevelSpaceConnection *proxyMgr =
+        perSpaceIter->second.mSpaceConnection.getTopLevelStream().get();
+    if (thisObj && proxyMgr) {
+        proxyMgr->unregisterHostedObject(thisObj->getObjectReference().object());
+    }
+    return true;
+}
+
+bool HostedObject::processResumeFailed(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    ProxyObjectPtr thisObj = getProxy(msg.source_space());
+    // The space forgot us while we were reconnecting: give up on it, as if we had not tried.
+    SpaceDataMap::iterator perSpaceIter = mSpaceData->find(msg.source_space());
+    if (msg.source_object() != ObjectReference::spaceServiceID() || perSpaceIter == mSpaceData->end()) {
+        SILOG(objecthost, error, "ResumeFailed message not for any known space.");
+        return false;
+    }
+    SILOG(objecthost, warning, "Space "<<msg.source_space()<<" could not resume "<<ObjectReference(getUUID()));
+    TopLevelSpaceConnection *proxyMgr =
+        perSpaceIter->second.mSpaceConnection.getTopLevelStream().get();
+    if (thisObj && proxyMgr) {
+        proxyMgr->unregisterHostedObject(thisObj->getObjectReference().object());
+    }
+    if (perSpaceIter->second.mShared && proxyMgr) {
+        proxyMgr->detachSharedStream(mInternalObjectReference);
+    }
+    mSpaceData->erase(perSpaceIter);
+    return true;
+}
+
+bool HostedObject::processMigrateObj(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    ProxyObjectPtr thisObj = getProxy(msg.source_space());
+    // Our region of the space is now hosted by another server: resume ourselves there, keeping our ObjectReference.
+    SpaceDataMap::iterator perSpaceIter = mSpaceData->find(msg.source_space());
+    if (msg.source_object() != ObjectReference::spaceServiceID() || perSpaceIter == mSpaceData->end() || !thisObj) {
+        SILOG(objecthost, error, "MigrateObj message not for any known space.");
+        return false;
+    }
+    Protocol::MigrateObj migrateObj;
+    migrateObj.ParseFromArray(args.data(), args.length());
+    String::size_type colon = migrateObj.has_address() ? migrateObj.address().rfind(':') : String::npos;
+    if (colon == String::npos || !migrateObj.has_resume_token()) {
+        SILOG(objecthost, error, "MigrateObj message without a server address and resume token.");
+        return false;
+    }
+    PerSpaceData &psd = perSpaceIter->second;
+    std::tr1::shared_ptr<TopLevelSpaceConnection> from(psd.mSpaceConnection.getTopLevelStream());
+    std::tr1::shared_ptr<TopLevelSpaceConnection> to(
+        mObjectHost->connectToSpaceAddress(msg.source_space(),
+                                           Network::Address(migrateObj.address().substr(0, colon),
+                                                            migrateObj.address().substr(colon + 1))));
+    if (to == from) {
+        return false;
+    }
+    const ObjectReference &objectId = thisObj->getObjectReference().object();
+    from->unregisterHostedObject(objectId);
+    if (psd.mShared) {
+        from->detachSharedStream(mInternalObjectReference);
+    } else if (psd.mSpaceConnection.getStream()) {
+        psd.mSpaceConnection.getStream()->close();
+    }
+    to->registerHostedObject(objectId, getSharedPtr());
+    psd.mResumable = true;
+    psd.mResumeToken = migrateObj.resume_token();
+    cloneTopLevelStream(msg.source_space(), to);
+    sendResumeObj(msg.source_space(), psd);
+    return true;
+}
+
+bool HostedObject::processRetObj(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    SpaceDataMap::iterator perSpaceIter = mSpaceData->find(msg.source_space());
+    if (msg.source_object() != ObjectReference::spaceServiceID()) {
+        SILOG(objecthost, error, "RetObj message not coming from space: "<<msg.source_object());
+        return false;
+    }
+    if (perSpaceIter == mSpaceData->end()) {
+        SILOG(objecthost, error, "RetObj message not for any known space.");
+        return false;
+    }
+    // getProxyManager() does not work because we have not yet created our ProxyObject.
+    TopLevelSpaceConnection *proxyMgr =
+        perSpaceIter->second.mSpaceConnection.getTopLevelStream().get();
+
+    Protocol::RetObj retObj;
+    retObj.ParseFromArray(args.data(), args.length());
+    if (retObj.has_object_reference() && retObj.has_location()) {
+        SpaceObjectReference objectId(msg.source_space(), ObjectReference(retObj.object_reference()));
+        ProxyObjectPtr proxyObj;
+        if (hasProperty("IsCamera")) {
+            printstr<<"RetObj: I am now a Camera known as "<<objectId.object();
+            proxyObj = ProxyObjectPtr(new ProxyCameraObject(proxyMgr, objectId));
+        } else if (hasProperty("LightInfo") && !hasProperty("MeshURI")) {
+            printstr<<"RetObj. I am now a Light known as "<<objectId.object();
+            proxyObj = ProxyObjectPtr(new ProxyLightObject(proxyMgr, objectId));
+        } else {
+            printstr<<"RetObj: I am now a Mesh known as "<<objectId.object();
+            proxyObj = ProxyObjectPtr(new ProxyMeshObject(proxyMgr, objectId));
         }
-        if (perSpaceIter == mSpaceData->end()) {
-            SILOG(objecthost, error, "RetObj message not for any known space.");
-            return;
+        proxyObj->setLocal(true);
+        perSpaceIter->second.mProxyObject = proxyObj;
+        if (retObj.has_compact_loc_format())
+            perSpaceIter->second.mCompactFormat = CompactLocationFormat::fromMessage(retObj.compact_loc_format());
+        if (retObj.has_resume_token()) {
+            perSpaceIter->second.mResumable = true;
+            perSpaceIter->second.mResumeToken = retObj.resume_token();
         }
-        // getProxyManager() does not work because we have not yet created our ProxyObject.
-        TopLevelSpaceConnection *proxyMgr =
-            perSpaceIter->second.mSpaceConnection.getTopLevelStream().get();
-
-        Protocol::RetObj retObj;
-        retObj.ParseFromArray(args.data(), args.length());
-        if (retObj.has_object_reference() && retObj.has_location()) {
-            SpaceObjectReference objectId(msg.source_space(), ObjectReference(retObj.object_reference()));
-            ProxyObjectPtr proxyObj;
-            if (hasProperty("IsCamera")) {
-                printstr<<"RetObj: I am now a Camera known as "<<objectId.object();
-                proxyObj = ProxyObjectPtr(new ProxyCameraObject(proxyMgr, objectId));
-            } else if (hasProperty("LightInfo") && !hasProperty("MeshURI")) {
-                printstr<<"RetObj. I am now a Light known as "<<objectId.object();
-                proxyObj = ProxyObjectPtr(new ProxyLightObject(proxyMgr, objectId));
-            } else {
-                printstr<<"RetObj: I am now a Mesh known as "<<objectId.object();
-                proxyObj = ProxyObjectPtr(new ProxyMeshObject(proxyMgr, objectId));
+        proxyMgr->registerHostedObject(objectId.object(), getSharedPtr());
+        receivedPositionUpdate(proxyObj, retObj.location(), true);
+        if (proxyMgr) {
+            proxyMgr->createObject(proxyObj);
+            ProxyCameraObject* cam = dynamic_cast<ProxyCameraObject*>(proxyObj.get());
+            if (cam) {
+                /* HACK: Because we have no method of scripting yet, we force
+                   any local camera we create to attach for convenience. */
+                cam->attach(String(), 0, 0);
+                uint32 my_query_id = query_id;
+                query_id++;
+                Protocol::NewProxQuery proxQuery;
+                proxQuery.set_query_id(my_query_id);
+                proxQuery.set_max_radius(1.0e+30);
+                String proxQueryStr;
+                proxQuery.SerializeToString(&proxQueryStr);
+                RoutableMessageBody body;
+                body.add_message("NewProxQuery", proxQueryStr);
+                String bodyStr;
+                body.SerializeToString(&bodyStr);
+                RoutableMessageHeader proxHeader;
+                proxHeader.set_destination_port(Services::GEOM);
+                proxHeader.set_destination_object(ObjectReference::spaceServiceID());
+                proxHeader.set_destination_space(objectId.space());
+                send(proxHeader, MemoryReference(bodyStr));
             }
-            proxyObj->setLocal(true);
-            perSpaceIter->second.mProxyObject = proxyObj;
-            proxyMgr->registerHostedObject(objectId.object(), getSharedPtr());
-            receivedPositionUpdate(proxyObj, retObj.location(), true);
-            if (proxyMgr) {
-                proxyMgr->createObject(proxyObj);
-                ProxyCameraObject* cam = dynamic_cast<ProxyCameraObject*>(proxyObj.get());
-                if (cam) {
-                    /* HACK: Because we have no method of scripting yet, we force
-                       any local camera we create to attach for convenience. */
-                    cam->attach(String(), 0, 0);
-                    uint32 my_query_id = query_id;
-                    query_id++;
-                    Protocol::NewProxQuery proxQuery;
-                    proxQuery.set_query_id(my_query_id);
-                    proxQuery.set_max_radius(1.0e+30);
-                    String proxQueryStr;
-                    proxQuery.SerializeToString(&proxQueryStr);
-                    RoutableMessageBody body;
-                    body.add_message("NewProxQuery", proxQueryStr);
-                    String bodyStr;
-                    body.SerializeToString(&bodyStr);
-                    RoutableMessageHeader proxHeader;
-                    proxHeader.set_destination_port(Services::GEOM);
-                    proxHeader.set_destination_object(ObjectReference::spaceServiceID());
-                    proxHeader.set_destination_space(objectId.space());
-                    send(proxHeader, MemoryReference(bodyStr));
-                }
-                for (PropertyMap::const_iterator iter = mProperties.begin();
-                        iter != mProperties.end();
-                        ++iter) {
-                    receivedPropertyUpdate(proxyObj, iter->first, iter->second);
+            for (PropertyStore::const_iterator iter = mProperties.begin();
+                    iter != mProperties.end();
+                    ++iter) {
+                if (iter->mPresent) {
+                    receivedPropertyUpdate(proxyObj, *iter->mName, iter->mValue);
                 }
             }
         }
     }
-    else if (name == "ProxCall") {
-        ObjectHostProxyManager *proxyMgr;
-        if (false && msg.source_object() != ObjectReference::spaceServiceID()) {
-            SILOG(objecthost, error, "ProxCall message not coming from space: "<<msg.source_object());
-            return;
-        }
-        if (!thisObj) {
-            SILOG(objecthost, error, "ProxCall message with null ProxyManager.");
-            return;
+    return true;
+}
+
+bool HostedObject::processProxCallBatch(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    // Unpack the batch so the proxy manager and scripts see the usual individual ProxCalls.
+    // Each call is passed on as the span of the batch it already occupies.
+    static const String proxCallName("ProxCall");
+    WireReader batch(args);
+    WireReader::Field call;
+    while (batch.next(call)) {
+        if (call.tag == Protocol::ProxCallBatch::calls_field_tag && call.type == WireReader::LENGTH_DELIMITED) {
+            processRPC(msg, proxCallName, call.bytes, NULL);
         }
+    }
+    return false;
+}
 
-        SpaceDataMap::iterator sditer = mSpaceData->find(msg.source_space());
-        assert (sditer != mSpaceData->end());
-        proxyMgr = sditer->second.mSpaceConnection.getTopLevelStream().get();
-
-        Protocol::ProxCall proxCall;
-        proxCall.ParseFromArray(args.data(), args.length());
-        SpaceObjectReference proximateObjectId (msg.source_space(), ObjectReference(proxCall.proximate_object()));
-        ProxyObjectPtr proxyObj (proxyMgr->getProxyObject(proximateObjectId));
-        switch (proxCall.proximity_event()) {
-          case Protocol::ProxCall::EXITED_PROXIMITY:
-            printstr<<"ProxCall EXITED "<<proximateObjectId.object();
-            if (proxyObj) {
-                PerSpaceData::ProxQueryMap::iterator iter = sditer->second.mProxQueryMap.find(proxCall.query_id());
-                if (iter != sditer->second.mProxQueryMap.end()) {
-                    std::set<ObjectReference>::iterator proxyiter = iter->second.find(proximateObjectId.object());
-                    assert (proxyiter != iter->second.end());
-                    if (proxyiter != iter->second.end()) {
-                        iter->second.erase(proxyiter);
-                    }
-                }
-                proxyMgr->destroyViewedObject(proxyObj->getObjectReference(), this->getTracker());
-            } else {
-                printstr<<" (unknown obj)";
-            }
-            break;
-          case Protocol::ProxCall::ENTERED_PROXIMITY:
-            printstr<<"ProxCall ENTERED "<<proximateObjectId.object();
-            {
-                PerSpaceData::ProxQueryMap::iterator iter =
-                    sditer->second.mProxQueryMap.insert(
-                        PerSpaceData::ProxQueryMap::value_type(proxCall.query_id(), std::set<ObjectReference>())
-                        ).first;
-                iter->second.insert(proximateObjectId.object());
-            }
-            if (!proxyObj) { // FIXME: We may get one of these for each prox query. Keep track of in-progress queries in ProxyManager.
-                printstr<<" (Requesting information...)";
+bool HostedObject::processProxCall(const RoutableMessageHeader &msg, MemoryReference args, String *response, std::ostream &printstr) {
+    ProxyObjectPtr thisObj = getProxy(msg.source_space());
+    ObjectHostProxyManager *proxyMgr;
+    if (false && msg.source_object() != ObjectReference::spaceServiceID()) {
+        SILOG(objecthost, error, "ProxCall message not coming from space: "<<msg.source_object());
+        return false;
+    }
+    if (!thisObj) {
+        SILOG(objecthost, error, "ProxCall message with null ProxyManager.");
+        return false;
+    }
 
-                {
-                    RPCMessage *locRequest = new RPCMessage(&mTracker);
-                    locRequest->header().set_destination_space(proximateObjectId.space());
-                    locRequest->header().set_destination_object(proximateObjectId.object());
-                    LocRequest loc;
-                    loc.SerializeToString(locRequest->body().add_message("LocRequest"));
-
-                    locRequest->setCallback(std::tr1::bind(&PrivateCallbacks::receivedProxObjectLocation,
-                                                        getWeakPtr(), _1, _2, _3,
-                                                        proxCall.query_id()));
-                    locRequest->setTimeout(Duration::seconds(5.0));
-                    locRequest->serializeSend();
+    SpaceDataMap::iterator sditer = mSpaceData->find(msg.source_space());
+    assert (sditer != mSpaceData->end());
+    proxyMgr = sditer->second.mSpaceConnection.getTopLevelStream().get();
+
+    ProxCallView proxCall;
+    proxCall.ParseFromArray(args);
+    SpaceObjectReference proximateObjectId (msg.source_space(), ObjectReference(proxCall.proximate_object()));
+    ProxyObjectPtr proxyObj (proxyMgr->getProxyObject(proximateObjectId));
+    switch (proxCall.proximity_event()) {
+      case ProxCallView::EXITED_PROXIMITY:
+        printstr<<"ProxCall EXITED "<<proximateObjectId.object();
+        if (proxyObj) {
+            PerSpaceData::ProxQueryMap::iterator iter = sditer->second.mProxQueryMap.find(proxCall.query_id());
+            if (iter != sditer->second.mProxQueryMap.end()) {
+                std::set<ObjectReference>::iterator proxyiter = iter->second.find(proximateObjectId.object());
+                assert (proxyiter != iter->second.end());
+                if (proxyiter != iter->second.end()) {
+                    iter->second.erase(proxyiter);
                 }
-            } else {
-                printstr<<" (Already known)";
-                proxyMgr->createViewedObject(proxyObj, this->getTracker());
             }
-            break;
-          case Protocol::ProxCall::STATELESS_PROXIMITY:
-            printstr<<"ProxCall Stateless'ed "<<proximateObjectId.object();
-            // Do not create a proxy object in this case: This message is for one-time queries
+            proxyMgr->destroyViewedObject(proxyObj->getObjectReference(), this->getTracker());
+        } else {
+            printstr<<" (unknown obj)";
+        }
+        break;
+      case ProxCallView::ENTERED_PROXIMITY:
+        printstr<<"ProxCall ENTERED "<<proximateObjectId.object();
+        {
+            PerSpaceData::ProxQueryMap::iterator iter =
+                sditer->second.mProxQueryMap.insert(
+                    PerSpaceData::ProxQueryMap::value_type(proxCall.query_id(), std::set<ObjectReference>())
+                    ).first;
+            iter->second.insert(proximateObjectId.object());
+        }
+        if (proxCall.has_aggregate()) {
+            Protocol::ProxAggregate aggregate;
+            if (aggregate.ParseFromArray(proxCall.aggregate().data(), proxCall.aggregate().size())) {
+                printstr<<" (aggregate of "<<aggregate.member_count()<<")";
+                PrivateCallbacks::receivedProxAggregate(this, proxyMgr, proximateObjectId, proxyObj, aggregate);
+            }
             break;
         }
-    } else {
-        printstr<<"Message to be handled in script: "<<name;
-    }
-    SILOG(cppoh,debug,printstr.str());
-    if (mObjectScript) {
-        MemoryBuffer returnCopy;
-        mObjectScript->processRPC(msg, name, args, returnCopy);
-        if (response) {
-            response->reserve(returnCopy.size());
-            std::copy(returnCopy.begin(), returnCopy.end(),
-                      std::insert_iterator<std::string>(*response, response->begin()));
+        if (!proxyObj) { // FIXME: We may get one of these for each prox query. Keep track of in-progress queries in ProxyManager.
+            printstr<<" (Requesting information...)";
+
+            {
+                RPCMessage *locRequest = new RPCMessage(&mTracker);
+                locRequest->header().set_destination_space(proximateObjectId.space());
+                locRequest->header().set_destination_object(proximateObjectId.object());
+                LocRequest loc;
+                if (sditer->second.mCompactFormat.sectorSize() > 0)
+                    loc.set_compact(true);
+                loc.SerializeToString(locRequest->body().add_message("LocRequest"));
+
+                locRequest->setCallback(std::tr1::bind(&PrivateCallbacks::receivedProxObjectLocation,
+                                                    getWeakPtr(), _1, _2, _3,
+                                                    proxCall.query_id()));
+                locRequest->setTimeout(Duration::seconds(5.0));
+                locRequest->serializeSend();
+            }
+        } else {
+            printstr<<" (Already known)";
+            proxyMgr->createViewedObject(proxyObj, this->getTracker());
         }
+        break;
+      case ProxCallView::STATELESS_PROXIMITY:
+        printstr<<"ProxCall Stateless'ed "<<proximateObjectId.object();
+        // Do not create a proxy object in this case: This message is for one-time queries
+        break;
     }
+    return true;
 }
 
 void HostedObject::receivedPropertyUpdate(
@@ -1166,6 +1751,9 @@ void HostedObject::receivedPropertyUpdate(
             case Protocol::PhysicalParameters::CHARACTER:
                 params.mode = PhysicalParameters::Character;
                 break;
+            case Protocol::PhysicalParameters::DYNAMICMESH:
+                params.mode = PhysicalParameters::DynamicMesh;
+                break;
             default:
                 params.mode = PhysicalParameters::Disabled;
             }
@@ -44,6 +44,7 @@
 #include "oh/ObjectScriptManager.hpp"
 #include "oh/ObjectScript.hpp"
 #include "oh/ObjectScriptManagerFactory.hpp"
+#include "oh/ScriptTickScheduler.hpp"
 
 
 namespace Sirikata {
@@ -60,6 +61,16 @@ ObjectHost::ObjectHost(SpaceIDMap *spaceMap, Task::WorkQueue *messageQueue, Netw
     mSpaceIDMap = spaceMap;
     mMessageQueue = messageQueue;
     mSpaceConnectionIO=ioServ;
+    mBatchSpaceMessages=false;
+    mLocationErrorThreshold=0;
+    mCompactLocations=false;
+    mResumeSpaceSessions=false;
+    mObjectLaneQueue=NULL;
+    mProxyFullRadius=0;
+    mProxyMinAngularSize=0;
+    mSharedSpaceStreams=0;
+    mRegistrationBatchSize=0;
+    mScriptTicks=new ScriptTickScheduler;
     static std::auto_ptr<AtomicInt> gEnqueuers;
     mEnqueuers = new AtomicInt(0,gEnqueuers);
     std::auto_ptr<AtomicInt> tmp(mEnqueuers);
@@ -81,19 +92,57 @@ ObjectHost::~ObjectHost() {
         mHostedObjects.swap(objs);
         objs.clear(); // The HostedObject destructor will attempt to delete from mHostedObjects
     }
+    delete mScriptTicks;
 }
 
-class ObjectHost::MessageProcessor : public Task::WorkItem {
+/// Hands a message to its HostedObject on the object's own WorkLane.
+class LaneDelivery : public Task::WorkItem, public Memory::Accounted<Memory::MESSAGES> {
+    HostedObjectWPtr mDest;
+    RoutableMessageHeader mHeader;
+    std::string mBody;
+    size_t mAccountedBody;
+public:
+    LaneDelivery(const HostedObjectPtr &dest, const RoutableMessageHeader&header, std::string&body)
+        : mDest(dest), mHeader(header) {
+        mBody.swap(body);
+        mAccountedBody = mBody.capacity();
+        Memory::adjust(Memory::MESSAGES, (int64)mAccountedBody);
+    }
+    ~LaneDelivery() {
+        Memory::adjust(Memory::MESSAGES, -(int64)mAccountedBody);
+    }
+    void operator() () {
+        AutoPtr delete_me(this);
+        HostedObjectPtr dest(mDest.lock());
+        if (dest) {
+            dest->processRoutableMessage(mHeader, MemoryReference(mBody));
+        }
+    }
+};
+
+class ObjectHost::MessageProcessor : public Task::WorkItem, public Memory::Accounted<Memory::MESSAGES> {
     ObjectHost *parent;
     RoutableMessageHeader header;
     std::string body;
+    size_t accountedBody; ///< body's bytes as counted towards Memory::MESSAGES
 public:
     MessageProcessor(ObjectHost *parent,
                      const RoutableMessageHeader&header,
                      MemoryReference message_body)
         : parent(parent), header(header), body((char*)message_body.begin(), (char*)message_body.end()) {
+        accountedBody = body.capacity();
+        Memory::adjust(Memory::MESSAGES, (int64)accountedBody);
+    }
+    MessageProcessor(ObjectHost *parent,
+                     const RoutableMessageHeader&header,
+                     String&message_body)
+        : parent(parent), header(header) {
+        body.swap(message_body);
+        accountedBody = body.capacity();
+        Memory::adjust(Memory::MESSAGES, (int64)accountedBody);
     }
     ~MessageProcessor() {
+        Memory::adjust(Memory::MESSAGES, -(int64)accountedBody);
     }
 
     void operator() () {
@@ -112,7 +161,12 @@ public:
             } else {
                 HostedObjectPtr dest = parent->getHostedObject(header.destination_object().getAsUUID());
                 if (dest) {
-                    dest->processRoutableMessage(header, MemoryReference(body));
+                    Task::WorkLane *lane = dest->getWorkLane();
+                    if (lane) {
+                        lane->enqueue(new LaneDelivery(dest, header, body));
+                    } else {
+                        dest->processRoutableMessage(header, MemoryReference(body));
+                    }
                     return;
                 }
                 status = RoutableMessageHeader::UNKNOWN_OBJECT;
@@ -179,30 +233,40 @@ void ObjectHost::processMessage(const RoutableMessageHeader&header, MemoryRefere
     if (++mEnqueuers>0) {
         Task::WorkQueue *queue = mMessageQueue;
         if (queue) {
-            queue->enqueue(new MessageProcessor(this, header, message_body));
+            queue->enqueuePriority(new MessageProcessor(this, header, message_body), Task::PRIORITY_HIGH);
+        }
+    }
+    --mEnqueuers;
+}
+
+void ObjectHost::processMessage(const RoutableMessageHeader&header, String&message_body) {
+    assert(header.has_destination_object());
+    assert(header.has_source_object());
+    assert(!header.has_source_space() || header.source_space() == header.destination_space());
+    if (++mEnqueuers>0) {
+        Task::WorkQueue *queue = mMessageQueue;
+        if (queue) {
+            queue->enqueuePriority(new MessageProcessor(this, header, message_body), Task::PRIORITY_HIGH);
         }
     }
     --mEnqueuers;
 }
 
 void ObjectHost::registerHostedObject(const HostedObjectPtr &obj) {
-    mHostedObjects.insert(HostedObjectMap::value_type(obj->getUUID(), obj));
+    HostedObjectPtr &slot = mHostedObjects[mHostedObjectHandles.insert(obj->getUUID())];
+    if (!slot) {
+        slot = obj;
+    }
 }
 void ObjectHost::unregisterHostedObject(const UUID &objID) {
-    HostedObjectMap::iterator iter = mHostedObjects.find(objID);
-    if (iter != mHostedObjects.end()) {
-        mHostedObjects.erase(iter);
+    HandleTable<UUID>::Handle handle = mHostedObjectHandles.find(objID);
+    if (handle != HandleTable<UUID>::npos) {
+        mHostedObjects.reset(handle);
+        mHostedObjectHandles.erase(handle);
     }
 }
 HostedObjectPtr ObjectHost::getHostedObject(const UUID &id) const {
-    HostedObjectMap::const_iterator iter = mHostedObjects.find(id);
-    if (iter != mHostedObjects.end()) {
-//        HostedObjectPtr obj(iter->second.lock());
-//        assert(obj);
-//        return obj;
-        return iter->second;
-    }
-    return HostedObjectPtr();
+    return mHostedObjects.get(mHostedObjectHandles.find(id));
 }
 
 
@@ -220,6 +284,10 @@ std::tr1::shared_ptr<TopLevelSpaceConnection> ObjectHost::connectToSpace(const S
         SpaceConnectionMap::iterator where=mSpaceConnections.find(id);
         if ((where==mSpaceConnections.end())||((retval=where->second.lock())==NULL)) {
             std::tr1::shared_ptr<TopLevelSpaceConnection> temp(new TopLevelSpaceConnection(mSpaceConnectionIO));
+            temp->setInterestPolicy(mProxyFullRadius, mProxyMinAngularSize);
+            temp->setSharedStreams(mSharedSpaceStreams, mBatchSpaceMessages);
+            temp->setResumeSessions(mResumeSpaceSessions);
+            temp->setRegistrationBatchSize(mRegistrationBatchSize);
             temp->connect(temp,this,id);//inserts into mSpaceConnections and eventuallly mAddressConnections
             retval = temp;
             if (where==mSpaceConnections.end()) {
@@ -241,6 +309,10 @@ std::tr1::shared_ptr<TopLevelSpaceConnection> ObjectHost::connectToSpaceAddress(
         AddressConnectionMap::iterator where=mAddressConnections.find(addy);
         if ((where==mAddressConnections.end())||(!(retval=where->second.lock()))) {
             std::tr1::shared_ptr<TopLevelSpaceConnection> temp(new TopLevelSpaceConnection(mSpaceConnectionIO));
+            temp->setInterestPolicy(mProxyFullRadius, mProxyMinAngularSize);
+            temp->setSharedStreams(mSharedSpaceStreams, mBatchSpaceMessages);
+            temp->setResumeSessions(mResumeSpaceSessions);
+            temp->setRegistrationBatchSize(mRegistrationBatchSize);
             temp->connect(temp,this,id,addy);//inserts into mSpaceConnections and eventuallly mAddressConnections
             retval = temp;
             if (where==mAddressConnections.end()) {
@@ -285,6 +357,51 @@ void ObjectHost::removeTopLevelSpaceConnection(const SpaceID&id, const Network::
     }
 }
 
+void ObjectHost::setProxyInterest(float64 fullRadius, float32 minAngularSize) {
+    mProxyFullRadius = fullRadius;
+    mProxyMinAngularSize = minAngularSize;
+    boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);
+    for (SpaceConnectionMap::iterator iter = mSpaceConnections.begin(); iter != mSpaceConnections.end(); ++iter) {
+        std::tr1::shared_ptr<TopLevelSpaceConnection> spaceConnPtr = iter->second.lock();
+        if (spaceConnPtr) {
+            spaceConnPtr->setInterestPolicy(fullRadius, minAngularSize);
+        }
+    }
+}
+
+namespace {
+    ///held while scripts tick, so a script is not unregistered and deleted by another thread mid-tick
+    boost::recursive_mutex gScriptTickLock;
+}
+
+void ObjectHost::registerScriptTick(ObjectScript *script, const Duration&interval) {
+    boost::recursive_mutex::scoped_lock lock(gScriptTickLock);
+    mScriptTicks->add(script, interval);
+}
+
+void ObjectHost::unregisterScriptTick(ObjectScript *script) {
+    boost::recursive_mutex::scoped_lock lock(gScriptTickLock);
+    mScriptTicks->remove(script);
+}
+
+size_t ObjectHost::tickScripts(const Time&now, const Duration&budget) {
+    boost::recursive_mutex::scoped_lock lock(gScriptTickLock);
+    return mScriptTicks->tick(now, budget);
+}
+
+void ObjectHost::updateProxyInterest(const Time&now) {
+    if (mProxyFullRadius <= 0) {
+        return;
+    }
+    boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);
+    for (SpaceConnectionMap::iterator iter = mSpaceConnections.begin(); iter != mSpaceConnections.end(); ++iter) {
+        std::tr1::shared_ptr<TopLevelSpaceConnection> spaceConnPtr = iter->second.lock();
+        if (spaceConnPtr) {
+            spaceConnPtr->updateInterest(now);
+        }
+    }
+}
+
 ProxyManager *ObjectHost::getProxyManager(const SpaceID&space) const {
     SpaceConnectionMap::const_iterator iter = mSpaceConnections.find(space);
     if (iter != mSpaceConnections.end()) {
@@ -34,8 +34,23 @@
 #include "oh/ObjectHostProxyManager.hpp"
 #include "oh/ObjectHost.hpp"
 #include "oh/HostedObject.hpp"
+#include "oh/ProxyCameraObject.hpp"
+#include "oh/ProxyMeshObject.hpp"
 namespace Sirikata {
 
+namespace {
+/// Proxies already shown stay so until they are this much further out than it took to show them.
+const float32 DEMOTE_SLACK = 1.25f;
+/// How often updateInterest looks at the whole map.
+const Duration INTEREST_INTERVAL = Duration::milliseconds((int64)250);
+}
+
+ObjectHostProxyManager::ObjectHostProxyManager()
+    : mFullRadius(0),
+      mMinAngularSize(0),
+      mNextInterestUpdate(Time::null()) {
+}
+
 void ObjectHostProxyManager::initialize() {
 }
 void ObjectHostProxyManager::destroy() {
@@ -54,7 +69,11 @@ void ObjectHostProxyManager::createViewedObject(const ProxyObjectPtr &newObj, Qu
     std::pair<ProxyMap::iterator, bool> result = mProxyMap.insert(
         ProxyMap::value_type(newObj->getObjectReference().object(), newObj));
     if (result.second==true) {
-        notify(&ProxyCreationListener::createProxy,newObj);
+        // Local objects are always shown, as is everything until the first updateInterest found a camera.
+        if (mFullRadius <= 0 || newObj->isLocal() || mInterestViewers.empty() ||
+            isInteresting(newObj, Time::now(), 1.0f)) {
+            promote(result.first->second);
+        }
     }
     result.first->second.viewers.insert(viewer);
 }
@@ -67,7 +86,9 @@ void ObjectHostProxyManager::destroyViewedObject(const SpaceObjectReference &new
         viewiter = iter->second.viewers.find(viewer);
         if (viewiter == iter->second.viewers.end()) {
             iter->second.obj->destroy();
-            notify(&ProxyCreationListener::destroyProxy,iter->second.obj);
+            if (iter->second.tier == FULL_TIER) {
+                notify(&ProxyCreationListener::destroyProxy,iter->second.obj);
+            }
             mProxyMap.erase(iter);
         }
     }
@@ -97,4 +118,86 @@ ProxyObjectPtr ObjectHostProxyManager::getProxyObject(const SpaceObjectReference
     return ProxyObjectPtr();
 }
 
+void ObjectHostProxyManager::promote(ObjectHostProxyInfo &info) {
+    info.tier = FULL_TIER;
+    notify(&ProxyCreationListener::createProxy,info.obj);
+    // Listeners created just now have not seen where the object is.
+    info.obj->resetLocation(info.obj->getLastUpdated(), info.obj->getLastLocation());
+}
+
+void ObjectHostProxyManager::demote(ObjectHostProxyInfo &info) {
+    info.tier = LOCATION_TIER;
+    notify(&ProxyCreationListener::destroyProxy,info.obj);
+}
+
+bool ObjectHostProxyManager::isInteresting(const ProxyObjectPtr &obj, const Time&now, float32 slack) const {
+    Vector3d position = obj->globalLocation(now).getPosition();
+    float64 radius = 1.0;
+    ProxyMeshObject *mesh = dynamic_cast<ProxyMeshObject*>(obj.get());
+    if (mesh) {
+        const Vector3f &scale = mesh->getScale();
+        radius = std::max(scale.x, std::max(scale.y, scale.z));
+    }
+    float64 fullRadius = mFullRadius * slack;
+    float64 minAngularSize = mMinAngularSize / slack;
+    for (size_t i = 0; i < mInterestViewers.size(); ++i) {
+        float64 distance = (position - mInterestViewers[i]).length();
+        if (distance <= fullRadius || (minAngularSize > 0 && 2.0 * radius >= distance * minAngularSize)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ObjectHostProxyManager::setInterestPolicy(float64 fullRadius, float32 minAngularSize) {
+    mFullRadius = fullRadius;
+    mMinAngularSize = minAngularSize;
+    mNextInterestUpdate = Time::null();
+    if (mFullRadius <= 0) {
+        mInterestViewers.clear();
+        for (ProxyMap::iterator iter = mProxyMap.begin(); iter != mProxyMap.end(); ++iter) {
+            if (iter->second.tier != FULL_TIER) {
+                promote(iter->second);
+            }
+        }
+    }
+}
+
+void ObjectHostProxyManager::updateInterest(const Time&now) {
+    if (mFullRadius <= 0 || now < mNextInterestUpdate) {
+        return;
+    }
+    mNextInterestUpdate = now + INTEREST_INTERVAL;
+    mInterestViewers.clear();
+    for (ProxyMap::iterator iter = mProxyMap.begin(); iter != mProxyMap.end(); ++iter) {
+        if (iter->second.obj->isLocal() && dynamic_cast<ProxyCameraObject*>(iter->second.obj.get())) {
+            mInterestViewers.push_back(iter->second.obj->globalLocation(now).getPosition());
+        }
+    }
+    for (ProxyMap::iterator iter = mProxyMap.begin(); iter != mProxyMap.end(); ++iter) {
+        ObjectHostProxyInfo &info = iter->second;
+        if (info.obj->isLocal() || mInterestViewers.empty()) {
+            if (info.tier != FULL_TIER) {
+                promote(info);
+            }
+        } else if (info.tier == FULL_TIER) {
+            if (!isInteresting(info.obj, now, DEMOTE_SLACK)) {
+                demote(info);
+            }
+        } else if (isInteresting(info.obj, now, 1.0f)) {
+            promote(info);
+        }
+    }
+}
+
+ObjectHostProxyManager::ProxyTier ObjectHostProxyManager::getTier(const SpaceObjectReference &id) const {
+    if (id.space() == mSpaceID) {
+        ProxyMap::const_iterator iter = mProxyMap.find(id.object());
+        if (iter != mProxyMap.end()) {
+            return iter->second.tier;
+        }
+    }
+    return LOCATION_TIER;
+}
+
 }
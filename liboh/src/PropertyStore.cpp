@@ -0,0 +1,141 @@
+/*  Sirikata Object Host
+ *  PropertyStore.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include "oh/PropertyStore.hpp"
+#include <boost/thread/mutex.hpp>
+#include <set>
+#include <algorithm>
+
+namespace Sirikata {
+
+namespace {
+boost::mutex sNameTableMutex;
+std::set<String> sNameTable; ///< never shrinks, so the interned pointers stay valid
+
+bool entryBefore(const PropertyStore::Entry &entry, const String &name) {
+    return *entry.mName < name;
+}
+}
+
+PropertyStore::Name PropertyStore::intern(const String &name) {
+    boost::mutex::scoped_lock lock(sNameTableMutex);
+    return &*sNameTable.insert(name).first;
+}
+
+PropertyStore::EntryVector::iterator PropertyStore::lowerBound(const String &name) {
+    return std::lower_bound(mEntries.begin(), mEntries.end(), name, &entryBefore);
+}
+
+PropertyStore::EntryVector::const_iterator PropertyStore::lowerBound(const String &name) const {
+    return std::lower_bound(mEntries.begin(), mEntries.end(), name, &entryBefore);
+}
+
+const String *PropertyStore::get(const String &name) const {
+    EntryVector::const_iterator iter = lowerBound(name);
+    if (iter != mEntries.end() && iter->mPresent && *iter->mName == name) {
+        return &iter->mValue;
+    }
+    return NULL;
+}
+
+PropertyStore::Entry &PropertyStore::touch(const String &name, unsigned char dirty) {
+    EntryVector::iterator iter = lowerBound(name);
+    if (iter == mEntries.end() || *iter->mName != name) {
+        Entry entry;
+        entry.mName = intern(name);
+        entry.mDirty = CLEAN;
+        entry.mPresent = false;
+        iter = mEntries.insert(iter, entry);
+    }
+    if (iter->mDirty == CLEAN && dirty != CLEAN) {
+        ++mDirtyCount;
+    }
+    iter->mDirty |= dirty;
+    iter->mPresent = true;
+    return *iter;
+}
+
+String *PropertyStore::mutableValue(const String &name, unsigned char dirty) {
+    return &touch(name, dirty).mValue;
+}
+
+void PropertyStore::set(const String &name, const String &value, unsigned char dirty) {
+    const String *current = get(name);
+    if (current && *current == value) {
+        return;
+    }
+    touch(name, dirty).mValue = value;
+}
+
+void PropertyStore::unset(const String &name, unsigned char dirty) {
+    EntryVector::iterator iter = lowerBound(name);
+    if (iter == mEntries.end() || !iter->mPresent || *iter->mName != name) {
+        return;
+    }
+    if (dirty == CLEAN && iter->mDirty == CLEAN) {
+        mEntries.erase(iter);
+        return;
+    }
+    if (iter->mDirty == CLEAN) {
+        ++mDirtyCount;
+    }
+    iter->mDirty |= dirty;
+    iter->mPresent = false;
+    iter->mValue = String();
+}
+
+void PropertyStore::takeDirty(EntryVector &out) {
+    if (!mDirtyCount) {
+        return;
+    }
+    EntryVector::iterator kept = mEntries.begin();
+    for (EntryVector::iterator iter = mEntries.begin(); iter != mEntries.end(); ++iter) {
+        if (iter->mDirty != CLEAN) {
+            out.push_back(*iter);
+            iter->mDirty = CLEAN;
+        }
+        if (iter->mPresent) {
+            if (kept != iter) {
+                kept->mName = iter->mName;
+                kept->mValue.swap(iter->mValue);
+                kept->mDirty = CLEAN;
+                kept->mPresent = true;
+            }
+            ++kept;
+        }
+    }
+    mEntries.erase(kept, mEntries.end());
+    mDirtyCount = 0;
+}
+
+}
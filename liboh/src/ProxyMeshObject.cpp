@@ -38,6 +38,18 @@ ProxyMeshObject::ProxyMeshObject(ProxyManager *man, const SpaceObjectReference&i
     : ProxyObject(man, id), mScale(1,1,1) {
 }
 
+void ProxyMeshObject::listenerAdded(MeshListener *listener) {
+    if (mMeshURI != URI()) {
+        listener->meshChanged(mMeshURI);
+    }
+    if (mScale != Vector3f(1,1,1)) {
+        listener->setScale(mScale);
+    }
+    if (mPhysical.mode != PhysicalParameters::Disabled) {
+        listener->setPhysical(mPhysical);
+    }
+}
+
 void ProxyMeshObject::setMesh(const URI&meshFile) {
     mMeshURI = meshFile;
     MeshProvider::notify(&MeshListener::meshChanged,meshFile);
@@ -33,6 +33,7 @@
 #include <oh/Platform.hpp>
 #include <oh/ProxyObject.hpp>
 #include <util/Extrapolation.hpp>
+#include <util/SlabAllocator.hpp>
 #include <oh/PositionListener.hpp>
 #include <oh/ProxyManager.hpp>
 #include "ObjectHost_Sirikata.pbj.hpp"
@@ -54,16 +55,59 @@ ProxyObject::ProxyObject(ProxyManager *man, const SpaceObjectReference&id)
         mParentId(SpaceObjectReference::null()),
         mLocationAuthority(0) {
     mLocal = true;
+    mLocationSlot = mManager->getLocationTable().allocate();
+    mInLocationTable = true;
+    updateLocationTable();
 }
 
 ProxyObject::~ProxyObject() {}
 
+namespace {
+SlabAllocator &proxyAllocator() {
+    // Never destroyed: proxies held by other static objects may be deleted during exit.
+    static SlabAllocator *sAllocator = new SlabAllocator;
+    return *sAllocator;
+}
+}
+
+void *ProxyObject::operator new(size_t size) {
+    return proxyAllocator().allocate(size);
+}
+
+void ProxyObject::operator delete(void *data, size_t size) {
+    proxyAllocator().release(data, size);
+}
+
+void ProxyObject::updateLocationTable() {
+    if (mInLocationTable) {
+        mManager->getLocationTable().set(mLocationSlot, mLocation);
+    }
+}
+
+void ProxyObject::extrapolatePositionOrientation(TemporalValue<Location>::Time current,
+                                                 Vector3d &position, Quaternion &orientation) const {
+    const LocationTable &table = mManager->getLocationTable();
+    if (mInLocationTable && table.isCurrent(mLocationSlot, current)) {
+        position = table.position(mLocationSlot);
+        orientation = table.orientation(mLocationSlot);
+    } else {
+        Location loc (extrapolateLocation(current));
+        position = loc.getPosition();
+        orientation = loc.getOrientation();
+    }
+}
+
 void ProxyObject::setLocal(bool loc) {
     mLocal = loc;
 }
 
 void ProxyObject::destroy() {
     ProxyObjectProvider::notify(&ProxyObjectListener::destroyed);
+    // The object may outlive its ProxyManager after this, so let go of the slot now.
+    if (mInLocationTable) {
+        mInLocationTable = false;
+        mManager->getLocationTable().release(mLocationSlot);
+    }
     //FIXME mManager->notify(&ProxyCreationListener::destroyProxy);
 }
 
@@ -81,6 +125,7 @@ class IsLocationStatic {
 public:
     bool operator() (const Location&l) const {
         return l.getVelocity()==Vector3f(0.0,0.0,0.0)
+               &&l.getAcceleration()==Vector3f(0.0,0.0,0.0)
                &&(l.getAxisOfRotation()==Vector3f(0.0,0.0,0.0)
                   || l.getAngularSpeed()==0.0);
     }
@@ -119,6 +164,7 @@ void ProxyObject::setLocation(TemporalValue<Location>::Time timeStamp,
                               const Location&location) {
     mLocation.updateValue(timeStamp,
                           location);
+    updateLocationTable();
     PositionProvider::notify(&PositionListener::updateLocation, timeStamp, location);
 }
 
@@ -143,13 +189,27 @@ void ProxyObject::requestLocation(TemporalValue<Location>::Time timeStamp, const
         if (reqLoc.has_angular_speed()) {
             loc.setAngularSpeed(reqLoc.angular_speed());
         }
+        if (reqLoc.has_extrapolation()) {
+            setLocationBlend(reqLoc.extrapolation()==Protocol::ObjLoc::ACCELERATED ? HERMITE_BLEND : LINEAR_BLEND);
+        }
+        if (reqLoc.has_acceleration()) {
+            loc.setAcceleration(reqLoc.acceleration());
+        }
+        if (locationBlend()==LINEAR_BLEND) {
+            loc.setAcceleration(Vector3f(0,0,0));
+        }
         setLocation(timeStamp, loc);
     }
 }
+void ProxyObject::setLocationBlend(ExtrapolationBlend blend) {
+    mLocation.setBlend(blend);
+    updateLocationTable();
+}
 void ProxyObject::resetLocation(TemporalValue<Location>::Time timeStamp,
                                 const Location&location) {
     mLocation.resetValue(timeStamp,
                          location);
+    updateLocationTable();
     PositionProvider::notify(&PositionListener::resetLocation, timeStamp, location);
 }
 void ProxyObject::setParent(const ProxyObjectPtr &parent,
@@ -198,6 +258,7 @@ void ProxyObject::setParent(const ProxyObjectPtr &parent,
     */
     mLocation.resetValue(timeStamp, lastPosition.toLocal(newparentLastGlobal));
     mLocation.updateValue(timeStamp, relLocation);
+    updateLocationTable();
 
     PositionProvider::notify(&PositionListener::setParent,
                              parent,
@@ -223,6 +284,7 @@ void ProxyObject::unsetParent(TemporalValue<Location>::Time timeStamp,
 
     mLocation.resetValue(timeStamp, lastPosition);
     mLocation.updateValue(timeStamp, absLocation);
+    updateLocationTable();
 
     PositionProvider::notify(&PositionListener::unsetParent,
                              timeStamp,
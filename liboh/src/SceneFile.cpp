@@ -0,0 +1,176 @@
+/*  Sirikata Object Host
+ *  SceneFile.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <ObjectHost_Sirikata.pbj.hpp>
+#include "oh/SceneFile.hpp"
+
+namespace Sirikata {
+
+namespace {
+const char sSceneMagic[8]={'S','I','R','I','S','C','N','1'};
+
+uint32 readUint32(const unsigned char *data) {
+    return (uint32)data[0]|((uint32)data[1]<<8)|((uint32)data[2]<<16)|((uint32)data[3]<<24);
+}
+uint64 readUint64(const unsigned char *data) {
+    return (uint64)readUint32(data)|((uint64)readUint32(data+4)<<32);
+}
+float64 readFloat64(const unsigned char *data) {
+    uint64 bits=readUint64(data);
+    float64 value;
+    std::memcpy(&value,&bits,sizeof(value));
+    return value;
+}
+float32 readFloat32(const unsigned char *data) {
+    uint32 bits=readUint32(data);
+    float32 value;
+    std::memcpy(&value,&bits,sizeof(value));
+    return value;
+}
+/// Whether count records of size bytes at offset fit in a file of fileSize bytes
+bool fits(size_t fileSize, uint32 offset, uint32 count, size_t size) {
+    return offset<=fileSize&&(uint64)count*size<=(uint64)(fileSize-offset);
+}
+}
+
+SceneFile::SceneFile(const String &filename)
+    : mFile(filename), mNumObjects(0), mNumProperties(0), mNumStrings(0),
+      mObjects(NULL), mProperties(NULL), mStrings(NULL), mStringData(NULL), mStringDataSize(0),
+      mValid(false) {
+    const unsigned char *data=(const unsigned char*)mFile.data();
+    size_t size=mFile.size();
+    if (!data||size<HEADER_SIZE||std::memcmp(data,sSceneMagic,sizeof(sSceneMagic))!=0) {
+        return;
+    }
+    uint32 numObjects=readUint32(data+8);
+    uint32 numProperties=readUint32(data+12);
+    uint32 numStrings=readUint32(data+16);
+    uint32 objectsOffset=readUint32(data+20);
+    uint32 propertiesOffset=readUint32(data+24);
+    uint32 stringsOffset=readUint32(data+28);
+    if (!fits(size,objectsOffset,numObjects,OBJECT_SIZE)||
+        !fits(size,propertiesOffset,numProperties,PROPERTY_SIZE)||
+        !fits(size,stringsOffset,numStrings,8)) {
+        return;
+    }
+    mNumObjects=numObjects;
+    mNumProperties=numProperties;
+    mNumStrings=numStrings;
+    mObjects=data+objectsOffset;
+    mProperties=data+propertiesOffset;
+    mStrings=data+stringsOffset;
+    mStringData=(const char*)mStrings+(size_t)numStrings*8;
+    mStringDataSize=size-(stringsOffset+(size_t)numStrings*8);
+    mValid=checkStrings()&&checkObjects();
+    if (!mValid) {
+        mNumObjects=0;
+    }
+}
+
+bool SceneFile::checkStrings() const {
+    for (uint32 i=0;i<mNumStrings;++i) {
+        uint32 offset=readUint32(mStrings+(size_t)i*8);
+        uint32 length=readUint32(mStrings+(size_t)i*8+4);
+        if (offset>mStringDataSize||length>mStringDataSize-offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SceneFile::checkObjects() const {
+    uint32 lastProperty=0;
+    for (uint32 i=0;i<mNumObjects;++i) {
+        uint32 mesh=readUint32(object(i)+56);
+        uint32 firstProperty=readUint32(object(i)+60);
+        if ((mesh!=NO_STRING&&mesh>=mNumStrings)||firstProperty<lastProperty||firstProperty>mNumProperties) {
+            return false;
+        }
+        lastProperty=firstProperty;
+    }
+    for (uint32 i=0;i<mNumProperties;++i) {
+        if (readUint32(mProperties+(size_t)i*PROPERTY_SIZE)>=mNumStrings||
+            readUint32(mProperties+(size_t)i*PROPERTY_SIZE+4)>=mNumStrings) {
+            return false;
+        }
+    }
+    return true;
+}
+
+UUID SceneFile::objectID(uint32 which) const {
+    return UUID(object(which),UUID::static_size);
+}
+
+Vector3d SceneFile::position(uint32 which) const {
+    const unsigned char *data=object(which)+16;
+    return Vector3d(readFloat64(data),readFloat64(data+8),readFloat64(data+16));
+}
+
+Quaternion SceneFile::orientation(uint32 which) const {
+    const unsigned char *data=object(which)+40;
+    return Quaternion(readFloat32(data),readFloat32(data+4),readFloat32(data+8),readFloat32(data+12),Quaternion::XYZW());
+}
+
+String SceneFile::meshURI(uint32 which) const {
+    uint32 mesh=readUint32(object(which)+56);
+    if (mesh==NO_STRING) {
+        return String();
+    }
+    return String(mStringData+readUint32(mStrings+(size_t)mesh*8),readUint32(mStrings+(size_t)mesh*8+4));
+}
+
+void SceneFile::fields(uint32 which, std::map<String,String> &fields) const {
+    uint32 first=readUint32(object(which)+60);
+    uint32 last=which+1<mNumObjects?readUint32(object(which+1)+60):mNumProperties;
+    for (uint32 i=first;i<last;++i) {
+        const unsigned char *property=mProperties+(size_t)i*PROPERTY_SIZE;
+        uint32 name=readUint32(property);
+        uint32 value=readUint32(property+4);
+        fields[String(mStringData+readUint32(mStrings+(size_t)name*8),readUint32(mStrings+(size_t)name*8+4))]=
+            String(mStringData+readUint32(mStrings+(size_t)value*8),readUint32(mStrings+(size_t)value*8+4));
+    }
+    if (fields.find("Loc")==fields.end()) {
+        Protocol::ObjLoc loc;
+        loc.set_position(position(which));
+        loc.set_orientation(orientation(which));
+        loc.SerializeToString(&fields["Loc"]);
+    }
+    uint32 mesh=readUint32(object(which)+56);
+    if (mesh!=NO_STRING&&fields.find("MeshURI")==fields.end()) {
+        Protocol::StringProperty meshProperty;
+        meshProperty.set_value(meshURI(which));
+        meshProperty.SerializeToString(&fields["MeshURI"]);
+    }
+}
+
+}
@@ -0,0 +1,123 @@
+/*  Sirikata liboh -- Object Host
+ *  ScriptTickScheduler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <util/Time.hpp>
+#include <oh/ObjectScript.hpp>
+#include <oh/ScriptTickScheduler.hpp>
+
+namespace Sirikata {
+
+ScriptTickScheduler::ScriptTickScheduler()
+    : mCursor(mRing.end()), mTicking(false) {
+}
+
+void ScriptTickScheduler::add(ObjectScript *script, const Duration &interval) {
+    if (interval < Duration::seconds(0.)) {
+        remove(script);
+        return;
+    }
+    std::map<ObjectScript*, Ring::iterator>::iterator where = mEntries.find(script);
+    if (where != mEntries.end()) {
+        where->second->interval = interval;
+        return;
+    }
+    // New scripts go just behind the cursor, so they wait their turn in the rotation.
+    mEntries[script] = mRing.insert(mCursor, Entry(script, interval, Time::now()));
+}
+
+void ScriptTickScheduler::remove(ObjectScript *script) {
+    std::map<ObjectScript*, Ring::iterator>::iterator where = mEntries.find(script);
+    if (where == mEntries.end()) {
+        return;
+    }
+    Ring::iterator entry = where->second;
+    mEntries.erase(where);
+    if (mTicking) {
+        // tick() holds iterators into the ring; it sweeps the entry out when done.
+        entry->script = NULL;
+    } else {
+        erase(entry);
+    }
+}
+
+void ScriptTickScheduler::erase(Ring::iterator where) {
+    if (mCursor == where) {
+        ++mCursor;
+    }
+    mRing.erase(where);
+}
+
+size_t ScriptTickScheduler::tick(const Time &now, const Duration &budget) {
+    if (mRing.empty()) {
+        return 0;
+    }
+    if (mCursor == mRing.end()) {
+        mCursor = mRing.begin();
+    }
+    mTicking = true;
+    Time deadline = now + budget;
+    size_t ticked = 0, skipped = 0;
+    Ring::iterator iter = mCursor;
+    Ring::iterator resume = mRing.end();
+    for (size_t visited = 0, n = mRing.size(); visited < n; ++visited) {
+        if (iter == mRing.end()) {
+            iter = mRing.begin();
+        }
+        Ring::iterator current = iter++;
+        if (current->script == NULL || now < current->due) {
+            continue;
+        }
+        if (ticked && Time::now() >= deadline) {
+            if (resume == mRing.end()) {
+                resume = current;
+            }
+            ++skipped;
+            continue;
+        }
+        // Late scripts are not ticked twice to catch up.
+        current->due = now + current->interval;
+        ++ticked;
+        current->script->tick();
+    }
+    mTicking = false;
+    mCursor = (resume == mRing.end()) ? iter : resume;
+    for (Ring::iterator sweep = mRing.begin(); sweep != mRing.end();) {
+        Ring::iterator current = sweep++;
+        if (current->script == NULL) {
+            erase(current);
+        }
+    }
+    return skipped;
+}
+
+}
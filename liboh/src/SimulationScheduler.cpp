@@ -0,0 +1,153 @@
+/*  Sirikata liboh -- Object Host
+ *  SimulationScheduler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <util/Time.hpp>
+#include <oh/TimeSteppedSimulation.hpp>
+#include <oh/SimulationScheduler.hpp>
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+
+class SimulationScheduler::SteppingThread {
+    TimeSteppedSimulation *mSimulation;
+    boost::mutex mMutex;
+    boost::condition_variable mCondition;
+    bool mStepping;
+    bool mQuit;
+    bool mUnpublished; ///< a step finished whose results publish() has not handed out
+    Time mNextStep;
+    boost::thread *mThread;
+
+    void run() {
+        boost::mutex::scoped_lock lock(mMutex);
+        while (true) {
+            while (!mStepping && !mQuit) {
+                mCondition.wait(lock);
+            }
+            if (!mStepping) {
+                return;
+            }
+            lock.unlock();
+            mSimulation->step();
+            lock.lock();
+            mStepping = false;
+        }
+    }
+public:
+    SteppingThread(TimeSteppedSimulation *sim)
+        : mSimulation(sim),
+          mStepping(false),
+          mQuit(false),
+          mUnpublished(false),
+          mNextStep(Time::null()) {
+        mThread = new boost::thread(std::tr1::bind(&SteppingThread::run, this));
+    }
+    ~SteppingThread() {
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            mQuit = true;
+            mCondition.notify_one();
+        }
+        mThread->join();
+        delete mThread;
+    }
+    /// Publishes a finished step and starts the next once it is due. \returns false to quit
+    bool poll(const Time &now) {
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            if (mStepping) {
+                return true;
+            }
+        }
+        bool continue_simulation = true;
+        if (mUnpublished) {
+            mUnpublished = false;
+            continue_simulation = mSimulation->publish();
+        }
+        if (continue_simulation && now >= mNextStep) {
+            mSimulation->snapshot();
+            mNextStep = now + mSimulation->desiredTickRate();
+            mUnpublished = true;
+            boost::mutex::scoped_lock lock(mMutex);
+            mStepping = true;
+            mCondition.notify_one();
+        }
+        return continue_simulation;
+    }
+    Time nextStep() const {
+        return mNextStep;
+    }
+};
+
+SimulationScheduler::SimulationScheduler(bool parallel)
+    : mParallel(parallel) {
+}
+
+SimulationScheduler::~SimulationScheduler() {
+    for (size_t i = 0; i < mThreads.size(); ++i) {
+        delete mThreads[i];
+    }
+}
+
+void SimulationScheduler::add(TimeSteppedSimulation *sim) {
+    mSimulations.push_back(sim);
+    mThreads.push_back(mParallel && sim->canStepInParallel() ? new SteppingThread(sim) : NULL);
+    mLastTicks.push_back(Time::null());
+}
+
+bool SimulationScheduler::tick() {
+    Time now = Time::now();
+    bool continue_simulation = true;
+    for (size_t i = 0; i < mSimulations.size() && continue_simulation; ++i) {
+        if (mThreads[i]) {
+            continue_simulation = mThreads[i]->poll(now);
+        } else {
+            continue_simulation = mSimulations[i]->tick();
+            mLastTicks[i] = now;
+        }
+    }
+    return continue_simulation;
+}
+
+Time SimulationScheduler::nextDeadline() const {
+    Time deadline = Time::null();
+    for (size_t i = 0; i < mSimulations.size(); ++i) {
+        Time due = mThreads[i] ? mThreads[i]->nextStep() : mLastTicks[i] + mSimulations[i]->desiredTickRate();
+        if (i == 0 || due < deadline) {
+            deadline = due;
+        }
+    }
+    return deadline;
+}
+
+}
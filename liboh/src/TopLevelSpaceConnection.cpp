@@ -30,9 +30,14 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <oh/Platform.hpp>
+#include <ObjectHost_Sirikata.pbj.hpp>
 #include <util/SpaceID.hpp>
 #include <network/Stream.hpp>
 #include <network/StreamFactory.hpp>
+#include <network/IOServiceFactory.hpp>
+#include "util/RoutableMessage.hpp"
+#include "util/RoutableMessageHeaderView.hpp"
+#include "util/KnownServices.hpp"
 #include "oh/SpaceConnection.hpp"
 #include "oh/TopLevelSpaceConnection.hpp"
 #include "oh/SpaceIDMap.hpp"
@@ -40,28 +45,37 @@
 #include "oh/HostedObject.hpp"
 
 namespace Sirikata {
-namespace {
-void connectionStatus(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus,Network::Stream::ConnectionStatus status,const std::string&reason){
+
+void TopLevelSpaceConnection::connectionStatus(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus,uint32 generation,Network::Stream::ConnectionStatus status,const std::string&reason){
     std::tr1::shared_ptr<TopLevelSpaceConnection>thus=weak_thus.lock();
-    if (thus) {
-        if (status!=Network::Stream::Connected) {//won't get this error until lookup returns
+    if (thus&&generation==thus->mGeneration) {//a stream replaced by reconnect() has nothing more to say
+        if (status==Network::Stream::Connected) {
+            thus->mTopLevelConnected=true;
+        }else {//won't get this error until lookup returns
             thus->remoteDisconnection(reason);
         }
     }
 }
-}
 
 TopLevelSpaceConnection::TopLevelSpaceConnection(Network::IOService*io):mRegisteredAddress(Network::Address::null()) {
     mParent=NULL;
+    mIO=io;
+    mResumeSessions=false;
+    mGeneration=0;
+    mTopLevelConnected=false;
+    mNumSharedStreams=0;
+    mBatchSharedStreams=false;
+    mRegistrationBatchSize=0;
     mTopLevelStream=Network::StreamFactory::getSingleton().getDefaultConstructor()(io);
     ObjectHostProxyManager::initialize();
 }
 void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConnection>&thus, ObjectHost * oh,  const SpaceID & id) {
     mSpaceID=id;
+    mWeakThis=thus;
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
     mTopLevelStream->prepareOutboundConnection(&Network::Stream::ignoreSubstreamCallback,
-                                               std::tr1::bind(&connectionStatus, thus,_1,_2),                                               
+                                               std::tr1::bind(&connectionStatus, thus,mGeneration,_1,_2),                                               
                                                &Network::Stream::ignoreBytesReceived);
     oh->spaceIDMap()->lookup(id,std::tr1::bind(&TopLevelSpaceConnection::connectToAddress,thus,oh,_1));
 }
@@ -70,11 +84,13 @@ void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConn
 void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConnection>&thus, ObjectHost * oh,  const SpaceID & id, const Network::Address&addy) {
     mSpaceID=id;
     mParent=oh;
+    mWeakThis=thus;
+    mRegisteredAddress=addy;
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
     mTopLevelStream->connect(addy,
                              &Network::Stream::ignoreSubstreamCallback,
-                             std::tr1::bind(&connectionStatus, thus,_1,_2),                                               
+                             std::tr1::bind(&connectionStatus, thus,mGeneration,_1,_2),                                               
                              &Network::Stream::ignoreBytesReceived);
 }
 
@@ -83,6 +99,9 @@ void TopLevelSpaceConnection::removeFromMap() {
 }
 void TopLevelSpaceConnection::remoteDisconnection(const std::string&reason) {
     if (mParent) {
+        if (reconnect(mGeneration)) {
+            return;
+        }
         removeFromMap();//FIXME: is it possible for an object host to connect at exactly this time
         //maybe resolution is to connect nowhere?
         Network::Stream *topLevel=mTopLevelStream;
@@ -96,6 +115,7 @@ void TopLevelSpaceConnection::connectToAddress(const std::tr1::weak_ptr<TopLevel
     if (thus) {
         thus->mParent=oh;
         if (addy) {
+            thus->mRegisteredAddress=*addy;
             thus->mTopLevelStream->connect(*addy);
             oh->insertAddressMapping(*addy,thus);
         }else {
@@ -103,8 +123,45 @@ void TopLevelSpaceConnection::connectToAddress(const std::tr1::weak_ptr<TopLevel
         }
     }
 }
+bool TopLevelSpaceConnection::reconnect(uint32 generation) {
+    if (!mResumeSessions||!mTopLevelStream||mRegisteredAddress==Network::Address::null()) {
+        return false;
+    }
+    if (generation==mGeneration) {
+        if (!mTopLevelConnected) {
+            return false;//the space never answered this connection either
+        }
+        SILOG(objecthost,info,"Reconnecting to space "<<mSpaceID<<" to resume its objects");
+        for (size_t i=0;i<mRetiredStreams.size();++i) {
+            delete mRetiredStreams[i];
+        }
+        mRetiredStreams.clear();
+        {
+            boost::mutex::scoped_lock lock(mSharedStreamMutex);
+            mRetiredStreams.insert(mRetiredStreams.end(),mSharedStreams.begin(),mSharedStreams.end());
+            mSharedStreams.clear();//the first object to attach again clones new ones
+            ++mGeneration;
+        }
+        mRetiredStreams.push_back(mTopLevelStream);
+        mTopLevelConnected=false;
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        mTopLevelStream=Network::StreamFactory::getSingleton().getDefaultConstructor()(mIO);
+        mTopLevelStream->connect(mRegisteredAddress,
+                                 &Network::Stream::ignoreSubstreamCallback,
+                                 std::tr1::bind(&connectionStatus, mWeakThis,mGeneration,_1,_2),
+                                 &Network::Stream::ignoreBytesReceived);
+    }
+    return true;
+}
 TopLevelSpaceConnection::~TopLevelSpaceConnection() {
     ObjectHostProxyManager::destroy();
+    for (size_t i=0;i<mSharedStreams.size();++i) {
+        delete mSharedStreams[i];//their callbacks point at this
+    }
+    for (size_t i=0;i<mRetiredStreams.size();++i) {
+        delete mRetiredStreams[i];//substreams ahead of the top level stream they came from
+    }
     if (mParent) {
         removeFromMap();
         delete mTopLevelStream;
@@ -112,23 +169,225 @@ TopLevelSpaceConnection::~TopLevelSpaceConnection() {
 }
 
 void TopLevelSpaceConnection::registerHostedObject(const ObjectReference &mRef, const HostedObjectPtr &hostedObj) {
-    mHostedObjects.insert(HostedObjectMap::value_type(mRef, hostedObj));
+    HostedObjectWPtr &slot = mHostedObjects[mHostedObjectHandles.insert(mRef)];
+    if (slot.expired()) {
+        slot = hostedObj;
+    }
 }
 void TopLevelSpaceConnection::unregisterHostedObject(const ObjectReference &mRef) {
-    HostedObjectMap::iterator iter = mHostedObjects.find(mRef);
-    assert (iter != mHostedObjects.end());
-    if (iter != mHostedObjects.end()) {
-        mHostedObjects.erase(iter);
+    HandleTable<ObjectReference>::Handle handle = mHostedObjectHandles.find(mRef);
+    assert (handle != HandleTable<ObjectReference>::npos);
+    if (handle != HandleTable<ObjectReference>::npos) {
+        mHostedObjects.reset(handle);
+        mHostedObjectHandles.erase(handle);
     }
 }
 HostedObjectPtr TopLevelSpaceConnection::getHostedObject(const ObjectReference &mref) const {
-    HostedObjectMap::const_iterator iter = mHostedObjects.find(mref);
-    if (iter != mHostedObjects.end()) {
-        HostedObjectPtr obj(iter->second.lock());
+    HandleTable<ObjectReference>::Handle handle = mHostedObjectHandles.find(mref);
+    if (handle != HandleTable<ObjectReference>::npos) {
+        HostedObjectPtr obj(mHostedObjects.get(handle).lock());
         assert(obj);
         return obj;
     }
     return HostedObjectPtr();
 }
 
+void TopLevelSpaceConnection::setSharedStreams(uint32 count, bool batch) {
+    boost::mutex::scoped_lock lock(mSharedStreamMutex);
+    mNumSharedStreams=count;
+    mBatchSharedStreams=batch;
+}
+
+void TopLevelSpaceConnection::sendConnectionOptions(Network::Stream*stream, const RoutableMessageBody&options, const UUID*key) {
+    RoutableMessageHeader optionsHeader;
+    optionsHeader.set_destination_object(ObjectReference::spaceServiceID());
+    optionsHeader.set_destination_port(Services::OBJECT_CONNECTIONS);
+    if (key) {
+        optionsHeader.set_source_object(ObjectReference(*key));
+    }
+    String serializedHeader;
+    optionsHeader.SerializeToString(&serializedHeader);
+    String serializedOptions;
+    options.SerializeToString(&serializedOptions);
+    stream->send(MemoryReference(serializedHeader),MemoryReference(serializedOptions),Network::ReliableOrdered);
+}
+
+Network::Stream *TopLevelSpaceConnection::attachSharedStream(const UUID&key,
+                                                             const Network::Stream::ConnectionCallback&connectionCallback,
+                                                             const Network::Stream::BytesReceivedCallback&bytesReceivedCallback) {
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    boost::mutex::scoped_lock lock(mSharedStreamMutex);
+    if (mSharedStreams.empty()) {
+        RoutableMessageBody options;
+        options.add_message("MultiplexObjects");//must reach the space before any object's messages do
+        if (mBatchSharedStreams) {
+            options.add_message("EnableBatching");
+        }
+        for (uint32 i=0;i<mNumSharedStreams;++i) {
+            Network::Stream*stream=mTopLevelStream->clone(std::tr1::bind(&TopLevelSpaceConnection::sharedStreamConnectionEvent,this,mGeneration,(size_t)i,_1,_2),
+                                                         std::tr1::bind(&TopLevelSpaceConnection::sharedStreamReceived,this,_1));
+            sendConnectionOptions(stream,options,NULL);
+            mSharedStreams.push_back(stream);
+        }
+    }
+    SharedStreamObject&object=mSharedStreamObjects[key];
+    object.mStream=UUID::Hasher()(key)%mSharedStreams.size();
+    object.mConnectionCallback=connectionCallback;
+    object.mBytesReceivedCallback=bytesReceivedCallback;
+    return mSharedStreams[object.mStream];
+}
+
+void TopLevelSpaceConnection::detachSharedStream(const UUID&key) {
+    boost::mutex::scoped_lock lock(mSharedStreamMutex);
+    SharedStreamObjectMap::iterator where=mSharedStreamObjects.find(key);
+    if (where!=mSharedStreamObjects.end()) {
+        RoutableMessageBody options;
+        options.add_message("DetachObject");
+        sendConnectionOptions(mSharedStreams[where->second.mStream],options,&key);
+        mSharedStreamObjects.erase(where);
+    }
+}
+
+bool TopLevelSpaceConnection::queueRegistration(const UUID&key, const String&newObj) {
+    boost::mutex::scoped_lock lock(mSharedStreamMutex);
+    SharedStreamObjectMap::const_iterator where;
+    if (mRegistrationBatchSize==0||(where=mSharedStreamObjects.find(key))==mSharedStreamObjects.end()) {
+        return false;
+    }
+    if (mPendingRegistrations.empty()) {
+        Network::IOServiceFactory::dispatchServiceMessage(mIO,std::tr1::bind(&TopLevelSpaceConnection::flushRegistrations,mWeakThis));
+    }
+    mPendingRegistrations.push_back(PendingRegistration());
+    mPendingRegistrations.back().mStream=where->second.mStream;
+    mPendingRegistrations.back().mKey=key;
+    mPendingRegistrations.back().mNewObj=newObj;
+    if (mPendingRegistrations.size()>=mRegistrationBatchSize) {
+        sendRegistrations();
+    }
+    return true;
+}
+
+void TopLevelSpaceConnection::flushRegistrations(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus) {
+    std::tr1::shared_ptr<TopLevelSpaceConnection>thus=weak_thus.lock();
+    if (thus) {
+        boost::mutex::scoped_lock lock(thus->mSharedStreamMutex);
+        thus->sendRegistrations();
+    }
+}
+
+void TopLevelSpaceConnection::sendRegistrations() {
+    RoutableMessageHeader registrationHeader;//no source_object: the batch belongs to the whole substream
+    registrationHeader.set_destination_object(ObjectReference::spaceServiceID());
+    registrationHeader.set_destination_port(Services::REGISTRATION);
+    String serializedHeader;
+    registrationHeader.SerializeToString(&serializedHeader);
+    std::vector<Protocol::NewObjBatch> batches(mSharedStreams.size());
+    for (size_t i=0;i<mPendingRegistrations.size();++i) {
+        const PendingRegistration&pending=mPendingRegistrations[i];
+        if (pending.mStream<batches.size()) {
+            batches[pending.mStream].add_object_keys(pending.mKey);
+            batches[pending.mStream].add_objects().ParseFromString(pending.mNewObj);
+        }
+    }
+    mPendingRegistrations.clear();
+    for (size_t i=0;i<batches.size();++i) {
+        if (batches[i].object_keys_size()) {
+            RoutableMessageBody body;
+            batches[i].SerializeToString(body.add_message("NewObjBatch"));
+            String serializedBody;
+            body.SerializeToString(&serializedBody);
+            mSharedStreams[i]->send(MemoryReference(serializedHeader),MemoryReference(serializedBody),Network::ReliableOrdered);
+        }
+    }
+}
+
+void TopLevelSpaceConnection::sharedStreamConnectionEvent(uint32 generation, size_t which, Network::Stream::ConnectionStatus status, const std::string&reason) {
+    std::vector<Network::Stream::ConnectionCallback> callbacks;
+    {
+        boost::mutex::scoped_lock lock(mSharedStreamMutex);
+        if (generation!=mGeneration) {
+            return;//its objects have moved to the stream reconnect() made
+        }
+        for (SharedStreamObjectMap::const_iterator iter=mSharedStreamObjects.begin();iter!=mSharedStreamObjects.end();++iter) {
+            if (iter->second.mStream==which) {
+                callbacks.push_back(iter->second.mConnectionCallback);
+            }
+        }
+    }
+    // Called without the lock, since objects may detach on hearing they are disconnected.
+    for (size_t i=0;i<callbacks.size();++i) {
+        callbacks[i](status,reason);
+    }
+}
+
+void TopLevelSpaceConnection::sharedStreamReceived(const Network::Chunk&chunk) {
+    sharedMessageReceived(MemoryReference(chunk),&chunk);
+}
+
+void TopLevelSpaceConnection::sharedMessageReceived(MemoryReference message, const Network::Chunk*whole) {
+    RoutableMessageHeaderView header;
+    MemoryReference bodyData=header.ParseFromArray(message);
+    if (header.has_destination_object()) {
+        Network::Stream::BytesReceivedCallback callback;
+        {
+            boost::mutex::scoped_lock lock(mSharedStreamMutex);
+            SharedStreamObjectMap::const_iterator where=mSharedStreamObjects.find(header.destination_object().getAsUUID());
+            if (where!=mSharedStreamObjects.end()) {
+                callback=where->second.mBytesReceivedCallback;
+            }
+        }
+        if (!callback) {
+            SILOG(objecthost,debug,"Message for detached object "<<header.destination_object()<<" on shared stream to "<<mSpaceID);
+        }else if (whole) {
+            callback(*whole);
+        }else {
+            callback(Network::Chunk((const uint8*)message.data(),(const uint8*)message.data()+message.size()));
+        }
+    }else if (!header.has_source_object() && header.source_port() == Services::OBJECT_CONNECTIONS) {
+        // A batch for any of the objects on the stream: each whole message is preceded by its length.
+        const uint8 *data = (const uint8*)bodyData.data();
+        size_t remaining = bodyData.size();
+        while (remaining) {
+            Network::Stream::uint30 length;
+            unsigned int lengthSize = remaining < Network::Stream::uint30::MAX_SERIALIZED_LENGTH ? remaining : Network::Stream::uint30::MAX_SERIALIZED_LENGTH;
+            if (!length.unserialize(data, lengthSize) || length.read() > remaining - lengthSize) {
+                SILOG(objecthost,error,"Malformed message batch from space "<<mSpaceID);
+                return;
+            }
+            sharedMessageReceived(MemoryReference(data + lengthSize, length.read()), NULL);
+            data += lengthSize + length.read();
+            remaining -= lengthSize + length.read();
+        }
+    }else if (header.source_port() == Services::REGISTRATION) {
+        registrationBatchReceived(bodyData);
+    }else {
+        SILOG(objecthost,warning,"Dropping message without an object key on shared stream to "<<mSpaceID);
+    }
+}
+
+void TopLevelSpaceConnection::registrationBatchReceived(MemoryReference body) {
+    // The reply to a NewObjBatch: each object gets its RetObj in a message of its own, as if it had registered alone.
+    RoutableMessageBody batch;
+    Protocol::RetObjBatch keys;
+    if (!batch.ParseFromArray(body.data(),body.size())||batch.message_size()==0||batch.message_names(0)!="RetObjBatch"||
+        !keys.ParseFromString(batch.message_arguments(0))) {
+        SILOG(objecthost,error,"Malformed registration batch from space "<<mSpaceID);
+        return;
+    }
+    RoutableMessageHeader retObjHeader;
+    retObjHeader.set_source_object(ObjectReference::spaceServiceID());
+    retObjHeader.set_source_port(Services::REGISTRATION);
+    for (int i=1;i<batch.message_size()&&i<=keys.object_keys_size();++i) {
+        retObjHeader.set_destination_object(ObjectReference(keys.object_keys(i-1)));
+        RoutableMessageBody retObj;
+        retObj.add_message(batch.message_names(i),batch.message_arguments(i));
+        String message,serializedRetObj;
+        retObjHeader.SerializeToString(&message);
+        retObj.SerializeToString(&serializedRetObj);
+        message+=serializedRetObj;
+        sharedMessageReceived(MemoryReference(message),NULL);
+    }
+}
+
 }
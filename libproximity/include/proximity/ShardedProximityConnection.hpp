@@ -0,0 +1,117 @@
+/*  Sirikata Proximity Library
+ *  ShardedProximityConnection.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _PROXIMITY_SHARDEDPROXIMITYCONNECTION_HPP_
+#define _PROXIMITY_SHARDEDPROXIMITYCONNECTION_HPP_
+#include "proximity/ProximityConnection.hpp"
+namespace Sirikata { namespace Network {
+class Stream;
+class IOService;
+} }
+
+namespace Sirikata { namespace Proximity {
+
+/**
+ * Spreads the objects and queries of a space over several proximity servers, each answering for one slab of the world along x.
+ * An object is registered with the server of its slab and with any other whose slab is within the margin of it, so objects
+ * near a boundary are on both sides. Queries go to every server whose slab they reach and follow relative queries about
+ * as their object moves. The ProxCalls that come back are merged, so an object seen by several servers enters and exits
+ * a query once. Stateless queries are answered, unmerged, by the servers the object is registered with already
+ */
+class SIRIKATA_PROXIMITY_EXPORT ShardedProximityConnection :public ProximityConnection{
+public:
+    enum {
+        MAX_SHARDS=32
+    };
+private:
+    class QueryRecord {
+    public:
+        ///the NewProxQuery as the object sent it
+        String mNewProxQuery;
+        bool mAbsolute;
+        Vector3d mCenter;
+        Vector3f mOffset;
+        ///negative for queries bounded only by solid angle, which go to every server
+        double mRadius;
+        ///bit per server the query is registered with
+        uint32 mShards;
+        ///bit per server reporting each proximate object as in the query
+        typedef std::tr1::unordered_map<UUID,uint32,UUID::Hasher> ResultMap;
+        ResultMap mResults;
+    };
+    class ObjectRecord {
+    public:
+        ///the RetObj the object registered with, its location kept up to date for servers it is registered with later
+        String mRetObj;
+        Vector3d mPosition;
+        ///bit per server the object is registered with
+        uint32 mShards;
+        std::vector<Network::Stream*> mStreams;
+        typedef std::map<uint32,QueryRecord> QueryMap;
+        QueryMap mQueries;
+        ObjectRecord():mPosition(0,0,0),mShards(0){}
+    };
+    typedef std::tr1::unordered_map<ObjectReference,ObjectRecord,ObjectReference::Hasher> ObjectMap;
+    ObjectMap mObjects;
+    MessageService *mParent;
+    std::vector<std::tr1::shared_ptr<Network::Stream> > mShardStreams;
+    double mMinX;
+    double mSlabWidth;
+    double mMargin;
+    ///servers whose slabs overlap [minX,maxX]
+    uint32 shardsBetween(double minX, double maxX)const;
+    uint32 queryShards(const ObjectRecord&record, const QueryRecord&query)const;
+    void sendToShard(const ObjectReference&object, ObjectRecord&record, uint32 shard, const String&name, const String&argument);
+    ///registers the object with, and withdraws it from, servers so it is on all those its position and queries need
+    void updateShards(const ObjectReference&object, ObjectRecord&record);
+    ///forgets what shard reported for query, returning ProxCalls for every object no server reports any more
+    void dropShardResults(QueryRecord&query, uint32 queryId, uint32 shard, RoutableMessageBody&exits);
+    void mergeProxCall(ObjectRecord&record, uint32 shard, uint32 queryId, const UUID&proximateObject, bool entered, RoutableMessageBody&merged);
+    static void readShardMessage(const std::tr1::weak_ptr<Network::Stream>&lock,
+                                 ShardedProximityConnection*thus,
+                                 uint32 shard,
+                                 const ObjectReference&object,
+                                 const Network::Chunk&chunk);
+public:
+    static ProximityConnection* create(Network::IOService*, const String&options);
+    ShardedProximityConnection(Network::IOService*io, const String&options);
+    ~ShardedProximityConnection();
+    void streamDisconnected();
+    bool forwardMessagesTo(MessageService*parent);
+    bool endForwardingMessagesTo(MessageService*parent);
+    void constructObjectStream(const ObjectReference&obc);
+    void deleteObjectStream(const ObjectReference&obc);
+    void processMessage(const RoutableMessageHeader&,
+                        MemoryReference message_body);
+};
+
+} }
+#endif
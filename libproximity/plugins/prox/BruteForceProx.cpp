@@ -31,13 +31,13 @@
  */
 #include "proximity/Platform.hpp"
 #include "util/ObjectReference.hpp"
-#include "prox/BruteForceQueryHandler.hpp"
 #include "Prox_Sirikata.pbj.hpp"
 #include "proximity/ProximitySystem.hpp"
 #include "ProxBridge.hpp"
 #include "BruteForceProx.hpp"
 namespace Sirikata { namespace Proximity {
 ProximitySystem*BruteForceProx::create(Network::IOService*io,const String&options,const ProximitySystem::Callback&callback){
-    return new ProxBridge(*io,options,new Prox::BruteForceQueryHandler(),callback);
+    //the bridge picks its query handler from the options, defaulting to brute force
+    return new ProxBridge(*io,options,NULL,callback);
 }
 } }
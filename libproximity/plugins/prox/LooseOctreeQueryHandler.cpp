@@ -0,0 +1,348 @@
+/*  Sirikata Proximity Management -- Prox Plugin
+ *  LooseOctreeQueryHandler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "proximity/Platform.hpp"
+#include "LooseOctreeQueryHandler.hpp"
+namespace Sirikata { namespace Proximity {
+
+LooseOctreeQueryHandler::Node::Node(Node*parent, const Prox::Vector3f&center, float halfExtent)
+ : mParent(parent),mCenter(center),mHalfExtent(halfExtent),mMaxRadius(0) {
+    for (int i=0;i<8;++i) mChildren[i]=NULL;
+}
+LooseOctreeQueryHandler::Node::~Node() {
+    for (int i=0;i<8;++i) delete mChildren[i];
+}
+bool LooseOctreeQueryHandler::Node::empty()const {
+    if (!mObjects.empty()) return false;
+    for (int i=0;i<8;++i)
+        if (mChildren[i]) return false;
+    return true;
+}
+
+LooseOctreeQueryHandler::LooseOctreeQueryHandler(float rootHalfExtent, unsigned int maxDepth, bool incremental, float enterBand, float exitBand)
+ : mRoot(new Node(NULL,Prox::Vector3f(0,0,0),rootHalfExtent)),
+   mMaxDepth(maxDepth),
+   mIncremental(incremental),
+   mEnterScale(1.f-std::min(std::max(enterBand,0.f),.99f)),
+   mExitScale(1.f+std::max(exitBand,0.f)),
+   mStructureChanged(false),
+   mLastTime(0) {
+}
+
+LooseOctreeQueryHandler::~LooseOctreeQueryHandler() {
+    for(ObjectMap::iterator it=mObjects.begin();it!=mObjects.end();++it) {
+        it->second->mObject->removeChangeListener(this);
+        delete it->second;
+    }
+    mObjects.clear();
+    for(QueryMap::iterator it=mQueries.begin();it!=mQueries.end();++it) {
+        it->first->removeChangeListener(this);
+        delete it->second;
+    }
+    mQueries.clear();
+    delete mRoot;
+}
+
+unsigned int LooseOctreeQueryHandler::childIndex(const Node*node, const Prox::Vector3f&pos) {
+    return (pos.x>=node->mCenter.x?1:0)|(pos.y>=node->mCenter.y?2:0)|(pos.z>=node->mCenter.z?4:0);
+}
+
+bool LooseOctreeQueryHandler::contains(const Node*node, const Prox::Vector3f&pos) {
+    Prox::Vector3f delta=pos-node->mCenter;
+    return fabs(delta.x)<=node->mHalfExtent&&fabs(delta.y)<=node->mHalfExtent&&fabs(delta.z)<=node->mHalfExtent;
+}
+
+bool LooseOctreeQueryHandler::fits(const Node*node, const ObjectEntry*entry)const {
+    if (node->mParent==NULL) {
+        //the root catches everything outside its bounds and everything too large for its children
+        return mMaxDepth==0||entry->mRadius>node->mHalfExtent*.5f||!contains(node,entry->mCenter);
+    }
+    return entry->mRadius<=node->mHalfExtent&&contains(node,entry->mCenter);
+}
+
+void LooseOctreeQueryHandler::insert(ObjectEntry*entry) {
+    Node*node=mRoot;
+    if (contains(mRoot,entry->mCenter)) {
+        //descend while the child cell is still at least as large as the object, since loose cells extend by half their width in every direction
+        for (unsigned int depth=0;depth<mMaxDepth&&entry->mRadius<=node->mHalfExtent*.5f;++depth) {
+            unsigned int index=childIndex(node,entry->mCenter);
+            if (node->mChildren[index]==NULL) {
+                float childHalf=node->mHalfExtent*.5f;
+                Prox::Vector3f childCenter(node->mCenter.x+((index&1)?childHalf:-childHalf),
+                                           node->mCenter.y+((index&2)?childHalf:-childHalf),
+                                           node->mCenter.z+((index&4)?childHalf:-childHalf));
+                node->mChildren[index]=new Node(node,childCenter,childHalf);
+            }
+            node=node->mChildren[index];
+        }
+    }
+    node->mObjects.push_back(entry);
+    entry->mNode=node;
+    for (Node*n=node;n&&n->mMaxRadius<entry->mRadius;n=n->mParent) {
+        n->mMaxRadius=entry->mRadius;
+    }
+}
+
+void LooseOctreeQueryHandler::remove(ObjectEntry*entry) {
+    Node*node=entry->mNode;
+    if (node) {
+        std::vector<ObjectEntry*>::iterator where=std::find(node->mObjects.begin(),node->mObjects.end(),entry);
+        if (where!=node->mObjects.end()) {
+            *where=node->mObjects.back();
+            node->mObjects.pop_back();
+        }
+        entry->mNode=NULL;
+    }
+}
+
+bool LooseOctreeQueryHandler::refresh(Node*node) {
+    float maxRadius=0;
+    for (std::vector<ObjectEntry*>::const_iterator i=node->mObjects.begin(),ie=node->mObjects.end();i!=ie;++i) {
+        if ((*i)->mRadius>maxRadius) maxRadius=(*i)->mRadius;
+    }
+    for (int i=0;i<8;++i) {
+        Node*child=node->mChildren[i];
+        if (child) {
+            if (refresh(child)) {
+                delete child;
+                node->mChildren[i]=NULL;
+            }else if (child->mMaxRadius>maxRadius) {
+                maxRadius=child->mMaxRadius;
+            }
+        }
+    }
+    node->mMaxRadius=maxRadius;
+    return node->mParent!=NULL&&node->empty();
+}
+
+bool LooseOctreeQueryHandler::isMoving(const Prox::MotionVector3f&motion) {
+    Prox::Vector3f velocity=motion.velocity();
+    return velocity.x!=0||velocity.y!=0||velocity.z!=0;
+}
+
+void LooseOctreeQueryHandler::markDirty(ObjectEntry*entry) {
+    if (!entry->mDirty) {
+        entry->mDirty=true;
+        mDirtyObjects.push_back(entry);
+    }
+}
+
+void LooseOctreeQueryHandler::relocate(ObjectEntry*entry, const Prox::Time&t) {
+    entry->mCenter=entry->mObject->position(t)+entry->mObject->bounds().center();
+    if (!fits(entry->mNode,entry)) {
+        remove(entry);
+        insert(entry);
+        mStructureChanged=true;
+    }
+}
+
+void LooseOctreeQueryHandler::registerObject(Prox::Object* obj) {
+    ObjectEntry*entry=new ObjectEntry;
+    entry->mObject=obj;
+    entry->mCenter=obj->position(mLastTime)+obj->bounds().center();
+    entry->mRadius=obj->bounds().radius();
+    mObjects[obj]=entry;
+    insert(entry);
+    markDirty(entry);
+    if (isMoving(obj->position()))
+        mMovingObjects.insert(entry);
+    obj->addChangeListener(this);
+}
+
+void LooseOctreeQueryHandler::registerQuery(Prox::Query* query) {
+    mQueries[query]=new QueryState;
+    query->addChangeListener(this);
+}
+
+bool LooseOctreeQueryHandler::satisfies(const ObjectEntry*entry, const Prox::Query*query, const Prox::Vector3f&queryPos, float scale) {
+    Prox::Vector3f to_obj=entry->mCenter-queryPos;
+    float to_obj_len=to_obj.length();
+    float radius=entry->mRadius*scale;
+    if (to_obj_len-radius>query->radius()*scale)
+        return false;
+    //a larger object at the same distance subtends a larger solid angle, which widens the angle test by scale squared
+    return to_obj_len<=radius||Prox::SolidAngle::fromCenterRadius(to_obj,radius)>=query->angle();
+}
+
+void LooseOctreeQueryHandler::evaluate(const Node*node, const Prox::Query*query, const Prox::Vector3f&queryPos, const ResultSet&previous, ResultSet&results)const {
+    if (node->mParent) {
+        //distance from the query to the loose bounds of this cell, which are twice the size of the tight bounds
+        float loose=node->mHalfExtent*2.f;
+        Prox::Vector3f delta=queryPos-node->mCenter;
+        float dx=std::max(0.f,(float)fabs(delta.x)-loose);
+        float dy=std::max(0.f,(float)fabs(delta.y)-loose);
+        float dz=std::max(0.f,(float)fabs(delta.z)-loose);
+        float dist=sqrt(dx*dx+dy*dy+dz*dz);
+        //pruned with the exit band, the widest either test uses
+        float maxRadius=node->mMaxRadius*mExitScale;
+        if (dist>maxRadius) {
+            if (dist-maxRadius>query->radius()*mExitScale)
+                return;
+            if (Prox::SolidAngle::fromCenterRadius(Prox::Vector3f(dist,0,0),maxRadius)<query->angle())
+                return;
+        }
+    }
+    for (std::vector<ObjectEntry*>::const_iterator i=node->mObjects.begin(),ie=node->mObjects.end();i!=ie;++i) {
+        if (satisfies(*i,query,queryPos,previous.find(*i)!=previous.end()?mExitScale:mEnterScale))
+            results.insert(*i);
+    }
+    for (int i=0;i<8;++i) {
+        if (node->mChildren[i])
+            evaluate(node->mChildren[i],query,queryPos,previous,results);
+    }
+}
+
+void LooseOctreeQueryHandler::tick(const Prox::Time& t) {
+    //the objects whose relationship to unmoved queries may have changed since the last tick
+    std::vector<ObjectEntry*> changed;
+    if (mIncremental) {
+        changed.swap(mDirtyObjects);
+        for (std::tr1::unordered_set<ObjectEntry*>::iterator it=mMovingObjects.begin();it!=mMovingObjects.end();++it) {
+            if (!(*it)->mDirty)
+                changed.push_back(*it);
+        }
+        for (std::vector<ObjectEntry*>::iterator it=changed.begin();it!=changed.end();++it) {
+            (*it)->mDirty=false;
+            relocate(*it,t);
+        }
+    }else {
+        for (std::vector<ObjectEntry*>::iterator it=mDirtyObjects.begin();it!=mDirtyObjects.end();++it)
+            (*it)->mDirty=false;
+        mDirtyObjects.clear();
+        for(ObjectMap::iterator it=mObjects.begin();it!=mObjects.end();++it)
+            relocate(it->second,t);
+    }
+    if (mStructureChanged||!mIncremental) {
+        refresh(mRoot);
+        mStructureChanged=false;
+    }
+    for(QueryMap::iterator query_it=mQueries.begin();query_it!=mQueries.end();++query_it) {
+        Prox::Query*query=query_it->first;
+        QueryState*state=query_it->second;
+        Prox::Vector3f queryPos=query->position(t);
+        if (!mIncremental||state->mDirty||isMoving(query->position())) {
+            ResultSet results;
+            evaluate(mRoot,query,queryPos,state->mResults,results);
+            state->mResults.swap(results);
+            state->mDirty=false;
+            state->mChanged=true;
+        }else {
+            for (std::vector<ObjectEntry*>::const_iterator it=changed.begin();it!=changed.end();++it) {
+                bool inResults=state->mResults.find(*it)!=state->mResults.end();
+                if (satisfies(*it,query,queryPos,inResults?mExitScale:mEnterScale)!=inResults) {
+                    if (inResults)
+                        state->mResults.erase(*it);
+                    else
+                        state->mResults.insert(*it);
+                    state->mChanged=true;
+                }
+            }
+        }
+        if (state->mChanged) {
+            Prox::QueryCache newcache;
+            for (ResultSet::const_iterator it=state->mResults.begin();it!=state->mResults.end();++it)
+                newcache.add((*it)->mObject->id());
+            std::deque<Prox::QueryEvent> events;
+            state->mCache.exchange(newcache,&events);
+            query->pushEvents(events);
+            state->mCache=newcache;
+            state->mChanged=false;
+        }
+    }
+    mLastTime=t;
+}
+
+unsigned int LooseOctreeQueryHandler::numObjects() const {
+    return (unsigned int)mObjects.size();
+}
+unsigned int LooseOctreeQueryHandler::numQueries() const {
+    return (unsigned int)mQueries.size();
+}
+
+void LooseOctreeQueryHandler::objectPositionUpdated(Prox::Object* obj, const Prox::MotionVector3f& old_pos, const Prox::MotionVector3f& new_pos) {
+    //relocation is deferred to tick, where the extrapolated position is known
+    ObjectMap::iterator where=mObjects.find(obj);
+    if (where!=mObjects.end()) {
+        ObjectEntry*entry=where->second;
+        markDirty(entry);
+        if (isMoving(new_pos))
+            mMovingObjects.insert(entry);
+        else
+            mMovingObjects.erase(entry);
+    }
+}
+
+void LooseOctreeQueryHandler::objectBoundsUpdated(Prox::Object* obj, const Prox::BoundingSphere3f& old_bounds, const Prox::BoundingSphere3f& new_bounds) {
+    ObjectMap::iterator where=mObjects.find(obj);
+    if (where!=mObjects.end()) {
+        ObjectEntry*entry=where->second;
+        entry->mRadius=new_bounds.radius();
+        remove(entry);
+        insert(entry);
+        markDirty(entry);
+        mStructureChanged=true;
+    }
+}
+
+void LooseOctreeQueryHandler::objectDeleted(const Prox::Object* obj) {
+    ObjectMap::iterator where=mObjects.find(obj);
+    if (where!=mObjects.end()) {
+        ObjectEntry*entry=where->second;
+        for(QueryMap::iterator it=mQueries.begin();it!=mQueries.end();++it) {
+            if (it->second->mResults.erase(entry))
+                it->second->mChanged=true;
+        }
+        if (entry->mDirty) {
+            mDirtyObjects.erase(std::find(mDirtyObjects.begin(),mDirtyObjects.end(),entry));
+        }
+        mMovingObjects.erase(entry);
+        remove(entry);
+        delete entry;
+        mObjects.erase(where);
+        mStructureChanged=true;
+    }
+}
+
+void LooseOctreeQueryHandler::queryPositionUpdated(Prox::Query* query, const Prox::MotionVector3f& old_pos, const Prox::MotionVector3f& new_pos) {
+    QueryMap::iterator where=mQueries.find(query);
+    if (where!=mQueries.end())
+        where->second->mDirty=true;
+}
+
+void LooseOctreeQueryHandler::queryDeleted(const Prox::Query* query) {
+    QueryMap::iterator where=mQueries.find(const_cast<Prox::Query*>(query));
+    if (where!=mQueries.end()) {
+        delete where->second;
+        mQueries.erase(where);
+    }
+}
+
+} }
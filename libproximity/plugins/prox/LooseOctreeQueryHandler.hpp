@@ -0,0 +1,154 @@
+/*  Sirikata Proximity Management -- Prox Plugin
+ *  LooseOctreeQueryHandler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _PROXIMITY_LOOSE_OCTREE_QUERY_HANDLER_HPP
+#define _PROXIMITY_LOOSE_OCTREE_QUERY_HANDLER_HPP
+#include "prox/QueryHandler.hpp"
+#include "prox/QueryCache.hpp"
+#include "prox/Object.hpp"
+#include "prox/Query.hpp"
+namespace Sirikata { namespace Proximity {
+
+/**
+ * A Prox::QueryHandler that keeps objects in a loose octree so each query only
+ * visits the cells that could possibly satisfy its radius and solid angle.
+ * Objects are placed at the depth matching their bounding radius and are only
+ * relocated when their extrapolated position leaves their cell, so static
+ * objects cost nothing beyond a containment check per tick.
+ *
+ * In incremental mode only objects that received a position or bounds update
+ * since the last tick, or that are moving, are re-checked against queries that
+ * have not moved themselves.  Unchanged queries skip the tick entirely.
+ *
+ * Results have hysteresis: an object must come within the query's radius and
+ * solid angle shrunk by the enter band before it is reported, and is only
+ * removed once it leaves them grown by the exit band, so objects hovering at
+ * the edge of a query do not flicker in and out.
+ */
+class LooseOctreeQueryHandler : public Prox::QueryHandler {
+public:
+    /**
+     * \param rootHalfExtent is half the edge length of the root cell; objects outside of it still work but are tested against every query
+     * \param maxDepth limits how many levels below the root objects may be placed
+     * \param incremental restricts each tick to the objects and queries that changed since the previous one
+     * \param enterBand and exitBand are the fractions the distances a query reaches are shrunk by to enter it and grown by to stay in it
+     */
+    LooseOctreeQueryHandler(float rootHalfExtent=4096.f, unsigned int maxDepth=10, bool incremental=false, float enterBand=0.f, float exitBand=0.f);
+    virtual ~LooseOctreeQueryHandler();
+
+    virtual void registerObject(Prox::Object* obj);
+    virtual void registerQuery(Prox::Query* query);
+    virtual void tick(const Prox::Time& t);
+
+    virtual unsigned int numObjects() const;
+    virtual unsigned int numQueries() const;
+
+    // ObjectChangeListener Implementation
+    virtual void objectPositionUpdated(Prox::Object* obj, const Prox::MotionVector3f& old_pos, const Prox::MotionVector3f& new_pos);
+    virtual void objectBoundsUpdated(Prox::Object* obj, const Prox::BoundingSphere3f& old_bounds, const Prox::BoundingSphere3f& new_bounds);
+    virtual void objectDeleted(const Prox::Object* obj);
+
+    // QueryChangeListener Implementation
+    virtual void queryPositionUpdated(Prox::Query* query, const Prox::MotionVector3f& old_pos, const Prox::MotionVector3f& new_pos);
+    virtual void queryDeleted(const Prox::Query* query);
+private:
+    class Node;
+    class ObjectEntry {
+    public:
+        Prox::Object* mObject;
+        Node* mNode;
+        Prox::Vector3f mCenter;
+        float mRadius;
+        ///set when the object is on mDirtyObjects for the coming tick
+        bool mDirty;
+        ObjectEntry():mObject(NULL),mNode(NULL),mRadius(0),mDirty(false) {}
+    };
+    typedef std::tr1::unordered_set<const ObjectEntry*> ResultSet;
+    class Node {
+    public:
+        Node* mParent;
+        Node* mChildren[8];
+        Prox::Vector3f mCenter;
+        float mHalfExtent;
+        ///largest object radius anywhere below this node, refreshed once per tick
+        float mMaxRadius;
+        std::vector<ObjectEntry*> mObjects;
+        Node(Node*parent, const Prox::Vector3f&center, float halfExtent);
+        ~Node();
+        bool empty()const;
+    };
+    class QueryState {
+    public:
+        Prox::QueryCache mCache;
+        ResultSet mResults;
+        ///the query moved or is new, so it must be fully evaluated
+        bool mDirty;
+        ///mResults differs from mCache and events need to be generated
+        bool mChanged;
+        QueryState():mDirty(true),mChanged(false) {}
+    };
+    typedef std::tr1::unordered_map<const Prox::Object*,ObjectEntry*> ObjectMap;
+    typedef std::map<Prox::Query*,QueryState*> QueryMap;
+
+    void insert(ObjectEntry*entry);
+    void remove(ObjectEntry*entry);
+    static bool contains(const Node*node, const Prox::Vector3f&pos);
+    bool fits(const Node*node, const ObjectEntry*entry)const;
+    static unsigned int childIndex(const Node*node, const Prox::Vector3f&pos);
+    ///recomputes mMaxRadius bottom up and frees empty leaves, returns true if node can be deleted
+    bool refresh(Node*node);
+    ///scale multiplies the query radius and the object radius, widening the query for scales over 1
+    static bool satisfies(const ObjectEntry*entry, const Prox::Query*query, const Prox::Vector3f&queryPos, float scale);
+    static bool isMoving(const Prox::MotionVector3f&motion);
+    ///previous holds the results from the last tick, which are held to the exit band rather than the enter band
+    void evaluate(const Node*node, const Prox::Query*query, const Prox::Vector3f&queryPos, const ResultSet&previous, ResultSet&results)const;
+    void markDirty(ObjectEntry*entry);
+    void relocate(ObjectEntry*entry, const Prox::Time&t);
+
+    Node* mRoot;
+    unsigned int mMaxDepth;
+    bool mIncremental;
+    ///scales for objects not yet in a query's results, and for those in them
+    float mEnterScale;
+    float mExitScale;
+    ///set whenever an object changes cells, so maximum radii get recomputed
+    bool mStructureChanged;
+    ObjectMap mObjects;
+    QueryMap mQueries;
+    ///objects with a position or bounds update since the last tick
+    std::vector<ObjectEntry*> mDirtyObjects;
+    ///objects with a nonzero velocity, which must be re-checked every tick
+    std::tr1::unordered_set<ObjectEntry*> mMovingObjects;
+    Prox::Time mLastTime;
+};
+
+} }
+#endif
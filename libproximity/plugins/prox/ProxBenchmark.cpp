@@ -0,0 +1,303 @@
+/*  Sirikata Proximity Management -- Prox Plugin
+ *  ProxBenchmark.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "proximity/Platform.hpp"
+#include "util/ObjectReference.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/PluginManager.hpp"
+#include "Prox_Sirikata.pbj.hpp"
+#include "proximity/ProximitySystem.hpp"
+#include "ProxBridge.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "options/Options.hpp"
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Standalone proximity benchmark: registers synthetic object populations and
+ * queries with a ProxBridge through its newObj/objLoc/newProxQuery interface
+ * and times its ticks, for every combination of query handler, layout, object
+ * count and query count given on the command line.  Reports setup time, the
+ * first (initial population) tick, the mean steady state tick, ProxCall events
+ * per second of tick time and resident memory.
+ */
+using namespace Sirikata;
+using namespace Sirikata::Proximity;
+
+namespace {
+OptionValue*handlers;
+OptionValue*distributions;
+OptionValue*objectCounts;
+OptionValue*queryCounts;
+OptionValue*ticks;
+OptionValue*extent;
+OptionValue*queryRadius;
+OptionValue*crowdSpeed;
+OptionValue*tickBudget;
+OptionValue*bridgePort;
+InitializeGlobalOptions o("proxbench",
+                    handlers=new OptionValue("handlers","bruteforce,octree,octree-incremental",OptionValueType<String>(),"Comma separated query handlers out of bruteforce, octree and octree-incremental"),
+                    distributions=new OptionValue("distributions","uniform,clustered,crowd",OptionValueType<String>(),"Comma separated object layouts out of uniform, clustered and crowd (clustered objects that move every tick)"),
+                    objectCounts=new OptionValue("objects","1000,10000,100000,1000000",OptionValueType<String>(),"Comma separated object populations"),
+                    queryCounts=new OptionValue("queries","1000,10000,100000,1000000",OptionValueType<String>(),"Comma separated query counts; counts above the population are skipped"),
+                    ticks=new OptionValue("ticks","10",OptionValueType<uint32>(),"Steady state ticks timed after the first one"),
+                    extent=new OptionValue("extent","4000",OptionValueType<float>(),"Half the width of the cube objects are placed in"),
+                    queryRadius=new OptionValue("query-radius","50",OptionValueType<float>(),"Maximum radius of every query"),
+                    crowdSpeed=new OptionValue("crowd-speed","2",OptionValueType<float>(),"Meters per second crowd objects walk"),
+                    tickBudget=new OptionValue("tick-budget","5",OptionValueType<double>(),"Seconds a steady tick may take before larger configurations of the same handler and layout are skipped"),
+                    bridgePort=new OptionValue("port","6409",OptionValueType<String>(),"Port the ProxBridge listener is bound to while benchmarking"),
+                    NULL);
+
+std::vector<String> splitList(const String&list) {
+    std::vector<String> retval;
+    String::size_type pos=0;
+    while (pos<list.length()) {
+        String::size_type comma=list.find(',',pos);
+        if (comma==String::npos) comma=list.length();
+        if (comma>pos)
+            retval.push_back(list.substr(pos,comma-pos));
+        pos=comma+1;
+    }
+    return retval;
+}
+std::vector<uint32> parseCounts(const String&list) {
+    std::vector<String> items=splitList(list);
+    std::vector<uint32> retval;
+    for (size_t i=0;i<items.size();++i) {
+        uint32 value=(uint32)strtoul(items[i].c_str(),NULL,10);
+        if (value) retval.push_back(value);
+    }
+    std::sort(retval.begin(),retval.end());
+    return retval;
+}
+
+///Resident set size in megabytes, or the peak if the platform only reports that
+double residentMegabytes() {
+#ifdef __linux__
+    FILE*statm=fopen("/proc/self/statm","r");
+    if (statm) {
+        unsigned long size=0,resident=0;
+        int found=fscanf(statm,"%lu %lu",&size,&resident);
+        fclose(statm);
+        if (found==2)
+            return resident*(double)sysconf(_SC_PAGESIZE)/(1024.0*1024.0);
+    }
+#endif
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF,&usage)==0)
+#ifdef __APPLE__
+        return usage.ru_maxrss/(1024.0*1024.0);
+#else
+        return usage.ru_maxrss/1024.0;
+#endif
+#endif
+    return 0;
+}
+
+///Small deterministic generator so every handler sees the same population
+class Random {
+    uint32 mState;
+public:
+    Random(uint32 seed):mState(seed?seed:1) {}
+    uint32 next() {
+        mState^=mState<<13;
+        mState^=mState>>17;
+        mState^=mState<<5;
+        return mState;
+    }
+    ///uniform in [-1,1]
+    float uniform() {
+        return (next()>>8)*(2.0f/16777216.0f)-1.0f;
+    }
+    ///roughly normal in [-1,1]
+    float bell() {
+        return (uniform()+uniform()+uniform())/3.0f;
+    }
+};
+
+class ProxBenchmark {
+    Network::IOService*mIO;
+    uint64 mEvents;
+    std::vector<ObjectReference> mObjects;
+    std::vector<Vector3d> mPositions;
+    std::vector<Vector3f> mVelocities;
+    Time mLastMove;
+
+    void countEvents(Network::Stream*, const RoutableMessageHeader&, const RoutableMessageBody&body) {
+        mEvents+=body.message_size();
+    }
+    void layout(const String&distribution, uint32 numObjects) {
+        Random random(numObjects);
+        float size=extent->as<float>();
+        float speed=crowdSpeed->as<float>();
+        uint32 numClusters=numObjects/1000+1;
+        std::vector<Vector3d> centers(numClusters);
+        for (uint32 i=0;i<numClusters;++i)
+            centers[i]=Vector3d(random.uniform()*size,random.uniform()*size,random.uniform()*size);
+        mPositions.resize(numObjects);
+        mVelocities.assign(numObjects,Vector3f(0,0,0));
+        for (uint32 i=0;i<numObjects;++i) {
+            if (distribution=="uniform") {
+                mPositions[i]=Vector3d(random.uniform()*size,random.uniform()*size,random.uniform()*size);
+            }else {
+                const Vector3d&center=centers[random.next()%numClusters];
+                float spread=size/20;
+                mPositions[i]=center+Vector3d(random.bell()*spread,random.bell()*spread,random.bell()*spread);
+                if (distribution=="crowd")
+                    mVelocities[i]=Vector3f(random.uniform(),random.uniform(),0).normal()*speed;
+            }
+        }
+    }
+    ///crowd objects turn a little each tick and report their new heading
+    void moveCrowd(ProxBridge&bridge, Random&random) {
+        Protocol::ObjLoc loc;
+        Time now=Time::now();
+        double elapsed=(now-mLastMove).toSeconds();
+        mLastMove=now;
+        float speed=crowdSpeed->as<float>();
+        for (size_t i=0;i<mObjects.size();++i) {
+            mPositions[i]+=Vector3d(mVelocities[i].x*elapsed,mVelocities[i].y*elapsed,mVelocities[i].z*elapsed);
+            Vector3f heading=mVelocities[i]+Vector3f(random.uniform(),random.uniform(),0)*(speed/4);
+            mVelocities[i]=heading.normal()*speed;
+            loc.set_timestamp(now);
+            loc.set_position(mPositions[i]);
+            loc.set_velocity(mVelocities[i]);
+            bridge.objLoc(mObjects[i],loc);
+        }
+    }
+public:
+    ProxBenchmark():mIO(Network::IOServiceFactory::makeIOService()),mEvents(0),mLastMove(Time::null()) {}
+    ~ProxBenchmark() {
+        Network::IOServiceFactory::destroyIOService(mIO);
+    }
+    ///\returns the mean steady state tick in seconds
+    double run(const String&handler, const String&distribution, uint32 numObjects, uint32 numQueries) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+        String options="--port "+bridgePort->as<String>()+" --updateDuration 3600s --batchProxCalls false";
+        if (handler=="octree-incremental")
+            options+=" --handler octree --incremental true";
+        else
+            options+=" --handler "+handler;
+        double startMemory=residentMegabytes();
+        ProxBridge*bridge=new ProxBridge(*mIO,options,NULL,std::tr1::bind(&ProxBenchmark::countEvents,this,_1,_2,_3));
+        layout(distribution,numObjects);
+
+        Time start=mLastMove=Time::now();
+        Protocol::RetObj obj;
+        mObjects.resize(numObjects);
+        for (uint32 i=0;i<numObjects;++i) {
+            obj.set_object_reference(UUID::random());
+            obj.mutable_location().set_timestamp(start);
+            obj.mutable_location().set_position(mPositions[i]);
+            obj.mutable_location().set_orientation(Quaternion::identity());
+            obj.mutable_location().set_velocity(mVelocities[i]);
+            obj.set_bounding_sphere(BoundingSphere3f(Vector3f(0,0,0),1));
+            mObjects[i]=bridge->newObj(obj);
+        }
+        Protocol::NewProxQuery query;
+        query.set_max_radius(queryRadius->as<float>());
+        for (uint32 i=0;i<numQueries;++i) {
+            query.set_query_id(i);
+            bridge->newProxQuery(mObjects[(uint64)i*numObjects/numQueries],query);
+        }
+        double setupSeconds=(Time::now()-start).toSeconds();
+
+        mEvents=0;
+        Time firstStart=Time::now();
+        bridge->tick();
+        double firstSeconds=(Time::now()-firstStart).toSeconds();
+        uint64 firstEvents=mEvents;
+
+        Random random(numObjects+numQueries);
+        uint32 numTicks=ticks->as<uint32>();
+        double tickSeconds=0;
+        mEvents=0;
+        for (uint32 t=0;t<numTicks;++t) {
+            if (distribution=="crowd")
+                moveCrowd(*bridge,random);
+            Time tickStart=Time::now();
+            bridge->tick();
+            tickSeconds+=(Time::now()-tickStart).toSeconds();
+        }
+        double meanTick=numTicks?tickSeconds/numTicks:firstSeconds;
+        double memory=residentMegabytes()-startMemory;
+        double eventsPerSecond=tickSeconds>0?mEvents/tickSeconds:(firstSeconds>0?firstEvents/firstSeconds:0);
+        printf("%-18s %-9s %8u %8u %9.2f %11.2f %11.3f %12.0f %10llu %8.1f\n",
+               handler.c_str(),distribution.c_str(),numObjects,numQueries,
+               setupSeconds,firstSeconds*1000,meanTick*1000,eventsPerSecond,(unsigned long long)firstEvents,memory);
+        fflush(stdout);
+        delete bridge;
+        mObjects.clear();
+        return meanTick;
+    }
+};
+}
+
+int main(int argc, const char**argv) {
+    PluginManager plugins;
+    plugins.load(DynamicLibrary::filename("tcpsst"));
+    OptionSet::getOptions("proxbench")->parse(argc,argv);
+
+    std::vector<String> handlerNames=splitList(handlers->as<String>());
+    std::vector<String> layouts=splitList(distributions->as<String>());
+    std::vector<uint32> populations=parseCounts(objectCounts->as<String>());
+    std::vector<uint32> queries=parseCounts(queryCounts->as<String>());
+    double budget=tickBudget->as<double>();
+
+    printf("%-18s %-9s %8s %8s %9s %11s %11s %12s %10s %8s\n",
+           "handler","layout","objects","queries","setup(s)","first(ms)","tick(ms)","events/sec","initial","mem(MB)");
+    ProxBenchmark benchmark;
+    for (size_t h=0;h<handlerNames.size();++h) {
+        for (size_t d=0;d<layouts.size();++d) {
+            bool overBudget=false;
+            for (size_t o=0;o<populations.size()&&!overBudget;++o) {
+                for (size_t q=0;q<queries.size()&&!overBudget;++q) {
+                    if (queries[q]>populations[o])
+                        continue;
+                    if (benchmark.run(handlerNames[h],layouts[d],populations[o],queries[q])>budget) {
+                        printf("# %s/%s exceeded the %gs tick budget, skipping larger configurations\n",
+                               handlerNames[h].c_str(),layouts[d].c_str(),budget);
+                        overBudget=true;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -37,7 +37,9 @@
 #include "prox/QueryHandler.hpp"
 #include "prox/QueryEventListener.hpp"
 #include "prox/QueryChangeListener.hpp"
+#include "prox/BruteForceQueryHandler.hpp"
 #include "ProxBridge.hpp"
+#include "LooseOctreeQueryHandler.hpp"
 #include "network/StreamListener.hpp"
 #include "network/Stream.hpp"
 #include "network/StreamListenerFactory.hpp"
@@ -45,8 +47,58 @@
 #include "options/Options.hpp"
 #include "network/IOServiceFactory.hpp"
 #include "util/RoutableMessage.hpp"
+#include "task/WorkQueue.hpp"
+#include "util/Metrics.hpp"
+#include "util/MappedFile.hpp"
+#include "util/Sha256.hpp"
+#include <fstream>
+#include <cstdio>
 //#include "Sirikata.pbj.hpp"
 namespace Sirikata { namespace Proximity {
+namespace {
+Metrics::Histogram sTickTime("prox.tick_us","microseconds one ProxBridge tick takes, including sending the resulting ProxCalls");
+
+/**
+ * Snapshots are a SnapshotHeader followed by one SnapshotObject per object, each followed by its stateful queries:
+ * a SnapshotQuery, the serialized NewProxQuery and the UUIDs of the objects the owner had been told were in it
+ */
+const char sSnapshotMagic[4]={'S','P','X','S'};
+const uint32 sSnapshotVersion=1;
+struct SnapshotHeader {
+    char mMagic[4];
+    uint32 mVersion;
+    uint32 mNumObjects;
+    int64 mTime;
+};
+struct SnapshotObject {
+    unsigned char mId[UUID::static_size];
+    float32 mPosition[3];
+    float32 mVelocity[3];
+    float32 mCenter[3];
+    float32 mRadius;
+    uint32 mNumQueries;
+};
+struct SnapshotQuery {
+    uint32 mId;
+    uint32 mRequestSize;
+    uint32 mNumResults;
+};
+
+///Reads successive records out of a MappedFile, failing once one would run past its end
+class SnapshotReader {
+    const char*mCursor;
+    const char*mEnd;
+public:
+    SnapshotReader(const MappedFile&file):mCursor(file.data()),mEnd(file.data()+file.size()) {}
+    bool read(void*destination, size_t size) {
+        if ((size_t)(mEnd-mCursor)<size)
+            return false;
+        std::memcpy(destination,mCursor,size);
+        mCursor+=size;
+        return true;
+    }
+};
+}
 
 void ProxBridge::newObjectStreamCallback(Network::Stream*newStream, Network::Stream::SetCallbacks&setCallbacks) {
     if (newStream) {
@@ -60,13 +112,100 @@ void ProxBridge::newObjectStreamCallback(Network::Stream*newStream, Network::Str
     }
 }
 
+void ProxBridge::tick(Prox::QueryHandler*listener) {
+    Metrics::ScopedTimer timer(sTickTime);
+    Prox::Time now((Time::now()-Time::epoch()).toMicroseconds());
+    mCollectingProxCalls=mBatchProxCalls;
+    if (mQueryShards.empty()) {
+        listener->tick(now);
+    }else {
+        tickShards(now);
+    }
+    if (aggregating()) {
+        refreshAggregates(now);
+    }
+    mCollectingProxCalls=false;
+    flushProxCalls();
+}
+void ProxBridge::tick() {
+    std::tr1::shared_ptr<Prox::QueryHandler> listener=mQueryHandler;
+    if (listener) {
+        tick(&*listener);
+    }
+}
 void ProxBridge::update(const Duration&duration,const std::tr1::weak_ptr<Prox::QueryHandler>&listen) {
     std::tr1::shared_ptr<Prox::QueryHandler> listener=listen.lock();
     if (listener) {
-        listener->tick(Prox::Time((Time::now()-Time::epoch()).toMicroseconds()));
+        tick(&*listener);
         Network::IOServiceFactory::dispatchServiceMessage(mIO,duration,std::tr1::bind(&ProxBridge::update,this,duration,listen));
     }
 }
+
+namespace {
+class ShardTickWorkItem : public Task::WorkItem {
+    std::tr1::function<void()> mTick;
+public:
+    ShardTickWorkItem(const std::tr1::function<void()>&tick):mTick(tick) {}
+    virtual void operator()() {
+        AutoPtr deleteMe(this);
+        mTick();
+    }
+};
+}
+
+void ProxBridge::tickShard(Prox::QueryHandler*shard, const Prox::Time&t) {
+    shard->tick(t);
+    boost::unique_lock<boost::mutex> lock(mShardMutex);
+    if (--mShardsRemaining==0) {
+        mShardCondition.notify_all();
+    }
+}
+
+void ProxBridge::tickShards(const Prox::Time&t) {
+    {
+        boost::unique_lock<boost::mutex> lock(mShardMutex);
+        mShardsRemaining=(int)mQueryShards.size();
+        mShardsTicking=true;
+    }
+    for (std::vector<Prox::QueryHandler*>::iterator i=mQueryShards.begin(),ie=mQueryShards.end();i!=ie;++i) {
+        mShardWorkQueue->enqueue(new ShardTickWorkItem(std::tr1::bind(&ProxBridge::tickShard,this,*i,t)));
+    }
+    mQueryHandler->tick(t);
+    std::vector<std::pair<QueryListener*,Prox::Query*> > pending;
+    {
+        boost::unique_lock<boost::mutex> lock(mShardMutex);
+        while (mShardsRemaining) {
+            mShardCondition.wait(lock);
+        }
+        mShardsTicking=false;
+        pending.swap(mPendingQueryEvents);
+    }
+    for (std::vector<std::pair<QueryListener*,Prox::Query*> >::iterator i=pending.begin(),ie=pending.end();i!=ie;++i) {
+        deliverQueryEvents(i->first,i->second);
+    }
+}
+
+bool ProxBridge::deferQueryEvents(QueryListener*listener, Prox::Query*query) {
+    if (mQueryShards.empty())
+        return false;
+    boost::unique_lock<boost::mutex> lock(mShardMutex);
+    if (!mShardsTicking)
+        return false;
+    mPendingQueryEvents.push_back(std::pair<QueryListener*,Prox::Query*>(listener,query));
+    return true;
+}
+
+Prox::QueryHandler*ProxBridge::shardFor(const Prox::Vector3f&pos) {
+    if (mQueryShards.empty())
+        return &*mQueryHandler;
+    size_t hash=(size_t)(int64)floor(pos.x/mShardCellSize)*73856093u
+        ^(size_t)(int64)floor(pos.y/mShardCellSize)*19349663u
+        ^(size_t)(int64)floor(pos.z/mShardCellSize)*83492791u;
+    size_t which=hash%(mQueryShards.size()+1);
+    if (which==0)
+        return &*mQueryHandler;
+    return mQueryShards[which-1];
+}
 bool ProxBridge::forwardMessagesTo(MessageService*ms){
     for (int i=0;i<sMaxMessageServices;++i) {
         if(mMessageServices[i]==NULL) {
@@ -89,22 +228,107 @@ bool ProxBridge::endForwardingMessagesTo(MessageService*ms){
     return false;
 }
 
-ProxBridge::ProxBridge(Network::IOService&io,const String&options, Prox::QueryHandler*handler, const Callback&cb):mIO(&io),mListener(Network::StreamListenerFactory::getSingleton().getDefaultConstructor()(&io)),mQueryHandler(handler),mCallback(cb) {
+Prox::QueryHandler* ProxBridge::createQueryHandler(const String&name, float octreeExtent, uint32 octreeDepth, bool incremental, float enterBand, float exitBand) {
+    if (name=="octree") {
+        return new LooseOctreeQueryHandler(octreeExtent,octreeDepth,incremental,enterBand,exitBand);
+    }
+    if (name!="bruteforce") {
+        SILOG(proximity,error,"Unknown proximity query handler "<<name<<", falling back to bruteforce");
+    }
+    if (incremental) {
+        SILOG(proximity,warning,"Incremental proximity updates require the octree handler");
+    }
+    return new Prox::BruteForceQueryHandler();
+}
+
+ProxBridge::ProxBridge(Network::IOService&io,const String&options, Prox::QueryHandler*handler, const Callback&cb):mIO(&io),mListener(Network::StreamListenerFactory::getSingleton().getDefaultConstructor()(&io)),mQueryHandler(handler),mShardWorkQueue(NULL),mShardThreads(NULL),mShardsRemaining(0),mShardsTicking(false),mAggregateRefresh(Duration::seconds(1)),mLastAggregateRefresh(Time::epoch()),mCallback(cb) {
+    mBatchProxCalls=false;
+    mCollectingProxCalls=false;
     std::memset(mMessageServices,0,sMaxMessageServices*sizeof(MessageService*));
     OptionValue*port;
     OptionValue*updateDuration;
+    OptionValue*handlerName;
+    OptionValue*octreeExtent;
+    OptionValue*octreeDepth;
+    OptionValue*incremental;
+    OptionValue*shards;
+    OptionValue*shardCellSize;
+    OptionValue*batchProxCalls;
+    OptionValue*enterHysteresis;
+    OptionValue*exitHysteresis;
+    OptionValue*snapshotFile;
+    OptionValue*snapshotInterval;
+    OptionValue*restoreGrace;
+    OptionValue*aggregateDistance;
+    OptionValue*aggregateCellSize;
+    OptionValue*aggregateMinMembers;
+    OptionValue*aggregateMesh;
+    OptionValue*aggregateRefresh;
     InitializeClassOptions("proxbridge",this,
                           port=new OptionValue("port","6408",OptionValueType<String>(),"sets the port that the proximity bridge should listen on"),
                           updateDuration=new OptionValue("updateDuration","60ms",OptionValueType<Duration>(),"sets the ammt of time between proximity updates"),
+                          handlerName=new OptionValue("handler","bruteforce",OptionValueType<String>(),"selects the query handler when none is supplied: bruteforce or octree"),
+                          octreeExtent=new OptionValue("octreeExtent","4096",OptionValueType<float>(),"half the width of the root cell of the octree query handler"),
+                          octreeDepth=new OptionValue("octreeDepth","10",OptionValueType<uint32>(),"maximum depth objects may be placed at in the octree query handler"),
+                          incremental=new OptionValue("incremental","false",OptionValueType<bool>(),"only recheck objects that moved or were updated since the last proximity update"),
+                          shards=new OptionValue("shards","1",OptionValueType<uint32>(),"number of query handlers, each ticked on its own thread, that queries are spread across"),
+                          shardCellSize=new OptionValue("shardCellSize","256",OptionValueType<float>(),"edge length of the grid cells used to assign queries to shards"),
+                          batchProxCalls=new OptionValue("batchProxCalls","true",OptionValueType<bool>(),"merges all ProxCalls for one object within an update into a single ProxCallBatch message"),
+                          enterHysteresis=new OptionValue("enterHysteresis","0",OptionValueType<float>(),"fraction the radius and apparent size a query reaches are shrunk by for objects entering it, in the octree handler"),
+                          exitHysteresis=new OptionValue("exitHysteresis","0.1",OptionValueType<float>(),"fraction the radius and apparent size a query reaches are grown by for objects already in it, in the octree handler"),
+                          snapshotFile=new OptionValue("snapshotFile","",OptionValueType<String>(),"file the objects, queries and query results are saved to periodically and restored from on startup, empty for none"),
+                          snapshotInterval=new OptionValue("snapshotInterval","10s",OptionValueType<Duration>(),"time between snapshots"),
+                          restoreGrace=new OptionValue("restoreGrace","30s",OptionValueType<Duration>(),"how long restored objects wait for their space to register them again before they are forgotten"),
+                          aggregateDistance=new OptionValue("aggregateDistance","0",OptionValueType<float>(),"query results farther than this from the query center are clustered into aggregate objects, 0 reports every object"),
+                          aggregateCellSize=new OptionValue("aggregateCellSize","64",OptionValueType<float>(),"edge length of the cells results are clustered by just past aggregateDistance, doubled each time the distance doubles"),
+                          aggregateMinMembers=new OptionValue("aggregateMinMembers","4",OptionValueType<uint32>(),"cells holding fewer results than this report them individually"),
+                          aggregateMesh=new OptionValue("aggregateMesh","",OptionValueType<String>(),"mesh to display for every aggregate, empty to use the mesh of its largest member"),
+                          aggregateRefresh=new OptionValue("aggregateRefresh","1s",OptionValueType<Duration>(),"time between recomputing the aggregates of queries whose results have not changed, to follow moving objects"),
 						  NULL);
     (mOptions=OptionSet::getOptions("proxbridge",this))->parse(options);
+    if (!mQueryHandler) {
+        mQueryHandler=std::tr1::shared_ptr<Prox::QueryHandler>(createQueryHandler(handlerName->as<String>(),
+                                                                                  octreeExtent->as<float>(),
+                                                                                  octreeDepth->as<uint32>(),
+                                                                                  incremental->as<bool>(),
+                                                                                  enterHysteresis->as<float>(),
+                                                                                  exitHysteresis->as<float>()));
+    }
+    mShardCellSize=shardCellSize->as<float>();
+    mBatchProxCalls=batchProxCalls->as<bool>();
+    mAggregateDistance=aggregateDistance->as<float>();
+    mAggregateCellSize=aggregateCellSize->as<float>();
+    mAggregateMinMembers=aggregateMinMembers->as<uint32>();
+    mAggregateMesh=aggregateMesh->as<String>();
+    mAggregateRefresh=aggregateRefresh->as<Duration>();
+    if (shards->as<uint32>()>1) {
+        for (uint32 i=1;i<shards->as<uint32>();++i) {
+            mQueryShards.push_back(createQueryHandler(handlerName->as<String>(),
+                                                      octreeExtent->as<float>(),
+                                                      octreeDepth->as<uint32>(),
+                                                      incremental->as<bool>(),
+                                                      enterHysteresis->as<float>(),
+                                                      exitHysteresis->as<float>()));
+        }
+        mShardWorkQueue=new Task::ThreadSafeWorkQueue;
+        mShardThreads=mShardWorkQueue->createWorkerThreads((int)mQueryShards.size());
+    }
     std::tr1::weak_ptr<Prox::QueryHandler> phandler=mQueryHandler;
+    mSnapshotFile=snapshotFile->as<String>();
+    if (snapshotting()) {
+        restoreSnapshot();
+        Network::IOServiceFactory::dispatchServiceMessage(&io,restoreGrace->as<Duration>(),std::tr1::bind(&ProxBridge::expireRestored,this,phandler));
+        Network::IOServiceFactory::dispatchServiceMessage(&io,snapshotInterval->as<Duration>(),std::tr1::bind(&ProxBridge::snapshot,this,snapshotInterval->as<Duration>(),phandler));
+    }
     Network::IOServiceFactory::dispatchServiceMessage(&io,updateDuration->as<Duration>(),std::tr1::bind(&ProxBridge::update,this,updateDuration->as<Duration>(),phandler));
     mListener->listen(Network::Address("127.0.0.1",port->as<String>()),
                       std::tr1::bind(&ProxBridge::newObjectStreamCallback,this,_1,_2));
 
 }
 ProxBridge::~ProxBridge() {
+    if (snapshotting()) {
+        writeSnapshot();
+    }
     std::tr1::weak_ptr<Prox::QueryHandler> listener=mQueryHandler;
     mQueryHandler=std::tr1::shared_ptr<Prox::QueryHandler>();
     while (listener.lock()) {
@@ -114,6 +338,14 @@ ProxBridge::~ProxBridge() {
         sleep(0);
 #endif
     }
+    if (mShardWorkQueue) {
+        mShardWorkQueue->destroyWorkerThreads(mShardThreads);
+        delete mShardWorkQueue;
+    }
+    for (std::vector<Prox::QueryHandler*>::iterator i=mQueryShards.begin(),ie=mQueryShards.end();i!=ie;++i) {
+        delete *i;
+    }
+    mQueryShards.clear();
     while (!mObjectStreams.empty()) {
         delObj(mObjectStreams.begin());
     }
@@ -226,6 +458,8 @@ ProxBridge::ObjectStateMap::iterator ProxBridge::newObj(ObjectReference&retval,
     if ((where=mObjectStreams.find(ObjectReference(object_reference)))!=mObjectStreams.end()) {
         where->second->mObject->bounds(boundingSphere);
         objLoc(where,location);
+        if (where->second->mRestored)
+            reconcileRestored(where->second);
     } else {
         Prox::Object::PositionVectorType position(Prox::Time((location.timestamp()-Time::epoch()).toMicroseconds()),
                                                   location.position().convert<Prox::Object::PositionVectorType::CoordType>(),
@@ -240,6 +474,9 @@ ProxBridge::ObjectStateMap::iterator ProxBridge::newObj(ObjectReference&retval,
         state->mObject=obj;
         state->mQueries.clear();
         mQueryHandler->registerObject(obj);
+        for (std::vector<Prox::QueryHandler*>::iterator i=mQueryShards.begin(),ie=mQueryShards.end();i!=ie;++i) {
+            (*i)->registerObject(obj);
+        }
         where=mObjectStreams.find(retval);
     }
     return where;
@@ -250,6 +487,62 @@ UUID convertProxObjectId(const Prox::ObjectID &id) {
     return UUID((unsigned char*)id.begin(),Prox::ObjectID::static_size);
 }
 
+void setAggregate(Protocol::IProxAggregate aggregate, const ProxBridge::Aggregate&summary, const String&mesh) {
+    aggregate.set_bounds(summary.mBounds);
+    aggregate.set_member_count(summary.mMembers);
+    aggregate.set_representative(summary.mRepresentative);
+    if (!mesh.empty())
+        aggregate.set_mesh_uri(mesh);
+}
+
+///objects already shown individually stay so until they are this fraction past aggregateDistance, so they do not flicker between forms
+const float sAggregateHysteresis=0.1f;
+///an aggregate whose bounds shift by less than this fraction of its radius is not sent again
+const float sAggregateTolerance=0.1f;
+
+///The grid cell, at some level of coarseness, that distant results are clustered by
+struct AggregateCell {
+    int32 mLevel;
+    int64 mX,mY,mZ;
+    bool operator<(const AggregateCell&other)const {
+        if (mLevel!=other.mLevel) return mLevel<other.mLevel;
+        if (mX!=other.mX) return mX<other.mX;
+        if (mY!=other.mY) return mY<other.mY;
+        return mZ<other.mZ;
+    }
+    ///the same cell of the same query always gets the same id, across refreshes and restarts
+    UUID id(const UUID&owner, uint32 queryId)const {
+        unsigned char key[UUID::static_size+2*sizeof(int32)+3*sizeof(int64)];
+        unsigned char*cursor=key;
+        std::memcpy(cursor,owner.getArray().begin(),UUID::static_size);
+        cursor+=UUID::static_size;
+        std::memcpy(cursor,&queryId,sizeof(int32));
+        cursor+=sizeof(int32);
+        std::memcpy(cursor,&mLevel,sizeof(int32));
+        cursor+=sizeof(int32);
+        std::memcpy(cursor,&mX,sizeof(int64));
+        cursor+=sizeof(int64);
+        std::memcpy(cursor,&mY,sizeof(int64));
+        cursor+=sizeof(int64);
+        std::memcpy(cursor,&mZ,sizeof(int64));
+        SHA256 digest=SHA256::computeDigest(key,sizeof(key));
+        return UUID(digest.rawData().begin(),UUID::static_size);
+    }
+};
+struct AggregateMembers {
+    std::vector<UUID> mIds;
+    ProxBridge::Aggregate mSummary;
+    float mLargest;
+    AggregateMembers():mLargest(-1){}
+};
+bool aggregateChanged(const ProxBridge::Aggregate&was, const ProxBridge::Aggregate&is) {
+    if (was.mMembers!=is.mMembers||was.mRepresentative!=is.mRepresentative)
+        return true;
+    float tolerance=is.mBounds.radius()*sAggregateTolerance;
+    return (was.mBounds.center()-is.mBounds.center()).length()>tolerance
+        ||std::fabs(was.mBounds.radius()-is.mBounds.radius())>tolerance;
+}
+
 
 }
 void ProxBridge::sendProxCallback(Network::Stream*stream,
@@ -270,49 +563,234 @@ public:
     }
     virtual ~QueryListener(){}
     virtual void queryHasEvents(Prox::Query*query){
-        Protocol::ProxCall callback_message;
-        RoutableMessage message_container;
-        message_container.set_destination_object(ObjectReference(convertProxObjectId(mState->mObject->id())));
+        if (!mParent->deferQueryEvents(this,query)) {
+            deliver(query);
+        }
+    }
+    void deliver(Prox::Query*query){
+        ProxBridge::PendingProxCallList calls;
         std::deque<Prox::QueryEvent> evts;
         query->popEvents(evts);
         std::deque<Prox::QueryEvent>::const_iterator i=evts.begin(),iend=evts.end();
         for (;i!=iend;++i) {
             if (i->type()==Prox::QueryEvent::Added||i->type()==Prox::QueryEvent::Removed) {
-                callback_message.set_proximity_event(i->type()==Prox::QueryEvent::Added?Protocol::ProxCall::ENTERED_PROXIMITY:Protocol::ProxCall::EXITED_PROXIMITY);
-                callback_message.set_proximate_object(convertProxObjectId(i->id()));
-                callback_message.set_query_id(mID);
-                callback_message.SerializeToString(message_container.body().add_message("ProxCall", std::string()));
+                calls.push_back(ProxBridge::PendingProxCall());
+                calls.back().mQueryId=mID;
+                calls.back().mProximateObject=convertProxObjectId(i->id());
+                calls.back().mEntered=(i->type()==Prox::QueryEvent::Added);
             }
         }
-        if (message_container.body().message_size()) {
-            mParent->mCallback(mState->mStream?&*mState->mStream:NULL,message_container,message_container.body());
-        }
-        std::string toSerialize;
-        for (int i=0;i<ProxBridge::sMaxMessageServices;++i){
-            MessageService*svc;
-            if ((svc=mParent->mMessageServices[i])==NULL)
-                break;
-            if (toSerialize.length()==0) {
-                message_container.body().SerializeToString(&toSerialize);
+        if (mParent->snapshotting()||mParent->aggregating()) {
+            ProxBridge::QueryMap::iterator where=mState->mQueries.find(mID);
+            if (where!=mState->mQueries.end()) {
+                for (ProxBridge::PendingProxCallList::const_iterator j=calls.begin(),je=calls.end();j!=je;++j) {
+                    if (j->mEntered)
+                        where->second.mResults.insert(j->mProximateObject);
+                    else
+                        where->second.mResults.erase(j->mProximateObject);
+                }
+                if (mParent->aggregating()) {
+                    //refreshAggregates decides what the owner hears about
+                    where->second.mAggregateDirty=true;
+                    return;
+                }
+                if (where->second.mRestored)
+                    return;//held until the owner is registered again
             }
-            svc->processMessage(message_container.header(),MemoryReference(toSerialize));
         }
+        mParent->queueProxCalls(mState,calls);
     }
     virtual void queryPositionUpdated(Prox::Query* query, const Prox::Query::PositionVectorType& old_pos, const Prox::MotionVector3f& new_pos){}
     virtual void queryDeleted(const Prox::Query* query){delete this;}
 };
+void ProxBridge::deliverQueryEvents(QueryListener*listener, Prox::Query*query) {
+    listener->deliver(query);
+}
+void ProxBridge::queueProxCalls(ObjectState*destination, const PendingProxCallList&calls) {
+    if (calls.empty())
+        return;
+    if (mCollectingProxCalls) {
+        PendingProxCallList&pending=mPendingProxCalls[destination];
+        pending.insert(pending.end(),calls.begin(),calls.end());
+    }else {
+        sendProxCalls(destination,calls);
+    }
+}
+void ProxBridge::flushProxCalls() {
+    std::map<ObjectState*,PendingProxCallList> pending;
+    pending.swap(mPendingProxCalls);
+    for (std::map<ObjectState*,PendingProxCallList>::iterator i=pending.begin(),ie=pending.end();i!=ie;++i) {
+        sendProxCalls(i->first,i->second);
+    }
+}
+void ProxBridge::sendProxCalls(ObjectState*destination, const PendingProxCallList&calls) {
+    if (calls.empty())
+        return;
+    RoutableMessage message_container;
+    message_container.set_destination_object(ObjectReference(convertProxObjectId(destination->mObject->id())));
+    if (mBatchProxCalls&&calls.size()>1) {
+        Protocol::ProxCallBatch batch;
+        for (PendingProxCallList::const_iterator i=calls.begin(),ie=calls.end();i!=ie;++i) {
+            Protocol::IProxCall call=batch.add_calls();
+            call.set_proximity_event(i->mEntered?Protocol::ProxCall::ENTERED_PROXIMITY:Protocol::ProxCall::EXITED_PROXIMITY);
+            call.set_proximate_object(i->mProximateObject);
+            call.set_query_id(i->mQueryId);
+            if (i->mAggregate)
+                setAggregate(call.mutable_aggregate(),i->mSummary,mAggregateMesh);
+        }
+        batch.SerializeToString(message_container.body().add_message("ProxCallBatch", std::string()));
+    }else {
+        for (PendingProxCallList::const_iterator i=calls.begin(),ie=calls.end();i!=ie;++i) {
+            Protocol::ProxCall callback_message;
+            if (i->mAggregate)
+                setAggregate(callback_message.mutable_aggregate(),i->mSummary,mAggregateMesh);
+            callback_message.set_proximity_event(i->mEntered?Protocol::ProxCall::ENTERED_PROXIMITY:Protocol::ProxCall::EXITED_PROXIMITY);
+            callback_message.set_proximate_object(i->mProximateObject);
+            callback_message.set_query_id(i->mQueryId);
+            callback_message.SerializeToString(message_container.body().add_message("ProxCall", std::string()));
+        }
+    }
+    mCallback(destination->mStream?&*destination->mStream:NULL,message_container,message_container.body());
+    std::string toSerialize;
+    for (int i=0;i<sMaxMessageServices;++i){
+        MessageService*svc;
+        if ((svc=mMessageServices[i])==NULL)
+            break;
+        if (toSerialize.length()==0) {
+            message_container.body().SerializeToString(&toSerialize);
+        }
+        svc->processMessage(message_container.header(),MemoryReference(toSerialize));
+    }
+}
+void ProxBridge::refreshAggregates(const Prox::Time&t) {
+    Time now=Time::now();
+    bool all=now-mLastAggregateRefresh>=mAggregateRefresh;
+    if (all)
+        mLastAggregateRefresh=now;
+    for (ObjectStateMap::iterator i=mObjectStreams.begin(),ie=mObjectStreams.end();i!=ie;++i) {
+        ObjectState*state=i->second;
+        PendingProxCallList calls;
+        for (QueryMap::iterator j=state->mQueries.begin(),je=state->mQueries.end();j!=je;++j) {
+            if (j->second.mQuery&&!j->second.mRestored&&(all||j->second.mAggregateDirty))
+                refreshAggregates(state,j->first,j->second,t,calls);
+        }
+        queueProxCalls(state,calls);
+    }
+}
+void ProxBridge::refreshAggregates(ObjectState*owner, uint32 queryId, QueryState&query, const Prox::Time&t, PendingProxCallList&calls) {
+    query.mAggregateDirty=false;
+    Prox::Vector3f center=query.mQuery->position(t);
+    std::set<UUID> individuals;
+    std::map<AggregateCell,AggregateMembers> cells;
+    for (std::set<UUID>::const_iterator i=query.mResults.begin(),ie=query.mResults.end();i!=ie;++i) {
+        ObjectStateMap::const_iterator member=mObjectStreams.find(ObjectReference(*i));
+        if (member==mObjectStreams.end()||member->second->mObject==NULL) {
+            individuals.insert(*i);
+            continue;
+        }
+        Prox::Object*object=member->second->mObject;
+        Prox::Vector3f position=object->position(t);
+        float dx=position.x-center.x,dy=position.y-center.y,dz=position.z-center.z;
+        float distance=std::sqrt(dx*dx+dy*dy+dz*dz);
+        float threshold=mAggregateDistance;
+        if (query.mReported.find(*i)!=query.mReported.end())
+            threshold*=1+sAggregateHysteresis;
+        if (distance<threshold) {
+            individuals.insert(*i);
+            continue;
+        }
+        AggregateCell cell;
+        cell.mLevel=0;
+        float cellSize=mAggregateCellSize;
+        for (float reach=2*mAggregateDistance;distance>=reach&&cell.mLevel<32;reach*=2) {
+            ++cell.mLevel;
+            cellSize*=2;
+        }
+        cell.mX=(int64)floor(position.x/cellSize);
+        cell.mY=(int64)floor(position.y/cellSize);
+        cell.mZ=(int64)floor(position.z/cellSize);
+        AggregateMembers&members=cells[cell];
+        Prox::Vector3f boundsCenter=object->bounds().center();
+        BoundingSphere3f bounds(Vector3f(position.x+boundsCenter.x,position.y+boundsCenter.y,position.z+boundsCenter.z),
+                                object->bounds().radius());
+        if (members.mIds.empty())
+            members.mSummary.mBounds=bounds;
+        else
+            members.mSummary.mBounds.mergeIn(bounds);
+        members.mIds.push_back(*i);
+        if (bounds.radius()>members.mLargest) {
+            members.mLargest=bounds.radius();
+            members.mSummary.mRepresentative=*i;
+        }
+    }
+    UUID ownerId=convertProxObjectId(owner->mObject->id());
+    std::map<UUID,Aggregate> aggregates;
+    for (std::map<AggregateCell,AggregateMembers>::iterator i=cells.begin(),ie=cells.end();i!=ie;++i) {
+        if (i->second.mIds.size()<mAggregateMinMembers) {
+            individuals.insert(i->second.mIds.begin(),i->second.mIds.end());
+        }else {
+            i->second.mSummary.mMembers=(uint32)i->second.mIds.size();
+            aggregates[i->first.id(ownerId,queryId)]=i->second.mSummary;
+        }
+    }
+    //new entries go out before the ones they replace, so the owner never shows a gap
+    PendingProxCall call;
+    call.mQueryId=queryId;
+    call.mEntered=true;
+    for (std::set<UUID>::const_iterator i=individuals.begin(),ie=individuals.end();i!=ie;++i) {
+        if (query.mReported.find(*i)==query.mReported.end()) {
+            call.mProximateObject=*i;
+            calls.push_back(call);
+        }
+    }
+    call.mAggregate=true;
+    for (std::map<UUID,Aggregate>::const_iterator i=aggregates.begin(),ie=aggregates.end();i!=ie;++i) {
+        std::map<UUID,Aggregate>::const_iterator was=query.mAggregates.find(i->first);
+        if (was==query.mAggregates.end()||aggregateChanged(was->second,i->second)) {
+            call.mProximateObject=i->first;
+            call.mSummary=i->second;
+            calls.push_back(call);
+        }else {
+            //keep what the owner was sent, so slow drift still adds up to a resend
+            aggregates[i->first]=was->second;
+        }
+    }
+    call.mEntered=false;
+    call.mAggregate=false;
+    call.mSummary=Aggregate();
+    std::set<UUID> reported(individuals);
+    for (std::map<UUID,Aggregate>::const_iterator i=aggregates.begin(),ie=aggregates.end();i!=ie;++i)
+        reported.insert(reported.end(),i->first);
+    for (std::set<UUID>::const_iterator i=query.mReported.begin(),ie=query.mReported.end();i!=ie;++i) {
+        if (reported.find(*i)==reported.end()) {
+            call.mProximateObject=*i;
+            calls.push_back(call);
+        }
+    }
+    query.mReported.swap(reported);
+    query.mAggregates.swap(aggregates);
+}
 void ProxBridge::newProxQuery(ObjectStateMap::iterator source,
                               const Sirikata::Protocol::INewProxQuery&new_query,
                               const void *optionalSerializedProximityQuery,
                               size_t optionalSerializedProximitySize){
+    String request;
+    if (optionalSerializedProximitySize)
+        request=String((const char*)optionalSerializedProximityQuery,optionalSerializedProximitySize);
     QueryMap::iterator where=source->second->mQueries.find(new_query.query_id());
     if (where!=source->second->mQueries.end()) {
+        if (where->second.mFromSnapshot&&!request.empty()&&where->second.mRequest==request) {
+            //the owner is asking again for the query it had before the restart: its results carry on
+            where->second.mFromSnapshot=false;
+            return;
+        }
         delete where->second.mQuery;
         source->second->mQueries.erase(where);
     }
     Prox::Query * query=NULL;
     if (new_query.has_min_solid_angle()||new_query.has_max_radius()) {
         QueryState*queryState=&source->second->mQueries[new_query.query_id()];
+        queryState->mRequest=request;
         Prox::Query::PositionVectorType pos(source->second->mObject->position());
         queryState->mOffset=Vector3d(0,0,0);
         queryState->mQueryType=new_query.stateless()?QueryState::RELATIVE_STATELESS:QueryState::RELATIVE_STATEFUL;
@@ -336,7 +814,7 @@ void ProxBridge::newProxQuery(ObjectStateMap::iterator source,
         }else if (new_query.has_min_solid_angle()) {
             queryState->mQuery=query=new Prox::Query(pos,Prox::SolidAngle(new_query.min_solid_angle()));
         }
-        mQueryHandler->registerQuery(query);
+        shardFor(query->position(Prox::Time((Time::now()-Time::epoch()).toMicroseconds())))->registerQuery(query);
         QueryListener * ql=new QueryListener(new_query.query_id(),source->second,this);
         query->addChangeListener(ql);
         query->setEventListener(ql);
@@ -353,6 +831,7 @@ void ProxBridge::delProxQuery(ObjectStateMap::iterator source,
     }
 }
 void ProxBridge::delObj(ObjectStateMap::iterator source){
+    mPendingProxCalls.erase(source->second);
     QueryMap::iterator i=source->second->mQueries.begin(),ie=source->second->mQueries.end();
     for (;i!=ie;++i) {
         delete i->second.mQuery;
@@ -506,4 +985,213 @@ void ProxBridge::disconnectionCallback(const std::tr1::shared_ptr<Network::Strea
 }
 
 
+void ProxBridge::writeSnapshot() {
+    String temporary=mSnapshotFile+".tmp";
+    std::ofstream out(temporary.c_str(),std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!out) {
+        SILOG(proximity,warning,"Cannot write proximity snapshot to "<<temporary);
+        return;
+    }
+    int64 now=(Time::now()-Time::epoch()).toMicroseconds();
+    Prox::Time proxNow(now);
+    SnapshotHeader header;
+    std::memcpy(header.mMagic,sSnapshotMagic,sizeof(header.mMagic));
+    header.mVersion=sSnapshotVersion;
+    header.mNumObjects=0;
+    header.mTime=now;
+    out.write((const char*)&header,sizeof(header));
+    for (ObjectStateMap::const_iterator i=mObjectStreams.begin(),ie=mObjectStreams.end();i!=ie;++i) {
+        const ObjectState*state=i->second;
+        if (state->mObject==NULL)
+            continue;
+        SnapshotObject object;
+        std::memcpy(object.mId,i->first.getAsUUID().getArray().begin(),UUID::static_size);
+        Prox::Vector3f position=state->mObject->position(proxNow);
+        Prox::Vector3f velocity=state->mObject->position().velocity();
+        Prox::Vector3f center=state->mObject->bounds().center();
+        object.mPosition[0]=position.x;
+        object.mPosition[1]=position.y;
+        object.mPosition[2]=position.z;
+        object.mVelocity[0]=velocity.x;
+        object.mVelocity[1]=velocity.y;
+        object.mVelocity[2]=velocity.z;
+        object.mCenter[0]=center.x;
+        object.mCenter[1]=center.y;
+        object.mCenter[2]=center.z;
+        object.mRadius=state->mObject->bounds().radius();
+        object.mNumQueries=0;
+        for (QueryMap::const_iterator j=state->mQueries.begin(),je=state->mQueries.end();j!=je;++j) {
+            if ((j->second.mQueryType==QueryState::RELATIVE_STATEFUL||j->second.mQueryType==QueryState::ABSOLUTE_STATEFUL)&&!j->second.mRequest.empty())
+                ++object.mNumQueries;
+        }
+        out.write((const char*)&object,sizeof(object));
+        for (QueryMap::const_iterator j=state->mQueries.begin(),je=state->mQueries.end();j!=je;++j) {
+            if ((j->second.mQueryType==QueryState::RELATIVE_STATEFUL||j->second.mQueryType==QueryState::ABSOLUTE_STATEFUL)&&!j->second.mRequest.empty()) {
+                //a query still held back reports what its owner knew, not what it has found since
+                const std::set<UUID>&results=j->second.mRestored?j->second.mRestoredResults:(aggregating()?j->second.mReported:j->second.mResults);
+                SnapshotQuery query;
+                query.mId=j->first;
+                query.mRequestSize=(uint32)j->second.mRequest.size();
+                query.mNumResults=(uint32)results.size();
+                out.write((const char*)&query,sizeof(query));
+                out.write(j->second.mRequest.data(),j->second.mRequest.size());
+                for (std::set<UUID>::const_iterator k=results.begin(),ke=results.end();k!=ke;++k) {
+                    out.write((const char*)k->getArray().begin(),UUID::static_size);
+                }
+            }
+        }
+        ++header.mNumObjects;
+    }
+    out.seekp(0);
+    out.write((const char*)&header,sizeof(header));
+    out.close();
+    if (!out) {
+        SILOG(proximity,warning,"Failed writing proximity snapshot to "<<temporary);
+        return;
+    }
+#ifdef _WIN32
+    std::remove(mSnapshotFile.c_str());
+#endif
+    if (std::rename(temporary.c_str(),mSnapshotFile.c_str())!=0) {
+        SILOG(proximity,warning,"Cannot replace proximity snapshot "<<mSnapshotFile);
+    }
+}
+
+void ProxBridge::restoreSnapshot() {
+    MappedFile file(mSnapshotFile);
+    if (file.data()==NULL) {
+        SILOG(proximity,info,"No proximity snapshot to restore from "<<mSnapshotFile);
+        return;
+    }
+    SnapshotReader reader(file);
+    SnapshotHeader header;
+    if (!reader.read(&header,sizeof(header))||std::memcmp(header.mMagic,sSnapshotMagic,sizeof(header.mMagic))!=0||header.mVersion!=sSnapshotVersion) {
+        SILOG(proximity,warning,"Ignoring unrecognized proximity snapshot "<<mSnapshotFile);
+        return;
+    }
+    Time taken=Time::epoch()+Duration::microseconds(header.mTime);
+    uint32 numQueries=0;
+    bool complete=true;
+    for (uint32 i=0;i<header.mNumObjects&&complete;++i) {
+        SnapshotObject object;
+        if (!reader.read(&object,sizeof(object))) {
+            complete=false;
+            break;
+        }
+        Sirikata::Protocol::RetObj retObj;
+        retObj.set_object_reference(UUID(object.mId,UUID::static_size));
+        retObj.mutable_location().set_timestamp(taken);
+        retObj.mutable_location().set_position(Vector3d(object.mPosition[0],object.mPosition[1],object.mPosition[2]));
+        retObj.mutable_location().set_velocity(Vector3f(object.mVelocity[0],object.mVelocity[1],object.mVelocity[2]));
+        retObj.set_bounding_sphere(BoundingSphere3f(Vector3f(object.mCenter[0],object.mCenter[1],object.mCenter[2]),object.mRadius));
+        ObjectReference ref;
+        ObjectStateMap::iterator where=newObj(ref,retObj);
+        where->second->mRestored=true;
+        for (uint32 j=0;j<object.mNumQueries;++j) {
+            SnapshotQuery query;
+            if (!reader.read(&query,sizeof(query))) {
+                complete=false;
+                break;
+            }
+            String request(query.mRequestSize,'\0');
+            if (query.mRequestSize&&!reader.read(&request[0],query.mRequestSize)) {
+                complete=false;
+                break;
+            }
+            std::set<UUID> results;
+            for (uint32 k=0;k<query.mNumResults&&complete;++k) {
+                UUID::byte id[UUID::static_size];
+                if (reader.read(id,sizeof(id)))
+                    results.insert(UUID(id,UUID::static_size));
+                else
+                    complete=false;
+            }
+            Sirikata::Protocol::NewProxQuery newQuery;
+            if (complete&&newQuery.ParseFromString(request)) {
+                newProxQuery(where,newQuery,request.data(),request.size());
+                QueryMap::iterator restored=where->second->mQueries.find(query.mId);
+                if (restored!=where->second->mQueries.end()) {
+                    restored->second.mRestored=true;
+                    restored->second.mFromSnapshot=true;
+                    restored->second.mRestoredResults.swap(results);
+                    ++numQueries;
+                }
+            }
+        }
+    }
+    if (!complete) {
+        SILOG(proximity,warning,"Proximity snapshot "<<mSnapshotFile<<" is truncated");
+    }
+    SILOG(proximity,info,"Restored "<<mObjectStreams.size()<<" objects and "<<numQueries<<" queries from "<<mSnapshotFile);
+}
+
+void ProxBridge::snapshot(const Duration&interval,const std::tr1::weak_ptr<Prox::QueryHandler>&listen) {
+    std::tr1::shared_ptr<Prox::QueryHandler> listener=listen.lock();
+    if (listener) {
+        writeSnapshot();
+        Network::IOServiceFactory::dispatchServiceMessage(mIO,interval,std::tr1::bind(&ProxBridge::snapshot,this,interval,listen));
+    }
+}
+
+void ProxBridge::reconcileRestored(ObjectState*state) {
+    state->mRestored=false;
+    PendingProxCallList&pending=mPendingProxCalls[state];
+    for (QueryMap::iterator i=state->mQueries.begin(),ie=state->mQueries.end();i!=ie;++i) {
+        QueryState&query=i->second;
+        if (!query.mRestored)
+            continue;
+        query.mRestored=false;
+        if (aggregating()) {
+            //what the owner knew is diffed against the current aggregates in the next update
+            query.mReported.swap(query.mRestoredResults);
+            query.mRestoredResults.clear();
+            query.mAggregateDirty=true;
+            continue;
+        }
+        PendingProxCall call;
+        call.mQueryId=i->first;
+        call.mEntered=true;
+        for (std::set<UUID>::const_iterator j=query.mResults.begin(),je=query.mResults.end();j!=je;++j) {
+            if (query.mRestoredResults.find(*j)==query.mRestoredResults.end()) {
+                call.mProximateObject=*j;
+                pending.push_back(call);
+            }
+        }
+        call.mEntered=false;
+        for (std::set<UUID>::const_iterator j=query.mRestoredResults.begin(),je=query.mRestoredResults.end();j!=je;++j) {
+            if (query.mResults.find(*j)==query.mResults.end()) {
+                call.mProximateObject=*j;
+                pending.push_back(call);
+            }
+        }
+        query.mRestoredResults.clear();
+    }
+    //sent with the calls of the next update, by which time the object's stream is known
+    if (pending.empty())
+        mPendingProxCalls.erase(state);
+}
+
+void ProxBridge::expireRestored(const std::tr1::weak_ptr<Prox::QueryHandler>&listen) {
+    std::tr1::shared_ptr<Prox::QueryHandler> listener=listen.lock();
+    if (!listener)
+        return;
+    std::vector<ObjectReference> expired;
+    for (ObjectStateMap::iterator i=mObjectStreams.begin(),ie=mObjectStreams.end();i!=ie;++i) {
+        if (i->second->mRestored) {
+            expired.push_back(i->first);
+        }else {
+            for (QueryMap::iterator j=i->second->mQueries.begin(),je=i->second->mQueries.end();j!=je;++j)
+                j->second.mFromSnapshot=false;
+        }
+    }
+    for (std::vector<ObjectReference>::iterator i=expired.begin(),ie=expired.end();i!=ie;++i) {
+        ObjectStateMap::iterator where=mObjectStreams.find(*i);
+        if (where!=mObjectStreams.end())
+            delObj(where);
+    }
+    if (!expired.empty()) {
+        SILOG(proximity,info,"Forgot "<<expired.size()<<" restored objects that were not registered again");
+    }
+}
+
 } }
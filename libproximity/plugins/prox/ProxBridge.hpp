@@ -33,7 +33,12 @@
 #include "network/Stream.hpp"
 #include "network/StreamListener.hpp"
 
-namespace Sirikata { namespace Proximity {
+namespace Sirikata {
+namespace Task {
+class WorkQueue;
+class WorkQueueThread;
+}
+namespace Proximity {
 class QueryListener;
 class ProxCallback;
 /**
@@ -47,8 +52,31 @@ class ProxBridge : public ProximitySystem {
     Network::StreamListener*mListener;
     //The query handler for proximity: This class will not finish its destructor until all references to mListener are gone.
     std::tr1::shared_ptr<Prox::QueryHandler> mQueryHandler;
+    ///Additional query handlers beyond mQueryHandler: each holds every object but only the queries whose center hashed to it
+    std::vector<Prox::QueryHandler*> mQueryShards;
+    ///Edge length of the grid cells used to assign new queries to a shard
+    float mShardCellSize;
+    ///Ticks all but the first shard while the IO thread ticks mQueryHandler
+    Task::WorkQueue*mShardWorkQueue;
+    Task::WorkQueueThread*mShardThreads;
+    boost::mutex mShardMutex;
+    boost::condition_variable mShardCondition;
+    int mShardsRemaining;
+    ///Set while shards tick in parallel, so query events get queued instead of sent from worker threads
+    bool mShardsTicking;
+    std::vector<std::pair<QueryListener*,Prox::Query*> > mPendingQueryEvents;
     friend class QueryListener;
     friend class ProxCallback;
+public:
+    ///A cluster of distant query results reported to the owner as a single object
+    class Aggregate {
+    public:
+        BoundingSphere3f mBounds;
+        uint32 mMembers;
+        UUID mRepresentative;
+        Aggregate():mBounds(BoundingSphere3f::null()),mMembers(0){}
+    };
+private:
     class QueryState {
     public:
         Prox::Query *mQuery;
@@ -59,6 +87,22 @@ class ProxBridge : public ProximitySystem {
             RELATIVE_STATELESS=2,
             ABSOLUTE_STATELESS=3
         } mQueryType;
+        ///the serialized NewProxQuery, kept for snapshots
+        String mRequest;
+        ///the objects the owner has been told are in the query, kept while snapshotting
+        std::set<UUID> mResults;
+        ///results the owner knew of when the snapshot was taken, reconciled with mResults once the owner re-registers
+        std::set<UUID> mRestoredResults;
+        ///restored from a snapshot and not yet reconciled: ProxCalls are held back
+        bool mRestored;
+        ///restored from a snapshot, so the owner re-sending the same query keeps it as it is
+        bool mFromSnapshot;
+        ///when aggregating: the individual objects and aggregates the owner has been told about
+        std::set<UUID> mReported;
+        std::map<UUID,Aggregate> mAggregates;
+        ///mResults changed since the aggregates were last computed
+        bool mAggregateDirty;
+        QueryState():mQuery(NULL),mRestored(false),mFromSnapshot(false),mAggregateDirty(false){}
     };
     typedef std::map<uint32,QueryState> QueryMap;
     class ObjectState {
@@ -66,10 +110,61 @@ class ProxBridge : public ProximitySystem {
         Prox::Object * mObject;
         QueryMap mQueries;
         std::tr1::shared_ptr<Network::Stream> mStream;
-        ObjectState(Network::Stream*strm):mStream(strm){mObject=NULL;}
+        ///restored from a snapshot and not re-registered by its space yet
+        bool mRestored;
+        ObjectState(Network::Stream*strm):mStream(strm),mRestored(false){mObject=NULL;}
     };
     typedef std::tr1::unordered_map<ObjectReference,ObjectState*,ObjectReference::Hasher >ObjectStateMap;
     ObjectStateMap mObjectStreams;//should it be a shared ptr to the stream? I think not since this is the only place we hold the ref
+    class PendingProxCall {
+    public:
+        uint32 mQueryId;
+        UUID mProximateObject;
+        bool mEntered;
+        ///set if mProximateObject names an aggregate, described by mSummary
+        bool mAggregate;
+        Aggregate mSummary;
+        PendingProxCall():mQueryId(0),mEntered(false),mAggregate(false){}
+    };
+    typedef std::vector<PendingProxCall> PendingProxCallList;
+    ///If set, destinations with several ProxCalls in one update receive a single ProxCallBatch instead
+    bool mBatchProxCalls;
+    ///Set during update(), while ProxCalls are collected into mPendingProxCalls rather than sent right away
+    bool mCollectingProxCalls;
+    std::map<ObjectState*,PendingProxCallList> mPendingProxCalls;
+    ///Results beyond this distance from a query's center are clustered into aggregates, 0 to report every object
+    float mAggregateDistance;
+    ///Edge length of the grid cells results are clustered by just past mAggregateDistance; doubles each time the distance does
+    float mAggregateCellSize;
+    ///Cells with fewer results than this report them individually
+    uint32 mAggregateMinMembers;
+    ///Mesh the owner is told to display for every aggregate, empty to use the representative member's
+    String mAggregateMesh;
+    ///Every query's aggregates are recomputed this often, as well as whenever its results change, to follow movement
+    Duration mAggregateRefresh;
+    Time mLastAggregateRefresh;
+    bool aggregating()const {
+        return mAggregateDistance>0;
+    }
+    ///Recomputes the aggregates of the queries that need it and queues the changes for their owners
+    void refreshAggregates(const Prox::Time&t);
+    void refreshAggregates(ObjectState*owner, uint32 queryId, QueryState&query, const Prox::Time&t, PendingProxCallList&calls);
+    ///where the state is snapshotted to and restored from on startup, empty to keep no snapshots
+    String mSnapshotFile;
+    bool snapshotting()const {
+        return !mSnapshotFile.empty();
+    }
+    void writeSnapshot();
+    void restoreSnapshot();
+    void snapshot(const Duration&interval,const std::tr1::weak_ptr<Prox::QueryHandler>&);
+    ///queues the ProxCalls that bring a re-registered object from what it knew at the snapshot to the current results
+    void reconcileRestored(ObjectState*state);
+    ///forgets restored objects their spaces did not re-register within the grace period
+    void expireRestored(const std::tr1::weak_ptr<Prox::QueryHandler>&);
+    ///Sends calls now, or holds them until the end of the current update if batching
+    void queueProxCalls(ObjectState*destination, const PendingProxCallList&calls);
+    void sendProxCalls(ObjectState*destination, const PendingProxCallList&calls);
+    void flushProxCalls();
     /**
      * Process a message that may be meant for the proximity system
      * \returns whether an object has been deleted, so the previous system can update its records
@@ -115,15 +210,28 @@ class ProxBridge : public ProximitySystem {
                                const std::string&reason);
     static void sendProxCallback(Network::Stream*, const RoutableMessageHeader&,const Sirikata::RoutableMessageBody&);
 
+    ///Constructs the QueryHandler named by the "handler" option: either bruteforce or octree
+    static Prox::QueryHandler* createQueryHandler(const String&name, float octreeExtent, uint32 octreeDepth, bool incremental, float enterBand, float exitBand);
     void update(const Duration&timeSinceUpdate,const std::tr1::weak_ptr<Prox::QueryHandler>&);
-    void updateThread(const Duration&optimalUpdateTime,const std::tr1::weak_ptr<Prox::QueryHandler>&);
+    void tick(Prox::QueryHandler*);
+    ///Ticks every shard on the worker pool, waits for all of them, then delivers the queued query events from this thread
+    void tickShards(const Prox::Time&t);
+    void tickShard(Prox::QueryHandler*shard, const Prox::Time&t);
+    ///Picks the handler responsible for a query centered at pos
+    Prox::QueryHandler*shardFor(const Prox::Vector3f&pos);
+    ///\returns true if the events were queued for delivery after the shards finish ticking
+    bool deferQueryEvents(QueryListener*listener, Prox::Query*query);
+    static void deliverQueryEvents(QueryListener*listener, Prox::Query*query);
 
 public:
 
 
 
+    ///If no QueryHandler is passed in, one is selected by the --handler option
     ProxBridge(Network::IOService&io,const String&options, Prox::QueryHandler*, const Callback &cb=&sendProxCallback);
     virtual ~ProxBridge();
+    ///Runs one proximity update on the calling thread right away, for tools that drive the bridge without running its IOService
+    void tick();
 
     virtual OpaqueMessageReturnValue processOpaqueProximityMessage(std::vector<ObjectReference>&newObjectReferences,
                                                const ObjectReference*object,
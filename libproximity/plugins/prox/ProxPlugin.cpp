@@ -30,6 +30,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <proximity/Platform.hpp>
+#include <util/PluginManager.hpp>
 #include "util/ObjectReference.hpp"
 #include <Proximity_Sirikata.pbj.hpp>
 #include <proximity/ProximitySystem.hpp>
@@ -38,9 +39,10 @@
 #include <proximity/ProximityConnectionFactory.hpp>
 #include <proximity/ProximityConnection.hpp>
 #include <proximity/SingleStreamProximityConnection.hpp>
+#include <proximity/ShardedProximityConnection.hpp>
 static int core_plugin_refcount = 0;
 
-SIRIKATA_PLUGIN_EXPORT_C void init() {
+SIRIKATA_PLUGIN_ENTRY_C void init() {
     using namespace Sirikata;
     using namespace Sirikata::Proximity;
     if (core_plugin_refcount==0) {
@@ -50,19 +52,22 @@ SIRIKATA_PLUGIN_EXPORT_C void init() {
         ProximityConnectionFactory::getSingleton().registerConstructor("bruteforceprox",
                                                                        &SingleStreamProximityConnection::create,
                                                                        true);
+        ProximityConnectionFactory::getSingleton().registerConstructor("sharded",
+                                                                       &ShardedProximityConnection::create,
+                                                                       false);
     }
     core_plugin_refcount++;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C int increfcount() {
+SIRIKATA_PLUGIN_ENTRY_C int increfcount() {
     return ++core_plugin_refcount;
 }
-SIRIKATA_PLUGIN_EXPORT_C int decrefcount() {
+SIRIKATA_PLUGIN_ENTRY_C int decrefcount() {
     assert(core_plugin_refcount>0);
     return --core_plugin_refcount;
 }
 
-SIRIKATA_PLUGIN_EXPORT_C void destroy() {
+SIRIKATA_PLUGIN_ENTRY_C void destroy() {
     using namespace Sirikata;
     using namespace Sirikata::Proximity;
     if (core_plugin_refcount>0) {
@@ -71,13 +76,16 @@ SIRIKATA_PLUGIN_EXPORT_C void destroy() {
         if (core_plugin_refcount==0) {
             ProximitySystemFactory::getSingleton().unregisterConstructor("bruteforceprox",true);
             ProximityConnectionFactory::getSingleton().unregisterConstructor("bruteforceprox",true);
+            ProximityConnectionFactory::getSingleton().unregisterConstructor("sharded",false);
         }
     }
 }
 
-SIRIKATA_PLUGIN_EXPORT_C const char* name() {
+SIRIKATA_PLUGIN_ENTRY_C const char* name() {
     return "ogregraphics";
 }
-SIRIKATA_PLUGIN_EXPORT_C int refcount() {
+SIRIKATA_PLUGIN_ENTRY_C int refcount() {
     return core_plugin_refcount;
 }
+
+SIRIKATA_REGISTER_STATIC_PLUGIN(prox)
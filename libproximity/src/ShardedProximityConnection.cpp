@@ -0,0 +1,424 @@
+/*  Sirikata Proximity Library -- Sharded Proximity Connection
+ *  ShardedProximityConnection.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <proximity/Platform.hpp>
+#include "options/Options.hpp"
+#include "Proximity_Sirikata.pbj.hpp"
+#include "util/RoutableMessage.hpp"
+#include "proximity/ShardedProximityConnection.hpp"
+#include "network/Stream.hpp"
+#include "network/StreamFactory.hpp"
+
+namespace Sirikata { namespace Proximity {
+namespace {
+
+void connectionCallback(ProximityConnection* con, Network::Stream::ConnectionStatus status, const std::string&reason) {
+    if (status!=Network::Stream::Connected)
+        con->streamDisconnected();
+}
+
+void addProxCall(RoutableMessageBody&body, uint32 queryId, const UUID&proximateObject, Protocol::ProxCall::ProximityEvent event) {
+    Protocol::ProxCall call;
+    call.set_query_id(queryId);
+    call.set_proximate_object(proximateObject);
+    call.set_proximity_event(event);
+    call.SerializeToString(body.add_message("ProxCall"));
+}
+
+}
+
+ProximityConnection* ShardedProximityConnection::create(Network::IOService*io, const String&options){
+    return new ShardedProximityConnection(io,options);
+}
+
+ShardedProximityConnection::ShardedProximityConnection(Network::IOService*io, const String&options):mParent(NULL) {
+    OptionValue*shards;
+    OptionValue*worldSize;
+    OptionValue*margin;
+    InitializeClassOptions("shardedproximityconnection",this,
+                           shards=new OptionValue("shards","localhost:6408",OptionValueType<String>(),"comma separated host:port addresses of the proximity managers, each answering for one slab of the world along x"),
+                           worldSize=new OptionValue("worldsize","8192",OptionValueType<double>(),"width of the world around the origin split into slabs; the outer slabs reach past it"),
+                           margin=new OptionValue("margin","64",OptionValueType<double>(),"distance from a slab within which objects are registered with its proximity manager too"),
+                           NULL);
+    OptionSet::getOptions("shardedproximityconnection",this)->parse(options);
+    String list=shards->as<String>();
+    String::size_type start=0;
+    while (start<list.size()&&mShardStreams.size()<MAX_SHARDS) {
+        String::size_type end=list.find(',',start);
+        if (end==String::npos)
+            end=list.size();
+        String address=list.substr(start,end-start);
+        String::size_type colon=address.rfind(':');
+        if (colon==String::npos) {
+            SILOG(proximity,error,"Proximity manager address "<<address<<" does not contain a port");
+        }else {
+            std::tr1::shared_ptr<Network::Stream> stream(Network::StreamFactory::getSingleton().getDefaultConstructor()(io));
+            stream->connect(Network::Address(address.substr(0,colon),address.substr(colon+1)),
+                            &Network::Stream::ignoreSubstreamCallback,
+                            std::tr1::bind(&connectionCallback,this,_1,_2),
+                            &Network::Stream::ignoreBytesReceived);
+            mShardStreams.push_back(stream);
+        }
+        start=end+1;
+    }
+    if (mShardStreams.empty()) {
+        SILOG(proximity,error,"No proximity managers to connect to in "<<list);
+    }
+    mMinX=-worldSize->as<double>()*.5;
+    mSlabWidth=mShardStreams.empty()?worldSize->as<double>():worldSize->as<double>()/mShardStreams.size();
+    mMargin=margin->as<double>();
+}
+
+ShardedProximityConnection::~ShardedProximityConnection() {
+    for (ObjectMap::iterator i=mObjects.begin(),ie=mObjects.end();i!=ie;++i) {
+        for (std::vector<Network::Stream*>::iterator j=i->second.mStreams.begin(),je=i->second.mStreams.end();j!=je;++j) {
+            delete *j;
+        }
+    }
+    mObjects.clear();
+    for (size_t i=0;i<mShardStreams.size();++i) {
+        std::tr1::weak_ptr<Network::Stream> lok(mShardStreams[i]);
+        mShardStreams[i]=std::tr1::shared_ptr<Network::Stream>();
+        while (lok.lock()) {
+            //wait for callbacks on the stream to complete
+        }
+    }
+}
+
+void ShardedProximityConnection::streamDisconnected() {
+    SILOG(proximity,error,"Lost connection with a proximity manager");
+}
+
+bool ShardedProximityConnection::forwardMessagesTo(MessageService*parent) {
+    if (mParent!=NULL)
+        return false;
+    mParent=parent;
+    return true;
+}
+bool ShardedProximityConnection::endForwardingMessagesTo(MessageService*parent) {
+    if (mParent==parent) {
+        mParent=NULL;
+        return true;
+    }
+    return false;
+}
+
+uint32 ShardedProximityConnection::shardsBetween(double minX, double maxX)const {
+    uint32 numShards=(uint32)mShardStreams.size();
+    if (numShards==0)
+        return 0;
+    double first=std::floor((minX-mMinX)/mSlabWidth);
+    double last=std::floor((maxX-mMinX)/mSlabWidth);
+    uint32 lo=first<0?0:(first>=numShards?numShards-1:(uint32)first);
+    uint32 hi=last<0?0:(last>=numShards?numShards-1:(uint32)last);
+    uint32 retval=0;
+    for (uint32 i=lo;i<=hi;++i)
+        retval|=(1u<<i);
+    return retval;
+}
+
+uint32 ShardedProximityConnection::queryShards(const ObjectRecord&record, const QueryRecord&query)const {
+    if (query.mRadius<0)
+        return shardsBetween(mMinX-1,mMinX+mSlabWidth*mShardStreams.size()+1);
+    double center=query.mAbsolute?query.mCenter.x:record.mPosition.x+query.mOffset.x;
+    return shardsBetween(center-query.mRadius,center+query.mRadius);
+}
+
+void ShardedProximityConnection::sendToShard(const ObjectReference&object, ObjectRecord&record, uint32 shard, const String&name, const String&argument) {
+    if (!(record.mShards&(1u<<shard)))
+        return;
+    RoutableMessageBody body;
+    body.add_message(name,argument);
+    std::string data;
+    RoutableMessageHeader rmh;
+    rmh.SerializeToString(&data);
+    body.AppendToString(&data);
+    record.mStreams[shard]->send(MemoryReference(data),Network::ReliableOrdered);
+}
+
+void ShardedProximityConnection::updateShards(const ObjectReference&object, ObjectRecord&record) {
+    if (record.mRetObj.empty())
+        return;
+    uint32 needed=shardsBetween(record.mPosition.x-mMargin,record.mPosition.x+mMargin);
+    for (ObjectRecord::QueryMap::iterator i=record.mQueries.begin(),ie=record.mQueries.end();i!=ie;++i) {
+        needed|=queryShards(record,i->second);
+    }
+    record.mStreams.resize(mShardStreams.size(),NULL);
+    for (uint32 s=0;s<mShardStreams.size();++s) {
+        uint32 bit=1u<<s;
+        if ((needed&bit)&&!(record.mShards&bit)) {
+            record.mStreams[s]=mShardStreams[s]->clone(&Network::Stream::ignoreConnectionStatus,
+                                                       std::tr1::bind(&ShardedProximityConnection::readShardMessage,
+                                                                      std::tr1::weak_ptr<Network::Stream>(mShardStreams[s]),
+                                                                      this,
+                                                                      s,
+                                                                      object,
+                                                                      _1));
+            record.mShards|=bit;
+            sendToShard(object,record,s,"RetObj",record.mRetObj);
+        }
+    }
+    RoutableMessageBody exits;
+    for (ObjectRecord::QueryMap::iterator i=record.mQueries.begin(),ie=record.mQueries.end();i!=ie;++i) {
+        QueryRecord&query=i->second;
+        uint32 covered=queryShards(record,query);
+        for (uint32 s=0;s<mShardStreams.size();++s) {
+            uint32 bit=1u<<s;
+            if ((covered&bit)&&!(query.mShards&bit)) {
+                sendToShard(object,record,s,"NewProxQuery",query.mNewProxQuery);
+            }else if ((query.mShards&bit)&&!(covered&bit)) {
+                Protocol::DelProxQuery delQuery;
+                delQuery.set_query_id(i->first);
+                String delQueryString;
+                delQuery.SerializeToString(&delQueryString);
+                sendToShard(object,record,s,"DelProxQuery",delQueryString);
+                dropShardResults(query,i->first,s,exits);
+            }
+        }
+        query.mShards=covered;
+    }
+    for (uint32 s=0;s<mShardStreams.size();++s) {
+        uint32 bit=1u<<s;
+        if ((record.mShards&bit)&&!(needed&bit)) {
+            Protocol::DelObj delObj;
+            delObj.set_object_reference(object.getAsUUID());
+            String delObjString;
+            delObj.SerializeToString(&delObjString);
+            sendToShard(object,record,s,"DelObj",delObjString);
+            record.mStreams[s]->close();
+            delete record.mStreams[s];
+            record.mStreams[s]=NULL;
+            record.mShards&=~bit;
+        }
+    }
+    if (exits.message_size()&&mParent) {
+        std::string data;
+        exits.SerializeToString(&data);
+        RoutableMessageHeader hdr;
+        hdr.set_destination_object(object);
+        mParent->processMessage(hdr,MemoryReference(data));
+    }
+}
+
+void ShardedProximityConnection::dropShardResults(QueryRecord&query, uint32 queryId, uint32 shard, RoutableMessageBody&exits) {
+    for (QueryRecord::ResultMap::iterator i=query.mResults.begin();i!=query.mResults.end();) {
+        i->second&=~(1u<<shard);
+        if (i->second==0) {
+            addProxCall(exits,queryId,i->first,Protocol::ProxCall::EXITED_PROXIMITY);
+            query.mResults.erase(i++);
+        }else {
+            ++i;
+        }
+    }
+}
+
+void ShardedProximityConnection::mergeProxCall(ObjectRecord&record, uint32 shard, uint32 queryId, const UUID&proximateObject, bool entered, RoutableMessageBody&merged) {
+    ObjectRecord::QueryMap::iterator where=record.mQueries.find(queryId);
+    if (where==record.mQueries.end()||!(where->second.mShards&(1u<<shard))) {
+        //a query since deleted or withdrawn from that server
+        return;
+    }
+    QueryRecord::ResultMap&results=where->second.mResults;
+    if (entered) {
+        uint32&shards=results[proximateObject];
+        if (shards==0)
+            addProxCall(merged,queryId,proximateObject,Protocol::ProxCall::ENTERED_PROXIMITY);
+        shards|=(1u<<shard);
+    }else {
+        QueryRecord::ResultMap::iterator result=results.find(proximateObject);
+        if (result!=results.end()) {
+            result->second&=~(1u<<shard);
+            if (result->second==0) {
+                addProxCall(merged,queryId,proximateObject,Protocol::ProxCall::EXITED_PROXIMITY);
+                results.erase(result);
+            }
+        }
+    }
+}
+
+void ShardedProximityConnection::readShardMessage(const std::tr1::weak_ptr<Network::Stream>&lock,
+                                                  ShardedProximityConnection*thus,
+                                                  uint32 shard,
+                                                  const ObjectReference&object,
+                                                  const Network::Chunk&chunk) {
+    std::tr1::shared_ptr<Network::Stream> lok=lock.lock();//make sure this proximity connection will not disappear
+    if (!lok||chunk.empty())
+        return;
+    ObjectMap::iterator where=thus->mObjects.find(object);
+    if (where==thus->mObjects.end()||thus->mParent==NULL)
+        return;
+    RoutableMessageHeader hdr;
+    MemoryReference body=hdr.ParseFromArray(&chunk[0],chunk.size());
+    RoutableMessageBody incoming;
+    if (!incoming.ParseFromArray(body.data(),body.size())) {
+        SILOG(proximity,warning,"Unparseable message from proximity manager "<<shard);
+        return;
+    }
+    RoutableMessageBody merged;
+    for (int i=0;i<incoming.message_size();++i) {
+        const String&name=incoming.message_names(i);
+        if (name=="ProxCall") {
+            Protocol::ProxCall call;
+            if (call.ParseFromString(incoming.message_arguments(i))) {
+                if (call.proximity_event()==Protocol::ProxCall::STATELESS_PROXIMITY)
+                    merged.add_message(name,incoming.message_arguments(i));
+                else
+                    thus->mergeProxCall(where->second,shard,call.query_id(),call.proximate_object(),
+                                        call.proximity_event()==Protocol::ProxCall::ENTERED_PROXIMITY,merged);
+            }
+        }else if (name=="ProxCallBatch") {
+            Protocol::ProxCallBatch batch;
+            if (batch.ParseFromString(incoming.message_arguments(i))) {
+                for (int j=0;j<batch.calls_size();++j) {
+                    if (batch.calls(j).proximity_event()==Protocol::ProxCall::STATELESS_PROXIMITY)
+                        addProxCall(merged,batch.calls(j).query_id(),batch.calls(j).proximate_object(),Protocol::ProxCall::STATELESS_PROXIMITY);
+                    else
+                        thus->mergeProxCall(where->second,shard,batch.calls(j).query_id(),batch.calls(j).proximate_object(),
+                                            batch.calls(j).proximity_event()==Protocol::ProxCall::ENTERED_PROXIMITY,merged);
+                }
+            }
+        }else {
+            merged.add_message(name,incoming.message_arguments(i));
+        }
+    }
+    if (merged.message_size()) {
+        std::string data;
+        merged.SerializeToString(&data);
+        hdr.set_destination_object(object);
+        thus->mParent->processMessage(hdr,MemoryReference(data));
+    }
+}
+
+void ShardedProximityConnection::processMessage(const RoutableMessageHeader&hdr,
+                                                MemoryReference message_body) {
+    ObjectMap::iterator where=mObjects.find(hdr.has_source_object()?hdr.source_object():ObjectReference::null());
+    if (where==mObjects.end()) {
+        where=mObjects.find(hdr.has_destination_object()?hdr.destination_object():ObjectReference::null());
+    }
+    if (where==mObjects.end()) {
+        SILOG(proximity,error,"Cannot locate object with OR "<<hdr.source_object()<<" in the proximity connection map: "<<hdr.has_source_object());
+        return;
+    }
+    RoutableMessageBody body;
+    if (!body.ParseFromArray(message_body.data(),message_body.size())) {
+        SILOG(proximity,warning,"Unparseable message for the proximity managers");
+        return;
+    }
+    const ObjectReference&object=where->first;
+    ObjectRecord&record=where->second;
+    for (int i=0;i<body.message_size();++i) {
+        const String&name=body.message_names(i);
+        const String&argument=body.message_arguments(i);
+        if (name=="RetObj") {
+            Protocol::RetObj retObj;
+            if (retObj.ParseFromString(argument)) {
+                record.mRetObj=argument;
+                record.mPosition=retObj.location().position();
+                for (uint32 s=0;s<mShardStreams.size();++s)
+                    sendToShard(object,record,s,name,argument);
+                updateShards(object,record);
+            }
+        }else if (name=="ObjLoc") {
+            Protocol::ObjLoc loc;
+            Protocol::RetObj retObj;
+            if (loc.ParseFromString(argument)&&retObj.ParseFromString(record.mRetObj)) {
+                for (uint32 s=0;s<mShardStreams.size();++s)
+                    sendToShard(object,record,s,name,argument);
+                if (loc.has_timestamp())
+                    retObj.mutable_location().set_timestamp(loc.timestamp());
+                if (loc.has_position()) {
+                    record.mPosition=loc.position();
+                    retObj.mutable_location().set_position(record.mPosition);
+                }
+                if (loc.has_velocity())
+                    retObj.mutable_location().set_velocity(loc.velocity());
+                retObj.SerializeToString(&record.mRetObj);
+                updateShards(object,record);
+            }
+        }else if (name=="NewProxQuery") {
+            Protocol::NewProxQuery newQuery;
+            if (newQuery.ParseFromString(argument)) {
+                QueryRecord query;
+                query.mNewProxQuery=argument;
+                query.mAbsolute=newQuery.has_absolute_center();
+                query.mCenter=query.mAbsolute?Vector3d(newQuery.absolute_center()):Vector3d(0,0,0);
+                query.mOffset=newQuery.has_relative_center()?Vector3f(newQuery.relative_center()):Vector3f(0,0,0);
+                query.mRadius=newQuery.has_max_radius()?newQuery.max_radius():-1.0;
+                query.mShards=0;
+                if (newQuery.stateless()) {
+                    //answered once and forgotten, by the servers the object is on already
+                    uint32 covered=queryShards(record,query);
+                    for (uint32 s=0;s<mShardStreams.size();++s) {
+                        if (covered&(1u<<s))
+                            sendToShard(object,record,s,name,argument);
+                    }
+                }else {
+                    record.mQueries[newQuery.query_id()]=query;
+                    updateShards(object,record);
+                }
+            }
+        }else if (name=="DelProxQuery") {
+            Protocol::DelProxQuery delQuery;
+            ObjectRecord::QueryMap::iterator query;
+            if (delQuery.ParseFromString(argument)&&(query=record.mQueries.find(delQuery.query_id()))!=record.mQueries.end()) {
+                for (uint32 s=0;s<mShardStreams.size();++s) {
+                    if (query->second.mShards&(1u<<s))
+                        sendToShard(object,record,s,name,argument);
+                }
+                record.mQueries.erase(query);
+                updateShards(object,record);
+            }
+        }else {
+            for (uint32 s=0;s<mShardStreams.size();++s)
+                sendToShard(object,record,s,name,argument);
+        }
+    }
+}
+
+void ShardedProximityConnection::constructObjectStream(const ObjectReference&obc) {
+    mObjects[obc];
+}
+void ShardedProximityConnection::deleteObjectStream(const ObjectReference&obc) {
+    ObjectMap::iterator where=mObjects.find(obc);
+    if (where==mObjects.end()) {
+        SILOG(proximity,error,"Cannot locate object with OR "<<obc<<" in the proximity connection map");
+    }else {
+        for (std::vector<Network::Stream*>::iterator i=where->second.mStreams.begin(),ie=where->second.mStreams.end();i!=ie;++i) {
+            if (*i) {
+                (*i)->close();
+                delete *i;
+            }
+        }
+        mObjects.erase(where);
+    }
+}
+} }
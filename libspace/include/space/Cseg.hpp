@@ -0,0 +1,98 @@
+/*  Sirikata libspace -- Coordinate Segmentation
+ *  Cseg.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_CSEG_HPP_
+#define _SIRIKATA_CSEG_HPP_
+
+#include <space/Platform.hpp>
+#include <network/Address.hpp>
+
+namespace Sirikata {
+
+/**
+ * Coordinate segmentation: splits the bounds of the space into a grid of regions along x and z, each hosted by one space server.
+ * Every server of a space is given the same layout, so any of them can tell which server hosts a position;
+ * positions outside the bounds belong to the nearest region.
+ * As a service it answers CsegLookup messages, handing the CsegServer replies to the services it forwards to
+ */
+class SIRIKATA_SPACE_EXPORT Cseg : public MessageService {
+    std::vector<MessageService*> mServices;
+    BoundingBox3d3f mBounds;
+    uint32 mRegionsX;
+    uint32 mRegionsZ;
+    ///the server hosting each region, rows along x one after the other
+    std::vector<uint32> mRegionServers;
+    ///where object hosts connect to each server
+    std::vector<Network::Address> mServers;
+public:
+    ///a space with a single region on a single server
+    Cseg();
+    ~Cseg();
+    ///splits bounds into regionsX by regionsZ regions, handed out to the servers in runs of neighbouring regions
+    void setLayout(const BoundingBox3d3f&bounds, uint32 regionsX, uint32 regionsZ, const std::vector<Network::Address>&servers);
+    uint32 numRegions()const {
+        return (uint32)mRegionServers.size();
+    }
+    uint32 regionsX()const {
+        return mRegionsX;
+    }
+    uint32 regionsZ()const {
+        return mRegionsZ;
+    }
+    uint32 numServers()const {
+        return mServers.empty()?1:(uint32)mServers.size();
+    }
+    ///where object hosts connect to server, or Address::null() if the space has a single server
+    Network::Address serverAddress(uint32 server)const {
+        return server<mServers.size()?mServers[server]:Network::Address::null();
+    }
+    uint32 regionAt(const Vector3d&position)const;
+    BoundingBox3d3f regionBounds(uint32 region)const;
+    uint32 serverForRegion(uint32 region)const {
+        return mRegionServers[region];
+    }
+    uint32 serverAt(const Vector3d&position)const {
+        return mRegionServers[regionAt(position)];
+    }
+    ///hands a region over to another server: every server of the space must be told the same
+    void assignRegion(uint32 region, uint32 server) {
+        mRegionServers[region]=server;
+    }
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&header,
+                        MemoryReference message_body);
+}; // class Cseg
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_CSEG_HPP_
@@ -0,0 +1,125 @@
+/*  Sirikata libspace -- Load Balancing
+ *  LoadBalancer.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_LOAD_BALANCER_HPP_
+#define _SIRIKATA_LOAD_BALANCER_HPP_
+
+#include <space/Platform.hpp>
+#include <space/Router.hpp>
+#include <util/ObjectReference.hpp>
+#include <util/Time.hpp>
+
+namespace Sirikata {
+class Cseg;
+class Registration;
+class ObjectConnections;
+
+/**
+ * Keeps the load of the servers of a space within a band around their mean by handing regions of the Cseg from busy servers to idle ones.
+ * The load of a region is the number of objects in it plus the location updates they send per second, weighted by the message weight;
+ * a server's load is that of its regions, scaled up by how far its CPU use is over the CPU target.
+ * Every interval each server tells the others its load, and one above the band hands the least loaded server one of its regions,
+ * preferring regions next to those the other already hosts, so each server's regions stay together.
+ * Objects in a region that changes hands, or that move into a region hosted elsewhere, are admitted by the server now hosting them
+ * and then asked to resume themselves there with MigrateObj, keeping their ObjectReference
+ */
+class SIRIKATA_SPACE_EXPORT LoadBalancer : public MessageService, public ServerMessageService {
+    class ObjectRecord {
+    public:
+        ///the RetObj the object was registered with
+        String mRetObj;
+        Vector3d mPosition;
+        uint32 mRegion;
+        ///the server the object is being handed to, if any
+        uint32 mMigratingTo;
+    };
+    typedef std::tr1::unordered_map<ObjectReference,ObjectRecord,ObjectReference::Hasher> ObjectMap;
+    ObjectMap mObjects;
+    ///objects hosted here in each region
+    std::vector<uint32> mRegionObjects;
+    ///location updates from each region since the last tick
+    std::vector<uint32> mRegionMessages;
+    ///the last load each server reported, and when
+    std::vector<double> mServerLoads;
+    std::vector<Time> mServerReports;
+    Network::IOService*mIO;
+    Cseg*mCoordinateSegmentation;
+    Router*mRouter;
+    const Registration*mRegistration;
+    ObjectConnections*mObjectConnections;
+    ///told of objects admitted from other servers as if they had just registered here
+    std::vector<MessageService*> mServices;
+    Duration mInterval;
+    double mBand;
+    double mMessageWeight;
+    double mCpuTarget;
+    Time mLastTick;
+    double mLastCpuSeconds;
+    Time mLastHandover;
+    void tick();
+    void sendToServer(uint32 server, const String&name, const String&argument);
+    void addObject(const ObjectReference&object, const String&retObj);
+    void removeObject(const ObjectReference&object);
+    void moveObject(const ObjectReference&object, ObjectRecord&record, const Vector3d&position);
+    ///hands an object to the server hosting its region, if that is no longer this one
+    void checkHost(const ObjectReference&object, ObjectRecord&record);
+    void handOverRegion(uint32 region, uint32 server);
+    void admitObject(uint32 server, const String&argument);
+    ///whether region borders one hosted by server
+    bool bordersServer(uint32 region, uint32 server)const;
+public:
+    /**
+     * Balances every interval once the first tick is scheduled by start, handing on a region once this server's load is
+     * band times the mean over it. Objects admitted here stay registered with the ObjectConnections for its resume grace period
+     */
+    LoadBalancer(Network::IOService*io,
+                 Cseg*coordinateSegmentation,
+                 Router*router,
+                 const Registration*registration,
+                 ObjectConnections*objectConnections,
+                 const Duration&interval,
+                 double band=0.25,
+                 double messageWeight=0.1,
+                 double cpuTarget=0.8);
+    ~LoadBalancer();
+    void start();
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    ///follows objects through the RetObj and DelObj messages of the Registration service and the ObjLoc updates of Loc
+    void processMessage(const RoutableMessageHeader&header,
+                        MemoryReference message_body);
+    void processServerMessage(uint32 server, MemoryReference message_body);
+}; // class LoadBalancer
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_LOAD_BALANCER_HPP_
@@ -35,6 +35,7 @@
 
 #include <space/Platform.hpp>
 #include <util/ObjectReference.hpp>
+#include <util/Time.hpp>
 
 namespace Sirikata {
 namespace Protocol {
@@ -44,14 +45,60 @@ class Loc;
 class Oseg;
 class Cseg;
 
+/**
+ * Forwards every object's location updates to the services registered with it.
+ * A service may narrow what it is sent to an interest region with setInterest: it then only hears about objects in (or leaving) the region,
+ * and objects further from the center are forwarded less often. Interest regions are indexed in a uniform grid,
+ * so the cost of an update depends on how many services care about where the object is, not on how many there are
+ */
 class SIRIKATA_SPACE_EXPORT Loc : public MessageService {
     std::vector<MessageService*> mServices;
+    ///A grid cell of the spatial index
+    class Cell {
+    public:
+        int32 x,y,z;
+        bool operator==(const Cell&other)const{return x==other.x&&y==other.y&&z==other.z;}
+        class Hasher {public:
+            size_t operator()(const Cell&c)const{return (size_t)c.x*73856093u^(size_t)c.y*19349663u^(size_t)c.z*83492791u;}
+        };
+    };
+    class Interest {
+    public:
+        MessageService*mService;
+        Vector3d mCenter;
+        double mRadius;
+        ///when each object this service is hearing about was last forwarded to it
+        std::tr1::unordered_map<ObjectReference,Time,ObjectReference::Hasher> mLastSent;
+    };
+    typedef std::tr1::unordered_map<Cell,std::vector<Interest*>,Cell::Hasher> InterestGrid;
+    InterestGrid mInterestGrid;
+    ///interests covering too many cells to index: checked against every update
+    std::vector<Interest*> mUnindexedInterests;
+    std::tr1::unordered_map<MessageService*,Interest*> mInterests;
+    ///the cell each object was last seen in, so services watching that cell hear about the object leaving
+    std::tr1::unordered_map<ObjectReference,Cell,ObjectReference::Hasher> mObjectCells;
+    double mCellSize;
+    ///how often an object at the edge of an interest region is forwarded: nearer objects proportionally more often
+    Duration mEdgeUpdateInterval;
+    Cell cellFor(const Vector3d&position)const;
+    void indexInterest(Interest*, bool add);
+    ///\returns whether the update should reach the interested service now, updating its records of the object
+    bool admit(Interest*, const ObjectReference&, const Vector3d&position, bool force, const Time&now);
+    ///drops what the index knows of a deleted object
+    void forgetObject(const ObjectReference&object_reference);
     void processMessage(const ObjectReference&object_reference,const Protocol::ObjLoc&loc);
 public:
-    Loc();
+    Loc(double cellSize=64.0, const Duration&edgeUpdateInterval=Duration::milliseconds(500.0));
     ~Loc();
     bool forwardMessagesTo(MessageService*);
     bool endForwardingMessagesTo(MessageService*);
+    /**
+     * Limits the updates a service registered with forwardMessagesTo receives to objects within radius of center.
+     * May be called again as the region moves
+     */
+    void setInterest(MessageService*, const Vector3d&center, double radius);
+    ///Goes back to sending the service every update
+    void clearInterest(MessageService*);
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
 
@@ -35,6 +35,13 @@
 #include <space/Platform.hpp>
 #include <network/Stream.hpp>
 namespace Sirikata {
+class RoutableMessageHeaderView;
+namespace Network {
+class StreamCaptureWriter;
+}
+namespace Protocol {
+class RetObj;
+}
 
 /**
  * This class holds all the direct object connections out to actual live objects connected to this space node
@@ -43,8 +50,9 @@ namespace Sirikata {
  * Permanent streams are generated when the Registration service returns a valid ObjectReference
  */
 class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
-    typedef std::vector<Network::Stream*> StreamSet;
-    ///Object with active ID's (map from ObjectReference to Stream*)
+    class StreamMapUUID;
+    typedef std::vector<StreamMapUUID*> StreamSet;
+    ///Object with active ID's (map from ObjectReference to the state of each of its streams)
     typedef std::tr1::unordered_map<UUID,StreamSet,UUID::Hasher>StreamMap;
     StreamMap mActiveStreams;
 
@@ -56,22 +64,38 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     class TemporaryStreamData {
     public:
         Network::Stream*mStream;
+        ///the stream, or the object on a multiplexed stream, that receives the permanent ID
+        StreamMapUUID*mState;
         size_t mTotalMessageSize;
         std::vector<Network::Chunk>mPendingMessages;
-        TemporaryStreamData(){mStream=NULL;mTotalMessageSize=0;}
+        TemporaryStreamData(){mStream=NULL;mState=NULL;mTotalMessageSize=0;}
     };
     /**
-     *This class holds whether a given Stream* is connected and the ID (ObjectReference or temp ID) of the Stream*
+     * This class holds whether a given Stream* is connected and the ID (ObjectReference or temp ID) of the Stream*
+     * Each stream's callbacks are bound to its own StreamMapUUID when it is accepted, so packets need no lookup to find it
      */
     class StreamMapUUID {
+        Network::Stream*mStream;
         UUID mId;
         bool mConnected;
         bool mConnecting;
+        bool mBatching;
+        bool mMultiplexed;
+        bool mHasObjectHostKey;
+        UUID mObjectHostKey;
     public:
         StreamMapUUID() {
+            mStream=NULL;
             mConnected=false;
             mConnecting=false;
+            mBatching=false;
+            mMultiplexed=false;
+            mHasObjectHostKey=false;
         }
+        void setStream(Network::Stream*stream) {
+            mStream=stream;
+        }
+        Network::Stream*stream() const{return mStream;}
         void setId(const UUID&id) {
             mId=id;
         }
@@ -81,6 +105,16 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
         void setConnected(){mConnected=true;}
         void setDisconnected(){mConnected=false;}
         bool connected() const{return mConnected;}
+        ///The object host on the other side has asked for its messages to be sent in batches
+        void setBatching(){mBatching=true;}
+        bool batching() const{return mBatching;}
+        ///The object host sends many objects' messages down this stream, each with its own key in source_object
+        void setMultiplexed(){mMultiplexed=true;}
+        bool multiplexed() const{return mMultiplexed;}
+        ///Marks this as one object on a multiplexed stream: messages to it carry key as their destination_object
+        void setObjectHostKey(const UUID&key){mObjectHostKey=key;mHasObjectHostKey=true;}
+        bool hasObjectHostKey() const{return mHasObjectHostKey;}
+        const UUID&objectHostKey() const{return mObjectHostKey;}
         const UUID& uuid() {
             return mId;
         }
@@ -91,8 +125,11 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     ///Objects in the process of receiving a permanent ID, mapping a UUID to a Stream* and messages pending send
     typedef std::multimap<UUID,TemporaryStreamData> TemporaryStreamMultimap;
     TemporaryStreamMultimap mTemporaryStreams;
-    ///Every active stream maps to either a temporary ID in mTemporaryStreams or a permanent ObjectReference in mActiveStreams
+    ///Every active stream maps to either a temporary ID in mTemporaryStreams or a permanent ObjectReference in mActiveStreams: elements never move, so StreamSets and callbacks point at them
     std::tr1::unordered_map<Network::Stream*,StreamMapUUID>mStreams;
+    ///The objects on each multiplexed stream, by the key their object host gave them: elements never move either
+    typedef std::tr1::unordered_map<UUID,StreamMapUUID,UUID::Hasher> MultiplexedObjectMap;
+    std::tr1::unordered_map<Network::Stream*,MultiplexedObjectMap>mMultiplexedObjects;
     ///to forward messages to
     MessageService * mSpace;
     ///the maximum number of bytes allowed to be pending for a temporary object id
@@ -103,6 +140,61 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     Network::StreamListener*mListener;
     ///The message that lets users know which services the space supports and on what ObjectReferences
     String mSpaceServiceIntroductionMessage;
+    ///IO service on which pending batches are flushed
+    Network::IOService*mIO;
+    ///Where the bytes object hosts send are recorded for spacereplay, or NULL when not capturing
+    Network::StreamCaptureWriter*mCapture;
+    ///Header of the message carrying a batch: each message in its body is preceded by its length as a uint30
+    String mBatchHeader;
+    ///Messages waiting to go out to streams that asked for batching
+    std::tr1::unordered_map<Network::Stream*,String> mPendingBatches;
+    ///a batch is sent as soon as it holds this many bytes
+    size_t mMaxBatchSize;
+    ///how long a message may wait in a batch for company
+    Duration mBatchDelay;
+    bool mBatchFlushScheduled;
+    ///An object whose RetObj carried a resume token: it may take itself over from a new stream by presenting it
+    class ResumableObject {
+    public:
+        UUID mToken;
+        ///while mSuspended the object has no streams, and is deleted if not resumed by this time
+        Time mExpiry;
+        bool mSuspended;
+        ResumableObject(const UUID&token):mToken(token),mExpiry(Time::null()),mSuspended(false){}
+    };
+    typedef std::tr1::unordered_map<UUID,ResumableObject,UUID::Hasher> ResumableObjectMap;
+    ResumableObjectMap mResumableObjects;
+    ///how long a resumable object outlives its last stream
+    Duration mResumeGracePeriod;
+    ///deletes a suspended object, unless it was resumed since its stream dropped
+    void expireSuspendedObject(UUID id);
+    /**
+     * moves a temporary stream or multiplexed object over to the object named in the ResumeObj argument
+     * \returns false, leaving the stream temporary, if the token does not match
+     */
+    bool resumeObject(StreamMapUUID&state,const String&argument);
+    ///handles a message to the OBJECT_CONNECTIONS port, where an object host sets options for its stream
+    void processConnectionOptions(StreamMapUUID&stream,MemoryReference body_array);
+    ///sends a message to an object, or queues it if the stream receives batches
+    void sendToStream(StreamMapUUID*stream,MemoryReference header,MemoryReference body_array);
+    void flushBatch(Network::Stream*stream);
+    ///picks one of the streams a connected object may be reached through
+    StreamMapUUID*chooseStream(const StreamSet&streams);
+    ///hands a message on a multiplexed stream to the state of the object named by its source_object, creating one if needed
+    void multiplexedBytesReceived(StreamMapUUID*stream,const Network::Chunk&chunk);
+    ///the state of the object with the given key on a multiplexed stream, made temporary if it is new
+    StreamMapUUID*multiplexedObject(StreamMapUUID*stream,const UUID&key);
+    ///passes a NewObjBatch for objects on a multiplexed stream to the Registration service, under their temporary IDs
+    void registerObjectBatch(StreamMapUUID*stream,MemoryReference body_array);
+    ///activates the objects of a RetObjBatch, answering their object host in one message: false if the message is not one
+    bool processNewObjectBatch(const RoutableMessageHeader&hdr,MemoryReference body_array);
+    ///moves the streams of a temporary ID over to the permanent newRef, returning one of them or NULL if there are none left
+    StreamMapUUID*activateTemporaryObject(const UUID&uuid,const ObjectReference&newRef,const Protocol::RetObj&ro);
+    ///forgets a stream or multiplexed object, letting the Registration service know if it was connected
+    void disconnectState(StreamMapUUID*state);
+    ///removes an object from its multiplexed stream, leaving the stream to the other objects
+    void eraseMultiplexedObject(Network::Stream*stream,UUID key);
+    void flushBatches();
     ///processes a message from the RegistrationService: returns true if the object is a new object (false if the object was deleted)
     bool processNewObject(const RoutableMessageHeader&hdr,MemoryReference body_array,ObjectReference&);
     ///processes a message for an object that exists in the Space (i.e. not a temporary object with fake UUID), forwarding message if necessary
@@ -117,15 +209,44 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
      *                                     or giving up and forwarding them to mSpace in the hopes
      *                                     that they may to a service or a forwader
      */
-    void bytesReceivedCallback(Network::Stream*stream,const Network::Chunk&chunk);
+    void bytesReceivedCallback(StreamMapUUID*stream,const Network::Chunk&chunk);
+    ///bytesReceivedCallback for streams accepted while capturing: records chunk before processing it
+    void capturedBytesReceivedCallback(Network::Stream*stream,StreamMapUUID*state,const Network::Chunk&chunk);
     ///makes a Disconnection message for the Registration service in the event a connection should unexpectedly close
     void forgeDisconnectionMessage(const ObjectReference&ref);
     ///actually close a Stream connection to an object.
     void shutdownConnection(const ObjectReference&ref);
   public:
-    ObjectConnections(Network::StreamListener*listener,                      
+    ObjectConnections(Network::IOService*io,
+                      Network::StreamListener*listener,
                       const Network::Address &listenAddress);
     ~ObjectConnections();
+    /**
+     * Objects that asked to be resumable stay registered this long after their last stream drops,
+     * waiting for their object host to reconnect. 0 deletes them right away, like any other object.
+     */
+    void setResumeGracePeriod(const Duration&gracePeriod) {
+        mResumeGracePeriod=gracePeriod;
+    }
+    const Duration&resumeGracePeriod()const {
+        return mResumeGracePeriod;
+    }
+    /**
+     * Records everything object hosts send on streams accepted from now on to filename, see Network::StreamCaptureWriter.
+     * \returns false if the file could not be created
+     */
+    bool captureTo(const String&filename);
+    /**
+     * Expects an object registered with another server of the space to resume itself here with resumeToken,
+     * for as long as a suspended object waits for its object host
+     */
+    void admitObject(const ObjectReference&object, const UUID&resumeToken);
+    /**
+     * Asks a connected object to resume itself on the server object hosts reach at address, which has admitted it.
+     * It is forgotten here as soon as its connection to this server drops
+     * \returns false if the object is not connected here
+     */
+    bool migrateObject(const ObjectReference&object, const Network::Address&address, const UUID&resumeToken);
     ///If there's an active connection to a given object reference
     Network::Stream* activeConnectionTo(const ObjectReference&);
     ///If there's an as-of-yet-unnamed connection to a given object reference
@@ -137,6 +258,12 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     ///Processes a message destined for an Object referenced by either temporary (from registrationService) or permanent (from anyone else) ID in the header
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
+    /**
+     * Sends a message straight out the stream of a connected object, rewriting only the header fields that change
+     * \returns false, leaving header alone, if the destination object is not connected here
+     */
+    bool forwardToConnectedObject(RoutableMessageHeaderView&header,
+                                  MemoryReference message_body);
     
 };
 }
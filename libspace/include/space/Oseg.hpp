@@ -0,0 +1,95 @@
+/*  Sirikata libspace -- Object Segmentation
+ *  Oseg.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_OSEG_HPP_
+#define _SIRIKATA_OSEG_HPP_
+
+#include <space/Platform.hpp>
+#include <util/ObjectReference.hpp>
+#include <space/Router.hpp>
+
+namespace Sirikata {
+
+/**
+ * Object segmentation: which space server hosts each object.
+ * Every object has a home server, picked from its ObjectReference, which the server hosting the object keeps up to date.
+ * A server with a message for an object it knows nothing about sends it to the object's home, which passes it on and
+ * tells the sender where the object lives. Such answers are cached, and dropped as soon as the server named in one
+ * turns out not to host the object any more
+ */
+class SIRIKATA_SPACE_EXPORT Oseg : public MessageService, public ServerMessageService {
+public:
+    enum {UNKNOWN_SERVER=0xffffffff};
+private:
+    uint32 mServerIndex;
+    uint32 mNumServers;
+    Router*mRouter;
+    typedef std::tr1::unordered_map<ObjectReference,uint32,ObjectReference::Hasher> ServerMap;
+    ///objects registered with this server
+    std::tr1::unordered_set<ObjectReference,ObjectReference::Hasher> mLocalObjects;
+    ///the server hosting each object whose home is this server
+    ServerMap mHomeObjects;
+    ///where objects with other homes were last heard to be: the oldest are forgotten once mMaxCacheSize are held
+    ServerMap mCache;
+    std::deque<ObjectReference> mCacheOrder;
+    size_t mMaxCacheSize;
+    void addLocalObject(const ObjectReference&object);
+    void removeLocalObject(const ObjectReference&object);
+    void cacheServer(const ObjectReference&object, uint32 host);
+    ///sends server an OsegUpdate saying host (or no server, if UNKNOWN_SERVER) hosts object
+    void sendUpdate(uint32 server, const ObjectReference&object, uint32 host);
+public:
+    Oseg(size_t maxCacheSize=65536);
+    ~Oseg();
+    ///makes this server serverIndex of numServers, reaching the others through router. Until then every object is local or nowhere
+    void setServers(uint32 serverIndex, uint32 numServers, Router*router);
+    uint32 serverIndex()const {
+        return mServerIndex;
+    }
+    uint32 homeServer(const ObjectReference&object)const;
+    ///the server believed to host object, or UNKNOWN_SERVER
+    uint32 lookup(const ObjectReference&object)const;
+    ///tells server where this one believes object lives, after server sent it a message for object it could not deliver
+    void sendLocation(uint32 server, const ObjectReference&object);
+    ///handles an OsegUpdate sent by another server
+    void processServerMessage(uint32 server, MemoryReference message_body);
+    ///Oseg only answers other servers, through its Router
+    bool forwardMessagesTo(MessageService*){return false;}
+    bool endForwardingMessagesTo(MessageService*){return false;}
+    ///watches the RetObj and DelObj messages of the Registration service for objects joining and leaving this server
+    void processMessage(const RoutableMessageHeader&header,
+                        MemoryReference message_body);
+}; // class Oseg
+
+} // namespace Sirikata
+
+#endif //_SIRIKATA_OSEG_HPP_
@@ -36,7 +36,12 @@
 #include <space/Platform.hpp>
 #include "util/Sha256.hpp"
 #include "util/ObjectReference.hpp"
+#include "util/CompactLocation.hpp"
 namespace Sirikata {
+namespace Protocol {
+class NewObj;
+class RetObj;
+}
 class Registration;
 class Oseg;
 class Cseg;
@@ -44,8 +49,12 @@ class Cseg;
 class SIRIKATA_SPACE_EXPORT Registration : public MessageService {
     std::vector<MessageService*> mServices;
     SHA256 mPrivateKey;
+    ///granted to every object whose NewObj asks for compact location updates, unless the sector size is 0
+    CompactLocationFormat mCompactFormat;
+    ///fills in the RetObj for a NewObj: false if the request lacks a location or bounds
+    bool registerObject(const Protocol::NewObj&newObj,Protocol::RetObj&retObj) const;
 public:
-    Registration(const SHA256&privateKey);
+    Registration(const SHA256&privateKey, double compactSectorSize=1024.0, float compactMaxSpeed=256.0f);
     ~Registration();
     bool forwardMessagesTo(MessageService*);
     bool endForwardingMessagesTo(MessageService*);
@@ -57,6 +66,11 @@ public:
      */
     void asyncRegister(const RoutableMessageHeader&header,
                        const RoutableMessageBody& message_body);
+    /**
+     * The token handed to an object that asked to be resumable: only the
+     * holder of the private key can make one for a given object reference.
+     */
+    UUID resumeToken(const UUID&object_reference) const;
 }; // class Space
 
 } // namespace Sirikata
@@ -34,17 +34,79 @@
 #define _SIRIKATA_ROUTER_HPP_
 
 #include <space/Platform.hpp>
+#include <network/Stream.hpp>
+#include <network/StreamListener.hpp>
 namespace Sirikata {
+class Oseg;
+class ObjectConnections;
 
+///A space service that hears from its counterparts on the other servers of the space through the Router
+class SIRIKATA_SPACE_EXPORT ServerMessageService {
+public:
+    virtual ~ServerMessageService(){}
+    ///handles a message that the same service on server sent with Router::sendToServer
+    virtual void processServerMessage(uint32 server, MemoryReference message_body)=0;
+};
+
+/**
+ * Carries messages for objects hosted by other servers of the space to them, over a stream to each server opened the first time it is needed.
+ * Messages go to the server Oseg says hosts the object, or to the object's home server if it does not know.
+ * Each packet between servers is the number of servers it has already been passed on by as a uint8, the index of the server that sent it
+ * as a little endian uint32, then the message as objects send it. A message is passed on at most MAX_HOPS times
+ */
 class SIRIKATA_SPACE_EXPORT Router : public MessageService {
-    std::vector<MessageService*> mServices;
 public:
-	Router(){}
-	~Router(){}
+    enum {MAX_HOPS=3, ENVELOPE_SIZE=5};
+private:
+    Network::IOService*mIO;
+    uint32 mServerIndex;
+    ///where every server of the space listens for the others
+    std::vector<Network::Address> mServers;
+    ///the stream out to each server, NULL until there is something to send it
+    std::vector<Network::Stream*> mServerStreams;
+    Network::StreamListener*mListener;
+    ///streams other servers opened to this one
+    std::tr1::unordered_set<Network::Stream*> mIncomingStreams;
+    Oseg*mObjectSegmentation;
+    ObjectConnections*mObjectConnections;
+    ///services on this server that messages from the other servers to their port go to
+    std::tr1::unordered_map<unsigned int,ServerMessageService*> mServerServices;
+    void sendToServer(uint32 server, uint8 hops, MemoryReference message);
+    void outgoingConnectionCallback(uint32 server, Network::Stream::ConnectionStatus status, const std::string&reason);
+    void newStreamCallback(Network::Stream*stream, Network::Stream::SetCallbacks&callbacks);
+    void incomingConnectionCallback(Network::Stream*stream, Network::Stream::ConnectionStatus status, const std::string&reason);
+    void bytesReceivedCallback(const Network::Chunk&chunk);
+public:
+    /**
+     * Listens for the other servers on the port of servers[serverIndex].
+     * Messages from them for objects connected here are delivered through objectConnections
+     */
+    Router(Network::IOService*io,
+           const std::vector<Network::Address>&servers,
+           uint32 serverIndex,
+           Oseg*objectSegmentation,
+           ObjectConnections*objectConnections);
+    ~Router();
+    uint32 serverIndex()const {
+        return mServerIndex;
+    }
+    uint32 numServers()const {
+        return (uint32)mServers.size();
+    }
+    ///hands messages from other servers to the space service on port to service
+    void addServerService(unsigned int port, ServerMessageService*service) {
+        mServerServices[port]=service;
+    }
+    ///sends a message straight to the given server, for the ServerMessageService on its destination_port there
+    void sendToServer(uint32 server, const RoutableMessageHeader&header, MemoryReference message_body);
+    ///The Router only delivers messages to the ObjectConnections it was made with
+    bool forwardMessagesTo(MessageService*){return false;}
+    bool endForwardingMessagesTo(MessageService*){return false;}
+    ///Sends a message for an object not connected to this server on to the server that hosts it
     void processMessage(const RoutableMessageHeader&header,
-		                MemoryReference message_body){}
-}; // class Space
+                        MemoryReference message_body);
+}; // class Router
 
 } // namespace Sirikata
 
-#endif //_SIRIKATA_REGISTRATION_HPP
+#endif //_SIRIKATA_ROUTER_HPP_
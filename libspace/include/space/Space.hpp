@@ -35,10 +35,14 @@
 
 #include <space/Platform.hpp>
 #include <util/SpaceObjectReference.hpp>
+#include <network/Address.hpp>
+#include <util/Time.hpp>
 namespace Sirikata {
 class Loc;
 class Oseg;
 class Cseg;
+class Registration;
+class LoadBalancer;
 class MessageRouter;
 class ObjectConnections;
 namespace Proximity{
@@ -57,7 +61,7 @@ class SIRIKATA_SPACE_EXPORT Space :public MessageService{
     SpaceID mID;
     Network::IOService*mIO;
     ///The registration service that allows objects to connect to the space and maps them to consistent ObjectReferences
-    MessageService *mRegistration;
+    Registration *mRegistration;
     ///The location services system: arbiter of object locations    
     MessageService * mLoc;
     ///The Proximity System which answers object proximity queries
@@ -70,6 +74,8 @@ class SIRIKATA_SPACE_EXPORT Space :public MessageService{
     MessageService *mRouter;
     ///Active connections to object hosts, with streams to individual objects;
     ObjectConnections* mObjectConnections;
+    ///Hands regions from busy servers to idle ones, if the space spans several and balancing is enabled
+    LoadBalancer *mLoadBalancer;
     ///map from message port to space service
     std::tr1::unordered_map<unsigned int,MessageService*> mServices;
 public:
@@ -83,8 +89,33 @@ public:
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
 
-    Space(const SpaceID&);
+    /**
+     * A space on a single server, on which object hosts connect to port. Proximity queries are answered over the
+     * ProximityConnection registered as proximityConnection, the default one if empty, configured with proximityOptions
+     */
+    Space(const SpaceID&,
+          const String&port="5943",
+          const String&proximityConnection=String(),
+          const String&proximityOptions=String());
     ~Space();
+    /**
+     * Makes this server serverIndex of several hosting the space, each listening for object hosts on objectHostAddresses and
+     * for the other servers on serverAddresses. The Cseg splits bounds into regionsX by regionsZ regions shared out among them:
+     * every server must be given the same arguments, bar serverIndex.
+     * A nonzero balanceInterval has the servers move regions between each other to even out their load, see LoadBalancer
+     */
+    void joinServers(const std::vector<Network::Address>&objectHostAddresses,
+                     const std::vector<Network::Address>&serverAddresses,
+                     uint32 serverIndex,
+                     const BoundingBox3d3f&bounds,
+                     uint32 regionsX,
+                     uint32 regionsZ,
+                     const Duration&balanceInterval=Duration::zero(),
+                     double balanceBand=0.25,
+                     double messageWeight=0.1,
+                     double cpuTarget=0.8);
+    ///Records the traffic of object hosts connecting from now on to filename, for spacereplay. \returns false if it cannot be created
+    bool captureTo(const String&filename);
     ///hands control off to mIO and never returns
     void run();
 
@@ -0,0 +1,141 @@
+/*  Sirikata libspace -- Coordinate Segmentation
+ *  Cseg.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <space/Cseg.hpp>
+#include "Space_Sirikata.pbj.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/KnownServices.hpp"
+namespace Sirikata {
+
+Cseg::Cseg():mBounds(Vector3d(0,0,0),Vector3d(0,0,0)),mRegionsX(1),mRegionsZ(1),mRegionServers(1,0) {
+}
+
+Cseg::~Cseg() {
+}
+
+void Cseg::setLayout(const BoundingBox3d3f&bounds, uint32 regionsX, uint32 regionsZ, const std::vector<Network::Address>&servers) {
+    mBounds=bounds;
+    mRegionsX=regionsX?regionsX:1;
+    mRegionsZ=regionsZ?regionsZ:1;
+    mServers=servers;
+    uint32 num_regions=mRegionsX*mRegionsZ;
+    uint32 num_servers=numServers();
+    mRegionServers.resize(num_regions);
+    for (uint32 i=0;i<num_regions;++i) {
+        mRegionServers[i]=(uint32)((uint64)i*num_servers/num_regions);
+    }
+}
+
+namespace {
+uint32 gridIndex(double position, double low, double across, uint32 count) {
+    if (!(across>0))
+        return 0;
+    double where=std::floor((position-low)*count/across);
+    if (where<0)
+        return 0;
+    if (where>=count)
+        return count-1;
+    return (uint32)where;
+}
+}
+
+uint32 Cseg::regionAt(const Vector3d&position)const {
+    uint32 x=gridIndex(position.x,mBounds.min().x,mBounds.across().x,mRegionsX);
+    uint32 z=gridIndex(position.z,mBounds.min().z,mBounds.across().z,mRegionsZ);
+    return z*mRegionsX+x;
+}
+
+BoundingBox3d3f Cseg::regionBounds(uint32 region)const {
+    double width=mBounds.across().x/mRegionsX;
+    double depth=mBounds.across().z/mRegionsZ;
+    Vector3d low(mBounds.min().x+width*(region%mRegionsX),
+                 mBounds.min().y,
+                 mBounds.min().z+depth*(region/mRegionsX));
+    return BoundingBox3d3f(low,Vector3d(low.x+width,mBounds.max().y,low.z+depth));
+}
+
+bool Cseg::forwardMessagesTo(MessageService*ms) {
+    mServices.push_back(ms);
+    return true;
+}
+
+bool Cseg::endForwardingMessagesTo(MessageService*ms) {
+    std::vector<MessageService*>::iterator where=std::find(mServices.begin(),mServices.end(),ms);
+    if (where==mServices.end())
+        return false;
+    mServices.erase(where);
+    return true;
+}
+
+void Cseg::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    RoutableMessageBody body;
+    if (!body.ParseFromArray(message_body.data(),message_body.size())) {
+        SILOG(space,warning,"Cseg:Unable to parse message body originating from "<<header.source_object());
+        return;
+    }
+    RoutableMessageBody reply;
+    for (int i=0;i<body.message_size();++i) {
+        if (body.message_names(i)=="CsegLookup") {
+            Protocol::CsegLookup lookup;
+            if (lookup.ParseFromString(body.message_arguments(i))&&lookup.has_position()) {
+                Protocol::CsegServer server;
+                uint32 index=serverAt(lookup.position());
+                server.set_server(index);
+                if (index<mServers.size()) {
+                    server.set_address(mServers[index].getHostName()+":"+mServers[index].getService());
+                }
+                server.SerializeToString(reply.add_message("CsegServer"));
+            }else {
+                SILOG(space,warning,"Cseg:Unable to parse CsegLookup originating from "<<header.source_object());
+            }
+        }else {
+            SILOG(space,warning,"Cseg:Do not understand message of type "<<body.message_names(i));
+        }
+    }
+    if (reply.message_size()==0)
+        return;
+    RoutableMessageHeader destination_header;
+    destination_header.set_destination_object(header.source_object());
+    destination_header.set_destination_port(header.source_port());
+    destination_header.set_source_object(ObjectReference::spaceServiceID());
+    destination_header.set_source_port(Services::CSEG);
+    if (header.has_id()) {
+        destination_header.set_reply_id(header.id());
+    }
+    std::string return_message;
+    reply.SerializeToString(&return_message);
+    for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
+        (*i)->processMessage(destination_header,MemoryReference(return_message));
+    }
+}
+
+}
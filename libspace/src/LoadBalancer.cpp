@@ -0,0 +1,385 @@
+/*  Sirikata libspace -- Load Balancing
+ *  LoadBalancer.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <space/Platform.hpp>
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "Space_Sirikata.pbj.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/KnownServices.hpp"
+#include "space/Registration.hpp"
+#include "space/ObjectConnections.hpp"
+#include "space/Cseg.hpp"
+#include "space/LoadBalancer.hpp"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+namespace Sirikata {
+
+namespace {
+double processCpuSeconds() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF,&usage)==0)
+        return usage.ru_utime.tv_sec+usage.ru_stime.tv_sec+(usage.ru_utime.tv_usec+usage.ru_stime.tv_usec)*1.0e-6;
+#endif
+    return 0;
+}
+const uint32 sNotMigrating=0xffffffff;
+}
+
+LoadBalancer::LoadBalancer(Network::IOService*io,
+                           Cseg*coordinateSegmentation,
+                           Router*router,
+                           const Registration*registration,
+                           ObjectConnections*objectConnections,
+                           const Duration&interval,
+                           double band,
+                           double messageWeight,
+                           double cpuTarget)
+ : mRegionObjects(coordinateSegmentation->numRegions(),0),
+   mRegionMessages(coordinateSegmentation->numRegions(),0),
+   mServerLoads(router->numServers(),0.0),
+   mServerReports(router->numServers(),Time::null()),
+   mIO(io),
+   mCoordinateSegmentation(coordinateSegmentation),
+   mRouter(router),
+   mRegistration(registration),
+   mObjectConnections(objectConnections),
+   mInterval(interval),
+   mBand(band),
+   mMessageWeight(messageWeight),
+   mCpuTarget(cpuTarget),
+   mLastTick(Time::null()),
+   mLastCpuSeconds(0),
+   mLastHandover(Time::null()) {
+    mRouter->addServerService(Services::LOAD_BALANCER,this);
+}
+
+LoadBalancer::~LoadBalancer() {
+}
+
+void LoadBalancer::start() {
+    mLastTick=Time::now();
+    mLastCpuSeconds=processCpuSeconds();
+    Network::IOServiceFactory::dispatchServiceMessage(mIO,mInterval,std::tr1::bind(&LoadBalancer::tick,this));
+}
+
+bool LoadBalancer::forwardMessagesTo(MessageService*ms) {
+    mServices.push_back(ms);
+    return true;
+}
+
+bool LoadBalancer::endForwardingMessagesTo(MessageService*ms) {
+    std::vector<MessageService*>::iterator where=std::find(mServices.begin(),mServices.end(),ms);
+    if (where==mServices.end())
+        return false;
+    mServices.erase(where);
+    return true;
+}
+
+bool LoadBalancer::bordersServer(uint32 region, uint32 server)const {
+    uint32 regionsX=mCoordinateSegmentation->regionsX();
+    uint32 regionsZ=mCoordinateSegmentation->regionsZ();
+    uint32 x=region%regionsX;
+    uint32 z=region/regionsX;
+    return (x>0&&mCoordinateSegmentation->serverForRegion(region-1)==server)||
+        (x+1<regionsX&&mCoordinateSegmentation->serverForRegion(region+1)==server)||
+        (z>0&&mCoordinateSegmentation->serverForRegion(region-regionsX)==server)||
+        (z+1<regionsZ&&mCoordinateSegmentation->serverForRegion(region+regionsX)==server);
+}
+
+void LoadBalancer::sendToServer(uint32 server, const String&name, const String&argument) {
+    RoutableMessageBody body;
+    body.add_message(name,argument);
+    std::string message_body;
+    body.SerializeToString(&message_body);
+    RoutableMessageHeader header;
+    header.set_source_object(ObjectReference::spaceServiceID());
+    header.set_source_port(Services::LOAD_BALANCER);
+    header.set_destination_object(ObjectReference::spaceServiceID());
+    header.set_destination_port(Services::LOAD_BALANCER);
+    mRouter->sendToServer(server,header,MemoryReference(message_body));
+}
+
+void LoadBalancer::tick() {
+    Time now=Time::now();
+    double seconds=(now-mLastTick).toSeconds();
+    if (!(seconds>0))
+        seconds=mInterval.toSeconds();
+    double cpuSeconds=processCpuSeconds();
+    double cpu=(cpuSeconds-mLastCpuSeconds)/seconds;
+    mLastTick=now;
+    mLastCpuSeconds=cpuSeconds;
+    uint32 self=mRouter->serverIndex();
+    uint32 numRegions=mCoordinateSegmentation->numRegions();
+    std::vector<double> regionLoads(numRegions,0.0);
+    double load=0;
+    uint32 hosted=0;
+    for (uint32 r=0;r<numRegions;++r) {
+        regionLoads[r]=mRegionObjects[r]+mMessageWeight*mRegionMessages[r]/seconds;
+        mRegionMessages[r]=0;
+        if (mCoordinateSegmentation->serverForRegion(r)==self) {
+            load+=regionLoads[r];
+            ++hosted;
+        }
+    }
+    if (mCpuTarget>0&&cpu>mCpuTarget)
+        load*=cpu/mCpuTarget;
+    mServerLoads[self]=load;
+    mServerReports[self]=now;
+    Protocol::ServerLoad report;
+    report.set_load(load);
+    String reportString;
+    report.SerializeToString(&reportString);
+    for (uint32 s=0;s<mServerLoads.size();++s) {
+        if (s!=self)
+            sendToServer(s,"ServerLoad",reportString);
+    }
+    //compare with the servers heard from lately: those that went quiet are not handed anything
+    double total=0;
+    uint32 count=0;
+    uint32 idlest=self;
+    for (uint32 s=0;s<mServerLoads.size();++s) {
+        if (s==self||now-mServerReports[s]<mInterval*3.0) {
+            total+=mServerLoads[s];
+            ++count;
+            if (s!=self&&(idlest==self||mServerLoads[s]<mServerLoads[idlest]))
+                idlest=s;
+        }
+    }
+    double mean=total/count;
+    if (idlest!=self&&hosted>1&&load>mean*(1.0+mBand)&&mServerLoads[idlest]<mean&&!(now-mLastHandover<mInterval*3.0)) {
+        //the region that evens the two out best without overshooting, next to the other's regions if possible
+        double excess=(load-mServerLoads[idlest])*.5;
+        uint32 best=numRegions;
+        bool bestBorders=false;
+        for (uint32 r=0;r<numRegions;++r) {
+            if (mCoordinateSegmentation->serverForRegion(r)!=self||!(regionLoads[r]>0)||regionLoads[r]>excess)
+                continue;
+            bool borders=bordersServer(r,idlest);
+            if (best==numRegions||(borders&&!bestBorders)||(borders==bestBorders&&regionLoads[r]>regionLoads[best])) {
+                best=r;
+                bestBorders=borders;
+            }
+        }
+        if (best<numRegions) {
+            SILOG(space,info,"Handing region "<<best<<" with load "<<regionLoads[best]<<" to server "<<idlest);
+            handOverRegion(best,idlest);
+            mServerLoads[idlest]+=regionLoads[best];
+            mLastHandover=now;
+        }
+    }
+    Network::IOServiceFactory::dispatchServiceMessage(mIO,mInterval,std::tr1::bind(&LoadBalancer::tick,this));
+}
+
+void LoadBalancer::handOverRegion(uint32 region, uint32 server) {
+    mCoordinateSegmentation->assignRegion(region,server);
+    Protocol::RegionAssignment assignment;
+    assignment.set_region(region);
+    assignment.set_server(server);
+    String assignmentString;
+    assignment.SerializeToString(&assignmentString);
+    for (uint32 s=0;s<mServerLoads.size();++s) {
+        if (s!=mRouter->serverIndex())
+            sendToServer(s,"RegionAssignment",assignmentString);
+    }
+    for (ObjectMap::iterator i=mObjects.begin(),ie=mObjects.end();i!=ie;++i) {
+        if (i->second.mRegion==region)
+            checkHost(i->first,i->second);
+    }
+}
+
+void LoadBalancer::checkHost(const ObjectReference&object, ObjectRecord&record) {
+    uint32 host=mCoordinateSegmentation->serverForRegion(record.mRegion);
+    if (record.mMigratingTo!=sNotMigrating||host==mRouter->serverIndex())
+        return;
+    Protocol::RetObj retObj;
+    if (!retObj.ParseFromString(record.mRetObj))
+        return;
+    record.mMigratingTo=host;
+    retObj.mutable_location().set_position(record.mPosition);
+    retObj.set_resume_token(mRegistration->resumeToken(object.getAsUUID()));
+    String retObjString;
+    retObj.SerializeToString(&retObjString);
+    Protocol::AdmitObj admit;
+    admit.mutable_object().ParseFromString(retObjString);
+    String admitString;
+    admit.SerializeToString(&admitString);
+    sendToServer(host,"AdmitObj",admitString);
+}
+
+void LoadBalancer::addObject(const ObjectReference&object, const String&retObjString) {
+    Protocol::RetObj retObj;
+    if (!retObj.ParseFromString(retObjString))
+        return;
+    removeObject(object);
+    ObjectRecord&record=mObjects[object];
+    record.mRetObj=retObjString;
+    record.mPosition=retObj.has_location()&&retObj.location().has_position()?Vector3d(retObj.location().position()):Vector3d(0,0,0);
+    record.mRegion=mCoordinateSegmentation->regionAt(record.mPosition);
+    record.mMigratingTo=sNotMigrating;
+    ++mRegionObjects[record.mRegion];
+    checkHost(object,record);
+}
+
+void LoadBalancer::removeObject(const ObjectReference&object) {
+    ObjectMap::iterator where=mObjects.find(object);
+    if (where!=mObjects.end()) {
+        --mRegionObjects[where->second.mRegion];
+        mObjects.erase(where);
+    }
+}
+
+void LoadBalancer::moveObject(const ObjectReference&object, ObjectRecord&record, const Vector3d&position) {
+    record.mPosition=position;
+    uint32 region=mCoordinateSegmentation->regionAt(position);
+    if (region!=record.mRegion) {
+        --mRegionObjects[record.mRegion];
+        ++mRegionObjects[region];
+        record.mRegion=region;
+        checkHost(object,record);
+    }
+}
+
+void LoadBalancer::admitObject(uint32 server, const String&argument) {
+    Protocol::AdmitObj admit;
+    if (!admit.ParseFromString(argument)||!admit.has_object()||!admit.object().has_object_reference()||!admit.object().has_resume_token()) {
+        SILOG(space,warning,"LoadBalancer:Unable to parse AdmitObj from server "<<server);
+        return;
+    }
+    ObjectReference object(admit.object().object_reference());
+    mObjectConnections->admitObject(object,admit.object().resume_token());
+    if (mObjects.find(object)==mObjects.end()) {
+        //the other services follow it from here as if it had just registered
+        RoutableMessageBody body;
+        admit.object().SerializeToString(body.add_message("RetObj"));
+        std::string message_body;
+        body.SerializeToString(&message_body);
+        RoutableMessageHeader header;
+        header.set_source_object(ObjectReference::spaceServiceID());
+        header.set_source_port(Services::REGISTRATION);
+        header.set_destination_object(object);
+        for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
+            (*i)->processMessage(header,MemoryReference(message_body));
+        }
+        addObject(object,body.message_arguments(0));
+    }
+    Protocol::ObjectAdmitted admitted;
+    admitted.set_object_reference(object.getAsUUID());
+    String admittedString;
+    admitted.SerializeToString(&admittedString);
+    sendToServer(server,"ObjectAdmitted",admittedString);
+}
+
+void LoadBalancer::processServerMessage(uint32 server, MemoryReference message_body) {
+    RoutableMessageBody body;
+    if (!body.ParseFromArray(message_body.data(),message_body.size())) {
+        SILOG(space,warning,"LoadBalancer:Unable to parse message body from server "<<server);
+        return;
+    }
+    for (int i=0;i<body.message_size();++i) {
+        const String&name=body.message_names(i);
+        if (name=="ServerLoad") {
+            Protocol::ServerLoad report;
+            if (server<mServerLoads.size()&&report.ParseFromString(body.message_arguments(i))&&report.has_load()) {
+                mServerLoads[server]=report.load();
+                mServerReports[server]=Time::now();
+            }
+        }else if (name=="RegionAssignment") {
+            Protocol::RegionAssignment assignment;
+            if (assignment.ParseFromString(body.message_arguments(i))&&
+                assignment.region()<mCoordinateSegmentation->numRegions()&&
+                assignment.server()<mServerLoads.size()) {
+                mCoordinateSegmentation->assignRegion(assignment.region(),assignment.server());
+                for (ObjectMap::iterator j=mObjects.begin(),je=mObjects.end();j!=je;++j) {
+                    if (j->second.mRegion==assignment.region())
+                        checkHost(j->first,j->second);
+                }
+            }
+        }else if (name=="AdmitObj") {
+            admitObject(server,body.message_arguments(i));
+        }else if (name=="ObjectAdmitted") {
+            Protocol::ObjectAdmitted admitted;
+            ObjectMap::iterator where;
+            if (admitted.ParseFromString(body.message_arguments(i))&&
+                (where=mObjects.find(ObjectReference(admitted.object_reference())))!=mObjects.end()&&
+                where->second.mMigratingTo==server) {
+                mObjectConnections->migrateObject(where->first,
+                                                  mCoordinateSegmentation->serverAddress(server),
+                                                  mRegistration->resumeToken(where->first.getAsUUID()));
+            }
+        }else {
+            SILOG(space,warning,"LoadBalancer:Do not understand message of type "<<name<<" from server "<<server);
+        }
+    }
+}
+
+void LoadBalancer::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    if (!(header.has_source_object()&&header.source_object()==ObjectReference::spaceServiceID()))
+        return;
+    RoutableMessageBody body;
+    if (!body.ParseFromArray(message_body.data(),message_body.size())) {
+        SILOG(space,warning,"LoadBalancer:Unable to parse message body originating from "<<header.source_object());
+        return;
+    }
+    if (header.source_port()==Services::REGISTRATION) {
+        for (int i=0;i<body.message_size();++i) {
+            if (body.message_names(i)=="RetObj") {
+                Protocol::RetObj retObj;
+                if (retObj.ParseFromString(body.message_arguments(i))&&retObj.has_object_reference()) {
+                    addObject(ObjectReference(retObj.object_reference()),body.message_arguments(i));
+                }
+            }else if (body.message_names(i)=="DelObj") {
+                Protocol::DelObj delObj;
+                if (delObj.ParseFromString(body.message_arguments(i))&&delObj.has_object_reference()) {
+                    removeObject(ObjectReference(delObj.object_reference()));
+                }
+            }
+        }
+    }else if (header.source_port()==Services::LOC&&header.has_destination_object()) {
+        ObjectMap::iterator where=mObjects.find(header.destination_object());
+        if (where==mObjects.end())
+            return;
+        for (int i=0;i<body.message_size();++i) {
+            Protocol::ObjLoc loc;
+            if (loc.ParseFromString(body.message_arguments(i))) {
+                ++mRegionMessages[where->second.mRegion];
+                if (loc.has_position())
+                    moveObject(where->first,where->second,loc.position());
+            }
+        }
+    }
+}
+
+}
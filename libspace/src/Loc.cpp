@@ -36,12 +36,18 @@
 #include "util/RoutableMessage.hpp"
 #include "util/KnownServices.hpp"
 namespace Sirikata {
-Loc::Loc(){
+namespace {
+///interests covering more cells than this are checked against every update instead of being indexed
+const size_t sMaxIndexedCells=4096;
+}
+Loc::Loc(double cellSize, const Duration&edgeUpdateInterval):mCellSize(cellSize),mEdgeUpdateInterval(edgeUpdateInterval){
     
 }
 
 Loc::~Loc() {
-
+    for (std::tr1::unordered_map<MessageService*,Interest*>::iterator i=mInterests.begin(),ie=mInterests.end();i!=ie;++i) {
+        delete i->second;
+    }
 }
 
 bool Loc::forwardMessagesTo(MessageService*ms) {
@@ -54,6 +60,95 @@ bool Loc::endForwardingMessagesTo(MessageService*ms) {
     if (where==mServices.end())
         return false;
     mServices.erase(where);
+    clearInterest(ms);
+    return true;
+}
+
+Loc::Cell Loc::cellFor(const Vector3d&position)const {
+    Cell retval;
+    retval.x=(int32)std::floor(position.x/mCellSize);
+    retval.y=(int32)std::floor(position.y/mCellSize);
+    retval.z=(int32)std::floor(position.z/mCellSize);
+    return retval;
+}
+
+void Loc::indexInterest(Interest*interest, bool add) {
+    Vector3d extent(interest->mRadius,interest->mRadius,interest->mRadius);
+    Cell low=cellFor(interest->mCenter-extent);
+    Cell high=cellFor(interest->mCenter+extent);
+    double numCells=(double)(high.x-low.x+1)*(double)(high.y-low.y+1)*(double)(high.z-low.z+1);
+    if (numCells>(double)sMaxIndexedCells) {
+        if (add) {
+            mUnindexedInterests.push_back(interest);
+        }else {
+            std::vector<Interest*>::iterator where=std::find(mUnindexedInterests.begin(),mUnindexedInterests.end(),interest);
+            if (where!=mUnindexedInterests.end())
+                mUnindexedInterests.erase(where);
+        }
+        return;
+    }
+    Cell cell;
+    for (cell.x=low.x;cell.x<=high.x;++cell.x) {
+        for (cell.y=low.y;cell.y<=high.y;++cell.y) {
+            for (cell.z=low.z;cell.z<=high.z;++cell.z) {
+                if (add) {
+                    mInterestGrid[cell].push_back(interest);
+                }else {
+                    InterestGrid::iterator where=mInterestGrid.find(cell);
+                    if (where!=mInterestGrid.end()) {
+                        std::vector<Interest*>::iterator which=std::find(where->second.begin(),where->second.end(),interest);
+                        if (which!=where->second.end())
+                            where->second.erase(which);
+                        if (where->second.empty())
+                            mInterestGrid.erase(where);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Loc::setInterest(MessageService*ms, const Vector3d&center, double radius) {
+    Interest*&interest=mInterests[ms];
+    if (interest) {
+        indexInterest(interest,false);
+    }else {
+        interest=new Interest;
+        interest->mService=ms;
+    }
+    interest->mCenter=center;
+    interest->mRadius=radius;
+    indexInterest(interest,true);
+}
+
+void Loc::clearInterest(MessageService*ms) {
+    std::tr1::unordered_map<MessageService*,Interest*>::iterator where=mInterests.find(ms);
+    if (where!=mInterests.end()) {
+        indexInterest(where->second,false);
+        delete where->second;
+        mInterests.erase(where);
+    }
+}
+
+bool Loc::admit(Interest*interest, const ObjectReference&object_reference, const Vector3d&position, bool force, const Time&now) {
+    double distance=(position-interest->mCenter).length();
+    std::tr1::unordered_map<ObjectReference,Time,ObjectReference::Hasher>::iterator where=interest->mLastSent.find(object_reference);
+    if (distance>interest->mRadius) {
+        if (where==interest->mLastSent.end())
+            return false;
+        interest->mLastSent.erase(where);//one last update, so the service sees the object go
+        return true;
+    }
+    if (where==interest->mLastSent.end()) {
+        interest->mLastSent.insert(std::pair<ObjectReference,Time>(object_reference,now));
+        return true;
+    }
+    if (!force&&interest->mRadius>0) {
+        Duration wait=mEdgeUpdateInterval*(distance/interest->mRadius);
+        if (now-where->second<wait)
+            return false;
+    }
+    where->second=now;
     return true;
 }
 
@@ -69,9 +164,47 @@ void Loc::processMessage(const ObjectReference&object_reference,const Protocol::
     destination_header.set_destination_object(object_reference);
     
     for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
-        (*i)->processMessage(destination_header,MemoryReference(message_body));
+        if (mInterests.empty()||mInterests.find(*i)==mInterests.end())
+            (*i)->processMessage(destination_header,MemoryReference(message_body));
+    }
+    if (mInterests.empty())
+        return;
+    //gather the services whose regions may hold the object now or held it before
+    std::vector<Interest*> candidates(mUnindexedInterests);
+    std::tr1::unordered_map<ObjectReference,Cell,ObjectReference::Hasher>::iterator lastCell=mObjectCells.find(object_reference);
+    InterestGrid::iterator where;
+    if (lastCell!=mObjectCells.end()&&(where=mInterestGrid.find(lastCell->second))!=mInterestGrid.end()) {
+        candidates.insert(candidates.end(),where->second.begin(),where->second.end());
+    }
+    if (loc.has_position()) {
+        Cell cell=cellFor(loc.position());
+        if ((lastCell==mObjectCells.end()||!(lastCell->second==cell))&&(where=mInterestGrid.find(cell))!=mInterestGrid.end()) {
+            for (std::vector<Interest*>::iterator i=where->second.begin(),ie=where->second.end();i!=ie;++i) {
+                if (std::find(candidates.begin(),candidates.end(),*i)==candidates.end())
+                    candidates.push_back(*i);
+            }
+        }
+        mObjectCells[object_reference]=cell;
+    }
+    bool force=loc.has_update_flags()&&(loc.update_flags()&Protocol::ObjLoc::FORCE);
+    Time now=Time::now();
+    for (std::vector<Interest*>::iterator i=candidates.begin(),ie=candidates.end();i!=ie;++i) {
+        bool send;
+        if (loc.has_position()) {
+            send=admit(*i,object_reference,loc.position(),force,now);
+        }else {//nothing to judge by: only those already hearing about the object are told
+            send=(*i)->mLastSent.find(object_reference)!=(*i)->mLastSent.end();
+        }
+        if (send)
+            (*i)->mService->processMessage(destination_header,MemoryReference(message_body));
+    }
+}
+
+void Loc::forgetObject(const ObjectReference&object_reference) {
+    mObjectCells.erase(object_reference);
+    for (std::tr1::unordered_map<MessageService*,Interest*>::iterator i=mInterests.begin(),ie=mInterests.end();i!=ie;++i) {
+        i->second->mLastSent.erase(object_reference);
     }
-   
 }
 void Loc::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
     RoutableMessageBody body;
@@ -86,6 +219,11 @@ void Loc::processMessage(const RoutableMessageHeader&header,MemoryReference mess
                     }else {
                         SILOG(loc,warning,"Loc:Unable to parse RetObj message body originating from "<<header.source_object());
                     }
+                }else if (body.message_names(i)=="DelObj") {
+                    Protocol::DelObj delObj;
+                    if (delObj.ParseFromString(body.message_arguments(i))&&delObj.has_object_reference()) {
+                        forgetObject(ObjectReference(delObj.object_reference()));
+                    }
                 }
             }
         }else {
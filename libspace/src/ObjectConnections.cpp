@@ -33,21 +33,36 @@
 #include <space/Platform.hpp>
 #include "network/Stream.hpp"
 #include "network/StreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
 #include "util/UUID.hpp"
 #include "util/ObjectReference.hpp"
 #include "Space_Sirikata.pbj.hpp"
 #include "util/RoutableMessage.hpp"
+#include "util/RoutableMessageHeaderView.hpp"
+#include "util/MessageTrace.hpp"
+#include "network/StreamCapture.hpp"
 #include "util/KnownServices.hpp"
 #include "space/Registration.hpp"
 #include "space/ObjectConnections.hpp"
 namespace Sirikata {
-ObjectConnections::ObjectConnections(Network::StreamListener*listener,
+ObjectConnections::ObjectConnections(Network::IOService*io,
+                                     Network::StreamListener*listener,
                                      const Network::Address&listenAddress) {
 
     //mSpaceServiceIntroductionMessage=introductoryMessage;
     mSpace=NULL;
     mPerObjectTemporarySizeMaximum=8192;
     mPerObjectTemporaryNumMessagesMaximum=64;
+    mIO=io;
+    mCapture=NULL;
+    mMaxBatchSize=16384;
+    mBatchDelay=Duration::microseconds(500);
+    mBatchFlushScheduled=false;
+    mResumeGracePeriod=Duration::seconds(5.0);
+    RoutableMessageHeader batchHeader;
+    batchHeader.set_source_port(Services::OBJECT_CONNECTIONS);
+    batchHeader.set_destination_port(Services::OBJECT_CONNECTIONS);
+    batchHeader.SerializeToString(&mBatchHeader);
 //    Protocol::SpaceServices svc;
 //    svc.set_pre_connection_buffer(mPerObjectTemporarySizeMaximum);
 //    svc.set_max_pre_connection_messages(mPerObjectTemporaryNumMessagesMaximum);
@@ -60,29 +75,65 @@ ObjectConnections::ObjectConnections(Network::StreamListener*listener,
 void ObjectConnections::newStreamCallback(Network::Stream*stream, Network::Stream::SetCallbacks&callbacks) {
     if (stream!=NULL){
         UUID temporaryId=UUID::random();//generate a random ID as a placeholder ObjectReference until Registration service calls back with RetObj
-        mStreams[stream].setId(temporaryId);//set it for the streams (mStreams is set to disconnected by default)
+        StreamMapUUID*state=&mStreams[stream];
+        state->setId(temporaryId);//set it for the streams (mStreams is set to disconnected by default)
+        state->setStream(stream);
         TemporaryStreamData data;
         data.mStream=stream;
+        data.mState=state;
         mTemporaryStreams.insert(TemporaryStreamMultimap::value_type(temporaryId,data));//record this stream to the mTemporaryStreams
         using std::tr1::placeholders::_1;    using std::tr1::placeholders::_2;
-        callbacks(std::tr1::bind(&ObjectConnections::connectionCallback,this,stream,_1,_2),
-                  std::tr1::bind(&ObjectConnections::bytesReceivedCallback,this,stream,_1));
+        if (mCapture) {
+            callbacks(std::tr1::bind(&ObjectConnections::connectionCallback,this,stream,_1,_2),
+                      std::tr1::bind(&ObjectConnections::capturedBytesReceivedCallback,this,stream,state,_1));
+        }else {
+            callbacks(std::tr1::bind(&ObjectConnections::connectionCallback,this,stream,_1,_2),
+                      std::tr1::bind(&ObjectConnections::bytesReceivedCallback,this,state,_1));
+        }
     }else{
         //whole object host has disconnected
     }
 }
-void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Network::Chunk&chunk) {
-    //find the temporary stream ID and connected boolean
-    std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator where=mStreams.find(stream);
-    RoutableMessageHeader hdr;
-    MemoryReference chunkRef(chunk);//parse header
-    MemoryReference message_body=hdr.ParseFromArray(chunkRef.data(),chunkRef.size());
+bool ObjectConnections::captureTo(const String&filename) {
+    if (!mCapture)
+        mCapture=new Network::StreamCaptureWriter;
+    if (mCapture->open(filename))
+        return true;
+    delete mCapture;
+    mCapture=NULL;
+    return false;
+}
+void ObjectConnections::capturedBytesReceivedCallback(Network::Stream*stream, StreamMapUUID*state, const Network::Chunk&chunk) {
+    mCapture->received(stream,chunk);
+    bytesReceivedCallback(state,chunk);
+}
+void ObjectConnections::bytesReceivedCallback(StreamMapUUID*state, const Network::Chunk&chunk) {
+    if (state->multiplexed()) {
+        multiplexedBytesReceived(state,chunk);
+        return;
+    }
+    //the temporary stream ID and connected boolean came bound to the callback
+    RoutableMessageHeaderView view;
+    MemoryReference chunkRef(chunk);//find the header fields without decoding them
+    MemoryReference message_body=view.ParseFromArray(chunkRef);
     //munge header to reflect known ID
-    hdr.set_source_object(ObjectReference(where->second.uuid()));
+    view.set_source_object(ObjectReference(state->uuid()));
+    MessageTrace::stamp(view,MessageTrace::SPACE_RECEIVE);
+    bool toSpace=view.has_destination_object()&&view.destination_object()==ObjectReference::spaceServiceID();
+    if (toSpace&&view.destination_port()==Services::OBJECT_CONNECTIONS) {
+        processConnectionOptions(*state,message_body);
+        return;
+    }
+    bool registration=toSpace&&view.destination_port()==Services::REGISTRATION;
+    if (!registration&&state->connected()&&forwardToConnectedObject(view,message_body)) {
+        return;//the common case: passed through to another object on this space node untouched
+    }
+    RoutableMessageHeader hdr;
+    view.copyTo(hdr);
     if (false&&((!hdr.has_destination_object())||hdr.destination_object()==ObjectReference::null())&&message_body.size()==0) {
         //if our message is size 0 and header nowhere or to null(), assume it's the object host request for service addresses
-        stream->send(MemoryReference(mSpaceServiceIntroductionMessage),Network::ReliableOrdered);//send the tuned packet with all information needed to know services
-    }else if (hdr.has_destination_object()&&hdr.destination_object()==ObjectReference::spaceServiceID()&&hdr.destination_port()==Services::REGISTRATION) {
+        state->stream()->send(MemoryReference(mSpaceServiceIntroductionMessage),Network::ReliableOrdered);//send the tuned packet with all information needed to know services
+    }else if (registration) {
         //this is a NewObj request Parse the body to find out
         RoutableMessageBody rmb;
         bool success=rmb.ParseFromArray(message_body.data(),message_body.size());
@@ -94,17 +145,17 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
                 connection=connection||(rmb.message_names(i)=="NewObj");
             }
             if (connection) {
-                where->second.setConnecting();
+                state->setConnecting();
             }
             //let a connection request through to the registration service
-            if (connection||where->second.connected()) {
+            if (connection||state->connected()) {
                 if (mSpace) {
                     mSpace->processMessage(hdr,MemoryReference(message_body));
                 } else {
-                    SILOG(space,warning,"Dropping registration message from "<<where->second.uuid().toString()<<" because forwardMessagesTo was not called");
+                    SILOG(space,warning,"Dropping registration message from "<<state->uuid().toString()<<" because forwardMessagesTo was not called");
                 }
             }else {//push other requests for registration to the queue
-                TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(where->second.uuid());
+                TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(state->uuid());
                 if (twhere!=mTemporaryStreams.end()) {//find the queue on which the request should live
                     if (twhere->second.mTotalMessageSize+chunk.size()<mPerObjectTemporarySizeMaximum
                         &&twhere->second.mPendingMessages.size()<mPerObjectTemporaryNumMessagesMaximum) {//if message queue has space
@@ -112,16 +163,16 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
                         twhere->second.mPendingMessages.push_back(chunk);//push back to array
                     }
                 }else{
-                    SILOG(space,warning,"Dropping message from "<<where->second.uuid().toString()<<" due to already disconnected object");
+                    SILOG(space,warning,"Dropping message from "<<state->uuid().toString()<<" due to already disconnected object");
                 }
             }
         }
-    } else if (where->second.connected()) {//ordinary message to connected object
+    } else if (state->connected()) {//ordinary message to connected object
         processExistingObject(hdr, message_body, true); // forward set to true for now....
     } else {//Not sure if we should verify that a connection request is going through,
             // or if we should just find the size of bytes saved and cap that reasonably
-            // this check would have verified a good faith effort to start connecting if (where->second.isConnecting()) {
-        TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(where->second.uuid());
+            // this check would have verified a good faith effort to start connecting if (state->isConnecting()) {
+        TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(state->uuid());
         if (twhere!=mTemporaryStreams.end()) {
             if (twhere->second.mTotalMessageSize<mPerObjectTemporarySizeMaximum
                 &&twhere->second.mPendingMessages.size()<mPerObjectTemporaryNumMessagesMaximum) {//if message queue has space
@@ -129,7 +180,7 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
                 twhere->second.mPendingMessages.push_back(chunk);//push back to array
             }
         }else{
-            SILOG(space,warning,"Dropping message from "<<where->second.uuid().toString()<<" due to already disconnected object");
+            SILOG(space,warning,"Dropping message from "<<state->uuid().toString()<<" due to already disconnected object");
         }
     }
 }
@@ -149,39 +200,260 @@ void ObjectConnections::forgeDisconnectionMessage(const ObjectReference&ref) {
         mSpace->processMessage(rm.header(),MemoryReference(serialized_message_body));//tell the space to forward the message to the registration service
     }
 }
+ObjectConnections::StreamMapUUID*ObjectConnections::multiplexedObject(StreamMapUUID*stream,const UUID&key) {
+    MultiplexedObjectMap&objects=mMultiplexedObjects[stream->stream()];
+    MultiplexedObjectMap::iterator where=objects.find(key);
+    if (where==objects.end()) {//first message from this object: it gets a temporary UUID just as a new stream would
+        where=objects.insert(MultiplexedObjectMap::value_type(key,StreamMapUUID())).first;
+        StreamMapUUID*state=&where->second;
+        UUID temporaryId=UUID::random();
+        state->setId(temporaryId);
+        state->setStream(stream->stream());
+        state->setObjectHostKey(key);
+        if (stream->batching()) {
+            state->setBatching();
+        }
+        TemporaryStreamData data;
+        data.mStream=stream->stream();
+        data.mState=state;
+        mTemporaryStreams.insert(TemporaryStreamMultimap::value_type(temporaryId,data));
+    }
+    return &where->second;
+}
+void ObjectConnections::multiplexedBytesReceived(StreamMapUUID*stream,const Network::Chunk&chunk) {
+    RoutableMessageHeaderView view;
+    MemoryReference message_body=view.ParseFromArray(MemoryReference(chunk));
+    if (!view.has_source_object()) {
+        if (view.has_destination_object()&&view.destination_object()==ObjectReference::spaceServiceID()&&view.destination_port()==Services::REGISTRATION) {
+            registerObjectBatch(stream,message_body);
+            return;
+        }
+        SILOG(space,warning,"Dropping message without an object key on multiplexed stream "<<stream->uuid().toString());
+        return;
+    }
+    bytesReceivedCallback(multiplexedObject(stream,view.source_object().getAsUUID()),chunk);//source_object is replaced with the object's own ID there
+}
+void ObjectConnections::registerObjectBatch(StreamMapUUID*stream,MemoryReference body_array) {
+    RoutableMessageBody rmb;
+    if (!rmb.ParseFromArray(body_array.data(),body_array.size())) {
+        SILOG(space,warning,"Cannot parse registration batch from multiplexed stream "<<stream->uuid().toString());
+        return;
+    }
+    RoutableMessageBody forwarded;
+    for (int i=0;i<rmb.message_size();++i) {
+        Protocol::NewObjBatch batch;
+        if (rmb.message_names(i)!="NewObjBatch"||!batch.ParseFromString(rmb.message_arguments(i))) {
+            SILOG(space,warning,"Dropping "<<rmb.message_names(i)<<" without an object key on multiplexed stream "<<stream->uuid().toString());
+            continue;
+        }
+        Protocol::NewObjBatch temporaryBatch;//the same requests, under the temporary IDs the Registration service replies to
+        int num_objects=batch.objects_size()<batch.object_keys_size()?batch.objects_size():batch.object_keys_size();
+        for (int j=0;j<num_objects;++j) {
+            StreamMapUUID*state=multiplexedObject(stream,batch.object_keys(j));
+            if (state->connected()) {
+                SILOG(space,warning,"Ignoring second registration of "<<state->uuid().toString());
+                continue;
+            }
+            state->setConnecting();
+            temporaryBatch.add_object_keys(state->uuid());
+            std::string newObj;
+            batch.objects(j).SerializeToString(&newObj);
+            temporaryBatch.add_objects().ParseFromString(newObj);
+        }
+        temporaryBatch.SerializeToString(forwarded.add_message("NewObjBatch"));
+    }
+    if (forwarded.message_size()==0) {
+        return;
+    }
+    RoutableMessageHeader hdr;
+    hdr.set_source_object(ObjectReference(stream->uuid()));//the reply comes back addressed to the stream itself
+    hdr.set_destination_object(ObjectReference::spaceServiceID());
+    hdr.set_destination_port(Services::REGISTRATION);
+    std::string serialized_body;
+    forwarded.SerializeToString(&serialized_body);
+    if (mSpace) {
+        mSpace->processMessage(hdr,MemoryReference(serialized_body));
+    } else {
+        SILOG(space,warning,"Dropping registration batch from "<<stream->uuid().toString()<<" because forwardMessagesTo was not called");
+    }
+}
+bool ObjectConnections::processNewObjectBatch(const RoutableMessageHeader&hdr,MemoryReference body_array) {
+    RoutableMessageBody rmb;
+    if (!hdr.has_destination_object()||!rmb.ParseFromArray(body_array.data(),body_array.size())||rmb.message_size()==0||rmb.message_names(0)!="RetObjBatch") {
+        return false;
+    }
+    Protocol::RetObjBatch temporaryKeys;
+    temporaryKeys.ParseFromString(rmb.message_arguments(0));
+    Protocol::RetObjBatch keys;//what the object host knows the objects by
+    RoutableMessageBody retObjs;
+    StreamMapUUID*target=NULL;
+    for (int i=1;i<rmb.message_size()&&i<=temporaryKeys.object_keys_size();++i) {
+        Protocol::RetObj ro;
+        if (rmb.message_names(i)!="RetObj"||!ro.ParseFromString(rmb.message_arguments(i))||!ro.has_object_reference()) {
+            continue;
+        }
+        ObjectReference newRef(ro.object_reference());
+        StreamMapUUID*state=activateTemporaryObject(temporaryKeys.object_keys(i-1),newRef,ro);
+        if (state==NULL||!state->hasObjectHostKey()) {
+            forgeDisconnectionMessage(newRef);//disconnected while registering, as in processNewObject
+            continue;
+        }
+        target=state;
+        keys.add_object_keys(state->objectHostKey());
+        retObjs.add_message(rmb.message_names(i),rmb.message_arguments(i));
+    }
+    if (target) {//every object in a batch came from the same multiplexed stream
+        RoutableMessageBody reply;
+        keys.SerializeToString(reply.add_message("RetObjBatch"));
+        for (int i=0;i<retObjs.message_size();++i) {
+            reply.add_message(retObjs.message_names(i),retObjs.message_arguments(i));
+        }
+        RoutableMessageHeader replyHeader;
+        replyHeader.set_source_object(ObjectReference::spaceServiceID());
+        replyHeader.set_source_port(Services::REGISTRATION);
+        std::string header_data,reply_data;
+        replyHeader.SerializeToString(&header_data);
+        reply.SerializeToString(&reply_data);
+        sendToStream(target,MemoryReference(header_data),MemoryReference(reply_data));
+    }
+    return true;
+}
+void ObjectConnections::disconnectState(StreamMapUUID*state) {
+    UUID id=state->uuid();
+    StreamMap::iterator uwhere=mActiveStreams.find(id);
+    TemporaryStreamMultimap::iterator twhere;
+    StreamSet::iterator stream_set_iterator;
+    if (uwhere!=mActiveStreams.end()&&(stream_set_iterator=std::find(uwhere->second.begin(),uwhere->second.end(),state))!=uwhere->second.end()) {
+        ResumableObjectMap::iterator rwhere;
+        if (uwhere->second.size()==1&&state->connected()&&mResumeGracePeriod>Duration::zero()&&(rwhere=mResumableObjects.find(id))!=mResumableObjects.end()) {
+            //the object stays registered for a while in case its object host reconnects and resumes it
+            rwhere->second.mSuspended=true;
+            rwhere->second.mExpiry=Time::now()+mResumeGracePeriod;
+            mActiveStreams.erase(uwhere);
+            Network::IOServiceFactory::dispatchServiceMessage(mIO,mResumeGracePeriod,std::tr1::bind(&ObjectConnections::expireSuspendedObject,this,id));
+        }else if (uwhere->second.size()==1&&state->connected()) {//As soon as discon message detected, stream is disconnected, so must have had no disconnect message, hence send forged disconnect
+            forgeDisconnectionMessage(ObjectReference(id)); // forged disconnect may erase the stream, and state with it.
+            uwhere=mActiveStreams.find(id); // so search for it again
+            if (uwhere != mActiveStreams.end()) {
+                mActiveStreams.erase(uwhere);//erase the active stream
+            }
+        }else {
+            uwhere->second.erase(stream_set_iterator);
+        }
+    }else if ((twhere=mTemporaryStreams.find(id))!=mTemporaryStreams.end()) {
+        while (twhere!=mTemporaryStreams.end()&&twhere->first==id) {
+            if (twhere->second.mState==state) {
+                mTemporaryStreams.erase(twhere++);//erase the temporary stream, destroying all pending messages
+            } else {
+                ++twhere;
+            }
+        }
+    }else {
+        SILOG(space,error,"Stream with unknown reference "<<id.toString());
+    }
+}
+void ObjectConnections::expireSuspendedObject(UUID id) {
+    ResumableObjectMap::iterator where=mResumableObjects.find(id);
+    if (where!=mResumableObjects.end()&&where->second.mSuspended&&!(Time::now()<where->second.mExpiry)) {
+        SILOG(space,debug,"Object "<<id.toString()<<" was not resumed in time");
+        forgeDisconnectionMessage(ObjectReference(id));
+        mResumableObjects.erase(id);//in case the Registration service did not answer
+    }
+}
+void ObjectConnections::admitObject(const ObjectReference&object, const UUID&resumeToken) {
+    UUID id=object.getAsUUID();
+    if (mActiveStreams.find(id)!=mActiveStreams.end()) {
+        return;//it has come back before the server it left let go of it
+    }
+    ResumableObjectMap::iterator where=mResumableObjects.insert(ResumableObjectMap::value_type(id,ResumableObject(resumeToken))).first;
+    where->second.mToken=resumeToken;
+    where->second.mSuspended=true;
+    where->second.mExpiry=Time::now()+mResumeGracePeriod;
+    Network::IOServiceFactory::dispatchServiceMessage(mIO,mResumeGracePeriod,std::tr1::bind(&ObjectConnections::expireSuspendedObject,this,id));
+}
+bool ObjectConnections::migrateObject(const ObjectReference&object, const Network::Address&address, const UUID&resumeToken) {
+    StreamMap::iterator where=mActiveStreams.find(object.getAsUUID());
+    if (where==mActiveStreams.end()||where->second.empty()) {
+        return false;
+    }
+    mResumableObjects.erase(object.getAsUUID());//once its stream here drops it lives on the other server
+    StreamMapUUID*target=chooseStream(where->second);
+    RoutableMessageHeader hdr;
+    hdr.set_source_object(ObjectReference::spaceServiceID());
+    hdr.set_source_port(Services::OBJECT_CONNECTIONS);
+    if (target->hasObjectHostKey()) {
+        hdr.set_destination_object(ObjectReference(target->objectHostKey()));
+    }
+    Protocol::MigrateObj migrate;
+    migrate.set_address(address.getHostName()+":"+address.getService());
+    migrate.set_resume_token(resumeToken);
+    RoutableMessageBody body;
+    migrate.SerializeToString(body.add_message("MigrateObj"));
+    std::string header_data,body_data;
+    hdr.SerializeToString(&header_data);
+    body.SerializeToString(&body_data);
+    sendToStream(target,MemoryReference(header_data),MemoryReference(body_data));
+    return true;
+}
+bool ObjectConnections::resumeObject(StreamMapUUID&state,const String&argument) {
+    Protocol::ResumeObj resume;
+    if (state.connected()||!resume.ParseFromString(argument)||!resume.has_object_reference()||!resume.has_resume_token()) {
+        return false;
+    }
+    UUID id=resume.object_reference();
+    ResumableObjectMap::iterator rwhere=mResumableObjects.find(id);
+    if (rwhere==mResumableObjects.end()||!(rwhere->second.mToken==resume.resume_token())) {
+        return false;
+    }
+    rwhere->second.mSuspended=false;//if the old stream has not dropped yet, the object just has one more stream until it does
+    UUID temporaryId=state.uuid();
+    std::vector<Network::Chunk> pendingMessages;
+    for (TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(temporaryId);twhere!=mTemporaryStreams.end()&&twhere->first==temporaryId;) {
+        if (twhere->second.mState==&state) {
+            twhere->second.mPendingMessages.swap(pendingMessages);
+            mTemporaryStreams.erase(twhere++);
+        }else {
+            ++twhere;
+        }
+    }
+    state.setId(id);
+    state.setConnected();
+    state.setDoneConnecting();
+    mActiveStreams[id].push_back(&state);
+    for (std::vector<Network::Chunk>::iterator i=pendingMessages.begin(),ie=pendingMessages.end();i!=ie;++i) {
+        bytesReceivedCallback(&state,*i);//process pending messages as if they were just received
+    }
+    return true;
+}
+void ObjectConnections::eraseMultiplexedObject(Network::Stream*stream,UUID key) {
+    std::tr1::unordered_map<Network::Stream*,MultiplexedObjectMap>::iterator where=mMultiplexedObjects.find(stream);
+    if (where!=mMultiplexedObjects.end()) {
+        where->second.erase(key);
+    }
+}
 void ObjectConnections::connectionCallback(Network::Stream*stream, Network::Stream::ConnectionStatus status, const std::string&reason){
     if (status!=Network::Stream::Connected) {
         SILOG(space,debug,"Connection lost "<<reason);//log connection lost
+        if (mCapture)
+            mCapture->closed(stream);
+        std::tr1::unordered_map<Network::Stream*,MultiplexedObjectMap>::iterator mwhere;
+        while ((mwhere=mMultiplexedObjects.find(stream))!=mMultiplexedObjects.end()&&!mwhere->second.empty()) {
+            UUID key=mwhere->second.begin()->first;
+            disconnectState(&mwhere->second.begin()->second);
+            eraseMultiplexedObject(stream,key);
+        }
+        mMultiplexedObjects.erase(stream);
         std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator where=mStreams.find(stream);//find active stream
         if (where!=mStreams.end()) {
-            StreamMap::iterator uwhere=mActiveStreams.find(where->second.uuid());
-            TemporaryStreamMultimap::iterator twhere;
-            StreamSet::iterator stream_set_iterator;
-            if (uwhere!=mActiveStreams.end()&&(stream_set_iterator=std::find(uwhere->second.begin(),uwhere->second.end(),stream))!=uwhere->second.end()) {
-                if (uwhere->second.size()==1&&where->second.connected()) {//As soon as discon message detected, stream is disconnected, so must have had no disconnect message, hence send forged disconnect
-                    forgeDisconnectionMessage(ObjectReference(uwhere->first)); // forged disconnect may erase the stream.
-                    uwhere=mActiveStreams.find(where->second.uuid()); // so search for it again
-                    if (uwhere != mActiveStreams.end()) {
-                        mActiveStreams.erase(uwhere);//erase the active stream
-                    }
-                }else {
-                    uwhere->second.erase(stream_set_iterator);
-                }
-            }else if ((twhere=mTemporaryStreams.find(where->second.uuid()))!=mTemporaryStreams.end()) {
-                while (twhere!=mTemporaryStreams.end()&&twhere->first==where->second.uuid()) {
-                    if (twhere->second.mStream==stream) {
-                        mTemporaryStreams.erase(twhere++);//erase the temporary stream, destroying all pending messages
-                    } else {
-                        ++twhere;
-                    }
-                }
-            }else {
-                SILOG(space,error,"Stream with unknown reference "<<where->second.uuid().toString());
+            disconnectState(&where->second);
+            where=mStreams.find(stream);
+            if (where!=mStreams.end()) {
+                mStreams.erase(where);//delete stream from record of active streams
             }
-            mStreams.erase(where);//delete stream from record of active streams
         }else {
             SILOG(space,error,"Stream not found "<<reason);
         }
+        mPendingBatches.erase(stream);
         delete stream;//delete the stream pointer since all references to it have been waxed (aside from callbacks--which is ok due to single-threaded assumption))
     }else {
         SILOG(space,insane,"Connected "<<reason);
@@ -189,6 +461,7 @@ void ObjectConnections::connectionCallback(Network::Stream*stream, Network::Stre
 }
 ObjectConnections::~ObjectConnections(){
     delete mListener;
+    delete mCapture;
     for (std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator i=mStreams.begin(),
              ie=mStreams.end();
          i!=ie;
@@ -206,7 +479,7 @@ Network::Stream* ObjectConnections::activeConnectionTo(const ObjectReference&ref
         mActiveStreams.erase(where);
         return NULL;
     }
-    return where->second[((size_t)(percent*where->second.size()))%where->second.size()];
+    return where->second[((size_t)(percent*where->second.size()))%where->second.size()]->stream();
 }
 
 Network::Stream* ObjectConnections::temporaryConnectionTo(const UUID&ref) {
@@ -238,6 +511,9 @@ void ObjectConnections::processMessage(const RoutableMessageHeader&header,
     const RoutableMessageHeader *hdr=&header;
     bool disconnectionAttempt=false;
     if (header.has_source_object()&&header.source_object()==ObjectReference::spaceServiceID()&&header.source_port()==Services::REGISTRATION) {//message from registration service
+        if (processNewObjectBatch(header,message_body)) {
+            return;//answered in one message down the stream the batch came from
+        }
         ObjectReference newRef;
         if (processNewObject(header,message_body,newRef)) {//it could be a new object
             newHeader=header;
@@ -255,15 +531,27 @@ void ObjectConnections::processMessage(const RoutableMessageHeader&header,
 
 void ObjectConnections::shutdownConnection(const ObjectReference&ref) {
     Network::Stream*stream=NULL;
+    ResumableObjectMap::iterator rwhere=mResumableObjects.find(ref.getAsUUID());
+    if (rwhere!=mResumableObjects.end()) {
+        bool suspended=rwhere->second.mSuspended;
+        mResumableObjects.erase(rwhere);
+        if (suspended) {
+            return;//it has no streams left to close
+        }
+    }
     StreamMap::iterator awhere=mActiveStreams.find(ref.getAsUUID());//find uuid in active streams
     if (awhere!=mActiveStreams.end()){
-        if (awhere->second.size()>1) {
-            for (StreamSet::iterator i=awhere->second.begin(),ie=awhere->second.end();i!=ie;++i) {
-                std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator where=mStreams.find(*i);
+        for (StreamSet::iterator i=awhere->second.begin(),ie=awhere->second.end();i!=ie;++i) {
+            if ((*i)->hasObjectHostKey()) {
+                eraseMultiplexedObject((*i)->stream(),(*i)->objectHostKey());//the stream stays up for the other objects on it
+            }else if (awhere->second.size()>1) {
+                stream=(*i)->stream();
+                std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator where=mStreams.find(stream);
                 if (where!=mStreams.end()) {
                     mStreams.erase(where);
                 }
-                delete *i;
+                mPendingBatches.erase(stream);
+                delete stream;
             }
         }
         mActiveStreams.erase(awhere);
@@ -271,16 +559,23 @@ void ObjectConnections::shutdownConnection(const ObjectReference&ref) {
         UUID uuid=ref.getAsUUID();
         TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(uuid);       //ok maybe it's a temporary stream
         if (twhere!=mTemporaryStreams.end()) {
-            for (;twhere!=mTemporaryStreams.end()&&twhere->first==uuid;++twhere) {
+            while (twhere!=mTemporaryStreams.end()&&twhere->first==uuid) {
                 std::tr1::unordered_map<Network::Stream*,StreamMapUUID>::iterator where;
 
                 stream=twhere->second.mStream;//well erase it to avoid dangling references
+                if (twhere->second.mState->hasObjectHostKey()) {//only the one object goes away from a multiplexed stream
+                    UUID key=twhere->second.mState->objectHostKey();
+                    mTemporaryStreams.erase(twhere++);
+                    eraseMultiplexedObject(stream,key);
+                    continue;
+                }
                 where=mStreams.find(stream);
-                mTemporaryStreams.erase(twhere);//but this is a critical error: the registration service should not know about this
+                mTemporaryStreams.erase(twhere++);//but this is a critical error: the registration service should not know about this
                 SILOG(space,error,"FATAL: Stream connected yet found in temporary streams" << where->second.uuid().toString());
                 if (where!=mStreams.end()) {
                     mStreams.erase(where);
                 }
+                mPendingBatches.erase(stream);
                 delete stream;
             }
         }else {
@@ -289,6 +584,60 @@ void ObjectConnections::shutdownConnection(const ObjectReference&ref) {
     }
 }
 
+ObjectConnections::StreamMapUUID*ObjectConnections::activateTemporaryObject(const UUID&uuid,const ObjectReference&newRef,const Protocol::RetObj&ro) {
+    TemporaryStreamMultimap::iterator start,where=mTemporaryStreams.find(uuid);
+    if (where==mTemporaryStreams.end()) {
+        return NULL;
+    }
+    start=where;//messages are always added to first mTemporaryStream, so go from back to front when sending them out
+    for (;where!=mTemporaryStreams.end()&&where->first==uuid;++where) {
+    }
+    StreamMapUUID*connection=NULL;
+    std::vector<Network::Chunk> pendingMessages;
+    std::vector<std::pair<StreamMapUUID*,Network::Chunk> > taggedPendingMessages;
+    do  {
+        --where;
+        StreamMapUUID* iter=connection=where->second.mState;
+        iter->setConnected();
+        iter->setDoneConnecting();
+        iter->setId(newRef.getAsUUID());//set the id of the stream map to the permanent ObjetReference
+        if (pendingMessages.empty()) {
+            where->second.mPendingMessages.swap(pendingMessages);//get ready to send pending messages
+        }else {
+            for (std::vector<Network::Chunk>::iterator i=where->second.mPendingMessages.begin(),ie=where->second.mPendingMessages.end();i!=ie;++i) {
+                std::pair<StreamMapUUID*,Network::Chunk> newChunk;
+                newChunk.first=iter;
+
+
+                taggedPendingMessages.push_back(newChunk);
+                taggedPendingMessages.back().second.swap(*i);
+            }
+        }
+        where->second.mTotalMessageSize=0;//reset bytes used
+        mActiveStreams[newRef.getAsUUID()].push_back(iter);//setup mStream and
+    }while (where!=start);
+    mTemporaryStreams.erase(start);
+    while ((where=mTemporaryStreams.find(uuid))!=mTemporaryStreams.end()) {
+        mTemporaryStreams.erase(where);
+    }
+    if (ro.has_resume_token()) {
+        mResumableObjects.erase(newRef.getAsUUID());
+        mResumableObjects.insert(ResumableObjectMap::value_type(newRef.getAsUUID(),ResumableObject(ro.resume_token())));
+    }
+    for (std::vector<Network::Chunk>::iterator i=pendingMessages.begin(),
+             ie=pendingMessages.end();
+         i!=ie;
+         ++i) {
+        bytesReceivedCallback(connection,*i);//process pending messages as if they were just received
+    }
+    for (std::vector<std::pair<StreamMapUUID*,Network::Chunk> >::iterator i=taggedPendingMessages.begin(),
+             ie=taggedPendingMessages.end();
+         i!=ie;
+         ++i) {
+        bytesReceivedCallback(i->first,i->second);//process pending messages as if they were just received
+    }
+    return connection;
+}
 bool ObjectConnections::processNewObject(const RoutableMessageHeader&hdr,MemoryReference body_array, ObjectReference&newRef) {
     bool new_object=false;
     RoutableMessageBody rmb;
@@ -301,59 +650,14 @@ bool ObjectConnections::processNewObject(const RoutableMessageHeader&hdr,MemoryR
                         if (ro.has_object_reference()) {
                             newRef=ObjectReference(ro.object_reference());//get the new reference
                             UUID uuid=hdr.destination_object().getAsUUID();
-                            TemporaryStreamMultimap::iterator start,where=mTemporaryStreams.find(uuid);
-                            if (where!=mTemporaryStreams.end()) {//a currently existing temporary stream
-                                start=where;//messages are always added to first mTemporaryStream, so go from back to front when sending them out
-                                for (;where!=mTemporaryStreams.end()&&where->first==uuid;++where) {
-                                }
-                                Network::Stream*stream=NULL;
-                                std::vector<Network::Chunk> pendingMessages;
-                                std::vector<std::pair<Network::Stream*,Network::Chunk> > taggedPendingMessages;
-                                do  {
-                                    --where;
-                                    stream = where->second.mStream;
-                                    StreamMapUUID* iter=&mStreams[stream];
-                                    iter->setConnected();
-                                    iter->setDoneConnecting();
-                                    iter->setId(newRef.getAsUUID());//set the id of the stream map to the permanent ObjetReference
-                                    if (pendingMessages.empty()) {
-                                        where->second.mPendingMessages.swap(pendingMessages);//get ready to send pending messages
-                                    }else {
-                                        for (std::vector<Network::Chunk>::iterator i=where->second.mPendingMessages.begin(),ie=where->second.mPendingMessages.end();i!=ie;++i) {
-                                            std::pair<Network::Stream*,Network::Chunk> newChunk;
-                                            newChunk.first=where->second.mStream;
-
-
-                                            taggedPendingMessages.push_back(newChunk);
-                                            taggedPendingMessages.back().second.swap(*i);
-                                        }
-                                    }
-                                    where->second.mTotalMessageSize=0;//reset bytes used
-                                    mActiveStreams[newRef.getAsUUID()].push_back(stream);//setup mStream and
-                                }while (where!=start);
-                                mTemporaryStreams.erase(start);
-                                while ((where=mTemporaryStreams.find(uuid))!=mTemporaryStreams.end()) {
-                                    mTemporaryStreams.erase(where);
-                                }
-                                for (std::vector<Network::Chunk>::iterator i=pendingMessages.begin(),
-                                         ie=pendingMessages.end();
-                                     i!=ie;
-                                     ++i) {
-                                    bytesReceivedCallback(stream,*i);//process pending messages as if they were just received
-                                }
-                                for (std::vector<std::pair<Network::Stream*,Network::Chunk> >::iterator i=taggedPendingMessages.begin(),
-                                         ie=taggedPendingMessages.end();
-                                     i!=ie;
-                                     ++i) {
-                                    bytesReceivedCallback(i->first,i->second);//process pending messages as if they were just received
-                                }
+                            if (activateTemporaryObject(uuid,newRef,ro)) {//a currently existing temporary stream
                                 return true;//new object ready to use
                             }else {
                                 StreamMap::iterator replicatedObject=mActiveStreams.find(newRef.getAsUUID());
                                 if (replicatedObject!=mActiveStreams.end()) {//for some reason the registration service gave us another active registration
                                     //FIXME: this error case is potentially problematic
                                     for (StreamSet::iterator i=replicatedObject->second.begin(),ie=replicatedObject->second.end();i!=ie;++i) {
-                                        mStreams[*i].setDoneConnecting();//make sure to mark the stream as done connecting
+                                        (*i)->setDoneConnecting();//make sure to mark the stream as done connecting
                                     }
                                     SILOG(space,error,"Duplicate addition of "<<hdr.destination_object().toString()<<" as "<<newRef.toString());
                                     return true;
@@ -385,6 +689,35 @@ bool ObjectConnections::processNewObject(const RoutableMessageHeader&hdr,MemoryR
     SILOG(space,error,"null destination object for new object reference");//should not get here
     return true;
 }
+bool ObjectConnections::forwardToConnectedObject(RoutableMessageHeaderView&hdr,MemoryReference body_array){
+    if (!hdr.has_destination_object())
+        return false;
+    StreamMap::iterator where=mActiveStreams.find(hdr.destination_object().getAsUUID());
+    if (where==mActiveStreams.end()||where->second.empty())
+        return false;
+    StreamMapUUID*target=chooseStream(where->second);
+    if (target->hasObjectHostKey()) {
+        hdr.set_destination_object(ObjectReference(target->objectHostKey()));//lets the object host tell the objects on the stream apart
+    }else {
+        hdr.clear_destination_object();//no reason to waste bytes
+    }
+    MessageTrace::stamp(hdr,MessageTrace::SPACE_SEND);
+    unsigned char header_data[256];
+    size_t header_size=hdr.SerializeToArray(header_data,sizeof(header_data));
+    std::string large_header;
+    MemoryReference header(header_data,header_size);
+    if (header_size==0&&hdr.ByteSize()) {
+        large_header.resize(hdr.ByteSize());
+        hdr.SerializeToArray(&large_header[0],large_header.size());
+        header=MemoryReference(large_header);
+    }
+    sendToStream(target,header,body_array);
+    return true;
+}
+ObjectConnections::StreamMapUUID*ObjectConnections::chooseStream(const StreamSet&streams) {
+    double percent=((double)rand())/(RAND_MAX);
+    return streams[((size_t)(percent*streams.size()))%streams.size()];
+}
 void ObjectConnections::processExistingObject(const RoutableMessageHeader&const_hdr,MemoryReference body_array, bool forward){
     if (const_hdr.has_destination_object()) {//only process if valid destination
         StreamMap::iterator where;
@@ -395,21 +728,104 @@ void ObjectConnections::processExistingObject(const RoutableMessageHeader&const_
             } else {
                 SILOG(space,warning,"Dropping message from "<<const_hdr.source_object().toString()<<" because forwardMessagesTo was not called");
             }
-        }else {
-            RoutableMessageHeader hdr(const_hdr);//send it to the found stream
-            std::string header_data;
-            hdr.clear_destination_object();//no reason to waste bytes
-            hdr.SerializeToString(&header_data);//serialize then send out
-            double percent=((double)rand())/(RAND_MAX);
+        }else if (where!=mActiveStreams.end()) {
             if (where->second.empty()) {
                 SILOG(space,error,"Somehow got empty object connection stream.");
                 mActiveStreams.erase(where);
             }else {
-                where->second[((size_t)(percent*where->second.size()))%where->second.size()]->send(MemoryReference(header_data),body_array,Network::ReliableOrdered);//FIXME can this be unordered?
+                StreamMapUUID*target=chooseStream(where->second);
+                RoutableMessageHeader hdr(const_hdr);//send it to the found stream
+                std::string header_data;
+                if (target->hasObjectHostKey()) {
+                    hdr.set_destination_object(ObjectReference(target->objectHostKey()));//lets the object host tell the objects on the stream apart
+                }else {
+                    hdr.clear_destination_object();//no reason to waste bytes
+                }
+                MessageTrace::stamp(hdr,MessageTrace::SPACE_SEND);
+                hdr.SerializeToString(&header_data);//serialize then send out
+                sendToStream(target,MemoryReference(header_data),body_array);
             }
         }
     }else {
         SILOG(space,warning, "null destination object for message routing with source "<<const_hdr.source_object().toString());
     }
 }
+void ObjectConnections::processConnectionOptions(StreamMapUUID&stream,MemoryReference body_array) {
+    RoutableMessageBody rmb;
+    if (rmb.ParseFromArray(body_array.data(),body_array.size())) {
+        for (int i=0;i<rmb.message_size();++i) {
+            if (rmb.message_names(i)=="EnableBatching") {
+                stream.setBatching();
+            }else if (rmb.message_names(i)=="MultiplexObjects"&&!stream.hasObjectHostKey()) {
+                stream.setMultiplexed();
+            }else if (rmb.message_names(i)=="DetachObject"&&stream.hasObjectHostKey()) {
+                //the object left its multiplexed stream: treat it like a stream closing, which also frees stream
+                Network::Stream*multiplexed=stream.stream();
+                UUID key=stream.objectHostKey();
+                disconnectState(&stream);
+                eraseMultiplexedObject(multiplexed,key);
+                return;
+            }else if (rmb.message_names(i)=="ResumeObject") {
+                if (!resumeObject(stream,rmb.message_arguments(i))) {
+                    SILOG(space,warning,"Cannot resume object for "<<stream.uuid().toString());
+                    RoutableMessageHeader hdr;//so the object host stops waiting on it
+                    hdr.set_source_object(ObjectReference::spaceServiceID());
+                    hdr.set_source_port(Services::OBJECT_CONNECTIONS);
+                    if (stream.hasObjectHostKey()) {
+                        hdr.set_destination_object(ObjectReference(stream.objectHostKey()));
+                    }
+                    RoutableMessageBody failure;
+                    failure.add_message("ResumeFailed");
+                    std::string header_data,failure_data;
+                    hdr.SerializeToString(&header_data);
+                    failure.SerializeToString(&failure_data);
+                    sendToStream(&stream,MemoryReference(header_data),MemoryReference(failure_data));
+                }
+            }else {
+                SILOG(space,warning,"Unknown connection option "<<rmb.message_names(i)<<" from "<<stream.uuid().toString());
+            }
+        }
+    }else {
+        SILOG(space,warning,"Cannot parse connection options from "<<stream.uuid().toString());
+    }
+}
+void ObjectConnections::sendToStream(StreamMapUUID*connection,MemoryReference header,MemoryReference body_array) {
+    Network::Stream*stream=connection->stream();
+    size_t size=header.size()+body_array.size();
+    if (!connection->batching()) {
+        stream->send(header,body_array,Network::ReliableOrdered);//FIXME can this be unordered?
+        return;
+    }
+    if (size>=mMaxBatchSize) {
+        flushBatch(stream);//keep earlier messages ahead of this one
+        stream->send(header,body_array,Network::ReliableOrdered);
+        return;
+    }
+    String&batch=mPendingBatches[stream];
+    uint8 length[Network::Stream::uint30::MAX_SERIALIZED_LENGTH];
+    unsigned int lengthSize=Network::Stream::uint30(size).serialize(length,sizeof(length));
+    batch.append((const char*)length,lengthSize);
+    batch.append((const char*)header.data(),header.size());
+    batch.append((const char*)body_array.data(),body_array.size());
+    if (batch.size()>=mMaxBatchSize) {
+        flushBatch(stream);
+    }else if (!mBatchFlushScheduled) {
+        mBatchFlushScheduled=true;
+        Network::IOServiceFactory::dispatchServiceMessage(mIO,mBatchDelay,std::tr1::bind(&ObjectConnections::flushBatches,this));
+    }
+}
+void ObjectConnections::flushBatch(Network::Stream*stream) {
+    std::tr1::unordered_map<Network::Stream*,String>::iterator where=mPendingBatches.find(stream);
+    if (where!=mPendingBatches.end()) {
+        stream->send(MemoryReference(mBatchHeader),MemoryReference(where->second),Network::ReliableOrdered);
+        mPendingBatches.erase(where);
+    }
+}
+void ObjectConnections::flushBatches() {
+    mBatchFlushScheduled=false;
+    for (std::tr1::unordered_map<Network::Stream*,String>::iterator i=mPendingBatches.begin(),ie=mPendingBatches.end();i!=ie;++i) {
+        i->first->send(MemoryReference(mBatchHeader),MemoryReference(i->second),Network::ReliableOrdered);
+    }
+    mPendingBatches.clear();
+}
 }
@@ -0,0 +1,191 @@
+/*  Sirikata libspace -- Object Segmentation
+ *  Oseg.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <space/Oseg.hpp>
+#include <space/Router.hpp>
+#include "Space_Sirikata.pbj.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/KnownServices.hpp"
+namespace Sirikata {
+
+Oseg::Oseg(size_t maxCacheSize):mServerIndex(0),mNumServers(1),mRouter(NULL),mMaxCacheSize(maxCacheSize) {
+}
+
+Oseg::~Oseg() {
+}
+
+void Oseg::setServers(uint32 serverIndex, uint32 numServers, Router*router) {
+    mServerIndex=serverIndex;
+    mNumServers=numServers?numServers:1;
+    mRouter=router;
+    mHomeObjects.clear();
+    mCache.clear();
+    mCacheOrder.clear();
+    for (std::tr1::unordered_set<ObjectReference,ObjectReference::Hasher>::iterator i=mLocalObjects.begin(),ie=mLocalObjects.end();i!=ie;++i) {
+        addLocalObject(*i);
+    }
+}
+
+uint32 Oseg::homeServer(const ObjectReference&object)const {
+    //the same on every server, whatever its hash functions: ObjectReferences are digests, so any four bytes spread well
+    UUID::Data data=object.toRawBytes();
+    uint32 hash=data[0]|(data[1]<<8)|(data[2]<<16)|((uint32)data[3]<<24);
+    return hash%mNumServers;
+}
+
+uint32 Oseg::lookup(const ObjectReference&object)const {
+    if (mLocalObjects.find(object)!=mLocalObjects.end())
+        return mServerIndex;
+    ServerMap::const_iterator where=mHomeObjects.find(object);
+    if (where!=mHomeObjects.end())
+        return where->second;
+    where=mCache.find(object);
+    if (where!=mCache.end())
+        return where->second;
+    return UNKNOWN_SERVER;
+}
+
+void Oseg::addLocalObject(const ObjectReference&object) {
+    mLocalObjects.insert(object);
+    uint32 home=homeServer(object);
+    if (home==mServerIndex) {
+        mHomeObjects[object]=mServerIndex;
+    }else {
+        sendUpdate(home,object,mServerIndex);
+    }
+}
+
+void Oseg::removeLocalObject(const ObjectReference&object) {
+    if (mLocalObjects.erase(object)==0)
+        return;
+    uint32 home=homeServer(object);
+    if (home==mServerIndex) {
+        ServerMap::iterator where=mHomeObjects.find(object);
+        if (where!=mHomeObjects.end()&&where->second==mServerIndex)
+            mHomeObjects.erase(where);
+    }else {
+        sendUpdate(home,object,UNKNOWN_SERVER);
+    }
+}
+
+void Oseg::cacheServer(const ObjectReference&object, uint32 host) {
+    std::pair<ServerMap::iterator,bool> inserted=mCache.insert(ServerMap::value_type(object,host));
+    if (!inserted.second) {
+        inserted.first->second=host;
+        return;
+    }
+    mCacheOrder.push_back(object);
+    while (mCacheOrder.size()>mMaxCacheSize) {
+        //an entry dropped and cached again since may go early: it is only a cache
+        mCache.erase(mCacheOrder.front());
+        mCacheOrder.pop_front();
+    }
+}
+
+void Oseg::sendUpdate(uint32 server, const ObjectReference&object, uint32 host) {
+    if (mRouter==NULL||server==mServerIndex)
+        return;
+    Protocol::OsegUpdate update;
+    update.set_object_reference(object.getAsUUID());
+    if (host!=UNKNOWN_SERVER)
+        update.set_server(host);
+    RoutableMessageBody body;
+    update.SerializeToString(body.add_message("OsegUpdate"));
+    std::string message_body;
+    body.SerializeToString(&message_body);
+    RoutableMessageHeader header;
+    header.set_source_object(ObjectReference::spaceServiceID());
+    header.set_source_port(Services::OSEG);
+    header.set_destination_object(ObjectReference::spaceServiceID());
+    header.set_destination_port(Services::OSEG);
+    mRouter->sendToServer(server,header,MemoryReference(message_body));
+}
+
+void Oseg::sendLocation(uint32 server, const ObjectReference&object) {
+    sendUpdate(server,object,lookup(object));
+}
+
+void Oseg::processServerMessage(uint32 server, MemoryReference message_body) {
+    RoutableMessageBody body;
+    if (!body.ParseFromArray(message_body.data(),message_body.size())) {
+        SILOG(space,warning,"Oseg:Unable to parse message body from server "<<server);
+        return;
+    }
+    for (int i=0;i<body.message_size();++i) {
+        Protocol::OsegUpdate update;
+        if (body.message_names(i)!="OsegUpdate"||!update.ParseFromString(body.message_arguments(i))||!update.has_object_reference()) {
+            SILOG(space,warning,"Oseg:Do not understand message of type "<<body.message_names(i)<<" from server "<<server);
+            continue;
+        }
+        ObjectReference object(update.object_reference());
+        if (mLocalObjects.find(object)!=mLocalObjects.end())
+            continue;//nobody knows better than the server the object is registered with
+        bool home=homeServer(object)==mServerIndex;
+        ServerMap&entries=home?mHomeObjects:mCache;
+        if (update.has_server()) {
+            if (home)
+                mHomeObjects[object]=update.server();
+            else
+                cacheServer(object,update.server());
+        }else {
+            //the sender does not host the object: forget it was said to, unless someone else has claimed it since
+            ServerMap::iterator where=entries.find(object);
+            if (where!=entries.end()&&where->second==server)
+                entries.erase(where);
+        }
+    }
+}
+
+void Oseg::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    if (!(header.has_source_object()&&header.source_object()==ObjectReference::spaceServiceID()&&header.source_port()==Services::REGISTRATION))
+        return;
+    RoutableMessageBody body;
+    if (!body.ParseFromArray(message_body.data(),message_body.size())) {
+        SILOG(space,warning,"Oseg:Unable to parse message body originating from "<<header.source_object());
+        return;
+    }
+    for (int i=0;i<body.message_size();++i) {
+        if (body.message_names(i)=="RetObj") {
+            Protocol::RetObj retObj;
+            if (retObj.ParseFromString(body.message_arguments(i))&&retObj.has_object_reference()) {
+                addLocalObject(ObjectReference(retObj.object_reference()));
+            }
+        }else if (body.message_names(i)=="DelObj") {
+            Protocol::DelObj delObj;
+            if (delObj.ParseFromString(body.message_arguments(i))&&delObj.has_object_reference()) {
+                removeLocalObject(ObjectReference(delObj.object_reference()));
+            }
+        }
+    }
+}
+
+}
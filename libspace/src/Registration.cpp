@@ -36,7 +36,9 @@
 #include <util/KnownServices.hpp>
 namespace Sirikata {
 
-Registration::Registration(const SHA256&privateKey):mPrivateKey(privateKey) {
+Registration::Registration(const SHA256&privateKey, double compactSectorSize, float compactMaxSpeed)
+ : mPrivateKey(privateKey),
+   mCompactFormat(compactSectorSize,compactMaxSpeed,Time::now()) {
     
 }
 
@@ -65,6 +67,52 @@ void Registration::processMessage(const RoutableMessageHeader&header,MemoryRefer
         SILOG(registration,warning,"Unable to parse message body from message originating from "<<header.source_object());        
     }
 }
+UUID Registration::resumeToken(const UUID&object_reference) const {
+    unsigned char evidence[SHA256::static_size+UUID::static_size];
+    std::memcpy(evidence,mPrivateKey.rawData().begin(),SHA256::static_size);
+    std::memcpy(evidence+SHA256::static_size,object_reference.getArray().begin(),UUID::static_size);
+    return UUID(SHA256::computeDigest(evidence,sizeof(evidence)).rawData().begin(),UUID::static_size);
+}
+bool Registration::registerObject(const Protocol::NewObj&newObj,Protocol::RetObj&retObj) const {
+    if (!(newObj.has_requested_object_loc()&&newObj.has_bounding_sphere())) {
+        return false;
+    }
+    unsigned char evidence[SHA256::static_size+UUID::static_size];
+    UUID private_object_evidence (newObj.object_uuid_evidence());
+    std::memcpy(evidence,mPrivateKey.rawData().begin(),SHA256::static_size);
+    std::memcpy(evidence+SHA256::static_size,private_object_evidence.getArray().begin(),UUID::static_size);
+    std::string obj_loc_string;
+    newObj.requested_object_loc().SerializeToString(&obj_loc_string);
+    retObj.mutable_location().ParseFromString(obj_loc_string);
+    retObj.set_bounding_sphere(newObj.bounding_sphere());
+    if (newObj.has_compact_loc_format()&&mCompactFormat.sectorSize()>0) {
+        mCompactFormat.toMessage(retObj.mutable_compact_loc_format());
+    }
+    if (private_object_evidence.getArray()[0]==private_object_evidence.getArray()[1]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[2]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[3]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[4]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[5]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[6]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[7]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[8]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[9]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[10]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[11]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[12]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[13]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[14]&&
+        private_object_evidence.getArray()[1]==private_object_evidence.getArray()[15]&&
+        private_object_evidence.getArray()[0]!=0) {
+        retObj.set_object_reference(private_object_evidence);                    
+    }else {
+        retObj.set_object_reference(UUID(SHA256::computeDigest(evidence,sizeof(evidence)).rawData().begin(),UUID::static_size));
+    }
+    if (newObj.has_resumable()&&newObj.resumable()) {
+        retObj.set_resume_token(resumeToken(retObj.object_reference()));
+    }
+    return true;
+}
 void Registration::asyncRegister(const RoutableMessageHeader&header,const RoutableMessageBody& body) {
     RoutableMessageBody retval;
     //for now do so synchronously in a very short-sighted manner.
@@ -73,37 +121,9 @@ void Registration::asyncRegister(const RoutableMessageHeader&header,const Routab
         if (body.message_names(i)=="NewObj") {
             Protocol::NewObj newObj;
             newObj.ParseFromString(body.message_arguments(i));
-            if (newObj.has_requested_object_loc()&&newObj.has_bounding_sphere()) {
-                unsigned char evidence[SHA256::static_size+UUID::static_size];
-                UUID private_object_evidence (newObj.object_uuid_evidence());
-                std::memcpy(evidence,mPrivateKey.rawData().begin(),SHA256::static_size);
-                std::memcpy(evidence+SHA256::static_size,private_object_evidence.getArray().begin(),UUID::static_size);
+            Protocol::RetObj retObj;
+            if (registerObject(newObj,retObj)) {
                 RoutableMessageHeader destination_header;
-                Protocol::RetObj retObj;
-                std::string obj_loc_string;
-                newObj.requested_object_loc().SerializeToString(&obj_loc_string);
-                retObj.mutable_location().ParseFromString(obj_loc_string);
-                retObj.set_bounding_sphere(newObj.bounding_sphere());
-                if (private_object_evidence.getArray()[0]==private_object_evidence.getArray()[1]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[2]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[3]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[4]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[5]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[6]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[7]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[8]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[9]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[10]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[11]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[12]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[13]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[14]&&
-                    private_object_evidence.getArray()[1]==private_object_evidence.getArray()[15]&&
-                    private_object_evidence.getArray()[0]!=0) {
-                    retObj.set_object_reference(private_object_evidence);                    
-                }else {
-                    retObj.set_object_reference(UUID(SHA256::computeDigest(evidence,sizeof(evidence)).rawData().begin(),UUID::static_size));
-                }
                 destination_header.set_destination_object(header.source_object());
                 destination_header.set_destination_port(header.source_port());
                 destination_header.set_source_object(ObjectReference::spaceServiceID());
@@ -120,6 +140,37 @@ void Registration::asyncRegister(const RoutableMessageHeader&header,const Routab
             }else {
                 SILOG(registration,warning,"Insufficient information in NewObj request"<<body.message_names(i));
             }
+        }else if (body.message_names(i)=="NewObjBatch") {
+            //one reply for the lot: a RetObjBatch naming the key of each RetObj after it, which the other services skip
+            Protocol::NewObjBatch batch;
+            batch.ParseFromString(body.message_arguments(i));
+            Protocol::RetObjBatch retBatch;
+            RoutableMessageBody retObjs;
+            int num_objects=batch.objects_size()<batch.object_keys_size()?batch.objects_size():batch.object_keys_size();
+            for (int j=0;j<num_objects;++j) {
+                Protocol::RetObj retObj;
+                if (registerObject(batch.objects(j),retObj)) {
+                    retBatch.add_object_keys(batch.object_keys(j));
+                    retObj.SerializeToString(retObjs.add_message("RetObj"));
+                }else {
+                    SILOG(registration,warning,"Insufficient information in NewObjBatch entry for "<<batch.object_keys(j).toString());
+                }
+            }
+            RoutableMessageBody reply;
+            retBatch.SerializeToString(reply.add_message("RetObjBatch"));
+            for (int j=0;j<retObjs.message_size();++j) {
+                reply.add_message(retObjs.message_names(j),retObjs.message_arguments(j));
+            }
+            RoutableMessageHeader destination_header;
+            destination_header.set_destination_object(header.source_object());
+            destination_header.set_destination_port(header.source_port());
+            destination_header.set_source_object(ObjectReference::spaceServiceID());
+            destination_header.set_source_port(Services::REGISTRATION);
+            std::string return_message;
+            reply.SerializeToString(&return_message);
+            for (std::vector<MessageService*>::iterator i=mServices.begin(),ie=mServices.end();i!=ie;++i) {
+                (*i)->processMessage(destination_header,MemoryReference(return_message));
+            }
         }else if (body.message_names(i)=="DelObj") {
             Protocol::DelObj delObj;
             delObj.ParseFromString(body.message_arguments(i));
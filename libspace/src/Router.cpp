@@ -0,0 +1,183 @@
+/*  Sirikata libspace -- Server to Server Routing
+ *  Router.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <space/Platform.hpp>
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "network/StreamFactory.hpp"
+#include "network/StreamListenerFactory.hpp"
+#include "util/Time.hpp"
+#include "util/RoutableMessage.hpp"
+#include "util/RoutableMessageHeaderView.hpp"
+#include "util/KnownServices.hpp"
+#include "space/Oseg.hpp"
+#include "space/Router.hpp"
+#include "space/ObjectConnections.hpp"
+namespace Sirikata {
+
+Router::Router(Network::IOService*io,
+               const std::vector<Network::Address>&servers,
+               uint32 serverIndex,
+               Oseg*objectSegmentation,
+               ObjectConnections*objectConnections)
+ : mIO(io),
+   mServerIndex(serverIndex),
+   mServers(servers),
+   mServerStreams(servers.size(),(Network::Stream*)NULL),
+   mObjectSegmentation(objectSegmentation),
+   mObjectConnections(objectConnections) {
+    mServerServices[Services::OSEG]=objectSegmentation;
+    mListener=Network::StreamListenerFactory::getSingleton().getDefaultConstructor()(mIO);
+    using std::tr1::placeholders::_1;    using std::tr1::placeholders::_2;
+    mListener->listen(Network::Address("0.0.0.0",mServers[mServerIndex].getService()),
+                      std::tr1::bind(&Router::newStreamCallback,this,_1,_2));
+}
+
+Router::~Router() {
+    delete mListener;
+    for (std::vector<Network::Stream*>::iterator i=mServerStreams.begin(),ie=mServerStreams.end();i!=ie;++i) {
+        delete *i;
+    }
+    for (std::tr1::unordered_set<Network::Stream*>::iterator i=mIncomingStreams.begin(),ie=mIncomingStreams.end();i!=ie;++i) {
+        delete *i;
+    }
+}
+
+void Router::sendToServer(uint32 server, uint8 hops, MemoryReference message) {
+    if (server>=mServerStreams.size()||server==mServerIndex)
+        return;
+    if (mServerStreams[server]==NULL) {
+        using std::tr1::placeholders::_1;    using std::tr1::placeholders::_2;
+        Network::Stream*stream=Network::StreamFactory::getSingleton().getDefaultConstructor()(mIO);
+        mServerStreams[server]=stream;
+        stream->connect(mServers[server],
+                        &Network::Stream::ignoreSubstreamCallback,
+                        std::tr1::bind(&Router::outgoingConnectionCallback,this,server,_1,_2),
+                        &Network::Stream::ignoreBytesReceived);
+    }
+    uint8 envelope[ENVELOPE_SIZE]={hops,
+                                   (uint8)mServerIndex,
+                                   (uint8)(mServerIndex>>8),
+                                   (uint8)(mServerIndex>>16),
+                                   (uint8)(mServerIndex>>24)};
+    if (mServerStreams[server]) {//unless it failed to connect then and there
+        mServerStreams[server]->send(MemoryReference(envelope,ENVELOPE_SIZE),message,Network::ReliableOrdered);
+    }
+}
+
+void Router::sendToServer(uint32 server, const RoutableMessageHeader&header, MemoryReference message_body) {
+    std::string message;
+    header.SerializeToString(&message);
+    message.append((const char*)message_body.data(),message_body.size());
+    sendToServer(server,0,MemoryReference(message));
+}
+
+void Router::outgoingConnectionCallback(uint32 server, Network::Stream::ConnectionStatus status, const std::string&reason) {
+    if (status!=Network::Stream::Connected) {
+        SILOG(space,warning,"Router:Lost connection to server "<<server<<": "<<reason);
+        //reconnect when next there is something to send: what was queued for the server is lost
+        delete mServerStreams[server];
+        mServerStreams[server]=NULL;
+    }
+}
+
+void Router::newStreamCallback(Network::Stream*stream, Network::Stream::SetCallbacks&callbacks) {
+    if (stream!=NULL) {
+        using std::tr1::placeholders::_1;    using std::tr1::placeholders::_2;
+        mIncomingStreams.insert(stream);
+        callbacks(std::tr1::bind(&Router::incomingConnectionCallback,this,stream,_1,_2),
+                  std::tr1::bind(&Router::bytesReceivedCallback,this,_1));
+    }
+}
+
+void Router::incomingConnectionCallback(Network::Stream*stream, Network::Stream::ConnectionStatus status, const std::string&reason) {
+    if (status!=Network::Stream::Connected) {
+        SILOG(space,debug,"Router:Server disconnected: "<<reason);
+        mIncomingStreams.erase(stream);
+        delete stream;
+    }
+}
+
+void Router::bytesReceivedCallback(const Network::Chunk&chunk) {
+    if (chunk.size()<ENVELOPE_SIZE) {
+        SILOG(space,warning,"Router:Dropping packet too short to have come from a server");
+        return;
+    }
+    uint8 hops=chunk[0];
+    uint32 server=chunk[1]|(chunk[2]<<8)|(chunk[3]<<16)|((uint32)chunk[4]<<24);
+    MemoryReference message(&chunk[ENVELOPE_SIZE],chunk.size()-ENVELOPE_SIZE);
+    RoutableMessageHeaderView view;
+    MemoryReference message_body=view.ParseFromArray(message);
+    if (view.has_destination_object()&&view.destination_object()==ObjectReference::spaceServiceID()) {
+        std::tr1::unordered_map<unsigned int,ServerMessageService*>::iterator where=mServerServices.find(view.destination_port());
+        if (where!=mServerServices.end()) {
+            where->second->processServerMessage(server,message_body);
+        }else {
+            SILOG(space,warning,"Router:Dropping message from server "<<server<<" for space service "<<view.destination_port());
+        }
+        return;
+    }
+    if (mObjectConnections->forwardToConnectedObject(view,message_body)) {
+        return;
+    }
+    //the sender believed the object to be here, or this is its home: let it know better and pass the message on
+    ObjectReference destination=view.destination_object();
+    mObjectSegmentation->sendLocation(server,destination);
+    uint32 next=mObjectSegmentation->lookup(destination);
+    if (next==Oseg::UNKNOWN_SERVER||next==mServerIndex) {
+        next=mObjectSegmentation->homeServer(destination);
+    }
+    if (next==server||next==mServerIndex||hops+1>=MAX_HOPS) {
+        SILOG(space,warning,"Router:No server to pass on message from server "<<server<<" for "<<destination.toString());
+        return;
+    }
+    sendToServer(next,hops+1,message);
+}
+
+void Router::processMessage(const RoutableMessageHeader&header,MemoryReference message_body) {
+    if (!header.has_destination_object()) {
+        SILOG(space,warning,"Router:Dropping message without a destination from "<<header.source_object());
+        return;
+    }
+    ObjectReference destination=header.destination_object();
+    uint32 server=mObjectSegmentation->lookup(destination);
+    if (server==Oseg::UNKNOWN_SERVER||server==mServerIndex) {
+        server=mObjectSegmentation->homeServer(destination);
+    }
+    if (server==mServerIndex) {
+        SILOG(space,warning,"Router:No server hosts "<<destination.toString());
+        return;
+    }
+    sendToServer(server,header,message_body);
+}
+
+}
@@ -40,6 +40,7 @@
 #include <space/ObjectConnections.hpp>
 #include <Space_Sirikata.pbj.hpp>
 #include <util/RoutableMessage.hpp>
+#include <util/RoutableMessageHeaderView.hpp>
 #include <util/KnownServices.hpp>
 #include <proximity/Platform.hpp>
 #include <proximity/ProximitySystem.hpp>
@@ -50,14 +51,17 @@
 #include <space/Loc.hpp>
 #include <space/Registration.hpp>
 #include <space/Router.hpp>
+#include <space/Oseg.hpp>
+#include <space/Cseg.hpp>
+#include <space/LoadBalancer.hpp>
 namespace Sirikata {
 
-Space::Space(const SpaceID&id):mID(id),mIO(Network::IOServiceFactory::makeIOService()) {
+Space::Space(const SpaceID&id, const String&port, const String&proximityConnection, const String&proximityOptions):mID(id),mIO(Network::IOServiceFactory::makeIOService()) {
     unsigned int rsi=Services::REGISTRATION;
     unsigned int lsi=Services::LOC;
     unsigned int gsi=Services::GEOM;
-    unsigned int osi;
-    unsigned int csi;
+    unsigned int osi=Services::OSEG;
+    unsigned int csi=Services::CSEG;
     unsigned int fsi=Services::ROUTER;
     unsigned char randomKey[SHA256::static_size]={3,2,1,4,5,6,3,8,235,124,24,15,26,165,123,95,
                                                   53,2,111,114,125,166,123,158,232,144,4,152,221,161,122,96};
@@ -66,21 +70,22 @@ Space::Space(const SpaceID&id):mID(id),mIO(Network::IOServiceFactory::makeIOServ
     spaceServices.set_registration_port(rsi);
     spaceServices.set_loc_port(lsi);//UUID(lsi,sizeof(lsi)));
     spaceServices.set_geom_port(gsi);//UUID(gsi,sizeof(gsi)));
-    //spaceServices.set_oseg(osi);//UUID(osi,sizeof(osi)));
-    //spaceServices.set_cseg(csi);//UUID(csi,sizeof(csi)));
+    spaceServices.set_oseg_port(osi);
+    spaceServices.set_cseg_port(csi);
     spaceServices.set_router_port(fsi);//UUID(fsi,sizeof(fsi)));
     
     mRegistration = new Registration(SHA256::convertFromBinary(randomKey));
     mLoc=new Loc;
-    Proximity::ProximityConnection*proxCon=Proximity::ProximityConnectionFactory::getSingleton().getDefaultConstructor()(mIO,"");
+    Proximity::ProximityConnection*proxCon=Proximity::ProximityConnectionFactory::getSingleton().getConstructor(proximityConnection)(mIO,proximityOptions);
     mGeom=new Proximity::BridgeProximitySystem(proxCon,spaceServices.registration_port());
     mRouter=NULL;
-    mCoordinateSegmentation=NULL;
-    mObjectSegmentation=NULL;
-    String port="5943";
+    mLoadBalancer=NULL;
+    mCoordinateSegmentation=new Cseg;
+    mObjectSegmentation=new Oseg;
     String spaceServicesString;
     spaceServices.SerializeToString(&spaceServicesString);
-    mObjectConnections=new ObjectConnections(Network::StreamListenerFactory::getSingleton().getDefaultConstructor()(mIO),
+    mObjectConnections=new ObjectConnections(mIO,
+                                             Network::StreamListenerFactory::getSingleton().getDefaultConstructor()(mIO),
                                              Network::Address("0.0.0.0",port)
                                              //spaceServicesString
                                              );
@@ -88,27 +93,85 @@ Space::Space(const SpaceID&id):mID(id),mIO(Network::IOServiceFactory::makeIOServ
     mServices[spaceServices.registration_port()]=mRegistration;
     mServices[spaceServices.loc_port()]=mLoc;
     mServices[spaceServices.geom_port()]=mGeom;
-    //mServices[ObjectReference(spaceServices.oseg_port())]=mObjectSegmentation;
-    //mServices[ObjectReference(spaceServices.cseg_port())]=mCoordinateSegmentation;
+    mServices[spaceServices.oseg_port()]=mObjectSegmentation;
+    mServices[spaceServices.cseg_port()]=mCoordinateSegmentation;
     //mServices[ObjectReference(spaceServices.router_port())]=mRouter;
     mRegistration->forwardMessagesTo(mObjectConnections);
     mRegistration->forwardMessagesTo(mLoc);
     mRegistration->forwardMessagesTo(mGeom);
+    mRegistration->forwardMessagesTo(mObjectSegmentation);
+    mCoordinateSegmentation->forwardMessagesTo(mObjectConnections);
 
     mGeom->forwardMessagesTo(mObjectConnections);
     mLoc->forwardMessagesTo(mGeom);
     mLoc->forwardMessagesTo(mObjectConnections);//FIXME: is this necessary
 }
+void Space::joinServers(const std::vector<Network::Address>&objectHostAddresses,
+                        const std::vector<Network::Address>&serverAddresses,
+                        uint32 serverIndex,
+                        const BoundingBox3d3f&bounds,
+                        uint32 regionsX,
+                        uint32 regionsZ,
+                        const Duration&balanceInterval,
+                        double balanceBand,
+                        double messageWeight,
+                        double cpuTarget) {
+    if (serverIndex>=serverAddresses.size()||objectHostAddresses.size()!=serverAddresses.size()) {
+        SILOG(space,error,"Server "<<serverIndex<<" is not among the "<<serverAddresses.size()<<" servers of the space");
+        return;
+    }
+    mCoordinateSegmentation->setLayout(bounds,regionsX,regionsZ,objectHostAddresses);
+    Router*router=new Router(mIO,serverAddresses,serverIndex,mObjectSegmentation,mObjectConnections);
+    mObjectSegmentation->setServers(serverIndex,(uint32)serverAddresses.size(),router);
+    delete mRouter;
+    mRouter=router;
+    if (balanceInterval>Duration::zero()&&mLoadBalancer==NULL) {
+        mLoadBalancer=new LoadBalancer(mIO,
+                                       mCoordinateSegmentation,
+                                       router,
+                                       mRegistration,
+                                       mObjectConnections,
+                                       balanceInterval,
+                                       balanceBand,
+                                       messageWeight,
+                                       cpuTarget);
+        mRegistration->forwardMessagesTo(mLoadBalancer);
+        mLoc->forwardMessagesTo(mLoadBalancer);
+        mLoadBalancer->forwardMessagesTo(mLoc);
+        mLoadBalancer->forwardMessagesTo(mGeom);
+        mLoadBalancer->forwardMessagesTo(mObjectSegmentation);
+        mLoadBalancer->start();
+    }
+}
+bool Space::captureTo(const String&filename) {
+    return mObjectConnections->captureTo(filename);
+}
 void Space::run() {
     Network::IOServiceFactory::runService(mIO);
 }
 void Space::processMessage(const ObjectReference*ref,MemoryReference message){
-    
-    RoutableMessageHeader hdr;
-    MemoryReference message_body=hdr.ParseFromArray(message.data(),message.size());
-    if (!hdr.has_source_object()&&ref) {
-        hdr.set_source_object(*ref);
+    // only the destination is looked at until we know where the message goes
+    RoutableMessageHeaderView view;
+    MemoryReference message_body=view.ParseFromArray(message);
+    if (!view.has_source_object()&&ref) {
+        view.set_source_object(*ref);
+    }
+    if (view.has_destination_object()&&view.destination_object()==ObjectReference::spaceServiceID()) {
+        std::tr1::unordered_map<unsigned int,MessageService*>::iterator where=mServices.find(view.destination_port());
+        if (where==mServices.end()) {
+            SILOG(space,warning,"Do not know where to forward space-destined message to "<<view.destination_port());
+            return;
+        }
+        RoutableMessageHeader hdr;
+        view.copyTo(hdr);
+        where->second->processMessage(hdr,message_body);
+        return;
     }
+    if (mObjectConnections&&mObjectConnections->forwardToConnectedObject(view,message_body)) {
+        return;
+    }
+    RoutableMessageHeader hdr;
+    view.copyTo(hdr);
     this->processMessage(hdr,message_body);
 }
 
@@ -0,0 +1,68 @@
+/*  Sirikata Subscription and Broadcasting System -- Relay Services
+ *  Relay.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_SUBSCRIPTION_RELAY_HPP_
+#define _SIRIKATA_SUBSCRIPTION_RELAY_HPP_
+#include <subscription/Broadcast.hpp>
+#include <subscription/SubscriptionClient.hpp>
+namespace Sirikata { namespace Subscription {
+
+/**
+ * Subscribes to a broadcast on one subscription Server and rebroadcasts every update to another,
+ * so that servers serving a large audience may feed each other in a tree rather than all subscribing to the root.
+ * The updates are received as they happen and as DeltaUpdates, so a relay adds little traffic between servers
+ */
+class SIRIKATA_SUBSCRIPTION_EXPORT Relay :Noncopyable {
+    UUID mName;
+    Broadcast::BroadcastStream*mDownstream;
+    std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription> mUpstream;
+    void forward(const Network::Chunk&);
+    void upstreamDisconnected();
+    void downstreamConnectionCallback(Network::Stream::ConnectionStatus, const std::string&reason);
+public:
+    /**
+     * Which server the server at index subscribes to, in a tree of the given degree laid out as a heap:
+     * servers[0] is the one the broadcaster connects to, and each server feeds at most degree others.
+     * \returns index for the root
+     */
+    static size_t parentIndex(size_t index, size_t degree);
+    ///Subscribes to name on the Server at upstream and rebroadcasts it to the Server at downstream
+    Relay(SubscriptionClient*client, Broadcast*broadcast, const Network::Address&upstream, const Network::Address&downstream, const UUID&name);
+    /**
+     * Joins servers[index] to the relay tree of the given degree formed by servers
+     * \returns the relay feeding servers[index], or NULL if it is the root and is fed by the broadcaster itself
+     */
+    static Relay*joinTree(SubscriptionClient*client, Broadcast*broadcast, const std::vector<Network::Address>&servers, size_t index, size_t degree, const UUID&name);
+    ~Relay();
+};
+
+} }
+#endif
@@ -40,10 +40,9 @@ namespace Protocol {
 class Subscribe;
 }
 class SubscriptionState;
+class MulticastSender;
 
 class SIRIKATA_SUBSCRIPTION_EXPORT Server:public std::tr1::enable_shared_from_this<Server> {
-    class UniqueLock;
-    std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>mSubscriptions;
     class WaitingStreams {public:
             std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >mStream;
         Protocol::Subscribe mSubscriptionRequest;
@@ -52,27 +51,60 @@ class SIRIKATA_SUBSCRIPTION_EXPORT Server:public std::tr1::enable_shared_from_th
                        const Protocol::Subscribe&sub):mStream(strm),mSubscriptionRequest(sub){}
     };
     typedef std::tr1::unordered_map<UUID,std::vector<WaitingStreams >, UUID::Hasher > WaitingStreamMap;
-    WaitingStreamMap mWaitingStreams;
-    std::tr1::unordered_map<SubscriptionState*,UUID>mBroadcasters;
-    UniqueLock*mBroadcastersSubscriptionsLock;
+    ///The subscriptions whose UUID hashes to one IOService. A shard is only ever touched from its IOService's thread, so it needs no lock
+    class Shard {public:
+        Network::IOService*mIOService;
+        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>mSubscriptions;
+        WaitingStreamMap mWaitingStreams;
+        std::tr1::unordered_map<SubscriptionState*,UUID>mBroadcasters;
+        ///sends this shard's multicast datagrams, if multicast is enabled
+        MulticastSender*mMulticast;
+        Shard(Network::IOService*io):mIOService(io),mMulticast(NULL){}
+    };
+    std::vector<Shard*>mShards;
     Network::StreamListener*mBroadcastListener;
     Network::IOService*mBroadcastIOService;
     Network::StreamListener*mSubscriberListener;
     Duration mMaxSubscribeDelay;
     unsigned int mMaxCachedMessageSize;
+    ///the first multicast group as an IPv4 address in host order, and the port every group is sent to
+    uint32 mMulticastBase;
+    unsigned short mMulticastPort;
+    ///how many groups broadcasts are spread over: zero if multicast is off
+    unsigned int mNumMulticastGroups;
+    unsigned int mMaxDatagramSize;
+    unsigned int shardIndex(const UUID&)const;
     void subscriberStreamCallback(Network::Stream*,Network::Stream::SetCallbacks&);
-    static void purgeWaitingSubscriberOnBroadcastIOService(const std::tr1::weak_ptr<Server> &,const UUID&uuid, size_t which);
+    static void purgeWaitingSubscriberOnShard(const std::tr1::weak_ptr<Server> &,const UUID&uuid, size_t which);
     void subscriberBytesReceivedCallback(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&,const Network::Chunk&);
-    void subscriberBytesReceivedCallbackOnBroadcastIOService(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest);
+    void subscriberBytesReceivedCallbackOnShard(Shard*,const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest);
     static void subscriberConnectionCallback(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&,Network::Stream::ConnectionStatus,const std::string&reason);
     void broadcastConnectionCallback(SubscriptionState*,Network::Stream::ConnectionStatus,const std::string&reason);
     void broadcastStreamCallback(Network::Stream*,Network::Stream::SetCallbacks&);
     void broadcastBytesReceivedCallback(SubscriptionState*, const Network::Chunk&);
+    ///The halves of the broadcaster callbacks that touch a shard, handed to the shard's IOService from the broadcaster's stream thread
+    void registerBroadcasterOnShard(SubscriptionState*, const UUID&);
+    void broadcastOnShard(SubscriptionState*, const Network::Stream::SharedChunk&);
+    void removeBroadcasterOnShard(SubscriptionState*);
     static void poll(const std::tr1::weak_ptr<Server> &, const UUID&);
 public:
 
-    Server(Network::IOService*broadcastIOSerivce, Network::StreamListener*broadcastListener, const Network::Address& broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxCachedMessageSize);
+    /**
+     * Subscriptions are spread across the shardIOServices by the hash of their UUID, so a fan-out server may run one IOService per core.
+     * The caller runs every IOService passed in. With no shardIOServices, all subscriptions are served from broadcastIOService
+     */
+    Server(Network::IOService*broadcastIOSerivce, Network::StreamListener*broadcastListener, const Network::Address& broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxCachedMessageSize, const std::vector<Network::IOService*>&shardIOServices=std::vector<Network::IOService*>());
     ~Server();
+    /**
+     * Lets subscribers ask for multicast delivery: each broadcast is then sent once per update as a datagram to one of numGroups groups,
+     * picked by the hash of its UUID, counting up from the IPv4 group address. Datagrams larger than maxDatagramSize go over each subscriber's stream instead.
+     * Must be called before any subscriber connects
+     */
+    void enableMulticast(const Network::Address&firstGroup, unsigned int numGroups, unsigned int maxDatagramSize=1400, unsigned int ttl=1);
+    ///fills in the multicast group the named broadcast is sent to. \returns false if multicast is not enabled
+    bool multicastGroup(const UUID&, Network::Address&group) const;
+    ///sends an update of the named broadcast to its group from the calling shard. \returns false if it was not sent and must go over each stream
+    bool multicast(const UUID&, const Network::Stream::SharedChunk&);
     void initiatePolling(const UUID&, const Duration&waitFor);
 };
 
@@ -38,6 +38,8 @@
 namespace Sirikata { namespace Subscription {
 namespace Protocol {
 class Subscribe;
+class DeltaUpdate;
+class Address;
 }
 class SIRIKATA_SUBSCRIPTION_EXPORT SubscriptionClient {
     class AddressUUID {
@@ -62,8 +64,12 @@ class SIRIKATA_SUBSCRIPTION_EXPORT SubscriptionClient {
     Network::IOService*mService;
     class UniqueLock;
     UniqueLock*mMapLock;
+    ///how long new subscriptions to a server wait for others to share one Subscribe message and stream with
+    Duration mCoalesceWindow;
 protected:
     class State;
+    class SharedStream;
+    class MulticastReceiver;
 public:
     class SIRIKATA_SUBSCRIPTION_EXPORT IndividualSubscription {
         friend class SubscriptionClient;
@@ -92,6 +98,22 @@ protected:
 
     TopLevelStreamMap mTopLevelStreams;
     BroadcastMap mBroadcasts;
+    ///The new States for one server still waiting out the coalescing window, each with the Subscribe message it would have sent alone
+    class PendingBatch {public:
+        std::tr1::shared_ptr<Network::Stream> mTopLevelStream;
+        std::vector<std::pair<std::tr1::shared_ptr<State>,String> > mStates;
+    };
+    typedef std::tr1::unordered_map<Network::Address,PendingBatch,Network::Address::Hasher> PendingBatchMap;
+    PendingBatchMap mPendingBatches;
+    typedef std::tr1::unordered_map<Network::Address,std::tr1::weak_ptr<MulticastReceiver>,Network::Address::Hasher> MulticastGroupMap;
+    ///The groups joined by states subscribed with multicast, shared by every broadcast on one group. Only touched from the IO thread
+    MulticastGroupMap mMulticastGroups;
+    ///joins the group, or finds the receiver already on it. \returns null if the group cannot be joined
+    std::tr1::shared_ptr<MulticastReceiver> multicastReceiverFromIOThread(const Network::Address&group);
+    ///Connects a new state to its server, directly or by adding it to the server's pending batch. Must hold mMapLock
+    void introduce(const std::tr1::shared_ptr<State>&state, const std::tr1::shared_ptr<Network::Stream>&topLevelStream, const String&serializedSubscription);
+    ///Sends a server's pending batch: states asking for the same period share a single stream and Subscribe message
+    void flushBatchFromIOThread(const Network::Address&address);
     ///schedules a work task to upgrade all items from source to destination
     void upgrade(const std::tr1::weak_ptr<State>&source,
                  const std::tr1::weak_ptr<State>&dest);
@@ -102,9 +124,36 @@ protected:
     class State{
         friend class SubscriptionClient;
         friend class IndividualSubscription;
+        friend class SharedStream;
         Network::Chunk mLastDeliveredMessage;
         std::tr1::shared_ptr<Network::Stream> mTopLevelStream;
         SubscriptionClient*mParent;
+        ///whether this stream asked for DeltaUpdates, which are decoded against mDeltaBase before reaching subscribers
+        bool mDeltaUpdates;
+        ///whether mDeltaBase holds a decoded update yet
+        bool mHasDeltaBase;
+        ///the epoch of mDeltaBase
+        uint32 mDeltaEpoch;
+        ///the last update decoded: the next delta is encoded against it however large it is
+        Network::Chunk mDeltaBase;
+        ///the demultiplexer of the stream this state shares with other broadcasts, if any
+        std::tr1::shared_ptr<SharedStream> mSharedStream;
+        ///whether this state asked for its updates on the broadcast's multicast group
+        bool mMulticast;
+        ///whether a resend has been asked for since the last update that decoded
+        bool mResendRequested;
+        ///the group this state receives its datagrams on, once the server has named it
+        std::tr1::shared_ptr<MulticastReceiver> mMulticastReceiver;
+        ///turns a received DeltaUpdate into the message it stands for. \returns false if it cannot be decoded
+        bool decodeDeltaUpdate(const Protocol::DeltaUpdate&update, Network::Chunk&message);
+        ///hands a decoded update to every live subscriber
+        void deliver(const std::tr1::weak_ptr<State>&weak_thus, const Network::Chunk&data);
+        ///decodes and delivers a DeltaUpdate from the stream or the multicast group, joining the group or asking for a resend as it says
+        void receiveUpdate(const std::tr1::weak_ptr<State>&weak_thus, const Protocol::DeltaUpdate&update);
+        ///starts receiving the group's datagrams, or falls back to subscribing on the stream if it cannot be joined
+        void joinMulticastGroup(const std::tr1::weak_ptr<State>&weak_thus, const Protocol::Address&group);
+        ///asks the server over the stream for the current update whole, once until an update decodes again
+        void requestResend();
     public:
         ///this function goes through all subscribers of this State and sees if any are dead (probably). Also computes the maximum needed period and potentially downgrades the subscribers if it's too high
         void purgeSubscribersFromIOThread(const std::tr1::weak_ptr<State>&weak_thus, SubscriptionClient *parent);
@@ -126,7 +175,11 @@ protected:
     };
 
 public:
-    SubscriptionClient(Network::IOService*mService);
+    /**
+     * If coalesceWindow is nonzero, subscriptions that need new streams to a server are gathered for that long
+     * and then sent as one Subscribe message naming all their broadcasts, on one stream
+     */
+    SubscriptionClient(Network::IOService*mService, const Duration&coalesceWindow=Duration::seconds(0));
     ~SubscriptionClient();
 
     std::tr1::shared_ptr<IndividualSubscription> subscribe(const Network::Address&,
@@ -32,6 +32,8 @@
 #ifndef _SIRIKATA_SUBSCRIPTION_STATE_HPP_
 #define _SIRIKATA_SUBSCRIPTION_STATE_HPP_
 #include "util/Time.hpp"
+#include <map>
+#include <deque>
 namespace Sirikata { namespace Subscription {
 class Server;
 
@@ -45,62 +47,108 @@ public:
         ReservedEpoch=0
     };
 private:
+    enum {
+        ///Subscribers whose update windows open within the same span of this many microseconds share a bucket: windows are rounded up to it
+        BUCKET_MICROSECONDS=1000,
+        ///How many recent messages are kept for delta subscribers to be encoded against
+        DELTA_HISTORY=8,
+        ///How many broadcasts pass between sweeps of the multicast subscribers for closed streams
+        MULTICAST_PRUNE_INTERVAL=256
+    };
     class Subscriber {
         friend class SubscriptionState;
         std::tr1::weak_ptr<Network::Stream>mSender;
         Duration mPeriod;
         EpochType mSentEpoch;
+        ///The SubscriptionState::mVersion of the last message this subscriber was sent
+        uint32 mSentVersion;
+        ///whether the subscriber asked for DeltaUpdates rather than raw messages
+        bool mDelta;
+        ///whether the subscriber has been sent anything it could decode a delta against
+        bool mHasBaseline;
+        ///whether the subscriber's stream carries several broadcasts, so each update must say which one it belongs to
+        bool mNamed;
+        ///whether the subscriber asked to receive updates on the broadcast's multicast group
+        bool mMulticast;
     public:
         ///registers self with parent and finds appropriate parentOffset from array size
         Subscriber(const std::tr1::shared_ptr<Network::Stream>&sender,const Protocol::Subscribe&);
-        ///broadcasts the message to the mSender
-        void broadcast(const MemoryReference&);
+        /**
+         * broadcasts the message to the mSender, which may hold on to the payload instead of copying it
+         * \returns false if the subscriber's stream is gone, so it may be forgotten
+         */
+        bool broadcast(const Network::Stream::SharedChunk&);
         Time computeNextUpdateFromNow();
     };
-    class SubscriberTimePair {
-        friend class SubscriptionState;
-      public:
-        Time mNextUpdateTime;
-        Subscriber* mSubscriber;
-        SubscriberTimePair(const Time&nextUpdate, Subscriber*subscriber):mNextUpdateTime(nextUpdate) {
-            mSubscriber=subscriber;
-        }
-        bool operator <(const SubscriberTimePair&other)const {
-            return mNextUpdateTime<other.mNextUpdateTime;
-        }
-        bool operator ==(const SubscriberTimePair&other) const{
-            return mNextUpdateTime==other.mNextUpdateTime;
-        }
-        
-    };
+    ///Buckets of subscribers waiting out their update period, keyed by the (rounded up) time their window opens
+    typedef std::map<Time,std::vector<Subscriber*> > SubscriberWheel;
     UUID mName;
     Network::Stream*mBroadcaster;
-    Time mLatestSentTime;
-    Time mLatestUnsentTime;
     EpochType mEpoch;
+    ///Which of the Server's shards owns this state, assigned when the broadcaster names itself
+    unsigned int mShard;
     bool mEverReceivedMessage;
+    ///whether a poll has been requested from the Server and has not run yet
     bool mPolling;
-    Network::Chunk mLastSentMessage;
-	void setLastSentMessage(Network::Chunk&chunk);
+    ///when the outstanding poll is due
+    Time mPollTime;
+    ///The same payload last handed to every subscriber's stream, so late subscribers and polls share it too
+    Network::Stream::SharedChunk mLastSentMessage;
+	void setLastSentMessage(const Network::Stream::SharedChunk&chunk);
 	void clearLastSentMessage();
-    ///this is the heap of subscribers who opted out of the last message
-    std::vector<SubscriberTimePair>mUnsentSubscribersHeap;
-    ///this is the heap of subscribers that received the last message
-    std::vector<SubscriberTimePair>mSentSubscribersHeap;
-    ///does the heap management for sent or unsent subscribers based on the passed vector
-    Time pushSubscriber(Subscriber*,std::vector<SubscriberTimePair>*);
-    ///Push a subscriber who missed a broadcast into the mUnsentSubscribersHeap
-    void pushNewSubscriber(Subscriber*,const Time&);
-    ///Push a Subscriber who has just heard a broadcast into the mSentSubscribersHeap
-    void pushJustReceivedSubscriber(Subscriber*);
+    ///counts broadcasts: a subscriber has missed the latest message exactly when its mSentVersion differs
+    uint32 mVersion;
+    ///subscribers whose update window has not opened yet
+    SubscriberWheel mWaitingSubscribers;
+    ///how many subscribers sit in mWaitingSubscribers
+    size_t mNumWaiting;
+    ///how many of mWaitingSubscribers missed the latest message and must be sent it when their window opens
+    size_t mNumBehind;
+    ///subscribers whose window is open and who have the latest message already: the next broadcast reaches them right away
+    std::vector<Subscriber*> mReadySubscribers;
+    ///subscribers reached by one datagram per update on the multicast group rather than on their own streams: they are sent every update
+    std::vector<Subscriber*> mMulticastSubscribers;
+    ///whether any subscriber ever asked for delta updates: until then no history is kept
+    bool mAnyDeltaSubscribers;
+    ///The most recent messages along with the version each was sent as, oldest first
+    std::deque<std::pair<uint32,Network::Stream::SharedChunk> > mHistory;
+    ///The current version wrapped for delta subscribers, keyed by the version it was encoded against and whether it is named, so subscribers sharing a baseline share the payload
+    std::map<std::pair<uint32,bool>,Network::Stream::SharedChunk> mEncodedUpdates;
+    ///The current version wrapped whole, for delta subscribers without a usable baseline: unnamed and named
+    Network::Stream::SharedChunk mFullUpdate[2];
+    ///forgets every wrapped form of the current version
+    void clearEncodedUpdates();
+    ///What the subscriber should be sent to bring it to the current version, data being the current message
+    Network::Stream::SharedChunk encodeFor(Subscriber*, const Network::Stream::SharedChunk&data);
+    ///The current version as a DeltaUpdate against the given version, or whole if that is not in the history or the delta is no smaller
+    Network::Stream::SharedChunk encodeAgainst(bool hasBase, uint32 baseVersion, bool named, const Network::Stream::SharedChunk&data);
+    ///sends the update to the multicast group, or over each multicast subscriber's stream if it cannot go as one datagram
+    void multicast(Server*parent, const Network::Stream::SharedChunk&data);
+    ///forgets the multicast subscribers whose streams have closed
+    void pruneMulticastSubscribers();
+    ///The current version wrapped whole, built on first use
+    const Network::Stream::SharedChunk&wholeUpdate(const Network::Stream::SharedChunk&data, bool named);
+    ///puts the subscriber in the bucket for the time its next update is allowed
+    void scheduleSubscriber(Subscriber*);
+    ///sends data to the subscriber and schedules its next window, or deletes it if its stream is gone. \returns whether it was kept
+    bool deliver(Subscriber*, const Network::Stream::SharedChunk&data);
+    ///removes and returns the subscribers in the earliest bucket if that bucket's windows opened before now
+    bool popDueBucket(const Time&now, std::vector<Subscriber*>&due);
+    ///asks the server to poll when the next subscriber who missed the latest message may be sent it
+    void schedulePoll(Server*parent, const Time&now);
 public:
     void setUUID(const UUID&name){mName=name;}
     ///Creates a new subscription state class for a given named subscription associated with a given network stream
     SubscriptionState(Network::Stream*broadcaster);
-    ///register a new Stream to get updates who subscribed with the given protocol message. Must be called from IOServiceThread of *broadcaster*, instead of new subscriber
-    void registerSubscriber(const std::tr1::shared_ptr<Network::Stream>&, const Protocol::Subscribe&);
-    ///Take a memory reference and broadcast it to all interested parties who are within a receive window. Also schedules a poll if no other polls are present to retry for unsent subscribers
-    void broadcast(Server*parent, const MemoryReference&);
+    ///register a new Stream to get updates who subscribed with the given protocol message. Must be called from the IOService thread of the Server shard owning this state, instead of that of the new subscriber
+    void registerSubscriber(Server*parent, const std::tr1::shared_ptr<Network::Stream>&, const Protocol::Subscribe&);
+    ///sends the current update whole to a multicast subscriber that could not decode a datagram, unless it already has the given version
+    void resend(const std::tr1::shared_ptr<Network::Stream>&, uint32 version);
+    /**
+     * Take a shared payload and broadcast it to all interested parties who are within a receive window. Also schedules a poll if no other polls are present to retry for unsent subscribers.
+     * Only subscribers whose window is open are touched, so the cost is proportional to how many are due rather than to the audience
+     */
+    void broadcast(Server*parent, const Network::Stream::SharedChunk&);
     ///Check if any of the subscribers who had not received the last message when it was broadcast are able to receive it by now. If there are still unsent subscribers then ask the server to schedule a second polling
     void poll(Server*parent);
     ~SubscriptionState();
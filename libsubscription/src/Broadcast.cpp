@@ -32,13 +32,17 @@
 
 #include <subscription/Platform.hpp>
 #include "subscription/Broadcast.hpp"
+#include "util/ProfiledMutex.hpp"
 #include <boost/thread.hpp>
 #include "network/Stream.hpp"
 #include "network/StreamFactory.hpp"
 #include "Subscription_Subscription.pbj.hpp"
 namespace Sirikata { namespace Subscription {
 
-class Broadcast::UniqueLock: public boost::mutex {};
+class Broadcast::UniqueLock: public Metrics::ProfiledMutex<> {
+public:
+    UniqueLock():Metrics::ProfiledMutex<>("subscription.broadcast") {}
+};
 
 Broadcast::BroadcastStream::BroadcastStream(const std::tr1::shared_ptr<Network::Stream>&tls,
                                             Network::Stream*stream) :mTopLevelStream(tls),mStream(stream){}
@@ -94,7 +98,7 @@ std::tr1::shared_ptr<Broadcast::BroadcastStream> Broadcast::establishSharedBroad
     std::tr1::shared_ptr<Broadcast::BroadcastStream> retval;
     Network::Stream*newBroadcastStream=NULL;    
     while(newBroadcastStream==NULL) {
-        boost::lock_guard<boost::mutex>lok(*mUniqueLock);
+        boost::lock_guard<UniqueLock>lok(*mUniqueLock);
         std::tr1::weak_ptr<Network::Stream>*weak_topLevelStream=&mTopLevelStreams[addy];
         std::tr1::shared_ptr<Network::Stream> topLevelStream;
         if ((topLevelStream=weak_topLevelStream->lock())) {
@@ -136,7 +140,7 @@ Broadcast::BroadcastStream *Broadcast::establishBroadcast(const Network::Address
     Network::Stream*newBroadcastStream=NULL;
 
     while(newBroadcastStream==NULL) {
-        boost::lock_guard<boost::mutex>lok(*mUniqueLock);
+        boost::lock_guard<UniqueLock>lok(*mUniqueLock);
         std::tr1::weak_ptr<Network::Stream>*weak_topLevelStream=&mTopLevelStreams[addy];
         std::tr1::shared_ptr<Network::Stream> topLevelStream;
         if ((topLevelStream=weak_topLevelStream->lock())) {
@@ -0,0 +1,91 @@
+/*  Sirikata Subscription and Broadcasting System -- Relay Services
+ *  Relay.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <subscription/Platform.hpp>
+#include "subscription/Relay.hpp"
+#include "network/Stream.hpp"
+#include "Subscription_Subscription.pbj.hpp"
+namespace Sirikata { namespace Subscription {
+
+size_t Relay::parentIndex(size_t index, size_t degree) {
+    if (index==0||degree==0)
+        return index;
+    return (index-1)/degree;
+}
+
+Relay::Relay(SubscriptionClient*client, Broadcast*broadcast, const Network::Address&upstream, const Network::Address&downstream, const UUID&name):mName(name) {
+    mDownstream=broadcast->establishBroadcast(downstream,
+                                              name,
+                                              std::tr1::bind(&Relay::downstreamConnectionCallback,this,_2,_3));
+    Protocol::Subscribe subscription;
+    subscription.mutable_broadcast_address().set_hostname(upstream.getHostName());
+    subscription.mutable_broadcast_address().set_service(upstream.getService());
+    subscription.set_broadcast_name(name);
+    subscription.set_update_period(Duration::microseconds(0));
+    subscription.set_delta_updates(true);
+    mUpstream=client->subscribe(upstream,
+                                subscription,
+                                std::tr1::bind(&Relay::forward,this,_1),
+                                std::tr1::bind(&Relay::upstreamDisconnected,this));
+}
+
+Relay*Relay::joinTree(SubscriptionClient*client, Broadcast*broadcast, const std::vector<Network::Address>&servers, size_t index, size_t degree, const UUID&name) {
+    size_t parent=parentIndex(index,degree);
+    if (parent==index||index>=servers.size())
+        return NULL;
+    return new Relay(client,broadcast,servers[parent],servers[index],name);
+}
+
+void Relay::forward(const Network::Chunk&chunk) {
+    if (chunk.empty()) {
+        (*mDownstream)->send(MemoryReference::null(),Network::ReliableOrdered);
+    }else {
+        (*mDownstream)->send(MemoryReference(&chunk[0],chunk.size()),Network::ReliableOrdered);
+    }
+}
+
+void Relay::upstreamDisconnected() {
+    SILOG(subscription,warning,"Relay lost upstream subscription to "<<mName.toString());
+}
+
+void Relay::downstreamConnectionCallback(Network::Stream::ConnectionStatus status, const std::string&reason) {
+    if (status!=Network::Stream::Connected) {
+        SILOG(subscription,warning,"Relay lost downstream broadcast of "<<mName.toString()<<": "<<reason);
+    }
+}
+
+Relay::~Relay() {
+    mUpstream=std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>();
+    delete mDownstream;
+}
+
+} }
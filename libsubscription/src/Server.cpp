@@ -36,20 +36,40 @@
 #include "network/StreamFactory.hpp"
 #include "network/StreamListenerFactory.hpp"
 #include "network/IOServiceFactory.hpp"
+#include "network/TCPDefinitions.hpp"
 #include "util/UUID.hpp"
 #include "Subscription_Subscription.pbj.hpp"
 #include "subscription/Server.hpp"
 #include "subscription/SubscriptionState.hpp"
 #include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
 using namespace Sirikata::Network;
 namespace Sirikata { namespace Subscription {
-
-class Server::UniqueLock :public boost::mutex{
-
+///The UDP socket one shard sends its broadcasts' datagrams from
+class MulticastSender {
+public:
+    boost::asio::ip::udp::socket mSocket;
+    MulticastSender(Network::IOService*io):mSocket(*io){}
+    ///holds the payload until the datagram is on the wire
+    static void sent(const Network::Stream::SharedChunk&, const boost::system::error_code&error, std::size_t) {
+        if (error) {
+            SILOG(subscription,debug,"Multicast send failed: "<<error.message());
+        }
+    }
 };
-Server::Server(Network::IOService*broadcastIOService,Network::StreamListener*broadcastListener, const Network::Address&broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxMessageSize):mMaxSubscribeDelay(maxSubscribeDelay),mMaxCachedMessageSize(maxMessageSize){
+
+Server::Server(Network::IOService*broadcastIOService,Network::StreamListener*broadcastListener, const Network::Address&broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxMessageSize, const std::vector<Network::IOService*>&shardIOServices):mMaxSubscribeDelay(maxSubscribeDelay),mMaxCachedMessageSize(maxMessageSize){
+    mMulticastBase=0;
+    mMulticastPort=0;
+    mNumMulticastGroups=0;
+    mMaxDatagramSize=0;
     mBroadcastIOService=broadcastIOService;
-    mBroadcastersSubscriptionsLock=new UniqueLock;
+    for (std::vector<Network::IOService*>::const_iterator i=shardIOServices.begin(),ie=shardIOServices.end();i!=ie;++i) {
+        mShards.push_back(new Shard(*i));
+    }
+    if (mShards.empty()) {
+        mShards.push_back(new Shard(broadcastIOService));
+    }
     mBroadcastListener=broadcastListener;
     if (!broadcastListener->listen(broadcastAddress,std::tr1::bind(&Server::broadcastStreamCallback,this,_1,_2))) {
         SILOG(subscription,error,"Error listening to broadcast on port "<<broadcastAddress.getHostName()<<':'<<broadcastAddress.getService());
@@ -63,18 +83,53 @@ Server::Server(Network::IOService*broadcastIOService,Network::StreamListener*bro
 Server::~Server() {
     delete mBroadcastListener;
     delete mSubscriberListener;
-    {
-        boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator iter1=mSubscriptions.begin(),iter1e=mSubscriptions.end();
-        //std::tr1::unordered_map<SubscriptionState*,UUID>::iterator iter2=mBroadcasters.begin(),iter2e=mBroadcasters.end();
+    for (std::vector<Shard*>::iterator shard=mShards.begin(),sharde=mShards.end();shard!=sharde;++shard) {
+        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator iter1=(*shard)->mSubscriptions.begin(),iter1e=(*shard)->mSubscriptions.end();
         for(;iter1!=iter1e;++iter1) {
             delete iter1->second;
         }
-        mBroadcasters.clear();
-        mSubscriptions.clear();
+        delete (*shard)->mMulticast;
+        delete *shard;
     }
-    delete mBroadcastersSubscriptionsLock;
-    
+    mShards.clear();
+}
+void Server::enableMulticast(const Network::Address&firstGroup, unsigned int numGroups, unsigned int maxDatagramSize, unsigned int ttl) {
+    try {
+        uint32 base=(uint32)boost::asio::ip::address_v4::from_string(firstGroup.getHostName()).to_ulong();
+        unsigned short port=boost::lexical_cast<unsigned short>(firstGroup.getService());
+        for (std::vector<Shard*>::iterator shard=mShards.begin(),sharde=mShards.end();shard!=sharde;++shard) {
+            MulticastSender*sender=new MulticastSender((*shard)->mIOService);
+            (*shard)->mMulticast=sender;
+            sender->mSocket.open(boost::asio::ip::udp::v4());
+            sender->mSocket.set_option(boost::asio::ip::multicast::hops((int)ttl));
+        }
+        mMulticastBase=base;
+        mMulticastPort=port;
+        mNumMulticastGroups=numGroups;
+        mMaxDatagramSize=maxDatagramSize;
+    } catch (std::exception&e) {
+        SILOG(subscription,error,"Error enabling multicast on "<<firstGroup.getHostName()<<':'<<firstGroup.getService()<<": "<<e.what());
+        mNumMulticastGroups=0;
+    }
+}
+bool Server::multicastGroup(const UUID&uuid, Network::Address&group) const {
+    if (mNumMulticastGroups==0)
+        return false;
+    boost::asio::ip::address_v4 address((unsigned long)(mMulticastBase+UUID::Hasher()(uuid)%mNumMulticastGroups));
+    group=Network::Address(address.to_string(),boost::lexical_cast<String>(mMulticastPort));
+    return true;
+}
+bool Server::multicast(const UUID&uuid, const Network::Stream::SharedChunk&datagram) {
+    if (mNumMulticastGroups==0||datagram->size()>mMaxDatagramSize||datagram->empty())
+        return false;
+    boost::asio::ip::address_v4 address((unsigned long)(mMulticastBase+UUID::Hasher()(uuid)%mNumMulticastGroups));
+    mShards[shardIndex(uuid)]->mMulticast->mSocket.async_send_to(boost::asio::buffer(&(*datagram)[0],datagram->size()),
+                                                               boost::asio::ip::udp::endpoint(address,mMulticastPort),
+                                                               std::tr1::bind(&MulticastSender::sent,datagram,_1,_2));
+    return true;
+}
+unsigned int Server::shardIndex(const UUID&uuid)const {
+    return (unsigned int)(UUID::Hasher()(uuid)%mShards.size());
 }
 void Server::subscriberStreamCallback(Network::Stream*newStream,Network::Stream::SetCallbacks&cb){
     if (newStream) {
@@ -89,14 +144,29 @@ void Server::subscriberStreamCallback(Network::Stream*newStream,Network::Stream:
 }
 void Server::subscriberBytesReceivedCallback(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Network::Chunk&dat){
     Protocol::Subscribe subscriptionRequest;
-    bool success=false;
     if (!dat.empty()&&subscriptionRequest.ParseFromArray(&dat[0],dat.size())&&subscriptionRequest.has_broadcast_name()) {
+        //the shard is fixed by the name alone, so the request is handed straight to the thread that owns it
+        Shard*shard=mShards[shardIndex(subscriptionRequest.broadcast_name())];
         Network::IOServiceFactory::
-            dispatchServiceMessage(mBroadcastIOService,
-                                   std::tr1::bind(&Server::subscriberBytesReceivedCallbackOnBroadcastIOService,
+            dispatchServiceMessage(shard->mIOService,
+                                   std::tr1::bind(&Server::subscriberBytesReceivedCallbackOnShard,
                                                   this,
+                                                  shard,
                                                   stream,
                                                   subscriptionRequest));
+        //every further name joins the same stream: the copies keep broadcast_names so each subscriber knows its updates must be named
+        for (int i=0;i<subscriptionRequest.broadcast_names_size();++i) {
+            Protocol::Subscribe additionalRequest(subscriptionRequest);
+            additionalRequest.set_broadcast_name(subscriptionRequest.broadcast_names(i));
+            shard=mShards[shardIndex(additionalRequest.broadcast_name())];
+            Network::IOServiceFactory::
+                dispatchServiceMessage(shard->mIOService,
+                                       std::tr1::bind(&Server::subscriberBytesReceivedCallbackOnShard,
+                                                      this,
+                                                      shard,
+                                                      stream,
+                                                      additionalRequest));
+        }
     }else {
         std::tr1::shared_ptr<Stream> strongStream(*stream);
         if(strongStream) {
@@ -105,19 +175,22 @@ void Server::subscriberBytesReceivedCallback(const std::tr1::shared_ptr<std::tr1
         *stream=std::tr1::shared_ptr<Stream>();
     }
 }
-void Server::purgeWaitingSubscriberOnBroadcastIOService(const std::tr1::weak_ptr<Server> &weak_thus, const UUID&uuid, size_t which){
+void Server::purgeWaitingSubscriberOnShard(const std::tr1::weak_ptr<Server> &weak_thus, const UUID&uuid, size_t which){
     std::tr1::shared_ptr<Server>thus=weak_thus.lock();
     if (thus) {
-        WaitingStreamMap::iterator where=thus->mWaitingStreams.find(uuid);
-        if (where!=thus->mWaitingStreams.end()) {
+        Shard*shard=thus->mShards[thus->shardIndex(uuid)];
+        WaitingStreamMap::iterator where=shard->mWaitingStreams.find(uuid);
+        if (where!=shard->mWaitingStreams.end()) {
             SILOG (subscription,debug,"Purging Broadcaster "<<uuid.toString());
             if (which+1==where->second.size()) {
-                thus->mWaitingStreams.erase(where);//last one to be erased
+                shard->mWaitingStreams.erase(where);//last one to be erased
             }else if (which<where->second.size()) {
                 while (true) {
                     if (where->second[which].mStream) {
                         //disconnect the stream, since it does not match a thing after the timeout, probably garbage
-                        *where->second[which].mStream=std::tr1::shared_ptr<Stream>();
+                        //unless the stream carries other broadcasts as well, which may well exist
+                        if (where->second[which].mSubscriptionRequest.broadcast_names_size()==0)
+                            *where->second[which].mStream=std::tr1::shared_ptr<Stream>();
                         where->second[which].mStream=std::tr1::shared_ptr<std::tr1::shared_ptr<Stream> > ();
                     }else {
                         break;
@@ -129,35 +202,38 @@ void Server::purgeWaitingSubscriberOnBroadcastIOService(const std::tr1::weak_ptr
         }
     }
 }
-void Server::subscriberBytesReceivedCallbackOnBroadcastIOService(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest){
+void Server::subscriberBytesReceivedCallbackOnShard(Shard*shard,const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest){
     bool success=false;
-    {
-        boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where
-            =mSubscriptions.find(subscriptionRequest.broadcast_name());
-        if (where!=mSubscriptions.end()) {
-            if (*stream) {
-                where->second->registerSubscriber(*stream,subscriptionRequest);
-                success=true;
-            }else {
-
-            }
+    std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where
+        =shard->mSubscriptions.find(subscriptionRequest.broadcast_name());
+    if (subscriptionRequest.has_resend_epoch()) {
+        //a multicast subscriber missed a datagram: it is already subscribed, so a broadcast that is gone has nothing to resend
+        if (where!=shard->mSubscriptions.end()&&*stream)
+            where->second->resend(*stream,subscriptionRequest.resend_epoch());
+        return;
+    }
+    if (where!=shard->mSubscriptions.end()) {
+        if (*stream) {
+            where->second->registerSubscriber(this,*stream,subscriptionRequest);
+            success=true;
         }else {
-			success=true;
-            UUID uuid(subscriptionRequest.broadcast_name());
-            std::vector<WaitingStreams>*waiting=&mWaitingStreams[uuid];
-            size_t which=waiting->size();
-            waiting->push_back(WaitingStreams(stream,subscriptionRequest));
-            std::tr1::weak_ptr<Server> thus=shared_from_this();
-            Network::IOServiceFactory::
-                dispatchServiceMessage(mBroadcastIOService,
-                                       mMaxSubscribeDelay,
-                                       std::tr1::bind(&Server::purgeWaitingSubscriberOnBroadcastIOService,
-                                                      thus,
-                                                      uuid,
-                                                      which));
-                           
+
         }
+    }else {
+        success=true;
+        UUID uuid(subscriptionRequest.broadcast_name());
+        std::vector<WaitingStreams>*waiting=&shard->mWaitingStreams[uuid];
+        size_t which=waiting->size();
+        waiting->push_back(WaitingStreams(stream,subscriptionRequest));
+        std::tr1::weak_ptr<Server> thus=shared_from_this();
+        Network::IOServiceFactory::
+            dispatchServiceMessage(shard->mIOService,
+                                   mMaxSubscribeDelay,
+                                   std::tr1::bind(&Server::purgeWaitingSubscriberOnShard,
+                                                  thus,
+                                                  uuid,
+                                                  which));
+
     }
     if (!success) {
         std::tr1::shared_ptr<Stream> strongStream(*stream);
@@ -179,63 +255,84 @@ void Server::subscriberConnectionCallback(const std::tr1::shared_ptr<std::tr1::s
 }
 void Server::broadcastConnectionCallback(SubscriptionState*subscription,Network::Stream::ConnectionStatus status,const std::string&reason){
     if (status!=Stream::Connected) {
-        boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where;
-        std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
-        whichuuid=mBroadcasters.find(subscription);
-        if (whichuuid!=mBroadcasters.end()) {
-            where=mSubscriptions.find(whichuuid->second);
-            mBroadcasters.erase(whichuuid);
-            if (where!=mSubscriptions.end()) {
-                mSubscriptions.erase(where);
-            }
+        if (subscription->mEpoch==SubscriptionState::ReservedEpoch) {
+            //never named itself, so no shard has seen it
+            delete subscription;
+        }else {
+            Network::IOServiceFactory::
+                dispatchServiceMessage(mShards[subscription->mShard]->mIOService,
+                                       std::tr1::bind(&Server::removeBroadcasterOnShard,this,subscription));
         }
-        delete subscription;
     }
 }
+void Server::removeBroadcasterOnShard(SubscriptionState*subscription){
+    Shard*shard=mShards[subscription->mShard];
+    std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where;
+    std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
+    whichuuid=shard->mBroadcasters.find(subscription);
+    if (whichuuid!=shard->mBroadcasters.end()) {
+        where=shard->mSubscriptions.find(whichuuid->second);
+        shard->mBroadcasters.erase(whichuuid);
+        if (where!=shard->mSubscriptions.end()) {
+            shard->mSubscriptions.erase(where);
+        }
+    }
+    delete subscription;
+}
 void Server::broadcastBytesReceivedCallback(SubscriptionState*state, const Network::Chunk&chunk) {
     if (state->mEpoch==SubscriptionState::ReservedEpoch) {
         Protocol::Broadcast broadcastRegistration;
         if (!chunk.empty()&&broadcastRegistration.ParseFromArray(&chunk[0],chunk.size())&&broadcastRegistration.has_broadcast_name()) {
             ++state->mEpoch;
-            boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-            std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
-            whichuuid=mBroadcasters.find(state);
-            if (whichuuid==mBroadcasters.end()) {
-                UUID uuid=broadcastRegistration.broadcast_name();
-                if (mSubscriptions.find(broadcastRegistration.broadcast_name())==mSubscriptions.end()) {
-                    mSubscriptions[uuid]=state;
-                    mBroadcasters[state]=uuid;
-                    state->setUUID(uuid);
-                    WaitingStreamMap::iterator where=mWaitingStreams.find(uuid);
-                    if (where!=mWaitingStreams.end()) {
-                        for (std::vector<WaitingStreams>::iterator i=where->second.begin(),ie=where->second.end();
-                             i!=ie;
-                             ++i) {
-                            if (i->mStream&&*i->mStream) {
-                                state->registerSubscriber(*i->mStream,i->mSubscriptionRequest);
-                            }
-                        }
-                        mWaitingStreams.erase(where);
+            UUID uuid=broadcastRegistration.broadcast_name();
+            state->mShard=shardIndex(uuid);
+            Network::IOServiceFactory::
+                dispatchServiceMessage(mShards[state->mShard]->mIOService,
+                                       std::tr1::bind(&Server::registerBroadcasterOnShard,this,state,uuid));
+        }else {
+            state->setLastSentMessage(Network::Stream::SharedChunk(new Network::Chunk(chunk)));
+        }
+    }else {
+        //copy the message once: every subscriber's stream references this same payload until it is on the wire
+        Network::Stream::SharedChunk payload(new Network::Chunk(chunk));
+        Network::IOServiceFactory::
+            dispatchServiceMessage(mShards[state->mShard]->mIOService,
+                                   std::tr1::bind(&Server::broadcastOnShard,this,state,payload));
+    }
+}
+void Server::registerBroadcasterOnShard(SubscriptionState*state, const UUID&uuid) {
+    Shard*shard=mShards[state->mShard];
+    std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
+    whichuuid=shard->mBroadcasters.find(state);
+    if (whichuuid==shard->mBroadcasters.end()) {
+        if (shard->mSubscriptions.find(uuid)==shard->mSubscriptions.end()) {
+            shard->mSubscriptions[uuid]=state;
+            shard->mBroadcasters[state]=uuid;
+            state->setUUID(uuid);
+            WaitingStreamMap::iterator where=shard->mWaitingStreams.find(uuid);
+            if (where!=shard->mWaitingStreams.end()) {
+                for (std::vector<WaitingStreams>::iterator i=where->second.begin(),ie=where->second.end();
+                     i!=ie;
+                     ++i) {
+                    if (i->mStream&&*i->mStream) {
+                        state->registerSubscriber(this,*i->mStream,i->mSubscriptionRequest);
                     }
-                }else {
-                    SILOG(subscription,warning,"Duplicate UUID for broadcast "<<broadcastRegistration.broadcast_name().toString()<<" Already in map");
                 }
-            }else {
-                SILOG(subscription,error,"UUID "<<whichuuid->second.toString()<<" Already in map");
+                shard->mWaitingStreams.erase(where);
             }
         }else {
-			Network::Chunk chk(chunk);
-            state->setLastSentMessage(chk);
+            SILOG(subscription,warning,"Duplicate UUID for broadcast "<<uuid.toString()<<" Already in map");
         }
     }else {
-        state->broadcast(this,MemoryReference(chunk));
-        if (chunk.size()<=mMaxCachedMessageSize) {
-			Network::Chunk chk(chunk);
-            state->setLastSentMessage(chk);
-        }else {
-            state->clearLastSentMessage();
-        }
+        SILOG(subscription,error,"UUID "<<whichuuid->second.toString()<<" Already in map");
+    }
+}
+void Server::broadcastOnShard(SubscriptionState*state, const Network::Stream::SharedChunk&payload) {
+    state->broadcast(this,payload);
+    if (payload->size()<=mMaxCachedMessageSize) {
+        state->setLastSentMessage(payload);
+    }else {
+        state->clearLastSentMessage();
     }
 }
 void Server::broadcastStreamCallback(Network::Stream* stream,Network::Stream::SetCallbacks&cb) {
@@ -251,7 +348,7 @@ void Server::broadcastStreamCallback(Network::Stream* stream,Network::Stream::Se
 void Server::initiatePolling(const UUID&name, const Duration&waitTime) {
     std::tr1::weak_ptr<Server>thus=shared_from_this();
     Network::IOServiceFactory::
-        dispatchServiceMessage(mBroadcastIOService,
+        dispatchServiceMessage(mShards[shardIndex(name)]->mIOService,
                                waitTime,
                                std::tr1::bind(&poll,
                                               thus,
@@ -261,10 +358,10 @@ void Server::initiatePolling(const UUID&name, const Duration&waitTime) {
 void Server::poll(const std::tr1::weak_ptr<Server> &weak_thus, const UUID&name) {
     std::tr1::shared_ptr<Server>thus=weak_thus.lock();
     if (thus) {
-        boost::lock_guard<boost::mutex>lok(*thus->mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where=thus->mSubscriptions.find(name);
+        Shard*shard=thus->mShards[thus->shardIndex(name)];
+        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where=shard->mSubscriptions.find(name);
 
-        if (where!=thus->mSubscriptions.end()) {
+        if (where!=shard->mSubscriptions.end()) {
             where->second->poll(&*thus);
         }
     }
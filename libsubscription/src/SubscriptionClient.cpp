@@ -35,13 +35,134 @@
 #include "network/IOServiceFactory.hpp"
 #include "network/Stream.hpp"
 #include "network/StreamFactory.hpp"
+#include "network/TCPDefinitions.hpp"
 #include "Subscription_Subscription.pbj.hpp"
+#include "util/ProfiledMutex.hpp"
 #include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
 namespace Sirikata { namespace Subscription {
-class SubscriptionClient::UniqueLock : public boost::mutex {
+namespace {
+bool readVarint(const std::string&input, size_t&offset, size_t&value) {
+    value=0;
+    for (unsigned int shift=0;offset<input.size()&&shift<sizeof(size_t)*8;shift+=7) {
+        uint8 byte=(uint8)input[offset++];
+        value|=(size_t)(byte&127)<<shift;
+        if ((byte&128)==0)
+            return true;
+    }
+    return false;
+}
+///Undoes the XOR run encoding described with Protocol::DeltaUpdate
+bool decodeXorRuns(const Network::Chunk&base, const std::string&delta, Network::Chunk&message) {
+    message.resize(0);
+    size_t offset=0;
+    while (offset<delta.size()) {
+        size_t zeros,literals;
+        if (!readVarint(delta,offset,zeros)||!readVarint(delta,offset,literals)||literals>delta.size()-offset)
+            return false;
+        for (size_t end=message.size()+zeros;message.size()<end;)
+            message.push_back(message.size()<base.size()?base[message.size()]:0);
+        for (size_t i=0;i<literals;++i,++offset) {
+            size_t where=message.size();
+            message.push_back((uint8)delta[offset]^(where<base.size()?base[where]:0));
+        }
+    }
+    return true;
+}
+}
+class SubscriptionClient::UniqueLock : public Metrics::ProfiledMutex<> {
+public:
+    UniqueLock():Metrics::ProfiledMutex<>("subscription.client") {}
+};
+///Routes the named DeltaUpdates arriving on a stream subscribed to several broadcasts to each broadcast's State
+class SubscriptionClient::SharedStream {
+public:
+    std::tr1::unordered_map<UUID,std::tr1::weak_ptr<State>,UUID::Hasher> mStates;
+    static void bytesReceived(const std::tr1::weak_ptr<SharedStream>&weak_thus,
+                              const Network::Chunk&data) {
+        std::tr1::shared_ptr<SharedStream> thus=weak_thus.lock();
+        Protocol::DeltaUpdate update;
+        if (thus&&!data.empty()&&update.ParseFromArray(&data[0],data.size())&&update.has_broadcast_name()) {
+            std::tr1::unordered_map<UUID,std::tr1::weak_ptr<State>,UUID::Hasher>::iterator where=thus->mStates.find(update.broadcast_name());
+            std::tr1::shared_ptr<State> state;
+            if (where!=thus->mStates.end()&&(state=where->second.lock())) {
+                state->receiveUpdate(where->second,update);
+            }
+        }
+    }
+    static void connectionCallback(const std::tr1::weak_ptr<SharedStream>&weak_thus,
+                                   const Network::Stream::ConnectionStatus status,
+                                   const String&reason) {
+        std::tr1::shared_ptr<SharedStream> thus=weak_thus.lock();
+        if (thus) {
+            for (std::tr1::unordered_map<UUID,std::tr1::weak_ptr<State>,UUID::Hasher>::iterator i=thus->mStates.begin(),ie=thus->mStates.end();i!=ie;++i) {
+                State::connectionCallback(i->second,status,reason);
+            }
+        }
+    }
+};
 
+///The socket joined to one multicast group, handing each named DeltaUpdate datagram to the State of its broadcast
+class SubscriptionClient::MulticastReceiver {
+public:
+    enum {MAX_DATAGRAM_SIZE=65536};
+    boost::asio::ip::udp::socket mSocket;
+    boost::asio::ip::udp::endpoint mSender;
+    Network::Chunk mBuffer;
+    std::tr1::unordered_map<UUID,std::tr1::weak_ptr<State>,UUID::Hasher> mStates;
+    MulticastReceiver(Network::IOService*io):mSocket(*io),mBuffer(MAX_DATAGRAM_SIZE){}
+    static void startReceive(const std::tr1::shared_ptr<MulticastReceiver>&thus) {
+        std::tr1::weak_ptr<MulticastReceiver> weak_thus(thus);
+        thus->mSocket.async_receive_from(boost::asio::buffer(&thus->mBuffer[0],thus->mBuffer.size()),
+                                         thus->mSender,
+                                         std::tr1::bind(&MulticastReceiver::received,weak_thus,_1,_2));
+    }
+    static void received(const std::tr1::weak_ptr<MulticastReceiver>&weak_thus,
+                         const boost::system::error_code&error,
+                         std::size_t length) {
+        std::tr1::shared_ptr<MulticastReceiver> thus=weak_thus.lock();
+        if (!thus||error==boost::asio::error::operation_aborted)
+            return;
+        Protocol::DeltaUpdate update;
+        if (error) {
+            SILOG(subscription,warning,"Error receiving subscription multicast: "<<error.message());
+        }else if (length&&update.ParseFromArray(&thus->mBuffer[0],length)&&update.has_broadcast_name()) {
+            std::tr1::unordered_map<UUID,std::tr1::weak_ptr<State>,UUID::Hasher>::iterator where=thus->mStates.find(update.broadcast_name());
+            if (where!=thus->mStates.end()) {
+                std::tr1::shared_ptr<State> state=where->second.lock();
+                if (state) {
+                    state->receiveUpdate(where->second,update);
+                }else {
+                    thus->mStates.erase(where);
+                }
+            }
+        }
+        startReceive(thus);
+    }
 };
 
+std::tr1::shared_ptr<SubscriptionClient::MulticastReceiver> SubscriptionClient::multicastReceiverFromIOThread(const Network::Address&group) {
+    std::tr1::shared_ptr<MulticastReceiver> receiver=mMulticastGroups[group].lock();
+    if (receiver)
+        return receiver;
+    try {
+        boost::asio::ip::address_v4 address=boost::asio::ip::address_v4::from_string(group.getHostName());
+        receiver=std::tr1::shared_ptr<MulticastReceiver>(new MulticastReceiver(mService));
+        receiver->mSocket.open(boost::asio::ip::udp::v4());
+        receiver->mSocket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+        receiver->mSocket.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::any(),
+                                                              boost::lexical_cast<unsigned short>(group.getService())));
+        receiver->mSocket.set_option(boost::asio::ip::multicast::join_group(address));
+    } catch (std::exception&e) {
+        SILOG(subscription,error,"Cannot join subscription multicast group "<<group.getHostName()<<':'<<group.getService()<<": "<<e.what());
+        mMulticastGroups.erase(group);
+        return std::tr1::shared_ptr<MulticastReceiver>();
+    }
+    MulticastReceiver::startReceive(receiver);
+    mMulticastGroups[group]=receiver;
+    return receiver;
+}
+
 void SubscriptionClient::upgradeFromIOThread(const std::tr1::weak_ptr<State>&weak_source,
                                              const std::tr1::weak_ptr<State>&weak_dest) {
     std::tr1::shared_ptr<State> dest=weak_dest.lock();
@@ -90,7 +211,7 @@ void SubscriptionClient::addSubscriberFromIOThread(const std::tr1::weak_ptr<Indi
 }
 void SubscriptionClient::removeSubscriberFromIOThreadHint(Network::Address address,
                                                           const UUID&uuid){
-    boost::lock_guard<boost::mutex>lok(*static_cast<boost::mutex*>(mMapLock));
+    boost::lock_guard<UniqueLock>lok(*mMapLock);
     BroadcastMap::iterator where=mBroadcasts.find(AddressUUID(address,uuid));
     if (where!=mBroadcasts.end()) {
         std::tr1::shared_ptr<State> thus=where->second.lock();
@@ -107,7 +228,7 @@ void SubscriptionClient::addSubscriber(const std::tr1::weak_ptr<IndividualSubscr
                                               individual,
                                               sendIntroMessage));
 }
-SubscriptionClient::SubscriptionClient(Network::IOService*service):mService(service){
+SubscriptionClient::SubscriptionClient(Network::IOService*service, const Duration&coalesceWindow):mService(service),mCoalesceWindow(coalesceWindow){
     mMapLock = new UniqueLock;
 }
 SubscriptionClient::~SubscriptionClient(){
@@ -118,6 +239,74 @@ SubscriptionClient::State::State(const Duration &period,
                                  const UUID&uuid,
                                  SubscriptionClient *parent):mAddress(address),mUUID(uuid),mPeriod(period){
     mParent=parent;
+    mDeltaUpdates=false;
+    mHasDeltaBase=false;
+    mDeltaEpoch=0;
+    mMulticast=false;
+    mResendRequested=false;
+}
+bool SubscriptionClient::State::decodeDeltaUpdate(const Protocol::DeltaUpdate&update, Network::Chunk&message) {
+    if (update.has_base_epoch()) {
+        if (!mHasDeltaBase||update.base_epoch()!=mDeltaEpoch||!decodeXorRuns(mDeltaBase,update.data(),message))
+            return false;
+    }else {
+        const std::string&whole=update.data();
+        message.assign(whole.begin(),whole.end());
+    }
+    mDeltaBase=message;
+    mDeltaEpoch=update.epoch();
+    mHasDeltaBase=true;
+    return true;
+}
+void SubscriptionClient::State::receiveUpdate(const std::tr1::weak_ptr<State>&weak_thus, const Protocol::DeltaUpdate&update) {
+    if (update.has_multicast_group()) {
+        joinMulticastGroup(weak_thus,update.multicast_group());
+        if (!update.has_data())
+            return;//the broadcast has not sent anything yet
+    }
+    //a resend may cross a datagram on the way: whichever arrives second is stale
+    if (mMulticast&&mHasDeltaBase&&(int32)(update.epoch()-mDeltaEpoch)<=0)
+        return;
+    Network::Chunk decoded;
+    if (!decodeDeltaUpdate(update,decoded)) {
+        if (mMulticast) {
+            requestResend();
+        }else {
+            SILOG(subscription,warning,"Dropping subscription update for "<<mUUID.toString()<<" that does not decode against epoch "<<mDeltaEpoch);
+        }
+        return;
+    }
+    mResendRequested=false;
+    deliver(weak_thus,decoded);
+}
+void SubscriptionClient::State::joinMulticastGroup(const std::tr1::weak_ptr<State>&weak_thus, const Protocol::Address&group) {
+    if (!mMulticast||mMulticastReceiver)
+        return;
+    mMulticastReceiver=mParent->multicastReceiverFromIOThread(Network::Address(group.hostname(),group.service()));
+    if (mMulticastReceiver) {
+        mMulticastReceiver->mStates[mUUID]=weak_thus;
+    }else if (mStream&&!mSharedStream) {
+        //the server only sends this subscription datagrams now, so ask for the updates over the stream as well.
+        //A shared stream cannot tell unnamed updates apart, so its broadcasts stay without
+        Protocol::Subscribe subscription;
+        subscription.set_broadcast_name(mUUID);
+        subscription.set_update_period(mPeriod);
+        subscription.set_delta_updates(true);
+        String serialized;
+        subscription.SerializeToString(&serialized);
+        mStream->send(MemoryReference(serialized),Network::ReliableUnordered);
+    }
+}
+void SubscriptionClient::State::requestResend() {
+    if (mResendRequested||!mStream)
+        return;
+    Protocol::Subscribe subscription;
+    subscription.set_broadcast_name(mUUID);
+    subscription.set_resend_epoch(mHasDeltaBase?mDeltaEpoch:0);
+    String serialized;
+    subscription.SerializeToString(&serialized);
+    mStream->send(MemoryReference(serialized),Network::ReliableUnordered);
+    mResendRequested=true;
 }
 void SubscriptionClient::State::setStream(const std::tr1::shared_ptr<State> thus,
                       const std::tr1::shared_ptr<Network::Stream>topLevelStream,
@@ -174,7 +363,7 @@ void SubscriptionClient::State::purgeSubscribersFromIOThread(const std::tr1::wea
         if (tooGoodForMe){
             mSubscribers.pop_back();//pop the back guy--he will be the guinea pig in our upgrade process
             {
-                boost::lock_guard<boost::mutex>lok(*parent->mMapLock);//lock the map
+                boost::lock_guard<UniqueLock>lok(*parent->mMapLock);//lock the map
                 BroadcastMap::iterator where=parent->mBroadcasts.find(AddressUUID(mAddress,mUUID));
                 if (where!=parent->mBroadcasts.end()) {
                     parent->mBroadcasts.erase(where);//purge the map of our entry
@@ -183,6 +372,10 @@ void SubscriptionClient::State::purgeSubscribersFromIOThread(const std::tr1::wea
             Protocol::Subscribe subscription;//make a subscription packet
             subscription.set_broadcast_name(mUUID);//populate it with fields from this
             subscription.set_update_period(period);//and with the desired slower period
+            if (mDeltaUpdates)
+                subscription.set_delta_updates(true);
+            if (mMulticast)
+                subscription.set_multicast(true);
             
             //FIXME any more properties? we don't have a way to determine to edit the code if there are
             parent->subscribe(mAddress,
@@ -200,30 +393,43 @@ namespace {
 size_t sMaximumSubscriptionStateSize=1360;
 }
 void SubscriptionClient::State::bytesReceived(const std::tr1::weak_ptr<State>&weak_thus,
-                          const Network::Chunk&data) {
+                          const Network::Chunk&wireData) {
     std::tr1::shared_ptr<State> thus=weak_thus.lock();
     if (thus) {
-        bool eraseAny=false;
-        for (std::vector<std::tr1::weak_ptr<IndividualSubscription> >::iterator i
-                     =thus->mSubscribers.begin(),ie=thus->mSubscribers.end();
-             i!=ie;
-             ++i) {
-            std::tr1::shared_ptr<IndividualSubscription> temp=i->lock();
-            if (temp) {//lock each guy...if true send datae
-                temp->mFunction(data);
-            }else {//if false, get ready for a round of purge
-                eraseAny=true;
+        if (thus->mDeltaUpdates) {
+            Protocol::DeltaUpdate update;
+            if (wireData.empty()||!update.ParseFromArray(&wireData[0],wireData.size())) {
+                SILOG(subscription,warning,"Dropping subscription update for "<<thus->mUUID.toString()<<" that does not parse");
+                return;
             }
-        }
-        if (eraseAny) {
-            thus->purgeSubscribersFromIOThread(weak_thus,thus->mParent);
-        }
-        if (data.size()<sMaximumSubscriptionStateSize) {
-            thus->mLastDeliveredMessage=data;
+            thus->receiveUpdate(weak_thus,update);
         }else {
-            thus->mLastDeliveredMessage.resize(0);
+            thus->deliver(weak_thus,wireData);
+        }
+    }
+}
+void SubscriptionClient::State::deliver(const std::tr1::weak_ptr<State>&weak_thus,
+                                        const Network::Chunk&data) {
+    bool eraseAny=false;
+    for (std::vector<std::tr1::weak_ptr<IndividualSubscription> >::iterator i
+             =mSubscribers.begin(),ie=mSubscribers.end();
+         i!=ie;
+         ++i) {
+        std::tr1::shared_ptr<IndividualSubscription> temp=i->lock();
+        if (temp) {//lock each guy...if true send datae
+            temp->mFunction(data);
+        }else {//if false, get ready for a round of purge
+            eraseAny=true;
         }
     }
+    if (eraseAny) {
+        purgeSubscribersFromIOThread(weak_thus,mParent);
+    }
+    if (data.size()<sMaximumSubscriptionStateSize) {
+        mLastDeliveredMessage=data;
+    }else {
+        mLastDeliveredMessage.resize(0);
+    }
 }
 
 void SubscriptionClient::State::connectionCallback(const std::tr1::weak_ptr<State>&weak_thus,
@@ -251,6 +457,10 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription> SubscriptionCli
     Protocol::Subscribe sub;
     sub.set_broadcast_name(mSubscriptionState->mUUID);
     sub.set_update_period(period);
+    if (mSubscriptionState->mDeltaUpdates)
+        sub.set_delta_updates(true);
+    if (mSubscriptionState->mMulticast)
+        sub.set_multicast(true);
     return mSubscriptionState->mParent->subscribe(mSubscriptionState->mAddress,sub,mFunction,mDisconFunction);
 }
 std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
@@ -273,7 +483,7 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
         newSubscription=newerSubscription;
     }
     {//lock guard
-        boost::lock_guard<boost::mutex>lok(*mMapLock);
+        boost::lock_guard<UniqueLock>lok(*mMapLock);
         AddressUUID key(address,subscription.broadcast_name());
         BroadcastMap::iterator where=mBroadcasts.find(key);
         TopLevelStreamMap::iterator topLevelStreamIter;
@@ -298,9 +508,11 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
                                                       subscription.update_period(),
                                                       address,
                                                       subscription.broadcast_name(),this));//setup state
+                state->mMulticast=subscription.has_multicast()&&subscription.multicast();
+                state->mDeltaUpdates=state->mMulticast||(subscription.has_delta_updates()&&subscription.delta_updates());
 
-                state->setStream(state,topLevelStreamPtr,serializedSubscription.length()?serializedSubscription:localSerializedSubscription);//set state to use a given toplevel stream and serialize
-                                                                                                                           //out a broadcast join request
+                introduce(state,topLevelStreamPtr,serializedSubscription.length()?serializedSubscription:localSerializedSubscription);//set state to use a given toplevel stream and serialize
+                                                                                                                     //out a broadcast join request
 
                 //put new broadcast into the broadcasts lists
                 mBroadcasts.insert(BroadcastMap::value_type(key,state));
@@ -322,10 +534,12 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
                                                                   address,
                                                                   subscription.broadcast_name(),
                                                                   this));
+            state->mMulticast=subscription.has_multicast()&&subscription.multicast();
+            state->mDeltaUpdates=state->mMulticast||(subscription.has_delta_updates()&&subscription.delta_updates());
             if (do_upgrade) {
                 upgrade_dest=state;
             }
-            state->setStream(state,topLevelStream,serializedSubscription.length()?serializedSubscription:localSerializedSubscription);
+            introduce(state,topLevelStream,serializedSubscription.length()?serializedSubscription:localSerializedSubscription);
             newSubscription->mSubscriptionState=state;
             state->mSubscribers.push_back(newSubscription);
             mTopLevelStreams.insert(TopLevelStreamMap::value_type(address,topLevelStream));
@@ -338,6 +552,82 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
     }
     return retval;
 }
+void SubscriptionClient::introduce(const std::tr1::shared_ptr<State>&state,
+                                   const std::tr1::shared_ptr<Network::Stream>&topLevelStream,
+                                   const String&serializedSubscription) {
+    if (mCoalesceWindow<=Duration::microseconds(0)) {
+        state->setStream(state,topLevelStream,serializedSubscription);
+        return;
+    }
+    PendingBatch*batch=&mPendingBatches[state->mAddress];
+    if (batch->mStates.empty()) {//first of a batch: the window starts now
+        batch->mTopLevelStream=topLevelStream;
+        Network::IOServiceFactory::
+            dispatchServiceMessage(mService,
+                                   mCoalesceWindow,
+                                   std::tr1::bind(&SubscriptionClient::flushBatchFromIOThread,
+                                                  this,
+                                                  state->mAddress));
+    }
+    //the state holds the toplevel stream from now on, so it survives until the batch is sent
+    state->mTopLevelStream=topLevelStream;
+    batch->mStates.push_back(std::pair<std::tr1::shared_ptr<State>,String>(state,serializedSubscription));
+}
+void SubscriptionClient::flushBatchFromIOThread(const Network::Address&address) {
+    PendingBatch batch;
+    {
+        boost::lock_guard<UniqueLock>lok(*mMapLock);
+        PendingBatchMap::iterator where=mPendingBatches.find(address);
+        if (where==mPendingBatches.end())
+            return;
+        batch=where->second;
+        mPendingBatches.erase(where);
+    }
+    std::vector<std::pair<std::tr1::shared_ptr<State>,String> >&states=batch.mStates;
+    while (!states.empty()) {
+        //gather the states asking for the same period as the first: they can share a Subscribe message
+        std::vector<std::pair<std::tr1::shared_ptr<State>,String> > group;
+        for (size_t i=0;i<states.size();) {
+            if (states[i].first->mPeriod==states.front().first->mPeriod) {
+                group.push_back(states[i]);
+                states[i]=states.back();
+                states.pop_back();
+            }else ++i;
+        }
+        Protocol::Subscribe subscription;
+        if (group.size()==1||!subscription.ParseFromString(group.front().second)) {
+            for (size_t i=0;i<group.size();++i)
+                group[i].first->setStream(group[i].first,batch.mTopLevelStream,group[i].second);
+            continue;
+        }
+        std::tr1::shared_ptr<SharedStream> shared(new SharedStream);
+        std::tr1::weak_ptr<SharedStream> weak_shared(shared);
+        subscription.clear_broadcast_names();
+        for (size_t i=0;i<group.size();++i) {
+            State*state=&*group[i].first;
+            if (i)
+                subscription.add_broadcast_names(state->mUUID);
+            //updates on a shared stream are always DeltaUpdates
+            state->mDeltaUpdates=true;
+            state->mSharedStream=shared;
+            state->mTopLevelStream=batch.mTopLevelStream;
+            shared->mStates[state->mUUID]=group[i].first;
+        }
+        std::tr1::shared_ptr<Network::Stream>
+            clonedStream(batch.mTopLevelStream->clone(std::tr1::bind(&SharedStream::connectionCallback,
+                                                                     weak_shared,
+                                                                     _1,
+                                                                     _2),
+                                                      std::tr1::bind(&SharedStream::bytesReceived,
+                                                                     weak_shared,
+                                                                     _1)));
+        for (size_t i=0;i<group.size();++i)
+            group[i].first->mStream=clonedStream;
+        String serialized;
+        subscription.SerializeToString(&serialized);
+        clonedStream->send(MemoryReference(serialized),Network::ReliableUnordered);
+    }
+}
 std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
     SubscriptionClient::subscribe(const String&subscription,
                                   const std::tr1::function<void(const Network::Chunk&)>&cb,
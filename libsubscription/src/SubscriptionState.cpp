@@ -42,164 +42,341 @@
 
 
 namespace Sirikata { namespace Subscription {
-SubscriptionState::SubscriptionState(Network::Stream*broadcaster):mName(UUID::null()),mLatestSentTime(Time::null()),mLatestUnsentTime(Time::null()){
+namespace {
+void appendVarint(std::string&output, size_t value) {
+    while (value>=128) {
+        output.push_back((char)((value&127)|128));
+        value>>=7;
+    }
+    output.push_back((char)value);
+}
+uint8 xorByte(const Network::Chunk&base, const Network::Chunk&target, size_t i) {
+    return i<base.size()?target[i]^base[i]:target[i];
+}
+///Writes target XOR base in the DeltaUpdate data format: runs of zeros are skipped, and zero runs shorter than a varint pair are kept as literals
+void encodeXorRuns(const Network::Chunk&base, const Network::Chunk&target, std::string&output) {
+    size_t size=target.size();
+    size_t i=0;
+    while (i<size) {
+        size_t zeros=0;
+        while (i+zeros<size&&xorByte(base,target,i+zeros)==0)
+            ++zeros;
+        size_t literalStart=i+zeros;
+        size_t literalEnd=literalStart;
+        while (literalEnd<size) {
+            if (xorByte(base,target,literalEnd)!=0) {
+                ++literalEnd;
+            }else {
+                size_t gap=0;
+                while (literalEnd+gap<size&&gap<3&&xorByte(base,target,literalEnd+gap)==0)
+                    ++gap;
+                if (gap==3||literalEnd+gap==size)
+                    break;
+                literalEnd+=gap;
+            }
+        }
+        appendVarint(output,zeros);
+        appendVarint(output,literalEnd-literalStart);
+        for (size_t j=literalStart;j<literalEnd;++j)
+            output.push_back((char)xorByte(base,target,j));
+        i=literalEnd;
+    }
+}
+}
+SubscriptionState::SubscriptionState(Network::Stream*broadcaster):mName(UUID::null()),mPollTime(Time::null()){
     mEpoch=ReservedEpoch;
+    mShard=0;
     mBroadcaster=broadcaster;
     mEverReceivedMessage=false;
     mPolling=false;
+    mVersion=0;
+    mNumWaiting=0;
+    mNumBehind=0;
+    mAnyDeltaSubscribers=false;
 }
 void SubscriptionState::clearLastSentMessage() {
 	mEverReceivedMessage=true;
-	mLastSentMessage.resize(0);
+	mLastSentMessage.reset();
+    if (!mHistory.empty()&&mHistory.back().first==mVersion)
+        mHistory.pop_back();
+    clearEncodedUpdates();
 }
 
-void SubscriptionState::setLastSentMessage(Network::Chunk&chunk) {
+void SubscriptionState::setLastSentMessage(const Network::Stream::SharedChunk&chunk) {
 	mEverReceivedMessage=true;
-	mLastSentMessage.swap(chunk);
+	mLastSentMessage=chunk;
+    if (mAnyDeltaSubscribers) {
+        if (!mHistory.empty()&&mHistory.back().first==mVersion) {
+            mHistory.back().second=chunk;
+        }else {
+            mHistory.push_back(std::pair<uint32,Network::Stream::SharedChunk>(mVersion,chunk));
+            if (mHistory.size()>(size_t)DELTA_HISTORY)
+                mHistory.pop_front();
+        }
+    }
+    clearEncodedUpdates();
 }
 
+void SubscriptionState::clearEncodedUpdates() {
+    mEncodedUpdates.clear();
+    mFullUpdate[0].reset();
+    mFullUpdate[1].reset();
+}
 
-Time SubscriptionState::pushSubscriber(Subscriber*subscriber,std::vector<SubscriberTimePair>*heap) {
-    Time retval=subscriber->computeNextUpdateFromNow();
-    heap->push_back(SubscriberTimePair(retval,subscriber));
-    std::push_heap(heap->begin(),heap->end());
-    return retval;
+Network::Stream::SharedChunk SubscriptionState::encodeFor(Subscriber*subscriber, const Network::Stream::SharedChunk&data) {
+    if (!subscriber->mDelta)
+        return data;
+    return encodeAgainst(subscriber->mHasBaseline,subscriber->mSentVersion,subscriber->mNamed,data);
 }
 
-void SubscriptionState::pushNewSubscriber(Subscriber*s,const Time&oldTime) {
-    mUnsentSubscribersHeap.push_back(SubscriberTimePair(oldTime,s));
-    std::push_heap(mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-    if (mLatestUnsentTime<oldTime) {
-        mLatestUnsentTime=oldTime;
+Network::Stream::SharedChunk SubscriptionState::encodeAgainst(bool hasBase, uint32 baseVersion, bool named, const Network::Stream::SharedChunk&data) {
+    const Network::Stream::SharedChunk*base=NULL;
+    if (hasBase&&data) {
+        for (std::deque<std::pair<uint32,Network::Stream::SharedChunk> >::reverse_iterator i=mHistory.rbegin(),ie=mHistory.rend();i!=ie;++i) {
+            if (i->first==baseVersion) {
+                if (i->second)
+                    base=&i->second;
+                break;
+            }
+        }
     }
+    if (base) {
+        std::pair<uint32,bool> key(baseVersion,named);
+        std::map<std::pair<uint32,bool>,Network::Stream::SharedChunk>::iterator where=mEncodedUpdates.find(key);
+        if (where!=mEncodedUpdates.end())
+            return where->second;
+        std::string delta;
+        encodeXorRuns(**base,*data,delta);
+        if (delta.size()<data->size()) {
+            Protocol::DeltaUpdate update;
+            update.set_epoch(mVersion);
+            update.set_base_epoch(baseVersion);
+            update.set_data(delta);
+            if (named)
+                update.set_broadcast_name(mName);
+            std::string serialized;
+            update.SerializeToString(&serialized);
+            Network::Stream::SharedChunk encoded(new Network::Chunk(serialized.begin(),serialized.end()));
+            mEncodedUpdates[key]=encoded;
+            return encoded;
+        }
+        //the change is as large as the message: remember that sending it whole is the better deal
+        return mEncodedUpdates[key]=wholeUpdate(data,named);
+    }
+    return wholeUpdate(data,named);
+}
+
+const Network::Stream::SharedChunk&SubscriptionState::wholeUpdate(const Network::Stream::SharedChunk&data, bool named) {
+    Network::Stream::SharedChunk&whole=mFullUpdate[named?1:0];
+    if (!whole) {
+        Protocol::DeltaUpdate update;
+        update.set_epoch(mVersion);
+        if (data&&!data->empty())
+            update.set_data((const char*)&(*data)[0],data->size());
+        if (named)
+            update.set_broadcast_name(mName);
+        std::string serialized;
+        update.SerializeToString(&serialized);
+        whole=Network::Stream::SharedChunk(new Network::Chunk(serialized.begin(),serialized.end()));
+    }
+    return whole;
+}
+
+void SubscriptionState::scheduleSubscriber(Subscriber*subscriber) {
+    uint64 opens=subscriber->computeNextUpdateFromNow().raw();
+    //round up so a subscriber is never sent updates faster than its period asks for
+    opens=(opens+BUCKET_MICROSECONDS-1)/BUCKET_MICROSECONDS*BUCKET_MICROSECONDS;
+    mWaitingSubscribers[Time::microseconds((int64)opens)].push_back(subscriber);
+    ++mNumWaiting;
 }
-void SubscriptionState::pushJustReceivedSubscriber(Subscriber*s) {
-    Time retval=pushSubscriber(s,&mSentSubscribersHeap);
-    if (mLatestSentTime<retval) {
-        mLatestSentTime=retval;
+
+bool SubscriptionState::deliver(Subscriber*subscriber, const Network::Stream::SharedChunk&data) {
+    if (!subscriber->broadcast(encodeFor(subscriber,data))) {
+        delete subscriber;
+        return false;
     }
+    subscriber->mSentVersion=mVersion;
+    subscriber->mHasBaseline=true;
+    scheduleSubscriber(subscriber);
+    return true;
 }
-void SubscriptionState::registerSubscriber(const std::tr1::shared_ptr<Network::Stream>&stream, const Protocol::Subscribe&subscriptionMessage){
+
+bool SubscriptionState::popDueBucket(const Time&now, std::vector<Subscriber*>&due) {
+    SubscriberWheel::iterator earliest=mWaitingSubscribers.begin();
+    if (earliest==mWaitingSubscribers.end()||!(earliest->first<now))
+        return false;
+    due.swap(earliest->second);
+    mWaitingSubscribers.erase(earliest);
+    mNumWaiting-=due.size();
+    return true;
+}
+
+void SubscriptionState::schedulePoll(Server*parent, const Time&now) {
+    if (mNumBehind==0||mWaitingSubscribers.empty())
+        return;
+    Time next=mWaitingSubscribers.begin()->first;
+    if (!mPolling||next<mPollTime) {
+        assert(mName!=UUID::null());
+        mPolling=true;
+        mPollTime=next;
+        parent->initiatePolling(mName,next<now?Duration::microseconds(0):next-now);
+    }
+}
+
+void SubscriptionState::registerSubscriber(Server*parent, const std::tr1::shared_ptr<Network::Stream>&stream, const Protocol::Subscribe&subscriptionMessage){
     Subscriber*subscriber =new Subscriber(stream,subscriptionMessage);
-    if (mEverReceivedMessage)
-        subscriber->broadcast(MemoryReference(mLastSentMessage));
-    pushJustReceivedSubscriber(subscriber);
+    Network::Address group(Network::Address::null());
+    if (subscriber->mMulticast&&!parent->multicastGroup(mName,group))
+        subscriber->mMulticast=false;//this server sends no datagrams: the subscriber is served on its stream like any other
+    if (subscriber->mDelta&&!mAnyDeltaSubscribers) {
+        mAnyDeltaSubscribers=true;
+        if (mEverReceivedMessage)
+            mHistory.push_back(std::pair<uint32,Network::Stream::SharedChunk>(mVersion,mLastSentMessage));
+    }
+    if (subscriber->mMulticast) {
+        //the stream carries the current update and the group to join; everything after it arrives as datagrams
+        Protocol::DeltaUpdate introduction;
+        introduction.set_epoch(mVersion);
+        introduction.set_broadcast_name(mName);
+        if (mEverReceivedMessage&&mLastSentMessage&&!mLastSentMessage->empty())
+            introduction.set_data((const char*)&(*mLastSentMessage)[0],mLastSentMessage->size());
+        introduction.mutable_multicast_group().set_hostname(group.getHostName());
+        introduction.mutable_multicast_group().set_service(group.getService());
+        std::string serialized;
+        introduction.SerializeToString(&serialized);
+        subscriber->broadcast(Network::Stream::SharedChunk(new Network::Chunk(serialized.begin(),serialized.end())));
+        subscriber->mSentVersion=mVersion;
+        subscriber->mHasBaseline=true;
+        mMulticastSubscribers.push_back(subscriber);
+        return;
+    }
+    if (mEverReceivedMessage) {
+        subscriber->broadcast(encodeFor(subscriber,mLastSentMessage));
+        subscriber->mHasBaseline=true;
+    }
+    subscriber->mSentVersion=mVersion;
+    scheduleSubscriber(subscriber);
 }
 
 
-void SubscriptionState::broadcast(Server*poll,const MemoryReference&data){
+void SubscriptionState::broadcast(Server*poll,const Network::Stream::SharedChunk&data){
     Time now=Time::now();
-    std::vector<SubscriberTimePair> newUnsenders;
-    if (mLatestSentTime<now||mLatestUnsentTime<now) {//there exists a completing queue
-        Time latestSentTime=mLatestSentTime;
-        bool unsentSwap=false;
-        if (!(mLatestSentTime<now)) {//if the queue of those items that were marked as having sent the last packet isn't fully ready to send
-            mLatestSentTime=now;//make sure to reset the time for things in the sent queue
-            mSentSubscribersHeap.swap(mUnsentSubscribersHeap);//swap it with that queue that is... since by the end of this operation all items that haven't sent this latest packet won't
-                                                              //have sent the latest packet and can be placed in the unsent heap
-            unsentSwap=true;//swap the latest times
-        }
-        if (mLatestSentTime<now&&mLatestUnsentTime<now) {//if both queues are going to empty, combine them as the sent queue
-            mSentSubscribersHeap.insert(mSentSubscribersHeap.end(),mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-            mUnsentSubscribersHeap.clear();
-        }else if (!mUnsentSubscribersHeap.empty()) {//otherwise pop items off the Unsent queue onto the sent queue for mass processing
-            if (unsentSwap)
-                mLatestUnsentTime=latestSentTime;
-            while(mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
-                mSentSubscribersHeap.push_back(mUnsentSubscribersHeap.front());
-                std::pop_heap(mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-                mUnsentSubscribersHeap.pop_back();
-            }
-        }
-        std::vector<SubscriberTimePair>::iterator i,ie=mSentSubscribersHeap.end();
-        for (i=mSentSubscribersHeap.begin(); i!=ie;++i) {
-            i->mSubscriber->broadcast(data);
-            i->mNextUpdateTime=i->mSubscriber->computeNextUpdateFromNow();
-            if (mLatestSentTime<i->mNextUpdateTime) {
-                mLatestSentTime=i->mNextUpdateTime;
-            }
-        }
-        std::make_heap(mSentSubscribersHeap.begin(),mSentSubscribersHeap.end());//since the sent queue's heap property was violated, reheapify
-    }else {
-        //neither queue completes, meaning both will have partial entries that will need to be merged into a heap
-        std::vector<SubscriberTimePair> temp,sent;
-        sent.swap(mSentSubscribersHeap);
-        mLatestSentTime=now;
-        std::vector<SubscriberTimePair>::iterator unsentHeapEnd=mUnsentSubscribersHeap.end(),sentEnd=sent.end(),iter;
-        size_t unsentSize=mUnsentSubscribersHeap.size();
-        for (size_t i=0;i<unsentSize;++i) {
-            if (mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
-                mUnsentSubscribersHeap.front().mSubscriber->broadcast(data);
-                std::pop_heap(mUnsentSubscribersHeap.begin(),unsentHeapEnd);
-                --unsentHeapEnd;
-                pushJustReceivedSubscriber(unsentHeapEnd->mSubscriber);
-            }else {
-                if (unsentHeapEnd!=mUnsentSubscribersHeap.end())
-                    mUnsentSubscribersHeap.erase(unsentHeapEnd,mUnsentSubscribersHeap.end());
-                break;
-            }
+    ++mVersion;
+    clearEncodedUpdates();
+    if (!mMulticastSubscribers.empty())
+        multicast(poll,data);
+    //every subscriber still waiting for its window misses this message: those delivered below are added back up to date
+    size_t missed=mNumWaiting;
+    std::vector<Subscriber*> due;
+    due.swap(mReadySubscribers);
+    for (std::vector<Subscriber*>::iterator i=due.begin(),ie=due.end();i!=ie;++i) {
+        deliver(*i,data);
+    }
+    while (popDueBucket(now,due)) {
+        missed-=due.size();
+        for (std::vector<Subscriber*>::iterator i=due.begin(),ie=due.end();i!=ie;++i) {
+            deliver(*i,data);
         }
-        size_t sentSize=sent.size();
-        for (size_t i=0;i<sentSize;++i) {
-            if (sent.front().mNextUpdateTime<now) {
-                sent.front().mSubscriber->broadcast(data);
-                std::pop_heap(sent.begin(),sentEnd);
-                --sentEnd;
-                pushJustReceivedSubscriber(sentEnd->mSubscriber);
-            }else {
-                for (iter=sent.begin();iter!=sentEnd;++iter) {
-                    pushNewSubscriber(iter->mSubscriber,iter->mNextUpdateTime);
-                }
-                break;
-            }
+        due.clear();
+    }
+    mNumBehind=missed;
+    schedulePoll(poll,now);
+}
+
+void SubscriptionState::multicast(Server*parent, const Network::Stream::SharedChunk&data) {
+    //one datagram serves every subscriber in the group: encoded against the previous version, which a subscriber that missed it asks to be resent
+    Network::Stream::SharedChunk datagram=encodeAgainst(true,mVersion-1,true,data);
+    if (mVersion%MULTICAST_PRUNE_INTERVAL==0)
+        pruneMulticastSubscribers();
+    if (parent->multicast(mName,datagram))
+        return;
+    size_t kept=0;
+    for (size_t i=0;i<mMulticastSubscribers.size();++i) {
+        Subscriber*subscriber=mMulticastSubscribers[i];
+        if (subscriber->broadcast(datagram)) {
+            subscriber->mSentVersion=mVersion;
+            mMulticastSubscribers[kept++]=subscriber;
+        }else {
+            delete subscriber;
         }
     }
-    if (!mUnsentSubscribersHeap.empty()) {
-        poll->initiatePolling(mName,mUnsentSubscribersHeap.front().mNextUpdateTime-now);
+    mMulticastSubscribers.resize(kept);
+}
+
+void SubscriptionState::pruneMulticastSubscribers() {
+    size_t kept=0;
+    for (size_t i=0;i<mMulticastSubscribers.size();++i) {
+        if (mMulticastSubscribers[i]->mSender.expired()) {
+            delete mMulticastSubscribers[i];
+        }else {
+            mMulticastSubscribers[kept++]=mMulticastSubscribers[i];
+        }
     }
+    mMulticastSubscribers.resize(kept);
+}
 
+void SubscriptionState::resend(const std::tr1::shared_ptr<Network::Stream>&stream, uint32 version) {
+    //without the current message cached the next datagram goes out whole anyway, since the history lacks its base too
+    if (!mEverReceivedMessage||version==mVersion||!mLastSentMessage)
+        return;
+    stream->send(wholeUpdate(mLastSentMessage,true),Network::ReliableOrdered);
 }
 
 SubscriptionState::~SubscriptionState(){
-    std::vector<SubscriberTimePair>::iterator i=mUnsentSubscribersHeap.begin(),ie=mUnsentSubscribersHeap.end();
-    for (;i!=ie;++i) {
-        delete i->mSubscriber;
+    for (SubscriberWheel::iterator i=mWaitingSubscribers.begin(),ie=mWaitingSubscribers.end();i!=ie;++i) {
+        for (std::vector<Subscriber*>::iterator j=i->second.begin(),je=i->second.end();j!=je;++j) {
+            delete *j;
+        }
     }
-    i=mSentSubscribersHeap.begin();
-    ie=mSentSubscribersHeap.end();
-    for (;i!=ie;++i) {
-        delete i->mSubscriber;
+    for (std::vector<Subscriber*>::iterator i=mReadySubscribers.begin(),ie=mReadySubscribers.end();i!=ie;++i) {
+        delete *i;
+    }
+    for (std::vector<Subscriber*>::iterator i=mMulticastSubscribers.begin(),ie=mMulticastSubscribers.end();i!=ie;++i) {
+        delete *i;
     }
     delete mBroadcaster;
 }
 
 SubscriptionState::Subscriber::Subscriber(const std::tr1::shared_ptr<Network::Stream>&sender,const Protocol::Subscribe&msg):mSender(sender),mPeriod(msg.has_update_period()?msg.update_period():Duration::microseconds(0)) {
     mSentEpoch=ReservedEpoch;
+    mSentVersion=0;
+    mNamed=msg.broadcast_names_size()>0;
+    //a shared stream can only tell its broadcasts apart inside DeltaUpdates
+    mDelta=mNamed||(msg.has_delta_updates()&&msg.delta_updates());
+    mMulticast=msg.has_multicast()&&msg.multicast();
+    if (mMulticast) {
+        //groups carry many broadcasts' datagrams, and any that fall back to the stream must read the same
+        mDelta=true;
+        mNamed=true;
+    }
+    mHasBaseline=false;
 }
-void SubscriptionState::Subscriber::broadcast(const MemoryReference&data){
+bool SubscriptionState::Subscriber::broadcast(const Network::Stream::SharedChunk&data){
     std::tr1::shared_ptr<Network::Stream> sender=mSender.lock();
     if (sender) {
         sender->send(data,Network::ReliableOrdered);
+        return true;
     }
+    return false;
 }
 void SubscriptionState::poll(Server*parent) {
     Time now=Time::now();
-    while (!mUnsentSubscribersHeap.empty()) {
-        SubscriberTimePair* iter=&mUnsentSubscribersHeap.front();
-        if (mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
-            iter->mSubscriber->broadcast(MemoryReference(mLastSentMessage));
-            pushJustReceivedSubscriber(iter->mSubscriber);
-            std::pop_heap(mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-            mUnsentSubscribersHeap.pop_back();
-        }else {
-            assert(mName!=UUID::null());
-            parent->initiatePolling(mName,mUnsentSubscribersHeap.front().mNextUpdateTime-now);
-            break;
+    mPolling=false;
+    std::vector<Subscriber*> due;
+    while (popDueBucket(now,due)) {
+        for (std::vector<Subscriber*>::iterator i=due.begin(),ie=due.end();i!=ie;++i) {
+            if ((*i)->mSentVersion!=mVersion) {
+                --mNumBehind;
+                deliver(*i,mLastSentMessage);
+            }else if ((*i)->mSender.expired()) {
+                delete *i;
+            }else {
+                mReadySubscribers.push_back(*i);
+            }
         }
+        due.clear();
     }
-    if (mUnsentSubscribersHeap.empty()) {
-        mPolling=false;
-    }
+    schedulePoll(parent,now);
 }
 
 Time SubscriptionState::Subscriber::computeNextUpdateFromNow(){
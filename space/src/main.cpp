@@ -35,10 +35,59 @@
 #include <util/SpaceObjectReference.hpp>
 #include <util/PluginManager.hpp>
 #include <space/Space.hpp>
+#include <network/Address.hpp>
 
 namespace Sirikata {
 //InitializeOptions main_options("verbose",
+OptionValue *port;
+OptionValue *servers;
+OptionValue *serverLinks;
+OptionValue *serverIndex;
+OptionValue *worldSize;
+OptionValue *regionsX;
+OptionValue *regionsZ;
+OptionValue *balanceInterval;
+OptionValue *balanceBand;
+OptionValue *messageWeight;
+OptionValue *cpuTarget;
+OptionValue *proximityConnection;
+OptionValue *proximityOptions;
+OptionValue *capture;
+InitializeGlobalOptions main_options("",
+    port=new OptionValue("port","5943",OptionValueType<String>(),"Port object hosts connect to this server on"),
+    servers=new OptionValue("servers","",OptionValueType<String>(),"Comma separated host:port addresses object hosts connect to every server of the space on, empty for a space on this server alone"),
+    serverLinks=new OptionValue("serverlinks","",OptionValueType<String>(),"Comma separated host:port addresses every server of the space listens for the others on, in the same order as servers"),
+    serverIndex=new OptionValue("serverindex","0",OptionValueType<uint32>(),"Which of the servers this one is, counting from 0"),
+    worldSize=new OptionValue("worldsize","8192",OptionValueType<double>(),"Edge of the cube around the origin split into regions among the servers"),
+    regionsX=new OptionValue("regionsx","0",OptionValueType<uint32>(),"Regions the world is split into along x, 0 for one per server"),
+    regionsZ=new OptionValue("regionsz","1",OptionValueType<uint32>(),"Regions the world is split into along z"),
+    balanceInterval=new OptionValue("balanceinterval","0s",OptionValueType<Duration>(),"How often the servers compare loads and move regions from busy ones to idle ones, 0s to keep the regions where they start"),
+    balanceBand=new OptionValue("balanceband","0.25",OptionValueType<double>(),"Fraction over the mean load a server may reach before it hands a region on"),
+    messageWeight=new OptionValue("messageweight","0.1",OptionValueType<double>(),"Load of one location update per second, relative to that of one object"),
+    cpuTarget=new OptionValue("cputarget","0.8",OptionValueType<double>(),"Fraction of a CPU a server may use before its load is scaled up, 0 to ignore CPU use"),
+    proximityConnection=new OptionValue("proximity","",OptionValueType<String>(),"How proximity queries are answered: empty for a single proximity manager, sharded to spread them over several"),
+    proximityOptions=new OptionValue("proximityoptions","",OptionValueType<String>(),"Options for the proximity connection, such as --shards=host:port,host:port for sharded"),
+    capture=new OptionValue("capture","",OptionValueType<String>(),"File to record the traffic of connecting object hosts to, for replaying with spacereplay; empty to record nothing"),
+    NULL);
 
+std::vector<Network::Address> parseAddresses(const String&list) {
+    std::vector<Network::Address> retval;
+    String::size_type start=0;
+    while (start<list.size()) {
+        String::size_type end=list.find(',',start);
+        if (end==String::npos)
+            end=list.size();
+        String address=list.substr(start,end-start);
+        String::size_type colon=address.rfind(':');
+        if (colon!=String::npos) {
+            retval.push_back(Network::Address(address.substr(0,colon),address.substr(colon+1)));
+        }else if (!address.empty()) {
+            SILOG(space,error,"Address "<<address<<" does not contain a port");
+        }
+        start=end+1;
+    }
+    return retval;
+}
 }
 
 int main(int argc,const char**argv) {
@@ -48,7 +97,26 @@ int main(int argc,const char**argv) {
         plugins.load( DynamicLibrary::filename("prox") );
 
     OptionSet::getOptions("")->parse(argc,argv);
-    Space space(SpaceID(UUID("12345678-1111-1111-1111-DEFA01759ACE", UUID::HumanReadable())));
+    Space space(SpaceID(UUID("12345678-1111-1111-1111-DEFA01759ACE", UUID::HumanReadable())),port->as<String>(),proximityConnection->as<String>(),proximityOptions->as<String>());
+    std::vector<Network::Address> objectHostAddresses=parseAddresses(servers->as<String>());
+    if (!objectHostAddresses.empty()) {
+        double half=worldSize->as<double>()*.5;
+        uint32 regions=regionsX->as<uint32>();
+        space.joinServers(objectHostAddresses,
+                          parseAddresses(serverLinks->as<String>()),
+                          serverIndex->as<uint32>(),
+                          BoundingBox3d3f(Vector3d(-half,-half,-half),Vector3d(half,half,half)),
+                          regions?regions:(uint32)objectHostAddresses.size(),
+                          regionsZ->as<uint32>(),
+                          balanceInterval->as<Duration>(),
+                          balanceBand->as<double>(),
+                          messageWeight->as<double>(),
+                          cpuTarget->as<double>());
+    }
+    String captureFile=capture->as<String>();
+    if (!captureFile.empty()&&!space.captureTo(captureFile)) {
+        SILOG(space,error,"Cannot record traffic to "<<captureFile);
+    }
     space.run();
     return 0;
 }